@@ -0,0 +1,67 @@
+#include "PerViewData.glsl"
+
+#define GROUP_SIZE 16
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+layout(std430, binding = 1) writeonly buffer TileDepthBuffer
+{
+    vec2 tileDepths[];
+};
+
+uniform sampler2D depthTex0;
+uniform ivec2 clusterTiles;
+uniform vec2 depthConversion;
+
+shared uint tileMinDepth;
+shared uint tileMaxDepth;
+
+float GetViewDepth(float hwDepth)
+{
+    float nearClip = depthParameters.x;
+    float farClip = depthParameters.y;
+
+    // Orthographic depth is linear
+    if (depthParameters.z > 0.0)
+        return mix(nearClip, farClip, hwDepth);
+    else
+        return nearClip * farClip / (farClip - hwDepth * (farClip - nearClip));
+}
+
+void comp()
+{
+    ivec2 tile = ivec2(gl_WorkGroupID.xy);
+    ivec2 size = textureSize(depthTex0, 0);
+
+    // Cluster Y index increases downward, while the texture rows increase upward
+    ivec2 start = ivec2(tile.x * size.x / clusterTiles.x, size.y - (tile.y + 1) * size.y / clusterTiles.y);
+    ivec2 end = ivec2((tile.x + 1) * size.x / clusterTiles.x, size.y - tile.y * size.y / clusterTiles.y);
+
+    if (gl_LocalInvocationIndex == 0u)
+    {
+        tileMinDepth = floatBitsToUint(1.0);
+        tileMaxDepth = 0u;
+    }
+    barrier();
+
+    float minDepth = 1.0;
+    float maxDepth = 0.0;
+    for (int y = start.y + int(gl_LocalInvocationID.y); y < end.y; y += GROUP_SIZE)
+    {
+        for (int x = start.x + int(gl_LocalInvocationID.x); x < end.x; x += GROUP_SIZE)
+        {
+            // Convert to the conventional depth first, as reversed depth orders the other way
+            float depth = min(depthConversion.x + depthConversion.y * texelFetch(depthTex0, ivec2(x, y), 0).r, 1.0);
+            minDepth = min(minDepth, depth);
+            maxDepth = max(maxDepth, depth);
+        }
+    }
+
+    // Non-negative floats order the same as their bit patterns
+    atomicMin(tileMinDepth, floatBitsToUint(minDepth));
+    atomicMax(tileMaxDepth, floatBitsToUint(maxDepth));
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0u)
+        tileDepths[tile.y * clusterTiles.x + tile.x] = vec2(GetViewDepth(uintBitsToFloat(tileMinDepth)), GetViewDepth(uintBitsToFloat(tileMaxDepth)));
+}
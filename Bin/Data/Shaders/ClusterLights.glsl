@@ -0,0 +1,135 @@
+#include "PerViewData.glsl"
+#include "LightData.glsl"
+
+#define GROUP_SIZE 64
+
+// Must match MAX_LIGHTS_CLUSTER_LIMIT in Renderer.h
+#define MAX_CLUSTER_LIGHTS 255
+
+layout(local_size_x = GROUP_SIZE) in;
+
+struct ClusterBounds
+{
+    vec4 boxMin;
+    vec4 boxMax;
+};
+
+layout(std430, binding = 0) readonly buffer ClusterBoundsBuffer
+{
+    ClusterBounds clusterBounds[];
+};
+
+#ifdef DEPTHBOUNDS
+layout(std430, binding = 1) readonly buffer TileDepthBuffer
+{
+    vec2 tileDepths[];
+};
+#endif
+
+// The element after the clusters counts the light indices allocated so far
+layout(std430, binding = 2) buffer ClusterDataBuffer
+{
+    uint clusterData[];
+};
+
+layout(std430, binding = 3) writeonly buffer LightIndexBuffer
+{
+    uint lightIndices[];
+};
+
+uniform uint numLights;
+uniform uint numClusters;
+uniform uint maxLightsPerCluster;
+uniform uint maxLightIndices;
+#ifdef DEPTHBOUNDS
+uniform uint tilesPerSlice;
+uniform bool maxDepthOnly;
+#endif
+
+shared uint numClusterLights;
+shared uint clusterLightOffset;
+shared uint clusterLights[MAX_CLUSTER_LIGHTS];
+
+bool SphereIntersectsBox(vec3 center, float radius, vec3 boxMin, vec3 boxMax)
+{
+    vec3 delta = clamp(center, boxMin, boxMax) - center;
+    return dot(delta, delta) < radius * radius;
+}
+
+void comp()
+{
+    uint cluster = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    vec3 boxMin = clusterBounds[cluster].boxMin.xyz;
+    vec3 boxMax = clusterBounds[cluster].boxMax.xyz;
+
+    if (gl_LocalInvocationIndex == 0u)
+        numClusterLights = 0u;
+    barrier();
+
+#ifdef DEPTHBOUNDS
+    // Skip clusters outside the depth range of the opaque geometry in their screen tile. Transparent geometry may be in front of it
+    vec2 tileDepth = tileDepths[cluster % tilesPerSlice];
+    bool occupied = boxMin.z <= tileDepth.y && (maxDepthOnly || boxMax.z >= tileDepth.x);
+#else
+    bool occupied = true;
+#endif
+
+    if (occupied)
+    {
+        for (uint i = gl_LocalInvocationIndex; i < numLights; i += uint(GROUP_SIZE))
+        {
+            vec3 center = vec4(lights[i].position.xyz, 1.0) * viewMatrix;
+            float range = 1.0 / lights[i].attenuation.x;
+            float cutoff = lights[i].attenuation.y;
+            float radius = range;
+
+            // Use the bounding sphere of a spot light's cone
+            if (cutoff > 0.0)
+            {
+                vec3 axis = -(vec4(lights[i].direction.xyz, 0.0) * viewMatrix);
+                if (cutoff < 0.70710678)
+                {
+                    center += axis * range * cutoff;
+                    radius = range * sqrt(1.0 - cutoff * cutoff);
+                }
+                else
+                {
+                    radius = range / (2.0 * cutoff);
+                    center += axis * radius;
+                }
+            }
+
+            if (SphereIntersectsBox(center, radius, boxMin, boxMax))
+            {
+                uint slot = atomicAdd(numClusterLights, 1u);
+                if (slot < maxLightsPerCluster)
+                    clusterLights[slot] = i;
+            }
+        }
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0u)
+    {
+        uint count = min(numClusterLights, maxLightsPerCluster);
+        // Allocate an even number of indices so that each list starts at a whole texel
+        uint offset = count > 0u ? atomicAdd(clusterData[numClusters], (count + 1u) & ~1u) : 0u;
+        if (offset + count > maxLightIndices)
+            count = 0u;
+
+        numClusterLights = count;
+        clusterLightOffset = offset;
+        // Cluster data holds the light list offset in the upper 24 bits and light count in the lower 8 bits
+        clusterData[cluster] = offset << 8u | count;
+    }
+    barrier();
+
+    // Light indices are 16-bit, packed two per texel
+    uint count = numClusterLights;
+    uint offset = clusterLightOffset;
+    for (uint i = gl_LocalInvocationIndex * 2u; i < count; i += uint(GROUP_SIZE) * 2u)
+    {
+        uint second = i + 1u < count ? clusterLights[i + 1u] : 0u;
+        lightIndices[(offset + i) >> 1u] = clusterLights[i] | second << 16u;
+    }
+}
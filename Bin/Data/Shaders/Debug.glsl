@@ -0,0 +1,25 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+in vec4 color;
+out vec4 vColor;
+
+uniform mat4 viewProjMatrix;
+
+#else
+
+in vec4 vColor;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0) * viewProjMatrix;
+    vColor = color;
+}
+
+void frag()
+{
+    fragColor = vColor;
+}
@@ -0,0 +1,21 @@
+#ifndef DECALDATA
+#define DECALDATA
+
+#ifndef MAX_DECALS
+#define MAX_DECALS 256
+#endif
+
+// Must match DecalData in Batch.h
+struct Decal
+{
+    mat3x4 inverseTransform;
+    vec4 atlasRect;
+    vec4 parameters;
+};
+
+layout(std140) uniform DecalData3
+{
+    Decal decals[MAX_DECALS];
+};
+
+#endif
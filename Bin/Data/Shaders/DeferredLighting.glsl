@@ -0,0 +1,51 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+#include "Lighting.glsl"
+
+uniform sampler2D albedoTex0;
+uniform sampler2D normalTex1;
+uniform sampler2D depthTex2;
+uniform mat4 invViewProjMatrix;
+uniform vec2 depthConversion;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    vec4 albedo = texture(albedoTex0, vUv);
+    vec4 viewNormal = texture(normalTex1, vUv);
+    // Convert to the conventional depth, which may exceed 1 on the background with an infinite far plane
+    float depth = depthConversion.x + depthConversion.y * texture(depthTex2, vUv).r;
+
+    // The background and the surfaces lit in their own shaders keep their color
+    if (depth >= 1.0 || viewNormal.a > 0.5)
+    {
+        fragColor = albedo;
+        return;
+    }
+
+    vec4 projWorldPos = vec4(vec3(vUv, depth) * 2.0 - 1.0, 1.0) * invViewProjMatrix;
+    vec4 worldPos = vec4(projWorldPos.xyz / projWorldPos.w, 0.0);
+    vec4 clipPos = vec4(worldPos.xyz, 1.0) * viewProjMatrix;
+    worldPos.w = dot(depthParameters.zw, clipPos.zw);
+    vec2 screenPos = vec2(vUv.x, 1.0 - vUv.y);
+
+    // The view matrix rotation is orthonormal, so multiplying from the other side rotates the normal back to world space
+    vec3 normal = normalize((viewMatrix * (viewNormal.xyz * 2.0 - 1.0)).xyz);
+
+    fragColor = vec4(albedo.rgb * CalculateLighting(worldPos, normal, screenPos), albedo.a);
+}
@@ -0,0 +1,38 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+
+#else
+
+uniform sampler2D depthTex0;
+uniform vec2 destSize;
+uniform float reverseDepth;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+}
+
+void frag()
+{
+    // Take the nearest depth of all source texels this texel covers, so that the transparent geometry is not drawn over opaque geometry in front of it. The bilateral upsampling restores the edges
+    ivec2 srcSize = textureSize(depthTex0, 0);
+    vec2 destPos = floor(gl_FragCoord.xy);
+    vec2 scale = vec2(srcSize) / destSize;
+    ivec2 start = ivec2(floor(destPos * scale));
+    ivec2 end = min(ivec2(ceil((destPos + 1.0) * scale)), srcSize);
+
+    float depth = reverseDepth > 0.5 ? 0.0 : 1.0;
+    for (int y = start.y; y < end.y; ++y)
+    {
+        for (int x = start.x; x < end.x; ++x)
+        {
+            float sampleDepth = texelFetch(depthTex0, ivec2(x, y), 0).r;
+            depth = reverseDepth > 0.5 ? max(depth, sampleDepth) : min(depth, sampleDepth);
+        }
+    }
+
+    gl_FragDepth = depth;
+}
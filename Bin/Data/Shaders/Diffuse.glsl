@@ -1,6 +1,13 @@
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
 #ifdef COMPILEVS
 
 #include "Transform.glsl"
+#ifdef MOTION
+#include "Motion.glsl"
+#endif
 
 in vec3 position;
 in vec3 normal;
@@ -9,6 +16,7 @@ in vec2 texCoord;
 out vec4 vWorldPos;
 out vec3 vNormal;
 out vec3 vViewNormal;
+flat out vec4 vInstanceColor;
 out vec2 vTexCoord;
 noperspective out vec2 vScreenPos;
 
@@ -19,18 +27,42 @@ noperspective out vec2 vScreenPos;
 in vec4 vWorldPos;
 in vec3 vNormal;
 in vec3 vViewNormal;
+flat in vec4 vInstanceColor;
 in vec2 vTexCoord;
 noperspective in vec2 vScreenPos;
+#ifdef MOTION
+out vec4 fragColor[3];
+#include "Motion.glsl"
+#else
 out vec4 fragColor[2];
+#endif
 
+#ifdef OIT
+#include "OIT.glsl"
+#endif
+
+#ifdef BINDLESS
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+    uvec4 matTextures[1];
+};
+#define diffuseTex0 sampler2D(matTextures[0].xy)
+#else
 uniform sampler2D diffuseTex0;
-uniform vec4 matDiffColor;
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+};
+#endif
 
 #endif
 
 void vert()
 {
-#ifdef INSTANCED
+#ifdef SKINNED
+    mat3x4 worldMatrix = GetSkinMatrix();
+#elif defined(INSTANCED)
     mat3x4 worldMatrix = mat3x4(texCoord3, texCoord4, texCoord5);
 #endif
 
@@ -38,11 +70,42 @@ void vert()
     vNormal = normalize((vec4(normal, 0.0) * worldMatrix));
     vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;    vTexCoord = texCoord;
     gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
+#ifdef CUSTOMGEOM
+    // Material instance parameters
+    vInstanceColor = instanceData;
+#else
+    vInstanceColor = vec4(1.0);
+#endif
     vWorldPos.w = CalculateDepth(gl_Position);
     vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef MOTION
+    CalculateMotion(position, vWorldPos.xyz);
+#endif
 }
 
 void frag()
 {
-    fragColor[0] = vec4(matDiffColor.rgb * texture(diffuseTex0, vTexCoord).rgb * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
-    fragColor[1] = vec4(vViewNormal, 1.0);}
+#ifdef ATLAS
+    // Instance data holds the texture's rectangle in the atlas page instead of a color tint. Wrap the texture coordinates inside it, with the gradients of the unwrapped coordinates so that the mip level does not jump at the wrap
+    vec4 diffColor = matDiffColor;
+    vec2 atlasCoord = fract(vTexCoord) * vInstanceColor.xy + vInstanceColor.zw;
+    vec3 diffTex = textureGrad(diffuseTex0, atlasCoord, dFdx(vTexCoord) * vInstanceColor.xy, dFdy(vTexCoord) * vInstanceColor.xy).rgb;
+#else
+    vec4 diffColor = matDiffColor * vInstanceColor;
+    vec3 diffTex = texture(diffuseTex0, vTexCoord).rgb;
+#endif
+
+#ifdef DEFERRED
+    // Lit later from the G-buffer. Zero normal alpha marks the pixel for deferred lighting
+    fragColor[0] = vec4(ApplyDecals(vWorldPos, vScreenPos, diffColor.rgb * diffTex), diffColor.a);
+    fragColor[1] = vec4(vViewNormal, 0.0);
+#elif defined(OIT)
+    WriteOIT(vec4(diffColor.rgb * diffTex * CalculateLighting(vWorldPos, vNormal, vScreenPos), diffColor.a), vWorldPos.w);
+#else
+    fragColor[0] = vec4(ApplyDecals(vWorldPos, vScreenPos, diffColor.rgb * diffTex) * CalculateLighting(vWorldPos, vNormal, vScreenPos), diffColor.a);
+    fragColor[1] = vec4(vViewNormal, 1.0);
+#endif
+#ifdef MOTION
+    fragColor[2] = CalculateMotion();
+#endif
+}
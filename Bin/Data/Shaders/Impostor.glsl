@@ -0,0 +1,125 @@
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+#ifdef MOTION
+#include "Motion.glsl"
+#endif
+
+// The vertices are at the center of the model's bounds, with the corner offsets in object space units as texture coordinates
+in vec3 position;
+in vec2 texCoord;
+
+out vec4 vWorldPos;
+out vec3 vNormal;
+out vec3 vViewNormal;
+out vec2 vTexCoord;
+noperspective out vec2 vScreenPos;
+
+#else
+
+#include "Lighting.glsl"
+
+in vec4 vWorldPos;
+in vec3 vNormal;
+in vec3 vViewNormal;
+in vec2 vTexCoord;
+noperspective in vec2 vScreenPos;
+#ifdef MOTION
+out vec4 fragColor[3];
+#include "Motion.glsl"
+#else
+out vec4 fragColor[2];
+#endif
+
+#ifdef BINDLESS
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+    uvec4 matTextures[1];
+};
+#define diffuseTex0 sampler2D(matTextures[0].xy)
+#else
+uniform sampler2D diffuseTex0;
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+};
+#endif
+
+#endif
+
+#ifdef COMPILEVS
+// Must match ImpostorFrameDirection() in Renderer.cpp
+vec3 OctahedronToDirection(vec2 oct)
+{
+    vec3 dir = vec3(oct.x, 1.0 - abs(oct.x) - abs(oct.y), oct.y);
+    if (dir.y < 0.0)
+        dir.xz = (1.0 - abs(dir.zx)) * vec2(dir.x >= 0.0 ? 1.0 : -1.0, dir.z >= 0.0 ? 1.0 : -1.0);
+    return normalize(dir);
+}
+
+vec2 DirectionToOctahedron(vec3 dir)
+{
+    dir /= abs(dir.x) + abs(dir.y) + abs(dir.z);
+    vec2 oct = dir.xz;
+    if (dir.y < 0.0)
+        oct = (1.0 - abs(dir.zx)) * vec2(dir.x >= 0.0 ? 1.0 : -1.0, dir.z >= 0.0 ? 1.0 : -1.0);
+    return oct;
+}
+#endif
+
+void vert()
+{
+#ifdef INSTANCED
+    mat3x4 worldMatrix = mat3x4(texCoord3, texCoord4, texCoord5);
+#endif
+
+    // Direction to the camera in object space, assuming uniform scale
+    vec3 cameraPos = -(viewMatrix[0].xyz * viewMatrix[0].w + viewMatrix[1].xyz * viewMatrix[1].w + viewMatrix[2].xyz * viewMatrix[2].w);
+    vec3 worldCenter = vec4(position, 1.0) * worldMatrix;
+    mat3 inverseRotation = mat3(worldMatrix[0].xyz, worldMatrix[1].xyz, worldMatrix[2].xyz);
+    vec3 objectDir = normalize(inverseRotation * (cameraPos - worldCenter));
+
+    // Select the nearest baked frame, and orient the quad like the frame's bake camera did
+    float frames = float(FRAMES);
+    vec2 frame = clamp(floor((DirectionToOctahedron(objectDir) * 0.5 + 0.5) * frames), 0.0, frames - 1.0);
+    vec3 forward = -OctahedronToDirection((frame + 0.5) / frames * 2.0 - 1.0);
+    vec3 upRef = abs(forward.y) > 0.99 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 up = cross(normalize(cross(forward, upRef)), forward);
+    vec3 right = cross(up, forward);
+
+    vec3 objectPos = position + right * texCoord.x + up * texCoord.y;
+    vWorldPos.xyz = vec4(objectPos, 1.0) * worldMatrix;
+    vNormal = normalize(cameraPos - worldCenter);
+    vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
+    vTexCoord = (frame + texCoord / abs(texCoord.x) * 0.5 + 0.5) / frames;
+    gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
+    vWorldPos.w = CalculateDepth(gl_Position);
+    vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef MOTION
+    CalculateMotion(objectPos, vWorldPos.xyz);
+#endif
+}
+
+void frag()
+{
+    vec4 diffuse = texture(diffuseTex0, vTexCoord);
+    if (diffuse.a < 0.5)
+        discard;
+
+#ifdef DEFERRED
+    // Lit later from the G-buffer. Zero normal alpha marks the pixel for deferred lighting
+    fragColor[0] = vec4(matDiffColor.rgb * diffuse.rgb, matDiffColor.a);
+    fragColor[1] = vec4(vViewNormal, 0.0);
+#else
+    fragColor[0] = vec4(matDiffColor.rgb * diffuse.rgb * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
+    fragColor[1] = vec4(vViewNormal, 1.0);
+#endif
+#ifdef MOTION
+    fragColor[2] = CalculateMotion();
+#endif
+}
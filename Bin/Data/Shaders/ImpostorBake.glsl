@@ -0,0 +1,45 @@
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+
+in vec3 position;
+#ifdef DIFFUSEMAP
+in vec2 texCoord;
+#endif
+
+#ifdef DIFFUSEMAP
+out vec2 vTexCoord;
+#endif
+
+#else
+
+#ifdef DIFFUSEMAP
+in vec2 vTexCoord;
+uniform sampler2D diffuseTex0;
+#endif
+out vec4 fragColor;
+
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+};
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(vec4(position, 1.0) * worldMatrix, 1.0) * viewProjMatrix;
+#ifdef DIFFUSEMAP
+    vTexCoord = texCoord;
+#endif
+}
+
+void frag()
+{
+    // Unlit albedo, with alpha marking the covered pixels
+#ifdef DIFFUSEMAP
+    fragColor = vec4(matDiffColor.rgb * texture(diffuseTex0, vTexCoord).rgb, 1.0);
+#else
+    fragColor = vec4(matDiffColor.rgb, 1.0);
+#endif
+}
@@ -0,0 +1,24 @@
+#ifndef LIGHTDATA
+#define LIGHTDATA
+
+#ifndef MAX_LIGHTS
+#define MAX_LIGHTS 255
+#endif
+
+// Must match LightData in Batch.h
+struct Light
+{
+    vec4 position;
+    vec4 direction;
+    vec4 attenuation;
+    vec4 color;
+    vec4 shadowParameters;
+    mat4 shadowMatrix;
+};
+
+layout(std140) uniform LightData0
+{
+    Light lights[MAX_LIGHTS];
+};
+
+#endif
@@ -1,25 +1,28 @@
-struct Light
-{
-    vec4 position;
-    vec4 direction;
-    vec4 attenuation;
-    vec4 color;
-    vec4 shadowParameters;
-    mat4 shadowMatrix;
-};
-
-layout(std140) uniform LightData0
-{
-    Light lights[255];
-};
+#include "PerViewData.glsl"
+#include "LightData.glsl"
+#include "DecalData.glsl"
 
-uniform vec4 dirLightData[12];
+// Must match LIGHT_INDEX_TEXTURE_WIDTH in Renderer.h
+#define LIGHT_INDEX_TEXTURE_WIDTH 1024
+
+#ifdef EVSM
+// Must match EVSM_EXPONENT in ShadowFilter.glsl
+#define EVSM_EXPONENT 40.0
+// Lit fraction below which a pixel is fully shadowed, to reduce light bleeding
+#define EVSM_BLEED_REDUCTION 0.2
+#define ShadowSampler sampler2D
+#else
+#define ShadowSampler sampler2DShadow
+#endif
 
-uniform sampler2DShadow dirShadowTex8;
-uniform sampler2DShadow shadowTex9;
+uniform ShadowSampler dirShadowTex8;
+uniform ShadowSampler shadowTex9;
 uniform samplerCube faceSelectionTex10;
 uniform samplerCube faceSelectionTex11;
 uniform usampler3D clusterTex12;
+uniform usampler2D lightIndexTex13;
+uniform sampler3D irradianceTex14;
+uniform sampler2D decalTex15;
 
 vec3 CalculateClusterPos(vec2 screenPos, float depth)
 {
@@ -30,9 +33,21 @@ vec3 CalculateClusterPos(vec2 screenPos, float depth)
     );
 }
 
-float SampleShadowMap(sampler2DShadow shadowTex, vec4 shadowPos, vec4 parameters)
+float SampleShadowMap(ShadowSampler shadowTex, vec4 shadowPos, vec4 parameters)
 {
-#ifdef HQSHADOW
+#if defined(EVSM)
+    // The moments are prefiltered, so one bilinear fetch replaces the comparison taps. Chebyshev's inequality gives the upper bound of the lit fraction
+    vec3 pos = shadowPos.xyz / shadowPos.w;
+    vec2 moments = textureLod(shadowTex, pos.xy, 0.0).xy;
+    float warped = exp(EVSM_EXPONENT * (pos.z * 2.0 - 1.0));
+    if (warped <= moments.x)
+        return 1.0;
+
+    float minVariance = EVSM_EXPONENT * warped * 0.0001;
+    float variance = max(moments.y - moments.x * moments.x, minVariance * minVariance);
+    float d = warped - moments.x;
+    return clamp((variance / (variance + d * d) - EVSM_BLEED_REDUCTION) / (1.0 - EVSM_BLEED_REDUCTION), 0.0, 1.0);
+#elif defined(HQSHADOW)
     vec4 offsets1 = vec4(2.0 * parameters.xy * shadowPos.w, 0.0, 0.0);
     vec4 offsets2 = vec4(2.0 * parameters.x * shadowPos.w, -2.0 * parameters.y * shadowPos.w, 0.0, 0.0);
     vec4 offsets3 = vec4(2.0 * parameters.x * shadowPos.w, 0.0, 0.0, 0.0);
@@ -62,6 +77,24 @@ float SampleShadowMap(sampler2DShadow shadowTex, vec4 shadowPos, vec4 parameters
 #endif
 }
 
+float CalculateDirShadow(vec4 worldPos)
+{
+    vec4 shadowSplits = dirLightData[2];
+    vec4 shadowParameters = dirLightData[3];
+    vec4 shadowFadeParameters = dirLightData[4];
+
+    if (shadowParameters.z >= 1.0 || worldPos.w >= shadowFadeParameters.z)
+        return 1.0;
+
+    // Cascade index is the number of split ends passed. Unused cascades repeat the last split and are never passed
+    int cascade = int(dot(vec4(greaterThan(vec4(worldPos.w), shadowSplits)), vec4(1.0)));
+    int matIndex = 5 + cascade * 4;
+
+    mat4 shadowMatrix = mat4(dirLightData[matIndex], dirLightData[matIndex+1], dirLightData[matIndex+2], dirLightData[matIndex+3]);
+    float shadowFade = shadowParameters.z + clamp((worldPos.w - shadowFadeParameters.x) * shadowFadeParameters.y, 0.0, 1.0);
+    return clamp(shadowFade + SampleShadowMap(dirShadowTex8, vec4(worldPos.xyz, 1.0) * shadowMatrix, shadowParameters), 0.0, 1.0);
+}
+
 void CalculateDirLight(vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
 {
     vec4 lightDirection = dirLightData[0];
@@ -71,19 +104,7 @@ void CalculateDirLight(vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
     if (NdotL <= 0.0)
         return;
 
-    vec4 shadowSplits = dirLightData[2];
-    vec4 shadowParameters = dirLightData[3];
-
-    if (shadowParameters.z < 1.0 && worldPos.w < shadowSplits.y)
-    {
-        int matIndex = worldPos.w > shadowSplits.x ? 8 : 4;
-
-        mat4 shadowMatrix = mat4(dirLightData[matIndex], dirLightData[matIndex+1], dirLightData[matIndex+2], dirLightData[matIndex+3]);
-        float shadowFade = shadowParameters.z + clamp((worldPos.w - shadowSplits.z) * shadowSplits.w, 0.0, 1.0);
-        NdotL *= clamp(shadowFade + SampleShadowMap(dirShadowTex8, vec4(worldPos.xyz, 1.0) * shadowMatrix, shadowParameters), 0.0, 1.0);
-    }
-
-    accumulatedLight += NdotL * lightColor;
+    accumulatedLight += NdotL * CalculateDirShadow(worldPos) * lightColor;
 }
 
 vec4 GetPointShadowPos(uint index, vec3 lightVec)
@@ -102,20 +123,15 @@ vec4 GetPointShadowPos(uint index, vec3 lightVec)
     return vec4(coords * pointParameters.xy + pointParameters.zw, q + r / depth, 1.0);
 }
 
-void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
+// Return the distance, spotlight and shadow attenuation of a point or spot light, given the vector and the normalized direction toward it
+float CalculateLightAtten(uint index, vec4 worldPos, vec3 lightVec, vec3 lightDir)
 {
-    vec3 lightPosition = lights[index].position.xyz;
     vec4 lightAttenuation = lights[index].attenuation;
-    vec3 lightColor = lights[index].color.rgb;
-
-    vec3 lightVec = lightPosition - worldPos.xyz;
     vec3 scaledLightVec = lightVec * lightAttenuation.x;
-    vec3 lightDir = normalize(lightVec);
     float atten = 1.0 - dot(scaledLightVec, scaledLightVec);
-    float NdotL = dot(normal, lightDir);
 
-    if (atten <= 0.0 || NdotL <= 0.0)
-        return;
+    if (atten <= 0.0)
+        return 0.0;
 
     vec4 shadowParameters = lights[index].shadowParameters;
 
@@ -125,7 +141,7 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulat
         float spotEffect = dot(lightDir, lightSpotDirection);
         float spotAtten = (spotEffect - lightAttenuation.y) * lightAttenuation.z;
         if (spotAtten <= 0.0)
-            return;
+            return 0.0;
 
         atten *= spotAtten;
 
@@ -135,37 +151,109 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulat
     else if (shadowParameters.z < 1.0)
         atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, GetPointShadowPos(index, lightVec), shadowParameters), 0.0, 1.0);
 
-    accumulatedLight += atten * NdotL * lightColor;
+    return atten;
 }
 
-vec3 CalculateLighting(vec4 worldPos, vec3 normal, vec2 screenPos)
+void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
 {
-    vec3 accumulatedLight = vec3(0.1, 0.1, 0.1);
+    vec3 lightVec = lights[index].position.xyz - worldPos.xyz;
+    vec3 lightDir = normalize(lightVec);
+    float NdotL = dot(normal, lightDir);
 
-    CalculateDirLight(worldPos, normal, accumulatedLight);
+    if (NdotL <= 0.0)
+        return;
 
-    uvec4 lightClusterData = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w));
+    accumulatedLight += CalculateLightAtten(index, worldPos, lightVec, lightDir) * NdotL * lights[index].color.rgb;
+}
 
-    while (lightClusterData.x > 0U)
-    {
-        CalculateLight((lightClusterData.x & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.x >>= 8U;
-    }
-    while (lightClusterData.y > 0U)
-    {
-        CalculateLight((lightClusterData.y & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.y >>= 8U;
-    }
-    while (lightClusterData.z > 0U)
+// Return a light index from the cluster light lists. Light indices are 16-bit, packed two per texel
+uint ClusterLightIndex(uint i)
+{
+    uint texel = i >> 1U;
+    uint lightIndices = texelFetch(lightIndexTex13, ivec2(int(texel % uint(LIGHT_INDEX_TEXTURE_WIDTH)), int(texel / uint(LIGHT_INDEX_TEXTURE_WIDTH))), 0).r;
+    return (i & 1U) != 0U ? lightIndices >> 16U : lightIndices & 0xffffU;
+}
+
+#ifdef COMPILEFS
+// Blend the decals of the pixel's cluster over the albedo, oldest first. The cluster decal lists follow the light lists in the light index texture: the offset and count of each cluster, then the 16-bit decal indices
+vec3 ApplyDecals(vec4 worldPos, vec2 screenPos, vec3 albedo)
+{
+    if (decalParameters.y <= 0.0)
+        return albedo;
+
+    ivec3 clusterSize = textureSize(clusterTex12, 0);
+    ivec3 cluster = clamp(ivec3(CalculateClusterPos(screenPos, worldPos.w) * vec3(clusterSize)), ivec3(0), clusterSize - 1);
+    uint numClusters = uint(clusterSize.x * clusterSize.y * clusterSize.z);
+    uint decalStart = uint(decalParameters.x);
+    uint headerTexel = decalStart + uint(cluster.x + (cluster.y + cluster.z * clusterSize.y) * clusterSize.x);
+    uint clusterDecalData = texelFetch(lightIndexTex13, ivec2(int(headerTexel % uint(LIGHT_INDEX_TEXTURE_WIDTH)), int(headerTexel / uint(LIGHT_INDEX_TEXTURE_WIDTH))), 0).r;
+    uint indexStart = (decalStart + numClusters) * 2U;
+    uint decalOffset = indexStart + (clusterDecalData >> 8U);
+    uint decalEnd = decalOffset + (clusterDecalData & 0xffU);
+
+    // The texture coordinate derivatives come from the world position outside the loop, as the loop is not uniform across the pixel quad
+    vec3 worldPosDx = dFdx(worldPos.xyz);
+    vec3 worldPosDy = dFdy(worldPos.xyz);
+
+    for (uint i = decalOffset; i < decalEnd; ++i)
     {
-        CalculateLight((lightClusterData.z & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.z >>= 8U;
+        uint index = ClusterLightIndex(i);
+        vec3 decalPos = vec4(worldPos.xyz, 1.0) * decals[index].inverseTransform;
+        if (any(greaterThan(abs(decalPos), vec3(0.5))))
+            continue;
+
+        vec4 atlasRect = decals[index].atlasRect;
+        vec2 uv = atlasRect.xy + vec2(decalPos.x + 0.5, 0.5 - decalPos.y) * atlasRect.zw;
+        vec2 uvDx = (vec4(worldPosDx, 0.0) * decals[index].inverseTransform).xy * vec2(1.0, -1.0) * atlasRect.zw;
+        vec2 uvDy = (vec4(worldPosDy, 0.0) * decals[index].inverseTransform).xy * vec2(1.0, -1.0) * atlasRect.zw;
+        vec4 decalColor = textureGrad(decalTex15, uv, uvDx, uvDy);
+
+        // Fade out toward the ends of the projection box
+        float alpha = decalColor.a * decals[index].parameters.x * clamp((0.5 - abs(decalPos.z)) * 10.0, 0.0, 1.0);
+        albedo = mix(albedo, decalColor.rgb, alpha);
     }
-    while (lightClusterData.w > 0U)
+
+    return albedo;
+}
+#endif
+
+vec3 CalculateAmbient(vec4 worldPos, vec3 normal)
+{
+    vec3 ambient = ambientColor.rgb;
+    float numZ = irradianceParameters[0].w;
+    if (numZ > 0.0)
     {
-        CalculateLight((lightClusterData.w & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.w >>= 8U;
+        // Sample off the surface along the normal, so that the probes behind the surface contribute less
+        vec3 volumePos = (worldPos.xyz + normal * irradianceParameters[1].w - irradianceParameters[0].xyz) * irradianceParameters[1].xyz;
+        if (all(greaterThanEqual(volumePos, vec3(0.0))) && all(lessThanEqual(volumePos, vec3(1.0))))
+        {
+            // The color channels are stacked along Z, each texel holding the constant and the normal dependent terms. Clamp inside the channel's probes to not blend into the next
+            float z = clamp(volumePos.z * numZ, 0.5, numZ - 0.5);
+            float invDepth = 1.0 / (3.0 * numZ);
+            vec4 r = textureLod(irradianceTex14, vec3(volumePos.xy, z * invDepth), 0.0);
+            vec4 g = textureLod(irradianceTex14, vec3(volumePos.xy, (z + numZ) * invDepth), 0.0);
+            vec4 b = textureLod(irradianceTex14, vec3(volumePos.xy, (z + 2.0 * numZ) * invDepth), 0.0);
+            vec4 n = vec4(1.0, normal);
+            ambient += max(vec3(dot(r, n), dot(g, n), dot(b, n)), vec3(0.0));
+        }
     }
 
+    return ambient;
+}
+
+vec3 CalculateLighting(vec4 worldPos, vec3 normal, vec2 screenPos)
+{
+    vec3 accumulatedLight = CalculateAmbient(worldPos, normal);
+
+    CalculateDirLight(worldPos, normal, accumulatedLight);
+
+    // Cluster data holds the light list offset in the upper 24 bits and light count in the lower 8 bits
+    uint lightClusterData = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w)).r;
+    uint lightOffset = lightClusterData >> 8U;
+    uint lightEnd = lightOffset + (lightClusterData & 0xffU);
+
+    for (uint i = lightOffset; i < lightEnd; ++i)
+        CalculateLight(ClusterLightIndex(i), worldPos, normal, accumulatedLight);
+
     return accumulatedLight;
 }
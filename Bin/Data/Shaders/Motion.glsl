@@ -0,0 +1,42 @@
+// Screen space motion since the previous view for temporal reprojection, written by the opaque shaders as the third color target. Include in both stages after Transform.glsl
+
+#ifdef COMPILEVS
+
+#ifdef INSTANCED
+in vec4 texCoord6;
+in vec4 texCoord7;
+in vec4 texCoord8;
+#elif !defined(SKINNED)
+uniform mat3x4 prevWorldMatrix;
+#endif
+
+out vec4 vMotionPos;
+out vec4 vPrevMotionPos;
+
+void CalculateMotion(vec3 objectPos, vec3 worldPos)
+{
+    vMotionPos = vec4(worldPos, 1.0) * motionViewProjMatrix;
+
+    // Skinned geometry has no previous bone palette, so only the camera movement is accounted for
+#if defined(SKINNED)
+    vec3 prevWorldPos = worldPos;
+#elif defined(INSTANCED)
+    vec3 prevWorldPos = vec4(objectPos, 1.0) * mat3x4(texCoord6, texCoord7, texCoord8);
+#else
+    vec3 prevWorldPos = vec4(objectPos, 1.0) * prevWorldMatrix;
+#endif
+    vPrevMotionPos = vec4(prevWorldPos, 1.0) * prevViewProjMatrix;
+}
+
+#else
+
+in vec4 vMotionPos;
+in vec4 vPrevMotionPos;
+
+vec4 CalculateMotion()
+{
+    // Motion in texture coordinates, so that the previous position of the pixel is at the current texture coordinate minus the motion
+    return vec4((vMotionPos.xy / vMotionPos.w - vPrevMotionPos.xy / vPrevMotionPos.w) * 0.5, 0.0, 1.0);
+}
+
+#endif
@@ -1,6 +1,9 @@
 #ifdef COMPILEVS
 
 #include "Transform.glsl"
+#ifdef MOTION
+#include "Motion.glsl"
+#endif
 
 in vec3 position;
 in vec3 normal;
@@ -8,6 +11,7 @@ in vec3 normal;
 out vec4 vWorldPos;
 out vec3 vNormal;
 out vec3 vViewNormal;
+flat out vec4 vInstanceColor;
 noperspective out vec2 vScreenPos;
 
 #else
@@ -17,15 +21,30 @@ noperspective out vec2 vScreenPos;
 in vec4 vWorldPos;
 in vec3 vNormal;
 in vec3 vViewNormal;
+flat in vec4 vInstanceColor;
 noperspective in vec2 vScreenPos;
+#ifdef MOTION
+out vec4 fragColor[3];
+#include "Motion.glsl"
+#else
 out vec4 fragColor[2];
+#endif
 
-uniform vec4 matDiffColor;
+#ifdef OIT
+#include "OIT.glsl"
+#endif
+
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+};
 #endif
 
 void vert()
 {
-#ifdef INSTANCED
+#ifdef SKINNED
+    mat3x4 worldMatrix = GetSkinMatrix();
+#elif defined(INSTANCED)
     mat3x4 worldMatrix = mat3x4(texCoord3, texCoord4, texCoord5);
 #endif
 
@@ -33,12 +52,34 @@ void vert()
     vNormal = normalize((vec4(normal, 0.0) * worldMatrix));
     vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
     gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
+#ifdef CUSTOMGEOM
+    // Material instance parameters
+    vInstanceColor = instanceData;
+#else
+    vInstanceColor = vec4(1.0);
+#endif
     vWorldPos.w = CalculateDepth(gl_Position);
     vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef MOTION
+    CalculateMotion(position, vWorldPos.xyz);
+#endif
 }
 
 void frag()
 {
-    fragColor[0] = vec4(matDiffColor.rgb * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
+    vec4 diffColor = matDiffColor * vInstanceColor;
+
+#ifdef DEFERRED
+    // Lit later from the G-buffer. Zero normal alpha marks the pixel for deferred lighting
+    fragColor[0] = vec4(ApplyDecals(vWorldPos, vScreenPos, diffColor.rgb), diffColor.a);
+    fragColor[1] = vec4(vViewNormal, 0.0);
+#elif defined(OIT)
+    WriteOIT(vec4(diffColor.rgb * CalculateLighting(vWorldPos, vNormal, vScreenPos), diffColor.a), vWorldPos.w);
+#else
+    fragColor[0] = vec4(ApplyDecals(vWorldPos, vScreenPos, diffColor.rgb) * CalculateLighting(vWorldPos, vNormal, vScreenPos), diffColor.a);
     fragColor[1] = vec4(vViewNormal, 1.0);
+#endif
+#ifdef MOTION
+    fragColor[2] = CalculateMotion();
+#endif
 }
@@ -0,0 +1,15 @@
+#ifndef OITOUTPUT
+#define OITOUTPUT
+
+#include "PerViewData.glsl"
+
+// Weighted blended order-independent transparency. The first target accumulates weighted premultiplied color and alpha additively, the second multiplies the revealage by one minus alpha. Must match the blend state of Renderer::RenderAlpha
+void WriteOIT(vec4 color, float linearDepth)
+{
+    float viewZ = linearDepth * depthParameters.y;
+    float weight = color.a * clamp(0.03 / (1e-5 + pow(viewZ / 200.0, 4.0)), 1e-2, 3e3);
+    fragColor[0] = vec4(color.rgb * color.a, color.a) * weight;
+    fragColor[1] = vec4(color.a);
+}
+
+#endif
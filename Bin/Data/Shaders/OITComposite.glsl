@@ -0,0 +1,85 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler2D accumTex0;
+uniform sampler2D revealageTex1;
+
+#ifdef BILATERAL
+uniform sampler2D depthTex2;
+uniform sampler2D lowDepthTex3;
+// Linear depth from hardware depth: (x + y * depth) / (z + w * depth)
+uniform vec4 depthLinearize;
+uniform float depthSharpness;
+#endif
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#ifdef BILATERAL
+float LinearDepth(float hwDepth)
+{
+    return (depthLinearize.x + depthLinearize.y * hwDepth) / (depthLinearize.z + depthLinearize.w * hwDepth);
+}
+
+// Upsample the low resolution accumulation and revealage from the four nearest texels, weighted by bilinear position and by depth similarity to the full resolution pixel, so that the transparent geometry does not bleed across opaque edges
+void SampleBilateral(out vec4 accum, out float revealage)
+{
+    ivec2 lowSize = textureSize(accumTex0, 0);
+    vec2 lowPos = vUv * vec2(lowSize) - 0.5;
+    ivec2 base = ivec2(floor(lowPos));
+    vec2 f = lowPos - vec2(base);
+    float depth = LinearDepth(texelFetch(depthTex2, ivec2(gl_FragCoord.xy), 0).r);
+
+    vec4 bilinear = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+    ivec2 offsets[4] = ivec2[](ivec2(0, 0), ivec2(1, 0), ivec2(0, 1), ivec2(1, 1));
+
+    accum = vec4(0.0);
+    revealage = 0.0;
+    float totalWeight = 0.0;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 texel = clamp(base + offsets[i], ivec2(0), lowSize - 1);
+        float lowDepth = LinearDepth(texelFetch(lowDepthTex3, texel, 0).r);
+        float weight = bilinear[i] / (1e-4 + depthSharpness * abs(depth - lowDepth) / max(depth, 1e-4));
+        accum += texelFetch(accumTex0, texel, 0) * weight;
+        revealage += texelFetch(revealageTex1, texel, 0).r * weight;
+        totalWeight += weight;
+    }
+
+    accum /= totalWeight;
+    revealage /= totalWeight;
+}
+#endif
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+#ifdef BILATERAL
+    vec4 accum;
+    float revealage;
+    SampleBilateral(accum, revealage);
+    if (revealage >= 1.0)
+        discard;
+#else
+    // Revealage of one means no transparent surfaces covered the pixel
+    float revealage = texture(revealageTex1, vUv).r;
+    if (revealage >= 1.0)
+        discard;
+
+    vec4 accum = texture(accumTex0, vUv);
+#endif
+
+    fragColor = vec4(accum.rgb / max(accum.a, 1e-5), 1.0 - revealage);
+}
@@ -0,0 +1,38 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+
+#else
+
+uniform sampler2D depthTex0;
+uniform vec2 destSize;
+uniform vec2 depthConversion;
+
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+}
+
+void frag()
+{
+    // Take the farthest depth of all source texels this texel covers, so that occlusion tests stay conservative. Convert first, as reversed depth orders the other way
+    ivec2 srcSize = textureSize(depthTex0, 0);
+    vec2 destPos = floor(gl_FragCoord.xy);
+    vec2 scale = vec2(srcSize) / destSize;
+    ivec2 start = ivec2(floor(destPos * scale));
+    ivec2 end = min(ivec2(ceil((destPos + 1.0) * scale)), srcSize);
+
+    float depth = 0.0;
+    for (int y = start.y; y < end.y; ++y)
+    {
+        for (int x = start.x; x < end.x; ++x)
+            depth = max(depth, depthConversion.x + depthConversion.y * texelFetch(depthTex0, ivec2(x, y), 0).r);
+    }
+
+    // The occlusion test expects the conventional depth, which may exceed 1 on the background with an infinite far plane
+    fragColor = vec4(min(depth, 1.0), 0.0, 0.0, 1.0);
+}
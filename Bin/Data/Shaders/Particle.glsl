@@ -0,0 +1,99 @@
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+
+// Must match PARTICLE_TEXTURE_WIDTH in ParticleEmitter.h
+#define TEXTURE_WIDTH 256
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+
+out vec4 vColor;
+out vec2 vTexCoord;
+out float vDepth;
+
+#else
+
+in vec4 vColor;
+in vec2 vTexCoord;
+in float vDepth;
+out vec4 fragColor[2];
+
+#ifdef OIT
+#include "OIT.glsl"
+#endif
+
+#endif
+
+#ifdef BINDLESS
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+    uvec4 matTextures[2];
+};
+#define diffuseTex0 sampler2D(matTextures[0].xy)
+#define particleTex1 sampler2D(matTextures[1].xy)
+#else
+#ifdef COMPILEVS
+uniform sampler2D particleTex1;
+#elif defined(DIFFUSEMAP)
+uniform sampler2D diffuseTex0;
+#endif
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+};
+#endif
+
+void vert()
+{
+    // Each particle is a quad of four consecutive vertex indices. The particle state is in world space, so the world matrix is unused
+    int particle = gl_VertexID >> 2;
+    int corner = gl_VertexID & 3;
+    ivec2 texel = ivec2(particle % TEXTURE_WIDTH, (particle / TEXTURE_WIDTH) * 2);
+    vec4 posLife = texelFetch(particleTex1, texel, 0);
+    vec4 velInvLife = texelFetch(particleTex1, texel + ivec2(0, 1), 0);
+
+    if (posLife.w <= 0.0)
+    {
+        // Degenerate quad outside the clip volume for dead particles
+        gl_Position = vec4(0.0, 0.0, -2.0, 1.0);
+        vColor = vec4(0.0);
+        vTexCoord = vec2(0.0);
+        vDepth = 0.0;
+        return;
+    }
+
+    // Instance data holds the start and end sizes, and the life fraction after which to fade out
+    float age = clamp(1.0 - posLife.w * velInvLife.w, 0.0, 1.0);
+    float size = mix(instanceData.x, instanceData.y, age);
+    float fade = 1.0 - clamp((age - instanceData.z) / max(1.0 - instanceData.z, 0.0001), 0.0, 1.0);
+
+    vec2 offset = vec2(corner == 1 || corner == 2 ? 1.0 : -1.0, corner >= 2 ? 1.0 : -1.0);
+    vec3 right = viewMatrix[0].xyz;
+    vec3 up = viewMatrix[1].xyz;
+    vec3 worldPos = posLife.xyz + (right * offset.x + up * offset.y) * (size * 0.5);
+
+    vColor = vec4(matDiffColor.rgb, matDiffColor.a * fade);
+    vTexCoord = vec2(offset.x * 0.5 + 0.5, 0.5 - offset.y * 0.5);
+    gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
+    vDepth = CalculateDepth(gl_Position);
+}
+
+void frag()
+{
+#ifdef DIFFUSEMAP
+    vec4 color = vColor * texture(diffuseTex0, vTexCoord);
+#else
+    // Soft round particle without a texture
+    vec2 delta = vTexCoord * 2.0 - 1.0;
+    vec4 color = vec4(vColor.rgb, vColor.a * clamp(1.0 - dot(delta, delta), 0.0, 1.0));
+#endif
+
+#ifdef OIT
+    WriteOIT(color, vDepth);
+#else
+    fragColor[0] = color;
+#endif
+}
@@ -0,0 +1,85 @@
+// Must match PARTICLE_GROUP_SIZE and PARTICLE_TEXTURE_WIDTH in ParticleEmitter.h
+#define GROUP_SIZE 64
+#define TEXTURE_WIDTH 256
+
+layout(local_size_x = GROUP_SIZE) in;
+
+// Two texels per particle in consecutive rows: position and remaining life, velocity and inverse lifetime
+layout(rgba32f, binding = 0) uniform image2D particleImage;
+
+uniform mat3x4 emitterMatrix;
+uniform vec4 emitParams;
+uniform vec4 lifeParams;
+uniform vec4 directionParams;
+uniform vec4 accelerationParams;
+uniform float randomSeed;
+
+uint Hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float Random(inout uint state)
+{
+    state = Hash(state);
+    return float(state >> 8) / 16777216.0;
+}
+
+vec3 RandomDirection(vec3 axis, float cosSpread, inout uint state)
+{
+    // Uniform direction within the cone around the axis
+    float z = mix(1.0, cosSpread, Random(state));
+    float phi = Random(state) * 6.2831853;
+    float r = sqrt(max(1.0 - z * z, 0.0));
+    vec3 tangent = normalize(cross(axis, abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+    vec3 bitangent = cross(axis, tangent);
+    return tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + axis * z;
+}
+
+void comp()
+{
+    int index = int(gl_GlobalInvocationID.x);
+    int maxParticles = int(emitParams.z);
+    if (index >= maxParticles)
+        return;
+
+    ivec2 posTexel = ivec2(index % TEXTURE_WIDTH, (index / TEXTURE_WIDTH) * 2);
+    ivec2 velTexel = posTexel + ivec2(0, 1);
+    float timeStep = emitParams.w;
+
+    // Slots in the emission range of this step are respawned, in ring order
+    int emitOffset = (index - int(emitParams.x) + maxParticles) % maxParticles;
+    if (emitOffset < int(emitParams.y))
+    {
+        uint state = Hash(uint(index) ^ (uint(randomSeed) << 16));
+        float lifetime = mix(lifeParams.x, lifeParams.y, Random(state));
+        float speed = mix(lifeParams.z, lifeParams.w, Random(state));
+        vec3 direction = normalize(vec4(RandomDirection(directionParams.xyz, directionParams.w, state), 0.0) * emitterMatrix);
+        vec3 velocity = direction * speed;
+        vec3 position = vec4(0.0, 0.0, 0.0, 1.0) * emitterMatrix;
+
+        // Spread the emission over the time step so that particles emitted together do not bunch up
+        float age = Random(state) * timeStep;
+        imageStore(particleImage, posTexel, vec4(position + velocity * age, lifetime - age));
+        imageStore(particleImage, velTexel, vec4(velocity, 1.0 / lifetime));
+        return;
+    }
+
+    vec4 posLife = imageLoad(particleImage, posTexel);
+    if (posLife.w <= 0.0)
+        return;
+
+    vec4 velInvLife = imageLoad(particleImage, velTexel);
+    vec3 velocity = velInvLife.xyz;
+    posLife.xyz += velocity * timeStep;
+    posLife.w -= timeStep;
+    velocity = (velocity + accelerationParams.xyz * timeStep) * max(1.0 - accelerationParams.w * timeStep, 0.0);
+
+    imageStore(particleImage, posTexel, posLife);
+    imageStore(particleImage, velTexel, vec4(velocity, velInvLife.w));
+}
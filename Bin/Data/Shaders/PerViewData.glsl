@@ -0,0 +1,19 @@
+#ifndef PERVIEWDATA
+#define PERVIEWDATA
+
+// Must match PerViewData in Batch.h
+layout(std140) uniform PerViewData1
+{
+    mat3x4 viewMatrix;
+    mat4x4 projectionMatrix;
+    mat4x4 viewProjMatrix;
+    vec4 depthParameters;
+    vec4 dirLightData[21];
+    vec4 ambientColor;
+    vec4 irradianceParameters[2];
+    mat4x4 motionViewProjMatrix;
+    mat4x4 prevViewProjMatrix;
+    vec4 decalParameters;
+};
+
+#endif
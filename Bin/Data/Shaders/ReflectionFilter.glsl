@@ -0,0 +1,78 @@
+// Must match PROBE_FILTER_GROUP_SIZE in ReflectionProbeUpdater.h
+#define GROUP_SIZE 8
+#define NUM_SAMPLES 32
+#define M_PI 3.14159265358979323846
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+uniform samplerCube envTex0;
+layout(rgba16f, binding = 0) writeonly uniform imageCube envImage;
+
+// Source level and roughness of the destination level
+uniform vec2 filterParams;
+
+// Direction through a texel center, following the OpenGL cubemap face orientation
+vec3 FaceDirection(ivec3 texel, int size)
+{
+    vec2 uv = (vec2(texel.xy) + 0.5) / float(size) * 2.0 - 1.0;
+    switch (texel.z)
+    {
+    case 0: return vec3(1.0, -uv.y, -uv.x);
+    case 1: return vec3(-1.0, -uv.y, uv.x);
+    case 2: return vec3(uv.x, 1.0, uv.y);
+    case 3: return vec3(uv.x, -1.0, -uv.y);
+    case 4: return vec3(uv.x, -uv.y, 1.0);
+    default: return vec3(-uv.x, -uv.y, -1.0);
+    }
+}
+
+vec2 Hammersley(uint i)
+{
+    uint bits = (i << 16u) | (i >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xaaaaaaaau) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xccccccccu) >> 2u);
+    bits = ((bits & 0x0f0f0f0fu) << 4u) | ((bits & 0xf0f0f0f0u) >> 4u);
+    bits = ((bits & 0x00ff00ffu) << 8u) | ((bits & 0xff00ff00u) >> 8u);
+    return vec2(float(i) / float(NUM_SAMPLES), float(bits) * 2.3283064365386963e-10);
+}
+
+// GGX importance sampled half vector around the normal
+vec3 SampleGGX(vec2 xi, vec3 n, float roughness)
+{
+    float a = roughness * roughness;
+    float phi = 2.0 * M_PI * xi.x;
+    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangentX = normalize(cross(up, n));
+    vec3 tangentY = cross(n, tangentX);
+    return normalize(tangentX * (sinTheta * cos(phi)) + tangentY * (sinTheta * sin(phi)) + n * cosTheta);
+}
+
+void comp()
+{
+    int size = imageSize(envImage).x;
+    ivec3 texel = ivec3(gl_GlobalInvocationID.xyz);
+    if (texel.x >= size || texel.y >= size)
+        return;
+
+    // Assume the view direction equals the normal, so that the lobe only depends on the reflection direction
+    vec3 n = normalize(FaceDirection(texel, size));
+    vec3 color = vec3(0.0);
+    float totalWeight = 0.0;
+
+    for (uint i = 0u; i < uint(NUM_SAMPLES); ++i)
+    {
+        vec3 h = SampleGGX(Hammersley(i), n, filterParams.y);
+        vec3 l = 2.0 * dot(n, h) * h - n;
+        float nDotL = dot(n, l);
+        if (nDotL > 0.0)
+        {
+            color += textureLod(envTex0, l, filterParams.x).rgb * nDotL;
+            totalWeight += nDotL;
+        }
+    }
+
+    imageStore(envImage, texel, vec4(color / max(totalWeight, 0.0001), 1.0));
+}
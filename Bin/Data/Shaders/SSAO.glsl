@@ -20,7 +20,8 @@ out vec4 fragColor;
 
 float GetLinearDepth(float hwDepth)
 {
-    return depthReconstruct.y / (hwDepth - depthReconstruct.x);
+    // Clamp the background, which is infinitely far with an infinite far plane
+    return min(depthReconstruct.y / (hwDepth - depthReconstruct.x), 1.0);
 }
 
 vec3 GetPosition(float depth, vec2 uv)
@@ -0,0 +1,63 @@
+#define GROUP_SIZE 64
+#define BLUR_RADIUS 4
+#define CACHE_SIZE (GROUP_SIZE + 2 * BLUR_RADIUS)
+
+#ifdef HORIZONTAL
+layout(local_size_x = GROUP_SIZE, local_size_y = 1) in;
+#else
+layout(local_size_x = 1, local_size_y = GROUP_SIZE) in;
+#endif
+
+uniform sampler2D ssaoTex0;
+uniform sampler2D depthTex1;
+layout(r8, binding = 0) writeonly uniform image2D aoImage;
+
+uniform float depthSharpness;
+
+shared float cachedAo[CACHE_SIZE];
+shared float cachedDepths[CACHE_SIZE];
+
+const float blurWeights[BLUR_RADIUS + 1] = float[](0.2270, 0.1945, 0.1216, 0.0540, 0.0162);
+
+void comp()
+{
+#ifdef HORIZONTAL
+    ivec2 axis = ivec2(1, 0);
+    int localIndex = int(gl_LocalInvocationID.x);
+#else
+    ivec2 axis = ivec2(0, 1);
+    int localIndex = int(gl_LocalInvocationID.y);
+#endif
+
+    ivec2 size = textureSize(ssaoTex0, 0);
+    ivec2 rowStart = ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy) - axis * BLUR_RADIUS;
+
+    // Cache the row or column of the group with the blur radius on both sides
+    for (int i = localIndex; i < CACHE_SIZE; i += GROUP_SIZE)
+    {
+        ivec2 texel = clamp(rowStart + axis * i, ivec2(0), size - 1);
+        cachedAo[i] = texelFetch(ssaoTex0, texel, 0).r;
+        cachedDepths[i] = texelFetch(depthTex1, texel, 0).r;
+    }
+    barrier();
+
+    ivec2 dest = ivec2(gl_GlobalInvocationID.xy);
+    if (dest.x >= size.x || dest.y >= size.y)
+        return;
+
+    int center = localIndex + BLUR_RADIUS;
+    float centerDepth = cachedDepths[center];
+    float ao = 0.0;
+    float totalWeight = 0.0;
+
+    // Weight the samples by distance, rejecting those across depth discontinuities
+    for (int i = -BLUR_RADIUS; i <= BLUR_RADIUS; ++i)
+    {
+        float depthWeight = max(1.0 - abs(cachedDepths[center + i] - centerDepth) * depthSharpness / centerDepth, 0.0);
+        float weight = blurWeights[abs(i)] * depthWeight;
+        ao += cachedAo[center + i] * weight;
+        totalWeight += weight;
+    }
+
+    imageStore(aoImage, dest, vec4(ao / max(totalWeight, 0.0001), 0.0, 0.0, 0.0));
+}
@@ -0,0 +1,31 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler2D ssaoTex0;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    const float threshold = 1.0 / 1024.0;
+
+    // The occlusion has already been blurred at half resolution, so a bilinear fetch upsamples it
+    float occ = texture(ssaoTex0, vUv).r;
+    if (occ < threshold)
+        discard;
+
+    fragColor = vec4(occ, occ, occ, 1.0);
+}
@@ -0,0 +1,97 @@
+#define GROUP_SIZE 8
+#define TILE_BORDER 8
+#define TILE_SIZE (GROUP_SIZE + 2 * TILE_BORDER)
+#define LEVEL_BIAS 3
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+uniform sampler2D depthTex0;
+uniform sampler2D normalTex1;
+uniform sampler2D noiseTex2;
+layout(r8, binding = 0) writeonly uniform image2D aoImage;
+
+uniform vec2 screenInvSize;
+uniform vec4 frustumSize;
+uniform vec4 aoParameters;
+
+shared float tileDepths[TILE_SIZE * TILE_SIZE];
+
+ivec2 depthSize;
+ivec2 tileOrigin;
+int maxLevel;
+
+vec3 GetPosition(float depth, vec2 uv)
+{
+    return vec3((uv - 0.5) * frustumSize.xy, frustumSize.z) * depth;
+}
+
+float GetSampleDepth(vec2 uv, float pixelDistance)
+{
+    ivec2 texel = ivec2(floor(uv * vec2(depthSize)));
+    ivec2 local = texel - tileOrigin;
+    if (all(greaterThanEqual(local, ivec2(0))) && all(lessThan(local, ivec2(TILE_SIZE))))
+        return tileDepths[local.y * TILE_SIZE + local.x];
+
+    // Distant samples read a coarser level of the depth pyramid to keep the fetches within a small cache footprint
+    int level = clamp(findMSB(int(pixelDistance)) - LEVEL_BIAS, 0, maxLevel);
+    return texelFetch(depthTex0, clamp(texel >> level, ivec2(0), textureSize(depthTex0, level) - 1), level).r;
+}
+
+float DoAmbientOcclusion(vec2 uv, vec2 offs, vec3 pos, vec3 n)
+{
+    offs.x *= frustumSize.w;
+    vec2 sampleUv = uv + offs;
+    vec3 diff = GetPosition(GetSampleDepth(sampleUv, length(offs * vec2(depthSize))), sampleUv) - pos;
+    vec3 v = normalize(diff);
+    return dot(v, n) * clamp(1.0 - abs(diff.z) * aoParameters.y, 0.0, 1.0);
+}
+
+void comp()
+{
+    depthSize = textureSize(depthTex0, 0);
+    tileOrigin = ivec2(gl_WorkGroupID.xy) * GROUP_SIZE - TILE_BORDER;
+    maxLevel = textureQueryLevels(depthTex0) - 1;
+
+    // Cache the linear depths around the group for the nearby samples
+    for (uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += GROUP_SIZE * GROUP_SIZE)
+    {
+        ivec2 texel = clamp(tileOrigin + ivec2(i % TILE_SIZE, i / TILE_SIZE), ivec2(0), depthSize - 1);
+        tileDepths[i] = texelFetch(depthTex0, texel, 0).r;
+    }
+    barrier();
+
+    ivec2 dest = ivec2(gl_GlobalInvocationID.xy);
+    if (dest.x >= depthSize.x || dest.y >= depthSize.y)
+        return;
+
+    vec2 uv = (vec2(dest) + 0.5) / vec2(depthSize);
+    ivec2 local = dest - tileOrigin;
+    vec3 pos = GetPosition(tileDepths[local.y * TILE_SIZE + local.x], uv);
+    vec2 rand = texelFetch(noiseTex2, dest & 3, 0).rg * 2.0 - 1.0;
+
+    float rad = min(aoParameters.x / pos.z, aoParameters.w);
+    float ao = 0.0;
+
+    if (rad > 3.5 * screenInvSize.x)
+    {
+        vec3 normal = textureLod(normalTex1, uv, 0.0).rgb * 2.0 - 1.0;
+
+        vec2 vec[4] = vec2[](
+            vec2(1,0),
+            vec2(-1,0),
+            vec2(0,1),
+            vec2(0,-1)
+        );
+
+        for (int i = 0; i < 4; ++i)
+        {
+            vec2 coord1 = reflect(vec[i], rand) * rad;
+            vec2 coord2 = vec2(coord1.x * 0.707 - coord1.y * 0.707, coord1.x * 0.707 + coord1.y * 0.707);
+
+            ao += DoAmbientOcclusion(uv, coord1*0.5, pos, normal);
+            ao += DoAmbientOcclusion(uv, coord2, pos, normal);
+        }
+    }
+
+    imageStore(aoImage, dest, vec4(clamp(ao * aoParameters.z, 0.0, 1.0), 0.0, 0.0, 0.0));
+}
@@ -0,0 +1,44 @@
+#define GROUP_SIZE 8
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+uniform sampler2D depthTex0;
+layout(r16f, binding = 0) writeonly uniform image2D depthImage;
+
+uniform vec2 depthReconstruct;
+uniform float sourceLevel;
+
+float GetLinearDepth(float hwDepth)
+{
+    // Clamp the background, which is infinitely far with an infinite far plane
+    return min(depthReconstruct.y / (hwDepth - depthReconstruct.x), 1.0);
+}
+
+float GetSourceDepth(ivec2 texel, int level)
+{
+    float depth = texelFetch(depthTex0, texel, level).r;
+#ifndef DOWNSAMPLE
+    depth = GetLinearDepth(depth);
+#endif
+    return depth;
+}
+
+void comp()
+{
+    ivec2 dest = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 destSize = imageSize(depthImage);
+    if (dest.x >= destSize.x || dest.y >= destSize.y)
+        return;
+
+    int level = int(sourceLevel);
+    ivec2 sourceMax = textureSize(depthTex0, level) - 1;
+    ivec2 source = dest * 2;
+
+    // Keep the nearest of the 2x2 source texels so that thin occluders survive the downsampling. Linearize first, as reversed depth orders the other way
+    float depth = min(
+        min(GetSourceDepth(min(source, sourceMax), level), GetSourceDepth(min(source + ivec2(1, 0), sourceMax), level)),
+        min(GetSourceDepth(min(source + ivec2(0, 1), sourceMax), level), GetSourceDepth(min(source + ivec2(1, 1), sourceMax), level))
+    );
+
+    imageStore(depthImage, dest, vec4(depth, 0.0, 0.0, 0.0));
+}
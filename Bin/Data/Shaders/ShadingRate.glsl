@@ -0,0 +1,48 @@
+// Must match SHADING_RATE_GROUP_SIZE in Renderer.h
+#define GROUP_SIZE 8
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+uniform sampler2D colorTex0;
+layout(r8ui, binding = 0) writeonly uniform uimage2D rateImage;
+
+// Tile size in pixels and the luminance contrast below which the rate is halved
+uniform vec3 rateParams;
+
+void comp()
+{
+    ivec2 tile = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(tile, imageSize(rateImage))))
+        return;
+
+    ivec2 colorSize = textureSize(colorTex0, 0);
+    ivec2 tileSize = ivec2(rateParams.xy);
+    ivec2 start = tile * tileSize;
+    ivec2 end = min(start + tileSize, colorSize);
+
+    // Relative luminance contrast of the tile in the previous frame. Flat or dark tiles hide the coarser shading
+    float minLum = 1e10;
+    float maxLum = 0.0;
+    for (int y = start.y; y < end.y; ++y)
+    {
+        for (int x = start.x; x < end.x; ++x)
+        {
+            float lum = dot(texelFetch(colorTex0, ivec2(x, y), 0).rgb, vec3(0.299, 0.587, 0.114));
+            minLum = min(minLum, lum);
+            maxLum = max(maxLum, lum);
+        }
+    }
+
+    float contrast = (maxLum - max(minLum, 0.0)) / max(maxLum, 0.05);
+    uint rate;
+    if (contrast >= rateParams.z)
+        rate = 0u;
+    else if (contrast >= rateParams.z * 0.5)
+        rate = 1u;
+    else if (contrast >= rateParams.z * 0.25)
+        rate = 2u;
+    else
+        rate = 3u;
+
+    imageStore(rateImage, tile, uvec4(rate));
+}
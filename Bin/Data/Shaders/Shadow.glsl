@@ -4,6 +4,14 @@
 
 in vec3 position;
 
+#ifdef CUBESHADOW
+// Point light face view-projection matrices for single-pass rendering. Must match UB_CUBESHADOWDATA in Renderer.h
+layout(std140) uniform CubeShadowData4
+{
+    mat4 cubeFaceMatrices[6];
+};
+#endif
+
 #else
 
 out vec4 fragColor;
@@ -12,12 +20,21 @@ out vec4 fragColor;
 
 void vert()
 {
-#ifdef INSTANCED
+#ifdef SKINNED
+    mat3x4 worldMatrix = GetSkinMatrix();
+#elif defined(INSTANCED)
     mat3x4 worldMatrix = mat3x4(texCoord3, texCoord4, texCoord5);
 #endif
 
     vec3 worldPos = vec4(position, 1.0) * worldMatrix;
+#ifdef CUBESHADOW
+    // Each instance renders one face, selected by the face index after the world transform
+    int face = int(instanceData.x);
+    gl_Position = vec4(worldPos, 1.0) * cubeFaceMatrices[face];
+    gl_ViewportIndex = face;
+#else
     gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
+#endif
 }
 
 void frag()
@@ -0,0 +1,49 @@
+// Must match SHADOW_FILTER_GROUP_SIZE in Renderer.h
+#define GROUP_SIZE 8
+// Must match EVSM_EXPONENT in Lighting.glsl
+#define EVSM_EXPONENT 40.0
+#define FILTER_RADIUS 2
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+#ifdef DEPTH
+uniform sampler2D depthTex0;
+#else
+uniform sampler2D momentTex0;
+#endif
+layout(rg32f, binding = 0) writeonly uniform image2D momentImage;
+
+// Shadow view rectangle as left, top, right and bottom. The taps are clamped to it, so that the neighbouring views in the atlas do not bleed in
+uniform vec4 filterRect;
+
+vec2 LoadMoments(ivec2 texel)
+{
+#ifdef DEPTH
+    float warped = exp(EVSM_EXPONENT * (texelFetch(depthTex0, texel, 0).r * 2.0 - 1.0));
+    return vec2(warped, warped * warped);
+#else
+    return texelFetch(momentTex0, texel, 0).rg;
+#endif
+}
+
+void comp()
+{
+    ivec4 rect = ivec4(filterRect);
+    ivec2 dest = rect.xy + ivec2(gl_GlobalInvocationID.xy);
+    if (dest.x >= rect.z || dest.y >= rect.w)
+        return;
+
+    // Binomial weights. The depth pass converts to moments and blurs horizontally, the moment pass blurs vertically
+    const float weights[5] = float[](0.0625, 0.25, 0.375, 0.25, 0.0625);
+#ifdef DEPTH
+    ivec2 direction = ivec2(1, 0);
+#else
+    ivec2 direction = ivec2(0, 1);
+#endif
+
+    vec2 moments = vec2(0.0);
+    for (int i = -FILTER_RADIUS; i <= FILTER_RADIUS; ++i)
+        moments += weights[i + FILTER_RADIUS] * LoadMoments(clamp(dest + direction * i, rect.xy, rect.zw - 1));
+
+    imageStore(momentImage, dest, vec4(moments, 0.0, 0.0));
+}
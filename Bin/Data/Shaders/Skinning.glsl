@@ -0,0 +1,118 @@
+#define GROUP_SIZE 64
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer SourceBuffer
+{
+    uint sourceVertices[];
+};
+
+layout(std430, binding = 1) writeonly buffer DestBuffer
+{
+    uint destVertices[];
+};
+
+// World space skinning matrices of all skinned objects in the view. Must match SB_BONEPALETTE in Renderer.h
+layout(std430, binding = 4) readonly buffer BonePalette
+{
+    vec4 bonePalette[];
+};
+
+uniform uint numVertices;
+uniform uint vertexWords;
+uniform uint destStart;
+uniform uint paletteOffset;
+// Word offsets of position, normal, tangent and blend weights, or -1 if missing
+uniform ivec4 elementOffsets;
+// Word offset of blend indices, and whether normal and tangent are packed to 10 bits per component
+uniform ivec3 elementFlags;
+uniform mat3x4 inverseWorldMatrix;
+
+vec3 ReadVector3(uint base)
+{
+    return vec3(uintBitsToFloat(sourceVertices[base]), uintBitsToFloat(sourceVertices[base + 1u]), uintBitsToFloat(sourceVertices[base + 2u]));
+}
+
+void WriteVector3(uint base, vec3 value)
+{
+    destVertices[base] = floatBitsToUint(value.x);
+    destVertices[base + 1u] = floatBitsToUint(value.y);
+    destVertices[base + 2u] = floatBitsToUint(value.z);
+}
+
+vec3 UnpackSnorm10(uint value)
+{
+    ivec3 components = (ivec3(value) << ivec3(22, 12, 2)) >> 22;
+    return max(vec3(components) / 511.0, -1.0);
+}
+
+uint PackSnorm10(vec3 value, uint original)
+{
+    uvec3 components = uvec3(ivec3(round(clamp(value, -1.0, 1.0) * 511.0))) & 0x3ffu;
+    return components.x | (components.y << 10) | (components.z << 20) | (original & 0xc0000000u);
+}
+
+void comp()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= numVertices)
+        return;
+
+    uint src = index * vertexWords;
+    uint dest = (destStart + index) * vertexWords;
+
+    // Copy everything through first, then overwrite the skinned elements
+    for (uint i = 0u; i < vertexWords; ++i)
+        destVertices[dest + i] = sourceVertices[src + i];
+
+    uint packedIndices = sourceVertices[src + uint(elementFlags.x)];
+    ivec4 idx = (ivec4((uvec4(packedIndices) >> uvec4(0, 8, 16, 24)) & 0xffu) + int(paletteOffset)) * 3;
+    vec4 blendWeights = vec4(ReadVector3(src + uint(elementOffsets.w)), uintBitsToFloat(sourceVertices[src + uint(elementOffsets.w) + 3u]));
+
+    // Skin to world space with the palette, then back to model space so that the result is drawn with the object's world transform
+    mat3x4 skinMatrix =
+        mat3x4(bonePalette[idx.x], bonePalette[idx.x + 1], bonePalette[idx.x + 2]) * blendWeights.x +
+        mat3x4(bonePalette[idx.y], bonePalette[idx.y + 1], bonePalette[idx.y + 2]) * blendWeights.y +
+        mat3x4(bonePalette[idx.z], bonePalette[idx.z + 1], bonePalette[idx.z + 2]) * blendWeights.z +
+        mat3x4(bonePalette[idx.w], bonePalette[idx.w + 1], bonePalette[idx.w + 2]) * blendWeights.w;
+
+    if (elementOffsets.x >= 0)
+    {
+        uint offset = uint(elementOffsets.x);
+        vec3 worldPos = vec4(ReadVector3(src + offset), 1.0) * skinMatrix;
+        WriteVector3(dest + offset, vec4(worldPos, 1.0) * inverseWorldMatrix);
+    }
+
+    if (elementOffsets.y >= 0)
+    {
+        uint offset = uint(elementOffsets.y);
+        if (elementFlags.y != 0)
+        {
+            uint original = sourceVertices[src + offset];
+            vec3 normal = normalize(vec4(vec4(UnpackSnorm10(original), 0.0) * skinMatrix, 0.0) * inverseWorldMatrix);
+            destVertices[dest + offset] = PackSnorm10(normal, original);
+        }
+        else
+        {
+            vec3 normal = normalize(vec4(vec4(ReadVector3(src + offset), 0.0) * skinMatrix, 0.0) * inverseWorldMatrix);
+            WriteVector3(dest + offset, normal);
+        }
+    }
+
+    // The tangent's w holds the binormal sign, which is kept
+    if (elementOffsets.z >= 0)
+    {
+        uint offset = uint(elementOffsets.z);
+        if (elementFlags.z != 0)
+        {
+            uint original = sourceVertices[src + offset];
+            vec3 tangent = normalize(vec4(vec4(UnpackSnorm10(original), 0.0) * skinMatrix, 0.0) * inverseWorldMatrix);
+            destVertices[dest + offset] = PackSnorm10(tangent, original);
+        }
+        else
+        {
+            vec3 tangent = normalize(vec4(vec4(ReadVector3(src + offset), 0.0) * skinMatrix, 0.0) * inverseWorldMatrix);
+            WriteVector3(dest + offset, tangent);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#define GROUP_SIZE 64
+
+struct Instance
+{
+    vec4 boxMin;
+    vec4 boxMax;
+    vec4 worldMatrix[3];
+};
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    uint baseVertex;
+    uint baseInstance;
+};
+
+layout(local_size_x = GROUP_SIZE) in;
+
+layout(std430, binding = 0) readonly buffer InstanceBuffer
+{
+    Instance instances[];
+};
+
+layout(std430, binding = 1) buffer CommandBuffer
+{
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 2) writeonly buffer TransformBuffer
+{
+    vec4 transforms[];
+};
+
+uniform vec4 frustumPlanes[6];
+uniform uint numInstances;
+uniform uint viewMask;
+
+void comp()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= numInstances)
+        return;
+
+    Instance instance = instances[index];
+    if ((floatBitsToUint(instance.boxMax.w) & viewMask) == 0u)
+        return;
+
+    vec3 center = (instance.boxMin.xyz + instance.boxMax.xyz) * 0.5;
+    vec3 edge = (instance.boxMax.xyz - instance.boxMin.xyz) * 0.5;
+
+    for (int i = 0; i < 6; ++i)
+    {
+        vec4 plane = frustumPlanes[i];
+        if (dot(plane.xyz, center) + plane.w < -dot(abs(plane.xyz), edge))
+            return;
+    }
+
+    uint command = floatBitsToUint(instance.boxMin.w);
+    uint slot = (commands[command].baseInstance + atomicAdd(commands[command].instanceCount, 1u)) * 3u;
+    transforms[slot] = instance.worldMatrix[0];
+    transforms[slot + 1u] = instance.worldMatrix[1];
+    transforms[slot + 2u] = instance.worldMatrix[2];
+}
@@ -0,0 +1,48 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler2D colorTex0;
+uniform sampler2D historyTex1;
+uniform sampler2D motionTex2;
+uniform vec2 screenInvSize;
+uniform float historyWeight;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    vec3 color = texture(colorTex0, vUv).rgb;
+
+    // Clamp the history to the color range of the current neighborhood, to reject disoccluded and changed content
+    vec3 minColor = color;
+    vec3 maxColor = color;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            vec3 neighbor = texture(colorTex0, vUv + vec2(x, y) * screenInvSize).rgb;
+            minColor = min(minColor, neighbor);
+            maxColor = max(maxColor, neighbor);
+        }
+    }
+
+    vec2 prevUv = vUv - texture(motionTex2, vUv).xy;
+    vec3 history = clamp(texture(historyTex1, prevUv).rgb, minColor, maxColor);
+    // History from outside the previous view is not available
+    float weight = all(equal(prevUv, clamp(prevUv, 0.0, 1.0))) ? historyWeight : 0.0;
+
+    fragColor = vec4(mix(color, history, weight), 1.0);
+}
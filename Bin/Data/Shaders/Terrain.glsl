@@ -0,0 +1,159 @@
+#ifdef BINDLESS
+#extension GL_ARB_bindless_texture : require
+#endif
+#if defined(VIRTUALTEXTURE) && !defined(COMPILEVS)
+#extension GL_ARB_shader_image_load_store : enable
+#endif
+
+// Must match TERRAIN_MORPH_START in Terrain.h
+#define MORPH_START 0.75
+
+#ifndef UVREPEAT
+#define UVREPEAT 1.0
+#endif
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+#if defined(MOTION) && !defined(SHADOW)
+#include "Motion.glsl"
+#endif
+
+in vec3 position;
+
+#ifndef SHADOW
+out vec4 vWorldPos;
+out vec3 vNormal;
+out vec3 vViewNormal;
+out vec2 vTexCoord;
+noperspective out vec2 vScreenPos;
+#endif
+
+#else
+
+#ifdef SHADOW
+out vec4 fragColor;
+#else
+#include "Lighting.glsl"
+#ifdef VIRTUALTEXTURE
+#include "VirtualTexture.glsl"
+#endif
+
+in vec4 vWorldPos;
+in vec3 vNormal;
+in vec3 vViewNormal;
+in vec2 vTexCoord;
+noperspective in vec2 vScreenPos;
+#ifdef MOTION
+out vec4 fragColor[3];
+#include "Motion.glsl"
+#else
+out vec4 fragColor[2];
+#endif
+#endif
+
+#endif
+
+#ifdef BINDLESS
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+    uvec4 matTextures[3];
+};
+#define diffuseTex0 sampler2D(matTextures[0].xy)
+#define heightMapTex1 sampler2D(matTextures[1].xy)
+#define vtPageTableTex2 sampler2D(matTextures[2].xy)
+#else
+#ifdef COMPILEVS
+uniform sampler2D heightMapTex1;
+#elif defined(VIRTUALTEXTURE)
+uniform sampler2D diffuseTex0;
+uniform sampler2D vtPageTableTex2;
+#elif defined(DIFFUSEMAP)
+uniform sampler2D diffuseTex0;
+#endif
+layout(std140) uniform MaterialData2
+{
+    vec4 matDiffColor;
+};
+#endif
+
+#ifdef COMPILEVS
+float SampleHeight(vec2 texel, vec2 invSize)
+{
+    return textureLod(heightMapTex1, (texel + 0.5) * invSize, 0.0).r;
+}
+#endif
+
+void vert()
+{
+#ifdef INSTANCED
+    mat3x4 worldMatrix = mat3x4(texCoord3, texCoord4, texCoord5);
+#endif
+
+    // Instance data holds the heightmap texel offset of the patch, the texel step of its grid and its world space LOD range. The positions are in grid units
+    vec2 invSize = 1.0 / vec2(textureSize(heightMapTex1, 0));
+    vec2 gridPos = position.xz;
+    vec2 texel = instanceData.xy + gridPos * instanceData.z;
+    vec3 worldPos = vec4(gridPos.x, SampleHeight(texel, invSize), gridPos.y, 1.0) * worldMatrix;
+
+    // Move the odd vertices onto their even neighbours toward the end of the range, so that the grid matches the next coarser level at the transition
+    float morph = clamp((length(vec4(worldPos, 1.0) * viewMatrix) / instanceData.w - MORPH_START) / (1.0 - MORPH_START), 0.0, 1.0);
+    gridPos -= fract(gridPos * 0.5) * 2.0 * morph;
+    texel = instanceData.xy + gridPos * instanceData.z;
+    vec3 objectPos = vec3(gridPos.x, SampleHeight(texel, invSize), gridPos.y);
+    worldPos = vec4(objectPos, 1.0) * worldMatrix;
+    gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
+
+#ifndef SHADOW
+    vec2 texelStep = vec2(instanceData.z, 0.0);
+    float left = SampleHeight(texel - texelStep.xy, invSize);
+    float right = SampleHeight(texel + texelStep.xy, invSize);
+    float back = SampleHeight(texel - texelStep.yx, invSize);
+    float front = SampleHeight(texel + texelStep.yx, invSize);
+    vec3 tangent = vec4(2.0, right - left, 0.0, 0.0) * worldMatrix;
+    vec3 bitangent = vec4(0.0, front - back, 2.0, 0.0) * worldMatrix;
+
+    vWorldPos.xyz = worldPos;
+    vNormal = normalize(cross(bitangent, tangent));
+    vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
+#ifdef VIRTUALTEXTURE
+    // The virtual texture spans the terrain exactly once
+    vTexCoord = texel / (vec2(textureSize(heightMapTex1, 0)) - 1.0);
+#else
+    vTexCoord = texel * invSize * UVREPEAT;
+#endif
+    vWorldPos.w = CalculateDepth(gl_Position);
+    vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef MOTION
+    CalculateMotion(objectPos, worldPos);
+#endif
+#endif
+}
+
+void frag()
+{
+#ifdef SHADOW
+    fragColor = vec4(1.0, 1.0, 1.0, 1.0);
+#else
+#ifdef VIRTUALTEXTURE
+    vec3 diffColor = matDiffColor.rgb * SampleVirtualTexture(diffuseTex0, vtPageTableTex2, vTexCoord).rgb;
+#elif defined(DIFFUSEMAP)
+    vec3 diffColor = matDiffColor.rgb * texture(diffuseTex0, vTexCoord).rgb;
+#else
+    vec3 diffColor = matDiffColor.rgb;
+#endif
+    diffColor = ApplyDecals(vWorldPos, vScreenPos, diffColor);
+#ifdef DEFERRED
+    // Lit later from the G-buffer. Zero normal alpha marks the pixel for deferred lighting
+    fragColor[0] = vec4(diffColor, matDiffColor.a);
+    fragColor[1] = vec4(vViewNormal, 0.0);
+#else
+    fragColor[0] = vec4(diffColor * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
+    fragColor[1] = vec4(vViewNormal, 1.0);
+#endif
+#ifdef MOTION
+    fragColor[2] = CalculateMotion();
+#endif
+#endif
+}
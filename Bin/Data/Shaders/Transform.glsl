@@ -1,16 +1,55 @@
-uniform mat3x4 viewMatrix;
-uniform mat4x4 projectionMatrix;
-uniform mat4x4 viewProjMatrix;
-uniform vec4 depthParameters;
+#ifdef SKINNED
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+#ifdef CUBESHADOW
+#extension GL_ARB_viewport_array : enable
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_viewport_index : enable
+#endif
+
+#include "PerViewData.glsl"
+
+// Transform identically in the depth pre-pass and the main pass, which tests for equal depth
+invariant gl_Position;
 
 #ifdef INSTANCED
 in vec4 texCoord3;
 in vec4 texCoord4;
 in vec4 texCoord5;
-#else
+#elif !defined(SKINNED)
 uniform mat3x4 worldMatrix;
 #endif
 
+#if defined(SKINNED) || defined(CUSTOMGEOM) || defined(CUBESHADOW)
+#if defined(INSTANCED) || defined(CUBESHADOW)
+in vec4 instanceData;
+#else
+uniform vec4 instanceData;
+#endif
+#endif
+
+#ifdef SKINNED
+in vec4 blendWeights;
+in vec4 blendIndices;
+
+// World space skinning matrices of all skinned objects in the view. Must match SB_BONEPALETTE in Renderer.h
+layout(std430) buffer BonePalette4
+{
+    vec4 bonePalette[];
+};
+
+mat3x4 GetSkinMatrix()
+{
+    // The palette offset of the object is in instanceData.x, in matrices
+    ivec4 idx = (ivec4(blendIndices) + int(instanceData.x)) * 3;
+    return
+        mat3x4(bonePalette[idx.x], bonePalette[idx.x + 1], bonePalette[idx.x + 2]) * blendWeights.x +
+        mat3x4(bonePalette[idx.y], bonePalette[idx.y + 1], bonePalette[idx.y + 2]) * blendWeights.y +
+        mat3x4(bonePalette[idx.z], bonePalette[idx.z + 1], bonePalette[idx.z + 2]) * blendWeights.z +
+        mat3x4(bonePalette[idx.w], bonePalette[idx.w + 1], bonePalette[idx.w + 2]) * blendWeights.w;
+}
+#endif
+
 float CalculateDepth(vec4 outPos)
 {
     return dot(depthParameters.zw, outPos.zw);
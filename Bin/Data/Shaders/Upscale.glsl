@@ -0,0 +1,41 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler2D upscaleTex0;
+uniform vec2 sourceInvSize;
+uniform float sharpness;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    vec3 color = texture(upscaleTex0, vUv).rgb;
+
+#ifdef SHARPEN
+    vec3 up = texture(upscaleTex0, vUv + vec2(0.0, -sourceInvSize.y)).rgb;
+    vec3 down = texture(upscaleTex0, vUv + vec2(0.0, sourceInvSize.y)).rgb;
+    vec3 left = texture(upscaleTex0, vUv + vec2(-sourceInvSize.x, 0.0)).rgb;
+    vec3 right = texture(upscaleTex0, vUv + vec2(sourceInvSize.x, 0.0)).rgb;
+
+    // Limit the sharpened color to the neighborhood to avoid ringing
+    vec3 minColor = min(color, min(min(up, down), min(left, right)));
+    vec3 maxColor = max(color, max(max(up, down), max(left, right)));
+    vec3 sharpened = color + (color * 4.0 - up - down - left - right) * (sharpness * 0.25);
+    color = clamp(sharpened, minColor, maxColor);
+#endif
+
+    fragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,47 @@
+// Sampling of a virtual texture through its page table, with feedback of the needed pages. The including shader must enable GL_ARB_shader_image_load_store before any code for the feedback to be written
+
+// Must match VIRTUAL_PAGE_SIZE, VIRTUAL_PAGE_BORDER and VIRTUAL_FEEDBACK_SCALE in VirtualTexture.h
+#define VT_PAGE_SIZE 128.0
+#define VT_PAGE_BORDER 4.0
+#define VT_SLOT_SIZE (VT_PAGE_SIZE + 2.0 * VT_PAGE_BORDER)
+#define VT_FEEDBACK_SCALE 8
+
+#ifdef GL_ARB_shader_image_load_store
+// Test depth before shading, so that hidden surfaces do not request pages
+layout(early_fragment_tests) in;
+layout(rgba8) writeonly uniform image2D vtFeedbackImage7;
+
+void WriteVirtualFeedback(ivec2 page, float level)
+{
+    // One fragment of each feedback texel writes. The key matches VirtualTexture::PageKey()
+    ivec2 fragPos = ivec2(gl_FragCoord.xy);
+    if (((fragPos.x | fragPos.y) & (VT_FEEDBACK_SCALE - 1)) == 0)
+    {
+        uint key = uint(page.x) | (uint(page.y) << 12) | (uint(level + 1.0) << 24);
+        imageStore(vtFeedbackImage7, fragPos / VT_FEEDBACK_SCALE, vec4(uvec4(key, key >> 8, key >> 16, key >> 24) & 255u) / 255.0);
+    }
+}
+#endif
+
+vec4 SampleVirtualTexture(sampler2D cacheTex, sampler2D pageTableTex, vec2 uv)
+{
+    vec2 numPages = vec2(textureSize(pageTableTex, 0));
+    float maxLevel = log2(numPages.x);
+    uv = clamp(uv, 0.0, 0.99999);
+
+    vec2 texelPos = uv * numPages * VT_PAGE_SIZE;
+    vec2 dx = dFdx(texelPos);
+    vec2 dy = dFdy(texelPos);
+    float level = clamp(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + 0.5), 0.0, maxLevel);
+    ivec2 page = ivec2(uv * floor(numPages / exp2(level)));
+
+#ifdef GL_ARB_shader_image_load_store
+    WriteVirtualFeedback(page, level);
+#endif
+
+    // The entry holds the cache slot and the level of the page, or of its most detailed resident ancestor
+    vec3 entry = floor(texelFetch(pageTableTex, page, int(level)).rgb * 255.0 + 0.5);
+    vec2 pagePos = fract(uv * floor(numPages / exp2(entry.b)));
+    vec2 cacheTexel = entry.rg * VT_SLOT_SIZE + VT_PAGE_BORDER + pagePos * VT_PAGE_SIZE;
+    return textureLod(cacheTex, cacheTexel / vec2(textureSize(cacheTex, 0)), 0.0);
+}
@@ -0,0 +1,33 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler3D fogTex0;
+uniform sampler2D depthTex1;
+// Linear depth from hardware depth: (x + y * depth) / (z + w * depth)
+uniform vec4 depthLinearize;
+// Reciprocal of the far clip distance and half a slice in texture coordinates
+uniform vec2 fogDepthParams;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    float hwDepth = texture(depthTex1, vUv).r;
+    float depth = clamp((depthLinearize.x + depthLinearize.y * hwDepth) / (depthLinearize.z + depthLinearize.w * hwDepth) * fogDepthParams.x, 0.0, 1.0);
+
+    vec4 fog = texture(fogTex0, vec3(vUv.x, 1.0 - vUv.y, sqrt(depth) - fogDepthParams.y));
+    fragColor = vec4(fog.rgb, 1.0 - fog.a);
+}
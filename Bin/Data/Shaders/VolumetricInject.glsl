@@ -0,0 +1,59 @@
+#include "Lighting.glsl"
+
+// Must match FOG_INJECT_GROUP_SIZE in Renderer.h
+#define GROUP_SIZE 4
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE, local_size_z = GROUP_SIZE) in;
+
+layout(rgba16f, binding = 0) writeonly uniform image3D scatterImage;
+
+uniform vec3 cameraPosition;
+// World space rays to the far plane center, and from it to the right and top edges
+uniform vec3 frustumRayCenter;
+uniform vec3 frustumRayRight;
+uniform vec3 frustumRayUp;
+// Extinction per world unit and phase function anisotropy
+uniform vec2 fogParams;
+
+// Henyey-Greenstein phase function, scaled to 1 for isotropic scattering so that the fog takes the color of the light
+float Phase(float cosTheta)
+{
+    float g = fogParams.y;
+    float g2 = g * g;
+    return (1.0 - g2) / pow(max(1.0 + g2 - 2.0 * g * cosTheta, 1e-4), 1.5);
+}
+
+void comp()
+{
+    ivec3 froxel = ivec3(gl_GlobalInvocationID);
+    ivec3 gridSize = imageSize(scatterImage);
+    if (any(greaterThanEqual(froxel, gridSize)))
+        return;
+
+    // The froxels share the light cluster coordinates: screen position from the top left, and slices along the square root of the linear depth
+    vec3 clusterPos = (vec3(froxel) + 0.5) / vec3(gridSize);
+    float depth = clusterPos.z * clusterPos.z;
+    vec3 ray = frustumRayCenter + (clusterPos.x * 2.0 - 1.0) * frustumRayRight + (1.0 - clusterPos.y * 2.0) * frustumRayUp;
+    vec4 worldPos = vec4(cameraPosition + depth * ray, depth);
+    vec3 viewDir = normalize(ray);
+
+    vec3 scattering = ambientColor.rgb;
+
+    vec3 dirLightColor = dirLightData[1].rgb;
+    if (dot(dirLightColor, dirLightColor) > 0.0)
+        scattering += Phase(dot(dirLightData[0].xyz, viewDir)) * CalculateDirShadow(worldPos) * dirLightColor;
+
+    uint lightClusterData = textureLod(clusterTex12, clusterPos, 0.0).r;
+    uint lightOffset = lightClusterData >> 8U;
+    uint lightEnd = lightOffset + (lightClusterData & 0xffU);
+
+    for (uint i = lightOffset; i < lightEnd; ++i)
+    {
+        uint index = ClusterLightIndex(i);
+        vec3 lightVec = lights[index].position.xyz - worldPos.xyz;
+        vec3 lightDir = normalize(lightVec);
+        scattering += Phase(dot(lightDir, viewDir)) * CalculateLightAtten(index, worldPos, lightVec, lightDir) * lights[index].color.rgb;
+    }
+
+    imageStore(scatterImage, froxel, vec4(scattering * fogParams.x, fogParams.x));
+}
@@ -0,0 +1,44 @@
+// Must match FOG_INTEGRATE_GROUP_SIZE in Renderer.h
+#define GROUP_SIZE 8
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+layout(rgba16f, binding = 0) readonly uniform image3D scatterImage;
+layout(rgba16f, binding = 1) writeonly uniform image3D integratedImage;
+
+// World space rays to the far plane center, and from it to the right and top edges
+uniform vec3 frustumRayCenter;
+uniform vec3 frustumRayRight;
+uniform vec3 frustumRayUp;
+
+void comp()
+{
+    ivec3 gridSize = imageSize(scatterImage);
+    ivec2 column = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(column, gridSize.xy)))
+        return;
+
+    vec2 screenPos = (vec2(column) + 0.5) / vec2(gridSize.xy);
+    float rayLength = length(frustumRayCenter + (screenPos.x * 2.0 - 1.0) * frustumRayRight + (1.0 - screenPos.y * 2.0) * frustumRayUp);
+
+    vec3 accumulated = vec3(0.0);
+    float transmittance = 1.0;
+    float sliceStart = 0.0;
+
+    for (int z = 0; z < gridSize.z; ++z)
+    {
+        float sliceEnd = float(z + 1) / float(gridSize.z);
+        sliceEnd *= sliceEnd;
+
+        vec4 scatter = imageLoad(scatterImage, ivec3(column, z));
+        float extinction = max(scatter.a, 1e-6);
+        float sliceTransmittance = exp(-extinction * (sliceEnd - sliceStart) * rayLength);
+
+        // Integrate the in-scattering over the slice against the extinction inside it, so that thick slices do not gain energy
+        accumulated += transmittance * (scatter.rgb - scatter.rgb * sliceTransmittance) / extinction;
+        transmittance *= sliceTransmittance;
+        imageStore(integratedImage, ivec3(column, z), vec4(accumulated, transmittance));
+
+        sliceStart = sliceEnd;
+    }
+}
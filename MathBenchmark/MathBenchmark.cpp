@@ -0,0 +1,258 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Math/BoundingBox.h"
+#include "Math/Matrix3x4.h"
+#include "Math/Random.h"
+#include "Time/Timer.h"
+
+#include <cstdio>
+#include <vector>
+
+static const size_t NUM_ITEMS = 4096;
+static const size_t NUM_ROUNDS = 500;
+
+/// Scalar reference of a 3x4 matrix multiply.
+static Matrix3x4 ScalarMultiply(const Matrix3x4& lhs, const Matrix3x4& rhs)
+{
+    return Matrix3x4(
+        lhs.m00 * rhs.m00 + lhs.m01 * rhs.m10 + lhs.m02 * rhs.m20,
+        lhs.m00 * rhs.m01 + lhs.m01 * rhs.m11 + lhs.m02 * rhs.m21,
+        lhs.m00 * rhs.m02 + lhs.m01 * rhs.m12 + lhs.m02 * rhs.m22,
+        lhs.m00 * rhs.m03 + lhs.m01 * rhs.m13 + lhs.m02 * rhs.m23 + lhs.m03,
+        lhs.m10 * rhs.m00 + lhs.m11 * rhs.m10 + lhs.m12 * rhs.m20,
+        lhs.m10 * rhs.m01 + lhs.m11 * rhs.m11 + lhs.m12 * rhs.m21,
+        lhs.m10 * rhs.m02 + lhs.m11 * rhs.m12 + lhs.m12 * rhs.m22,
+        lhs.m10 * rhs.m03 + lhs.m11 * rhs.m13 + lhs.m12 * rhs.m23 + lhs.m13,
+        lhs.m20 * rhs.m00 + lhs.m21 * rhs.m10 + lhs.m22 * rhs.m20,
+        lhs.m20 * rhs.m01 + lhs.m21 * rhs.m11 + lhs.m22 * rhs.m21,
+        lhs.m20 * rhs.m02 + lhs.m21 * rhs.m12 + lhs.m22 * rhs.m22,
+        lhs.m20 * rhs.m03 + lhs.m21 * rhs.m13 + lhs.m22 * rhs.m23 + lhs.m23
+    );
+}
+
+/// Scalar reference of a 4x4 matrix multiply.
+static Matrix4 ScalarMultiply(const Matrix4& lhs, const Matrix4& rhs)
+{
+    Matrix4 ret;
+    const float* l = lhs.Data();
+    const float* r = rhs.Data();
+    float* dest = &ret.m00;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        for (size_t j = 0; j < 4; ++j)
+            dest[i * 4 + j] = l[i * 4] * r[j] + l[i * 4 + 1] * r[4 + j] + l[i * 4 + 2] * r[8 + j] + l[i * 4 + 3] * r[12 + j];
+    }
+    return ret;
+}
+
+/// Scalar reference of transforming a point.
+static Vector3 ScalarTransform(const Matrix3x4& lhs, const Vector3& rhs)
+{
+    return Vector3(
+        lhs.m00 * rhs.x + lhs.m01 * rhs.y + lhs.m02 * rhs.z + lhs.m03,
+        lhs.m10 * rhs.x + lhs.m11 * rhs.y + lhs.m12 * rhs.z + lhs.m13,
+        lhs.m20 * rhs.x + lhs.m21 * rhs.y + lhs.m22 * rhs.z + lhs.m23
+    );
+}
+
+/// Scalar reference of transforming a bounding box.
+static BoundingBox ScalarTransform(const Matrix3x4& lhs, const BoundingBox& rhs)
+{
+    Vector3 oldCenter = rhs.Center();
+    Vector3 oldEdge = rhs.max - oldCenter;
+    Vector3 newCenter = ScalarTransform(lhs, oldCenter);
+    Vector3 newEdge(
+        Abs(lhs.m00) * oldEdge.x + Abs(lhs.m01) * oldEdge.y + Abs(lhs.m02) * oldEdge.z,
+        Abs(lhs.m10) * oldEdge.x + Abs(lhs.m11) * oldEdge.y + Abs(lhs.m12) * oldEdge.z,
+        Abs(lhs.m20) * oldEdge.x + Abs(lhs.m21) * oldEdge.y + Abs(lhs.m22) * oldEdge.z
+    );
+    return BoundingBox(newCenter - newEdge, newCenter + newEdge);
+}
+
+/// Scalar reference of a quaternion multiply.
+static Quaternion ScalarMultiply(const Quaternion& lhs, const Quaternion& rhs)
+{
+    return Quaternion(
+        lhs.w * rhs.w - lhs.x * rhs.x - lhs.y * rhs.y - lhs.z * rhs.z,
+        lhs.w * rhs.x + lhs.x * rhs.w + lhs.y * rhs.z - lhs.z * rhs.y,
+        lhs.w * rhs.y + lhs.y * rhs.w + lhs.z * rhs.x - lhs.x * rhs.z,
+        lhs.w * rhs.z + lhs.z * rhs.w + lhs.x * rhs.y - lhs.y * rhs.x
+    );
+}
+
+/// Print the timings of a test and whether the results match. Return the match flag.
+static bool PrintResult(const char* name, long long scalarUSec, long long simdUSec, bool match)
+{
+    printf("%-24s scalar %8lld us  library %8lld us  speedup %5.2fx  %s\n", name, scalarUSec, simdUSec,
+        simdUSec ? (double)scalarUSec / (double)simdUSec : 0.0, match ? "ok" : "MISMATCH");
+    return match;
+}
+
+int main()
+{
+#ifdef TURSO3D_SSE
+    printf("Math library compiled with SSE\n");
+#else
+    printf("Math library compiled with scalar code\n");
+#endif
+
+    std::vector<Matrix3x4> matrices(NUM_ITEMS);
+    std::vector<Matrix4> projections(NUM_ITEMS);
+    std::vector<Quaternion> rotations(NUM_ITEMS);
+    std::vector<Vector3> points(NUM_ITEMS);
+    std::vector<BoundingBox> boxes(NUM_ITEMS);
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+    {
+        Vector3 position(Random(-100.0f, 100.0f), Random(-100.0f, 100.0f), Random(-100.0f, 100.0f));
+        Quaternion rotation(Random(360.0f), Random(360.0f), Random(360.0f));
+        matrices[i] = Matrix3x4(position, rotation, Random(0.5f, 2.0f));
+        projections[i] = matrices[i].ToMatrix4();
+        projections[i].m30 = Random(-0.1f, 0.1f);
+        rotations[i] = rotation;
+        points[i] = position;
+        boxes[i] = BoundingBox(position - Vector3::ONE, position + Vector3(Random(1.0f, 10.0f), Random(1.0f, 10.0f), Random(1.0f, 10.0f)));
+    }
+
+    std::vector<Matrix3x4> matrixResults(NUM_ITEMS);
+    std::vector<Matrix3x4> matrixReference(NUM_ITEMS);
+    std::vector<Matrix4> projectionResults(NUM_ITEMS);
+    std::vector<Matrix4> projectionReference(NUM_ITEMS);
+    std::vector<Vector3> pointResults(NUM_ITEMS);
+    std::vector<Vector3> pointReference(NUM_ITEMS);
+    std::vector<BoundingBox> boxResults(NUM_ITEMS);
+    std::vector<BoundingBox> boxReference(NUM_ITEMS);
+    std::vector<Quaternion> rotationResults(NUM_ITEMS);
+    std::vector<Quaternion> rotationReference(NUM_ITEMS);
+    HiresTimer timer;
+    long long scalarUSec, simdUSec;
+    bool match;
+    bool allMatch = true;
+
+    // Each item is combined with the next, so that the inputs vary
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            matrixReference[i] = ScalarMultiply(matrices[i], matrices[(i + round) % NUM_ITEMS]);
+    }
+    scalarUSec = timer.ElapsedUSec();
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            matrixResults[i] = matrices[i] * matrices[(i + round) % NUM_ITEMS];
+    }
+    simdUSec = timer.ElapsedUSec();
+    match = true;
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+        match &= matrixResults[i].Equals(matrixReference[i], 0.01f);
+    allMatch &= PrintResult("Matrix3x4 multiply", scalarUSec, simdUSec, match);
+
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            projectionReference[i] = ScalarMultiply(projections[i], projections[(i + round) % NUM_ITEMS]);
+    }
+    scalarUSec = timer.ElapsedUSec();
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            projectionResults[i] = projections[i] * projections[(i + round) % NUM_ITEMS];
+    }
+    simdUSec = timer.ElapsedUSec();
+    match = true;
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+        match &= projectionResults[i].Equals(projectionReference[i], 0.01f);
+    allMatch &= PrintResult("Matrix4 multiply", scalarUSec, simdUSec, match);
+
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        const Matrix3x4& transform = matrices[round];
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            pointReference[i] = ScalarTransform(transform, points[i]);
+    }
+    scalarUSec = timer.ElapsedUSec();
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        const Matrix3x4& transform = matrices[round];
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            pointResults[i] = transform * points[i];
+    }
+    simdUSec = timer.ElapsedUSec();
+    match = true;
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+        match &= pointResults[i].Equals(pointReference[i], 0.01f);
+    allMatch &= PrintResult("Transform points", scalarUSec, simdUSec, match);
+
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        const Matrix3x4& transform = matrices[round];
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            boxReference[i] = ScalarTransform(transform, boxes[i]);
+    }
+    scalarUSec = timer.ElapsedUSec();
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        const Matrix3x4& transform = matrices[round];
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            boxResults[i] = boxes[i].Transformed(transform);
+    }
+    simdUSec = timer.ElapsedUSec();
+    match = true;
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+        match &= boxResults[i].min.Equals(boxReference[i].min, 0.01f) && boxResults[i].max.Equals(boxReference[i].max, 0.01f);
+    allMatch &= PrintResult("Transform boxes", scalarUSec, simdUSec, match);
+
+    // Batch transform with one matrix per box, as in the octree update
+    std::vector<BoundingBox*> boxDest(NUM_ITEMS);
+    std::vector<const BoundingBox*> boxSource(NUM_ITEMS);
+    std::vector<const Matrix3x4*> boxTransforms(NUM_ITEMS);
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+    {
+        boxDest[i] = &boxResults[i];
+        boxSource[i] = &boxes[i];
+        boxTransforms[i] = &matrices[i];
+    }
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            boxReference[i] = ScalarTransform(matrices[i], boxes[i]);
+    }
+    scalarUSec = timer.ElapsedUSec();
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+        BoundingBox::TransformBatch(&boxDest[0], &boxSource[0], &boxTransforms[0], NUM_ITEMS);
+    simdUSec = timer.ElapsedUSec();
+    match = true;
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+        match &= boxResults[i].min.Equals(boxReference[i].min, 0.01f) && boxResults[i].max.Equals(boxReference[i].max, 0.01f);
+    allMatch &= PrintResult("Batch transform boxes", scalarUSec, simdUSec, match);
+
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            rotationReference[i] = ScalarMultiply(rotations[i], rotations[(i + round) % NUM_ITEMS]);
+    }
+    scalarUSec = timer.ElapsedUSec();
+    timer.Reset();
+    for (size_t round = 0; round < NUM_ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < NUM_ITEMS; ++i)
+            rotationResults[i] = rotations[i] * rotations[(i + round) % NUM_ITEMS];
+    }
+    simdUSec = timer.ElapsedUSec();
+    match = true;
+    for (size_t i = 0; i < NUM_ITEMS; ++i)
+        match &= rotationResults[i].Equals(rotationReference[i], 0.0001f);
+    allMatch &= PrintResult("Quaternion multiply", scalarUSec, simdUSec, match);
+
+    return allMatch ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IO/Arguments.h"
+#include "IO/Compression.h"
+#include "IO/File.h"
+#include "IO/FileSystem.h"
+#include "IO/Log.h"
+#include "IO/MemoryBuffer.h"
+#include "IO/PackageFile.h"
+#include "IO/StringHash.h"
+#include "IO/VectorBuffer.h"
+#include "Math/Matrix3x4.h"
+#include "Scene/Node.h"
+#include "Renderer/Model.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+/// Entry being written to a package, with its data.
+struct PackageToolEntry
+{
+    /// Directory entry.
+    PackageEntry entry;
+    /// Data to write, compressed or not.
+    std::vector<unsigned char> data;
+};
+
+/// Sort entries by name hash, then name, to match the package directory order.
+bool CompareToolEntries(const PackageToolEntry& lhs, const PackageToolEntry& rhs)
+{
+    if (lhs.entry.nameHash != rhs.entry.nameHash)
+        return lhs.entry.nameHash < rhs.entry.nameHash;
+    return lhs.entry.name < rhs.entry.name;
+}
+
+/// Compress data in blocks. Return false if compression does not save space.
+bool CompressEntry(const std::vector<unsigned char>& src, std::vector<unsigned char>& dest)
+{
+    std::vector<unsigned char> packedBlock(CompressBound(PACKAGE_BLOCK_SIZE));
+    dest.clear();
+
+    for (size_t offset = 0; offset < src.size(); offset += PACKAGE_BLOCK_SIZE)
+    {
+        size_t blockSize = std::min(PACKAGE_BLOCK_SIZE, src.size() - offset);
+        unsigned packedSize = (unsigned)CompressData(&packedBlock[0], &src[offset], blockSize);
+        const unsigned char* blockData = &packedBlock[0];
+
+        // Store the block as is if it does not compress
+        if (packedSize >= blockSize)
+        {
+            packedSize = (unsigned)blockSize;
+            blockData = &src[offset];
+        }
+
+        size_t start = dest.size();
+        dest.resize(start + sizeof(unsigned) + packedSize);
+        memcpy(&dest[start], &packedSize, sizeof(unsigned));
+        memcpy(&dest[start + sizeof(unsigned)], blockData, packedSize);
+    }
+
+    return dest.size() < src.size();
+}
+
+/// Convert a Urho3D format model to the native format. Return false if the data is not a convertible model.
+bool ConvertModel(const std::string& name, std::vector<unsigned char>& data)
+{
+    if (data.size() < 4 || memcmp(&data[0], "UMDL", 4))
+        return false;
+
+    MemoryBuffer source(&data[0], data.size());
+    source.SetName(name);
+    SharedPtr<Model> model(new Model());
+    VectorBuffer dest;
+    if (!model->BeginLoad(source) || !model->Save(dest))
+        return false;
+
+    data.assign(dest.Data(), dest.Data() + dest.Size());
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+
+    bool compress = false;
+    bool convertModels = false;
+    std::vector<std::string> paths;
+    // Skip the executable name
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        const std::string& argument = arguments[i];
+        if (argument == "-c")
+            compress = true;
+        else if (argument == "-m")
+            convertModels = true;
+        else if (argument == "-q")
+        {
+            convertModels = true;
+            Model::SetVertexCompression(true);
+        }
+        else if (argument == "-o")
+        {
+            convertModels = true;
+            Model::SetMeshOptimization(true);
+        }
+        else if (argument == "-l" && i + 1 < arguments.size())
+        {
+            convertModels = true;
+            Model::SetLodGeneration((size_t)Max(ParseInt(arguments[++i]), 0));
+        }
+        else
+            paths.push_back(argument);
+    }
+
+    if (paths.size() != 2)
+    {
+        printf("Usage: PackageTool <source directory> <package file> [-c] [-m] [-q] [-o] [-l levels]\n\n"
+            "Packs all files of the source directory recursively. Entry names are relative to the source directory.\n"
+            "-c compresses entries when it saves space.\n"
+            "-m converts Urho3D format models to the native model format.\n"
+            "-q converts models like -m and quantizes their normals, tangents and texture coordinates.\n"
+            "-o converts models like -m and reorders their triangles and vertices for the vertex cache and fetch.\n"
+            "-l converts models like -m and generates up to the given number of LOD levels for geometries that have only one.\n");
+        return 1;
+    }
+
+    AutoPtr<Log> log = new Log();
+
+    std::string sourceDir = AddTrailingSlash(NormalizePath(paths[0]));
+    std::vector<std::string> fileNames;
+    ScanDir(fileNames, sourceDir, "*.*", SCAN_FILES, true);
+
+    std::vector<PackageToolEntry> entries;
+    for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
+    {
+        File file(sourceDir + *it);
+        if (!file.IsOpen())
+        {
+            LOGERROR("Could not open " + sourceDir + *it);
+            return 1;
+        }
+
+        entries.push_back(PackageToolEntry());
+        PackageToolEntry& toolEntry = entries.back();
+        toolEntry.entry.name = NormalizePath(*it);
+        toolEntry.entry.nameHash = StringHash(toolEntry.entry.name).Value();
+        toolEntry.entry.offset = 0;
+        toolEntry.entry.packedSize = 0;
+        toolEntry.data.resize(file.Size());
+        if (file.Size())
+            file.Read(&toolEntry.data[0], file.Size());
+        if (convertModels && Extension(*it, true) == ".mdl" && ConvertModel(toolEntry.entry.name, toolEntry.data))
+            LOGINFO("Converted model " + toolEntry.entry.name);
+        toolEntry.entry.size = (unsigned)toolEntry.data.size();
+
+        std::vector<unsigned char> packedData;
+        if (compress && toolEntry.data.size() && CompressEntry(toolEntry.data, packedData))
+        {
+            toolEntry.entry.packedSize = (unsigned)packedData.size();
+            toolEntry.data.swap(packedData);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), CompareToolEntries);
+
+    // The directory size does not depend on the offsets, so write it once to measure
+    VectorBuffer directory;
+    directory.WriteFileID("TPAK");
+    directory.Write((unsigned)entries.size());
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        directory.Write(it->entry.nameHash);
+        directory.Write(it->entry.offset);
+        directory.Write(it->entry.size);
+        directory.Write(it->entry.packedSize);
+        directory.Write(it->entry.name);
+    }
+
+    size_t offset = directory.Size();
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        offset = (offset + PACKAGE_ALIGNMENT - 1) & ~(PACKAGE_ALIGNMENT - 1);
+        it->entry.offset = (unsigned)offset;
+        offset += it->data.size();
+    }
+
+    File package(paths[1], FILE_WRITE);
+    if (!package.IsOpen())
+    {
+        LOGERROR("Could not open " + paths[1] + " for writing");
+        return 1;
+    }
+
+    package.WriteFileID("TPAK");
+    package.Write((unsigned)entries.size());
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        package.Write(it->entry.nameHash);
+        package.Write(it->entry.offset);
+        package.Write(it->entry.size);
+        package.Write(it->entry.packedSize);
+        package.Write(it->entry.name);
+    }
+
+    size_t totalSize = 0;
+    size_t totalPackedSize = 0;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        package.Seek(it->entry.offset);
+        if (it->data.size())
+            package.Write(&it->data[0], it->data.size());
+
+        totalSize += it->entry.size;
+        totalPackedSize += it->data.size();
+    }
+
+    LOGINFOF("Wrote %d entries to %s, %u bytes of data stored as %u bytes", (int)entries.size(), paths[1].c_str(), (unsigned)totalSize, (unsigned)totalPackedSize);
+    return 0;
+}
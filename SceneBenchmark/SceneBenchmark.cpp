@@ -0,0 +1,366 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IO/JSONValue.h"
+#include "IO/MemoryBuffer.h"
+#include "IO/VectorBuffer.h"
+#include "Math/AreaAllocator.h"
+#include "Math/Random.h"
+#include "Math/TileAllocator.h"
+#include "Renderer/Batch.h"
+#include "Renderer/Camera.h"
+#include "Renderer/Material.h"
+#include "Renderer/Model.h"
+#include "Renderer/Octree.h"
+#include "Renderer/Renderer.h"
+#include "Renderer/StaticModel.h"
+#include "Resource/ResourceCache.h"
+#include "Scene/Scene.h"
+#include "Thread/WorkQueue.h"
+#include "Time/Timer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static const size_t NUM_NODES = 100000;
+static const size_t NUM_SERIALIZED_NODES = 10000;
+static const size_t NUM_MODELS = 16;
+static const size_t NUM_MATERIALS = 16;
+static const size_t NUM_QUERIES = 16;
+static const size_t NUM_ALLOCATIONS = 4096;
+static const size_t NUM_SAMPLES = 15;
+static const size_t NUM_WARMUP_SAMPLES = 2;
+static const float SCENE_SIZE = 1000.0f;
+
+/// Scene and scratch data shared by the benchmarks. The models and materials have no graphics resources, so no graphics context is needed.
+struct BenchmarkData
+{
+    /// Scene with the octree.
+    AutoPtr<Scene> scene;
+    /// Scene for loading.
+    AutoPtr<Scene> loadScene;
+    /// Octree of the scene.
+    Octree* octree;
+    /// Mock models with bounding boxes only.
+    std::vector<SharedPtr<Model> > models;
+    /// Materials with an opaque pass.
+    std::vector<SharedPtr<Material> > materials;
+    /// Scene nodes.
+    std::vector<StaticModel*> nodes;
+    /// Query frustums.
+    std::vector<Frustum> frustums;
+    /// Query results.
+    std::vector<OctreeNode*> queryResult;
+    /// World bounding boxes of the nodes.
+    std::vector<BoundingBox> boxes;
+    /// World bounding box minimum X coordinates.
+    std::vector<float> minX;
+    /// World bounding box minimum Y coordinates.
+    std::vector<float> minY;
+    /// World bounding box minimum Z coordinates.
+    std::vector<float> minZ;
+    /// World bounding box maximum X coordinates.
+    std::vector<float> maxX;
+    /// World bounding box maximum Y coordinates.
+    std::vector<float> maxY;
+    /// World bounding box maximum Z coordinates.
+    std::vector<float> maxZ;
+    /// Frustum test results.
+    std::vector<unsigned> results;
+    /// Batches of all nodes.
+    std::vector<Batch> batches;
+    /// Batch queue to sort.
+    BatchQueue batchQueue;
+    /// Instance transform memory.
+    std::vector<Vector4> instanceData;
+    /// Instance transform buffer.
+    InstanceTransformBuffer instanceTransforms;
+    /// Serialized scene JSON.
+    std::string sceneJSON;
+    /// Serialized scene JSON as bytes for stream loading.
+    VectorBuffer sceneBuffer;
+    /// Parsed scene JSON.
+    JSONValue parsedJSON;
+    /// Allocation sizes for the atlas allocators.
+    std::vector<IntVector2> allocationSizes;
+    /// Octree frame number.
+    unsigned short frameNumber;
+    /// Sum of results, so that the work is not optimized away.
+    size_t checksum;
+};
+
+/// Benchmark function. Setup functions are not timed.
+typedef void (*BenchmarkFunction)(BenchmarkData& data);
+
+/// Create scene nodes with random positions, sizes, models and materials.
+static void CreateNodes(BenchmarkData& data, Scene* scene, size_t count, bool store)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        StaticModel* node = scene->CreateChild<StaticModel>();
+        node->SetStatic(true);
+        node->SetPosition(Vector3(Random(-SCENE_SIZE, SCENE_SIZE), Random(0.0f, 10.0f), Random(-SCENE_SIZE, SCENE_SIZE)));
+        node->SetRotation(Quaternion(0.0f, Random(360.0f), 0.0f));
+        node->SetScale(Random(0.5f, 2.0f));
+        node->SetModel(data.models[i % NUM_MODELS]);
+        node->SetMaterial(data.materials[(i / NUM_MODELS) % NUM_MATERIALS]);
+        if (store)
+            data.nodes.push_back(node);
+    }
+}
+
+static void SetupOctreeInsert(BenchmarkData& data)
+{
+    data.scene->Clear();
+    data.octree = data.scene->CreateChild<Octree>();
+    data.nodes.clear();
+    CreateNodes(data, data.scene, NUM_NODES, true);
+}
+
+static void OctreeInsert(BenchmarkData& data)
+{
+    data.octree->Update(++data.frameNumber);
+}
+
+static void SetupOctreeUpdate(BenchmarkData& data)
+{
+    // Move a tenth of the nodes
+    for (size_t i = 0; i < data.nodes.size(); i += 10)
+        data.nodes[i]->Translate(Vector3(Random(-5.0f, 5.0f), 0.0f, Random(-5.0f, 5.0f)));
+}
+
+static void OctreeUpdate(BenchmarkData& data)
+{
+    data.octree->Update(++data.frameNumber);
+}
+
+static void OctreeQuery(BenchmarkData& data)
+{
+    for (size_t i = 0; i < data.frustums.size(); ++i)
+    {
+        data.queryResult.clear();
+        data.octree->FindNodesMasked(data.queryResult, data.frustums[i], NF_GEOMETRY);
+        data.checksum += data.queryResult.size();
+    }
+}
+
+static void FrustumTest(BenchmarkData& data)
+{
+    for (size_t i = 0; i < data.frustums.size(); ++i)
+    {
+        const Frustum& frustum = data.frustums[i];
+        for (size_t j = 0; j < data.boxes.size(); ++j)
+            data.checksum += frustum.IsInsideFast(data.boxes[j]);
+    }
+}
+
+static void FrustumTestBatch(BenchmarkData& data)
+{
+    for (size_t i = 0; i < data.frustums.size(); ++i)
+    {
+        data.frustums[i].IsInsideMaskedFast(&data.minX[0], &data.minY[0], &data.minZ[0], &data.maxX[0], &data.maxY[0], &data.maxZ[0],
+            data.boxes.size(), &data.results[0]);
+        data.checksum += data.results[0];
+    }
+}
+
+static void SetupBatchSort(BenchmarkData& data)
+{
+    data.batchQueue.Clear();
+    data.batchQueue.batches = data.batches;
+    data.instanceTransforms.Reset(&data.instanceData[0], 0, data.instanceData.size());
+}
+
+static void BatchSort(BenchmarkData& data)
+{
+    data.batchQueue.Sort(data.instanceTransforms, SORT_STATE, false);
+}
+
+static void BatchSortInstanced(BenchmarkData& data)
+{
+    data.batchQueue.Sort(data.instanceTransforms, SORT_STATE, true);
+    data.checksum += data.instanceTransforms.Size();
+}
+
+static void JSONParse(BenchmarkData& data)
+{
+    data.parsedJSON.FromString(data.sceneJSON);
+}
+
+static void SceneLoad(BenchmarkData& data)
+{
+    data.loadScene->LoadJSON(data.parsedJSON);
+}
+
+static void SetupSceneStreamLoad(BenchmarkData& data)
+{
+    data.sceneBuffer.Seek(0);
+}
+
+static void SceneStreamLoad(BenchmarkData& data)
+{
+    data.loadScene->LoadJSON(data.sceneBuffer);
+}
+
+static void AreaAllocate(BenchmarkData& data)
+{
+    AreaAllocator allocator(2048, 2048);
+    int x, y;
+    for (size_t i = 0; i < data.allocationSizes.size(); ++i)
+    {
+        if (!allocator.Allocate(data.allocationSizes[i].x, data.allocationSizes[i].y, x, y))
+            allocator.Reset(2048, 2048);
+    }
+}
+
+static void TileAllocate(BenchmarkData& data)
+{
+    TileAllocator allocator(2048, 2048, SHADOW_ATLAS_TILE_SIZE);
+    int x, y;
+    for (size_t i = 0; i < data.allocationSizes.size(); ++i)
+    {
+        if (!allocator.Allocate(data.allocationSizes[i].x, data.allocationSizes[i].y, x, y))
+            allocator.Reset(2048, 2048, SHADOW_ATLAS_TILE_SIZE);
+    }
+}
+
+/// Create the models, materials, scene, query frustums and serialized scene shared by the benchmarks.
+static void SetupData(BenchmarkData& data)
+{
+    SetRandomSeed(1);
+
+    for (size_t i = 0; i < NUM_MODELS; ++i)
+    {
+        SharedPtr<Model> model(new Model());
+        model->SetNumGeometries(1);
+        Vector3 halfSize(Random(0.5f, 2.0f), Random(0.5f, 4.0f), Random(0.5f, 2.0f));
+        model->SetLocalBoundingBox(BoundingBox(-halfSize, halfSize));
+        data.models.push_back(model);
+    }
+
+    for (size_t i = 0; i < NUM_MATERIALS; ++i)
+    {
+        SharedPtr<Material> material(new Material());
+        material->CreatePass(PASS_OPAQUE);
+        data.materials.push_back(material);
+    }
+
+    data.scene = new Scene();
+    data.loadScene = new Scene();
+    data.frameNumber = 0;
+    data.checksum = 0;
+
+    SetupOctreeInsert(data);
+    OctreeInsert(data);
+
+    // Look around from above the scene center
+    Camera camera;
+    camera.SetPosition(Vector3(0.0f, 20.0f, 0.0f));
+    camera.SetFarClip(500.0f);
+    for (size_t i = 0; i < NUM_QUERIES; ++i)
+    {
+        camera.SetRotation(Quaternion(15.0f, i * 360.0f / NUM_QUERIES, 0.0f));
+        data.frustums.push_back(camera.WorldFrustum());
+    }
+
+    for (size_t i = 0; i < data.nodes.size(); ++i)
+    {
+        const BoundingBox& box = data.nodes[i]->WorldBoundingBox();
+        data.boxes.push_back(box);
+        data.minX.push_back(box.min.x);
+        data.minY.push_back(box.min.y);
+        data.minZ.push_back(box.min.z);
+        data.maxX.push_back(box.max.x);
+        data.maxY.push_back(box.max.y);
+        data.maxZ.push_back(box.max.z);
+    }
+    data.results.resize(data.boxes.size());
+
+    // Collect the batches of all nodes, as the renderer would for a view that sees the whole scene
+    for (auto it = data.nodes.begin(); it != data.nodes.end(); ++it)
+    {
+        StaticModel* node = *it;
+        Batch batch;
+        batch.pass = node->GetMaterial(0)->GetPass(PASS_OPAQUE);
+        batch.geometry = node->GetGeometry(0);
+        batch.programBits = 0;
+        batch.node = node;
+        data.batches.push_back(batch);
+    }
+    data.instanceData.resize(data.batches.size() * 3);
+
+    // Serialize a smaller scene for the parsing tests
+    Scene serializeScene;
+    serializeScene.CreateChild<Octree>();
+    CreateNodes(data, &serializeScene, NUM_SERIALIZED_NODES, false);
+    serializeScene.SaveJSON(data.sceneBuffer);
+    data.sceneJSON.assign((const char*)data.sceneBuffer.Data(), data.sceneBuffer.Size());
+    data.parsedJSON.FromString(data.sceneJSON);
+
+    for (size_t i = 0; i < NUM_ALLOCATIONS; ++i)
+    {
+        int size = 32 << Rand() % 4;
+        data.allocationSizes.push_back(IntVector2(size, size));
+    }
+}
+
+/// Time a benchmark over several samples and print the median, minimum and median absolute deviation, which are robust to outliers from the operating system. The per item time is given from the median.
+static void RunBenchmark(BenchmarkData& data, const char* name, BenchmarkFunction setup, BenchmarkFunction run, size_t numItems)
+{
+    std::vector<long long> samples;
+    HiresTimer timer;
+
+    for (size_t i = 0; i < NUM_WARMUP_SAMPLES + NUM_SAMPLES; ++i)
+    {
+        if (setup)
+            setup(data);
+
+        timer.Reset();
+        run(data);
+        long long usec = timer.ElapsedUSec();
+
+        if (i >= NUM_WARMUP_SAMPLES)
+            samples.push_back(usec);
+    }
+
+    std::sort(samples.begin(), samples.end());
+    long long median = samples[samples.size() / 2];
+
+    std::vector<long long> deviations;
+    for (auto it = samples.begin(); it != samples.end(); ++it)
+        deviations.push_back(*it > median ? *it - median : median - *it);
+    std::sort(deviations.begin(), deviations.end());
+    long long deviation = deviations[deviations.size() / 2];
+
+    printf("%-24s median %8lld us  min %8lld us  mad %6lld us  %9.2f ns/item\n", name, median, samples.front(), deviation,
+        numItems ? median * 1000.0 / numItems : 0.0);
+}
+
+int main()
+{
+    // The factories are needed for scene creation and loading. The resources are mocked, but loading still goes through the cache
+    AutoPtr<WorkQueue> workQueue = new WorkQueue();
+    AutoPtr<ResourceCache> cache = new ResourceCache();
+    RegisterRendererLibrary();
+
+    printf("Nodes %u, %u worker threads, %u samples\n", (unsigned)NUM_NODES, workQueue->NumThreads(), (unsigned)NUM_SAMPLES);
+
+    BenchmarkData data;
+    SetupData(data);
+
+    RunBenchmark(data, "Octree insert", SetupOctreeInsert, OctreeInsert, NUM_NODES);
+    RunBenchmark(data, "Octree update", SetupOctreeUpdate, OctreeUpdate, NUM_NODES / 10);
+    RunBenchmark(data, "Octree query", nullptr, OctreeQuery, NUM_QUERIES);
+    RunBenchmark(data, "Frustum test", nullptr, FrustumTest, NUM_QUERIES * data.boxes.size());
+    RunBenchmark(data, "Frustum test batch", nullptr, FrustumTestBatch, NUM_QUERIES * data.boxes.size());
+    RunBenchmark(data, "Batch sort", SetupBatchSort, BatchSort, data.batches.size());
+    RunBenchmark(data, "Batch sort instanced", SetupBatchSort, BatchSortInstanced, data.batches.size());
+    RunBenchmark(data, "JSON parse", nullptr, JSONParse, data.sceneJSON.size());
+    RunBenchmark(data, "Scene load", nullptr, SceneLoad, NUM_SERIALIZED_NODES);
+    RunBenchmark(data, "Scene stream load", SetupSceneStreamLoad, SceneStreamLoad, NUM_SERIALIZED_NODES);
+    RunBenchmark(data, "Area allocate", nullptr, AreaAllocate, NUM_ALLOCATIONS);
+    RunBenchmark(data, "Tile allocate", nullptr, TileAllocate, NUM_ALLOCATIONS);
+
+    printf("Checksum %u\n", (unsigned)data.checksum);
+    return 0;
+}
@@ -0,0 +1,214 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Object/Allocator.h"
+#include "Thread/Mutex.h"
+#include "Time/Timer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static const unsigned NUM_LOCKS = 1000000;
+static const unsigned MAX_THREADS = 8;
+static const size_t TABLE_SIZE = 1024;
+/// One in this many read-mostly operations is a write.
+static const unsigned WRITE_INTERVAL = 100;
+static const unsigned NUM_ALLOCATIONS = 1000000;
+static const unsigned ALLOCATION_ROUNDS = 10;
+
+/// Small fixed-size object, like a scene node's component or an octree query result.
+struct AllocatedObject
+{
+    float data[8];
+};
+
+/// Shared data protected by the locks. Each operation touches a few entries to simulate a short critical section like a resource lookup.
+static std::vector<unsigned> table(TABLE_SIZE);
+
+/// Run a function in several threads at once and return the elapsed time.
+template <class T> long long RunThreads(unsigned numThreads, T function)
+{
+    HiresTimer timer;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < numThreads; ++i)
+        threads.push_back(std::thread(function, i));
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        it->join();
+    return timer.ElapsedUSec();
+}
+
+/// Increment the table under an exclusive lock from each thread.
+static long long BenchmarkMutex(unsigned numThreads, unsigned spinCount)
+{
+    Mutex mutex(spinCount);
+    unsigned locksPerThread = NUM_LOCKS / numThreads;
+
+    return RunThreads(numThreads, [&mutex, locksPerThread](unsigned threadIndex)
+    {
+        for (unsigned i = 0; i < locksPerThread; ++i)
+        {
+            MutexLock lock(mutex);
+            ++table[(i + threadIndex) & (TABLE_SIZE - 1)];
+        }
+    });
+}
+
+/// Read the table under an exclusive lock, with occasional writes.
+static long long BenchmarkReadMostlyMutex(unsigned numThreads, unsigned spinCount)
+{
+    Mutex mutex(spinCount);
+    unsigned locksPerThread = NUM_LOCKS / numThreads;
+
+    return RunThreads(numThreads, [&mutex, locksPerThread](unsigned threadIndex)
+    {
+        unsigned sum = 0;
+        for (unsigned i = 0; i < locksPerThread; ++i)
+        {
+            MutexLock lock(mutex);
+            size_t index = (i * 7 + threadIndex) & (TABLE_SIZE - 1);
+            if (i % WRITE_INTERVAL == 0)
+                ++table[index];
+            else
+                sum += table[index] + table[(index + 1) & (TABLE_SIZE - 1)];
+        }
+        table[threadIndex] += sum & 1;
+    });
+}
+
+/// Read the table under a shared lock, with occasional writes under an exclusive lock.
+static long long BenchmarkReadMostlyReadWriteMutex(unsigned numThreads, unsigned spinCount)
+{
+    ReadWriteMutex mutex(spinCount);
+    unsigned locksPerThread = NUM_LOCKS / numThreads;
+
+    return RunThreads(numThreads, [&mutex, locksPerThread](unsigned threadIndex)
+    {
+        unsigned sum = 0;
+        for (unsigned i = 0; i < locksPerThread; ++i)
+        {
+            size_t index = (i * 7 + threadIndex) & (TABLE_SIZE - 1);
+            if (i % WRITE_INTERVAL == 0)
+            {
+                WriteLock lock(mutex);
+                ++table[index];
+            }
+            else
+            {
+                ReadLock lock(mutex);
+                sum += table[index] + table[(index + 1) & (TABLE_SIZE - 1)];
+            }
+        }
+        WriteLock lock(mutex);
+        table[threadIndex] += sum & 1;
+    });
+}
+
+/// Allocate objects in each thread, then free them from the neighbouring thread. The last round frees everything at once. The allocator is locked for each call.
+static long long BenchmarkLockedAllocator(unsigned numThreads)
+{
+    Allocator<AllocatedObject> allocator;
+    Mutex mutex;
+    unsigned allocationsPerThread = NUM_ALLOCATIONS / ALLOCATION_ROUNDS / numThreads;
+    std::vector<std::vector<AllocatedObject*> > objects(numThreads);
+    long long elapsed = 0;
+
+    for (unsigned round = 0; round < ALLOCATION_ROUNDS; ++round)
+    {
+        elapsed += RunThreads(numThreads, [&allocator, &mutex, &objects, allocationsPerThread](unsigned threadIndex)
+        {
+            std::vector<AllocatedObject*>& dest = objects[threadIndex];
+            for (unsigned i = 0; i < allocationsPerThread; ++i)
+            {
+                MutexLock lock(mutex);
+                dest.push_back(allocator.Allocate());
+            }
+        });
+
+        if (round + 1 < ALLOCATION_ROUNDS)
+        {
+            elapsed += RunThreads(numThreads, [&allocator, &mutex, &objects, numThreads](unsigned threadIndex)
+            {
+                std::vector<AllocatedObject*>& source = objects[(threadIndex + 1) % numThreads];
+                for (auto it = source.begin(); it != source.end(); ++it)
+                {
+                    MutexLock lock(mutex);
+                    allocator.Free(*it);
+                }
+                source.clear();
+            });
+        }
+    }
+
+    HiresTimer timer;
+    allocator.FreeAll();
+    return elapsed + timer.ElapsedUSec();
+}
+
+/// Allocate objects in each thread, then free them from the neighbouring thread. The last round frees everything at once. The allocator uses per-thread magazines.
+static long long BenchmarkThreadSafeAllocator(unsigned numThreads)
+{
+    ThreadSafeAllocator<AllocatedObject> allocator;
+    allocator.SetNumThreads(numThreads);
+    unsigned allocationsPerThread = NUM_ALLOCATIONS / ALLOCATION_ROUNDS / numThreads;
+    std::vector<std::vector<AllocatedObject*> > objects(numThreads);
+    long long elapsed = 0;
+
+    for (unsigned round = 0; round < ALLOCATION_ROUNDS; ++round)
+    {
+        elapsed += RunThreads(numThreads, [&allocator, &objects, allocationsPerThread](unsigned threadIndex)
+        {
+            std::vector<AllocatedObject*>& dest = objects[threadIndex];
+            for (unsigned i = 0; i < allocationsPerThread; ++i)
+                dest.push_back(allocator.Allocate(threadIndex));
+        });
+
+        if (round + 1 < ALLOCATION_ROUNDS)
+        {
+            elapsed += RunThreads(numThreads, [&allocator, &objects, numThreads](unsigned threadIndex)
+            {
+                std::vector<AllocatedObject*>& source = objects[(threadIndex + 1) % numThreads];
+                for (auto it = source.begin(); it != source.end(); ++it)
+                    allocator.Free(*it, threadIndex);
+                source.clear();
+            });
+        }
+    }
+
+    HiresTimer timer;
+    allocator.FreeAll();
+    return elapsed + timer.ElapsedUSec();
+}
+
+static void PrintResult(const char* name, unsigned numThreads, long long blockingUSec, long long spinningUSec)
+{
+    printf("%-28s %u threads  blocking %8lld us  spinning %8lld us  speedup %5.2fx\n", name, numThreads, blockingUSec, spinningUSec,
+        spinningUSec ? (double)blockingUSec / (double)spinningUSec : 0.0);
+}
+
+int main()
+{
+    unsigned maxThreads = std::max(std::min(std::thread::hardware_concurrency(), MAX_THREADS), 2u);
+    printf("Locks compared without a spin phase and with %u polls before blocking\n", DEFAULT_MUTEX_SPIN_COUNT);
+
+    for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        PrintResult("Mutex", numThreads, BenchmarkMutex(numThreads, 0), BenchmarkMutex(numThreads, DEFAULT_MUTEX_SPIN_COUNT));
+        PrintResult("Read-mostly Mutex", numThreads, BenchmarkReadMostlyMutex(numThreads, 0), BenchmarkReadMostlyMutex(numThreads,
+            DEFAULT_MUTEX_SPIN_COUNT));
+        PrintResult("Read-mostly ReadWriteMutex", numThreads, BenchmarkReadMostlyReadWriteMutex(numThreads, 0),
+            BenchmarkReadMostlyReadWriteMutex(numThreads, DEFAULT_MUTEX_SPIN_COUNT));
+    }
+
+    printf("\nCross-thread allocation and free compared with a locked allocator and per-thread magazines\n");
+
+    for (unsigned numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        long long lockedUSec = BenchmarkLockedAllocator(numThreads);
+        long long threadSafeUSec = BenchmarkThreadSafeAllocator(numThreads);
+        printf("%-28s %u threads  locked %8lld us  magazines %8lld us  speedup %5.2fx\n", "Allocator", numThreads, lockedUSec,
+            threadSafeUSec, threadSafeUSec ? (double)lockedUSec / (double)threadSafeUSec : 0.0);
+    }
+
+    return 0;
+}
@@ -4,11 +4,10 @@
 #include "../Time/Profiler.h"
 #include "FrameBuffer.h"
 #include "Graphics.h"
+#include "GraphicsBackend.h"
 #include "RenderBuffer.h"
 #include "Texture.h"
 
-#include <glew.h>
-
 static FrameBuffer* boundDrawBuffer = nullptr;
 static FrameBuffer* boundReadBuffer = nullptr;
 
@@ -16,7 +15,7 @@ FrameBuffer::FrameBuffer()
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
 
-    glGenFramebuffers(1, &buffer);
+    buffer = Graphics::CurrentBackend()->CreateFrameBuffer();
 }
 
 FrameBuffer::~FrameBuffer()
@@ -30,6 +29,8 @@ FrameBuffer::~FrameBuffer()
 
 void FrameBuffer::Define(RenderBuffer* colorBuffer, RenderBuffer* depthStencilBuffer)
 {
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
     Bind(true);
 
     IntVector2 size = IntVector2::ZERO;
@@ -37,13 +38,13 @@ void FrameBuffer::Define(RenderBuffer* colorBuffer, RenderBuffer* depthStencilBu
     if (colorBuffer)
     {
         size = colorBuffer->Size();
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer->GLBuffer());
+        SetDrawBuffer(true);
+        backend->AttachRenderBuffer(0, colorBuffer->GLBuffer());
     }
     else
     {
-        glDrawBuffer(GL_NONE);
-        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, 0);
+        SetDrawBuffer(false);
+        backend->AttachRenderBuffer(0, 0);
     }
 
     if (depthStencilBuffer)
@@ -53,13 +54,13 @@ void FrameBuffer::Define(RenderBuffer* colorBuffer, RenderBuffer* depthStencilBu
         else
             size = depthStencilBuffer->Size();
 
-        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthStencilBuffer->GLBuffer());
-        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencilBuffer->Format() == FMT_D24S8 ? depthStencilBuffer->GLBuffer() : 0);
+        backend->AttachRenderBuffer(DEPTH_ATTACHMENT, depthStencilBuffer->GLBuffer());
+        backend->AttachRenderBuffer(STENCIL_ATTACHMENT, depthStencilBuffer->Format() == FMT_D24S8 ? depthStencilBuffer->GLBuffer() : 0);
     }
     else
     {
-        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
-        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+        backend->AttachRenderBuffer(DEPTH_ATTACHMENT, 0);
+        backend->AttachRenderBuffer(STENCIL_ATTACHMENT, 0);
     }
 
     LOGDEBUGF("Defined framebuffer width %d height %d", size.x, size.y);
@@ -74,13 +75,13 @@ void FrameBuffer::Define(Texture* colorTexture, Texture* depthStencilTexture)
     if (colorTexture && colorTexture->TexType() == TEX_2D)
     {
         size = colorTexture->Size2D();
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture->GLTexture(), 0);
+        SetDrawBuffer(true);
+        AttachTexture(0, colorTexture);
     }
     else
     {
-        glDrawBuffer(GL_NONE);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        SetDrawBuffer(false);
+        AttachTexture(0, nullptr);
     }
 
     if (depthStencilTexture)
@@ -90,13 +91,13 @@ void FrameBuffer::Define(Texture* colorTexture, Texture* depthStencilTexture)
         else
             size = depthStencilTexture->Size2D();
 
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture->GLTexture(), 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture->Format() == FMT_D24S8 ? depthStencilTexture->GLTexture() : 0, 0);
+        AttachTexture(DEPTH_ATTACHMENT, depthStencilTexture);
+        AttachTexture(STENCIL_ATTACHMENT, depthStencilTexture->Format() == FMT_D24S8 ? depthStencilTexture : nullptr);
     }
     else
     {
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+        AttachTexture(DEPTH_ATTACHMENT, nullptr);
+        AttachTexture(STENCIL_ATTACHMENT, nullptr);
     }
 
     LOGDEBUGF("Defined framebuffer width %d height %d", size.x, size.y);
@@ -104,6 +105,8 @@ void FrameBuffer::Define(Texture* colorTexture, Texture* depthStencilTexture)
 
 void FrameBuffer::Define(Texture* colorTexture, size_t cubeMapFace, Texture* depthStencilTexture)
 {
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
     Bind(true);
 
     IntVector2 size = IntVector2::ZERO;
@@ -111,13 +114,13 @@ void FrameBuffer::Define(Texture* colorTexture, size_t cubeMapFace, Texture* dep
     if (colorTexture && colorTexture->TexType() == TEX_CUBE)
     {
         size = colorTexture->Size2D();
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)cubeMapFace, colorTexture->GLTexture(), 0);
+        SetDrawBuffer(true);
+        backend->AttachTexture(0, TEX_CUBE, 1, cubeMapFace, colorTexture->GLTexture());
     }
     else
     {
-        glDrawBuffer(GL_NONE);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        SetDrawBuffer(false);
+        AttachTexture(0, nullptr);
     }
 
     if (depthStencilTexture)
@@ -127,13 +130,13 @@ void FrameBuffer::Define(Texture* colorTexture, size_t cubeMapFace, Texture* dep
         else
             size = depthStencilTexture->Size2D();
 
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture->GLTexture(), 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture->Format() == FMT_D24S8 ? depthStencilTexture->GLTexture() : 0, 0);
+        backend->AttachTexture(DEPTH_ATTACHMENT, TEX_2D, 1, 0, depthStencilTexture->GLTexture());
+        backend->AttachTexture(STENCIL_ATTACHMENT, TEX_2D, 1, 0, depthStencilTexture->Format() == FMT_D24S8 ? depthStencilTexture->GLTexture() : 0);
     }
     else
     {
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+        AttachTexture(DEPTH_ATTACHMENT, nullptr);
+        AttachTexture(STENCIL_ATTACHMENT, nullptr);
     }
 
     LOGDEBUGF("Defined framebuffer width %d height %d from cube texture", size.x, size.y);
@@ -145,7 +148,7 @@ void FrameBuffer::Define(const std::vector<Texture*>& colorTextures, Texture* de
 
     IntVector2 size = IntVector2::ZERO;
 
-    std::vector<GLenum> drawBufferIds;
+    drawBuffers.clear();
     for (size_t i = 0; i < colorTextures.size(); ++i)
     {
         if (colorTextures[i] && colorTextures[i]->TexType() == TEX_2D)
@@ -155,17 +158,14 @@ void FrameBuffer::Define(const std::vector<Texture*>& colorTextures, Texture* de
             else
                 size = colorTextures[i]->Size2D();
 
-            drawBufferIds.push_back(GL_COLOR_ATTACHMENT0 + (GLenum)i);
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i, GL_TEXTURE_2D, colorTextures[i]->GLTexture(), 0);
+            drawBuffers.push_back(i);
+            AttachTexture(i, colorTextures[i]);
         }
         else
-            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum)i, GL_TEXTURE_2D, 0, 0);
+            AttachTexture(i, nullptr);
     }
 
-    if (drawBufferIds.size())
-        glDrawBuffers((GLsizei)drawBufferIds.size(), &drawBufferIds[0]);
-    else
-        glDrawBuffer(GL_NONE);
+    RestoreDrawBuffers();
 
     if (depthStencilTexture)
     {
@@ -174,13 +174,13 @@ void FrameBuffer::Define(const std::vector<Texture*>& colorTextures, Texture* de
         else
             size = depthStencilTexture->Size2D();
 
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture->GLTexture(), 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthStencilTexture->Format() == FMT_D24S8 ? depthStencilTexture->GLTexture() : 0, 0);
+        AttachTexture(DEPTH_ATTACHMENT, depthStencilTexture);
+        AttachTexture(STENCIL_ATTACHMENT, depthStencilTexture->Format() == FMT_D24S8 ? depthStencilTexture : nullptr);
     }
     else
     {
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+        AttachTexture(DEPTH_ATTACHMENT, nullptr);
+        AttachTexture(STENCIL_ATTACHMENT, nullptr);
     }
 
     LOGDEBUGF("Defined MRT framebuffer width %d height %d", size.x, size.y);
@@ -188,48 +188,119 @@ void FrameBuffer::Define(const std::vector<Texture*>& colorTextures, Texture* de
 
 void FrameBuffer::Bind(bool force)
 {
-    if (!buffer || (boundDrawBuffer == this && !force))
+    if (!buffer)
+        return;
+    if (boundDrawBuffer == this && !force)
+    {
+        Graphics::CountBinding(true);
         return;
+    }
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer);
+    Graphics::CurrentBackend()->BindFrameBuffer(buffer, false);
     boundDrawBuffer = this;
+    Graphics::CountBinding(false);
+}
+
+void FrameBuffer::BindRead(bool force)
+{
+    if (!buffer)
+        return;
+    if (boundReadBuffer == this && !force)
+    {
+        Graphics::CountBinding(true);
+        return;
+    }
+
+    Graphics::CurrentBackend()->BindFrameBuffer(buffer, true);
+    boundReadBuffer = this;
+    Graphics::CountBinding(false);
+}
+
+void FrameBuffer::Invalidate(unsigned colorMask, bool depthStencil)
+{
+    if (!buffer || !Texture::IsInvalidateSupported())
+        return;
+
+    if ((colorMask & ((1 << MAX_RENDERTARGETS) - 1)) || depthStencil)
+    {
+        Bind();
+        Graphics::CurrentBackend()->InvalidateFrameBuffer(colorMask, depthStencil);
+    }
 }
 
 void FrameBuffer::Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src, const IntRect& srcRect, bool blitColor, bool blitDepth, TextureFilterMode filter)
 {
-    GLenum glBlitBits = 0;
-    if (blitColor)
-        glBlitBits |= GL_COLOR_BUFFER_BIT;
-    if (blitDepth)
-        glBlitBits |= GL_DEPTH_BUFFER_BIT;
+    GraphicsBackend* backend = Graphics::CurrentBackend();
 
     if (boundReadBuffer != src)
     {
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, src ? src->buffer : 0);
+        backend->BindFrameBuffer(src ? src->buffer : 0, true);
         boundReadBuffer = src;
     }
     if (boundDrawBuffer != dest)
     {
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dest ? dest->buffer : 0);
+        backend->BindFrameBuffer(dest ? dest->buffer : 0, false);
         boundDrawBuffer = dest;
     }
-    glBlitFramebuffer(srcRect.left, srcRect.top, srcRect.right, srcRect.bottom, destRect.left, destRect.top, destRect.right, destRect.bottom, glBlitBits, filter == FILTER_POINT ? GL_NEAREST : GL_LINEAR);
+    backend->BlitFrameBuffer(srcRect, destRect, blitColor, blitDepth, filter);
+}
+
+void FrameBuffer::Resolve(FrameBuffer* dest, FrameBuffer* src, const IntRect& rect, size_t numColorAttachments, bool resolveDepth)
+{
+    if (!dest || !src)
+        return;
+
+    src->BindRead();
+    dest->Bind();
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    // A blit reads one color attachment, so resolve each separately by selecting it as the only draw buffer
+    for (size_t i = 0; i < numColorAttachments && i < MAX_RENDERTARGETS; ++i)
+    {
+        backend->SetReadBuffer(i);
+        backend->SetSingleDrawBuffer(i);
+        backend->BlitFrameBuffer(rect, rect, true, false, FILTER_POINT);
+    }
+    if (resolveDepth)
+        backend->BlitFrameBuffer(rect, rect, false, true, FILTER_POINT);
+
+    backend->SetReadBuffer(0);
+    dest->RestoreDrawBuffers();
 }
 
 void FrameBuffer::Unbind()
 {
     if (boundDrawBuffer)
     {
-        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        Graphics::CurrentBackend()->BindFrameBuffer(0, false);
         boundDrawBuffer = nullptr;
     }
+    UnbindRead();
+}
+
+void FrameBuffer::UnbindRead()
+{
     if (boundReadBuffer)
     {
-        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        Graphics::CurrentBackend()->BindFrameBuffer(0, true);
         boundReadBuffer = nullptr;
     }
 }
 
+void FrameBuffer::SetDrawBuffer(bool enable)
+{
+    drawBuffers.clear();
+    if (enable)
+        drawBuffers.push_back(0);
+    RestoreDrawBuffers();
+}
+
+void FrameBuffer::RestoreDrawBuffers()
+{
+    Graphics::CurrentBackend()->SetDrawBuffers(drawBuffers);
+}
+
 void FrameBuffer::Release()
 {
     if (buffer)
@@ -237,7 +308,15 @@ void FrameBuffer::Release()
         if (boundDrawBuffer == this || boundReadBuffer == this)
             FrameBuffer::Unbind();
 
-        glDeleteFramebuffers(1, &buffer);
+        Graphics::CurrentBackend()->DestroyFrameBuffer(buffer);
         buffer = 0;
     }
 }
+
+void FrameBuffer::AttachTexture(size_t attachment, Texture* texture)
+{
+    if (texture)
+        Graphics::CurrentBackend()->AttachTexture(attachment, texture->TexType(), texture->Multisample(), 0, texture->GLTexture());
+    else
+        Graphics::CurrentBackend()->AttachTexture(attachment, TEX_2D, 1, 0, 0);
+}
@@ -31,18 +31,34 @@ public:
     void Define(const std::vector<Texture*>& colorTextures, Texture* depthStencilTexture);
     /// Bind for rendering or for defining.
     void Bind(bool force = false);
+    /// Bind for reading pixels.
+    void BindRead(bool force = false);
+    /// Discard the content of attachments after their last use, so that tiled GPUs need not write them back to memory. The color mask has a bit per color attachment. Binds for rendering. No-op if not supported.
+    void Invalidate(unsigned colorMask, bool depthStencil);
 
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
-    /// Blit from one framebuffer to another.
+    /// Blit from one framebuffer to another. A multisampled source is resolved, which requires equal rectangle sizes. Only the first color attachment is blitted.
     static void Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src, const IntRect& srcRect, bool blitColor, bool blitDepth, TextureFilterMode filter);
+    /// Resolve a multisampled framebuffer's color attachments to the same attachments of another framebuffer, and optionally the depth. Depth takes the first sample.
+    static void Resolve(FrameBuffer* dest, FrameBuffer* src, const IntRect& rect, size_t numColorAttachments, bool resolveDepth);
     /// Return to backbuffer rendering.
     static void Unbind();
+    /// Return to reading pixels from the backbuffer, without changing the rendering destination.
+    static void UnbindRead();
 
 private:
+    /// Set the first color attachment as the only draw buffer, or none.
+    void SetDrawBuffer(bool enable);
+    /// Set the draw buffers of the color attachments. The framebuffer must be bound.
+    void RestoreDrawBuffers();
+    /// Attach a texture to the bound framebuffer, or null to detach.
+    void AttachTexture(size_t attachment, Texture* texture);
     /// Release the framebuffer object.
     void Release();
 
-    /// OpenGL buffer object identifier.
+    /// Framebuffer object handle.
     unsigned buffer;
+    /// Color attachments drawn to, restored after resolving.
+    std::vector<size_t> drawBuffers;
 };
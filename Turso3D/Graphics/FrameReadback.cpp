@@ -0,0 +1,279 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/File.h"
+#include "../IO/Log.h"
+#include "../IO/StringUtils.h"
+#include "../Resource/Image.h"
+#include "../Time/Profiler.h"
+#include "FrameBuffer.h"
+#include "FrameReadback.h"
+#include "Graphics.h"
+#include "Texture.h"
+
+#include <cassert>
+#include <cstring>
+#include <glew.h>
+
+/// Timeout for waiting on a readback fence when flushing.
+static const GLuint64 READBACK_FENCE_TIMEOUT_NSEC = 1000000000;
+
+ReadbackHandler::~ReadbackHandler()
+{
+}
+
+ReadbackImageWriter::ReadbackImageWriter(const std::string& prefix_) :
+    prefix(prefix_)
+{
+}
+
+void ReadbackImageWriter::OnReadback(const ReadbackData& data)
+{
+    PROFILE(WriteReadbackImage);
+
+    // Flip to top-down row order for the image file
+    Image image;
+    image.SetSize(data.size, FMT_RGBA8);
+    size_t imageRowSize = data.size.x * 4;
+    for (int y = 0; y < data.size.y; ++y)
+        memcpy(image.Data() + y * imageRowSize, data.data + (data.size.y - 1 - y) * data.rowSize, imageRowSize);
+
+    std::string fileName = prefix + FormatString("%05u", data.sequence) + ".png";
+    File file(fileName, FILE_WRITE);
+    if (!file.IsOpen() || !image.Save(file))
+        LOGERROR("Could not write readback image " + fileName);
+}
+
+ReadbackTask::ReadbackTask() :
+    handler(nullptr),
+    done(true)
+{
+    data.data = nullptr;
+    data.rowSize = 0;
+    data.sequence = 0;
+}
+
+void ReadbackTask::Complete(unsigned)
+{
+    if (handler)
+        handler->OnReadback(data);
+    done.store(true, std::memory_order_release);
+}
+
+FrameReadback::FrameReadback(size_t numBuffers) :
+    nextBuffer(0),
+    oldestBuffer(0),
+    numPending(0),
+    nextSequence(0),
+    numSkipped(0),
+    handler(nullptr),
+    counter(0)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+
+    if (numBuffers < 1)
+        numBuffers = 1;
+
+    for (size_t i = 0; i < numBuffers; ++i)
+    {
+        ReadbackBuffer* buffer = new ReadbackBuffer();
+        glGenBuffers(1, &buffer->buffer);
+        buffer->allocatedSize = 0;
+        buffer->fence = nullptr;
+        buffer->mapped = false;
+        buffers.push_back(buffer);
+    }
+}
+
+FrameReadback::~FrameReadback()
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    if (workQueue)
+        workQueue->Complete(counter);
+
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!Object::Subsystem<Graphics>())
+        return;
+
+    for (auto it = buffers.begin(); it != buffers.end(); ++it)
+    {
+        ReadbackBuffer* buffer = *it;
+        if (buffer->fence)
+            glDeleteSync((GLsync)buffer->fence);
+        if (buffer->mapped && buffer->task.data.data)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glDeleteBuffers(1, &buffer->buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void FrameReadback::SetHandler(ReadbackHandler* handler_)
+{
+    handler = handler_;
+}
+
+bool FrameReadback::Read(FrameBuffer* source, const IntRect& rect)
+{
+    PROFILE(ReadFrameBuffer);
+
+    IntVector2 size(rect.Width(), rect.Height());
+    ReadbackBuffer* buffer = BeginRead(size);
+    if (!buffer)
+        return false;
+
+    if (source)
+        source->BindRead();
+    else
+        FrameBuffer::UnbindRead();
+
+    glReadPixels(rect.left, rect.top, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    EndRead(buffer, size);
+    return true;
+}
+
+bool FrameReadback::Read(Texture* texture)
+{
+    PROFILE(ReadTexture);
+
+    if (!texture || !texture->GLTexture() || texture->TexType() != TEX_2D || texture->IsCompressed() || texture->Multisample() > 1 ||
+        texture->Format() >= FMT_D16)
+    {
+        LOGERROR("Readback requires an uncompressed 2D color texture");
+        return false;
+    }
+
+    size_t level = texture->ResidentLevel();
+    IntVector2 size(Max(texture->Width() >> level, 1), Max(texture->Height() >> level, 1));
+    ReadbackBuffer* buffer = BeginRead(size);
+    if (!buffer)
+        return false;
+
+    texture->Bind(0, true);
+    glGetTexImage(GL_TEXTURE_2D, (int)level, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    EndRead(buffer, size);
+    return true;
+}
+
+void FrameReadback::Update()
+{
+    PROFILE(UpdateReadback);
+
+    // Only the oldest buffer is handled at a time, which keeps the handler calls in order
+    while (numPending)
+    {
+        ReadbackBuffer* buffer = buffers[oldestBuffer];
+
+        if (!buffer->mapped)
+        {
+            GLenum result = glClientWaitSync((GLsync)buffer->fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                break;
+
+            glDeleteSync((GLsync)buffer->fence);
+            buffer->fence = nullptr;
+            Dispatch(buffer);
+        }
+
+        if (!buffer->task.done.load(std::memory_order_acquire))
+            break;
+
+        if (buffer->task.data.data)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->buffer);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            buffer->task.data.data = nullptr;
+        }
+        buffer->mapped = false;
+
+        oldestBuffer = (oldestBuffer + 1) % buffers.size();
+        --numPending;
+    }
+}
+
+void FrameReadback::Flush()
+{
+    PROFILE(FlushReadback);
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+
+    while (numPending)
+    {
+        ReadbackBuffer* buffer = buffers[oldestBuffer];
+        if (buffer->mapped)
+        {
+            if (workQueue)
+                workQueue->Complete(counter);
+        }
+        else
+            glClientWaitSync((GLsync)buffer->fence, GL_SYNC_FLUSH_COMMANDS_BIT, READBACK_FENCE_TIMEOUT_NSEC);
+
+        Update();
+    }
+}
+
+ReadbackBuffer* FrameReadback::BeginRead(const IntVector2& size)
+{
+    if (size.x <= 0 || size.y <= 0)
+    {
+        LOGERROR("Readback region must not be empty");
+        return nullptr;
+    }
+
+    if (numPending == buffers.size())
+    {
+        ++numSkipped;
+        return nullptr;
+    }
+
+    ReadbackBuffer* buffer = buffers[nextBuffer];
+    size_t dataSize = (size_t)size.x * size.y * 4;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->buffer);
+    if (buffer->allocatedSize != dataSize)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, dataSize, nullptr, GL_STREAM_READ);
+        buffer->allocatedSize = dataSize;
+    }
+
+    return buffer;
+}
+
+void FrameReadback::EndRead(ReadbackBuffer* buffer, const IntVector2& size)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    buffer->task.data.size = size;
+    buffer->task.data.rowSize = size.x * 4;
+    buffer->task.data.sequence = nextSequence++;
+
+    nextBuffer = (nextBuffer + 1) % buffers.size();
+    ++numPending;
+}
+
+void FrameReadback::Dispatch(ReadbackBuffer* buffer)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer->buffer);
+    buffer->task.data.data = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, buffer->allocatedSize, GL_MAP_READ_BIT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    buffer->mapped = true;
+
+    if (!buffer->task.data.data)
+    {
+        LOGERROR("Failed to map readback buffer");
+        return;
+    }
+
+    buffer->task.handler = handler;
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    if (workQueue && workQueue->NumWorkerThreads())
+    {
+        buffer->task.done.store(false, std::memory_order_relaxed);
+        workQueue->QueueTask(&buffer->task, &counter);
+    }
+    else
+        buffer->task.Complete(0);
+}
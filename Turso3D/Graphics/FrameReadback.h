@@ -0,0 +1,141 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntRect.h"
+#include "../Object/AutoPtr.h"
+#include "../Thread/WorkQueue.h"
+
+#include <string>
+
+class FrameBuffer;
+class Texture;
+
+/// Default number of pixel buffers for asynchronous readback.
+static const size_t DEFAULT_READBACK_BUFFERS = 3;
+
+/// Pixel data read back from the GPU in RGBA8 format. Rows are bottom-up as in OpenGL.
+struct ReadbackData
+{
+    /// Pixel data. Valid only during the handler call.
+    const unsigned char* data;
+    /// Size in pixels.
+    IntVector2 size;
+    /// Row size in bytes.
+    size_t rowSize;
+    /// Sequence number of the read request, counting from zero.
+    unsigned sequence;
+};
+
+/// Receiver of read back pixel data, for example to encode images or write raw frames to a video pipe. Called from a worker thread if the WorkQueue subsystem exists, otherwise from the main thread during FrameReadback::Update(). The calls are made in request order, one at a time.
+class ReadbackHandler
+{
+public:
+    /// Destruct.
+    virtual ~ReadbackHandler();
+
+    /// Handle read back data.
+    virtual void OnReadback(const ReadbackData& data) = 0;
+};
+
+/// %Readback handler that writes each frame as a PNG file, named with a prefix and the sequence number.
+class ReadbackImageWriter : public ReadbackHandler
+{
+public:
+    /// Construct with file name prefix, for example "Screenshots/Frame".
+    ReadbackImageWriter(const std::string& prefix);
+
+    /// Encode and write the data to a file.
+    void OnReadback(const ReadbackData& data) override;
+
+    /// File name prefix.
+    std::string prefix;
+};
+
+/// %Task for handling one read back buffer.
+class ReadbackTask : public Task
+{
+public:
+    /// Construct.
+    ReadbackTask();
+
+    /// Invoke the handler.
+    void Complete(unsigned threadIndex) override;
+
+    /// Handler.
+    ReadbackHandler* handler;
+    /// Read back data.
+    ReadbackData data;
+    /// Whether the handler has finished.
+    std::atomic<bool> done;
+};
+
+/// Pixel buffer of the readback ring.
+struct ReadbackBuffer
+{
+    /// OpenGL buffer object identifier.
+    unsigned buffer;
+    /// Allocated size in bytes.
+    size_t allocatedSize;
+    /// Fence inserted after the read, or null if not pending.
+    void* fence;
+    /// Whether is mapped and being handled.
+    bool mapped;
+    /// Handler task.
+    ReadbackTask task;
+};
+
+/// Asynchronous GPU readback of framebuffers and textures for screenshots and frame capture. Each read copies into the next pixel buffer of a ring and inserts a fence. A later Update() maps the oldest buffer once its fence has passed and hands it to the handler on a worker thread, so that the main thread never waits for the GPU or the handler. If all buffers are still in use, the read is skipped, which limits the capture rate to what the handler can keep up with.
+class FrameReadback
+{
+public:
+    /// Construct with number of pixel buffers. %Graphics subsystem must have been initialized.
+    FrameReadback(size_t numBuffers = DEFAULT_READBACK_BUFFERS);
+    /// Destruct. Waits for the handler calls in progress.
+    ~FrameReadback();
+
+    /// Set the handler. Not owned. Should not be changed while reads are pending.
+    void SetHandler(ReadbackHandler* handler);
+    /// Queue a read of a framebuffer's first color attachment, or the backbuffer if null. Return true if queued, false if all buffers are in use.
+    bool Read(FrameBuffer* source, const IntRect& rect);
+    /// Queue a read of a 2D texture's most detailed resident mip level, converted to RGBA8. Return true if queued, false if all buffers are in use or the texture is not an uncompressed 2D color texture.
+    bool Read(Texture* texture);
+    /// Deliver the completed reads to the handler and recycle the buffers it has finished with. Call once per frame.
+    void Update();
+    /// Wait for all pending reads and deliver them.
+    void Flush();
+
+    /// Return the handler.
+    ReadbackHandler* Handler() const { return handler; }
+    /// Return number of pixel buffers.
+    size_t NumBuffers() const { return buffers.size(); }
+    /// Return number of reads queued or being handled.
+    size_t NumPending() const { return numPending; }
+    /// Return number of reads skipped because all buffers were in use.
+    unsigned NumSkipped() const { return numSkipped; }
+
+private:
+    /// Return the next buffer to read into, allocated for a size in pixels, or null if all are in use.
+    ReadbackBuffer* BeginRead(const IntVector2& size);
+    /// Insert the fence after reading into the next buffer and advance the ring.
+    void EndRead(ReadbackBuffer* buffer, const IntVector2& size);
+    /// Map a buffer whose fence has passed and queue its handler task, or call the handler now without a work queue.
+    void Dispatch(ReadbackBuffer* buffer);
+
+    /// Pixel buffers.
+    std::vector<AutoPtr<ReadbackBuffer> > buffers;
+    /// Index of the next buffer to read into. Buffers are delivered in the same order.
+    size_t nextBuffer;
+    /// Index of the oldest buffer not yet recycled.
+    size_t oldestBuffer;
+    /// Number of reads queued or being handled.
+    size_t numPending;
+    /// Sequence number of the next read.
+    unsigned nextSequence;
+    /// Number of skipped reads.
+    unsigned numSkipped;
+    /// Handler.
+    ReadbackHandler* handler;
+    /// Counter of unfinished handler tasks.
+    TaskCounter counter;
+};
@@ -0,0 +1,1048 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "GLGraphicsBackend.h"
+
+#include <SDL.h>
+#include <glew.h>
+
+static const GLenum glCompareFuncs[] =
+{
+    GL_NEVER,
+    GL_LESS,
+    GL_EQUAL,
+    GL_LEQUAL,
+    GL_GREATER,
+    GL_NOTEQUAL,
+    GL_GEQUAL,
+    GL_ALWAYS,
+};
+
+static const GLenum glSrcBlend[] =
+{
+    GL_ONE,
+    GL_ONE,
+    GL_DST_COLOR,
+    GL_SRC_ALPHA,
+    GL_SRC_ALPHA,
+    GL_ONE,
+    GL_ONE_MINUS_DST_ALPHA,
+    GL_ONE,
+    GL_SRC_ALPHA
+};
+
+static const GLenum glDestBlend[] =
+{
+    GL_ZERO,
+    GL_ONE,
+    GL_ZERO,
+    GL_ONE_MINUS_SRC_ALPHA,
+    GL_ONE,
+    GL_ONE_MINUS_SRC_ALPHA,
+    GL_DST_ALPHA,
+    GL_ONE,
+    GL_ONE
+};
+
+static const GLenum glBlendOp[] =
+{
+    GL_FUNC_ADD,
+    GL_FUNC_ADD,
+    GL_FUNC_ADD,
+    GL_FUNC_ADD,
+    GL_FUNC_ADD,
+    GL_FUNC_ADD,
+    GL_FUNC_ADD,
+    GL_FUNC_REVERSE_SUBTRACT,
+    GL_FUNC_REVERSE_SUBTRACT
+};
+
+static const GLenum glBufferTargets[] =
+{
+    GL_ARRAY_BUFFER,
+    GL_ELEMENT_ARRAY_BUFFER,
+    GL_UNIFORM_BUFFER,
+    GL_SHADER_STORAGE_BUFFER
+};
+
+static const unsigned elementGLSizes[] =
+{
+    1,
+    1,
+    2,
+    3,
+    4,
+    4,
+    2,
+    4,
+    2,
+    2,
+    4
+};
+
+static const GLenum elementGLTypes[] =
+{
+    GL_INT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_UNSIGNED_BYTE,
+    GL_HALF_FLOAT,
+    GL_HALF_FLOAT,
+    GL_SHORT,
+    GL_UNSIGNED_SHORT,
+    GL_INT_2_10_10_10_REV
+};
+
+static const bool elementGLNormalized[] =
+{
+    false,
+    false,
+    false,
+    false,
+    false,
+    false,
+    false,
+    false,
+    true,
+    true,
+    true
+};
+
+static const GLenum glTargets[] =
+{
+    GL_TEXTURE_2D,
+    GL_TEXTURE_3D,
+    GL_TEXTURE_CUBE_MAP
+};
+
+static const GLenum glInternalFormats[] =
+{
+    0,
+    GL_R8,
+    GL_RG8,
+    GL_RGBA8,
+    GL_ALPHA,
+    GL_R16,
+    GL_RG16,
+    GL_RGBA16,
+    GL_R16F,
+    GL_RG16F,
+    GL_RGBA16F,
+    GL_R32F,
+    GL_RG32F,
+    GL_RGB32F,
+    GL_RGBA32F,
+    GL_R32UI,
+    GL_RG32UI,
+    GL_RGBA32UI,
+    GL_DEPTH_COMPONENT16,
+    GL_DEPTH_COMPONENT32,
+    GL_DEPTH24_STENCIL8,
+    GL_DEPTH_COMPONENT32F,
+    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+    GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+    0,
+    0,
+    0,
+    0,
+    0
+};
+
+static const GLenum glFormats[] =
+{
+    0,
+    GL_RED,
+    GL_RG,
+    GL_RGBA,
+    GL_ALPHA,
+    GL_RED,
+    GL_RG,
+    GL_RGBA,
+    GL_RED,
+    GL_RG,
+    GL_RGBA,
+    GL_RED,
+    GL_RG,
+    GL_RGB,
+    GL_RGBA,
+    GL_RED_INTEGER,
+    GL_RG_INTEGER,
+    GL_RGBA_INTEGER,
+    GL_DEPTH_COMPONENT,
+    GL_DEPTH_COMPONENT,
+    GL_DEPTH_STENCIL,
+    GL_DEPTH_COMPONENT,
+    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+    GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
+    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+    0,
+    0,
+    0,
+    0,
+    0
+};
+
+static const GLenum glDataTypes[] =
+{
+    0,
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_BYTE,
+    GL_UNSIGNED_SHORT,
+    GL_UNSIGNED_SHORT,
+    GL_UNSIGNED_SHORT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_FLOAT,
+    GL_UNSIGNED_INT,
+    GL_UNSIGNED_INT,
+    GL_UNSIGNED_INT,
+    GL_UNSIGNED_SHORT,
+    GL_UNSIGNED_INT,
+    GL_UNSIGNED_INT_24_8,
+    GL_FLOAT,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0
+};
+
+static const GLenum glImageAccess[] =
+{
+    GL_READ_ONLY,
+    GL_WRITE_ONLY,
+    GL_READ_WRITE
+};
+
+static const GLenum glWrapModes[] =
+{
+    GL_REPEAT,
+    GL_MIRRORED_REPEAT,
+    GL_CLAMP_TO_EDGE,
+    GL_CLAMP_TO_BORDER,
+    GL_MIRROR_CLAMP_EXT
+};
+
+static const GLenum glShaderStages[] =
+{
+    GL_VERTEX_SHADER,
+    GL_FRAGMENT_SHADER,
+    GL_COMPUTE_SHADER
+};
+
+/// Maximum length of uniform, attribute and block names.
+static const size_t MAX_NAME_LENGTH = 256;
+
+/// Return the texture binding target.
+static GLenum TextureTarget(TextureType type, int multisample)
+{
+    return multisample > 1 && type == TEX_2D ? GL_TEXTURE_2D_MULTISAMPLE : glTargets[type];
+}
+
+/// Return the framebuffer attachment point of an attachment index.
+static GLenum AttachmentPoint(size_t attachment)
+{
+    if (attachment == DEPTH_ATTACHMENT)
+        return GL_DEPTH_ATTACHMENT;
+    else if (attachment == STENCIL_ATTACHMENT)
+        return GL_STENCIL_ATTACHMENT;
+    else
+        return GL_COLOR_ATTACHMENT0 + (GLenum)attachment;
+}
+
+GLGraphicsBackend::GLGraphicsBackend() :
+    activeTextureUnit(0xffffffff)
+{
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
+        activeTargets[i] = 0;
+}
+
+void GLGraphicsBackend::SetWindowAttributes(bool headless)
+{
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, headless ? 0 : 1);
+    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
+    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 0);
+    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 0);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+}
+
+unsigned GLGraphicsBackend::WindowFlags() const
+{
+    return SDL_WINDOW_OPENGL;
+}
+
+void* GLGraphicsBackend::CreateContext(SDL_Window* window, bool headless)
+{
+    void* context = SDL_GL_CreateContext(window);
+    if (!context)
+    {
+        LOGERROR("Could not create OpenGL 3.2 context");
+        return nullptr;
+    }
+
+    // Without a GLX display, initialize only the OpenGL entry points, as the GLX query would fail
+    GLenum err = headless ? glewContextInit() : glewInit();
+    if (err != GLEW_OK || !GLEW_VERSION_3_2)
+    {
+        LOGERROR("Could not initialize OpenGL 3.2");
+        SDL_GL_DeleteContext(context);
+        return nullptr;
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_MULTISAMPLE);
+    // Filter across cubemap face edges, which matters for the blurry mip levels of prefiltered environment maps
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    glClearDepth(1.0f);
+    glDepthRange(0.0f, 1.0f);
+
+    return context;
+}
+
+void GLGraphicsBackend::DestroyContext(void* context)
+{
+    SDL_GL_DeleteContext(context);
+}
+
+bool GLGraphicsBackend::SetSwapInterval(int interval)
+{
+    return SDL_GL_SetSwapInterval(interval) >= 0;
+}
+
+void GLGraphicsBackend::SwapBuffers(SDL_Window* window)
+{
+    SDL_GL_SwapWindow(window);
+}
+
+void GLGraphicsBackend::Flush()
+{
+    glFlush();
+}
+
+IntVector2 GLGraphicsBackend::RenderSize(SDL_Window* window) const
+{
+    IntVector2 size;
+    SDL_GL_GetDrawableSize(window, &size.x, &size.y);
+    return size;
+}
+
+bool GLGraphicsBackend::IsSupported(GraphicsFeature feature) const
+{
+    switch (feature)
+    {
+    case FEATURE_PERSISTENT_BUFFERS:
+        return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+    case FEATURE_STORAGE_BUFFERS:
+        return GLEW_VERSION_4_3 || (GLEW_ARB_shader_storage_buffer_object && GLEW_ARB_compute_shader);
+
+    case FEATURE_COMPUTE:
+        return GLEW_VERSION_4_3 || GLEW_ARB_compute_shader;
+
+    case FEATURE_IMAGE_LOAD_STORE:
+        return glBindImageTexture != nullptr;
+
+    case FEATURE_INVALIDATE:
+        return GLEW_VERSION_4_3 || GLEW_ARB_invalidate_subdata;
+
+    case FEATURE_BINDLESS_TEXTURES:
+        return GLEW_ARB_bindless_texture != 0;
+
+    case FEATURE_PARALLEL_COMPILE:
+        return GLEW_ARB_parallel_shader_compile != GL_FALSE;
+
+    case FEATURE_PROGRAM_BINARIES:
+        {
+            if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+                return false;
+
+            int numFormats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+            return numFormats > 0;
+        }
+
+    default:
+        return false;
+    }
+}
+
+std::string GLGraphicsBackend::DeviceString() const
+{
+    return std::string((const char*)glGetString(GL_VENDOR)) + (const char*)glGetString(GL_RENDERER) + (const char*)glGetString(GL_VERSION);
+}
+
+void GLGraphicsBackend::ClearErrors()
+{
+    glGetError();
+}
+
+bool GLGraphicsBackend::HasErrors()
+{
+    return glGetError() != GL_NO_ERROR;
+}
+
+void GLGraphicsBackend::SetBlendEnabled(bool enable)
+{
+    if (enable)
+        glEnable(GL_BLEND);
+    else
+        glDisable(GL_BLEND);
+}
+
+void GLGraphicsBackend::SetBlendMode(BlendMode mode)
+{
+    glBlendFunc(glSrcBlend[mode], glDestBlend[mode]);
+    glBlendEquation(glBlendOp[mode]);
+}
+
+void GLGraphicsBackend::SetCullEnabled(bool enable)
+{
+    if (enable)
+        glEnable(GL_CULL_FACE);
+    else
+        glDisable(GL_CULL_FACE);
+}
+
+void GLGraphicsBackend::SetCullMode(CullMode mode)
+{
+    // Use Direct3D convention, ie. clockwise vertices define a front face
+    glCullFace(mode == CULL_BACK ? GL_FRONT : GL_BACK);
+}
+
+void GLGraphicsBackend::SetDepthTest(CompareMode mode)
+{
+    glDepthFunc(glCompareFuncs[mode]);
+}
+
+void GLGraphicsBackend::SetColorWrite(bool enable)
+{
+    GLboolean newColorWrite = enable ? GL_TRUE : GL_FALSE;
+    glColorMask(newColorWrite, newColorWrite, newColorWrite, newColorWrite);
+}
+
+void GLGraphicsBackend::SetDepthWrite(bool enable)
+{
+    glDepthMask(enable ? GL_TRUE : GL_FALSE);
+}
+
+void GLGraphicsBackend::SetDepthBiasEnabled(bool enable)
+{
+    if (enable)
+        glEnable(GL_POLYGON_OFFSET_FILL);
+    else
+        glDisable(GL_POLYGON_OFFSET_FILL);
+}
+
+void GLGraphicsBackend::SetDepthBias(float constantBias, float slopeScaleBias)
+{
+    glPolygonOffset(slopeScaleBias, constantBias);
+}
+
+void GLGraphicsBackend::SetViewport(const IntRect& rect)
+{
+    glViewport(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+}
+
+void GLGraphicsBackend::SetScissorEnabled(bool enable)
+{
+    if (enable)
+        glEnable(GL_SCISSOR_TEST);
+    else
+        glDisable(GL_SCISSOR_TEST);
+}
+
+void GLGraphicsBackend::SetScissorRect(const IntRect& rect)
+{
+    glScissor(rect.left, rect.top, rect.right - rect.left, rect.bottom - rect.top);
+}
+
+void GLGraphicsBackend::SetClearColor(const Color& color)
+{
+    glClearColor(color.r, color.g, color.b, color.a);
+}
+
+void GLGraphicsBackend::Clear(bool clearColor, bool clearDepth)
+{
+    GLenum glClearBits = 0;
+    if (clearColor)
+        glClearBits |= GL_COLOR_BUFFER_BIT;
+    if (clearDepth)
+        glClearBits |= GL_DEPTH_BUFFER_BIT;
+
+    glClear(glClearBits);
+}
+
+void* GLGraphicsBackend::CreateFence()
+{
+    return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool GLGraphicsBackend::WaitFence(void* fence, bool wait, unsigned long long timeoutNsec)
+{
+    GLenum result = glClientWaitSync((GLsync)fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? timeoutNsec : 0);
+    return result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED;
+}
+
+void GLGraphicsBackend::DestroyFence(void* fence)
+{
+    glDeleteSync((GLsync)fence);
+}
+
+unsigned GLGraphicsBackend::CreateBuffer()
+{
+    unsigned buffer = 0;
+    glGenBuffers(1, &buffer);
+    return buffer;
+}
+
+void GLGraphicsBackend::DestroyBuffer(unsigned buffer)
+{
+    // Deleting the buffer also unmaps it
+    glDeleteBuffers(1, &buffer);
+}
+
+void GLGraphicsBackend::BindBuffer(BufferTarget target, unsigned buffer)
+{
+    glBindBuffer(glBufferTargets[target], buffer);
+}
+
+void GLGraphicsBackend::BindBufferSlot(BufferTarget target, size_t index, unsigned buffer, size_t size)
+{
+    if (target == BUFFER_UNIFORM)
+        glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, buffer, 0, size);
+    else
+        glBindBufferBase(glBufferTargets[target], (GLuint)index, buffer);
+}
+
+void* GLGraphicsBackend::DefineBufferData(BufferTarget target, size_t size, ResourceUsage usage, const void* data)
+{
+    GLenum glTarget = glBufferTargets[target];
+
+    if (usage == USAGE_PERSISTENT)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(glTarget, size, data, flags);
+        return glMapBufferRange(glTarget, 0, size, flags);
+    }
+
+    glBufferData(glTarget, size, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    return nullptr;
+}
+
+void GLGraphicsBackend::SetBufferData(BufferTarget target, size_t offset, size_t numBytes, const void* data)
+{
+    glBufferSubData(glBufferTargets[target], offset, numBytes, data);
+}
+
+void GLGraphicsBackend::SetVertexAttributeEnabled(unsigned index, bool enable)
+{
+    if (enable)
+        glEnableVertexAttribArray(index);
+    else
+        glDisableVertexAttribArray(index);
+}
+
+void GLGraphicsBackend::SetVertexAttribute(unsigned index, ElementType type, bool normalize, size_t stride, size_t offset)
+{
+    glVertexAttribPointer(index, elementGLSizes[type], elementGLTypes[type], (elementGLNormalized[type] || normalize) ? GL_TRUE : GL_FALSE,
+        (GLsizei)stride, reinterpret_cast<void*>(offset));
+}
+
+unsigned GLGraphicsBackend::CreateTexture()
+{
+    unsigned texture = 0;
+    glGenTextures(1, &texture);
+    return texture;
+}
+
+void GLGraphicsBackend::DestroyTexture(unsigned texture, unsigned long long bindlessHandle)
+{
+    if (bindlessHandle)
+        glMakeTextureHandleNonResidentARB(bindlessHandle);
+
+    glDeleteTextures(1, &texture);
+}
+
+void GLGraphicsBackend::BindTexture(size_t unit, TextureType type, int multisample, unsigned texture)
+{
+    if (activeTextureUnit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + (GLenum)unit);
+        activeTextureUnit = unit;
+    }
+
+    GLenum glTarget = TextureTarget(type, multisample);
+
+    if (activeTargets[unit] && activeTargets[unit] != glTarget)
+        glBindTexture(activeTargets[unit], 0);
+
+    glBindTexture(glTarget, texture);
+    activeTargets[unit] = glTarget;
+}
+
+void GLGraphicsBackend::UnbindTexture(size_t unit)
+{
+    if (!activeTargets[unit])
+        return;
+
+    if (activeTextureUnit != unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + (GLenum)unit);
+        activeTextureUnit = unit;
+    }
+
+    glBindTexture(activeTargets[unit], 0);
+    activeTargets[unit] = 0;
+}
+
+void GLGraphicsBackend::DefineTextureLevel(TextureType type, int multisample, size_t level, const IntVector3& size, ImageFormat format)
+{
+    if (multisample == 1)
+    {
+        if (type == TEX_2D)
+            glTexImage2D(glTargets[type], (int)level, glInternalFormats[format], size.x, size.y, 0, glFormats[format], glDataTypes[format], nullptr);
+        else if (type == TEX_3D)
+            glTexImage3D(glTargets[type], (int)level, glInternalFormats[format], size.x, size.y, size.z, 0, glFormats[format], glDataTypes[format], nullptr);
+        else if (type == TEX_CUBE)
+        {
+            for (size_t i = 0; i < MAX_CUBE_FACES; ++i)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i, (int)level, glInternalFormats[format], size.x, size.y, 0, glFormats[format], glDataTypes[format], nullptr);
+        }
+    }
+    else
+    {
+        if (type == TEX_2D)
+            glTexImage2DMultisample(TextureTarget(type, multisample), multisample, glInternalFormats[format], size.x, size.y, GL_TRUE);
+        else if (type == TEX_3D)
+            glTexImage3DMultisample(glTargets[type], multisample, glInternalFormats[format], size.x, size.y, size.z, GL_TRUE);
+        else if (type == TEX_CUBE)
+        {
+            for (size_t i = 0; i < MAX_CUBE_FACES; ++i)
+                glTexImage2DMultisample(GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i, multisample, glInternalFormats[format], size.x, size.y, GL_TRUE);
+        }
+    }
+}
+
+void GLGraphicsBackend::SetTextureData(TextureType type, size_t level, const IntBox& box, ImageFormat format, const void* data, size_t dataSize, bool wholeLevel)
+{
+    GLenum target = (type == TEX_CUBE) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + box.near : glTargets[type];
+    bool compressed = format >= FMT_DXT1;
+
+    if (type != TEX_3D)
+    {
+        if (!compressed)
+        {
+            if (wholeLevel)
+                glTexImage2D(target, (int)level, glInternalFormats[format], box.Width(), box.Height(), 0, glFormats[format], glDataTypes[format], data);
+            else
+                glTexSubImage2D(target, (int)level, box.left, box.top, box.Width(), box.Height(), glFormats[format], glDataTypes[format], data);
+        }
+        else
+        {
+            if (wholeLevel)
+                glCompressedTexImage2D(target, (int)level, glInternalFormats[format], box.Width(), box.Height(), 0, (GLsizei)dataSize, data);
+            else
+                glCompressedTexSubImage2D(target, (int)level, box.left, box.top, box.Width(), box.Height(), glFormats[format], (GLsizei)dataSize, data);
+        }
+    }
+    else
+    {
+        if (wholeLevel)
+            glTexImage3D(target, (int)level, glInternalFormats[format], box.Width(), box.Height(), box.Depth(), 0, glFormats[format], glDataTypes[format], data);
+        else
+            glTexSubImage3D(target, (int)level, box.left, box.top, box.near, box.Width(), box.Height(), box.Depth(), glFormats[format], glDataTypes[format], data);
+    }
+}
+
+void GLGraphicsBackend::ReleaseTextureLevel(size_t level, ImageFormat format)
+{
+    // Respecify the level with zero size to free its storage
+    if (format < FMT_DXT1)
+        glTexImage2D(GL_TEXTURE_2D, (int)level, glInternalFormats[format], 0, 0, 0, glFormats[format], glDataTypes[format], nullptr);
+    else
+        glCompressedTexImage2D(GL_TEXTURE_2D, (int)level, glInternalFormats[format], 0, 0, 0, 0, nullptr);
+}
+
+void GLGraphicsBackend::SetTextureLevels(TextureType type, size_t baseLevel, size_t maxLevel)
+{
+    glTexParameteri(glTargets[type], GL_TEXTURE_BASE_LEVEL, (int)baseLevel);
+    glTexParameteri(glTargets[type], GL_TEXTURE_MAX_LEVEL, (int)maxLevel);
+}
+
+void GLGraphicsBackend::SetTextureLodRange(TextureType type, float minLod, float maxLod)
+{
+    glTexParameterf(glTargets[type], GL_TEXTURE_MIN_LOD, minLod);
+    glTexParameterf(glTargets[type], GL_TEXTURE_MAX_LOD, maxLod);
+}
+
+void GLGraphicsBackend::SetTextureSampler(TextureType type, size_t numLevels, TextureFilterMode filter, const TextureAddressMode* addressModes, unsigned maxAnisotropy, const Color& borderColor)
+{
+    GLenum target = glTargets[type];
+
+    switch (filter)
+    {
+    case FILTER_POINT:
+    case COMPARE_POINT:
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        break;
+
+    case FILTER_BILINEAR:
+    case COMPARE_BILINEAR:
+        if (numLevels < 2)
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        else
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        break;
+
+    case FILTER_ANISOTROPIC:
+    case FILTER_TRILINEAR:
+    case COMPARE_ANISOTROPIC:
+    case COMPARE_TRILINEAR:
+        if (numLevels < 2)
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        else
+            glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        break;
+
+    default:
+        break;
+    }
+
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, glWrapModes[addressModes[0]]);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, glWrapModes[addressModes[1]]);
+    glTexParameteri(target, GL_TEXTURE_WRAP_R, glWrapModes[addressModes[2]]);
+
+    glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, filter == FILTER_ANISOTROPIC ? maxAnisotropy : 1.0f);
+
+    glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, borderColor.Data());
+
+    if (filter >= COMPARE_POINT)
+    {
+        glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+    else
+        glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+}
+
+void GLGraphicsBackend::BindImage(size_t unit, unsigned texture, size_t level, bool layered, ImageAccess access, ImageFormat format)
+{
+    if (texture)
+        glBindImageTexture((GLuint)unit, texture, (GLint)level, layered ? GL_TRUE : GL_FALSE, 0, glImageAccess[access], glInternalFormats[format]);
+    else
+        glBindImageTexture((GLuint)unit, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8);
+}
+
+void GLGraphicsBackend::InvalidateTexture(unsigned texture, size_t level)
+{
+    glInvalidateTexImage(texture, (GLint)level);
+}
+
+unsigned long long GLGraphicsBackend::CreateBindlessHandle(unsigned texture)
+{
+    unsigned long long handle = glGetTextureHandleARB(texture);
+    if (handle)
+        glMakeTextureHandleResidentARB(handle);
+    return handle;
+}
+
+unsigned GLGraphicsBackend::CreateFrameBuffer()
+{
+    unsigned buffer = 0;
+    glGenFramebuffers(1, &buffer);
+    return buffer;
+}
+
+void GLGraphicsBackend::DestroyFrameBuffer(unsigned buffer)
+{
+    glDeleteFramebuffers(1, &buffer);
+}
+
+void GLGraphicsBackend::BindFrameBuffer(unsigned buffer, bool read)
+{
+    glBindFramebuffer(read ? GL_READ_FRAMEBUFFER : GL_DRAW_FRAMEBUFFER, buffer);
+}
+
+void GLGraphicsBackend::AttachRenderBuffer(size_t attachment, unsigned renderBuffer)
+{
+    glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, AttachmentPoint(attachment), GL_RENDERBUFFER, renderBuffer);
+}
+
+void GLGraphicsBackend::AttachTexture(size_t attachment, TextureType type, int multisample, size_t face, unsigned texture)
+{
+    GLenum target = type == TEX_CUBE ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)face : TextureTarget(type, multisample);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, AttachmentPoint(attachment), texture ? target : GL_TEXTURE_2D, texture, 0);
+}
+
+void GLGraphicsBackend::SetDrawBuffers(const std::vector<size_t>& attachments)
+{
+    if (attachments.empty())
+    {
+        glDrawBuffer(GL_NONE);
+        return;
+    }
+
+    GLenum drawBuffers[MAX_RENDERTARGETS];
+    GLsizei numDrawBuffers = 0;
+    for (size_t i = 0; i < attachments.size() && i < MAX_RENDERTARGETS; ++i)
+        drawBuffers[numDrawBuffers++] = GL_COLOR_ATTACHMENT0 + (GLenum)attachments[i];
+    glDrawBuffers(numDrawBuffers, drawBuffers);
+}
+
+void GLGraphicsBackend::SetSingleDrawBuffer(size_t attachment)
+{
+    // Draw buffers are indexed by the fragment output, so the preceding outputs are left unused
+    GLenum drawBuffers[MAX_RENDERTARGETS];
+    for (size_t i = 0; i < attachment; ++i)
+        drawBuffers[i] = GL_NONE;
+    drawBuffers[attachment] = GL_COLOR_ATTACHMENT0 + (GLenum)attachment;
+    glDrawBuffers((GLsizei)attachment + 1, drawBuffers);
+}
+
+void GLGraphicsBackend::SetReadBuffer(size_t attachment)
+{
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + (GLenum)attachment);
+}
+
+void GLGraphicsBackend::InvalidateFrameBuffer(unsigned colorMask, bool depthStencil)
+{
+    GLenum attachments[MAX_RENDERTARGETS + 2];
+    GLsizei numAttachments = 0;
+    for (unsigned i = 0; i < (unsigned)MAX_RENDERTARGETS; ++i)
+    {
+        if (colorMask & (1 << i))
+            attachments[numAttachments++] = GL_COLOR_ATTACHMENT0 + i;
+    }
+    if (depthStencil)
+    {
+        attachments[numAttachments++] = GL_DEPTH_ATTACHMENT;
+        attachments[numAttachments++] = GL_STENCIL_ATTACHMENT;
+    }
+
+    if (numAttachments)
+        glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, numAttachments, attachments);
+}
+
+void GLGraphicsBackend::BlitFrameBuffer(const IntRect& srcRect, const IntRect& destRect, bool blitColor, bool blitDepth, TextureFilterMode filter)
+{
+    GLenum glBlitBits = 0;
+    if (blitColor)
+        glBlitBits |= GL_COLOR_BUFFER_BIT;
+    if (blitDepth)
+        glBlitBits |= GL_DEPTH_BUFFER_BIT;
+
+    glBlitFramebuffer(srcRect.left, srcRect.top, srcRect.right, srcRect.bottom, destRect.left, destRect.top, destRect.right, destRect.bottom, glBlitBits, filter == FILTER_POINT ? GL_NEAREST : GL_LINEAR);
+}
+
+unsigned GLGraphicsBackend::CompileShader(ShaderStage stage, const std::string& sourceCode)
+{
+    const char* shaderStr = sourceCode.c_str();
+
+    unsigned shader = glCreateShader(glShaderStages[stage]);
+    glShaderSource(shader, 1, &shaderStr, nullptr);
+    glCompileShader(shader);
+    return shader;
+}
+
+bool GLGraphicsBackend::ShaderStatus(unsigned shader, std::string& log)
+{
+    int compiled, length, outLength;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    log.resize(length);
+    if (length)
+        glGetShaderInfoLog(shader, length, &outLength, &log[0]);
+    return compiled != 0;
+}
+
+void GLGraphicsBackend::DestroyShader(unsigned shader)
+{
+    glDeleteShader(shader);
+}
+
+unsigned GLGraphicsBackend::LinkProgram(const std::vector<unsigned>& shaders, const char** attributeNames, bool retrievable)
+{
+    unsigned program = glCreateProgram();
+    for (size_t i = 0; i < shaders.size(); ++i)
+        glAttachShader(program, shaders[i]);
+    for (unsigned i = 0; attributeNames && attributeNames[i]; ++i)
+        glBindAttribLocation(program, i, attributeNames[i]);
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    return program;
+}
+
+bool GLGraphicsBackend::ProgramStatus(unsigned program, std::string& log)
+{
+    int linked, length, outLength;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+    log.resize(length);
+    if (length)
+        glGetProgramInfoLog(program, length, &outLength, &log[0]);
+    return linked != 0;
+}
+
+bool GLGraphicsBackend::IsProgramReady(unsigned program)
+{
+    int completed = GL_FALSE;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_ARB, &completed);
+    return completed != GL_FALSE;
+}
+
+void GLGraphicsBackend::DestroyProgram(unsigned program)
+{
+    glDeleteProgram(program);
+}
+
+void GLGraphicsBackend::UseProgram(unsigned program)
+{
+    glUseProgram(program);
+}
+
+void GLGraphicsBackend::EnableParallelCompile()
+{
+    glMaxShaderCompilerThreadsARB(0xffffffff);
+}
+
+unsigned GLGraphicsBackend::LoadProgramBinary(unsigned format, const void* data, size_t size)
+{
+    unsigned program = glCreateProgram();
+    glProgramBinary(program, format, data, (GLsizei)size);
+
+    int linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+bool GLGraphicsBackend::ProgramBinary(unsigned program, unsigned& format, std::vector<unsigned char>& data)
+{
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return false;
+
+    data.resize(length);
+    GLenum glFormat = 0;
+    glGetProgramBinary(program, length, nullptr, &glFormat, &data[0]);
+    format = glFormat;
+    return true;
+}
+
+void GLGraphicsBackend::ProgramAttributes(unsigned program, std::vector<std::string>& names)
+{
+    char nameBuffer[MAX_NAME_LENGTH];
+    int numAttributes, nameLength, numElements;
+    GLenum type;
+
+    names.clear();
+    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+    for (int i = 0; i < numAttributes; ++i)
+    {
+        glGetActiveAttrib(program, i, (GLsizei)MAX_NAME_LENGTH, &nameLength, &numElements, &type, nameBuffer);
+        names.push_back(std::string(nameBuffer, nameLength));
+    }
+}
+
+void GLGraphicsBackend::ProgramUniforms(unsigned program, std::vector<UniformInfo>& uniforms)
+{
+    char nameBuffer[MAX_NAME_LENGTH];
+    int numUniforms, nameLength, numElements;
+    GLenum type;
+
+    uniforms.clear();
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    for (int i = 0; i < numUniforms; ++i)
+    {
+        glGetActiveUniform(program, i, MAX_NAME_LENGTH, &nameLength, &numElements, &type, nameBuffer);
+
+        UniformInfo info;
+        info.name = std::string(nameBuffer, nameLength);
+        info.location = glGetUniformLocation(program, info.name.c_str());
+        info.numElements = numElements;
+        if ((type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_SHADOW) || (type >= GL_SAMPLER_1D_ARRAY && type <= GL_SAMPLER_CUBE_SHADOW) || (type >= GL_INT_SAMPLER_1D && type <= GL_UNSIGNED_INT_SAMPLER_2D_ARRAY))
+            info.kind = UNIFORM_SAMPLER;
+        else if (type >= GL_IMAGE_1D && type <= GL_UNSIGNED_INT_IMAGE_2D_MULTISAMPLE_ARRAY)
+            info.kind = UNIFORM_IMAGE;
+        else
+            info.kind = UNIFORM_VALUE;
+        uniforms.push_back(info);
+    }
+}
+
+void GLGraphicsBackend::SetUniformInts(int location, const int* values, size_t count)
+{
+    glUniform1iv(location, (GLsizei)count, values);
+}
+
+void GLGraphicsBackend::ProgramUniformBlocks(unsigned program, std::vector<std::string>& names)
+{
+    char nameBuffer[MAX_NAME_LENGTH];
+    int numUniformBlocks, nameLength;
+
+    names.clear();
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numUniformBlocks);
+    for (int i = 0; i < numUniformBlocks; ++i)
+    {
+        glGetActiveUniformBlockName(program, i, MAX_NAME_LENGTH, &nameLength, nameBuffer);
+        names.push_back(std::string(nameBuffer, nameLength));
+    }
+}
+
+void GLGraphicsBackend::SetUniformBlockBinding(unsigned program, size_t blockIndex, size_t binding)
+{
+    glUniformBlockBinding(program, (GLuint)blockIndex, (GLuint)binding);
+}
+
+void GLGraphicsBackend::ProgramStorageBlocks(unsigned program, std::vector<std::string>& names)
+{
+    names.clear();
+    if (!glGetProgramInterfaceiv || !glShaderStorageBlockBinding)
+        return;
+
+    char nameBuffer[MAX_NAME_LENGTH];
+    int numStorageBlocks = 0, nameLength;
+
+    glGetProgramInterfaceiv(program, GL_SHADER_STORAGE_BLOCK, GL_ACTIVE_RESOURCES, &numStorageBlocks);
+    for (int i = 0; i < numStorageBlocks; ++i)
+    {
+        glGetProgramResourceName(program, GL_SHADER_STORAGE_BLOCK, i, MAX_NAME_LENGTH, &nameLength, nameBuffer);
+        names.push_back(std::string(nameBuffer, nameLength));
+    }
+}
+
+void GLGraphicsBackend::SetStorageBlockBinding(unsigned program, size_t blockIndex, size_t binding)
+{
+    glShaderStorageBlockBinding(program, (GLuint)blockIndex, (GLuint)binding);
+}
@@ -0,0 +1,182 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GraphicsBackend.h"
+
+/// OpenGL 3.2+ implementation of the rendering API, the default backend.
+class GLGraphicsBackend : public GraphicsBackend
+{
+public:
+    /// Construct.
+    GLGraphicsBackend();
+
+    /// Set the context attributes to use for windows created afterward.
+    void SetWindowAttributes(bool headless) override;
+    /// Return the SDL window flags the rendering API requires.
+    unsigned WindowFlags() const override;
+    /// Create the rendering context for a window and set its initial state. Return the context, or null on failure.
+    void* CreateContext(SDL_Window* window, bool headless) override;
+    /// Destroy the rendering context.
+    void DestroyContext(void* context) override;
+    /// Set the swap interval: 0 immediate, 1 vertical sync, -1 adaptive vertical sync. Return true on success.
+    bool SetSwapInterval(int interval) override;
+    /// Present the backbuffer of the window.
+    void SwapBuffers(SDL_Window* window) override;
+    /// Submit queued commands to the GPU without waiting.
+    void Flush() override;
+    /// Return the window size in rendering pixels.
+    IntVector2 RenderSize(SDL_Window* window) const override;
+    /// Return whether an optional feature is supported.
+    bool IsSupported(GraphicsFeature feature) const override;
+    /// Return an identification of the GPU and driver.
+    std::string DeviceString() const override;
+    /// Clear pending errors, to check with HasErrors() whether the following operations succeeded.
+    void ClearErrors() override;
+    /// Return whether errors were raised since the last check, and clear them.
+    bool HasErrors() override;
+
+    /// Enable or disable blending.
+    void SetBlendEnabled(bool enable) override;
+    /// Set the blend factors and operation of a blend mode.
+    void SetBlendMode(BlendMode mode) override;
+    /// Enable or disable face culling.
+    void SetCullEnabled(bool enable) override;
+    /// Set the face culling mode. Clockwise vertices define a front face.
+    void SetCullMode(CullMode mode) override;
+    /// Set the depth test comparison.
+    void SetDepthTest(CompareMode mode) override;
+    /// Set color write.
+    void SetColorWrite(bool enable) override;
+    /// Set depth write.
+    void SetDepthWrite(bool enable) override;
+    /// Enable or disable depth bias.
+    void SetDepthBiasEnabled(bool enable) override;
+    /// Set constant and slope-scaled depth bias.
+    void SetDepthBias(float constantBias, float slopeScaleBias) override;
+    /// Set the viewport rectangle.
+    void SetViewport(const IntRect& rect) override;
+    /// Enable or disable the scissor test.
+    void SetScissorEnabled(bool enable) override;
+    /// Set the scissor rectangle.
+    void SetScissorRect(const IntRect& rect) override;
+    /// Set the clear color.
+    void SetClearColor(const Color& color) override;
+    /// Clear the color and/or depth of the bound framebuffer.
+    void Clear(bool clearColor, bool clearDepth) override;
+
+    /// Insert a fence after the commands issued so far. Return the fence.
+    void* CreateFence() override;
+    /// Return whether a fence has completed, optionally flushing and waiting up to a timeout in nanoseconds.
+    bool WaitFence(void* fence, bool wait, unsigned long long timeoutNsec) override;
+    /// Destroy a fence.
+    void DestroyFence(void* fence) override;
+
+    /// Create a buffer object. Return the handle, or zero on failure.
+    unsigned CreateBuffer() override;
+    /// Destroy a buffer object. A persistent mapping is released with it.
+    void DestroyBuffer(unsigned buffer) override;
+    /// Bind a buffer to a target, or zero to unbind.
+    void BindBuffer(BufferTarget target, unsigned buffer) override;
+    /// Bind a buffer range to an indexed uniform or storage slot. Zero buffer unbinds.
+    void BindBufferSlot(BufferTarget target, size_t index, unsigned buffer, size_t size) override;
+    /// Allocate the storage of the bound buffer with optional initial data. Persistent usage maps it coherently; return the mapping, or null if not persistent or if mapping failed.
+    void* DefineBufferData(BufferTarget target, size_t size, ResourceUsage usage, const void* data) override;
+    /// Update a range of the bound buffer.
+    void SetBufferData(BufferTarget target, size_t offset, size_t numBytes, const void* data) override;
+    /// Enable or disable a vertex attribute in the bound vertex array.
+    void SetVertexAttributeEnabled(unsigned index, bool enable) override;
+    /// Point a vertex attribute to an element of the bound vertex buffer.
+    void SetVertexAttribute(unsigned index, ElementType type, bool normalize, size_t stride, size_t offset) override;
+
+    /// Create a texture object. Return the handle, or zero on failure.
+    unsigned CreateTexture() override;
+    /// Destroy a texture object, making its bindless handle non-resident first if nonzero.
+    void DestroyTexture(unsigned texture, unsigned long long bindlessHandle) override;
+    /// Bind a texture to a texture unit. The unit also becomes the one edited.
+    void BindTexture(size_t unit, TextureType type, int multisample, unsigned texture) override;
+    /// Unbind a texture unit.
+    void UnbindTexture(size_t unit) override;
+    /// Allocate storage for a mip level of the bound texture without data.
+    void DefineTextureLevel(TextureType type, int multisample, size_t level, const IntVector3& size, ImageFormat format) override;
+    /// Set data for a region of a mip level of the bound texture.
+    void SetTextureData(TextureType type, size_t level, const IntBox& box, ImageFormat format, const void* data, size_t dataSize, bool wholeLevel) override;
+    /// Release the storage of a mip level of the bound 2D texture.
+    void ReleaseTextureLevel(size_t level, ImageFormat format) override;
+    /// Set the base and maximum mip level of the bound texture.
+    void SetTextureLevels(TextureType type, size_t baseLevel, size_t maxLevel) override;
+    /// Set the LOD range of the bound texture.
+    void SetTextureLodRange(TextureType type, float minLod, float maxLod) override;
+    /// Set the sampling parameters of the bound texture.
+    void SetTextureSampler(TextureType type, size_t numLevels, TextureFilterMode filter, const TextureAddressMode* addressModes, unsigned maxAnisotropy, const Color& borderColor) override;
+    /// Bind a mip level of a texture to an image unit, or zero texture to unbind.
+    void BindImage(size_t unit, unsigned texture, size_t level, bool layered, ImageAccess access, ImageFormat format) override;
+    /// Discard the content of a mip level of a texture.
+    void InvalidateTexture(unsigned texture, size_t level) override;
+    /// Create and make resident a bindless handle of a texture. Return zero on failure.
+    unsigned long long CreateBindlessHandle(unsigned texture) override;
+
+    /// Create a framebuffer object. Return the handle, or zero on failure.
+    unsigned CreateFrameBuffer() override;
+    /// Destroy a framebuffer object.
+    void DestroyFrameBuffer(unsigned buffer) override;
+    /// Bind a framebuffer for drawing or for reading. Zero is the backbuffer.
+    void BindFrameBuffer(unsigned buffer, bool read) override;
+    /// Attach a renderbuffer to the bound draw framebuffer, or zero to detach.
+    void AttachRenderBuffer(size_t attachment, unsigned renderBuffer) override;
+    /// Attach a texture to the bound draw framebuffer, or zero to detach.
+    void AttachTexture(size_t attachment, TextureType type, int multisample, size_t face, unsigned texture) override;
+    /// Set the color attachments drawn to in the bound draw framebuffer.
+    void SetDrawBuffers(const std::vector<size_t>& attachments) override;
+    /// Set a single color attachment drawn to, keeping its index.
+    void SetSingleDrawBuffer(size_t attachment) override;
+    /// Set the color attachment read from in the bound read framebuffer.
+    void SetReadBuffer(size_t attachment) override;
+    /// Discard the content of attachments of the bound draw framebuffer.
+    void InvalidateFrameBuffer(unsigned colorMask, bool depthStencil) override;
+    /// Blit a rectangle from the bound read framebuffer to the bound draw framebuffer.
+    void BlitFrameBuffer(const IntRect& srcRect, const IntRect& destRect, bool blitColor, bool blitDepth, TextureFilterMode filter) override;
+
+    /// Issue compile of a shader stage without waiting for the result. Return the handle.
+    unsigned CompileShader(ShaderStage stage, const std::string& sourceCode) override;
+    /// Return whether a shader compiled, and its compile log.
+    bool ShaderStatus(unsigned shader, std::string& log) override;
+    /// Destroy a shader.
+    void DestroyShader(unsigned shader) override;
+    /// Issue link of a program from shaders without waiting for the result. Return the handle.
+    unsigned LinkProgram(const std::vector<unsigned>& shaders, const char** attributeNames, bool retrievable) override;
+    /// Return whether a program linked, and its link log.
+    bool ProgramStatus(unsigned program, std::string& log) override;
+    /// Return whether a parallel compile & link of a program has finished.
+    bool IsProgramReady(unsigned program) override;
+    /// Destroy a program.
+    void DestroyProgram(unsigned program) override;
+    /// Use a program for drawing or dispatch.
+    void UseProgram(unsigned program) override;
+    /// Let the driver compile and link in parallel with the number of threads it chooses.
+    void EnableParallelCompile() override;
+    /// Create a program from a binary. Return the handle, or zero if the binary was rejected.
+    unsigned LoadProgramBinary(unsigned format, const void* data, size_t size) override;
+    /// Retrieve the binary of a linked program. Return true on success.
+    bool ProgramBinary(unsigned program, unsigned& format, std::vector<unsigned char>& data) override;
+    /// Return the names of the active vertex attributes of a program.
+    void ProgramAttributes(unsigned program, std::vector<std::string>& names) override;
+    /// Return the active uniforms of a program.
+    void ProgramUniforms(unsigned program, std::vector<UniformInfo>& uniforms) override;
+    /// Set integer uniform values of the used program.
+    void SetUniformInts(int location, const int* values, size_t count) override;
+    /// Return the names of the uniform blocks of a program.
+    void ProgramUniformBlocks(unsigned program, std::vector<std::string>& names) override;
+    /// Bind a uniform block of a program to a uniform buffer slot.
+    void SetUniformBlockBinding(unsigned program, size_t blockIndex, size_t binding) override;
+    /// Return the names of the storage blocks of a program.
+    void ProgramStorageBlocks(unsigned program, std::vector<std::string>& names) override;
+    /// Bind a storage block of a program to a storage buffer slot.
+    void SetStorageBlockBinding(unsigned program, size_t blockIndex, size_t binding) override;
+
+private:
+    /// Active texture unit.
+    size_t activeTextureUnit;
+    /// Binding targets of the texture units, or zero if unbound.
+    unsigned activeTargets[MAX_TEXTURE_UNITS];
+};
@@ -0,0 +1,115 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "GPUProfiler.h"
+
+#include <glew.h>
+#include <vector>
+
+/// GPU block waiting for its timestamps.
+struct PendingGPUBlock
+{
+    /// Block name.
+    const char* name;
+    /// Begin timestamp query.
+    unsigned beginQuery;
+    /// End timestamp query.
+    unsigned endQuery;
+    /// Whether has ended.
+    bool ended;
+};
+
+static std::vector<unsigned> freeQueries;
+static std::vector<PendingGPUBlock> pendingBlocks;
+static std::vector<size_t> openBlocks;
+static bool enabled = false;
+
+/// Return a timestamp query from the pool, creating if necessary.
+static unsigned GetQuery()
+{
+    unsigned query;
+    if (freeQueries.size())
+    {
+        query = freeQueries.back();
+        freeQueries.pop_back();
+    }
+    else
+        glGenQueries(1, &query);
+
+    return query;
+}
+
+void GPUProfiler::SetEnabled(bool enable)
+{
+    enabled = enable;
+}
+
+void GPUProfiler::BeginBlock(const char* name)
+{
+    PendingGPUBlock block;
+    block.name = name;
+    block.beginQuery = GetQuery();
+    block.endQuery = GetQuery();
+    block.ended = false;
+    glQueryCounter(block.beginQuery, GL_TIMESTAMP);
+
+    openBlocks.push_back(pendingBlocks.size());
+    pendingBlocks.push_back(block);
+}
+
+void GPUProfiler::EndBlock()
+{
+    if (openBlocks.empty())
+        return;
+
+    PendingGPUBlock& block = pendingBlocks[openBlocks.back()];
+    glQueryCounter(block.endQuery, GL_TIMESTAMP);
+    block.ended = true;
+    openBlocks.pop_back();
+}
+
+void GPUProfiler::Update()
+{
+    if (pendingBlocks.empty() || !openBlocks.empty())
+        return;
+
+    Profiler* profiler = Object::Subsystem<Profiler>();
+
+    // Map the GPU clock in nanoseconds to the profiler time in ticks now. The clocks drift slowly, so the mapping is good for the recent queries
+    GLint64 gpuTime = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+    long long offset = profiler ? profiler->EventTime() - HiresTimer::NSecToTicks(gpuTime) : 0;
+
+    // The queries finish in order, so stop at the first that is not available yet
+    size_t numDone = 0;
+    for (; numDone < pendingBlocks.size(); ++numDone)
+    {
+        PendingGPUBlock& block = pendingBlocks[numDone];
+        GLint available = 0;
+        glGetQueryObjectiv(block.endQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 beginTime = 0;
+        GLuint64 endTime = 0;
+        glGetQueryObjectui64v(block.beginQuery, GL_QUERY_RESULT, &beginTime);
+        glGetQueryObjectui64v(block.endQuery, GL_QUERY_RESULT, &endTime);
+        if (profiler)
+            profiler->AddGPUBlock(block.name, HiresTimer::NSecToTicks((long long)beginTime) + offset, HiresTimer::NSecToTicks((long long)endTime) + offset);
+
+        freeQueries.push_back(block.beginQuery);
+        freeQueries.push_back(block.endQuery);
+    }
+
+    pendingBlocks.erase(pendingBlocks.begin(), pendingBlocks.begin() + numDone);
+}
+
+bool GPUProfiler::IsEnabled()
+{
+    return enabled;
+}
+
+bool GPUProfiler::IsActive()
+{
+    Profiler* profiler = Object::Subsystem<Profiler>();
+    return profiler && (enabled || profiler->IsCapturing()) && (GLEW_VERSION_3_3 || GLEW_ARB_timer_query);
+}
@@ -0,0 +1,54 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Time/Profiler.h"
+
+/// GPU timestamp queries for named regions, reported in the profiler's GPU block tree and trace capture. Timestamps are used instead of elapsed time queries so that the regions can nest. The queries are pooled and read back a few frames late without stalling when presenting.
+class GPUProfiler
+{
+public:
+    /// Set whether to measure GPU blocks for the profiler output. They are always measured while the profiler is capturing a trace.
+    static void SetEnabled(bool enable);
+    /// Begin a GPU block. The name must be persistent; string literals are recommended.
+    static void BeginBlock(const char* name);
+    /// End the current GPU block.
+    static void EndBlock();
+    /// Add the finished blocks to the profiler. Called by Graphics when presenting.
+    static void Update();
+
+    /// Return whether GPU blocks are measured for the profiler output.
+    static bool IsEnabled();
+    /// Return whether GPU blocks are measured: enabled or the profiler is capturing, and timestamp queries are supported.
+    static bool IsActive();
+};
+
+/// Helper class for automatically beginning and ending a GPU profiling block.
+class AutoGPUProfileBlock
+{
+public:
+    /// Construct and begin a GPU profiling block if measuring. The name must be persistent; string literals are recommended.
+    AutoGPUProfileBlock(const char* name) :
+        active(GPUProfiler::IsActive())
+    {
+        if (active)
+            GPUProfiler::BeginBlock(name);
+    }
+
+    /// Destruct. End the GPU profiling block.
+    ~AutoGPUProfileBlock()
+    {
+        if (active)
+            GPUProfiler::EndBlock();
+    }
+
+private:
+    /// Whether the block was begun.
+    bool active;
+};
+
+#ifdef USE_PROFILER
+#define PROFILE_GPU(name) AutoGPUProfileBlock gpuProfile_ ## name (#name)
+#else
+#define PROFILE_GPU(name)
+#endif
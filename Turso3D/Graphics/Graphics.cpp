@@ -2,12 +2,15 @@
 
 #include "../IO/Log.h"
 #include "../Time/Profiler.h"
+#include "GLGraphicsBackend.h"
+#include "GPUProfiler.h"
 #include "Graphics.h"
 #include "Shader.h"
 #include "Texture.h"
+#include "TextureUploadBuffer.h"
+#include "VertexArrayCache.h"
 
 #include <SDL.h>
-#include <glew.h>
 
 #ifdef WIN32
 #include <Windows.h>
@@ -18,38 +21,83 @@ extern "C" {
 }
 #endif
 
-Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize) :
+/// Render state items pending a flush.
+static const unsigned STATE_BLEND = 0x1;
+static const unsigned STATE_CULL = 0x2;
+static const unsigned STATE_DEPTHTEST = 0x4;
+static const unsigned STATE_COLORWRITE = 0x8;
+static const unsigned STATE_DEPTHWRITE = 0x10;
+static const unsigned STATE_DEPTHBIAS = 0x20;
+static const unsigned STATE_VIEWPORT = 0x40;
+static const unsigned STATE_SCISSOR = 0x80;
+static const unsigned STATE_ALL = 0xff;
+
+GraphicsStateStats Graphics::stateStats;
+
+/// Time before a frame-rate limited swap to stop sleeping and spin instead, to compensate for OS sleep granularity.
+static const long long SPIN_TIME_USEC = 2000;
+/// Timeout for waiting on a frame fence.
+static const unsigned long long FENCE_TIMEOUT_NSEC = 1000000000;
+
+Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, bool headless_, int eglDevice) :
     window(nullptr),
     context(nullptr),
-    vsync(false)
+    presentMode(PRESENT_IMMEDIATE),
+    maxFrameRate(0),
+    maxFramesInFlight(0),
+    nextSwapTime(0),
+    inputPending(false),
+    inputFence(nullptr),
+    inputLatency(0.0f),
+    pendingStates(STATE_ALL),
+    stateKnown(false),
+    headless(headless_)
 {
+    pendingState.blendMode = BLEND_REPLACE;
+    pendingState.cullMode = CULL_BACK;
+    pendingState.depthTest = CMP_LESS;
+    pendingState.colorWrite = true;
+    pendingState.depthWrite = true;
+    pendingState.constantBias = 0.0f;
+    pendingState.slopeScaleBias = 0.0f;
+    pendingState.scissorTest = false;
+    pendingState.clearColor = Color::BLACK;
+    currentState = pendingState;
+
     RegisterSubsystem(this);
     RegisterGraphicsLibrary();
 
     SDL_SetHint(SDL_HINT_WINDOWS_DPI_AWARENESS, "system");
+    if (headless)
+    {
+        // The offscreen driver creates the contexts on an EGL device with a pbuffer surface. SDL reads the device index from a hint literally named as below
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+        if (eglDevice >= 0)
+            SDL_SetHint("SDL_HINT_EGL_DEVICE", std::to_string(eglDevice).c_str());
+    }
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 
-    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-    SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
-    SDL_GL_SetAttribute(SDL_GL_STENCIL_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
-    SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 0);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLEBUFFERS, 0);
-    SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, 0);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+    // OpenGL is the only rendering API implemented
+    backend = new GLGraphicsBackend();
+    backend->SetWindowAttributes(headless);
 
-    window = SDL_CreateWindow(windowTitle, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowSize.x, windowSize.y, SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI);
+    window = SDL_CreateWindow(windowTitle, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, windowSize.x, windowSize.y, backend->WindowFlags() |
+        (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_ALLOW_HIGHDPI));
+    if (!window)
+        LOGERRORF("Could not open %s window: %s", headless ? "headless" : "application", SDL_GetError());
 }
 
 Graphics::~Graphics()
 {
     if (context)
     {
-        SDL_GL_DeleteContext(context);
+        for (auto it = frameFences.begin(); it != frameFences.end(); ++it)
+            backend->DestroyFence(*it);
+        frameFences.clear();
+
+        uploadBuffer.Reset();
+        VertexArrayCache::Clear();
+        backend->DestroyContext(context);
         context = nullptr;
     }
 
@@ -76,32 +124,18 @@ bool Graphics::Initialize()
         return false;
     }
 
-    context = SDL_GL_CreateContext(window);
+    context = backend->CreateContext(window, headless);
     if (!context)
-    {
-        LOGERROR("Could not create OpenGL 3.2 context");
         return false;
-    }
 
-    GLenum err = glewInit();
-    if (err != GLEW_OK || !GLEW_VERSION_3_2)
-    {
-        LOGERROR("Could not initialize OpenGL 3.2");
-        return false;
-    }
-
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_MULTISAMPLE);
-    glClearDepth(1.0f);
-    glDepthRange(0.0f, 1.0f);
+    VertexArrayCache::Initialize();
 
-    GLuint defaultVao;
-    glGenVertexArrays(1, &defaultVao);
-    glBindVertexArray(defaultVao);
+    // Issue all state on the first flush
+    IntVector2 renderSize = RenderSize();
+    pendingState.viewport = IntRect(0, 0, renderSize.x, renderSize.y);
+    ResetState();
 
-    SetVSync(vsync);
+    SetPresentMode(presentMode);
 
     return true;
 }
@@ -113,23 +147,353 @@ void Graphics::Resize(const IntVector2& size)
 
 void Graphics::SetFullscreen(bool enable)
 {
+    if (headless)
+        return;
+
     SDL_SetWindowFullscreen(window, enable ? SDL_WINDOW_FULLSCREEN : 0);
 }
 
 void Graphics::SetVSync(bool enable)
+{
+    SetPresentMode(enable ? PRESENT_VSYNC : PRESENT_IMMEDIATE);
+}
+
+void Graphics::SetPresentMode(PresentMode mode)
 {
     if (IsInitialized())
     {
-        SDL_GL_SetSwapInterval(enable ? 1 : 0);
-        vsync = enable;
+        if (mode == PRESENT_ADAPTIVE_VSYNC && !backend->SetSwapInterval(-1))
+        {
+            LOGWARNING("Adaptive vertical sync not supported, using vertical sync");
+            mode = PRESENT_VSYNC;
+        }
+        if (mode != PRESENT_ADAPTIVE_VSYNC)
+            backend->SetSwapInterval(mode == PRESENT_VSYNC ? 1 : 0);
+        presentMode = mode;
+    }
+}
+
+void Graphics::SetMaxFrameRate(int fps)
+{
+    maxFrameRate = fps > 0 ? fps : 0;
+    nextSwapTime = 0;
+}
+
+void Graphics::SetMaxFramesInFlight(int frames)
+{
+    maxFramesInFlight = frames > 0 ? frames : 0;
+}
+
+bool Graphics::SetTextureUploadBufferSize(size_t size)
+{
+    if (!size)
+    {
+        uploadBuffer.Reset();
+        return true;
+    }
+
+    if (!IsInitialized())
+    {
+        LOGERROR("Rendering context must be initialized before creating the texture upload buffer");
+        return false;
+    }
+
+    if (!uploadBuffer)
+        uploadBuffer = new TextureUploadBuffer();
+    if (!uploadBuffer->Define(size))
+    {
+        uploadBuffer.Reset();
+        return false;
+    }
+
+    return true;
+}
+
+void Graphics::MarkInput()
+{
+    // Measure from the first input event of a frame
+    if (!inputPending)
+    {
+        inputTimer.Reset();
+        inputPending = true;
+    }
+}
+
+void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite)
+{
+    pendingState.blendMode = blendMode;
+    pendingState.cullMode = cullMode;
+    pendingState.depthTest = depthTest;
+    pendingState.colorWrite = colorWrite;
+    pendingState.depthWrite = depthWrite;
+    pendingStates |= STATE_BLEND | STATE_CULL | STATE_DEPTHTEST | STATE_COLORWRITE | STATE_DEPTHWRITE;
+}
+
+void Graphics::SetDepthBias(float constantBias, float slopeScaleBias)
+{
+    pendingState.constantBias = constantBias;
+    pendingState.slopeScaleBias = slopeScaleBias;
+    pendingStates |= STATE_DEPTHBIAS;
+}
+
+void Graphics::SetViewport(const IntRect& viewRect)
+{
+    pendingState.viewport = viewRect;
+    pendingStates |= STATE_VIEWPORT;
+}
+
+void Graphics::SetScissor(bool enable, const IntRect& scissorRect)
+{
+    pendingState.scissorTest = enable;
+    pendingState.scissorRect = scissorRect;
+    pendingStates |= STATE_SCISSOR;
+}
+
+unsigned Graphics::FlushState()
+{
+    if (!pendingStates)
+        return 0;
+
+    const RenderState& pending = pendingState;
+    RenderState& current = currentState;
+    unsigned changes = 0;
+    unsigned filtered = 0;
+
+    if (pendingStates & STATE_BLEND)
+    {
+        if (!stateKnown || pending.blendMode != current.blendMode)
+        {
+            if (pending.blendMode == BLEND_REPLACE)
+                backend->SetBlendEnabled(false);
+            else
+            {
+                if (!stateKnown || current.blendMode == BLEND_REPLACE)
+                    backend->SetBlendEnabled(true);
+                backend->SetBlendMode(pending.blendMode);
+            }
+            current.blendMode = pending.blendMode;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_CULL)
+    {
+        if (!stateKnown || pending.cullMode != current.cullMode)
+        {
+            if (pending.cullMode == CULL_NONE)
+                backend->SetCullEnabled(false);
+            else
+            {
+                if (!stateKnown || current.cullMode == CULL_NONE)
+                    backend->SetCullEnabled(true);
+                backend->SetCullMode(pending.cullMode);
+            }
+            current.cullMode = pending.cullMode;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_DEPTHTEST)
+    {
+        if (!stateKnown || pending.depthTest != current.depthTest)
+        {
+            backend->SetDepthTest(pending.depthTest);
+            current.depthTest = pending.depthTest;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_COLORWRITE)
+    {
+        if (!stateKnown || pending.colorWrite != current.colorWrite)
+        {
+            backend->SetColorWrite(pending.colorWrite);
+            current.colorWrite = pending.colorWrite;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_DEPTHWRITE)
+    {
+        if (!stateKnown || pending.depthWrite != current.depthWrite)
+        {
+            backend->SetDepthWrite(pending.depthWrite);
+            current.depthWrite = pending.depthWrite;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_DEPTHBIAS)
+    {
+        bool enable = pending.constantBias > 0.0f || pending.slopeScaleBias > 0.0f;
+        bool enabled = current.constantBias > 0.0f || current.slopeScaleBias > 0.0f;
+
+        if (!stateKnown || enable != enabled || (enable && (pending.constantBias != current.constantBias ||
+            pending.slopeScaleBias != current.slopeScaleBias)))
+        {
+            if (!enable)
+                backend->SetDepthBiasEnabled(false);
+            else
+            {
+                if (!stateKnown || !enabled)
+                    backend->SetDepthBiasEnabled(true);
+                backend->SetDepthBias(pending.constantBias, pending.slopeScaleBias);
+            }
+            current.constantBias = pending.constantBias;
+            current.slopeScaleBias = pending.slopeScaleBias;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_VIEWPORT)
+    {
+        if (!stateKnown || pending.viewport != current.viewport)
+        {
+            backend->SetViewport(pending.viewport);
+            current.viewport = pending.viewport;
+            ++changes;
+        }
+        else
+            ++filtered;
+    }
+
+    if (pendingStates & STATE_SCISSOR)
+    {
+        if (!stateKnown || pending.scissorTest != current.scissorTest || (pending.scissorTest && pending.scissorRect != current.scissorRect))
+        {
+            if (!pending.scissorTest)
+                backend->SetScissorEnabled(false);
+            else
+            {
+                if (!stateKnown || !current.scissorTest)
+                    backend->SetScissorEnabled(true);
+                backend->SetScissorRect(pending.scissorRect);
+            }
+            current.scissorTest = pending.scissorTest;
+            current.scissorRect = pending.scissorRect;
+            ++changes;
+        }
+        else
+            ++filtered;
     }
+
+    pendingStates = 0;
+    stateKnown = true;
+    stateStats.stateChanges += changes;
+    stateStats.filteredStateChanges += filtered;
+    return changes;
+}
+
+void Graphics::Clear(bool clearColor, bool clearDepth, const IntRect& clearRect, const Color& backgroundColor)
+{
+    if (clearColor)
+    {
+        // The clear color is not used for drawing, so it is set immediately
+        if (!stateKnown || backgroundColor != currentState.clearColor)
+        {
+            backend->SetClearColor(backgroundColor);
+            currentState.clearColor = backgroundColor;
+            ++stateStats.stateChanges;
+        }
+        else
+            ++stateStats.filteredStateChanges;
+
+        pendingState.colorWrite = true;
+        pendingStates |= STATE_COLORWRITE;
+    }
+    if (clearDepth)
+    {
+        pendingState.depthWrite = true;
+        pendingStates |= STATE_DEPTHWRITE;
+    }
+
+    // Restrict to the rectangle with the scissor test, and restore the previous scissor state for the next flush
+    bool scissorTest = pendingState.scissorTest;
+    IntRect scissorRect = pendingState.scissorRect;
+    SetScissor(clearRect != IntRect::ZERO, clearRect);
+    FlushState();
+    backend->Clear(clearColor, clearDepth);
+    SetScissor(scissorTest, scissorRect);
+}
+
+void Graphics::ResetState()
+{
+    stateKnown = false;
+    pendingStates = STATE_ALL;
 }
 
 void Graphics::Present()
 {
     PROFILE(Present);
 
-    SDL_GL_SwapWindow(window);
+    if (maxFrameRate > 0)
+    {
+        long long interval = 1000000LL / maxFrameRate;
+        long long now = paceTimer.ElapsedUSec();
+
+        // Restart the pacing if a frame took longer than the interval, instead of rushing to catch up
+        if (!nextSwapTime || now > nextSwapTime + interval)
+            nextSwapTime = now;
+
+        while (nextSwapTime - now > SPIN_TIME_USEC)
+        {
+            SDL_Delay((unsigned)((nextSwapTime - now - SPIN_TIME_USEC) / 1000) + 1);
+            now = paceTimer.ElapsedUSec();
+        }
+        while (now < nextSwapTime)
+            now = paceTimer.ElapsedUSec();
+
+        nextSwapTime += interval;
+    }
+
+    // A headless pbuffer has nothing to swap, but the frame is still flushed and fenced for the frames in flight limit
+    if (!headless)
+        backend->SwapBuffers(window);
+    else
+        backend->Flush();
+    GPUProfiler::Update();
+    if (uploadBuffer)
+        uploadBuffer->Update();
+
+    frameFences.push_back(backend->CreateFence());
+    if (inputPending)
+    {
+        inputFence = frameFences.back();
+        inputPending = false;
+    }
+
+    // Retire the completed frames, and wait for the oldest while over the limit
+    size_t maxFences = maxFramesInFlight > 0 ? maxFramesInFlight : MAX_PENDING_FENCES;
+    while (!frameFences.empty())
+    {
+        bool overLimit = frameFences.size() > maxFences;
+        bool wait = overLimit && maxFramesInFlight > 0;
+        bool complete = backend->WaitFence(frameFences.front(), wait, FENCE_TIMEOUT_NSEC);
+        if (!complete && !overLimit)
+            break;
+
+        if (frameFences.front() == inputFence)
+        {
+            if (complete)
+                inputLatency = inputTimer.ElapsedUSec() * 0.001f;
+            inputFence = nullptr;
+        }
+
+        backend->DestroyFence(frameFences.front());
+        frameFences.erase(frameFences.begin());
+    }
 }
 
 IntVector2 Graphics::Size() const
@@ -141,9 +505,7 @@ IntVector2 Graphics::Size() const
 
 IntVector2 Graphics::RenderSize() const
 {
-    IntVector2 size;
-    SDL_GL_GetDrawableSize(window, &size.x, &size.y);
-    return size;
+    return backend->RenderSize(window);
 }
 
 bool Graphics::IsFullscreen() const
@@ -3,20 +3,93 @@
 #pragma once
 
 #include "../Math/Color.h"
+#include "../Math/IntRect.h"
 #include "../Math/IntVector2.h"
+#include "../Object/AutoPtr.h"
 #include "../Object/Object.h"
+#include "../Time/Timer.h"
 #include "GraphicsDefs.h"
 
+#include <vector>
+
 struct SDL_Window;
+class GraphicsBackend;
+class TextureUploadBuffer;
+
+/// Maximum number of frame fences kept pending when the frames in flight are not limited.
+static const size_t MAX_PENDING_FENCES = 8;
+
+/// Buffer swap synchronization modes.
+enum PresentMode
+{
+    PRESENT_IMMEDIATE = 0,
+    PRESENT_VSYNC,
+    PRESENT_ADAPTIVE_VSYNC
+};
+
+/// Counts of OpenGL state changes and object bindings, and of those filtered as redundant by the shadow state.
+struct GraphicsStateStats
+{
+    /// Construct with zero counts.
+    GraphicsStateStats()
+    {
+        Reset();
+    }
+
+    /// Reset all counts to zero.
+    void Reset()
+    {
+        stateChanges = 0;
+        filteredStateChanges = 0;
+        bindings = 0;
+        filteredBindings = 0;
+    }
 
-/// %Graphics rendering context and application window.
+    /// Render state, viewport and scissor changes issued.
+    unsigned long long stateChanges;
+    /// Render state, viewport and scissor changes filtered.
+    unsigned long long filteredStateChanges;
+    /// Program, framebuffer, buffer and texture bindings issued.
+    unsigned long long bindings;
+    /// Program, framebuffer, buffer and texture bindings filtered.
+    unsigned long long filteredBindings;
+};
+
+/// Fixed-function render state tracked by Graphics.
+struct RenderState
+{
+    /// Blend mode.
+    BlendMode blendMode;
+    /// Culling mode.
+    CullMode cullMode;
+    /// Depth test mode.
+    CompareMode depthTest;
+    /// Color write flag.
+    bool colorWrite;
+    /// Depth write flag.
+    bool depthWrite;
+    /// Constant depth bias.
+    float constantBias;
+    /// Slope-scaled depth bias.
+    float slopeScaleBias;
+    /// Viewport rectangle.
+    IntRect viewport;
+    /// Scissor test flag.
+    bool scissorTest;
+    /// Scissor rectangle.
+    IntRect scissorRect;
+    /// Clear color.
+    Color clearColor;
+};
+
+/// %Graphics rendering context and application window. In headless mode the window is an offscreen EGL pbuffer surface of the window size, so that views can be rendered and read back on servers without a display.
 class Graphics : public Object
 {
     OBJECT(Graphics);
 
 public:
-    /// Create window with initial size and register subsystem and object. Rendering context is not created yet.
-    Graphics(const char* windowTitle, const IntVector2& windowSize);
+    /// Create window with initial size and register subsystem and object. Rendering context is not created yet. Headless mode uses SDL's offscreen video driver, on the EGL device of the given index, or the first that initializes if negative. The headless backbuffer is not resized, so views of other sizes should render to framebuffers and read back with FrameReadback. Graphics has one context per process, so headless throughput should be scaled with one process per context.
+    Graphics(const char* windowTitle, const IntVector2& windowSize, bool headless = false, int eglDevice = -1);
     /// Destruct. Closes the application window.
     ~Graphics();
 
@@ -28,10 +101,38 @@ public:
     void SetFullscreen(bool enable);
     /// Set vertical sync on/off.
     void SetVSync(bool enable);
+    /// Set buffer swap synchronization mode. Adaptive vertical sync swaps immediately when a frame misses the vertical blank; falls back to vertical sync if not supported.
+    void SetPresentMode(PresentMode mode);
+    /// Set maximum frame rate, enforced in Present() by sleeping and spinning until the frame interval has passed. 0 is unlimited.
+    void SetMaxFrameRate(int fps);
+    /// Set maximum number of frames the GPU may have queued after Present() returns, enforced by waiting on a fence of an earlier frame. Lower values reduce latency at the cost of CPU/GPU parallelism. 0 is unlimited.
+    void SetMaxFramesInFlight(int frames);
+    /// Set size of the persistently mapped buffer that loader threads stage texture data into, so that texture uploads do not block on copying client memory. 0 disables. Should be set while no textures are loading. Return true on success.
+    bool SetTextureUploadBufferSize(size_t size);
+    /// Mark the time of an input event, for measuring the latency until the GPU completes the next presented frame.
+    void MarkInput();
     /// Present the contents of the backbuffer.
     void Present();
+    /// Set blend, cull, depth test and write state. Applied on the next FlushState().
+    void SetRenderState(BlendMode blendMode, CullMode cullMode = CULL_BACK, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
+    /// Set depth bias. Disabled if neither value is positive. Applied on the next FlushState().
+    void SetDepthBias(float constantBias = 0.0f, float slopeScaleBias = 0.0f);
+    /// Set viewport rectangle. Applied on the next FlushState().
+    void SetViewport(const IntRect& viewRect);
+    /// Set scissor test. Applied on the next FlushState().
+    void SetScissor(bool enable, const IntRect& scissorRect = IntRect::ZERO);
+    /// Apply the state set since the last flush, issuing OpenGL calls only for what differs from the current state. Call before drawing, clearing or other operations that depend on the state. Return number of state changes issued.
+    unsigned FlushState();
+    /// Clear the color and/or depth of the bound framebuffer, optionally restricted to a rectangle. Enables the color and depth writes being cleared.
+    void Clear(bool clearColor, bool clearDepth, const IntRect& clearRect = IntRect::ZERO, const Color& backgroundColor = Color::BLACK);
+    /// Forget the current state, so that the next flush issues all state. Call after changing the state with direct OpenGL calls.
+    void ResetState();
+    /// Return the state to be applied on the next flush.
+    const RenderState& PendingState() const { return pendingState; }
     /// Return whether is initialized.
     bool IsInitialized() const { return context != nullptr; }
+    /// Return whether is headless.
+    bool IsHeadless() const { return headless; }
     /// Return current window size.
     IntVector2 Size() const;
     /// Return current window width.
@@ -47,17 +148,79 @@ public:
     /// Return whether is fullscreen.
     bool IsFullscreen() const;
     /// Return whether is using vertical sync.
-    bool VSync() const { return vsync; }
+    bool VSync() const { return presentMode != PRESENT_IMMEDIATE; }
+    /// Return buffer swap synchronization mode.
+    PresentMode CurrentPresentMode() const { return presentMode; }
+    /// Return maximum frame rate, 0 if unlimited.
+    int MaxFrameRate() const { return maxFrameRate; }
+    /// Return maximum number of frames in flight, 0 if unlimited.
+    int MaxFramesInFlight() const { return maxFramesInFlight; }
+    /// Return the last measured latency from a marked input event to the completion of the frame presented after it, in milliseconds. This excludes the display scanout, and is measured when the completion is observed on a later Present(), so it can overestimate by up to a frame unless the frames in flight are limited.
+    float InputLatency() const { return inputLatency; }
+    /// Return the texture upload buffer, or null if disabled.
+    TextureUploadBuffer* UploadBuffer() const { return uploadBuffer; }
     /// Return the OS-level window.
     SDL_Window* Window() const { return window; }
+    /// Return the rendering API backend.
+    GraphicsBackend* Backend() const { return backend; }
+
+    /// Count an object binding, or a binding filtered because the object was already bound. Called by the graphics classes.
+    static void CountBinding(bool filtered)
+    {
+        if (filtered)
+            ++stateStats.filteredBindings;
+        else
+            ++stateStats.bindings;
+    }
+    /// Return the rendering API backend of the graphics subsystem. Called by the graphics classes.
+    static GraphicsBackend* CurrentBackend() { return Subsystem<Graphics>()->backend; }
+    /// Return the counts of state changes and bindings since the last reset.
+    static const GraphicsStateStats& StateStats() { return stateStats; }
+    /// Reset the counts of state changes and bindings.
+    static void ResetStateStats() { stateStats.Reset(); }
 
 private:
+    /// Rendering API backend.
+    AutoPtr<GraphicsBackend> backend;
     /// OS-level rendering window.
     SDL_Window* window;
-    /// OpenGL context.
+    /// Rendering context.
     void* context;
-    /// Vertical sync flag.
-    bool vsync;
+    /// Buffer swap synchronization mode.
+    PresentMode presentMode;
+    /// Maximum frame rate, 0 if unlimited.
+    int maxFrameRate;
+    /// Maximum frames in flight, 0 if unlimited.
+    int maxFramesInFlight;
+    /// Running timer for frame pacing.
+    HiresTimer paceTimer;
+    /// Time of the next frame-rate limited swap in microseconds on the pacing timer.
+    long long nextSwapTime;
+    /// Fences of the presented frames not yet known to be complete, oldest first.
+    std::vector<void*> frameFences;
+    /// Timer started by the last marked input event.
+    HiresTimer inputTimer;
+    /// Marked input waiting for the next presented frame flag.
+    bool inputPending;
+    /// Fence of the frame presented after the marked input, or null if not measuring.
+    void* inputFence;
+    /// Last measured input latency in milliseconds.
+    float inputLatency;
+    /// Texture upload buffer.
+    AutoPtr<TextureUploadBuffer> uploadBuffer;
+    /// State to apply on the next flush.
+    RenderState pendingState;
+    /// State in the OpenGL context.
+    RenderState currentState;
+    /// Bitmask of state items set since the last flush.
+    unsigned pendingStates;
+    /// Whether the state in the OpenGL context is known.
+    bool stateKnown;
+    /// Headless mode flag.
+    bool headless;
+
+    /// Counts of state changes and bindings.
+    static GraphicsStateStats stateStats;
 };
 
 /// Register Graphics related object factories and attributes.
@@ -0,0 +1,241 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Color.h"
+#include "../Math/IntBox.h"
+#include "../Math/IntRect.h"
+#include "../Resource/Image.h"
+#include "GraphicsDefs.h"
+
+#include <string>
+#include <vector>
+
+struct SDL_Window;
+
+/// Buffer binding targets.
+enum BufferTarget
+{
+    BUFFER_VERTEX = 0,
+    BUFFER_INDEX,
+    BUFFER_UNIFORM,
+    BUFFER_STORAGE
+};
+
+/// Shader stages.
+enum ShaderStage
+{
+    STAGE_VERTEX = 0,
+    STAGE_FRAGMENT,
+    STAGE_COMPUTE
+};
+
+/// Optional rendering API features.
+enum GraphicsFeature
+{
+    FEATURE_PERSISTENT_BUFFERS = 0,
+    FEATURE_STORAGE_BUFFERS,
+    FEATURE_COMPUTE,
+    FEATURE_IMAGE_LOAD_STORE,
+    FEATURE_INVALIDATE,
+    FEATURE_BINDLESS_TEXTURES,
+    FEATURE_PARALLEL_COMPILE,
+    FEATURE_PROGRAM_BINARIES
+};
+
+/// Kinds of shader uniforms.
+enum UniformKind
+{
+    UNIFORM_VALUE = 0,
+    UNIFORM_SAMPLER,
+    UNIFORM_IMAGE
+};
+
+/// Framebuffer attachment index of the depth buffer. Color attachments are indexed from zero.
+static const size_t DEPTH_ATTACHMENT = MAX_RENDERTARGETS;
+/// Framebuffer attachment index of the stencil buffer.
+static const size_t STENCIL_ATTACHMENT = MAX_RENDERTARGETS + 1;
+
+/// Description of an active uniform in a linked shader program.
+struct UniformInfo
+{
+    /// Name as reported by the rendering API.
+    std::string name;
+    /// Location.
+    int location;
+    /// Number of array elements.
+    int numElements;
+    /// Kind of uniform.
+    UniformKind kind;
+};
+
+/// Rendering API underneath Graphics and the GPU resource classes. The classes keep their own binding caches and statistics and call the backend only for the actual API work. Objects are referred to by nonzero handles. Buffer data and texture edits apply to the object last bound to the target, or to texture unit 0, as the classes bind before editing.
+class GraphicsBackend
+{
+public:
+    /// Destruct.
+    virtual ~GraphicsBackend() {}
+
+    /// Set the context attributes to use for windows created afterward.
+    virtual void SetWindowAttributes(bool headless) = 0;
+    /// Return the SDL window flags the rendering API requires.
+    virtual unsigned WindowFlags() const = 0;
+    /// Create the rendering context for a window and set its initial state. Return the context, or null on failure.
+    virtual void* CreateContext(SDL_Window* window, bool headless) = 0;
+    /// Destroy the rendering context.
+    virtual void DestroyContext(void* context) = 0;
+    /// Set the swap interval: 0 immediate, 1 vertical sync, -1 adaptive vertical sync. Return true on success.
+    virtual bool SetSwapInterval(int interval) = 0;
+    /// Present the backbuffer of the window.
+    virtual void SwapBuffers(SDL_Window* window) = 0;
+    /// Submit queued commands to the GPU without waiting.
+    virtual void Flush() = 0;
+    /// Return the window size in rendering pixels.
+    virtual IntVector2 RenderSize(SDL_Window* window) const = 0;
+    /// Return whether an optional feature is supported.
+    virtual bool IsSupported(GraphicsFeature feature) const = 0;
+    /// Return an identification of the GPU and driver.
+    virtual std::string DeviceString() const = 0;
+    /// Clear pending errors, to check with HasErrors() whether the following operations succeeded.
+    virtual void ClearErrors() = 0;
+    /// Return whether errors were raised since the last check, and clear them.
+    virtual bool HasErrors() = 0;
+
+    /// Enable or disable blending.
+    virtual void SetBlendEnabled(bool enable) = 0;
+    /// Set the blend factors and operation of a blend mode.
+    virtual void SetBlendMode(BlendMode mode) = 0;
+    /// Enable or disable face culling.
+    virtual void SetCullEnabled(bool enable) = 0;
+    /// Set the face culling mode. Clockwise vertices define a front face.
+    virtual void SetCullMode(CullMode mode) = 0;
+    /// Set the depth test comparison.
+    virtual void SetDepthTest(CompareMode mode) = 0;
+    /// Set color write.
+    virtual void SetColorWrite(bool enable) = 0;
+    /// Set depth write.
+    virtual void SetDepthWrite(bool enable) = 0;
+    /// Enable or disable depth bias.
+    virtual void SetDepthBiasEnabled(bool enable) = 0;
+    /// Set constant and slope-scaled depth bias.
+    virtual void SetDepthBias(float constantBias, float slopeScaleBias) = 0;
+    /// Set the viewport rectangle.
+    virtual void SetViewport(const IntRect& rect) = 0;
+    /// Enable or disable the scissor test.
+    virtual void SetScissorEnabled(bool enable) = 0;
+    /// Set the scissor rectangle.
+    virtual void SetScissorRect(const IntRect& rect) = 0;
+    /// Set the clear color.
+    virtual void SetClearColor(const Color& color) = 0;
+    /// Clear the color and/or depth of the bound framebuffer.
+    virtual void Clear(bool clearColor, bool clearDepth) = 0;
+
+    /// Insert a fence after the commands issued so far. Return the fence.
+    virtual void* CreateFence() = 0;
+    /// Return whether a fence has completed, optionally flushing and waiting up to a timeout in nanoseconds.
+    virtual bool WaitFence(void* fence, bool wait, unsigned long long timeoutNsec) = 0;
+    /// Destroy a fence.
+    virtual void DestroyFence(void* fence) = 0;
+
+    /// Create a buffer object. Return the handle, or zero on failure.
+    virtual unsigned CreateBuffer() = 0;
+    /// Destroy a buffer object. A persistent mapping is released with it.
+    virtual void DestroyBuffer(unsigned buffer) = 0;
+    /// Bind a buffer to a target, or zero to unbind.
+    virtual void BindBuffer(BufferTarget target, unsigned buffer) = 0;
+    /// Bind a buffer range to an indexed uniform or storage slot. Zero buffer unbinds.
+    virtual void BindBufferSlot(BufferTarget target, size_t index, unsigned buffer, size_t size) = 0;
+    /// Allocate the storage of the bound buffer with optional initial data. Persistent usage maps it coherently; return the mapping, or null if not persistent or if mapping failed.
+    virtual void* DefineBufferData(BufferTarget target, size_t size, ResourceUsage usage, const void* data) = 0;
+    /// Update a range of the bound buffer.
+    virtual void SetBufferData(BufferTarget target, size_t offset, size_t numBytes, const void* data) = 0;
+    /// Enable or disable a vertex attribute in the bound vertex array.
+    virtual void SetVertexAttributeEnabled(unsigned index, bool enable) = 0;
+    /// Point a vertex attribute to an element of the bound vertex buffer. Normalized integer types always read as normalized floats, and others if the normalize flag is set, as for colors.
+    virtual void SetVertexAttribute(unsigned index, ElementType type, bool normalize, size_t stride, size_t offset) = 0;
+
+    /// Create a texture object. Return the handle, or zero on failure.
+    virtual unsigned CreateTexture() = 0;
+    /// Destroy a texture object, making its bindless handle non-resident first if nonzero.
+    virtual void DestroyTexture(unsigned texture, unsigned long long bindlessHandle) = 0;
+    /// Bind a texture to a texture unit. The unit also becomes the one edited.
+    virtual void BindTexture(size_t unit, TextureType type, int multisample, unsigned texture) = 0;
+    /// Unbind a texture unit.
+    virtual void UnbindTexture(size_t unit) = 0;
+    /// Allocate storage for a mip level of the bound texture without data. Multisampled textures have one level.
+    virtual void DefineTextureLevel(TextureType type, int multisample, size_t level, const IntVector3& size, ImageFormat format) = 0;
+    /// Set data for a region of a mip level of the bound texture. The whole level flag specifies the data to define the level. For cube maps the near coordinate of the box selects the face.
+    virtual void SetTextureData(TextureType type, size_t level, const IntBox& box, ImageFormat format, const void* data, size_t dataSize, bool wholeLevel) = 0;
+    /// Release the storage of a mip level of the bound 2D texture.
+    virtual void ReleaseTextureLevel(size_t level, ImageFormat format) = 0;
+    /// Set the base and maximum mip level of the bound texture.
+    virtual void SetTextureLevels(TextureType type, size_t baseLevel, size_t maxLevel) = 0;
+    /// Set the LOD range of the bound texture.
+    virtual void SetTextureLodRange(TextureType type, float minLod, float maxLod) = 0;
+    /// Set the sampling parameters of the bound texture.
+    virtual void SetTextureSampler(TextureType type, size_t numLevels, TextureFilterMode filter, const TextureAddressMode* addressModes, unsigned maxAnisotropy, const Color& borderColor) = 0;
+    /// Bind a mip level of a texture to an image unit, or zero texture to unbind. Layered binds all slices.
+    virtual void BindImage(size_t unit, unsigned texture, size_t level, bool layered, ImageAccess access, ImageFormat format) = 0;
+    /// Discard the content of a mip level of a texture.
+    virtual void InvalidateTexture(unsigned texture, size_t level) = 0;
+    /// Create and make resident a bindless handle of a texture. Return zero on failure.
+    virtual unsigned long long CreateBindlessHandle(unsigned texture) = 0;
+
+    /// Create a framebuffer object. Return the handle, or zero on failure.
+    virtual unsigned CreateFrameBuffer() = 0;
+    /// Destroy a framebuffer object.
+    virtual void DestroyFrameBuffer(unsigned buffer) = 0;
+    /// Bind a framebuffer for drawing or for reading. Zero is the backbuffer.
+    virtual void BindFrameBuffer(unsigned buffer, bool read) = 0;
+    /// Attach a renderbuffer to the bound draw framebuffer, or zero to detach.
+    virtual void AttachRenderBuffer(size_t attachment, unsigned renderBuffer) = 0;
+    /// Attach a texture to the bound draw framebuffer, or zero to detach. For cube maps the face selects the side.
+    virtual void AttachTexture(size_t attachment, TextureType type, int multisample, size_t face, unsigned texture) = 0;
+    /// Set the color attachments drawn to in the bound draw framebuffer.
+    virtual void SetDrawBuffers(const std::vector<size_t>& attachments) = 0;
+    /// Set a single color attachment drawn to, keeping its index.
+    virtual void SetSingleDrawBuffer(size_t attachment) = 0;
+    /// Set the color attachment read from in the bound read framebuffer.
+    virtual void SetReadBuffer(size_t attachment) = 0;
+    /// Discard the content of attachments of the bound draw framebuffer. The color mask has a bit per color attachment.
+    virtual void InvalidateFrameBuffer(unsigned colorMask, bool depthStencil) = 0;
+    /// Blit a rectangle from the bound read framebuffer to the bound draw framebuffer.
+    virtual void BlitFrameBuffer(const IntRect& srcRect, const IntRect& destRect, bool blitColor, bool blitDepth, TextureFilterMode filter) = 0;
+
+    /// Issue compile of a shader stage without waiting for the result. Return the handle.
+    virtual unsigned CompileShader(ShaderStage stage, const std::string& sourceCode) = 0;
+    /// Return whether a shader compiled, and its compile log.
+    virtual bool ShaderStatus(unsigned shader, std::string& log) = 0;
+    /// Destroy a shader.
+    virtual void DestroyShader(unsigned shader) = 0;
+    /// Issue link of a program from shaders without waiting for the result. Attribute names are bound to their indices; the list ends with null. Return the handle.
+    virtual unsigned LinkProgram(const std::vector<unsigned>& shaders, const char** attributeNames, bool retrievable) = 0;
+    /// Return whether a program linked, and its link log.
+    virtual bool ProgramStatus(unsigned program, std::string& log) = 0;
+    /// Return whether a parallel compile & link of a program has finished. Does not block.
+    virtual bool IsProgramReady(unsigned program) = 0;
+    /// Destroy a program.
+    virtual void DestroyProgram(unsigned program) = 0;
+    /// Use a program for drawing or dispatch.
+    virtual void UseProgram(unsigned program) = 0;
+    /// Let the driver compile and link in parallel with the number of threads it chooses.
+    virtual void EnableParallelCompile() = 0;
+    /// Create a program from a binary. Return the handle, or zero if the binary was rejected.
+    virtual unsigned LoadProgramBinary(unsigned format, const void* data, size_t size) = 0;
+    /// Retrieve the binary of a linked program. Return true on success.
+    virtual bool ProgramBinary(unsigned program, unsigned& format, std::vector<unsigned char>& data) = 0;
+    /// Return the names of the active vertex attributes of a program.
+    virtual void ProgramAttributes(unsigned program, std::vector<std::string>& names) = 0;
+    /// Return the active uniforms of a program.
+    virtual void ProgramUniforms(unsigned program, std::vector<UniformInfo>& uniforms) = 0;
+    /// Set integer uniform values of the used program.
+    virtual void SetUniformInts(int location, const int* values, size_t count) = 0;
+    /// Return the names of the uniform blocks of a program, in block index order.
+    virtual void ProgramUniformBlocks(unsigned program, std::vector<std::string>& names) = 0;
+    /// Bind a uniform block of a program to a uniform buffer slot.
+    virtual void SetUniformBlockBinding(unsigned program, size_t blockIndex, size_t binding) = 0;
+    /// Return the names of the storage blocks of a program, in block index order. Empty if storage buffers are not supported.
+    virtual void ProgramStorageBlocks(unsigned program, std::vector<std::string>& names) = 0;
+    /// Bind a storage block of a program to a storage buffer slot.
+    virtual void SetStorageBlockBinding(unsigned program, size_t blockIndex, size_t binding) = 0;
+};
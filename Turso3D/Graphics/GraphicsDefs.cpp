@@ -11,6 +11,11 @@ const size_t elementSizes[] =
     sizeof(Vector3),
     sizeof(Vector4),
     sizeof(unsigned),
+    2 * sizeof(unsigned short),
+    4 * sizeof(unsigned short),
+    2 * sizeof(short),
+    2 * sizeof(unsigned short),
+    sizeof(unsigned)
 };
 
 const char* elementSemanticNames[] =
@@ -28,6 +33,8 @@ const char* elementSemanticNames[] =
 const char* presetUniformNames[] = 
 {
     "worldMatrix",
+    "instanceData",
+    "prevWorldMatrix",
     "viewMatrix",
     "projectionMatrix",
     "viewProjMatrix",
@@ -10,6 +10,8 @@ static const size_t MAX_MATERIAL_TEXTURE_UNITS = 8;
 static const size_t MAX_TEXTURE_UNITS = 16;
 /// Maximum number of constant buffer slots in use at once.
 static const size_t MAX_CONSTANT_BUFFER_SLOTS = 8;
+/// Maximum number of shader storage buffer slots in use at once.
+static const size_t MAX_STORAGE_BUFFER_SLOTS = 8;
 /// Maximum number of color rendertargets in use at once.
 static const size_t MAX_RENDERTARGETS = 4;
 /// Number of cube map faces.
@@ -24,6 +26,11 @@ enum ElementType
     ELEM_VECTOR3,
     ELEM_VECTOR4,
     ELEM_UBYTE4,
+    ELEM_HALF2,
+    ELEM_HALF4,
+    ELEM_SHORT2N,
+    ELEM_USHORT2N,
+    ELEM_INT2101010N,
     MAX_ELEMENT_TYPES
 };
 
@@ -90,7 +97,8 @@ enum TextureType
 enum ResourceUsage
 {
     USAGE_DEFAULT = 0,
-    USAGE_DYNAMIC
+    USAGE_DYNAMIC,
+    USAGE_PERSISTENT
 };
 
 /// Texture filtering modes.
@@ -116,10 +124,20 @@ enum TextureAddressMode
     ADDRESS_MIRROR_ONCE
 };
 
+/// Image access modes for compute shader image load and store.
+enum ImageAccess
+{
+    IMAGE_READ = 0,
+    IMAGE_WRITE,
+    IMAGE_READ_WRITE
+};
+
 /// Preset uniforms.
 enum PresetUniform
 {
     U_WORLDMATRIX = 0,
+    U_INSTANCEDATA,
+    U_PREVWORLDMATRIX,
     U_VIEWMATRIX,
     U_PROJECTIONMATRIX,
     U_VIEWPROJMATRIX,
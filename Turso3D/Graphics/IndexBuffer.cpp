@@ -1,11 +1,13 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/Log.h"
+#include "../Object/MemoryTracker.h"
 #include "../Time/Profiler.h"
 #include "Graphics.h"
+#include "GraphicsBackend.h"
 #include "IndexBuffer.h"
+#include "VertexArrayCache.h"
 
-#include <glew.h>
 #include <cstring>
 
 static IndexBuffer* boundIndexBuffer = nullptr;
@@ -56,11 +58,14 @@ void IndexBuffer::Release()
 {
     if (buffer)
     {
-        glDeleteBuffers(1, &buffer);
+        Graphics::CurrentBackend()->DestroyBuffer(buffer);
         buffer = 0;
+        MemoryTrackFree(MEMORY_GPU_BUFFER, numIndices * indexSize);
 
         if (boundIndexBuffer == this)
             boundIndexBuffer = nullptr;
+
+        VertexArrayCache::ReleaseBuffer(this);
     }
 }
 
@@ -81,16 +86,18 @@ bool IndexBuffer::SetData(size_t firstIndex, size_t numIndices_, const void* dat
 
     if (buffer)
     {
+        GraphicsBackend* backend = Graphics::CurrentBackend();
+
         Bind(true);
         if (numIndices_ == numIndices)
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+            backend->DefineBufferData(BUFFER_INDEX, numIndices * indexSize, usage, data);
         else if (discard)
         {
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexSize, nullptr, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * indexSize, numIndices_ * indexSize, data);
+            backend->DefineBufferData(BUFFER_INDEX, numIndices * indexSize, usage, nullptr);
+            backend->SetBufferData(BUFFER_INDEX, firstIndex * indexSize, numIndices_ * indexSize, data);
         }
         else
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * indexSize, numIndices_ * indexSize, data);
+            backend->SetBufferData(BUFFER_INDEX, firstIndex * indexSize, numIndices_ * indexSize, data);
     }
 
     return true;
@@ -98,15 +105,19 @@ bool IndexBuffer::SetData(size_t firstIndex, size_t numIndices_, const void* dat
 
 bool IndexBuffer::Create(const void* data)
 {
-    glGenBuffers(1, &buffer);
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    buffer = backend->CreateBuffer();
     if (!buffer)
     {
         LOGERROR("Failed to create index buffer");
         return false;
     }
 
+    MemoryTrackAllocation(MEMORY_GPU_BUFFER, numIndices * indexSize);
+
     Bind(true);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    backend->DefineBufferData(BUFFER_INDEX, numIndices * indexSize, usage, data);
     LOGDEBUGF("Created index buffer numIndices %u indexSize %u", (unsigned)numIndices, (unsigned)indexSize);
 
     return true;
@@ -114,9 +125,18 @@ bool IndexBuffer::Create(const void* data)
 
 void IndexBuffer::Bind(bool force)
 {
-    if (!buffer || (boundIndexBuffer == this && !force))
+    if (!buffer)
         return;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    // The index buffer binding is part of the vertex array state, so also creating and editing must use the default vertex array
+    VertexArrayCache::BindDefault();
+    if (boundIndexBuffer == this && !force)
+    {
+        Graphics::CountBinding(true);
+        return;
+    }
+
+    Graphics::CurrentBackend()->BindBuffer(BUFFER_INDEX, buffer);
     boundIndexBuffer = this;
+    Graphics::CountBinding(false);
 }
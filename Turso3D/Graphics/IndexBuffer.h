@@ -19,7 +19,7 @@ public:
     bool Define(ResourceUsage usage, size_t numIndices, size_t indexSize, const void* data = nullptr);
     /// Redefine buffer data either completely or partially. Return true on success.
     bool SetData(size_t firstIndex, size_t numIndices, const void* data, bool discard = false);
-    /// Bind to use. No-op if already bound, unless force is specified. Force mode is used when editing.
+    /// Bind to use in the default vertex array object. No-op if already bound, unless force is specified. Force mode is used when editing.
     void Bind(bool force = false);
 
     /// Return number of indices.
@@ -1,6 +1,8 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/Log.h"
+#include "../Object/MemoryTracker.h"
+#include "../Resource/Image.h"
 #include "../Time/Profiler.h"
 #include "Graphics.h"
 #include "RenderBuffer.h"
@@ -30,6 +32,7 @@ static const GLenum glInternalFormats[] =
     GL_DEPTH_COMPONENT16,
     GL_DEPTH_COMPONENT32,
     GL_DEPTH24_STENCIL8,
+    GL_DEPTH_COMPONENT32F,
     0,
     0,
     0,
@@ -45,7 +48,8 @@ RenderBuffer::RenderBuffer() :
     buffer(0),
     size(IntVector2::ZERO),
     format(FMT_NONE),
-    multisample(0)
+    multisample(0),
+    trackedMemory(0)
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
 }
@@ -65,6 +69,9 @@ void RenderBuffer::Release()
     {
         glDeleteRenderbuffers(1, &buffer);
         buffer = 0;
+
+        MemoryTrackFree(MEMORY_GPU_TEXTURE, trackedMemory);
+        trackedMemory = 0;
     }
 }
 
@@ -125,5 +132,10 @@ bool RenderBuffer::Define(const IntVector2& size_, ImageFormat format_, int mult
 
     LOGDEBUGF("Created renderbuffer width %d height %d format %d", size.x, size.y, (int)format);
 
+    ImageLevel level;
+    Image::CalculateDataSize(IntVector3(size.x, size.y, 1), format, level);
+    trackedMemory = level.dataSize * multisample;
+    MemoryTrackAllocation(MEMORY_GPU_TEXTURE, trackedMemory);
+
     return true;
 }
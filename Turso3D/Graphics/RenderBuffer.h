@@ -44,4 +44,6 @@ private:
     ImageFormat format;
     /// Multisampling level.
     int multisample;
+    /// GPU memory accounted to the texture category.
+    size_t trackedMemory;
 };
@@ -42,9 +42,14 @@ void Shader::Define(const std::string& code)
     EndLoad();
 }
 
-ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn)
+ShaderProgram* Shader::CreateProgram(const std::string& vsDefines, const std::string& fsDefines)
 {
-    auto hashPair = std::make_pair(StringHash(vsDefinesIn), StringHash(fsDefinesIn));
+    return CreateProgram(vsDefines, fsDefines, HashDefines(vsDefines), HashDefines(fsDefines));
+}
+
+ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn, unsigned long long vsHash, unsigned long long fsHash)
+{
+    auto hashPair = std::make_pair(vsHash, fsHash);
 
     auto it = programs.find(hashPair);
     if (it != programs.end())
@@ -53,10 +58,13 @@ ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::
     // If initially not found, normalize the defines and try again. Remove unused defines
     std::string vsDefines = NormalizeDefines(vsDefinesIn);
     std::string fsDefines = NormalizeDefines(fsDefinesIn);
-    auto normalizedHashPair = std::make_pair(StringHash(vsDefines), StringHash(fsDefines));
+    auto normalizedHashPair = std::make_pair(HashDefines(vsDefines), HashDefines(fsDefines));
     it = programs.find(normalizedHashPair);
     if (it != programs.end())
+    {
+        programs[hashPair] = it->second;
         return it->second.Get();
+    }
 
     ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), vsDefines, fsDefines);
     programs[hashPair] = newVariation;
@@ -64,6 +72,62 @@ ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::
     return newVariation;
 }
 
+ShaderProgram* Shader::FindProgram(unsigned long long vsHash, unsigned long long fsHash) const
+{
+    auto it = programs.find(std::make_pair(vsHash, fsHash));
+    return it != programs.end() ? it->second.Get() : nullptr;
+}
+
+size_t Shader::PrecompilePrograms(const std::vector<ShaderVariation>& variations)
+{
+    PROFILE(PrecompileShaderPrograms);
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    size_t numLinked = 0;
+
+    for (auto it = variations.begin(); it != variations.end(); ++it)
+    {
+        Shader* shader = cache->LoadResource<Shader>(it->shaderName);
+        if (!shader)
+            continue;
+
+        ShaderProgram* program = shader->CreateProgram(it->vsDefines, it->fsDefines);
+        if (program && program->GLProgram())
+            ++numLinked;
+    }
+
+    return numLinked;
+}
+
+unsigned long long Shader::HashDefines(const std::string& defines)
+{
+    unsigned long long ret = 0;
+    unsigned long long defineHash = 14695981039346656037ULL;
+    bool inDefine = false;
+
+    // Hash each define with FNV-1a and sum the hashes
+    for (size_t i = 0; i <= defines.length(); ++i)
+    {
+        char c = i < defines.length() ? defines[i] : ' ';
+        if (c == ' ' || c == '\t')
+        {
+            if (inDefine)
+            {
+                ret += defineHash;
+                defineHash = 14695981039346656037ULL;
+                inDefine = false;
+            }
+        }
+        else
+        {
+            defineHash = (defineHash ^ (unsigned char)c) * 1099511628211ULL;
+            inDefine = true;
+        }
+    }
+
+    return ret;
+}
+
 std::string Shader::NormalizeDefines(const std::string& defines)
 {
     std::string ret;
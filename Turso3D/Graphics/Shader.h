@@ -7,6 +7,17 @@
 
 class ShaderProgram;
 
+/// Description of a shader variation for pre-warming.
+struct ShaderVariation
+{
+    /// %Shader resource name.
+    std::string shaderName;
+    /// Vertex shader defines.
+    std::string vsDefines;
+    /// Fragment shader defines.
+    std::string fsDefines;
+};
+
 /// %Shader resource. Defines shader source code, from which shader programs can be compiled & linked by specifying defines.
 class Shader : public Resource
 {
@@ -25,11 +36,17 @@ public:
     bool BeginLoad(Stream& source) override;
     /// Finish shader loading in the main thread. Return true on success.
     bool EndLoad() override;
+    /// Return CPU memory used by the source code in bytes.
+    size_t CpuMemoryUse() const override { return sourceCode.capacity(); }
 
     /// Define shader from source code. All existing variations are destroyed.
     void Define(const std::string& code);
     /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query.
     ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Create and return a shader program with defines and their hashes from HashDefines(). Existing program is returned if possible.
+    ShaderProgram* CreateProgram(const std::string& vsDefines, const std::string& fsDefines, unsigned long long vsHash, unsigned long long fsHash);
+    /// Return an existing shader program by define hashes, or null if not created yet.
+    ShaderProgram* FindProgram(unsigned long long vsHash, unsigned long long fsHash) const;
     
     /// Return shader source code.
     const std::string& SourceCode() const { return sourceCode; }
@@ -37,12 +54,17 @@ public:
     /// Sort the defines and strip extra spaces to prevent creation of unnecessary duplicate shader variations.
     std::string NormalizeDefines(const std::string& defines);
 
+    /// Load shaders and link a list of variations ahead of rendering, using the program binary cache if enabled. Return number of variations that linked successfully.
+    static size_t PrecompilePrograms(const std::vector<ShaderVariation>& variations);
+    /// Return a 64-bit hash of a space-separated define set. The hash does not depend on the order of the defines, so hashes of define strings can be added together to get the hash of their concatenation.
+    static unsigned long long HashDefines(const std::string& defines);
+
 private:
     /// Process include statements in the shader source code recursively. Return true if successful.
     bool ProcessIncludes(std::string& code, Stream& source);
 
-    /// %Shader programs.
-    std::map<std::pair<StringHash, StringHash>, SharedPtr<ShaderProgram> > programs;
+    /// %Shader programs by vertex and fragment shader define hashes. Shared by all passes using the shader, and kept when the passes reset their programs.
+    std::map<std::pair<unsigned long long, unsigned long long>, SharedPtr<ShaderProgram> > programs;
     /// %Shader source code.
     std::string sourceCode;
 };
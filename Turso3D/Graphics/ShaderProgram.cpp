@@ -1,17 +1,23 @@
 ﻿// For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
+#include "../IO/MappedFile.h"
+#include "../IO/MemoryBuffer.h"
 #include "../Time/Profiler.h"
 #include "Graphics.h"
+#include "GraphicsBackend.h"
 #include "ShaderProgram.h"
 
-#include <glew.h>
-
 #include <cctype>
+#include <cstdlib>
+#include <set>
 
 static ShaderProgram* boundProgram = nullptr;
-
-const size_t MAX_NAME_LENGTH = 256;
+static std::string binaryCacheDir;
+static std::set<unsigned long long> cachedBinaries;
+static bool parallelCompile = false;
 
 const char* attribNames[] =
 {
@@ -26,7 +32,12 @@ const char* attribNames[] =
     "texCoord4",
     "texCoord5",
     "blendWeights",
-    "blendIndices"
+    "blendIndices",
+    "instanceData",
+    "texCoord6",
+    "texCoord7",
+    "texCoord8",
+    nullptr
 };
 
 void CommentOutFunction(std::string& code, const std::string& signature)
@@ -67,8 +78,10 @@ int NumberPostfix(const std::string& string)
 
 ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines) :
     program(0),
-    lastPerViewUniforms(0),
-    lastPerMaterialUniforms(0)
+    vertexShader(0),
+    fragmentShader(0),
+    pendingBinaryKey(0),
+    linkPending(false)
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
 
@@ -88,9 +101,23 @@ ShaderProgram::~ShaderProgram()
 
 void ShaderProgram::Release()
 {
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    if (vertexShader)
+    {
+        backend->DestroyShader(vertexShader);
+        vertexShader = 0;
+    }
+    if (fragmentShader)
+    {
+        backend->DestroyShader(fragmentShader);
+        fragmentShader = 0;
+    }
+    linkPending = false;
+
     if (program)
     {
-        glDeleteProgram(program);
+        backend->DestroyProgram(program);
         program = 0;
 
         if (boundProgram == this)
@@ -102,6 +129,13 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
 {
     PROFILE(CreateShaderProgram);
 
+    // Compute shaders consist of a single stage and use the vertex shader defines
+    if (sourceCode.find("void comp(") != std::string::npos)
+    {
+        CreateCompute(sourceCode, vsDefines);
+        return;
+    }
+
     std::string vsSourceCode;
     vsSourceCode += "#version 150\n";
     vsSourceCode += "#define COMPILEVS\n";
@@ -114,29 +148,6 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     vsSourceCode += sourceCode;
     CommentOutFunction(vsSourceCode, "void frag(");
     ReplaceInPlace(vsSourceCode, "void vert(", "void main(");
-    const char* vsShaderStr = vsSourceCode.c_str();
-    
-    int vsCompiled;
-    unsigned vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &vsShaderStr, nullptr);
-    glCompileShader(vs);
-    glGetShaderiv(vs, GL_COMPILE_STATUS, &vsCompiled);
-
-    {
-        int length, outLength;
-        std::string errorString;
-        
-        glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(vs, 1024, &outLength, &errorString[0]);
-        
-        if (!vsCompiled)
-            LOGERRORF("VS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("VS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
 
     std::string fsSourceCode;
     fsSourceCode += "#version 150\n";
@@ -150,84 +161,163 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     fsSourceCode += sourceCode;
     CommentOutFunction(fsSourceCode, "void vert(");
     ReplaceInPlace(fsSourceCode, "void frag(", "void main(");
-    const char* fsShaderStr = fsSourceCode.c_str();
-
-    int fsCompiled;
-    unsigned fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &fsShaderStr, nullptr);
-    glCompileShader(fs);
-    glGetShaderiv(fs, GL_COMPILE_STATUS, &fsCompiled);
 
+    // Use the cached binary if the same source has been linked before with this driver
+    unsigned long long binaryKey = BinaryCacheKey(vsSourceCode + fsSourceCode);
+    if (LoadBinary(binaryKey))
     {
-        int length, outLength;
-        std::string errorString;
+        QueryUniforms();
+        return;
+    }
+
+    // Issue compile & link without querying status, so that with parallel compile the driver can work in the background
+    GraphicsBackend* backend = Graphics::CurrentBackend();
 
-        glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(fs, 1024, &outLength, &errorString[0]);
+    vertexShader = backend->CompileShader(STAGE_VERTEX, vsSourceCode);
+    fragmentShader = backend->CompileShader(STAGE_FRAGMENT, fsSourceCode);
 
-        if (!fsCompiled)
-            LOGERRORF("FS %s compile error: %s", shaderName.c_str(), errorString.c_str());
+    std::vector<unsigned> shaders;
+    shaders.push_back(vertexShader);
+    shaders.push_back(fragmentShader);
+    program = backend->LinkProgram(shaders, attribNames, binaryCacheDir.length() > 0);
+
+    pendingBinaryKey = binaryKey;
+    linkPending = true;
+
+    if (!parallelCompile)
+        FinishLink();
+}
+
+void ShaderProgram::FinishLink()
+{
+    PROFILE(FinishShaderProgramLink);
+
+    linkPending = false;
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    std::string log;
+
+    bool vsCompiled = backend->ShaderStatus(vertexShader, log);
+    if (!vsCompiled)
+        LOGERRORF("VS %s compile error: %s", shaderName.c_str(), log.c_str());
 #ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("FS %s compile output: %s", shaderName.c_str(), errorString.c_str());
+    else if (log.length() > 1)
+        LOGDEBUGF("VS %s compile output: %s", shaderName.c_str(), log.c_str());
 #endif
-    }
+
+    bool fsCompiled = backend->ShaderStatus(fragmentShader, log);
+    if (!fsCompiled)
+        LOGERRORF("FS %s compile error: %s", shaderName.c_str(), log.c_str());
+#ifdef _DEBUG
+    else if (log.length() > 1)
+        LOGDEBUGF("FS %s compile output: %s", shaderName.c_str(), log.c_str());
+#endif
+
+    backend->DestroyShader(vertexShader);
+    backend->DestroyShader(fragmentShader);
+    vertexShader = 0;
+    fragmentShader = 0;
 
     if (!vsCompiled || !fsCompiled)
     {
-        glDeleteShader(vs);
-        glDeleteShader(fs);
+        backend->DestroyProgram(program);
+        program = 0;
         return;
     }
 
-    program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    for (unsigned i = 0; i < 12; ++i)
-        glBindAttribLocation(program, i, attribNames[i]);
-    
-    glLinkProgram(program);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+    bool linked = backend->ProgramStatus(program, log);
+    if (!linked)
+    {
+        LOGERRORF("Could not link shader %s: %s", shaderName.c_str(), log.c_str());
+        backend->DestroyProgram(program);
+        program = 0;
+        return;
+    }
+#ifdef _DEBUG
+    else if (log.length() > 1)
+        LOGDEBUGF("Shader %s link messages: %s", shaderName.c_str(), log.c_str());
+#endif
 
-    int linked;
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    SaveBinary(pendingBinaryKey);
+    QueryUniforms();
+}
 
+void ShaderProgram::CreateCompute(const std::string& sourceCode, const std::vector<std::string>& defines)
+{
+    if (!IsComputeSupported())
     {
-        int length, outLength;
-        std::string errorString;
+        LOGERRORF("Compute shader %s is not supported", shaderName.c_str());
+        return;
+    }
 
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetProgramInfoLog(program, length, &outLength, &errorString[0]);
+    std::string csSourceCode;
+    csSourceCode += "#version 430\n";
+    csSourceCode += "#define COMPILECS\n";
+    for (size_t i = 0; i < defines.size(); ++i)
+    {
+        csSourceCode += "#define ";
+        csSourceCode += Replace(defines[i], '=', ' ');
+        csSourceCode += "\n";
+    }
+    csSourceCode += sourceCode;
+    ReplaceInPlace(csSourceCode, "void comp(", "void main(");
 
-        if (!linked)
-        {
-            LOGERRORF("Could not link shader %s: %s", shaderName.c_str(), errorString.c_str());
-            glDeleteProgram(program);
-            program = 0;
-            return;
-        }
+    unsigned long long binaryKey = BinaryCacheKey(csSourceCode);
+    if (LoadBinary(binaryKey))
+    {
+        QueryUniforms();
+        return;
+    }
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    std::string log;
+
+    unsigned cs = backend->CompileShader(STAGE_COMPUTE, csSourceCode);
+    bool csCompiled = backend->ShaderStatus(cs, log);
+    if (!csCompiled)
+        LOGERRORF("CS %s compile error: %s", shaderName.c_str(), log.c_str());
 #ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("Shader %s link messages: %s", shaderName.c_str(), errorString.c_str());
+    else if (log.length() > 1)
+        LOGDEBUGF("CS %s compile output: %s", shaderName.c_str(), log.c_str());
 #endif
+
+    if (!csCompiled)
+    {
+        backend->DestroyShader(cs);
+        return;
+    }
+
+    program = backend->LinkProgram(std::vector<unsigned>(1, cs), nullptr, binaryCacheDir.length() > 0);
+    backend->DestroyShader(cs);
+
+    bool linked = backend->ProgramStatus(program, log);
+    if (!linked)
+    {
+        LOGERRORF("Could not link shader %s: %s", shaderName.c_str(), log.c_str());
+        backend->DestroyProgram(program);
+        program = 0;
+        return;
     }
+#ifdef _DEBUG
+    else if (log.length() > 1)
+        LOGDEBUGF("Shader %s link messages: %s", shaderName.c_str(), log.c_str());
+#endif
 
-    char nameBuffer[MAX_NAME_LENGTH];
-    int numAttributes, numUniforms,  nameLength, numElements, numUniformBlocks;
-    GLenum type;
+    SaveBinary(binaryKey);
+    QueryUniforms();
+}
+
+void ShaderProgram::QueryUniforms()
+{
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    std::vector<std::string> names;
 
     attributes = 0;
 
-    glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &numAttributes);
-    for (int i = 0; i < numAttributes; ++i)
+    backend->ProgramAttributes(program, names);
+    for (size_t i = 0; i < names.size(); ++i)
     {
-        glGetActiveAttrib(program, i, (GLsizei)MAX_NAME_LENGTH, &nameLength, &numElements, &type, nameBuffer);
-        
-        std::string name(nameBuffer, nameLength);
-        size_t attribIndex = ListIndex(name.c_str(), attribNames, 0xfffffff);
+        size_t attribIndex = ListIndex(names[i].c_str(), attribNames, 0xfffffff);
         if (attribIndex < 32)
             attributes |= (1 << attribIndex);
     }
@@ -235,17 +325,17 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     uniforms.clear();
 
     Bind(true);
-    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
 
     for (size_t i = 0; i < MAX_PRESET_UNIFORMS; ++i)
         presetUniforms[i] = -1;
 
-    for (int i = 0; i < numUniforms; ++i)
+    std::vector<UniformInfo> uniformInfos;
+    backend->ProgramUniforms(program, uniformInfos);
+    for (size_t i = 0; i < uniformInfos.size(); ++i)
     {
-        glGetActiveUniform(program, i, MAX_NAME_LENGTH, &nameLength, &numElements, &type, nameBuffer);
-        std::string name(nameBuffer, nameLength);
-
-        int location = glGetUniformLocation(program, name.c_str());
+        const UniformInfo& info = uniformInfos[i];
+        std::string name = info.name;
+        int location = info.location;
         ReplaceInPlace(name, "[0]", "");
         uniforms[StringHash(name)] = location;
 
@@ -254,7 +344,7 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
         if (preset < MAX_PRESET_UNIFORMS)
             presetUniforms[preset] = location;
 
-        if ((type >= GL_SAMPLER_1D && type <= GL_SAMPLER_2D_SHADOW) || (type >= GL_SAMPLER_1D_ARRAY && type <= GL_SAMPLER_CUBE_SHADOW) || (type >= GL_INT_SAMPLER_1D && type <= GL_UNSIGNED_INT_SAMPLER_2D_ARRAY))
+        if (info.kind == UNIFORM_SAMPLER)
         {
             // Assign sampler uniforms to a texture unit according to the number appended to the sampler name
             int unit = NumberPostfix(name);
@@ -263,31 +353,43 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
                 continue;
 
             // Array samplers may have multiple elements, assign each sequentially
-            if (numElements > 1)
+            if (info.numElements > 1)
             {
                 std::vector<int> units;
-                for (int j = 0; j < numElements; ++j)
+                for (int j = 0; j < info.numElements; ++j)
                     units.push_back(unit++);
-                glUniform1iv(location, numElements, &units[0]);
+                backend->SetUniformInts(location, &units[0], units.size());
             }
             else
-                glUniform1iv(location, 1, &unit);
+                backend->SetUniformInts(location, &unit, 1);
+        }
+        else if (info.kind == UNIFORM_IMAGE)
+        {
+            // Assign image uniforms without an explicit binding to an image unit the same way. Compute shaders use layout bindings instead
+            int unit = NumberPostfix(name);
+            if (unit >= 0)
+                backend->SetUniformInts(location, &unit, 1);
         }
     }
     
-    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numUniformBlocks);
-    for (int i = 0; i < numUniformBlocks; ++i)
+    backend->ProgramUniformBlocks(program, names);
+    for (size_t i = 0; i < names.size(); ++i)
     {
-        glGetActiveUniformBlockName(program, i, MAX_NAME_LENGTH, &nameLength, nameBuffer);
-        std::string name(nameBuffer, nameLength);
-
-        int blockIndex = glGetUniformBlockIndex(program, name.c_str());
-        int bindingIndex = NumberPostfix(name);
+        int bindingIndex = NumberPostfix(names[i]);
         // If no number postfix in the name, use the block index
         if (bindingIndex < 0)
-            bindingIndex = blockIndex;
+            bindingIndex = (int)i;
             
-        glUniformBlockBinding(program, blockIndex, bindingIndex);
+        backend->SetUniformBlockBinding(program, i, bindingIndex);
+    }
+
+    // Storage blocks with a number postfix are bound like uniform blocks. Others specify their binding in the shader
+    backend->ProgramStorageBlocks(program, names);
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        int bindingIndex = NumberPostfix(names[i]);
+        if (bindingIndex >= 0)
+            backend->SetStorageBlockBinding(program, i, bindingIndex);
     }
 
     LOGDEBUGF("Linked shader program %s", shaderName.c_str());
@@ -311,13 +413,190 @@ int ShaderProgram::Uniform(StringHash name) const
 
 bool ShaderProgram::Bind(bool force)
 {
+    // Binding a program that is still compiling waits for the driver
+    if (linkPending)
+        FinishLink();
     if (!program)
         return false;
 
     if (!force && boundProgram == this)
+    {
+        Graphics::CountBinding(true);
         return true;
+    }
 
-    glUseProgram(program);
+    Graphics::CurrentBackend()->UseProgram(program);
     boundProgram = this;
+    Graphics::CountBinding(false);
+    return true;
+}
+
+bool ShaderProgram::IsReady()
+{
+    if (!linkPending)
+        return true;
+
+    if (!Graphics::CurrentBackend()->IsProgramReady(program))
+        return false;
+
+    FinishLink();
     return true;
+}
+
+bool ShaderProgram::IsParallelCompileSupported()
+{
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_PARALLEL_COMPILE);
+}
+
+void ShaderProgram::SetParallelCompile(bool enable)
+{
+    if (enable && !IsParallelCompileSupported())
+    {
+        LOGERROR("Parallel shader compilation is not supported");
+        enable = false;
+    }
+
+    // Let the driver choose the number of compiler threads
+    if (enable)
+        Graphics::CurrentBackend()->EnableParallelCompile();
+
+    parallelCompile = enable;
+}
+
+bool ShaderProgram::ParallelCompile()
+{
+    return parallelCompile;
+}
+
+ShaderProgram* ShaderProgram::BoundProgram()
+{
+    return boundProgram;
+}
+
+bool ShaderProgram::IsComputeSupported()
+{
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_COMPUTE);
+}
+
+bool ShaderProgram::IsBinarySupported()
+{
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_PROGRAM_BINARIES);
+}
+
+bool ShaderProgram::SetBinaryCacheDir(const std::string& dir)
+{
+    binaryCacheDir.clear();
+    cachedBinaries.clear();
+
+    if (dir.empty())
+        return true;
+    if (!IsBinarySupported())
+    {
+        LOGERROR("Shader program binaries are not supported");
+        return false;
+    }
+
+    std::string cacheDir = AddTrailingSlash(dir);
+    if (!DirExists(cacheDir) && !CreateDir(cacheDir))
+    {
+        LOGERROR("Could not create shader program binary cache directory " + cacheDir);
+        return false;
+    }
+
+    binaryCacheDir = cacheDir;
+
+    std::vector<std::string> fileNames;
+    ScanDir(fileNames, binaryCacheDir, "*.bin", SCAN_FILES);
+    for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
+        cachedBinaries.insert(strtoull(FileName(*it).c_str(), nullptr, 16));
+
+    LOGDEBUGF("Found %u cached shader program binaries", (unsigned)cachedBinaries.size());
+    return true;
+}
+
+const std::string& ShaderProgram::BinaryCacheDir()
+{
+    return binaryCacheDir;
+}
+
+unsigned long long ShaderProgram::BinaryCacheKey(const std::string& sourceCode)
+{
+    static std::string driverString;
+    if (driverString.empty())
+    {
+        driverString = Graphics::CurrentBackend()->DeviceString();
+    }
+
+    // 64-bit FNV-1a over the driver identification and the final source code, which includes the defines
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < driverString.length(); ++i)
+        hash = (hash ^ (unsigned char)driverString[i]) * 1099511628211ULL;
+    for (size_t i = 0; i < sourceCode.length(); ++i)
+        hash = (hash ^ (unsigned char)sourceCode[i]) * 1099511628211ULL;
+
+    return hash;
+}
+
+bool ShaderProgram::LoadBinary(unsigned long long key)
+{
+    if (binaryCacheDir.empty() || cachedBinaries.find(key) == cachedBinaries.end())
+        return false;
+
+    PROFILE(LoadShaderProgramBinary);
+
+    MappedFile file(BinaryFileName(key));
+    if (!file.IsOpen() || file.ReadFileID() != "TSPB" || file.Read<unsigned long long>() != key)
+    {
+        cachedBinaries.erase(key);
+        return false;
+    }
+
+    unsigned format = file.Read<unsigned>();
+    std::vector<unsigned char> storage;
+    MemoryBuffer binary = file.ReadBufferInPlace(storage);
+    if (!binary.Size())
+    {
+        cachedBinaries.erase(key);
+        return false;
+    }
+
+    // The driver may reject binaries, for example after an update. Fall back to compiling from source
+    program = Graphics::CurrentBackend()->LoadProgramBinary(format, binary.Data(), binary.Size());
+    if (!program)
+    {
+        cachedBinaries.erase(key);
+        return false;
+    }
+
+    LOGDEBUGF("Loaded shader program binary %s", shaderName.c_str());
+    return true;
+}
+
+void ShaderProgram::SaveBinary(unsigned long long key)
+{
+    if (binaryCacheDir.empty())
+        return;
+
+    std::vector<unsigned char> binary;
+    unsigned format = 0;
+    if (!Graphics::CurrentBackend()->ProgramBinary(program, format, binary))
+        return;
+
+    File file(BinaryFileName(key), FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        LOGERRORF("Could not write shader program binary %s", shaderName.c_str());
+        return;
+    }
+
+    file.WriteFileID("TSPB");
+    file.Write(key);
+    file.Write(format);
+    file.WriteBuffer(binary);
+    cachedBinaries.insert(key);
+}
+
+std::string ShaderProgram::BinaryFileName(unsigned long long key)
+{
+    return binaryCacheDir + FormatString("%016llx", key) + ".bin";
 }
\ No newline at end of file
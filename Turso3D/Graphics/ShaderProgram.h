@@ -7,7 +7,7 @@
 #include "../Object/Ptr.h"
 #include "GraphicsDefs.h"
 
-/// Linked shader program consisting of vertex and fragment shaders.
+/// Linked shader program consisting of vertex and fragment shaders, or of a compute shader if the source code defines a comp() function.
 class ShaderProgram : public RefCounted
 {
 public:
@@ -16,8 +16,12 @@ public:
     /// Destruct.
     ~ShaderProgram();
 
-    /// Bind to use. No-op if already bound, unless force is specified. Return false if no program is successfully linked.
+    /// Bind to use. No-op if already bound, unless force is specified. Waits for a pending parallel compile to finish. Return false if no program is successfully linked.
     bool Bind(bool force = false);
+    /// Poll whether compile & link has finished, either successfully or not. Does not block.
+    bool IsReady();
+    /// Return whether a parallel compile & link has not been found finished by IsReady() or Bind() yet.
+    bool IsLinkPending() const { return linkPending; }
 
     /// Return shader name concatenated from parent shader name and defines.
     const std::string& ShaderName() const { return shaderName; }
@@ -37,19 +41,54 @@ public:
     /// Return the OpenGL shader program identifier. Zero if not successfully compiled and linked.
     unsigned GLProgram() const { return program; }
 
-    /// Last per-view / per-frame uniform assignment. Used by Renderer.
-    unsigned lastPerViewUniforms;
-    /// Last per-material uniform assignment. Used by Renderer.
-    unsigned lastPerMaterialUniforms;
+    /// Return whether compute shaders are supported.
+    static bool IsComputeSupported();
+    /// Return whether parallel compile & link in the driver is supported.
+    static bool IsParallelCompileSupported();
+    /// Set whether programs created afterward compile in parallel in the driver without blocking. Their status should be polled with IsReady().
+    static void SetParallelCompile(bool enable);
+    /// Return whether parallel compile is enabled.
+    static bool ParallelCompile();
+    /// Return whether retrieving and loading program binaries is supported.
+    static bool IsBinarySupported();
+    /// Set directory of the on-disk program binary cache and scan it for existing binaries. Programs linked afterward are loaded from and stored to it. Empty disables the cache. Return true on success.
+    static bool SetBinaryCacheDir(const std::string& dir);
+    /// Return program binary cache directory, or empty if disabled.
+    static const std::string& BinaryCacheDir();
+    /// Return the currently bound shader program, or null if none.
+    static ShaderProgram* BoundProgram();
 
 private:
     /// Compile & link the shader program.
     void Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines);
+    /// Compile & link a compute shader program.
+    void CreateCompute(const std::string& sourceCode, const std::vector<std::string>& defines);
+    /// Check compile & link status of the vertex and fragment shader program, report errors and query uniforms.
+    void FinishLink();
+    /// Query attributes, uniforms and uniform blocks of the linked program and assign sampler units and block bindings.
+    void QueryUniforms();
     /// Release the linked shader program.
     void Release();
+    /// Create the program from a cached binary. Return true on success.
+    bool LoadBinary(unsigned long long key);
+    /// Store the linked program to the binary cache.
+    void SaveBinary(unsigned long long key);
+
+    /// Return binary cache key for final source code, combined with the driver identification.
+    static unsigned long long BinaryCacheKey(const std::string& sourceCode);
+    /// Return binary cache file name for a key.
+    static std::string BinaryFileName(unsigned long long key);
 
     /// OpenGL shader program identifier.
     unsigned program;
+    /// OpenGL vertex shader identifier while compile is pending.
+    unsigned vertexShader;
+    /// OpenGL fragment shader identifier while compile is pending.
+    unsigned fragmentShader;
+    /// Binary cache key of the pending program.
+    unsigned long long pendingBinaryKey;
+    /// Whether compile & link status has not yet been checked.
+    bool linkPending;
     /// Used vertex attribute bitmask.
     unsigned attributes;
     /// All uniform locations.
@@ -0,0 +1,142 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "Graphics.h"
+#include "ShadingRateImage.h"
+
+#include <SDL.h>
+#include <glew.h>
+
+// GL_NV_shading_rate_image is newer than the bundled GLEW, so its enums and entry points are defined here and loaded through SDL
+#define GL_SHADING_RATE_IMAGE_NV 0x9563
+#define GL_SHADING_RATE_1_INVOCATION_PER_PIXEL_NV 0x9565
+#define GL_SHADING_RATE_1_INVOCATION_PER_2X1_PIXELS_NV 0x9567
+#define GL_SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV 0x9568
+#define GL_SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV 0x956B
+#define GL_SHADING_RATE_IMAGE_TEXEL_WIDTH_NV 0x955C
+#define GL_SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV 0x955D
+
+typedef void (GLAPIENTRY* PFNGLBINDSHADINGRATEIMAGENVPROC)(GLuint texture);
+typedef void (GLAPIENTRY* PFNGLSHADINGRATEIMAGEPALETTENVPROC)(GLuint viewport, GLuint first, GLsizei count, const GLenum* rates);
+
+static PFNGLBINDSHADINGRATEIMAGENVPROC glBindShadingRateImageNV = nullptr;
+static PFNGLSHADINGRATEIMAGEPALETTENVPROC glShadingRateImagePaletteNV = nullptr;
+
+static const GLenum shadingRatePalette[] =
+{
+    GL_SHADING_RATE_1_INVOCATION_PER_PIXEL_NV,
+    GL_SHADING_RATE_1_INVOCATION_PER_2X1_PIXELS_NV,
+    GL_SHADING_RATE_1_INVOCATION_PER_2X2_PIXELS_NV,
+    GL_SHADING_RATE_1_INVOCATION_PER_4X4_PIXELS_NV
+};
+
+ShadingRateImage::ShadingRateImage() :
+    texture(0),
+    size(IntVector2::ZERO),
+    tileSize(IntVector2::ZERO)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+}
+
+ShadingRateImage::~ShadingRateImage()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!Object::Subsystem<Graphics>())
+        return;
+
+    Release();
+}
+
+bool ShadingRateImage::Define(const IntVector2& viewSize)
+{
+    if (!IsSupported())
+    {
+        LOGERROR("Shading rate images are not supported");
+        return false;
+    }
+
+    if (tileSize == IntVector2::ZERO)
+    {
+        glGetIntegerv(GL_SHADING_RATE_IMAGE_TEXEL_WIDTH_NV, &tileSize.x);
+        glGetIntegerv(GL_SHADING_RATE_IMAGE_TEXEL_HEIGHT_NV, &tileSize.y);
+        tileSize.x = Max(tileSize.x, 1);
+        tileSize.y = Max(tileSize.y, 1);
+    }
+
+    IntVector2 newSize((viewSize.x + tileSize.x - 1) / tileSize.x, (viewSize.y + tileSize.y - 1) / tileSize.y);
+    newSize.x = Max(newSize.x, 1);
+    newSize.y = Max(newSize.y, 1);
+    if (texture && newSize == size)
+        return true;
+
+    Release();
+
+    // Create through direct state access, to not disturb the texture unit bindings tracked by Texture
+    glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+    if (!texture)
+    {
+        LOGERROR("Failed to create shading rate image");
+        return false;
+    }
+
+    glTextureStorage2D(texture, 1, GL_R8UI, newSize.x, newSize.y);
+    // Start at full rate until written
+    const GLubyte fullRate = SHADING_RATE_1X1;
+    glClearTexImage(texture, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, &fullRate);
+
+    size = newSize;
+    return true;
+}
+
+void ShadingRateImage::BindImage(size_t unit)
+{
+    if (texture)
+        glBindImageTexture((GLuint)unit, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8UI);
+}
+
+void ShadingRateImage::Enable()
+{
+    if (!texture)
+        return;
+
+    glBindShadingRateImageNV(texture);
+    glShadingRateImagePaletteNV(0, 0, MAX_SHADING_RATES, shadingRatePalette);
+    glEnable(GL_SHADING_RATE_IMAGE_NV);
+}
+
+void ShadingRateImage::Disable()
+{
+    if (!IsSupported())
+        return;
+
+    glDisable(GL_SHADING_RATE_IMAGE_NV);
+    glBindShadingRateImageNV(0);
+}
+
+bool ShadingRateImage::IsSupported()
+{
+    static bool checked = false;
+    static bool supported = false;
+
+    if (!checked)
+    {
+        checked = true;
+        if (GLEW_VERSION_4_5 && SDL_GL_ExtensionSupported("GL_NV_shading_rate_image"))
+        {
+            glBindShadingRateImageNV = (PFNGLBINDSHADINGRATEIMAGENVPROC)SDL_GL_GetProcAddress("glBindShadingRateImageNV");
+            glShadingRateImagePaletteNV = (PFNGLSHADINGRATEIMAGEPALETTENVPROC)SDL_GL_GetProcAddress("glShadingRateImagePaletteNV");
+            supported = glBindShadingRateImageNV && glShadingRateImagePaletteNV;
+        }
+    }
+
+    return supported;
+}
+
+void ShadingRateImage::Release()
+{
+    if (texture)
+    {
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+}
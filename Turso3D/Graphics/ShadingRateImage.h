@@ -0,0 +1,56 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Object/Ptr.h"
+
+/// Shading rate palette indices stored in the shading rate image.
+enum ShadingRate
+{
+    SHADING_RATE_1X1 = 0,
+    SHADING_RATE_2X1,
+    SHADING_RATE_2X2,
+    SHADING_RATE_4X4,
+    MAX_SHADING_RATES
+};
+
+/// Screen-space image of per-tile fragment shading rates for variable-rate shading. Holds a palette index per tile, written for example by a compute shader, which selects one fragment shader invocation per 1x1 up to 4x4 pixels while the image is enabled. Requires GL_NV_shading_rate_image and OpenGL 4.5.
+class ShadingRateImage : public RefCounted
+{
+public:
+    /// Construct. %Graphics subsystem must have been initialized.
+    ShadingRateImage();
+    /// Destruct.
+    ~ShadingRateImage();
+
+    /// Define to cover a view size in pixels. No-op if the tile count stays the same. Return true on success.
+    bool Define(const IntVector2& viewSize);
+    /// Bind for writing the palette indices from a compute shader as an r8ui image.
+    void BindImage(size_t unit);
+    /// Enable for the following draws.
+    void Enable();
+
+    /// Return size in tiles.
+    const IntVector2& Size() const { return size; }
+    /// Return tile size in pixels.
+    const IntVector2& TileSize() const { return tileSize; }
+    /// Return the OpenGL object identifier.
+    unsigned GLTexture() const { return texture; }
+
+    /// Disable variable-rate shading for the following draws.
+    static void Disable();
+    /// Return whether shading rate images are supported. Loads the extension entry points on the first call.
+    static bool IsSupported();
+
+private:
+    /// Release the texture.
+    void Release();
+
+    /// OpenGL object identifier.
+    unsigned texture;
+    /// Size in tiles.
+    IntVector2 size;
+    /// Tile size in pixels.
+    IntVector2 tileSize;
+};
@@ -0,0 +1,148 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../Object/MemoryTracker.h"
+#include "../Time/Profiler.h"
+#include "Graphics.h"
+#include "GraphicsBackend.h"
+#include "StorageBuffer.h"
+
+
+static StorageBuffer* boundStorageBuffers[MAX_STORAGE_BUFFER_SLOTS];
+
+StorageBuffer::StorageBuffer() :
+    buffer(0),
+    size(0),
+    usage(USAGE_DEFAULT)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+}
+
+StorageBuffer::~StorageBuffer()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!Object::Subsystem<Graphics>())
+        return;
+
+    Release();
+}
+
+bool StorageBuffer::Define(ResourceUsage usage_, size_t size_, const void* data)
+{
+    PROFILE(DefineStorageBuffer);
+
+    Release();
+
+    if (!size_)
+    {
+        LOGERROR("Can not define empty storage buffer");
+        return false;
+    }
+    if (!IsSupported())
+    {
+        LOGERROR("Storage buffers are not supported");
+        return false;
+    }
+
+    size = size_;
+    usage = usage_;
+
+    return Create(data);
+}
+
+void StorageBuffer::Release()
+{
+    if (buffer)
+    {
+        Graphics::CurrentBackend()->DestroyBuffer(buffer);
+        buffer = 0;
+        MemoryTrackFree(MEMORY_GPU_BUFFER, size);
+
+        for (size_t i = 0; i < MAX_STORAGE_BUFFER_SLOTS; ++i)
+        {
+            if (boundStorageBuffers[i] == this)
+                boundStorageBuffers[i] = nullptr;
+        }
+    }
+}
+
+bool StorageBuffer::SetData(size_t offset, size_t numBytes, const void* data)
+{
+    PROFILE(UpdateStorageBuffer);
+
+    if (!numBytes)
+        return true;
+
+    if (!data)
+    {
+        LOGERROR("Null source data for updating storage buffer");
+        return false;
+    }
+    if (offset + numBytes > size)
+    {
+        LOGERROR("Out of bounds range for updating storage buffer");
+        return false;
+    }
+
+    if (buffer)
+    {
+        GraphicsBackend* backend = Graphics::CurrentBackend();
+
+        backend->BindBuffer(BUFFER_STORAGE, buffer);
+        if (numBytes == size)
+            backend->DefineBufferData(BUFFER_STORAGE, numBytes, usage, data);
+        else
+            backend->SetBufferData(BUFFER_STORAGE, offset, numBytes, data);
+    }
+
+    return true;
+}
+
+bool StorageBuffer::Create(const void* data)
+{
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    buffer = backend->CreateBuffer();
+    if (!buffer)
+    {
+        LOGERROR("Failed to create storage buffer");
+        return false;
+    }
+
+    MemoryTrackAllocation(MEMORY_GPU_BUFFER, size);
+
+    backend->BindBuffer(BUFFER_STORAGE, buffer);
+    backend->DefineBufferData(BUFFER_STORAGE, size, usage, data);
+    LOGDEBUGF("Created storage buffer size %u", (unsigned)size);
+
+    return true;
+}
+
+void StorageBuffer::Bind(size_t index, bool force)
+{
+    if (!buffer)
+        return;
+    if (boundStorageBuffers[index] == this && !force)
+    {
+        Graphics::CountBinding(true);
+        return;
+    }
+
+    Graphics::CurrentBackend()->BindBufferSlot(BUFFER_STORAGE, index, buffer, size);
+    boundStorageBuffers[index] = this;
+    Graphics::CountBinding(false);
+}
+
+void StorageBuffer::Unbind(size_t index)
+{
+    if (boundStorageBuffers[index])
+    {
+        Graphics::CurrentBackend()->BindBufferSlot(BUFFER_STORAGE, index, 0, 0);
+        boundStorageBuffers[index] = nullptr;
+    }
+}
+
+bool StorageBuffer::IsSupported()
+{
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_STORAGE_BUFFERS);
+}
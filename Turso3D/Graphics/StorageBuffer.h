@@ -0,0 +1,52 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+#include "GraphicsDefs.h"
+
+/// GPU buffer for shader storage data that can be read and written by compute shaders. Requires OpenGL 4.3.
+class StorageBuffer : public RefCounted
+{
+public:
+    /// Construct. %Graphics subsystem must have been initialized.
+    StorageBuffer();
+    /// Destruct.
+    ~StorageBuffer();
+
+    /// Define buffer with byte size. Return true on success.
+    bool Define(ResourceUsage usage, size_t size, const void* data = nullptr);
+    /// Redefine buffer data either completely or partially. Return true on success.
+    bool SetData(size_t offset, size_t numBytes, const void* data);
+    /// Bind to use at a specific shader storage slot. No-op if already bound, unless force is specified.
+    void Bind(size_t index, bool force = false);
+
+    /// Return size of buffer in bytes.
+    size_t Size() const { return size; }
+    /// Return resource usage type.
+    ResourceUsage Usage() const { return usage; }
+    /// Return whether is dynamic.
+    bool IsDynamic() const { return usage == USAGE_DYNAMIC; }
+
+    /// Return the OpenGL object identifier.
+    unsigned GLBuffer() const { return buffer; }
+
+    /// Unbind a slot.
+    static void Unbind(size_t index);
+    /// Return whether shader storage buffers are supported.
+    static bool IsSupported();
+
+private:
+    /// Create the GPU-side buffer. Return true on success.
+    bool Create(const void* data);
+    /// Release the buffer.
+    void Release();
+
+    /// OpenGL object identifier.
+    unsigned buffer;
+    /// Buffer size in bytes.
+    size_t size;
+    /// Resource usage type.
+    ResourceUsage usage;
+};
@@ -1,139 +1,48 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
+#include "../IO/StringUtils.h"
+#include "../Object/MemoryTracker.h"
+#include "../Resource/ResourceCache.h"
 #include "../Time/Profiler.h"
 #include "Graphics.h"
+#include "GraphicsBackend.h"
 #include "Texture.h"
+#include "TextureUploadBuffer.h"
 
-#include <glew.h>
+#include <algorithm>
+#include <cstring>
 
-static size_t activeTextureUnit = 0xffffffff;
-static unsigned activeTargets[MAX_TEXTURE_UNITS];
 static Texture* boundTextures[MAX_TEXTURE_UNITS];
 
-static const GLenum glTargets[] = 
-{
-    GL_TEXTURE_2D,
-    GL_TEXTURE_3D,
-    GL_TEXTURE_CUBE_MAP
-};
-
-static const GLenum glInternalFormats[] =
-{
-    0,
-    GL_R8,
-    GL_RG8,
-    GL_RGBA8,
-    GL_ALPHA,
-    GL_R16,
-    GL_RG16,
-    GL_RGBA16,
-    GL_R16F,
-    GL_RG16F,
-    GL_RGBA16F,
-    GL_R32F,
-    GL_RG32F,
-    GL_RGB32F,
-    GL_RGBA32F,
-    GL_R32UI,
-    GL_RG32UI,
-    GL_RGBA32UI,
-    GL_DEPTH_COMPONENT16,
-    GL_DEPTH_COMPONENT32,
-    GL_DEPTH24_STENCIL8,
-    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-    GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
-    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
-    0,
-    0,
-    0,
-    0,
-    0
-};
-
-static const GLenum glFormats[] =
-{
-    0,
-    GL_RED,
-    GL_RG,
-    GL_RGBA,
-    GL_ALPHA,
-    GL_RED,
-    GL_RG,
-    GL_RGBA,
-    GL_RED,
-    GL_RG,
-    GL_RGBA,
-    GL_RED,
-    GL_RG,
-    GL_RGB,
-    GL_RGBA,
-    GL_RED_INTEGER,
-    GL_RG_INTEGER,
-    GL_RGBA_INTEGER,
-    GL_DEPTH_COMPONENT,
-    GL_DEPTH_COMPONENT,
-    GL_DEPTH_STENCIL,
-    GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
-    GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
-    GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
-    0,
-    0,
-    0,
-    0,
-    0
-};
-
-static const GLenum glDataTypes[] =
-{
-    0,
-    GL_UNSIGNED_BYTE,
-    GL_UNSIGNED_BYTE,
-    GL_UNSIGNED_BYTE,
-    GL_UNSIGNED_BYTE,
-    GL_UNSIGNED_SHORT,
-    GL_UNSIGNED_SHORT,
-    GL_UNSIGNED_SHORT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_UNSIGNED_INT,
-    GL_UNSIGNED_INT,
-    GL_UNSIGNED_INT,
-    GL_UNSIGNED_SHORT,
-    GL_UNSIGNED_INT,
-    GL_UNSIGNED_INT_24_8,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0,
-    0
-};
-
-static const GLenum glWrapModes[] =
-{
-    GL_REPEAT,
-    GL_MIRRORED_REPEAT,
-    GL_CLAMP_TO_EDGE,
-    GL_CLAMP_TO_BORDER,
-    GL_MIRROR_CLAMP_EXT
-};
+/// Maximum uncompressed data size uploaded per stepped loading step.
+static const size_t TEXTURE_UPLOAD_CHUNK_SIZE = 1024 * 1024;
+
+/// Largest mip level size resident on load for streamed textures, or 0 if streaming is disabled.
+static int streamingMinSize = 0;
+/// Whether to compress uncompressed RGBA images to DXT on load.
+static bool loadCompression = false;
+/// Directory of the on-disk cache for images compressed on load, or empty if disabled.
+static std::string compressionCacheDir;
 
 Texture::Texture() :
     texture(0),
+    bindlessHandle(0),
     type(TEX_2D),
     usage(USAGE_DEFAULT),
     size(IntVector3::ZERO),
     format(FMT_NONE),
     multisample(0),
-    numLevels(0)
+    numLevels(0),
+    residentLevel(0),
+    streamLevel(0),
+    loadLevel(0),
+    loadRow(-1),
+    stagingBuffer(nullptr),
+    stagingOffset(0),
+    trackedMemory(0)
 {
 }
 
@@ -143,6 +52,7 @@ Texture::~Texture()
     if (!Object::Subsystem<Graphics>())
         return;
 
+    ReleaseStaging(false);
     Release();
 }
 
@@ -152,9 +62,62 @@ void Texture::RegisterObject()
 }
 
 bool Texture::BeginLoad(Stream& source)
+{
+    loadLevel = 0;
+    loadRow = -1;
+    streamLevel = 0;
+    ReleaseStaging(false);
+    if (!LoadImages(source))
+        return false;
+
+    // When streaming, upload only the levels up to the minimum size now. Compressed levels referenced in place are not even read
+    Image* image = loadImages[0];
+    if (streamingMinSize > 0)
+    {
+        size_t totalLevels = 0;
+        for (size_t i = 0; i < loadImages.size(); ++i)
+            totalLevels += loadImages[i]->NumLevels();
+
+        while (streamLevel + 1 < totalLevels && Max(image->Width() >> streamLevel, image->Height() >> streamLevel) > streamingMinSize)
+            ++streamLevel;
+        loadLevel = streamLevel;
+    }
+
+    StageLoadLevels();
+    return true;
+}
+
+bool Texture::LoadImages(Stream& source)
 {
     loadImages.clear();
+
+    // Use the image compressed on an earlier load if the cached file has the same timestamp as the source
+    std::string cacheFileName;
+    unsigned sourceTime = 0;
+    if (loadCompression && compressionCacheDir.length())
+    {
+        ResourceCache* cache = Subsystem<ResourceCache>();
+        sourceTime = cache ? cache->LastModifiedTime(Name()) : 0;
+        if (sourceTime)
+        {
+            cacheFileName = compressionCacheDir + Replace(Replace(Name(), '/', '_'), ':', '_') + ".dds";
+            if (LastModifiedTime(cacheFileName) == sourceTime)
+            {
+                File cacheFile(cacheFileName);
+                AutoPtr<Image> cachedImage(new Image());
+                if (cacheFile.IsOpen() && cachedImage->Load(cacheFile))
+                {
+                    loadImages.push_back(cachedImage);
+                    return true;
+                }
+            }
+        }
+    }
+
     loadImages.push_back(new Image());
+    // The stream stays alive until the images are uploaded, so compressed data can be uploaded directly from it
+    loadImages[0]->SetReferenceSource(true);
+    loadImages[0]->SetReserveMipChain(true);
     if (!loadImages[0]->Load(source))
     {
         loadImages.clear();
@@ -165,22 +128,28 @@ bool Texture::BeginLoad(Stream& source)
     if (loadImages[0]->Format() >= FMT_ETC1)
     {
         Image* rgbaImage = new Image();
+        rgbaImage->SetReserveMipChain(true);
         rgbaImage->SetSize(loadImages[0]->Size(), FMT_RGBA8);
         loadImages[0]->DecompressLevel(rgbaImage->Data(), 0);
         loadImages[0] = rgbaImage; // This destroys the original compressed image
     }
 
     // Construct mip levels now if image is uncompressed
-    if (!loadImages[0]->IsCompressed())
-    {
-        Image* mipImage = loadImages[0];
+    Image* image = loadImages[0];
+    if (!image->IsCompressed())
+        image->GenerateMipChain();
 
-        while (mipImage->Width() > 1 || mipImage->Height() > 1)
+    if (loadCompression && image->Format() == FMT_RGBA8 && image->Compress(image->IsOpaque() ? FMT_DXT1 : FMT_DXT5) &&
+        cacheFileName.length())
+    {
+        File cacheFile(cacheFileName, FILE_WRITE);
+        if (cacheFile.IsOpen() && image->Save(cacheFile))
         {
-            loadImages.push_back(new Image());
-            mipImage->GenerateMipImage(*loadImages.back());
-            mipImage = loadImages.back();
+            cacheFile.Close();
+            SetLastModifiedTime(cacheFileName, sourceTime);
         }
+        else
+            LOGERROR("Could not write compressed image cache file " + cacheFileName);
     }
 
     return true;
@@ -192,35 +161,375 @@ bool Texture::EndLoad()
         return false;
 
     std::vector<ImageLevel> initialData;
+    CollectLoadLevels(initialData);
 
-    for (size_t i = 0; i < loadImages.size(); ++i)
+    bool staged = BindStagedLevels(initialData);
+    Image* image = loadImages[0];
+    bool success = streamLevel ? DefineStreamed(image->Format(), initialData) : Define(TEX_2D, image->Size(), image->Format(), 1,
+        initialData.size(), &initialData[0]);
+    if (staged)
+        TextureUploadBuffer::Unbind();
+    ReleaseStaging(staged);
+    /// \todo Read a parameter file for the sampling parameters
+    success &= DefineSampler(FILTER_TRILINEAR, ADDRESS_WRAP, ADDRESS_WRAP, ADDRESS_WRAP);
+
+    loadImages.clear();
+    return success;
+}
+
+bool Texture::EndLoadStep(bool& success)
+{
+    success = false;
+    if (loadImages.empty())
+        return true;
+
+    // Streamed textures upload only the small levels, so finish in one step
+    if (streamLevel)
     {
-        for (size_t j = 0; j < loadImages[i]->NumLevels(); ++j)
-            initialData.push_back(loadImages[i]->Level(j));
+        success = EndLoad();
+        return true;
+    }
+
+    std::vector<ImageLevel> levels;
+    CollectLoadLevels(levels);
+
+    // Define the storage first without data. For uncompressed formats this allocates the top level for partial updates
+    if (loadRow < 0)
+    {
+        Image* image = loadImages[0];
+        if (!Define(TEX_2D, image->Size(), image->Format(), 1, levels.size()))
+        {
+            ReleaseStaging(false);
+            loadImages.clear();
+            return true;
+        }
+
+        loadRow = 0;
+        return false;
     }
 
+    bool staged = BindStagedLevels(levels);
+    const ImageLevel& level = levels[loadLevel];
+
+    if (loadLevel == 0 && !IsCompressed() && level.dataSize > TEXTURE_UPLOAD_CHUNK_SIZE)
+    {
+        int numRows = Max((int)(TEXTURE_UPLOAD_CHUNK_SIZE / level.rowSize), 1);
+        int endRow = Min(loadRow + numRows, level.size.y);
+        ImageLevel rows(IntVector2(level.size.x, endRow - loadRow), format, level.data + loadRow * level.rowSize);
+        SetData(0, IntRect(0, loadRow, level.size.x, endRow), rows);
+
+        loadRow = endRow;
+    }
+    else
+    {
+        SetData(loadLevel, IntRect(0, 0, level.size.x, level.size.y), level);
+        loadRow = level.size.y;
+    }
+
+    if (staged)
+        TextureUploadBuffer::Unbind();
+    if (loadRow < level.size.y)
+        return false;
+
+    loadRow = 0;
+    ++loadLevel;
+    if (loadLevel < levels.size())
+        return false;
+
+    ReleaseStaging(staged);
+    success = DefineSampler(FILTER_TRILINEAR, ADDRESS_WRAP, ADDRESS_WRAP, ADDRESS_WRAP);
+    loadImages.clear();
+    return true;
+}
+
+bool Texture::BeginLoadLevels(Stream& source, size_t level)
+{
+    ReleaseStaging(false);
+    if (!LoadImages(source))
+        return false;
+
     Image* image = loadImages[0];
-    bool success = Define(TEX_2D, image->Size(), image->Format(), 1, initialData.size(), &initialData[0]);
-    /// \todo Read a parameter file for the sampling parameters
-    success &= DefineSampler(FILTER_TRILINEAR, ADDRESS_WRAP, ADDRESS_WRAP, ADDRESS_WRAP);
+    if (image->Size() != size || image->Format() != format)
+    {
+        LOGERROR("Image " + source.Name() + " no longer matches the streamed texture");
+        loadImages.clear();
+        return false;
+    }
+
+    loadLevel = level;
+    StageLoadLevels();
+    return true;
+}
+
+bool Texture::EndLoadLevels()
+{
+    PROFILE(EndLoadTextureLevels);
+
+    if (loadImages.empty())
+        return false;
+
+    std::vector<ImageLevel> levels;
+    CollectLoadLevels(levels);
+
+    bool success = true;
+    bool staged = BindStagedLevels(levels);
+    size_t newResidentLevel = std::min(loadLevel, residentLevel);
+    for (size_t i = newResidentLevel; i < residentLevel && i < levels.size(); ++i)
+        success &= SetData(i, IntRect(0, 0, levels[i].size.x, levels[i].size.y), levels[i]);
+    if (staged)
+        TextureUploadBuffer::Unbind();
+    ReleaseStaging(staged);
+
+    if (success)
+    {
+        residentLevel = newResidentLevel;
+        Bind(0, true);
+        UpdateLevelRange();
+        UpdateTrackedMemory();
+    }
 
     loadImages.clear();
     return success;
 }
 
+void Texture::ReleaseLevels(size_t level)
+{
+    if (!texture || type != TEX_2D || level <= residentLevel)
+        return;
+    if (level >= numLevels)
+        level = numLevels - 1;
+
+    Bind(0, true);
+
+    // Free the storage of the levels. They are outside the base level, so the texture stays complete
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    for (size_t i = residentLevel; i < level; ++i)
+        backend->ReleaseTextureLevel(i, format);
+
+    residentLevel = level;
+    UpdateLevelRange();
+    UpdateTrackedMemory();
+}
+
+size_t Texture::LevelDataSize(size_t level) const
+{
+    if (level >= numLevels)
+        return 0;
+
+    ImageLevel levelDesc;
+    Image::CalculateDataSize(IntVector3(Max(size.x >> level, 1), Max(size.y >> level, 1), type == TEX_3D ? Max(size.z >> level, 1) : 1), format, levelDesc);
+    return levelDesc.dataSize * (type == TEX_CUBE ? MAX_CUBE_FACES : 1);
+}
+
+size_t Texture::ResidentDataSize() const
+{
+    size_t dataSize = 0;
+    for (size_t i = residentLevel; i < numLevels; ++i)
+        dataSize += LevelDataSize(i);
+    return dataSize;
+}
+
+void Texture::SetStreamingMinSize(int size)
+{
+    streamingMinSize = Max(size, 0);
+}
+
+int Texture::StreamingMinSize()
+{
+    return streamingMinSize;
+}
+
+void Texture::SetLoadCompression(bool enable)
+{
+    loadCompression = enable;
+}
+
+bool Texture::LoadCompression()
+{
+    return loadCompression;
+}
+
+bool Texture::SetCompressionCacheDir(const std::string& dir)
+{
+    compressionCacheDir.clear();
+
+    if (dir.empty())
+        return true;
+
+    std::string cacheDir = AddTrailingSlash(dir);
+    if (!DirExists(cacheDir) && !CreateDir(cacheDir))
+    {
+        LOGERROR("Could not create texture compression cache directory " + cacheDir);
+        return false;
+    }
+
+    compressionCacheDir = cacheDir;
+    return true;
+}
+
+const std::string& Texture::CompressionCacheDir()
+{
+    return compressionCacheDir;
+}
+
+void Texture::CollectLoadLevels(std::vector<ImageLevel>& dest) const
+{
+    for (size_t i = 0; i < loadImages.size(); ++i)
+    {
+        for (size_t j = 0; j < loadImages[i]->NumLevels(); ++j)
+            dest.push_back(loadImages[i]->Level(j));
+    }
+}
+
+bool Texture::DefineStreamed(ImageFormat format_, const std::vector<ImageLevel>& levels)
+{
+    PROFILE(DefineTexture);
+
+    Release();
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    texture = backend->CreateTexture();
+    if (!texture)
+    {
+        size = IntVector3::ZERO;
+        format = FMT_NONE;
+        numLevels = 0;
+        multisample = 0;
+
+        LOGERROR("Failed to create texture");
+        return false;
+    }
+
+    type = TEX_2D;
+    multisample = 1;
+    Bind(0, true);
+
+    size = levels[0].size;
+    format = format_;
+    numLevels = levels.size();
+
+    // Only the levels from the stream level onward get storage
+    backend->ClearErrors();
+    for (size_t i = streamLevel; i < numLevels; ++i)
+        SetData(i, IntRect(0, 0, levels[i].size.x, levels[i].size.y), levels[i]);
+
+    if (backend->HasErrors())
+    {
+        Release();
+        size = IntVector3::ZERO;
+        format = FMT_NONE;
+        numLevels = 0;
+
+        LOGERROR("Failed to create texture");
+        return false;
+    }
+
+    residentLevel = streamLevel;
+    backend->SetTextureLevels(type, residentLevel, numLevels - 1);
+    LOGDEBUGF("Created streamed texture width %d height %d format %d numLevels %d residentLevel %d", size.x, size.y, (int)format, numLevels, residentLevel);
+    UpdateTrackedMemory();
+
+    return true;
+}
+
+void Texture::UpdateLevelRange()
+{
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    // Levels are relative to the base level, so shift the LOD range to keep it in terms of the full mip chain
+    backend->SetTextureLevels(type, residentLevel, type != TEX_3D ? numLevels - 1 : 0);
+    backend->SetTextureLodRange(type, minLod - (float)residentLevel, maxLod - (float)residentLevel);
+}
+
+void Texture::StageLoadLevels()
+{
+    Graphics* graphics = Subsystem<Graphics>();
+    TextureUploadBuffer* buffer = graphics ? graphics->UploadBuffer() : nullptr;
+    if (!buffer || loadImages.empty())
+        return;
+
+    std::vector<ImageLevel> levels;
+    CollectLoadLevels(levels);
+    if (loadLevel >= levels.size())
+        return;
+
+    size_t totalSize = 0;
+    for (size_t i = loadLevel; i < levels.size(); ++i)
+        totalSize += (levels[i].dataSize + UPLOAD_BLOCK_ALIGNMENT - 1) & ~(UPLOAD_BLOCK_ALIGNMENT - 1);
+
+    // If the upload buffer is full, upload from the images as usual
+    unsigned char* dest = buffer->Allocate(totalSize, stagingOffset);
+    if (!dest)
+        return;
+
+    stagingBuffer = buffer;
+    stagingLevelOffsets.assign(levels.size(), NO_UPLOAD_OFFSET);
+
+    size_t offset = 0;
+    for (size_t i = loadLevel; i < levels.size(); ++i)
+    {
+        memcpy(dest + offset, levels[i].data, levels[i].dataSize);
+        stagingLevelOffsets[i] = stagingOffset + offset;
+        offset += (levels[i].dataSize + UPLOAD_BLOCK_ALIGNMENT - 1) & ~(UPLOAD_BLOCK_ALIGNMENT - 1);
+    }
+}
+
+bool Texture::BindStagedLevels(std::vector<ImageLevel>& levels) const
+{
+    if (!stagingBuffer)
+        return false;
+
+    for (size_t i = 0; i < levels.size() && i < stagingLevelOffsets.size(); ++i)
+    {
+        if (stagingLevelOffsets[i] != NO_UPLOAD_OFFSET)
+            levels[i].data = reinterpret_cast<const unsigned char*>(stagingLevelOffsets[i]);
+    }
+
+    stagingBuffer->Bind();
+    return true;
+}
+
+void Texture::ReleaseStaging(bool uploaded)
+{
+    if (!stagingBuffer)
+        return;
+
+    if (uploaded)
+        stagingBuffer->Release(stagingOffset);
+    else
+        stagingBuffer->Free(stagingOffset);
+
+    stagingBuffer = nullptr;
+    stagingLevelOffsets.clear();
+}
+
+void Texture::UpdateTrackedMemory()
+{
+    // Multisampled textures have one level, stored per sample
+    size_t memoryUse = texture ? ResidentDataSize() * Max(multisample, 1) : 0;
+    if (memoryUse > trackedMemory)
+        MemoryTrackAllocation(MEMORY_GPU_TEXTURE, memoryUse - trackedMemory);
+    else if (memoryUse < trackedMemory)
+        MemoryTrackFree(MEMORY_GPU_TEXTURE, trackedMemory - memoryUse);
+    trackedMemory = memoryUse;
+}
 
 void Texture::Release()
 {
     if (texture)
     {
-        glDeleteTextures(1, &texture);
+        Graphics::CurrentBackend()->DestroyTexture(texture, bindlessHandle);
         texture = 0;
+        bindlessHandle = 0;
 
         for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
         {
             if (boundTextures[i] == this)
                 boundTextures[i] = nullptr;
         }
+
+        UpdateTrackedMemory();
     }
 }
 
@@ -262,8 +571,12 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
         multisample_ = 1;
 
     type = type_;
+    residentLevel = 0;
+    streamLevel = 0;
 
-    glGenTextures(1, &texture);
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    texture = backend->CreateTexture();
     if (!texture)
     {
         size = IntVector3::ZERO;
@@ -275,41 +588,25 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
         return false;
     }
 
+    // The binding target depends on multisampling
+    multisample = multisample_;
     Bind(0, true);
 
     size = size_;
     format = format_;
     numLevels = numLevels_;
-    multisample = multisample_;
 
-    // If not compressed and no initial data, create the initial level 0 texture with null data
+    // If not compressed and no initial data, create the levels with null data, so that they can be rendered or written to
     // Clear previous error first to be able to check whether the data was successfully set
-    glGetError();
+    backend->ClearErrors();
     if (!IsCompressed() && !initialData)
     {
-        if (multisample == 1)
-        {
-            if (type == TEX_2D)
-                glTexImage2D(glTargets[type], 0, glInternalFormats[format], size.x, size.y, 0, glFormats[format], glDataTypes[format], nullptr);
-            else if (type == TEX_3D)
-                glTexImage3D(glTargets[type], 0, glInternalFormats[format], size.x, size.y, size.z, 0, glFormats[format], glDataTypes[format], nullptr);
-            else if (type == TEX_CUBE)
-            {
-                for (size_t i = 0; i < MAX_CUBE_FACES; ++i)
-                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i, 0, glInternalFormats[format], size.x, size.y, 0, glFormats[format], glDataTypes[format], nullptr);
-            }
-        }
-        else
+        // 3D textures and multisampled textures get only the top level
+        size_t numDataLevels = type != TEX_3D && multisample == 1 ? numLevels : 1;
+        for (size_t i = 0; i < numDataLevels; ++i)
         {
-            if (type == TEX_2D)
-                glTexImage2DMultisample(glTargets[type], multisample, glInternalFormats[format], size.x, size.y, GL_TRUE);
-            else if (type == TEX_3D)
-                glTexImage3DMultisample(glTargets[type], multisample, glInternalFormats[format], size.x, size.y, size.z, GL_TRUE);
-            else if (type == TEX_CUBE)
-            {
-                for (size_t i = 0; i < MAX_CUBE_FACES; ++i)
-                    glTexImage2DMultisample(GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i, multisample, glInternalFormats[format], size.x, size.y, GL_TRUE);
-            }
+            IntVector3 levelSize(Max(size.x >> i, 1), Max(size.y >> i, 1), size.z);
+            backend->DefineTextureLevel(type, multisample, i, levelSize, format);
         }
     }
 
@@ -328,7 +625,7 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
     }
 
     // If we have an error now, the texture was not created correctly
-    if (glGetError() != GL_NO_ERROR)
+    if (backend->HasErrors())
     {
         Release();
         size = IntVector3::ZERO;
@@ -339,9 +636,10 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
         return false;
     }
 
-    glTexParameteri(glTargets[type], GL_TEXTURE_BASE_LEVEL, 0);
-    glTexParameteri(glTargets[type], GL_TEXTURE_MAX_LEVEL, type != TEX_3D ? (unsigned)numLevels - 1 : 0);
+    if (multisample == 1)
+        backend->SetTextureLevels(type, 0, type != TEX_3D ? numLevels - 1 : 0);
     LOGDEBUGF("Created texture width %d height %d depth %d format %d numLevels %d", size.x, size.y, size.z, (int)format, numLevels);
+    UpdateTrackedMemory();
 
     return true;
 }
@@ -350,6 +648,12 @@ bool Texture::DefineSampler(TextureFilterMode filter_, TextureAddressMode u, Tex
 {
     PROFILE(DefineTextureSampler);
 
+    if (bindlessHandle)
+    {
+        LOGERROR("Can not change sampling parameters of a texture with a bindless handle");
+        return false;
+    }
+
     filter = filter_;
     addressModes[0] = u;
     addressModes[1] = v;
@@ -365,59 +669,13 @@ bool Texture::DefineSampler(TextureFilterMode filter_, TextureAddressMode u, Tex
         return false;
     }
 
-    Bind(0, true);
-
-    switch (filter)
-    {
-    case FILTER_POINT:
-    case COMPARE_POINT:
-        glTexParameteri(glTargets[type], GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(glTargets[type], GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        break;
-
-    case FILTER_BILINEAR:
-    case COMPARE_BILINEAR:
-        if (numLevels < 2)
-            glTexParameteri(glTargets[type], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        else
-            glTexParameteri(glTargets[type], GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-        glTexParameteri(glTargets[type], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        break;
-
-    case FILTER_ANISOTROPIC:
-    case FILTER_TRILINEAR:
-    case COMPARE_ANISOTROPIC:
-    case COMPARE_TRILINEAR:
-        if (numLevels < 2)
-            glTexParameteri(glTargets[type], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        else
-            glTexParameteri(glTargets[type], GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(glTargets[type], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        break;
-
-    default:
-        break;
-    }
-
-    glTexParameteri(glTargets[type], GL_TEXTURE_WRAP_S, glWrapModes[addressModes[0]]);
-    glTexParameteri(glTargets[type], GL_TEXTURE_WRAP_T, glWrapModes[addressModes[1]]);
-    glTexParameteri(glTargets[type], GL_TEXTURE_WRAP_R, glWrapModes[addressModes[2]]);
-
-    glTexParameterf(glTargets[type], GL_TEXTURE_MAX_ANISOTROPY_EXT, filter == FILTER_ANISOTROPIC ?
-        maxAnisotropy : 1.0f);
-
-    glTexParameterf(glTargets[type], GL_TEXTURE_MIN_LOD, minLod);
-    glTexParameterf(glTargets[type], GL_TEXTURE_MAX_LOD, maxLod);
+    // Multisampled textures are read with texelFetch() only and have no sampling state
+    if (multisample > 1)
+        return true;
 
-    glTexParameterfv(glTargets[type], GL_TEXTURE_BORDER_COLOR, borderColor.Data());
-        
-    if (filter >= COMPARE_POINT)
-    {
-        glTexParameteri(glTargets[type], GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-        glTexParameteri(glTargets[type], GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-    }
-    else
-        glTexParameteri(glTargets[type], GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    Bind(0, true);
+    Graphics::CurrentBackend()->SetTextureSampler(type, numLevels, filter, addressModes, maxAnisotropy, borderColor);
+    UpdateLevelRange();
 
     return true;
 }
@@ -446,8 +704,6 @@ bool Texture::SetData(size_t level, const IntBox& box, const ImageLevel& data)
         return false;
     }
 
-    unsigned target = (type == TEX_CUBE) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + box.near : glTargets[type];
-
     IntBox levelBox(0, 0, 0, Max(size.x >> level, 1), Max(size.y >> level, 1), Max(size.z >> level, 1));
     if (type == TEX_CUBE)
     {
@@ -470,72 +726,80 @@ bool Texture::SetData(size_t level, const IntBox& box, const ImageLevel& data)
     Bind(0, true);
 
     bool wholeLevel = box == levelBox;
-
-    if (type != TEX_3D)
-    {
-        if (!IsCompressed())
-        {
-            if (wholeLevel)
-                glTexImage2D(target, (int)level, glInternalFormats[format], box.Width(), box.Height(), 0, glFormats[format], glDataTypes[format], data.data);
-            else
-                glTexSubImage2D(target, (int)level, box.left, box.top, box.Width(), box.Height(), glFormats[format], glDataTypes[format], data.data);
-        }
-        else
-        {
-            if (wholeLevel)
-                glCompressedTexImage2D(target, (int)level, glInternalFormats[format], box.Width(), box.Height(), 0, (GLsizei)data.dataSize, data.data);
-            else
-                glCompressedTexSubImage2D(target, (int)level, box.left, box.top, box.Width(), box.Height(), glFormats[format], (GLsizei)data.dataSize, data.data);
-        }
-    }
-    else
-    {
-        if (wholeLevel)
-            glTexImage3D(target, (int)level, glInternalFormats[format], box.Width(), box.Height(), box.Depth(), 0, glFormats[format], glDataTypes[format], data.data);
-        else
-            glTexSubImage3D(target, (int)level, box.left, box.top, box.near, box.Width(), box.Height(), box.Depth(), glFormats[format], glDataTypes[format], data.data);
-    }
+    Graphics::CurrentBackend()->SetTextureData(type, level, box, format, data.data, data.dataSize, wholeLevel);
 
     return true;
 }
 
 void Texture::Bind(size_t unit, bool force)
 {
-    if (unit >= MAX_TEXTURE_UNITS || !texture || (!force && boundTextures[unit] == this))
+    if (unit >= MAX_TEXTURE_UNITS || !texture)
         return;
-
-    if (activeTextureUnit != unit)
+    if (!force && boundTextures[unit] == this)
     {
-        glActiveTexture(GL_TEXTURE0 + (GLenum)unit);
-        activeTextureUnit = unit;
+        Graphics::CountBinding(true);
+        return;
     }
 
-    unsigned glTarget = glTargets[type];
-
-    if (activeTargets[unit] && activeTargets[unit] != glTarget)
-        glBindTexture(activeTargets[unit], 0);
-
-    glBindTexture(glTarget, texture);
-    activeTargets[unit] = glTarget;
+    Graphics::CurrentBackend()->BindTexture(unit, type, multisample, texture);
     boundTextures[unit] = this;
+    Graphics::CountBinding(false);
 }
 
 void Texture::Unbind(size_t unit)
 {
     if (boundTextures[unit])
     {
-        if (activeTextureUnit != unit)
-        {
-            glActiveTexture(GL_TEXTURE0 + (GLenum)unit);
-            activeTextureUnit = unit;
-        }
-        glBindTexture(activeTargets[unit], 0);
-        activeTargets[unit] = 0;
+        Graphics::CurrentBackend()->UnbindTexture(unit);
         boundTextures[unit] = nullptr;
     }
 }
 
-unsigned Texture::GLTarget() const
+void Texture::BindImage(size_t unit, size_t level, ImageAccess access)
+{
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    if (!texture || level >= numLevels || !backend->IsSupported(FEATURE_IMAGE_LOAD_STORE))
+        return;
+
+    // Layered binding is used for 3D and cube textures so that all slices are accessible
+    backend->BindImage(unit, texture, level, type != TEX_2D, access, format);
+}
+
+void Texture::UnbindImage(size_t unit)
+{
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    if (backend->IsSupported(FEATURE_IMAGE_LOAD_STORE))
+        backend->BindImage(unit, 0, 0, false, IMAGE_READ, FMT_R8);
+}
+
+void Texture::Invalidate()
+{
+    if (!texture || !IsInvalidateSupported())
+        return;
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+    for (size_t i = 0; i < numLevels; ++i)
+        backend->InvalidateTexture(texture, i);
+}
+
+bool Texture::IsInvalidateSupported()
+{
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_INVALIDATE);
+}
+
+unsigned long long Texture::BindlessHandle()
+{
+    if (!bindlessHandle && texture && IsBindlessSupported())
+    {
+        bindlessHandle = Graphics::CurrentBackend()->CreateBindlessHandle(texture);
+        if (!bindlessHandle)
+            LOGERROR("Failed to create bindless texture handle");
+    }
+
+    return bindlessHandle;
+}
+
+bool Texture::IsBindlessSupported()
 {
-    return glTargets[type];
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_BINDLESS_TEXTURES);
 }
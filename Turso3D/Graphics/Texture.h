@@ -9,6 +9,7 @@
 #include "GraphicsDefs.h"
 
 class Image;
+class TextureUploadBuffer;
 
 /// %Texture on the GPU.
 class Texture : public Resource
@@ -28,6 +29,16 @@ public:
     bool BeginLoad(Stream& source) override;
     /// Finish texture loading by uploading to the GPU. Return true on success.
     bool EndLoad() override;
+    /// Upload one mip level, or a range of rows of a large top level, per call. Return true when finished.
+    bool EndLoadStep(bool& success) override;
+    /// Return GPU memory used by the resident mip levels in bytes.
+    size_t GpuMemoryUse() const override { return texture ? ResidentDataSize() : 0; }
+    /// Load image data for streaming more detailed mip levels, down to the given level. Can be called from a worker thread. Return true on success.
+    bool BeginLoadLevels(Stream& source, size_t level);
+    /// Upload the mip levels loaded with BeginLoadLevels() and make them resident. Return true on success.
+    bool EndLoadLevels();
+    /// Release mip levels more detailed than the given level from GPU memory. Only for 2D textures.
+    void ReleaseLevels(size_t level);
 
     /// Define texture type and dimensions and set initial data. Return true on success.
     bool Define(TextureType type, const IntVector2& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
@@ -43,6 +54,12 @@ public:
     void Bind(size_t unit, bool force = false);
     /// Unbind a texture unit.
     static void Unbind(size_t unit);
+    /// Bind a mip level to an image unit for compute shader image load and store. The shader's image format qualifier must match the texture format.
+    void BindImage(size_t unit, size_t level = 0, ImageAccess access = IMAGE_WRITE);
+    /// Unbind an image unit.
+    static void UnbindImage(size_t unit);
+    /// Discard the content, for example of a render target after its last use in a frame, so that the GPU need not preserve it. No-op if not supported.
+    void Invalidate();
 
     /// Return texture type.
     TextureType TexType() const { return type; }
@@ -64,11 +81,38 @@ public:
     int Multisample() const { return multisample; }
     /// Return number of mipmap levels.
     size_t NumLevels() const { return numLevels; }
+    /// Return the most detailed mip level resident in GPU memory.
+    size_t ResidentLevel() const { return residentLevel; }
+    /// Return the mip level that stays resident for a streamed texture, or 0 if not streamed.
+    size_t StreamLevel() const { return streamLevel; }
+    /// Return whether mip levels can be streamed. A bindless handle freezes the residency.
+    bool IsStreamable() const { return streamLevel && !bindlessHandle; }
+    /// Return GPU memory size of a mip level in bytes.
+    size_t LevelDataSize(size_t level) const;
+    /// Return GPU memory size of the resident mip levels in bytes.
+    size_t ResidentDataSize() const;
 
     /// Return the OpenGL object identifier.
     unsigned GLTexture() const { return texture; }
-    /// Return the OpenGL binding target of the texture.
-    unsigned GLTarget() const;
+    /// Return a resident bindless handle, creating it on first use. Sampling parameters can not be changed afterward. Return zero if not supported or not defined.
+    unsigned long long BindlessHandle();
+
+    /// Return whether discarding texture and framebuffer content is supported.
+    static bool IsInvalidateSupported();
+    /// Return whether bindless textures are supported.
+    static bool IsBindlessSupported();
+    /// Set the largest mip level size resident on load for textures loaded afterward. The more detailed levels are streamed on request. Zero disables streaming.
+    static void SetStreamingMinSize(int size);
+    /// Return the largest mip level size resident on load, or 0 if streaming is disabled.
+    static int StreamingMinSize();
+    /// Set whether to compress uncompressed RGBA images, such as PNG or JPG, to DXT1 or DXT5 on load. Images with translucent pixels use DXT5.
+    static void SetLoadCompression(bool enable);
+    /// Return whether images are compressed on load.
+    static bool LoadCompression();
+    /// Set directory of the on-disk cache for images compressed on load. Cached images are used while their timestamp matches the source file. Empty disables the cache. Return true on success.
+    static bool SetCompressionCacheDir(const std::string& dir);
+    /// Return the compression cache directory, or empty if disabled.
+    static const std::string& CompressionCacheDir();
 
     /// Texture filtering mode.
     TextureFilterMode filter;
@@ -86,9 +130,27 @@ public:
 private:
     /// Release the texture.
     void Release();
+    /// Load the images, generate mip levels for uncompressed data and compress them if enabled. Return true on success.
+    bool LoadImages(Stream& source);
+    /// Collect all mip levels of the loaded images.
+    void CollectLoadLevels(std::vector<ImageLevel>& dest) const;
+    /// Define a streamed 2D texture with storage only for the levels from the stream level onward. Return true on success.
+    bool DefineStreamed(ImageFormat format, const std::vector<ImageLevel>& levels);
+    /// Apply the resident base level, with the LOD range shifted to match.
+    void UpdateLevelRange();
+    /// Copy the loaded mip levels from the load level onward to the texture upload buffer, if it exists and has room. Called from the loader thread.
+    void StageLoadLevels();
+    /// If the loaded levels were staged, bind the upload buffer and replace the data pointers of the staged levels with offsets into it. Return true if bound.
+    bool BindStagedLevels(std::vector<ImageLevel>& levels) const;
+    /// Release the staging memory of the loaded levels, with a fence if they were uploaded from.
+    void ReleaseStaging(bool uploaded);
+    /// Update the GPU memory accounted to the texture category after the resident levels change.
+    void UpdateTrackedMemory();
 
     /// OpenGL object identifier.
     unsigned texture;
+    /// Resident bindless handle, or zero if not created.
+    unsigned long long bindlessHandle;
     /// Texture type.
     TextureType type;
     /// Texture usage mode.
@@ -101,6 +163,22 @@ private:
     int multisample;
     /// Number of mipmap levels.
     size_t numLevels;
+    /// Most detailed resident mip level.
+    size_t residentLevel;
+    /// Mip level that stays resident for a streamed texture, or 0 if not streamed.
+    size_t streamLevel;
     /// Images used for loading.
     std::vector<AutoPtr<Image> > loadImages;
+    /// Next mip level to upload in stepped loading, or the first level to upload when loading streamed levels.
+    size_t loadLevel;
+    /// Next row to upload in stepped loading, or negative if the texture is not yet defined.
+    int loadRow;
+    /// Upload buffer holding the staged levels, or null if not staged.
+    TextureUploadBuffer* stagingBuffer;
+    /// Offset of the staging memory block.
+    size_t stagingOffset;
+    /// Offsets of the loaded levels in the upload buffer, or NO_UPLOAD_OFFSET for levels that were not staged.
+    std::vector<size_t> stagingLevelOffsets;
+    /// GPU memory accounted to the texture category.
+    size_t trackedMemory;
 };
@@ -0,0 +1,206 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../Time/Profiler.h"
+#include "Graphics.h"
+#include "TextureUploadBuffer.h"
+
+#include <cassert>
+#include <glew.h>
+
+TextureUploadBuffer::TextureUploadBuffer() :
+    buffer(0),
+    size(0),
+    mappedData(nullptr),
+    head(0)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+}
+
+TextureUploadBuffer::~TextureUploadBuffer()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!Object::Subsystem<Graphics>())
+        return;
+
+    ReleaseBuffer();
+}
+
+bool TextureUploadBuffer::Define(size_t size_)
+{
+    PROFILE(DefineTextureUploadBuffer);
+
+    ReleaseBuffer();
+
+    if (!size_)
+    {
+        LOGERROR("Can not define empty texture upload buffer");
+        return false;
+    }
+    if (!IsSupported())
+    {
+        LOGERROR("Persistently mapped texture upload buffers are not supported");
+        return false;
+    }
+
+    glGenBuffers(1, &buffer);
+    if (!buffer)
+    {
+        LOGERROR("Failed to create texture upload buffer");
+        return false;
+    }
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size_, nullptr, flags);
+    mappedData = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size_, flags);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (!mappedData)
+    {
+        LOGERROR("Failed to map texture upload buffer");
+        ReleaseBuffer();
+        return false;
+    }
+
+    size = size_;
+    LOGDEBUGF("Created texture upload buffer size %u", (unsigned)size);
+    return true;
+}
+
+unsigned char* TextureUploadBuffer::Allocate(size_t numBytes, size_t& offset)
+{
+    numBytes = (numBytes + UPLOAD_BLOCK_ALIGNMENT - 1) & ~(UPLOAD_BLOCK_ALIGNMENT - 1);
+
+    std::lock_guard<std::mutex> lock(blockMutex);
+
+    if (!mappedData || !numBytes || numBytes > size)
+        return nullptr;
+
+    // Until the blocks wrap around, the free space is after the head and before the oldest block. After that it is between them
+    if (blocks.empty())
+        head = 0;
+    else
+    {
+        size_t tail = blocks.front().offset;
+        if (head > tail)
+        {
+            if (head + numBytes > size)
+            {
+                if (numBytes > tail)
+                    return nullptr;
+                head = 0;
+            }
+        }
+        else if (head + numBytes > tail)
+            return nullptr;
+    }
+
+    UploadBlock block;
+    block.offset = head;
+    block.size = numBytes;
+    block.fence = nullptr;
+    block.released = false;
+    blocks.push_back(block);
+
+    offset = head;
+    head += numBytes;
+    return mappedData + offset;
+}
+
+void TextureUploadBuffer::Release(size_t offset)
+{
+    ReleaseBlock(offset, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+}
+
+void TextureUploadBuffer::Free(size_t offset)
+{
+    ReleaseBlock(offset, nullptr);
+}
+
+void TextureUploadBuffer::Update()
+{
+    std::lock_guard<std::mutex> lock(blockMutex);
+
+    while (!blocks.empty() && blocks.front().released)
+    {
+        UploadBlock& block = blocks.front();
+        if (block.fence)
+        {
+            GLenum result = glClientWaitSync((GLsync)block.fence, 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                break;
+            glDeleteSync((GLsync)block.fence);
+        }
+        blocks.pop_front();
+    }
+}
+
+void TextureUploadBuffer::Bind()
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+}
+
+size_t TextureUploadBuffer::UsedSize() const
+{
+    std::lock_guard<std::mutex> lock(blockMutex);
+
+    size_t used = 0;
+    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+        used += it->size;
+    return used;
+}
+
+void TextureUploadBuffer::Unbind()
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+bool TextureUploadBuffer::IsSupported()
+{
+    return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+void TextureUploadBuffer::ReleaseBuffer()
+{
+    std::lock_guard<std::mutex> lock(blockMutex);
+
+    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        if (it->fence)
+            glDeleteSync((GLsync)it->fence);
+    }
+    blocks.clear();
+    head = 0;
+
+    if (buffer)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    mappedData = nullptr;
+    size = 0;
+}
+
+void TextureUploadBuffer::ReleaseBlock(size_t offset, void* fence)
+{
+    std::lock_guard<std::mutex> lock(blockMutex);
+
+    for (auto it = blocks.begin(); it != blocks.end(); ++it)
+    {
+        if (it->offset == offset && !it->released)
+        {
+            it->fence = fence;
+            it->released = true;
+            return;
+        }
+    }
+
+    // Block lost by redefining the buffer
+    if (fence)
+        glDeleteSync((GLsync)fence);
+}
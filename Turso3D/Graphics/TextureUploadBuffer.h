@@ -0,0 +1,78 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+
+/// Alignment of staging memory blocks in bytes.
+static const size_t UPLOAD_BLOCK_ALIGNMENT = 16;
+/// Offset value for data that is not in the upload buffer.
+static const size_t NO_UPLOAD_OFFSET = (size_t)-1;
+
+/// Persistently mapped pixel unpack buffer for staging texture data. Loader threads reserve blocks and write decoded image levels into them, after which the main thread uploads from the buffer, letting the driver copy the data asynchronously instead of blocking on client memory. Blocks are allocated from a ring, and their memory is reused once a fence shows the GPU has finished reading them. Requires OpenGL 4.4 or the buffer storage extension.
+class TextureUploadBuffer
+{
+public:
+    /// Construct. %Graphics subsystem must have been initialized.
+    TextureUploadBuffer();
+    /// Destruct.
+    ~TextureUploadBuffer();
+
+    /// Define the buffer with byte size. Any blocks still in use are lost. Return true on success.
+    bool Define(size_t size);
+    /// Reserve a block of staging memory and return a pointer for writing, or null if there is not enough free space. The byte offset in the buffer is written to offset. Can be called from any thread.
+    unsigned char* Allocate(size_t numBytes, size_t& offset);
+    /// Release a block after issuing the uploads that read from it. Its memory is reused once the GPU has executed them.
+    void Release(size_t offset);
+    /// Release a block that has not been uploaded from. Can be called from any thread.
+    void Free(size_t offset);
+    /// Reclaim the memory of released blocks that the GPU has finished with. Called by Graphics on Present().
+    void Update();
+    /// Bind as the pixel unpack buffer, so that texture data pointers are interpreted as offsets into it.
+    void Bind();
+
+    /// Return size in bytes.
+    size_t Size() const { return size; }
+    /// Return number of bytes in blocks that are allocated or waiting for the GPU.
+    size_t UsedSize() const;
+    /// Return the OpenGL object identifier.
+    unsigned GLBuffer() const { return buffer; }
+
+    /// Unbind the pixel unpack buffer.
+    static void Unbind();
+    /// Return whether persistently mapped upload buffers are supported.
+    static bool IsSupported();
+
+private:
+    /// Staging memory block.
+    struct UploadBlock
+    {
+        /// Byte offset in the buffer.
+        size_t offset;
+        /// Size in bytes, including alignment padding.
+        size_t size;
+        /// Fence inserted after the uploads from the block, or null if the GPU never read it.
+        void* fence;
+        /// Whether has been released.
+        bool released;
+    };
+
+    /// Release the buffer and the fences.
+    void ReleaseBuffer();
+    /// Mark a block released with a fence.
+    void ReleaseBlock(size_t offset, void* fence);
+
+    /// OpenGL object identifier.
+    unsigned buffer;
+    /// Size in bytes.
+    size_t size;
+    /// Persistently and coherently mapped memory.
+    unsigned char* mappedData;
+    /// Blocks in allocation order. The oldest block is reclaimed first, so the free space is between the newest and the oldest.
+    std::deque<UploadBlock> blocks;
+    /// Byte offset of the next allocation.
+    size_t head;
+    /// Mutex for allocating from the loader threads.
+    mutable std::mutex blockMutex;
+};
@@ -1,11 +1,12 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/Log.h"
+#include "../Object/MemoryTracker.h"
 #include "../Time/Profiler.h"
 #include "Graphics.h"
+#include "GraphicsBackend.h"
 #include "UniformBuffer.h"
 
-#include <glew.h>
 #include <cstring>
 
 static UniformBuffer* boundUniformBuffers[MAX_CONSTANT_BUFFER_SLOTS];
@@ -49,8 +50,9 @@ void UniformBuffer::Release()
 {
     if (buffer)
     {
-        glDeleteBuffers(1, &buffer);
+        Graphics::CurrentBackend()->DestroyBuffer(buffer);
         buffer = 0;
+        MemoryTrackFree(MEMORY_GPU_BUFFER, size);
 
         for (size_t i = 0; i < MAX_CONSTANT_BUFFER_SLOTS; ++i)
         {
@@ -80,16 +82,18 @@ bool UniformBuffer::SetData(size_t offset, size_t numBytes, const void* data, bo
 
     if (buffer)
     {
-        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        GraphicsBackend* backend = Graphics::CurrentBackend();
+
+        backend->BindBuffer(BUFFER_UNIFORM, buffer);
         if (numBytes == size)
-            glBufferData(GL_UNIFORM_BUFFER, numBytes, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+            backend->DefineBufferData(BUFFER_UNIFORM, numBytes, usage, data);
         else if (discard)
         {
-            glBufferData(GL_UNIFORM_BUFFER, size, nullptr, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-            glBufferSubData(GL_UNIFORM_BUFFER, offset, numBytes, data);
+            backend->DefineBufferData(BUFFER_UNIFORM, size, usage, nullptr);
+            backend->SetBufferData(BUFFER_UNIFORM, offset, numBytes, data);
         }
         else
-            glBufferSubData(GL_UNIFORM_BUFFER, offset, numBytes, data);
+            backend->SetBufferData(BUFFER_UNIFORM, offset, numBytes, data);
     }
 
     return true;
@@ -97,15 +101,19 @@ bool UniformBuffer::SetData(size_t offset, size_t numBytes, const void* data, bo
 
 bool UniformBuffer::Create(const void* data)
 {
-    glGenBuffers(1, &buffer);
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    buffer = backend->CreateBuffer();
     if (!buffer)
     {
         LOGERROR("Failed to create uniform buffer");
         return false;
     }
 
-    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
-    glBufferData(GL_UNIFORM_BUFFER, size, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    MemoryTrackAllocation(MEMORY_GPU_BUFFER, size);
+
+    backend->BindBuffer(BUFFER_UNIFORM, buffer);
+    backend->DefineBufferData(BUFFER_UNIFORM, size, usage, data);
     LOGDEBUGF("Created constant buffer size %u", (unsigned)size);
 
     return true;
@@ -113,18 +121,24 @@ bool UniformBuffer::Create(const void* data)
 
 void UniformBuffer::Bind(size_t index, bool force)
 {
-    if (!buffer || (boundUniformBuffers[index] == this && !force))
+    if (!buffer)
         return;
+    if (boundUniformBuffers[index] == this && !force)
+    {
+        Graphics::CountBinding(true);
+        return;
+    }
 
-    glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, 0, size);
+    Graphics::CurrentBackend()->BindBufferSlot(BUFFER_UNIFORM, index, buffer, size);
     boundUniformBuffers[index] = this;
+    Graphics::CountBinding(false);
 }
 
 void UniformBuffer::Unbind(size_t index)
 {
     if (boundUniformBuffers[index])
     {
-        glBindBufferRange(GL_UNIFORM_BUFFER, index, 0, 0, 0);
+        Graphics::CurrentBackend()->BindBufferSlot(BUFFER_UNIFORM, index, 0, 0);
         boundUniformBuffers[index] = nullptr;
     }
 }
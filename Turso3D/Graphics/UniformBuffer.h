@@ -6,7 +6,7 @@
 #include "../Object/Ptr.h"
 #include "GraphicsDefs.h"
 
-/// GPU buffer for shader program uniform data. Note: because of poor performance when constantly updating, is used only for special case large data (forward+ lights).
+/// GPU buffer for shader program uniform data. Used for forward+ lights, per-view data and material uniforms, which are each updated at most once per view or material change.
 class UniformBuffer : public RefCounted
 {
 public:
@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Matrix3x4.h"
+#include "Graphics.h"
+#include "IndexBuffer.h"
+#include "VertexArrayCache.h"
+#include "VertexBuffer.h"
+
+#include <glew.h>
+#include <map>
+
+static unsigned defaultVertexArray = 0;
+static unsigned boundVertexArray = 0;
+static std::map<VertexArrayKey, unsigned> vertexArrays;
+
+void VertexArrayCache::Initialize()
+{
+    Clear();
+
+    glGenVertexArrays(1, &defaultVertexArray);
+    glBindVertexArray(defaultVertexArray);
+    boundVertexArray = defaultVertexArray;
+}
+
+bool VertexArrayCache::Bind(VertexBuffer* vertexBuffer, IndexBuffer* indexBuffer, unsigned attributeMask, VertexBuffer* instanceBuffer, InstanceLayout instanceLayout)
+{
+    if (!vertexBuffer || !vertexBuffer->GLBuffer() || (indexBuffer && !indexBuffer->GLBuffer()))
+        return false;
+    if (!instanceBuffer || !instanceBuffer->GLBuffer())
+        instanceLayout = INSTANCE_NONE;
+    if (!instanceLayout)
+        instanceBuffer = nullptr;
+
+    VertexArrayKey key(vertexBuffer, indexBuffer, attributeMask & vertexBuffer->Attributes(), instanceBuffer, instanceLayout);
+    auto it = vertexArrays.find(key);
+    if (it != vertexArrays.end())
+    {
+        if (boundVertexArray != it->second)
+        {
+            glBindVertexArray(it->second);
+            boundVertexArray = it->second;
+            Graphics::CountBinding(false);
+        }
+        else
+            Graphics::CountBinding(true);
+        return true;
+    }
+
+    unsigned vertexArray;
+    glGenVertexArrays(1, &vertexArray);
+    if (!vertexArray)
+        return false;
+
+    glBindVertexArray(vertexArray);
+    boundVertexArray = vertexArray;
+
+    vertexBuffer->SetupAttributes(key.attributeMask);
+
+    if (instanceLayout)
+    {
+        const bool hasData = instanceLayout == INSTANCE_TRANSFORM_DATA || instanceLayout == INSTANCE_TRANSFORM_DATA_PREV;
+        const bool hasPrev = instanceLayout >= INSTANCE_TRANSFORM_PREV;
+        const size_t numVectors = (hasData ? 4 : 3) + (hasPrev ? 3 : 0);
+        const GLsizei instanceVertexSize = (GLsizei)(numVectors * sizeof(Vector4));
+
+        instanceBuffer->Bind(0);
+        for (size_t i = 0; i < numVectors; ++i)
+        {
+            // The transform rows use texcoords 3-5, the per-instance data attribute 12, and the previous transform rows texcoords 6-8
+            unsigned attributeIdx = i < 3 ? 7 + (unsigned)i : (hasData && i == 3 ? 12 : 13 + (unsigned)(i - (hasData ? 4 : 3)));
+            glEnableVertexAttribArray(attributeIdx);
+            glVertexAttribPointer(attributeIdx, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(i * sizeof(Vector4)));
+            glVertexAttribDivisorARB(attributeIdx, 1);
+        }
+    }
+
+    // The index buffer binding is part of the vertex array state
+    if (indexBuffer)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GLBuffer());
+
+    vertexArrays[key] = vertexArray;
+    return true;
+}
+
+void VertexArrayCache::BindDefault()
+{
+    if (boundVertexArray != defaultVertexArray)
+    {
+        glBindVertexArray(defaultVertexArray);
+        boundVertexArray = defaultVertexArray;
+    }
+}
+
+void VertexArrayCache::ReleaseBuffer(const void* buffer)
+{
+    for (auto it = vertexArrays.begin(); it != vertexArrays.end();)
+    {
+        const VertexArrayKey& key = it->first;
+        if (key.vertexBuffer == buffer || key.indexBuffer == buffer || key.instanceBuffer == buffer)
+        {
+            if (boundVertexArray == it->second)
+                boundVertexArray = 0;
+            glDeleteVertexArrays(1, &it->second);
+            it = vertexArrays.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void VertexArrayCache::Clear()
+{
+    for (auto it = vertexArrays.begin(); it != vertexArrays.end(); ++it)
+    {
+        if (boundVertexArray == it->second)
+            boundVertexArray = 0;
+        glDeleteVertexArrays(1, &it->second);
+    }
+
+    vertexArrays.clear();
+}
+
+size_t VertexArrayCache::Size()
+{
+    return vertexArrays.size();
+}
+
+bool VertexArrayCache::IsInstancingSupported()
+{
+    return glVertexAttribDivisorARB && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+}
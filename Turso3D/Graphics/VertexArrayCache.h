@@ -0,0 +1,78 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cstddef>
+
+class IndexBuffer;
+class VertexBuffer;
+
+/// Per-instance attributes of a vertex array object.
+enum InstanceLayout
+{
+    INSTANCE_NONE = 0,
+    INSTANCE_TRANSFORM,
+    INSTANCE_TRANSFORM_DATA,
+    INSTANCE_TRANSFORM_PREV,
+    INSTANCE_TRANSFORM_DATA_PREV
+};
+
+/// Description of a cached vertex array object.
+struct VertexArrayKey
+{
+    /// Construct.
+    VertexArrayKey(VertexBuffer* vertexBuffer_, IndexBuffer* indexBuffer_, unsigned attributeMask_, VertexBuffer* instanceBuffer_, InstanceLayout instanceLayout_) :
+        vertexBuffer(vertexBuffer_),
+        indexBuffer(indexBuffer_),
+        instanceBuffer(instanceBuffer_),
+        attributeMask(attributeMask_),
+        instanceLayout(instanceLayout_)
+    {
+    }
+
+    /// Test for less than with another key.
+    bool operator < (const VertexArrayKey& rhs) const
+    {
+        if (vertexBuffer != rhs.vertexBuffer)
+            return vertexBuffer < rhs.vertexBuffer;
+        if (indexBuffer != rhs.indexBuffer)
+            return indexBuffer < rhs.indexBuffer;
+        if (instanceBuffer != rhs.instanceBuffer)
+            return instanceBuffer < rhs.instanceBuffer;
+        if (attributeMask != rhs.attributeMask)
+            return attributeMask < rhs.attributeMask;
+        return instanceLayout < rhs.instanceLayout;
+    }
+
+    /// Vertex buffer.
+    VertexBuffer* vertexBuffer;
+    /// Index buffer, or null if not indexed.
+    IndexBuffer* indexBuffer;
+    /// Instance transform buffer, or null if not instanced.
+    VertexBuffer* instanceBuffer;
+    /// Vertex attributes used from the vertex buffer.
+    unsigned attributeMask;
+    /// Per-instance attributes.
+    InstanceLayout instanceLayout;
+};
+
+/// Cache of vertex array objects by vertex buffer, index buffer, attribute mask and instance layout, so that switching the geometry of a draw call is one bind. The buffers' own Bind() functions set up the default vertex array object instead. Vertex arrays are destroyed when a buffer they refer to is released or redefined.
+class VertexArrayCache
+{
+public:
+    /// Create and bind the default vertex array object. Called by Graphics on initialization.
+    static void Initialize();
+    /// Bind the vertex array object for a combination of buffers, creating it on first use. The instance transform occupies attributes 7-9, the per-instance data attribute 12 and the previous instance transform attributes 13-15, read from the start of the instance buffer with divisor 1; select the instances with the base instance of the draw call. Return true on success.
+    static bool Bind(VertexBuffer* vertexBuffer, IndexBuffer* indexBuffer, unsigned attributeMask, VertexBuffer* instanceBuffer = nullptr, InstanceLayout instanceLayout = INSTANCE_NONE);
+    /// Bind the default vertex array object for attributes set up by the buffers' Bind() functions. No-op if already bound.
+    static void BindDefault();
+    /// Destroy the vertex arrays that refer to a vertex or index buffer. Called by the buffers when releasing.
+    static void ReleaseBuffer(const void* buffer);
+    /// Destroy all cached vertex arrays.
+    static void Clear();
+
+    /// Return number of cached vertex arrays.
+    static size_t Size();
+    /// Return whether vertex arrays can be used for instanced drawing, which requires the base instance draw calls.
+    static bool IsInstancingSupported();
+};
@@ -1,11 +1,13 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/Log.h"
+#include "../Object/MemoryTracker.h"
 #include "../Time/Profiler.h"
 #include "Graphics.h"
+#include "GraphicsBackend.h"
+#include "VertexArrayCache.h"
 #include "VertexBuffer.h"
 
-#include <glew.h>
 #include <cstring>
 
 static unsigned boundAttributes = 0;
@@ -22,28 +24,9 @@ static const unsigned baseAttributeIndex[] = {
     11
 };
 
-static const unsigned elementGLSizes[] =
-{
-    1,
-    1,
-    2,
-    3,
-    4,
-    4
-};
-
-static const unsigned elementGLTypes[] =
-{
-    GL_INT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_FLOAT,
-    GL_UNSIGNED_BYTE,
-};
-
 VertexBuffer::VertexBuffer() :
     buffer(0),
+    mappedData(nullptr),
     numVertices(0),
     vertexSize(0),
     attributes(0),
@@ -68,6 +51,11 @@ bool VertexBuffer::Define(ResourceUsage usage_, size_t numVertices_, const std::
         LOGERROR("Can not define vertex buffer with no vertices or no elements");
         return false;
     }
+    if (usage_ == USAGE_PERSISTENT && !IsPersistentSupported())
+    {
+        LOGERROR("Persistently mapped vertex buffers are not supported");
+        return false;
+    }
 
     Release();
 
@@ -93,13 +81,17 @@ void VertexBuffer::Release()
 {
     if (buffer)
     {
-        glDeleteBuffers(1, &buffer);
+        Graphics::CurrentBackend()->DestroyBuffer(buffer);
         buffer = 0;
+        mappedData = nullptr;
+        MemoryTrackFree(MEMORY_GPU_BUFFER, numVertices * vertexSize);
 
         if (boundVertexBuffer == this)
             boundVertexBuffer = nullptr;
         if (boundVertexAttribSource == this)
             boundVertexAttribSource = nullptr;
+
+        VertexArrayCache::ReleaseBuffer(this);
     }
 }
 
@@ -118,18 +110,22 @@ bool VertexBuffer::SetData(size_t firstVertex, size_t numVertices_, const void*
         return false;
     }
 
-    if (buffer)
+    if (mappedData)
+        memcpy((unsigned char*)mappedData + firstVertex * vertexSize, data, numVertices_ * vertexSize);
+    else if (buffer)
     {
+        GraphicsBackend* backend = Graphics::CurrentBackend();
+
         Bind(0, true);
         if (numVertices_ == numVertices)
-            glBufferData(GL_ARRAY_BUFFER, numVertices * vertexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+            backend->DefineBufferData(BUFFER_VERTEX, numVertices * vertexSize, usage, data);
         else if (discard)
         {
-            glBufferData(GL_ARRAY_BUFFER, numVertices * vertexSize, nullptr, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
-            glBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, numVertices_ * vertexSize, data);
+            backend->DefineBufferData(BUFFER_VERTEX, numVertices * vertexSize, usage, nullptr);
+            backend->SetBufferData(BUFFER_VERTEX, firstVertex * vertexSize, numVertices_ * vertexSize, data);
         }
         else
-            glBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, numVertices_ * vertexSize, data);
+            backend->SetBufferData(BUFFER_VERTEX, firstVertex * vertexSize, numVertices_ * vertexSize, data);
     }
 
     return true;
@@ -137,15 +133,25 @@ bool VertexBuffer::SetData(size_t firstVertex, size_t numVertices_, const void*
 
 bool VertexBuffer::Create(const void* data)
 {
-    glGenBuffers(1, &buffer);
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    buffer = backend->CreateBuffer();
     if (!buffer)
     {
         LOGERROR("Failed to create vertex buffer");
         return false;
     }
 
+    MemoryTrackAllocation(MEMORY_GPU_BUFFER, numVertices * vertexSize);
+
     Bind(0, true);
-    glBufferData(GL_ARRAY_BUFFER, numVertices * vertexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    mappedData = backend->DefineBufferData(BUFFER_VERTEX, numVertices * vertexSize, usage, data);
+    if (usage == USAGE_PERSISTENT && !mappedData)
+    {
+        LOGERROR("Failed to map persistent vertex buffer");
+        Release();
+        return false;
+    }
     LOGDEBUGF("Created vertex buffer numVertices %u vertexSize %u", (unsigned)numVertices, (unsigned)vertexSize);
 
     if (boundVertexAttribSource == this)
@@ -164,7 +170,7 @@ void VertexBuffer::Bind(unsigned attributeMask, bool force)
     {
         if (boundVertexBuffer != this || force)
         {
-            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            Graphics::CurrentBackend()->BindBuffer(BUFFER_VERTEX, buffer);
             boundVertexBuffer = this;
         }
         return;
@@ -173,13 +179,22 @@ void VertexBuffer::Bind(unsigned attributeMask, bool force)
     // Do not attempt to bind elements the current vertex buffer doesn't have
     attributeMask &= attributes;
 
+    VertexArrayCache::BindDefault();
+
     // If attributes already bound from this buffer, no-op
     if (!force && attributeMask == boundAttributes && boundVertexAttribSource == this)
+    {
+        Graphics::CountBinding(true);
         return;
+    }
+
+    Graphics::CountBinding(false);
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
 
     if (boundVertexBuffer != this)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        backend->BindBuffer(BUFFER_VERTEX, buffer);
         boundVertexBuffer = this;
     }
 
@@ -195,10 +210,9 @@ void VertexBuffer::Bind(unsigned attributeMask, bool force)
             continue;
 
         if (!(boundAttributes & attributeBit))
-            glEnableVertexAttribArray(attributeIdx);
+            backend->SetVertexAttributeEnabled(attributeIdx, true);
 
-        glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], element.semantic == SEM_COLOR ? GL_TRUE : GL_FALSE, 
-            (GLsizei)vertexSize, reinterpret_cast<void*>(element.offset));
+        backend->SetVertexAttribute(attributeIdx, element.type, element.semantic == SEM_COLOR, vertexSize, element.offset);
 
         usedAttributes |= attributeBit;
     }
@@ -208,7 +222,7 @@ void VertexBuffer::Bind(unsigned attributeMask, bool force)
     while (disableAttributes)
     {
         if (disableAttributes & 1)
-            glDisableVertexAttribArray(disableIdx);
+            backend->SetVertexAttributeEnabled(disableIdx, false);
         disableAttributes >>= 1;
         ++disableIdx;
     }
@@ -218,6 +232,25 @@ void VertexBuffer::Bind(unsigned attributeMask, bool force)
     boundVertexAttribSource = this;
 }
 
+void VertexBuffer::SetupAttributes(unsigned attributeMask)
+{
+    Bind(0);
+
+    GraphicsBackend* backend = Graphics::CurrentBackend();
+
+    for (size_t i = 0; i < elements.size(); ++i)
+    {
+        const VertexElement& element = elements[i];
+
+        unsigned attributeIdx = baseAttributeIndex[element.semantic] + element.index;
+        if (!(attributeMask & (1 << attributeIdx)))
+            continue;
+
+        backend->SetVertexAttributeEnabled(attributeIdx, true);
+        backend->SetVertexAttribute(attributeIdx, element.type, element.semantic == SEM_COLOR, vertexSize, element.offset);
+    }
+}
+
 unsigned VertexBuffer::CalculateAttributeMask(const std::vector<VertexElement>& elements)
 {
     unsigned attributes = 0;
@@ -231,3 +264,8 @@ unsigned VertexBuffer::CalculateAttributeMask(const std::vector<VertexElement>&
 
     return attributes;
 }
+
+bool VertexBuffer::IsPersistentSupported()
+{
+    return Graphics::CurrentBackend()->IsSupported(FEATURE_PERSISTENT_BUFFERS);
+}
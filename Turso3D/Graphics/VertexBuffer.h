@@ -19,10 +19,12 @@ public:
 
     /// Define buffer. Return true on success.
     bool Define(ResourceUsage usage, size_t numVertices, const std::vector<VertexElement>& elements, const void* data = nullptr);
-    /// Redefine buffer data either completely or partially. Return true on success.
+    /// Redefine buffer data either completely or partially. Persistent buffers are written through the mapped memory. Return true on success.
     bool SetData(size_t firstVertex, size_t numVertices, const void* data, bool discard = false);
-    /// Bind to use. No-op if already bound, unless force is specified. Force mode is used when editing.
+    /// Bind to use. No-op if already bound, unless force is specified. Force mode is used when editing. Sets up the attributes in the default vertex array object.
     void Bind(unsigned attributeMask, bool force = false);
+    /// Bind and enable the attributes of the mask in the currently bound vertex array object, which is assumed to have no attributes enabled. Used by VertexArrayCache.
+    void SetupAttributes(unsigned attributeMask);
 
     /// Return number of vertices.
     size_t NumVertices() const { return numVertices; }
@@ -38,12 +40,16 @@ public:
     ResourceUsage Usage() const { return usage; }
     /// Return whether is dynamic.
     bool IsDynamic() const { return usage == USAGE_DYNAMIC; }
+    /// Return persistently and coherently mapped memory, or null if not a persistent buffer.
+    void* MappedData() const { return mappedData; }
 
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
 
     /// Calculate a vertex attribute mask from elements.
     static unsigned CalculateAttributeMask(const std::vector<VertexElement>& elements);
+    /// Return whether persistently mapped buffers are supported.
+    static bool IsPersistentSupported();
 
     /// Last sort key for combined distance and state sorting. Used by Renderer.
     std::pair<unsigned short, unsigned short> lastSortKey;
@@ -56,6 +62,8 @@ private:
 
     /// OpenGL object identifier.
     unsigned buffer;
+    /// Mapped memory of a persistent buffer.
+    void* mappedData;
     /// Number of vertices.
     size_t numVertices;
     /// Size of vertex in bytes.
@@ -0,0 +1,250 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Compression.h"
+#include "Stream.h"
+
+#include <cstring>
+#include <vector>
+
+/// Minimum match length of the LZ4 format.
+static const size_t MIN_MATCH = 4;
+/// Matches must start this many bytes before the end of the data.
+static const size_t MATCH_LIMIT = 12;
+/// The last bytes of the data are always literals.
+static const size_t LAST_LITERALS = 5;
+/// Maximum match offset.
+static const size_t MAX_OFFSET = 65535;
+/// Match finder hash table size as a power of two.
+static const unsigned HASH_BITS = 14;
+
+/// Read 4 bytes from possibly unaligned memory.
+static inline unsigned Read32(const unsigned char* src)
+{
+    unsigned ret;
+    memcpy(&ret, src, sizeof ret);
+    return ret;
+}
+
+/// Hash 4 bytes for the match finder.
+static inline unsigned Hash32(unsigned value)
+{
+    return (value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/// Write an LZ4 length continuation.
+static inline unsigned char* WriteLength(unsigned char* dest, size_t length)
+{
+    while (length >= 255)
+    {
+        *dest++ = 255;
+        length -= 255;
+    }
+    *dest++ = (unsigned char)length;
+    return dest;
+}
+
+/// Write a run of literals, followed by an optional match.
+static unsigned char* WriteSequence(unsigned char* dest, const unsigned char* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+    unsigned char* token = dest++;
+    *token = (unsigned char)((numLiterals < 15 ? numLiterals : 15) << 4);
+    if (numLiterals >= 15)
+        dest = WriteLength(dest, numLiterals - 15);
+    memcpy(dest, literals, numLiterals);
+    dest += numLiterals;
+
+    if (matchLength)
+    {
+        *dest++ = (unsigned char)(offset & 0xff);
+        *dest++ = (unsigned char)(offset >> 8);
+
+        size_t lengthCode = matchLength - MIN_MATCH;
+        *token |= (unsigned char)(lengthCode < 15 ? lengthCode : 15);
+        if (lengthCode >= 15)
+            dest = WriteLength(dest, lengthCode - 15);
+    }
+
+    return dest;
+}
+
+size_t CompressBound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+size_t CompressData(void* dest, const void* src, size_t srcSize)
+{
+    const unsigned char* srcStart = (const unsigned char*)src;
+    const unsigned char* srcEnd = srcStart + srcSize;
+    const unsigned char* ip = srcStart;
+    const unsigned char* anchor = srcStart;
+    unsigned char* op = (unsigned char*)dest;
+
+    if (srcSize > MATCH_LIMIT)
+    {
+        const unsigned char* matchStartLimit = srcEnd - MATCH_LIMIT;
+        const unsigned char* matchEndLimit = srcEnd - LAST_LITERALS;
+        std::vector<int> hashTable(1 << HASH_BITS, -1);
+
+        while (ip < matchStartLimit)
+        {
+            unsigned sequence = Read32(ip);
+            unsigned hash = Hash32(sequence);
+            int candidate = hashTable[hash];
+            hashTable[hash] = (int)(ip - srcStart);
+
+            if (candidate >= 0 && (size_t)(ip - srcStart - candidate) <= MAX_OFFSET && Read32(srcStart + candidate) == sequence)
+            {
+                const unsigned char* match = srcStart + candidate;
+                size_t matchLength = MIN_MATCH;
+                while (ip + matchLength < matchEndLimit && ip[matchLength] == match[matchLength])
+                    ++matchLength;
+
+                op = WriteSequence(op, anchor, ip - anchor, ip - match, matchLength);
+                ip += matchLength;
+                anchor = ip;
+            }
+            else
+                ++ip;
+        }
+    }
+
+    op = WriteSequence(op, anchor, srcEnd - anchor, 0, 0);
+    return op - (unsigned char*)dest;
+}
+
+size_t DecompressData(void* dest, size_t destSize, const void* src, size_t srcSize)
+{
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* srcEnd = ip + srcSize;
+    unsigned char* destStart = (unsigned char*)dest;
+    unsigned char* op = destStart;
+    unsigned char* destEnd = destStart + destSize;
+
+    while (ip < srcEnd)
+    {
+        unsigned token = *ip++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15)
+        {
+            unsigned char byte;
+            do
+            {
+                if (ip >= srcEnd)
+                    return 0;
+                byte = *ip++;
+                numLiterals += byte;
+            } while (byte == 255);
+        }
+
+        if ((size_t)(srcEnd - ip) < numLiterals || (size_t)(destEnd - op) < numLiterals)
+            return 0;
+        memcpy(op, ip, numLiterals);
+        ip += numLiterals;
+        op += numLiterals;
+
+        // The last sequence has only literals
+        if (ip >= srcEnd)
+            break;
+
+        if (srcEnd - ip < 2)
+            return 0;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - destStart))
+            return 0;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15)
+        {
+            unsigned char byte;
+            do
+            {
+                if (ip >= srcEnd)
+                    return 0;
+                byte = *ip++;
+                matchLength += byte;
+            } while (byte == 255);
+        }
+        matchLength += MIN_MATCH;
+
+        if ((size_t)(destEnd - op) < matchLength)
+            return 0;
+
+        // Matches may overlap the output, so copy byte by byte
+        const unsigned char* match = op - offset;
+        for (size_t i = 0; i < matchLength; ++i)
+            op[i] = match[i];
+        op += matchLength;
+    }
+
+    return op - destStart;
+}
+
+/// XOR data with a baseline over their common length.
+static void XorBaseline(unsigned char* data, size_t size, const unsigned char* baseline, size_t baselineSize)
+{
+    size_t length = size < baselineSize ? size : baselineSize;
+    size_t i = 0;
+    for (; i + sizeof(unsigned long long) <= length; i += sizeof(unsigned long long))
+    {
+        unsigned long long a, b;
+        memcpy(&a, data + i, sizeof a);
+        memcpy(&b, baseline + i, sizeof b);
+        a ^= b;
+        memcpy(data + i, &a, sizeof a);
+    }
+    for (; i < length; ++i)
+        data[i] ^= baseline[i];
+}
+
+bool WriteCompressed(Stream& dest, const void* src, size_t srcSize, const void* baseline, size_t baselineSize)
+{
+    if (!baseline)
+        baselineSize = 0;
+
+    const unsigned char* data = static_cast<const unsigned char*>(src);
+    std::vector<unsigned char> delta;
+    if (baselineSize && srcSize)
+    {
+        delta.assign(data, data + srcSize);
+        XorBaseline(&delta[0], srcSize, static_cast<const unsigned char*>(baseline), baselineSize);
+        data = &delta[0];
+    }
+
+    std::vector<unsigned char> compressed(CompressBound(srcSize));
+    size_t compressedSize = srcSize ? CompressData(&compressed[0], data, srcSize) : 0;
+
+    // The baseline size is stored to detect reading with a different baseline
+    dest.WriteVLE(srcSize);
+    dest.WriteVLE(baselineSize);
+    dest.WriteVLE(compressedSize);
+    return !compressedSize || dest.Write(&compressed[0], compressedSize) == compressedSize;
+}
+
+bool ReadCompressed(Stream& source, std::vector<unsigned char>& dest, const void* baseline, size_t baselineSize)
+{
+    if (!baseline)
+        baselineSize = 0;
+
+    size_t srcSize = source.ReadVLE();
+    size_t writtenBaselineSize = source.ReadVLE();
+    size_t compressedSize = source.ReadVLE();
+    if (writtenBaselineSize != baselineSize)
+        return false;
+
+    dest.resize(srcSize);
+    if (!srcSize)
+        return true;
+
+    std::vector<unsigned char> compressed(compressedSize);
+    if (!compressedSize || source.Read(&compressed[0], compressedSize) != compressedSize)
+        return false;
+    if (DecompressData(&dest[0], srcSize, &compressed[0], compressedSize) != srcSize)
+        return false;
+
+    if (baselineSize)
+        XorBaseline(&dest[0], srcSize, static_cast<const unsigned char*>(baseline), baselineSize);
+    return true;
+}
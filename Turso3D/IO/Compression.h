@@ -0,0 +1,19 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class Stream;
+
+/// Return the maximum size of data compressed with CompressData().
+size_t CompressBound(size_t srcSize);
+/// Compress data in LZ4 block format. Destination must hold CompressBound() bytes. Return compressed size.
+size_t CompressData(void* dest, const void* src, size_t srcSize);
+/// Decompress data in LZ4 block format. Return decompressed size, or zero if the data is malformed or does not fit the destination.
+size_t DecompressData(void* dest, size_t destSize, const void* src, size_t srcSize);
+/// Write data to a stream as a compressed block, prefixed with the uncompressed and compressed sizes. If a baseline is given, the data is XORed with it before compressing, so that bytes unchanged from the baseline compress to almost nothing. Return true on success.
+bool WriteCompressed(Stream& dest, const void* src, size_t srcSize, const void* baseline = nullptr, size_t baselineSize = 0);
+/// Read a block written with WriteCompressed(), using the same baseline as when writing. Return true on success.
+bool ReadCompressed(Stream& source, std::vector<unsigned char>& dest, const void* baseline = nullptr, size_t baselineSize = 0);
@@ -3,8 +3,13 @@
 #include "File.h"
 #include "FileSystem.h"
 
+#include <algorithm>
 #include <cstdio>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
 static const char* openModes[] =
 {
     "rb",
@@ -16,6 +21,7 @@ static const char* openModes[] =
 File::File() :
     mode(FILE_READ),
     handle(nullptr),
+    handlePosition(0),
     readSyncNeeded(false),
     writeSyncNeeded(false)
 {
@@ -24,6 +30,7 @@ File::File() :
 File::File(const std::string& fileName, FileMode mode) :
     mode(FILE_READ),
     handle(nullptr),
+    handlePosition(0),
     readSyncNeeded(false),
     writeSyncNeeded(false)
 {
@@ -62,6 +69,12 @@ bool File::Open(const std::string& fileName, FileMode fileMode)
     fseek((FILE*)handle, 0, SEEK_END);
     size = ftell((FILE*)handle);
     fseek((FILE*)handle, 0, SEEK_SET);
+    handlePosition = 0;
+
+    // Reads are buffered by the file itself, so the stdio buffer would only add a copy
+    if (mode == FILE_READ)
+        setvbuf((FILE*)handle, nullptr, _IONBF, 0);
+
     return true;
 }
 
@@ -75,6 +88,35 @@ size_t File::Read(void* dest, size_t numBytes)
     if (!numBytes)
         return 0;
 
+    if (mode == FILE_READ)
+    {
+        unsigned char* destPtr = (unsigned char*)dest;
+        size_t bytesLeft = numBytes;
+
+        while (bytesLeft)
+        {
+            if (position >= readWindowStart && position < readWindowEnd)
+            {
+                size_t copySize = std::min(bytesLeft, readWindowEnd - position);
+                memcpy(destPtr, readWindow + (position - readWindowStart), copySize);
+                destPtr += copySize;
+                position += copySize;
+                bytesLeft -= copySize;
+            }
+            else if (bytesLeft >= FILE_READ_BUFFER_SIZE)
+            {
+                if (!ReadUnbuffered(destPtr, bytesLeft))
+                    break;
+                position += bytesLeft;
+                bytesLeft = 0;
+            }
+            else if (!FillReadBuffer())
+                break;
+        }
+
+        return numBytes - bytesLeft;
+    }
+
     // Need to reassign the position due to internal buffering when transitioning from writing to reading
     if (readSyncNeeded)
     {
@@ -104,6 +146,13 @@ size_t File::Seek(size_t newPosition)
     if (mode == FILE_READ && newPosition > size)
         newPosition = size;
 
+    // In read mode the handle is repositioned on the next unbuffered read, so seeks within the buffer are free
+    if (mode == FILE_READ)
+    {
+        position = newPosition;
+        return position;
+    }
+
     fseek((FILE*)handle, (long)newPosition, SEEK_SET);
     position = newPosition;
     readSyncNeeded = false;
@@ -138,7 +187,7 @@ size_t File::Write(const void* data, size_t numBytes)
     if (position > size)
         size = position;
 
-    return size;
+    return numBytes;
 }
 
 bool File::IsReadable() const
@@ -151,6 +200,14 @@ bool File::IsWritable() const
     return handle != 0 && mode != FILE_READ;
 }
 
+void File::Prefetch()
+{
+    #ifndef _WIN32
+    if (handle && mode == FILE_READ && position < size)
+        posix_fadvise(fileno((FILE*)handle), (off_t)position, (off_t)(size - position), POSIX_FADV_WILLNEED);
+    #endif
+}
+
 void File::Close()
 {
     if (handle)
@@ -159,6 +216,8 @@ void File::Close()
         handle = 0;
         position = 0;
         size = 0;
+        handlePosition = 0;
+        ClearReadWindow();
     }
 }
 
@@ -172,3 +231,37 @@ bool File::IsOpen() const
 {
     return handle != 0;
 }
+
+bool File::ReadUnbuffered(void* dest, size_t numBytes)
+{
+    if (handlePosition != position)
+    {
+        fseek((FILE*)handle, (long)position, SEEK_SET);
+        handlePosition = position;
+    }
+
+    if (fread(dest, numBytes, 1, (FILE*)handle) != 1)
+    {
+        // If error, return to the position where the read began
+        fseek((FILE*)handle, (long)position, SEEK_SET);
+        return false;
+    }
+
+    handlePosition += numBytes;
+    return true;
+}
+
+bool File::FillReadBuffer()
+{
+    size_t numBytes = std::min(FILE_READ_BUFFER_SIZE, size - position);
+    readBuffer.resize(FILE_READ_BUFFER_SIZE);
+
+    if (!numBytes || !ReadUnbuffered(&readBuffer[0], numBytes))
+    {
+        ClearReadWindow();
+        return false;
+    }
+
+    SetReadWindow(&readBuffer[0], position, position + numBytes);
+    return true;
+}
@@ -14,7 +14,10 @@ enum FileMode
 
 class PackageFile;
 
-/// Filesystem file.
+/// Size of the read buffer of a file opened for reading. Larger reads bypass the buffer.
+static const size_t FILE_READ_BUFFER_SIZE = 65536;
+
+/// Filesystem file. In read mode, small reads are served from an internal buffer that is refilled in bulk, and exposed as the read window for inline reads of values.
 class File : public Stream
 {
 public:
@@ -35,6 +38,8 @@ public:
     bool IsReadable() const override;
     /// Return whether write operations are allowed.
     bool IsWritable() const override;
+    /// Request the rest of the file to be read into the operating system's cache in the background. Only has an effect in read mode.
+    void Prefetch() override;
 
     /// Open a file. Return true on success.
     bool Open(const std::string& fileName, FileMode fileMode = FILE_READ);
@@ -54,10 +59,19 @@ public:
     using Stream::Write;
     
 private:
+    /// Read from the file handle at the current position without buffering. Return true on success.
+    bool ReadUnbuffered(void* dest, size_t numBytes);
+    /// Refill the read buffer from the current position. Return true on success.
+    bool FillReadBuffer();
+
     /// Open mode.
     FileMode mode;
     /// File handle.
     void* handle;
+    /// Read buffer in read mode.
+    std::vector<unsigned char> readBuffer;
+    /// Position of the file handle in read mode, which may differ from the stream position due to buffering.
+    size_t handlePosition;
     /// Synchronization needed before read -flag.
     bool readSyncNeeded;
     /// Synchronization needed before write -flag.
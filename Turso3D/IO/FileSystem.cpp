@@ -250,6 +250,60 @@ void ScanDir(std::vector<std::string>& result, const std::string& pathName, cons
     ScanDirInternal(result, initialPath, initialPath, filter, flags, recursive);
 }
 
+void ScanDirEntries(std::vector<DirEntry>& result, const std::string& pathName)
+{
+    std::string path = AddTrailingSlash(pathName);
+    DirEntry entry;
+
+#ifdef _WIN32
+    WIN32_FIND_DATA info;
+    HANDLE handle = FindFirstFile(std::string(path + "*").c_str(), &info);
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            entry.name = info.cFileName;
+            if (entry.name.empty() || entry.name == "." || entry.name == ".." || (info.dwFileAttributes & FILE_ATTRIBUTE_HIDDEN))
+                continue;
+
+            // Convert from 100 nanosecond intervals since 1601 to seconds since 1970
+            unsigned long long writeTime = ((unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+            entry.isDir = (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+            entry.size = entry.isDir ? 0 : ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+            entry.modifiedTime = (unsigned)((writeTime - 116444736000000000ULL) / 10000000ULL);
+            result.push_back(entry);
+        } while (FindNextFile(handle, &info));
+
+        FindClose(handle);
+    }
+#else
+    DIR* dir = opendir(NativePath(path).c_str());
+    if (dir)
+    {
+        struct dirent* de;
+        struct stat st;
+
+        while ((de = readdir(dir)))
+        {
+            if (de->d_name[0] == '.')
+                continue;
+
+            // Stat relative to the open directory to avoid resolving the full path for each entry
+            if (!fstatat(dirfd(dir), de->d_name, &st, 0))
+            {
+                entry.name = de->d_name;
+                entry.isDir = S_ISDIR(st.st_mode);
+                entry.size = entry.isDir ? 0 : (unsigned long long)st.st_size;
+                entry.modifiedTime = (unsigned)st.st_mtime;
+                result.push_back(entry);
+            }
+        }
+
+        closedir(dir);
+    }
+#endif
+}
+
 std::string ExecutableDir()
 {
     std::string ret;
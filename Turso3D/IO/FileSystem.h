@@ -12,6 +12,19 @@ static const unsigned SCAN_DIRS = 0x2;
 /// Return also hidden files.
 static const unsigned SCAN_HIDDEN = 0x4;
 
+/// File or directory found by a directory scan, with the information the scan returns without further filesystem calls.
+struct DirEntry
+{
+    /// Name without path.
+    std::string name;
+    /// Size in bytes. Zero for directories.
+    unsigned long long size;
+    /// Last modified time as seconds since epoch.
+    unsigned modifiedTime;
+    /// Whether is a directory.
+    bool isDir;
+};
+
 /// Set the current working directory.
 bool SetCurrentDir(const std::string& pathName);
 /// Create a directory.
@@ -32,6 +45,8 @@ bool FileExists(const std::string& fileName);
 bool DirExists(const std::string& pathName);
 /// Scan a directory for specified files.
 void ScanDir(std::vector<std::string>& result, const std::string& pathName, const std::string& filter, unsigned flags = SCAN_FILES, bool recursive = false);
+/// Scan the files and subdirectories of a single directory with their sizes and last modified times. Hidden entries and the . and .. entries are skipped.
+void ScanDirEntries(std::vector<DirEntry>& result, const std::string& pathName);
 /// Return the executable's directory.
 std::string ExecutableDir();
 /// Split a full path to path, filename and extension.
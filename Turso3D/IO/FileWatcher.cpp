@@ -0,0 +1,274 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "FileSystem.h"
+#include "FileWatcher.h"
+#include "Log.h"
+#include "StringUtils.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+/// Events that mark a file changed, or a file or directory created or removed.
+static const unsigned WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM;
+#endif
+
+FileWatcher::FileWatcher() :
+    delay(DEFAULT_FILEWATCHER_DELAY),
+    watchSubDirs(false)
+#ifdef _WIN32
+    , dirHandle(nullptr)
+#elif defined(__linux__)
+    , watchHandle(-1)
+#endif
+{
+#ifdef __linux__
+    stopPipe[0] = -1;
+    stopPipe[1] = -1;
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+    StopWatching();
+}
+
+bool FileWatcher::StartWatching(const std::string& pathName, bool watchSubDirs_)
+{
+    StopWatching();
+
+    std::string watchPath = AddTrailingSlash(pathName);
+    watchSubDirs = watchSubDirs_;
+
+#ifdef _WIN32
+    dirHandle = CreateFileA(watchPath.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_WRITE | FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (dirHandle == INVALID_HANDLE_VALUE)
+    {
+        dirHandle = nullptr;
+        LOGERROR("Could not start watching directory " + watchPath);
+        return false;
+    }
+
+    path = watchPath;
+#elif defined(__linux__)
+    watchHandle = inotify_init();
+    if (watchHandle < 0 || pipe(stopPipe) < 0)
+    {
+        LOGERROR("Could not initialize file watching");
+        StopWatching();
+        return false;
+    }
+
+    path = watchPath;
+    if (!AddWatch(std::string()))
+    {
+        LOGERROR("Could not start watching directory " + watchPath);
+        StopWatching();
+        return false;
+    }
+#else
+    LOGERROR("File watching not supported on this platform");
+    return false;
+#endif
+
+    SetSchedulingClass(SCHEDULE_BACKGROUND);
+    Run();
+    LOGDEBUG("Started watching directory " + path);
+    return true;
+}
+
+void FileWatcher::StopWatching()
+{
+#ifdef _WIN32
+    if (handle)
+    {
+        // The thread may not have entered the blocking read yet, so repeat the cancel until it exits
+        shouldRun = false;
+        while (WaitForSingleObject((HANDLE)handle, 10) == WAIT_TIMEOUT)
+            CancelSynchronousIo((HANDLE)handle);
+    }
+    Stop();
+
+    if (dirHandle)
+    {
+        CloseHandle((HANDLE)dirHandle);
+        dirHandle = nullptr;
+    }
+#elif defined(__linux__)
+    if (handle)
+    {
+        char wakeup = 0;
+        if (write(stopPipe[1], &wakeup, 1) < 0)
+            LOGERROR("Could not wake up the file watcher thread");
+    }
+    Stop();
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (stopPipe[i] >= 0)
+        {
+            close(stopPipe[i]);
+            stopPipe[i] = -1;
+        }
+    }
+    if (watchHandle >= 0)
+    {
+        close(watchHandle);
+        watchHandle = -1;
+    }
+    dirNames.clear();
+#endif
+
+    std::lock_guard<std::mutex> lock(changesMutex);
+    changes.clear();
+    path.clear();
+}
+
+void FileWatcher::SetDelay(float seconds)
+{
+    delay = seconds > 0.0f ? seconds : 0.0f;
+}
+
+bool FileWatcher::NextChange(std::string& dest)
+{
+    unsigned delayMSec = (unsigned)(delay * 1000.0f);
+
+    std::lock_guard<std::mutex> lock(changesMutex);
+    for (auto it = changes.begin(); it != changes.end(); ++it)
+    {
+        if (it->second.ElapsedMSec() >= delayMSec)
+        {
+            dest = it->first;
+            changes.erase(it);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FileWatcher::ThreadFunction()
+{
+#ifdef _WIN32
+    static const DWORD BUFFER_SIZE = 4096;
+    DWORD buffer[BUFFER_SIZE / sizeof(DWORD)];
+
+    while (shouldRun)
+    {
+        DWORD bytesFilled = 0;
+        if (!ReadDirectoryChangesW((HANDLE)dirHandle, buffer, BUFFER_SIZE, watchSubDirs, FILE_NOTIFY_CHANGE_FILE_NAME |
+            FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, &bytesFilled, nullptr, nullptr))
+            continue;
+
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(buffer);
+        for (DWORD offset = 0; offset < bytesFilled;)
+        {
+            const FILE_NOTIFY_INFORMATION* record = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(data + offset);
+            if (record->Action == FILE_ACTION_ADDED || record->Action == FILE_ACTION_MODIFIED || record->Action == FILE_ACTION_RENAMED_NEW_NAME ||
+                record->Action == FILE_ACTION_REMOVED || record->Action == FILE_ACTION_RENAMED_OLD_NAME)
+            {
+                int numChars = (int)(record->FileNameLength / sizeof(WCHAR));
+                int length = WideCharToMultiByte(CP_UTF8, 0, record->FileName, numChars, nullptr, 0, nullptr, nullptr);
+                std::string fileName(length, '\0');
+                WideCharToMultiByte(CP_UTF8, 0, record->FileName, numChars, &fileName[0], length, nullptr, nullptr);
+                AddChange(NormalizePath(fileName));
+            }
+
+            if (!record->NextEntryOffset)
+                break;
+            offset += record->NextEntryOffset;
+        }
+    }
+#elif defined(__linux__)
+    static const size_t BUFFER_SIZE = 4096;
+    // Align for the event structures
+    int buffer[BUFFER_SIZE / sizeof(int)];
+
+    while (shouldRun)
+    {
+        pollfd fds[2];
+        fds[0].fd = watchHandle;
+        fds[0].events = POLLIN;
+        fds[1].fd = stopPipe[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+
+        ssize_t length = read(watchHandle, buffer, BUFFER_SIZE);
+        if (length <= 0)
+            continue;
+
+        const char* data = reinterpret_cast<const char*>(buffer);
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(data + offset);
+            auto it = dirNames.find(event->wd);
+
+            if (it != dirNames.end())
+            {
+                if (event->mask & IN_IGNORED)
+                    dirNames.erase(it);
+                else if (event->len)
+                {
+                    std::string fileName = it->second + event->name;
+                    if (event->mask & IN_ISDIR)
+                    {
+                        // Watch new subdirectories, which may already contain files
+                        if (watchSubDirs && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                            AddWatch(fileName + "/");
+                        AddChange(fileName);
+                    }
+                    else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM))
+                        AddChange(fileName);
+                }
+            }
+
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+#endif
+}
+
+void FileWatcher::AddChange(const std::string& fileName)
+{
+    std::lock_guard<std::mutex> lock(changesMutex);
+    changes[fileName].Reset();
+}
+
+#ifdef __linux__
+bool FileWatcher::AddWatch(const std::string& subDirName)
+{
+    int wd = inotify_add_watch(watchHandle, (path + subDirName).c_str(), WATCH_MASK);
+    if (wd < 0)
+        return false;
+
+    dirNames[wd] = subDirName;
+
+    if (watchSubDirs)
+    {
+        std::vector<std::string> subDirs;
+        ScanDir(subDirs, path + subDirName, "*.*", SCAN_DIRS, false);
+        for (auto it = subDirs.begin(); it != subDirs.end(); ++it)
+        {
+            if (*it != "." && *it != "..")
+                AddWatch(subDirName + *it + "/");
+        }
+    }
+
+    return true;
+}
+#endif
@@ -0,0 +1,70 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Thread/Thread.h"
+#include "../Time/Timer.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Default delay in seconds after the last change to a file before it is reported.
+static const float DEFAULT_FILEWATCHER_DELAY = 0.25f;
+
+/// Watches a directory and optionally its subdirectories for file changes on a background thread, using the operating system notifications instead of polling. Changes are reported after they have settled for the delay, so that a file written in several parts or saved repeatedly is reported once.
+class FileWatcher : public Thread
+{
+public:
+    /// Construct.
+    FileWatcher();
+    /// Destruct. Stop watching.
+    ~FileWatcher();
+
+    /// Wait for the notifications and record the changed files.
+    void ThreadFunction() override;
+
+    /// Start watching a directory. Return true on success.
+    bool StartWatching(const std::string& pathName, bool watchSubDirs);
+    /// Stop watching the directory and discard the unreported changes.
+    void StopWatching();
+    /// Set the delay in seconds after the last change to a file before it is reported.
+    void SetDelay(float seconds);
+    /// Return the next changed, created or removed file or directory name relative to the watched directory, if it has settled for the delay. Return true if a change was returned.
+    bool NextChange(std::string& dest);
+
+    /// Return the watched directory with a trailing slash, or empty if not watching.
+    const std::string& Path() const { return path; }
+    /// Return the delay in seconds.
+    float Delay() const { return delay; }
+
+private:
+    /// Record a change to a file, restarting its delay.
+    void AddChange(const std::string& fileName);
+#ifdef __linux__
+    /// Add an inotify watch for a subdirectory and, if watching subdirectories, its subdirectories. Return true on success.
+    bool AddWatch(const std::string& subDirName);
+#endif
+
+    /// Watched directory.
+    std::string path;
+    /// Changed file names and the time since the last change.
+    std::map<std::string, Timer> changes;
+    /// Mutex for the changes.
+    std::mutex changesMutex;
+    /// Delay in seconds.
+    float delay;
+    /// Whether watches subdirectories.
+    bool watchSubDirs;
+#ifdef _WIN32
+    /// Directory handle.
+    void* dirHandle;
+#elif defined(__linux__)
+    /// Subdirectory names by inotify watch descriptor.
+    std::map<int, std::string> dirNames;
+    /// Inotify instance descriptor.
+    int watchHandle;
+    /// Pipe for waking up the thread to stop.
+    int stopPipe[2];
+#endif
+};
@@ -0,0 +1,374 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "JSONReader.h"
+#include "Stream.h"
+#include "StringUtils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+JSONReader::JSONReader(const char* data, size_t size) :
+    start(data),
+    pos(data),
+    end(data + size),
+    errorPos(nullptr),
+    error(false)
+{
+}
+
+JSONReader::JSONReader(Stream& source) :
+    errorPos(nullptr),
+    error(false)
+{
+    size_t dataSize = source.Size() - source.Position();
+    start = reinterpret_cast<const char*>(source.ReadInPlace(dataSize));
+    if (!start)
+    {
+        buffer = new char[dataSize];
+        dataSize = source.Read(buffer.Get(), dataSize);
+        start = buffer.Get();
+    }
+
+    pos = start;
+    end = start + dataSize;
+}
+
+bool JSONReader::BeginObject()
+{
+    if (SkipWhiteSpace() != '{')
+    {
+        SkipValue();
+        return false;
+    }
+
+    ++pos;
+    return true;
+}
+
+bool JSONReader::NextKey()
+{
+    char c = SkipWhiteSpace();
+    if (c == ',')
+    {
+        ++pos;
+        c = SkipWhiteSpace();
+    }
+    if (c == '}')
+    {
+        ++pos;
+        return false;
+    }
+
+    if (c != '\"' || !ReadQuoted(key) || SkipWhiteSpace() != ':')
+    {
+        SetError();
+        return false;
+    }
+
+    ++pos;
+    return true;
+}
+
+bool JSONReader::BeginArray()
+{
+    if (SkipWhiteSpace() != '[')
+    {
+        SkipValue();
+        return false;
+    }
+
+    ++pos;
+    return true;
+}
+
+bool JSONReader::NextElement()
+{
+    char c = SkipWhiteSpace();
+    if (c == ',')
+    {
+        ++pos;
+        c = SkipWhiteSpace();
+    }
+    if (c == ']')
+    {
+        ++pos;
+        return false;
+    }
+
+    if (!c)
+        SetError();
+    return !error;
+}
+
+bool JSONReader::ReadBool()
+{
+    char c = SkipWhiteSpace();
+    if (c == 't')
+        return MatchLiteral("true");
+    else if (c == 'f')
+        MatchLiteral("false");
+    else
+        SkipValue();
+
+    return false;
+}
+
+double JSONReader::ReadNumber()
+{
+    char c = SkipWhiteSpace();
+    if (!isdigit(c) && c != '-')
+    {
+        SkipValue();
+        return 0.0;
+    }
+
+    double number = 0.0;
+    const char* numberEnd = ParseDouble(pos, number);
+    if (numberEnd == pos)
+        SetError();
+    pos = numberEnd;
+    return number;
+}
+
+const std::string& JSONReader::ReadString()
+{
+    value.clear();
+
+    if (SkipWhiteSpace() != '\"')
+        SkipValue();
+    else if (!ReadQuoted(value))
+        SetError();
+
+    return value;
+}
+
+void JSONReader::ReadValue(JSONValue& dest)
+{
+    dest.SetNull();
+
+    if (!SkipWhiteSpace() || !dest.Parse(pos, end))
+        SetError();
+}
+
+void JSONReader::SkipValue()
+{
+    int depth = 0;
+
+    do
+    {
+        char c = SkipWhiteSpace();
+        switch (c)
+        {
+        case 0:
+            SetError();
+            return;
+
+        case '{':
+        case '[':
+            ++depth;
+            ++pos;
+            break;
+
+        case '}':
+        case ']':
+            if (!depth)
+            {
+                // The enclosing object or array ended without a value
+                SetError();
+                return;
+            }
+            --depth;
+            ++pos;
+            break;
+
+        case ',':
+        case ':':
+            if (!depth)
+            {
+                SetError();
+                return;
+            }
+            ++pos;
+            break;
+
+        case '\"':
+            if (!ReadQuoted(value))
+            {
+                SetError();
+                return;
+            }
+            break;
+
+        case 't':
+        case 'f':
+        case 'n':
+            if (!MatchLiteral(c == 't' ? "true" : (c == 'f' ? "false" : "null")))
+                return;
+            break;
+
+        default:
+            if (!isdigit(c) && c != '-')
+            {
+                SetError();
+                return;
+            }
+            ReadNumber();
+            break;
+        }
+    } while (depth);
+}
+
+void JSONReader::SetPosition(size_t newPosition)
+{
+    if (!error)
+        pos = start + std::min(newPosition, (size_t)(end - start));
+}
+
+JSONType JSONReader::PeekType()
+{
+    char c = SkipWhiteSpace();
+    if (c == '{')
+        return JSON_OBJECT;
+    else if (c == '[')
+        return JSON_ARRAY;
+    else if (c == '\"')
+        return JSON_STRING;
+    else if (c == 't' || c == 'f')
+        return JSON_BOOL;
+    else if (isdigit(c) || c == '-')
+        return JSON_NUMBER;
+    else
+        return JSON_NULL;
+}
+
+unsigned JSONReader::Line() const
+{
+    unsigned line = 1;
+    for (const char* c = start; c < (error ? errorPos : pos); ++c)
+    {
+        if (*c == '\n')
+            ++line;
+    }
+
+    return line;
+}
+
+char JSONReader::SkipWhiteSpace()
+{
+    while (pos < end)
+    {
+        char c = *pos;
+        if ((unsigned char)c <= 0x20)
+            ++pos;
+        else if (c == '/' && pos + 1 < end && pos[1] == '/')
+        {
+            // Skip until end of line
+            while (pos < end && *pos != '\n')
+                ++pos;
+        }
+        else if (c == '/' && pos + 1 < end && pos[1] == '*')
+        {
+            // Skip until end of comment
+            pos += 2;
+            while (pos + 1 < end && (pos[0] != '*' || pos[1] != '/'))
+                ++pos;
+            pos = std::min(pos + 2, end);
+        }
+        else
+            return c;
+    }
+
+    return 0;
+}
+
+bool JSONReader::ReadQuoted(std::string& dest)
+{
+    // Skip the opening quote
+    ++pos;
+    dest.clear();
+
+    for (;;)
+    {
+        // Append runs without escapes at once
+        const char* run = pos;
+        while (pos < end && *pos != '\"' && *pos != '\\')
+            ++pos;
+        dest.append(run, pos - run);
+
+        if (pos >= end)
+            return false;
+
+        char c = *pos++;
+        if (c == '\"')
+            return true;
+
+        if (pos >= end)
+            return false;
+
+        c = *pos++;
+        switch (c)
+        {
+        case 'b':
+            dest += '\b';
+            break;
+
+        case 'f':
+            dest += '\f';
+            break;
+
+        case 'n':
+            dest += '\n';
+            break;
+
+        case 'r':
+            dest += '\r';
+            break;
+
+        case 't':
+            dest += '\t';
+            break;
+
+        case 'u':
+            {
+                /// \todo Doesn't handle unicode
+                unsigned code = 0;
+                if (end - pos < 4 || sscanf(pos, "%4x", &code) != 1)
+                    return false;
+                pos += 4;
+                dest += (char)code;
+            }
+            break;
+
+        default:
+            dest += c;
+            break;
+        }
+    }
+}
+
+bool JSONReader::MatchLiteral(const char* literal)
+{
+    while (*literal)
+    {
+        if (pos >= end || *pos != *literal)
+        {
+            SetError();
+            return false;
+        }
+
+        ++pos;
+        ++literal;
+    }
+
+    return true;
+}
+
+void JSONReader::SetError()
+{
+    if (!error)
+        errorPos = pos;
+    error = true;
+    pos = end;
+}
@@ -0,0 +1,75 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "JSONValue.h"
+
+/// Streaming JSON reader. Reads values in document order directly from the text without building a JSONValue tree, so that large files can be consumed without a heap allocation per value. Keys and strings are decoded into reused buffers.
+class JSONReader
+{
+public:
+    /// Construct over JSON text, which must stay alive while reading.
+    JSONReader(const char* data, size_t size);
+    /// Construct over the remaining data of a stream. The data is referenced in place if the stream supports it, in which case the stream must stay alive while reading, and copied otherwise.
+    JSONReader(Stream& source);
+
+    /// Begin reading an object. Return false and skip the value if it is not an object.
+    bool BeginObject();
+    /// Advance to the next key of the object being read, after which its value should be read or skipped. Return false when the object ends.
+    bool NextKey();
+    /// Begin reading an array. Return false and skip the value if it is not an array.
+    bool BeginArray();
+    /// Advance to the next element of the array being read, after which it should be read or skipped. Return false when the array ends.
+    bool NextElement();
+    /// Read a bool, or return false on type mismatch.
+    bool ReadBool();
+    /// Read a number, or return zero on type mismatch.
+    double ReadNumber();
+    /// Read a string, or return empty on type mismatch. The string stays valid until the next string is read.
+    const std::string& ReadString();
+    /// Read a value with all its nested values into a JSONValue tree.
+    void ReadValue(JSONValue& dest);
+    /// Skip a value with all its nested values.
+    void SkipValue();
+    /// Set the read position, for example to read an object again after scanning it.
+    void SetPosition(size_t newPosition);
+
+    /// Return the type of the next value without consuming it.
+    JSONType PeekType();
+    /// Return the key read by the last NextKey().
+    const std::string& Key() const { return key; }
+    /// Return the read position.
+    size_t Position() const { return pos - start; }
+    /// Return whether malformed data was encountered. Afterward all reads fail.
+    bool HasError() const { return error; }
+    /// Return the line number of the read position for diagnostics.
+    unsigned Line() const;
+
+private:
+    /// Skip whitespace and comments. Return the next character without consuming it, or 0 at the end.
+    char SkipWhiteSpace();
+    /// Read a quoted string into the destination. Return true on success.
+    bool ReadQuoted(std::string& dest);
+    /// Consume a literal. Return true if it matched.
+    bool MatchLiteral(const char* literal);
+    /// Mark the data malformed and stop reading.
+    void SetError();
+
+    /// Owned copy of the data when not referenced in place.
+    AutoArrayPtr<char> buffer;
+    /// Start of the data.
+    const char* start;
+    /// Read position.
+    const char* pos;
+    /// End of the data.
+    const char* end;
+    /// Position where malformed data was encountered.
+    const char* errorPos;
+    /// Current object key.
+    std::string key;
+    /// Last read string value.
+    std::string value;
+    /// Malformed data -flag.
+    bool error;
+};
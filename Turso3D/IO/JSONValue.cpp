@@ -317,7 +317,10 @@ void JSONValue::ToString(std::string& dest, int spacing, int indent) const
         return;
         
     case JSON_NUMBER:
-        dest += ::ToString(data.numberValue);
+        {
+            char buffer[NUMBER_BUFFER_SIZE];
+            dest.append(buffer, FormatDouble(buffer, data.numberValue));
+        }
         return;
         
     case JSON_STRING:
@@ -590,7 +593,9 @@ bool JSONValue::Parse(const char*& pos, const char*& end)
     else if (isdigit(c) || c == '-')
     {
         --pos;
-        *this = strtod(pos, const_cast<char**>(&pos));
+        double number = 0.0;
+        pos = ParseDouble(pos, number);
+        *this = number;
         return true;
     }
     else if (c == '\"')
@@ -40,6 +40,7 @@ struct JSONData
 class JSONValue
 {
     friend class JSONFile;
+    friend class JSONReader;
     
 public:
     /// Construct a null value.
@@ -0,0 +1,262 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "JSONValue.h"
+#include "JSONWriter.h"
+#include "Stream.h"
+#include "StringUtils.h"
+
+#include <cstdio>
+#include <cstring>
+
+JSONWriter::JSONWriter(Stream& dest_, int spacing_) :
+    dest(dest_),
+    spacing(spacing_),
+    afterKey(false),
+    error(false)
+{
+    buffer.reserve(JSON_WRITE_BUFFER_SIZE + NUMBER_BUFFER_SIZE);
+}
+
+JSONWriter::~JSONWriter()
+{
+    Flush();
+}
+
+void JSONWriter::BeginObject()
+{
+    BeginValue();
+    Append('{');
+    hasValues.push_back(false);
+}
+
+void JSONWriter::EndObject()
+{
+    bool nonEmpty = !hasValues.empty() && hasValues.back();
+    if (!hasValues.empty())
+        hasValues.pop_back();
+    if (nonEmpty)
+        AppendNewLine();
+    Append('}');
+}
+
+void JSONWriter::BeginArray()
+{
+    BeginValue();
+    Append('[');
+    hasValues.push_back(false);
+}
+
+void JSONWriter::EndArray()
+{
+    bool nonEmpty = !hasValues.empty() && hasValues.back();
+    if (!hasValues.empty())
+        hasValues.pop_back();
+    if (nonEmpty)
+        AppendNewLine();
+    Append(']');
+}
+
+void JSONWriter::Key(const char* key)
+{
+    BeginValue();
+    AppendQuoted(key, strlen(key));
+    Append(": ", 2);
+    afterKey = true;
+}
+
+void JSONWriter::Key(const std::string& key)
+{
+    BeginValue();
+    AppendQuoted(key.c_str(), key.length());
+    Append(": ", 2);
+    afterKey = true;
+}
+
+void JSONWriter::WriteNull()
+{
+    BeginValue();
+    Append("null", 4);
+}
+
+void JSONWriter::WriteBool(bool value)
+{
+    BeginValue();
+    if (value)
+        Append("true", 4);
+    else
+        Append("false", 5);
+}
+
+void JSONWriter::WriteInt(int value)
+{
+    BeginValue();
+    char number[NUMBER_BUFFER_SIZE];
+    Append(number, FormatInt(number, value));
+}
+
+void JSONWriter::WriteUInt(unsigned value)
+{
+    BeginValue();
+    char number[NUMBER_BUFFER_SIZE];
+    Append(number, FormatUInt(number, value));
+}
+
+void JSONWriter::WriteFloat(float value)
+{
+    BeginValue();
+    char number[NUMBER_BUFFER_SIZE];
+    Append(number, FormatFloat(number, value));
+}
+
+void JSONWriter::WriteNumber(double value)
+{
+    BeginValue();
+    char number[NUMBER_BUFFER_SIZE];
+    Append(number, FormatDouble(number, value));
+}
+
+void JSONWriter::WriteString(const char* value)
+{
+    BeginValue();
+    AppendQuoted(value, strlen(value));
+}
+
+void JSONWriter::WriteString(const std::string& value)
+{
+    BeginValue();
+    AppendQuoted(value.c_str(), value.length());
+}
+
+void JSONWriter::WriteFloats(const float* values, size_t count)
+{
+    BeginValue();
+    Append('\"');
+    char number[NUMBER_BUFFER_SIZE];
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i)
+            Append(' ');
+        Append(number, FormatFloat(number, values[i]));
+    }
+    Append('\"');
+}
+
+void JSONWriter::WriteValue(const JSONValue& value)
+{
+    BeginValue();
+    // Nested values are rare in scene data, so format them through the tree
+    std::string text;
+    value.ToString(text, spacing, (int)hasValues.size() * spacing);
+    Append(text.c_str(), text.length());
+}
+
+bool JSONWriter::Flush()
+{
+    if (buffer.length())
+    {
+        if (dest.Write(buffer.c_str(), buffer.length()) != buffer.length())
+            error = true;
+        buffer.clear();
+    }
+
+    return !error;
+}
+
+void JSONWriter::BeginValue()
+{
+    if (afterKey)
+    {
+        afterKey = false;
+        return;
+    }
+
+    if (!hasValues.empty())
+    {
+        if (hasValues.back())
+            Append(',');
+        hasValues.back() = true;
+        AppendNewLine();
+    }
+}
+
+void JSONWriter::AppendQuoted(const char* value, size_t length)
+{
+    Append('\"');
+
+    const char* runStart = value;
+    const char* end = value + length;
+    for (const char* pos = value; pos < end; ++pos)
+    {
+        unsigned char c = (unsigned char)*pos;
+        if (c >= 0x20 && c != '\"' && c != '\\')
+            continue;
+
+        Append(runStart, pos - runStart);
+        runStart = pos + 1;
+        Append('\\');
+
+        switch (c)
+        {
+        case '\"':
+        case '\\':
+            Append((char)c);
+            break;
+
+        case '\b':
+            Append('b');
+            break;
+
+        case '\f':
+            Append('f');
+            break;
+
+        case '\n':
+            Append('n');
+            break;
+
+        case '\r':
+            Append('r');
+            break;
+
+        case '\t':
+            Append('t');
+            break;
+
+        default:
+            {
+                char escape[8];
+                snprintf(escape, sizeof escape, "u%04x", (unsigned)c);
+                Append(escape, 5);
+            }
+            break;
+        }
+    }
+
+    Append(runStart, end - runStart);
+    Append('\"');
+}
+
+void JSONWriter::Append(const char* text, size_t length)
+{
+    if (buffer.size() + length > JSON_WRITE_BUFFER_SIZE)
+    {
+        Flush();
+        // Write long text directly instead of through the buffer
+        if (length > JSON_WRITE_BUFFER_SIZE)
+        {
+            if (dest.Write(text, length) != length)
+                error = true;
+            return;
+        }
+    }
+
+    buffer.append(text, length);
+}
+
+void JSONWriter::AppendNewLine()
+{
+    Append('\n');
+    size_t indent = hasValues.size() * spacing;
+    for (size_t i = 0; i < indent; ++i)
+        Append(' ');
+}
@@ -0,0 +1,85 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class JSONValue;
+class Stream;
+
+/// Size of the JSON writer's output buffer in bytes.
+static const size_t JSON_WRITE_BUFFER_SIZE = 64 * 1024;
+
+/// Streaming JSON writer. Writes values in document order to a stream through a fixed-size buffer without building a JSONValue tree, so that the memory use stays constant regardless of the document size. The output is indented like JSONValue::ToString(). Keys are written in the order given, and are not checked for duplicates.
+class JSONWriter
+{
+public:
+    /// Construct with the destination stream and the number of spaces per indent level.
+    JSONWriter(Stream& dest, int spacing = 2);
+    /// Destruct. Flush the remaining output.
+    ~JSONWriter();
+
+    /// Begin an object.
+    void BeginObject();
+    /// End the current object.
+    void EndObject();
+    /// Begin an array.
+    void BeginArray();
+    /// End the current array.
+    void EndArray();
+    /// Write an object key, after which its value should be written.
+    void Key(const char* key);
+    /// Write an object key, after which its value should be written.
+    void Key(const std::string& key);
+    /// Write a null value.
+    void WriteNull();
+    /// Write a bool.
+    void WriteBool(bool value);
+    /// Write an integer.
+    void WriteInt(int value);
+    /// Write an unsigned integer.
+    void WriteUInt(unsigned value);
+    /// Write a float, using the shortest representation that parses back to the same value.
+    void WriteFloat(float value);
+    /// Write a double.
+    void WriteNumber(double value);
+    /// Write a string.
+    void WriteString(const char* value);
+    /// Write a string.
+    void WriteString(const std::string& value);
+    /// Write floats as a string separated by spaces, without an intermediate string. Used for the vector and matrix types.
+    void WriteFloats(const float* values, size_t count);
+    /// Write a JSONValue tree.
+    void WriteValue(const JSONValue& value);
+    /// Write the buffered output to the stream. Return true if all output so far has been written successfully.
+    bool Flush();
+
+    /// Return whether writing to the stream has failed.
+    bool HasError() const { return error; }
+
+private:
+    /// Write the separator and indentation before a value, unless it follows a key.
+    void BeginValue();
+    /// Append a string with escapes and quotes.
+    void AppendQuoted(const char* value, size_t length);
+    /// Append raw text.
+    void Append(const char* text, size_t length);
+    /// Append a character.
+    void Append(char c) { if (buffer.size() >= JSON_WRITE_BUFFER_SIZE) Flush(); buffer += c; }
+    /// Append a newline and the current indentation.
+    void AppendNewLine();
+
+    /// Destination stream.
+    Stream& dest;
+    /// Output buffer.
+    std::string buffer;
+    /// Whether each open object or array has had values written to it, innermost last.
+    std::vector<bool> hasValues;
+    /// Spaces per indent level.
+    int spacing;
+    /// Whether a key has been written without its value.
+    bool afterKey;
+    /// Stream write failure -flag.
+    bool error;
+};
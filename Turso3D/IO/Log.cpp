@@ -5,7 +5,9 @@
 #include "../Time/TimeUtils.h"
 #include "Log.h"
 
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
 #include <ctime>
 
 const char* logLevelPrefixes[] =
@@ -17,21 +19,133 @@ const char* logLevelPrefixes[] =
     nullptr
 };
 
+/// Signals on which the log queue is flushed before the default handling.
+static const int crashSignals[] =
+{
+    SIGSEGV,
+    SIGABRT,
+    SIGFPE,
+    SIGILL
+};
+
+static const size_t NUM_CRASH_SIGNALS = sizeof crashSignals / sizeof crashSignals[0];
+
+/// Handlers that were installed for the crash signals before the log's own.
+static void (*previousSignalHandlers[NUM_CRASH_SIGNALS])(int);
+
+/// %Thread that writes the queued log messages to the outputs.
+class LogWriterThread : public Thread
+{
+public:
+    /// Construct.
+    LogWriterThread(Log* owner_) :
+        owner(owner_)
+    {
+    }
+
+    /// Write messages as they are queued until stopped, then write the remaining.
+    void ThreadFunction() override
+    {
+        while (shouldRun)
+        {
+            if (owner->WriteQueuedMessages())
+                continue;
+
+            // Announce sleeping before checking the queue once more, so that a message queued in between wakes the thread. The checks are made under the lock, so that a wakeup or shutdown between them and the wait is not lost
+            std::unique_lock<std::mutex> lock(owner->writerMutex);
+            owner->writerSleeping.store(true);
+            owner->writerCondition.wait(lock, [this]() { return !shouldRun || owner->NextMessageQueued(); });
+            owner->writerSleeping.store(false);
+        }
+
+        owner->WriteQueuedMessages();
+    }
+
+    /// Wake up the thread and wait for it to write the remaining messages and exit.
+    void Shutdown()
+    {
+        shouldRun = false;
+        owner->WakeWriter();
+        Stop();
+    }
+
+private:
+    /// Owning log.
+    Log* owner;
+};
+
+/// Flush the log queue when the program exits without destroying the log.
+static void FlushLogOnExit()
+{
+    Log* instance = Object::Subsystem<Log>();
+    if (instance)
+        instance->Flush();
+}
+
+/// Give the writer thread a moment to write the queued messages on a crash, then pass the signal to the previously installed handler.
+static void FlushLogOnSignal(int signalNumber)
+{
+    Log* instance = Object::Subsystem<Log>();
+    if (instance)
+    {
+        // The writer or the mutexes may be in an unknown state, so only wait with a time limit
+        for (unsigned i = 0; i < 100 && instance->HasQueuedMessages(); ++i)
+            Thread::Sleep(10);
+    }
+
+    void (*previous)(int) = SIG_DFL;
+    for (size_t i = 0; i < NUM_CRASH_SIGNALS; ++i)
+    {
+        if (crashSignals[i] == signalNumber && previousSignalHandlers[i] != SIG_ERR && previousSignalHandlers[i] != SIG_IGN)
+            previous = previousSignalHandlers[i];
+    }
+
+    signal(signalNumber, previous);
+    raise(signalNumber);
+}
+
 Log::Log() :
+    writeIndex(0),
+    readIndex(0),
 #ifdef _DEBUG
     level(LOG_DEBUG),
 #else
     level(LOG_INFO),
 #endif
     timeStamp(false),
+    writerSleeping(false),
     inWrite(false),
     quiet(false)
 {
+    for (unsigned i = 0; i < LOG_QUEUE_SIZE; ++i)
+        queue[i].sequence.store(i, std::memory_order_relaxed);
+
     RegisterSubsystem(this);
+
+    static bool handlersInstalled = false;
+    if (!handlersInstalled)
+    {
+        std::atexit(FlushLogOnExit);
+        for (size_t i = 0; i < NUM_CRASH_SIGNALS; ++i)
+            previousSignalHandlers[i] = signal(crashSignals[i], FlushLogOnSignal);
+        handlersInstalled = true;
+    }
+
+    // If the thread can not be started, messages are written in the calling thread
+    writerThread = new LogWriterThread(this);
+    writerThread->SetSchedulingClass(SCHEDULE_BACKGROUND);
+    if (!writerThread->Run())
+        writerThread.Reset();
 }
 
 Log::~Log()
 {
+    if (writerThread)
+    {
+        writerThread->Shutdown();
+        writerThread.Reset();
+    }
+
     Close();
     RemoveSubsystem(this);
 }
@@ -49,20 +163,27 @@ void Log::Open(const std::string& fileName)
             Close();
     }
 
-    logFile = new File();
-    if (logFile->Open(fileName, FILE_WRITE))
+    AutoPtr<File> newFile(new File());
+    if (newFile->Open(fileName, FILE_WRITE))
+    {
+        {
+            MutexLock lock(logMutex);
+            logFile = newFile;
+        }
         LOGINFO("Opened log file " + fileName);
+    }
     else
-    {
-        logFile.Reset();
         LOGERROR("Failed to create log file " + fileName);
-    }
 }
 
 void Log::Close()
 {
     if (logFile && logFile->IsOpen())
     {
+        // Write the messages that are still queued for the file
+        Flush();
+
+        MutexLock lock(logMutex);
         logFile->Close();
         logFile.Reset();
     }
@@ -72,35 +193,48 @@ void Log::SetLevel(int newLevel)
 {
     assert(newLevel >= LOG_DEBUG && newLevel < LOG_NONE);
 
-    level = newLevel;
+    level.store(newLevel, std::memory_order_relaxed);
 }
 
 void Log::SetTimeStamp(bool enable)
 {
-    timeStamp = enable;
+    timeStamp.store(enable, std::memory_order_relaxed);
 }
 
 void Log::SetQuiet(bool enable)
 {
-    quiet = enable;
+    quiet.store(enable, std::memory_order_relaxed);
 }
 
 void Log::EndFrame()
 {
-    MutexLock lock(logMutex);
-
-    // Process messages accumulated from other threads (if any)
-    while (!threadMessages.empty())
+    std::vector<StoredLogMessage> messages;
     {
-        const StoredLogMessage& stored = threadMessages.front();
+        MutexLock lock(logMutex);
+        messages.swap(threadMessages);
+    }
 
-        if (stored.level != LOG_RAW)
-            Write(stored.level, stored.message);
-        else
-            WriteRaw(stored.message, stored.error);
+    for (auto it = messages.begin(); it != messages.end(); ++it)
+        SendLogEvent(*it);
+}
 
-        threadMessages.pop_front();
+void Log::Flush()
+{
+    if (!writerThread)
+    {
+        WriteQueuedMessages();
+        return;
     }
+
+    // Wait for the writer to pass the messages queued so far, then for it to finish flushing the outputs
+    unsigned target = writeIndex.load();
+    while ((int)(target - readIndex.load()) > 0)
+    {
+        WakeWriter();
+        Thread::Sleep(0);
+    }
+
+    MutexLock lock(outputMutex);
 }
 
 void Log::Write(int msgLevel, const std::string& message)
@@ -108,94 +242,170 @@ void Log::Write(int msgLevel, const std::string& message)
     assert(msgLevel >= LOG_DEBUG && msgLevel < LOG_NONE);
     
     Log* instance = Subsystem<Log>();
-    if (!instance)
+    if (!instance || instance->Level() > msgLevel)
         return;
 
-    // If not in the main thread, store message for later processing
-    if (!Thread::IsMainThread())
-    {
-        MutexLock lock(instance->logMutex);
-        instance->threadMessages.push_back(StoredLogMessage(message, msgLevel, false));
+    // Do not log if currently sending a log event
+    bool mainThread = Thread::IsMainThread();
+    if (mainThread && instance->inWrite)
+        return;
+
+    StoredLogMessage stored(message, msgLevel, false, instance->timeStamp.load(std::memory_order_relaxed) ? CurrentTime() : 0, mainThread);
+    instance->QueueMessage(stored);
+    if (mainThread)
+        instance->SendLogEvent(stored);
+}
+
+void Log::WriteRaw(const std::string& message, bool error)
+{
+    Log* instance = Subsystem<Log>();
+    if (!instance)
         return;
-    }
 
-    // Do not log if message level excluded or if currently sending a log event
-    if (instance->level > msgLevel || instance->inWrite)
+    // Prevent recursion during log event
+    bool mainThread = Thread::IsMainThread();
+    if (mainThread && instance->inWrite)
         return;
 
-    std::string formattedMessage = logLevelPrefixes[msgLevel];
-    formattedMessage += ": " + message;
-    instance->lastMessage = message;
+    StoredLogMessage stored(message, LOG_RAW, error, 0, mainThread);
+    instance->QueueMessage(stored);
+    if (mainThread)
+        instance->SendLogEvent(stored);
+}
 
-    if (instance->timeStamp)
-        formattedMessage = "[" + TimeStamp() + "] " + formattedMessage;
-    
-    if (instance->quiet)
-    {
-        // If in quiet mode, still print the error message to the standard error stream
-        if (msgLevel == LOG_ERROR)
-            fprintf(stderr, "%s\n", formattedMessage.c_str());
-    }
-    else
-        fprintf(msgLevel == LOG_ERROR ? stderr : stdout, "%s\n", formattedMessage.c_str());
+void Log::QueueMessage(const StoredLogMessage& message)
+{
+    unsigned index = writeIndex.load(std::memory_order_relaxed);
+    LogQueueSlot* slot;
 
-    if (instance->logFile)
+    for (;;)
     {
-        instance->logFile->WriteLine(formattedMessage);
-        instance->logFile->Flush();
+        slot = &queue[index % LOG_QUEUE_SIZE];
+        int diff = (int)(slot->sequence.load(std::memory_order_acquire) - index);
+        if (!diff)
+        {
+            if (writeIndex.compare_exchange_weak(index, index + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // The queue is full: let the writer catch up
+            if (writerThread)
+            {
+                WakeWriter();
+                Thread::Sleep(0);
+            }
+            else
+                WriteQueuedMessages();
+            index = writeIndex.load(std::memory_order_relaxed);
+        }
+        else
+            index = writeIndex.load(std::memory_order_relaxed);
     }
 
-    instance->inWrite = true;
+    slot->message = message;
+    slot->sequence.store(index + 1);
 
-    LogMessageEvent& event = instance->logMessageEvent;
-    event.message = formattedMessage;
-    event.level = msgLevel;
-    instance->SendEvent(event);
+    if (!writerThread)
+        WriteQueuedMessages();
+    else if (writerSleeping.load())
+        WakeWriter();
+}
 
-    instance->inWrite = false;
+bool Log::NextMessageQueued() const
+{
+    unsigned index = readIndex.load();
+    return queue[index % LOG_QUEUE_SIZE].sequence.load() == index + 1;
 }
 
-void Log::WriteRaw(const std::string& message, bool error)
+void Log::WakeWriter()
 {
-    Log* instance = Subsystem<Log>();
-    if (!instance)
-        return;
+    // Locking the mutex before notifying ensures the writer is either still to check the queue, or already waiting
+    std::lock_guard<std::mutex> lock(writerMutex);
+    writerCondition.notify_one();
+}
 
-    // If not in the main thread, store message for later processing
-    if (!Thread::IsMainThread())
-    {
-        MutexLock lock(instance->logMutex);
-        instance->threadMessages.push_back(StoredLogMessage(message, LOG_RAW, error));
-        return;
-    }
-    
-    // Prevent recursion during log event
-    if (instance->inWrite)
-        return;
+bool Log::WriteQueuedMessages()
+{
+    MutexLock outputLock(outputMutex);
 
-    instance->lastMessage = message;
+    unsigned index = readIndex.load(std::memory_order_relaxed);
+    bool wrote = false;
 
-    if (instance->quiet)
+    for (;;)
     {
+        LogQueueSlot& slot = queue[index % LOG_QUEUE_SIZE];
+        if (slot.sequence.load(std::memory_order_acquire) != index + 1)
+            break;
+
+        StoredLogMessage message;
+        std::swap(message, slot.message);
+        slot.sequence.store(index + LOG_QUEUE_SIZE, std::memory_order_release);
+        readIndex.store(++index, std::memory_order_release);
+
+        bool raw = message.level == LOG_RAW;
+        bool error = raw ? message.error : message.level == LOG_ERROR;
+        std::string formattedMessage = FormatMessage(message);
+
         // If in quiet mode, still print the error message to the standard error stream
-        if (error)
-            fprintf(stderr, "%s\n", message.c_str());
+        if (!quiet.load(std::memory_order_relaxed) || error)
+            fprintf(error ? stderr : stdout, "%s\n", formattedMessage.c_str());
+
+        {
+            MutexLock lock(logMutex);
+            if (logFile)
+            {
+                if (raw)
+                    logFile->Write(formattedMessage.c_str(), formattedMessage.length());
+                else
+                    logFile->WriteLine(formattedMessage);
+            }
+            if (!message.mainThread)
+                threadMessages.push_back(message);
+        }
+
+        wrote = true;
     }
-    else
-        fprintf(error ? stderr : stdout, "%s\n", message.c_str());
 
-    if (instance->logFile)
+    if (wrote)
     {
-        instance->logFile->Write(message.c_str(), message.length());
-        instance->logFile->Flush();
+        fflush(stdout);
+        MutexLock lock(logMutex);
+        if (logFile)
+            logFile->Flush();
     }
 
-    instance->inWrite = true;
+    return wrote;
+}
+
+void Log::SendLogEvent(const StoredLogMessage& message)
+{
+    if (inWrite)
+        return;
+
+    lastMessage = message.message;
 
-    LogMessageEvent& event = instance->logMessageEvent;
-    event.message = message;
-    event.level = error ? LOG_ERROR : LOG_INFO;
-    instance->SendEvent(event);
+    if (!logMessageEvent.HasReceivers())
+        return;
+
+    inWrite = true;
+
+    LogMessageEvent& event = logMessageEvent;
+    event.message = FormatMessage(message);
+    event.level = message.level != LOG_RAW ? message.level : (message.error ? LOG_ERROR : LOG_INFO);
+    SendEvent(event);
 
-    instance->inWrite = false;
+    inWrite = false;
+}
+
+std::string Log::FormatMessage(const StoredLogMessage& message)
+{
+    if (message.level == LOG_RAW)
+        return message.message;
+
+    std::string formattedMessage = logLevelPrefixes[message.level];
+    formattedMessage += ": " + message.message;
+    if (message.time)
+        formattedMessage = "[" + TimeStamp(message.time) + "] " + formattedMessage;
+    return formattedMessage;
 }
@@ -7,10 +7,22 @@
 #include "../Object/Object.h"
 #include "StringUtils.h"
 
-#include <list>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
 
 #define USE_LOG
 
+/// Lowest message level compiled in; calls for lower levels are stripped by the macros. Define before including to override, for example as 2 to leave only warnings and errors.
+#ifndef LOG_COMPILE_LEVEL
+#ifdef _DEBUG
+#define LOG_COMPILE_LEVEL 0
+#else
+#define LOG_COMPILE_LEVEL 1
+#endif
+#endif
+
 /// Fictional message level to indicate a stored raw message.
 static const int LOG_RAW = -1;
 /// Debug message level. By default only shown in debug mode.
@@ -23,22 +35,31 @@ static const int LOG_WARNING = 2;
 static const int LOG_ERROR = 3;
 /// Disable all log messages.
 static const int LOG_NONE = 4;
+/// Number of messages the log queue can hold. Writers wait if the queue is full.
+static const unsigned LOG_QUEUE_SIZE = 1024;
 
 class File;
+class LogWriterThread;
 
-/// Stored log message from another thread.
+/// Stored log message waiting to be written.
 struct StoredLogMessage
 {
-    /// Construct undefined.
-    StoredLogMessage()
+    /// Construct empty.
+    StoredLogMessage() :
+        level(LOG_RAW),
+        time(0),
+        error(false),
+        mainThread(true)
     {
     }
     
     /// Construct with parameters.
-    StoredLogMessage(const std::string& message_, int level_, bool error_) :
+    StoredLogMessage(const std::string& message_, int level_, bool error_, unsigned time_, bool mainThread_) :
         message(message_),
         level(level_),
-        error(error_)
+        time(time_),
+        error(error_),
+        mainThread(mainThread_)
     {
     }
     
@@ -46,8 +67,21 @@ struct StoredLogMessage
     std::string message;
     /// Message level. -1 for raw messages.
     int level;
+    /// Time the message was logged, or zero if not timestamped.
+    unsigned time;
     /// Error flag for raw messages.
     bool error;
+    /// Whether was logged from the main thread. Messages from other threads send their log events at the end of the frame.
+    bool mainThread;
+};
+
+/// Slot of the log message queue.
+struct LogQueueSlot
+{
+    /// Sequence number that tells whether the slot is free for writing or holds a message to output.
+    std::atomic<unsigned> sequence;
+    /// Message.
+    StoredLogMessage message;
 };
 
 /// %Log message event.
@@ -60,15 +94,17 @@ public:
     int level;
 };
 
-/// Logging subsystem.
+/// Logging subsystem. Messages from any thread are pushed to a lock-free queue and written to the standard output and the log file by a background thread, so logging does not wait on I/O. The queue is flushed on destruction, on exit and on a crash signal.
 class Log : public Object
 {
     OBJECT(Log);
 
+    friend class LogWriterThread;
+
 public:
-    /// Construct and register subsystem.
+    /// Construct, start the writer thread and register subsystem.
     Log();
-    /// Destruct. Close the log file if open.
+    /// Destruct. Write the queued messages and close the log file if open.
     ~Log();
 
     /// Open the log file.
@@ -81,15 +117,19 @@ public:
     void SetTimeStamp(bool enable);
     /// Set quiet mode, ie. only output error messages to the standard error stream.
     void SetQuiet(bool enable);
-    /// Process threaded log messages at the end of a frame.
+    /// Send the log events of messages from other threads at the end of a frame.
     void EndFrame();
+    /// Wait until the queued messages have been written.
+    void Flush();
 
     /// Return logging level.
-    int Level() const { return level; }
+    int Level() const { return level.load(std::memory_order_relaxed); }
     /// Return whether log messages are timestamped.
     bool HasTimeStamp() const { return timeStamp; }
     /// Return last log message.
     const std::string& LastMessage() const { return lastMessage; }
+    /// Return whether there are queued messages not yet written.
+    bool HasQueuedMessages() const { return readIndex.load() != writeIndex.load(); }
 
     /// Write to the log. If logging level is higher than the level of the message, the message is ignored.
     static void Write(int msgLevel, const std::string& message);
@@ -100,27 +140,57 @@ public:
     LogMessageEvent logMessageEvent;
 
 private:
-    /// Mutex for threaded operation.
+    /// Push a message to the queue, waiting if it is full.
+    void QueueMessage(const StoredLogMessage& message);
+    /// Write the queued messages to the outputs. Called by the writer thread, or by the caller of Flush() if there is no writer thread. Return true if wrote any.
+    bool WriteQueuedMessages();
+    /// Send the log event of a message in the main thread.
+    void SendLogEvent(const StoredLogMessage& message);
+    /// Return whether the next message to output has been queued.
+    bool NextMessageQueued() const;
+    /// Wake up the writer thread if it is sleeping or about to sleep.
+    void WakeWriter();
+
+    /// Return a message formatted with the level prefix and timestamp.
+    static std::string FormatMessage(const StoredLogMessage& message);
+
+    /// Message queue.
+    LogQueueSlot queue[LOG_QUEUE_SIZE];
+    /// Sequence number of the next message to push.
+    std::atomic<unsigned> writeIndex;
+    /// Sequence number of the next message to output. Only modified by the writer.
+    std::atomic<unsigned> readIndex;
+    /// Writer thread.
+    AutoPtr<LogWriterThread> writerThread;
+    /// Mutex for the writer thread's sleep. Held while it checks whether to sleep, so that a wakeup can not be lost.
+    std::mutex writerMutex;
+    /// Condition for waking up the writer thread.
+    std::condition_variable writerCondition;
+    /// Mutex for the log file and the thread messages, shared between the main and writer threads.
     Mutex logMutex;
-    /// %Log messages from other threads.
-    std::list<StoredLogMessage> threadMessages;
+    /// Mutex that allows only one thread to output the queued messages.
+    Mutex outputMutex;
+    /// %Log messages from other threads whose events are sent at the end of the frame.
+    std::vector<StoredLogMessage> threadMessages;
     /// %Log file.
     AutoPtr<File> logFile;
     /// Last log message.
     std::string lastMessage;
     /// Logging level.
-    int level;
+    std::atomic<int> level;
     /// Use timestamps flag.
-    bool timeStamp;
+    std::atomic<bool> timeStamp;
+    /// Whether the writer thread is sleeping and needs to be woken up.
+    std::atomic<bool> writerSleeping;
     /// In write flag to prevent recursion.
     bool inWrite;
-    /// Quite mode flag.
-    bool quiet;
+    /// Quiet mode flag.
+    std::atomic<bool> quiet;
 };
 
 #ifdef USE_LOG
 
-#ifdef _DEBUG
+#if LOG_COMPILE_LEVEL <= 0
 #define LOGDEBUG(message) Log::Write(LOG_DEBUG, message)
 #define LOGDEBUGF(format, ...) Log::Write(LOG_DEBUG, FormatString(format, ##__VA_ARGS__))
 #else
@@ -128,13 +198,31 @@ private:
 #define LOGDEBUGF(format, ...)
 #endif
 
+#if LOG_COMPILE_LEVEL <= 1
 #define LOGINFO(message) Log::Write(LOG_INFO, message)
-#define LOGWARNING(message) Log::Write(LOG_WARNING, message)
-#define LOGERROR(message) Log::Write(LOG_ERROR, message)
-#define LOGRAW(message) Log::WriteRaw(message)
 #define LOGINFOF(format, ...) Log::Write(LOG_INFO, FormatString(format, ##__VA_ARGS__))
+#else
+#define LOGINFO(message)
+#define LOGINFOF(format, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL <= 2
+#define LOGWARNING(message) Log::Write(LOG_WARNING, message)
 #define LOGWARNINGF(format, ...) Log::Write(LOG_WARNING, FormatString(format, ##__VA_ARGS__))
+#else
+#define LOGWARNING(message)
+#define LOGWARNINGF(format, ...)
+#endif
+
+#if LOG_COMPILE_LEVEL <= 3
+#define LOGERROR(message) Log::Write(LOG_ERROR, message)
 #define LOGERRORF(format, ...) Log::Write(LOG_ERROR, FormatString(format, ##__VA_ARGS__))
+#else
+#define LOGERROR(message)
+#define LOGERRORF(format, ...)
+#endif
+
+#define LOGRAW(message) Log::WriteRaw(message)
 #define LOGRAWF(format, ...) Log::WriteRaw(FormatString(format, ##__VA_ARGS__))
 
 #else
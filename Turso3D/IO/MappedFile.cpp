@@ -0,0 +1,194 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "FileSystem.h"
+#include "MappedFile.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+    data(nullptr),
+    handle(nullptr),
+    mapping(nullptr)
+{
+}
+
+MappedFile::MappedFile(const std::string& fileName) :
+    data(nullptr),
+    handle(nullptr),
+    mapping(nullptr)
+{
+    Open(fileName);
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& fileName)
+{
+    Close();
+
+    if (fileName.empty())
+        return false;
+
+    #ifdef _WIN32
+    HANDLE fileHandle = CreateFile(NativePath(fileName).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || !fileSize.QuadPart)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    HANDLE mappingHandle = CreateFileMapping(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view)
+    {
+        if (mappingHandle)
+            CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    handle = fileHandle;
+    mapping = mappingHandle;
+    size = (size_t)fileSize.QuadPart;
+    #else
+    int fd = open(NativePath(fileName).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !st.st_size)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    handle = (void*)(size_t)fd;
+    size = (size_t)st.st_size;
+    #endif
+
+    data = (const unsigned char*)view;
+    name = fileName;
+    position = 0;
+    SetReadWindow(data, 0, size);
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data)
+    {
+        #ifdef _WIN32
+        UnmapViewOfFile(data);
+        CloseHandle((HANDLE)mapping);
+        CloseHandle((HANDLE)handle);
+        #else
+        munmap(const_cast<unsigned char*>(data), size);
+        close((int)(size_t)handle);
+        #endif
+
+        data = nullptr;
+        handle = nullptr;
+        mapping = nullptr;
+        position = 0;
+        size = 0;
+        ClearReadWindow();
+    }
+}
+
+size_t MappedFile::Read(void* dest, size_t numBytes)
+{
+    if (numBytes + position > size)
+        numBytes = size - position;
+    if (!numBytes)
+        return 0;
+
+    memcpy(dest, data + position, numBytes);
+    position += numBytes;
+    return numBytes;
+}
+
+size_t MappedFile::Seek(size_t newPosition)
+{
+    if (newPosition > size)
+        newPosition = size;
+
+    position = newPosition;
+    return position;
+}
+
+size_t MappedFile::Write(const void*, size_t)
+{
+    return 0;
+}
+
+bool MappedFile::IsReadable() const
+{
+    return data != nullptr;
+}
+
+bool MappedFile::IsWritable() const
+{
+    return false;
+}
+
+void MappedFile::Prefetch()
+{
+    PrefetchRange(position, size - position);
+}
+
+void MappedFile::PrefetchRange(size_t offset, size_t numBytes) const
+{
+    if (!data || offset >= size)
+        return;
+    if (numBytes > size - offset)
+        numBytes = size - offset;
+    if (!numBytes)
+        return;
+
+    #ifdef _WIN32
+    #if _WIN32_WINNT >= 0x0602
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<unsigned char*>(data + offset);
+    range.NumberOfBytes = numBytes;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    #endif
+    #else
+    // The advised range must start on a page boundary
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = offset & ~(pageSize - 1);
+    madvise(const_cast<unsigned char*>(data + start), numBytes + offset - start, MADV_WILLNEED);
+    #endif
+}
+
+const unsigned char* MappedFile::ReadInPlace(size_t numBytes)
+{
+    if (!data || numBytes + position > size)
+        return nullptr;
+
+    const unsigned char* ret = data + position;
+    position += numBytes;
+    return ret;
+}
@@ -0,0 +1,55 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Stream.h"
+
+/// Read-only filesystem file mapped to memory. Data can be referenced in place without copying for as long as the file stays open.
+class MappedFile : public Stream
+{
+public:
+    /// Construct.
+    MappedFile();
+    /// Construct and open a file.
+    MappedFile(const std::string& fileName);
+    /// Destruct. Unmap and close the file if open.
+    ~MappedFile();
+
+    /// Read bytes from the mapped memory. Return number of bytes actually read.
+    size_t Read(void* dest, size_t numBytes) override;
+    /// Set position in bytes from the beginning of the file.
+    size_t Seek(size_t newPosition) override;
+    /// Write bytes to the file. Not supported, return zero.
+    size_t Write(const void* data, size_t numBytes) override;
+    /// Return whether read operations are allowed.
+    bool IsReadable() const override;
+    /// Return whether write operations are allowed.
+    bool IsWritable() const override;
+    /// Return pointer to the next bytes in the mapped memory and advance the position.
+    const unsigned char* ReadInPlace(size_t numBytes) override;
+    /// Request the pages from the current position to the end to be read into memory in the background.
+    void Prefetch() override;
+
+    /// Open and map a file. Empty files can not be mapped. Return true on success.
+    bool Open(const std::string& fileName);
+    /// Unmap and close the file.
+    void Close();
+    /// Request a byte range of the mapped memory to be read in the background, so that the page faults of reading it later do not wait on storage one page at a time.
+    void PrefetchRange(size_t offset, size_t numBytes) const;
+
+    /// Return whether is open.
+    bool IsOpen() const { return data != nullptr; }
+    /// Return the mapped memory.
+    const unsigned char* Data() const { return data; }
+
+    using Stream::Read;
+    using Stream::Write;
+
+private:
+    /// Mapped memory.
+    const unsigned char* data;
+    /// File handle on Windows, or file descriptor on other platforms.
+    void* handle;
+    /// File mapping handle on Windows.
+    void* mapping;
+};
@@ -9,6 +9,7 @@ MemoryBuffer::MemoryBuffer(void* data, size_t numBytes) :
     buffer((unsigned char*)data),
     readOnly(false)
 {
+    SetReadWindow(buffer, 0, size);
 }
 
 MemoryBuffer::MemoryBuffer(const void* data, size_t numBytes) :
@@ -16,6 +17,7 @@ MemoryBuffer::MemoryBuffer(const void* data, size_t numBytes) :
     buffer((unsigned char*)data),
     readOnly(true)
 {
+    SetReadWindow(buffer, 0, size);
 }
 
 MemoryBuffer::MemoryBuffer(std::vector<unsigned char>& data) :
@@ -23,6 +25,7 @@ MemoryBuffer::MemoryBuffer(std::vector<unsigned char>& data) :
     buffer(&*data.begin()),
     readOnly(false)
 {
+    SetReadWindow(buffer, 0, size);
 }
 
 MemoryBuffer::MemoryBuffer(const std::vector<unsigned char>& data) :
@@ -30,6 +33,7 @@ MemoryBuffer::MemoryBuffer(const std::vector<unsigned char>& data) :
     buffer((const_cast<unsigned char*>(&*data.begin()))),
     readOnly(true)
 {
+    SetReadWindow(buffer, 0, size);
 }
 
 size_t MemoryBuffer::Read(void* dest, size_t numBytes)
@@ -113,3 +117,12 @@ bool MemoryBuffer::IsWritable() const
     return buffer && !readOnly;
 }
 
+const unsigned char* MemoryBuffer::ReadInPlace(size_t numBytes)
+{
+    if (numBytes + position > size)
+        return nullptr;
+
+    const unsigned char* ret = buffer + position;
+    position += numBytes;
+    return ret;
+}
@@ -27,6 +27,8 @@ public:
     bool IsReadable() const override;
     /// Return whether write operations are allowed.
     bool IsWritable() const override;
+    /// Return pointer to the next bytes in the memory area and advance the position.
+    const unsigned char* ReadInPlace(size_t numBytes) override;
 
     /// Return memory area.
     unsigned char* Data() { return buffer; }
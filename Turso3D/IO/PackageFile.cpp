@@ -0,0 +1,239 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/StringHash.h"
+#include "../Time/Profiler.h"
+#include "Compression.h"
+#include "Log.h"
+#include "MemoryBuffer.h"
+#include "PackageFile.h"
+
+#include <algorithm>
+#include <cstring>
+
+/// Compare package entries by name hash.
+static bool CompareEntries(const PackageEntry& lhs, unsigned rhs)
+{
+    return lhs.nameHash < rhs;
+}
+
+PackageFile::PackageFile()
+{
+}
+
+PackageFile::PackageFile(const std::string& fileName_)
+{
+    Open(fileName_);
+}
+
+PackageFile::~PackageFile()
+{
+}
+
+bool PackageFile::Open(const std::string& fileName_)
+{
+    PROFILE(OpenPackageFile);
+
+    Close();
+
+    if (!file.Open(fileName_))
+    {
+        LOGERROR("Could not open package file " + fileName_);
+        return false;
+    }
+
+    MemoryBuffer directory(file.Data(), file.Size());
+    if (directory.ReadFileID() != "TPAK")
+    {
+        LOGERROR(fileName_ + " is not a valid package file");
+        file.Close();
+        return false;
+    }
+
+    size_t numEntries = directory.Read<unsigned>();
+    entries.resize(numEntries);
+    for (size_t i = 0; i < numEntries; ++i)
+    {
+        PackageEntry& entry = entries[i];
+        entry.nameHash = directory.Read<unsigned>();
+        entry.offset = directory.Read<unsigned>();
+        entry.size = directory.Read<unsigned>();
+        entry.packedSize = directory.Read<unsigned>();
+        entry.name = directory.Read<std::string>();
+
+        size_t dataSize = entry.packedSize ? entry.packedSize : entry.size;
+        if (directory.IsEof() || (size_t)entry.offset + dataSize > file.Size() || (i && entry.nameHash < entries[i - 1].nameHash))
+        {
+            LOGERROR("Corrupt directory in package file " + fileName_);
+            entries.clear();
+            file.Close();
+            return false;
+        }
+    }
+
+    fileName = fileName_;
+    LOGINFOF("Opened package file %s with %d entries", fileName.c_str(), (int)entries.size());
+    return true;
+}
+
+void PackageFile::Close()
+{
+    file.Close();
+    entries.clear();
+    fileName.clear();
+}
+
+AutoPtr<Stream> PackageFile::OpenEntry(const std::string& name)
+{
+    const PackageEntry* entry = FindEntry(name);
+    if (!entry)
+        return AutoPtr<Stream>();
+
+    PackageEntryStream* stream = new PackageEntryStream(this, *entry);
+    stream->SetName(name);
+    return AutoPtr<Stream>(stream);
+}
+
+const PackageEntry* PackageFile::FindEntry(const std::string& name) const
+{
+    unsigned nameHash = StringHash(name).Value();
+
+    // Names with the same hash are next to each other
+    for (auto it = std::lower_bound(entries.begin(), entries.end(), nameHash, CompareEntries); it != entries.end() && it->nameHash == nameHash; ++it)
+    {
+        if (it->name == name)
+            return &(*it);
+    }
+
+    return nullptr;
+}
+
+PackageEntryStream::PackageEntryStream(PackageFile* package_, const PackageEntry& entry) :
+    Stream(entry.size),
+    package(package_),
+    entryData(package_->Data() + entry.offset),
+    storedSize(entry.packedSize ? entry.packedSize : entry.size),
+    currentBlock(-1)
+{
+    if (entry.packedSize)
+    {
+        // Walk the block headers up front to allow seeking
+        size_t numBlocks = (entry.size + PACKAGE_BLOCK_SIZE - 1) / PACKAGE_BLOCK_SIZE;
+        size_t blockOffset = 0;
+        blockOffsets.resize(numBlocks);
+        for (size_t i = 0; i < numBlocks && blockOffset + sizeof(unsigned) <= entry.packedSize; ++i)
+        {
+            unsigned packedBlockSize;
+            memcpy(&packedBlockSize, entryData + blockOffset, sizeof packedBlockSize);
+            blockOffsets[i] = (unsigned)blockOffset;
+            blockOffset += sizeof(unsigned) + packedBlockSize;
+        }
+    }
+    else
+        SetReadWindow(entryData, 0, size);
+}
+
+size_t PackageEntryStream::Read(void* dest, size_t numBytes)
+{
+    if (numBytes + position > size)
+        numBytes = size - position;
+    if (!numBytes)
+        return 0;
+
+    if (!IsCompressed())
+    {
+        memcpy(dest, entryData + position, numBytes);
+        position += numBytes;
+        return numBytes;
+    }
+
+    unsigned char* destPtr = (unsigned char*)dest;
+    size_t bytesLeft = numBytes;
+    while (bytesLeft)
+    {
+        size_t blockIndex = position / PACKAGE_BLOCK_SIZE;
+        if ((int)blockIndex != currentBlock && !DecompressBlock(blockIndex))
+            break;
+
+        size_t blockPosition = position - blockIndex * PACKAGE_BLOCK_SIZE;
+        size_t copySize = std::min(bytesLeft, blockData.size() - blockPosition);
+        memcpy(destPtr, &blockData[blockPosition], copySize);
+        destPtr += copySize;
+        position += copySize;
+        bytesLeft -= copySize;
+    }
+
+    return numBytes - bytesLeft;
+}
+
+size_t PackageEntryStream::Seek(size_t newPosition)
+{
+    if (newPosition > size)
+        newPosition = size;
+
+    position = newPosition;
+    return position;
+}
+
+size_t PackageEntryStream::Write(const void*, size_t)
+{
+    return 0;
+}
+
+bool PackageEntryStream::IsReadable() const
+{
+    return true;
+}
+
+bool PackageEntryStream::IsWritable() const
+{
+    return false;
+}
+
+const unsigned char* PackageEntryStream::ReadInPlace(size_t numBytes)
+{
+    if (IsCompressed() || numBytes + position > size)
+        return nullptr;
+
+    const unsigned char* ret = entryData + position;
+    position += numBytes;
+    return ret;
+}
+
+void PackageEntryStream::Prefetch()
+{
+    // Compressed data is prefetched from the start of the current block
+    size_t offset = position;
+    if (IsCompressed())
+    {
+        size_t index = position / PACKAGE_BLOCK_SIZE;
+        offset = index < blockOffsets.size() ? blockOffsets[index] : storedSize;
+    }
+
+    if (offset < storedSize)
+        package->PrefetchRange(entryData - package->Data() + offset, storedSize - offset);
+}
+
+bool PackageEntryStream::DecompressBlock(size_t index)
+{
+    PROFILE(DecompressPackageBlock);
+
+    size_t blockSize = std::min(PACKAGE_BLOCK_SIZE, size - index * PACKAGE_BLOCK_SIZE);
+    unsigned packedBlockSize;
+    memcpy(&packedBlockSize, entryData + blockOffsets[index], sizeof packedBlockSize);
+    const unsigned char* packedData = entryData + blockOffsets[index] + sizeof(unsigned);
+
+    blockData.resize(blockSize);
+    if (packedBlockSize == blockSize)
+        memcpy(&blockData[0], packedData, blockSize);
+    else if (DecompressData(&blockData[0], blockSize, packedData, packedBlockSize) != blockSize)
+    {
+        LOGERRORF("Corrupt compressed data in %s", name.c_str());
+        currentBlock = -1;
+        ClearReadWindow();
+        return false;
+    }
+
+    currentBlock = (int)index;
+    SetReadWindow(&blockData[0], index * PACKAGE_BLOCK_SIZE, index * PACKAGE_BLOCK_SIZE + blockSize);
+    return true;
+}
@@ -0,0 +1,118 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+#include "MappedFile.h"
+
+/// Alignment of entry data in a package file.
+static const size_t PACKAGE_ALIGNMENT = 4096;
+/// Uncompressed size of a compressed entry data block.
+static const size_t PACKAGE_BLOCK_SIZE = 65536;
+
+/// %File entry within a package file.
+struct PackageEntry
+{
+    /// Hash of the sanitated resource name. The directory is sorted by this.
+    unsigned nameHash;
+    /// Offset of the data from the package file start, aligned to PACKAGE_ALIGNMENT.
+    unsigned offset;
+    /// Uncompressed size.
+    unsigned size;
+    /// Compressed size including block headers, or zero if stored uncompressed. Compressed data consists of blocks of PACKAGE_BLOCK_SIZE uncompressed bytes, each preceded by its compressed size. A block whose compressed size equals its uncompressed size is stored as is.
+    unsigned packedSize;
+    /// %Resource name.
+    std::string name;
+};
+
+/// Package file containing resources, with a directory of entries sorted by name hash. The package is memory-mapped, so uncompressed entries can be read in place.
+class PackageFile : public RefCounted
+{
+public:
+    /// Construct.
+    PackageFile();
+    /// Construct and open.
+    PackageFile(const std::string& fileName);
+    /// Destruct.
+    ~PackageFile();
+
+    /// Open a package file and read its directory. Return true on success.
+    bool Open(const std::string& fileName);
+    /// Close the package file.
+    void Close();
+    /// Open an entry for reading. Return a pointer to the stream, or null if not found.
+    AutoPtr<Stream> OpenEntry(const std::string& name);
+
+    /// Return entry by name, or null if not found.
+    const PackageEntry* FindEntry(const std::string& name) const;
+    /// Return whether an entry exists.
+    bool Exists(const std::string& name) const { return FindEntry(name) != nullptr; }
+    /// Request a byte range of the package to be read into memory in the background.
+    void PrefetchRange(size_t offset, size_t numBytes) const { file.PrefetchRange(offset, numBytes); }
+
+    /// Return whether is open.
+    bool IsOpen() const { return file.IsOpen(); }
+    /// Return package file name.
+    const std::string& FileName() const { return fileName; }
+    /// Return entries sorted by name hash.
+    const std::vector<PackageEntry>& Entries() const { return entries; }
+    /// Return mapped package data.
+    const unsigned char* Data() const { return file.Data(); }
+    /// Return package size in bytes.
+    size_t Size() const { return file.Size(); }
+
+private:
+    /// Package file name.
+    std::string fileName;
+    /// Memory-mapped package file.
+    MappedFile file;
+    /// Entries sorted by name hash.
+    std::vector<PackageEntry> entries;
+};
+
+/// Read-only stream of a package file entry. Compressed entries are decompressed one block at a time as they are read.
+class PackageEntryStream : public Stream
+{
+public:
+    /// Construct for an entry of an open package.
+    PackageEntryStream(PackageFile* package, const PackageEntry& entry);
+
+    /// Read bytes from the entry. Return number of bytes actually read.
+    size_t Read(void* dest, size_t numBytes) override;
+    /// Set position in bytes from the beginning of the entry.
+    size_t Seek(size_t newPosition) override;
+    /// Write bytes. Not supported, return zero.
+    size_t Write(const void* data, size_t numBytes) override;
+    /// Return whether read operations are allowed.
+    bool IsReadable() const override;
+    /// Return whether write operations are allowed.
+    bool IsWritable() const override;
+    /// Return pointer to the next bytes and advance the position. Null for compressed entries.
+    const unsigned char* ReadInPlace(size_t numBytes) override;
+    /// Request the entry data from the current position to the end to be read from the package in the background.
+    void Prefetch() override;
+
+    /// Return whether the entry is compressed.
+    bool IsCompressed() const { return blockOffsets.size() > 0; }
+
+    using Stream::Read;
+    using Stream::Write;
+
+private:
+    /// Decompress a block into the block buffer. Return true on success.
+    bool DecompressBlock(size_t index);
+
+    /// Package, kept alive for the mapped data.
+    SharedPtr<PackageFile> package;
+    /// Entry data in the mapped package.
+    const unsigned char* entryData;
+    /// Size of the entry data in the package, compressed or uncompressed.
+    size_t storedSize;
+    /// Offsets of compressed blocks from the entry data start.
+    std::vector<unsigned> blockOffsets;
+    /// Decompressed block data.
+    std::vector<unsigned char> blockData;
+    /// Index of the decompressed block, or negative if none.
+    int currentBlock;
+};
@@ -12,15 +12,15 @@ bool ResourceRef::FromString(const std::string& str)
 
 bool ResourceRef::FromString(const char* string)
 {
-    std::vector<std::string> values = Split(string, ';');
-    if (values.size() == 2)
-    {
-        type = values[0];
-        name = values[1];
-        return true;
-    }
-    else
+    size_t typeLength, nameLength, extraLength;
+    const char* typeStart = NextToken(string, ';', typeLength);
+    const char* nameStart = NextToken(string, ';', nameLength);
+    if (!nameStart || NextToken(string, ';', extraLength))
         return false;
+
+    type = StringHash(std::string(typeStart, typeLength));
+    name.assign(nameStart, nameLength);
+    return true;
 }
 
 void ResourceRef::FromBinary(Stream& source)
@@ -47,17 +47,16 @@ bool ResourceRefList::FromString(const std::string& str)
 
 bool ResourceRefList::FromString(const char* string)
 {
-    std::vector<std::string> values = Split(string, ';');
-    if (values.size() >= 1)
-    {
-        type = values[0];
-        names.clear();
-        for (size_t i = 1; i < values.size(); ++i)
-            names.push_back(values[i]);
-        return true;
-    }
-    else
+    size_t length;
+    const char* start = NextToken(string, ';', length);
+    if (!start)
         return false;
+
+    type = StringHash(std::string(start, length));
+    names.clear();
+    while ((start = NextToken(string, ';', length)))
+        names.push_back(std::string(start, length));
+    return true;
 }
 
 void ResourceRefList::FromBinary(Stream& source)
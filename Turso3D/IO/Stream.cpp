@@ -1,6 +1,7 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../Math/Math.h"
+#include "MemoryBuffer.h"
 #include "Stream.h"
 #include "JSONValue.h"
 #include "ObjectRef.h"
@@ -8,13 +9,19 @@
 
 Stream::Stream() :
     position(0),
-    size(0)
+    size(0),
+    readWindow(nullptr),
+    readWindowStart(0),
+    readWindowEnd(0)
 {
 }
 
 Stream::Stream(size_t numBytes) :
     position(0),
-    size(numBytes)
+    size(numBytes),
+    readWindow(nullptr),
+    readWindowStart(0),
+    readWindowEnd(0)
 {
 }
 
@@ -22,6 +29,15 @@ Stream::~Stream()
 {
 }
 
+const unsigned char* Stream::ReadInPlace(size_t)
+{
+    return nullptr;
+}
+
+void Stream::Prefetch()
+{
+}
+
 void Stream::SetName(const std::string& newName)
 {
     name = newName;
@@ -100,6 +116,19 @@ std::vector<unsigned char> Stream::ReadBuffer()
     return ret;
 }
 
+MemoryBuffer Stream::ReadBufferInPlace(std::vector<unsigned char>& storage)
+{
+    size_t numBytes = ReadVLE();
+    const unsigned char* data = numBytes ? ReadInPlace(numBytes) : nullptr;
+    if (data)
+        return MemoryBuffer(data, numBytes);
+
+    storage.resize(numBytes);
+    if (numBytes)
+        storage.resize(Read(&storage[0], numBytes));
+    return MemoryBuffer(storage.empty() ? nullptr : (const void*)&storage[0], storage.size());
+}
+
 template<> bool Stream::Read<bool>()
 {
     return Read<unsigned char>() != 0;
@@ -108,7 +137,20 @@ template<> bool Stream::Read<bool>()
 template<> std::string Stream::Read<std::string>()
 {
     std::string ret;
-    
+
+    // Find the terminator within the read window to copy the string at once
+    if (position >= readWindowStart && position < readWindowEnd)
+    {
+        const char* start = reinterpret_cast<const char*>(readWindow + (position - readWindowStart));
+        const char* end = static_cast<const char*>(memchr(start, 0, readWindowEnd - position));
+        if (end)
+        {
+            ret.assign(start, end);
+            position += ret.length() + 1;
+            return ret;
+        }
+    }
+
     while (!IsEof())
     {
         char c = Read<char>();
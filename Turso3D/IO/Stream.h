@@ -2,10 +2,12 @@
 
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <vector>
 
 class JSONValue;
+class MemoryBuffer;
 class StringHash;
 struct ObjectRef;
 struct ResourceRef;
@@ -32,6 +34,10 @@ public:
     virtual bool IsReadable() const = 0;
     /// Return whether write operations are allowed.
     virtual bool IsWritable() const = 0;
+    /// Return pointer to the next bytes for reading them in place without a copy and advance the position, or null if not supported by the stream or not enough data. Default returns null.
+    virtual const unsigned char* ReadInPlace(size_t numBytes);
+    /// Hint that the rest of the stream will be read soon, so that the operating system can start reading the data from storage in the background without blocking the caller. Default does nothing.
+    virtual void Prefetch();
 
     /// Change the stream name.
     void SetName(const std::string& newName);
@@ -45,6 +51,8 @@ public:
     std::string ReadFileID();
     /// Read a byte buffer, with size prepended as a VLE value.
     std::vector<unsigned char> ReadBuffer();
+    /// Read a byte buffer, with size prepended as a VLE value, without copying if the stream supports reading in place. Otherwise the data is read into the storage vector. Return a read-only memory buffer of the data, valid while the stream or the storage is.
+    MemoryBuffer ReadBufferInPlace(std::vector<unsigned char>& storage);
     /// Write a four-letter file ID. If the string is not long enough, spaces will be appended.
     void WriteFileID(const std::string& value);
     /// Write a byte buffer, with size encoded as VLE.
@@ -57,11 +65,17 @@ public:
     /// Write a value, template version.
     template <class T> void Write(const T& value) { Write(&value, sizeof value); }
 
-    /// Read a value, template version.
+    /// Read a value, template version. Copies directly from the read window if the value is within it, otherwise calls the virtual Read().
     template <class T> T Read()
     {
         T ret;
-        Read(&ret, sizeof ret);
+        if (position >= readWindowStart && position + sizeof ret <= readWindowEnd)
+        {
+            memcpy(static_cast<void*>(&ret), readWindow + (position - readWindowStart), sizeof ret);
+            position += sizeof ret;
+        }
+        else
+            Read(&ret, sizeof ret);
         return ret;
     }
     
@@ -75,12 +89,28 @@ public:
     bool IsEof() const { return position >= size; }
     
 protected:
+    /// Set the read window: stream bytes from start to end that are in memory at data, so that small reads can be done inline without the virtual Read(). The data must stay valid and unchanged until the window is changed or cleared.
+    void SetReadWindow(const unsigned char* data, size_t start, size_t end)
+    {
+        readWindow = data;
+        readWindowStart = start;
+        readWindowEnd = data ? end : 0;
+    }
+    /// Clear the read window.
+    void ClearReadWindow() { SetReadWindow(nullptr, 0, 0); }
+
     /// Stream position.
     size_t position;
     /// Stream size.
     size_t size;
     /// Stream name.
     std::string name;
+    /// Read window data, corresponding to the stream position readWindowStart.
+    const unsigned char* readWindow;
+    /// Stream position of the read window start.
+    size_t readWindowStart;
+    /// Stream position of the read window end.
+    size_t readWindowEnd;
 };
 
 template<> bool Stream::Read();
@@ -3,24 +3,61 @@
 #include "StringHash.h"
 #include "StringUtils.h"
 
-#include <cctype>
 #include <cstdio>
+#include <map>
+#include <mutex>
 
 const StringHash StringHash::ZERO;
 
+/// Global registered strings by hash.
+struct StringHashRegistry
+{
+    /// Strings by hash.
+    std::map<StringHash, std::string> strings;
+    /// Lock for registering and lookup.
+    std::mutex mutex;
+};
+
+static StringHashRegistry& Registry()
+{
+    // Construct on first use, as types and attributes are registered from static initializers as well
+    static StringHashRegistry registry;
+    return registry;
+}
+
 std::string StringHash::ToString() const
 {
     return FormatString("%08X", value);
 }
 
-unsigned StringHash::Calculate(const char* str)
+const std::string& StringHash::Reverse() const
 {
-    unsigned hash = 0;
-    while (*str)
-    {
-        hash = (tolower(*str)) + (hash << 6) + (hash << 16) - hash;
-        ++str;
-    }
+    static const std::string noString;
+
+    StringHashRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    // Map entries are never erased, so the reference stays valid
+    auto it = registry.strings.find(*this);
+    return it != registry.strings.end() ? it->second : noString;
+}
 
+StringHash StringHash::Register(const std::string& str)
+{
+    StringHash hash(str);
+    StringHashRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.strings.insert(std::make_pair(hash, str));
     return hash;
 }
+
+StringHash StringHash::Register(const char* str)
+{
+    return Register(std::string(str));
+}
+
+size_t StringHash::NumRegistered()
+{
+    StringHashRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.strings.size();
+}
@@ -4,24 +4,24 @@
 
 #include <string>
 
-/// 32-bit case-insensitive hash value for a string.
+/// 32-bit case-insensitive hash value for a string. Hashes of string literals can be calculated at compile time in constant expressions.
 class StringHash
 {
 public:
     /// Construct with zero value.
-    StringHash() :
+    constexpr StringHash() :
         value(0)
     {
     }
     
     /// Copy-construct.
-    StringHash(const StringHash& hash) :
+    constexpr StringHash(const StringHash& hash) :
         value(hash.value)
     {
     }
     
     /// Construct with an initial value.
-    explicit StringHash(unsigned value_) :
+    constexpr explicit StringHash(unsigned value_) :
         value(value_)
     {
     }
@@ -32,8 +32,8 @@ public:
     {
     }
     
-    /// Construct from a C string case-insensitively.
-    explicit StringHash(const char* str) :
+    /// Construct from a C string case-insensitively. Evaluated at compile time when used in a constant expression, for example to initialize a constexpr variable.
+    constexpr explicit StringHash(const char* str) :
         value(Calculate(str))
     {
     }
@@ -88,29 +88,44 @@ public:
     }
     
     // Test for equality with another hash.
-    bool operator == (const StringHash& rhs) const { return value == rhs.value; }
+    constexpr bool operator == (const StringHash& rhs) const { return value == rhs.value; }
     /// Test for inequality with another hash.
-    bool operator != (const StringHash& rhs) const { return value != rhs.value; }
+    constexpr bool operator != (const StringHash& rhs) const { return value != rhs.value; }
     /// Test if less than another hash.
-    bool operator < (const StringHash& rhs) const { return value < rhs.value; }
+    constexpr bool operator < (const StringHash& rhs) const { return value < rhs.value; }
     /// Test if greater than another hash.
-    bool operator > (const StringHash& rhs) const { return value > rhs.value; }
+    constexpr bool operator > (const StringHash& rhs) const { return value > rhs.value; }
     /// Return true if nonzero hash value.
-    operator bool () const { return value != 0; }
+    constexpr operator bool () const { return value != 0; }
     /// Return hash value.
-    unsigned Value() const { return value; }
+    constexpr unsigned Value() const { return value; }
     /// Return as string.
     std::string ToString() const;
+    /// Return the string registered for this hash, or an empty string if none has been registered.
+    const std::string& Reverse() const;
     /// Return hash value for HashSet & HashMap.
-    unsigned ToHash() const { return value; }
+    constexpr unsigned ToHash() const { return value; }
     
-    /// Calculate hash value case-insensitively from a C string.
-    static unsigned Calculate(const char* str);
+    /// Calculate hash value case-insensitively from a C string. Only ASCII letters are case-folded.
+    static constexpr unsigned Calculate(const char* str, unsigned hash = 0)
+    {
+        return *str ? Calculate(str + 1, ToLower((unsigned char)*str) + (hash << 6) + (hash << 16) - hash) : hash;
+    }
+
+    /// Register a string to the global string table for reverse lookup from its hash, and return the hash. On a collision the first registered string is kept. Thread-safe.
+    static StringHash Register(const std::string& str);
+    /// Register a C string to the global string table for reverse lookup from its hash, and return the hash. Thread-safe.
+    static StringHash Register(const char* str);
+    /// Return number of registered strings.
+    static size_t NumRegistered();
     
     /// Zero hash.
     static const StringHash ZERO;
     
 private:
+    /// Convert an ASCII letter to lowercase.
+    static constexpr unsigned ToLower(unsigned char c) { return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c; }
+
     /// Hash value.
     unsigned value;
 };
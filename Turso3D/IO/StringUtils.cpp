@@ -2,10 +2,61 @@
 
 #include "StringUtils.h"
 
+#include <cmath>
 #include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cctype>
 
+/// Powers of ten that cover the decimal exponent range of floats. Up to 1e22 they are exact in double precision.
+static const double powersOf10[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22, 1e23, 1e24, 1e25, 1e26, 1e27, 1e28, 1e29, 1e30, 1e31,
+    1e32, 1e33, 1e34, 1e35, 1e36, 1e37, 1e38, 1e39, 1e40, 1e41, 1e42, 1e43, 1e44, 1e45, 1e46, 1e47,
+    1e48, 1e49, 1e50, 1e51, 1e52, 1e53, 1e54, 1e55, 1e56, 1e57, 1e58, 1e59, 1e60, 1e61, 1e62, 1e63
+};
+
+/// Largest power of ten exactly representable in double precision.
+static const int MAX_EXACT_POWER_OF_10 = 22;
+/// Largest integer mantissa exactly representable in double precision.
+static const unsigned long long MAX_EXACT_MANTISSA = 1ULL << 53;
+
+static inline bool IsWhiteSpace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline double ScaleByPowerOf10(double value, int exponent)
+{
+    return exponent >= 0 ? value * powersOf10[exponent] : value / powersOf10[-exponent];
+}
+
+/// Convert an integer mantissa and decimal exponent to double exactly when both are in the exactly representable range. Return false if they are not.
+static inline bool ComposeExact(unsigned long long mantissa, int exponent, double& dest)
+{
+    if (mantissa > MAX_EXACT_MANTISSA || exponent < -MAX_EXACT_POWER_OF_10 || exponent > MAX_EXACT_POWER_OF_10)
+        return false;
+
+    dest = ScaleByPowerOf10((double)mantissa, exponent);
+    return true;
+}
+
+/// Return whether a decimal mantissa and exponent parse back to the float value, the same way as ParseFloat() converts them.
+static bool ParsesBackTo(unsigned long long mantissa, int exponent, float value)
+{
+    double result;
+    if (!ComposeExact(mantissa, exponent, result))
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        snprintf(buffer, NUMBER_BUFFER_SIZE, "%llue%d", mantissa, exponent);
+        result = strtod(buffer, nullptr);
+    }
+
+    return (float)result == value;
+}
+
 size_t CountElements(const std::string& string, char separator)
 {
     return CountElements(string.c_str(), separator);
@@ -13,52 +64,12 @@ size_t CountElements(const std::string& string, char separator)
 
 size_t CountElements(const char* string, char separator)
 {
-    if (!string)
-        return 0;
-
-    const char* endPos = string + strlen(string);
-    const char* pos = string;
     size_t ret = 0;
-    
-    while (pos < endPos)
-    {
-        if (*pos != separator)
-            break;
-        ++pos;
-    }
-    
-    while (pos < endPos)
-    {
-        const char* start = pos;
-        
-        while (start < endPos)
-        {
-            if (*start == separator)
-                break;
-            
-            ++start;
-        }
-        
-        if (start == endPos)
-        {
-            ++ret;
-            break;
-        }
+    size_t length;
 
-        const char* end = start;
-        
-        while (end < endPos)
-        {
-            if (*end != separator)
-                break;
-            
-            ++end;
-        }
-        
+    while (NextToken(string, separator, length))
         ++ret;
-        pos = end;
-    }
-    
+
     return ret;
 }
 
@@ -161,7 +172,7 @@ bool StartsWith(const std::string& string, const std::string& substring)
 
 bool EndsWith(const std::string& string, const std::string& substring)
 {
-    return string.find(substring) == string.length() - substring.length();
+    return string.length() >= substring.length() && string.compare(string.length() - substring.length(), substring.length(), substring) == 0;
 }
 
 std::vector<std::string> Split(const std::string& string, char separator)
@@ -169,54 +180,32 @@ std::vector<std::string> Split(const std::string& string, char separator)
     return Split(string.c_str(), separator);
 }
 
+const char* NextToken(const char*& string, char separator, size_t& length)
+{
+    if (!string)
+        return nullptr;
+
+    while (*string == separator)
+        ++string;
+    if (!*string)
+        return nullptr;
+
+    const char* start = string;
+    while (*string && *string != separator)
+        ++string;
+
+    length = string - start;
+    return start;
+}
+
 std::vector<std::string> Split(const char* string, char separator)
 {
     std::vector<std::string> ret;
-    if (!string)
-        return ret;
+    size_t length;
 
-    size_t pos = 0;
-    size_t length = strlen(string);
+    while (const char* start = NextToken(string, separator, length))
+        ret.push_back(std::string(start, length));
 
-    while (pos < length)
-    {
-        if (string[pos] != separator)
-            break;
-        ++pos;
-    }
-    
-    while (pos < length)
-    {
-        size_t start = pos;
-        
-        while (start < length)
-        {
-            if (string[start] == separator)
-                break;
-            
-            ++start;
-        }
-        
-        if (start == length)
-        {
-            ret.push_back(std::string(&string[pos]));
-            break;
-        }
-        
-        size_t end = start;
-        
-        while (end < length)
-        {
-            if (string[end] != separator)
-                break;
-            
-            ++end;
-        }
-        
-        ret.push_back(std::string(&string[pos], start - pos));
-        pos = end;
-    }
-    
     return ret;
 }
 
@@ -258,6 +247,183 @@ size_t ListIndex(const char* string, const char** strings, size_t defaultIndex)
     return defaultIndex;
 }
 
+size_t FormatInt(char* dest, long long value)
+{
+    if (value < 0)
+    {
+        *dest = '-';
+        return FormatUInt(dest + 1, 0ULL - (unsigned long long)value) + 1;
+    }
+    else
+        return FormatUInt(dest, (unsigned long long)value);
+}
+
+size_t FormatUInt(char* dest, unsigned long long value)
+{
+    char digits[20];
+    size_t length = 0;
+
+    do
+    {
+        digits[length++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    for (size_t i = 0; i < length; ++i)
+        dest[i] = digits[length - 1 - i];
+    dest[length] = 0;
+    return length;
+}
+
+size_t FormatFloat(char* dest, float value)
+{
+    char* ptr = dest;
+
+    // Inspect the bits for the sign and special values, as floating point comparisons can not be trusted for them with fast math
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+    if (bits & 0x80000000)
+    {
+        *ptr++ = '-';
+        bits &= 0x7fffffff;
+        memcpy(&value, &bits, sizeof value);
+    }
+    if ((bits & 0x7f800000) == 0x7f800000)
+    {
+        strcpy(ptr, (bits & 0x7fffff) ? "nan" : "inf");
+        return ptr - dest + 3;
+    }
+
+    // Integral values are printed exactly as integers
+    if (value < 1e9f && value == (float)(long long)value)
+        return ptr - dest + FormatUInt(ptr, (unsigned long long)value);
+
+    // Find the shortest digit sequence, rounded to nearest, that parses back to the same float. At most 9 significant digits are needed
+    double v = value;
+    int exponent = (int)floor(log10(v));
+    if (ScaleByPowerOf10(1.0, exponent) > v)
+        --exponent;
+    else if (ScaleByPowerOf10(1.0, exponent + 1) <= v)
+        ++exponent;
+
+    unsigned long long mantissa = 0;
+    int mantissaExponent = 0;
+    bool found = false;
+
+    for (int precision = 1; precision <= 9 && !found; ++precision)
+    {
+        mantissaExponent = exponent - precision + 1;
+        mantissa = (unsigned long long)(ScaleByPowerOf10(v, -mantissaExponent) + 0.5);
+        found = ParsesBackTo(mantissa, mantissaExponent, value);
+    }
+
+    if (!found)
+    {
+        snprintf(ptr, NUMBER_BUFFER_SIZE - 1, "%.9g", value);
+        return strlen(dest);
+    }
+
+    while (mantissa % 10 == 0)
+    {
+        mantissa /= 10;
+        ++mantissaExponent;
+    }
+
+    char digits[NUMBER_BUFFER_SIZE];
+    int numDigits = (int)FormatUInt(digits, mantissa);
+    int pointPosition = numDigits + mantissaExponent;
+
+    // Choose between fixed and scientific notation like printf's %g
+    if (pointPosition - 1 < -4 || pointPosition - 1 >= 9)
+    {
+        *ptr++ = digits[0];
+        if (numDigits > 1)
+        {
+            *ptr++ = '.';
+            memcpy(ptr, digits + 1, numDigits - 1);
+            ptr += numDigits - 1;
+        }
+        int sciExponent = pointPosition - 1;
+        *ptr++ = 'e';
+        *ptr++ = sciExponent < 0 ? '-' : '+';
+        if (sciExponent < 0)
+            sciExponent = -sciExponent;
+        if (sciExponent < 10)
+            *ptr++ = '0';
+        ptr += FormatUInt(ptr, (unsigned long long)sciExponent);
+    }
+    else if (pointPosition <= 0)
+    {
+        *ptr++ = '0';
+        *ptr++ = '.';
+        for (int i = pointPosition; i < 0; ++i)
+            *ptr++ = '0';
+        memcpy(ptr, digits, numDigits);
+        ptr += numDigits;
+    }
+    else if (pointPosition >= numDigits)
+    {
+        memcpy(ptr, digits, numDigits);
+        ptr += numDigits;
+        for (int i = numDigits; i < pointPosition; ++i)
+            *ptr++ = '0';
+    }
+    else
+    {
+        memcpy(ptr, digits, pointPosition);
+        ptr += pointPosition;
+        *ptr++ = '.';
+        memcpy(ptr, digits + pointPosition, numDigits - pointPosition);
+        ptr += numDigits - pointPosition;
+    }
+
+    *ptr = 0;
+    return ptr - dest;
+}
+
+size_t FormatDouble(char* dest, double value)
+{
+    // Integral values, such as JSON ids and counts, are printed without going through printf
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof bits);
+    if ((bits & 0x7ff0000000000000ULL) != 0x7ff0000000000000ULL && value > -1e15 && value < 1e15 && value == (double)(long long)value &&
+        bits != 0x8000000000000000ULL)
+        return FormatInt(dest, (long long)value);
+
+    int length = snprintf(dest, NUMBER_BUFFER_SIZE, "%.15g", value);
+    return length > 0 ? (size_t)length : 0;
+}
+
+std::string FormatFloats(const float* values, size_t count)
+{
+    std::string ret;
+    char buffer[NUMBER_BUFFER_SIZE];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i)
+            ret += ' ';
+        ret.append(buffer, FormatFloat(buffer, values[i]));
+    }
+
+    return ret;
+}
+
+std::string FormatInts(const int* values, size_t count)
+{
+    std::string ret;
+    char buffer[NUMBER_BUFFER_SIZE];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i)
+            ret += ' ';
+        ret.append(buffer, FormatInt(buffer, values[i]));
+    }
+
+    return ret;
+}
+
 std::string FormatString(const char* formatString, ...)
 {
     char formatBuffer[1024];
@@ -278,42 +444,46 @@ std::string ToString(bool value)
 
 std::string ToString(short value)
 {
-    return FormatString("%d", value);
+    return ToString((long long)value);
 }
 
 std::string ToString(int value)
 {
-    return FormatString("%d", value);
+    return ToString((long long)value);
 }
 
 std::string ToString(long long value) 
 {
-    return FormatString("%lld", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatInt(buffer, value));
 }
 
 std::string ToString(unsigned short value)
 {
-    return FormatString("%u", value);
+    return ToString((unsigned long long)value);
 }
 
 std::string ToString(unsigned value) 
 {
-    return FormatString("%u", value);
+    return ToString((unsigned long long)value);
 }
 
 std::string ToString(unsigned long long value)
 {
-    return FormatString("%llu", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatUInt(buffer, value));
 }
 
 std::string ToString(float value)
 {
-    return FormatString("%g", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatFloat(buffer, value));
 }
 
 std::string ToString(double value)
 {
-    return FormatString("%.15g", value);
+    char buffer[NUMBER_BUFFER_SIZE];
+    return std::string(buffer, FormatDouble(buffer, value));
 }
 
 int ParseInt(const std::string& string)
@@ -323,8 +493,9 @@ int ParseInt(const std::string& string)
 
 int ParseInt(const char* string)
 {
-    char* ptr = const_cast<char*>(string);
-    return strtol(ptr, &ptr, 10);
+    int ret = 0;
+    ParseInt(string, ret);
+    return ret;
 }
 
 float ParseFloat(const std::string& string)
@@ -334,6 +505,170 @@ float ParseFloat(const std::string& string)
 
 float ParseFloat(const char* string)
 {
-    char* ptr = const_cast<char*>(string);
-    return (float)strtod(ptr, &ptr);
+    float ret = 0.0f;
+    ParseFloat(string, ret);
+    return ret;
+}
+
+const char* ParseInt(const char* string, int& dest)
+{
+    const char* ptr = string;
+    while (IsWhiteSpace(*ptr))
+        ++ptr;
+
+    bool negative = *ptr == '-';
+    if (*ptr == '-' || *ptr == '+')
+        ++ptr;
+    if (!isdigit((unsigned char)*ptr))
+        return string;
+
+    long long value = 0;
+    while (isdigit((unsigned char)*ptr))
+    {
+        // Saturate on overflow like strtol
+        if (value <= 0x80000000LL)
+            value = value * 10 + (*ptr - '0');
+        ++ptr;
+    }
+
+    if (negative)
+        dest = value >= 0x80000000LL ? (int)0x80000000 : -(int)value;
+    else
+        dest = value >= 0x7fffffffLL ? 0x7fffffff : (int)value;
+    return ptr;
+}
+
+const char* ParseFloat(const char* string, float& dest)
+{
+    double value;
+    const char* ret = ParseDouble(string, value);
+    if (ret != string)
+        dest = (float)value;
+    return ret;
+}
+
+const char* ParseDouble(const char* string, double& dest)
+{
+    const char* ptr = string;
+    while (IsWhiteSpace(*ptr))
+        ++ptr;
+
+    const char* start = ptr;
+    bool negative = *ptr == '-';
+    if (*ptr == '-' || *ptr == '+')
+        ++ptr;
+
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int numDigits = 0;
+    bool anyDigits = false;
+    bool exact = true;
+
+    // Accumulate up to 19 significant digits, which always fit the mantissa. Any further digits send the conversion to strtod
+    while (isdigit((unsigned char)*ptr))
+    {
+        if (numDigits < 19)
+        {
+            mantissa = mantissa * 10 + (*ptr - '0');
+            if (mantissa)
+                ++numDigits;
+        }
+        else
+        {
+            ++exponent;
+            exact = false;
+        }
+        anyDigits = true;
+        ++ptr;
+    }
+    if (*ptr == '.')
+    {
+        ++ptr;
+        while (isdigit((unsigned char)*ptr))
+        {
+            if (numDigits < 19)
+            {
+                mantissa = mantissa * 10 + (*ptr - '0');
+                if (mantissa)
+                    ++numDigits;
+                --exponent;
+            }
+            else
+                exact = false;
+            anyDigits = true;
+            ++ptr;
+        }
+    }
+
+    // Special values, such as inf and nan, and hexadecimal notation are left to strtod
+    if (!anyDigits || ((*ptr == 'x' || *ptr == 'X') && mantissa == 0 && ptr[-1] == '0'))
+    {
+        char* end;
+        double value = strtod(start, &end);
+        if (end == start)
+            return string;
+        dest = value;
+        return end;
+    }
+
+    if (*ptr == 'e' || *ptr == 'E')
+    {
+        const char* expPtr = ptr + 1;
+        bool expNegative = *expPtr == '-';
+        if (*expPtr == '-' || *expPtr == '+')
+            ++expPtr;
+        if (isdigit((unsigned char)*expPtr))
+        {
+            int expValue = 0;
+            while (isdigit((unsigned char)*expPtr))
+            {
+                if (expValue < 100000)
+                    expValue = expValue * 10 + (*expPtr - '0');
+                ++expPtr;
+            }
+            exponent += expNegative ? -expValue : expValue;
+            ptr = expPtr;
+        }
+    }
+
+    double value;
+    if (!exact || !ComposeExact(mantissa, exponent, value))
+        value = strtod(start, nullptr);
+    else if (negative)
+        value = -value;
+
+    dest = value;
+    return ptr;
+}
+
+size_t ParseInts(const char* string, int* dest, size_t count)
+{
+    if (!string)
+        return 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* next = ParseInt(string, dest[i]);
+        if (next == string)
+            return i;
+        string = next;
+    }
+
+    return count;
+}
+
+size_t ParseFloats(const char* string, float* dest, size_t count)
+{
+    if (!string)
+        return 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* next = ParseFloat(string, dest[i]);
+        if (next == string)
+            return i;
+        string = next;
+    }
+
+    return count;
 }
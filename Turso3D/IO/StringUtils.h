@@ -27,6 +27,8 @@ std::string ToLower(const std::string& string);
 bool StartsWith(const std::string& string, const std::string& substring);
 /// Check if string ends with another string.
 bool EndsWith(const std::string& string, const std::string& substring);
+/// Find the next substring delimited by a separator without copying it. Leading separators are skipped. Return the start of the substring and store its length, and advance the string pointer past it, or return null if there are no more substrings.
+const char* NextToken(const char*& string, char separator, size_t& length);
 /// Split a string with separator.
 std::vector<std::string> Split(const std::string& string, char separator = ' ');
 /// Split a string with separator.
@@ -39,6 +41,21 @@ size_t ListIndex(const char* string, const std::string* strings, size_t defaultI
 size_t ListIndex(const std::string& string, const char** strings, size_t defaultIndex);
 /// Return an index to a C string list corresponding to the given C string, or a default value if not found. The string list must be null-terminated.
 size_t ListIndex(const char* string, const char** strings, size_t defaultIndex);
+/// Buffer size sufficient for any number formatted by FormatInt(), FormatUInt(), FormatFloat() or FormatDouble(), including the terminating null.
+static const size_t NUMBER_BUFFER_SIZE = 32;
+
+/// Format a signed integer into a buffer without allocating. Return the length without the terminating null.
+size_t FormatInt(char* dest, long long value);
+/// Format an unsigned integer into a buffer without allocating. Return the length without the terminating null.
+size_t FormatUInt(char* dest, unsigned long long value);
+/// Format a float into a buffer without allocating, using the shortest decimal representation that parses back to the same value. Return the length without the terminating null.
+size_t FormatFloat(char* dest, float value);
+/// Format a double into a buffer without allocating, using up to 15 significant digits. Return the length without the terminating null.
+size_t FormatDouble(char* dest, double value);
+/// Return floats separated by spaces, formatted as in FormatFloat().
+std::string FormatFloats(const float* values, size_t count);
+/// Return integers separated by spaces.
+std::string FormatInts(const int* values, size_t count);
 /// Return a formatted string.
 std::string FormatString(const char* formatString, ...);
 /// Convert value to string.
@@ -67,4 +84,14 @@ int ParseInt(const char* string);
 float ParseFloat(const std::string& string);
 /// Parse a floating-point value from a string.
 float ParseFloat(const char* string);
+/// Parse an integer value from a string without allocating, skipping leading whitespace. Return a pointer past the parsed characters, or the string itself if no number was found.
+const char* ParseInt(const char* string, int& dest);
+/// Parse a floating-point value from a string without allocating and independent of the C locale, skipping leading whitespace. Return a pointer past the parsed characters, or the string itself if no number was found.
+const char* ParseFloat(const char* string, float& dest);
+/// Parse a double-precision floating-point value from a string without allocating and independent of the C locale, skipping leading whitespace. Return a pointer past the parsed characters, or the string itself if no number was found.
+const char* ParseDouble(const char* string, double& dest);
+/// Parse up to count whitespace-separated integers from a string. Return the number of values parsed.
+size_t ParseInts(const char* string, int* dest, size_t count);
+/// Parse up to count whitespace-separated floating-point values from a string. Return the number of values parsed.
+size_t ParseFloats(const char* string, float* dest, size_t count);
 
@@ -51,7 +51,7 @@ size_t VectorBuffer::Read(void* dest, size_t numBytes)
     if (copySize & 1)
         *destPtr = *srcPtr;
     
-    return size;
+    return numBytes;
 }
 
 size_t VectorBuffer::Seek(size_t newPosition)
@@ -73,6 +73,7 @@ size_t VectorBuffer::Write(const void* data, size_t numBytes)
     {
         size = position + numBytes;
         buffer.resize(size);
+        UpdateReadWindow();
     }
     
     unsigned char* srcPtr = (unsigned char*)data;
@@ -114,6 +115,7 @@ void VectorBuffer::SetData(const std::vector<unsigned char>& data)
     buffer = data;
     position = 0;
     size = data.size();
+    UpdateReadWindow();
 }
 
 void VectorBuffer::SetData(const void* data, size_t numBytes)
@@ -127,6 +129,7 @@ void VectorBuffer::SetData(const void* data, size_t numBytes)
     
     position = 0;
     size = numBytes;
+    UpdateReadWindow();
 }
 
 void VectorBuffer::SetData(Stream& source, size_t numBytes)
@@ -138,6 +141,7 @@ void VectorBuffer::SetData(Stream& source, size_t numBytes)
     
     position = 0;
     size = actualSize;
+    UpdateReadWindow();
 }
 
 void VectorBuffer::Clear()
@@ -145,6 +149,7 @@ void VectorBuffer::Clear()
     buffer.clear();
     position = 0;
     size = 0;
+    ClearReadWindow();
 }
 
 void VectorBuffer::Resize(size_t newSize)
@@ -153,4 +158,5 @@ void VectorBuffer::Resize(size_t newSize)
     size = newSize;
     if (position > size)
         position = size;
+    UpdateReadWindow();
 }
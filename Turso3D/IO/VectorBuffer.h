@@ -50,6 +50,9 @@ public:
     using Stream::Write;
     
 private:
+    /// Point the read window to the buffer after it may have been reallocated.
+    void UpdateReadWindow() { SetReadWindow(buffer.empty() ? nullptr : &buffer[0], 0, size); }
+
     /// Dynamic data buffer.
     std::vector<unsigned char> buffer;
 };
@@ -5,9 +5,14 @@
 
 #include <SDL.h>
 
+/// Number of events to take from the SDL queue at a time when latching.
+static const size_t MAX_LATCH_EVENTS = 64;
+
 Input::Input(SDL_Window* window_) :
     window(window_),
     mouseMove(IntVector2::ZERO),
+    mouseWheel(IntVector2::ZERO),
+    lateMouseMove(IntVector2::ZERO),
     shouldExit(false),
     focus(false)
 {
@@ -40,6 +45,8 @@ void Input::Update()
 
     mouseMove = IntVector2::ZERO;
     mouseWheel = IntVector2::ZERO;
+    lateMouseMove = IntVector2::ZERO;
+    mouseMotions.clear();
 
     unsigned focusFlags = SDL_GetWindowFlags(window) & SDL_WINDOW_INPUT_FOCUS;
     if (focusFlags && !focus)
@@ -87,6 +94,7 @@ void Input::Update()
             {
                 mouseMove.x += event.motion.xrel;
                 mouseMove.y += event.motion.yrel;
+                AddMouseMotion(event);
             }
             break;
 
@@ -101,6 +109,37 @@ void Input::Update()
     }
 }
 
+void Input::LatchMouse()
+{
+    PROFILE(LatchMouse);
+
+    if (!focus)
+        return;
+
+    SDL_PumpEvents();
+
+    // Take out only the motion events, leaving the rest in order for the next update
+    SDL_Event events[MAX_LATCH_EVENTS];
+    for (;;)
+    {
+        int numEvents = SDL_PeepEvents(events, MAX_LATCH_EVENTS, SDL_GETEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION);
+        for (int i = 0; i < numEvents; ++i)
+        {
+            lateMouseMove.x += events[i].motion.xrel;
+            lateMouseMove.y += events[i].motion.yrel;
+            AddMouseMotion(events[i]);
+        }
+
+        if (numEvents < (int)MAX_LATCH_EVENTS)
+            break;
+    }
+}
+
+void Input::SetKeyState(unsigned keyCode, ButtonState state)
+{
+    keyStates[keyCode] = state;
+}
+
 ButtonState Input::KeyState(unsigned keyCode) const
 {
     auto it = keyStates.find(keyCode);
@@ -112,3 +151,11 @@ ButtonState Input::MouseButtonState(unsigned num) const
     auto it = mouseButtonStates.find(num);
     return it != mouseButtonStates.end() ? it->second : STATE_UP;
 }
+
+void Input::AddMouseMotion(const SDL_Event& event)
+{
+    MouseMotion motion;
+    motion.delta = IntVector2(event.motion.xrel, event.motion.yrel);
+    motion.timestamp = event.motion.timestamp;
+    mouseMotions.push_back(motion);
+}
@@ -5,7 +5,10 @@
 #include "../Math/IntVector2.h"
 #include "../Object/Object.h"
 
+#include <vector>
+
 struct SDL_Window;
+union SDL_Event;
 
 /// Button states for keys, mouse and controller.
 enum ButtonState
@@ -16,6 +19,15 @@ enum ButtonState
     STATE_PRESSED
 };
 
+/// Mouse motion event with its time.
+struct MouseMotion
+{
+    /// Relative movement.
+    IntVector2 delta;
+    /// SDL event timestamp in milliseconds.
+    unsigned timestamp;
+};
+
 /// %Input collection subsystem.
 class Input : public Object
 {
@@ -29,6 +41,10 @@ public:
 
     /// Poll OS input events from the window.
     void Update();
+    /// Poll only the mouse motion events queued since the last update or latch, for updating the camera orientation just before rendering. Their movement goes to the late mouse movement. Other events stay queued until the next Update().
+    void LatchMouse();
+    /// Set state of a key, for example to replay recorded input. Pressed and released states return to up or down on the next update.
+    void SetKeyState(unsigned keyCode, ButtonState state);
    
     /// Return state of a key.
     ButtonState KeyState(unsigned keyCode) const;
@@ -46,8 +62,14 @@ public:
     bool MouseButtonReleased(unsigned num) const { return MouseButtonState(num) == STATE_RELEASED; }
     /// Return whether key was pressed or held down this frame.
     bool MouseButtonDown(unsigned num) const { ButtonState state = MouseButtonState(num); return state >= STATE_DOWN; }
+    /// Return the states of the keys that have been used.
+    const std::map<unsigned, ButtonState>& KeyStates() const { return keyStates; }
     /// Return mouse movement since last frame.
     const IntVector2& MouseMove() const { return mouseMove; }
+    /// Return mouse movement latched after the update this frame. Not included in the next frame's movement.
+    const IntVector2& LateMouseMove() const { return lateMouseMove; }
+    /// Return the mouse motion events of this frame, including the latched ones, in the order they arrived.
+    const std::vector<MouseMotion>& MouseMotions() const { return mouseMotions; }
     /// Return mouse wheel scroll since last frame.
     const IntVector2& MouseWheel() const { return mouseWheel; }
     /// Return whether has input focus.
@@ -58,12 +80,19 @@ public:
     SDL_Window* Window() const { return window; }
 
 private:
+    /// Record a mouse motion event.
+    void AddMouseMotion(const SDL_Event& event);
+
     /// OS-level window.
     SDL_Window* window;
     /// Accumulated mouse movement.
     IntVector2 mouseMove;
     /// Accumulated mouse wheel movement.
     IntVector2 mouseWheel;
+    /// Mouse movement latched after the update.
+    IntVector2 lateMouseMove;
+    /// Mouse motion events of the frame.
+    std::vector<MouseMotion> mouseMotions;
     /// Key states.
     std::map<unsigned, ButtonState> keyStates;
     /// Mouse button states.
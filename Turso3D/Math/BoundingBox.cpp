@@ -3,6 +3,7 @@
 #include "BoundingBox.h"
 #include "Frustum.h"
 #include "Polyhedron.h"
+#include "SIMD.h"
 #include "../IO/StringUtils.h"
 
 #include <utility>
@@ -99,18 +100,17 @@ void BoundingBox::Transform(const Matrix3x4& transform)
 
 bool BoundingBox::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 6)
+    float values[6];
+    if (ParseFloats(string, values, 6) < 6)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    min.x = (float)strtod(ptr, &ptr);
-    min.y = (float)strtod(ptr, &ptr);
-    min.z = (float)strtod(ptr, &ptr);
-    max.x = (float)strtod(ptr, &ptr);
-    max.y = (float)strtod(ptr, &ptr);
-    max.z = (float)strtod(ptr, &ptr);
-    
+    min.x = values[0];
+    min.y = values[1];
+    min.z = values[2];
+    max.x = values[3];
+    max.y = values[4];
+    max.z = values[5];
+
     return true;
 }
 
@@ -133,6 +133,80 @@ BoundingBox BoundingBox::Transformed(const Matrix3x4& transform) const
     return BoundingBox(newCenter - newEdge, newCenter + newEdge);
 }
 
+void BoundingBox::TransformBatch(BoundingBox* const* dest, const BoundingBox* const* boxes, const Matrix3x4* const* transforms, size_t count)
+{
+    size_t i = 0;
+
+#ifdef TURSO3D_SSE
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    // Transpose four boxes and matrices so that each register holds one component of all four
+    for (; i + 4 <= count; i += 4)
+    {
+        // The first load of a box holds min and max.x, the second min.z and max
+        __m128 minX = _mm_loadu_ps(&boxes[i]->min.x);
+        __m128 minY = _mm_loadu_ps(&boxes[i + 1]->min.x);
+        __m128 minZ = _mm_loadu_ps(&boxes[i + 2]->min.x);
+        __m128 maxX = _mm_loadu_ps(&boxes[i + 3]->min.x);
+        _MM_TRANSPOSE4_PS(minX, minY, minZ, maxX);
+        __m128 copyMinZ = _mm_loadu_ps(&boxes[i]->min.z);
+        __m128 copyMaxX = _mm_loadu_ps(&boxes[i + 1]->min.z);
+        __m128 maxY = _mm_loadu_ps(&boxes[i + 2]->min.z);
+        __m128 maxZ = _mm_loadu_ps(&boxes[i + 3]->min.z);
+        _MM_TRANSPOSE4_PS(copyMinZ, copyMaxX, maxY, maxZ);
+
+        __m128 centerX = _mm_mul_ps(_mm_add_ps(maxX, minX), half);
+        __m128 centerY = _mm_mul_ps(_mm_add_ps(maxY, minY), half);
+        __m128 centerZ = _mm_mul_ps(_mm_add_ps(maxZ, minZ), half);
+        __m128 edgeX = _mm_sub_ps(maxX, centerX);
+        __m128 edgeY = _mm_sub_ps(maxY, centerY);
+        __m128 edgeZ = _mm_sub_ps(maxZ, centerZ);
+
+        __m128 newMin[3];
+        __m128 newMax[3];
+        for (size_t j = 0; j < 3; ++j)
+        {
+            __m128 m0 = _mm_loadu_ps(&transforms[i]->m00 + j * 4);
+            __m128 m1 = _mm_loadu_ps(&transforms[i + 1]->m00 + j * 4);
+            __m128 m2 = _mm_loadu_ps(&transforms[i + 2]->m00 + j * 4);
+            __m128 m3 = _mm_loadu_ps(&transforms[i + 3]->m00 + j * 4);
+            _MM_TRANSPOSE4_PS(m0, m1, m2, m3);
+
+            __m128 newCenter = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, centerX), _mm_mul_ps(m1, centerY)),
+                _mm_mul_ps(m2, centerZ)), m3);
+            __m128 newEdge = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(m0, absMask), edgeX),
+                _mm_mul_ps(_mm_and_ps(m1, absMask), edgeY)), _mm_mul_ps(_mm_and_ps(m2, absMask), edgeZ));
+            newMin[j] = _mm_sub_ps(newCenter, newEdge);
+            newMax[j] = _mm_add_ps(newCenter, newEdge);
+        }
+
+        // Transpose back and store with the same overlapping layout as loaded
+        __m128 store0 = newMin[0];
+        __m128 store1 = newMin[1];
+        __m128 store2 = newMin[2];
+        __m128 store3 = newMax[0];
+        _MM_TRANSPOSE4_PS(store0, store1, store2, store3);
+        __m128 store4 = newMin[2];
+        __m128 store5 = newMax[0];
+        __m128 store6 = newMax[1];
+        __m128 store7 = newMax[2];
+        _MM_TRANSPOSE4_PS(store4, store5, store6, store7);
+        _mm_storeu_ps(&dest[i]->min.x, store0);
+        _mm_storeu_ps(&dest[i]->min.z, store4);
+        _mm_storeu_ps(&dest[i + 1]->min.x, store1);
+        _mm_storeu_ps(&dest[i + 1]->min.z, store5);
+        _mm_storeu_ps(&dest[i + 2]->min.x, store2);
+        _mm_storeu_ps(&dest[i + 2]->min.z, store6);
+        _mm_storeu_ps(&dest[i + 3]->min.x, store3);
+        _mm_storeu_ps(&dest[i + 3]->min.z, store7);
+    }
+#endif
+
+    for (; i < count; ++i)
+        *dest[i] = boxes[i]->Transformed(*transforms[i]);
+}
+
 Rect BoundingBox::Projected(const Matrix4& projection) const
 {
     Vector3 projMin = min;
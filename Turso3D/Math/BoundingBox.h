@@ -249,6 +249,9 @@ public:
     /// Return projected by a 4x4 projection matrix.
     Rect Projected(const Matrix4& projection) const;
     
+    /// Transform an array of bounding boxes by an array of 3x4 matrices, using SIMD four boxes at a time where available. The destination boxes may be the same as the source boxes.
+    static void TransformBatch(BoundingBox* const* dest, const BoundingBox* const* boxes, const Matrix3x4* const* transforms, size_t count);
+    
     /// Test if a point is inside.
     Intersection IsInside(const Vector3& point) const
     {
@@ -28,18 +28,16 @@ unsigned Color::ToUInt() const
 
 bool Color::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
+    float values[4];
+    size_t elements = ParseFloats(string, values, 4);
     if (elements < 3)
         return false;
-    char* ptr = const_cast<char*>(string);
-    r = (float)strtod(ptr, &ptr);
-    g = (float)strtod(ptr, &ptr);
-    b = (float)strtod(ptr, &ptr);
-    if (elements > 3)
-        a = (float)strtod(ptr, &ptr);
-    else
-        a = 1.0f;
-    
+
+    r = values[0];
+    g = values[1];
+    b = values[2];
+    a = elements > 3 ? values[3] : 1.0f;
+
     return true;
 }
 
@@ -56,5 +54,5 @@ Color Color::Lerp(const Color &rhs, float t) const
 
 std::string Color::ToString() const
 {
-    return FormatString("%g %g %g %g", r, g, b, a);
+    return FormatFloats(Data(), 4);
 }
@@ -0,0 +1,244 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "ConvexVolume.h"
+
+/// Relative tolerance for the vertex and plane tests.
+static const float CONVEX_TOLERANCE = 0.0001f;
+
+ConvexVolume::ConvexVolume() :
+    numPlanes(0),
+    numVertices(0)
+{
+    UpdatePlaneData();
+}
+
+ConvexVolume::ConvexVolume(const Frustum& frustum)
+{
+    Define(frustum);
+}
+
+void ConvexVolume::Define(const Frustum& frustum)
+{
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+        planes[i] = frustum.planes[i];
+    for (size_t i = 0; i < NUM_FRUSTUM_VERTICES; ++i)
+        vertices[i] = frustum.vertices[i];
+
+    numPlanes = NUM_FRUSTUM_PLANES;
+    numVertices = NUM_FRUSTUM_VERTICES;
+    UpdatePlaneData();
+}
+
+void ConvexVolume::Clip(const Plane& plane)
+{
+    if (!numVertices)
+        return;
+
+    bool anyInside = false;
+    bool anyOutside = false;
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        if (plane.Distance(vertices[i]) >= 0.0f)
+            anyInside = true;
+        else
+            anyOutside = true;
+    }
+
+    if (!anyInside)
+        Clear();
+    else if (anyOutside && numPlanes < MAX_CONVEX_PLANES)
+    {
+        planes[numPlanes++] = plane;
+        UpdateVertices();
+    }
+}
+
+void ConvexVolume::Clip(const BoundingBox& box)
+{
+    Clip(Plane(Vector3::RIGHT, box.min));
+    Clip(Plane(Vector3::LEFT, box.max));
+    Clip(Plane(Vector3::UP, box.min));
+    Clip(Plane(Vector3::DOWN, box.max));
+    Clip(Plane(Vector3::FORWARD, box.min));
+    Clip(Plane(Vector3::BACK, box.max));
+}
+
+void ConvexVolume::Clip(const Frustum& frustum)
+{
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+        Clip(frustum.planes[i]);
+}
+
+void ConvexVolume::Sweep(const Vector3& direction)
+{
+    if (!numVertices)
+        return;
+
+    Vector3 dir = direction.Normalized();
+    Plane oldPlanes[MAX_CONVEX_PLANES];
+    size_t numOldPlanes = numPlanes;
+    for (size_t i = 0; i < numOldPlanes; ++i)
+        oldPlanes[i] = planes[i];
+
+    // Keep the planes the sweep does not cross
+    numPlanes = 0;
+    for (size_t i = 0; i < numOldPlanes; ++i)
+    {
+        if (oldPlanes[i].normal.DotProduct(dir) >= 0.0f)
+            planes[numPlanes++] = oldPlanes[i];
+    }
+
+    float scale = 1.0f;
+    for (size_t i = 0; i < numVertices; ++i)
+        scale = Max(scale, Max(Max(Abs(vertices[i].x), Abs(vertices[i].y)), Abs(vertices[i].z)));
+    float tolerance = scale * CONVEX_TOLERANCE;
+
+    // The sides are the planes through the silhouette edges, parallel to the direction. Any pair of vertices whose plane has all vertices on one side gives a valid side plane
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        for (size_t j = i + 1; j < numVertices; ++j)
+        {
+            Vector3 normal = (vertices[j] - vertices[i]).CrossProduct(dir);
+            if (normal.LengthSquared() < M_EPSILON * M_EPSILON)
+                continue;
+            normal.Normalize();
+
+            float minDistance = M_INFINITY;
+            float maxDistance = -M_INFINITY;
+            for (size_t k = 0; k < numVertices; ++k)
+            {
+                float distance = normal.DotProduct(vertices[k] - vertices[i]);
+                minDistance = Min(minDistance, distance);
+                maxDistance = Max(maxDistance, distance);
+            }
+
+            bool added = true;
+            if (minDistance >= -tolerance)
+                added = AddUniquePlane(Plane(normal, vertices[i]));
+            else if (maxDistance <= tolerance)
+                added = AddUniquePlane(Plane(-normal, vertices[i]));
+
+            if (!added)
+            {
+                UpdatePlaneData();
+                return;
+            }
+        }
+    }
+
+    UpdatePlaneData();
+}
+
+void ConvexVolume::AddPlane(const Plane& plane)
+{
+    if (numPlanes < MAX_CONVEX_PLANES)
+    {
+        planes[numPlanes++] = plane;
+        UpdatePlaneData();
+    }
+}
+
+void ConvexVolume::Clear()
+{
+    numPlanes = 0;
+    numVertices = 0;
+    UpdatePlaneData();
+}
+
+void ConvexVolume::UpdateVertices()
+{
+    bool planeUsed[MAX_CONVEX_PLANES];
+    for (size_t i = 0; i < numPlanes; ++i)
+        planeUsed[i] = false;
+
+    numVertices = 0;
+
+    // The vertices are the intersection points of three planes that are inside the rest
+    for (size_t i = 0; i < numPlanes; ++i)
+    {
+        for (size_t j = i + 1; j < numPlanes; ++j)
+        {
+            Vector3 crossIJ = planes[i].normal.CrossProduct(planes[j].normal);
+
+            for (size_t k = j + 1; k < numPlanes; ++k)
+            {
+                float det = crossIJ.DotProduct(planes[k].normal);
+                if (Abs(det) < M_EPSILON)
+                    continue;
+
+                Vector3 point = (-planes[i].d * planes[j].normal.CrossProduct(planes[k].normal) - planes[j].d * planes[k].normal.CrossProduct(planes[i].normal) -
+                    planes[k].d * crossIJ) / det;
+                float tolerance = Max(1.0f, Max(Max(Abs(point.x), Abs(point.y)), Abs(point.z))) * CONVEX_TOLERANCE;
+
+                bool inside = true;
+                for (size_t l = 0; l < numPlanes && inside; ++l)
+                    inside = planes[l].Distance(point) >= -tolerance;
+                if (!inside)
+                    continue;
+
+                planeUsed[i] = planeUsed[j] = planeUsed[k] = true;
+
+                bool duplicate = false;
+                for (size_t l = 0; l < numVertices && !duplicate; ++l)
+                    duplicate = (vertices[l] - point).LengthSquared() <= tolerance * tolerance;
+                if (!duplicate && numVertices < MAX_CONVEX_VERTICES)
+                    vertices[numVertices++] = point;
+            }
+        }
+    }
+
+    if (numVertices < 4)
+    {
+        Clear();
+        return;
+    }
+
+    // Remove the planes that do not touch the volume
+    size_t numUsedPlanes = 0;
+    for (size_t i = 0; i < numPlanes; ++i)
+    {
+        if (planeUsed[i])
+            planes[numUsedPlanes++] = planes[i];
+    }
+    numPlanes = numUsedPlanes;
+
+    UpdatePlaneData();
+}
+
+void ConvexVolume::UpdatePlaneData()
+{
+    for (size_t i = 0; i < MAX_CONVEX_PLANES; ++i)
+    {
+        if (i < numPlanes)
+        {
+            const Plane& plane = planes[i];
+            planeData[0][i] = plane.normal.x;
+            planeData[1][i] = plane.normal.y;
+            planeData[2][i] = plane.normal.z;
+            planeData[3][i] = plane.absNormal.x;
+            planeData[4][i] = plane.absNormal.y;
+            planeData[5][i] = plane.absNormal.z;
+            planeData[6][i] = plane.d;
+        }
+        else
+        {
+            for (size_t j = 0; j < NUM_PLANE_COMPONENTS; ++j)
+                planeData[j][i] = 0.0f;
+        }
+    }
+}
+
+bool ConvexVolume::AddUniquePlane(const Plane& plane)
+{
+    for (size_t i = 0; i < numPlanes; ++i)
+    {
+        if (planes[i].normal.DotProduct(plane.normal) > 1.0f - CONVEX_TOLERANCE && Abs(planes[i].d - plane.d) <= CONVEX_TOLERANCE * Max(1.0f, Abs(plane.d)))
+            return true;
+    }
+
+    if (numPlanes >= MAX_CONVEX_PLANES)
+        return false;
+
+    planes[numPlanes++] = plane;
+    return true;
+}
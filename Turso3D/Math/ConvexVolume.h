@@ -0,0 +1,129 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Frustum.h"
+#include "SIMD.h"
+
+/// Maximum number of planes in a convex volume. A multiple of four for the SIMD tests.
+static const size_t MAX_CONVEX_PLANES = 32;
+/// Maximum number of vertices in a convex volume.
+static const size_t MAX_CONVEX_VERTICES = 32;
+
+/// Convex volume bounded by planes, with its vertices, in fixed-size storage so that building and clipping do not allocate. Can be swept along a direction, for example toward a directional light to cover the shadowcasters of a view. Bounding boxes are tested four planes at a time with SIMD.
+class ConvexVolume
+{
+public:
+    /// Planes, with normals pointing inward.
+    Plane planes[MAX_CONVEX_PLANES];
+    /// Vertices. After sweeping, the vertices of the volume before the sweep.
+    Vector3 vertices[MAX_CONVEX_VERTICES];
+    /// Plane normal X, Y, Z, absolute normal X, Y, Z and D components in structure-of-arrays layout for SIMD testing. Padded with planes that every box is inside of.
+    float planeData[NUM_PLANE_COMPONENTS][MAX_CONVEX_PLANES];
+    /// Number of planes.
+    size_t numPlanes;
+    /// Number of vertices.
+    size_t numVertices;
+
+    /// Construct empty.
+    ConvexVolume();
+    /// Construct from a frustum.
+    ConvexVolume(const Frustum& frustum);
+
+    /// Define from a frustum.
+    void Define(const Frustum& frustum);
+    /// Clip with a plane and recalculate the vertices. Planes that no longer touch the volume are removed.
+    void Clip(const Plane& plane);
+    /// Clip with a bounding box.
+    void Clip(const BoundingBox& box);
+    /// Clip with a frustum.
+    void Clip(const Frustum& frustum);
+    /// Sweep infinitely along a direction. Keeps the planes the sweep does not cross and adds the planes through the silhouette edges. If the plane capacity runs out, the remaining silhouette planes are left out, which keeps the volume conservative.
+    void Sweep(const Vector3& direction);
+    /// Add a bounding plane without recalculating the vertices, for example to bound a swept volume. No-op if the plane capacity is full.
+    void AddPlane(const Plane& plane);
+    /// Clear to empty.
+    void Clear();
+
+    /// Test if a bounding box is inside, outside or intersects.
+    Intersection IsInside(const BoundingBox& box) const
+    {
+        if (!numVertices)
+            return OUTSIDE;
+
+        unsigned outside, inside;
+        TestPlanes(box, outside, inside);
+        if (outside)
+            return OUTSIDE;
+        return inside == AllPlanesMask() ? INSIDE : INTERSECTS;
+    }
+
+    /// Test if a bounding box is (partially) inside or outside.
+    Intersection IsInsideFast(const BoundingBox& box) const
+    {
+        if (!numVertices)
+            return OUTSIDE;
+
+        unsigned outside, inside;
+        TestPlanes(box, outside, inside);
+        return outside ? OUTSIDE : INSIDE;
+    }
+
+    /// Return whether has no volume.
+    bool IsEmpty() const { return numVertices == 0; }
+
+private:
+    /// Recalculate the vertices from the plane intersections and remove the planes that do not touch the volume.
+    void UpdateVertices();
+    /// Update the structure-of-arrays plane data.
+    void UpdatePlaneData();
+    /// Add a plane if not a duplicate of an existing one. Return false if the capacity is full.
+    bool AddUniquePlane(const Plane& plane);
+    /// Return the bitmask of all the defined planes.
+    unsigned AllPlanesMask() const { return numPlanes < 32 ? (1u << numPlanes) - 1 : 0xffffffff; }
+
+    /// Test a bounding box against all planes. Return bitmasks of the planes it is outside of and completely inside of.
+    void TestPlanes(const BoundingBox& box, unsigned& outside, unsigned& inside) const
+    {
+        Vector3 center = box.Center();
+        Vector3 edge = center - box.min;
+        outside = 0;
+        inside = 0;
+
+#ifdef TURSO3D_SSE
+        __m128 centerX = _mm_set1_ps(center.x);
+        __m128 centerY = _mm_set1_ps(center.y);
+        __m128 centerZ = _mm_set1_ps(center.z);
+        __m128 edgeX = _mm_set1_ps(edge.x);
+        __m128 edgeY = _mm_set1_ps(edge.y);
+        __m128 edgeZ = _mm_set1_ps(edge.z);
+
+        // Test four planes per pass. The padding planes test inside
+        for (size_t i = 0; i < numPlanes; i += 4)
+        {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&planeData[0][i]), centerX), _mm_mul_ps(_mm_loadu_ps(&planeData[1][i]), centerY)),
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&planeData[2][i]), centerZ), _mm_loadu_ps(&planeData[6][i])));
+            __m128 absDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&planeData[3][i]), edgeX), _mm_mul_ps(_mm_loadu_ps(&planeData[4][i]), edgeY)),
+                _mm_mul_ps(_mm_loadu_ps(&planeData[5][i]), edgeZ));
+
+            outside |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), absDist))) << i;
+            inside |= (unsigned)_mm_movemask_ps(_mm_cmpge_ps(dist, absDist)) << i;
+        }
+
+        outside &= AllPlanesMask();
+        inside &= AllPlanesMask();
+#else
+        for (size_t i = 0; i < numPlanes; ++i)
+        {
+            const Plane& plane = planes[i];
+            float dist = plane.normal.DotProduct(center) + plane.d;
+            float absDist = plane.absNormal.DotProduct(edge);
+
+            if (dist < -absDist)
+                outside |= 1u << i;
+            else if (dist >= absDist)
+                inside |= 1u << i;
+        }
+#endif
+    }
+};
@@ -30,6 +30,39 @@ void ProjectAndMergeEdge(Vector3 v0, Vector3 v1, Rect& rect, const Matrix4& proj
     rect.Merge(Vector2(tV1.x, tV1.y));
 }
 
+/// Return the unique edge directions of a frustum: the near plane's horizontal and vertical edges, and the four edges from near to far.
+static void EdgeDirections(const Vector3* vertices, Vector3* directions)
+{
+    directions[0] = vertices[0] - vertices[3];
+    directions[1] = vertices[0] - vertices[1];
+    for (size_t i = 0; i < 4; ++i)
+        directions[i + 2] = vertices[i + 4] - vertices[i];
+}
+
+/// Return whether a set of vertices is completely on the negative side of a plane.
+static bool IsOutside(const Plane& plane, const Vector3* vertices)
+{
+    for (size_t i = 0; i < NUM_FRUSTUM_VERTICES; ++i)
+    {
+        if (plane.Distance(vertices[i]) >= 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+/// Project a set of vertices onto an axis and return the extents.
+static void ProjectVertices(const Vector3& axis, const Vector3* vertices, float& min, float& max)
+{
+    min = max = axis.DotProduct(vertices[0]);
+    for (size_t i = 1; i < NUM_FRUSTUM_VERTICES; ++i)
+    {
+        float projection = axis.DotProduct(vertices[i]);
+        min = Min(min, projection);
+        max = Max(max, projection);
+    }
+}
+
 Frustum::Frustum()
 {
     for (size_t i = 0; i < NUM_FRUSTUM_VERTICES; ++i)
@@ -49,6 +82,11 @@ Frustum& Frustum::operator = (const Frustum& rhs)
         planes[i] = rhs.planes[i];
     for (size_t i = 0; i < NUM_FRUSTUM_VERTICES; ++i)
         vertices[i] = rhs.vertices[i];
+    for (size_t i = 0; i < NUM_PLANE_COMPONENTS; ++i)
+    {
+        for (size_t j = 0; j < NUM_PADDED_FRUSTUM_PLANES; ++j)
+            planeData[i][j] = rhs.planeData[i][j];
+    }
     
     return *this;
 }
@@ -149,6 +187,40 @@ Frustum Frustum::Transformed(const Matrix3x4& transform) const
     return transformed;
 }
 
+bool Frustum::Intersects(const Frustum& frustum) const
+{
+    // The face planes usually separate, so test them first
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+    {
+        if (IsOutside(planes[i], frustum.vertices) || IsOutside(frustum.planes[i], vertices))
+            return false;
+    }
+
+    Vector3 directions[6];
+    Vector3 otherDirections[6];
+    EdgeDirections(vertices, directions);
+    EdgeDirections(frustum.vertices, otherDirections);
+
+    for (size_t i = 0; i < 6; ++i)
+    {
+        for (size_t j = 0; j < 6; ++j)
+        {
+            // Parallel edges do not give an axis
+            Vector3 axis = directions[i].CrossProduct(otherDirections[j]);
+            if (axis.LengthSquared() < M_EPSILON * directions[i].LengthSquared() * otherDirections[j].LengthSquared())
+                continue;
+
+            float min, max, otherMin, otherMax;
+            ProjectVertices(axis, vertices, min, max);
+            ProjectVertices(axis, frustum.vertices, otherMin, otherMax);
+            if (max < otherMin || otherMax < min)
+                return false;
+        }
+    }
+
+    return true;
+}
+
 Rect Frustum::Projected(const Matrix4& projection) const
 {
     Rect rect;
@@ -183,4 +255,72 @@ void Frustum::UpdatePlanes()
             planes[i].d = -planes[i].d;
         }
     }
+
+    // Padding planes have zero normal and distance, so that every box tests inside them
+    for (size_t i = 0; i < NUM_PLANE_COMPONENTS; ++i)
+    {
+        for (size_t j = NUM_FRUSTUM_PLANES; j < NUM_PADDED_FRUSTUM_PLANES; ++j)
+            planeData[i][j] = 0.0f;
+    }
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+    {
+        const Plane& plane = planes[i];
+        planeData[0][i] = plane.normal.x;
+        planeData[1][i] = plane.normal.y;
+        planeData[2][i] = plane.normal.z;
+        planeData[3][i] = plane.absNormal.x;
+        planeData[4][i] = plane.absNormal.y;
+        planeData[5][i] = plane.absNormal.z;
+        planeData[6][i] = plane.d;
+    }
+}
+
+void Frustum::IsInsideMaskedFast(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ, size_t count, unsigned* result, unsigned char planeMask) const
+{
+    for (size_t i = 0; i < (count + 31) / 32; ++i)
+        result[i] = 0;
+
+    size_t i = 0;
+
+#ifdef TURSO3D_SSE
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    // Test four boxes at a time against each plane
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 boxMinX = _mm_loadu_ps(minX + i);
+        __m128 boxMinY = _mm_loadu_ps(minY + i);
+        __m128 boxMinZ = _mm_loadu_ps(minZ + i);
+        __m128 boxMaxX = _mm_loadu_ps(maxX + i);
+        __m128 boxMaxY = _mm_loadu_ps(maxY + i);
+        __m128 boxMaxZ = _mm_loadu_ps(maxZ + i);
+        __m128 centerX = _mm_mul_ps(_mm_add_ps(boxMinX, boxMaxX), half);
+        __m128 centerY = _mm_mul_ps(_mm_add_ps(boxMinY, boxMaxY), half);
+        __m128 centerZ = _mm_mul_ps(_mm_add_ps(boxMinZ, boxMaxZ), half);
+        __m128 edgeX = _mm_sub_ps(centerX, boxMinX);
+        __m128 edgeY = _mm_sub_ps(centerY, boxMinY);
+        __m128 edgeZ = _mm_sub_ps(centerZ, boxMinZ);
+        __m128 outside = _mm_setzero_ps();
+
+        for (size_t j = 0; j < NUM_FRUSTUM_PLANES; ++j)
+        {
+            if (planeMask & (1 << j))
+                continue;
+
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planeData[0][j]), centerX), _mm_mul_ps(_mm_set1_ps(planeData[1][j]), centerY)),
+                _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planeData[2][j]), centerZ), _mm_set1_ps(planeData[6][j])));
+            __m128 absDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planeData[3][j]), edgeX), _mm_mul_ps(_mm_set1_ps(planeData[4][j]), edgeY)),
+                _mm_mul_ps(_mm_set1_ps(planeData[5][j]), edgeZ));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), absDist)));
+        }
+
+        result[i >> 5] |= ((unsigned)_mm_movemask_ps(outside) ^ 0xf) << (i & 31);
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        if (IsInsideMaskedFast(BoundingBox(Vector3(minX[i], minY[i], minZ[i]), Vector3(maxX[i], maxY[i], maxZ[i])), planeMask) != OUTSIDE)
+            result[i >> 5] |= 1u << (i & 31);
+    }
 }
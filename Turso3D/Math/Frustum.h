@@ -20,6 +20,8 @@ enum FrustumPlane
 
 static const size_t NUM_FRUSTUM_PLANES = 6;
 static const size_t NUM_FRUSTUM_VERTICES = 8;
+static const size_t NUM_PADDED_FRUSTUM_PLANES = 8;
+static const size_t NUM_PLANE_COMPONENTS = 7;
 
 /// Convex constructed of 6 planes.
 class Frustum
@@ -29,6 +31,8 @@ public:
     Plane planes[NUM_FRUSTUM_PLANES];
     /// Frustum vertices.
     Vector3 vertices[NUM_FRUSTUM_VERTICES];
+    /// Plane normal X, Y, Z, absolute normal X, Y, Z and D components in structure-of-arrays layout for SIMD testing. Padded with planes that every box is inside of.
+    float planeData[NUM_PLANE_COMPONENTS][NUM_PADDED_FRUSTUM_PLANES];
     
     /// Construct a degenerate frustum with all points at origin.
     Frustum();
@@ -94,94 +98,51 @@ public:
     /// Test if a bounding box is inside, outside or intersects.
     Intersection IsInside(const BoundingBox& box) const
     {
-        Vector3 center = box.Center();
-        Vector3 edge = center - box.min;
-        bool allInside = true;
-        
-        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
-        {
-            const Plane& plane = planes[i];
-            float dist = plane.normal.DotProduct(center) + plane.d;
-            float absDist = plane.absNormal.DotProduct(edge);
-            
-            if (dist < -absDist)
-                return OUTSIDE;
-            else if (dist < absDist)
-                allInside = false;
-        }
-        
-        return allInside ? INSIDE : INTERSECTS;
+        unsigned outside, inside;
+        TestPlanes(box, outside, inside);
+
+        if (outside)
+            return OUTSIDE;
+        else
+            return inside == 0x3f ? INSIDE : INTERSECTS;
     }
 
     /// Test if a bounding box is inside, outside or intersects. Updates a bitmask for speeding up further tests of hierarchies. Returns updated plane mask: 0xff if outside, 0x3f if completely inside, otherwise intersecting.
     unsigned char IsInsideMasked(const BoundingBox& box, unsigned char planeMask = 0) const
     {
-        Vector3 center = box.Center();
-        Vector3 edge = center - box.min;
-
-        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
-        {
-            unsigned char bit = 1 << i;
-
-            if (!(planeMask & bit))
-            {
-                const Plane& plane = planes[i];
-                float dist = plane.normal.DotProduct(center) + plane.d;
-                float absDist = plane.absNormal.DotProduct(edge);
-
-                if (dist < -absDist)
-                    return 0xff;
-                else if (dist >= absDist)
-                    planeMask |= bit;
-            }
-        }
+        unsigned outside, inside;
+        TestPlanes(box, outside, inside);
 
-        return planeMask;
+        if (outside & ~planeMask)
+            return 0xff;
+        else
+            return planeMask | (unsigned char)inside;
     }
 
     /// Test if a bounding box is inside, using a mask to skip unnecessary planes.
     Intersection IsInsideMaskedFast(const BoundingBox& box, unsigned char planeMask = 0) const
     {
-        Vector3 center = box.Center();
-        Vector3 edge = center - box.min;
+        unsigned outside, inside;
+        TestPlanes(box, outside, inside);
 
-        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
-        {
-            unsigned char bit = 1 << i;
-
-            if (!(planeMask & bit))
-            {
-                const Plane& plane = planes[i];
-                float dist = plane.normal.DotProduct(center) + plane.d;
-                float absDist = plane.absNormal.DotProduct(edge);
-    
-                if (dist < -absDist)
-                    return OUTSIDE;
-            }
-        }
-
-        return INSIDE;
+        return (outside & ~planeMask) ? OUTSIDE : INSIDE;
     }
     
     /// Test if a bounding box is (partially) inside or outside.
     Intersection IsInsideFast(const BoundingBox& box) const
     {
-        Vector3 center = box.Center();
-        Vector3 edge = center - box.min;
-        
-        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
-        {
-            const Plane& plane = planes[i];
-            float dist = plane.normal.DotProduct(center) + plane.d;
-            float absDist = plane.absNormal.DotProduct(edge);
-            
-            if (dist < -absDist)
-                return OUTSIDE;
-        }
-        
-        return INSIDE;
+        unsigned outside, inside;
+        TestPlanes(box, outside, inside);
+
+        return outside ? OUTSIDE : INSIDE;
     }
+
+    /// Test bounding boxes in structure-of-arrays layout for being (partially) inside, using a mask to skip unnecessary planes. Writes one bit per box into the result masks, 32 boxes per mask.
+    void IsInsideMaskedFast(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ, size_t count, unsigned* result, unsigned char planeMask = 0) const;
     
+    /// Test if another frustum intersects. Exact separating axis test using both frustums' planes and the cross products of their edges.
+    bool Intersects(const Frustum& frustum) const;
+
     /// Return distance of a point to the frustum, or 0 if inside.
     float Distance(const Vector3& point) const
     {
@@ -201,4 +162,53 @@ public:
     
     /// Update the planes. Called internally.
     void UpdatePlanes();
+
+private:
+    /// Test a bounding box against all planes. Return bitmasks of the planes it is outside of and completely inside of.
+    void TestPlanes(const BoundingBox& box, unsigned& outside, unsigned& inside) const
+    {
+        Vector3 center = box.Center();
+        Vector3 edge = center - box.min;
+
+#ifdef TURSO3D_SSE
+        __m128 centerX = _mm_set1_ps(center.x);
+        __m128 centerY = _mm_set1_ps(center.y);
+        __m128 centerZ = _mm_set1_ps(center.z);
+        __m128 edgeX = _mm_set1_ps(edge.x);
+        __m128 edgeY = _mm_set1_ps(edge.y);
+        __m128 edgeZ = _mm_set1_ps(edge.z);
+        outside = 0;
+        inside = 0;
+
+        // Test four planes per pass
+        for (size_t i = 0; i < NUM_PADDED_FRUSTUM_PLANES; i += 4)
+        {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&planeData[0][i]), centerX), _mm_mul_ps(_mm_loadu_ps(&planeData[1][i]), centerY)),
+                _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&planeData[2][i]), centerZ), _mm_loadu_ps(&planeData[6][i])));
+            __m128 absDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&planeData[3][i]), edgeX), _mm_mul_ps(_mm_loadu_ps(&planeData[4][i]), edgeY)),
+                _mm_mul_ps(_mm_loadu_ps(&planeData[5][i]), edgeZ));
+
+            outside |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), absDist))) << i;
+            inside |= (unsigned)_mm_movemask_ps(_mm_cmpge_ps(dist, absDist)) << i;
+        }
+
+        outside &= 0x3f;
+        inside &= 0x3f;
+#else
+        outside = 0;
+        inside = 0;
+
+        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+        {
+            const Plane& plane = planes[i];
+            float dist = plane.normal.DotProduct(center) + plane.d;
+            float absDist = plane.absNormal.DotProduct(edge);
+
+            if (dist < -absDist)
+                outside |= 1 << i;
+            else if (dist >= absDist)
+                inside |= 1 << i;
+        }
+#endif
+    }
 };
@@ -10,22 +10,21 @@ const IntBox IntBox::ZERO(0, 0, 0, 0, 0, 0);
 
 bool IntBox::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 6)
+    int values[6];
+    if (ParseInts(string, values, 6) < 6)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    left = strtol(ptr, &ptr, 10);
-    top = strtol(ptr, &ptr, 10);
-    near = strtol(ptr, &ptr, 10);
-    right = strtol(ptr, &ptr, 10);
-    bottom = strtol(ptr, &ptr, 10);
-    far = strtol(ptr, &ptr, 10);
+    left = values[0];
+    top = values[1];
+    near = values[2];
+    right = values[3];
+    bottom = values[4];
+    far = values[5];
 
     return true;
 }
 
 std::string IntBox::ToString() const
 {
-    return FormatString("%d %d %d %d %d %d", left, top, near, right, bottom, far);
+    return FormatInts(Data(), 6);
 }
@@ -10,20 +10,19 @@ const IntRect IntRect::ZERO(0, 0, 0, 0);
 
 bool IntRect::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 4)
+    int values[4];
+    if (ParseInts(string, values, 4) < 4)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    left = strtol(ptr, &ptr, 10);
-    top = strtol(ptr, &ptr, 10);
-    right = strtol(ptr, &ptr, 10);
-    bottom = strtol(ptr, &ptr, 10);
-    
+    left = values[0];
+    top = values[1];
+    right = values[2];
+    bottom = values[3];
+
     return true;
 }
 
 std::string IntRect::ToString() const
 {
-    return FormatString("%d %d %d %d", left, top, right, bottom);
+    return FormatInts(Data(), 4);
 }
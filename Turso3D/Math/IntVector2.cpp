@@ -10,19 +10,18 @@ const IntVector2 IntVector2::ZERO(0, 0);
 
 bool IntVector2::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 2)
+    int values[2];
+    if (ParseInts(string, values, 2) < 2)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = strtol(ptr, &ptr, 10);
-    y = strtol(ptr, &ptr, 10);
-    
+    x = values[0];
+    y = values[1];
+
     return true;
 }
 
 std::string IntVector2::ToString() const
 {
-    return FormatString("%d %d", x, y);
+    return FormatInts(Data(), 2);
 }
 
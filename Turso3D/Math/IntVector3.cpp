@@ -15,19 +15,18 @@ bool IntVector3::FromString(const std::string& str)
 
 bool IntVector3::FromString(const char* str)
 {
-    size_t elements = CountElements(str, ' ');
-    if (elements < 3)
+    int values[3];
+    if (ParseInts(str, values, 3) < 3)
         return false;
-    
-    char* ptr = (char*)str;
-    x = strtol(ptr, &ptr, 10);
-    y = strtol(ptr, &ptr, 10);
-    z = strtol(ptr, &ptr, 10);
+
+    x = values[0];
+    y = values[1];
+    z = values[2];
 
     return true;
 }
 
 std::string IntVector3::ToString() const
 {
-    return FormatString("%d %d %d", x, y, z);
+    return FormatInts(Data(), 3);
 }
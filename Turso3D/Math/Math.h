@@ -105,6 +105,71 @@ inline bool IsPowerOfTwo(unsigned value)
     return value == 1;
 }
 
+/// Convert a float to half precision floating point bits, rounding to nearest. Too large values become infinity.
+inline unsigned short FloatToHalf(float value)
+{
+    union
+    {
+        float f;
+        unsigned u;
+    } bits;
+
+    bits.f = value;
+    unsigned sign = (bits.u >> 16) & 0x8000;
+    int exponent = (int)((bits.u >> 23) & 0xff) - 127 + 15;
+    unsigned mantissa = bits.u & 0x7fffff;
+
+    if ((bits.u & 0x7f800000) == 0x7f800000)
+        return (unsigned short)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    if (exponent >= 31)
+        return (unsigned short)(sign | 0x7c00);
+    if (exponent <= 0)
+    {
+        // Denormal or zero
+        if (exponent < -10)
+            return (unsigned short)sign;
+        mantissa |= 0x800000;
+        unsigned shift = (unsigned)(14 - exponent);
+        unsigned half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1)
+            ++half;
+        return (unsigned short)(sign | half);
+    }
+
+    // Rounding may carry into the exponent, which produces the correct result
+    unsigned half = sign | ((unsigned)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        ++half;
+    return (unsigned short)half;
+}
+
+/// Convert half precision floating point bits to a float.
+inline float HalfToFloat(unsigned short value)
+{
+    union
+    {
+        float f;
+        unsigned u;
+    } bits;
+
+    unsigned sign = ((unsigned)value & 0x8000) << 16;
+    unsigned exponent = ((unsigned)value >> 10) & 0x1f;
+    unsigned mantissa = (unsigned)value & 0x3ff;
+
+    if (exponent == 0x1f)
+        bits.u = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent)
+        bits.u = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else
+    {
+        // Denormal or zero
+        bits.f = (float)mantissa * (1.0f / 16777216.0f);
+        bits.u |= sign;
+    }
+
+    return bits.f;
+}
+
 /// Round up to next power of two.
 inline unsigned NextPowerOfTwo(unsigned value)
 {
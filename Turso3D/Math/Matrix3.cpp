@@ -18,21 +18,20 @@ const Matrix3 Matrix3::IDENTITY(
 
 bool Matrix3::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 9)
+    float values[9];
+    if (ParseFloats(string, values, 9) < 9)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    m00 = (float)strtod(ptr, &ptr);
-    m01 = (float)strtod(ptr, &ptr);
-    m02 = (float)strtod(ptr, &ptr);
-    m10 = (float)strtod(ptr, &ptr);
-    m11 = (float)strtod(ptr, &ptr);
-    m12 = (float)strtod(ptr, &ptr);
-    m20 = (float)strtod(ptr, &ptr);
-    m21 = (float)strtod(ptr, &ptr);
-    m22 = (float)strtod(ptr, &ptr);
-    
+    m00 = values[0];
+    m01 = values[1];
+    m02 = values[2];
+    m10 = values[3];
+    m11 = values[4];
+    m12 = values[5];
+    m20 = values[6];
+    m21 = values[7];
+    m22 = values[8];
+
     return true;
 }
 
@@ -62,8 +61,5 @@ Matrix3 Matrix3::Inverse() const
 
 std::string Matrix3::ToString() const
 {
-    return FormatString("%g %g %g %g %g %g %g %g %g", 
-        m00, m01, m02,
-        m10, m11, m12,
-        m20, m21, m22);
+    return FormatFloats(Data(), 9);
 }
@@ -30,24 +30,23 @@ Matrix3x4::Matrix3x4(const Vector3& translation, const Quaternion& rotation, con
 
 bool Matrix3x4::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 12)
+    float values[12];
+    if (ParseFloats(string, values, 12) < 12)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    m00 = (float)strtod(ptr, &ptr);
-    m01 = (float)strtod(ptr, &ptr);
-    m02 = (float)strtod(ptr, &ptr);
-    m03 = (float)strtod(ptr, &ptr);
-    m10 = (float)strtod(ptr, &ptr);
-    m11 = (float)strtod(ptr, &ptr);
-    m12 = (float)strtod(ptr, &ptr);
-    m13 = (float)strtod(ptr, &ptr);
-    m20 = (float)strtod(ptr, &ptr);
-    m21 = (float)strtod(ptr, &ptr);
-    m22 = (float)strtod(ptr, &ptr);
-    m23 = (float)strtod(ptr, &ptr);
-    
+    m00 = values[0];
+    m01 = values[1];
+    m02 = values[2];
+    m03 = values[3];
+    m10 = values[4];
+    m11 = values[5];
+    m12 = values[6];
+    m13 = values[7];
+    m20 = values[8];
+    m21 = values[9];
+    m22 = values[10];
+    m23 = values[11];
+
     return true;
 }
 
@@ -95,8 +94,5 @@ Matrix3x4 Matrix3x4::Inverse() const
 
 std::string Matrix3x4::ToString() const
 {
-    return FormatString("%g %g %g %g %g %g %g %g %g %g %g %g", 
-        m00, m01, m02, m03, 
-        m10, m11, m12, m13, 
-        m20, m21, m22, m23);
+    return FormatFloats(Data(), 12);
 }
@@ -177,6 +177,22 @@ public:
     /// Multiply a matrix.
     Matrix3x4 operator * (const Matrix3x4& rhs) const
     {
+#ifdef TURSO3D_SSE
+        __m128 r0 = _mm_loadu_ps(&rhs.m00);
+        __m128 r1 = _mm_loadu_ps(&rhs.m10);
+        __m128 r2 = _mm_loadu_ps(&rhs.m20);
+        // The implicit last row of rhs is 0, 0, 0, 1, so the translation column of lhs is added as is
+        __m128 translationMask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+        __m128 l0 = _mm_loadu_ps(&m00);
+        __m128 l1 = _mm_loadu_ps(&m10);
+        __m128 l2 = _mm_loadu_ps(&m20);
+
+        Matrix3x4 ret;
+        _mm_storeu_ps(&ret.m00, SIMDCombineRowsAdd(l0, r0, r1, r2, _mm_and_ps(l0, translationMask)));
+        _mm_storeu_ps(&ret.m10, SIMDCombineRowsAdd(l1, r0, r1, r2, _mm_and_ps(l1, translationMask)));
+        _mm_storeu_ps(&ret.m20, SIMDCombineRowsAdd(l2, r0, r1, r2, _mm_and_ps(l2, translationMask)));
+        return ret;
+#else
         return Matrix3x4(
             m00 * rhs.m00 + m01 * rhs.m10 + m02 * rhs.m20,
             m00 * rhs.m01 + m01 * rhs.m11 + m02 * rhs.m21,
@@ -191,11 +207,25 @@ public:
             m20 * rhs.m02 + m21 * rhs.m12 + m22 * rhs.m22,
             m20 * rhs.m03 + m21 * rhs.m13 + m22 * rhs.m23 + m23
         );
+#endif
     }
     
     /// Multiply a 4x4 matrix.
     Matrix4 operator * (const Matrix4& rhs) const
     {
+#ifdef TURSO3D_SSE
+        __m128 r0 = _mm_loadu_ps(&rhs.m00);
+        __m128 r1 = _mm_loadu_ps(&rhs.m10);
+        __m128 r2 = _mm_loadu_ps(&rhs.m20);
+        __m128 r3 = _mm_loadu_ps(&rhs.m30);
+
+        Matrix4 ret;
+        _mm_storeu_ps(&ret.m00, SIMDCombineRows(_mm_loadu_ps(&m00), r0, r1, r2, r3));
+        _mm_storeu_ps(&ret.m10, SIMDCombineRows(_mm_loadu_ps(&m10), r0, r1, r2, r3));
+        _mm_storeu_ps(&ret.m20, SIMDCombineRows(_mm_loadu_ps(&m20), r0, r1, r2, r3));
+        _mm_storeu_ps(&ret.m30, r3);
+        return ret;
+#else
         return Matrix4(
             m00 * rhs.m00 + m01 * rhs.m10 + m02 * rhs.m20 + m03 * rhs.m30,
             m00 * rhs.m01 + m01 * rhs.m11 + m02 * rhs.m21 + m03 * rhs.m31,
@@ -214,6 +244,7 @@ public:
             rhs.m32,
             rhs.m33
         );
+#endif
     }
     
     /// Set translation elements.
@@ -346,6 +377,23 @@ inline Matrix3x4 operator * (float lhs, const Matrix3x4& rhs) { return rhs * lhs
 /// Multiply a 3x4 matrix with a 4x4 matrix.
 inline Matrix4 operator * (const Matrix4& lhs, const Matrix3x4& rhs)
 {
+#ifdef TURSO3D_SSE
+    __m128 r0 = _mm_loadu_ps(&rhs.m00);
+    __m128 r1 = _mm_loadu_ps(&rhs.m10);
+    __m128 r2 = _mm_loadu_ps(&rhs.m20);
+    __m128 translationMask = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+    __m128 l0 = _mm_loadu_ps(&lhs.m00);
+    __m128 l1 = _mm_loadu_ps(&lhs.m10);
+    __m128 l2 = _mm_loadu_ps(&lhs.m20);
+    __m128 l3 = _mm_loadu_ps(&lhs.m30);
+
+    Matrix4 ret;
+    _mm_storeu_ps(&ret.m00, SIMDCombineRowsAdd(l0, r0, r1, r2, _mm_and_ps(l0, translationMask)));
+    _mm_storeu_ps(&ret.m10, SIMDCombineRowsAdd(l1, r0, r1, r2, _mm_and_ps(l1, translationMask)));
+    _mm_storeu_ps(&ret.m20, SIMDCombineRowsAdd(l2, r0, r1, r2, _mm_and_ps(l2, translationMask)));
+    _mm_storeu_ps(&ret.m30, SIMDCombineRowsAdd(l3, r0, r1, r2, _mm_and_ps(l3, translationMask)));
+    return ret;
+#else
     return Matrix4(
         lhs.m00 * rhs.m00 + lhs.m01 * rhs.m10 + lhs.m02 * rhs.m20,
         lhs.m00 * rhs.m01 + lhs.m01 * rhs.m11 + lhs.m02 * rhs.m21,
@@ -364,4 +412,5 @@ inline Matrix4 operator * (const Matrix4& lhs, const Matrix3x4& rhs)
         lhs.m30 * rhs.m02 + lhs.m31 * rhs.m12 + lhs.m32 * rhs.m22,
         lhs.m30 * rhs.m03 + lhs.m31 * rhs.m13 + lhs.m32 * rhs.m23 + lhs.m33
     );
+#endif
 }
@@ -28,28 +28,27 @@ Matrix4::Matrix4(const Matrix3x4& matrix) :
 
 bool Matrix4::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 16)
+    float values[16];
+    if (ParseFloats(string, values, 16) < 16)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    m00 = (float)strtod(ptr, &ptr);
-    m01 = (float)strtod(ptr, &ptr);
-    m02 = (float)strtod(ptr, &ptr);
-    m03 = (float)strtod(ptr, &ptr);
-    m10 = (float)strtod(ptr, &ptr);
-    m11 = (float)strtod(ptr, &ptr);
-    m12 = (float)strtod(ptr, &ptr);
-    m13 = (float)strtod(ptr, &ptr);
-    m20 = (float)strtod(ptr, &ptr);
-    m21 = (float)strtod(ptr, &ptr);
-    m22 = (float)strtod(ptr, &ptr);
-    m23 = (float)strtod(ptr, &ptr);
-    m30 = (float)strtod(ptr, &ptr);
-    m31 = (float)strtod(ptr, &ptr);
-    m32 = (float)strtod(ptr, &ptr);
-    m33 = (float)strtod(ptr, &ptr);
-    
+    m00 = values[0];
+    m01 = values[1];
+    m02 = values[2];
+    m03 = values[3];
+    m10 = values[4];
+    m11 = values[5];
+    m12 = values[6];
+    m13 = values[7];
+    m20 = values[8];
+    m21 = values[9];
+    m22 = values[10];
+    m23 = values[11];
+    m30 = values[12];
+    m31 = values[13];
+    m32 = values[14];
+    m33 = values[15];
+
     return true;
 }
 
@@ -127,9 +126,5 @@ Matrix4 Matrix4::Inverse() const
 
 std::string Matrix4::ToString() const
 {
-    return FormatString("%g %g %g %g %g %g %g %g %g %g %g %g %g %g %g %g", 
-        m00, m01, m02, m03,
-        m10, m11, m12, m13,
-        m20, m21, m22, m23,
-        m30, m31, m32, m33);
+    return FormatFloats(Data(), 16);
 }
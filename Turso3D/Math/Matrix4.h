@@ -175,6 +175,19 @@ public:
     /// Multiply a matrix.
     Matrix4 operator * (const Matrix4& rhs) const
     {
+#ifdef TURSO3D_SSE
+        __m128 r0 = _mm_loadu_ps(&rhs.m00);
+        __m128 r1 = _mm_loadu_ps(&rhs.m10);
+        __m128 r2 = _mm_loadu_ps(&rhs.m20);
+        __m128 r3 = _mm_loadu_ps(&rhs.m30);
+
+        Matrix4 ret;
+        _mm_storeu_ps(&ret.m00, SIMDCombineRows(_mm_loadu_ps(&m00), r0, r1, r2, r3));
+        _mm_storeu_ps(&ret.m10, SIMDCombineRows(_mm_loadu_ps(&m10), r0, r1, r2, r3));
+        _mm_storeu_ps(&ret.m20, SIMDCombineRows(_mm_loadu_ps(&m20), r0, r1, r2, r3));
+        _mm_storeu_ps(&ret.m30, SIMDCombineRows(_mm_loadu_ps(&m30), r0, r1, r2, r3));
+        return ret;
+#else
         return Matrix4(
             m00 * rhs.m00 + m01 * rhs.m10 + m02 * rhs.m20 + m03 * rhs.m30,
             m00 * rhs.m01 + m01 * rhs.m11 + m02 * rhs.m21 + m03 * rhs.m31,
@@ -193,6 +206,7 @@ public:
             m30 * rhs.m02 + m31 * rhs.m12 + m32 * rhs.m22 + m33 * rhs.m32,
             m30 * rhs.m03 + m31 * rhs.m13 + m32 * rhs.m23 + m33 * rhs.m33
         );
+#endif
     }
     
     /// Set translation elements.
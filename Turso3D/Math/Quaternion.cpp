@@ -151,26 +151,20 @@ bool Quaternion::FromLookRotation(const Vector3& direction, const Vector3& upDir
 
 bool Quaternion::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
+    float values[4];
+    size_t elements = ParseFloats(string, values, 4);
     if (elements < 3)
         return false;
 
-    char* ptr = const_cast<char*>(string);
     if (elements >= 4)
     {
-        w = (float)strtod(ptr, &ptr);
-        x = (float)strtod(ptr, &ptr);
-        y = (float)strtod(ptr, &ptr);
-        z = (float)strtod(ptr, &ptr);
+        w = values[0];
+        x = values[1];
+        y = values[2];
+        z = values[3];
     }
     else
-    {
-        float x_, y_, z_;
-        x_ = (float)strtod(ptr, &ptr);
-        y_ = (float)strtod(ptr, &ptr);
-        z_ = (float)strtod(ptr, &ptr);
-        FromEulerAngles(x_, y_, z_);
-    }
+        FromEulerAngles(values[0], values[1], values[2]);
 
     return true;
 }
@@ -280,5 +274,5 @@ Quaternion Quaternion::Nlerp(Quaternion rhs, float t, bool shortestPath) const
 
 std::string Quaternion::ToString() const
 {
-    return FormatString("%g %g %g %g", w, x, y, z);
+    return FormatFloats(Data(), 4);
 }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "Matrix3.h"
+#include "SIMD.h"
 
 #include <string>
 
@@ -130,12 +131,29 @@ public:
     /// Multiply a quaternion.
     Quaternion operator * (const Quaternion& rhs) const
     {
+#ifdef TURSO3D_SSE
+        // Both are stored as w, x, y, z. Each lhs component multiplies a permutation of rhs with sign changes
+        __m128 q1 = _mm_loadu_ps(&w);
+        __m128 q2 = _mm_loadu_ps(&rhs.w);
+        __m128 ret = _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(0, 0, 0, 0)), q2);
+        ret = _mm_add_ps(ret, _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(1, 1, 1, 1)),
+            _mm_xor_ps(_mm_shuffle_ps(q2, q2, _MM_SHUFFLE(2, 3, 0, 1)), _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f))));
+        ret = _mm_add_ps(ret, _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(2, 2, 2, 2)),
+            _mm_xor_ps(_mm_shuffle_ps(q2, q2, _MM_SHUFFLE(1, 0, 3, 2)), _mm_set_ps(-0.0f, 0.0f, 0.0f, -0.0f))));
+        ret = _mm_add_ps(ret, _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(3, 3, 3, 3)),
+            _mm_xor_ps(_mm_shuffle_ps(q2, q2, _MM_SHUFFLE(0, 1, 2, 3)), _mm_set_ps(0.0f, 0.0f, -0.0f, -0.0f))));
+
+        Quaternion result;
+        _mm_storeu_ps(&result.w, ret);
+        return result;
+#else
         return Quaternion(
             w * rhs.w - x * rhs.x - y * rhs.y - z * rhs.z,
             w * rhs.x + x * rhs.w + y * rhs.z - z * rhs.y,
             w * rhs.y + y * rhs.w + z * rhs.x - x * rhs.z,
             w * rhs.z + z * rhs.w + x * rhs.y - y * rhs.x
         );
+#endif
     }
     
     /// Multiply a Vector3.
@@ -1,8 +1,168 @@
- // For conditions of distribution and use, see copyright notice in License.txt
+// For conditions of distribution and use, see copyright notice in License.txt
 
 #include "Random.h"
+#include "SIMD.h"
 
-static unsigned randomSeed = 1;
+#include <cstring>
+
+/// Polynomial for advancing xoshiro128** state by 2^64 steps.
+static const unsigned jumpPolynomial[] = { 0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b };
+
+static thread_local unsigned randomSeed = 1;
+
+/// Return the next value of a splitmix64 sequence, used for expanding a seed to the generator state.
+static unsigned long long SplitMix64(unsigned long long& x)
+{
+    unsigned long long z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void RandomGenerator::SetSeed(unsigned long long seed)
+{
+    unsigned long long a = SplitMix64(seed);
+    unsigned long long b = SplitMix64(seed);
+    state[0] = (unsigned)a;
+    state[1] = (unsigned)(a >> 32);
+    state[2] = (unsigned)b;
+    state[3] = (unsigned)(b >> 32);
+
+    // Split the array fill lanes off the single value sequence so that they do not overlap
+    RandomGenerator lane(*this);
+    for (size_t i = 0; i < 4; ++i)
+    {
+        lane.Jump();
+        for (size_t j = 0; j < 4; ++j)
+            laneState[j][i] = lane.state[j];
+    }
+}
+
+void RandomGenerator::Jump()
+{
+    unsigned s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        for (int b = 0; b < 32; ++b)
+        {
+            if (jumpPolynomial[i] & (1u << b))
+            {
+                s0 ^= state[0];
+                s1 ^= state[1];
+                s2 ^= state[2];
+                s3 ^= state[3];
+            }
+            Next();
+        }
+    }
+
+    state[0] = s0;
+    state[1] = s1;
+    state[2] = s2;
+    state[3] = s3;
+}
+
+void RandomGenerator::Fill(unsigned* dest, size_t count)
+{
+    unsigned block[4];
+
+    while (count)
+    {
+#ifdef TURSO3D_SSE
+        __m128i s0 = _mm_loadu_si128((const __m128i*)laneState[0]);
+        __m128i s1 = _mm_loadu_si128((const __m128i*)laneState[1]);
+        __m128i s2 = _mm_loadu_si128((const __m128i*)laneState[2]);
+        __m128i s3 = _mm_loadu_si128((const __m128i*)laneState[3]);
+
+        // SSE2 has no 32-bit multiply, so multiply by 5 and 9 with shifts and adds
+        __m128i times5 = _mm_add_epi32(_mm_slli_epi32(s1, 2), s1);
+        __m128i rotated = _mm_or_si128(_mm_slli_epi32(times5, 7), _mm_srli_epi32(times5, 25));
+        __m128i result = _mm_add_epi32(_mm_slli_epi32(rotated, 3), rotated);
+        __m128i t = _mm_slli_epi32(s1, 9);
+
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+        _mm_storeu_si128((__m128i*)laneState[0], s0);
+        _mm_storeu_si128((__m128i*)laneState[1], s1);
+        _mm_storeu_si128((__m128i*)laneState[2], s2);
+        _mm_storeu_si128((__m128i*)laneState[3], s3);
+
+        if (count >= 4)
+        {
+            _mm_storeu_si128((__m128i*)dest, result);
+            dest += 4;
+            count -= 4;
+            continue;
+        }
+        _mm_storeu_si128((__m128i*)block, result);
+#else
+        for (size_t i = 0; i < 4; ++i)
+        {
+            block[i] = RotateLeft(laneState[1][i] * 5, 7) * 9;
+            unsigned t = laneState[1][i] << 9;
+
+            laneState[2][i] ^= laneState[0][i];
+            laneState[3][i] ^= laneState[1][i];
+            laneState[1][i] ^= laneState[2][i];
+            laneState[0][i] ^= laneState[3][i];
+            laneState[2][i] ^= t;
+            laneState[3][i] = RotateLeft(laneState[3][i], 11);
+        }
+
+        if (count >= 4)
+        {
+            memcpy(dest, block, sizeof block);
+            dest += 4;
+            count -= 4;
+            continue;
+        }
+#endif
+
+        // Partial block at the end: the rest of the generated values are discarded
+        memcpy(dest, block, count * sizeof(unsigned));
+        count = 0;
+    }
+}
+
+void RandomGenerator::Fill(float* dest, size_t count, float min, float max)
+{
+    // Generate the integers in place, then convert their top 24 bits to floats
+    Fill(reinterpret_cast<unsigned*>(dest), count);
+
+    float scale = (max - min) * (1.0f / 16777216.0f);
+    size_t i = 0;
+
+#ifdef TURSO3D_SSE
+    __m128 scaleVec = _mm_set1_ps(scale);
+    __m128 minVec = _mm_set1_ps(min);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i bits = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(dest + i)), 8);
+        _mm_storeu_ps(dest + i, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(bits), scaleVec), minVec));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        unsigned bits;
+        memcpy(&bits, dest + i, sizeof bits);
+        dest[i] = (float)(bits >> 8) * scale + min;
+    }
+}
+
+float RandomGenerator::StandardNormal()
+{
+    // Box-Muller transform. Use 1 - x to keep the logarithm argument nonzero
+    float u = 1.0f - NextFloat();
+    float v = NextFloat();
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * M_PI * v);
+}
 
 void SetRandomSeed(unsigned seed)
 {
@@ -30,4 +190,3 @@ float RandStandardNormal()
     // Now val is approximatly standard normal distributed
     return val;
 }
-
@@ -4,11 +4,66 @@
 
 #include "Math.h"
 
-/// Set the random seed. The default seed is 1.
+/// Pseudo-random number generator with explicit state, using the xoshiro128** algorithm for full 32-bit output. Generators are not shared between threads; give each thread or job its own, seeded differently or split off with Jump(), to generate without synchronization and without correlated output.
+class RandomGenerator
+{
+public:
+    /// Construct with a seed.
+    RandomGenerator(unsigned long long seed = 1) { SetSeed(seed); }
+
+    /// Reset the state from a seed.
+    void SetSeed(unsigned long long seed);
+    /// Advance the state by 2^64 steps. Generators split off by copying and jumping produce non-overlapping sequences.
+    void Jump();
+    /// Fill an array with random 32-bit values, generating four values at a time with SIMD if available. Uses separate state from the single value functions.
+    void Fill(unsigned* dest, size_t count);
+    /// Fill an array with random floats between min (inclusive) and max (exclusive), generating four values at a time with SIMD if available. Uses separate state from the single value functions.
+    void Fill(float* dest, size_t count, float min = 0.0f, float max = 1.0f);
+    /// Return a standard normal distributed number.
+    float StandardNormal();
+
+    /// Return a random 32-bit value.
+    unsigned Next()
+    {
+        unsigned result = RotateLeft(state[1] * 5, 7) * 9;
+        unsigned t = state[1] << 9;
+
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = RotateLeft(state[3], 11);
+
+        return result;
+    }
+
+    /// Return a random float between 0.0 (inclusive) and 1.0 (exclusive.)
+    float NextFloat() { return (Next() >> 8) * (1.0f / 16777216.0f); }
+    /// Return a random float between min (inclusive) and max (exclusive.)
+    float NextFloat(float min, float max) { return NextFloat() * (max - min) + min; }
+    /// Return a random unsigned integer between 0 and range - 1.
+    unsigned NextUInt(unsigned range) { return (unsigned)(((unsigned long long)Next() * range) >> 32); }
+    /// Return a random integer between min and max - 1.
+    int NextInt(int min, int max) { return min + (int)NextUInt((unsigned)(max - min)); }
+    /// Return a random normal distributed number with the given mean value and variance.
+    float NextNormal(float meanValue, float variance) { return StandardNormal() * sqrtf(variance) + meanValue; }
+
+private:
+    /// Rotate bits left.
+    static unsigned RotateLeft(unsigned value, int bits) { return (value << bits) | (value >> (32 - bits)); }
+
+    /// State for single values.
+    unsigned state[4];
+    /// State for four-wide array fills, with the same state word of each lane stored together.
+    unsigned laneState[4][4];
+};
+
+/// Set the random seed of the calling thread. The default seed is 1.
 void SetRandomSeed(unsigned seed);
-/// Return the current random seed.
+/// Return the current random seed of the calling thread.
 unsigned RandomSeed();
-/// Return a random number between 0-32767. Should operate similarly to MSVC rand().
+/// Return a random number between 0-32767. Should operate similarly to MSVC rand(). The state is per thread.
 int Rand();
 /// Return a standard normal distributed number.
 float RandStandardNormal();
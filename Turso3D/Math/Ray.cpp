@@ -227,7 +227,15 @@ float Ray::HitDistance(const void* vertexData, size_t vertexSize, size_t vertexS
         const Vector3& v0 = *((const Vector3*)(&vertices[index * vertexSize]));
         const Vector3& v1 = *((const Vector3*)(&vertices[(index + 1) * vertexSize]));
         const Vector3& v2 = *((const Vector3*)(&vertices[(index + 2) * vertexSize]));
-        nearest = Min(nearest, HitDistance(v0, v1, v2, outNormal));
+        Vector3 normal;
+        float distance = HitDistance(v0, v1, v2, outNormal ? &normal : nullptr);
+        // Keep the normal of the nearest hit
+        if (distance < nearest)
+        {
+            nearest = distance;
+            if (outNormal)
+                *outNormal = normal;
+        }
         index += 3;
     }
     
@@ -251,22 +259,38 @@ float Ray::HitDistance(const void* vertexData, size_t vertexSize, const void* in
             const Vector3& v0 = *((const Vector3*)(&vertices[indices[0] * vertexSize]));
             const Vector3& v1 = *((const Vector3*)(&vertices[indices[1] * vertexSize]));
             const Vector3& v2 = *((const Vector3*)(&vertices[indices[2] * vertexSize]));
-            nearest = Min(nearest, HitDistance(v0, v1, v2, outNormal));
+            Vector3 normal;
+            float distance = HitDistance(v0, v1, v2, outNormal ? &normal : nullptr);
+            // Keep the normal of the nearest hit
+            if (distance < nearest)
+            {
+                nearest = distance;
+                if (outNormal)
+                    *outNormal = normal;
+            }
             indices += 3;
         }
     }
     // 32-bit indices
     else
     {
-        const size_t* indices = ((const size_t*)indexData) + indexStart;
-        const size_t* indicesEnd = indices + indexCount;
+        const unsigned* indices = ((const unsigned*)indexData) + indexStart;
+        const unsigned* indicesEnd = indices + indexCount;
         
         while (indices < indicesEnd)
         {
             const Vector3& v0 = *((const Vector3*)(&vertices[indices[0] * vertexSize]));
             const Vector3& v1 = *((const Vector3*)(&vertices[indices[1] * vertexSize]));
             const Vector3& v2 = *((const Vector3*)(&vertices[indices[2] * vertexSize]));
-            nearest = Min(nearest, HitDistance(v0, v1, v2, outNormal));
+            Vector3 normal;
+            float distance = HitDistance(v0, v1, v2, outNormal ? &normal : nullptr);
+            // Keep the normal of the nearest hit
+            if (distance < nearest)
+            {
+                nearest = distance;
+                if (outNormal)
+                    *outNormal = normal;
+            }
             indices += 3;
         }
     }
@@ -336,8 +360,8 @@ bool Ray::InsideGeometry(const void* vertexData, size_t vertexSize, const void*
     // 32-bit indices
     else
     {
-        const size_t* indices = ((const size_t*)indexData) + indexStart;
-        const size_t* indicesEnd = indices + indexCount;
+        const unsigned* indices = ((const unsigned*)indexData) + indexStart;
+        const unsigned* indicesEnd = indices + indexCount;
         
         while (indices < indicesEnd)
         {
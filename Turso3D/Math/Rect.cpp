@@ -29,16 +29,15 @@ void Rect::Clip(const Rect& rect)
 
 bool Rect::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 4)
+    float values[4];
+    if (ParseFloats(string, values, 4) < 4)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    min.x = (float)strtod(ptr, &ptr);
-    min.y = (float)strtod(ptr, &ptr);
-    max.x = (float)strtod(ptr, &ptr);
-    max.y = (float)strtod(ptr, &ptr);
-    
+    min.x = values[0];
+    min.y = values[1];
+    max.x = values[2];
+    max.y = values[3];
+
     return true;
 }
 
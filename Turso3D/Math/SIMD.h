@@ -0,0 +1,30 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+// SIMD code paths of the math classes are selected at compile time. Define TURSO3D_SCALAR_MATH to use the scalar versions instead
+#if !defined(TURSO3D_SCALAR_MATH) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define TURSO3D_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef TURSO3D_SSE
+/// Return a linear combination of four rows weighted by the components of a vector.
+inline __m128 SIMDCombineRows(__m128 weights, __m128 row0, __m128 row1, __m128 row2, __m128 row3)
+{
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(0, 0, 0, 0)), row0),
+            _mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(1, 1, 1, 1)), row1)),
+        _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(2, 2, 2, 2)), row2),
+            _mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(3, 3, 3, 3)), row3)));
+}
+
+/// Return a linear combination of three rows weighted by the first three components of a vector, plus a fourth row.
+inline __m128 SIMDCombineRowsAdd(__m128 weights, __m128 row0, __m128 row1, __m128 row2, __m128 add)
+{
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(0, 0, 0, 0)), row0),
+            _mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(1, 1, 1, 1)), row1)),
+        _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(weights, weights, _MM_SHUFFLE(2, 2, 2, 2)), row2), add));
+}
+#endif
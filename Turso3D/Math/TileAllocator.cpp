@@ -0,0 +1,243 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Math.h"
+#include "TileAllocator.h"
+
+#include <algorithm>
+
+/// Node states.
+static const unsigned char NODE_FREE = 0;
+static const unsigned char NODE_PARTIAL = 1;
+static const unsigned char NODE_FULL = 2;
+
+/// Return whether a rectangle overlaps another.
+static inline bool Overlaps(const IntRect& a, const IntRect& b)
+{
+    return a.right > b.left && a.left < b.right && a.bottom > b.top && a.top < b.bottom;
+}
+
+/// Return whether a rectangle contains another.
+static inline bool Contains(const IntRect& a, const IntRect& b)
+{
+    return b.left >= a.left && b.right <= a.right && b.top >= a.top && b.bottom <= a.bottom;
+}
+
+TileAllocator::TileAllocator()
+{
+    Reset(0, 0, 1);
+}
+
+TileAllocator::TileAllocator(int width, int height, int tileSize_)
+{
+    Reset(width, height, tileSize_);
+}
+
+void TileAllocator::Reset(int width, int height, int tileSize_)
+{
+    size = IntVector2(Max(width, 0), Max(height, 0));
+    usedArea = 0;
+
+    int minDimension = Min(size.x, size.y);
+    if (minDimension <= 0)
+    {
+        rootGrid = IntVector2::ZERO;
+        rootSize = 0;
+        tileSize = 1;
+        nodeStates.clear();
+        return;
+    }
+
+    rootSize = (int)NextPowerOfTwo((unsigned)minDimension);
+    if (rootSize > minDimension)
+        rootSize >>= 1;
+    tileSize = Min((int)NextPowerOfTwo((unsigned)Max(tileSize_, 1)), rootSize);
+    rootGrid = IntVector2(size.x / rootSize, size.y / rootSize);
+
+    size_t numLevels = 1;
+    for (int nodeSize = rootSize; nodeSize > tileSize; nodeSize >>= 1)
+        ++numLevels;
+
+    nodeStates.resize(numLevels);
+    for (size_t i = 0; i < numLevels; ++i)
+    {
+        nodeStates[i].resize((size_t)(rootGrid.x << i) * (size_t)(rootGrid.y << i));
+        std::fill(nodeStates[i].begin(), nodeStates[i].end(), NODE_FREE);
+    }
+}
+
+bool TileAllocator::Allocate(int width, int height, int& x, int& y)
+{
+    if (!rootSize)
+        return false;
+
+    // Round up to whole tiles
+    width = (Max(width, 1) + tileSize - 1) / tileSize * tileSize;
+    height = (Max(height, 1) + tileSize - 1) / tileSize * tileSize;
+
+    int nodeSize = (int)NextPowerOfTwo((unsigned)Max(width, height));
+    if (nodeSize > rootSize)
+        return false;
+
+    size_t targetLevel = 0;
+    while ((rootSize >> targetLevel) > nodeSize)
+        ++targetLevel;
+
+    // Search partially used roots first, then free roots
+    for (size_t pass = 0; pass < 2; ++pass)
+    {
+        for (int rootY = 0; rootY < rootGrid.y; ++rootY)
+        {
+            for (int rootX = 0; rootX < rootGrid.x; ++rootX)
+            {
+                unsigned char state = NodeState(0, rootX, rootY);
+                if ((pass == 0) != (state == NODE_PARTIAL))
+                    continue;
+
+                int nodeX, nodeY;
+                if (FindNode(0, rootX, rootY, targetLevel, width, height, nodeX, nodeY))
+                {
+                    x = nodeX * nodeSize;
+                    y = nodeY * nodeSize;
+                    AllocateSpecific(IntRect(x, y, x + width, y + height));
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+bool TileAllocator::AllocateSpecific(const IntRect& reserved)
+{
+    if (!rootSize || reserved.right <= reserved.left || reserved.bottom <= reserved.top)
+        return false;
+
+    // Round outward to whole tiles
+    IntRect rect(reserved.left / tileSize * tileSize, reserved.top / tileSize * tileSize, (reserved.right + tileSize - 1) / tileSize * tileSize,
+        (reserved.bottom + tileSize - 1) / tileSize * tileSize);
+    if (rect.left < 0 || rect.top < 0 || rect.right > rootGrid.x * rootSize || rect.bottom > rootGrid.y * rootSize)
+        return false;
+
+    int firstX = rect.left / rootSize;
+    int firstY = rect.top / rootSize;
+    int lastX = (rect.right - 1) / rootSize;
+    int lastY = (rect.bottom - 1) / rootSize;
+
+    for (int rootY = firstY; rootY <= lastY; ++rootY)
+    {
+        for (int rootX = firstX; rootX <= lastX; ++rootX)
+        {
+            if (!IsFree(0, rootX, rootY, rect))
+                return false;
+        }
+    }
+
+    for (int rootY = firstY; rootY <= lastY; ++rootY)
+    {
+        for (int rootX = firstX; rootX <= lastX; ++rootX)
+            Reserve(0, rootX, rootY, rect);
+    }
+
+    usedArea += rect.Width() * rect.Height();
+    return true;
+}
+
+bool TileAllocator::IsFree(size_t level, int x, int y, const IntRect& rect) const
+{
+    if (!Overlaps(NodeRect(level, x, y), rect))
+        return true;
+
+    unsigned char state = NodeState(level, x, y);
+    if (state == NODE_FREE)
+        return true;
+    if (state == NODE_FULL || level + 1 >= nodeStates.size())
+        return false;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!IsFree(level + 1, x * 2 + (i & 1), y * 2 + (i >> 1), rect))
+            return false;
+    }
+
+    return true;
+}
+
+void TileAllocator::Reserve(size_t level, int x, int y, const IntRect& rect)
+{
+    IntRect nodeRect = NodeRect(level, x, y);
+    if (!Overlaps(nodeRect, rect))
+        return;
+
+    unsigned char& state = nodeStates[level][y * (rootGrid.x << level) + x];
+    if (Contains(rect, nodeRect) || level + 1 >= nodeStates.size())
+    {
+        state = NODE_FULL;
+        return;
+    }
+
+    state = NODE_PARTIAL;
+    bool allFull = true;
+    for (int i = 0; i < 4; ++i)
+    {
+        int childX = x * 2 + (i & 1);
+        int childY = y * 2 + (i >> 1);
+        Reserve(level + 1, childX, childY, rect);
+        if (NodeState(level + 1, childX, childY) != NODE_FULL)
+            allFull = false;
+    }
+
+    if (allFull)
+        state = NODE_FULL;
+}
+
+bool TileAllocator::FindNode(size_t level, int x, int y, size_t targetLevel, int width, int height, int& destX, int& destY) const
+{
+    unsigned char state = NodeState(level, x, y);
+    if (state == NODE_FULL)
+        return false;
+
+    if (level == targetLevel)
+    {
+        // A partially used node can still fit a rectangle that does not fill it, for example a point light's 3x2 faces
+        IntRect nodeRect = NodeRect(level, x, y);
+        if (state == NODE_PARTIAL && !IsFree(level, x, y, IntRect(nodeRect.left, nodeRect.top, nodeRect.left + width, nodeRect.top + height)))
+            return false;
+
+        destX = x;
+        destY = y;
+        return true;
+    }
+
+    if (state == NODE_FREE)
+    {
+        // Use the top-left descendant
+        destX = x << (targetLevel - level);
+        destY = y << (targetLevel - level);
+        return true;
+    }
+
+    // Search partially used children first, then free children
+    for (size_t pass = 0; pass < 2; ++pass)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            int childX = x * 2 + (i & 1);
+            int childY = y * 2 + (i >> 1);
+            unsigned char childState = NodeState(level + 1, childX, childY);
+            if ((pass == 0) != (childState == NODE_PARTIAL))
+                continue;
+
+            if (FindNode(level + 1, childX, childY, targetLevel, width, height, destX, destY))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+IntRect TileAllocator::NodeRect(size_t level, int x, int y) const
+{
+    int nodeSize = rootSize >> level;
+    return IntRect(x * nodeSize, y * nodeSize, (x + 1) * nodeSize, (y + 1) * nodeSize);
+}
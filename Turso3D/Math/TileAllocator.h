@@ -0,0 +1,60 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "IntRect.h"
+
+#include <vector>
+
+/// Power of two quadtree allocator for rectangles that are multiples of a tile size, for example shadow map atlas tiles. A rectangle is placed in the top-left corner of the smallest quadtree node that fits it, preferring partially used nodes so that the free space stays in large blocks.
+class TileAllocator
+{
+public:
+    /// Default construct with empty size.
+    TileAllocator();
+    /// Construct with given size and tile size.
+    TileAllocator(int width, int height, int tileSize);
+
+    /// Reset to given size and tile size and remove all previous allocations. The quadtree roots are the largest power of two squares that fit the smaller dimension.
+    void Reset(int width, int height, int tileSize);
+    /// Try to allocate a rectangle. The reserved area is rounded up to whole tiles. Return true on success, with x & y coordinates filled.
+    bool Allocate(int width, int height, int& x, int& y);
+    /// Attempt a specific allocation, for example a rectangle allocated on the previous frame. Return true on success.
+    bool AllocateSpecific(const IntRect& reserved);
+
+    /// Return the size.
+    const IntVector2& Size() const { return size; }
+    /// Return the tile size.
+    int TileSize() const { return tileSize; }
+    /// Return the allocatable area, which excludes the parts not covered by the quadtree roots.
+    int Capacity() const { return rootGrid.x * rootGrid.y * rootSize * rootSize; }
+    /// Return the reserved area.
+    int UsedArea() const { return usedArea; }
+    /// Return the reserved fraction of the allocatable area.
+    float Occupancy() const { return Capacity() ? (float)usedArea / (float)Capacity() : 0.0f; }
+
+private:
+    /// Return whether the part of a rectangle inside a node is free.
+    bool IsFree(size_t level, int x, int y, const IntRect& rect) const;
+    /// Mark the part of a rectangle inside a node reserved.
+    void Reserve(size_t level, int x, int y, const IntRect& rect);
+    /// Find a node at the target level with room for a rectangle at its top-left corner. Return true on success, with the node position filled.
+    bool FindNode(size_t level, int x, int y, size_t targetLevel, int width, int height, int& destX, int& destY) const;
+    /// Return the rectangle of a node.
+    IntRect NodeRect(size_t level, int x, int y) const;
+    /// Return the state of a node.
+    unsigned char NodeState(size_t level, int x, int y) const { return nodeStates[level][y * (rootGrid.x << level) + x]; }
+
+    /// Node states per quadtree level.
+    std::vector<std::vector<unsigned char> > nodeStates;
+    /// Size.
+    IntVector2 size;
+    /// Number of quadtree roots horizontally and vertically.
+    IntVector2 rootGrid;
+    /// Quadtree root size.
+    int rootSize;
+    /// Tile size, which is the size of the smallest nodes.
+    int tileSize;
+    /// Reserved area.
+    int usedArea;
+};
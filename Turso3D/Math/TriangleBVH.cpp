@@ -0,0 +1,157 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Ray.h"
+#include "TriangleBVH.h"
+
+#include <algorithm>
+
+/// Maximum number of triangles in a leaf node.
+static const unsigned MAX_LEAF_TRIANGLES = 4;
+/// Traversal stack size. The hierarchy is split at the median, so its depth is logarithmic to the triangle count.
+static const size_t MAX_TRAVERSAL_STACK = 64;
+
+/// Triangle range of a node waiting to be built.
+struct BuildRange
+{
+    /// Node index.
+    unsigned node;
+    /// First triangle in the build order.
+    unsigned start;
+    /// Number of triangles.
+    unsigned count;
+};
+
+void TriangleBVH::Build(const std::vector<Vector3>& vertices, std::vector<unsigned>& indices)
+{
+    nodes.clear();
+
+    unsigned numTriangles = (unsigned)(indices.size() / 3);
+    if (!numTriangles)
+        return;
+
+    std::vector<Vector3> centroids(numTriangles);
+    std::vector<unsigned> order(numTriangles);
+    for (unsigned i = 0; i < numTriangles; ++i)
+    {
+        centroids[i] = (vertices[indices[i * 3]] + vertices[indices[i * 3 + 1]] + vertices[indices[i * 3 + 2]]) * (1.0f / 3.0f);
+        order[i] = i;
+    }
+
+    nodes.reserve(2 * (numTriangles / MAX_LEAF_TRIANGLES) + 1);
+    nodes.resize(1);
+
+    // Split the triangles at the median centroid along the longest axis of the centroid bounds, until the leaves are small enough
+    std::vector<BuildRange> pending;
+    BuildRange root = { 0, 0, numTriangles };
+    pending.push_back(root);
+
+    while (!pending.empty())
+    {
+        BuildRange range = pending.back();
+        unsigned nodeIndex = range.node;
+        pending.pop_back();
+
+        BoundingBox box;
+        BoundingBox centroidBox;
+        for (unsigned i = range.start; i < range.start + range.count; ++i)
+        {
+            unsigned triangle = order[i];
+            box.Merge(vertices[indices[triangle * 3]]);
+            box.Merge(vertices[indices[triangle * 3 + 1]]);
+            box.Merge(vertices[indices[triangle * 3 + 2]]);
+            centroidBox.Merge(centroids[triangle]);
+        }
+
+        nodes[nodeIndex].box = box;
+        if (range.count <= MAX_LEAF_TRIANGLES)
+        {
+            nodes[nodeIndex].start = range.start;
+            nodes[nodeIndex].count = range.count;
+            continue;
+        }
+
+        Vector3 size = centroidBox.Size();
+        size_t axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+        unsigned middle = range.start + range.count / 2;
+        std::nth_element(order.begin() + range.start, order.begin() + middle, order.begin() + range.start + range.count,
+            [&centroids, axis](unsigned lhs, unsigned rhs) { return centroids[lhs].Data()[axis] < centroids[rhs].Data()[axis]; });
+
+        unsigned firstChild = (unsigned)nodes.size();
+        nodes[nodeIndex].start = firstChild;
+        nodes[nodeIndex].count = 0;
+        nodes.resize(nodes.size() + 2);
+
+        BuildRange first = { firstChild, range.start, middle - range.start };
+        BuildRange second = { firstChild + 1, middle, range.start + range.count - middle };
+        pending.push_back(first);
+        pending.push_back(second);
+    }
+
+    std::vector<unsigned> newIndices(numTriangles * 3);
+    for (unsigned i = 0; i < numTriangles; ++i)
+    {
+        newIndices[i * 3] = indices[order[i] * 3];
+        newIndices[i * 3 + 1] = indices[order[i] * 3 + 1];
+        newIndices[i * 3 + 2] = indices[order[i] * 3 + 2];
+    }
+    indices.swap(newIndices);
+}
+
+void TriangleBVH::Clear()
+{
+    nodes.clear();
+}
+
+float TriangleBVH::HitDistance(const Ray& ray, const std::vector<Vector3>& vertices, const std::vector<unsigned>& indices, Vector3* outNormal) const
+{
+    if (nodes.empty())
+        return M_INFINITY;
+
+    float nearest = M_INFINITY;
+    std::pair<unsigned, float> stack[MAX_TRAVERSAL_STACK];
+    size_t stackSize = 0;
+
+    float rootDistance = ray.HitDistance(nodes[0].box);
+    if (rootDistance < M_INFINITY)
+        stack[stackSize++] = std::make_pair(0u, rootDistance);
+
+    while (stackSize)
+    {
+        std::pair<unsigned, float> entry = stack[--stackSize];
+        // Skip nodes that are beyond a hit found after they were pushed
+        if (entry.second >= nearest)
+            continue;
+
+        const TriangleBVHNode& node = nodes[entry.first];
+        if (node.count)
+        {
+            const unsigned* triangle = &indices[node.start * 3];
+            for (unsigned i = 0; i < node.count; ++i, triangle += 3)
+            {
+                Vector3 normal;
+                float distance = ray.HitDistance(vertices[triangle[0]], vertices[triangle[1]], vertices[triangle[2]], outNormal ? &normal : nullptr);
+                if (distance < nearest)
+                {
+                    nearest = distance;
+                    if (outNormal)
+                        *outNormal = normal;
+                }
+            }
+        }
+        else
+        {
+            // Push the farther child first so that the nearer one is visited first
+            std::pair<unsigned, float> first(node.start, ray.HitDistance(nodes[node.start].box));
+            std::pair<unsigned, float> second(node.start + 1, ray.HitDistance(nodes[node.start + 1].box));
+            if (second.second < first.second)
+                std::swap(first, second);
+
+            if (second.second < nearest && stackSize < MAX_TRAVERSAL_STACK)
+                stack[stackSize++] = second;
+            if (first.second < nearest && stackSize < MAX_TRAVERSAL_STACK)
+                stack[stackSize++] = first;
+        }
+    }
+
+    return nearest;
+}
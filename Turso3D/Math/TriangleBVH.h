@@ -0,0 +1,41 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "BoundingBox.h"
+
+#include <vector>
+
+class Ray;
+
+/// Node of a triangle bounding volume hierarchy.
+struct TriangleBVHNode
+{
+    /// Bounding box of the node's triangles.
+    BoundingBox box;
+    /// First triangle if a leaf, otherwise index of the first child node. The second child node follows it.
+    unsigned start;
+    /// Number of triangles if a leaf, or zero if the node has children.
+    unsigned count;
+};
+
+/// Bounding volume hierarchy over an indexed triangle list, for raycasts in logarithmic rather than linear time to the triangle count. Refers to the triangles by their order in the index list, which is reordered when building so that each leaf's triangles are contiguous.
+class TriangleBVH
+{
+public:
+    /// Build from vertex positions and triangle list indices. Reorders the triangles of the index list.
+    void Build(const std::vector<Vector3>& vertices, std::vector<unsigned>& indices);
+    /// Clear the hierarchy.
+    void Clear();
+
+    /// Return hit distance to the triangles, or infinity if no hit. Optionally return the normal of the nearest hit triangle. The vertices and indices must be those the hierarchy was built with.
+    float HitDistance(const Ray& ray, const std::vector<Vector3>& vertices, const std::vector<unsigned>& indices, Vector3* outNormal = nullptr) const;
+    /// Return the nodes, root first.
+    const std::vector<TriangleBVHNode>& Nodes() const { return nodes; }
+    /// Return memory used by the nodes in bytes.
+    size_t MemoryUse() const { return nodes.capacity() * sizeof(TriangleBVHNode); }
+
+private:
+    /// Nodes, root first.
+    std::vector<TriangleBVHNode> nodes;
+};
@@ -15,18 +15,17 @@ const Vector2 Vector2::ONE(1.0f, 1.0f);
 
 bool Vector2::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 2)
+    float values[2];
+    if (ParseFloats(string, values, 2) < 2)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = (float)strtod(ptr, &ptr);
-    y = (float)strtod(ptr, &ptr);
+    x = values[0];
+    y = values[1];
 
     return true;
 }
 
 std::string Vector2::ToString() const
 {
-    return FormatString("%g %g", x, y);
+    return FormatFloats(Data(), 2);
 }
@@ -17,19 +17,18 @@ const Vector3 Vector3::ONE(1.0f, 1.0f, 1.0f);
 
 bool Vector3::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 3)
+    float values[3];
+    if (ParseFloats(string, values, 3) < 3)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = (float)strtod(ptr, &ptr);
-    y = (float)strtod(ptr, &ptr);
-    z = (float)strtod(ptr, &ptr);
-    
+    x = values[0];
+    y = values[1];
+    z = values[2];
+
     return true;
 }
 
 std::string Vector3::ToString() const
 {
-    return FormatString("%g %g %g", x, y, z);
+    return FormatFloats(Data(), 3);
 }
@@ -11,20 +11,19 @@ const Vector4 Vector4::ONE(1.0f, 1.0f, 1.0f, 1.0f);
 
 bool Vector4::FromString(const char* string)
 {
-    size_t elements = CountElements(string);
-    if (elements < 4)
+    float values[4];
+    if (ParseFloats(string, values, 4) < 4)
         return false;
 
-    char* ptr = const_cast<char*>(string);
-    x = (float)strtod(ptr, &ptr);
-    y = (float)strtod(ptr, &ptr);
-    z = (float)strtod(ptr, &ptr);
-    w = (float)strtod(ptr, &ptr);
-    
+    x = values[0];
+    y = values[1];
+    z = values[2];
+    w = values[3];
+
     return true;
 }
 
 std::string Vector4::ToString() const
 {
-    return FormatString("%g %g %g %g", x, y, z, w);
+    return FormatFloats(Data(), 4);
 }
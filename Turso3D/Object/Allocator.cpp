@@ -2,6 +2,10 @@
 
 #include "Allocator.h"
 
+#include <cassert>
+#include <algorithm>
+#include <cstdlib>
+
 static AllocatorBlock* AllocatorGetBlock(AllocatorBlock* allocator, size_t nodeSize, size_t capacity)
 {
     if (!capacity)
@@ -11,6 +15,7 @@ static AllocatorBlock* AllocatorGetBlock(AllocatorBlock* allocator, size_t nodeS
     AllocatorBlock* newBlock = reinterpret_cast<AllocatorBlock*>(blockPtr);
     newBlock->nodeSize = nodeSize;
     newBlock->capacity = capacity;
+    newBlock->used = 0;
     newBlock->free = nullptr;
     newBlock->next = nullptr;
     
@@ -76,6 +81,7 @@ void* AllocatorGet(AllocatorBlock* allocator)
     void* ptr = (reinterpret_cast<unsigned char*>(freeNode)) + sizeof(AllocatorNode);
     allocator->free = freeNode->next;
     freeNode->next = nullptr;
+    ++allocator->used;
     
     return ptr;
 }
@@ -91,4 +97,320 @@ void AllocatorFree(AllocatorBlock* allocator, void* ptr)
     // Chain the node back to free nodes
     node->next = allocator->free;
     allocator->free = node;
+    --allocator->used;
+}
+
+AllocatorBlock* AllocatorFreeAll(AllocatorBlock* allocator)
+{
+    if (!allocator)
+        return nullptr;
+
+    // Coalesce a chain into one block, so that the nodes are contiguous from now on
+    if (allocator->next)
+    {
+        size_t nodeSize = allocator->nodeSize;
+        size_t capacity = allocator->capacity;
+        AllocatorUninitialize(allocator);
+        return AllocatorInitialize(nodeSize, capacity);
+    }
+
+    unsigned char* nodePtr = reinterpret_cast<unsigned char*>(allocator) + sizeof(AllocatorBlock);
+    size_t stride = sizeof(AllocatorNode) + allocator->nodeSize;
+    allocator->free = reinterpret_cast<AllocatorNode*>(nodePtr);
+    for (size_t i = 0; i < allocator->capacity - 1; ++i)
+    {
+        reinterpret_cast<AllocatorNode*>(nodePtr)->next = reinterpret_cast<AllocatorNode*>(nodePtr + stride);
+        nodePtr += stride;
+    }
+    reinterpret_cast<AllocatorNode*>(nodePtr)->next = nullptr;
+    allocator->used = 0;
+
+    return allocator;
+}
+
+AllocatorStats AllocatorGetStats(const AllocatorBlock* allocator)
+{
+    AllocatorStats stats;
+    if (allocator)
+    {
+        stats.nodeSize = allocator->nodeSize;
+        stats.capacity = allocator->capacity;
+        stats.used = allocator->used;
+        for (const AllocatorBlock* block = allocator; block; block = block->next)
+            ++stats.numBlocks;
+    }
+
+    return stats;
+}
+
+PoolAllocator::PoolAllocator(size_t initialCapacity_) :
+    allocators(POOL_MAX_SIZE / POOL_SIZE_GRANULARITY, nullptr),
+    initialCapacity(initialCapacity_)
+{
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    // Objects may outlive a static pool allocator during program exit, so the memory can not be freed in that case
+    for (auto it = allocators.begin(); it != allocators.end(); ++it)
+    {
+        if (*it && !(*it)->used)
+            AllocatorUninitialize(*it);
+    }
+}
+
+void* PoolAllocator::Allocate(size_t size)
+{
+    if (!size || size > POOL_MAX_SIZE)
+        return ::operator new(size);
+
+    size_t index = (size - 1) / POOL_SIZE_GRANULARITY;
+    AllocatorBlock*& allocator = allocators[index];
+    if (!allocator)
+        allocator = AllocatorInitialize((index + 1) * POOL_SIZE_GRANULARITY, initialCapacity);
+
+    return AllocatorGet(allocator);
+}
+
+void PoolAllocator::Free(void* ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    if (!size || size > POOL_MAX_SIZE)
+        ::operator delete(ptr);
+    else
+        AllocatorFree(allocators[(size - 1) / POOL_SIZE_GRANULARITY], ptr);
+}
+
+void PoolAllocator::Stats(std::vector<AllocatorStats>& dest) const
+{
+    dest.clear();
+    for (auto it = allocators.begin(); it != allocators.end(); ++it)
+    {
+        if (*it)
+            dest.push_back(AllocatorGetStats(*it));
+    }
+}
+
+MagazineAllocator::MagazineAllocator(size_t nodeSize, size_t initialCapacity) :
+    blocks(AllocatorInitialize(nodeSize, initialCapacity))
+{
+    SetNumThreads(1);
+}
+
+MagazineAllocator::~MagazineAllocator()
+{
+    SetNumThreads(0);
+    AllocatorUninitialize(blocks);
+}
+
+void MagazineAllocator::SetNumThreads(size_t num)
+{
+    for (size_t i = num; i < threads.size(); ++i)
+    {
+        MagazineAllocatorThread& thread = threads[i];
+        if (thread.numPrevious == ALLOCATOR_MAGAZINE_SIZE)
+            PutMagazine(thread.previous);
+
+        if (thread.numLoaded == ALLOCATOR_MAGAZINE_SIZE)
+            PutMagazine(thread.loaded);
+        else
+        {
+            // Return a partial magazine node by node to the block chain
+            std::lock_guard<std::mutex> lock(mutex);
+            for (AllocatorNode* node = thread.loaded; node;)
+            {
+                AllocatorNode* next = node->next;
+                AllocatorFree(blocks, reinterpret_cast<unsigned char*>(node) + sizeof(AllocatorNode));
+                node = next;
+            }
+        }
+    }
+
+    threads.resize(num);
+}
+
+void* MagazineAllocator::Allocate(unsigned threadIndex)
+{
+    assert(threadIndex < threads.size());
+
+    MagazineAllocatorThread& thread = threads[threadIndex];
+    if (!thread.numLoaded)
+    {
+        if (thread.numPrevious)
+        {
+            std::swap(thread.loaded, thread.previous);
+            std::swap(thread.numLoaded, thread.numPrevious);
+        }
+        else
+        {
+            thread.loaded = GetMagazine();
+            thread.numLoaded = ALLOCATOR_MAGAZINE_SIZE;
+        }
+    }
+
+    AllocatorNode* node = thread.loaded;
+    thread.loaded = node->next;
+    --thread.numLoaded;
+    node->next = nullptr;
+
+    return reinterpret_cast<unsigned char*>(node) + sizeof(AllocatorNode);
+}
+
+void MagazineAllocator::Free(void* ptr, unsigned threadIndex)
+{
+    assert(threadIndex < threads.size());
+
+    if (!ptr)
+        return;
+
+    MagazineAllocatorThread& thread = threads[threadIndex];
+    if (thread.numLoaded == ALLOCATOR_MAGAZINE_SIZE)
+    {
+        // The previous magazine is either full or empty. If full, it goes to the shared list
+        if (thread.numPrevious)
+            PutMagazine(thread.previous);
+        thread.previous = thread.loaded;
+        thread.numPrevious = thread.numLoaded;
+        thread.loaded = nullptr;
+        thread.numLoaded = 0;
+    }
+
+    AllocatorNode* node = reinterpret_cast<AllocatorNode*>(static_cast<unsigned char*>(ptr) - sizeof(AllocatorNode));
+    node->next = thread.loaded;
+    thread.loaded = node;
+    ++thread.numLoaded;
+}
+
+void MagazineAllocator::FreeAll()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        *it = MagazineAllocatorThread();
+    magazines.clear();
+    blocks = AllocatorFreeAll(blocks);
+}
+
+AllocatorStats MagazineAllocator::Stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    AllocatorStats stats = AllocatorGetStats(blocks);
+    stats.cached = magazines.size() * ALLOCATOR_MAGAZINE_SIZE;
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        stats.cached += it->numLoaded + it->numPrevious;
+    // The block chain counts the nodes handed out to the caches as used
+    stats.used -= stats.cached;
+
+    return stats;
+}
+
+AllocatorNode* MagazineAllocator::GetMagazine()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!magazines.empty())
+    {
+        AllocatorNode* magazine = magazines.back();
+        magazines.pop_back();
+        return magazine;
+    }
+
+    // Link the new nodes in address order, so that a thread allocates contiguous memory
+    AllocatorNode* magazine = nullptr;
+    AllocatorNode** link = &magazine;
+    for (size_t i = 0; i < ALLOCATOR_MAGAZINE_SIZE; ++i)
+    {
+        AllocatorNode* node = reinterpret_cast<AllocatorNode*>(static_cast<unsigned char*>(AllocatorGet(blocks)) - sizeof(AllocatorNode));
+        *link = node;
+        link = &node->next;
+    }
+
+    return magazine;
+}
+
+void MagazineAllocator::PutMagazine(AllocatorNode* magazine)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    magazines.push_back(magazine);
+}
+
+FrameAllocator::FrameAllocator(size_t chunkSize_) :
+    chunkSize(chunkSize_)
+{
+    SetNumThreads(1);
+}
+
+FrameAllocator::~FrameAllocator()
+{
+    SetNumThreads(0);
+}
+
+void FrameAllocator::SetNumThreads(size_t num)
+{
+    for (size_t i = num; i < threads.size(); ++i)
+    {
+        FrameAllocatorThread& thread = threads[i];
+        for (auto it = thread.fullChunks.begin(); it != thread.fullChunks.end(); ++it)
+            delete[] *it;
+        delete[] thread.chunk;
+    }
+
+    threads.resize(num);
+}
+
+void* FrameAllocator::Allocate(size_t size, unsigned threadIndex)
+{
+    assert(threadIndex < threads.size());
+
+    FrameAllocatorThread& thread = threads[threadIndex];
+    size = (size + FRAME_ALLOCATION_ALIGNMENT - 1) & ~(FRAME_ALLOCATION_ALIGNMENT - 1);
+
+    if (thread.offset + size > thread.chunkSize)
+    {
+        if (thread.chunk)
+        {
+            thread.fullChunks.push_back(thread.chunk);
+            thread.used += thread.chunkSize - thread.offset;
+        }
+
+        thread.chunkSize = std::max(std::max(chunkSize, thread.chunkSize * 2), size);
+        thread.chunk = new unsigned char[thread.chunkSize];
+        thread.offset = 0;
+    }
+
+    void* ret = thread.chunk + thread.offset;
+    thread.offset += size;
+    thread.used += size;
+    return ret;
+}
+
+void FrameAllocator::Reset()
+{
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+    {
+        FrameAllocatorThread& thread = *it;
+        if (!thread.fullChunks.empty())
+        {
+            for (auto cIt = thread.fullChunks.begin(); cIt != thread.fullChunks.end(); ++cIt)
+                delete[] *cIt;
+            thread.fullChunks.clear();
+            delete[] thread.chunk;
+            thread.chunkSize = thread.used;
+            thread.chunk = new unsigned char[thread.chunkSize];
+        }
+
+        thread.offset = 0;
+        thread.used = 0;
+    }
+}
+
+size_t FrameAllocator::Capacity() const
+{
+    size_t ret = 0;
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        ret += it->chunkSize;
+    return ret;
 }
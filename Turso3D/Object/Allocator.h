@@ -3,7 +3,10 @@
 #pragma once
 
 #include <cstddef>
+#include <mutex>
 #include <new>
+#include <type_traits>
+#include <vector>
 
 struct AllocatorBlock;
 struct AllocatorNode;
@@ -13,8 +16,10 @@ struct AllocatorBlock
 {
     /// Size of a node.
     size_t nodeSize;
-    /// Number of nodes in this block.
+    /// Number of nodes in this block. In the first block, total number of nodes in the chain.
     size_t capacity;
+    /// Number of allocated nodes in the chain. Only updated in the first block.
+    size_t used;
     /// First free node.
     AllocatorNode* free;
     /// Next allocator block.
@@ -30,6 +35,31 @@ struct AllocatorNode
     /// Data follows.
 };
 
+/// %Allocator statistics.
+struct AllocatorStats
+{
+    /// Construct with zero values.
+    AllocatorStats() :
+        nodeSize(0),
+        capacity(0),
+        used(0),
+        numBlocks(0),
+        cached(0)
+    {
+    }
+
+    /// Size of a node.
+    size_t nodeSize;
+    /// Total number of nodes.
+    size_t capacity;
+    /// Number of allocated nodes. The rest are in the free list.
+    size_t used;
+    /// Number of memory blocks. More blocks means less contiguous allocation.
+    size_t numBlocks;
+    /// Number of free nodes held in per-thread caches and magazines. Always zero for single-threaded allocators.
+    size_t cached;
+};
+
 /// Initialize a fixed-size allocator with the node size and initial capacity.
 AllocatorBlock* AllocatorInitialize(size_t nodeSize, size_t initialCapacity = 1);
 /// Uninitialize a fixed-size allocator. Frees all blocks in the chain.
@@ -38,6 +68,10 @@ void AllocatorUninitialize(AllocatorBlock* allocator);
 void* AllocatorGet(AllocatorBlock* allocator);
 /// Free a node. Does not free any blocks.
 void AllocatorFree(AllocatorBlock* allocator, void* node);
+/// Free all nodes at once without destructing them. A chain of several blocks is replaced with one block of the total capacity. Return the new first block.
+AllocatorBlock* AllocatorFreeAll(AllocatorBlock* allocator);
+/// Return statistics of a fixed-size allocator.
+AllocatorStats AllocatorGetStats(const AllocatorBlock* allocator);
 
 /// %Allocator template class. Allocates objects of a specific class.
 template <class T> class Allocator
@@ -92,6 +126,14 @@ public:
         (object)->~T();
         AllocatorFree(allocator, object);
     }
+
+    /// Free all objects at once without destructing them. Only allowed for trivially destructible types.
+    void FreeAll()
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "FreeAll requires a trivially destructible type");
+        if (allocator)
+            allocator = AllocatorFreeAll(allocator);
+    }
     
     /// Free the allocator. All objects reserved from this allocator should be freed before this is called.
     void Reset()
@@ -99,6 +141,9 @@ public:
         AllocatorUninitialize(allocator);
         allocator = nullptr;
     }
+
+    /// Return statistics.
+    AllocatorStats Stats() const { return AllocatorGetStats(allocator); }
     
 private:
     /// Prevent copy construction.
@@ -109,3 +154,265 @@ private:
     /// Allocator block.
     AllocatorBlock* allocator;
 };
+
+/// Number of nodes in a magazine of a thread-safe allocator.
+static const size_t ALLOCATOR_MAGAZINE_SIZE = 64;
+
+/// Per-thread cache of a magazine allocator. Holds up to two magazines of free nodes.
+struct MagazineAllocatorThread
+{
+    /// Construct empty.
+    MagazineAllocatorThread() :
+        loaded(nullptr),
+        numLoaded(0),
+        previous(nullptr),
+        numPrevious(0)
+    {
+    }
+
+    /// Magazine being allocated from and freed to.
+    AllocatorNode* loaded;
+    /// Number of nodes in the loaded magazine.
+    size_t numLoaded;
+    /// Previous magazine, either full or empty, swapped with the loaded one before going to the shared list.
+    AllocatorNode* previous;
+    /// Number of nodes in the previous magazine.
+    size_t numPrevious;
+    /// Padding to keep the threads' state on separate cache lines.
+    unsigned char padding[64];
+};
+
+/// Thread-safe fixed-size allocator. Each thread allocates from and frees to its own cache without locking; only full magazines of ALLOCATOR_MAGAZINE_SIZE nodes are exchanged with the shared free list under a lock. Each thread index must be used by one thread at a time, but a node may be freed by a different thread than allocated it.
+class MagazineAllocator
+{
+public:
+    /// Construct with node size and initial capacity.
+    MagazineAllocator(size_t nodeSize, size_t initialCapacity = ALLOCATOR_MAGAZINE_SIZE);
+    /// Destruct. All nodes should be freed before this is called.
+    ~MagazineAllocator();
+
+    /// Set number of threads that allocate. Only call when no thread is allocating; the caches of removed threads are returned to the shared list.
+    void SetNumThreads(size_t num);
+    /// Allocate a node for a thread.
+    void* Allocate(unsigned threadIndex);
+    /// Free a node from a thread.
+    void Free(void* ptr, unsigned threadIndex);
+    /// Free all nodes at once without destructing them. Only call when no thread is allocating.
+    void FreeAll();
+
+    /// Return number of threads.
+    size_t NumThreads() const { return threads.size(); }
+    /// Return statistics. Exact only when no thread is allocating.
+    AllocatorStats Stats() const;
+
+private:
+    /// Prevent copy construction.
+    MagazineAllocator(const MagazineAllocator& rhs);
+    /// Prevent assignment.
+    MagazineAllocator& operator = (const MagazineAllocator& rhs);
+
+    /// Take a full magazine from the shared list, or carve new nodes if there is none. Return the first node.
+    AllocatorNode* GetMagazine();
+    /// Return a full magazine to the shared list.
+    void PutMagazine(AllocatorNode* magazine);
+
+    /// Per-thread caches.
+    std::vector<MagazineAllocatorThread> threads;
+    /// Full magazines returned by the threads.
+    std::vector<AllocatorNode*> magazines;
+    /// Block chain that new nodes are carved from.
+    AllocatorBlock* blocks;
+    /// Lock for the shared magazines and the block chain.
+    mutable std::mutex mutex;
+};
+
+/// Thread-safe allocator template class. Allocates objects of a specific class through a magazine allocator.
+template <class T> class ThreadSafeAllocator
+{
+public:
+    /// Construct with optional initial capacity.
+    ThreadSafeAllocator(size_t capacity = ALLOCATOR_MAGAZINE_SIZE) :
+        allocator(sizeof(T), capacity)
+    {
+    }
+
+    /// Set number of threads that allocate. Only call when no thread is allocating.
+    void SetNumThreads(size_t num) { allocator.SetNumThreads(num); }
+
+    /// Allocate and default-construct an object.
+    T* Allocate(unsigned threadIndex)
+    {
+        T* newObject = static_cast<T*>(allocator.Allocate(threadIndex));
+        new(newObject) T();
+
+        return newObject;
+    }
+
+    /// Allocate and copy-construct an object.
+    T* Allocate(const T& object, unsigned threadIndex)
+    {
+        T* newObject = static_cast<T*>(allocator.Allocate(threadIndex));
+        new(newObject) T(object);
+
+        return newObject;
+    }
+
+    /// Destruct and free an object.
+    void Free(T* object, unsigned threadIndex)
+    {
+        (object)->~T();
+        allocator.Free(object, threadIndex);
+    }
+
+    /// Free all objects at once without destructing them. Only allowed for trivially destructible types, and when no thread is allocating.
+    void FreeAll()
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "FreeAll requires a trivially destructible type");
+        allocator.FreeAll();
+    }
+
+    /// Return number of threads.
+    size_t NumThreads() const { return allocator.NumThreads(); }
+    /// Return statistics. Exact only when no thread is allocating.
+    AllocatorStats Stats() const { return allocator.Stats(); }
+
+private:
+    /// Untyped allocator.
+    MagazineAllocator allocator;
+};
+
+/// Granularity of the size classes in a pool allocator.
+static const size_t POOL_SIZE_GRANULARITY = 16;
+/// Largest size allocated from the pools of a pool allocator. Larger objects are allocated from the heap.
+static const size_t POOL_MAX_SIZE = 1024;
+
+/// %Pool allocator for objects of varying size, for example class-specific operator new of a class hierarchy. Each size class has its own fixed-size allocator, so that objects of the same class are allocated contiguously. Not thread-safe.
+class PoolAllocator
+{
+public:
+    /// Construct with initial capacity of each size class.
+    PoolAllocator(size_t initialCapacity);
+    /// Destruct. If objects are still allocated, the memory is left to the operating system.
+    ~PoolAllocator();
+
+    /// Allocate memory of a size.
+    void* Allocate(size_t size);
+    /// Free memory allocated with the same size.
+    void Free(void* ptr, size_t size);
+    /// Return statistics of the size classes in use.
+    void Stats(std::vector<AllocatorStats>& dest) const;
+
+private:
+    /// Prevent copy construction.
+    PoolAllocator(const PoolAllocator& rhs);
+    /// Prevent assignment.
+    PoolAllocator& operator = (const PoolAllocator& rhs);
+
+    /// Fixed-size allocators by size class, null if not used yet.
+    std::vector<AllocatorBlock*> allocators;
+    /// Initial capacity of each size class.
+    size_t initialCapacity;
+};
+
+/// Default chunk size of a frame allocator in bytes.
+static const size_t DEFAULT_FRAME_CHUNK_SIZE = 256 * 1024;
+/// Alignment of frame allocator allocations.
+static const size_t FRAME_ALLOCATION_ALIGNMENT = 16;
+
+/// Per-thread chunk state of a frame allocator.
+struct FrameAllocatorThread
+{
+    /// Construct empty.
+    FrameAllocatorThread() :
+        chunk(nullptr),
+        chunkSize(0),
+        offset(0),
+        used(0)
+    {
+    }
+
+    /// Chunk being allocated from.
+    unsigned char* chunk;
+    /// Size of the current chunk.
+    size_t chunkSize;
+    /// Allocation offset in the current chunk.
+    size_t offset;
+    /// Bytes allocated since the last reset, including the full chunks.
+    size_t used;
+    /// Full chunks, freed on the next reset.
+    std::vector<unsigned char*> fullChunks;
+    /// Padding to keep the threads' state on separate cache lines.
+    unsigned char padding[64];
+};
+
+/// Linear allocator for data that lives until the end of a frame. Each thread allocates from its own chunks, so no locking is needed as long as each thread index is used by one thread at a time. Reset() frees all allocations at once.
+class FrameAllocator
+{
+public:
+    /// Construct with the initial chunk size of each thread.
+    FrameAllocator(size_t chunkSize = DEFAULT_FRAME_CHUNK_SIZE);
+    /// Destruct. Free all chunks.
+    ~FrameAllocator();
+
+    /// Set number of threads that allocate. Only call between frames.
+    void SetNumThreads(size_t num);
+    /// Allocate memory for a thread. Returned memory is aligned to FRAME_ALLOCATION_ALIGNMENT.
+    void* Allocate(size_t size, unsigned threadIndex);
+    /// Free all allocations. A thread that needed more than one chunk gets one chunk large enough for the whole frame, so that a steady state frame allocates nothing from the heap.
+    void Reset();
+
+    /// Return number of threads.
+    size_t NumThreads() const { return threads.size(); }
+    /// Return total size of the chunks in bytes.
+    size_t Capacity() const;
+
+private:
+    /// Prevent copy construction.
+    FrameAllocator(const FrameAllocator& rhs);
+    /// Prevent assignment.
+    FrameAllocator& operator = (const FrameAllocator& rhs);
+
+    /// Per-thread chunks.
+    std::vector<FrameAllocatorThread> threads;
+    /// Initial chunk size.
+    size_t chunkSize;
+};
+
+/// STL-compatible allocator adapter for allocating container storage from a frame allocator on a specific thread. Deallocation does nothing, so the containers must be destroyed or discarded before the frame allocator is reset.
+template <class T> class FrameStdAllocator
+{
+public:
+    typedef T value_type;
+
+    /// Construct with frame allocator and thread index.
+    FrameStdAllocator(FrameAllocator* allocator_, unsigned threadIndex_) :
+        allocator(allocator_),
+        threadIndex(threadIndex_)
+    {
+    }
+
+    /// Construct from an adapter of another type.
+    template <class U> FrameStdAllocator(const FrameStdAllocator<U>& rhs) :
+        allocator(rhs.allocator),
+        threadIndex(rhs.threadIndex)
+    {
+    }
+
+    /// Allocate storage for elements.
+    T* allocate(size_t num) { return static_cast<T*>(allocator->Allocate(num * sizeof(T), threadIndex)); }
+    /// Free storage. Does nothing, as the frame allocator frees everything at once.
+    void deallocate(T*, size_t) {}
+
+    /// Test for equality with another adapter.
+    template <class U> bool operator == (const FrameStdAllocator<U>& rhs) const { return allocator == rhs.allocator && threadIndex == rhs.threadIndex; }
+    /// Test for inequality with another adapter.
+    template <class U> bool operator != (const FrameStdAllocator<U>& rhs) const { return !(*this == rhs); }
+
+    /// Frame allocator.
+    FrameAllocator* allocator;
+    /// Thread index.
+    unsigned threadIndex;
+};
+
+/// Return the number of heap allocations made through operator new by all threads since the program start. Always zero unless compiled with TURSO3D_TRACK_HEAP_ALLOCATIONS.
+size_t HeapAllocationCount();
@@ -1,6 +1,7 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
-#include "../IO/JSONValue.h"
+#include "../IO/JSONReader.h"
+#include "../IO/JSONWriter.h"
 #include "../IO/ObjectRef.h"
 #include "../IO/ResourceRef.h"
 #include "../IO/StringUtils.h"
@@ -11,6 +12,9 @@
 #include "../Math/Matrix3x4.h"
 #include "Attribute.h"
 
+#include <algorithm>
+#include <cstring>
+
 const std::string Attribute::typeNames[] =
 {
     "bool",
@@ -75,6 +79,9 @@ AttributeAccessor::~AttributeAccessor()
 
 Attribute::Attribute(const char* name_, AttributeAccessor* accessor_, const char** enumNames_) :
     name(name_),
+    nameHash(StringHash::Register(name_)),
+    offset(ATTR_NO_OFFSET),
+    offsetSize(0),
     accessor(accessor_),
     enumNames(enumNames_)
 {
@@ -82,12 +89,27 @@ Attribute::Attribute(const char* name_, AttributeAccessor* accessor_, const char
 
 void Attribute::FromValue(Serializable* instance, const void* source)
 {
-    accessor->Set(instance, source);
+    if (offset != ATTR_NO_OFFSET)
+        memcpy(reinterpret_cast<unsigned char*>(instance) + offset, source, offsetSize);
+    else
+        accessor->Set(instance, source);
 }
 
 void Attribute::ToValue(Serializable* instance, void* dest)
 {
-    accessor->Get(instance, dest);
+    if (offset != ATTR_NO_OFFSET)
+        memcpy(dest, reinterpret_cast<const unsigned char*>(instance) + offset, offsetSize);
+    else
+        accessor->Get(instance, dest);
+}
+
+void Attribute::SetOffset(size_t offset_)
+{
+    // Variable-size types must be assigned through the accessor
+    assert(offset_ == ATTR_NO_OFFSET || ByteSize());
+
+    offset = ByteSize() ? offset_ : ATTR_NO_OFFSET;
+    offsetSize = offset != ATTR_NO_OFFSET ? ByteSize() : 0;
 }
 
 void Attribute::Skip(AttributeType type, Stream& source)
@@ -240,6 +262,111 @@ void Attribute::FromJSON(AttributeType type, void* dest, const JSONValue& source
     }
 }
 
+void Attribute::FromJSON(AttributeType type, void* dest, JSONReader& source)
+{
+    switch (type)
+    {
+    case ATTR_BOOL:
+        *(reinterpret_cast<bool*>(dest)) = source.ReadBool();
+        break;
+
+    case ATTR_BYTE:
+        *(reinterpret_cast<unsigned char*>(dest)) = (unsigned char)source.ReadNumber();
+        break;
+
+    case ATTR_UNSIGNED:
+        *(reinterpret_cast<unsigned*>(dest)) = (unsigned)source.ReadNumber();
+        break;
+
+    case ATTR_INT:
+        *(reinterpret_cast<int*>(dest)) = (int)source.ReadNumber();
+        break;
+
+    case ATTR_INTVECTOR2:
+        reinterpret_cast<IntVector2*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_INTVECTOR3:
+        reinterpret_cast<IntVector3*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_INTRECT:
+        reinterpret_cast<IntRect*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_INTBOX:
+        reinterpret_cast<IntBox*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_FLOAT:
+        *(reinterpret_cast<float*>(dest)) = (float)source.ReadNumber();
+        break;
+
+    case ATTR_VECTOR2:
+        reinterpret_cast<Vector2*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_VECTOR3:
+        reinterpret_cast<Vector3*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_VECTOR4:
+        reinterpret_cast<Vector4*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_QUATERNION:
+        reinterpret_cast<Quaternion*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_COLOR:
+        reinterpret_cast<Color*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_RECT:
+        reinterpret_cast<Rect*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_BOUNDINGBOX:
+        reinterpret_cast<BoundingBox*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_MATRIX3:
+        reinterpret_cast<Matrix3*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_MATRIX3X4:
+        reinterpret_cast<Matrix3x4*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_MATRIX4:
+        reinterpret_cast<Matrix4*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_STRING:
+        *(reinterpret_cast<std::string*>(dest)) = source.ReadString();
+        break;
+
+    case ATTR_RESOURCEREF:
+        reinterpret_cast<ResourceRef*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_RESOURCEREFLIST:
+        reinterpret_cast<ResourceRefList*>(dest)->FromString(source.ReadString());
+        break;
+
+    case ATTR_OBJECTREF:
+        reinterpret_cast<ObjectRef*>(dest)->id = (unsigned)source.ReadNumber();
+        break;
+
+    case ATTR_JSONVALUE:
+        source.ReadValue(*(reinterpret_cast<JSONValue*>(dest)));
+        break;
+
+    default:
+        break;
+    }
+}
+
 void Attribute::ToJSON(AttributeType type, JSONValue& dest, const void* source)
 {
     switch (type)
@@ -345,6 +472,112 @@ void Attribute::ToJSON(AttributeType type, JSONValue& dest, const void* source)
     }
 }
 
+void Attribute::ToJSON(AttributeType type, JSONWriter& dest, const void* source)
+{
+    switch (type)
+    {
+    case ATTR_BOOL:
+        dest.WriteBool(*(reinterpret_cast<const bool*>(source)));
+        break;
+
+    case ATTR_BYTE:
+        dest.WriteUInt(*(reinterpret_cast<const unsigned char*>(source)));
+        break;
+
+    case ATTR_UNSIGNED:
+        dest.WriteUInt(*(reinterpret_cast<const unsigned*>(source)));
+        break;
+
+    case ATTR_INT:
+        dest.WriteInt(*(reinterpret_cast<const int*>(source)));
+        break;
+
+    case ATTR_INTVECTOR2:
+        dest.WriteString(reinterpret_cast<const IntVector2*>(source)->ToString());
+        break;
+
+    case ATTR_INTVECTOR3:
+        dest.WriteString(reinterpret_cast<const IntVector3*>(source)->ToString());
+        break;
+
+    case ATTR_INTRECT:
+        dest.WriteString(reinterpret_cast<const IntRect*>(source)->ToString());
+        break;
+
+    case ATTR_INTBOX:
+        dest.WriteString(reinterpret_cast<const IntBox*>(source)->ToString());
+        break;
+
+    case ATTR_FLOAT:
+        dest.WriteFloat(*(reinterpret_cast<const float*>(source)));
+        break;
+
+    case ATTR_VECTOR2:
+        dest.WriteFloats(reinterpret_cast<const Vector2*>(source)->Data(), 2);
+        break;
+
+    case ATTR_VECTOR3:
+        dest.WriteFloats(reinterpret_cast<const Vector3*>(source)->Data(), 3);
+        break;
+
+    case ATTR_VECTOR4:
+        dest.WriteFloats(reinterpret_cast<const Vector4*>(source)->Data(), 4);
+        break;
+
+    case ATTR_QUATERNION:
+        dest.WriteFloats(reinterpret_cast<const Quaternion*>(source)->Data(), 4);
+        break;
+
+    case ATTR_COLOR:
+        dest.WriteFloats(reinterpret_cast<const Color*>(source)->Data(), 4);
+        break;
+
+    case ATTR_RECT:
+        dest.WriteString(reinterpret_cast<const Rect*>(source)->ToString());
+        break;
+
+    case ATTR_BOUNDINGBOX:
+        dest.WriteString(reinterpret_cast<const BoundingBox*>(source)->ToString());
+        break;
+
+    case ATTR_MATRIX3:
+        dest.WriteFloats(reinterpret_cast<const Matrix3*>(source)->Data(), 9);
+        break;
+
+    case ATTR_MATRIX3X4:
+        dest.WriteFloats(reinterpret_cast<const Matrix3x4*>(source)->Data(), 12);
+        break;
+
+    case ATTR_MATRIX4:
+        dest.WriteFloats(reinterpret_cast<const Matrix4*>(source)->Data(), 16);
+        break;
+
+    case ATTR_STRING:
+        dest.WriteString(*(reinterpret_cast<const std::string*>(source)));
+        break;
+
+    case ATTR_RESOURCEREF:
+        dest.WriteString(reinterpret_cast<const ResourceRef*>(source)->ToString());
+        break;
+
+    case ATTR_RESOURCEREFLIST:
+        dest.WriteString(reinterpret_cast<const ResourceRefList*>(source)->ToString());
+        break;
+
+    case ATTR_OBJECTREF:
+        dest.WriteUInt(reinterpret_cast<const ObjectRef*>(source)->id);
+        break;
+
+    case ATTR_JSONVALUE:
+        dest.WriteValue(*(reinterpret_cast<const JSONValue*>(source)));
+        break;
+
+    default:
+        dest.WriteNull();
+        break;
+    }
+}
+
 AttributeType Attribute::TypeFromName(const std::string& name)
 {
     return (AttributeType)ListIndex(name, &typeNames[0], MAX_ATTR_TYPES);
@@ -454,3 +687,45 @@ template<> AttributeType AttributeImpl<JSONValue>::Type() const
 {
     return ATTR_JSONVALUE;
 }
+
+static bool CompareAttributeEntries(const AttributeTableEntry& lhs, const AttributeTableEntry& rhs)
+{
+    return lhs.nameHash < rhs.nameHash;
+}
+
+void AttributeTable::Compile()
+{
+    entries.resize(attributes.size());
+    for (size_t i = 0; i < attributes.size(); ++i)
+    {
+        Attribute* attr = attributes[i];
+        AttributeTableEntry& entry = entries[i];
+        entry.nameHash = attr->NameHash();
+        entry.type = attr->Type();
+        entry.offset = attr->Offset();
+        entry.attribute = attr;
+    }
+
+    lookup = entries;
+    std::stable_sort(lookup.begin(), lookup.end(), CompareAttributeEntries);
+}
+
+const AttributeTableEntry* AttributeTable::Find(const char* name) const
+{
+    return Find(StringHash(name), name);
+}
+
+const AttributeTableEntry* AttributeTable::Find(StringHash nameHash, const char* name) const
+{
+    AttributeTableEntry key;
+    key.nameHash = nameHash;
+
+    // The hash is case-insensitive, so check the exact name among the matches
+    for (auto it = std::lower_bound(lookup.begin(), lookup.end(), key, CompareAttributeEntries); it != lookup.end() && it->nameHash == nameHash; ++it)
+    {
+        if (it->attribute->Name() == name)
+            return &(*it);
+    }
+
+    return nullptr;
+}
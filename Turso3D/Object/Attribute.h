@@ -5,7 +5,10 @@
 #include "AutoPtr.h"
 #include "Ptr.h"
 #include "../IO/Stream.h"
+#include "../IO/StringHash.h"
 
+class JSONReader;
+class JSONWriter;
 class JSONValue;
 class Serializable;
 class Stream;
@@ -40,6 +43,9 @@ enum AttributeType
     MAX_ATTR_TYPES
 };
 
+/// Offset value of an attribute that is accessed only through its accessor.
+static const size_t ATTR_NO_OFFSET = (size_t)-1;
+
 /// Helper class for accessing serializable variables via getter and setter functions.
 class AttributeAccessor
 {
@@ -66,8 +72,12 @@ public:
     virtual void ToBinary(Serializable* instance, Stream& dest) = 0;
     /// Deserialize from JSON.
     virtual void FromJSON(Serializable* instance, const JSONValue& source) = 0;
+    /// Deserialize from a streaming JSON reader positioned at the value.
+    virtual void FromJSON(Serializable* instance, JSONReader& source) = 0;
     /// Serialize to JSON.
     virtual void ToJSON(Serializable* instance, JSONValue& dest) = 0;
+    /// Serialize to a streaming JSON writer.
+    virtual void ToJSON(Serializable* instance, JSONWriter& dest) = 0;
     /// Return type.
     virtual AttributeType Type() const = 0;
     /// Return whether is default value.
@@ -77,9 +87,15 @@ public:
     void FromValue(Serializable* instance, const void* source);
     /// Copy to a value in memory.
     void ToValue(Serializable* instance, void* dest);
+    /// Set byte offset of the variable from the start of the instance's Serializable base, allowing direct access without the accessor. Only for fixed-size variables without setter side effects.
+    void SetOffset(size_t offset);
     
     /// Return variable name.
     const std::string& Name() const { return name; }
+    /// Return hash of the variable name.
+    StringHash NameHash() const { return nameHash; }
+    /// Return byte offset for direct access, or ATTR_NO_OFFSET if accessed through the accessor.
+    size_t Offset() const { return offset; }
     /// Return zero-based enum names, or null if none.
     const char** EnumNames() const { return enumNames; }
     /// Return type name.
@@ -91,8 +107,12 @@ public:
     static void Skip(AttributeType type, Stream& source);
     /// Serialize attribute value to JSON.
     static void ToJSON(AttributeType type, JSONValue& dest, const void* source);
+    /// Serialize attribute value to a streaming JSON writer.
+    static void ToJSON(AttributeType type, JSONWriter& dest, const void* source);
     /// Deserialize attribute value from JSON.
     static void FromJSON(AttributeType type, void* dest, const JSONValue& source);
+    /// Deserialize attribute value from a streaming JSON reader.
+    static void FromJSON(AttributeType type, void* dest, JSONReader& source);
     /// Return attribute type from type name.
     static AttributeType TypeFromName(const std::string& name);
     /// Return attribute type from type name.
@@ -106,6 +126,12 @@ public:
 protected:
     /// Variable name.
     std::string name;
+    /// Variable name hash.
+    StringHash nameHash;
+    /// Byte offset for direct access, or ATTR_NO_OFFSET.
+    size_t offset;
+    /// Byte size for direct access.
+    size_t offsetSize;
     /// Attribute accessor.
     AutoPtr<AttributeAccessor> accessor;
     /// Enum names.
@@ -118,6 +144,37 @@ private:
     Attribute& operator = (const Attribute& rhs);
 };
 
+/// Compiled attribute entry for lookup by name hash and direct access.
+struct AttributeTableEntry
+{
+    /// Name hash.
+    StringHash nameHash;
+    /// Attribute type.
+    AttributeType type;
+    /// Byte offset for direct access, or ATTR_NO_OFFSET.
+    size_t offset;
+    /// Attribute description.
+    Attribute* attribute;
+};
+
+/// Per-class attribute descriptions in registration order and a compiled lookup table sorted by name hash.
+struct AttributeTable
+{
+    /// Rebuild the lookup table after the attributes have changed.
+    void Compile();
+    /// Return the entry of an attribute by name, or null if does not exist.
+    const AttributeTableEntry* Find(const char* name) const;
+    /// Return the entry of an attribute by name and precalculated name hash, or null if does not exist.
+    const AttributeTableEntry* Find(StringHash nameHash, const char* name) const;
+
+    /// Attributes in registration order.
+    std::vector<SharedPtr<Attribute> > attributes;
+    /// Entries index-aligned with the attributes.
+    std::vector<AttributeTableEntry> entries;
+    /// Entries sorted by name hash.
+    std::vector<AttributeTableEntry> lookup;
+};
+
 /// Template implementation of an attribute description with specific type.
 template <class T> class AttributeImpl : public Attribute
 {
@@ -155,6 +212,14 @@ public:
         accessor->Set(instance, &value);
     }
 
+    /// Deserialize from a streaming JSON reader.
+    void FromJSON(Serializable* instance, JSONReader& source) override
+    {
+        T value;
+        Attribute::FromJSON(Type(), &value, source);
+        accessor->Set(instance, &value);
+    }
+
     /// Serialize to JSON.
     void ToJSON(Serializable* instance, JSONValue& dest) override
     {
@@ -163,6 +228,14 @@ public:
         Attribute::ToJSON(Type(), dest, &value);
     }
 
+    /// Serialize to a streaming JSON writer.
+    void ToJSON(Serializable* instance, JSONWriter& dest) override
+    {
+        T value;
+        accessor->Get(instance, &value);
+        Attribute::ToJSON(Type(), dest, &value);
+    }
+
     /// Return type.
     AttributeType Type() const override;
     
@@ -316,3 +389,40 @@ private:
     SetFunctionPtr set;
 };
 
+/// Template implementation for accessing serializable variables directly as members.
+template <class T, class U> class MemberAttributeAccessorImpl : public AttributeAccessor
+{
+public:
+    typedef U T::*MemberPtr;
+
+    /// Construct with member pointer.
+    MemberAttributeAccessorImpl(MemberPtr memberPtr) :
+        member(memberPtr)
+    {
+        assert(member);
+    }
+
+    /// Get current value of the variable.
+    void Get(const Serializable* instance, void* dest) override
+    {
+        assert(instance);
+
+        U& value = *(reinterpret_cast<U*>(dest));
+        const T* classPtr = static_cast<const T*>(instance);
+        value = classPtr->*member;
+    }
+
+    /// Set new value for the variable.
+    void Set(Serializable* instance, const void* source) override
+    {
+        assert(instance);
+
+        const U& value = *(reinterpret_cast<const U*>(source));
+        T* classPtr = static_cast<T*>(instance);
+        classPtr->*member = value;
+    }
+
+private:
+    /// Member pointer.
+    MemberPtr member;
+};
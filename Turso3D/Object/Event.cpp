@@ -17,11 +17,20 @@ Event::Event()
 {
 }
 
+Event::Event(const Event&)
+{
+}
+
 Event::~Event()
 {
 }
 
 void Event::Send(RefCounted* sender)
+{
+    Send(sender, *this);
+}
+
+void Event::Send(RefCounted* sender, Event& data)
 {
     if (!Thread::IsMainThread())
     {
@@ -33,6 +42,7 @@ void Event::Send(RefCounted* sender)
     // as a result of event handling, in which case the current event may also be destroyed
     WeakPtr<RefCounted> safeCurrentSender = sender;
     currentSender = sender;
+    data.currentSender = sender;
     
     for (auto it = handlers.begin(); it != handlers.end();)
     {
@@ -45,7 +55,7 @@ void Event::Send(RefCounted* sender)
             if (receiver)
             {
                 remove = false;
-                handler->Invoke(*this);
+                handler->Invoke(data);
                 // If the sender has been destroyed, abort processing immediately
                 if (safeCurrentSender.IsExpired())
                     return;
@@ -59,6 +69,7 @@ void Event::Send(RefCounted* sender)
     }
     
     currentSender.Reset();
+    data.currentSender.Reset();
 }
 
 void Event::Subscribe(EventHandler* handler)
@@ -67,6 +67,8 @@ public:
     
     /// Send the event.
     void Send(RefCounted* sender);
+    /// Send the event with the data of another instance of the same event class. Used for deferred events.
+    void Send(RefCounted* sender, Event& data);
     /// Subscribe to the event. The event takes ownership of the handler data. If there is already handler data for the same receiver, it is overwritten.
     void Subscribe(EventHandler* handler);
     /// Unsubscribe from the event.
@@ -78,10 +80,12 @@ public:
     bool HasReceiver(const RefCounted* receiver) const;
     /// Return current sender.
     RefCounted* Sender() const { return currentSender; }
+
+protected:
+    /// Copy-construct. Copies only the subclass data and not the subscriptions, for deferred sending.
+    Event(const Event& rhs);
     
 private:
-    /// Prevent copy construction.
-    Event(const Event& rhs);
     /// Prevent assignment.
     Event& operator = (const Event& rhs);
     
@@ -0,0 +1,128 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Thread/Thread.h"
+#include "../Time/Profiler.h"
+#include "EventQueue.h"
+
+#include <thread>
+
+EventQueue::EventQueue(size_t arenaSize) :
+    activeArena(0),
+    numDispatched(0)
+{
+    RegisterSubsystem(this);
+
+    for (size_t i = 0; i < 2; ++i)
+        arenas[i].data.resize(arenaSize);
+}
+
+EventQueue::~EventQueue()
+{
+    for (size_t i = 0; i < 2; ++i)
+        ProcessArena(arenas[i], false);
+
+    RemoveSubsystem(this);
+}
+
+void EventQueue::DispatchEvents()
+{
+    PROFILE(DispatchEvents);
+
+    assert(Thread::IsMainThread());
+
+    // Switch the arena, then wait for the posts already in progress to finish. They take only a few instructions
+    unsigned index = activeArena.load();
+    activeArena.store(1 - index);
+    EventArena& arena = arenas[index];
+    while (arena.writers.load() > 0)
+        std::this_thread::yield();
+
+    ProcessArena(arena, true);
+}
+
+EventArena* EventQueue::BeginPost()
+{
+    // If the arena was switched in between, leave it and retry, so that the dispatch does not miss the post
+    for (;;)
+    {
+        unsigned index = activeArena.load();
+        EventArena* arena = &arenas[index];
+        arena->writers.fetch_add(1);
+        if (activeArena.load() == index)
+            return arena;
+        arena->writers.fetch_sub(1);
+    }
+}
+
+unsigned char* EventQueue::Allocate(EventArena* arena, size_t size, bool& heapAllocated)
+{
+    size = (size + EVENT_ARENA_ALIGNMENT - 1) & ~(EVENT_ARENA_ALIGNMENT - 1);
+    size_t offset = arena->used.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size <= arena->data.size())
+    {
+        heapAllocated = false;
+        return &arena->data[offset];
+    }
+
+    arena->overflow.fetch_add(size, std::memory_order_relaxed);
+    heapAllocated = true;
+    return new unsigned char[size];
+}
+
+void EventQueue::EndPost(EventArena* arena, DeferredEvent* entry)
+{
+    DeferredEvent* oldHead = arena->head.load(std::memory_order_relaxed);
+    do
+        entry->next = oldHead;
+    while (!arena->head.compare_exchange_weak(oldHead, entry, std::memory_order_release, std::memory_order_relaxed));
+
+    arena->writers.fetch_sub(1, std::memory_order_release);
+}
+
+void EventQueue::ProcessArena(EventArena& arena, bool send)
+{
+    // Reverse the queue to the order posted
+    DeferredEvent* entry = arena.head.exchange(nullptr, std::memory_order_acquire);
+    DeferredEvent* first = nullptr;
+    while (entry)
+    {
+        DeferredEvent* next = entry->next;
+        entry->next = first;
+        first = entry;
+        entry = next;
+    }
+
+    if (send)
+        numDispatched = 0;
+
+    for (entry = first; entry;)
+    {
+        DeferredEvent* next = entry->next;
+
+        if (send)
+        {
+            RefCounted* sender = entry->sender.Get();
+            if (sender)
+            {
+                entry->event->Send(sender, *entry->data);
+                ++numDispatched;
+            }
+        }
+
+        bool heapAllocated = entry->heapAllocated;
+        entry->data->~Event();
+        entry->~DeferredEvent();
+        if (heapAllocated)
+            delete[] reinterpret_cast<unsigned char*>(entry);
+
+        entry = next;
+    }
+
+    // Grow the storage if the frame did not fit, now that no thread is posting to this arena
+    size_t overflow = arena.overflow.load(std::memory_order_relaxed);
+    if (overflow)
+        arena.data.resize(arena.data.size() + overflow);
+
+    arena.used.store(0, std::memory_order_relaxed);
+    arena.overflow.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,106 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Object.h"
+
+#include <atomic>
+#include <new>
+#include <vector>
+
+/// Default size of each deferred event arena in bytes.
+static const size_t DEFAULT_EVENT_ARENA_SIZE = 64 * 1024;
+/// Alignment of the deferred event entries and data copies.
+static const size_t EVENT_ARENA_ALIGNMENT = 16;
+
+/// Deferred event entry, followed by the copy of the event data.
+struct DeferredEvent
+{
+    /// Next entry. Links to the previously posted entry until the queue is reversed for dispatch.
+    DeferredEvent* next;
+    /// %Event to send.
+    Event* event;
+    /// Copy of the event data.
+    Event* data;
+    /// Sender. The event is dropped if the sender has been destroyed, as the event is assumed to be its member.
+    WeakPtr<RefCounted> sender;
+    /// Whether was allocated from the heap because the arena was full.
+    bool heapAllocated;
+};
+
+/// Storage and queue of deferred events for one frame. Two arenas alternate, so that posting continues while the other is dispatched.
+struct EventArena
+{
+    /// Construct.
+    EventArena() :
+        used(0),
+        overflow(0),
+        head(nullptr),
+        writers(0)
+    {
+    }
+
+    /// Storage for the entries.
+    std::vector<unsigned char> data;
+    /// Bytes allocated so far. May exceed the storage size, in which case the entries are allocated from the heap.
+    std::atomic<size_t> used;
+    /// Bytes that did not fit, used to grow the storage on the next dispatch.
+    std::atomic<size_t> overflow;
+    /// Most recently posted entry.
+    std::atomic<DeferredEvent*> head;
+    /// Number of threads posting to the arena.
+    std::atomic<int> writers;
+};
+
+/// %Event queue subsystem for deferred sending. Any thread can post events without locking; the data is copied to a frame arena and the main thread sends the events in the order posted when it calls DispatchEvents().
+class EventQueue : public Object
+{
+    OBJECT(EventQueue);
+
+public:
+    /// Construct with arena size in bytes and register subsystem.
+    EventQueue(size_t arenaSize = DEFAULT_EVENT_ARENA_SIZE);
+    /// Destruct. Discard the events not yet dispatched and unregister subsystem.
+    ~EventQueue();
+
+    /// Post an event for sending on the next dispatch, with a copy of the data from another instance of the same event class. Safe to call from any thread. The event must be a member of the sender, or otherwise remain alive as long as the sender.
+    template <class T> void Post(T& event, RefCounted* sender, const T& data)
+    {
+        EventArena* arena = BeginPost();
+        size_t headerSize = (sizeof(DeferredEvent) + EVENT_ARENA_ALIGNMENT - 1) & ~(EVENT_ARENA_ALIGNMENT - 1);
+        bool heapAllocated;
+        unsigned char* storage = Allocate(arena, headerSize + sizeof(T), heapAllocated);
+
+        DeferredEvent* entry = new(storage) DeferredEvent();
+        entry->event = &event;
+        entry->data = new(storage + headerSize) T(data);
+        entry->sender = sender;
+        entry->heapAllocated = heapAllocated;
+        EndPost(arena, entry);
+    }
+
+    /// Send the events posted so far. Events posted by the handlers are sent on the next dispatch. Call from the main thread once per frame.
+    void DispatchEvents();
+
+    /// Return the arena size in bytes. Grows if a frame posts more than fits.
+    size_t ArenaSize() const { return arenas[activeArena.load(std::memory_order_relaxed)].data.size(); }
+    /// Return number of events sent on the last dispatch.
+    size_t NumDispatched() const { return numDispatched; }
+
+private:
+    /// Enter the active arena for posting.
+    EventArena* BeginPost();
+    /// Allocate storage for an entry from an arena, or from the heap if full.
+    unsigned char* Allocate(EventArena* arena, size_t size, bool& heapAllocated);
+    /// Link an entry to the arena's queue and leave the arena.
+    void EndPost(EventArena* arena, DeferredEvent* entry);
+    /// Send or discard the queued events of an inactive arena, free the entries and reset it.
+    void ProcessArena(EventArena& arena, bool send);
+
+    /// Alternating arenas.
+    EventArena arenas[2];
+    /// Index of the arena being posted to.
+    std::atomic<unsigned> activeArena;
+    /// Number of events sent on the last dispatch.
+    size_t numDispatched;
+};
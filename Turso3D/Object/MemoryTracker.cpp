@@ -0,0 +1,308 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Allocator.h"
+#include "MemoryTracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <Windows.h>
+#define TURSO3D_STACK_SAMPLING
+#elif defined(__GLIBC__)
+#include <execinfo.h>
+#define TURSO3D_STACK_SAMPLING
+#endif
+
+/// Counters of a memory category.
+struct MemoryCounters
+{
+    /// Bytes currently allocated.
+    std::atomic<size_t> current;
+    /// Highest number of bytes allocated at once.
+    std::atomic<size_t> peak;
+    /// Allocations since the program start.
+    std::atomic<size_t> allocations;
+    /// Allocations during the current frame.
+    std::atomic<size_t> frameAllocations;
+    /// Bytes allocated during the current frame.
+    std::atomic<size_t> frameBytes;
+    /// Allocations during the last ended frame.
+    std::atomic<size_t> lastFrameAllocations;
+    /// Bytes allocated during the last ended frame.
+    std::atomic<size_t> lastFrameBytes;
+};
+
+static const char* categoryNames[] =
+{
+    "General",
+    "Scene",
+    "Renderer",
+    "Resource/Model",
+    "Resource/Image",
+    "GPU/Texture",
+    "GPU/Buffer"
+};
+
+// Zero-initialized before any constructor runs, so that allocations during static initialization can be counted
+static MemoryCounters counters[MAX_MEMORY_CATEGORIES];
+static thread_local unsigned char currentCategory = MEMORY_GENERAL;
+// Set while the tracker itself allocates, so that sampling does not recurse
+static thread_local bool inTracker = false;
+
+static std::atomic<unsigned> sampleInterval(0);
+static std::atomic<size_t> sampleCounter(0);
+static std::mutex samplesMutex;
+static AllocationSample samples[MAX_ALLOCATION_SAMPLES];
+static size_t numSamples = 0;
+static size_t nextSample = 0;
+
+#ifdef TURSO3D_TRACK_HEAP_ALLOCATIONS
+/// Size of the header stored before each heap allocation. Keeps the 16-byte alignment of the returned memory.
+static const size_t HEAP_HEADER_SIZE = 16;
+
+/// Header of a heap allocation, so that a free is accounted to the category and size it was allocated with.
+struct HeapHeader
+{
+    /// Allocation size requested.
+    size_t size;
+    /// Category.
+    unsigned category;
+};
+
+static_assert(sizeof(HeapHeader) <= HEAP_HEADER_SIZE, "Heap header does not fit");
+
+static std::atomic<size_t> heapAllocations(0);
+
+static void SampleAllocation(size_t size, MemoryCategory category)
+{
+#ifdef TURSO3D_STACK_SAMPLING
+    AllocationSample sample;
+    inTracker = true;
+#ifdef _WIN32
+    sample.numFrames = CaptureStackBackTrace(2, (DWORD)MAX_SAMPLE_STACK_FRAMES, sample.frames, nullptr);
+#else
+    int numFrames = backtrace(sample.frames, (int)MAX_SAMPLE_STACK_FRAMES);
+    sample.numFrames = numFrames > 0 ? (size_t)numFrames : 0;
+#endif
+    inTracker = false;
+    sample.size = size;
+    sample.category = category;
+
+    std::lock_guard<std::mutex> lock(samplesMutex);
+    samples[nextSample] = sample;
+    nextSample = (nextSample + 1) % MAX_ALLOCATION_SAMPLES;
+    if (numSamples < MAX_ALLOCATION_SAMPLES)
+        ++numSamples;
+#else
+    (void)size;
+    (void)category;
+#endif
+}
+
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    unsigned char* ptr = static_cast<unsigned char*>(malloc(size + HEAP_HEADER_SIZE));
+    if (!ptr)
+        throw std::bad_alloc();
+
+    MemoryCategory category = (MemoryCategory)currentCategory;
+    HeapHeader* header = reinterpret_cast<HeapHeader*>(ptr);
+    header->size = size;
+    header->category = category;
+    MemoryTrackAllocation(category, size);
+
+    unsigned interval = sampleInterval.load(std::memory_order_relaxed);
+    if (interval && !inTracker && sampleCounter.fetch_add(1, std::memory_order_relaxed) % interval == 0)
+        SampleAllocation(size, category);
+
+    return ptr + HEAP_HEADER_SIZE;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (!ptr)
+        return;
+
+    unsigned char* block = static_cast<unsigned char*>(ptr) - HEAP_HEADER_SIZE;
+    const HeapHeader* header = reinterpret_cast<const HeapHeader*>(block);
+    MemoryTrackFree((MemoryCategory)header->category, header->size);
+    free(block);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+#endif
+
+void MemoryTrackAllocation(MemoryCategory category, size_t size)
+{
+    MemoryCounters& counter = counters[category];
+    size_t current = counter.current.fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = counter.peak.load(std::memory_order_relaxed);
+    while (current > peak && !counter.peak.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        ;
+
+    counter.allocations.fetch_add(1, std::memory_order_relaxed);
+    counter.frameAllocations.fetch_add(1, std::memory_order_relaxed);
+    counter.frameBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void MemoryTrackFree(MemoryCategory category, size_t size)
+{
+    counters[category].current.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void MemoryEndFrame()
+{
+    for (size_t i = 0; i < MAX_MEMORY_CATEGORIES; ++i)
+    {
+        MemoryCounters& counter = counters[i];
+        counter.lastFrameAllocations.store(counter.frameAllocations.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+        counter.lastFrameBytes.store(counter.frameBytes.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+MemoryCategoryStats MemoryGetStats(MemoryCategory category)
+{
+    const MemoryCounters& counter = counters[category];
+    MemoryCategoryStats stats;
+    stats.current = counter.current.load(std::memory_order_relaxed);
+    stats.peak = counter.peak.load(std::memory_order_relaxed);
+    stats.allocations = counter.allocations.load(std::memory_order_relaxed);
+    stats.frameAllocations = counter.lastFrameAllocations.load(std::memory_order_relaxed);
+    stats.frameBytes = counter.lastFrameBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+const char* MemoryCategoryName(MemoryCategory category)
+{
+    return category < MAX_MEMORY_CATEGORIES ? categoryNames[category] : "";
+}
+
+MemoryCategory MemoryCurrentCategory()
+{
+    return (MemoryCategory)currentCategory;
+}
+
+MemoryCategory MemorySetCurrentCategory(MemoryCategory category)
+{
+    MemoryCategory previous = (MemoryCategory)currentCategory;
+    currentCategory = (unsigned char)category;
+    return previous;
+}
+
+void MemorySetSampleInterval(unsigned interval)
+{
+    sampleInterval.store(interval, std::memory_order_relaxed);
+}
+
+void MemoryGetSamples(std::vector<AllocationSample>& dest)
+{
+    // Growing the destination must not sample, as the lock is held
+    bool wasInTracker = inTracker;
+    inTracker = true;
+
+    {
+        std::lock_guard<std::mutex> lock(samplesMutex);
+
+        dest.clear();
+        size_t first = numSamples < MAX_ALLOCATION_SAMPLES ? 0 : nextSample;
+        for (size_t i = 0; i < numSamples; ++i)
+            dest.push_back(samples[(first + i) % MAX_ALLOCATION_SAMPLES]);
+    }
+
+    inTracker = wasInTracker;
+}
+
+std::string MemorySampleReport(size_t maxStacks)
+{
+    // The report's own allocations are not sampled
+    bool wasInTracker = inTracker;
+    inTracker = true;
+
+    std::vector<AllocationSample> sampled;
+    MemoryGetSamples(sampled);
+
+    // Group the samples by call stack, and sort the most frequent first
+    std::map<std::vector<void*>, std::pair<size_t, size_t> > stacks;
+    std::map<std::vector<void*>, MemoryCategory> stackCategories;
+    for (auto it = sampled.begin(); it != sampled.end(); ++it)
+    {
+        std::vector<void*> frames(it->frames, it->frames + it->numFrames);
+        std::pair<size_t, size_t>& counts = stacks[frames];
+        ++counts.first;
+        counts.second += it->size;
+        stackCategories[frames] = it->category;
+    }
+
+    std::vector<std::pair<size_t, const std::vector<void*>*> > sortedStacks;
+    for (auto it = stacks.begin(); it != stacks.end(); ++it)
+        sortedStacks.push_back(std::make_pair(it->second.first, &it->first));
+    std::sort(sortedStacks.begin(), sortedStacks.end(), [](const std::pair<size_t, const std::vector<void*>*>& lhs,
+        const std::pair<size_t, const std::vector<void*>*>& rhs) { return lhs.first > rhs.first; });
+
+    std::string output;
+    char line[256];
+    snprintf(line, sizeof line, "%u allocations sampled, %u call stacks\n", (unsigned)sampled.size(), (unsigned)stacks.size());
+    output += line;
+
+    for (size_t i = 0; i < sortedStacks.size() && i < maxStacks; ++i)
+    {
+        const std::vector<void*>& frames = *sortedStacks[i].second;
+        const std::pair<size_t, size_t>& counts = stacks[frames];
+        snprintf(line, sizeof line, "\n%u samples, %u bytes, %s\n", (unsigned)counts.first, (unsigned)counts.second, MemoryCategoryName(stackCategories[frames]));
+        output += line;
+
+#if defined(__GLIBC__)
+        char** symbols = backtrace_symbols(frames.data(), (int)frames.size());
+        for (size_t j = 0; j < frames.size(); ++j)
+        {
+            output += "  ";
+            output += symbols ? symbols[j] : "?";
+            output += "\n";
+        }
+        free(symbols);
+#else
+        for (size_t j = 0; j < frames.size(); ++j)
+        {
+            snprintf(line, sizeof line, "  %p\n", frames[j]);
+            output += line;
+        }
+#endif
+    }
+
+    inTracker = wasInTracker;
+    return output;
+}
+
+size_t HeapAllocationCount()
+{
+#ifdef TURSO3D_TRACK_HEAP_ALLOCATIONS
+    return heapAllocations.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
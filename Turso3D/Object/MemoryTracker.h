@@ -0,0 +1,107 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Memory accounting categories.
+enum MemoryCategory
+{
+    MEMORY_GENERAL = 0,
+    MEMORY_SCENE,
+    MEMORY_RENDERER,
+    MEMORY_MODEL,
+    MEMORY_IMAGE,
+    MEMORY_GPU_TEXTURE,
+    MEMORY_GPU_BUFFER,
+    MAX_MEMORY_CATEGORIES
+};
+
+/// Number of call stack frames kept in an allocation sample.
+static const size_t MAX_SAMPLE_STACK_FRAMES = 16;
+/// Number of allocation samples kept. When full, the oldest are overwritten.
+static const size_t MAX_ALLOCATION_SAMPLES = 4096;
+
+/// Memory statistics of a category.
+struct MemoryCategoryStats
+{
+    /// Construct with zero values.
+    MemoryCategoryStats() :
+        current(0),
+        peak(0),
+        allocations(0),
+        frameAllocations(0),
+        frameBytes(0)
+    {
+    }
+
+    /// Bytes currently allocated.
+    size_t current;
+    /// Highest number of bytes allocated at once.
+    size_t peak;
+    /// Allocations since the program start.
+    size_t allocations;
+    /// Allocations during the last ended frame.
+    size_t frameAllocations;
+    /// Bytes allocated during the last ended frame.
+    size_t frameBytes;
+};
+
+/// Call stack of a sampled heap allocation.
+struct AllocationSample
+{
+    /// Return addresses, innermost first.
+    void* frames[MAX_SAMPLE_STACK_FRAMES];
+    /// Number of return addresses.
+    size_t numFrames;
+    /// Allocation size in bytes.
+    size_t size;
+    /// Category the allocation was accounted to.
+    MemoryCategory category;
+};
+
+/// Account an allocation to a category. Thread-safe. GPU resources call this directly; heap allocations are accounted automatically when compiled with TURSO3D_TRACK_HEAP_ALLOCATIONS.
+void MemoryTrackAllocation(MemoryCategory category, size_t size);
+/// Account a free of an allocation to a category. Thread-safe.
+void MemoryTrackFree(MemoryCategory category, size_t size);
+/// Latch the allocation counts of the frame and begin counting the next. Called by the profiler at the end of each frame.
+void MemoryEndFrame();
+/// Return statistics of a category.
+MemoryCategoryStats MemoryGetStats(MemoryCategory category);
+/// Return name of a category.
+const char* MemoryCategoryName(MemoryCategory category);
+/// Return the category the calling thread's heap allocations are accounted to.
+MemoryCategory MemoryCurrentCategory();
+/// Set the category the calling thread's heap allocations are accounted to. Return the previous category.
+MemoryCategory MemorySetCurrentCategory(MemoryCategory category);
+/// Set the interval of sampling the call stacks of heap allocations, for finding where the churn comes from. Zero disables. Requires TURSO3D_TRACK_HEAP_ALLOCATIONS, and a platform with stack walking (Windows or glibc).
+void MemorySetSampleInterval(unsigned interval);
+/// Copy the allocation samples, oldest first.
+void MemoryGetSamples(std::vector<AllocationSample>& dest);
+/// Return the most frequent sampled call stacks with symbols where available, as text.
+std::string MemorySampleReport(size_t maxStacks = 10);
+
+/// Helper class for accounting the calling thread's heap allocations to a category within a scope.
+class MemoryScope
+{
+public:
+    /// Construct and set the category.
+    MemoryScope(MemoryCategory category)
+    {
+        previous = MemorySetCurrentCategory(category);
+    }
+
+    /// Destruct. Restore the previous category.
+    ~MemoryScope()
+    {
+        MemorySetCurrentCategory(previous);
+    }
+
+private:
+    /// Category before the scope.
+    MemoryCategory previous;
+};
+
+#define MEMORY_SCOPE(category) MemoryScope memoryScope_(category)
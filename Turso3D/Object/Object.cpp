@@ -3,8 +3,8 @@
 #include "Object.h"
 #include "../IO/JSONValue.h"
 
-std::map<StringHash, Object*> Object::subsystems;
-std::map<StringHash, AutoPtr<ObjectFactory> > Object::factories;
+std::mutex Object::subsystemMutex;
+std::unordered_map<unsigned, AutoPtr<ObjectFactory> > Object::factories;
 std::set<std::pair<StringHash, StringHash> > Object::derivedTypes;
 std::map<StringHash, StringHash> Object::baseTypes;
 
@@ -37,7 +37,10 @@ void Object::RegisterSubsystem(Object* subsystem)
     if (!subsystem)
         return;
     
-    subsystems[subsystem->Type()] = subsystem;
+    StringHash::Register(subsystem->TypeName());
+
+    std::lock_guard<std::mutex> lock(subsystemMutex);
+    Subsystems()[subsystem->Type().Value()] = subsystem;
 }
 
 void Object::RemoveSubsystem(Object* subsystem)
@@ -45,20 +48,41 @@ void Object::RemoveSubsystem(Object* subsystem)
     if (!subsystem)
         return;
     
-    auto it = subsystems.find(subsystem->Type());
-    if (it != subsystems.end() && it->second == subsystem)
-        subsystems.erase(it);
+    std::lock_guard<std::mutex> lock(subsystemMutex);
+    std::unordered_map<unsigned, Object*>& slots = Subsystems();
+    auto it = slots.find(subsystem->Type().Value());
+    if (it != slots.end() && it->second == subsystem)
+        it->second = nullptr;
 }
 
 void Object::RemoveSubsystem(StringHash type)
 {
-    subsystems.erase(type);
+    std::lock_guard<std::mutex> lock(subsystemMutex);
+    std::unordered_map<unsigned, Object*>& slots = Subsystems();
+    auto it = slots.find(type.Value());
+    if (it != slots.end())
+        it->second = nullptr;
 }
 
 Object* Object::Subsystem(StringHash type)
 {
-    auto it = subsystems.find(type);
-    return it != subsystems.end() ? it->second : nullptr;
+    std::lock_guard<std::mutex> lock(subsystemMutex);
+    std::unordered_map<unsigned, Object*>& slots = Subsystems();
+    auto it = slots.find(type.Value());
+    return it != slots.end() ? it->second : nullptr;
+}
+
+Object* const* Object::SubsystemSlot(StringHash type)
+{
+    // Rehashing does not move the elements of an unordered map, so the slot address stays valid
+    std::lock_guard<std::mutex> lock(subsystemMutex);
+    return &Subsystems()[type.Value()];
+}
+
+std::unordered_map<unsigned, Object*>& Object::Subsystems()
+{
+    static std::unordered_map<unsigned, Object*>* slots = new std::unordered_map<unsigned, Object*>();
+    return *slots;
 }
 
 void Object::RegisterFactory(ObjectFactory* factory)
@@ -66,18 +90,19 @@ void Object::RegisterFactory(ObjectFactory* factory)
     if (!factory)
         return;
     
-    factories[factory->Type()] = factory;
+    StringHash::Register(factory->TypeName());
+    factories[factory->Type().Value()] = factory;
 }
 
 Object* Object::Create(StringHash type)
 {
-    auto it = factories.find(type);
+    auto it = factories.find(type.Value());
     return it != factories.end() ? it->second->Create() : nullptr;
 }
 
 const std::string& Object::TypeNameFromType(StringHash type)
 {
-    auto it = factories.find(type);
+    auto it = factories.find(type.Value());
     return it != factories.end() ? it->second->TypeName() : JSONValue::emptyString;
 }
 
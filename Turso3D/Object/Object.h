@@ -6,7 +6,9 @@
 #include "Event.h"
 
 #include <map>
+#include <mutex>
 #include <set>
+#include <unordered_map>
 
 class ObjectFactory;
 template <class T> class ObjectFactoryImpl;
@@ -54,8 +56,10 @@ public:
     static const std::string& TypeNameFromType(StringHash type);
     /// Return whether type is derived from another type.
     static bool DerivedFrom(StringHash derived, StringHash base);
-    /// Return a subsystem, template version.
-    template <class T> static T* Subsystem() { return static_cast<T*>(Subsystem(T::TypeStatic())); }
+    /// Return the storage slot of a subsystem type, which stays valid and is updated when the subsystem is registered or removed.
+    static Object* const* SubsystemSlot(StringHash type);
+    /// Return a subsystem, template version. Reads a per-type slot cached on first use instead of looking up by type.
+    template <class T> static T* Subsystem() { static Object* const* slot = SubsystemSlot(T::TypeStatic()); return static_cast<T*>(*slot); }
     /// Register an object factory, template version.
     template <class T> static void RegisterFactory() { RegisterFactory(new ObjectFactoryImpl<T>()); }
     /// Register a derived type, template version.
@@ -64,10 +68,13 @@ public:
     template <class T> static T* Create() { return static_cast<T*>(Create(T::TypeStatic())); }
     
 private:
-    /// Registered subsystems.
-    static std::map<StringHash, Object*> subsystems;
-    /// Registered object factories.
-    static std::map<StringHash, AutoPtr<ObjectFactory> > factories;
+    /// Return the subsystem slots by type hash value. Slots are never erased, as their addresses are cached by the templated subsystem access. The container is never destroyed, so that destructors run at exit can still check for subsystems.
+    static std::unordered_map<unsigned, Object*>& Subsystems();
+
+    /// Mutex for the subsystem slots, which may be created from any thread on first access.
+    static std::mutex subsystemMutex;
+    /// Registered object factories by type hash value.
+    static std::unordered_map<unsigned, AutoPtr<ObjectFactory> > factories;
     /// Registered derived types.
     static std::set<std::pair<StringHash, StringHash> > derivedTypes;
     /// Registered immediate base types.
@@ -113,11 +120,10 @@ public:
 
 #define OBJECT(typeName) \
     private: \
-        static const StringHash typeStatic; \
-        static const std::string typeNameStatic; \
+        static constexpr unsigned typeHashStatic = StringHash::Calculate(#typeName); \
     public: \
         StringHash Type() const override { return TypeStatic(); } \
         const std::string& TypeName() const override { return TypeNameStatic(); } \
-        static StringHash TypeStatic() { static const StringHash type(#typeName); return type; } \
+        static constexpr StringHash TypeStatic() { return StringHash(typeHashStatic); } \
         static const std::string& TypeNameStatic() { static const std::string type(#typeName); return type; } \
 
@@ -3,33 +3,141 @@
 #include "../IO/Log.h"
 #include "../IO/ObjectRef.h"
 #include "../IO/StringUtils.h"
+#include "../Math/Math.h"
 #include "ObjectResolver.h"
 #include "Serializable.h"
 
+#include <algorithm>
+
+/// Maximum ratio of old id table entries to objects. Sparser old id's are looked up by binary search.
+static const size_t MAX_ID_TABLE_SPARSITY = 4;
+/// Old id table size that is always allowed regardless of sparsity.
+static const size_t MIN_ID_TABLE_SIZE = 1024;
+
+static bool CompareObjects(const StoredObject& lhs, const StoredObject& rhs)
+{
+    return lhs.batch != rhs.batch ? lhs.batch < rhs.batch : lhs.oldId < rhs.oldId;
+}
+
+ObjectResolver::ObjectResolver() :
+    batch(0)
+{
+}
+
+void ObjectResolver::NextBatch()
+{
+    ++batch;
+}
+
 void ObjectResolver::StoreObject(unsigned oldId, Serializable* object)
 {
     if (object)
-        objects[oldId] = object;
+        objects.push_back(StoredObject(object, batch, oldId));
 }
 
 void ObjectResolver::StoreObjectRef(Serializable* object, Attribute* attr, const ObjectRef& value)
 {
     if (object && attr && attr->Type() == ATTR_OBJECTREF)
-        objectRefs.push_back(StoredObjectRef(object, attr, value.id));
+        objectRefs.push_back(StoredObjectRef(object, attr, batch, value.id));
 }
 
 void ObjectResolver::Resolve()
 {
-    for (auto it = objectRefs.begin(); it != objectRefs.end(); ++it)
+    if (!objectRefs.empty())
     {
-        auto refIt = objects.find(it->oldId);
-        // See if we can find the referred object
-        if (refIt != objects.end())
+        Sort();
+        ResolveRange(0, objectRefs.size());
+    }
+
+    Clear();
+}
+
+void ObjectResolver::Sort()
+{
+    // The stable sort keeps equal old id's in storage order, so that the last stored object wins
+    std::stable_sort(objects.begin(), objects.end(), CompareObjects);
+    size_t numUnique = 0;
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        if (numUnique && objects[numUnique - 1].batch == objects[i].batch && objects[numUnique - 1].oldId == objects[i].oldId)
+            objects[numUnique - 1] = objects[i];
+        else
+            objects[numUnique++] = objects[i];
+    }
+    objects.resize(numUnique);
+
+    batchIdRanges.assign(batch + 1, std::make_pair(M_MAX_UNSIGNED, 0u));
+    for (auto it = objects.begin(); it != objects.end(); ++it)
+    {
+        std::pair<unsigned, unsigned>& range = batchIdRanges[it->batch];
+        range.first = std::min(range.first, it->oldId);
+        range.second = std::max(range.second, it->oldId);
+    }
+
+    batchOffsets.resize(batch + 1);
+    size_t tableSize = 0;
+    for (size_t i = 0; i < batchIdRanges.size(); ++i)
+    {
+        batchOffsets[i] = tableSize;
+        if (batchIdRanges[i].first <= batchIdRanges[i].second)
+            tableSize += (size_t)(batchIdRanges[i].second - batchIdRanges[i].first) + 1;
+    }
+
+    idTable.clear();
+    if (tableSize <= std::max(objects.size() * MAX_ID_TABLE_SPARSITY, MIN_ID_TABLE_SIZE))
+    {
+        idTable.resize(tableSize, nullptr);
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+            idTable[batchOffsets[it->batch] + it->oldId - batchIdRanges[it->batch].first] = it->object;
+    }
+}
+
+size_t ObjectResolver::ResolveRange(size_t start, size_t end) const
+{
+    size_t numUnresolved = 0;
+    end = std::min(end, objectRefs.size());
+
+    for (size_t i = start; i < end; ++i)
+    {
+        const StoredObjectRef& ref = objectRefs[i];
+        Serializable* object = FindObject(ref.batch, ref.oldId);
+        if (object)
         {
-            AttributeImpl<ObjectRef>* typedAttr = static_cast<AttributeImpl<ObjectRef>*>(it->attr);
-            typedAttr->SetValue(it->object, ObjectRef(refIt->second->Id()));
+            AttributeImpl<ObjectRef>* typedAttr = static_cast<AttributeImpl<ObjectRef>*>(ref.attr);
+            typedAttr->SetValue(ref.object, ObjectRef(object->Id()));
         }
         else
-            LOGWARNING("Could not resolve object reference " + ToString(it->oldId));
+        {
+            LOGWARNING("Could not resolve object reference " + ToString(ref.oldId));
+            ++numUnresolved;
+        }
     }
+
+    return numUnresolved;
+}
+
+void ObjectResolver::Clear()
+{
+    objects.clear();
+    objectRefs.clear();
+    idTable.clear();
+    batchIdRanges.clear();
+    batchOffsets.clear();
+    batch = 0;
+}
+
+Serializable* ObjectResolver::FindObject(unsigned batch_, unsigned oldId) const
+{
+    if (batch_ >= batchIdRanges.size())
+        return nullptr;
+
+    const std::pair<unsigned, unsigned>& range = batchIdRanges[batch_];
+    if (oldId < range.first || oldId > range.second)
+        return nullptr;
+
+    if (!idTable.empty())
+        return idTable[batchOffsets[batch_] + oldId - range.first];
+
+    auto it = std::lower_bound(objects.begin(), objects.end(), StoredObject(nullptr, batch_, oldId), CompareObjects);
+    return (it != objects.end() && it->batch == batch_ && it->oldId == oldId) ? it->object : nullptr;
 }
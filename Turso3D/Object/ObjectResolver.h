@@ -2,13 +2,40 @@
 
 #pragma once
 
-#include <map>
+#include <utility>
 #include <vector>
 
 class Attribute;
 class Serializable;
 struct ObjectRef;
 
+/// Stored object with its old id.
+struct StoredObject
+{
+    /// Construct undefined.
+    StoredObject() :
+        object(nullptr),
+        batch(0),
+        oldId(0)
+    {
+    }
+
+    /// Construct with values.
+    StoredObject(Serializable* object_, unsigned batch_, unsigned oldId_) :
+        object(object_),
+        batch(batch_),
+        oldId(oldId_)
+    {
+    }
+
+    /// %Object.
+    Serializable* object;
+    /// Batch the old id belongs to.
+    unsigned batch;
+    /// Old id from the serialized data.
+    unsigned oldId;
+};
+
 /// Stored object ref attribute.
 struct StoredObjectRef
 {
@@ -16,14 +43,16 @@ struct StoredObjectRef
     StoredObjectRef() :
         object(nullptr),
         attr(nullptr),
+        batch(0),
         oldId(0)
     {
     }
 
     /// Construct with values.
-    StoredObjectRef(Serializable* object_, Attribute* attr_, unsigned oldId_) :
+    StoredObjectRef(Serializable* object_, Attribute* attr_, unsigned batch_, unsigned oldId_) :
         object(object_),
         attr(attr_),
+        batch(batch_),
         oldId(oldId_)
     {
     }
@@ -32,24 +61,53 @@ struct StoredObjectRef
     Serializable* object;
     /// Description of the object ref attribute.
     Attribute* attr;
+    /// Batch the old id belongs to.
+    unsigned batch;
     /// Old id from the serialized data.
     unsigned oldId;
 };
 
-/// Helper class for resolving object ref attributes when loading a scene.
+/// Helper class for resolving object ref attributes when loading a scene. The objects and refs are stored to flat arrays. On resolve the objects are sorted by old id once, and the refs are looked up from a dense old id table, or by binary search if the old id's are too sparse for the table. Several loads, such as instantiations of the same data, can share a resolver by starting a new batch for each, so that their old id's do not collide.
 class ObjectResolver
 {
 public:
-    /// Store an object along with its old id from the serialized data.
+    /// Construct.
+    ObjectResolver();
+
+    /// Begin a new batch of objects and refs, whose old id's are independent of the previous batches.
+    void NextBatch();
+    /// Store an object along with its old id from the serialized data. If the same old id is stored several times in a batch, the last object is used.
     void StoreObject(unsigned oldId, Serializable* object);
     /// Store an object ref attribute that needs to be resolved later.
     void StoreObjectRef(Serializable* object, Attribute* attr, const ObjectRef& value);
-    /// Resolve the object ref attributes.
+    /// Resolve all the object ref attributes and clear the stored data.
     void Resolve();
+    /// Sort the stored objects and build the old id table for resolving in ranges with ResolveRange(). Called by Resolve().
+    void Sort();
+    /// Resolve a range of the object ref attributes after Sort(). Non-overlapping ranges can be resolved in parallel when the attribute setters of the objects are thread-safe. The refs are in storage order, so the refs of an object loaded at once are contiguous. Return number of refs that could not be resolved.
+    size_t ResolveRange(size_t start, size_t end) const;
+    /// Clear the stored data.
+    void Clear();
+
+    /// Return number of stored object ref attributes.
+    size_t NumObjectRefs() const { return objectRefs.size(); }
+    /// Return the stored object ref attributes in storage order.
+    const std::vector<StoredObjectRef>& ObjectRefs() const { return objectRefs; }
 
 private:
-    /// Mapping of old id's to objects.
-    std::map<unsigned, Serializable*> objects;
+    /// Find an object by batch and old id after Sort(). Return null if not found.
+    Serializable* FindObject(unsigned batch, unsigned oldId) const;
+
+    /// Stored objects.
+    std::vector<StoredObject> objects;
     /// Stored object ref attributes.
     std::vector<StoredObjectRef> objectRefs;
+    /// Dense old id table of objects, indexed by the batch's table offset plus the old id. Empty if the old id's are too sparse.
+    std::vector<Serializable*> idTable;
+    /// Smallest and largest old id of each batch.
+    std::vector<std::pair<unsigned, unsigned> > batchIdRanges;
+    /// Offset of each batch's entries in the old id table.
+    std::vector<size_t> batchOffsets;
+    /// Current batch.
+    unsigned batch;
 };
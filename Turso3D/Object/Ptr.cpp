@@ -9,36 +9,49 @@ RefCounted::RefCounted() :
 
 RefCounted::~RefCounted()
 {
-    if (refCount)
+    RefCount* count = refCount;
+    if (count)
     {
-        assert(refCount->refs == 0);
-        if (refCount->weakRefs == 0)
-            delete refCount;
-        else
-            refCount->expired = true;
+        assert(count->Refs() == 0);
+        // Release the object's own weak reference. If no weak pointers, destroy the reference count now
+        count->SetExpired();
+        if (count->ReleaseWeakRef() == 0)
+            delete count;
     }
 }
 
 void RefCounted::AddRef()
 {
-    if (!refCount)
-        refCount = new RefCount();
-
-    ++(refCount->refs);
+    RefCountPtr()->AddRef();
 }
 
 void RefCounted::ReleaseRef()
 {
-    assert(refCount && refCount->refs > 0);
-    --(refCount->refs);
-    if (refCount->refs == 0)
+    RefCount* count = refCount;
+    assert(count && count->Refs() > 0);
+    if (count->ReleaseRef() == 0)
         delete this;
 }
 
 RefCount* RefCounted::RefCountPtr()
 {
+#ifdef TURSO3D_ATOMIC_REFCOUNT
+    // If another thread allocates at the same time, use its structure and discard this one
+    RefCount* count = refCount.load(std::memory_order_acquire);
+    if (!count)
+    {
+        RefCount* newCount = new RefCount();
+        if (refCount.compare_exchange_strong(count, newCount, std::memory_order_acq_rel, std::memory_order_acquire))
+            count = newCount;
+        else
+            delete newCount;
+    }
+
+    return count;
+#else
     if (!refCount)
         refCount = new RefCount();
 
     return refCount;
+#endif
 }
@@ -2,29 +2,78 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 
 class RefCounted;
 template <class T> class WeakPtr;
 
-/// Reference count structure. Used in both intrusive and non-intrusive reference counting.
+// Reference counts are atomic, so that shared and weak pointers to the same object can be copied and released on several threads. Define TURSO3D_NONATOMIC_REFCOUNT to use plain counters instead
+#ifndef TURSO3D_NONATOMIC_REFCOUNT
+#define TURSO3D_ATOMIC_REFCOUNT
+#endif
+
+/// Reference count structure. Used in both intrusive and non-intrusive reference counting. The object itself holds one weak reference until it is destroyed, so that whichever of the object and the last weak pointer goes last destroys the structure.
 struct RefCount
 {
-    /// Construct with zero refcounts.
+    /// Construct with zero strong refcount and the object's own weak reference.
     RefCount() :
         refs(0),
-        weakRefs(0),
+        weakRefs(1),
         expired(false)
     {
     }
 
+#ifdef TURSO3D_ATOMIC_REFCOUNT
+    /// Add a strong reference.
+    void AddRef() { refs.fetch_add(1, std::memory_order_relaxed); }
+    /// Release a strong reference and return the remaining count. Synchronizes with the other releases so that the last one sees all writes to the object.
+    unsigned ReleaseRef() { return refs.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+    /// Add a weak reference.
+    void AddWeakRef() { weakRefs.fetch_add(1, std::memory_order_relaxed); }
+    /// Release a weak reference and return the remaining count.
+    unsigned ReleaseWeakRef() { return weakRefs.fetch_sub(1, std::memory_order_acq_rel) - 1; }
+    /// Mark the object destroyed.
+    void SetExpired() { expired.store(true, std::memory_order_release); }
+    /// Return the number of strong references.
+    unsigned Refs() const { return refs.load(std::memory_order_relaxed); }
+    /// Return the number of weak references, excluding the object's own.
+    unsigned WeakRefs() const { return weakRefs.load(std::memory_order_relaxed) - (IsExpired() ? 0 : 1); }
+    /// Return whether the object has been destroyed.
+    bool IsExpired() const { return expired.load(std::memory_order_acquire); }
+
+    /// Number of strong references. These keep the object alive.
+    std::atomic<unsigned> refs;
+    /// Number of weak references.
+    std::atomic<unsigned> weakRefs;
+    /// Expired flag. The object is no longer safe to access after this is set true.
+    std::atomic<bool> expired;
+#else
+    /// Add a strong reference.
+    void AddRef() { ++refs; }
+    /// Release a strong reference and return the remaining count.
+    unsigned ReleaseRef() { return --refs; }
+    /// Add a weak reference.
+    void AddWeakRef() { ++weakRefs; }
+    /// Release a weak reference and return the remaining count.
+    unsigned ReleaseWeakRef() { return --weakRefs; }
+    /// Mark the object destroyed.
+    void SetExpired() { expired = true; }
+    /// Return the number of strong references.
+    unsigned Refs() const { return refs; }
+    /// Return the number of weak references, excluding the object's own.
+    unsigned WeakRefs() const { return weakRefs - (expired ? 0 : 1); }
+    /// Return whether the object has been destroyed.
+    bool IsExpired() const { return expired; }
+
     /// Number of strong references. These keep the object alive.
     unsigned refs;
     /// Number of weak references.
     unsigned weakRefs;
     /// Expired flag. The object is no longer safe to access after this is set true.
     bool expired;
+#endif
 };
 
 /// Base class for intrusively reference counted objects that can be pointed to with SharedPtr and WeakPtr. These are not copy-constructible and not assignable.
@@ -43,9 +92,9 @@ public:
     void ReleaseRef();
 
     /// Return the number of strong references.
-    unsigned Refs() const { return refCount ? refCount->refs : 0; }
+    unsigned Refs() const { RefCount* count = refCount; return count ? count->Refs() : 0; }
     /// Return the number of weak references.
-    unsigned WeakRefs() const { return refCount ? refCount->weakRefs : 0; }
+    unsigned WeakRefs() const { RefCount* count = refCount; return count ? count->WeakRefs() : 0; }
     /// Return pointer to the reference count structure. Allocate if not allocated yet.
     RefCount* RefCountPtr();
 
@@ -55,8 +104,13 @@ private:
     /// Prevent assignment.
     RefCounted& operator = (const RefCounted& rhs);
 
+#ifdef TURSO3D_ATOMIC_REFCOUNT
+    /// Reference count structure, allocated on demand by whichever thread first needs it.
+    std::atomic<RefCount*> refCount;
+#else
     /// Reference count structure, allocated on demand.
     RefCount* refCount;
+#endif
 };
 
 /// Pointer which holds a strong reference to a RefCounted subclass and allows shared ownership.
@@ -170,6 +224,55 @@ template <class T, class U> SharedPtr<T> DynamicCast(const SharedPtr<U>& rhs)
     return ret;
 }
 
+/// Pointer to a RefCounted subclass borrowed from a shared pointer without changing the reference count, for batches and hot loops. The owner must hold a strong reference for as long as the borrowed pointer is used.
+template <class T> class BorrowedPtr
+{
+public:
+    /// Construct a null pointer.
+    BorrowedPtr() :
+        ptr(nullptr)
+    {
+    }
+
+    /// Construct from a shared pointer.
+    BorrowedPtr(const SharedPtr<T>& ptr_) :
+        ptr(ptr_.Get())
+    {
+    }
+
+    /// Construct from a raw pointer to an object that is kept alive elsewhere.
+    explicit BorrowedPtr(T* ptr_) :
+        ptr(ptr_)
+    {
+    }
+
+    /// Test for equality with another borrowed pointer.
+    bool operator == (const BorrowedPtr<T>& rhs) const { return ptr == rhs.ptr; }
+    /// Test for equality with a raw pointer.
+    bool operator == (T* rhs) const { return ptr == rhs; }
+    /// Test for inequality with another borrowed pointer.
+    bool operator != (const BorrowedPtr<T>& rhs) const { return !(*this == rhs); }
+    /// Test for inequality with a raw pointer.
+    bool operator != (T* rhs) const { return !(*this == rhs); }
+    /// Point to the object.
+    T* operator -> () const { assert(ptr); return ptr; }
+    /// Dereference the object.
+    T& operator * () const { assert(ptr); return *ptr; }
+    /// Convert to the object.
+    operator T* () const { return ptr; }
+
+    /// Return a new strong reference to the object, for keeping it beyond the owner's lifetime.
+    SharedPtr<T> Lock() const { return SharedPtr<T>(ptr); }
+    /// Return the object.
+    T* Get() const { return ptr; }
+    /// Return whether is a null pointer.
+    bool IsNull() const { return ptr == nullptr; }
+
+private:
+    /// %Object pointer.
+    T* ptr;
+};
+
 /// Pointer which holds a weak reference to a RefCounted subclass. Can track destruction but does not keep the object alive.
 template <class T> class WeakPtr
 {
@@ -221,7 +324,7 @@ public:
         ptr = rhs.ptr;
         refCount = rhs.refCount;
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
         return *this;
     }
 
@@ -235,7 +338,7 @@ public:
         ptr = rhs.Get();
         refCount = ptr ? ptr->RefCountPtr() : nullptr;
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
         return *this;
     }
 
@@ -249,7 +352,7 @@ public:
         ptr = rhs;
         refCount = ptr ? ptr->RefCountPtr() : nullptr;
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
         return *this;
     }
 
@@ -258,9 +361,8 @@ public:
     {
         if (refCount)
         {
-            --(refCount->weakRefs);
-            // If expired and no more weak references, destroy the reference count
-            if (refCount->expired && refCount->weakRefs == 0)
+            // If the object and all other weak references are gone, destroy the reference count
+            if (refCount->ReleaseWeakRef() == 0)
                 delete refCount;
             ptr = nullptr;
             refCount = nullptr;
@@ -304,20 +406,20 @@ public:
     /// Return the object or null if it has been destroyed.
     T* Get() const
     {
-        if (refCount && !refCount->expired)
+        if (refCount && !refCount->IsExpired())
             return ptr;
         else
             return nullptr;
     }
 
     /// Return the number of strong references.
-    unsigned Refs() const { return refCount ? refCount->refs : 0; }
+    unsigned Refs() const { return refCount ? refCount->Refs() : 0; }
     /// Return the number of weak references.
-    unsigned WeakRefs() const { return refCount ? refCount->weakRefs : 0; }
+    unsigned WeakRefs() const { return refCount ? refCount->WeakRefs() : 0; }
     /// Return whether is a null pointer.
     bool IsNull() const { return ptr == nullptr; }
     /// Return whether the object has been destroyed. Returns false if is a null pointer.
-    bool IsExpired() const { return refCount && refCount->expired; }
+    bool IsExpired() const { return refCount && refCount->IsExpired(); }
 
 private:
     /// %Object pointer.
@@ -385,7 +487,7 @@ public:
         ptr = rhs.ptr;
         refCount = rhs.refCount;
         if (refCount)
-            ++(refCount->refs);
+            refCount->AddRef();
 
         return *this;
     }
@@ -403,7 +505,7 @@ public:
             ptr = rhs;
             refCount = new RefCount();
             if (refCount)
-                ++(refCount->refs);
+                refCount->AddRef();
         }
         
         return *this;
@@ -429,13 +531,12 @@ public:
     {
         if (refCount)
         {
-            --(refCount->refs);
-            if (refCount->refs == 0)
+            if (refCount->ReleaseRef() == 0)
             {
-                refCount->expired = true;
+                refCount->SetExpired();
                 delete[] ptr;
-                // If no weak refs, destroy the ref count now too
-                if (refCount->weakRefs == 0)
+                // Release the array's own weak reference. If no weak pointers, destroy the ref count now too
+                if (refCount->ReleaseWeakRef() == 0)
                     delete refCount;
             }
         }
@@ -451,7 +552,7 @@ public:
         ptr = static_cast<T*>(rhs.Get());
         refCount = rhs.RefCountPtr();
         if (refCount)
-            ++(refCount->refs);
+            refCount->AddRef();
     }
     
    /// Perform a reinterpret cast from a shared array pointer of another type.
@@ -461,15 +562,15 @@ public:
         ptr = reinterpret_cast<T*>(rhs.Get());
         refCount = rhs.RefCountPtr();
         if (refCount)
-            ++(refCount->refs);
+            refCount->AddRef();
     }
 
     /// Return the raw pointer.
     T* Get() const { return ptr; }
     /// Return the number of strong references.
-    unsigned Refs() const { return refCount ? refCount->refs : 0; }
+    unsigned Refs() const { return refCount ? refCount->Refs() : 0; }
     /// Return the number of weak references.
-    unsigned WeakRefs() const { return refCount ? refCount->weakRefs : 0; }
+    unsigned WeakRefs() const { return refCount ? refCount->WeakRefs() : 0; }
     /// Return pointer to the reference count structure.
     RefCount* RefCountPtr() const { return refCount; }
     /// Check if the pointer is null.
@@ -544,7 +645,7 @@ public:
         ptr = rhs.Get();
         refCount = rhs.RefCountPtr();
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
         
         return *this;
     }
@@ -559,7 +660,7 @@ public:
         ptr = rhs.ptr;
         refCount = rhs.refCount;
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
         
         return *this;
     }
@@ -612,8 +713,7 @@ public:
     {
         if (refCount)
         {
-            --(refCount->weakRefs);
-            if (refCount->expired && refCount->weakRefs == 0)
+            if (refCount->ReleaseWeakRef() == 0)
                 delete refCount;
         }
         
@@ -628,7 +728,7 @@ public:
         ptr = static_cast<T*>(rhs.Get());
         refCount = rhs.refCount;
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
     }
     
     /// Perform a reinterpret cast from a weak array pointer of another type.
@@ -638,13 +738,13 @@ public:
         ptr = reinterpret_cast<T*>(rhs.Get());
         refCount = rhs.refCount;
         if (refCount)
-            ++(refCount->weakRefs);
+            refCount->AddWeakRef();
     }
     
     /// Return raw pointer. If array has destroyed, return null.
     T* Get() const
     {
-        if (!refCount || refCount->expired)
+        if (!refCount || refCount->IsExpired())
             return nullptr;
         else
             return ptr;
@@ -653,11 +753,11 @@ public:
     /// Check if the pointer is null.
     bool IsNull() const { return refCount == nullptr; }
     /// Return number of strong references.
-    unsigned Refs() const { return (refCount && refCount->refs >= 0) ? refCount->refs : 0; }
+    unsigned Refs() const { return refCount ? refCount->Refs() : 0; }
     /// Return number of weak references.
-    unsigned WeakRefs() const { return refCount ? refCount->weakRefs : 0; }
+    unsigned WeakRefs() const { return refCount ? refCount->WeakRefs() : 0; }
     /// Return whether the array has been destroyed. Returns false if is a null pointer.
-    bool IsExpired() const { return refCount ? refCount->expired : false; }
+    bool IsExpired() const { return refCount ? refCount->IsExpired() : false; }
 
 private:
     /// Prevent direct assignment from a weak array pointer of different type.
@@ -1,12 +1,13 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
-#include "../IO/JSONValue.h"
+#include "../IO/JSONReader.h"
+#include "../IO/JSONWriter.h"
 #include "../IO/ObjectRef.h"
 #include "../IO/Stream.h"
 #include "ObjectResolver.h"
 #include "Serializable.h"
 
-std::map<StringHash, std::vector<SharedPtr<Attribute> > > Serializable::classAttributes;
+std::map<StringHash, AttributeTable> Serializable::classAttributes;
 
 void Serializable::Load(Stream& source, ObjectResolver& resolver)
 {
@@ -14,6 +15,9 @@ void Serializable::Load(Stream& source, ObjectResolver& resolver)
     if (!attributes)
         return; // Nothing to do
     
+    // Use the compiled types when available to avoid a virtual call per attribute
+    const AttributeTable* table = ClassAttributeTable();
+
     size_t numAttrs = source.ReadVLE();
     for (size_t i = 0; i < numAttrs; ++i)
     {
@@ -24,7 +28,7 @@ void Serializable::Load(Stream& source, ObjectResolver& resolver)
         if (i < attributes->size())
         {
             Attribute* attr = attributes->at(i);
-            if (attr->Type() == type)
+            if ((table ? table->entries[i].type : attr->Type()) == type)
             {
                 // Store object refs to the resolver instead of immediately setting
                 if (type != ATTR_OBJECTREF)
@@ -79,6 +83,56 @@ void Serializable::LoadJSON(const JSONValue& source, ObjectResolver& resolver)
     }
 }
 
+void Serializable::LoadJSON(JSONReader& source, ObjectResolver& resolver)
+{
+    if (!source.BeginObject())
+        return;
+
+    const AttributeTable* table = ClassAttributeTable();
+    while (source.NextKey())
+    {
+        if (!LoadJSONAttribute(source, resolver, table))
+            source.SkipValue();
+    }
+}
+
+bool Serializable::LoadJSONAttribute(JSONReader& source, ObjectResolver& resolver)
+{
+    return LoadJSONAttribute(source, resolver, ClassAttributeTable());
+}
+
+bool Serializable::LoadJSONAttribute(JSONReader& source, ObjectResolver& resolver, const AttributeTable* table)
+{
+    if (!table)
+    {
+        Attribute* attr = FindAttribute(source.Key());
+        if (!attr)
+            return false;
+
+        // Store object refs to the resolver instead of immediately setting
+        if (attr->Type() != ATTR_OBJECTREF)
+            attr->FromJSON(this, source);
+        else
+            resolver.StoreObjectRef(this, attr, ObjectRef((unsigned)source.ReadNumber()));
+
+        return true;
+    }
+
+    const AttributeTableEntry* entry = table->Find(source.Key().c_str());
+    if (!entry)
+        return false;
+
+    // Member attributes are read directly to the variable, others through the accessor
+    if (entry->type == ATTR_OBJECTREF)
+        resolver.StoreObjectRef(this, entry->attribute, ObjectRef((unsigned)source.ReadNumber()));
+    else if (entry->offset != ATTR_NO_OFFSET)
+        Attribute::FromJSON(entry->type, reinterpret_cast<unsigned char*>(this) + entry->offset, source);
+    else
+        entry->attribute->FromJSON(this, source);
+
+    return true;
+}
+
 void Serializable::SaveJSON(JSONValue& dest)
 {
     const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
@@ -94,10 +148,30 @@ void Serializable::SaveJSON(JSONValue& dest)
     }
 }
 
+void Serializable::SaveJSON(JSONWriter& dest)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    if (!attributes)
+        return;
+
+    for (size_t i = 0; i < attributes->size(); ++i)
+    {
+        Attribute* attr = attributes->at(i);
+        if (!attr->IsDefault(this))
+        {
+            dest.Key(attr->Name());
+            attr->ToJSON(this, dest);
+        }
+    }
+}
+
 void Serializable::SetAttributeValue(Attribute* attr, const void* source)
 {
     if (attr)
+    {
         attr->FromValue(this, source);
+        OnAttributeSet(attr);
+    }
 }
 
 void Serializable::AttributeValue(Attribute* attr, void* dest)
@@ -109,7 +183,14 @@ void Serializable::AttributeValue(Attribute* attr, void* dest)
 const std::vector<SharedPtr<Attribute> >* Serializable::Attributes() const
 {
     auto it = classAttributes.find(Type());
-    return it != classAttributes.end() ? &it->second : nullptr;
+    return it != classAttributes.end() ? &it->second.attributes : nullptr;
+}
+
+const AttributeTable* Serializable::ClassAttributeTable() const
+{
+    // A subclass may replace the per-class attributes, in which case the table does not apply
+    const AttributeTable* table = FindAttributeTable(Type());
+    return (table && Attributes() == &table->attributes) ? table : nullptr;
 }
 
 Attribute* Serializable::FindAttribute(const std::string& name) const
@@ -119,6 +200,13 @@ Attribute* Serializable::FindAttribute(const std::string& name) const
 
 Attribute* Serializable::FindAttribute(const char* name) const
 {
+    const AttributeTable* table = ClassAttributeTable();
+    if (table)
+    {
+        const AttributeTableEntry* entry = table->Find(name);
+        return entry ? entry->attribute : nullptr;
+    }
+
     const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
     if (!attributes)
         return nullptr;
@@ -135,17 +223,17 @@ Attribute* Serializable::FindAttribute(const char* name) const
 
 void Serializable::RegisterAttribute(StringHash type, Attribute* attr)
 {
-    std::vector<SharedPtr<Attribute> >& attributes = classAttributes[type];
-    for (size_t i = 0; i < attributes.size(); ++i)
+    AttributeTable& table = classAttributes[type];
+    std::vector<SharedPtr<Attribute> >& attributes = table.attributes;
+    size_t i = 0;
+    for (; i < attributes.size(); ++i)
     {
         if (attributes[i]->Name() == attr->Name())
-        {
-            attributes.insert(attributes.begin() + i, attr);
-            return;
-        }
+            break;
     }
     
-    attributes.push_back(attr);
+    attributes.insert(attributes.begin() + i, attr);
+    table.Compile();
 }
 
 void Serializable::CopyBaseAttributes(StringHash type, StringHash baseType)
@@ -153,7 +241,7 @@ void Serializable::CopyBaseAttributes(StringHash type, StringHash baseType)
     // Make sure the types are different, which may not be true if the OBJECT macro has been omitted
     if (type != baseType)
     {
-        std::vector<SharedPtr<Attribute> >& attributes = classAttributes[baseType];
+        std::vector<SharedPtr<Attribute> >& attributes = classAttributes[baseType].attributes;
         for (size_t i = 0; i < attributes.size(); ++i)
             RegisterAttribute(type, attributes[i]);
     }
@@ -164,7 +252,7 @@ void Serializable::CopyBaseAttribute(StringHash type, StringHash baseType, const
     // Make sure the types are different, which may not be true if the OBJECT macro has been omitted
     if (type != baseType)
     {
-        std::vector<SharedPtr<Attribute> >& attributes = classAttributes[baseType];
+        std::vector<SharedPtr<Attribute> >& attributes = classAttributes[baseType].attributes;
         for (size_t i = 0; i < attributes.size(); ++i)
         {
             if (attributes[i]->Name() == name)
@@ -176,6 +264,12 @@ void Serializable::CopyBaseAttribute(StringHash type, StringHash baseType, const
     }
 }
 
+const AttributeTable* Serializable::FindAttributeTable(StringHash type)
+{
+    auto it = classAttributes.find(type);
+    return it != classAttributes.end() ? &it->second : nullptr;
+}
+
 void Serializable::Skip(Stream& source)
 {
     size_t numAttrs = source.ReadVLE();
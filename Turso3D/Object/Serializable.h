@@ -5,6 +5,8 @@
 #include "Attribute.h"
 #include "Object.h"
 
+class JSONReader;
+class JSONWriter;
 class ObjectResolver;
 
 /// Base class for objects with automatic serialization using attributes.
@@ -17,11 +19,20 @@ public:
     virtual void Save(Stream& dest);
     /// Load from JSON data. Optionally store object ref attributes to be resolved later.
     virtual void LoadJSON(const JSONValue& source, ObjectResolver& resolver);
+    /// Load from a streaming JSON reader positioned at an object, consuming the object. Unknown keys are skipped. Optionally store object ref attributes to be resolved later.
+    virtual void LoadJSON(JSONReader& source, ObjectResolver& resolver);
     /// Save as JSON data.
     virtual void SaveJSON(JSONValue& dest);
+    /// Save the attributes as keys of the object being written by a streaming JSON writer.
+    virtual void SaveJSON(JSONWriter& dest);
     /// Return id for referring to the object in serialization.
     virtual unsigned Id() const { return 0; }
 
+    /// Load the attribute named by the current key of a streaming JSON reader. Return false if there is no such attribute, in which case the value is not consumed.
+    bool LoadJSONAttribute(JSONReader& source, ObjectResolver& resolver);
+    /// Load the attribute named by the current key of a streaming JSON reader, using an attribute table from ClassAttributeTable() that was looked up in advance. If the table is null, fall back to FindAttribute(). Return false if there is no such attribute.
+    bool LoadJSONAttribute(JSONReader& source, ObjectResolver& resolver, const AttributeTable* table);
+
     /// Set attribute value from memory.
     void SetAttributeValue(Attribute* attr, const void* source);
     /// Copy attribute value to memory.
@@ -34,6 +45,7 @@ public:
         if (typedAttr)
         {
             typedAttr->SetValue(this, source);
+            OnAttributeSet(attr);
             return true;
         }
         else
@@ -66,6 +78,8 @@ public:
     Attribute* FindAttribute(const std::string& name) const;
     /// Return an attribute description by name, or null if does not exist.
     Attribute* FindAttribute(const char* name) const;
+    /// Return the compiled attribute table if the attributes come from per-class registration, or null otherwise.
+    const AttributeTable* ClassAttributeTable() const;
     
     /// Register a per-class attribute. If an attribute with the same name already exists, it will be replaced.
     static void RegisterAttribute(StringHash type, Attribute* attr);
@@ -73,6 +87,8 @@ public:
     static void CopyBaseAttributes(StringHash type, StringHash baseType);
     /// Copy one base class attribute.
     static void CopyBaseAttribute(StringHash type, StringHash baseType, const std::string& name);
+    /// Return the per-class attribute table of a type, or null if it has no registered attributes.
+    static const AttributeTable* FindAttributeTable(StringHash type);
     /// Skip binary data of an object's all attributes.
     static void Skip(Stream& source);
     
@@ -88,6 +104,16 @@ public:
         RegisterAttribute(T::TypeStatic(), new AttributeImpl<U>(name, new RefAttributeAccessorImpl<T, U>(getFunction, setFunction), defaultValue, enumNames));
     }
 
+    /// Register a per-class attribute that is accessed directly as a member variable, template version. Loading writes the member without virtual calls, so only use for fixed-size variables which need no setter side effects. Should not be used for base class attributes unless the type is explicitly specified.
+    template <class T, class U> static void RegisterMemberAttribute(const char* name, U T::*member, const U& defaultValue = U(), const char** enumNames = 0)
+    {
+        AttributeImpl<U>* attr = new AttributeImpl<U>(name, new MemberAttributeAccessorImpl<T, U>(member), defaultValue, enumNames);
+        // Calculate the offset relative to the Serializable base from a dummy address, as casting a null pointer would not adjust it
+        T* dummy = reinterpret_cast<T*>(alignof(T) * 16);
+        attr->SetOffset(reinterpret_cast<unsigned char*>(&(dummy->*member)) - reinterpret_cast<unsigned char*>(static_cast<Serializable*>(dummy)));
+        RegisterAttribute(T::TypeStatic(), attr);
+    }
+
     /// Register a per-class attribute with mixed reference access, template version. Should not be used for base class attributes unless the type is explicitly specified, as by default the attribute will be re-registered to the base class redundantly.
     template <class T, class U> static void RegisterMixedRefAttribute(const char* name, U (T::*getFunction)() const, void (T::*setFunction)(const U&), const U& defaultValue = U(), const char** enumNames = 0)
     {
@@ -105,8 +131,12 @@ public:
     {
         CopyBaseAttribute(T::TypeStatic(), U::TypeStatic(), name);
     }
-    
+
+protected:
+    /// Handle an attribute value being set through SetAttributeValue().
+    virtual void OnAttributeSet(Attribute* /*attr*/) {}
+
 private:
-    /// Per-class attributes.
-    static std::map<StringHash, std::vector<SharedPtr<Attribute> > > classAttributes;
+    /// Per-class attribute tables.
+    static std::map<StringHash, AttributeTable> classAttributes;
 };
@@ -0,0 +1,304 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Sphere.h"
+#include "AnimatedModel.h"
+#include "Animation.h"
+#include "Material.h"
+#include "Model.h"
+#include "Octree.h"
+#include "Renderer.h"
+
+#include <thread>
+
+BoneNode::BoneNode()
+{
+}
+
+BoneNode::~BoneNode()
+{
+}
+
+void BoneNode::RegisterObject()
+{
+    RegisterFactory<BoneNode>();
+    RegisterDerivedType<BoneNode, SpatialNode>();
+    CopyBaseAttributes<BoneNode, SpatialNode>();
+}
+
+void BoneNode::SetAnimatedModel(AnimatedModel* model_)
+{
+    model = model_;
+}
+
+void BoneNode::OnTransformChanged()
+{
+    SpatialNode::OnTransformChanged();
+
+    AnimatedModel* animatedModel = model.Get();
+    if (animatedModel)
+        animatedModel->OnBoneTransformChanged();
+}
+
+AnimatedModel::AnimatedModel() :
+    paletteOffset(M_MAX_UNSIGNED),
+    claimedGeneration(0),
+    readyGeneration(0),
+    preSkinned(false)
+{
+}
+
+AnimatedModel::~AnimatedModel()
+{
+    for (auto it = boneNodes.begin(); it != boneNodes.end(); ++it)
+    {
+        if (*it)
+            (*it)->SetAnimatedModel(nullptr);
+    }
+}
+
+void AnimatedModel::RegisterObject()
+{
+    RegisterFactory<AnimatedModel>();
+    CopyBaseAttributes<AnimatedModel, StaticModel>();
+    RegisterDerivedType<AnimatedModel, StaticModel>();
+}
+
+bool AnimatedModel::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    if (!StaticModel::OnPrepareRender(frameNumber, camera))
+        return false;
+
+    return UpdateSkinning();
+}
+
+void AnimatedModel::SetModel(Model* model_)
+{
+    // The tracks are bound by bone index, so the states need to be recreated for a new skeleton
+    RemoveAllAnimationStates();
+    RemoveBoneNodes();
+    StaticModel::SetModel(model_);
+    CreateBoneNodes();
+}
+
+AnimationState* AnimatedModel::AddAnimationState(Animation* animation)
+{
+    if (!animation || !GetModel())
+        return nullptr;
+
+    AnimationState* existing = FindAnimationState(animation);
+    if (existing)
+        return existing;
+
+    AnimationState* state = new AnimationState(this, animation);
+    animationStates.push_back(state);
+    return state;
+}
+
+void AnimatedModel::RemoveAnimationState(Animation* animation)
+{
+    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    {
+        if ((*it)->GetAnimation() == animation)
+        {
+            animationStates.erase(it);
+            return;
+        }
+    }
+}
+
+void AnimatedModel::RemoveAllAnimationStates()
+{
+    animationStates.clear();
+}
+
+void AnimatedModel::UpdateAnimation(float timeStep)
+{
+    Model* model = GetModel();
+    if (!model || animationStates.empty())
+        return;
+
+    const std::vector<Bone>& bones = model->Bones();
+    boneTransforms.resize(bones.size());
+    animatedBones.resize(bones.size());
+
+    // Blend on top of the bind pose, so that a partial weight or partial skeleton coverage does not accumulate over frames
+    for (size_t i = 0; i < bones.size(); ++i)
+    {
+        BoneTransform& transform = boneTransforms[i];
+        transform.position = bones[i].initialPosition;
+        transform.rotation = bones[i].initialRotation;
+        transform.scale = bones[i].initialScale;
+        animatedBones[i] = 0;
+    }
+
+    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    {
+        AnimationState* state = *it;
+        state->AddTime(timeStep * state->Speed());
+        state->Apply(boneTransforms, animatedBones);
+    }
+
+    for (size_t i = 0; i < bones.size() && i < boneNodes.size(); ++i)
+    {
+        BoneNode* boneNode = boneNodes[i].Get();
+        if (animatedBones[i] && boneNode)
+        {
+            const BoneTransform& transform = boneTransforms[i];
+            boneNode->SetTransform(transform.position, transform.rotation, transform.scale);
+        }
+    }
+}
+
+BoneNode* AnimatedModel::FindBoneNode(const std::string& name) const
+{
+    for (auto it = boneNodes.begin(); it != boneNodes.end(); ++it)
+    {
+        if (*it && (*it)->Name() == name)
+            return it->Get();
+    }
+
+    return nullptr;
+}
+
+AnimationState* AnimatedModel::FindAnimationState(Animation* animation) const
+{
+    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    {
+        if ((*it)->GetAnimation() == animation)
+            return it->Get();
+    }
+
+    return nullptr;
+}
+
+void AnimatedModel::OnBoneTransformChanged()
+{
+    SetFlag(NF_BOUNDING_BOX_DIRTY, true);
+
+    Octree* octree = GetOctree();
+    if (!TestFlag(NF_OCTREE_UPDATE_QUEUED) && Parent() && octree)
+        octree->QueueUpdate(this);
+}
+
+void AnimatedModel::OnWorldBoundingBoxUpdate() const
+{
+    Model* model = GetModel();
+    if (!model || boneNodes.empty())
+    {
+        StaticModel::OnWorldBoundingBoxUpdate();
+        return;
+    }
+
+    // Merge the bone collision volumes. Bones without them do not affect the bounds
+    const std::vector<Bone>& bones = model->Bones();
+    BoundingBox box;
+    for (size_t i = 0; i < bones.size() && i < boneNodes.size(); ++i)
+    {
+        const Bone& bone = bones[i];
+        BoneNode* boneNode = boneNodes[i].Get();
+        if (!boneNode)
+            continue;
+
+        if (bone.boundingBox.IsDefined())
+            box.Merge(bone.boundingBox.Transformed(boneNode->WorldTransform()));
+        else if (bone.radius > 0.0f)
+            box.Merge(Sphere(boneNode->WorldPosition(), bone.radius));
+    }
+
+    if (box.IsDefined())
+    {
+        worldBoundingBox = box;
+        SetFlag(NF_BOUNDING_BOX_DIRTY, false);
+    }
+    else
+        StaticModel::OnWorldBoundingBoxUpdate();
+}
+
+const BoundingBox* AnimatedModel::LocalBoundingBox() const
+{
+    return nullptr;
+}
+
+void AnimatedModel::CreateBoneNodes()
+{
+    Model* model = GetModel();
+    if (!model)
+        return;
+
+    const std::vector<Bone>& bones = model->Bones();
+    boneNodes.resize(bones.size());
+    for (size_t i = 0; i < bones.size(); ++i)
+    {
+        const Bone& bone = bones[i];
+
+        BoneNode* boneNode = CreateChild<BoneNode>(bone.name);
+        boneNode->SetTemporary(true);
+        boneNode->SetTransform(bone.initialPosition, bone.initialRotation, bone.initialScale);
+        boneNode->SetAnimatedModel(this);
+        boneNodes[i] = boneNode;
+    }
+
+    // Parent bones may come after their children, so build the hierarchy once all exist
+    for (size_t i = 0; i < bones.size(); ++i)
+    {
+        size_t parentIndex = bones[i].parentIndex;
+        if (parentIndex != i && parentIndex < boneNodes.size())
+            boneNodes[i]->SetParent(boneNodes[parentIndex]);
+    }
+}
+
+void AnimatedModel::RemoveBoneNodes()
+{
+    // Removing a bone removes its children too, which leaves their weak pointers null
+    for (auto it = boneNodes.begin(); it != boneNodes.end(); ++it)
+    {
+        BoneNode* boneNode = it->Get();
+        if (boneNode)
+        {
+            boneNode->SetAnimatedModel(nullptr);
+            boneNode->RemoveSelf();
+        }
+    }
+
+    boneNodes.clear();
+}
+
+bool AnimatedModel::UpdateSkinning()
+{
+    Renderer* renderer = Subsystem<Renderer>();
+    unsigned generation = renderer ? renderer->BonePaletteGeneration() : 0;
+    Model* model = GetModel();
+    if (!generation || !model || boneNodes.empty())
+        return false;
+
+    // The first caller of the view calculates the matrices, while the others, such as shadow views of other lights, wait for them
+    if (claimedGeneration.exchange(generation) == generation)
+    {
+        while (readyGeneration.load(std::memory_order_acquire) != generation)
+            std::this_thread::yield();
+        return paletteOffset != M_MAX_UNSIGNED;
+    }
+
+    // The matrices are in world space, so that the skinned vertices need no further transform
+    const std::vector<Bone>& bones = model->Bones();
+    Matrix3x4* dest = renderer->AllocateBonePalette(bones.size(), paletteOffset);
+    if (dest)
+    {
+        for (size_t i = 0; i < bones.size(); ++i)
+        {
+            BoneNode* boneNode = i < boneNodes.size() ? boneNodes[i].Get() : nullptr;
+            dest[i] = (boneNode ? boneNode->WorldTransform() : WorldTransform()) * bones[i].offsetMatrix;
+        }
+    }
+    else
+        paletteOffset = M_MAX_UNSIGNED;
+
+    // Batches reused from earlier views hold the geometry and program, so they must be recollected when switching between skinning methods
+    bool wasPreSkinned = preSkinned;
+    preSkinned = dest && renderer->AllocateSkinnedGeometries(Batches(), skinnedGeometries, paletteOffset, WorldTransform());
+    if (preSkinned != wasPreSkinned)
+        SourceBatches::MarkLodChanged();
+
+    readyGeneration.store(generation, std::memory_order_release);
+    return dest != nullptr;
+}
@@ -0,0 +1,124 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "AnimationState.h"
+#include "StaticModel.h"
+
+#include <atomic>
+
+class AnimatedModel;
+
+/// %Scene node for a bone of an animated model's skeleton. Notifies the model when moved.
+class BoneNode : public SpatialNode
+{
+    OBJECT(BoneNode);
+
+public:
+    /// Construct.
+    BoneNode();
+    /// Destruct.
+    ~BoneNode();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Set the animated model to notify of transform changes.
+    void SetAnimatedModel(AnimatedModel* model);
+
+    /// Return the animated model, or null if detached.
+    AnimatedModel* GetAnimatedModel() const { return model.Get(); }
+
+protected:
+    /// Handle the transform matrix changing.
+    void OnTransformChanged() override;
+
+private:
+    /// Animated model to notify.
+    WeakPtr<AnimatedModel> model;
+};
+
+/// %Scene node that renders a skinned model. The skin matrices are calculated from the bone nodes once per view when preparing to render, and written to the renderer's bone palette for GPU skinning.
+class AnimatedModel : public StaticModel
+{
+    OBJECT(AnimatedModel);
+
+public:
+    /// Construct.
+    AnimatedModel();
+    /// Destruct.
+    ~AnimatedModel();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Prepare object for rendering. Check for LOD level changes and calculate the skin matrices if not yet done for the view. Called by Renderer, possibly several times per view in different threads. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+
+    /// Set the model resource and create the bone nodes of its skeleton as temporary child nodes.
+    void SetModel(Model* model) override;
+
+    /// Add an animation to play and return its state. Later states blend over the earlier ones.
+    AnimationState* AddAnimationState(Animation* animation);
+    /// Remove an animation state by animation.
+    void RemoveAnimationState(Animation* animation);
+    /// Remove all animation states.
+    void RemoveAllAnimationStates();
+    /// Advance the animation states by the time step and write the blended result into the animated bone nodes. Bones without tracks are left as they are. Touches only this model and its bones, so different models can be updated in parallel.
+    void UpdateAnimation(float timeStep);
+
+    /// Return geometry type.
+    GeometryType GetGeometryType() const override { return GEOM_SKINNED; }
+    /// Return per-object shader data, which holds the bone palette offset of the current view.
+    Vector4 InstanceData() const override { return Vector4((float)paletteOffset, 0.0f, 0.0f, 0.0f); }
+    /// Return the geometry pre-skinned in a compute shader for the current view by index, or null if skinned in the vertex shader.
+    Geometry* SkinnedGeometry(size_t index) const { return preSkinned && index < skinnedGeometries.size() ? skinnedGeometries[index].Get() : nullptr; }
+    /// Return number of bones.
+    size_t NumBones() const { return boneNodes.size(); }
+    /// Return bone node by index, or null if removed.
+    BoneNode* GetBoneNode(size_t index) const { return index < boneNodes.size() ? boneNodes[index].Get() : nullptr; }
+    /// Return bone node by name, or null if not found.
+    BoneNode* FindBoneNode(const std::string& name) const;
+    /// Return number of animation states.
+    size_t NumAnimationStates() const { return animationStates.size(); }
+    /// Return animation state by index.
+    AnimationState* GetAnimationState(size_t index) const { return index < animationStates.size() ? animationStates[index].Get() : nullptr; }
+    /// Return animation state by animation, or null if not found.
+    AnimationState* FindAnimationState(Animation* animation) const;
+
+    /// Handle a bone node moving. Called by BoneNode.
+    void OnBoneTransformChanged();
+
+protected:
+    /// Recalculate the world space bounding box from the bones.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Return null, as the world space bounding box follows the bones.
+    const BoundingBox* LocalBoundingBox() const override;
+
+private:
+    /// Create the bone nodes for the model's skeleton.
+    void CreateBoneNodes();
+    /// Remove the bone nodes.
+    void RemoveBoneNodes();
+    /// Calculate the skin matrices into the bone palette of the current view. Return false if the palette is out of space.
+    bool UpdateSkinning();
+
+    /// Bone nodes by skeleton bone index.
+    std::vector<WeakPtr<BoneNode> > boneNodes;
+    /// Bone palette offset of the current view in matrices.
+    unsigned paletteOffset;
+    /// Bone palette generation claimed for calculating the skin matrices.
+    std::atomic<unsigned> claimedGeneration;
+    /// Bone palette generation whose skin matrices are complete.
+    std::atomic<unsigned> readyGeneration;
+    /// Geometries pre-skinned by the renderer, which point to its transient vertex buffers.
+    std::vector<SharedPtr<Geometry> > skinnedGeometries;
+    /// Whether the skinned geometries are valid for the current view.
+    bool preSkinned;
+    /// Animation states.
+    std::vector<SharedPtr<AnimationState> > animationStates;
+    /// Local bone transforms for animation blending.
+    std::vector<BoneTransform> boneTransforms;
+    /// Per-bone flags of being affected by animation tracks.
+    std::vector<unsigned char> animatedBones;
+};
@@ -0,0 +1,330 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../IO/Stream.h"
+#include "../Time/Profiler.h"
+#include "Animation.h"
+
+#include <algorithm>
+
+/// Largest magnitude of the three smallest components of a unit quaternion.
+static const float ROTATION_COMPONENT_RANGE = 0.70710678f;
+
+static bool CompareKeyFrames(const AnimationKeyFrame& lhs, const AnimationKeyFrame& rhs)
+{
+    return lhs.time < rhs.time;
+}
+
+static unsigned short QuantizeUnit(float value, unsigned maxValue)
+{
+    return (unsigned short)(Clamp(value, 0.0f, 1.0f) * maxValue + 0.5f);
+}
+
+static void QuantizeRange(std::vector<unsigned short>& dest, const Vector3& value, const Vector3& min, const Vector3& step)
+{
+    dest.push_back(step.x > 0.0f ? QuantizeUnit((value.x - min.x) / (step.x * 65535.0f), 65535) : 0);
+    dest.push_back(step.y > 0.0f ? QuantizeUnit((value.y - min.y) / (step.y * 65535.0f), 65535) : 0);
+    dest.push_back(step.z > 0.0f ? QuantizeUnit((value.z - min.z) / (step.z * 65535.0f), 65535) : 0);
+}
+
+static void CalculateRange(const std::vector<AnimationKeyFrame>& keyFrames, bool scale, Vector3& min, Vector3& step)
+{
+    Vector3 max(-M_INFINITY, -M_INFINITY, -M_INFINITY);
+    min = Vector3(M_INFINITY, M_INFINITY, M_INFINITY);
+
+    for (auto it = keyFrames.begin(); it != keyFrames.end(); ++it)
+    {
+        const Vector3& value = scale ? it->scale : it->position;
+        min = Vector3(Min(min.x, value.x), Min(min.y, value.y), Min(min.z, value.z));
+        max = Vector3(Max(max.x, value.x), Max(max.y, value.y), Max(max.z, value.z));
+    }
+
+    step = (max - min) / 65535.0f;
+}
+
+static void QuantizeRotation(std::vector<unsigned short>& dest, Quaternion rotation)
+{
+    rotation.Normalize();
+    float components[4] = { rotation.w, rotation.x, rotation.y, rotation.z };
+
+    unsigned largest = 0;
+    for (unsigned i = 1; i < 4; ++i)
+    {
+        if (Abs(components[i]) > Abs(components[largest]))
+            largest = i;
+    }
+
+    // q and -q are the same rotation, so make the dropped component positive to reconstruct it with a square root
+    float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+    unsigned short values[3];
+    for (unsigned i = 0, j = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+        float unit = (components[i] * sign / ROTATION_COMPONENT_RANGE) * 0.5f + 0.5f;
+        values[j] = QuantizeUnit(unit, j < 2 ? 32767 : 65535);
+        ++j;
+    }
+
+    dest.push_back((unsigned short)(((largest >> 1) << 15) | values[0]));
+    dest.push_back((unsigned short)(((largest & 1) << 15) | values[1]));
+    dest.push_back(values[2]);
+}
+
+AnimationTrack::AnimationTrack() :
+    channelMask(0)
+{
+}
+
+void AnimationTrack::SetKeyFrames(unsigned char channelMask_, const std::vector<AnimationKeyFrame>& keyFrames)
+{
+    channelMask = channelMask_;
+    keyTimes.resize(keyFrames.size());
+    positions.clear();
+    rotations.clear();
+    scales.clear();
+
+    for (size_t i = 0; i < keyFrames.size(); ++i)
+        keyTimes[i] = keyFrames[i].time;
+
+    if (channelMask & CHANNEL_POSITION)
+    {
+        CalculateRange(keyFrames, false, positionMin, positionStep);
+        positions.reserve(keyFrames.size() * 3);
+        for (auto it = keyFrames.begin(); it != keyFrames.end(); ++it)
+            QuantizeRange(positions, it->position, positionMin, positionStep);
+    }
+    if (channelMask & CHANNEL_ROTATION)
+    {
+        rotations.reserve(keyFrames.size() * 3);
+        for (auto it = keyFrames.begin(); it != keyFrames.end(); ++it)
+            QuantizeRotation(rotations, it->rotation);
+    }
+    if (channelMask & CHANNEL_SCALE)
+    {
+        CalculateRange(keyFrames, true, scaleMin, scaleStep);
+        scales.reserve(keyFrames.size() * 3);
+        for (auto it = keyFrames.begin(); it != keyFrames.end(); ++it)
+            QuantizeRange(scales, it->scale, scaleMin, scaleStep);
+    }
+}
+
+size_t AnimationTrack::FindKey(float time, size_t hint) const
+{
+    if (keyTimes.empty())
+        return 0;
+
+    if (hint >= keyTimes.size() || keyTimes[hint] > time)
+        hint = 0;
+
+    // Check the next few keys before falling back to a binary search
+    for (size_t i = 0; i < 4 && hint + 1 < keyTimes.size(); ++i)
+    {
+        if (keyTimes[hint + 1] > time)
+            return hint;
+        ++hint;
+    }
+
+    if (hint + 1 >= keyTimes.size())
+        return hint;
+
+    auto it = std::upper_bound(keyTimes.begin() + hint, keyTimes.end(), time);
+    return (size_t)(it - keyTimes.begin()) - 1;
+}
+
+void AnimationTrack::Sample(float time, float length, bool looped, size_t& keyHint, Vector3& position, Quaternion& rotation, Vector3& scale) const
+{
+    if (keyTimes.empty())
+        return;
+
+    size_t key = FindKey(time, keyHint);
+    keyHint = key;
+
+    size_t nextKey = key + 1;
+    bool interpolate = true;
+    float t = 0.0f;
+
+    if (nextKey >= keyTimes.size())
+    {
+        if (!looped || keyTimes.size() < 2)
+            interpolate = false;
+        else
+        {
+            // Interpolate from the last key back to the first over the remaining animation length
+            nextKey = 0;
+            float span = length - keyTimes[key] + keyTimes[0];
+            t = span > 0.0f ? (time - keyTimes[key]) / span : 0.0f;
+        }
+    }
+    else
+    {
+        float span = keyTimes[nextKey] - keyTimes[key];
+        t = span > 0.0f ? (time - keyTimes[key]) / span : 0.0f;
+    }
+
+    t = Clamp(t, 0.0f, 1.0f);
+    if (t == 0.0f)
+        interpolate = false;
+
+    if (channelMask & CHANNEL_POSITION)
+        position = interpolate ? KeyPosition(key).Lerp(KeyPosition(nextKey), t) : KeyPosition(key);
+    if (channelMask & CHANNEL_ROTATION)
+        rotation = interpolate ? KeyRotation(key).Nlerp(KeyRotation(nextKey), t, true) : KeyRotation(key);
+    if (channelMask & CHANNEL_SCALE)
+        scale = interpolate ? KeyScale(key).Lerp(KeyScale(nextKey), t) : KeyScale(key);
+}
+
+Vector3 AnimationTrack::KeyPosition(size_t index) const
+{
+    const unsigned short* src = &positions[index * 3];
+    return Vector3(positionMin.x + src[0] * positionStep.x, positionMin.y + src[1] * positionStep.y, positionMin.z + src[2] * positionStep.z);
+}
+
+Quaternion AnimationTrack::KeyRotation(size_t index) const
+{
+    const unsigned short* src = &rotations[index * 3];
+    unsigned largest = ((src[0] >> 15) << 1) | (src[1] >> 15);
+
+    float values[3] = {
+        ((src[0] & 0x7fff) / 32767.0f * 2.0f - 1.0f) * ROTATION_COMPONENT_RANGE,
+        ((src[1] & 0x7fff) / 32767.0f * 2.0f - 1.0f) * ROTATION_COMPONENT_RANGE,
+        (src[2] / 65535.0f * 2.0f - 1.0f) * ROTATION_COMPONENT_RANGE
+    };
+
+    float components[4];
+    float sumSquares = 0.0f;
+    for (unsigned i = 0, j = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+        components[i] = values[j++];
+        sumSquares += components[i] * components[i];
+    }
+    components[largest] = sqrtf(Max(1.0f - sumSquares, 0.0f));
+
+    return Quaternion(components[0], components[1], components[2], components[3]);
+}
+
+Vector3 AnimationTrack::KeyScale(size_t index) const
+{
+    const unsigned short* src = &scales[index * 3];
+    return Vector3(scaleMin.x + src[0] * scaleStep.x, scaleMin.y + src[1] * scaleStep.y, scaleMin.z + src[2] * scaleStep.z);
+}
+
+Animation::Animation() :
+    length(0.0f)
+{
+}
+
+Animation::~Animation()
+{
+}
+
+void Animation::RegisterObject()
+{
+    RegisterFactory<Animation>();
+}
+
+bool Animation::BeginLoad(Stream& source)
+{
+    PROFILE(BeginLoadAnimation);
+
+    std::string fileID = source.ReadFileID();
+    if (fileID != "UANI")
+    {
+        LOGERROR(source.Name() + " is not a valid animation file");
+        return false;
+    }
+
+    RemoveAllTracks();
+    animationName = source.Read<std::string>();
+    length = source.Read<float>();
+    unsigned numTracks = source.Read<unsigned>();
+    tracks.reserve(numTracks);
+
+    std::vector<AnimationKeyFrame> keyFrames;
+
+    for (unsigned i = 0; i < numTracks; ++i)
+    {
+        std::string trackName = source.Read<std::string>();
+        unsigned char channelMask = source.Read<unsigned char>();
+        unsigned numKeyFrames = source.Read<unsigned>();
+
+        keyFrames.resize(numKeyFrames);
+        for (unsigned j = 0; j < numKeyFrames; ++j)
+        {
+            AnimationKeyFrame& keyFrame = keyFrames[j];
+            keyFrame.time = source.Read<float>();
+            keyFrame.position = Vector3::ZERO;
+            keyFrame.rotation = Quaternion::IDENTITY;
+            keyFrame.scale = Vector3::ONE;
+            if (channelMask & CHANNEL_POSITION)
+                keyFrame.position = source.Read<Vector3>();
+            if (channelMask & CHANNEL_ROTATION)
+                keyFrame.rotation = source.Read<Quaternion>();
+            if (channelMask & CHANNEL_SCALE)
+                keyFrame.scale = source.Read<Vector3>();
+        }
+
+        AddTrack(trackName, channelMask, keyFrames);
+    }
+
+    return true;
+}
+
+size_t Animation::CpuMemoryUse() const
+{
+    size_t memoryUse = tracks.capacity() * sizeof(AnimationTrack);
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        memoryUse += it->keyTimes.capacity() * sizeof(float);
+        memoryUse += (it->positions.capacity() + it->rotations.capacity() + it->scales.capacity()) * sizeof(unsigned short);
+    }
+    return memoryUse;
+}
+
+void Animation::SetAnimationName(const std::string& name)
+{
+    animationName = name;
+}
+
+void Animation::SetLength(float length_)
+{
+    length = Max(length_, 0.0f);
+}
+
+AnimationTrack* Animation::AddTrack(const std::string& name, unsigned char channelMask, const std::vector<AnimationKeyFrame>& keyFrames)
+{
+    tracks.resize(tracks.size() + 1);
+    AnimationTrack& track = tracks.back();
+    track.name = name;
+    track.nameHash = StringHash(name);
+
+    if (std::is_sorted(keyFrames.begin(), keyFrames.end(), CompareKeyFrames))
+        track.SetKeyFrames(channelMask, keyFrames);
+    else
+    {
+        std::vector<AnimationKeyFrame> sortedKeyFrames(keyFrames);
+        std::stable_sort(sortedKeyFrames.begin(), sortedKeyFrames.end(), CompareKeyFrames);
+        track.SetKeyFrames(channelMask, sortedKeyFrames);
+    }
+
+    return &track;
+}
+
+void Animation::RemoveAllTracks()
+{
+    tracks.clear();
+}
+
+const AnimationTrack* Animation::FindTrack(const std::string& name) const
+{
+    StringHash nameHash(name);
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        if (it->nameHash == nameHash)
+            return &*it;
+    }
+
+    return nullptr;
+}
@@ -0,0 +1,121 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/StringHash.h"
+#include "../Math/Quaternion.h"
+#include "../Math/Vector3.h"
+#include "../Resource/Resource.h"
+
+#include <vector>
+
+static const unsigned char CHANNEL_POSITION = 0x1;
+static const unsigned char CHANNEL_ROTATION = 0x2;
+static const unsigned char CHANNEL_SCALE = 0x4;
+
+/// Uncompressed animation keyframe, for defining tracks.
+struct AnimationKeyFrame
+{
+    /// Time in seconds.
+    float time;
+    /// Bone position.
+    Vector3 position;
+    /// Bone rotation.
+    Quaternion rotation;
+    /// Bone scale.
+    Vector3 scale;
+};
+
+/// Animation track of one bone. Each channel of a keyframe is quantized to 48 bits: positions and scales to 16 bits per component within the track's range, and rotations to the three smallest components.
+struct AnimationTrack
+{
+    /// Construct.
+    AnimationTrack();
+
+    /// Compress keyframes sorted by time into the track, replacing the old.
+    void SetKeyFrames(unsigned char channelMask, const std::vector<AnimationKeyFrame>& keyFrames);
+    /// Return the index of the last key at or before the time. Searches forward from the previously returned key first, as playback mostly advances a key at a time.
+    size_t FindKey(float time, size_t hint) const;
+    /// Sample the channels of the track at time, interpolating between keys and from the last key to the first if looped. Update the key hint. Channels not in the track are left unchanged.
+    void Sample(float time, float length, bool looped, size_t& keyHint, Vector3& position, Quaternion& rotation, Vector3& scale) const;
+
+    /// Return number of keyframes.
+    size_t NumKeyFrames() const { return keyTimes.size(); }
+    /// Return decompressed position of a keyframe.
+    Vector3 KeyPosition(size_t index) const;
+    /// Return decompressed rotation of a keyframe.
+    Quaternion KeyRotation(size_t index) const;
+    /// Return decompressed scale of a keyframe.
+    Vector3 KeyScale(size_t index) const;
+
+    /// Bone name.
+    std::string name;
+    /// Bone name hash.
+    StringHash nameHash;
+    /// Channels present.
+    unsigned char channelMask;
+    /// Keyframe times.
+    std::vector<float> keyTimes;
+    /// Quantized positions, three components per keyframe.
+    std::vector<unsigned short> positions;
+    /// Quantized rotations, three components per keyframe.
+    std::vector<unsigned short> rotations;
+    /// Quantized scales, three components per keyframe.
+    std::vector<unsigned short> scales;
+    /// Position range minimum.
+    Vector3 positionMin;
+    /// Position range per quantization step.
+    Vector3 positionStep;
+    /// Scale range minimum.
+    Vector3 scaleMin;
+    /// Scale range per quantization step.
+    Vector3 scaleStep;
+};
+
+/// Skeletal animation resource.
+class Animation : public Resource
+{
+    OBJECT(Animation);
+
+public:
+    /// Construct.
+    Animation();
+    /// Destruct.
+    ~Animation();
+
+    /// Register object factory.
+    static void RegisterObject();
+
+    /// Load animation from a stream in the Urho3D format. Return true on success.
+    bool BeginLoad(Stream& source) override;
+    /// Return CPU memory used by the tracks in bytes.
+    size_t CpuMemoryUse() const override;
+
+    /// Set animation name.
+    void SetAnimationName(const std::string& name);
+    /// Set length in seconds.
+    void SetLength(float length);
+    /// Add a track from keyframes, sorting them by time if necessary, and return it. The returned pointer is valid until the next track is added.
+    AnimationTrack* AddTrack(const std::string& name, unsigned char channelMask, const std::vector<AnimationKeyFrame>& keyFrames);
+    /// Remove all tracks.
+    void RemoveAllTracks();
+
+    /// Return animation name.
+    const std::string& AnimationName() const { return animationName; }
+    /// Return length in seconds.
+    float Length() const { return length; }
+    /// Return number of tracks.
+    size_t NumTracks() const { return tracks.size(); }
+    /// Return track by index.
+    const AnimationTrack* Track(size_t index) const { return index < tracks.size() ? &tracks[index] : nullptr; }
+    /// Return track by bone name, or null if not found.
+    const AnimationTrack* FindTrack(const std::string& name) const;
+
+private:
+    /// Animation name.
+    std::string animationName;
+    /// Length in seconds.
+    float length;
+    /// Tracks.
+    std::vector<AnimationTrack> tracks;
+};
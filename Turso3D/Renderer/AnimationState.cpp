@@ -0,0 +1,107 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "AnimatedModel.h"
+#include "Animation.h"
+#include "AnimationState.h"
+#include "Material.h"
+#include "Model.h"
+
+#include <cmath>
+
+AnimationState::AnimationState(AnimatedModel* model, Animation* animation_) :
+    animation(animation_),
+    time(0.0f),
+    weight(1.0f),
+    speed(1.0f),
+    looped(false)
+{
+    Model* modelResource = model ? model->GetModel() : nullptr;
+    if (!animation || !modelResource)
+        return;
+
+    const std::vector<Bone>& bones = modelResource->Bones();
+    for (size_t i = 0; i < animation->NumTracks(); ++i)
+    {
+        const AnimationTrack* track = animation->Track(i);
+        if (!track->NumKeyFrames())
+            continue;
+
+        for (size_t j = 0; j < bones.size(); ++j)
+        {
+            if (bones[j].name == track->name)
+            {
+                AnimationStateTrack stateTrack;
+                stateTrack.track = track;
+                stateTrack.boneIndex = j;
+                stateTrack.keyHint = 0;
+                tracks.push_back(stateTrack);
+                break;
+            }
+        }
+    }
+}
+
+AnimationState::~AnimationState()
+{
+}
+
+void AnimationState::SetTime(float time_)
+{
+    float length = animation ? animation->Length() : 0.0f;
+    if (looped && length > 0.0f)
+    {
+        time_ = fmodf(time_, length);
+        if (time_ < 0.0f)
+            time_ += length;
+    }
+
+    time = Clamp(time_, 0.0f, length);
+}
+
+void AnimationState::AddTime(float delta)
+{
+    SetTime(time + delta);
+}
+
+void AnimationState::SetWeight(float weight_)
+{
+    weight = Clamp(weight_, 0.0f, 1.0f);
+}
+
+void AnimationState::SetSpeed(float speed_)
+{
+    speed = speed_;
+}
+
+void AnimationState::SetLooped(bool looped_)
+{
+    looped = looped_;
+}
+
+void AnimationState::Apply(std::vector<BoneTransform>& transforms, std::vector<unsigned char>& animatedBones)
+{
+    if (!animation || weight <= 0.0f)
+        return;
+
+    float length = animation->Length();
+
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        if (it->boneIndex >= transforms.size())
+            continue;
+
+        BoneTransform& dest = transforms[it->boneIndex];
+        animatedBones[it->boneIndex] = 1;
+
+        if (weight >= 1.0f)
+            it->track->Sample(time, length, looped, it->keyHint, dest.position, dest.rotation, dest.scale);
+        else
+        {
+            BoneTransform sample = dest;
+            it->track->Sample(time, length, looped, it->keyHint, sample.position, sample.rotation, sample.scale);
+            dest.position = dest.position.Lerp(sample.position, weight);
+            dest.rotation = dest.rotation.Nlerp(sample.rotation, weight, true);
+            dest.scale = dest.scale.Lerp(sample.scale, weight);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Quaternion.h"
+#include "../Math/Vector3.h"
+#include "../Object/Ptr.h"
+
+#include <vector>
+
+class AnimatedModel;
+class Animation;
+struct AnimationTrack;
+
+/// Local transform of a bone during animation blending.
+struct BoneTransform
+{
+    /// Position.
+    Vector3 position;
+    /// Rotation.
+    Quaternion rotation;
+    /// Scale.
+    Vector3 scale;
+};
+
+/// Animation track bound to a bone of an animated model.
+struct AnimationStateTrack
+{
+    /// Track.
+    const AnimationTrack* track;
+    /// Bone index in the model's skeleton.
+    size_t boneIndex;
+    /// Key index of the previous sample, to start the next key search from.
+    size_t keyHint;
+};
+
+/// Playback state of an animation on an animated model.
+class AnimationState : public RefCounted
+{
+public:
+    /// Construct and bind the animation's tracks to the model's bones by name.
+    AnimationState(AnimatedModel* model, Animation* animation);
+    /// Destruct.
+    ~AnimationState();
+
+    /// Set playback time in seconds, clamped or wrapped to the animation length.
+    void SetTime(float time);
+    /// Advance playback time.
+    void AddTime(float delta);
+    /// Set blending weight.
+    void SetWeight(float weight);
+    /// Set playback speed multiplier.
+    void SetSpeed(float speed);
+    /// Set looping.
+    void SetLooped(bool looped);
+
+    /// Blend the animation into the local bone transforms by the weight, and mark the affected bones. Called by AnimatedModel.
+    void Apply(std::vector<BoneTransform>& transforms, std::vector<unsigned char>& animatedBones);
+
+    /// Return the animation.
+    Animation* GetAnimation() const { return animation; }
+    /// Return playback time.
+    float Time() const { return time; }
+    /// Return blending weight.
+    float Weight() const { return weight; }
+    /// Return playback speed multiplier.
+    float Speed() const { return speed; }
+    /// Return whether is looped.
+    bool IsLooped() const { return looped; }
+    /// Return number of tracks bound to bones.
+    size_t NumTracks() const { return tracks.size(); }
+
+private:
+    /// Animation.
+    SharedPtr<Animation> animation;
+    /// Bound tracks.
+    std::vector<AnimationStateTrack> tracks;
+    /// Playback time.
+    float time;
+    /// Blending weight.
+    float weight;
+    /// Playback speed multiplier.
+    float speed;
+    /// Looped flag.
+    bool looped;
+};
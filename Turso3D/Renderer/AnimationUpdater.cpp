@@ -0,0 +1,68 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Time/Profiler.h"
+#include "AnimatedModel.h"
+#include "AnimationUpdater.h"
+#include "Material.h"
+
+#include <algorithm>
+
+AnimationUpdater::AnimationUpdater() :
+    timeStep(0.0f)
+{
+}
+
+void AnimationUpdater::AddModel(AnimatedModel* model)
+{
+    if (model && model->NumAnimationStates())
+        models.push_back(model);
+}
+
+void AnimationUpdater::Update(float timeStep_)
+{
+    if (models.empty())
+        return;
+
+    PROFILE(UpdateAnimations);
+
+    timeStep = timeStep_;
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+
+    if (numThreads > 1 && models.size() > ANIMATIONS_PER_TASK)
+    {
+        size_t numTasks = (models.size() + ANIMATIONS_PER_TASK - 1) / ANIMATIONS_PER_TASK;
+        while (tasks.size() < numTasks)
+            tasks.push_back(new RangeTask<AnimationUpdater>(this, &AnimationUpdater::UpdateAnimationsWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<AnimationUpdater>* task = tasks[i];
+            task->start = i * ANIMATIONS_PER_TASK;
+            task->end = std::min((i + 1) * ANIMATIONS_PER_TASK, models.size());
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+        UpdateAnimations(0, models.size());
+
+    models.clear();
+}
+
+void AnimationUpdater::UpdateAnimationsWork(Task* task, unsigned)
+{
+    PROFILE(UpdateAnimationsWork);
+
+    RangeTask<AnimationUpdater>* rangeTask = static_cast<RangeTask<AnimationUpdater>*>(task);
+    UpdateAnimations(rangeTask->start, rangeTask->end);
+}
+
+void AnimationUpdater::UpdateAnimations(size_t start, size_t end)
+{
+    for (size_t i = start; i < end; ++i)
+        models[i]->UpdateAnimation(timeStep);
+}
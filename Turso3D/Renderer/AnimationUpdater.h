@@ -0,0 +1,42 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Thread/WorkQueue.h"
+
+#include <vector>
+
+class AnimatedModel;
+
+/// Number of animated models per animation update task.
+static const size_t ANIMATIONS_PER_TASK = 16;
+
+/// Batched animation update. Samples and blends the animation states of the added models in parallel tasks, each task handling whole models, as a model's bones are only written by its own update.
+class AnimationUpdater
+{
+public:
+    /// Construct.
+    AnimationUpdater();
+
+    /// Add an animated model to be updated.
+    void AddModel(AnimatedModel* model);
+    /// Update the animations of the added models by the time step and clear the model list. Uses the WorkQueue subsystem if available. Must be called before the octree update, and not while other threads modify the models.
+    void Update(float timeStep);
+
+    /// Return number of added models.
+    size_t NumModels() const { return models.size(); }
+
+private:
+    /// Work function to update a range of the models.
+    void UpdateAnimationsWork(Task* task, unsigned threadIndex);
+    /// Update a range of the models.
+    void UpdateAnimations(size_t start, size_t end);
+
+    /// Added models.
+    std::vector<AnimatedModel*> models;
+    /// Time step of the current update.
+    float timeStep;
+    /// Update tasks.
+    std::vector<AutoPtr<RangeTask<AnimationUpdater> > > tasks;
+};
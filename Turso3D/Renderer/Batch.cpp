@@ -1,20 +1,39 @@
 #include "../Graphics/FrameBuffer.h"
+#include "../Graphics/RenderBuffer.h"
 #include "../Graphics/Texture.h"
 #include "../Graphics/VertexBuffer.h"
 #include "Batch.h"
 #include "GeometryNode.h"
 #include "Material.h"
+#include "Model.h"
 
 #include <algorithm>
+#include <cstring>
 
-inline bool CompareBatchKeys(const Batch& lhs, const Batch& rhs)
+/// Convert a float to an unsigned integer that sorts in the same order.
+inline unsigned FloatToSortableKey(float value)
 {
-    return lhs.sortKey < rhs.sortKey;
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+    return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
 }
 
-inline bool CompareBatchDistance(const Batch& lhs, const Batch& rhs)
+/// Return a hashed sort key field of the given width.
+inline unsigned long long HashSortField(unsigned long long value, unsigned bits)
 {
-    return lhs.distance > rhs.distance;
+    return bits ? (value * 0x9e3779b97f4a7c15ULL) >> (64 - bits) : 0;
+}
+
+/// Return the most significant bits of a 15-bit distance key as a sort key field of the given width.
+inline unsigned long long DistanceSortField(unsigned short distance, unsigned bits)
+{
+    return bits >= 15 ? distance : distance >> (15 - bits);
+}
+
+/// Append a field to a sort key.
+inline unsigned long long AppendSortField(unsigned long long key, unsigned long long field, unsigned bits)
+{
+    return bits ? (key << bits) | field : key;
 }
 
 ShadowMap::ShadowMap()
@@ -30,84 +49,375 @@ ShadowMap::~ShadowMap()
 
 void ShadowMap::Clear()
 {
-    allocator.Reset(texture->Width(), texture->Height(), 0, 0, false);
+    allocator.Reset(texture->Width(), texture->Height(), SHADOW_ATLAS_TILE_SIZE);
     shadowViews.clear();
     freeQueueIdx = 0;
 }
 
+MinDistanceMap::MinDistanceMap() :
+    numEntries(0)
+{
+}
+
+void MinDistanceMap::Clear()
+{
+    if (numEntries)
+    {
+        std::fill(keys.begin(), keys.end(), nullptr);
+        numEntries = 0;
+    }
+}
+
+void BatchQueue::RadixSort()
+{
+    size_t numBatches = batches.size();
+    if (numBatches < 2)
+        return;
+
+    // Build histograms of all eight key bytes in one pass
+    unsigned counts[8][256];
+    memset(counts, 0, sizeof counts);
+    for (size_t i = 0; i < numBatches; ++i)
+    {
+        unsigned long long key = sortKeys[i].key;
+        for (unsigned j = 0; j < 8; ++j)
+            ++counts[j][(key >> (j * 8)) & 0xff];
+    }
+
+    tempSortKeys.resize(numBatches);
+    BatchSortKey* src = &sortKeys[0];
+    BatchSortKey* dest = &tempSortKeys[0];
+
+    for (unsigned pass = 0; pass < 8; ++pass)
+    {
+        unsigned* passCounts = counts[pass];
+        unsigned shift = pass * 8;
+
+        // Skip the pass if all keys have the same byte
+        if (passCounts[(src[0].key >> shift) & 0xff] == numBatches)
+            continue;
+
+        unsigned offset = 0;
+        for (unsigned i = 0; i < 256; ++i)
+        {
+            unsigned count = passCounts[i];
+            passCounts[i] = offset;
+            offset += count;
+        }
+
+        for (size_t i = 0; i < numBatches; ++i)
+            dest[passCounts[(src[i].key >> shift) & 0xff]++] = src[i];
+
+        std::swap(src, dest);
+    }
+
+    // Gather the batches in sorted order
+    sortedBatches.resize(numBatches);
+    for (size_t i = 0; i < numBatches; ++i)
+        sortedBatches[i] = batches[src[i].index];
+    batches.swap(sortedBatches);
+}
+
+void MinDistanceMap::Grow()
+{
+    std::vector<void*> oldKeys;
+    std::vector<unsigned short> oldDistances;
+    oldKeys.swap(keys);
+    oldDistances.swap(distances);
+
+    size_t newSize = oldKeys.size() ? oldKeys.size() * 2 : 64;
+    keys.resize(newSize, nullptr);
+    distances.resize(newSize);
+    numEntries = 0;
+
+    for (size_t i = 0; i < oldKeys.size(); ++i)
+    {
+        if (oldKeys[i])
+            Insert(oldKeys[i], oldDistances[i]);
+    }
+}
+
+void RenderCommandList::Record(bool multiDraw)
+{
+    commands.clear();
+    drawCommands.clear();
+
+    Pass* lastPass = nullptr;
+    unsigned char lastProgramBits = 0;
+
+    for (const Batch* it = batches; it < batches + numBatches;)
+    {
+        const Batch& batch = *it;
+        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+        bool instanced = geometryBits == GEOM_INSTANCED || (batch.programBits & SP_INSTANCEDBIT);
+
+        if (batch.pass != lastPass || batch.programBits != lastProgramBits)
+        {
+            RenderCommand command;
+            command.programBits = batch.programBits;
+            command.pass = batch.pass;
+            commands.push_back(command);
+
+            lastPass = batch.pass;
+            lastProgramBits = batch.programBits;
+        }
+
+        Geometry* geometry = batch.geometry;
+        RenderCommand command;
+        command.programBits = batch.programBits;
+        command.pass = batch.pass;
+        command.geometry = geometry;
+
+        if (instanced)
+        {
+            const Batch* next = it + batch.instanceCount;
+            size_t numDraws = 1;
+
+            // Combine the following instance groups that use the same pass, shader variation and buffers
+            if (multiDraw && geometry->indexBuffer)
+            {
+                while (next < batches + numBatches && next->pass == batch.pass && next->programBits == batch.programBits &&
+                    next->geometry->vertexBuffer == geometry->vertexBuffer && next->geometry->indexBuffer == geometry->indexBuffer)
+                {
+                    next += next->instanceCount;
+                    ++numDraws;
+                }
+            }
+
+            if (numDraws > 1)
+            {
+                // Skinned and custom geometry and single-pass point light shadows have the per-object data after the world transform, and the previous world transform follows when rendering motion vectors. The instance range is aligned to the instance size
+                const unsigned instanceSize = (geometryBits != GEOM_INSTANCED || (batch.programBits & SP_CUBESHADOWBIT) ? 4 : 3) + (historyFrame ? 3 : 0);
+
+                command.type = CMD_MULTI_DRAW;
+                command.firstDraw = (unsigned)drawCommands.size();
+                command.count = (unsigned)numDraws;
+
+                for (const Batch* drawIt = it; drawIt < next; drawIt += drawIt->instanceCount)
+                {
+                    const Geometry* drawGeometry = drawIt->geometry;
+                    DrawElementsIndirectCommand drawCommand;
+                    drawCommand.count = (unsigned)drawGeometry->drawCount;
+                    drawCommand.instanceCount = drawIt->instanceCount;
+                    drawCommand.firstIndex = (unsigned)drawGeometry->drawStart;
+                    drawCommand.baseVertex = drawGeometry->baseVertex;
+                    drawCommand.baseInstance = drawIt->instanceStart / instanceSize;
+                    drawCommands.push_back(drawCommand);
+                }
+            }
+            else
+            {
+                command.type = CMD_DRAW_INSTANCED;
+                command.instanceStart = batch.instanceStart;
+                command.count = batch.instanceCount;
+            }
+
+            it = next;
+        }
+        else
+        {
+            command.type = CMD_DRAW;
+            command.count = 1;
+            command.worldTransform = batch.node->WorldTransform();
+            if (geometryBits)
+                command.instanceData = batch.node->InstanceData();
+            if (historyFrame)
+                command.prevWorldTransform = batch.node->PreviousWorldTransform(historyFrame);
+
+            ++it;
+        }
+
+        commands.push_back(command);
+    }
+}
+
+BatchQueue::BatchQueue() :
+    numCommandLists(0),
+    historyFrame(0)
+{
+}
+
 void BatchQueue::Clear()
 {
     batches.clear();
+    numCommandLists = 0;
 }
 
-void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced)
+void BatchQueue::SetupCommandLists(size_t batchesPerList)
 {
+    numCommandLists = 0;
+    if (batches.empty())
+        return;
+
+    batchesPerList = std::max(batchesPerList, (size_t)1);
+    size_t start = 0;
+
+    while (start < batches.size())
+    {
+        // Advance by whole instance groups until the list is full
+        size_t end = start;
+        while (end < batches.size() && end - start < batchesPerList)
+        {
+            const Batch& batch = batches[end];
+            unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+            bool instanced = geometryBits == GEOM_INSTANCED || (batch.programBits & SP_INSTANCEDBIT);
+            end += instanced ? batch.instanceCount : 1;
+        }
+
+        if (commandLists.size() <= numCommandLists)
+            commandLists.resize(numCommandLists + 1);
+
+        RenderCommandList& list = commandLists[numCommandLists++];
+        list.batches = &batches[start];
+        list.numBatches = end - start;
+        list.historyFrame = historyFrame;
+        start = end;
+    }
+}
+
+void BatchQueue::Sort(InstanceTransformBuffer& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, bool convertSingle)
+{
+    SortBatches(sortMode);
+    SetupInstancing(instanceTransforms, convertToInstanced, convertSingle);
+}
+
+void BatchQueue::SortBatches(BatchSortMode sortMode, const BatchSortKeyLayout& layout)
+{
+    size_t numBatches = batches.size();
+    sortKeys.resize(numBatches);
+
     switch (sortMode)
     {
     case SORT_STATE:
-        for (auto it = batches.begin(); it < batches.end(); ++it)
+        for (size_t i = 0; i < numBatches; ++i)
         {
-            unsigned short materialId = (unsigned short)((size_t)it->pass / sizeof(Pass));
-            unsigned short geomId = (unsigned short)((size_t)it->geometry / sizeof(Geometry));
+            const Batch& batch = batches[i];
+            unsigned short materialId = (unsigned short)((size_t)batch.pass / sizeof(Pass));
+            unsigned short geomId = (unsigned short)((size_t)batch.geometry / sizeof(Geometry));
 
-            it->sortKey = (((unsigned)materialId) << 16) | geomId;
+            sortKeys[i].key = (((unsigned)materialId) << 16) | geomId;
+            sortKeys[i].index = (unsigned)i;
         }
-        std::sort(batches.begin(), batches.end(), CompareBatchKeys);
         break;
 
     case SORT_STATE_AND_DISTANCE:
-        for (auto it = batches.begin(); it < batches.end(); ++it)
+        for (size_t i = 0; i < numBatches; ++i)
         {
-            unsigned short materialId = it->pass->lastSortKey.second;
-            unsigned short geomId = it->geometry->lastSortKey.second;
-            
-            it->sortKey = (((unsigned)materialId) << 16) | geomId;
+            const Batch& batch = batches[i];
+            const Pass* pass = batch.pass;
+            const Material* material = pass->Parent();
+            const Geometry* geometry = batch.geometry;
+            const VertexBuffer* vertexBuffer = geometry->vertexBuffer;
+            unsigned short passDistance = pass->lastSortKey.second;
+
+            unsigned long long key = DistanceSortField(passDistance, layout.depthBits);
+            key = AppendSortField(key, HashSortField(pass->ShaderKey() + batch.programBits, layout.programBits), layout.programBits);
+            key = AppendSortField(key, HashSortField(pass->RenderStateKey() | ((unsigned)material->GetCullMode() << 16), layout.renderStateBits),
+                layout.renderStateBits);
+            key = AppendSortField(key, HashSortField(material->TextureKey(), layout.textureBits), layout.textureBits);
+            key = AppendSortField(key, DistanceSortField(passDistance, layout.passBits), layout.passBits);
+            key = AppendSortField(key, DistanceSortField(vertexBuffer ? vertexBuffer->lastSortKey.second : 0, layout.vertexBufferBits),
+                layout.vertexBufferBits);
+            key = AppendSortField(key, DistanceSortField(geometry->lastSortKey.second, layout.geometryBits), layout.geometryBits);
+
+            sortKeys[i].key = key;
+            sortKeys[i].index = (unsigned)i;
         }
-        std::sort(batches.begin(), batches.end(), CompareBatchKeys);
         break;
 
     case SORT_DISTANCE:
-        std::sort(batches.begin(), batches.end(), CompareBatchDistance);
+        // Back to front: invert the key so that the largest distance sorts first
+        for (size_t i = 0; i < numBatches; ++i)
+        {
+            sortKeys[i].key = ~FloatToSortableKey(batches[i].distance);
+            sortKeys[i].index = (unsigned)i;
+        }
         break;
     }
 
-    if (!convertToInstanced || batches.size() < 2)
+    RadixSort();
+}
+
+void BatchQueue::SetupInstancing(InstanceTransformBuffer& instanceTransforms, bool convertToInstanced, bool convertSingle, unsigned short historyFrame_)
+{
+    historyFrame = historyFrame_;
+
+    if (!convertToInstanced || batches.size() < (convertSingle ? 1 : 2))
         return;
 
-    for (auto it = batches.begin(); it < batches.end() - 1;)
+    for (auto it = batches.begin(); it < batches.end();)
     {
-        // Check if batch can be converted (static geometry)
-        if (it->programBits & SP_GEOMETRYBITS)
-            continue;
-
-        bool hasInstances = false;
-        size_t start = instanceTransforms.size();
+        auto next = it + 1;
+        while (next < batches.end() && next->programBits == it->programBits && next->pass == it->pass && next->geometry == it->geometry)
+            ++next;
 
-        for (auto next = it + 1; next < batches.end(); ++next)
+        size_t count = next - it;
+        unsigned char geometryBits = it->programBits & SP_GEOMETRYBITS;
+        // Skinned and custom geometry store the per-object data after the world transform, followed by the previous world transform if rendering motion vectors
+        size_t transformSize = geometryBits ? 4 : 3;
+        size_t instanceSize = transformSize + (historyFrame ? 3 : 0);
+        unsigned startIndex;
+        // Single static batches are instanced only when requested, so that they can be combined into multi-draw calls
+        bool convert = count > 1 || (convertSingle && !geometryBits);
+        Vector4* dest = convert ? instanceTransforms.Allocate(count * instanceSize, instanceSize, startIndex) : nullptr;
+        if (dest)
         {
-            if (next->programBits == it->programBits && next->pass == it->pass && next->geometry == it->geometry)
+            for (auto instIt = it; instIt < next; ++instIt)
             {
-                if (!hasInstances)
-                {
-                    instanceTransforms.push_back(*it->worldTransform);
-                    hasInstances = true;
-                }
-                
-                instanceTransforms.push_back(*next->worldTransform);
+                memcpy(static_cast<void*>(dest), &instIt->node->WorldTransform(), sizeof(Matrix3x4));
+                if (geometryBits)
+                    dest[3] = instIt->node->InstanceData();
+                if (historyFrame)
+                    memcpy(static_cast<void*>(dest + transformSize), &instIt->node->PreviousWorldTransform(historyFrame), sizeof(Matrix3x4));
+                dest += instanceSize;
             }
-            else
-                break;
+
+            it->programBits |= geometryBits ? SP_INSTANCEDBIT : GEOM_INSTANCED;
+            it->instanceStart = startIndex;
+            it->instanceCount = (unsigned)count;
         }
 
-        if (hasInstances)
+        it = next;
+    }
+}
+
+void BatchQueue::SetupFaceInstancing(InstanceTransformBuffer& instanceTransforms)
+{
+    historyFrame = 0;
+
+    // The world transform is followed by the face in the per-object data slot, like the instancing data of complex geometry
+    const size_t instanceSize = 4;
+    auto destIt = batches.begin();
+
+    for (auto it = batches.begin(); it < batches.end();)
+    {
+        auto next = it + 1;
+        while (next < batches.end() && next->programBits == it->programBits && next->pass == it->pass && next->geometry == it->geometry)
+            ++next;
+
+        size_t count = next - it;
+        unsigned startIndex;
+        Vector4* dest = instanceTransforms.Allocate(count * instanceSize, instanceSize, startIndex);
+        if (dest)
         {
-            size_t count = instanceTransforms.size() - start;
-            it->programBits |= GEOM_INSTANCED;
-            it->instanceStart = (unsigned)start;
-            it->instanceCount = (unsigned)count;
-            it += count;
+            for (auto instIt = it; instIt < next; ++instIt)
+            {
+                memcpy(static_cast<void*>(dest), &instIt->node->WorldTransform(), sizeof(Matrix3x4));
+                dest[3] = Vector4((float)instIt->face, 0.0f, 0.0f, 0.0f);
+                dest += instanceSize;
+            }
+
+            // Keep the group contiguous, as the following batches are skipped by the instance count
+            if (destIt != it)
+                std::copy(it, next, destIt);
+            destIt->programBits = GEOM_INSTANCED | SP_CUBESHADOWBIT;
+            destIt->instanceStart = startIndex;
+            destIt->instanceCount = (unsigned)count;
+            destIt += count;
         }
-        else
-            ++it;
+
+        it = next;
     }
+
+    batches.erase(destIt, batches.end());
 }
@@ -2,22 +2,29 @@
 
 #pragma once
 
-#include "../Math/AreaAllocator.h"
+#include "../Math/BoundingBox.h"
+#include "../Math/Color.h"
+#include "../Math/TileAllocator.h"
 #include "../Math/Matrix3x4.h"
 #include "../Object/Ptr.h"
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 class FrameBuffer;
 class GeometryNode;
 class Light;
 class Pass;
+class RenderBuffer;
 class ShaderProgram;
 class Texture;
 struct Geometry;
 struct ShadowView;
 
 static const int MAX_LIGHTS_PER_PASS = 4;
+static const int MAX_SHADOW_CASCADES = 4;
+static const int SHADOW_ATLAS_TILE_SIZE = 32;
 
 /// Sorting modes for batches.
 enum BatchSortMode
@@ -27,49 +34,332 @@ enum BatchSortMode
     SORT_DISTANCE
 };
 
-/// Stored draw call.
+/// Bit widths of the fields of the 64-bit state sort key, used when sorting by state and distance. The fields are from the most significant: coarse depth bucket, shader program, render state, texture set, pass, vertex buffer and geometry. The depth, pass, vertex buffer and geometry fields are taken from the most significant bits of their minimum distance in the view, so that equal state is drawn front to back, and the program, render state and texture set fields are hashed. Fields of zero width are left out.
+struct BatchSortKeyLayout
+{
+    /// Construct with the default layout.
+    BatchSortKeyLayout() :
+        depthBits(0),
+        programBits(10),
+        renderStateBits(6),
+        textureBits(10),
+        passBits(15),
+        vertexBufferBits(8),
+        geometryBits(15)
+    {
+    }
+
+    /// Return total number of bits.
+    unsigned TotalBits() const { return depthBits + programBits + renderStateBits + textureBits + passBits + vertexBufferBits + geometryBits; }
+
+    /// Coarse depth bucket bits, from the pass minimum distance. Give this bits to favor front to back order over state.
+    unsigned char depthBits;
+    /// Shader program bits.
+    unsigned char programBits;
+    /// Render state bits.
+    unsigned char renderStateBits;
+    /// Texture set bits.
+    unsigned char textureBits;
+    /// Pass bits.
+    unsigned char passBits;
+    /// Vertex buffer bits.
+    unsigned char vertexBufferBits;
+    /// Geometry bits.
+    unsigned char geometryBits;
+};
+
+/// Types of recorded render commands.
+enum RenderCommandType
+{
+    CMD_SETUP_PASS = 0,
+    CMD_DRAW,
+    CMD_DRAW_INSTANCED,
+    CMD_MULTI_DRAW
+};
+
+/// Indirect indexed draw command. Matches the layout consumed by glMultiDrawElementsIndirect.
+struct DrawElementsIndirectCommand
+{
+    /// Number of indices.
+    unsigned count;
+    /// Number of instances. Written by the culling compute shader for GPU-driven draws.
+    unsigned instanceCount;
+    /// First index.
+    unsigned firstIndex;
+    /// Constant added to the vertex indices.
+    unsigned baseVertex;
+    /// First instance in the instance buffer.
+    unsigned baseInstance;
+};
+
+/// Stored draw call. The small members are packed together ahead of the pointers, so that the batch takes 32 bytes instead of 40 on 64-bit when sorted and copied.
 struct Batch
 {
     union
     {
-        /// State sorting key.
-        unsigned sortKey;
         /// Distance for alpha batches.
         float distance;
-        /// Start position in the instance vertex buffer if instanced.
+        /// Start position in Vector4 units in the instance vertex buffer if instanced.
         unsigned instanceStart;
     };
 
+    /// %Shader variation bits.
+    unsigned char programBits;
+    /// Point light shadow face for single-pass point light shadow batches.
+    unsigned char face;
     /// %Material pass.
     Pass* pass;
     /// %Geometry.
     Geometry* geometry;
-    /// %Shader variation bits.
-    unsigned char programBits;
 
     union
     {
-        /// Owner object, for complex rendering like skinning.
+        /// Owner object, for the world transform and history, and complex rendering like skinning.
         GeometryNode* node;
-        /// Pointer to world transform matrix for static geometry rendering.
-        const Matrix3x4* worldTransform;
         /// Instance count if instanced.
         unsigned instanceCount;
     };
 };
 
+/// Sort key and original index of a batch for radix sorting.
+struct BatchSortKey
+{
+    /// Sort key.
+    unsigned long long key;
+    /// Index of batch.
+    unsigned index;
+};
+
+/// Destination memory for instancing data of one frame, shared by all batch queues. Holds world transforms, followed by the per-object data for skinned and custom geometry, and the previous world transforms when rendering motion vectors. Ranges are allocated atomically in Vector4 units so that queues can be sorted in worker threads.
+struct InstanceTransformBuffer
+{
+    /// Construct with no memory.
+    InstanceTransformBuffer() :
+        data(nullptr),
+        firstIndex(0),
+        capacity(0),
+        numVectors(0)
+    {
+    }
+
+    /// Begin a new frame writing to memory that corresponds to a vertex buffer range starting at firstIndex.
+    void Reset(Vector4* data_, size_t firstIndex_, size_t capacity_)
+    {
+        data = data_;
+        firstIndex = firstIndex_;
+        capacity = capacity_;
+        numVectors.store(0, std::memory_order_relaxed);
+    }
+
+    /// Allocate a range of vectors, with the vertex buffer index aligned to a multiple of the instance size so that the range can be addressed by base instance. Return memory to write to and the vertex buffer index of the range, or null if out of capacity.
+    Vector4* Allocate(size_t count, size_t alignment, unsigned& startIndex)
+    {
+        size_t start = numVectors.fetch_add(count + alignment - 1, std::memory_order_relaxed);
+        start += (alignment - (firstIndex + start) % alignment) % alignment;
+        if (start + count > capacity)
+            return nullptr;
+
+        startIndex = (unsigned)(firstIndex + start);
+        return data + start;
+    }
+
+    /// Return number of vectors written.
+    size_t Size() const { return std::min(numVectors.load(std::memory_order_relaxed), capacity); }
+    /// Return number of vectors requested, which exceeds the capacity if some allocations failed.
+    size_t NumRequested() const { return numVectors.load(std::memory_order_relaxed); }
+
+    /// Destination memory.
+    Vector4* data;
+    /// Vertex buffer index of the first vector.
+    size_t firstIndex;
+    /// Maximum number of vectors.
+    size_t capacity;
+    /// Number of vectors allocated so far.
+    std::atomic<size_t> numVectors;
+};
+
+/// Render command recorded from batches without graphics API calls.
+struct RenderCommand
+{
+    /// Construct as an empty pass setup, with the per-draw data zeroed.
+    RenderCommand() :
+        type(CMD_SETUP_PASS),
+        programBits(0),
+        pass(nullptr),
+        geometry(nullptr),
+        firstDraw(0),
+        count(0),
+        worldTransform(Matrix3x4::ZERO),
+        prevWorldTransform(Matrix3x4::ZERO),
+        instanceData(Vector4::ZERO)
+    {
+    }
+
+    /// Command type.
+    RenderCommandType type;
+    /// %Shader variation bits for pass setup.
+    unsigned char programBits;
+    /// %Material pass for pass setup.
+    Pass* pass;
+    /// %Geometry for draws. For multi-draws, the first geometry, which shares the buffers with the rest.
+    Geometry* geometry;
+
+    union
+    {
+        /// Start position in Vector4 units in the instance vertex buffer for an instanced draw.
+        unsigned instanceStart;
+        /// First indirect draw command of the list for a multi-draw.
+        unsigned firstDraw;
+    };
+
+    /// Instance count for an instanced draw, or number of indirect draws for a multi-draw.
+    unsigned count;
+    /// World transform for a draw, copied so that the scene can be updated while the commands are replayed.
+    Matrix3x4 worldTransform;
+    /// Previous world transform for a draw when rendering motion vectors.
+    Matrix3x4 prevWorldTransform;
+    /// Per-object data for a draw of complex geometry.
+    Vector4 instanceData;
+};
+
+/// Render commands recorded from a range of batches. Can be recorded on a worker thread, and replayed on the thread that owns the graphics context. Does not refer to the scene nodes after recording.
+struct RenderCommandList
+{
+    /// Record commands from the batch range. Pass setups are recorded only when the pass or shader variation changes. Consecutive instance groups with the same pass and buffers are combined into multi-draws if enabled.
+    void Record(bool multiDraw);
+
+    /// First batch to record.
+    const Batch* batches;
+    /// Number of batches to record.
+    size_t numBatches;
+    /// Recorded commands.
+    std::vector<RenderCommand> commands;
+    /// Indirect draw commands referred to by the multi-draws.
+    std::vector<DrawElementsIndirectCommand> drawCommands;
+    /// Motion vector history frame of the previous world transforms, or 0 if not rendering motion vectors.
+    unsigned short historyFrame;
+};
+
 /// Collection of draw calls with sorting and instancing functionality.
 struct BatchQueue
 {
+    /// Construct.
+    BatchQueue();
+
     /// Clear.
     void Clear();
-    /// Sort batches and setup instancing groups.
-    void Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced);
+    /// Sort batches and setup instancing groups. Skinned and custom geometry is instanced along with its per-object data. Instanced groups that do not fit in the buffer are left as individual draws. Optionally convert also single static batches to one-instance groups, so that all their transforms are in the instance buffer.
+    void Sort(InstanceTransformBuffer& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, bool convertSingle = false);
+    /// Sort batches without setting up instancing groups. The key layout is used when sorting by state and distance.
+    void SortBatches(BatchSortMode sortMode, const BatchSortKeyLayout& layout = BatchSortKeyLayout());
+    /// Setup instancing groups of sorted batches and write their instancing data. With a nonzero motion vector history frame, the instancing data and the recorded draws also hold the nodes' previous world transforms on it.
+    void SetupInstancing(InstanceTransformBuffer& instanceTransforms, bool convertToInstanced, bool convertSingle = false, unsigned short historyFrame = 0);
+    /// Setup instancing groups of sorted single-pass point light shadow batches of static geometry, writing the shadow face after each world transform. All batches are instanced, including single ones. Groups that do not fit in the buffer are left out, as the faces can not be drawn individually.
+    void SetupFaceInstancing(InstanceTransformBuffer& instanceTransforms);
+    /// Divide the batches into command lists of approximately the given size for recording, without splitting instance groups.
+    void SetupCommandLists(size_t batchesPerList);
     /// Return whether has batches added.
     bool HasBatches() const { return batches.size(); }
 
     /// Unsorted batches.
     std::vector<Batch> batches;
+    /// Sort keys for radix sorting.
+    std::vector<BatchSortKey> sortKeys;
+    /// Temporary sort keys for radix sorting.
+    std::vector<BatchSortKey> tempSortKeys;
+    /// Batches in sorted order, swapped with the stored batches after sorting.
+    std::vector<Batch> sortedBatches;
+    /// Render command lists. Only the first lists are in use.
+    std::vector<RenderCommandList> commandLists;
+    /// Number of render command lists in use.
+    size_t numCommandLists;
+    /// Motion vector history frame the instancing data was written for, or 0 if none.
+    unsigned short historyFrame;
+
+private:
+    /// Radix sort the batches according to the sort keys.
+    void RadixSort();
+};
+
+/// Open addressing hash map from pass or geometry pointers to their minimum distance keys. Used for per-thread reduction when collecting batches.
+struct MinDistanceMap
+{
+    /// Construct.
+    MinDistanceMap();
+
+    /// Clear all entries.
+    void Clear();
+    /// Store a distance for a key, keeping the minimum if already stored.
+    void Insert(void* key, unsigned short distance)
+    {
+        if ((numEntries + 1) * 2 > keys.size())
+            Grow();
+
+        size_t mask = keys.size() - 1;
+        size_t index = Hash(key) & mask;
+
+        for (;;)
+        {
+            if (keys[index] == key)
+            {
+                if (distance < distances[index])
+                    distances[index] = distance;
+                return;
+            }
+            else if (!keys[index])
+            {
+                keys[index] = key;
+                distances[index] = distance;
+                ++numEntries;
+                return;
+            }
+
+            index = (index + 1) & mask;
+        }
+    }
+
+    /// Return hash of a pointer.
+    static size_t Hash(void* key) { return ((size_t)key >> 4) * 2654435761U; }
+
+    /// Key slots. Null for a free slot.
+    std::vector<void*> keys;
+    /// Minimum distance for each key slot.
+    std::vector<unsigned short> distances;
+    /// Number of used slots.
+    size_t numEntries;
+
+private:
+    /// Double the capacity and rehash.
+    void Grow();
+};
+
+/// Opaque batches of the static geometry in an octant, collected once and reused while the octant's nodes and the source batches are unchanged.
+struct OctantBatchCache
+{
+    /// Cached batches.
+    std::vector<Batch> batches;
+    /// Indices of the octant's nodes that are not cached and are collected normally.
+    std::vector<unsigned> uncachedNodes;
+    /// Distinct passes of the cached batches.
+    std::vector<Pass*> passes;
+    /// Distinct geometries of the cached batches.
+    std::vector<Geometry*> geometries;
+    /// Distinct streamable textures of the cached batches.
+    std::vector<Texture*> textures;
+    /// Bounding box of the cached nodes.
+    BoundingBox boundingBox;
+    /// Largest bounding box diagonal of the cached nodes, for estimating texture streaming levels.
+    float maxNodeSize;
+    /// Sum of squared bounding sphere radii of the cached nodes that can be depth pre-passed, for estimating screen coverage.
+    float prePassRadiusSquared;
+    /// Number of cached nodes that can be depth pre-passed.
+    unsigned numPrePassNodes;
+    /// Octant version the cache was collected from.
+    unsigned octantVersion;
+    /// Source batch assignment generation the cache was collected from.
+    unsigned batchGeneration;
+    /// View layer mask the cache was collected with.
+    unsigned viewMask;
 };
 
 /// Shadow map data structure. May be shared by several lights.
@@ -83,12 +373,18 @@ struct ShadowMap
     /// Clear allocator and batch queue use count.
     void Clear();
 
-    /// Rectangle allocator.
-    AreaAllocator allocator;
+    /// Shadow rectangle allocator.
+    TileAllocator allocator;
     /// Shadow map texture.
     SharedPtr<Texture> texture;
     /// Shadow map framebuffer.
     SharedPtr<FrameBuffer> fbo;
+    /// Filtered exponential depth moments of the shadow map when prefiltered shadows are enabled.
+    SharedPtr<Texture> momentTexture;
+    /// Depth buffer for caching the static shadowcasters.
+    SharedPtr<RenderBuffer> staticBuffer;
+    /// Framebuffer for caching the static shadowcasters.
+    SharedPtr<FrameBuffer> staticFbo;
     /// Shadow views that use this shadow map.
     std::vector<ShadowView*> shadowViews;
     /// Shadow batch queues used by the shadow views.
@@ -113,3 +409,46 @@ struct LightData
     /// Shadow matrix. For point lights, contains extra parameters.
     Matrix4 shadowMatrix;
 };
+
+/// Decal data for the clustered decals. Must match the Decal struct in shaders.
+struct DecalData
+{
+    /// Transform from world space to the decal's unit box.
+    Matrix3x4 inverseTransform;
+    /// Atlas rectangle: offset in XY and size in ZW.
+    Vector4 atlasRect;
+    /// Opacity in X.
+    Vector4 parameters;
+};
+
+/// Per-view uniform block data. Must match the PerViewData1 block in shaders.
+struct PerViewData
+{
+    /// Camera view matrix.
+    Matrix3x4 viewMatrix;
+    /// Camera projection matrix.
+    Matrix4 projectionMatrix;
+    /// Camera view-projection matrix.
+    Matrix4 viewProjMatrix;
+    /// Depth reconstruction parameters.
+    Vector4 depthParameters;
+    /// Directional light direction, color, shadow split ends, shadow parameters, shadow fade parameters and the cascade shadow matrices.
+    Vector4 dirLightData[5 + 4 * MAX_SHADOW_CASCADES];
+    /// Ambient light color.
+    Vector4 ambientColor;
+    /// Irradiance volume minimum corner and probe count along Z, zero if no volume, and the inverse size and sampling offset along the normal.
+    Vector4 irradianceParameters[2];
+    /// Camera view-projection matrix without the projection offset, for motion vectors.
+    Matrix4 motionViewProjMatrix;
+    /// Camera view-projection matrix without the projection offset on the previous view with motion vectors.
+    Matrix4 prevViewProjMatrix;
+    /// First texel of the cluster decal lists in the light index texture, and the number of visible decals.
+    Vector4 decalParameters;
+};
+
+/// Point light shadow face view-projection matrices for single-pass rendering. Must match the CubeShadowData4 block in shaders.
+struct CubeShadowData
+{
+    /// View-projection matrix of each face.
+    Matrix4 faceMatrices[6];
+};
@@ -7,6 +7,8 @@ static const float DEFAULT_NEARCLIP = 0.1f;
 static const float DEFAULT_FARCLIP = 1000.0f;
 static const float DEFAULT_FOV = 45.0f;
 static const float DEFAULT_ORTHOSIZE = 20.0f;
+static const float DEFAULT_LODHYSTERESIS = 0.1f;
+static const Color DEFAULT_AMBIENT_COLOR(0.1f, 0.1f, 0.1f);
 
 static const Matrix4 flipMatrix(
     1.0f, 0.0f, 0.0f, 0.0f,
@@ -20,8 +22,13 @@ Camera::Camera() :
     worldDirection(Vector3::FORWARD),
     viewMatrixDirty(false),
     worldDirectionDirty(false),
+    projectionDirty(true),
+    viewProjDirty(true),
+    frustumDirty(true),
     orthographic(false),
     flipVertical(false),
+    infiniteFarClip(false),
+    reverseDepth(false),
     nearClip(DEFAULT_NEARCLIP),
     farClip(DEFAULT_FARCLIP),
     fov(DEFAULT_FOV),
@@ -30,11 +37,15 @@ Camera::Camera() :
     zoom(1.0f),
     lodBias(1.0f),
     viewMask(M_MAX_UNSIGNED),
+    ambientColor(DEFAULT_AMBIENT_COLOR),
     projectionOffset(Vector2::ZERO),
     reflectionPlane(Plane::UP),
     clipPlane(Plane::UP),
     useReflection(false),
-    useClipping(false)
+    useClipping(false),
+    lodHysteresis(DEFAULT_LODHYSTERESIS),
+    lodBudgetScale(1.0f),
+    lodFovScale(1.0f)
 {
     reflectionMatrix = reflectionPlane.ReflectionMatrix();
 }
@@ -53,49 +64,87 @@ void Camera::RegisterObject()
     RegisterAttribute("orthoSize", &Camera::OrthoSize, &Camera::SetOrthoSize, DEFAULT_ORTHOSIZE);
     RegisterAttribute("zoom", &Camera::Zoom, &Camera::SetZoom, 1.0f);
     RegisterAttribute("lodBias", &Camera::LodBias, &Camera::SetLodBias, 1.0f);
-    RegisterAttribute("viewMask", &Camera::ViewMask, &Camera::SetViewMask, M_MAX_UNSIGNED);
+    RegisterAttribute("lodHysteresis", &Camera::LodHysteresis, &Camera::SetLodHysteresis, DEFAULT_LODHYSTERESIS);
+    RegisterMemberAttribute("viewMask", &Camera::viewMask, M_MAX_UNSIGNED);
+    RegisterRefAttribute("ambientColor", &Camera::AmbientColor, &Camera::SetAmbientColor, DEFAULT_AMBIENT_COLOR);
     RegisterRefAttribute("projectionOffset", &Camera::ProjectionOffset, &Camera::SetProjectionOffset, Vector2::ZERO);
     RegisterMixedRefAttribute("reflectionPlane", &Camera::ReflectionPlaneAttr, &Camera::SetReflectionPlaneAttr, Vector4(0.0f, 1.0f, 0.0f, 0.0f));
     RegisterMixedRefAttribute("clipPlane", &Camera::ClipPlaneAttr, &Camera::SetClipPlaneAttr, Vector4(0.0f, 1.0f, 0.0f, 0.0f));
     RegisterAttribute("useReflection", &Camera::UseReflection, &Camera::SetUseReflection, false);
-    RegisterAttribute("useClipping", &Camera::UseClipping, &Camera::SetUseClipping, false);
+    RegisterMemberAttribute("useClipping", &Camera::useClipping, false);
+    RegisterAttribute("infiniteFarClip", &Camera::InfiniteFarClip, &Camera::SetInfiniteFarClip, false);
 }
 
 void Camera::SetNearClip(float nearClip_)
 {
-    nearClip = Max(nearClip_, M_EPSILON);
+    nearClip_ = Max(nearClip_, M_EPSILON);
+    if (nearClip_ != nearClip)
+    {
+        nearClip = nearClip_;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetFarClip(float farClip_)
 {
-    farClip = Max(farClip_, M_EPSILON);
+    farClip_ = Max(farClip_, M_EPSILON);
+    if (farClip_ != farClip)
+    {
+        farClip = farClip_;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetFov(float fov_)
 {
-    fov = Clamp(fov_, 0.0f, 180.0f);
+    fov_ = Clamp(fov_, 0.0f, 180.0f);
+    if (fov_ != fov)
+    {
+        fov = fov_;
+        lodFovScale = tanf(fov * M_DEGTORAD_2) / tanf(DEFAULT_FOV * M_DEGTORAD_2);
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetOrthoSize(float orthoSize_)
 {
-    orthoSize = orthoSize_;
-    aspectRatio = 1.0f;
+    if (orthoSize_ != orthoSize || aspectRatio != 1.0f)
+    {
+        orthoSize = orthoSize_;
+        aspectRatio = 1.0f;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetOrthoSize(const Vector2& orthoSize_)
 {
-    orthoSize = orthoSize_.y;
-    aspectRatio = orthoSize_.x / orthoSize_.y;
+    float aspectRatio_ = orthoSize_.x / orthoSize_.y;
+    if (orthoSize_.y != orthoSize || aspectRatio_ != aspectRatio)
+    {
+        orthoSize = orthoSize_.y;
+        aspectRatio = aspectRatio_;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetAspectRatio(float aspectRatio_)
 {
-    aspectRatio = Max(aspectRatio_, M_EPSILON);
+    aspectRatio_ = Max(aspectRatio_, M_EPSILON);
+    if (aspectRatio_ != aspectRatio)
+    {
+        aspectRatio = aspectRatio_;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetZoom(float zoom_)
 {
-    zoom = Max(zoom_, M_EPSILON);
+    zoom_ = Max(zoom_, M_EPSILON);
+    if (zoom_ != zoom)
+    {
+        zoom = zoom_;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetLodBias(float bias)
@@ -103,6 +152,16 @@ void Camera::SetLodBias(float bias)
     lodBias = Max(bias, M_EPSILON);
 }
 
+void Camera::SetLodHysteresis(float hysteresis)
+{
+    lodHysteresis = Clamp(hysteresis, 0.0f, 0.5f);
+}
+
+void Camera::SetLodBudgetScale(float scale)
+{
+    lodBudgetScale = Max(scale, M_EPSILON);
+}
+
 void Camera::SetViewMask(unsigned mask)
 {
     viewMask = mask;
@@ -110,25 +169,38 @@ void Camera::SetViewMask(unsigned mask)
 
 void Camera::SetOrthographic(bool enable)
 {
-    orthographic = enable;
+    if (enable != orthographic)
+    {
+        orthographic = enable;
+        OnProjectionChanged();
+    }
+}
+
+void Camera::SetAmbientColor(const Color& color)
+{
+    ambientColor = color;
 }
 
 void Camera::SetProjectionOffset(const Vector2& offset)
 {
-    projectionOffset = offset;
+    if (offset != projectionOffset)
+    {
+        projectionOffset = offset;
+        OnProjectionChanged();
+    }
 }
 
 void Camera::SetUseReflection(bool enable)
 {
     useReflection = enable;
-    viewMatrixDirty = true;
+    OnViewChanged();
 }
 
 void Camera::SetReflectionPlane(const Plane& plane)
 {
     reflectionPlane = plane;
     reflectionMatrix = plane.ReflectionMatrix();
-    viewMatrixDirty = true;
+    OnViewChanged();
 }
 
 void Camera::SetUseClipping(bool enable)
@@ -141,10 +213,31 @@ void Camera::SetClipPlane(const Plane& plane)
     clipPlane = plane;
 }
 
-
 void Camera::SetFlipVertical(bool enable)
 {
-    flipVertical = enable;
+    if (enable != flipVertical)
+    {
+        flipVertical = enable;
+        OnProjectionChanged();
+    }
+}
+
+void Camera::SetInfiniteFarClip(bool enable)
+{
+    if (enable != infiniteFarClip)
+    {
+        infiniteFarClip = enable;
+        OnProjectionChanged();
+    }
+}
+
+void Camera::SetReverseDepth(bool enable)
+{
+    if (enable != reverseDepth)
+    {
+        reverseDepth = enable;
+        OnProjectionChanged();
+    }
 }
 
 float Camera::NearClip() const
@@ -154,16 +247,18 @@ float Camera::NearClip() const
     return orthographic ? 0.0f : nearClip;
 }
 
-Frustum Camera::WorldFrustum() const
+const Frustum& Camera::WorldFrustum() const
 {
-    Frustum ret;
-
-    if (!orthographic)
-        ret.Define(fov, aspectRatio, zoom, NearClip(), farClip, EffectiveWorldTransform());
-    else
-        ret.DefineOrtho(orthoSize, aspectRatio, zoom, NearClip(), farClip, EffectiveWorldTransform());
+    if (frustumDirty)
+    {
+        if (!orthographic)
+            worldFrustum.Define(fov, aspectRatio, zoom, NearClip(), farClip, EffectiveWorldTransform());
+        else
+            worldFrustum.DefineOrtho(orthoSize, aspectRatio, zoom, NearClip(), farClip, EffectiveWorldTransform());
+        frustumDirty = false;
+    }
 
-    return ret;
+    return worldFrustum;
 }
 
 Frustum Camera::WorldSplitFrustum(float nearClip_, float farClip_) const
@@ -223,23 +318,52 @@ const Matrix3x4& Camera::ViewMatrix() const
     return viewMatrix;
 }
 
-Matrix4 Camera::ProjectionMatrix(bool apiSpecific) const
+Matrix4 Camera::ProjectionMatrix(bool apiSpecific, bool applyOffset) const
+{
+    if (!applyOffset)
+        return CalculateProjectionMatrix(apiSpecific, false);
+
+    if (projectionDirty)
+    {
+        projectionMatrices[0] = CalculateProjectionMatrix(false, true);
+        projectionMatrices[1] = CalculateProjectionMatrix(true, true);
+        projectionDirty = false;
+    }
+
+    return projectionMatrices[apiSpecific ? 1 : 0];
+}
+
+const Matrix4& Camera::ViewProjMatrix(bool apiSpecific) const
+{
+    if (viewProjDirty)
+    {
+        viewProjMatrices[0] = ProjectionMatrix(false) * ViewMatrix();
+        viewProjMatrices[1] = ProjectionMatrix(true) * ViewMatrix();
+        viewProjDirty = false;
+    }
+
+    return viewProjMatrices[apiSpecific ? 1 : 0];
+}
+
+Matrix4 Camera::CalculateProjectionMatrix(bool apiSpecific, bool applyOffset) const
 {
     Matrix4 ret(Matrix4::ZERO);
+    Vector2 offset = applyOffset ? projectionOffset : Vector2::ZERO;
 
-    bool openGLFormat = apiSpecific;
+    bool openGLFormat = apiSpecific && !reverseDepth;
 
     if (!orthographic)
     {
         float h = (1.0f / tanf(fov * M_DEGTORAD * 0.5f)) * zoom;
         float w = h / aspectRatio;
-        float q = farClip / (farClip - nearClip);
+        // The infinite far plane is the limit of q as far clip grows. Culling still uses the finite far clip
+        float q = (apiSpecific && infiniteFarClip) ? 1.0f : farClip / (farClip - nearClip);
         float r = -q * nearClip;
 
         ret.m00 = w;
-        ret.m02 = projectionOffset.x * 2.0f;
+        ret.m02 = offset.x * 2.0f;
         ret.m11 = h;
-        ret.m12 = projectionOffset.y * 2.0f;
+        ret.m12 = offset.y * 2.0f;
         ret.m22 = q;
         ret.m23 = r;
         ret.m32 = 1.0f;
@@ -253,9 +377,9 @@ Matrix4 Camera::ProjectionMatrix(bool apiSpecific) const
         float r = 0.0f;
 
         ret.m00 = w;
-        ret.m03 = projectionOffset.x * 2.0f;
+        ret.m03 = offset.x * 2.0f;
         ret.m11 = h;
-        ret.m13 = projectionOffset.y * 2.0f;
+        ret.m13 = offset.y * 2.0f;
         ret.m22 = q;
         ret.m23 = r;
         ret.m33 = 1.0f;
@@ -271,10 +395,34 @@ Matrix4 Camera::ProjectionMatrix(bool apiSpecific) const
         ret.m22 = 2.0f * ret.m22 - ret.m32;
         ret.m23 = 2.0f * ret.m23 - ret.m33;
     }
+    else if (apiSpecific)
+    {
+        // Clip control keeps the 0..1 depth range, so only flip it to map the near plane to 1 and the far plane to 0
+        ret.m20 = ret.m30 - ret.m20;
+        ret.m21 = ret.m31 - ret.m21;
+        ret.m22 = ret.m32 - ret.m22;
+        ret.m23 = ret.m33 - ret.m23;
+    }
 
     return ret;
 }
 
+Vector2 Camera::HardwareDepthConversion() const
+{
+    // An infinite far plane compresses the depth range up to the far clip distance by 1 / q
+    float scale = (!orthographic && infiniteFarClip) ? farClip / (farClip - nearClip) : 1.0f;
+    return reverseDepth ? Vector2(scale, -scale) : Vector2(0.0f, scale);
+}
+
+Vector2 Camera::DepthReconstruct() const
+{
+    // Reconstruct from the API-independent depth q - q * near / z, then fold in the hardware depth conversion
+    Vector2 conversion = HardwareDepthConversion();
+    float q = farClip / (farClip - nearClip);
+    float r = -nearClip / (farClip - nearClip);
+    return Vector2((q - conversion.x) / conversion.y, r / conversion.y);
+}
+
 void Camera::FrustumSize(Vector3& near, Vector3& far) const
 {
     near.z = NearClip();
@@ -322,7 +470,7 @@ Ray Camera::ScreenRay(float x, float y) const
         return ret;
     }
 
-    Matrix4 viewProjInverse = (ProjectionMatrix(false) * ViewMatrix()).Inverse();
+    Matrix4 viewProjInverse = ViewProjMatrix(false).Inverse();
 
     // The parameters range from 0.0 to 1.0. Expand to normalized device coordinates (-1.0 to 1.0) & flip Y axis
     x = 2.0f * x - 1.0f;
@@ -372,9 +520,9 @@ float Camera::LodDistance(float distance, float scale_, float bias) const
 {
     float d = Max(lodBias * bias * scale_ * zoom, M_EPSILON);
     if (!orthographic)
-        return distance / d;
+        return distance * lodFovScale * lodBudgetScale / d;
     else
-        return orthoSize / d;
+        return orthoSize * lodBudgetScale / d;
 }
 
 Quaternion Camera::FaceCameraRotation(const Vector3& position_, const Quaternion& rotation_, FaceCameraMode mode)
@@ -433,10 +581,24 @@ void Camera::OnTransformChanged()
 {
     SpatialNode::OnTransformChanged();
 
-    viewMatrixDirty = true;
+    OnViewChanged();
     worldDirectionDirty = true;
 }
 
+void Camera::OnViewChanged()
+{
+    viewMatrixDirty = true;
+    viewProjDirty = true;
+    frustumDirty = true;
+}
+
+void Camera::OnProjectionChanged()
+{
+    projectionDirty = true;
+    viewProjDirty = true;
+    frustumDirty = true;
+}
+
 void Camera::SetReflectionPlaneAttr(const Vector4& value)
 {
     SetReflectionPlane(Plane(value));
@@ -45,10 +45,16 @@ class Camera : public SpatialNode
     void SetZoom(float zoom);
     /// Set LOD bias. Values higher than 1 uses higher quality LOD (acts if distance is smaller.)
     void SetLodBias(float bias);
+    /// Set LOD hysteresis as a fraction of the LOD distance. A node switches to a lower quality LOD only beyond the LOD distance increased by the fraction, and back only within the distance decreased by it, to avoid flickering at the thresholds.
+    void SetLodHysteresis(float hysteresis);
+    /// Set LOD distance multiplier for meeting a triangle budget. Values higher than 1 use lower quality LODs. Set by Renderer each view when a LOD triangle budget is in use.
+    void SetLodBudgetScale(float scale);
     /// Set view layer mask. Will be checked against scene objects' layers to see what to render.
     void SetViewMask(unsigned mask);
     /// Set orthographic projection mode.
     void SetOrthographic(bool enable);
+    /// Set ambient light color. Added to the irradiance volume lighting where one is in use.
+    void SetAmbientColor(const Color& color);
     /// Set projection offset. It needs to be calculated as (offset in pixels) / (viewport dimensions.)
     void SetProjectionOffset(const Vector2& offset);
     /// Set reflection mode.
@@ -61,6 +67,10 @@ class Camera : public SpatialNode
     void SetClipPlane(const Plane& plane);
     /// Set vertical flipping mode.
     void SetFlipVertical(bool enable);
+    /// Set whether the API-specific perspective projection has an infinite far plane. The far clip distance still limits culling and is used for linear depth.
+    void SetInfiniteFarClip(bool enable);
+    /// Set whether the API-specific projection maps depth reversed to the 0..1 range, for a clip control 0..1 depth convention. Set by Renderer each view according to its depth mode.
+    void SetReverseDepth(bool enable);
 
     /// Return far clip distance.
     float FarClip() const { return farClip; }
@@ -76,6 +86,10 @@ class Camera : public SpatialNode
     float Zoom() const { return zoom; }
     /// Return LOD bias.
     float LodBias() const { return lodBias; }
+    /// Return LOD hysteresis fraction.
+    float LodHysteresis() const { return lodHysteresis; }
+    /// Return LOD distance multiplier for the triangle budget.
+    float LodBudgetScale() const { return lodBudgetScale; }
     /// Return view layer mask.
     unsigned ViewMask() const { return viewMask; }
     /// Return whether is orthographic.
@@ -94,10 +108,14 @@ class Camera : public SpatialNode
     const Plane& ClipPlane() const { return clipPlane; }
     /// Return vertical flipping mode.
     bool FlipVertical() const { return flipVertical; }
+    /// Return whether has an infinite far plane in the API-specific projection.
+    bool InfiniteFarClip() const { return infiniteFarClip; }
+    /// Return whether uses reversed 0..1 depth in the API-specific projection.
+    bool ReverseDepth() const { return reverseDepth; }
     /// Return whether to reverse culling; affected by vertical flipping and reflection.
     bool UseReverseCulling() const { return flipVertical ^ useReflection; }
-    /// Return frustum in world space.
-    Frustum WorldFrustum() const;
+    /// Return frustum in world space. Cached until the transform or the projection parameters change.
+    const Frustum& WorldFrustum() const;
     /// Return world space frustum split by custom near and far clip distances.
     Frustum WorldSplitFrustum(float nearClip, float farClip) const;
     /// Return frustum in view space.
@@ -108,8 +126,14 @@ class Camera : public SpatialNode
     const Matrix3x4& ViewMatrix() const;
     /// Return forward direction in world space.
     Vector3 WorldDirection() const { if (worldDirectionDirty) { worldDirection = SpatialNode::WorldDirection(); worldDirectionDirty = false; } return worldDirection; }
-    /// Return either API-specific or API-independent (D3D convention) projection matrix.
-    Matrix4 ProjectionMatrix(bool apiSpecific = true) const;
+    /// Return either API-specific or API-independent (D3D convention) projection matrix. The projection offset can be left out, for example to compute motion vectors without the temporal jitter. The matrices with the offset are cached.
+    Matrix4 ProjectionMatrix(bool apiSpecific = true, bool applyOffset = true) const;
+    /// Return either API-specific or API-independent view-projection matrix, including the projection offset. Cached.
+    const Matrix4& ViewProjMatrix(bool apiSpecific = true) const;
+    /// Return offset and scale for converting hardware depth to the depth of the API-independent projection: depth = x + y * hwDepth. Background depth may exceed 1 with an infinite far plane.
+    Vector2 HardwareDepthConversion() const;
+    /// Return parameters for reconstructing linear depth as a fraction of the far clip distance from hardware depth: depth = y / (hwDepth - x). Perspective projection only.
+    Vector2 DepthReconstruct() const;
     /// Return frustum near and far sizes.
     void FrustumSize(Vector3& near, Vector3& far) const;
     /// Return half view size.
@@ -122,7 +146,7 @@ class Camera : public SpatialNode
     Vector3 ScreenToWorldPoint(const Vector3& screenPos) const;
     /// Return depth distance (in camera's forward direction) to position.
     float Distance(const Vector3& worldPos) const;
-    /// Return a scene node's LOD scaled distance.
+    /// Return a scene node's LOD scaled distance. The distance is measured relative to the screen size at the default field of view, so that narrowing the field of view selects higher quality LODs.
     float LodDistance(float distance, float scale, float bias) const;
     /// Return a world rotation for facing a camera on certain axes based on the existing world rotation.
     Quaternion FaceCameraRotation(const Vector3& position, const Quaternion& rotation, FaceCameraMode mode);
@@ -136,6 +160,12 @@ protected:
     void OnTransformChanged() override;
 
 private:
+    /// Calculate the projection matrix.
+    Matrix4 CalculateProjectionMatrix(bool apiSpecific, bool applyOffset) const;
+    /// Invalidate the cached view matrix and the matrices and frustum derived from it.
+    void OnViewChanged();
+    /// Invalidate the cached projection matrices and the matrices and frustum derived from them.
+    void OnProjectionChanged();
     /// Set reflection plane as vector. Used in serialization.
     void SetReflectionPlaneAttr(const Vector4& value);
     /// Return reflection plane as vector. Used in serialization.
@@ -153,10 +183,26 @@ private:
     mutable bool viewMatrixDirty;
     /// World forward direction dirty flag.
     mutable bool worldDirectionDirty;
+    /// Cached API-independent and API-specific projection matrices with the offset.
+    mutable Matrix4 projectionMatrices[2];
+    /// Cached API-independent and API-specific view-projection matrices.
+    mutable Matrix4 viewProjMatrices[2];
+    /// Cached world space frustum.
+    mutable Frustum worldFrustum;
+    /// Projection matrices dirty flag.
+    mutable bool projectionDirty;
+    /// View-projection matrices dirty flag.
+    mutable bool viewProjDirty;
+    /// World space frustum dirty flag.
+    mutable bool frustumDirty;
     /// Orthographic mode flag.
     bool orthographic;
     /// Flip vertical flag.
     bool flipVertical;
+    /// Infinite far plane flag.
+    bool infiniteFarClip;
+    /// Reversed depth flag.
+    bool reverseDepth;
     /// Near clip distance.
     float nearClip;
     /// Far clip distance.
@@ -187,5 +233,11 @@ private:
     bool useReflection;
     /// Use custom clip plane flag.
     bool useClipping;
+    /// LOD hysteresis fraction.
+    float lodHysteresis;
+    /// LOD distance multiplier for the triangle budget.
+    float lodBudgetScale;
+    /// LOD distance multiplier from the field of view relative to the default.
+    float lodFovScale;
 };
 
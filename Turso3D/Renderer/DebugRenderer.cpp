@@ -0,0 +1,248 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/Shader.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../Math/BoundingBox.h"
+#include "../Math/Frustum.h"
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "Camera.h"
+#include "DebugRenderer.h"
+#include "Light.h"
+#include "Octree.h"
+#include "Renderer.h"
+
+#include <glew.h>
+
+/// Corner index pairs of the edges of a box whose corners are in min-max bit order.
+static const unsigned char boxEdges[] = {
+    0, 1, 2, 3, 4, 5, 6, 7,
+    0, 2, 1, 3, 4, 6, 5, 7,
+    0, 4, 1, 5, 2, 6, 3, 7
+};
+
+/// Frustum vertex indices in the same order as box corners.
+static const unsigned char frustumCorners[] = { 2, 1, 3, 0, 6, 5, 7, 4 };
+
+/// Return the corners of a bounding box in min-max bit order, X being the lowest bit.
+static void BoxCorners(const BoundingBox& box, Vector3* corners)
+{
+    for (size_t i = 0; i < 8; ++i)
+        corners[i] = Vector3((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+}
+
+DebugRenderer::DebugRenderer()
+{
+    RegisterSubsystem(this);
+
+    std::vector<VertexElement> vertexDeclaration;
+    vertexDeclaration.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+    vertexDeclaration.push_back(VertexElement(ELEM_UBYTE4, SEM_COLOR));
+    vertexBuffer = new VertexBuffer();
+    vertexBuffer->Define(USAGE_DYNAMIC, DEFAULT_DEBUG_VERTEX_CAPACITY, vertexDeclaration);
+}
+
+DebugRenderer::~DebugRenderer()
+{
+    RemoveSubsystem(this);
+}
+
+void DebugRenderer::AddLine(const Vector3& start, const Vector3& end, const Color& color, bool depthTest)
+{
+    unsigned packedColor = color.ToUInt();
+
+    MutexLock lock(mutex);
+    std::vector<DebugVertex>& dest = lines[depthTest];
+    dest.push_back(DebugVertex(start, packedColor));
+    dest.push_back(DebugVertex(end, packedColor));
+}
+
+void DebugRenderer::AddTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, const Color& color, bool depthTest)
+{
+    unsigned packedColor = color.ToUInt();
+
+    MutexLock lock(mutex);
+    std::vector<DebugVertex>& dest = triangles[depthTest];
+    dest.push_back(DebugVertex(v1, packedColor));
+    dest.push_back(DebugVertex(v2, packedColor));
+    dest.push_back(DebugVertex(v3, packedColor));
+}
+
+void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Color& color, bool depthTest)
+{
+    Vector3 corners[8];
+    BoxCorners(box, corners);
+
+    MutexLock lock(mutex);
+    AddBoxEdges(corners, color.ToUInt(), depthTest);
+}
+
+void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Matrix3x4& transform, const Color& color, bool depthTest)
+{
+    Vector3 corners[8];
+    BoxCorners(box, corners);
+    for (size_t i = 0; i < 8; ++i)
+        corners[i] = transform * corners[i];
+
+    MutexLock lock(mutex);
+    AddBoxEdges(corners, color.ToUInt(), depthTest);
+}
+
+void DebugRenderer::AddFrustum(const Frustum& frustum, const Color& color, bool depthTest)
+{
+    Vector3 corners[8];
+    for (size_t i = 0; i < 8; ++i)
+        corners[i] = frustum.vertices[frustumCorners[i]];
+
+    MutexLock lock(mutex);
+    AddBoxEdges(corners, color.ToUInt(), depthTest);
+}
+
+void DebugRenderer::AddOctree(const Octree* octree, const Color& color, bool depthTest)
+{
+    if (!octree)
+        return;
+
+    MutexLock lock(mutex);
+    AddOctant(octree->Root(), color.ToUInt(), depthTest);
+}
+
+void DebugRenderer::AddLightClusters(const Renderer* renderer, const Camera* camera, const Color& color, bool depthTest)
+{
+    if (!renderer || !camera)
+        return;
+
+    const std::vector<BoundingBox>& clusterBoxes = renderer->ClusterBoundingBoxes();
+    Matrix3x4 viewToWorld = camera->EffectiveWorldTransform();
+    unsigned packedColor = color.ToUInt();
+
+    MutexLock lock(mutex);
+    for (auto it = clusterBoxes.begin(); it != clusterBoxes.end(); ++it)
+    {
+        Vector3 corners[8];
+        BoxCorners(*it, corners);
+        for (size_t i = 0; i < 8; ++i)
+            corners[i] = viewToWorld * corners[i];
+        AddBoxEdges(corners, packedColor, depthTest);
+    }
+}
+
+void DebugRenderer::AddShadowFrustums(const Renderer* renderer, const Color& color, bool depthTest)
+{
+    if (!renderer)
+        return;
+
+    if (renderer->DirLight())
+        AddLightShadowFrustums(renderer->DirLight(), color, depthTest);
+
+    const std::vector<Light*>& lights = renderer->Lights();
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+        AddLightShadowFrustums(*it, color, depthTest);
+}
+
+void DebugRenderer::Render(const Matrix4& viewProjMatrix)
+{
+    PROFILE(RenderDebugGeometry);
+
+    MutexLock lock(mutex);
+
+    size_t numVertices = lines[0].size() + lines[1].size() + triangles[0].size() + triangles[1].size();
+    if (!numVertices)
+    {
+        Clear();
+        return;
+    }
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    Renderer* renderer = Subsystem<Renderer>();
+    Shader* shader = cache->LoadResource<Shader>("Shaders/Debug.glsl");
+    ShaderProgram* program = shader ? shader->CreateProgram() : nullptr;
+    if (!renderer || !program || !program->Bind())
+    {
+        Clear();
+        return;
+    }
+
+    // Draw with depth test first, as the geometry without depth test goes on top. Lines go last within each, so they are not hidden by the triangles' blending
+    std::vector<DebugVertex>* ranges[] = { &triangles[1], &lines[1], &triangles[0], &lines[0] };
+    vertices.clear();
+    for (size_t i = 0; i < 4; ++i)
+        vertices.insert(vertices.end(), ranges[i]->begin(), ranges[i]->end());
+
+    if (vertexBuffer->NumVertices() < numVertices)
+    {
+        size_t newCapacity = vertexBuffer->NumVertices();
+        while (newCapacity < numVertices)
+            newCapacity *= 2;
+        std::vector<VertexElement> vertexDeclaration = vertexBuffer->Elements();
+        vertexBuffer->Define(USAGE_DYNAMIC, newCapacity, vertexDeclaration);
+    }
+    vertexBuffer->SetData(0, numVertices, &vertices[0], true);
+    vertexBuffer->Bind(vertexBuffer->Attributes());
+
+    glUniformMatrix4fv(program->Uniform("viewProjMatrix"), 1, GL_FALSE, viewProjMatrix.Data());
+
+    Graphics* graphics = Subsystem<Graphics>();
+    size_t start = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        size_t count = ranges[i]->size();
+        if (count)
+        {
+            bool depthTest = i < 2;
+            renderer->SetRenderState(BLEND_ALPHA, CULL_NONE, depthTest ? CMP_LESS_EQUAL : CMP_ALWAYS, true, false);
+            graphics->FlushState();
+            glDrawArrays((i & 1) ? GL_LINES : GL_TRIANGLES, (GLsizei)start, (GLsizei)count);
+        }
+        start += count;
+    }
+
+    Clear();
+}
+
+void DebugRenderer::Clear()
+{
+    MutexLock lock(mutex);
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        lines[i].clear();
+        triangles[i].clear();
+    }
+}
+
+void DebugRenderer::AddBoxEdges(const Vector3* corners, unsigned color, bool depthTest)
+{
+    std::vector<DebugVertex>& dest = lines[depthTest];
+    for (size_t i = 0; i < sizeof boxEdges; ++i)
+        dest.push_back(DebugVertex(corners[boxEdges[i]], color));
+}
+
+void DebugRenderer::AddOctant(const Octant* octant, unsigned color, bool depthTest)
+{
+    if (!octant->numNodes)
+        return;
+
+    Vector3 corners[8];
+    BoxCorners(octant->cullingBox, corners);
+    AddBoxEdges(corners, color, depthTest);
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (octant->children[i])
+            AddOctant(octant->children[i], color, depthTest);
+    }
+}
+
+void DebugRenderer::AddLightShadowFrustums(Light* light, const Color& color, bool depthTest)
+{
+    if (!light->ShadowMap())
+        return;
+
+    std::vector<ShadowView>& views = light->ShadowViews();
+    size_t numViews = light->NumShadowViews();
+    for (size_t i = 0; i < numViews && i < views.size(); ++i)
+        AddFrustum(views[i].shadowFrustum, color, depthTest);
+}
@@ -0,0 +1,104 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Color.h"
+#include "../Math/Vector3.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/Object.h"
+#include "../Thread/Mutex.h"
+
+#include <vector>
+
+class BoundingBox;
+class Camera;
+class Frustum;
+class Light;
+class Matrix3x4;
+class Matrix4;
+class Octree;
+class Renderer;
+class VertexBuffer;
+struct Octant;
+
+/// Initial capacity of the debug geometry vertex buffer in vertices.
+static const size_t DEFAULT_DEBUG_VERTEX_CAPACITY = 4096;
+
+/// Debug geometry vertex.
+struct DebugVertex
+{
+    /// Construct undefined.
+    DebugVertex()
+    {
+    }
+
+    /// Construct with position and packed color.
+    DebugVertex(const Vector3& position_, unsigned color_) :
+        position(position_),
+        color(color_)
+    {
+    }
+
+    /// World position.
+    Vector3 position;
+    /// RGBA8 color.
+    unsigned color;
+};
+
+/// Debug geometry renderer subsystem. Lines and triangles are accumulated into CPU arrays during the frame, which may happen from worker threads, and drawn by Render() with one upload of a dynamic vertex buffer and a draw per primitive type and depth test mode. The draws are not counted in the renderer's statistics, so visualizing the scene structure does not distort the numbers being measured.
+class DebugRenderer : public Object
+{
+    OBJECT(DebugRenderer);
+
+public:
+    /// Construct and register subsystem. %Graphics subsystem must have been initialized.
+    DebugRenderer();
+    /// Destruct.
+    ~DebugRenderer();
+
+    /// Add a line. Thread-safe.
+    void AddLine(const Vector3& start, const Vector3& end, const Color& color, bool depthTest = true);
+    /// Add a triangle. Thread-safe.
+    void AddTriangle(const Vector3& v1, const Vector3& v2, const Vector3& v3, const Color& color, bool depthTest = true);
+    /// Add the edges of a world space bounding box. Thread-safe.
+    void AddBoundingBox(const BoundingBox& box, const Color& color, bool depthTest = true);
+    /// Add the edges of a bounding box transformed to world space. Thread-safe.
+    void AddBoundingBox(const BoundingBox& box, const Matrix3x4& transform, const Color& color, bool depthTest = true);
+    /// Add the edges of a world space frustum. Thread-safe.
+    void AddFrustum(const Frustum& frustum, const Color& color, bool depthTest = true);
+    /// Add the culling boxes of the octants that contain nodes. Must not overlap an octree update.
+    void AddOctree(const Octree* octree, const Color& color, bool depthTest = true);
+    /// Add the bounding boxes of the renderer's light clusters, which are in the view space of the camera it prepared the view for.
+    void AddLightClusters(const Renderer* renderer, const Camera* camera, const Color& color, bool depthTest = false);
+    /// Add the shadow camera frustums of the shadowed lights in the renderer's current view.
+    void AddShadowFrustums(const Renderer* renderer, const Color& color, bool depthTest = true);
+
+    /// Draw the accumulated geometry with a camera's view-projection matrix into the currently set framebuffer and viewport, then clear it. Capture the matrix after the view has been prepared, so that its depth convention matches the depth buffer.
+    void Render(const Matrix4& viewProjMatrix);
+    /// Clear the accumulated geometry without drawing.
+    void Clear();
+
+    /// Return number of accumulated lines.
+    size_t NumLines() const { return (lines[0].size() + lines[1].size()) / 2; }
+    /// Return number of accumulated triangles.
+    size_t NumTriangles() const { return (triangles[0].size() + triangles[1].size()) / 3; }
+
+private:
+    /// Add the 12 edges of a box given its corners in min-max bit order, X being the lowest bit.
+    void AddBoxEdges(const Vector3* corners, unsigned color, bool depthTest);
+    /// Add the culling boxes of an octant and its children that contain nodes.
+    void AddOctant(const Octant* octant, unsigned color, bool depthTest);
+    /// Add the shadow view frustums of a light, if it has a shadow map.
+    void AddLightShadowFrustums(Light* light, const Color& color, bool depthTest);
+
+    /// Line vertices without and with depth test.
+    std::vector<DebugVertex> lines[2];
+    /// Triangle vertices without and with depth test.
+    std::vector<DebugVertex> triangles[2];
+    /// Staging of all vertices for the upload.
+    std::vector<DebugVertex> vertices;
+    /// Dynamic vertex buffer.
+    AutoPtr<VertexBuffer> vertexBuffer;
+    /// Mutex for appending.
+    Mutex mutex;
+};
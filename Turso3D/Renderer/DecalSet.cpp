@@ -0,0 +1,75 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../Resource/ResourceCache.h"
+#include "DecalSet.h"
+
+DecalSet::DecalSet() :
+    first(0),
+    maxDecals(DEFAULT_MAX_DECALS)
+{
+}
+
+DecalSet::~DecalSet()
+{
+}
+
+void DecalSet::RegisterObject()
+{
+    RegisterFactory<DecalSet>();
+    RegisterDerivedType<DecalSet, Node>();
+    CopyBaseAttributes<DecalSet, Node>();
+    RegisterAttribute("maxDecals", &DecalSet::MaxDecals, &DecalSet::SetMaxDecals, DEFAULT_MAX_DECALS);
+    RegisterMixedRefAttribute("atlas", &DecalSet::AtlasAttr, &DecalSet::SetAtlasAttr, ResourceRef(Texture::TypeStatic()));
+}
+
+void DecalSet::SetAtlas(Texture* texture)
+{
+    atlas = texture;
+}
+
+void DecalSet::SetMaxDecals(int num)
+{
+    maxDecals = Max(num, 1);
+    RemoveAllDecals();
+}
+
+void DecalSet::AddDecal(const Vector3& position, const Quaternion& rotation, const Vector3& size, const Vector4& atlasRect, float opacity)
+{
+    Decal newDecal;
+    newDecal.transform = Matrix3x4(position, rotation, Vector3(Max(size.x, M_EPSILON), Max(size.y, M_EPSILON), Max(size.z, M_EPSILON)));
+    newDecal.inverseTransform = newDecal.transform.Inverse();
+    newDecal.worldBox = BoundingBox(Vector3(-0.5f, -0.5f, -0.5f), Vector3(0.5f, 0.5f, 0.5f)).Transformed(newDecal.transform);
+    newDecal.atlasRect = atlasRect;
+    newDecal.opacity = Clamp(opacity, 0.0f, 1.0f);
+
+    if (decals.size() < (size_t)maxDecals)
+        decals.push_back(newDecal);
+    else
+    {
+        decals[first] = newDecal;
+        first = (first + 1) % decals.size();
+    }
+}
+
+void DecalSet::RemoveAllDecals()
+{
+    decals.clear();
+    first = 0;
+}
+
+Texture* DecalSet::Atlas() const
+{
+    return atlas;
+}
+
+void DecalSet::SetAtlasAttr(const ResourceRef& texture)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetAtlas(texture.name.length() ? cache->LoadResource<Texture>(texture.name) : nullptr);
+}
+
+ResourceRef DecalSet::AtlasAttr() const
+{
+    return ResourceRef(Texture::TypeStatic(), ResourceName(atlas));
+}
@@ -0,0 +1,80 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/ResourceRef.h"
+#include "../Math/BoundingBox.h"
+#include "../Math/Matrix3x4.h"
+#include "../Math/Vector4.h"
+#include "../Object/Ptr.h"
+#include "../Scene/Node.h"
+
+#include <vector>
+
+class Texture;
+
+/// Default maximum number of decals in a set.
+static const int DEFAULT_MAX_DECALS = 1024;
+
+/// Decal projected through a box onto the opaque geometry inside it.
+struct Decal
+{
+    /// Transform of the unit box centered on the origin, projected along its local Z axis.
+    Matrix3x4 transform;
+    /// Transform from world space to the unit box.
+    Matrix3x4 inverseTransform;
+    /// World space bounding box.
+    BoundingBox worldBox;
+    /// Atlas rectangle in texture coordinates: offset in XY and size in ZW.
+    Vector4 atlasRect;
+    /// Opacity multiplier.
+    float opacity;
+};
+
+/// %Scene node holding world space decals that share an atlas texture, such as damage and markings. Set to the Renderer, which assigns the visible decals to the light clusters, so that the opaque shaders blend them over the albedo with a bounded per-pixel loop instead of a draw per decal. When full, adding a decal replaces the oldest.
+class DecalSet : public Node
+{
+    OBJECT(DecalSet);
+
+public:
+    /// Construct.
+    DecalSet();
+    /// Destruct.
+    ~DecalSet();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Set the atlas texture. Its alpha channel is the decal coverage.
+    void SetAtlas(Texture* texture);
+    /// Set maximum number of decals. Existing decals are removed.
+    void SetMaxDecals(int num);
+    /// Add a decal projected through a box of the given size, toward its local negative Z axis. The atlas rectangle is in texture coordinates: offset in XY and size in ZW.
+    void AddDecal(const Vector3& position, const Quaternion& rotation, const Vector3& size, const Vector4& atlasRect, float opacity = 1.0f);
+    /// Remove all decals.
+    void RemoveAllDecals();
+
+    /// Return the atlas texture.
+    Texture* Atlas() const;
+    /// Return maximum number of decals.
+    int MaxDecals() const { return maxDecals; }
+    /// Return number of decals.
+    size_t NumDecals() const { return decals.size(); }
+    /// Return a decal by age, from the oldest to the newest.
+    const Decal& GetDecal(size_t index) const { return decals[(first + index) % decals.size()]; }
+
+private:
+    /// Set the atlas texture attribute.
+    void SetAtlasAttr(const ResourceRef& texture);
+    /// Return the atlas texture attribute.
+    ResourceRef AtlasAttr() const;
+
+    /// Decals. Wrap around from the oldest once full.
+    std::vector<Decal> decals;
+    /// Atlas texture.
+    SharedPtr<Texture> atlas;
+    /// Index of the oldest decal.
+    size_t first;
+    /// Maximum number of decals.
+    int maxDecals;
+};
@@ -8,6 +8,10 @@
 #include "Camera.h"
 #include "GeometryNode.h"
 #include "Material.h"
+#include "Octree.h"
+
+std::atomic<unsigned> SourceBatches::generation(0);
+std::atomic<unsigned> SourceBatches::lodGeneration(0);
 
 SourceBatches::SourceBatches()
 {
@@ -41,6 +45,8 @@ void SourceBatches::SetNumGeometries(size_t num)
     if (numGeometries == num)
         return;
 
+    MarkChanged();
+
     if (numGeometries < 2 && num < 2)
     {
         numGeometries = num;
@@ -89,6 +95,7 @@ void SourceBatches::SetNumGeometries(size_t num)
 Geometry::Geometry() : 
     drawStart(0),
     drawCount(0),
+    baseVertex(0),
     lodDistance(0.0f)
 {
 }
@@ -97,7 +104,8 @@ Geometry::~Geometry()
 {
 }
 
-GeometryNode::GeometryNode()
+GeometryNode::GeometryNode() :
+    historyFrameNumber(0)
 {
     SetFlag(NF_GEOMETRY, true);
 }
@@ -113,6 +121,7 @@ void GeometryNode::RegisterObject()
     CopyBaseAttributes<GeometryNode, OctreeNode>();
     RegisterMixedRefAttribute("materials", &GeometryNode::MaterialsAttr, &GeometryNode::SetMaterialsAttr,
         ResourceRefList(Material::TypeStatic()));
+    RegisterAttribute("occluder", &GeometryNode::IsOccluder, &GeometryNode::SetOccluder, false);
 }
 
 bool GeometryNode::OnPrepareRender(unsigned short frameNumber, Camera* camera)
@@ -126,6 +135,18 @@ bool GeometryNode::OnPrepareRender(unsigned short frameNumber, Camera* camera)
     return true;
 }
 
+void GeometryNode::UpdateHistory(unsigned short historyFrame)
+{
+    if (historyFrameNumber == historyFrame)
+        return;
+
+    // The history frame number skips 0, so the frame preceding 1 is the largest
+    unsigned short previousFrame = historyFrame > 1 ? historyFrame - 1 : 0xffff;
+    prevWorldTransform = historyFrameNumber == previousFrame ? historyTransform : WorldTransform();
+    historyTransform = WorldTransform();
+    historyFrameNumber = historyFrame;
+}
+
 void GeometryNode::SetNumGeometries(size_t num)
 {
     batches.SetNumGeometries(num);
@@ -161,6 +182,18 @@ void GeometryNode::SetMaterial(size_t index, Material* material)
         batches.SetMaterial(index, material);
 }
 
+void GeometryNode::SetOccluder(bool enable)
+{
+    if (TestFlag(NF_OCCLUDER) != enable)
+    {
+        SetFlag(NF_OCCLUDER, enable);
+
+        // Reinsert into octree so that the octant's copy of the flags is updated
+        if (!TestFlag(NF_OCTREE_UPDATE_QUEUED) && impl->octree)
+            impl->octree->QueueUpdate(this);
+    }
+}
+
 void GeometryNode::SetMaterialsAttr(const ResourceRefList& materials)
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
@@ -171,7 +204,8 @@ void GeometryNode::SetMaterialsAttr(const ResourceRefList& materials)
 ResourceRefList GeometryNode::MaterialsAttr() const
 {
     ResourceRefList ret(Material::TypeStatic());
-    
+    ret.names.resize(batches.NumGeometries());
+
     for (size_t i = 0; i < batches.NumGeometries(); ++i)
         ret.names[i] = ResourceName(GetMaterial(i));
 
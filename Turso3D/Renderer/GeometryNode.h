@@ -4,8 +4,11 @@
 
 #include "../Graphics/GraphicsDefs.h"
 #include "../IO/ResourceRef.h"
+#include "../Math/TriangleBVH.h"
 #include "OctreeNode.h"
 
+#include <atomic>
+
 class GeometryNode;
 class IndexBuffer;
 class Material;
@@ -22,6 +25,17 @@ enum GeometryType
     GEOM_CUSTOM
 };
 
+/// CPU-side triangle data of a geometry for software occlusion rasterization and raycasts.
+struct OccluderGeometry : public RefCounted
+{
+    /// Vertex positions.
+    std::vector<Vector3> vertices;
+    /// Triangle list indices.
+    std::vector<unsigned> indices;
+    /// Bounding volume hierarchy of the triangles. Built only for raycast data.
+    TriangleBVH bvh;
+};
+
 /// Description of geometry to be rendered. %Scene nodes that render the same object can share these to reduce memory load and allow instancing.
 struct Geometry : public RefCounted
 {
@@ -41,8 +55,14 @@ struct Geometry : public RefCounted
     size_t drawStart;
     /// Draw range count. Specifies number of indices if index buffer defined, number of vertices otherwise.
     size_t drawCount;
+    /// Base vertex added to the indices if index buffer defined.
+    unsigned baseVertex;
     /// LOD transition distance.
     float lodDistance;
+    /// Simplified triangle data for occlusion. Null if not available.
+    SharedPtr<OccluderGeometry> occluder;
+    /// Full-detail triangle data for raycasts, kept after the vertex and index data are released to the GPU. Null if not available.
+    SharedPtr<OccluderGeometry> raycastData;
 };
 
 /// Draw call source data with optimal memory storage.
@@ -60,10 +80,15 @@ public:
     /// Set geometry at index.
     void SetGeometry(size_t index, Geometry* geometry)
     {
-        if (numGeometries < 2)
-            *reinterpret_cast<SharedPtr<Geometry>*>(&geomPtr) = geometry;
-        else
-            *reinterpret_cast<SharedPtr<Geometry>*>(geomPtr + index * 2) = geometry;
+        StoreGeometry(index, geometry);
+        MarkChanged();
+    }
+
+    /// Set geometry at index as a result of a LOD level change. Counted separately from other changes, as it does not affect nodes without LOD levels.
+    void SetLodGeometry(size_t index, Geometry* geometry)
+    {
+        StoreGeometry(index, geometry);
+        MarkLodChanged();
     }
 
     /// Set material at index.
@@ -73,6 +98,7 @@ public:
             *reinterpret_cast<SharedPtr<Material>*>(&matPtr) = material;
         else
             *reinterpret_cast<SharedPtr<Material>*>(geomPtr + index * 2 + 1) = material;
+        MarkChanged();
     }
 
     /// Get number of geometries.
@@ -96,7 +122,30 @@ public:
             return reinterpret_cast<SharedPtr<Material>*>(geomPtr + index * 2 + 1)->Get();
     }
 
+    /// Increment the change counter. Called when any geometry or material assignment, or the passes of a material, change. Safe to call from any thread.
+    static void MarkChanged() { generation.fetch_add(1, std::memory_order_relaxed); }
+    /// Increment the LOD level change counter. Called when a node switches between LOD levels or batch sources. Safe to call from any thread.
+    static void MarkLodChanged() { lodGeneration.fetch_add(1, std::memory_order_relaxed); }
+    /// Return the change counter, including LOD level changes. Batches collected from source batches stay valid while it is unchanged.
+    static unsigned Generation() { return generation.load(std::memory_order_relaxed) + lodGeneration.load(std::memory_order_relaxed); }
+    /// Return the change counter excluding LOD level changes. Batches collected from nodes without LOD levels stay valid while it is unchanged.
+    static unsigned AssignmentGeneration() { return generation.load(std::memory_order_relaxed); }
+
 private:
+    /// Store geometry at index.
+    void StoreGeometry(size_t index, Geometry* geometry)
+    {
+        if (numGeometries < 2)
+            *reinterpret_cast<SharedPtr<Geometry>*>(&geomPtr) = geometry;
+        else
+            *reinterpret_cast<SharedPtr<Geometry>*>(geomPtr + index * 2) = geometry;
+    }
+
+    /// Change counter of all source batches, excluding LOD level changes.
+    static std::atomic<unsigned> generation;
+    /// Change counter of LOD level changes.
+    static std::atomic<unsigned> lodGeneration;
+
     /// Geometry pointer or dynamic storage.
     mutable size_t* geomPtr;
     /// Material pointer.
@@ -130,9 +179,15 @@ public:
     void SetMaterial(Material* material);
     /// Set material at geometry index.
     void SetMaterial(size_t index, Material* material);
+    /// Set whether to rasterize into the software occlusion buffer. Requires the geometries to have occluder triangle data.
+    void SetOccluder(bool enable);
+    /// Advance the world transform history to a motion vector history frame. The previous transform is the one recorded on the preceding history frame, or the current one if the node was not rendered then. Called by Renderer once per history frame.
+    void UpdateHistory(unsigned short historyFrame);
 
     /// Return geometry type.
     virtual GeometryType GetGeometryType() const { return GEOM_STATIC; }
+    /// Return per-object shader data for skinned and custom geometry, for example a bone palette offset or a color tint. Read as the instanceData vertex attribute when instanced, or uniform otherwise.
+    virtual Vector4 InstanceData() const { return Vector4::ZERO; }
     /// Return number of geometries / batches.
     size_t NumGeometries() const { return batches.NumGeometries(); }
     /// Return geometry by index.
@@ -141,6 +196,10 @@ public:
     Material* GetMaterial(size_t index) const { return batches.GetMaterial(index); }
     /// Return the draw call source data for direct access
     const SourceBatches& Batches() const { return batches; }
+    /// Return whether is an occluder.
+    bool IsOccluder() const { return TestFlag(NF_OCCLUDER); }
+    /// Return world transform on the previous history frame, or the current if the history was not updated for the given frame.
+    const Matrix3x4& PreviousWorldTransform(unsigned short historyFrame) const { return historyFrameNumber == historyFrame ? prevWorldTransform : WorldTransform(); }
 
 protected:
     /// Set materials list. Used in serialization.
@@ -150,4 +209,12 @@ protected:
 
     /// Draw call source data.
     SourceBatches batches;
+
+private:
+    /// World transform on the previous history frame.
+    Matrix3x4 prevWorldTransform;
+    /// World transform recorded on the last history frame.
+    Matrix3x4 historyTransform;
+    /// Last history frame.
+    unsigned short historyFrameNumber;
 };
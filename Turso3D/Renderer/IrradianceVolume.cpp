@@ -0,0 +1,312 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Log.h"
+#include "../Math/Ray.h"
+#include "../Resource/Image.h"
+#include "../Scene/Scene.h"
+#include "../Time/Profiler.h"
+#include "Camera.h"
+#include "IrradianceVolume.h"
+#include "Light.h"
+#include "Octree.h"
+
+#include <algorithm>
+
+static const Vector3 DEFAULT_VOLUME_SIZE(100.0f, 20.0f, 100.0f);
+static const IntVector3 DEFAULT_VOLUME_RESOLUTION(16, 4, 16);
+static const int DEFAULT_PROBES_PER_UPDATE = 256;
+static const float DEFAULT_SAMPLE_OFFSET = 0.5f;
+/// Maximum number of probes along an axis.
+static const int MAX_VOLUME_RESOLUTION = 128;
+/// Number of probes per bake task.
+static const size_t PROBES_PER_TASK = 16;
+/// Offset of the visibility rays from the probe, to not hit a surface the probe lies on.
+static const float PROBE_RAY_OFFSET = 0.01f;
+
+IrradianceVolume::IrradianceVolume() :
+    size(DEFAULT_VOLUME_SIZE),
+    resolution(DEFAULT_VOLUME_RESOLUTION),
+    probesPerUpdate(DEFAULT_PROBES_PER_UPDATE),
+    sampleOffset(DEFAULT_SAMPLE_OFFSET),
+    octree(nullptr),
+    textureResolution(IntVector3::ZERO),
+    nextProbe(0),
+    bakeStaticGeneration(0),
+    dirty(true)
+{
+}
+
+IrradianceVolume::~IrradianceVolume()
+{
+}
+
+void IrradianceVolume::RegisterObject()
+{
+    RegisterFactory<IrradianceVolume>();
+    RegisterDerivedType<IrradianceVolume, SpatialNode>();
+    CopyBaseAttributes<IrradianceVolume, SpatialNode>();
+
+    RegisterRefAttribute("size", &IrradianceVolume::Size, &IrradianceVolume::SetSize, DEFAULT_VOLUME_SIZE);
+    RegisterRefAttribute("resolution", &IrradianceVolume::Resolution, &IrradianceVolume::SetResolution, DEFAULT_VOLUME_RESOLUTION);
+    RegisterAttribute("probesPerUpdate", &IrradianceVolume::ProbesPerUpdate, &IrradianceVolume::SetProbesPerUpdate, DEFAULT_PROBES_PER_UPDATE);
+    RegisterAttribute("sampleOffset", &IrradianceVolume::SampleOffset, &IrradianceVolume::SetSampleOffset, DEFAULT_SAMPLE_OFFSET);
+}
+
+void IrradianceVolume::SetSize(const Vector3& size_)
+{
+    size = Vector3(Max(size_.x, M_EPSILON), Max(size_.y, M_EPSILON), Max(size_.z, M_EPSILON));
+    Invalidate();
+}
+
+void IrradianceVolume::SetResolution(const IntVector3& resolution_)
+{
+    resolution = IntVector3(Clamp(resolution_.x, 1, MAX_VOLUME_RESOLUTION), Clamp(resolution_.y, 1, MAX_VOLUME_RESOLUTION), Clamp(resolution_.z, 1, MAX_VOLUME_RESOLUTION));
+    Invalidate();
+}
+
+void IrradianceVolume::SetProbesPerUpdate(int num)
+{
+    probesPerUpdate = Max(num, 1);
+}
+
+void IrradianceVolume::SetSampleOffset(float offset)
+{
+    sampleOffset = Max(offset, 0.0f);
+}
+
+void IrradianceVolume::Invalidate()
+{
+    dirty = true;
+}
+
+void IrradianceVolume::Update()
+{
+    PROFILE(UpdateIrradianceVolume);
+
+    Scene* scene = ParentScene();
+    Octree* currentOctree = scene ? scene->FindChild<Octree>() : nullptr;
+    if (!currentOctree)
+        return;
+
+    // Restart also if the static geometry changed during the bake, as the probes baked so far may be out of date
+    if (dirty || currentOctree != octree || currentOctree->StaticGeneration() != bakeStaticGeneration)
+    {
+        if (!BeginBake())
+            return;
+    }
+
+    BakeProbes((size_t)probesPerUpdate);
+}
+
+void IrradianceVolume::Bake()
+{
+    PROFILE(BakeIrradianceVolume);
+
+    if (BeginBake())
+        BakeProbes(NumProbes());
+}
+
+BoundingBox IrradianceVolume::WorldBox() const
+{
+    Vector3 center = WorldPosition();
+    Vector3 halfSize = 0.5f * size;
+    return BoundingBox(center - halfSize, center + halfSize);
+}
+
+void IrradianceVolume::ShaderParameters(Vector4& minAndNumZ, Vector4& invSizeAndOffset) const
+{
+    if (!texture)
+    {
+        minAndNumZ = Vector4::ZERO;
+        invSizeAndOffset = Vector4::ZERO;
+        return;
+    }
+
+    Vector3 textureSize = textureBox.Size();
+    minAndNumZ = Vector4(textureBox.min, (float)textureResolution.z);
+    invSizeAndOffset = Vector4(1.0f / textureSize.x, 1.0f / textureSize.y, 1.0f / textureSize.z, sampleOffset);
+}
+
+void IrradianceVolume::OnTransformChanged()
+{
+    SpatialNode::OnTransformChanged();
+
+    Invalidate();
+}
+
+bool IrradianceVolume::BeginBake()
+{
+    Scene* scene = ParentScene();
+    octree = scene ? scene->FindChild<Octree>() : nullptr;
+    if (!octree)
+        return false;
+
+    bakeBox = WorldBox();
+    bakeStaticGeneration = octree->StaticGeneration();
+    nextProbe = 0;
+    dirty = false;
+
+    probeData.resize(NumProbes() * 3);
+    lights.clear();
+
+    std::vector<OctreeNode*> nodes;
+    octree->FindNodes(nodes, bakeBox, NF_LIGHT);
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        Light* light = static_cast<Light*>(*it);
+        if (!light->IsBaked() || !light->IsEnabled())
+            continue;
+
+        IrradianceLight data;
+        LightType type = light->GetLightType();
+        const Color& color = light->GetColor();
+
+        data.position = light->WorldPosition();
+        data.direction = -light->WorldDirection();
+        data.color = Vector3(color.r, color.g, color.b);
+        data.invRange = type != LIGHT_DIRECTIONAL ? 1.0f / Max(light->Range(), M_EPSILON) : 0.0f;
+        data.cutoff = type == LIGHT_SPOT ? cosf(light->Fov() * 0.5f * M_DEGTORAD) : 0.0f;
+        data.invCutoffRange = 1.0f / (1.0f - data.cutoff);
+        data.directional = type == LIGHT_DIRECTIONAL;
+        lights.push_back(data);
+    }
+
+    return true;
+}
+
+void IrradianceVolume::BakeProbes(size_t count)
+{
+    size_t numProbes = NumProbes();
+    size_t start = nextProbe;
+    size_t end = std::min(start + count, numProbes);
+    if (start >= end)
+        return;
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue && workQueue->NumWorkerThreads() && end - start > PROBES_PER_TASK)
+    {
+        size_t numTasks = (end - start + PROBES_PER_TASK - 1) / PROBES_PER_TASK;
+        while (tasks.size() < numTasks)
+            tasks.push_back(new RangeTask<IrradianceVolume>(this, &IrradianceVolume::BakeProbesWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<IrradianceVolume>* task = tasks[i];
+            task->start = start + i * PROBES_PER_TASK;
+            task->end = std::min(start + (i + 1) * PROBES_PER_TASK, end);
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+    {
+        for (size_t i = start; i < end; ++i)
+            BakeProbe(i);
+    }
+
+    nextProbe = end;
+    if (nextProbe >= numProbes)
+        UploadTexture();
+}
+
+void IrradianceVolume::BakeProbesWork(Task* task, unsigned)
+{
+    RangeTask<IrradianceVolume>* rangeTask = static_cast<RangeTask<IrradianceVolume>*>(task);
+    OctreeReadLock lock(octree);
+
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+        BakeProbe(i);
+}
+
+void IrradianceVolume::BakeProbe(size_t index)
+{
+    Vector3 position = ProbePosition(index);
+    Vector4 sh[3] = { Vector4::ZERO, Vector4::ZERO, Vector4::ZERO };
+
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+    {
+        const IrradianceLight& light = *it;
+        Vector3 direction = light.direction;
+        float atten = 1.0f;
+        float distance = M_INFINITY;
+
+        if (!light.directional)
+        {
+            Vector3 lightVec = light.position - position;
+            distance = lightVec.Length();
+            if (distance < M_EPSILON)
+                continue;
+            Vector3 scaledLightVec = lightVec * light.invRange;
+            atten = 1.0f - scaledLightVec.DotProduct(scaledLightVec);
+            if (atten <= 0.0f)
+                continue;
+            direction = lightVec / distance;
+
+            if (light.cutoff > 0.0f)
+            {
+                float spotAtten = (direction.DotProduct(light.direction) - light.cutoff) * light.invCutoffRange;
+                if (spotAtten <= 0.0f)
+                    continue;
+                atten *= spotAtten;
+            }
+        }
+
+        // The baked lights are static, so only the static shadowcasters occlude them
+        Ray ray(position + direction * PROBE_RAY_OFFSET, direction);
+        if (octree->RaycastSingle(ray, NF_GEOMETRY | NF_CASTSHADOWS | NF_STATIC, distance - PROBE_RAY_OFFSET).node)
+            continue;
+
+        // First order projection of the clamped cosine lobe: irradiance toward normal n is approximately color * (1/4 + 1/2 dot(n, l))
+        Vector3 color = atten * light.color;
+        Vector4 lobe(0.25f, 0.5f * direction.x, 0.5f * direction.y, 0.5f * direction.z);
+        sh[0] += lobe * color.x;
+        sh[1] += lobe * color.y;
+        sh[2] += lobe * color.z;
+    }
+
+    size_t numProbes = NumProbes();
+    for (size_t i = 0; i < 3; ++i)
+        probeData[i * numProbes + index] = sh[i];
+}
+
+void IrradianceVolume::UploadTexture()
+{
+    IntVector3 textureSize(resolution.x, resolution.y, resolution.z * 3);
+    ImageLevel level(textureSize, FMT_RGBA32F, &probeData[0]);
+
+    if (!texture || textureResolution != resolution)
+    {
+        if (!texture)
+            texture = new Texture();
+        if (!texture->Define(TEX_3D, textureSize, FMT_RGBA32F, 1, 1, &level))
+        {
+            LOGERROR("Failed to create irradiance volume texture");
+            texture.Reset();
+            return;
+        }
+        texture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+    else
+        texture->SetData(0, IntBox(0, 0, 0, textureSize.x, textureSize.y, textureSize.z), level);
+
+    textureBox = bakeBox;
+    textureResolution = resolution;
+}
+
+Vector3 IrradianceVolume::ProbePosition(size_t index) const
+{
+    // Probes are at the cell centers, so that the texel centers of the texture line up with them
+    size_t x = index % resolution.x;
+    size_t y = (index / resolution.x) % resolution.y;
+    size_t z = index / ((size_t)resolution.x * resolution.y);
+    Vector3 bakeSize = bakeBox.Size();
+
+    return bakeBox.min + Vector3(
+        ((float)x + 0.5f) * bakeSize.x / resolution.x,
+        ((float)y + 0.5f) * bakeSize.y / resolution.y,
+        ((float)z + 0.5f) * bakeSize.z / resolution.z
+    );
+}
@@ -0,0 +1,132 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Math/IntVector3.h"
+#include "../Math/Vector4.h"
+#include "../Object/AutoPtr.h"
+#include "../Scene/SpatialNode.h"
+#include "../Thread/WorkQueue.h"
+
+#include <vector>
+
+class Octree;
+class Texture;
+
+/// Light data copied from a baked light at the start of a bake.
+struct IrradianceLight
+{
+    /// World position.
+    Vector3 position;
+    /// Direction toward the light.
+    Vector3 direction;
+    /// Color.
+    Vector3 color;
+    /// Reciprocal of range. Zero for directional lights.
+    float invRange;
+    /// Spotlight cutoff cosine, zero for other light types.
+    float cutoff;
+    /// Reciprocal of the spotlight falloff range.
+    float invCutoffRange;
+    /// Directional light flag.
+    bool directional;
+};
+
+/// Grid of irradiance probes in an axis-aligned box centered on the node position. Each probe stores first order spherical harmonics of the light received from the lights marked baked, with visibility raytraced against the static shadowcasting geometry, so that the baked lights need not be rendered. The probes are baked incrementally a batch per update, in parallel worker tasks, and the finished grid is uploaded to a 3D texture that the lighting shaders sample in place of the flat ambient color. A bake restarts when the static geometry of the octree changes or the volume is invalidated.
+class IrradianceVolume : public SpatialNode
+{
+    OBJECT(IrradianceVolume);
+
+public:
+    /// Construct.
+    IrradianceVolume();
+    /// Destruct.
+    ~IrradianceVolume();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Set size of the box.
+    void SetSize(const Vector3& size);
+    /// Set number of probes along each axis.
+    void SetResolution(const IntVector3& resolution);
+    /// Set number of probes to bake per update.
+    void SetProbesPerUpdate(int num);
+    /// Set distance along the surface normal to sample the volume from, to reduce the influence of probes behind the surface.
+    void SetSampleOffset(float offset);
+    /// Restart the bake, for example after changing the baked lights.
+    void Invalidate();
+    /// Bake the next batch of probes and upload the grid once all are done. Restarts the bake if invalidated or the static geometry has changed. Call once per frame from the main thread, outside the octree update.
+    void Update();
+    /// Bake all probes now and upload the grid.
+    void Bake();
+
+    /// Return size of the box.
+    const Vector3& Size() const { return size; }
+    /// Return number of probes along each axis.
+    const IntVector3& Resolution() const { return resolution; }
+    /// Return number of probes to bake per update.
+    int ProbesPerUpdate() const { return probesPerUpdate; }
+    /// Return sampling distance along the surface normal.
+    float SampleOffset() const { return sampleOffset; }
+    /// Return total number of probes.
+    size_t NumProbes() const { return (size_t)resolution.x * resolution.y * resolution.z; }
+    /// Return number of probes baked in the bake in progress.
+    size_t NumBakedProbes() const { return nextProbe; }
+    /// Return world space box.
+    BoundingBox WorldBox() const;
+    /// Return the irradiance texture, or null if not baked yet. The RGB channels are stacked along Z, each texel holding the constant term and the normal dependent terms of the channel.
+    Texture* IrradianceTexture() const { return texture; }
+    /// Return the shader parameters: minimum corner and number of probes along Z, and inverse size and sample offset. Zero number of probes if not baked yet.
+    void ShaderParameters(Vector4& minAndNumZ, Vector4& invSizeAndOffset) const;
+
+protected:
+    /// Handle the transform matrix changing.
+    void OnTransformChanged() override;
+
+private:
+    /// Restart the bake: find the octree and copy the baked lights.
+    bool BeginBake();
+    /// Bake a range of probes in parallel and advance.
+    void BakeProbes(size_t count);
+    /// Work function to bake a range of probes.
+    void BakeProbesWork(Task* task, unsigned threadIndex);
+    /// Bake one probe.
+    void BakeProbe(size_t index);
+    /// Upload the finished grid.
+    void UploadTexture();
+    /// Return world position of a probe.
+    Vector3 ProbePosition(size_t index) const;
+
+    /// Size of the box.
+    Vector3 size;
+    /// Number of probes along each axis.
+    IntVector3 resolution;
+    /// Number of probes to bake per update.
+    int probesPerUpdate;
+    /// Sampling distance along the surface normal.
+    float sampleOffset;
+    /// Irradiance texture.
+    SharedPtr<Texture> texture;
+    /// Octree of the bake in progress.
+    Octree* octree;
+    /// Lights of the bake in progress.
+    std::vector<IrradianceLight> lights;
+    /// Probe data of the bake in progress, in the texture layout.
+    std::vector<Vector4> probeData;
+    /// Box of the bake in progress.
+    BoundingBox bakeBox;
+    /// Box of the uploaded texture.
+    BoundingBox textureBox;
+    /// Resolution of the uploaded texture.
+    IntVector3 textureResolution;
+    /// Bake tasks.
+    std::vector<AutoPtr<RangeTask<IrradianceVolume> > > tasks;
+    /// Next probe to bake.
+    size_t nextProbe;
+    /// Octree static generation at the start of the bake.
+    unsigned bakeStaticGeneration;
+    /// Whether the bake must restart.
+    bool dirty;
+};
@@ -5,7 +5,9 @@
 #include "../IO/Log.h"
 #include "../Math/Ray.h"
 #include "Camera.h"
+#include "GeometryNode.h"
 #include "Light.h"
+#include "Material.h"
 #include "Octree.h"
 #include "Renderer.h"
 
@@ -20,6 +22,7 @@ static const float DEFAULT_SHADOW_MAX_STRENGTH = 0.0f;
 static const float DEFAULT_SHADOW_QUANTIZE = 0.5f;
 static const float DEFAULT_DEPTH_BIAS = 2.0f;
 static const float DEFAULT_SLOPESCALE_BIAS = 1.5f;
+static const int DEFAULT_SHADOW_CASCADES = 2;
 
 static const char* lightTypeNames[] =
 {
@@ -36,13 +39,17 @@ Light::Light() :
     fov(DEFAULT_SPOT_FOV),
     fadeStart(DEFAULT_FADE_START),
     shadowMapSize(DEFAULT_SHADOWMAP_SIZE),
+    numShadowCascades(DEFAULT_SHADOW_CASCADES),
     shadowFadeStart(DEFAULT_FADE_START),
     shadowMaxDistance(DEFAULT_SHADOW_MAX_DISTANCE),
     shadowMaxStrength(DEFAULT_SHADOW_MAX_STRENGTH),
     shadowQuantize(DEFAULT_SHADOW_QUANTIZE),
     depthBias(DEFAULT_DEPTH_BIAS),
     slopeScaleBias(DEFAULT_SLOPESCALE_BIAS),
-    shadowMap(nullptr)
+    importance(0.0f),
+    baked(false),
+    shadowMap(nullptr),
+    staticShadowCastersVersion(0)
 {
     SetFlag(NF_LIGHT, true);
 }
@@ -58,21 +65,26 @@ void Light::RegisterObject()
     CopyBaseAttributes<Light, OctreeNode>();
     RegisterDerivedType<Light, OctreeNode>();
     RegisterAttribute("lightType", &Light::LightTypeAttr, &Light::SetLightTypeAttr, (int)DEFAULT_LIGHTTYPE, lightTypeNames);
-    RegisterRefAttribute("color", &Light::GetColor, &Light::SetColor, DEFAULT_COLOR);
+    RegisterMemberAttribute("color", &Light::color, DEFAULT_COLOR);
     RegisterAttribute("range", &Light::Range, &Light::SetRange, DEFAULT_RANGE);
     RegisterAttribute("fov", &Light::Fov, &Light::SetFov, DEFAULT_SPOT_FOV);
     RegisterAttribute("fadeStart", &Light::FadeStart, &Light::SetFadeStart, DEFAULT_FADE_START);
     RegisterAttribute("shadowMapSize", &Light::ShadowMapSize, &Light::SetShadowMapSize, DEFAULT_SHADOWMAP_SIZE);
+    RegisterAttribute("shadowCascades", &Light::NumShadowCascades, &Light::SetNumShadowCascades, DEFAULT_SHADOW_CASCADES);
     RegisterAttribute("shadowFadeStart", &Light::ShadowFadeStart, &Light::SetShadowFadeStart, DEFAULT_FADE_START);
     RegisterAttribute("shadowMaxDistance", &Light::ShadowMaxDistance, &Light::SetShadowMaxDistance, DEFAULT_SHADOW_MAX_DISTANCE);
     RegisterAttribute("shadowMaxStrength", &Light::ShadowMaxStrength, &Light::SetShadowMaxStrength, DEFAULT_SHADOW_MAX_STRENGTH);
     RegisterAttribute("shadowQuantize", &Light::ShadowQuantize, &Light::SetShadowQuantize, DEFAULT_SHADOW_QUANTIZE);
     RegisterAttribute("depthBias", &Light::DepthBias, &Light::SetDepthBias, DEFAULT_DEPTH_BIAS);
     RegisterAttribute("slopeScaleBias", &Light::SlopeScaleBias, &Light::SetSlopeScaleBias, DEFAULT_SLOPESCALE_BIAS);
+    RegisterAttribute("baked", &Light::IsBaked, &Light::SetBaked, false);
 }
 
 bool Light::OnPrepareRender(unsigned short frameNumber, Camera* camera)
 {
+    if (baked)
+        return false;
+
     switch (lightType)
     {
     case LIGHT_DIRECTIONAL:
@@ -91,6 +103,15 @@ bool Light::OnPrepareRender(unsigned short frameNumber, Camera* camera)
     if (maxDistance > 0.0f && distance > maxDistance)
         return false;
 
+    // The covered share is the squared ratio of radius to distance far away and approaches one when the camera is within range
+    if (lightType != LIGHT_DIRECTIONAL)
+    {
+        float radiusSquared = WorldBoundingBox().HalfSize().LengthSquared();
+        importance = EffectiveColor().Average() * radiusSquared / Max(radiusSquared + distance * distance, M_EPSILON);
+    }
+    else
+        importance = EffectiveColor().Average();
+
     // If there was a discontinuity in rendering the light, assume cached shadow map content lost
     unsigned previousFrameNumber = frameNumber - 1;
     if (!previousFrameNumber)
@@ -205,6 +226,11 @@ void Light::SetShadowQuantize(float quantize)
     shadowQuantize = Max(quantize, M_EPSILON);
 }
 
+void Light::SetNumShadowCascades(int num)
+{
+    numShadowCascades = Clamp(num, 1, MAX_SHADOW_CASCADES);
+}
+
 void Light::SetDepthBias(float bias)
 {
     depthBias = Max(bias, 0.0f);
@@ -215,10 +241,15 @@ void Light::SetSlopeScaleBias(float bias)
     slopeScaleBias = Max(bias, 0.0f);
 }
 
+void Light::SetBaked(bool enable)
+{
+    baked = enable;
+}
+
 IntVector2 Light::TotalShadowMapSize() const
 {
     if (lightType == LIGHT_DIRECTIONAL)
-        return IntVector2(shadowMapSize * 2, shadowMapSize);
+        return IntVector2(shadowMapSize * Min(numShadowCascades, 2), shadowMapSize * (numShadowCascades > 2 ? 2 : 1));
     else if (lightType == LIGHT_POINT)
         return IntVector2(shadowMapSize * 3, shadowMapSize * 2);
     else
@@ -254,15 +285,16 @@ float Light::ShadowStrength() const
 
 float Light::ShadowSplit(size_t index) const
 {
-    if (index == 0)
-        return 0.25f * shadowMaxDistance;
-    else
+    if (index + 1 >= (size_t)numShadowCascades)
         return shadowMaxDistance;
+
+    float fraction = (float)(index + 1) / (float)numShadowCascades;
+    return fraction * fraction * shadowMaxDistance;
 }
 
-Vector2 Light::ShadowSplits() const
+Vector4 Light::ShadowSplits() const
 {
-    return Vector2(ShadowSplit(0), ShadowSplit(1));
+    return Vector4(ShadowSplit(0), ShadowSplit(1), ShadowSplit(2), ShadowSplit(3));
 }
 
 size_t Light::NumShadowViews() const
@@ -270,7 +302,7 @@ size_t Light::NumShadowViews() const
     if (!CastShadows())
         return 0;
     else if (lightType == LIGHT_DIRECTIONAL)
-        return 2;
+        return numShadowCascades;
     else if (lightType == LIGHT_POINT)
         return 6;
     else
@@ -300,6 +332,58 @@ void Light::SetShadowMap(Texture* shadowMap_, const IntRect& shadowRect_)
     shadowRect = shadowRect_;
 }
 
+void Light::UpdateStaticShadowCasters(Octree* octree)
+{
+    const Matrix3x4& transform = WorldTransform();
+    unsigned generation = octree->Generation();
+    unsigned staticGeneration = octree->StaticGeneration();
+
+    if (staticShadowCastersVersion && lightType == staticShadowCastersType && range == staticShadowCastersRange && fov == staticShadowCastersFov &&
+        transform.Equals(staticShadowCastersTransform))
+    {
+        if (staticGeneration == staticShadowCastersStaticGeneration)
+            return;
+
+        // Static geometry changed somewhere. Keep the shadowcasters if nothing changed within the light's bounds
+        if (!octree->ChangedSince(WorldBoundingBox(), staticShadowCastersGeneration))
+        {
+            staticShadowCastersGeneration = generation;
+            staticShadowCastersStaticGeneration = staticGeneration;
+            return;
+        }
+    }
+
+    // The query is rare, as the shadowcasters are cached, so use a temporary vector instead of aliasing the cache
+    std::vector<OctreeNode*> result;
+
+    switch (lightType)
+    {
+    case LIGHT_POINT:
+        octree->FindNodes(result, WorldSphere(), NF_GEOMETRY | NF_CASTSHADOWS | NF_STATIC);
+        break;
+
+    case LIGHT_SPOT:
+        octree->FindNodesMasked(result, WorldFrustum(), NF_GEOMETRY | NF_CASTSHADOWS | NF_STATIC);
+        break;
+
+    default:
+        break;
+    }
+
+    staticShadowCasters.resize(result.size());
+    for (size_t i = 0; i < result.size(); ++i)
+        staticShadowCasters[i] = static_cast<GeometryNode*>(result[i]);
+
+    staticShadowCastersTransform = transform;
+    staticShadowCastersRange = range;
+    staticShadowCastersFov = fov;
+    staticShadowCastersType = lightType;
+    staticShadowCastersGeneration = generation;
+    staticShadowCastersStaticGeneration = staticGeneration;
+    if (!++staticShadowCastersVersion)
+        ++staticShadowCastersVersion;
+}
+
 void Light::SetupShadowViews(Camera* mainCamera)
 {
     size_t numViews = NumShadowViews();
@@ -311,6 +395,9 @@ void Light::SetupShadowViews(Camera* mainCamera)
     int numVerticalSplits = lightType == LIGHT_POINT ? 2 : 1;
     int actualShadowMapSize = shadowRect.Height() / numVerticalSplits;
     float pointShadowZoom = (float)(actualShadowMapSize - 4) / (float)actualShadowMapSize;
+    // Directional light shadow receivers are within the octree's nodes
+    Octree* octree = lightType == LIGHT_DIRECTIONAL ? GetOctree() : nullptr;
+    BoundingBox nodeBounds = octree ? octree->NodeBounds() : BoundingBox();
 
     for (size_t i = 0; i < numViews; ++i)
     {
@@ -329,6 +416,8 @@ void Light::SetupShadowViews(Camera* mainCamera)
             IntVector2 topLeft(shadowRect.left, shadowRect.top);
             if (i & 1)
                 topLeft.x += actualShadowMapSize;
+            if (i & 2)
+                topLeft.y += actualShadowMapSize;
             view.viewport = IntRect(topLeft.x, topLeft.y, topLeft.x + actualShadowMapSize, topLeft.y + actualShadowMapSize);
 
             float splitStart = Max(mainCamera->NearClip(), (i == 0) ? 0.0f : ShadowSplit(i - 1));
@@ -342,10 +431,18 @@ void Light::SetupShadowViews(Camera* mainCamera)
             Frustum splitFrustum = mainCamera->WorldSplitFrustum(splitStart, splitEnd);
             view.lightViewFrustum = splitFrustum.Transformed(shadowCamera->ViewMatrix());
 
-            // Fit the frustum inside a bounding box
+            // Fit the frustum inside a bounding box for the depth range, and a bounding sphere for the width and height so that the shadow camera size does not change when the main camera rotates
             BoundingBox shadowBox;
             shadowBox.Define(view.lightViewFrustum);
 
+            Vector3 sphereCenter(Vector3::ZERO);
+            for (size_t j = 0; j < NUM_FRUSTUM_VERTICES; ++j)
+                sphereCenter += view.lightViewFrustum.vertices[j];
+            sphereCenter /= (float)NUM_FRUSTUM_VERTICES;
+            float sphereRadius = 0.0f;
+            for (size_t j = 0; j < NUM_FRUSTUM_VERTICES; ++j)
+                sphereRadius = Max(sphereRadius, (view.lightViewFrustum.vertices[j] - sphereCenter).Length());
+
             // If shadow camera is far away from the frustum, can bring it closer for better depth precision
             /// \todo The minimum distance is somewhat arbitrary
             float minDistance = mainCamera->FarClip() * 0.25f;
@@ -360,8 +457,8 @@ void Light::SetupShadowViews(Camera* mainCamera)
             shadowCamera->SetOrthographic(true);
             shadowCamera->SetFarClip(shadowBox.max.z);
 
-            Vector3 center = shadowBox.Center();
-            Vector3 size = shadowBox.Size();
+            Vector3 center(sphereCenter.x, sphereCenter.y, shadowBox.Center().z);
+            Vector3 size(2.0f * sphereRadius, 2.0f * sphereRadius, shadowBox.Size().z);
 
             size.x = ceilf(sqrtf(size.x / shadowQuantize));
             size.y = ceilf(sqrtf(size.y / shadowQuantize));
@@ -387,6 +484,14 @@ void Light::SetupShadowViews(Camera* mainCamera)
             }
 
             view.shadowFrustum = shadowCamera->WorldFrustum();
+
+            // Shadowcasters affect the split only if they are inside it, or between it and the light
+            view.casterVolume.Define(splitFrustum);
+            if (octree)
+                view.casterVolume.Clip(nodeBounds);
+            view.casterVolume.Sweep(-WorldDirection());
+            for (size_t j = 0; j < NUM_FRUSTUM_PLANES; ++j)
+                view.casterVolume.AddPlane(view.shadowFrustum.planes[j]);
         }
         break;
 
@@ -458,7 +563,7 @@ void Light::SetupShadowViews(Camera* mainCamera)
             texAdjust.SetTranslation(viewOffset);
             texAdjust.SetScale(viewScale);
 
-            view.shadowMatrix = texAdjust * shadowCamera->ProjectionMatrix() * shadowCamera->ViewMatrix();
+            view.shadowMatrix = texAdjust * shadowCamera->ViewProjMatrix();
         }
     }
     else
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../Math/Color.h"
+#include "../Math/ConvexVolume.h"
 #include "../Math/Frustum.h"
 #include "../Math/IntRect.h"
 #include "../Math/IntVector2.h"
@@ -12,6 +13,7 @@
 class Camera;
 class GeometryNode;
 class Light;
+class Octree;
 class Texture;
 struct ShadowView;
 
@@ -29,7 +31,8 @@ enum ShadowRenderMode
     RENDER_DYNAMIC_LIGHT,
     RENDER_STATIC_LIGHT_STORE_STATIC,
     RENDER_STATIC_LIGHT_RESTORE_STATIC,
-    RENDER_STATIC_LIGHT_CACHED
+    RENDER_STATIC_LIGHT_CACHED,
+    RENDER_STATIC_LIGHT_LOAD_BAKED
 };
 
 /// Shadow rendering view data structure.
@@ -37,7 +40,16 @@ struct ShadowView
 {
     /// Default construct.
     ShadowView() :
-        lastViewport(IntRect::ZERO)
+        deferUpdate(false),
+        updatePending(false),
+        staticStored(false),
+        singlePass(false),
+        lastViewport(IntRect::ZERO),
+        lastDynamicRect(IntRect::ZERO),
+        lastRenderFrame(0),
+        bakeKey(0),
+        staticShadowCastersVersion(0),
+        staticShadowCastersZoom(0.0f)
     {
     }
 
@@ -51,6 +63,8 @@ struct ShadowView
     Frustum shadowFrustum;
     /// Main camera frustum in light's view space for shadowcaster visibility optimization.
     Frustum lightViewFrustum;
+    /// Volume that can hold the shadowcasters of the view: the main camera split clipped to the octree's node bounds, swept toward the light and bounded by the shadow frustum. Used by directional lights.
+    ConvexVolume casterVolume;
     /// Current shadow projection matrix.
     Matrix4 shadowMatrix;
     /// Shadow render mode to use.
@@ -59,14 +73,36 @@ struct ShadowView
     size_t staticQueueIdx;
     /// Dynamic object batch queue index in the shadowmap.
     size_t dynamicQueueIdx;
+    /// Shadow map area to restore from the static shadow map and redraw when restoring static.
+    IntRect dirtyRect;
+    /// Whether to leave the shadow map stale this frame if it stays in place, due to update throttling or budget.
+    bool deferUpdate;
+    /// Whether an update was deferred, so that the changes since the last render are not known and the next render is full.
+    bool updatePending;
     /// Whether last render had dynamic shadowcasters.
     bool lastDynamicCasters;
+    /// Whether the static shadowcasters of the last viewport and projection are stored in the static shadow map. Used by static directional lights.
+    bool staticStored;
+    /// Whether static geometry is rendered for all faces of the point light at once. The static queue then holds the face's batches to be combined.
+    bool singlePass;
     /// Last viewport used in shadow map render.
     IntRect lastViewport;
+    /// Shadow map area covered by the dynamic shadowcasters in the last render.
+    IntRect lastDynamicRect;
     /// Last shadow projection matrix.
     Matrix4 lastShadowMatrix;
     /// Last amount of geometries passed in for shadow map render.
     size_t lastNumGeometries;
+    /// Frame number of the last shadow map render.
+    unsigned short lastRenderFrame;
+    /// Key of the baked static shadow tile to load or save on this render, or 0 if none.
+    unsigned long long bakeKey;
+    /// Light's static shadowcasters inside the shadow frustum. Used by static point lights.
+    std::vector<GeometryNode*> staticShadowCasters;
+    /// Version of the light's static shadowcasters that the view's static shadowcasters were filtered from.
+    unsigned staticShadowCastersVersion;
+    /// Shadow camera zoom the view's static shadowcasters were filtered with.
+    float staticShadowCastersZoom;
 };
 
 /// Dynamic light scene node.
@@ -108,10 +144,14 @@ public:
     void SetShadowMaxStrength(float strength);
     /// Set directional light shadow view quantize.
     void SetShadowQuantize(float quantize);
+    /// Set number of directional light shadow cascades, 1-4. The cascades are laid out in a 2x2 grid of the shadow map size.
+    void SetNumShadowCascades(int num);
     /// Set constant depth bias for shadows.
     void SetDepthBias(float bias);
     /// Set slope-scaled depth bias for shadows.
     void SetSlopeScaleBias(float bias);
+    /// Set whether the light is baked into irradiance volumes instead of being rendered. Irradiance volumes must be invalidated after changing baked lights.
+    void SetBaked(bool enable);
 
     /// Return light type.
     LightType GetLightType() const { return lightType; }
@@ -127,10 +167,12 @@ public:
     float FadeStart() const { return fadeStart; }
     /// Return shadow map face resolution in pixels.
     int ShadowMapSize() const { return shadowMapSize; }
-    /// Return shadow split distance by index.
+    /// Return shadow split distance by index. The splits are distributed quadratically up to the shadow max distance.
     float ShadowSplit(size_t index) const;
-    /// Return directional light shadow split distances.
-    Vector2 ShadowSplits() const;
+    /// Return directional light shadow split distances. Unused cascades repeat the last split.
+    Vector4 ShadowSplits() const;
+    /// Return number of directional light shadow cascades.
+    int NumShadowCascades() const { return numShadowCascades; }
     /// Return light shadow fade start as a function of max shadow distance.
     float ShadowFadeStart() const { return shadowFadeStart; }
     /// Return maximum distance for shadow rendering.
@@ -141,10 +183,14 @@ public:
     float ShadowQuantize() const { return shadowQuantize; }
     /// Return effective shadow strength from current distance.
     float ShadowStrength() const;
+    /// Return importance in the current view: the share of the view that the light's range covers, approximated from its bounding sphere and distance, times its distance faded brightness. Used by Renderer to prioritize lights within its light budget.
+    float Importance() const { return importance; }
     /// Return constant depth bias.
     float DepthBias() const { return depthBias; }
     /// Return slope-scaled depth bias.
     float SlopeScaleBias() const { return slopeScaleBias; }
+    /// Return whether is baked into irradiance volumes.
+    bool IsBaked() const { return baked; }
     /// Return total requested shadow map size, accounting for multiple faces / splits for directional and point lights.
     IntVector2 TotalShadowMapSize() const;
     /// Return number of required shadow views / cameras.
@@ -166,6 +212,12 @@ public:
     const IntRect& ShadowRect() const { return shadowRect; }
     /// Return shadow map offset and depth parameters.
     const Vector4& ShadowParameters() const { return shadowParameters; }
+    /// Requery the static shadowcasters within the light's range if the light's transform, range or field of view, or the static geometry of the octree within the light's bounding box have changed since the last query. Called by Renderer for static point and spot lights.
+    void UpdateStaticShadowCasters(Octree* octree);
+    /// Return the static shadowcasters within the light's range.
+    const std::vector<GeometryNode*>& StaticShadowCasters() const { return staticShadowCasters; }
+    /// Return a version number incremented whenever the static shadowcasters are requeried, or 0 if not queried yet.
+    unsigned StaticShadowCastersVersion() const { return staticShadowCastersVersion; }
 
 protected:
     /// Recalculate the world space bounding box.
@@ -189,8 +241,8 @@ private:
     float fadeStart;
     /// Shadow map resolution in pixels.
     int shadowMapSize;
-    /// Directional shadow splits.
-    Vector4 shadowSplits;
+    /// Number of directional light shadow cascades.
+    int numShadowCascades;
     /// Shadow fade start as a function of max distance.
     float shadowFadeStart;
     /// Shadow rendering max distance.
@@ -203,6 +255,10 @@ private:
     float depthBias;
     /// Slope-sclaed depth bias for shadows.
     float slopeScaleBias;
+    /// Importance in the current view.
+    float importance;
+    /// Baked into irradiance volumes flag.
+    bool baked;
     /// Current shadow map texture.
     Texture* shadowMap;
     /// Rectangle within the shadow map.
@@ -211,4 +267,20 @@ private:
     std::vector<ShadowView> shadowViews;
     /// Shadow mapping parameters.
     Vector4 shadowParameters;
+    /// Cached static shadowcasters.
+    std::vector<GeometryNode*> staticShadowCasters;
+    /// World transform the static shadowcasters were queried with.
+    Matrix3x4 staticShadowCastersTransform;
+    /// Range the static shadowcasters were queried with.
+    float staticShadowCastersRange;
+    /// Field of view the static shadowcasters were queried with.
+    float staticShadowCastersFov;
+    /// Light type the static shadowcasters were queried with.
+    LightType staticShadowCastersType;
+    /// Octree generation the static shadowcasters were last validated on.
+    unsigned staticShadowCastersGeneration;
+    /// Octree static generation the static shadowcasters were last validated on.
+    unsigned staticShadowCastersStaticGeneration;
+    /// Version number of the static shadowcasters.
+    unsigned staticShadowCastersVersion;
 };
@@ -1,12 +1,19 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../Graphics/Texture.h"
+#include "../Graphics/UniformBuffer.h"
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
+#include "../IO/Log.h"
 #include "../IO/StringUtils.h"
 #include "../Resource/JSONFile.h"
 #include "../Resource/ResourceCache.h"
 #include "../Time/Profiler.h"
+#include "GeometryNode.h"
 #include "Material.h"
 
+#include <cstring>
+
 const char* passNames[] = {
     "shadow",
     "opaque",
@@ -20,21 +27,49 @@ const char* geometryDefines[] = {
     "",
     "INSTANCED ",
     "SKINNED ",
-    "",
+    "CUSTOMGEOM ",
     nullptr
 };
 
+/// Define hashes of the geometry types.
+static const unsigned long long geometryDefinesHashes[] = {
+    Shader::HashDefines(geometryDefines[0]),
+    Shader::HashDefines(geometryDefines[1]),
+    Shader::HashDefines(geometryDefines[2]),
+    Shader::HashDefines(geometryDefines[3])
+};
+static const unsigned long long instancedDefineHash = Shader::HashDefines("INSTANCED");
+static const unsigned long long deferredDefineHash = Shader::HashDefines("DEFERRED");
+static const unsigned long long oitDefineHash = Shader::HashDefines("OIT");
+static const unsigned long long motionDefineHash = Shader::HashDefines("MOTION");
+static const unsigned long long cubeShadowDefineHash = Shader::HashDefines("CUBESHADOW");
+
+/// Binary material cache format version.
+static const unsigned MATERIAL_CACHE_VERSION = 1;
+/// Directory of the binary material cache, or empty if disabled.
+static std::string binaryCacheDir;
+
 std::set<Material*> Material::allMaterials;
 SharedPtr<Material> Material::defaultMaterial;
 std::string Material::globalVSDefines;
 std::string Material::globalFSDefines;
+std::string Material::rendererVSDefines;
+std::string Material::rendererFSDefines;
+unsigned long long Material::globalVSDefinesHash = 0;
+unsigned long long Material::globalFSDefinesHash = 0;
+unsigned long long Material::rendererVSDefinesHash = 0;
+unsigned long long Material::rendererFSDefinesHash = 0;
+bool Material::bindlessTextures = false;
 
 Pass::Pass(Material* parent_) :
     parent(parent_),
     colorWrite(true),
     depthWrite(true),
     depthTest(CMP_LESS),
-    blendMode(BLEND_REPLACE)
+    blendMode(BLEND_REPLACE),
+    vsDefinesHash(0),
+    fsDefinesHash(0),
+    shaderKey(0)
 {
 }
 
@@ -65,6 +100,8 @@ void Pass::SetShader(Shader* shader_, const std::string& vsDefines_, const std::
         vsDefines += " ";
     if (fsDefines.length())
         fsDefines += " ";
+    vsDefinesHash = Shader::HashDefines(vsDefines);
+    fsDefinesHash = Shader::HashDefines(fsDefines);
 
     ResetShaderPrograms();
 }
@@ -81,10 +118,45 @@ void Pass::ResetShaderPrograms()
 {
     for (size_t i = 0; i < MAX_SHADER_VARIATIONS; ++i)
         shaderPrograms[i].Reset();
+
+    // Global and renderer defines are common to all passes, so only the shader and the material and pass defines distinguish the programs
+    shaderKey = ((unsigned long long)(size_t)shader.Get() * 0x100000001b3ULL) ^ (parent->VSDefinesHash() + vsDefinesHash) ^
+        ((parent->FSDefinesHash() + fsDefinesHash) * 3);
+}
+
+std::string Pass::ProgramVSDefines(unsigned char programBits) const
+{
+    return Material::RendererVSDefines() + Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[programBits & SP_GEOMETRYBITS] +
+        ((programBits & SP_INSTANCEDBIT) ? "INSTANCED " : "") + ((programBits & SP_MOTIONBIT) ? "MOTION " : "") + ((programBits & SP_CUBESHADOWBIT) ? "CUBESHADOW " : "");
+}
+
+std::string Pass::ProgramFSDefines(unsigned char programBits) const
+{
+    return Material::RendererFSDefines() + Material::GlobalFSDefines() + parent->FSDefines() + fsDefines +
+        ((programBits & SP_DEFERREDBIT) ? "DEFERRED " : "") + ((programBits & SP_OITBIT) ? "OIT " : "") +
+        ((programBits & SP_MOTIONBIT) ? "MOTION " : "");
+}
+
+unsigned long long Pass::ProgramVSDefinesHash(unsigned char programBits) const
+{
+    return Material::RendererVSDefinesHash() + Material::GlobalVSDefinesHash() + parent->VSDefinesHash() + vsDefinesHash +
+        geometryDefinesHashes[programBits & SP_GEOMETRYBITS] + ((programBits & SP_INSTANCEDBIT) ? instancedDefineHash : 0) +
+        ((programBits & SP_MOTIONBIT) ? motionDefineHash : 0) + ((programBits & SP_CUBESHADOWBIT) ? cubeShadowDefineHash : 0);
+}
+
+unsigned long long Pass::ProgramFSDefinesHash(unsigned char programBits) const
+{
+    return Material::RendererFSDefinesHash() + Material::GlobalFSDefinesHash() + parent->FSDefinesHash() + fsDefinesHash +
+        ((programBits & SP_DEFERREDBIT) ? deferredDefineHash : 0) + ((programBits & SP_OITBIT) ? oitDefineHash : 0) +
+        ((programBits & SP_MOTIONBIT) ? motionDefineHash : 0);
 }
 
 Material::Material() :
-    cullMode(CULL_BACK)
+    cullMode(CULL_BACK),
+    uniformsDirty(true),
+    textureKey(0),
+    vsDefinesHash(0),
+    fsDefinesHash(0)
 {
     allMaterials.insert(this);
 }
@@ -103,28 +175,65 @@ bool Material::BeginLoad(Stream& source)
 {
     PROFILE(BeginLoadMaterial);
 
-    loadJSON = new JSONFile();
-    if (!loadJSON->Load(source))
-        return false;
+    loadData = new MaterialLoadData();
 
-    const JSONValue& root = loadJSON->Root();
+    // Use the binary form compiled on an earlier load if the cached file has the same timestamp as the source
+    std::string cacheFileName;
+    unsigned sourceTime = 0;
+    bool cached = false;
+    if (binaryCacheDir.length())
+    {
+        ResourceCache* cache = Subsystem<ResourceCache>();
+        sourceTime = cache ? cache->LastModifiedTime(Name()) : 0;
+        if (sourceTime)
+        {
+            cacheFileName = binaryCacheDir + Replace(Replace(Name(), '/', '_'), ':', '_') + ".bin";
+            if (LastModifiedTime(cacheFileName) == sourceTime)
+            {
+                File cacheFile(cacheFileName);
+                cached = cacheFile.IsOpen() && ReadBinary(cacheFile);
+            }
+        }
+    }
 
-    uniformValues.clear();
-    if (root.Contains("uniformValues"))
+    if (!cached)
     {
-        const JSONObject& jsonUniformValues = root["uniformValues"].GetObject();
-        for (auto it = jsonUniformValues.begin(); it != jsonUniformValues.end(); ++it)
+        // Start over in case a corrupt cache file was partially read
+        loadData = new MaterialLoadData();
+        if (!ReadJSON(source))
         {
-            PresetUniform uniform = (PresetUniform)ListIndex(it->first.c_str(), presetUniformNames, MAX_PRESET_UNIFORMS);
-            if (uniform != MAX_PRESET_UNIFORMS)
-                uniformValues[uniform] = Vector4(it->second.GetString());
+            loadData.Reset();
+            return false;
+        }
+
+        if (cacheFileName.length())
+        {
+            File cacheFile(cacheFileName, FILE_WRITE);
+            if (cacheFile.IsOpen())
+            {
+                WriteBinary(cacheFile);
+                cacheFile.Close();
+                SetLastModifiedTime(cacheFileName, sourceTime);
+            }
+            else
+                LOGERROR("Could not write material cache file " + cacheFileName);
         }
     }
 
-    if (root.Contains("cullMode"))
-        cullMode = (CullMode)ListIndex(root["cullMode"].GetString(), cullModeNames, CULL_BACK);
-    else
-        cullMode = CULL_BACK;
+    uniformValues.clear();
+    uniformsDirty = true;
+    for (auto it = loadData->uniformValues.begin(); it != loadData->uniformValues.end(); ++it)
+        uniformValues[it->first] = it->second;
+
+    cullMode = loadData->cullMode;
+
+    // When loading in the background, queue the textures as dependencies so that they are loaded by the time of EndLoad()
+    if (IsLoadingAsync())
+    {
+        ResourceCache* cache = Subsystem<ResourceCache>();
+        for (auto it = loadData->textures.begin(); it != loadData->textures.end(); ++it)
+            cache->LoadResourceAsync<Texture>(it->second, this);
+    }
 
     return true;
 }
@@ -133,64 +242,237 @@ bool Material::EndLoad()
 {
     PROFILE(EndLoadMaterial);
 
-    const JSONValue& root = loadJSON->Root();
+    if (!loadData)
+        return false;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
 
     for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
         passes[i].Reset();
+    SourceBatches::MarkChanged();
 
-    SetShaderDefines(root["vsDefines"].GetString(), root["fsDefines"].GetString());
+    SetShaderDefines(loadData->vsDefines, loadData->fsDefines);
 
-    if (root.Contains("passes"))
+    for (auto it = loadData->passes.begin(); it != loadData->passes.end(); ++it)
     {
-        const JSONObject& jsonPasses = root["passes"].GetObject();
-        for (auto it = jsonPasses.begin(); it != jsonPasses.end(); ++it)
-        {
-            PassType type = (PassType)ListIndex(it->first.c_str(), passNames, MAX_PASS_TYPES);
-            if (type != MAX_PASS_TYPES)
-            {
-                Pass* newPass = CreatePass(type);
-                newPass->LoadJSON(it->second);
-            }
-        }
+        Pass* newPass = CreatePass(it->type);
+        newPass->SetShader(cache->LoadResource<Shader>(it->shader), it->vsDefines, it->fsDefines);
+        newPass->SetRenderState(it->blendMode, it->depthTest, it->colorWrite, it->depthWrite);
     }
-    
-    /// \todo Queue texture loads during BeginLoad()
+
     ResetTextures();
-    if (root.Contains("textures"))
-    {
-        ResourceCache* cache = Subsystem<ResourceCache>();
-        const JSONObject& jsonTextures = root["textures"].GetObject();
-        for (auto it = jsonTextures.begin(); it != jsonTextures.end(); ++it)
-            SetTexture(ParseInt(it->first), cache->LoadResource<Texture>(it->second.GetString()));
-    }
+    for (auto it = loadData->textures.begin(); it != loadData->textures.end(); ++it)
+        SetTexture(it->first, cache->LoadResource<Texture>(it->second));
 
-    loadJSON.Reset();
+    loadData.Reset();
     return true;
 }
 
 Pass* Material::CreatePass(PassType type)
 {
     if (!passes[type])
+    {
         passes[type] = new Pass(this);
+        SourceBatches::MarkChanged();
+    }
     
     return passes[type];
 }
 
 void Material::RemovePass(PassType type)
 {
-    passes[type].Reset();
+    if (passes[type])
+    {
+        passes[type].Reset();
+        SourceBatches::MarkChanged();
+    }
+}
+
+Pass* Material::DepthPass()
+{
+    if (passes[PASS_SHADOW])
+        return passes[PASS_SHADOW];
+
+    if (!depthPass)
+    {
+        depthPass = new Pass(this);
+        depthPass->SetShader(Subsystem<ResourceCache>()->LoadResource<Shader>("Shaders/Shadow.glsl"));
+        depthPass->SetRenderState(BLEND_REPLACE, CMP_LESS, false, true);
+    }
+
+    return depthPass;
 }
 
 void Material::SetTexture(size_t index, Texture* texture)
 {
     if (index < MAX_MATERIAL_TEXTURE_UNITS)
+    {
         textures[index] = texture;
+        uniformsDirty = true;
+        UpdateTextureKey();
+        // Texture streaming requests are collected along with the batches
+        SourceBatches::MarkChanged();
+    }
+}
+
+void Material::UpdateTextureKey()
+{
+    // No textures result in zero key
+    textureKey = 0;
+    for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+    {
+        if (textures[i])
+            textureKey ^= ((unsigned long long)(size_t)textures[i].Get() + i) * 0x100000001b3ULL;
+    }
+}
+
+bool Material::ReadJSON(Stream& source)
+{
+    JSONFile json;
+    if (!json.Load(source))
+        return false;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    const JSONValue& root = json.Root();
+
+    if (root.Contains("uniformValues"))
+    {
+        const JSONObject& jsonUniformValues = root["uniformValues"].GetObject();
+        for (auto it = jsonUniformValues.begin(); it != jsonUniformValues.end(); ++it)
+        {
+            PresetUniform uniform = (PresetUniform)ListIndex(it->first.c_str(), presetUniformNames, MAX_PRESET_UNIFORMS);
+            if (uniform != MAX_PRESET_UNIFORMS)
+                loadData->uniformValues.push_back(std::make_pair(uniform, Vector4(it->second.GetString())));
+        }
+    }
+
+    loadData->cullMode = root.Contains("cullMode") ? (CullMode)ListIndex(root["cullMode"].GetString(), cullModeNames, CULL_BACK) : CULL_BACK;
+    loadData->vsDefines = root["vsDefines"].GetString();
+    loadData->fsDefines = root["fsDefines"].GetString();
+
+    if (root.Contains("passes"))
+    {
+        const JSONObject& jsonPasses = root["passes"].GetObject();
+        for (auto it = jsonPasses.begin(); it != jsonPasses.end(); ++it)
+        {
+            PassType type = (PassType)ListIndex(it->first.c_str(), passNames, MAX_PASS_TYPES);
+            if (type == MAX_PASS_TYPES)
+                continue;
+
+            const JSONValue& jsonPass = it->second;
+            PassLoadData pass;
+            pass.type = type;
+            pass.shader = cache->SanitateResourceName(jsonPass["shader"].GetString());
+            pass.vsDefines = jsonPass["vsDefines"].GetString();
+            pass.fsDefines = jsonPass["fsDefines"].GetString();
+            pass.blendMode = (BlendMode)ListIndex(jsonPass["blendMode"].GetString(), blendModeNames, BLEND_REPLACE);
+            pass.depthTest = (CompareMode)ListIndex(jsonPass["depthTest"].GetString(), compareModeNames, CMP_LESS);
+            pass.colorWrite = jsonPass.Contains("colorWrite") ? jsonPass["colorWrite"].GetBool() : true;
+            pass.depthWrite = jsonPass.Contains("depthWrite") ? jsonPass["depthWrite"].GetBool() : true;
+            loadData->passes.push_back(pass);
+        }
+    }
+
+    if (root.Contains("textures"))
+    {
+        const JSONObject& jsonTextures = root["textures"].GetObject();
+        for (auto it = jsonTextures.begin(); it != jsonTextures.end(); ++it)
+            loadData->textures.push_back(std::make_pair((size_t)ParseInt(it->first), cache->SanitateResourceName(it->second.GetString())));
+    }
+
+    return true;
+}
+
+bool Material::ReadBinary(Stream& source)
+{
+    PROFILE(ReadMaterialCache);
+
+    if (source.ReadFileID() != "TMAT" || source.Read<unsigned>() != MATERIAL_CACHE_VERSION)
+        return false;
+
+    loadData->cullMode = (CullMode)source.Read<unsigned char>();
+    loadData->vsDefines = source.Read<std::string>();
+    loadData->fsDefines = source.Read<std::string>();
+
+    // The uniform values are stored as they are in memory
+    loadData->uniformValues.resize(source.ReadVLE());
+    size_t uniformDataSize = loadData->uniformValues.size() * sizeof(std::pair<PresetUniform, Vector4>);
+    if (uniformDataSize && source.Read(&loadData->uniformValues[0], uniformDataSize) != uniformDataSize)
+        return false;
+    for (auto it = loadData->uniformValues.begin(); it != loadData->uniformValues.end(); ++it)
+    {
+        if (it->first >= MAX_PRESET_UNIFORMS)
+            return false;
+    }
+
+    loadData->passes.resize(source.ReadVLE());
+    for (auto it = loadData->passes.begin(); it != loadData->passes.end(); ++it)
+    {
+        it->type = (PassType)source.Read<unsigned char>();
+        it->shader = source.Read<std::string>();
+        it->vsDefines = source.Read<std::string>();
+        it->fsDefines = source.Read<std::string>();
+        it->blendMode = (BlendMode)source.Read<unsigned char>();
+        it->depthTest = (CompareMode)source.Read<unsigned char>();
+        it->colorWrite = source.Read<bool>();
+        it->depthWrite = source.Read<bool>();
+        if (it->type >= MAX_PASS_TYPES || it->blendMode >= MAX_BLEND_MODES || it->depthTest >= MAX_COMPARE_MODES)
+            return false;
+    }
+
+    loadData->textures.resize(source.ReadVLE());
+    for (auto it = loadData->textures.begin(); it != loadData->textures.end(); ++it)
+    {
+        it->first = source.ReadVLE();
+        it->second = source.Read<std::string>();
+    }
+
+    return loadData->cullMode < MAX_CULL_MODES && !source.IsEof();
+}
+
+void Material::WriteBinary(Stream& dest) const
+{
+    dest.WriteFileID("TMAT");
+    dest.Write(MATERIAL_CACHE_VERSION);
+    dest.Write((unsigned char)loadData->cullMode);
+    dest.Write(loadData->vsDefines);
+    dest.Write(loadData->fsDefines);
+
+    dest.WriteVLE(loadData->uniformValues.size());
+    if (loadData->uniformValues.size())
+        dest.Write(&loadData->uniformValues[0], loadData->uniformValues.size() * sizeof(std::pair<PresetUniform, Vector4>));
+
+    dest.WriteVLE(loadData->passes.size());
+    for (auto it = loadData->passes.begin(); it != loadData->passes.end(); ++it)
+    {
+        dest.Write((unsigned char)it->type);
+        dest.Write(it->shader);
+        dest.Write(it->vsDefines);
+        dest.Write(it->fsDefines);
+        dest.Write((unsigned char)it->blendMode);
+        dest.Write((unsigned char)it->depthTest);
+        dest.Write(it->colorWrite);
+        dest.Write(it->depthWrite);
+    }
+
+    dest.WriteVLE(loadData->textures.size());
+    for (auto it = loadData->textures.begin(); it != loadData->textures.end(); ++it)
+    {
+        dest.WriteVLE(it->first);
+        dest.Write(it->second);
+    }
+
+    // End marker, so that a truncated file is detected as end of file before it
+    dest.Write((unsigned char)0);
 }
 
 void Material::ResetTextures()
 {
     for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
         textures[i].Reset();
+    uniformsDirty = true;
+    textureKey = 0;
+    SourceBatches::MarkChanged();
 }
 
 void Material::SetShaderDefines(const std::string& vsDefines_, const std::string& fsDefines_)
@@ -201,6 +483,8 @@ void Material::SetShaderDefines(const std::string& vsDefines_, const std::string
         vsDefines += " ";
     if (fsDefines.length())
         fsDefines += " ";
+    vsDefinesHash = Shader::HashDefines(vsDefines);
+    fsDefinesHash = Shader::HashDefines(fsDefines);
     
     for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
     {
@@ -217,7 +501,109 @@ void Material::SetGlobalShaderDefines(const std::string& vsDefines_, const std::
         globalVSDefines += " ";
     if (globalFSDefines.length())
         globalFSDefines += " ";
+    globalVSDefinesHash = Shader::HashDefines(globalVSDefines);
+    globalFSDefinesHash = Shader::HashDefines(globalFSDefines);
+
+    ResetAllShaderPrograms();
+}
+
+void Material::SetRendererShaderDefines(const std::string& vsDefines_, const std::string& fsDefines_)
+{
+    rendererVSDefines = vsDefines_;
+    rendererFSDefines = fsDefines_;
+    if (rendererVSDefines.length())
+        rendererVSDefines += " ";
+    if (rendererFSDefines.length())
+        rendererFSDefines += " ";
+    rendererVSDefinesHash = Shader::HashDefines(rendererVSDefines);
+    rendererFSDefinesHash = Shader::HashDefines(rendererFSDefines);
+
+    ResetAllShaderPrograms();
+}
+
+void Material::SetBindlessTextures(bool enable)
+{
+    if (enable == bindlessTextures)
+        return;
 
+    bindlessTextures = enable;
+    for (auto it = allMaterials.begin(); it != allMaterials.end(); ++it)
+        (*it)->uniformsDirty = true;
+}
+
+bool Material::SetBinaryCacheDir(const std::string& dir)
+{
+    binaryCacheDir.clear();
+
+    if (dir.empty())
+        return true;
+
+    std::string cacheDir = AddTrailingSlash(dir);
+    if (!DirExists(cacheDir) && !CreateDir(cacheDir))
+    {
+        LOGERROR("Could not create material cache directory " + cacheDir);
+        return false;
+    }
+
+    binaryCacheDir = cacheDir;
+    return true;
+}
+
+const std::string& Material::BinaryCacheDir()
+{
+    return binaryCacheDir;
+}
+
+void Material::CollectShaderVariations(std::vector<ShaderVariation>& dest, const std::vector<Material*>& materials, unsigned geometryTypes, unsigned modeBits)
+{
+    std::set<std::pair<Shader*, std::pair<unsigned long long, unsigned long long> > > collected;
+
+    for (auto it = materials.begin(); it != materials.end(); ++it)
+    {
+        Material* material = *it;
+        if (!material)
+            continue;
+
+        for (size_t i = 0; i <= MAX_PASS_TYPES; ++i)
+        {
+            // The depth pass is used by the depth pre-pass of opaque geometry
+            Pass* pass = i < MAX_PASS_TYPES ? material->passes[i].Get() : (material->passes[PASS_OPAQUE] ? material->DepthPass() : nullptr);
+            if (!pass || !pass->GetShader() || (i == MAX_PASS_TYPES && pass == material->passes[PASS_SHADOW]))
+                continue;
+
+            unsigned passModeBits = modeBits & SP_INSTANCEDBIT;
+            if (i == PASS_OPAQUE)
+                passModeBits |= modeBits & (SP_DEFERREDBIT | SP_MOTIONBIT);
+            else if (i == PASS_ALPHA)
+                passModeBits |= modeBits & SP_OITBIT;
+            else if (i == PASS_SHADOW)
+                passModeBits |= modeBits & SP_CUBESHADOWBIT;
+
+            for (unsigned bits = 0; bits < MAX_SHADER_VARIATIONS; ++bits)
+            {
+                unsigned geomBits = bits & SP_GEOMETRYBITS;
+                // The instanced bit only combines with skinned and custom geometry, the deferred and OIT bits are exclusive, and single-pass point light shadows instance only static geometry
+                if (!(geometryTypes & (1 << geomBits)) || (bits & ~(SP_GEOMETRYBITS | passModeBits)) || ((bits & SP_INSTANCEDBIT) && geomBits <= SP_INSTANCED) ||
+                    ((bits & SP_DEFERREDBIT) && (bits & SP_OITBIT)) || ((bits & SP_CUBESHADOWBIT) && geomBits != SP_INSTANCED))
+                    continue;
+
+                unsigned char programBits = (unsigned char)bits;
+                auto key = std::make_pair(pass->GetShader(), std::make_pair(pass->ProgramVSDefinesHash(programBits), pass->ProgramFSDefinesHash(programBits)));
+                if (!collected.insert(key).second)
+                    continue;
+
+                ShaderVariation variation;
+                variation.shaderName = pass->GetShader()->Name();
+                variation.vsDefines = pass->ProgramVSDefines(programBits);
+                variation.fsDefines = pass->ProgramFSDefines(programBits);
+                dest.push_back(variation);
+            }
+        }
+    }
+}
+
+void Material::ResetAllShaderPrograms()
+{
     for (auto it = allMaterials.begin(); it != allMaterials.end(); ++it)
     {
         Material* material = *it;
@@ -227,12 +613,15 @@ void Material::SetGlobalShaderDefines(const std::string& vsDefines_, const std::
             if (material->passes[i])
                 material->passes[i]->ResetShaderPrograms();
         }
+        if (material->depthPass)
+            material->depthPass->ResetShaderPrograms();
     }
 }
 
 void Material::SetUniform(PresetUniform uniform, const Vector4& value)
 {
     uniformValues[uniform] = value;
+    uniformsDirty = true;
 }
 
 void Material::SetCullMode(CullMode mode)
@@ -240,6 +629,40 @@ void Material::SetCullMode(CullMode mode)
     cullMode = mode;
 }
 
+UniformBuffer* Material::GetUniformBuffer()
+{
+    if (!uniformBuffer)
+    {
+        uniformBuffer = new UniformBuffer();
+        uniformBuffer->Define(USAGE_DEFAULT, (MAX_MATERIAL_UNIFORMS + MAX_MATERIAL_TEXTURE_UNITS) * sizeof(Vector4));
+    }
+
+    if (uniformsDirty)
+    {
+        Vector4 data[MAX_MATERIAL_UNIFORMS + MAX_MATERIAL_TEXTURE_UNITS];
+        for (size_t i = 0; i < MAX_MATERIAL_UNIFORMS + MAX_MATERIAL_TEXTURE_UNITS; ++i)
+            data[i] = Vector4::ZERO;
+        for (auto it = uniformValues.begin(); it != uniformValues.end(); ++it)
+        {
+            if (it->first >= FIRST_MATERIAL_UNIFORM)
+                data[it->first - FIRST_MATERIAL_UNIFORM] = it->second;
+        }
+        if (bindlessTextures)
+        {
+            for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+            {
+                unsigned long long handle = textures[i] ? textures[i]->BindlessHandle() : 0;
+                memcpy(reinterpret_cast<unsigned char*>(&data[MAX_MATERIAL_UNIFORMS + i]), &handle, sizeof handle);
+            }
+        }
+
+        uniformBuffer->SetData(0, sizeof data, data);
+        uniformsDirty = false;
+    }
+
+    return uniformBuffer;
+}
+
 Material* Material::DefaultMaterial()
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
@@ -261,3 +684,13 @@ Material* Material::DefaultMaterial()
 
     return defaultMaterial.Get();
 }
+
+MaterialInstance::MaterialInstance(Material* parent_, const Vector4& parameters_) :
+    parent(parent_ ? parent_ : Material::DefaultMaterial()),
+    parameters(parameters_)
+{
+}
+
+MaterialInstance::~MaterialInstance()
+{
+}
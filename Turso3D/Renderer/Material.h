@@ -10,10 +10,11 @@
 
 #include <set>
 
-class JSONFile;
 class JSONValue;
 class Material;
+class Stream;
 class Texture;
+class UniformBuffer;
 
 enum PassType
 {
@@ -29,8 +30,17 @@ static const unsigned SP_INSTANCED = 0x1;
 static const unsigned SP_SKINNED = 0x2;
 static const unsigned SP_CUSTOMGEOM = 0x3;
 static const unsigned SP_GEOMETRYBITS = 0x3;
+static const unsigned SP_INSTANCEDBIT = 0x4;
+static const unsigned SP_DEFERREDBIT = 0x8;
+static const unsigned SP_OITBIT = 0x10;
+static const unsigned SP_MOTIONBIT = 0x20;
+static const unsigned SP_CUBESHADOWBIT = 0x40;
 
-static const size_t MAX_SHADER_VARIATIONS = 4;
+static const size_t MAX_SHADER_VARIATIONS = 128;
+
+/// Material uniforms are the preset uniforms from U_MATDIFFCOLOR onward, stored in order in the MaterialData2 uniform block. With bindless textures, they are followed by a 16-byte slot for each texture unit's handle.
+static const size_t FIRST_MATERIAL_UNIFORM = U_MATDIFFCOLOR;
+static const size_t MAX_MATERIAL_UNIFORMS = MAX_PRESET_UNIFORMS - FIRST_MATERIAL_UNIFORM;
 
 /// Render pass, which defines render state and shaders. A material may define several of these.
 class Pass : public RefCounted
@@ -51,11 +61,23 @@ public:
     void SetRenderState(BlendMode blendMode, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
     /// Get a shader program and cache for later use.
     ShaderProgram* GetShaderProgram(unsigned char programBits);
+    /// Return the vertex shader defines of a shader program, including the material, global and renderer defines.
+    std::string ProgramVSDefines(unsigned char programBits) const;
+    /// Return the fragment shader defines of a shader program, including the material, global and renderer defines.
+    std::string ProgramFSDefines(unsigned char programBits) const;
+    /// Return the vertex shader define hash of a shader program. Calculated without building the define string.
+    unsigned long long ProgramVSDefinesHash(unsigned char programBits) const;
+    /// Return the fragment shader define hash of a shader program. Calculated without building the define string.
+    unsigned long long ProgramFSDefinesHash(unsigned char programBits) const;
 
     /// Return parent material.
     Material* Parent() const { return parent; }
     /// Return shader.
     Shader* GetShader() const { return shader; }
+    /// Return vertex shader defines.
+    const std::string& VSDefines() const { return vsDefines; }
+    /// Return fragment shader defines.
+    const std::string& FSDefines() const { return fsDefines; }
     /// Return blend mode.
     BlendMode GetBlendMode() const { return blendMode; }
     /// Return depth test mode.
@@ -64,6 +86,10 @@ public:
     bool GetColorWrite() const { return colorWrite; }
     /// Return depth write flag.
     bool GetDepthWrite() const { return depthWrite; }
+    /// Return a key of the render state for state sorting.
+    unsigned RenderStateKey() const { return ((unsigned)blendMode << 5) | ((unsigned)depthTest << 2) | ((unsigned)colorWrite << 1) | (unsigned)depthWrite; }
+    /// Return a key of the shader and the pass and material defines for state sorting. Passes with the same key use the same shader programs.
+    unsigned long long ShaderKey() const { return shaderKey; }
 
     /// Last sort key for combined distance and state sorting. Used by Renderer.
     std::pair<unsigned short, unsigned short> lastSortKey;
@@ -87,6 +113,50 @@ private:
     std::string vsDefines;
     /// Fragment shader defines.
     std::string fsDefines;
+    /// Vertex shader define hash.
+    unsigned long long vsDefinesHash;
+    /// Fragment shader define hash.
+    unsigned long long fsDefinesHash;
+    /// Shader key for state sorting.
+    unsigned long long shaderKey;
+};
+
+/// Pass description read when loading a material.
+struct PassLoadData
+{
+    /// Pass type.
+    PassType type;
+    /// Shader resource name.
+    std::string shader;
+    /// Vertex shader defines.
+    std::string vsDefines;
+    /// Fragment shader defines.
+    std::string fsDefines;
+    /// Blend mode.
+    BlendMode blendMode;
+    /// Depth test mode.
+    CompareMode depthTest;
+    /// Color write flag.
+    bool colorWrite;
+    /// Depth write flag.
+    bool depthWrite;
+};
+
+/// Material description read in BeginLoad(), either from JSON or from the binary cache, and applied in EndLoad(). Resource names are sanitated, so that the resource cache finds loaded resources without sanitating them again.
+struct MaterialLoadData
+{
+    /// Culling mode.
+    CullMode cullMode;
+    /// Vertex shader defines for all passes.
+    std::string vsDefines;
+    /// Fragment shader defines for all passes.
+    std::string fsDefines;
+    /// Uniform values.
+    std::vector<std::pair<PresetUniform, Vector4> > uniformValues;
+    /// Passes.
+    std::vector<PassLoadData> passes;
+    /// Texture resource names by texture unit.
+    std::vector<std::pair<size_t, std::string> > textures;
 };
 
 /// %Material resource, which describes how to render 3D geometry and refers to textures. A material can contain several passes (for example normal rendering, and depth only.)
@@ -118,34 +188,79 @@ public:
     void ResetTextures();
     /// Set shader defines for all passes.
     void SetShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
-    /// Set an uniform value. For simplicity and performance, all material uniforms are Vector4's.
+    /// Set an uniform value. For simplicity and performance, all material uniforms are Vector4's. Only material uniforms are used for rendering.
     void SetUniform(PresetUniform uniform, const Vector4& value);
     /// Set culling mode, shared by all passes.
     void SetCullMode(CullMode mode);
 
     /// Return pass by index or null if not found.
     Pass* GetPass(PassType type) const { return passes[type]; }
+    /// Return the depth-only pass for the depth pre-pass: the shadow pass if defined, otherwise a pass generated on first use with the default shadow shader.
+    Pass* DepthPass();
     /// Return texture by texture unit.
     Texture* GetTexture(size_t index) const { return textures[index]; }
     /// Return vertex shader defines.
     const std::string& VSDefines() const { return vsDefines; }
     /// Return fragment shader defines.
     const std::string& FSDefines() const { return fsDefines; }
+    /// Return vertex shader define hash.
+    unsigned long long VSDefinesHash() const { return vsDefinesHash; }
+    /// Return fragment shader define hash.
+    unsigned long long FSDefinesHash() const { return fsDefinesHash; }
     /// Return uniform values.
     const std::map<PresetUniform, Vector4>& UniformValues() const { return uniformValues; }
     /// Return culling mode.
     CullMode GetCullMode() const { return cullMode; }
+    /// Return a key of the texture assignments for state sorting. Materials with the same key use the same textures.
+    unsigned long long TextureKey() const { return textureKey; }
+    /// Return the uniform block buffer of material uniforms and bindless texture handles, creating or updating it if they have changed. Called by Renderer.
+    UniformBuffer* GetUniformBuffer();
 
-    /// Set global (lighting-related) shader defines. Resets all loaded pass shaders.
+    /// Set global (lighting-related) shader defines. Resets all loaded pass shaders, which then find their programs from the shaders by define hash, so that switching back to earlier defines does not recompile.
     static void SetGlobalShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
+    /// Set shader defines controlled by the renderer, such as the light buffer size. Resets all loaded pass shaders.
+    static void SetRendererShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
+    /// Set whether to store bindless texture handles in the material uniform blocks. Called by Renderer.
+    static void SetBindlessTextures(bool enable);
+    /// Set directory of the on-disk cache of materials compiled to a binary form, which is read on later loads instead of parsing the JSON while its timestamp matches the source file. Empty disables the cache. Return true on success.
+    static bool SetBinaryCacheDir(const std::string& dir);
+    /// Return the binary cache directory, or empty if disabled.
+    static const std::string& BinaryCacheDir();
     /// Return a default opaque untextured material.
     static Material* DefaultMaterial();
     /// Return global vertex shader defines.
     static const std::string& GlobalVSDefines() { return globalVSDefines; }
     /// Return global fragment shader defines.
     static const std::string& GlobalFSDefines() { return globalFSDefines; }
+    /// Return renderer vertex shader defines.
+    static const std::string& RendererVSDefines() { return rendererVSDefines; }
+    /// Return renderer fragment shader defines.
+    static const std::string& RendererFSDefines() { return rendererFSDefines; }
+    /// Return whether bindless texture handles are stored in the material uniform blocks.
+    static bool BindlessTextures() { return bindlessTextures; }
+    /// Return global vertex shader define hash.
+    static unsigned long long GlobalVSDefinesHash() { return globalVSDefinesHash; }
+    /// Return global fragment shader define hash.
+    static unsigned long long GlobalFSDefinesHash() { return globalFSDefinesHash; }
+    /// Return renderer vertex shader define hash.
+    static unsigned long long RendererVSDefinesHash() { return rendererVSDefinesHash; }
+    /// Return renderer fragment shader define hash.
+    static unsigned long long RendererFSDefinesHash() { return rendererFSDefinesHash; }
+    /// Append the distinct shader program variations the passes of materials can use with the current global and renderer defines, for precompiling with Shader::PrecompilePrograms() to fill the program binary cache, for example in a build step. Geometry types are a bitmask of (1 << GeometryType). Program bits outside the mode bits (SP_INSTANCEDBIT, SP_DEFERREDBIT, SP_OITBIT, SP_MOTIONBIT and SP_CUBESHADOWBIT) are not enumerated.
+    static void CollectShaderVariations(std::vector<ShaderVariation>& dest, const std::vector<Material*>& materials, unsigned geometryTypes = 0xf, unsigned modeBits = SP_INSTANCEDBIT | SP_DEFERREDBIT | SP_OITBIT | SP_CUBESHADOWBIT);
 
 private:
+    /// Reset shader programs of all materials' passes.
+    static void ResetAllShaderPrograms();
+    /// Recalculate the texture key.
+    void UpdateTextureKey();
+    /// Read the load data from JSON. Return true on success.
+    bool ReadJSON(Stream& source);
+    /// Read the load data from the binary cache. Return true on success.
+    bool ReadBinary(Stream& source);
+    /// Write the load data to the binary cache.
+    void WriteBinary(Stream& dest) const;
+
     /// Culling mode.
     CullMode cullMode;
     /// Passes.
@@ -154,12 +269,24 @@ private:
     SharedPtr<Texture> textures[MAX_MATERIAL_TEXTURE_UNITS];
     /// Uniform values.
     std::map<PresetUniform, Vector4> uniformValues;
+    /// Uniform block buffer.
+    AutoPtr<UniformBuffer> uniformBuffer;
+    /// Uniform block buffer need update flag.
+    bool uniformsDirty;
+    /// Texture key for state sorting.
+    unsigned long long textureKey;
     /// Vertex shader defines for all passes.
     std::string vsDefines;
     /// Fragment shader defines for all passes.
     std::string fsDefines;
-    /// JSON data used for loading.
-    AutoPtr<JSONFile> loadJSON;
+    /// Vertex shader define hash for all passes.
+    unsigned long long vsDefinesHash;
+    /// Fragment shader define hash for all passes.
+    unsigned long long fsDefinesHash;
+    /// Description read for loading.
+    AutoPtr<MaterialLoadData> loadData;
+    /// Generated depth-only pass when there is no shadow pass.
+    SharedPtr<Pass> depthPass;
 
     /// Default material.
     static SharedPtr<Material> defaultMaterial;
@@ -169,6 +296,44 @@ private:
     static std::string globalVSDefines;
     /// Global fragment shader defines.
     static std::string globalFSDefines;
+    /// Renderer vertex shader defines.
+    static std::string rendererVSDefines;
+    /// Renderer fragment shader defines.
+    static std::string rendererFSDefines;
+    /// Global vertex shader define hash.
+    static unsigned long long globalVSDefinesHash;
+    /// Global fragment shader define hash.
+    static unsigned long long globalFSDefinesHash;
+    /// Renderer vertex shader define hash.
+    static unsigned long long rendererVSDefinesHash;
+    /// Renderer fragment shader define hash.
+    static unsigned long long rendererFSDefinesHash;
+    /// Bindless texture handles flag.
+    static bool bindlessTextures;
+};
+
+/// Lightweight variation of a material with its own per-object parameters, for example a color tint. Shares the parent material's passes and shader programs, so that objects using different instances of the same material are still sorted by pass and instanced into the same draw calls. The parameters are passed in the per-object instance data, and the default shaders multiply the diffuse color with them.
+class MaterialInstance : public RefCounted
+{
+public:
+    /// Construct with parent material and parameters.
+    MaterialInstance(Material* parent, const Vector4& parameters = Vector4::ONE);
+    /// Destruct.
+    ~MaterialInstance();
+
+    /// Set the parameters. Takes effect on the next rendered frame.
+    void SetParameters(const Vector4& parameters_) { parameters = parameters_; }
+
+    /// Return the parent material.
+    Material* Parent() const { return parent; }
+    /// Return the parameters.
+    const Vector4& Parameters() const { return parameters; }
+
+private:
+    /// Parent material.
+    SharedPtr<Material> parent;
+    /// Per-object parameters.
+    Vector4 parameters;
 };
 
 extern const char* geometryDefines[];
@@ -184,12 +349,12 @@ inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
         if (!shader)
             return nullptr;
 
-        unsigned char geomBits = programBits & SP_GEOMETRYBITS;
-
-        ShaderProgram* newShaderProgram = shader->CreateProgram(
-            Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits],
-            Material::GlobalFSDefines() + parent->FSDefines() + fsDefines
-        );
+        // Look up by the define hashes first, so that the define strings are built only when the program is new to the shader
+        unsigned long long vsHash = ProgramVSDefinesHash(programBits);
+        unsigned long long fsHash = ProgramFSDefinesHash(programBits);
+        ShaderProgram* newShaderProgram = shader->FindProgram(vsHash, fsHash);
+        if (!newShaderProgram)
+            newShaderProgram = shader->CreateProgram(ProgramVSDefines(programBits), ProgramFSDefines(programBits), vsHash, fsHash);
 
         shaderPrograms[programBits] = newShaderProgram;
         return newShaderProgram;
@@ -0,0 +1,493 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/BoundingBox.h"
+#include "MeshProcessing.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const int VERTEX_CACHE_SIZE = 32;
+static const float CACHE_DECAY_POWER = 1.5f;
+static const float LAST_TRIANGLE_SCORE = 0.75f;
+static const float VALENCE_BOOST_SCALE = 2.0f;
+static const float VALENCE_BOOST_POWER = 0.5f;
+
+/// Symmetric error quadric of squared distances to planes.
+struct Quadric
+{
+    /// Construct with zero error.
+    Quadric() :
+        a2(0.0), ab(0.0), ac(0.0), ad(0.0), b2(0.0), bc(0.0), bd(0.0), c2(0.0), cd(0.0), d2(0.0)
+    {
+    }
+
+    /// Add a plane with unit normal.
+    void AddPlane(const Vector3& normal, float d)
+    {
+        double a = normal.x;
+        double b = normal.y;
+        double c = normal.z;
+        a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+        b2 += b * b; bc += b * c; bd += b * d;
+        c2 += c * c; cd += c * d;
+        d2 += (double)d * d;
+    }
+
+    /// Add another quadric.
+    void Add(const Quadric& rhs)
+    {
+        a2 += rhs.a2; ab += rhs.ab; ac += rhs.ac; ad += rhs.ad;
+        b2 += rhs.b2; bc += rhs.bc; bd += rhs.bd;
+        c2 += rhs.c2; cd += rhs.cd;
+        d2 += rhs.d2;
+    }
+
+    /// Return the error of a position.
+    double Error(const Vector3& p) const
+    {
+        double x = p.x;
+        double y = p.y;
+        double z = p.z;
+        return a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y +
+            c2 * z * z + 2.0 * cd * z + d2;
+    }
+
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+};
+
+/// Candidate edge collapse.
+struct EdgeCollapse
+{
+    /// Error of the collapse.
+    float cost;
+    /// Vertex to remove.
+    unsigned from;
+    /// Vertex to collapse onto.
+    unsigned to;
+};
+
+/// Order vertex indices by position, for welding.
+struct PositionLess
+{
+    /// Construct with the positions.
+    PositionLess(const std::vector<Vector3>& positions_) :
+        positions(positions_)
+    {
+    }
+
+    /// Compare two vertices.
+    bool operator () (unsigned lhs, unsigned rhs) const
+    {
+        const Vector3& l = positions[lhs];
+        const Vector3& r = positions[rhs];
+        if (l.x != r.x)
+            return l.x < r.x;
+        if (l.y != r.y)
+            return l.y < r.y;
+        return l.z < r.z;
+    }
+
+    /// Vertex positions.
+    const std::vector<Vector3>& positions;
+};
+
+/// Order edge collapses by increasing error.
+static bool CompareEdgeCollapses(const EdgeCollapse& lhs, const EdgeCollapse& rhs)
+{
+    return lhs.cost < rhs.cost;
+}
+
+/// Return the score of a vertex from its cache position and number of triangles not yet emitted.
+static float VertexScore(int cachePosition, unsigned remainingTriangles)
+{
+    if (!remainingTriangles)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // The vertices of the last triangle get a fixed score so that the next triangle does not reuse the same edge too eagerly
+        if (cachePosition < 3)
+            score = LAST_TRIANGLE_SCORE;
+        else
+            score = powf(1.0f - (float)(cachePosition - 3) / (VERTEX_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+    }
+
+    // Prefer vertices with few triangles left, to finish them off
+    return score + VALENCE_BOOST_SCALE * powf((float)remainingTriangles, -VALENCE_BOOST_POWER);
+}
+
+/// Build the triangle adjacency of each vertex as offsets and counts into a triangle list.
+static void BuildAdjacency(const unsigned* indices, size_t numTriangles, size_t numVertices, std::vector<unsigned>& offsets, std::vector<unsigned>& counts, std::vector<unsigned>& adjacency)
+{
+    counts.assign(numVertices, 0);
+    for (size_t i = 0; i < numTriangles * 3; ++i)
+        ++counts[indices[i]];
+
+    offsets.resize(numVertices);
+    unsigned offset = 0;
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        offsets[i] = offset;
+        offset += counts[i];
+        counts[i] = 0;
+    }
+
+    adjacency.resize(numTriangles * 3);
+    for (size_t i = 0; i < numTriangles * 3; ++i)
+    {
+        unsigned vertex = indices[i];
+        adjacency[offsets[vertex] + counts[vertex]++] = (unsigned)(i / 3);
+    }
+}
+
+void OptimizeVertexCache(unsigned* indices, size_t numIndices, size_t numVertices)
+{
+    size_t numTriangles = numIndices / 3;
+    if (numTriangles < 2)
+        return;
+    for (size_t i = 0; i < numTriangles * 3; ++i)
+    {
+        if (indices[i] >= numVertices)
+            return;
+    }
+
+    // The triangles not yet emitted are kept first in each vertex's adjacency, with the remaining count
+    std::vector<unsigned> offsets;
+    std::vector<unsigned> remaining;
+    std::vector<unsigned> adjacency;
+    BuildAdjacency(indices, numTriangles, numVertices, offsets, remaining, adjacency);
+
+    std::vector<int> cachePositions(numVertices, -1);
+    std::vector<float> vertexScores(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+        vertexScores[i] = VertexScore(-1, remaining[i]);
+
+    std::vector<float> triangleScores(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    size_t bestTriangle = 0;
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+        triangleScores[i] = vertexScores[indices[i * 3]] + vertexScores[indices[i * 3 + 1]] + vertexScores[indices[i * 3 + 2]];
+        if (triangleScores[i] > triangleScores[bestTriangle])
+            bestTriangle = i;
+    }
+
+    std::vector<unsigned> result(numTriangles * 3);
+    std::vector<unsigned> cache;
+    std::vector<unsigned> newCache;
+    cache.reserve(VERTEX_CACHE_SIZE + 3);
+    newCache.reserve(VERTEX_CACHE_SIZE + 3);
+    size_t scanPosition = 0;
+
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+        // If no triangle uses the cached vertices, continue from the first triangle not emitted
+        if (bestTriangle >= numTriangles)
+        {
+            while (emitted[scanPosition])
+                ++scanPosition;
+            bestTriangle = scanPosition;
+        }
+
+        const unsigned* triangle = &indices[bestTriangle * 3];
+        result[i * 3] = triangle[0];
+        result[i * 3 + 1] = triangle[1];
+        result[i * 3 + 2] = triangle[2];
+        emitted[bestTriangle] = true;
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            unsigned vertex = triangle[j];
+            unsigned* vertexTriangles = &adjacency[offsets[vertex]];
+            unsigned count = remaining[vertex];
+            for (unsigned k = 0; k < count; ++k)
+            {
+                if (vertexTriangles[k] == bestTriangle)
+                {
+                    std::swap(vertexTriangles[k], vertexTriangles[count - 1]);
+                    --remaining[vertex];
+                    break;
+                }
+            }
+        }
+
+        // Move the triangle's vertices to the front of the cache
+        newCache.clear();
+        newCache.push_back(triangle[0]);
+        newCache.push_back(triangle[1]);
+        newCache.push_back(triangle[2]);
+        for (auto it = cache.begin(); it != cache.end(); ++it)
+        {
+            if (*it != triangle[0] && *it != triangle[1] && *it != triangle[2])
+                newCache.push_back(*it);
+        }
+
+        for (size_t j = 0; j < newCache.size(); ++j)
+        {
+            unsigned vertex = newCache[j];
+            cachePositions[vertex] = j < VERTEX_CACHE_SIZE ? (int)j : -1;
+            vertexScores[vertex] = VertexScore(cachePositions[vertex], remaining[vertex]);
+        }
+
+        // Rescore the triangles of the vertices whose cache position changed, including those pushed out, and pick the best
+        bestTriangle = M_MAX_UNSIGNED;
+        float bestScore = -M_MAX_FLOAT;
+        for (size_t j = 0; j < newCache.size(); ++j)
+        {
+            unsigned vertex = newCache[j];
+            const unsigned* vertexTriangles = &adjacency[offsets[vertex]];
+            for (unsigned k = 0; k < remaining[vertex]; ++k)
+            {
+                unsigned t = vertexTriangles[k];
+                float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                triangleScores[t] = score;
+                if (j < VERTEX_CACHE_SIZE && score > bestScore)
+                {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        if (newCache.size() > VERTEX_CACHE_SIZE)
+            newCache.resize(VERTEX_CACHE_SIZE);
+        cache.swap(newCache);
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+void SimplifyMesh(std::vector<unsigned>& dest, const unsigned* indices, size_t numIndices, const std::vector<Vector3>& positions, size_t targetIndices, float maxError)
+{
+    size_t numVertices = positions.size();
+    dest.assign(indices, indices + numIndices / 3 * 3);
+    if (dest.size() <= targetIndices)
+        return;
+    for (auto it = dest.begin(); it != dest.end(); ++it)
+    {
+        if (*it >= numVertices)
+            return;
+    }
+
+    // Weld the vertices by position, as attribute seams split them
+    std::vector<bool> used(numVertices, false);
+    std::vector<unsigned> sorted;
+    BoundingBox bounds;
+    for (auto it = dest.begin(); it != dest.end(); ++it)
+    {
+        if (!used[*it])
+        {
+            used[*it] = true;
+            sorted.push_back(*it);
+            bounds.Merge(positions[*it]);
+        }
+    }
+    std::sort(sorted.begin(), sorted.end(), PositionLess(positions));
+
+    std::vector<unsigned> weld(numVertices, M_MAX_UNSIGNED);
+    std::vector<unsigned> wedgeCounts(numVertices, 0);
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        unsigned vertex = sorted[i];
+        bool samePosition = i > 0 && positions[sorted[i - 1]] == positions[vertex];
+        weld[vertex] = samePosition ? weld[sorted[i - 1]] : vertex;
+        ++wedgeCounts[weld[vertex]];
+    }
+
+    // Vertices on open or non-manifold edges of the welded mesh are locked
+    std::vector<std::pair<unsigned, unsigned> > edges;
+    for (size_t i = 0; i < dest.size(); i += 3)
+    {
+        for (size_t j = 0; j < 3; ++j)
+        {
+            unsigned a = weld[dest[i + j]];
+            unsigned b = weld[dest[i + (j + 1) % 3]];
+            if (a != b)
+                edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<bool> locked(numVertices, false);
+    for (size_t i = 0; i < edges.size();)
+    {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j] == edges[i])
+            ++j;
+        if (j - i != 2)
+        {
+            locked[edges[i].first] = true;
+            locked[edges[i].second] = true;
+        }
+        i = j;
+    }
+
+    // Accumulate the triangle planes. Only vertices without seams move, so the quadrics are kept per vertex
+    std::vector<Quadric> quadrics(numVertices);
+    for (size_t i = 0; i < dest.size(); i += 3)
+    {
+        const Vector3& p0 = positions[dest[i]];
+        Vector3 normal = (positions[dest[i + 1]] - p0).CrossProduct(positions[dest[i + 2]] - p0);
+        float length = normal.Length();
+        if (length <= 0.0f)
+            continue;
+        normal /= length;
+        float d = -normal.DotProduct(p0);
+        for (size_t j = 0; j < 3; ++j)
+            quadrics[dest[i + j]].AddPlane(normal, d);
+    }
+
+    float errorDistance = maxError * bounds.Size().Length();
+    double errorLimit = (double)errorDistance * errorDistance;
+
+    std::vector<unsigned> remap(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+        remap[i] = (unsigned)i;
+
+    std::vector<bool> touched(numVertices, false);
+    std::vector<unsigned> touchedVertices;
+    std::vector<unsigned> offsets;
+    std::vector<unsigned> counts;
+    std::vector<unsigned> adjacency;
+    std::vector<EdgeCollapse> collapses;
+    size_t numLiveIndices = dest.size();
+
+    // Collapse in passes of independent edges in order of increasing error, then rebuild the adjacency
+    while (numLiveIndices > targetIndices)
+    {
+        size_t numTriangles = dest.size() / 3;
+        BuildAdjacency(&dest[0], numTriangles, numVertices, offsets, counts, adjacency);
+
+        collapses.clear();
+        for (size_t i = 0; i < dest.size(); i += 3)
+        {
+            for (size_t j = 0; j < 3; ++j)
+            {
+                unsigned a = dest[i + j];
+                unsigned b = dest[i + (j + 1) % 3];
+                if (weld[a] == weld[b])
+                    continue;
+
+                // A vertex can move onto another only if neither lies on a seam, as the collapse would have to pick one of the seam's attributes
+                bool movableA = wedgeCounts[weld[a]] == 1 && !locked[weld[a]];
+                bool movableB = wedgeCounts[weld[b]] == 1 && !locked[weld[b]];
+                bool targetA = wedgeCounts[weld[a]] == 1;
+                bool targetB = wedgeCounts[weld[b]] == 1;
+
+                EdgeCollapse collapse;
+                collapse.cost = M_MAX_FLOAT;
+                if (movableA && targetB)
+                {
+                    Quadric q = quadrics[a];
+                    q.Add(quadrics[b]);
+                    collapse.cost = (float)q.Error(positions[b]);
+                    collapse.from = a;
+                    collapse.to = b;
+                }
+                if (movableB && targetA)
+                {
+                    Quadric q = quadrics[a];
+                    q.Add(quadrics[b]);
+                    float cost = (float)q.Error(positions[a]);
+                    if (cost < collapse.cost)
+                    {
+                        collapse.cost = cost;
+                        collapse.from = b;
+                        collapse.to = a;
+                    }
+                }
+                if (collapse.cost <= errorLimit)
+                    collapses.push_back(collapse);
+            }
+        }
+
+        if (collapses.empty())
+            break;
+        std::sort(collapses.begin(), collapses.end(), CompareEdgeCollapses);
+
+        size_t numCollapsed = 0;
+        for (auto it = collapses.begin(); it != collapses.end() && numLiveIndices > targetIndices; ++it)
+        {
+            unsigned from = it->from;
+            unsigned to = it->to;
+            if (touched[from] || touched[to])
+                continue;
+
+            // Reject collapses that would flip a remaining triangle
+            const unsigned* vertexTriangles = &adjacency[offsets[from]];
+            size_t removedIndices = 0;
+            bool flipped = false;
+            for (unsigned k = 0; k < counts[from]; ++k)
+            {
+                const unsigned* triangle = &dest[vertexTriangles[k] * 3];
+                if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+                {
+                    removedIndices += 3;
+                    continue;
+                }
+
+                const Vector3& p0 = positions[triangle[0]];
+                const Vector3& p1 = positions[triangle[1]];
+                const Vector3& p2 = positions[triangle[2]];
+                Vector3 oldNormal = (p1 - p0).CrossProduct(p2 - p0);
+                const Vector3& n0 = triangle[0] == from ? positions[to] : p0;
+                const Vector3& n1 = triangle[1] == from ? positions[to] : p1;
+                const Vector3& n2 = triangle[2] == from ? positions[to] : p2;
+                Vector3 newNormal = (n1 - n0).CrossProduct(n2 - n0);
+                if (oldNormal.DotProduct(newNormal) <= 0.0f)
+                {
+                    flipped = true;
+                    break;
+                }
+            }
+            if (flipped)
+                continue;
+
+            remap[from] = to;
+            quadrics[to].Add(quadrics[from]);
+            numLiveIndices -= removedIndices;
+            ++numCollapsed;
+
+            // Keep the rest of the pass away from the changed triangles
+            for (unsigned k = 0; k < counts[from]; ++k)
+            {
+                const unsigned* triangle = &dest[vertexTriangles[k] * 3];
+                for (size_t j = 0; j < 3; ++j)
+                {
+                    if (!touched[triangle[j]])
+                    {
+                        touched[triangle[j]] = true;
+                        touchedVertices.push_back(triangle[j]);
+                    }
+                }
+            }
+        }
+
+        for (auto it = touchedVertices.begin(); it != touchedVertices.end(); ++it)
+            touched[*it] = false;
+        touchedVertices.clear();
+
+        if (!numCollapsed)
+            break;
+
+        // Apply the collapses and remove the degenerate triangles
+        size_t writeIndex = 0;
+        for (size_t i = 0; i < dest.size(); i += 3)
+        {
+            unsigned a = remap[dest[i]];
+            unsigned b = remap[dest[i + 1]];
+            unsigned c = remap[dest[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            dest[writeIndex++] = a;
+            dest[writeIndex++] = b;
+            dest[writeIndex++] = c;
+        }
+        dest.resize(writeIndex);
+        numLiveIndices = dest.size();
+
+        if (dest.empty())
+            break;
+    }
+}
@@ -0,0 +1,12 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Vector3.h"
+
+#include <vector>
+
+/// Reorder the triangles of a triangle list for the post-transform vertex cache, using Forsyth's linear-speed vertex cache optimization.
+void OptimizeVertexCache(unsigned* indices, size_t numIndices, size_t numVertices);
+/// Simplify a triangle list with quadric error edge collapses toward a target index count. Vertices are only reused, never moved or created, and open borders and attribute seams stay in place. The error limit is relative to the mesh extent. Return the simplified indices in dest.
+void SimplifyMesh(std::vector<unsigned>& dest, const unsigned* indices, size_t numIndices, const std::vector<Vector3>& positions, size_t targetIndices, float maxError);
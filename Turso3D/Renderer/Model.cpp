@@ -1,50 +1,276 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/Log.h"
+#include "../IO/VectorBuffer.h"
+#include "../Object/MemoryTracker.h"
 #include "../Time/Profiler.h"
 #include "../Graphics/IndexBuffer.h"
 #include "../Graphics/VertexBuffer.h"
 #include "../Scene/Node.h"
 #include "GeometryNode.h"
 #include "Material.h"
+#include "MeshProcessing.h"
 #include "Model.h"
 
+#include <algorithm>
+#include <cstring>
+#include <glew.h>
+
+/// Native model file format version.
+static const unsigned MODEL_FILE_VERSION = 1;
+/// Alignment of vertex and index data in a native model file, relative to the file start.
+static const size_t MODEL_DATA_ALIGNMENT = 4096;
+
+/// Minimum model size multiplier of the generated LOD distance step.
+static const float DEFAULT_LOD_DISTANCE_FACTOR = 8.0f;
+/// Simplification error limit of generated LOD levels, relative to the geometry extent.
+static const float LOD_GENERATION_MAX_ERROR = 0.05f;
+/// Index count ratio to the previous level above which a generated LOD level is not worth keeping.
+static const float LOD_GENERATION_MIN_REDUCTION = 0.9f;
+
+/// Whether to quantize vertex data on load.
+static bool vertexCompression = false;
+/// Whether to reorder vertex data and indices on load.
+static bool meshOptimization = false;
+/// Number of LOD levels to generate on load.
+static size_t lodGenerationLevels = 0;
+/// Index count reduction per generated LOD level.
+static float lodGenerationReduction = 0.5f;
+/// LOD distance step of generated LOD levels, or zero to derive from the model size.
+static float lodGenerationDistance = 0.0f;
+/// Whether to keep triangle data for raycasts on load.
+static bool raycastData = false;
+
 const size_t COMBINEDBUFFER_VERTICES = 384 * 1024;
 const size_t COMBINEDBUFFER_INDICES = 1024 * 1024;
+const size_t MAX_OCCLUDER_TRIANGLES = 2048;
 
 std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > CombinedBuffer::buffers;
+unsigned CombinedBuffer::generation = 0;
+
+/// Return whether vertex elements have the same format, ignoring the offsets.
+static bool SameVertexFormat(const std::vector<VertexElement>& lhs, const std::vector<VertexElement>& rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+
+    for (size_t i = 0; i < lhs.size(); ++i)
+    {
+        if (lhs[i].type != rhs[i].type || lhs[i].semantic != rhs[i].semantic || lhs[i].index != rhs[i].index)
+            return false;
+    }
+
+    return true;
+}
+
+/// Return allocations in order of vertex start.
+static bool CompareVertexStarts(const CombinedBufferAllocation* lhs, const CombinedBufferAllocation* rhs)
+{
+    return lhs->vertexStart < rhs->vertexStart;
+}
+
+/// Return allocations in order of index start.
+static bool CompareIndexStarts(const CombinedBufferAllocation* lhs, const CombinedBufferAllocation* rhs)
+{
+    return lhs->indexStart < rhs->indexStart;
+}
 
 CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements) :
     usedVertices(0),
-    usedIndices(0)
+    usedIndices(0),
+    nextAllocationId(1)
 {
     vertexBuffer = new VertexBuffer();
     vertexBuffer->Define(USAGE_DEFAULT, COMBINEDBUFFER_VERTICES, elements);
     indexBuffer = new IndexBuffer();
     indexBuffer->Define(USAGE_DEFAULT, COMBINEDBUFFER_INDICES, sizeof(unsigned));
+
+    freeVertices[0] = COMBINEDBUFFER_VERTICES;
+    freeIndices[0] = COMBINEDBUFFER_INDICES;
 }
 
-bool CombinedBuffer::FillVertices(size_t numVertices, const void* data)
+unsigned CombinedBuffer::AllocateRange(size_t numVertices, size_t numIndices)
 {
-    if (usedVertices + numVertices > vertexBuffer->NumVertices())
-        return false;
+    if (!numVertices)
+        return 0;
+
+    size_t vertexStart = TakeFreeRange(freeVertices, numVertices);
+    if (vertexStart == M_MAX_UNSIGNED)
+        return 0;
+
+    size_t indexStart = 0;
+    if (numIndices)
+    {
+        indexStart = TakeFreeRange(freeIndices, numIndices);
+        if (indexStart == M_MAX_UNSIGNED)
+        {
+            ReturnFreeRange(freeVertices, vertexStart, numVertices);
+            return 0;
+        }
+    }
+
+    unsigned id = nextAllocationId++;
+    CombinedBufferAllocation& allocation = allocations[id];
+    allocation.vertexStart = vertexStart;
+    allocation.numVertices = numVertices;
+    allocation.indexStart = indexStart;
+    allocation.numIndices = numIndices;
 
-    vertexBuffer->SetData(usedVertices, numVertices, data);
     usedVertices += numVertices;
-    return true;
+    usedIndices += numIndices;
+    return id;
 }
 
-bool CombinedBuffer::FillIndices(size_t numIndices, const void* data)
+void CombinedBuffer::FreeRange(unsigned id)
 {
-    if (usedIndices + numIndices > indexBuffer->NumIndices())
+    auto it = allocations.find(id);
+    if (it == allocations.end())
+        return;
+
+    const CombinedBufferAllocation& allocation = it->second;
+    ReturnFreeRange(freeVertices, allocation.vertexStart, allocation.numVertices);
+    if (allocation.numIndices)
+        ReturnFreeRange(freeIndices, allocation.indexStart, allocation.numIndices);
+
+    usedVertices -= allocation.numVertices;
+    usedIndices -= allocation.numIndices;
+    allocations.erase(it);
+}
+
+bool CombinedBuffer::SetVertices(unsigned id, const void* data)
+{
+    const CombinedBufferAllocation* allocation = Allocation(id);
+    return allocation ? vertexBuffer->SetData(allocation->vertexStart, allocation->numVertices, data) : false;
+}
+
+bool CombinedBuffer::SetIndices(unsigned id, size_t offset, size_t numIndices, const void* data)
+{
+    const CombinedBufferAllocation* allocation = Allocation(id);
+    if (!allocation || offset + numIndices > allocation->numIndices)
         return false;
 
-    indexBuffer->SetData(usedIndices, numIndices, data);
-    usedIndices += numIndices;
-    return true;
+    return indexBuffer->SetData(allocation->indexStart + offset, numIndices, data);
+}
+
+void CombinedBuffer::AddGeometry(unsigned id, Geometry* geometry)
+{
+    auto it = allocations.find(id);
+    if (it != allocations.end())
+        it->second.geometries.push_back(WeakPtr<Geometry>(geometry));
+}
+
+size_t CombinedBuffer::Defragment()
+{
+    PROFILE(DefragmentCombinedBuffer);
+
+    if (freeVertices.size() <= 1 && freeIndices.size() <= 1 && (freeVertices.empty() || freeVertices.begin()->first == usedVertices) &&
+        (freeIndices.empty() || freeIndices.begin()->first == usedIndices))
+        return 0;
+
+    std::vector<CombinedBufferAllocation*> sorted;
+    for (auto it = allocations.begin(); it != allocations.end(); ++it)
+        sorted.push_back(&it->second);
+
+    std::vector<size_t> newVertexStarts(sorted.size());
+    std::vector<size_t> newIndexStarts(sorted.size());
+    std::map<CombinedBufferAllocation*, size_t> sortedIndices;
+    for (size_t i = 0; i < sorted.size(); ++i)
+        sortedIndices[sorted[i]] = i;
+
+    // Copy the ranges packed to a temporary buffer, then back to the start, as a buffer can not be copied to itself with overlap
+    unsigned tempBuffer;
+    glGenBuffers(1, &tempBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, tempBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, std::max(usedVertices * vertexBuffer->VertexSize(), usedIndices * sizeof(unsigned)), nullptr, GL_STREAM_COPY);
+
+    std::sort(sorted.begin(), sorted.end(), CompareVertexStarts);
+    glBindBuffer(GL_COPY_READ_BUFFER, vertexBuffer->GLBuffer());
+    size_t vertexSize = vertexBuffer->VertexSize();
+    size_t position = 0;
+    for (auto it = sorted.begin(); it != sorted.end(); ++it)
+    {
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (*it)->vertexStart * vertexSize, position * vertexSize, (*it)->numVertices * vertexSize);
+        newVertexStarts[sortedIndices[*it]] = position;
+        position += (*it)->numVertices;
+    }
+    if (position)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, tempBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer->GLBuffer());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, position * vertexSize);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, tempBuffer);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), CompareIndexStarts);
+    glBindBuffer(GL_COPY_READ_BUFFER, indexBuffer->GLBuffer());
+    position = 0;
+    for (auto it = sorted.begin(); it != sorted.end(); ++it)
+    {
+        if ((*it)->numIndices)
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (*it)->indexStart * sizeof(unsigned), position * sizeof(unsigned), (*it)->numIndices * sizeof(unsigned));
+        newIndexStarts[sortedIndices[*it]] = position;
+        position += (*it)->numIndices;
+    }
+    if (position)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, tempBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer->GLBuffer());
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, position * sizeof(unsigned));
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &tempBuffer);
+
+    // Update the ranges and the geometries drawing from them, dropping expired geometries
+    size_t numMoved = 0;
+    for (auto it = sortedIndices.begin(); it != sortedIndices.end(); ++it)
+    {
+        CombinedBufferAllocation& allocation = *it->first;
+        size_t newVertexStart = newVertexStarts[it->second];
+        size_t newIndexStart = newIndexStarts[it->second];
+        if (newVertexStart == allocation.vertexStart && newIndexStart == allocation.indexStart)
+            continue;
+
+        for (size_t i = 0; i < allocation.geometries.size();)
+        {
+            Geometry* geometry = allocation.geometries[i].Get();
+            if (!geometry)
+            {
+                allocation.geometries.erase(allocation.geometries.begin() + i);
+                continue;
+            }
+
+            geometry->drawStart = geometry->drawStart - allocation.indexStart + newIndexStart;
+            geometry->baseVertex = (unsigned)newVertexStart;
+            ++i;
+        }
+
+        allocation.vertexStart = newVertexStart;
+        allocation.indexStart = newIndexStart;
+        ++numMoved;
+    }
+
+    freeVertices.clear();
+    if (usedVertices < vertexBuffer->NumVertices())
+        freeVertices[usedVertices] = vertexBuffer->NumVertices() - usedVertices;
+    freeIndices.clear();
+    if (usedIndices < indexBuffer->NumIndices())
+        freeIndices[usedIndices] = indexBuffer->NumIndices() - usedIndices;
+
+    if (numMoved)
+        ++generation;
+
+    return numMoved;
 }
 
-CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& elements, size_t numVertices, size_t numIndices)
+const CombinedBufferAllocation* CombinedBuffer::Allocation(unsigned id) const
+{
+    auto it = allocations.find(id);
+    return it != allocations.end() ? &it->second : nullptr;
+}
+
+CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& elements, size_t numVertices, size_t numIndices, unsigned& allocationId)
 {
     unsigned key = VertexBuffer::CalculateAttributeMask(elements);
     auto it = buffers.find(key);
@@ -61,11 +287,23 @@ CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& eleme
                 keyBuffers.erase(keyBuffers.begin() + i);
                 continue;
             }
+            ++i;
 
-            if (buffer->usedVertices + numVertices <= buffer->vertexBuffer->NumVertices() && buffer->usedIndices + numIndices <= buffer->indexBuffer->NumIndices())
-                return buffer;
+            // Vertex compression may give different element types for the same attributes
+            if (!SameVertexFormat(buffer->vertexBuffer->Elements(), elements))
+                continue;
+            if (buffer->usedVertices + numVertices > buffer->vertexBuffer->NumVertices() || buffer->usedIndices + numIndices > buffer->indexBuffer->NumIndices())
+                continue;
 
-            ++i;
+            // There is enough free space in total, so if it is fragmented, compact
+            allocationId = buffer->AllocateRange(numVertices, numIndices);
+            if (!allocationId)
+            {
+                buffer->Defragment();
+                allocationId = buffer->AllocateRange(numVertices, numIndices);
+            }
+            if (allocationId)
+                return buffer;
         }
     }
 
@@ -85,9 +323,71 @@ CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& eleme
 #endif
 
     buffers[key].push_back(buffer);
+    allocationId = buffer->AllocateRange(numVertices, numIndices);
     return buffer;
 }
 
+size_t CombinedBuffer::DefragmentAll()
+{
+    size_t numMoved = 0;
+
+    for (auto it = buffers.begin(); it != buffers.end(); ++it)
+    {
+        for (auto bIt = it->second.begin(); bIt != it->second.end(); ++bIt)
+        {
+            CombinedBuffer* buffer = bIt->Get();
+            if (buffer)
+                numMoved += buffer->Defragment();
+        }
+    }
+
+    return numMoved;
+}
+
+size_t CombinedBuffer::TakeFreeRange(std::map<size_t, size_t>& freeList, size_t count)
+{
+    for (auto it = freeList.begin(); it != freeList.end(); ++it)
+    {
+        if (it->second < count)
+            continue;
+
+        size_t start = it->first;
+        size_t remaining = it->second - count;
+        freeList.erase(it);
+        if (remaining)
+            freeList[start + count] = remaining;
+        return start;
+    }
+
+    return M_MAX_UNSIGNED;
+}
+
+void CombinedBuffer::ReturnFreeRange(std::map<size_t, size_t>& freeList, size_t start, size_t count)
+{
+    auto next = freeList.lower_bound(start);
+
+    // Merge with the following range
+    if (next != freeList.end() && start + count == next->first)
+    {
+        count += next->second;
+        next = freeList.erase(next);
+    }
+
+    // Merge with the preceding range
+    if (next != freeList.begin())
+    {
+        auto prev = next;
+        --prev;
+        if (prev->first + prev->second == start)
+        {
+            prev->second += count;
+            return;
+        }
+    }
+
+    freeList[start] = count;
+}
+
 Bone::Bone() :
     initialPosition(Vector3::ZERO),
     initialRotation(Quaternion::IDENTITY),
@@ -104,12 +404,231 @@ Bone::~Bone()
 {
 }
 
-Model::Model()
+/// Read a data blob of a native model file in place if possible, or copy it.
+static bool ReadModelData(Stream& source, const std::pair<unsigned, unsigned>& range, const unsigned char*& data, SharedArrayPtr<unsigned char>& storage)
+{
+    if ((size_t)range.first + range.second > source.Size())
+    {
+        LOGERROR("Out of range data in " + source.Name());
+        return false;
+    }
+
+    source.Seek(range.first);
+    data = source.ReadInPlace(range.second);
+    if (!data)
+    {
+        storage = new unsigned char[range.second];
+        source.Read(storage.Get(), range.second);
+        data = storage.Get();
+    }
+
+    return true;
+}
+
+/// Return vertex size of a vertex declaration.
+static size_t VertexSize(const std::vector<VertexElement>& elements)
+{
+    size_t vertexSize = 0;
+    for (auto it = elements.begin(); it != elements.end(); ++it)
+        vertexSize += elementSizes[it->type];
+    return vertexSize;
+}
+
+/// Pack a normalized float to a signed normalized integer of given bits.
+static unsigned PackSnorm(float value, unsigned bits)
+{
+    int maxValue = (1 << (bits - 1)) - 1;
+    int packed = (int)floorf(Clamp(value, -1.0f, 1.0f) * maxValue + 0.5f);
+    return (unsigned)packed & ((1u << bits) - 1);
+}
+
+/// Quantize normals, tangents and texture coordinates of a vertex buffer description to compact types. Positions are kept as floats for precision and CPU-side occluder use.
+static void QuantizeVertices(VertexBufferDesc& vbDesc)
+{
+    const std::vector<VertexElement>& elements = vbDesc.vertexElements;
+    std::vector<VertexElement> newElements = elements;
+    std::vector<size_t> offsets;
+    size_t vertexSize = VertexSize(elements);
+    bool changed = false;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < elements.size(); ++i)
+    {
+        const VertexElement& element = elements[i];
+        offsets.push_back(offset);
+
+        if ((element.semantic == SEM_NORMAL && element.type == ELEM_VECTOR3) || (element.semantic == SEM_TANGENT && element.type == ELEM_VECTOR4))
+            newElements[i].type = ELEM_INT2101010N;
+        else if (element.semantic == SEM_TEXCOORD && element.type == ELEM_VECTOR2)
+        {
+            // Use 16-bit normalized coordinates if the range allows, half floats otherwise
+            float minValue = M_MAX_FLOAT;
+            float maxValue = -M_MAX_FLOAT;
+            for (size_t j = 0; j < vbDesc.numVertices; ++j)
+            {
+                const Vector2& texCoord = *reinterpret_cast<const Vector2*>(vbDesc.vertexData + j * vertexSize + offset);
+                minValue = Min(minValue, Min(texCoord.x, texCoord.y));
+                maxValue = Max(maxValue, Max(texCoord.x, texCoord.y));
+            }
+
+            if (minValue >= 0.0f && maxValue <= 1.0f)
+                newElements[i].type = ELEM_USHORT2N;
+            else if (minValue >= -1.0f && maxValue <= 1.0f)
+                newElements[i].type = ELEM_SHORT2N;
+            else
+                newElements[i].type = ELEM_HALF2;
+        }
+
+        if (newElements[i].type != element.type)
+            changed = true;
+        offset += elementSizes[element.type];
+    }
+
+    if (!changed)
+        return;
+
+    size_t newVertexSize = VertexSize(newElements);
+    SharedArrayPtr<unsigned char> newStorage(new unsigned char[vbDesc.numVertices * newVertexSize]);
+
+    for (size_t i = 0; i < vbDesc.numVertices; ++i)
+    {
+        const unsigned char* src = vbDesc.vertexData + i * vertexSize;
+        unsigned char* dest = newStorage.Get() + i * newVertexSize;
+
+        for (size_t j = 0; j < elements.size(); ++j)
+        {
+            const float* values = reinterpret_cast<const float*>(src + offsets[j]);
+
+            switch (newElements[j].type)
+            {
+            case ELEM_INT2101010N:
+                {
+                    unsigned packed = PackSnorm(values[0], 10) | (PackSnorm(values[1], 10) << 10) | (PackSnorm(values[2], 10) << 20);
+                    if (elements[j].type == ELEM_VECTOR4)
+                        packed |= PackSnorm(values[3], 2) << 30;
+                    memcpy(dest, &packed, sizeof packed);
+                }
+                break;
+
+            case ELEM_USHORT2N:
+                {
+                    unsigned short packed[2];
+                    for (size_t k = 0; k < 2; ++k)
+                        packed[k] = (unsigned short)floorf(Clamp(values[k], 0.0f, 1.0f) * 65535.0f + 0.5f);
+                    memcpy(dest, packed, sizeof packed);
+                }
+                break;
+
+            case ELEM_SHORT2N:
+                {
+                    unsigned short packed[2];
+                    for (size_t k = 0; k < 2; ++k)
+                        packed[k] = (unsigned short)PackSnorm(values[k], 16);
+                    memcpy(dest, packed, sizeof packed);
+                }
+                break;
+
+            case ELEM_HALF2:
+                {
+                    unsigned short packed[2];
+                    for (size_t k = 0; k < 2; ++k)
+                        packed[k] = FloatToHalf(values[k]);
+                    memcpy(dest, packed, sizeof packed);
+                }
+                break;
+
+            default:
+                memcpy(dest, src + offsets[j], elementSizes[newElements[j].type]);
+                break;
+            }
+
+            dest += elementSizes[newElements[j].type];
+        }
+    }
+
+    vbDesc.vertexElements = newElements;
+    vbDesc.vertexStorage = newStorage;
+    vbDesc.vertexData = newStorage.Get();
+}
+
+/// Read an index range of an index buffer description.
+static void ReadIndices(const IndexBufferDesc& ibDesc, size_t start, size_t count, std::vector<unsigned>& dest)
+{
+    dest.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = ibDesc.indexSize == sizeof(unsigned short) ? ((const unsigned short*)ibDesc.indexData)[start + i] :
+            ((const unsigned*)ibDesc.indexData)[start + i];
+    }
+}
+
+/// Write an index range of an index buffer description. Copies index data referenced in place from the source stream first.
+static void WriteIndices(IndexBufferDesc& ibDesc, size_t start, const std::vector<unsigned>& src)
+{
+    if (ibDesc.indexData != ibDesc.indexStorage.Get())
+    {
+        size_t dataSize = ibDesc.numIndices * ibDesc.indexSize;
+        ibDesc.indexStorage = new unsigned char[dataSize];
+        memcpy(ibDesc.indexStorage.Get(), ibDesc.indexData, dataSize);
+        ibDesc.indexData = ibDesc.indexStorage.Get();
+    }
+
+    for (size_t i = 0; i < src.size(); ++i)
+    {
+        if (ibDesc.indexSize == sizeof(unsigned short))
+            ((unsigned short*)ibDesc.indexStorage.Get())[start + i] = (unsigned short)src[i];
+        else
+            ((unsigned*)ibDesc.indexStorage.Get())[start + i] = src[i];
+    }
+}
+
+/// Read the positions of a vertex buffer description. Return false if it has no float positions.
+static bool ReadPositions(const VertexBufferDesc& vbDesc, std::vector<Vector3>& dest)
+{
+    size_t vertexSize = 0;
+    size_t positionOffset = M_MAX_UNSIGNED;
+    for (auto it = vbDesc.vertexElements.begin(); it != vbDesc.vertexElements.end(); ++it)
+    {
+        if (it->semantic == SEM_POSITION && it->type == ELEM_VECTOR3 && positionOffset == M_MAX_UNSIGNED)
+            positionOffset = vertexSize;
+        vertexSize += elementSizes[it->type];
+    }
+    if (positionOffset == M_MAX_UNSIGNED)
+        return false;
+
+    dest.resize(vbDesc.numVertices);
+    for (size_t i = 0; i < vbDesc.numVertices; ++i)
+        dest[i] = *reinterpret_cast<const Vector3*>(vbDesc.vertexData + i * vertexSize + positionOffset);
+    return true;
+}
+
+/// Return whether an index range is within an index buffer description.
+static bool IsValidRange(const IndexBufferDesc& ibDesc, const GeometryDesc& desc)
+{
+    return desc.drawStart + desc.drawCount <= ibDesc.numIndices;
+}
+
+/// Order geometry descriptions by index buffer and draw range start.
+static bool CompareDrawRanges(const GeometryDesc& lhs, const GeometryDesc& rhs)
+{
+    if (lhs.ibRef != rhs.ibRef)
+        return lhs.ibRef < rhs.ibRef;
+    if (lhs.drawStart != rhs.drawStart)
+        return lhs.drawStart < rhs.drawStart;
+    return lhs.drawCount < rhs.drawCount;
+}
+
+Model::Model() :
+    combinedAllocation(0),
+    gpuMemoryUse(0),
+    impostorDistance(0.0f)
 {
 }
 
 Model::~Model()
 {
+    if (combinedBuffer)
+        combinedBuffer->FreeRange(combinedAllocation);
 }
 
 void Model::RegisterObject()
@@ -119,17 +638,100 @@ void Model::RegisterObject()
 
 bool Model::BeginLoad(Stream& source)
 {
-    /// \todo Develop own format for Turso3D
-    if (source.ReadFileID() != "UMDL")
+    MEMORY_SCOPE(MEMORY_MODEL);
+
+    vbDescs.clear();
+    ibDescs.clear();
+    geomDescs.clear();
+
+    std::string fileID = source.ReadFileID();
+    bool success;
+    if (fileID == "TMDL")
+        success = BeginLoadNative(source);
+    else if (fileID == "UMDL")
+        success = BeginLoadUMDL(source);
+    else
     {
         LOGERROR(source.Name() + " is not a valid model file");
         return false;
     }
 
-    vbDescs.clear();
-    ibDescs.clear();
-    geomDescs.clear();
+    if (success)
+        ResolveBoneMappings();
+    if (success && lodGenerationLevels)
+        GenerateLodLevels();
+    if (success && meshOptimization)
+        OptimizeMeshes();
+
+    if (success && vertexCompression)
+    {
+        for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
+            QuantizeVertices(*it);
+    }
+
+    // Keep positions and indices of the most detailed LOD level for raycasts, as the load data is released after upload. Built here, as BeginLoad() may run in a worker thread and the hierarchy is the costly part. Skinned geometries do not stay in bind pose, so they are left to the bounding box test
+    raycastGeometries.clear();
+    if (success && raycastData && bones.empty())
+    {
+        raycastGeometries.resize(geomDescs.size());
+        for (size_t i = 0; i < geomDescs.size(); ++i)
+        {
+            OccluderGeometry* triangles = geomDescs[i].size() ? CreateOccluderGeometry(geomDescs[i][0], M_MAX_UNSIGNED) : nullptr;
+            if (triangles)
+            {
+                triangles->bvh.Build(triangles->vertices, triangles->indices);
+                raycastGeometries[i] = triangles;
+            }
+        }
+    }
+
+    return success;
+}
+
+void Model::SetVertexCompression(bool enable)
+{
+    vertexCompression = enable;
+}
+
+bool Model::VertexCompression()
+{
+    return vertexCompression;
+}
+
+void Model::SetMeshOptimization(bool enable)
+{
+    meshOptimization = enable;
+}
+
+bool Model::MeshOptimization()
+{
+    return meshOptimization;
+}
+
+void Model::SetLodGeneration(size_t numLevels, float reduction, float distanceStep)
+{
+    lodGenerationLevels = numLevels;
+    lodGenerationReduction = Clamp(reduction, 0.05f, 0.95f);
+    lodGenerationDistance = Max(distanceStep, 0.0f);
+}
+
+size_t Model::LodGenerationLevels()
+{
+    return lodGenerationLevels;
+}
+
+void Model::SetRaycastData(bool enable)
+{
+    raycastData = enable;
+}
+
+bool Model::RaycastData()
+{
+    return raycastData;
+}
 
+bool Model::BeginLoadUMDL(Stream& source)
+{
     size_t numVertexBuffers = source.Read<unsigned>();
     vbDescs.resize(numVertexBuffers);
     for (size_t i = 0; i < numVertexBuffers; ++i)
@@ -193,8 +795,15 @@ bool Model::BeginLoad(Stream& source)
             vertexSize += 4;
         }
 
-        vbDesc.vertexData = new unsigned char[vbDesc.numVertices * vertexSize];
-        source.Read(&vbDesc.vertexData[0], vbDesc.numVertices * vertexSize);
+        // Reference the data in place if the stream allows, as it stays alive until EndLoad()
+        size_t dataSize = vbDesc.numVertices * vertexSize;
+        vbDesc.vertexData = source.ReadInPlace(dataSize);
+        if (!vbDesc.vertexData)
+        {
+            vbDesc.vertexStorage = new unsigned char[dataSize];
+            source.Read(&vbDesc.vertexStorage[0], dataSize);
+            vbDesc.vertexData = vbDesc.vertexStorage.Get();
+        }
     }
 
     size_t numIndexBuffers = source.Read<unsigned>();
@@ -205,8 +814,14 @@ bool Model::BeginLoad(Stream& source)
     
         ibDesc.numIndices = source.Read<unsigned>();
         ibDesc.indexSize = source.Read<unsigned>();
-        ibDesc.indexData = new unsigned char[ibDesc.numIndices * ibDesc.indexSize];
-        source.Read(&ibDesc.indexData[0], ibDesc.numIndices * ibDesc.indexSize);
+        size_t dataSize = ibDesc.numIndices * ibDesc.indexSize;
+        ibDesc.indexData = source.ReadInPlace(dataSize);
+        if (!ibDesc.indexData)
+        {
+            ibDesc.indexStorage = new unsigned char[dataSize];
+            source.Read(&ibDesc.indexStorage[0], dataSize);
+            ibDesc.indexData = ibDesc.indexStorage.Get();
+        }
     }
 
     size_t numGeometries = source.Read<unsigned>();
@@ -275,18 +890,180 @@ bool Model::BeginLoad(Stream& source)
     return true;
 }
 
+bool Model::BeginLoadNative(Stream& source)
+{
+    if (source.Read<unsigned>() != MODEL_FILE_VERSION)
+    {
+        LOGERROR(source.Name() + " has an unsupported model file version");
+        return false;
+    }
+
+    size_t numVertexBuffers = source.Read<unsigned>();
+    size_t numIndexBuffers = source.Read<unsigned>();
+    size_t numGeometries = source.Read<unsigned>();
+    size_t numBones = source.Read<unsigned>();
+    boundingBox = source.Read<BoundingBox>();
+
+    std::vector<std::pair<unsigned, unsigned> > vertexDataRanges(numVertexBuffers);
+    vbDescs.resize(numVertexBuffers);
+    for (size_t i = 0; i < numVertexBuffers; ++i)
+    {
+        VertexBufferDesc& vbDesc = vbDescs[i];
+
+        vbDesc.numVertices = source.Read<unsigned>();
+        size_t numElements = source.Read<unsigned>();
+        for (size_t j = 0; j < numElements; ++j)
+        {
+            unsigned char element[4];
+            source.Read(element, sizeof element);
+            if (element[0] >= MAX_ELEMENT_TYPES || element[1] >= MAX_ELEMENT_SEMANTICS)
+            {
+                LOGERROR("Unknown vertex element in " + source.Name());
+                return false;
+            }
+            vbDesc.vertexElements.push_back(VertexElement((ElementType)element[0], (ElementSemantic)element[1], element[2]));
+        }
+
+        vertexDataRanges[i].first = source.Read<unsigned>();
+        vertexDataRanges[i].second = source.Read<unsigned>();
+    }
+
+    std::vector<std::pair<unsigned, unsigned> > indexDataRanges(numIndexBuffers);
+    ibDescs.resize(numIndexBuffers);
+    for (size_t i = 0; i < numIndexBuffers; ++i)
+    {
+        IndexBufferDesc& ibDesc = ibDescs[i];
+
+        ibDesc.numIndices = source.Read<unsigned>();
+        ibDesc.indexSize = source.Read<unsigned>();
+        indexDataRanges[i].first = source.Read<unsigned>();
+        indexDataRanges[i].second = source.Read<unsigned>();
+    }
+
+    geomDescs.resize(numGeometries);
+    boneMappings.resize(numGeometries);
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        size_t boneMappingCount = source.Read<unsigned>();
+        std::vector<unsigned> boneMapping(boneMappingCount);
+        if (boneMappingCount)
+            source.Read(&boneMapping[0], boneMappingCount * sizeof(unsigned));
+        boneMappings[i].assign(boneMapping.begin(), boneMapping.end());
+
+        size_t numLodLevels = source.Read<unsigned>();
+        geomDescs[i].resize(numLodLevels);
+        for (size_t j = 0; j < numLodLevels; ++j)
+        {
+            GeometryDesc& geomDesc = geomDescs[i][j];
+
+            geomDesc.lodDistance = source.Read<float>();
+            geomDesc.vbRef = source.Read<unsigned>();
+            geomDesc.ibRef = source.Read<unsigned>();
+            geomDesc.drawStart = source.Read<unsigned>();
+            geomDesc.drawCount = source.Read<unsigned>();
+        }
+    }
+
+    bones.resize(numBones);
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        Bone& bone = bones[i];
+        bone.name = source.Read<std::string>();
+        bone.parentIndex = source.Read<unsigned>();
+        bone.initialPosition = source.Read<Vector3>();
+        bone.initialRotation = source.Read<Quaternion>();
+        bone.initialScale = source.Read<Vector3>();
+        bone.offsetMatrix = source.Read<Matrix3x4>();
+        bone.radius = source.Read<float>();
+        bone.boundingBox = source.Read<BoundingBox>();
+
+        if (bone.parentIndex == i)
+            rootBoneIndex = i;
+    }
+
+    // The data blobs are aligned and in GPU layout, so they are referenced in place when the stream allows
+    for (size_t i = 0; i < numVertexBuffers; ++i)
+    {
+        if (!ReadModelData(source, vertexDataRanges[i], vbDescs[i].vertexData, vbDescs[i].vertexStorage))
+            return false;
+    }
+    for (size_t i = 0; i < numIndexBuffers; ++i)
+    {
+        if (!ReadModelData(source, indexDataRanges[i], ibDescs[i].indexData, ibDescs[i].indexStorage))
+            return false;
+    }
+
+    return true;
+}
+
+bool Model::Save(Stream& dest)
+{
+    if (vbDescs.empty() && ibDescs.empty())
+    {
+        LOGERROR("Model load data is not available for saving " + Name());
+        return false;
+    }
+
+    // Measure the directory to know where the data blobs start
+    VectorBuffer directory;
+    WriteNativeDirectory(directory, std::vector<unsigned>());
+
+    std::vector<unsigned> dataOffsets;
+    size_t offset = directory.Size();
+    for (size_t i = 0; i < vbDescs.size(); ++i)
+    {
+        offset = (offset + MODEL_DATA_ALIGNMENT - 1) & ~(MODEL_DATA_ALIGNMENT - 1);
+        dataOffsets.push_back((unsigned)offset);
+        offset += vbDescs[i].numVertices * VertexSize(vbDescs[i].vertexElements);
+    }
+    for (size_t i = 0; i < ibDescs.size(); ++i)
+    {
+        offset = (offset + MODEL_DATA_ALIGNMENT - 1) & ~(MODEL_DATA_ALIGNMENT - 1);
+        dataOffsets.push_back((unsigned)offset);
+        offset += ibDescs[i].numIndices * ibDescs[i].indexSize;
+    }
+
+    size_t start = dest.Position();
+    WriteNativeDirectory(dest, dataOffsets);
+
+    std::vector<unsigned char> padding(MODEL_DATA_ALIGNMENT, 0);
+    for (size_t i = 0; i < vbDescs.size() + ibDescs.size(); ++i)
+    {
+        size_t padSize = start + dataOffsets[i] - dest.Position();
+        if (padSize)
+            dest.Write(&padding[0], padSize);
+
+        if (i < vbDescs.size())
+            dest.Write(vbDescs[i].vertexData, vbDescs[i].numVertices * VertexSize(vbDescs[i].vertexElements));
+        else
+        {
+            const IndexBufferDesc& ibDesc = ibDescs[i - vbDescs.size()];
+            dest.Write(ibDesc.indexData, ibDesc.numIndices * ibDesc.indexSize);
+        }
+    }
+
+    return true;
+}
+
 bool Model::EndLoad()
 {
+    MEMORY_SCOPE(MEMORY_MODEL);
+
+    gpuMemoryUse = 0;
+
+    // Release the previous range on reload
+    if (combinedBuffer)
+    {
+        combinedBuffer->FreeRange(combinedAllocation);
+        combinedBuffer.Reset();
+        combinedAllocation = 0;
+    }
+
     bool hasWeights = false;
-    bool hasSameIndexSize = true;
     size_t totalIndices = 0;
 
     for (size_t i = 0; i < ibDescs.size(); ++i)
-    {
         totalIndices += ibDescs[i].numIndices;
-        if (ibDescs[i].indexSize != ibDescs[0].indexSize)
-            hasSameIndexSize = false;
-    }
 
     for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
     {
@@ -302,43 +1079,45 @@ bool Model::EndLoad()
             break;
     }
 
-    if (vbDescs.size() == 1 && vbDescs[0].numVertices < COMBINEDBUFFER_VERTICES && totalIndices < COMBINEDBUFFER_INDICES && hasSameIndexSize && !hasWeights)
+    // Build occluder data from the lowest LOD level
+    std::vector<SharedPtr<OccluderGeometry> > occluders(geomDescs.size());
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        if (geomDescs[i].size())
+            occluders[i] = CreateOccluderGeometry(geomDescs[i].back(), MAX_OCCLUDER_TRIANGLES);
+    }
+    raycastGeometries.resize(geomDescs.size());
+
+    if (vbDescs.size() == 1 && vbDescs[0].numVertices < COMBINEDBUFFER_VERTICES && totalIndices < COMBINEDBUFFER_INDICES && !hasWeights)
     {
-        combinedBuffer = CombinedBuffer::Allocate(vbDescs[0].vertexElements, vbDescs[0].numVertices, totalIndices);
-        unsigned vertexStart = (unsigned)combinedBuffer->UsedVertices();
+        combinedBuffer = CombinedBuffer::Allocate(vbDescs[0].vertexElements, vbDescs[0].numVertices, totalIndices, combinedAllocation);
+        const CombinedBufferAllocation* allocation = combinedBuffer->Allocation(combinedAllocation);
+        combinedBuffer->SetVertices(combinedAllocation, vbDescs[0].vertexData);
 
+        // The indices are drawn with a base vertex, so they only need widening to the 32-bit index buffer
+        std::vector<size_t> indexOffsets;
+        size_t indexOffset = 0;
         for (size_t i = 0; i < ibDescs.size(); ++i)
         {
-            IndexBufferDesc& ibDesc = ibDescs[i];
+            const IndexBufferDesc& ibDesc = ibDescs[i];
 
             if (ibDesc.indexSize == sizeof(unsigned short))
             {
-                unsigned short* oldIndexData = (unsigned short*)&ibDesc.indexData[0];
-                SharedArrayPtr<unsigned char> newIndices(new unsigned char[sizeof(unsigned) * ibDesc.numIndices]);
-                unsigned* newIndexData = (unsigned*)newIndices.Get();
-                for (size_t j = 0; j < ibDescs[i].numIndices; ++j)
-                    newIndexData[j] = (unsigned)oldIndexData[j] + vertexStart;
-                
-                ibDesc.indexData = newIndices;
-                ibDesc.indexSize = sizeof(unsigned);
+                const unsigned short* oldIndexData = (const unsigned short*)ibDesc.indexData;
+                std::vector<unsigned> newIndexData(ibDesc.numIndices);
+                for (size_t j = 0; j < ibDesc.numIndices; ++j)
+                    newIndexData[j] = oldIndexData[j];
+                combinedBuffer->SetIndices(combinedAllocation, indexOffset, ibDesc.numIndices, &newIndexData[0]);
             }
             else
-            {
-                unsigned* indexData = (unsigned*)&ibDesc.indexData[0];
-                for (size_t j = 0; j < ibDescs[i].numIndices; ++j)
-                    indexData[j] += vertexStart;
-            }
-        }
-
-        std::vector<size_t> indexStarts;
+                combinedBuffer->SetIndices(combinedAllocation, indexOffset, ibDesc.numIndices, ibDesc.indexData);
 
-        combinedBuffer->FillVertices(vbDescs[0].numVertices, vbDescs[0].vertexData.Get());
-        for (size_t i = 0; i < ibDescs.size(); ++i)
-        {
-            indexStarts.push_back(combinedBuffer->UsedIndices());
-            combinedBuffer->FillIndices(ibDescs[i].numIndices, ibDescs[i].indexData.Get());
+            indexOffsets.push_back(indexOffset);
+            indexOffset += ibDesc.numIndices;
         }
 
+        gpuMemoryUse = vbDescs[0].numVertices * combinedBuffer->GetVertexBuffer()->VertexSize() + totalIndices * sizeof(unsigned);
+
         geometries.resize(geomDescs.size());
         for (size_t i = 0; i < geomDescs.size(); ++i)
         {
@@ -349,17 +1128,23 @@ bool Model::EndLoad()
                 SharedPtr<Geometry> geom(new Geometry());
 
                 geom->lodDistance = geomDesc.lodDistance;
-                geom->drawStart = geomDesc.drawStart + indexStarts[geomDesc.ibRef];
+                geom->drawStart = allocation->indexStart + indexOffsets[geomDesc.ibRef] + geomDesc.drawStart;
                 geom->drawCount = geomDesc.drawCount;
+                geom->baseVertex = (unsigned)allocation->vertexStart;
                 geom->vertexBuffer = combinedBuffer->GetVertexBuffer();
                 geom->indexBuffer = combinedBuffer->GetIndexBuffer();
+                geom->occluder = occluders[i];
+                if (j == 0)
+                    geom->raycastData = raycastGeometries[i];
                 geometries[i][j] = geom;
+                combinedBuffer->AddGeometry(combinedAllocation, geom);
             }
         }
 
         vbDescs.clear();
         ibDescs.clear();
         geomDescs.clear();
+        raycastGeometries.clear();
 
         return true;
     }
@@ -370,7 +1155,8 @@ bool Model::EndLoad()
         const VertexBufferDesc& vbDesc = vbDescs[i];
         SharedPtr<VertexBuffer> vb(new VertexBuffer());
 
-        vb->Define(USAGE_DEFAULT, vbDesc.numVertices, vbDesc.vertexElements, vbDesc.vertexData.Get());
+        vb->Define(USAGE_DEFAULT, vbDesc.numVertices, vbDesc.vertexElements, vbDesc.vertexData);
+        gpuMemoryUse += vb->NumVertices() * vb->VertexSize();
         vbs.push_back(vb);
     }
 
@@ -380,7 +1166,8 @@ bool Model::EndLoad()
         const IndexBufferDesc& ibDesc = ibDescs[i];
         SharedPtr<IndexBuffer> ib(new IndexBuffer());
 
-        ib->Define(USAGE_DEFAULT, ibDesc.numIndices, ibDesc.indexSize, ibDesc.indexData.Get());
+        ib->Define(USAGE_DEFAULT, ibDesc.numIndices, ibDesc.indexSize, ibDesc.indexData);
+        gpuMemoryUse += ib->NumIndices() * ib->IndexSize();
         ibs.push_back(ib);
     }
 
@@ -407,7 +1194,10 @@ bool Model::EndLoad()
                 geom->indexBuffer = ibs[geomDesc.ibRef];
             else
                 LOGERROR("Out of range index buffer reference in " + Name());
-            
+
+            geom->occluder = occluders[i];
+            if (j == 0)
+                geom->raycastData = raycastGeometries[i];
             geometries[i][j] = geom;
         }
     }
@@ -415,10 +1205,25 @@ bool Model::EndLoad()
     vbDescs.clear();
     ibDescs.clear();
     geomDescs.clear();
+    raycastGeometries.clear();
 
     return true;
 }
 
+size_t Model::CpuMemoryUse() const
+{
+    size_t memoryUse = bones.capacity() * sizeof(Bone);
+    for (size_t i = 0; i < boneMappings.size(); ++i)
+        memoryUse += boneMappings[i].capacity() * sizeof(size_t);
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        const OccluderGeometry* triangles = geometries[i].size() ? geometries[i][0]->raycastData.Get() : nullptr;
+        if (triangles)
+            memoryUse += triangles->vertices.capacity() * sizeof(Vector3) + triangles->indices.capacity() * sizeof(unsigned) + triangles->bvh.MemoryUse();
+    }
+    return memoryUse;
+}
+
 void Model::SetNumGeometries(size_t num)
 {
     geometries.resize(num);
@@ -463,6 +1268,15 @@ void Model::SetBoneMappings(const std::vector<std::vector<size_t> >& boneMapping
     boneMappings = boneMappings_;
 }
 
+void Model::SetImpostor(Geometry* geometry, Material* material, float distance)
+{
+    impostorGeometry = geometry;
+    impostorMaterial = geometry ? material : nullptr;
+    impostorDistance = Max(distance, 0.0f);
+    // Invalidate batches cached from the nodes using the model
+    SourceBatches::MarkChanged();
+}
+
 size_t Model::NumLodLevels(size_t index) const
 {
     return index < geometries.size() ? geometries[index].size() : 0;
@@ -472,3 +1286,353 @@ Geometry* Model::GetGeometry(size_t index, size_t lodLevel) const
 {
     return (index < geometries.size() && lodLevel < geometries[index].size()) ? geometries[index][lodLevel].Get() : nullptr;
 }
+
+void Model::WriteNativeDirectory(Stream& dest, const std::vector<unsigned>& dataOffsets) const
+{
+    dest.WriteFileID("TMDL");
+    dest.Write(MODEL_FILE_VERSION);
+    dest.Write((unsigned)vbDescs.size());
+    dest.Write((unsigned)ibDescs.size());
+    dest.Write((unsigned)geomDescs.size());
+    dest.Write((unsigned)bones.size());
+    dest.Write(boundingBox);
+
+    size_t dataIndex = 0;
+    for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it, ++dataIndex)
+    {
+        dest.Write((unsigned)it->numVertices);
+        dest.Write((unsigned)it->vertexElements.size());
+        for (auto eIt = it->vertexElements.begin(); eIt != it->vertexElements.end(); ++eIt)
+        {
+            unsigned char element[4] = { (unsigned char)eIt->type, (unsigned char)eIt->semantic, eIt->index, 0 };
+            dest.Write(element, sizeof element);
+        }
+
+        dest.Write(dataIndex < dataOffsets.size() ? dataOffsets[dataIndex] : 0U);
+        dest.Write((unsigned)(it->numVertices * VertexSize(it->vertexElements)));
+    }
+
+    for (auto it = ibDescs.begin(); it != ibDescs.end(); ++it, ++dataIndex)
+    {
+        dest.Write((unsigned)it->numIndices);
+        dest.Write((unsigned)it->indexSize);
+        dest.Write(dataIndex < dataOffsets.size() ? dataOffsets[dataIndex] : 0U);
+        dest.Write((unsigned)(it->numIndices * it->indexSize));
+    }
+
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        const std::vector<size_t>& boneMapping = i < boneMappings.size() ? boneMappings[i] : std::vector<size_t>();
+        dest.Write((unsigned)boneMapping.size());
+        for (auto it = boneMapping.begin(); it != boneMapping.end(); ++it)
+            dest.Write((unsigned)*it);
+
+        dest.Write((unsigned)geomDescs[i].size());
+        for (auto it = geomDescs[i].begin(); it != geomDescs[i].end(); ++it)
+        {
+            dest.Write(it->lodDistance);
+            dest.Write(it->vbRef);
+            dest.Write(it->ibRef);
+            dest.Write(it->drawStart);
+            dest.Write(it->drawCount);
+        }
+    }
+
+    for (auto it = bones.begin(); it != bones.end(); ++it)
+    {
+        dest.Write(it->name);
+        dest.Write((unsigned)it->parentIndex);
+        dest.Write(it->initialPosition);
+        dest.Write(it->initialRotation);
+        dest.Write(it->initialScale);
+        dest.Write(it->offsetMatrix);
+        dest.Write(it->radius);
+        dest.Write(it->boundingBox);
+    }
+}
+
+void Model::ResolveBoneMappings()
+{
+    std::vector<std::vector<bool> > resolved(vbDescs.size());
+    std::vector<unsigned> indices;
+
+    for (size_t i = 0; i < geomDescs.size() && i < boneMappings.size(); ++i)
+    {
+        const std::vector<size_t>& mapping = boneMappings[i];
+        if (mapping.empty())
+            continue;
+
+        bool success = true;
+        for (auto it = geomDescs[i].begin(); it != geomDescs[i].end(); ++it)
+        {
+            const GeometryDesc& desc = *it;
+            if (desc.vbRef >= vbDescs.size() || desc.ibRef >= ibDescs.size() || !IsValidRange(ibDescs[desc.ibRef], desc))
+            {
+                success = false;
+                continue;
+            }
+
+            VertexBufferDesc& vbDesc = vbDescs[desc.vbRef];
+            size_t vertexSize = 0;
+            size_t indicesOffset = M_MAX_UNSIGNED;
+            for (auto eIt = vbDesc.vertexElements.begin(); eIt != vbDesc.vertexElements.end(); ++eIt)
+            {
+                if (eIt->semantic == SEM_BLENDINDICES && eIt->type == ELEM_UBYTE4)
+                    indicesOffset = vertexSize;
+                vertexSize += elementSizes[eIt->type];
+            }
+            if (indicesOffset == M_MAX_UNSIGNED)
+                continue;
+
+            // Copy vertex data referenced in place from the source stream before modifying
+            if (vbDesc.vertexData != vbDesc.vertexStorage.Get())
+            {
+                size_t dataSize = vbDesc.numVertices * vertexSize;
+                vbDesc.vertexStorage = new unsigned char[dataSize];
+                memcpy(vbDesc.vertexStorage.Get(), vbDesc.vertexData, dataSize);
+                vbDesc.vertexData = vbDesc.vertexStorage.Get();
+            }
+
+            // LOD levels and other geometries may share vertices, which are resolved only once
+            std::vector<bool>& vbResolved = resolved[desc.vbRef];
+            vbResolved.resize(vbDesc.numVertices);
+            ReadIndices(ibDescs[desc.ibRef], desc.drawStart, desc.drawCount, indices);
+            for (auto iIt = indices.begin(); iIt != indices.end(); ++iIt)
+            {
+                if (*iIt >= vbDesc.numVertices || vbResolved[*iIt])
+                    continue;
+
+                unsigned char* blendIndices = vbDesc.vertexStorage.Get() + *iIt * vertexSize + indicesOffset;
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    size_t boneIndex = blendIndices[j] < mapping.size() ? mapping[blendIndices[j]] : 0;
+                    if (boneIndex > 0xff)
+                    {
+                        success = false;
+                        boneIndex = 0;
+                    }
+                    blendIndices[j] = (unsigned char)boneIndex;
+                }
+                vbResolved[*iIt] = true;
+            }
+        }
+
+        if (success)
+            boneMappings[i].clear();
+        else
+            LOGWARNINGF("Could not resolve the bone mapping of geometry %u in %s", (unsigned)i, Name().c_str());
+    }
+}
+
+void Model::GenerateLodLevels()
+{
+    PROFILE(GenerateLodLevels);
+
+    float distanceStep = lodGenerationDistance > 0.0f ? lodGenerationDistance : boundingBox.Size().Length() * DEFAULT_LOD_DISTANCE_FACTOR;
+    std::vector<std::vector<Vector3> > positions(vbDescs.size());
+    std::vector<unsigned> lodIndices;
+    std::vector<unsigned> current;
+    std::vector<unsigned> simplified;
+    unsigned maxIndex = 0;
+
+    // Authored LOD levels are kept as is
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        if (geomDescs[i].size() != 1)
+            continue;
+
+        GeometryDesc baseDesc = geomDescs[i][0];
+        if (baseDesc.vbRef >= vbDescs.size() || baseDesc.ibRef >= ibDescs.size() || !IsValidRange(ibDescs[baseDesc.ibRef], baseDesc))
+            continue;
+        if (positions[baseDesc.vbRef].empty() && !ReadPositions(vbDescs[baseDesc.vbRef], positions[baseDesc.vbRef]))
+            continue;
+
+        ReadIndices(ibDescs[baseDesc.ibRef], baseDesc.drawStart, baseDesc.drawCount, current);
+
+        for (size_t j = 1; j <= lodGenerationLevels; ++j)
+        {
+            size_t targetIndices = (size_t)(current.size() * lodGenerationReduction) / 3 * 3;
+            SimplifyMesh(simplified, current.empty() ? nullptr : &current[0], current.size(), positions[baseDesc.vbRef], targetIndices, LOD_GENERATION_MAX_ERROR);
+            if (simplified.empty() || simplified.size() > current.size() * LOD_GENERATION_MIN_REDUCTION)
+                break;
+
+            GeometryDesc lodDesc;
+            lodDesc.lodDistance = baseDesc.lodDistance + distanceStep * j;
+            lodDesc.vbRef = baseDesc.vbRef;
+            lodDesc.ibRef = (unsigned)ibDescs.size();
+            lodDesc.drawStart = (unsigned)lodIndices.size();
+            lodDesc.drawCount = (unsigned)simplified.size();
+            geomDescs[i].push_back(lodDesc);
+
+            for (auto it = simplified.begin(); it != simplified.end(); ++it)
+                maxIndex = std::max(maxIndex, *it);
+            lodIndices.insert(lodIndices.end(), simplified.begin(), simplified.end());
+            current.swap(simplified);
+        }
+    }
+
+    if (lodIndices.empty())
+        return;
+
+    // The generated levels share one new index buffer
+    ibDescs.push_back(IndexBufferDesc());
+    IndexBufferDesc& ibDesc = ibDescs.back();
+    ibDesc.numIndices = lodIndices.size();
+    ibDesc.indexSize = maxIndex <= 0xffff ? sizeof(unsigned short) : sizeof(unsigned);
+    ibDesc.indexStorage = new unsigned char[ibDesc.numIndices * ibDesc.indexSize];
+    ibDesc.indexData = ibDesc.indexStorage.Get();
+    WriteIndices(ibDesc, 0, lodIndices);
+}
+
+void Model::OptimizeMeshes()
+{
+    PROFILE(OptimizeMeshes);
+
+    std::vector<GeometryDesc> ranges;
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            const GeometryDesc& desc = geomDescs[i][j];
+            if (desc.vbRef < vbDescs.size() && desc.ibRef < ibDescs.size() && IsValidRange(ibDescs[desc.ibRef], desc))
+                ranges.push_back(desc);
+        }
+    }
+    std::sort(ranges.begin(), ranges.end(), CompareDrawRanges);
+
+    // Reorder the triangles of each distinct draw range. Partially overlapping ranges are left alone, as reordering one would break the other
+    std::vector<unsigned> indices;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const GeometryDesc& desc = ranges[i];
+        if (i > 0 && ranges[i - 1].ibRef == desc.ibRef && ranges[i - 1].drawStart == desc.drawStart && ranges[i - 1].drawCount == desc.drawCount)
+            continue;
+        bool overlaps = (i > 0 && ranges[i - 1].ibRef == desc.ibRef && ranges[i - 1].drawStart + ranges[i - 1].drawCount > desc.drawStart) ||
+            (i + 1 < ranges.size() && ranges[i + 1].ibRef == desc.ibRef && desc.drawStart + desc.drawCount > ranges[i + 1].drawStart &&
+            (ranges[i + 1].drawStart != desc.drawStart || ranges[i + 1].drawCount != desc.drawCount));
+        if (overlaps)
+            continue;
+
+        ReadIndices(ibDescs[desc.ibRef], desc.drawStart, desc.drawCount, indices);
+        OptimizeVertexCache(indices.empty() ? nullptr : &indices[0], indices.size(), vbDescs[desc.vbRef].numVertices);
+        WriteIndices(ibDescs[desc.ibRef], desc.drawStart, indices);
+    }
+
+    // Reorder the vertices into first use order, when the vertex buffer's index buffers are not used with other vertex buffers
+    const unsigned SHARED_INDEX_BUFFER = M_MAX_UNSIGNED - 1;
+    std::vector<unsigned> ibOwners(ibDescs.size(), M_MAX_UNSIGNED);
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+    {
+        if (ibOwners[it->ibRef] == M_MAX_UNSIGNED)
+            ibOwners[it->ibRef] = it->vbRef;
+        else if (ibOwners[it->ibRef] != it->vbRef)
+            ibOwners[it->ibRef] = SHARED_INDEX_BUFFER;
+    }
+
+    for (size_t i = 0; i < vbDescs.size(); ++i)
+    {
+        VertexBufferDesc& vbDesc = vbDescs[i];
+        bool exclusive = true;
+        for (auto it = ranges.begin(); it != ranges.end(); ++it)
+        {
+            if (it->vbRef == i && ibOwners[it->ibRef] != i)
+                exclusive = false;
+        }
+        if (!exclusive || !vbDesc.numVertices)
+            continue;
+
+        std::vector<unsigned> remap(vbDesc.numVertices, M_MAX_UNSIGNED);
+        unsigned numRemapped = 0;
+        bool valid = true;
+        for (size_t j = 0; j < ibDescs.size() && valid; ++j)
+        {
+            if (ibOwners[j] != i)
+                continue;
+
+            ReadIndices(ibDescs[j], 0, ibDescs[j].numIndices, indices);
+            for (auto it = indices.begin(); it != indices.end(); ++it)
+            {
+                if (*it >= vbDesc.numVertices)
+                {
+                    valid = false;
+                    break;
+                }
+                if (remap[*it] == M_MAX_UNSIGNED)
+                    remap[*it] = numRemapped++;
+            }
+        }
+        if (!valid)
+            continue;
+
+        for (size_t j = 0; j < remap.size(); ++j)
+        {
+            if (remap[j] == M_MAX_UNSIGNED)
+                remap[j] = numRemapped++;
+        }
+
+        for (size_t j = 0; j < ibDescs.size(); ++j)
+        {
+            if (ibOwners[j] != i)
+                continue;
+
+            ReadIndices(ibDescs[j], 0, ibDescs[j].numIndices, indices);
+            for (auto it = indices.begin(); it != indices.end(); ++it)
+                *it = remap[*it];
+            WriteIndices(ibDescs[j], 0, indices);
+        }
+
+        size_t vertexSize = VertexSize(vbDesc.vertexElements);
+        SharedArrayPtr<unsigned char> newStorage(new unsigned char[vbDesc.numVertices * vertexSize]);
+        for (size_t j = 0; j < vbDesc.numVertices; ++j)
+            memcpy(newStorage.Get() + remap[j] * vertexSize, vbDesc.vertexData + j * vertexSize, vertexSize);
+        vbDesc.vertexStorage = newStorage;
+        vbDesc.vertexData = newStorage.Get();
+    }
+}
+
+OccluderGeometry* Model::CreateOccluderGeometry(const GeometryDesc& desc, size_t maxTriangles) const
+{
+    if (desc.vbRef >= vbDescs.size() || desc.ibRef >= ibDescs.size() || desc.drawCount / 3 > maxTriangles)
+        return nullptr;
+
+    const VertexBufferDesc& vbDesc = vbDescs[desc.vbRef];
+    const IndexBufferDesc& ibDesc = ibDescs[desc.ibRef];
+    if (desc.drawStart + desc.drawCount > ibDesc.numIndices)
+        return nullptr;
+
+    size_t vertexSize = 0;
+    size_t positionOffset = M_MAX_UNSIGNED;
+    for (auto it = vbDesc.vertexElements.begin(); it != vbDesc.vertexElements.end(); ++it)
+    {
+        if (it->semantic == SEM_POSITION && it->type == ELEM_VECTOR3 && positionOffset == M_MAX_UNSIGNED)
+            positionOffset = vertexSize;
+        vertexSize += elementSizes[it->type];
+    }
+    if (positionOffset == M_MAX_UNSIGNED)
+        return nullptr;
+
+    OccluderGeometry* occluder = new OccluderGeometry();
+    std::vector<unsigned> vertexRemap(vbDesc.numVertices, M_MAX_UNSIGNED);
+    occluder->indices.reserve(desc.drawCount);
+
+    // Copy only the vertices that the draw range references
+    for (size_t i = desc.drawStart; i < desc.drawStart + desc.drawCount; ++i)
+    {
+        unsigned index = ibDesc.indexSize == sizeof(unsigned short) ? ((const unsigned short*)ibDesc.indexData)[i] :
+            ((const unsigned*)ibDesc.indexData)[i];
+        if (index >= vbDesc.numVertices)
+        {
+            delete occluder;
+            return nullptr;
+        }
+
+        if (vertexRemap[index] == M_MAX_UNSIGNED)
+        {
+            vertexRemap[index] = (unsigned)occluder->vertices.size();
+            occluder->vertices.push_back(*reinterpret_cast<const Vector3*>(vbDesc.vertexData + index * vertexSize + positionOffset));
+        }
+        occluder->indices.push_back(vertexRemap[index]);
+    }
+
+    return occluder;
+}
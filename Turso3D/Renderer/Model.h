@@ -8,7 +8,9 @@
 
 class VertexBuffer;
 class IndexBuffer;
+class Material;
 struct Geometry;
+struct OccluderGeometry;
 
 /// Load-time description of a vertex buffer, to be uploaded on the GPU later.
 struct VertexBufferDesc
@@ -17,8 +19,10 @@ struct VertexBufferDesc
     std::vector<VertexElement> vertexElements;
     /// Number of vertices.
     size_t numVertices;
-    /// Vertex data.
-    SharedArrayPtr<unsigned char> vertexData;
+    /// Vertex data, either referenced in place from the source stream or owned by vertexStorage.
+    const unsigned char* vertexData;
+    /// Owned vertex data when the source stream can not be referenced in place.
+    SharedArrayPtr<unsigned char> vertexStorage;
 };
 
 /// Load-time description of an index buffer, to be uploaded on the GPU later.
@@ -28,8 +32,10 @@ struct IndexBufferDesc
     size_t indexSize;
     /// Number of indices.
     size_t numIndices;
-    /// Index data.
-    SharedArrayPtr<unsigned char> indexData;
+    /// Index data, either referenced in place from the source stream or owned by indexStorage.
+    const unsigned char* indexData;
+    /// Owned index data when the source stream can not be referenced in place, or when the indices have been modified.
+    SharedArrayPtr<unsigned char> indexStorage;
 };
 
 /// Load-time description of a geometry.
@@ -77,42 +83,88 @@ struct Bone
     bool animated;
 };
 
-/// Combined vertex and index buffers for static models.
+/// Vertex and index range allocated from a combined buffer, and the geometries that draw from it.
+struct CombinedBufferAllocation
+{
+    /// First vertex.
+    size_t vertexStart;
+    /// Number of vertices.
+    size_t numVertices;
+    /// First index.
+    size_t indexStart;
+    /// Number of indices.
+    size_t numIndices;
+    /// Geometries to update when the range moves.
+    std::vector<WeakPtr<Geometry> > geometries;
+};
+
+/// Pool of large vertex and index buffers shared by static models with the same vertex format. Models sub-allocate ranges and draw with a base vertex, so that the indices are not rebased and models in the same pool draw without rebinding buffers.
 class CombinedBuffer : public RefCounted
 {
 public:
     /// Construct with the specified vertex elements.
     CombinedBuffer(const std::vector<VertexElement>& elements);
 
-    /// Update vertex data at current position and advance use counter. Return true if data fit the buffer.
-    bool FillVertices(size_t numVertices, const void* data);
-    /// Update index data at current position and advance use counter. Return true if data fit the buffer. Note that index data should be 32-bit.
-    bool FillIndices(size_t numIndices, const void* data);
+    /// Allocate a vertex and index range. Return the allocation ID, or 0 if does not fit.
+    unsigned AllocateRange(size_t numVertices, size_t numIndices);
+    /// Free a range.
+    void FreeRange(unsigned id);
+    /// Set the vertex data of a range. Return true on success.
+    bool SetVertices(unsigned id, const void* data);
+    /// Set 32-bit index data at an offset within a range. Return true on success.
+    bool SetIndices(unsigned id, size_t offset, size_t numIndices, const void* data);
+    /// Add a geometry drawing from a range, to be updated when the range moves.
+    void AddGeometry(unsigned id, Geometry* geometry);
+    /// Move the ranges to the start of the buffers to remove free space between them, and update the geometries. Return number of ranges moved.
+    size_t Defragment();
 
-    /// Return vertex use count so far.
+    /// Return a range by allocation ID, or null if not found.
+    const CombinedBufferAllocation* Allocation(unsigned id) const;
+    /// Return number of ranges.
+    size_t NumAllocations() const { return allocations.size(); }
+    /// Return number of vertices in use.
     size_t UsedVertices() const { return usedVertices; }
-    /// Return index use count so far.
+    /// Return number of indices in use.
     size_t UsedIndices() const { return usedIndices; }
     /// Return the large vertex buffer.
     VertexBuffer* GetVertexBuffer() const { return vertexBuffer; }
     /// Return the large index buffer.
     IndexBuffer* GetIndexBuffer() const { return indexBuffer; }
 
-    /// Allocate space from a buffer and return it for use. New buffers will be created as necessary.
-    static CombinedBuffer* Allocate(const std::vector<VertexElement>& vertexElements, size_t numVertices, size_t numIndices);
+    /// Allocate a range from a buffer with the vertex format, and return the buffer and allocation ID. Defragments a buffer that has enough free space but not in one piece. New buffers will be created as necessary.
+    static CombinedBuffer* Allocate(const std::vector<VertexElement>& vertexElements, size_t numVertices, size_t numIndices, unsigned& allocationId);
+    /// Defragment all buffers. Return number of ranges moved.
+    static size_t DefragmentAll();
+    /// Return a counter that is incremented whenever ranges move, for invalidating draw commands recorded with the old offsets.
+    static unsigned Generation() { return generation; }
 
 private:
+    /// Take a range from a free list. Return the start, or M_MAX_UNSIGNED if no piece is large enough.
+    static size_t TakeFreeRange(std::map<size_t, size_t>& freeList, size_t count);
+    /// Return a range to a free list, merging with the adjacent free ranges.
+    static void ReturnFreeRange(std::map<size_t, size_t>& freeList, size_t start, size_t count);
+
     /// Large vertex buffer.
     SharedPtr<VertexBuffer> vertexBuffer;
     /// Large index buffer.
     SharedPtr<IndexBuffer> indexBuffer;
-    /// Vertex buffer use count so far.
+    /// Ranges by allocation ID.
+    std::map<unsigned, CombinedBufferAllocation> allocations;
+    /// Free vertex ranges as start and count.
+    std::map<size_t, size_t> freeVertices;
+    /// Free index ranges as start and count.
+    std::map<size_t, size_t> freeIndices;
+    /// Number of vertices in use.
     size_t usedVertices;
-    /// Index buffer use count so far.
+    /// Number of indices in use.
     size_t usedIndices;
+    /// Next allocation ID.
+    unsigned nextAllocationId;
 
-    /// Current buffers.
+    /// Current buffers by vertex attribute mask.
     static std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > buffers;
+    /// Range move counter.
+    static unsigned generation;
 };
 
 /// 3D model resource.
@@ -129,10 +181,33 @@ public:
     /// Register object factory.
     static void RegisterObject();
 
-    /// Load model from a stream. Return true on success.
+    /// Load model from a stream, either in the native Turso3D format or the Urho3D format. Return true on success.
     bool BeginLoad(Stream& source) override;
     /// Finalize model loading in the main thread. Return true on success.
     bool EndLoad() override;
+    /// Save the model in the native format. Only possible between BeginLoad() and EndLoad(), while the load data is available, for converting. Return true on success.
+    bool Save(Stream& dest) override;
+    /// Return CPU memory used by the bone data and raycast triangle data in bytes.
+    size_t CpuMemoryUse() const override;
+    /// Return GPU memory used by the vertex and index data in bytes. For a combined buffer, counts only the model's own range.
+    size_t GpuMemoryUse() const override { return gpuMemoryUse; }
+
+    /// Set whether to quantize normals, tangents and texture coordinates of loaded models to compact vertex formats. Also applies to models converted with Save().
+    static void SetVertexCompression(bool enable);
+    /// Return whether vertex data is quantized on load.
+    static bool VertexCompression();
+    /// Set whether to reorder the triangles and vertices of loaded models for the post-transform vertex cache and vertex fetch. Also applies to models converted with Save().
+    static void SetMeshOptimization(bool enable);
+    /// Return whether loaded models are reordered for the vertex cache and fetch.
+    static bool MeshOptimization();
+    /// Set number of LOD levels to generate by simplification for the geometries of loaded models that have only one level, the index count reduction per level, and the LOD distance step. A zero distance step is derived from the model size. Also applies to models converted with Save().
+    static void SetLodGeneration(size_t numLevels, float reduction = 0.5f, float distanceStep = 0.0f);
+    /// Return number of LOD levels generated for loaded models.
+    static size_t LodGenerationLevels();
+    /// Set whether to keep a compact copy of the most detailed LOD level's positions and indices of loaded models for triangle-accurate raycasts, with a bounding volume hierarchy of the triangles. The vertex and index data are otherwise released after the GPU upload. Not kept for skinned models.
+    static void SetRaycastData(bool enable);
+    /// Return whether loaded models keep triangle data for raycasts.
+    static bool RaycastData();
 
     /// Set number of geometries.
     void SetNumGeometries(size_t num);
@@ -144,6 +219,8 @@ public:
     void SetBones(const std::vector<Bone>& bones, size_t rootBoneIndex);
     /// Set per-geometry bone mappings.
     void SetBoneMappings(const std::vector<std::vector<size_t> >& boneMappings);
+    /// Set the impostor drawn instead of the geometries beyond a LOD distance. Null geometry to disable. Baked by Renderer::BakeImpostor().
+    void SetImpostor(Geometry* geometry, Material* material, float distance);
     
     /// Return number of geometries.
     size_t NumGeometries() const { return geometries.size(); }
@@ -161,8 +238,29 @@ public:
     size_t RootBoneIndex() const { return rootBoneIndex; }
     /// Return per-geometry bone mapping.
     const std::vector<std::vector<size_t> > BoneMappings() const { return boneMappings; }
+    /// Return the impostor geometry, or null if none.
+    Geometry* ImpostorGeometry() const { return impostorGeometry.Get(); }
+    /// Return the impostor material.
+    Material* ImpostorMaterial() const { return impostorMaterial.Get(); }
+    /// Return the LOD distance beyond which the impostor is drawn.
+    float ImpostorDistance() const { return impostorDistance; }
 
 private:
+    /// Load the rest of a native format model, with vertex and index data in GPU layout at aligned offsets. Return true on success.
+    bool BeginLoadNative(Stream& source);
+    /// Load the rest of a Urho3D format model. Return true on success.
+    bool BeginLoadUMDL(Stream& source);
+    /// Write the native format header and directory, with given data blob offsets.
+    void WriteNativeDirectory(Stream& dest, const std::vector<unsigned>& dataOffsets) const;
+    /// Build compact triangle data from a geometry description. Return null if the geometry has no positions or has more triangles than the limit.
+    OccluderGeometry* CreateOccluderGeometry(const GeometryDesc& desc, size_t maxTriangles) const;
+    /// Rewrite the blend indices of the load data's geometries from their bone mappings to skeleton bone indices, as the skinning palette holds the whole skeleton.
+    void ResolveBoneMappings();
+    /// Generate LOD levels for the load data by simplification.
+    void GenerateLodLevels();
+    /// Reorder the load data's indices for the vertex cache and vertices for vertex fetch.
+    void OptimizeMeshes();
+
     /// Geometry LOD levels.
     std::vector<std::vector<SharedPtr<Geometry> > > geometries;
     /// Local space bounding box.
@@ -175,10 +273,22 @@ private:
     std::vector<std::vector<size_t> > boneMappings;
     /// Combined buffer if in use.
     SharedPtr<CombinedBuffer> combinedBuffer;
+    /// Range allocated from the combined buffer.
+    unsigned combinedAllocation;
+    /// GPU memory used by the vertex and index data in bytes.
+    size_t gpuMemoryUse;
     /// Vertex buffer data for loading.
     std::vector<VertexBufferDesc> vbDescs;
     /// Index buffer data for loading.
     std::vector<IndexBufferDesc> ibDescs;
     /// Geometry descriptions for loading.
     std::vector<std::vector<GeometryDesc> > geomDescs;
+    /// Raycast triangle data for loading, per geometry.
+    std::vector<SharedPtr<OccluderGeometry> > raycastGeometries;
+    /// Impostor geometry.
+    SharedPtr<Geometry> impostorGeometry;
+    /// Impostor material.
+    SharedPtr<Material> impostorMaterial;
+    /// Impostor LOD distance.
+    float impostorDistance;
 };
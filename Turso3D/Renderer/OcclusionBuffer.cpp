@@ -0,0 +1,338 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TURSO3D_SSE
+#include <emmintrin.h>
+#endif
+
+OcclusionBuffer::OcclusionBuffer() :
+    pyramidValid(false)
+{
+}
+
+void OcclusionBuffer::SetData(const IntVector2& size, const float* data, const Matrix4& viewProj_)
+{
+    if (size.x <= 0 || size.y <= 0 || !data)
+    {
+        Reset();
+        return;
+    }
+
+    viewProj = viewProj_;
+    levels.resize(1);
+    levelSizes.resize(1);
+    levelSizes[0] = size;
+    levels[0].assign(data, data + size.x * size.y);
+
+    BuildPyramid();
+}
+
+void OcclusionBuffer::Clear(const IntVector2& size, const Matrix4& viewProj_)
+{
+    viewProj = viewProj_;
+    pyramidValid = false;
+    triangles.clear();
+
+    levels.resize(1);
+    levelSizes.resize(1);
+    levelSizes[0] = IntVector2(Max(size.x, 1), Max(size.y, 1));
+    levels[0].assign(levelSizes[0].x * levelSizes[0].y, 1.0f);
+}
+
+void OcclusionBuffer::AddTriangles(const Matrix3x4& worldTransform, const Vector3* vertices, size_t numVertices, const unsigned* indices, size_t numIndices)
+{
+    Matrix4 worldViewProj = viewProj * worldTransform;
+
+    clipVertices.resize(numVertices);
+    for (size_t i = 0; i < numVertices; ++i)
+        clipVertices[i] = worldViewProj * Vector4(vertices[i], 1.0f);
+
+    for (size_t i = 0; i + 2 < numIndices; i += 3)
+    {
+        if (indices[i] < numVertices && indices[i + 1] < numVertices && indices[i + 2] < numVertices)
+            AddClipTriangle(clipVertices[indices[i]], clipVertices[indices[i + 1]], clipVertices[indices[i + 2]]);
+    }
+}
+
+void OcclusionBuffer::RasterizeRows(int startRow, int endRow)
+{
+    if (levels.empty())
+        return;
+
+    startRow = Max(startRow, 0);
+    endRow = Min(endRow, levelSizes[0].y);
+
+    for (auto it = triangles.begin(); it != triangles.end(); ++it)
+    {
+        if (it->maxY >= startRow && it->minY < endRow)
+            RasterizeTriangle(*it, startRow, endRow);
+    }
+}
+
+void OcclusionBuffer::BuildPyramid()
+{
+    if (levels.empty())
+        return;
+
+    size_t numLevels = 1;
+    for (IntVector2 levelSize = levelSizes[0]; levelSize.x > 1 || levelSize.y > 1; levelSize = IntVector2((levelSize.x + 1) / 2, (levelSize.y + 1) / 2))
+        ++numLevels;
+
+    levels.resize(numLevels);
+    levelSizes.resize(numLevels);
+
+    for (size_t i = 1; i < numLevels; ++i)
+    {
+        const IntVector2& srcSize = levelSizes[i - 1];
+        IntVector2 destSize((srcSize.x + 1) / 2, (srcSize.y + 1) / 2);
+        const std::vector<float>& src = levels[i - 1];
+        std::vector<float>& dest = levels[i];
+        levelSizes[i] = destSize;
+        dest.resize(destSize.x * destSize.y);
+
+        for (int y = 0; y < destSize.y; ++y)
+        {
+            int y0 = y * 2;
+            int y1 = Min(y0 + 1, srcSize.y - 1);
+
+            for (int x = 0; x < destSize.x; ++x)
+            {
+                int x0 = x * 2;
+                int x1 = Min(x0 + 1, srcSize.x - 1);
+
+                float depth = Max(Max(src[y0 * srcSize.x + x0], src[y0 * srcSize.x + x1]), Max(src[y1 * srcSize.x + x0], src[y1 * srcSize.x + x1]));
+                dest[y * destSize.x + x] = depth;
+            }
+        }
+    }
+
+    pyramidValid = true;
+}
+
+void OcclusionBuffer::Reset()
+{
+    levels.clear();
+    levelSizes.clear();
+    triangles.clear();
+    pyramidValid = false;
+}
+
+bool OcclusionBuffer::IsVisible(const BoundingBox& box) const
+{
+    if (!pyramidValid)
+        return true;
+
+    Vector3 projMin(M_MAX_FLOAT, M_MAX_FLOAT, M_MAX_FLOAT);
+    Vector3 projMax(-M_MAX_FLOAT, -M_MAX_FLOAT, -M_MAX_FLOAT);
+
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        Vector4 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+        Vector4 projected = viewProj * corner;
+
+        // If the box crosses the camera plane, can not use a screen rectangle for it
+        if (projected.w <= M_EPSILON)
+            return true;
+
+        float invW = 1.0f / projected.w;
+        Vector3 ndc(projected.x * invW, projected.y * invW, projected.z * invW);
+        projMin = Vector3(Min(projMin.x, ndc.x), Min(projMin.y, ndc.y), Min(projMin.z, ndc.z));
+        projMax = Vector3(Max(projMax.x, ndc.x), Max(projMax.y, ndc.y), Max(projMax.z, ndc.z));
+    }
+
+    // Boxes outside the view the depth was rendered from may since have become visible
+    if (projMax.x < -1.0f || projMin.x > 1.0f || projMax.y < -1.0f || projMin.y > 1.0f || projMin.z <= 0.0f)
+        return true;
+
+    const IntVector2& size = levelSizes[0];
+    int left = Clamp((int)((projMin.x * 0.5f + 0.5f) * size.x), 0, size.x - 1);
+    int right = Clamp((int)((projMax.x * 0.5f + 0.5f) * size.x), 0, size.x - 1);
+    int bottom = Clamp((int)((projMin.y * 0.5f + 0.5f) * size.y), 0, size.y - 1);
+    int top = Clamp((int)((projMax.y * 0.5f + 0.5f) * size.y), 0, size.y - 1);
+
+    // Go up the pyramid until the rectangle covers at most 2x2 texels
+    size_t level = 0;
+    while (level + 1 < levels.size() && (right - left > 1 || top - bottom > 1))
+    {
+        left >>= 1;
+        right >>= 1;
+        bottom >>= 1;
+        top >>= 1;
+        ++level;
+    }
+
+    const std::vector<float>& depths = levels[level];
+    int width = levelSizes[level].x;
+
+    for (int y = bottom; y <= top; ++y)
+    {
+        for (int x = left; x <= right; ++x)
+        {
+            if (projMin.z <= depths[y * width + x])
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void OcclusionBuffer::AddClipTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2)
+{
+    // Clip space Z is positive in front of the near plane
+    unsigned inside = (v0.z >= 0.0f ? 1 : 0) | (v1.z >= 0.0f ? 2 : 0) | (v2.z >= 0.0f ? 4 : 0);
+    if (!inside)
+        return;
+    if (inside == 7)
+    {
+        AddProjectedTriangle(v0, v1, v2);
+        return;
+    }
+
+    const Vector4* src[3] = { &v0, &v1, &v2 };
+    Vector4 clipped[4];
+    size_t numClipped = 0;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector4& a = *src[i];
+        const Vector4& b = *src[(i + 1) % 3];
+
+        if (a.z >= 0.0f)
+            clipped[numClipped++] = a;
+        if ((a.z >= 0.0f) != (b.z >= 0.0f))
+        {
+            float t = a.z / (a.z - b.z);
+            clipped[numClipped++] = a + (b - a) * t;
+        }
+    }
+
+    for (size_t i = 2; i < numClipped; ++i)
+        AddProjectedTriangle(clipped[0], clipped[i - 1], clipped[i]);
+}
+
+void OcclusionBuffer::AddProjectedTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2)
+{
+    const IntVector2& size = levelSizes[0];
+    const Vector4* src[3] = { &v0, &v1, &v2 };
+    OccluderTriangle newTriangle;
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector4& v = *src[i];
+        if (v.w <= M_EPSILON)
+            return;
+
+        float invW = 1.0f / v.w;
+        newTriangle.vertices[i] = Vector3((v.x * invW * 0.5f + 0.5f) * size.x, (v.y * invW * 0.5f + 0.5f) * size.y, Clamp(v.z * invW, 0.0f, 1.0f));
+    }
+
+    Vector3* vertices = newTriangle.vertices;
+    float area = (vertices[1].x - vertices[0].x) * (vertices[2].y - vertices[0].y) - (vertices[2].x - vertices[0].x) * (vertices[1].y - vertices[0].y);
+    if (Abs(area) < M_EPSILON)
+        return;
+    // Store with counterclockwise winding so that the edge functions are positive inside
+    if (area < 0.0f)
+        std::swap(vertices[1], vertices[2]);
+
+    float minX = Min(Min(vertices[0].x, vertices[1].x), vertices[2].x);
+    float maxX = Max(Max(vertices[0].x, vertices[1].x), vertices[2].x);
+    float minY = Min(Min(vertices[0].y, vertices[1].y), vertices[2].y);
+    float maxY = Max(Max(vertices[0].y, vertices[1].y), vertices[2].y);
+    if (maxX < 0.0f || minX > (float)size.x || maxY < 0.0f || minY > (float)size.y)
+        return;
+
+    // Rows whose pixel centers may be covered
+    newTriangle.minY = Max((int)ceilf(minY - 0.5f), 0);
+    newTriangle.maxY = Min((int)floorf(maxY - 0.5f), size.y - 1);
+    if (newTriangle.minY > newTriangle.maxY)
+        return;
+
+    triangles.push_back(newTriangle);
+}
+
+void OcclusionBuffer::RasterizeTriangle(const OccluderTriangle& triangle, int startRow, int endRow)
+{
+    const Vector3* v = triangle.vertices;
+    int width = levelSizes[0].x;
+
+    // Edge functions E(x, y) = a * x + b * y + c, positive inside
+    float a[3], b[3], c[3];
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const Vector3& p0 = v[i];
+        const Vector3& p1 = v[(i + 1) % 3];
+        a[i] = p0.y - p1.y;
+        b[i] = p1.x - p0.x;
+        c[i] = -(a[i] * p0.x + b[i] * p0.y);
+    }
+
+    // Depth plane from the barycentric weights. Edge i is opposite to vertex (i + 2) % 3
+    float invArea = 1.0f / (a[0] * v[2].x + b[0] * v[2].y + c[0]);
+    float za = (a[1] * v[0].z + a[2] * v[1].z + a[0] * v[2].z) * invArea;
+    float zb = (b[1] * v[0].z + b[2] * v[1].z + b[0] * v[2].z) * invArea;
+    float zc = (c[1] * v[0].z + c[2] * v[1].z + c[0] * v[2].z) * invArea;
+
+    int minX = Max((int)ceilf(Min(Min(v[0].x, v[1].x), v[2].x) - 0.5f), 0);
+    int maxX = Min((int)floorf(Max(Max(v[0].x, v[1].x), v[2].x) - 0.5f), width - 1);
+    int minY = Max(triangle.minY, startRow);
+    int maxY = Min(triangle.maxY, endRow - 1);
+
+    float* depths = &levels[0][0];
+
+    for (int y = minY; y <= maxY; ++y)
+    {
+        float py = (float)y + 0.5f;
+        float e0Row = b[0] * py + c[0];
+        float e1Row = b[1] * py + c[1];
+        float e2Row = b[2] * py + c[2];
+        float zRow = zb * py + zc;
+        float* row = depths + y * width;
+        int x = minX;
+
+#ifdef TURSO3D_SSE
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 a0 = _mm_set1_ps(a[0]);
+        __m128 a1 = _mm_set1_ps(a[1]);
+        __m128 a2 = _mm_set1_ps(a[2]);
+        __m128 az = _mm_set1_ps(za);
+        __m128 e0R = _mm_set1_ps(e0Row);
+        __m128 e1R = _mm_set1_ps(e1Row);
+        __m128 e2R = _mm_set1_ps(e2Row);
+        __m128 zR = _mm_set1_ps(zRow);
+
+        // Test and write 4 pixels at a time
+        for (; x + 3 <= maxX; x += 4)
+        {
+            __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), e0R);
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), e1R);
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), e2R);
+            __m128 mask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+            if (!_mm_movemask_ps(mask))
+                continue;
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(az, px), zR);
+            __m128 current = _mm_loadu_ps(row + x);
+            __m128 nearest = _mm_min_ps(current, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, nearest), _mm_andnot_ps(mask, current)));
+        }
+#endif
+
+        for (; x <= maxX; ++x)
+        {
+            float px = (float)x + 0.5f;
+            if (a[0] * px + e0Row >= 0.0f && a[1] * px + e1Row >= 0.0f && a[2] * px + e2Row >= 0.0f)
+            {
+                float z = za * px + zRow;
+                if (z < row[x])
+                    row[x] = z;
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Math/IntVector2.h"
+#include "../Math/Matrix3x4.h"
+
+#include <vector>
+
+/// Occluder triangle in screen space, clipped to the near plane.
+struct OccluderTriangle
+{
+    /// Vertex positions in pixels. Z holds window space depth.
+    Vector3 vertices[3];
+    /// First row covered.
+    int minY;
+    /// Last row covered.
+    int maxY;
+};
+
+/// Hierarchical depth buffer on the CPU for occlusion testing. Built either from a downsampled depth buffer of an earlier frame, or by rasterizing occluder triangles, and tested with the view-projection matrix the depth was rendered with.
+class OcclusionBuffer
+{
+public:
+    /// Construct empty.
+    OcclusionBuffer();
+
+    /// Build the depth pyramid from window space depth values, with rows ordered from bottom to top as read back from OpenGL.
+    void SetData(const IntVector2& size, const float* data, const Matrix4& viewProj);
+    /// Begin software rasterization. Clear to the far depth and remove previously added triangles.
+    void Clear(const IntVector2& size, const Matrix4& viewProj);
+    /// Transform, clip and add occluder triangles for rasterization.
+    void AddTriangles(const Matrix3x4& worldTransform, const Vector3* vertices, size_t numVertices, const unsigned* indices, size_t numIndices);
+    /// Rasterize the added triangles into a range of rows. Row ranges can be rasterized in parallel.
+    void RasterizeRows(int startRow, int endRow);
+    /// Build the depth pyramid after rasterization.
+    void BuildPyramid();
+    /// Clear the depth pyramid. Everything tests as visible until data is set again.
+    void Reset();
+    /// Test whether a world space bounding box may be visible. Returns true for boxes that cross the camera plane or lie outside the buffer's view.
+    bool IsVisible(const BoundingBox& box) const;
+
+    /// Return whether has depth data.
+    bool IsValid() const { return pyramidValid; }
+    /// Return size of the most detailed level.
+    IntVector2 Size() const { return levelSizes.size() ? levelSizes[0] : IntVector2::ZERO; }
+    /// Return number of triangles added for rasterization.
+    size_t NumTriangles() const { return triangles.size(); }
+
+private:
+    /// Rasterize one triangle into a range of rows.
+    void RasterizeTriangle(const OccluderTriangle& triangle, int startRow, int endRow);
+    /// Add a triangle in clip space, clipping it to the near plane first.
+    void AddClipTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2);
+    /// Add a triangle in clip space that is in front of the near plane.
+    void AddProjectedTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2);
+
+    /// Depth pyramid levels. Each texel stores the farthest depth of the texels it covers in the more detailed level.
+    std::vector<std::vector<float> > levels;
+    /// Depth pyramid level sizes.
+    std::vector<IntVector2> levelSizes;
+    /// View-projection matrix the depth data was rendered with.
+    Matrix4 viewProj;
+    /// Triangles to rasterize.
+    std::vector<OccluderTriangle> triangles;
+    /// Clip space vertices of the occluder being added.
+    std::vector<Vector4> clipVertices;
+    /// Whether the pyramid is built and can be tested against.
+    bool pyramidValid;
+};
@@ -2,34 +2,272 @@
 
 #include "../IO/Log.h"
 #include "../Math/Ray.h"
+#include "Batch.h"
 #include "Octree.h"
 
 #include <cassert>
 #include <algorithm>
+#include <thread>
 
 static const float DEFAULT_OCTREE_SIZE = 1000.0f;
 static const int DEFAULT_OCTREE_LEVELS = 8;
 static const int MAX_OCTREE_LEVELS = 256;
 
+/// Number of nodes per overlapping pair query task.
+static const size_t OVERLAP_PAIR_NODES_PER_TASK = 256;
+/// Number of pairs buffered by each task of the overlapping pair query before writing them out.
+static const size_t OVERLAP_PAIR_BUFFER_SIZE = 64;
+
+/// State of an overlapping pair query.
+struct OverlapPairQuery
+{
+    /// Destination buffer.
+    std::pair<OctreeNode*, OctreeNode*>* dest;
+    /// Destination buffer size.
+    size_t maxPairs;
+    /// Node flags to require.
+    unsigned short nodeFlags;
+    /// Layer mask to require.
+    unsigned layerMask;
+    /// Node flags to exclude.
+    unsigned short excludeFlags;
+    /// Octree root octant.
+    const Octant* root;
+    /// Nodes to query.
+    std::vector<OctreeNode*> nodes;
+    /// Number of pairs found so far. Also the write position of the destination buffer.
+    std::atomic<size_t> numPairs;
+};
+
+/// Buffer of found pairs, written out to the query's destination in blocks to limit atomic operations.
+class OverlapPairWriter
+{
+public:
+    /// Construct.
+    OverlapPairWriter(OverlapPairQuery& query_) :
+        query(query_),
+        numBuffered(0)
+    {
+    }
+
+    /// Add a pair.
+    void Add(OctreeNode* first, OctreeNode* second)
+    {
+        buffer[numBuffered].first = first;
+        buffer[numBuffered].second = second;
+        if (++numBuffered == OVERLAP_PAIR_BUFFER_SIZE)
+            Flush();
+    }
+
+    /// Write out the buffered pairs. Pairs past the end of the destination are counted but not written.
+    void Flush()
+    {
+        if (!numBuffered)
+            return;
+
+        size_t start = query.numPairs.fetch_add(numBuffered);
+        for (size_t i = 0; i < numBuffered && start + i < query.maxPairs; ++i)
+            query.dest[start + i] = buffer[i];
+        numBuffered = 0;
+    }
+
+private:
+    /// Query state.
+    OverlapPairQuery& query;
+    /// Buffered pairs.
+    std::pair<OctreeNode*, OctreeNode*> buffer[OVERLAP_PAIR_BUFFER_SIZE];
+    /// Number of buffered pairs.
+    size_t numBuffered;
+};
+
+/// Return whether two bounding boxes overlap. Touching boxes are considered overlapping.
+static inline bool BoxesOverlap(const BoundingBox& lhs, const BoundingBox& rhs)
+{
+    return lhs.min.x <= rhs.max.x && rhs.min.x <= lhs.max.x && lhs.min.y <= rhs.max.y && rhs.min.y <= lhs.max.y &&
+        lhs.min.z <= rhs.max.z && rhs.min.z <= lhs.max.z;
+}
+
+/// Find the nodes of an octant and its children that overlap a node and come after it in address order, so that each pair is reported once. The root may hold nodes outside its culling box, so it is always entered.
+static void FindNodeOverlaps(const OverlapPairQuery& query, OverlapPairWriter& writer, OctreeNode* node, const BoundingBox& box, const Octant* octant)
+{
+    if (octant != query.root && !BoxesOverlap(box, octant->cullingBox))
+        return;
+
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    // Use the octant's culling data when it is up to date
+    if (!octant->sortDirty && octant->nodeMinX.size() == octantNodes.size())
+    {
+        for (size_t i = 0; i < octantNodes.size(); ++i)
+        {
+            OctreeNode* other = octantNodes[i];
+            unsigned short flags = octant->nodeFlags[i];
+            if (other <= node || (flags & query.nodeFlags) != query.nodeFlags || (flags & query.excludeFlags) ||
+                !(octant->nodeLayerMasks[i] & query.layerMask))
+                continue;
+
+            if (box.min.x <= octant->nodeMaxX[i] && octant->nodeMinX[i] <= box.max.x && box.min.y <= octant->nodeMaxY[i] &&
+                octant->nodeMinY[i] <= box.max.y && box.min.z <= octant->nodeMaxZ[i] && octant->nodeMinZ[i] <= box.max.z)
+                writer.Add(node, other);
+        }
+    }
+    else
+    {
+        for (auto it = octantNodes.begin(); it != octantNodes.end(); ++it)
+        {
+            OctreeNode* other = *it;
+            unsigned short flags = other->Flags();
+            if (other <= node || (flags & query.nodeFlags) != query.nodeFlags || (flags & query.excludeFlags) ||
+                !(other->LayerMask() & query.layerMask))
+                continue;
+
+            if (BoxesOverlap(box, other->WorldBoundingBox()))
+                writer.Add(node, other);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        const Octant* child = octant->children[i];
+        if (child && child->numNodes)
+            FindNodeOverlaps(query, writer, node, box, child);
+    }
+}
+
+/// Find the overlapping pairs of a range of the query's nodes.
+static void FindOverlapPairs(OverlapPairQuery& query, size_t start, size_t end)
+{
+    OverlapPairWriter writer(query);
+    for (size_t i = start; i < end; ++i)
+    {
+        OctreeNode* node = query.nodes[i];
+        FindNodeOverlaps(query, writer, node, node->WorldBoundingBox(), query.root);
+    }
+    writer.Flush();
+}
+
+/// %Task for finding the overlapping pairs of a range of nodes.
+class OverlapPairTask : public Task
+{
+public:
+    /// Construct.
+    OverlapPairTask(OverlapPairQuery& query_, size_t start_, size_t end_) :
+        query(query_),
+        start(start_),
+        end(end_)
+    {
+    }
+
+    /// Process the nodes.
+    void Complete(unsigned) override
+    {
+        FindOverlapPairs(query, start, end);
+    }
+
+    /// Query state.
+    OverlapPairQuery& query;
+    /// Start node index.
+    size_t start;
+    /// End node index.
+    size_t end;
+};
+
 bool CompareRaycastResults(const RaycastResult& lhs, const RaycastResult& rhs)
 {
     return lhs.distance < rhs.distance;
 }
 
-bool CompareNodeDistances(const std::pair<OctreeNode*, float>& lhs, const std::pair<OctreeNode*, float>& rhs)
+/// Return a bitmask of the rays in a packet that hit a box closer than their closest hit so far.
+static unsigned HitBoxMask(const RayPacket& packet, float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+{
+#ifdef TURSO3D_SSE
+    __m128 originX = _mm_loadu_ps(packet.originX);
+    __m128 originY = _mm_loadu_ps(packet.originY);
+    __m128 originZ = _mm_loadu_ps(packet.originZ);
+    __m128 invDirX = _mm_loadu_ps(packet.invDirX);
+    __m128 invDirY = _mm_loadu_ps(packet.invDirY);
+    __m128 invDirZ = _mm_loadu_ps(packet.invDirZ);
+
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minX), originX), invDirX);
+    __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxX), originX), invDirX);
+    __m128 tNear = _mm_min_ps(t1, t2);
+    __m128 tFar = _mm_max_ps(t1, t2);
+    t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minY), originY), invDirY);
+    t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxY), originY), invDirY);
+    tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+    tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+    t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minZ), originZ), invDirZ);
+    t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxZ), originZ), invDirZ);
+    tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+    tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+    // Box behind the ray origin is a miss, origin inside the box is a hit at zero distance
+    tNear = _mm_max_ps(tNear, _mm_setzero_ps());
+    __m128 hit = _mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmplt_ps(tNear, _mm_loadu_ps(packet.closest)));
+    return (unsigned)_mm_movemask_ps(hit);
+#else
+    unsigned mask = 0;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        float t1 = (minX - packet.originX[i]) * packet.invDirX[i];
+        float t2 = (maxX - packet.originX[i]) * packet.invDirX[i];
+        float tNear = Min(t1, t2);
+        float tFar = Max(t1, t2);
+        t1 = (minY - packet.originY[i]) * packet.invDirY[i];
+        t2 = (maxY - packet.originY[i]) * packet.invDirY[i];
+        tNear = Max(tNear, Min(t1, t2));
+        tFar = Min(tFar, Max(t1, t2));
+        t1 = (minZ - packet.originZ[i]) * packet.invDirZ[i];
+        t2 = (maxZ - packet.originZ[i]) * packet.invDirZ[i];
+        tNear = Max(Max(tNear, Min(t1, t2)), 0.0f);
+        tFar = Min(tFar, Max(t1, t2));
+        if (tNear <= tFar && tNear < packet.closest[i])
+            mask |= 1u << i;
+    }
+
+    return mask;
+#endif
+}
+
+/// Return a bitmask of the rays in a packet that hit a box closer than their closest hit so far.
+static unsigned HitBoxMask(const RayPacket& packet, const BoundingBox& box)
+{
+    return HitBoxMask(packet, box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z);
+}
+
+/// Return reciprocal of a ray direction component, clamped so that multiplying a zero distance gives zero instead of NaN.
+static float SafeReciprocal(float value)
+{
+    static const float MAX_RECIPROCAL = 1.0e30f;
+    if (Abs(value) < 1.0f / MAX_RECIPROCAL)
+        return value < 0.0f ? -MAX_RECIPROCAL : MAX_RECIPROCAL;
+    return 1.0f / value;
+}
+
+static float SurfaceArea(const BoundingBox& box)
 {
-    return lhs.second < rhs.second;
+    Vector3 size = box.Size();
+    return size.x * size.y + size.y * size.z + size.z * size.x;
 }
 
 Octant::Octant() :
+    sortDirty(false),
+    mergeQueued(false),
+    bvhLeaf(false),
     parent(nullptr),
     numNodes(0),
-    sortDirty(false)
+    version(0),
+    changeGeneration(0),
+    subtreeGeneration(0)
 {
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
         children[i] = nullptr;
 }
 
+Octant::~Octant()
+{
+}
+
 void Octant::Initialize(Octant* parent_, const BoundingBox& boundingBox, int level_)
 {
     worldBoundingBox = boundingBox;
@@ -58,228 +296,1247 @@ bool Octant::FitBoundingBox(const BoundingBox& box, const Vector3& boxSize) cons
     return false;
 }
 
-Octree::Octree()
+void Octant::UpdateCullingData(size_t startIndex)
+{
+    size_t numNodes = nodes.size();
+    nodeMinX.resize(numNodes);
+    nodeMinY.resize(numNodes);
+    nodeMinZ.resize(numNodes);
+    nodeMaxX.resize(numNodes);
+    nodeMaxY.resize(numNodes);
+    nodeMaxZ.resize(numNodes);
+    nodeLayerMasks.resize(numNodes);
+    nodeFlags.resize(numNodes);
+    ++version;
+
+    for (size_t i = startIndex; i < numNodes; ++i)
+    {
+        OctreeNode* node = nodes[i];
+        const BoundingBox& box = node->WorldBoundingBox();
+        nodeMinX[i] = box.min.x;
+        nodeMinY[i] = box.min.y;
+        nodeMinZ[i] = box.min.z;
+        nodeMaxX[i] = box.max.x;
+        nodeMaxY[i] = box.max.y;
+        nodeMaxZ[i] = box.max.z;
+        nodeLayerMasks[i] = node->LayerMask();
+        nodeFlags[i] = node->Flags();
+    }
+}
+
+unsigned Octant::TestNodes(size_t startIndex, const Frustum& frustum, unsigned char planeMask, unsigned layerMask) const
+{
+    size_t count = std::min(nodes.size() - startIndex, NODES_PER_TEST);
+    unsigned visible = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (nodeLayerMasks[startIndex + i] & layerMask)
+            visible |= 1u << i;
+    }
+
+    if (!visible || planeMask == 0x3f)
+        return visible;
+
+    unsigned inside;
+    frustum.IsInsideMaskedFast(&nodeMinX[startIndex], &nodeMinY[startIndex], &nodeMinZ[startIndex], &nodeMaxX[startIndex], &nodeMaxY[startIndex],
+        &nodeMaxZ[startIndex], count, &inside, planeMask);
+    return visible & inside;
+}
+
+Octree::Octree() :
+    numQueuedUpdates(0),
+    adaptive(false),
+    splitThreshold(DEFAULT_SPLIT_THRESHOLD),
+    staticBVH(false),
+    bvhRebuildGeneration(0),
+    batchTransforms(true),
+    numReaders(0),
+    writing(false),
+    writeDepth(0),
+    generation(0),
+    staticGeneration(0)
 {
+    for (size_t i = 0; i < MAX_UPDATE_QUEUE_CHUNKS; ++i)
+        updateQueueChunks[i].store(nullptr);
+
     root.Initialize(nullptr, BoundingBox(-DEFAULT_OCTREE_SIZE, DEFAULT_OCTREE_SIZE), DEFAULT_OCTREE_LEVELS);
 }
 
 Octree::~Octree()
 {
     // Clear octree association from nodes that were never inserted
+    DrainUpdateQueue();
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        OctreeNode* node = *it;
+        if (node->impl->octree == this && !node->impl->octant)
+            node->impl->octree = nullptr;
+    }
+    updateQueue.clear();
+
+    DeleteBVH(true);
+    DeleteChildOctants(&root, true);
+
+    for (size_t i = 0; i < MAX_UPDATE_QUEUE_CHUNKS; ++i)
+        delete[] updateQueueChunks[i].load();
+}
+
+void Octree::RegisterObject()
+{
+    RegisterFactory<Octree>();
+    CopyBaseAttributes<Octree, Node>();
+    RegisterAttribute("adaptive", &Octree::IsAdaptive, &Octree::SetAdaptive, false);
+    RegisterAttribute("splitThreshold", &Octree::SplitThreshold, &Octree::SetSplitThreshold, DEFAULT_SPLIT_THRESHOLD);
+    RegisterAttribute("staticBVH", &Octree::StaticBVH, &Octree::SetStaticBVH, false);
+    RegisterAttribute("batchTransforms", &Octree::BatchTransforms, &Octree::SetBatchTransforms, true);
+    RegisterRefAttribute("boundingBox", &Octree::BoundingBoxAttr, &Octree::SetBoundingBoxAttr);
+    RegisterAttribute("numLevels", &Octree::NumLevelsAttr, &Octree::SetNumLevelsAttr);
+}
+
+void Octree::Update(unsigned short frameNumber)
+{
+    PROFILE(UpdateOctree);
+
+    BeginWrite();
+
+    DrainUpdateQueue();
+    if (updateQueue.size())
+        ++generation;
+
+    if (batchTransforms)
+    {
+        for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+            transformUpdater.AddNode(*it);
+        transformUpdater.Update();
+    }
+
+    bool staticChanged = false;
+
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        OctreeNode* node = *it;
+        node->lastUpdateFrameNumber = frameNumber;
+        if (node->TestFlag(NF_STATIC))
+            staticChanged = true;
+        // Without the batch update, update the world transforms serially, as nodes may share dirty parents
+        node->WorldTransform();
+    }
+
+    if (staticChanged)
+        ++staticGeneration;
+
+    UpdateBoundingBoxes();
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+
+    // Update the remaining bounding boxes and find the new octants in parallel. Only existing child octants are entered
+    reinsertTargets.resize(updateQueue.size());
+    reinsertIncomplete.resize(updateQueue.size());
+    if (numThreads > 1 && updateQueue.size() > NODES_PER_REINSERT_TASK)
+    {
+        size_t numTasks = (updateQueue.size() + NODES_PER_REINSERT_TASK - 1) / NODES_PER_REINSERT_TASK;
+        while (reinsertTasks.size() < numTasks)
+            reinsertTasks.push_back(new RangeTask<Octree>(this, &Octree::FindReinsertTargetsWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<Octree>* task = reinsertTasks[i];
+            task->start = i * NODES_PER_REINSERT_TASK;
+            task->end = std::min((i + 1) * NODES_PER_REINSERT_TASK, updateQueue.size());
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+    {
+        for (size_t i = 0; i < updateQueue.size(); ++i)
+            FindReinsertTarget(i);
+    }
+
+    // Link the nodes to their new octants. Finish the descent where child octants need to be created, and group the moved nodes by octant
+    bool growRoot = false;
+
+    for (size_t i = 0; i < updateQueue.size(); ++i)
+    {
+        OctreeNode* node = updateQueue[i];
+        Octant* oldOctant = node->impl->octant;
+        Octant* newOctant = reinsertTargets[i];
+
+        // Static geometry stays in its BVH leaf while inside the leaf bounds. Otherwise the BVH is rebuilt
+        if (!newOctant)
+        {
+            if (oldOctant && oldOctant->bvhLeaf && oldOctant->cullingBox.IsInside(node->WorldBoundingBox()) == INSIDE)
+                SetOctantDirty(oldOctant);
+            else
+            {
+                if (oldOctant)
+                {
+                    node->impl->octant = nullptr;
+                    vacatedOctants.push_back(oldOctant);
+                }
+                bvhPendingNodes.push_back(node);
+            }
+            continue;
+        }
+
+        // In adaptive mode, grow the root later to cover nodes that have left it, unless they are larger than the root itself
+        if (adaptive && newOctant == &root)
+        {
+            const BoundingBox& box = node->WorldBoundingBox();
+            Vector3 boxSize = box.Size();
+            Vector3 rootSize = root.worldBoundingBox.Size();
+            if (root.cullingBox.IsInside(box) != INSIDE && boxSize.x < rootSize.x && boxSize.y < rootSize.y && boxSize.z < rootSize.z)
+            {
+                if (!growRoot)
+                    growBox = box;
+                else
+                    growBox.Merge(box);
+                growRoot = true;
+            }
+        }
+
+        if (reinsertIncomplete[i])
+        {
+            const BoundingBox& box = node->WorldBoundingBox();
+            Vector3 boxSize = box.Size();
+            Vector3 boxCenter = box.Center();
+
+            do
+                newOctant = CreateChildOctant(newOctant, newOctant->ChildIndex(boxCenter));
+            while (!newOctant->FitBoundingBox(box, boxSize));
+        }
+
+        // Do nothing if still fits the current octant, except refresh its culling data
+        if (newOctant == oldOctant)
+            SetOctantDirty(oldOctant);
+        else
+        {
+            movedNodes.push_back(std::make_pair(newOctant, node));
+            if (oldOctant)
+                vacatedOctants.push_back(oldOctant);
+        }
+    }
+
+    updateQueue.clear();
+
+    // Add first, then remove, because node count going to zero deletes the octree branch in question
+    std::sort(movedNodes.begin(), movedNodes.end());
+    for (size_t i = 0; i < movedNodes.size();)
+    {
+        Octant* octant = movedNodes[i].first;
+        size_t groupEnd = i + 1;
+        while (groupEnd < movedNodes.size() && movedNodes[groupEnd].first == octant)
+            ++groupEnd;
+
+        AddNodes(octant, i, groupEnd);
+        i = groupEnd;
+    }
+
+    movedNodes.clear();
+
+    std::sort(vacatedOctants.begin(), vacatedOctants.end());
+    vacatedOctants.erase(std::unique(vacatedOctants.begin(), vacatedOctants.end()), vacatedOctants.end());
+    for (auto it = vacatedOctants.begin(); it != vacatedOctants.end(); ++it)
+        RemoveMovedNodes(*it);
+
+    vacatedOctants.clear();
+
+    if (bvhPendingNodes.size())
+        RebuildBVH();
+
+    if (adaptive)
+    {
+        // Split crowded octants. Children that receive nodes are appended to the changed octants and checked in turn
+        for (size_t i = 0; i < sortDirtyOctants.size(); ++i)
+        {
+            Octant* octant = sortDirtyOctants[i];
+            if (!octant->bvhLeaf && octant->nodes.size() > splitThreshold)
+                SplitOctant(octant);
+        }
+
+        // Then merge sparse branches
+        while (mergeOctants.size())
+        {
+            Octant* octant = mergeOctants.back();
+            mergeOctants.pop_back();
+            octant->mergeQueued = false;
+            if (octant->numNodes <= splitThreshold / 2)
+                MergeOctant(octant);
+        }
+    }
+
+    // Sort nodes and write their culling data, in parallel if many octants changed
+    if (numThreads > 1 && sortDirtyOctants.size() > OCTANTS_PER_SORT_TASK)
+    {
+        size_t numTasks = (sortDirtyOctants.size() + OCTANTS_PER_SORT_TASK - 1) / OCTANTS_PER_SORT_TASK;
+        while (sortTasks.size() < numTasks)
+            sortTasks.push_back(new RangeTask<Octree>(this, &Octree::SortOctantsWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<Octree>* task = sortTasks[i];
+            task->start = i * OCTANTS_PER_SORT_TASK;
+            task->end = std::min((i + 1) * OCTANTS_PER_SORT_TASK, sortDirtyOctants.size());
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+    {
+        for (auto it = sortDirtyOctants.begin(); it != sortDirtyOctants.end(); ++it)
+            SortNodes(*it);
+    }
+
+    sortDirtyOctants.clear();
+
+    // Growing rebuilds the octree, so reinsert immediately to keep the nodes visible this frame
+    if (growRoot)
+    {
+        GrowRoot(growBox);
+        Update(frameNumber);
+    }
+
+    EndWrite();
+}
+
+void Octree::Resize(const BoundingBox& boundingBox, int numLevels)
+{
+    PROFILE(ResizeOctree);
+
+    BeginWrite();
+
+    // Collect both the queued and inserted nodes, then delete all child octants and the BVH
+    DrainUpdateQueue();
+    CollectNodes(updateQueue, &root);
+    for (auto it = bvhNodes.begin(); it != bvhNodes.end(); ++it)
+    {
+        if (it->leaf)
+            updateQueue.insert(updateQueue.end(), it->leaf->nodes.begin(), it->leaf->nodes.end());
+    }
+    DeleteBVH(false);
+    DeleteChildOctants(&root, false);
+    allocator.Reset();
+    root.Initialize(nullptr, boundingBox, Clamp(numLevels, 1, MAX_OCTREE_LEVELS));
+    // The whole octree changed. Marking the root makes all change queries report true
+    ++generation;
+    MarkOctantChanged(&root);
+
+    // Nodes will be reinserted on next update
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        OctreeNode* node = *it;
+        if (!node->TestFlag(NF_OCTREE_UPDATE_QUEUED))
+            QueueUpdate(node);
+    }
+
+    updateQueue.clear();
+
+    EndWrite();
+}
+
+void Octree::SetAdaptive(bool enable)
+{
+    adaptive = enable;
+}
+
+void Octree::SetSplitThreshold(unsigned threshold)
+{
+    splitThreshold = std::max(threshold, 1u);
+}
+
+void Octree::SetStaticBVH(bool enable)
+{
+    if (enable != staticBVH)
+    {
+        staticBVH = enable;
+        // Move the static geometry on next update
+        Resize(root.worldBoundingBox, root.level);
+    }
+}
+
+void Octree::SetBatchTransforms(bool enable)
+{
+    batchTransforms = enable;
+}
+
+void Octree::RemoveNode(OctreeNode* node)
+{
+    assert(node);
+
+    // Only removal from an octant changes the structure. Canceling a queued update is safe during read phases
+    if (node->impl->octant)
+    {
+        BeginWrite();
+        ++generation;
+        RemoveNode(node, node->impl->octant);
+        node->impl->octant = nullptr;
+        if (node->TestFlag(NF_STATIC))
+            ++staticGeneration;
+        EndWrite();
+    }
+
+    if (node->TestFlag(NF_OCTREE_UPDATE_QUEUED))
+        CancelUpdate(node);
+}
+
+void Octree::RemoveAllNodes()
+{
+    PROFILE(RemoveAllOctreeNodes);
+
+    BeginWrite();
+
+    // Queued nodes that have not been inserted yet are not found from the octants
+    DrainUpdateQueue();
     for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
     {
         OctreeNode* node = *it;
-        if (node && node->impl->octree == this && !node->impl->octant)
-        {
-            node->impl->octree = nullptr;
-            node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
-        }
+        if (node->impl->octree == this)
+        {
+            node->impl->octree = nullptr;
+            node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
+        }
+    }
+    updateQueue.clear();
+
+    sortDirtyOctants.clear();
+    mergeOctants.clear();
+    root.sortDirty = false;
+    root.mergeQueued = false;
+    DeleteBVH(true);
+    DeleteChildOctants(&root, true);
+    allocator.Reset();
+    ++generation;
+    ++staticGeneration;
+    MarkOctantChanged(&root);
+
+    EndWrite();
+}
+
+void Octree::OnSceneSet(Scene* newScene, Scene*)
+{
+    if (!newScene)
+        RemoveAllNodes();
+}
+
+void Octree::OnStaticChanged(OctreeNode* node)
+{
+    // Becoming static is also seen by the reinsertion, but becoming dynamic is not
+    if (node->impl->octant)
+        ++staticGeneration;
+}
+
+BoundingBox Octree::NodeBounds() const
+{
+    // Nodes of the child octants are inside the loose bounds of their octant, which are inside the root's
+    BoundingBox bounds(root.cullingBox);
+    for (auto it = root.nodes.begin(); it != root.nodes.end(); ++it)
+        bounds.Merge((*it)->WorldBoundingBox());
+    if (bvhNodes.size())
+        bounds.Merge(bvhNodes[0].box);
+
+    return bounds;
+}
+
+bool Octree::ChangedSince(const BoundingBox& box, unsigned sinceGeneration) const
+{
+    if ((int)(bvhRebuildGeneration - sinceGeneration) > 0 && bvhRebuildBox.IsInsideFast(box) != OUTSIDE)
+        return true;
+    if (OctantChangedSince(&root, box, sinceGeneration))
+        return true;
+    return bvhNodes.size() && BVHChangedSince(0, box, sinceGeneration);
+}
+
+void Octree::BeginRead() const
+{
+    for (;;)
+    {
+        while (writing.load())
+            std::this_thread::yield();
+
+        // Recheck after registering as a reader, in case a structural change began at the same time
+        numReaders.fetch_add(1);
+        if (!writing.load())
+            return;
+        numReaders.fetch_sub(1);
+    }
+}
+
+void Octree::EndRead() const
+{
+    numReaders.fetch_sub(1);
+}
+
+void Octree::BeginWrite()
+{
+    if (writeDepth++ == 0)
+    {
+        writing.store(true);
+        while (numReaders.load())
+            std::this_thread::yield();
+    }
+}
+
+void Octree::EndWrite()
+{
+    if (--writeDepth == 0)
+        writing.store(false);
+}
+
+void Octree::QueueUpdate(OctreeNode* node)
+{
+    assert(node);
+    node->SetFlag(NF_OCTREE_UPDATE_QUEUED, true);
+    QueueSlot(numQueuedUpdates.fetch_add(1)).store(node);
+}
+
+void Octree::CancelUpdate(OctreeNode* node)
+{
+    assert(node);
+
+    size_t numQueued = numQueuedUpdates.load();
+    size_t chunkStart = 0;
+
+    for (size_t i = 0; i < MAX_UPDATE_QUEUE_CHUNKS && chunkStart < numQueued; ++i)
+    {
+        size_t chunkSize = UPDATE_QUEUE_CHUNK_SIZE << i;
+        std::atomic<OctreeNode*>* chunk = updateQueueChunks[i].load();
+        // A chunk that is not allocated yet can not contain the node
+        if (chunk)
+        {
+            size_t count = std::min(chunkSize, numQueued - chunkStart);
+            for (size_t j = 0; j < count; ++j)
+            {
+                OctreeNode* expected = node;
+                if (chunk[j].compare_exchange_strong(expected, nullptr))
+                {
+                    node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
+                    return;
+                }
+            }
+        }
+        chunkStart += chunkSize;
+    }
+
+    node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
+}
+
+void Octree::Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const
+{
+    result.clear();
+    CollectNodes(result, &root, ray, nodeFlags, maxDistance, layerMask);
+    if (bvhNodes.size())
+        CollectBVHRaycast(result, 0, ray, nodeFlags, maxDistance, layerMask);
+    std::sort(result.begin(), result.end(), CompareRaycastResults);
+}
+
+RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const
+{
+    // Per-thread scratch for the node raycast results, so that raycasts from several threads do not conflict
+    static thread_local std::vector<RaycastResult> hits;
+
+    // The result distance is the closest hit so far, which the traversal prunes against
+    RaycastResult result;
+    result.position = result.normal = Vector3::ZERO;
+    result.distance = maxDistance;
+    result.node = nullptr;
+    result.subObject = 0;
+
+    // Visit child octants front to back along the ray for earlier closest hits
+    size_t childOrder = (ray.direction.x < 0.0f ? 1 : 0) | (ray.direction.y < 0.0f ? 2 : 0) | (ray.direction.z < 0.0f ? 4 : 0);
+
+    CollectNodesSingle(&root, ray, childOrder, result, hits, nodeFlags, layerMask);
+    if (bvhNodes.size())
+        CollectBVHNodesSingle(0, ray, ray.HitDistance(bvhNodes[0].box), result, hits, nodeFlags, layerMask);
+
+    if (!result.node)
+        result.distance = M_INFINITY;
+    return result;
+}
+
+void Octree::RaycastBatch(RaycastResult* results, const Ray* rays, size_t numRays, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const
+{
+    // Per-thread scratch for the node raycast results, to avoid allocating per call
+    static thread_local std::vector<RaycastResult> hits;
+
+    for (size_t i = 0; i < numRays; i += 4)
+    {
+        RayPacket packet;
+        size_t count = std::min(numRays - i, (size_t)4);
+        unsigned activeMask = (1u << count) - 1;
+
+        for (size_t j = 0; j < 4; ++j)
+        {
+            // Unused lanes repeat the first ray, but can never hit due to negative closest distance
+            const Ray& ray = rays[i + (j < count ? j : 0)];
+            packet.originX[j] = ray.origin.x;
+            packet.originY[j] = ray.origin.y;
+            packet.originZ[j] = ray.origin.z;
+            packet.invDirX[j] = SafeReciprocal(ray.direction.x);
+            packet.invDirY[j] = SafeReciprocal(ray.direction.y);
+            packet.invDirZ[j] = SafeReciprocal(ray.direction.z);
+            packet.closest[j] = j < count ? maxDistance : -1.0f;
+            packet.rays[j] = &ray;
+
+            if (j < count)
+            {
+                RaycastResult& result = results[i + j];
+                result.position = result.normal = Vector3::ZERO;
+                result.distance = M_INFINITY;
+                result.node = nullptr;
+                result.subObject = 0;
+            }
+        }
+
+        // Visit child octants front to back along the first ray for earlier closest hits
+        const Vector3& direction = rays[i].direction;
+        size_t childOrder = (direction.x < 0.0f ? 1 : 0) | (direction.y < 0.0f ? 2 : 0) | (direction.z < 0.0f ? 4 : 0);
+
+        CollectNodesBatch(&root, packet, activeMask, childOrder, results + i, hits, nodeFlags, layerMask);
+        if (bvhNodes.size())
+            CollectBVHNodesBatch(0, packet, activeMask, results + i, hits, nodeFlags, layerMask);
+    }
+}
+
+size_t Octree::FindOverlappingPairs(std::pair<OctreeNode*, OctreeNode*>* dest, size_t maxPairs, unsigned short nodeFlags, unsigned layerMask, unsigned short excludeFlags) const
+{
+    PROFILE(FindOverlappingPairs);
+
+    OverlapPairQuery query;
+    query.dest = dest;
+    query.maxPairs = dest ? maxPairs : 0;
+    query.nodeFlags = nodeFlags;
+    query.layerMask = layerMask;
+    query.excludeFlags = excludeFlags;
+    query.root = &root;
+    query.numPairs = 0;
+    CollectNodes(query.nodes, &root, nodeFlags, layerMask, excludeFlags);
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numTasks = (query.nodes.size() + OVERLAP_PAIR_NODES_PER_TASK - 1) / OVERLAP_PAIR_NODES_PER_TASK;
+
+    if (workQueue && workQueue->NumThreads() > 1 && numTasks > 1)
+    {
+        std::vector<AutoPtr<OverlapPairTask> > tasks;
+        TaskCounter counter(0);
+
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            OverlapPairTask* task = new OverlapPairTask(query, i * OVERLAP_PAIR_NODES_PER_TASK, std::min((i + 1) *
+                OVERLAP_PAIR_NODES_PER_TASK, query.nodes.size()));
+            tasks.push_back(task);
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+        FindOverlapPairs(query, 0, query.nodes.size());
+
+    return query.numPairs.load();
+}
+
+void Octree::SetBoundingBoxAttr(const BoundingBox& boundingBox)
+{
+    root.worldBoundingBox = boundingBox;
+}
+
+const BoundingBox& Octree::BoundingBoxAttr() const
+{
+    return root.worldBoundingBox;
+}
+
+void Octree::SetNumLevelsAttr(int numLevels)
+{
+    /// Setting the number of level (last attribute) triggers octree resize when deserializing
+    Resize(root.worldBoundingBox, numLevels);
+}
+
+int Octree::NumLevelsAttr() const
+{
+    return root.level;
+}
+
+std::atomic<OctreeNode*>& Octree::QueueSlot(size_t index)
+{
+    // Chunk sizes double, so chunk i begins at UPDATE_QUEUE_CHUNK_SIZE * (2^i - 1)
+    size_t chunkIndex = 0;
+    for (size_t blocks = index / UPDATE_QUEUE_CHUNK_SIZE + 1; blocks > 1; blocks >>= 1)
+        ++chunkIndex;
+    assert(chunkIndex < MAX_UPDATE_QUEUE_CHUNKS);
+
+    std::atomic<OctreeNode*>* chunk = updateQueueChunks[chunkIndex].load();
+    if (!chunk)
+    {
+        size_t chunkSize = UPDATE_QUEUE_CHUNK_SIZE << chunkIndex;
+        std::atomic<OctreeNode*>* newChunk = new std::atomic<OctreeNode*>[chunkSize];
+        for (size_t i = 0; i < chunkSize; ++i)
+            newChunk[i].store(nullptr);
+
+        // If another thread allocated the chunk first, use theirs
+        if (updateQueueChunks[chunkIndex].compare_exchange_strong(chunk, newChunk))
+            chunk = newChunk;
+        else
+            delete[] newChunk;
+    }
+
+    return chunk[index - UPDATE_QUEUE_CHUNK_SIZE * ((((size_t)1) << chunkIndex) - 1)];
+}
+
+void Octree::DrainUpdateQueue()
+{
+    size_t numQueued = numQueuedUpdates.load();
+    size_t chunkStart = 0;
+
+    for (size_t i = 0; i < MAX_UPDATE_QUEUE_CHUNKS && chunkStart < numQueued; ++i)
+    {
+        size_t chunkSize = UPDATE_QUEUE_CHUNK_SIZE << i;
+        std::atomic<OctreeNode*>* chunk = updateQueueChunks[i].load();
+        size_t count = std::min(chunkSize, numQueued - chunkStart);
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            // If node was removed before update could happen, a null pointer will be in its place
+            OctreeNode* node = chunk[j].exchange(nullptr);
+            // A node queued several times is processed only once
+            if (node && node->TestFlag(NF_OCTREE_UPDATE_QUEUED))
+            {
+                node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
+                updateQueue.push_back(node);
+            }
+        }
+        chunkStart += chunkSize;
+    }
+
+    numQueuedUpdates.store(0);
+}
+
+void Octree::UpdateBoundingBoxes()
+{
+    boxBatchDest.clear();
+    boxBatchSource.clear();
+    boxBatchTransforms.clear();
+
+    // The flag is cleared beforehand, as the boxes are not read until the batch is complete
+    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    {
+        OctreeNode* node = *it;
+        if (!node->TestFlag(NF_BOUNDING_BOX_DIRTY))
+            continue;
+        const BoundingBox* localBox = node->LocalBoundingBox();
+        if (!localBox)
+            continue;
+
+        boxBatchDest.push_back(&node->worldBoundingBox);
+        boxBatchSource.push_back(localBox);
+        boxBatchTransforms.push_back(&node->WorldTransform());
+        node->SetFlag(NF_BOUNDING_BOX_DIRTY, false);
+    }
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numBoxes = boxBatchDest.size();
+
+    if (workQueue && workQueue->NumThreads() > 1 && numBoxes > BOXES_PER_TRANSFORM_TASK)
+    {
+        size_t numTasks = (numBoxes + BOXES_PER_TRANSFORM_TASK - 1) / BOXES_PER_TRANSFORM_TASK;
+        while (boxTasks.size() < numTasks)
+            boxTasks.push_back(new RangeTask<Octree>(this, &Octree::UpdateBoundingBoxesWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<Octree>* task = boxTasks[i];
+            task->start = i * BOXES_PER_TRANSFORM_TASK;
+            task->end = std::min((i + 1) * BOXES_PER_TRANSFORM_TASK, numBoxes);
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else if (numBoxes)
+        BoundingBox::TransformBatch(&boxBatchDest[0], &boxBatchSource[0], &boxBatchTransforms[0], numBoxes);
+}
+
+void Octree::UpdateBoundingBoxesWork(Task* task, unsigned)
+{
+    PROFILE(UpdateBoundingBoxesWork);
+
+    RangeTask<Octree>* rangeTask = static_cast<RangeTask<Octree>*>(task);
+    BoundingBox::TransformBatch(&boxBatchDest[rangeTask->start], &boxBatchSource[rangeTask->start], &boxBatchTransforms[rangeTask->start],
+        rangeTask->end - rangeTask->start);
+}
+
+void Octree::FindReinsertTargetsWork(Task* task, unsigned)
+{
+    PROFILE(FindReinsertTargetsWork);
+
+    RangeTask<Octree>* rangeTask = static_cast<RangeTask<Octree>*>(task);
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+        FindReinsertTarget(i);
+}
+
+void Octree::FindReinsertTarget(size_t index)
+{
+    OctreeNode* node = updateQueue[index];
+    const BoundingBox& box = node->WorldBoundingBox();
+    Vector3 boxSize = box.Size();
+    Octant* oldOctant = node->impl->octant;
+
+    reinsertIncomplete[index] = 0;
+
+    // Static geometry is linked to the BVH on the main thread
+    if (UseBVH(node))
+    {
+        reinsertTargets[index] = nullptr;
+        return;
+    }
+
+    if (oldOctant && !oldOctant->bvhLeaf && oldOctant->cullingBox.IsInside(box) == INSIDE && oldOctant->FitBoundingBox(box, boxSize))
+    {
+        reinsertTargets[index] = oldOctant;
+        return;
+    }
+
+    // Start from root and check what level child needs to be used. Stop at a missing child, which is created on the main thread
+    Octant* newOctant = &root;
+    Vector3 boxCenter = box.Center();
+
+    for (;;)
+    {
+        bool insertHere = (newOctant == &root) ?
+            (newOctant->cullingBox.IsInside(box) != INSIDE || newOctant->FitBoundingBox(box, boxSize)) :
+            newOctant->FitBoundingBox(box, boxSize);
+
+        if (insertHere)
+            break;
+
+        Octant* child = newOctant->children[newOctant->ChildIndex(boxCenter)];
+        if (!child)
+        {
+            reinsertIncomplete[index] = 1;
+            break;
+        }
+        newOctant = child;
+    }
+
+    reinsertTargets[index] = newOctant;
+}
+
+void Octree::SortOctantsWork(Task* task, unsigned)
+{
+    PROFILE(SortOctantsWork);
+
+    RangeTask<Octree>* rangeTask = static_cast<RangeTask<Octree>*>(task);
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+        SortNodes(sortDirtyOctants[i]);
+}
+
+void Octree::RemoveMovedNodes(Octant* octant)
+{
+    MarkOctantChanged(octant);
+
+    std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    size_t numKept = 0;
+    for (size_t i = 0; i < octantNodes.size(); ++i)
+    {
+        if (octantNodes[i]->impl->octant == octant)
+            octantNodes[numKept++] = octantNodes[i];
+    }
+    size_t numRemoved = octantNodes.size() - numKept;
+    octantNodes.resize(numKept);
+    // Order is preserved, so only the culling data needs refreshing, unless it is written after sorting anyway
+    if (!octant->sortDirty)
+        octant->UpdateCullingData();
+
+    // Decrement the node count in the whole parent branch and erase empty octants as necessary. Remember the topmost sparse octant for merging
+    Octant* mergeOctant = nullptr;
+
+    while (octant)
+    {
+        octant->numNodes -= numRemoved;
+        Octant* next = octant->parent;
+        if (!octant->numNodes && next)
+            DeleteChildOctant(next, next->ChildIndex(octant->center));
+        else if (adaptive && !octant->bvhLeaf && octant->numNodes <= splitThreshold / 2)
+            mergeOctant = octant;
+        octant = next;
+    }
+
+    if (mergeOctant && !mergeOctant->mergeQueued)
+    {
+        mergeOctant->mergeQueued = true;
+        mergeOctants.push_back(mergeOctant);
+    }
+}
+
+void Octree::SplitOctant(Octant* octant)
+{
+    if (octant->level <= 1)
+        return;
+
+    std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    size_t numKept = 0;
+
+    for (size_t i = 0; i < octantNodes.size(); ++i)
+    {
+        OctreeNode* node = octantNodes[i];
+        const BoundingBox& box = node->WorldBoundingBox();
+        if (octant->FitBoundingBox(box, box.Size()))
+            octantNodes[numKept++] = node;
+        else
+        {
+            // The relative order of the nodes is kept, so the child receives a sorted run
+            Octant* child = CreateChildOctant(octant, octant->ChildIndex(box.Center()));
+            child->nodes.push_back(node);
+            ++child->numNodes;
+            node->impl->octant = child;
+            SetOctantDirty(child);
+        }
+    }
+
+    octantNodes.resize(numKept);
+}
+
+void Octree::MergeOctant(Octant* octant)
+{
+    bool hasChildren = false;
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (octant->children[i])
+        {
+            MergeChildOctant(octant, i);
+            hasChildren = true;
+        }
+    }
+
+    if (hasChildren)
+        SetOctantDirty(octant);
+}
+
+void Octree::MergeChildOctant(Octant* octant, size_t index)
+{
+    Octant* child = octant->children[index];
+
+    // Collapse the branch bottom-up. The node counts of the octant and its parents do not change
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (child->children[i])
+            MergeChildOctant(child, i);
+    }
+
+    for (auto it = child->nodes.begin(); it != child->nodes.end(); ++it)
+    {
+        OctreeNode* node = *it;
+        octant->nodes.push_back(node);
+        node->impl->octant = octant;
     }
-    updateQueue.clear();
 
-    DeleteChildOctants(&root, true);
+    child->nodes.clear();
+    DeleteChildOctant(octant, index);
 }
 
-void Octree::RegisterObject()
+void Octree::GrowRoot(const BoundingBox& box)
 {
-    RegisterFactory<Octree>();
-    CopyBaseAttributes<Octree, Node>();
-    RegisterRefAttribute("boundingBox", &Octree::BoundingBoxAttr, &Octree::SetBoundingBoxAttr);
-    RegisterAttribute("numLevels", &Octree::NumLevelsAttr, &Octree::SetNumLevelsAttr);
-}
+    PROFILE(GrowOctree);
 
-void Octree::Update(unsigned short frameNumber)
-{
-    PROFILE(UpdateOctree);
+    // Double the root towards the nodes outside it, so that the old root would be one of the new root's children
+    BoundingBox newBox = root.worldBoundingBox;
+    int newLevels = root.level;
 
-    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    while (newLevels < MAX_OCTREE_LEVELS)
     {
-        OctreeNode* node = *it;
-        // If node was removed before update could happen, a null pointer will be in its place
-        if (!node)
-            continue;
+        Vector3 halfSize = newBox.HalfSize();
+        if (BoundingBox(newBox.min - halfSize, newBox.max + halfSize).IsInside(box) == INSIDE)
+            break;
 
-        node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
-        node->lastUpdateFrameNumber = frameNumber;
+        Vector3 size = newBox.Size();
+        if (box.min.x < newBox.min.x - halfSize.x)
+            newBox.min.x -= size.x;
+        else
+            newBox.max.x += size.x;
+        if (box.min.y < newBox.min.y - halfSize.y)
+            newBox.min.y -= size.y;
+        else
+            newBox.max.y += size.y;
+        if (box.min.z < newBox.min.z - halfSize.z)
+            newBox.min.z -= size.z;
+        else
+            newBox.max.z += size.z;
+        ++newLevels;
+    }
 
-        // Do nothing if still fits the current octant
-        const BoundingBox& box = node->WorldBoundingBox();
-        Vector3 boxSize = box.Size();
-        Octant* oldOctant = node->impl->octant;
-        if (oldOctant && oldOctant->cullingBox.IsInside(box) == INSIDE && oldOctant->FitBoundingBox(box, boxSize))
-            continue;
+    LOGDEBUGF("Growing octree to cover %s", box.ToString().c_str());
+    Resize(newBox, newLevels);
+}
 
-        // Begin reinsert process. Start from root and check what level child needs to be used
-        Octant* newOctant = &root;
-        Vector3 boxCenter = box.Center();
+void Octree::RebuildBVH()
+{
+    PROFILE(BuildBVH);
 
-        for (;;)
-        {
-            // If node does not fit fully inside root octant, must remain in it
-            bool insertHere = (newOctant == &root) ?
-                (newOctant->cullingBox.IsInside(box) != INSIDE || newOctant->FitBoundingBox(box, boxSize)) :
-                newOctant->FitBoundingBox(box, boxSize);
+    // The nodes' previous locations are not tracked, so report a change over the old and new bounds
+    bvhRebuildBox.Undefine();
+    if (bvhNodes.size())
+        bvhRebuildBox.Merge(bvhNodes[0].box);
 
-            if (insertHere)
-            {
-                if (newOctant != oldOctant)
-                {
-                    // Add first, then remove, because node count going to zero deletes the octree branch in question
-                    AddNode(node, newOctant);
-                    if (oldOctant)
-                        RemoveNode(node, oldOctant);
-                }
-                break;
-            }
-            else
-                newOctant = CreateChildOctant(newOctant, newOctant->ChildIndex(boxCenter));
-        }
+    for (auto it = bvhNodes.begin(); it != bvhNodes.end(); ++it)
+    {
+        if (it->leaf)
+            bvhPendingNodes.insert(bvhPendingNodes.end(), it->leaf->nodes.begin(), it->leaf->nodes.end());
     }
 
-    updateQueue.clear();
+    // The old leaves may be waiting for sorting. Remove them from the changed octants before freeing
+    size_t numKept = 0;
+    for (size_t i = 0; i < sortDirtyOctants.size(); ++i)
+    {
+        if (!sortDirtyOctants[i]->bvhLeaf)
+            sortDirtyOctants[numKept++] = sortDirtyOctants[i];
+    }
+    sortDirtyOctants.resize(numKept);
 
-    for (auto it = sortDirtyOctants.begin(); it != sortDirtyOctants.end(); ++it)
+    for (auto it = bvhNodes.begin(); it != bvhNodes.end(); ++it)
     {
-        Octant* octant = *it;
-        std::sort(octant->nodes.begin(), octant->nodes.end());
-        octant->sortDirty = false;
+        if (it->leaf)
+            allocator.Free(it->leaf);
     }
 
-    sortDirtyOctants.clear();
+    bvhNodes.clear();
+    BuildBVH(0, bvhPendingNodes.size());
+    bvhPendingNodes.clear();
+
+    if (bvhNodes.size())
+        bvhRebuildBox.Merge(bvhNodes[0].box);
+    bvhRebuildGeneration = generation;
 }
 
-void Octree::Resize(const BoundingBox& boundingBox, int numLevels)
+unsigned Octree::BuildBVH(size_t start, size_t end)
 {
-    PROFILE(ResizeOctree);
+    BoundingBox box;
+    BoundingBox centerBox;
 
-    // Collect nodes to the root and delete all child octants
-    updateQueue.clear();
-    CollectNodes(updateQueue, &root);
-    DeleteChildOctants(&root, false);
-    allocator.Reset();
-    root.Initialize(nullptr, boundingBox, Clamp(numLevels, 1, MAX_OCTREE_LEVELS));
+    for (size_t i = start; i < end; ++i)
+    {
+        const BoundingBox& nodeBox = bvhPendingNodes[i]->WorldBoundingBox();
+        box.Merge(nodeBox);
+        centerBox.Merge(nodeBox.Center());
+    }
 
-    // Nodes will be reinserted on next update
-}
+    unsigned index = (unsigned)bvhNodes.size();
+    BVHNode newNode;
+    newNode.box = box;
+    newNode.secondChild = 0;
+    newNode.leaf = nullptr;
+    bvhNodes.push_back(newNode);
 
-void Octree::RemoveNode(OctreeNode* node)
-{
-    assert(node);
-    RemoveNode(node, node->impl->octant);
-    if (node->TestFlag(NF_OCTREE_UPDATE_QUEUED))
-        CancelUpdate(node);
-    node->impl->octant = nullptr;
-}
+    size_t count = end - start;
+    if (count <= BVH_MAX_LEAF_NODES)
+    {
+        Octant* leaf = allocator.Allocate();
+        leaf->Initialize(nullptr, box, 0);
+        // Leaves are culled with their exact bounds
+        leaf->cullingBox = box;
+        leaf->bvhLeaf = true;
+        leaf->nodes.assign(bvhPendingNodes.begin() + start, bvhPendingNodes.begin() + end);
+        leaf->numNodes = count;
+        for (auto it = leaf->nodes.begin(); it != leaf->nodes.end(); ++it)
+            (*it)->impl->octant = leaf;
+        SetOctantDirty(leaf);
+
+        bvhNodes[index].leaf = leaf;
+        return index;
+    }
 
-void Octree::QueueUpdate(OctreeNode* node)
-{
-    assert(node);
-    updateQueue.push_back(node);
-    node->SetFlag(NF_OCTREE_UPDATE_QUEUED, true);
-}
+    // Split along the axis with the largest extent of node centers
+    Vector3 extent = centerBox.Size();
+    size_t axis = 0;
+    if (extent.y > extent.x)
+        axis = 1;
+    if (extent.z > extent.Data()[axis])
+        axis = 2;
 
-void Octree::CancelUpdate(OctreeNode* node)
-{
-    assert(node);
-    
-    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    size_t mid = start + count / 2;
+    float axisMin = centerBox.min.Data()[axis];
+    float axisExtent = extent.Data()[axis];
+
+    // If the centers coincide, any split is as good. Otherwise choose the split with the lowest surface area heuristic cost from binned centers
+    if (axisExtent > M_EPSILON)
     {
-        if ((*it) == node)
+        BoundingBox binBoxes[BVH_SAH_BINS];
+        size_t binCounts[BVH_SAH_BINS];
+        for (size_t i = 0; i < BVH_SAH_BINS; ++i)
+            binCounts[i] = 0;
+
+        float scale = (float)BVH_SAH_BINS / axisExtent;
+        for (size_t i = start; i < end; ++i)
         {
-            *it = nullptr;
-            break;
+            const BoundingBox& nodeBox = bvhPendingNodes[i]->WorldBoundingBox();
+            size_t bin = std::min((size_t)((nodeBox.Center().Data()[axis] - axisMin) * scale), BVH_SAH_BINS - 1);
+            binBoxes[bin].Merge(nodeBox);
+            ++binCounts[bin];
         }
-    }
 
-    node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
-}
+        // Costs of the splits after each bin, accumulated from the left
+        float leftCosts[BVH_SAH_BINS];
+        BoundingBox accumBox;
+        size_t accumCount = 0;
+        for (size_t i = 0; i < BVH_SAH_BINS - 1; ++i)
+        {
+            accumBox.Merge(binBoxes[i]);
+            accumCount += binCounts[i];
+            leftCosts[i] = accumCount ? SurfaceArea(accumBox) * accumCount : 0.0f;
+        }
 
-void Octree::Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask)
-{
-    result.clear();
-    CollectNodes(result, &root, ray, nodeFlags, maxDistance, layerMask);
-    std::sort(result.begin(), result.end(), CompareRaycastResults);
+        size_t bestSplit = 0;
+        float bestCost = M_INFINITY;
+        accumBox.Undefine();
+        accumCount = 0;
+        for (size_t i = BVH_SAH_BINS - 1; i > 0; --i)
+        {
+            accumBox.Merge(binBoxes[i]);
+            accumCount += binCounts[i];
+            float cost = leftCosts[i - 1] + (accumCount ? SurfaceArea(accumBox) * accumCount : 0.0f);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestSplit = i;
+            }
+        }
+
+        // Partition the nodes to the bins before and after the split. The first and last bins are never empty, so both sides get nodes
+        size_t left = start;
+        size_t right = end;
+        while (left < right)
+        {
+            const BoundingBox& nodeBox = bvhPendingNodes[left]->WorldBoundingBox();
+            size_t bin = std::min((size_t)((nodeBox.Center().Data()[axis] - axisMin) * scale), BVH_SAH_BINS - 1);
+            if (bin < bestSplit)
+                ++left;
+            else
+                std::swap(bvhPendingNodes[left], bvhPendingNodes[--right]);
+        }
+        mid = left;
+    }
+
+    BuildBVH(start, mid);
+    unsigned secondChild = BuildBVH(mid, end);
+    bvhNodes[index].secondChild = secondChild;
+    return index;
 }
 
-RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask)
+void Octree::DeleteBVH(bool deletingOctree)
 {
-    // Get first the potential hits
-    initialRes.clear();
-    CollectNodes(initialRes, &root, ray, nodeFlags, maxDistance, layerMask);
-    std::sort(initialRes.begin(), initialRes.end(), CompareNodeDistances);
-
-    // Then perform actual per-node ray tests and early-out when possible
-    finalRes.clear();
-    float closestHit = M_INFINITY;
-    for (auto it = initialRes.begin(); it != initialRes.end(); ++it)
+    for (auto it = bvhNodes.begin(); it != bvhNodes.end(); ++it)
     {
-        if (it->second < Min(closestHit, maxDistance))
+        Octant* leaf = it->leaf;
+        if (!leaf)
+            continue;
+
+        for (auto nIt = leaf->nodes.begin(); nIt != leaf->nodes.end(); ++nIt)
         {
-            size_t oldSize = finalRes.size();
-            it->first->OnRaycast(finalRes, ray, maxDistance);
-            if (finalRes.size() > oldSize)
-                closestHit = Min(closestHit, finalRes.back().distance);
+            OctreeNode* node = *nIt;
+            node->impl->octant = nullptr;
+            node->SetFlag(NF_OCTREE_UPDATE_QUEUED, false);
+            if (deletingOctree)
+                node->impl->octree = nullptr;
         }
-        else
-            break;
+        allocator.Free(leaf);
     }
 
-    if (finalRes.size())
-    {
-        std::sort(finalRes.begin(), finalRes.end(), CompareRaycastResults);
-        return finalRes.front();
-    }
-    else
-    {
-        RaycastResult emptyRes;
-        emptyRes.position = emptyRes.normal = Vector3::ZERO;
-        emptyRes.distance = M_INFINITY;
-        emptyRes.node = nullptr;
-        emptyRes.subObject = 0;
-        return emptyRes;
-    }
+    bvhNodes.clear();
 }
 
-void Octree::SetBoundingBoxAttr(const BoundingBox& boundingBox)
+void Octree::SetOctantDirty(Octant* octant)
 {
-    root.worldBoundingBox = boundingBox;
+    MarkOctantChanged(octant);
+
+    if (!octant->sortDirty)
+    {
+        octant->sortDirty = true;
+        sortDirtyOctants.push_back(octant);
+    }
 }
 
-const BoundingBox& Octree::BoundingBoxAttr() const
+void Octree::MarkOctantChanged(Octant* octant)
 {
-    return root.worldBoundingBox;
+    octant->changeGeneration = generation;
+
+    // Stop at the first parent already marked, as its parents are marked too
+    while (octant && octant->subtreeGeneration != generation)
+    {
+        octant->subtreeGeneration = generation;
+        octant = octant->parent;
+    }
 }
 
-void Octree::SetNumLevelsAttr(int numLevels)
+bool Octree::OctantChangedSince(const Octant* octant, const BoundingBox& box, unsigned sinceGeneration) const
 {
-    /// Setting the number of level (last attribute) triggers octree resize when deserializing
-    Resize(root.worldBoundingBox, numLevels);
+    if ((int)(octant->subtreeGeneration - sinceGeneration) <= 0)
+        return false;
+    // The nodes of an octant are within its culling box, except in the root, which holds also the nodes outside the octree bounds
+    if (octant != &root && octant->cullingBox.IsInsideFast(box) == OUTSIDE)
+        return false;
+    if ((int)(octant->changeGeneration - sinceGeneration) > 0)
+        return true;
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (octant->children[i] && OctantChangedSince(octant->children[i], box, sinceGeneration))
+            return true;
+    }
+
+    return false;
 }
 
-int Octree::NumLevelsAttr() const
+bool Octree::BVHChangedSince(unsigned index, const BoundingBox& box, unsigned sinceGeneration) const
 {
-    return root.level;
+    const BVHNode& bvhNode = bvhNodes[index];
+    if (bvhNode.box.IsInsideFast(box) == OUTSIDE)
+        return false;
+
+    if (bvhNode.leaf)
+        return (int)(bvhNode.leaf->changeGeneration - sinceGeneration) > 0;
+    else
+        return BVHChangedSince(index + 1, box, sinceGeneration) || BVHChangedSince(bvhNode.secondChild, box, sinceGeneration);
 }
 
-void Octree::AddNode(OctreeNode* node, Octant* octant)
+void Octree::AddNodes(Octant* octant, size_t start, size_t end)
 {
-    octant->nodes.push_back(node);
-    node->impl->octant = octant;
-
-    if (!octant->sortDirty)
+    for (size_t i = start; i < end; ++i)
     {
-        octant->sortDirty = true;
-        sortDirtyOctants.push_back(octant);
+        OctreeNode* node = movedNodes[i].second;
+        octant->nodes.push_back(node);
+        node->impl->octant = octant;
     }
+    // Culling data is written after sorting in Update()
+    SetOctantDirty(octant);
 
     // Increment the node count in the whole parent branch
     while (octant)
     {
-        ++octant->numNodes;
+        octant->numNodes += end - start;
         octant = octant->parent;
     }
 }
 
+void Octree::SortNodes(Octant* octant)
+{
+    // Existing nodes stay sorted and added nodes are appended in sorted order, so a merge is enough
+    std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    auto it = std::is_sorted_until(octantNodes.begin(), octantNodes.end());
+    if (it != octantNodes.end())
+    {
+        std::sort(it, octantNodes.end());
+        std::inplace_merge(octantNodes.begin(), it, octantNodes.end());
+    }
+
+    octant->UpdateCullingData();
+    octant->sortDirty = false;
+}
+
 void Octree::RemoveNode(OctreeNode* node, Octant* octant)
 {
     if (!octant)
@@ -290,7 +1547,11 @@ void Octree::RemoveNode(OctreeNode* node, Octant* octant)
     {
         if ((*it) == node)
         {
+            MarkOctantChanged(octant);
+            // Shift the culling data of the following nodes immediately, as removal can happen outside Update()
+            size_t index = it - octant->nodes.begin();
             octant->nodes.erase(it);
+            octant->UpdateCullingData(index);
             // Decrement the node count in the whole parent branch and erase empty octants as necessary
             while (octant)
             {
@@ -338,6 +1599,13 @@ Octant* Octree::CreateChildOctant(Octant* octant, size_t index)
 
 void Octree::DeleteChildOctant(Octant* octant, size_t index)
 {
+    // Splitting, merging and node removal may delete octants that are already queued during the update
+    Octant* child = octant->children[index];
+    if (child->sortDirty)
+        sortDirtyOctants.erase(std::find(sortDirtyOctants.begin(), sortDirtyOctants.end(), child));
+    if (child->mergeQueued)
+        mergeOctants.erase(std::find(mergeOctants.begin(), mergeOctants.end(), child));
+
     allocator.Free(octant->children[index]);
     octant->children[index] = nullptr;
 }
@@ -353,6 +1621,7 @@ void Octree::DeleteChildOctants(Octant* octant, bool deletingOctree)
             node->impl->octree = nullptr;
     }
     octant->nodes.clear();
+    octant->UpdateCullingData();
     octant->numNodes = 0;
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
@@ -368,76 +1637,248 @@ void Octree::DeleteChildOctants(Octant* octant, bool deletingOctree)
         allocator.Free(octant);
 }
 
-void Octree::CollectNodes(std::vector<OctreeNode*>& result, Octant* octant) const
+void Octree::SplitQueryMasked(std::vector<OctreeSubtree>& result, const Octant* octant, const Frustum& frustum, int depth, unsigned char planeMask) const
 {
-    result.insert(result.end(), octant->nodes.begin(), octant->nodes.end());
+    if (!octant->numNodes)
+        return;
+
+    OctreeSubtree subtree;
+    subtree.octant = octant;
+    subtree.bvhNode = 0;
+
+    // At split depth, leave the octant itself to be tested by the subtree query
+    if (depth <= 0)
+    {
+        subtree.planeMask = planeMask;
+        subtree.recursive = true;
+        result.push_back(subtree);
+        return;
+    }
+
+    if (planeMask != 0x3f)
+    {
+        planeMask = frustum.IsInsideMasked(octant->cullingBox, planeMask);
+        if (planeMask == 0xff)
+            return;
+    }
+
+    if (octant->nodes.size())
+    {
+        subtree.planeMask = planeMask;
+        subtree.recursive = false;
+        result.push_back(subtree);
+    }
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
     {
         if (octant->children[i])
-            CollectNodes(result, octant->children[i]);
+            SplitQueryMasked(result, octant->children[i], frustum, depth - 1, planeMask);
     }
 }
 
-void Octree::CollectNodes(std::vector<OctreeNode*>& result, Octant* octant, unsigned short nodeFlags, unsigned layerMask) const
+void Octree::CollectNodesBatch(const Octant* octant, RayPacket& packet, unsigned activeMask, size_t childOrder, RaycastResult* results,
+    std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const
 {
-    std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    activeMask &= HitBoxMask(packet, octant->cullingBox);
+    if (!activeMask)
+        return;
+
+    TestNodesBatch(octant, packet, activeMask, results, hits, nodeFlags, layerMask);
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        const Octant* child = octant->children[i ^ childOrder];
+        if (child)
+            CollectNodesBatch(child, packet, activeMask, childOrder, results, hits, nodeFlags, layerMask);
+    }
+}
+
+void Octree::CollectBVHNodesBatch(unsigned index, RayPacket& packet, unsigned activeMask, RaycastResult* results, std::vector<RaycastResult>& hits,
+    unsigned short nodeFlags, unsigned layerMask) const
+{
+    const BVHNode& bvhNode = bvhNodes[index];
+    activeMask &= HitBoxMask(packet, bvhNode.box);
+    if (!activeMask)
+        return;
+
+    if (bvhNode.leaf)
+        TestNodesBatch(bvhNode.leaf, packet, activeMask, results, hits, nodeFlags, layerMask);
+    else
+    {
+        CollectBVHNodesBatch(index + 1, packet, activeMask, results, hits, nodeFlags, layerMask);
+        CollectBVHNodesBatch(bvhNode.secondChild, packet, activeMask, results, hits, nodeFlags, layerMask);
+    }
+}
+
+void Octree::TestNodesBatch(const Octant* octant, RayPacket& packet, unsigned activeMask, RaycastResult* results, std::vector<RaycastResult>& hits,
+    unsigned short nodeFlags, unsigned layerMask) const
+{
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
+
+    for (size_t i = 0; i < octantNodes.size(); ++i)
+    {
+        if ((octant->nodeFlags[i] & nodeFlags) != nodeFlags || !(octant->nodeLayerMasks[i] & layerMask))
+            continue;
+
+        unsigned hitMask = activeMask & HitBoxMask(packet, octant->nodeMinX[i], octant->nodeMinY[i], octant->nodeMinZ[i], octant->nodeMaxX[i],
+            octant->nodeMaxY[i], octant->nodeMaxZ[i]);
+
+        for (size_t j = 0; hitMask; ++j, hitMask >>= 1)
+        {
+            if (!(hitMask & 1))
+                continue;
+
+            // Perform the actual per-node ray test
+            hits.clear();
+            octantNodes[i]->OnRaycast(hits, *packet.rays[j], packet.closest[j]);
+            for (auto it = hits.begin(); it != hits.end(); ++it)
+            {
+                if (it->distance < packet.closest[j])
+                {
+                    packet.closest[j] = it->distance;
+                    results[j] = *it;
+                }
+            }
+        }
+    }
+}
+
+void Octree::CollectNodesSingle(const Octant* octant, const Ray& ray, size_t childOrder, RaycastResult& result, std::vector<RaycastResult>& hits,
+    unsigned short nodeFlags, unsigned layerMask) const
+{
+    if (ray.HitDistance(octant->cullingBox) >= result.distance)
+        return;
+
+    TestNodesSingle(octant, ray, result, hits, nodeFlags, layerMask);
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        const Octant* child = octant->children[i ^ childOrder];
+        if (child)
+            CollectNodesSingle(child, ray, childOrder, result, hits, nodeFlags, layerMask);
+    }
+}
+
+void Octree::CollectBVHNodesSingle(unsigned index, const Ray& ray, float distance, RaycastResult& result, std::vector<RaycastResult>& hits,
+    unsigned short nodeFlags, unsigned layerMask) const
+{
+    if (distance >= result.distance)
+        return;
+
+    const BVHNode& bvhNode = bvhNodes[index];
+    if (bvhNode.leaf)
+        TestNodesSingle(bvhNode.leaf, ray, result, hits, nodeFlags, layerMask);
+    else
+    {
+        // The children are not ordered spatially, so order them by their entry distances
+        unsigned first = index + 1;
+        unsigned second = bvhNode.secondChild;
+        float firstDistance = ray.HitDistance(bvhNodes[first].box);
+        float secondDistance = ray.HitDistance(bvhNodes[second].box);
+        if (secondDistance < firstDistance)
+        {
+            std::swap(first, second);
+            std::swap(firstDistance, secondDistance);
+        }
+
+        CollectBVHNodesSingle(first, ray, firstDistance, result, hits, nodeFlags, layerMask);
+        CollectBVHNodesSingle(second, ray, secondDistance, result, hits, nodeFlags, layerMask);
+    }
+}
+
+void Octree::TestNodesSingle(const Octant* octant, const Ray& ray, RaycastResult& result, std::vector<RaycastResult>& hits, unsigned short nodeFlags,
+    unsigned layerMask) const
+{
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
 
     for (auto it = octantNodes.begin(); it != octantNodes.end(); ++it)
     {
         OctreeNode* node = *it;
-        if ((node->Flags() & nodeFlags) == nodeFlags && (node->LayerMask() & layerMask))
-            result.push_back(node);
+        if ((node->Flags() & nodeFlags) != nodeFlags || !(node->LayerMask() & layerMask) ||
+            ray.HitDistance(node->WorldBoundingBox()) >= result.distance)
+            continue;
+
+        // Perform the actual per-node ray test
+        hits.clear();
+        node->OnRaycast(hits, ray, result.distance);
+        for (auto hitIt = hits.begin(); hitIt != hits.end(); ++hitIt)
+        {
+            if (hitIt->distance < result.distance)
+                result = *hitIt;
+        }
+    }
+}
+
+void Octree::SplitBVHQueryMasked(std::vector<OctreeSubtree>& result, unsigned index, const Frustum& frustum, int depth, unsigned char planeMask) const
+{
+    const BVHNode& bvhNode = bvhNodes[index];
+
+    // At split depth or at a leaf, leave the BVH node itself to be tested by the subtree query
+    if (depth <= 0 || bvhNode.leaf)
+    {
+        OctreeSubtree subtree;
+        subtree.octant = nullptr;
+        subtree.bvhNode = index;
+        subtree.planeMask = planeMask;
+        subtree.recursive = true;
+        result.push_back(subtree);
+        return;
     }
 
+    if (planeMask != 0x3f)
+    {
+        planeMask = frustum.IsInsideMasked(bvhNode.box, planeMask);
+        if (planeMask == 0xff)
+            return;
+    }
+
+    SplitBVHQueryMasked(result, index + 1, frustum, depth - 1, planeMask);
+    SplitBVHQueryMasked(result, bvhNode.secondChild, frustum, depth - 1, planeMask);
+}
+
+void Octree::CollectNodes(std::vector<OctreeNode*>& result, const Octant* octant) const
+{
+    result.insert(result.end(), octant->nodes.begin(), octant->nodes.end());
+
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
     {
         if (octant->children[i])
-            CollectNodes(result, octant->children[i], nodeFlags, layerMask);
+            CollectNodes(result, octant->children[i]);
     }
 }
 
-void Octree::CollectNodes(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short nodeFlags, 
-    float maxDistance, unsigned layerMask) const
+void Octree::CollectNodes(std::vector<OctreeNode*>& result, const Octant* octant, unsigned short nodeFlags, unsigned layerMask, unsigned short excludeFlags) const
 {
-    float octantDist = ray.HitDistance(octant->cullingBox);
-    if (octantDist >= maxDistance)
-        return;
-
-    std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
 
     for (auto it = octantNodes.begin(); it != octantNodes.end(); ++it)
     {
         OctreeNode* node = *it;
-        if ((node->Flags() & nodeFlags) == nodeFlags && (node->LayerMask() & layerMask))
-            node->OnRaycast(result, ray, maxDistance);
+        if ((node->Flags() & nodeFlags) == nodeFlags && !(node->Flags() & excludeFlags) && (node->LayerMask() & layerMask))
+            result.push_back(node);
     }
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
     {
         if (octant->children[i])
-            CollectNodes(result, octant->children[i], ray, nodeFlags, maxDistance, layerMask);
+            CollectNodes(result, octant->children[i], nodeFlags, layerMask, excludeFlags);
     }
 }
 
-void Octree::CollectNodes(std::vector<std::pair<OctreeNode*, float> >& result, Octant* octant, const Ray& ray, unsigned short nodeFlags,
+void Octree::CollectNodes(std::vector<RaycastResult>& result, const Octant* octant, const Ray& ray, unsigned short nodeFlags, 
     float maxDistance, unsigned layerMask) const
 {
     float octantDist = ray.HitDistance(octant->cullingBox);
     if (octantDist >= maxDistance)
         return;
 
-    std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
 
     for (auto it = octantNodes.begin(); it != octantNodes.end(); ++it)
     {
         OctreeNode* node = *it;
         if ((node->Flags() & nodeFlags) == nodeFlags && (node->LayerMask() & layerMask))
-        {
-            float distance = ray.HitDistance(node->WorldBoundingBox());
-            if (distance < maxDistance)
-                result.push_back(std::make_pair(node, distance));
-        }
+            node->OnRaycast(result, ray, maxDistance);
     }
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
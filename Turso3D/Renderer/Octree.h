@@ -3,17 +3,33 @@
 #pragma once
 
 #include "../Math/Frustum.h"
+#include "../Math/Ray.h"
 #include "../Time/Profiler.h"
 #include "../Object/Allocator.h"
+#include "../Object/AutoPtr.h"
+#include "../Scene/TransformUpdater.h"
+#include "../Thread/WorkQueue.h"
+#include "OcclusionBuffer.h"
 #include "OctreeNode.h"
 
 #include <algorithm>
+#include <atomic>
 
 static const size_t NUM_OCTANTS = 8;
+static const size_t NODES_PER_TEST = 32;
+static const size_t UPDATE_QUEUE_CHUNK_SIZE = 1024;
+static const size_t MAX_UPDATE_QUEUE_CHUNKS = 32;
+static const size_t NODES_PER_REINSERT_TASK = 256;
+static const size_t BOXES_PER_TRANSFORM_TASK = 1024;
+static const size_t OCTANTS_PER_SORT_TASK = 16;
+static const unsigned DEFAULT_SPLIT_THRESHOLD = 32;
+static const size_t BVH_MAX_LEAF_NODES = 64;
+static const size_t BVH_SAH_BINS = 16;
+static const int BVH_LEVELS_PER_OCTREE_LEVEL = 3;
 
 class Octree;
 class OctreeNode;
-class Ray;
+struct OctantBatchCache;
 
 /// Structure for raycast query results.
 struct RaycastResult
@@ -30,11 +46,47 @@ struct RaycastResult
     size_t subObject;
 };
 
+/// Four rays in structure-of-arrays layout for batched raycasts.
+struct RayPacket
+{
+    /// Origin X coordinates.
+    float originX[4];
+    /// Origin Y coordinates.
+    float originY[4];
+    /// Origin Z coordinates.
+    float originZ[4];
+    /// Reciprocal direction X coordinates, clamped to finite values.
+    float invDirX[4];
+    /// Reciprocal direction Y coordinates, clamped to finite values.
+    float invDirY[4];
+    /// Reciprocal direction Z coordinates, clamped to finite values.
+    float invDirZ[4];
+    /// Closest hit distance so far. Negative for unused lanes.
+    float closest[4];
+    /// Source rays.
+    const Ray* rays[4];
+};
+
+/// Part of a frustum query that has been split for parallel processing.
+struct OctreeSubtree
+{
+    /// Octant to process, or null to process a static geometry BVH node.
+    const Octant* octant;
+    /// BVH node index to process if octant is null.
+    unsigned bvhNode;
+    /// Plane mask. If recursive, this is the parent's mask and the octant is tested again; otherwise the octant's own mask.
+    unsigned char planeMask;
+    /// Whether to process child octants.
+    bool recursive;
+};
+
 /// %Octree cell, contains up to 8 child octants.
 struct Octant
 {
     /// Construct.
     Octant();
+    /// Destruct.
+    ~Octant();
    
     /// Initialize parent and bounds.
     void Initialize(Octant* parent, const BoundingBox& boundingBox, int level);
@@ -42,11 +94,35 @@ struct Octant
     bool FitBoundingBox(const BoundingBox& box, const Vector3& boxSize) const;
     /// Return child octant index based on position.
     size_t ChildIndex(const Vector3& position) const { size_t ret = position.x < center.x ? 0 : 1; ret += position.y < center.y ? 0 : 2; ret += position.z < center.z ? 0 : 4; return ret; }
+    /// Copy the culling data of nodes from an index onward.
+    void UpdateCullingData(size_t startIndex = 0);
+    /// Return a bitmask of up to 32 nodes starting from an index that match the layer mask and are inside the frustum. Planes set in the plane mask are not tested.
+    unsigned TestNodes(size_t startIndex, const Frustum& frustum, unsigned char planeMask, unsigned layerMask) const;
     
     /// Nodes contained in the octant.
     std::vector<OctreeNode*> nodes;
-    /// Node sorting dirty.
+    /// Node bounding box minimum X coordinates. The culling data is in structure-of-arrays layout, index-aligned with the nodes vector.
+    std::vector<float> nodeMinX;
+    /// Node bounding box minimum Y coordinates.
+    std::vector<float> nodeMinY;
+    /// Node bounding box minimum Z coordinates.
+    std::vector<float> nodeMinZ;
+    /// Node bounding box maximum X coordinates.
+    std::vector<float> nodeMaxX;
+    /// Node bounding box maximum Y coordinates.
+    std::vector<float> nodeMaxY;
+    /// Node bounding box maximum Z coordinates.
+    std::vector<float> nodeMaxZ;
+    /// Node layer masks.
+    std::vector<unsigned> nodeLayerMasks;
+    /// Node flags.
+    std::vector<unsigned short> nodeFlags;
+    /// Node sorting and culling data dirty.
     bool sortDirty;
+    /// Queued for a sparseness check in adaptive mode.
+    bool mergeQueued;
+    /// Whether is a leaf of the static geometry BVH instead of being part of the octant hierarchy.
+    bool bvhLeaf;
     /// Expanded (loose) bounding box used for culling the octant and the nodes within it.
     BoundingBox cullingBox;
     /// Actual bounding box of the octant.
@@ -63,9 +139,28 @@ struct Octant
     Octant* parent;
     /// Number of nodes in this octant and the child octants combined.
     size_t numNodes;
+    /// Incremented whenever the nodes or their culling data change.
+    unsigned version;
+    /// Octree generation of the last insertion, removal or move of the octant's own nodes.
+    unsigned changeGeneration;
+    /// Octree generation of the last change in the octant or its child octants, including deleted ones.
+    unsigned subtreeGeneration;
+    /// Cached batches of the static geometry. Used by Renderer.
+    mutable AutoPtr<OctantBatchCache> batchCache;
 };
 
-/// Acceleration structure for rendering. Should be created as a child of the scene root.
+/// Node of the bounding volume hierarchy for static geometry. Stored in depth-first order, so that the first child directly follows its parent.
+struct BVHNode
+{
+    /// Bounding box of the contained scene nodes.
+    BoundingBox box;
+    /// Index of the second child. Zero for a leaf.
+    unsigned secondChild;
+    /// Octant holding the scene nodes of a leaf, not linked to the octant hierarchy. Null for an inner node.
+    Octant* leaf;
+};
+
+/// Acceleration structure for rendering. Should be created as a child of the scene root. Queries are const and reentrant. Threads other than the main thread may query concurrently inside a read phase, which is guaranteed not to overlap an update or other structural change.
 class Octree : public Node
 {
     OBJECT(Octree);
@@ -79,45 +174,124 @@ public:
     /// Register factory and attributes.
     static void RegisterObject();
     
-    /// Process the queue of nodes to be reinserted. Then sort nodes inside changed octants.
+    /// Process the queue of nodes to be reinserted, finding the new octants in parallel. Then sort nodes inside changed octants. Must not be called while other threads queue updates.
     void Update(unsigned short frameNumber);
-    /// Resize octree.
+    /// Resize octree. In adaptive mode the number of levels is the maximum depth, and grows along with the root.
     void Resize(const BoundingBox& boundingBox, int numLevels);
+    /// Set adaptive mode. When enabled, octants split once they contain more nodes than the threshold, merge when the whole branch falls below half of it, and the root grows to cover nodes that leave the bounds.
+    void SetAdaptive(bool enable);
+    /// Set node count threshold for splitting octants in adaptive mode.
+    void SetSplitThreshold(unsigned threshold);
+    /// Set whether to store static geometry in a separate SAH-built bounding volume hierarchy, which is queried along with the octants. The hierarchy is rebuilt when static geometry is added or moves outside its leaf.
+    void SetStaticBVH(bool enable);
+    /// Set whether to update the world transforms of the reinserted nodes in a batch sorted by hierarchy depth, in parallel where possible. Otherwise they are updated serially through the parent chains. Default true.
+    void SetBatchTransforms(bool enable);
     /// Remove a node from the octree.
     void RemoveNode(OctreeNode* node);
-    /// Queue a reinsertion for a node.
+    /// Remove all inserted and queued nodes at once, deleting the child octants and the BVH without updating them per node. The nodes are left without an octree until they are added to a scene again.
+    void RemoveAllNodes();
+    /// Queue a reinsertion for a node. Safe to call from any thread, as long as each node is modified by only one thread at a time.
     void QueueUpdate(OctreeNode* node);
-    /// Cancel a pending reinsertion.
+    /// Cancel a pending reinsertion. Safe to call from any thread, as long as each node is modified by only one thread at a time.
     void CancelUpdate(OctreeNode* node);
+    /// Notify of a node in the octree changing from static to dynamic or vice versa. Called by OctreeNode.
+    void OnStaticChanged(OctreeNode* node);
+    /// Begin a read phase for querying from another thread. Waits for an ongoing update or structural change to finish. Structural changes wait until all read phases have ended, so nodes must not be removed from the octree inside a read phase.
+    void BeginRead() const;
+    /// End a read phase.
+    void EndRead() const;
+
+    /// Return whether adaptive mode is enabled.
+    bool IsAdaptive() const { return adaptive; }
+    /// Return node count threshold for splitting octants in adaptive mode.
+    unsigned SplitThreshold() const { return splitThreshold; }
+    /// Return whether static geometry is stored in a bounding volume hierarchy.
+    bool StaticBVH() const { return staticBVH; }
+    /// Return whether world transforms are updated in a batch.
+    bool BatchTransforms() const { return batchTransforms; }
+    /// Return number of nodes in the static geometry bounding volume hierarchy.
+    size_t NumBVHNodes() const { return bvhNodes.size(); }
+    /// Return a counter incremented whenever nodes are reinserted or removed. Unchanged between updates when no node has moved.
+    unsigned Generation() const { return generation; }
+    /// Return whether nodes have been inserted, removed or moved within a world space box after the given generation. Only the octants overlapping the box are visited. Conservative: changes in octants whose loose bounds overlap the box, in the root octant, or a static geometry BVH rebuild overlapping the box count as changes.
+    bool ChangedSince(const BoundingBox& box, unsigned sinceGeneration) const;
+    /// Return a counter incremented whenever static nodes are inserted, reinserted or removed, or nodes change between static and dynamic. Caches of static geometry stay valid while it is unchanged.
+    unsigned StaticGeneration() const { return staticGeneration; }
+    /// Return the root octant.
+    const Octant* Root() const { return &root; }
+    /// Return a box that contains all nodes: the loose bounds of the root octant, merged with the nodes of the root octant, which may lie outside it, and the static geometry BVH. Conservative, and does not shrink when nodes are removed.
+    BoundingBox NodeBounds() const;
     /// Query for nodes with a raycast and return all results.
-    void Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL);
-    /// Query for nodes with a raycast and return the closest result.
-    RaycastResult RaycastSingle(const Ray& ray, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL);
+    void Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for nodes with a raycast and return the closest result. The octants are visited front to back along the ray and skipped when beyond the closest hit so far, so the cost is mostly proportional to the nearest hit. Returns infinite distance and a null node if nothing was hit.
+    RaycastResult RaycastSingle(const Ray& ray, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for the closest hit of each ray in a batch. The octree is traversed once per packet of four rays, using the octants' node culling data for the coarse tests. Rays that hit nothing get infinite distance and a null node.
+    void RaycastBatch(RaycastResult* results, const Ray* rays, size_t numRays, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
+
+    /// Query for nodes using a volume such as frustum or sphere. Nodes with any of the exclude flags set are skipped.
+    template <class T> void FindNodes(std::vector<OctreeNode*>& result, const T& volume, unsigned short nodeFlags, unsigned layerMask = LAYERMASK_ALL, unsigned short excludeFlags = 0) const
+    {
+        CollectNodes(result, &root, volume, nodeFlags, layerMask, excludeFlags);
+        // The BVH contains only static geometry
+        if (bvhNodes.size() && !(excludeFlags & NF_STATIC))
+            CollectBVHNodes(result, 0, volume, nodeFlags, layerMask, false);
+    }
 
-    /// Query for nodes using a volume such as frustum or sphere.
-    template <class T> void FindNodes(std::vector<OctreeNode*>& result, const T& volume, unsigned short nodeFlags, unsigned layerMask = LAYERMASK_ALL)
+    /// Query for all pairs of nodes whose world bounding boxes overlap, for example for a physics broadphase. Both nodes of a pair must have the node flags, match the layer mask and have none of the exclude flags. Each node descends the octants whose culling box it overlaps, using their node culling data, in parallel across nodes if the WorkQueue subsystem exists. Writes up to maxPairs pairs to the destination in no particular order and returns the total number found. If that is larger than the buffer, the query should be repeated with a larger one. Nodes in the static geometry BVH are not included.
+    size_t FindOverlappingPairs(std::pair<OctreeNode*, OctreeNode*>* dest, size_t maxPairs, unsigned short nodeFlags, unsigned layerMask = LAYERMASK_ALL, unsigned short excludeFlags = 0) const;
+    /// Query for all nodes regardless of position. Nodes with any of the exclude flags set are skipped. Nodes in the static geometry BVH are not included.
+    void FindAllNodes(std::vector<OctreeNode*>& result, unsigned short nodeFlags, unsigned layerMask = LAYERMASK_ALL, unsigned short excludeFlags = 0) const
     {
-        CollectNodes(result, &root, volume, nodeFlags, layerMask);
+        CollectNodes(result, &root, nodeFlags, layerMask, excludeFlags);
     }
 
     /// Query for nodes using a volume such as frustum or sphere. Invoke a member function for each octant.
-    template <class T, class U> void FindNodes(const T& volume, U* object, void (U::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool))
+    template <class T, class U> void FindNodes(const T& volume, U* object, void (U::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool)) const
     {
         CollectNodesMemberCallback(&root, volume, object, callback);
+        if (bvhNodes.size())
+            CollectBVHMemberCallback(0, volume, object, callback, false);
     }
 
-    /// Collect nodes matching flags using a frustum and masked testing.
-    void FindNodesMasked(std::vector<OctreeNode*>& result, const Frustum& frustum, unsigned short nodeFlags, unsigned layerMask = LAYERMASK_ALL)
+    /// Collect nodes matching flags using a frustum and masked testing. Nodes with any of the exclude flags set are skipped.
+    void FindNodesMasked(std::vector<OctreeNode*>& result, const Frustum& frustum, unsigned short nodeFlags, unsigned layerMask = LAYERMASK_ALL, unsigned short excludeFlags = 0) const
     {
-        CollectNodesMasked(result, &root, frustum, nodeFlags, layerMask);
+        CollectNodesMasked(result, &root, frustum, nodeFlags, layerMask, 0, excludeFlags);
+        if (bvhNodes.size() && !(excludeFlags & NF_STATIC))
+            CollectBVHNodesMasked(result, 0, frustum, nodeFlags, layerMask, 0);
     }
 
-    /// Collect nodes matching flags using a frustum and masked testing. Invoke a member callback for each octant, with current mask provided.
-    template <class T> void FindNodesMasked(const Frustum& frustum, T* object, void (T::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, unsigned char))
+    /// Collect nodes matching flags using a frustum and masked testing. Invoke a member callback for each octant with nodes, with current mask provided. Octants can optionally be occlusion tested.
+    template <class T> void FindNodesMasked(const Frustum& frustum, T* object, void (T::*callback)(const Octant*, unsigned char), const OcclusionBuffer* occlusion = nullptr) const
     {
-        CollectNodesMaskedMemberCallback(&root, frustum, object, callback);
+        CollectNodesMaskedMemberCallback(&root, frustum, object, callback, 0, occlusion);
+        if (bvhNodes.size())
+            CollectBVHMaskedMemberCallback(0, frustum, object, callback, 0, occlusion);
     }
 
+    /// Split a masked frustum query into independent subtrees for parallel processing. Octants above the split depth are tested immediately and returned as non-recursive parts for their own nodes. The static geometry BVH is split to a similar number of subtrees.
+    void SplitQueryMasked(std::vector<OctreeSubtree>& result, const Frustum& frustum, int splitDepth) const
+    {
+        SplitQueryMasked(result, &root, frustum, splitDepth, 0);
+        if (bvhNodes.size())
+            SplitBVHQueryMasked(result, 0, frustum, splitDepth * BVH_LEVELS_PER_OCTREE_LEVEL, 0);
+    }
+
+    /// Continue a split masked frustum query on one subtree. Invoke a member callback for each octant with nodes, with current mask provided. Octants can optionally be occlusion tested.
+    template <class T> void FindNodesMasked(const OctreeSubtree& subtree, const Frustum& frustum, T* object, void (T::*callback)(const Octant*, unsigned char), const OcclusionBuffer* occlusion = nullptr) const
+    {
+        if (!subtree.octant)
+            CollectBVHMaskedMemberCallback(subtree.bvhNode, frustum, object, callback, subtree.planeMask, occlusion);
+        else if (subtree.recursive)
+            CollectNodesMaskedMemberCallback(subtree.octant, frustum, object, callback, subtree.planeMask, occlusion);
+        else if (!occlusion || occlusion->IsVisible(subtree.octant->cullingBox))
+            (object->*callback)(subtree.octant, subtree.planeMask);
+    }
+
+protected:
+    /// Handle being assigned to a new scene. Remove all nodes when leaving the scene, as they no longer find this octree.
+    void OnSceneSet(Scene* newScene, Scene* oldScene) override;
+
 private:
     /// Set bounding box. Used in serialization.
     void SetBoundingBoxAttr(const BoundingBox& boundingBox);
@@ -127,8 +301,68 @@ private:
     void SetNumLevelsAttr(int numLevels);
     /// Return number of levels. Used in serialization.
     int NumLevelsAttr() const;
-    /// Add node to a specific octant.
-    void AddNode(OctreeNode* node, Octant* octant);
+    /// Return a slot of the concurrent update queue, allocating its chunk if necessary.
+    std::atomic<OctreeNode*>& QueueSlot(size_t index);
+    /// Move the nodes of the concurrent update queue to the processing queue, skipping canceled entries and duplicates.
+    void DrainUpdateQueue();
+    /// Transform the world bounding boxes of the queued nodes that have a local bounding box in a batch, in parallel if there are enough.
+    void UpdateBoundingBoxes();
+    /// Work function for transforming a range of the batched bounding boxes.
+    void UpdateBoundingBoxesWork(Task* task, unsigned threadIndex);
+    /// Work function for finding the new octants of a range of queued nodes.
+    void FindReinsertTargetsWork(Task* task, unsigned threadIndex);
+    /// Find the new octant of a queued node without creating child octants.
+    void FindReinsertTarget(size_t index);
+    /// Work function for sorting and updating the culling data of a range of changed octants.
+    void SortOctantsWork(Task* task, unsigned threadIndex);
+    /// Remove the nodes that have been moved to other octants from an octant.
+    void RemoveMovedNodes(Octant* octant);
+    /// Move the nodes of an octant that fit a child octant into the children. Used in adaptive mode.
+    void SplitOctant(Octant* octant);
+    /// Move the nodes of all child octants into an octant and delete the children. Used in adaptive mode.
+    void MergeOctant(Octant* octant);
+    /// Move the nodes of a child octant branch into an octant recursively and delete the branch.
+    void MergeChildOctant(Octant* octant, size_t index);
+    /// Enlarge the root to cover a bounding box, doubling its size as many times as necessary. Used in adaptive mode.
+    void GrowRoot(const BoundingBox& box);
+    /// Begin a structural change on the main thread. Waits until all read phases have ended. Can be nested.
+    void BeginWrite();
+    /// End a structural change.
+    void EndWrite();
+    /// Return whether a node should be stored in the static geometry BVH.
+    bool UseBVH(const OctreeNode* node) const { return staticBVH && (node->Flags() & (NF_STATIC | NF_GEOMETRY)) == (NF_STATIC | NF_GEOMETRY); }
+    /// Rebuild the static geometry BVH from the current leaves and the pending nodes.
+    void RebuildBVH();
+    /// Build a BVH node and its children from a range of the pending nodes. Return the node index.
+    unsigned BuildBVH(size_t start, size_t end);
+    /// Delete the static geometry BVH. Moves any nodes out of it.
+    void DeleteBVH(bool deletingOctree);
+    /// Test a ray packet against an octant and its children, updating the closest hits.
+    void CollectNodesBatch(const Octant* octant, RayPacket& packet, unsigned activeMask, size_t childOrder, RaycastResult* results, std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Test a ray packet against the static geometry BVH recursively, updating the closest hits.
+    void CollectBVHNodesBatch(unsigned index, RayPacket& packet, unsigned activeMask, RaycastResult* results, std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Test a ray packet against the nodes of one octant, updating the closest hits.
+    void TestNodesBatch(const Octant* octant, RayPacket& packet, unsigned activeMask, RaycastResult* results, std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Test a ray against an octant and its children, visiting the children front to back and updating the closest hit.
+    void CollectNodesSingle(const Octant* octant, const Ray& ray, size_t childOrder, RaycastResult& result, std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Test a ray against the static geometry BVH recursively, visiting the nearer child first and updating the closest hit.
+    void CollectBVHNodesSingle(unsigned index, const Ray& ray, float distance, RaycastResult& result, std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Test a ray against the nodes of one octant, updating the closest hit.
+    void TestNodesSingle(const Octant* octant, const Ray& ray, RaycastResult& result, std::vector<RaycastResult>& hits, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Split a masked frustum query of the static geometry BVH into subtrees recursively.
+    void SplitBVHQueryMasked(std::vector<OctreeSubtree>& result, unsigned index, const Frustum& frustum, int depth, unsigned char planeMask) const;
+    /// Queue an octant for node sorting and culling data update. Also marks it changed.
+    void SetOctantDirty(Octant* octant);
+    /// Stamp an octant and its parents with the current generation.
+    void MarkOctantChanged(Octant* octant);
+    /// Return whether an octant or its children have changed within a box after the given generation.
+    bool OctantChangedSince(const Octant* octant, const BoundingBox& box, unsigned sinceGeneration) const;
+    /// Return whether the leaves of a static geometry BVH node have changed within a box after the given generation.
+    bool BVHChangedSince(unsigned index, const BoundingBox& box, unsigned sinceGeneration) const;
+    /// Add a group of moved nodes to their new octant. The nodes are sorted by pointer.
+    void AddNodes(Octant* octant, size_t start, size_t end);
+    /// Sort the nodes of a changed octant and write their culling data.
+    void SortNodes(Octant* octant);
     /// Remove node from an octant.
     void RemoveNode(OctreeNode* node, Octant* octant);
     /// Create a new child octant.
@@ -137,17 +371,17 @@ private:
     void DeleteChildOctant(Octant* octant, size_t index);
     /// Delete a child octant hierarchy. If not deleting the octree for good, moves any nodes back to the root octant.
     void DeleteChildOctants(Octant* octant, bool deletingOctree);
+    /// Split a masked frustum query into subtrees recursively.
+    void SplitQueryMasked(std::vector<OctreeSubtree>& result, const Octant* octant, const Frustum& frustum, int depth, unsigned char planeMask) const;
     /// Get all nodes from an octant recursively.
-    void CollectNodes(std::vector<OctreeNode*>& result, Octant* octant) const;
+    void CollectNodes(std::vector<OctreeNode*>& result, const Octant* octant) const;
     /// Get all visible nodes matching flags from an octant recursively.
-    void CollectNodes(std::vector<OctreeNode*>& result, Octant* octant, unsigned short nodeFlags, unsigned layerMask) const;
+    void CollectNodes(std::vector<OctreeNode*>& result, const Octant* octant, unsigned short nodeFlags, unsigned layerMask, unsigned short excludeFlags = 0) const;
     /// Get all visible nodes matching flags along a ray.
-    void CollectNodes(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const;
-    /// Get all visible nodes matching flags that could be potential raycast hits.
-    void CollectNodes(std::vector<std::pair<OctreeNode*, float> >& result, Octant* octant, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const;
+    void CollectNodes(std::vector<RaycastResult>& result, const Octant* octant, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const;
 
     /// Collect nodes matching flags using a volume such as frustum or sphere.
-    template <class T> void CollectNodes(std::vector<OctreeNode*>& result, Octant* octant, const T& volume, unsigned short nodeFlags, unsigned layerMask) const
+    template <class T> void CollectNodes(std::vector<OctreeNode*>& result, const Octant* octant, const T& volume, unsigned short nodeFlags, unsigned layerMask, unsigned short excludeFlags = 0) const
     {
         Intersection res = volume.IsInside(octant->cullingBox);
         if (res == OUTSIDE)
@@ -155,15 +389,15 @@ private:
         
         // If this octant is completely inside the volume, can include all contained octants and their nodes without further tests
         if (res == INSIDE)
-            CollectNodes(result, octant, nodeFlags, layerMask);
+            CollectNodes(result, octant, nodeFlags, layerMask, excludeFlags);
         else
         {
-            std::vector<OctreeNode*>& octantNodes = octant->nodes;
+            const std::vector<OctreeNode*>& octantNodes = octant->nodes;
 
             for (auto it = octantNodes.begin(); it != octantNodes.end(); ++it)
             {
                 OctreeNode* node = *it;
-                if ((node->Flags() & nodeFlags) == nodeFlags && (node->LayerMask() & layerMask) &&
+                if ((node->Flags() & nodeFlags) == nodeFlags && !(node->Flags() & excludeFlags) && (node->LayerMask() & layerMask) &&
                     volume.IsInsideFast(node->WorldBoundingBox()) != OUTSIDE)
                     result.push_back(node);
             }
@@ -171,15 +405,15 @@ private:
             for (size_t i = 0; i < NUM_OCTANTS; ++i)
             {
                 if (octant->children[i])
-                    CollectNodes(result, octant->children[i], volume, nodeFlags, layerMask);
+                    CollectNodes(result, octant->children[i], volume, nodeFlags, layerMask, excludeFlags);
             }
         }
     }
 
     /// Collect nodes from octant and child octants. Invoke a member function for each octant.
-    template <class T> void CollectNodesMemberCallback(Octant* octant, T* object, void (T::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool)) const
+    template <class T> void CollectNodesMemberCallback(const Octant* octant, T* object, void (T::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool)) const
     {
-        std::vector<OctreeNode*>& octantNodes = octant->nodes;
+        const std::vector<OctreeNode*>& octantNodes = octant->nodes;
 
         if (octantNodes.size())
             (object->*callback)(octantNodes.begin(), octantNodes.end(), true);
@@ -192,7 +426,7 @@ private:
     }
 
     /// Collect nodes using a volume such as frustum or sphere. Invoke a member function for each octant.
-    template <class T, class U> void CollectNodesMemberCallback(Octant* octant, const T& volume, U* object, void (U::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool)) const
+    template <class T, class U> void CollectNodesMemberCallback(const Octant* octant, const T& volume, U* object, void (U::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool)) const
     {
         Intersection res = volume.IsInside(octant->cullingBox);
         if (res == OUTSIDE)
@@ -203,7 +437,7 @@ private:
             CollectNodesMemberCallback(octant, object, callback);
         else
         {
-            std::vector<OctreeNode*>& octantNodes = octant->nodes;
+            const std::vector<OctreeNode*>& octantNodes = octant->nodes;
 
             if (octantNodes.size())
                 (object->*callback)(octantNodes.begin(), octantNodes.end(), false);
@@ -216,8 +450,8 @@ private:
         }
     }
 
-    /// Collect nodes using a frustum and masked testing.
-    void CollectNodesMasked(std::vector<OctreeNode*>& result, Octant* octant, const Frustum& frustum, unsigned short nodeFlags, unsigned layerMask, unsigned char planeMask = 0) const
+    /// Collect nodes using a frustum and masked testing. Uses the octants' node culling data to avoid accessing the nodes.
+    void CollectNodesMasked(std::vector<OctreeNode*>& result, const Octant* octant, const Frustum& frustum, unsigned short nodeFlags, unsigned layerMask, unsigned char planeMask = 0, unsigned short excludeFlags = 0) const
     {
         if (planeMask != 0x3f)
         {
@@ -226,25 +460,29 @@ private:
                 return;
         }
 
-        std::vector<OctreeNode*>& octantNodes = octant->nodes;
-     
-        for (auto it = octantNodes.begin(); it != octantNodes.end(); ++it)
+        const std::vector<OctreeNode*>& octantNodes = octant->nodes;
+
+        for (size_t i = 0; i < octantNodes.size(); i += NODES_PER_TEST)
         {
-            OctreeNode* node = *it;
-            if ((node->Flags() & nodeFlags) == nodeFlags && (node->LayerMask() & layerMask) && (planeMask == 0x3f || frustum.IsInsideMaskedFast(node->WorldBoundingBox(), planeMask) != OUTSIDE))
-                result.push_back(node);
+            unsigned visible = octant->TestNodes(i, frustum, planeMask, layerMask);
+
+            for (size_t j = i; visible; ++j, visible >>= 1)
+            {
+                if ((visible & 1) && (octant->nodeFlags[j] & nodeFlags) == nodeFlags && !(octant->nodeFlags[j] & excludeFlags))
+                    result.push_back(octantNodes[j]);
+            }
         }
 
         for (size_t i = 0; i < NUM_OCTANTS; ++i)
         {
             if (octant->children[i])
-                CollectNodesMasked(result, octant->children[i], frustum, nodeFlags, layerMask, planeMask);
+                CollectNodesMasked(result, octant->children[i], frustum, nodeFlags, layerMask, planeMask, excludeFlags);
         }
     }
 
-    /// Collect nodes using a frustum and masked testing. Invoke a member function for each octant.
-    template <class T> void CollectNodesMaskedMemberCallback(Octant* octant, const Frustum& frustum, T* object, void (T::*callback)(std::vector<OctreeNode*>::const_iterator, 
-        std::vector<OctreeNode*>::const_iterator, unsigned char), unsigned char planeMask = 0) const
+    /// Collect nodes using a frustum and masked testing, and optionally occlusion testing. Invoke a member function for each octant.
+    template <class T> void CollectNodesMaskedMemberCallback(const Octant* octant, const Frustum& frustum, T* object, void (T::*callback)(const Octant*, unsigned char),
+        unsigned char planeMask = 0, const OcclusionBuffer* occlusion = nullptr) const
     {
         if (planeMask != 0x3f)
         {
@@ -253,28 +491,226 @@ private:
                 return;
         }
 
-        std::vector<OctreeNode*>& octantNodes = octant->nodes;
+        if (occlusion && !occlusion->IsVisible(octant->cullingBox))
+            return;
 
-        if (octantNodes.size())
-            (object->*callback)(octantNodes.begin(), octantNodes.end(), planeMask);
+        if (octant->nodes.size())
+            (object->*callback)(octant, planeMask);
 
         for (size_t i = 0; i < NUM_OCTANTS; ++i)
         {
             if (octant->children[i])
-                CollectNodesMaskedMemberCallback(octant->children[i], frustum, object, callback, planeMask);
+                CollectNodesMaskedMemberCallback(octant->children[i], frustum, object, callback, planeMask, occlusion);
+        }
+    }
+
+    /// Collect nodes matching flags from the static geometry BVH using a volume such as frustum or sphere.
+    template <class T> void CollectBVHNodes(std::vector<OctreeNode*>& result, unsigned index, const T& volume, unsigned short nodeFlags, unsigned layerMask, bool inside) const
+    {
+        const BVHNode& bvhNode = bvhNodes[index];
+
+        if (!inside)
+        {
+            Intersection res = volume.IsInside(bvhNode.box);
+            if (res == OUTSIDE)
+                return;
+            inside = res == INSIDE;
+        }
+
+        if (bvhNode.leaf)
+        {
+            if (inside)
+                CollectNodes(result, bvhNode.leaf, nodeFlags, layerMask);
+            else
+                CollectNodes(result, bvhNode.leaf, volume, nodeFlags, layerMask);
+        }
+        else
+        {
+            CollectBVHNodes(result, index + 1, volume, nodeFlags, layerMask, inside);
+            CollectBVHNodes(result, bvhNode.secondChild, volume, nodeFlags, layerMask, inside);
+        }
+    }
+
+    /// Collect nodes from the static geometry BVH using a volume such as frustum or sphere. Invoke a member function for each leaf.
+    template <class T, class U> void CollectBVHMemberCallback(unsigned index, const T& volume, U* object, void (U::*callback)(std::vector<OctreeNode*>::const_iterator, std::vector<OctreeNode*>::const_iterator, bool), bool inside) const
+    {
+        const BVHNode& bvhNode = bvhNodes[index];
+
+        if (!inside)
+        {
+            Intersection res = volume.IsInside(bvhNode.box);
+            if (res == OUTSIDE)
+                return;
+            inside = res == INSIDE;
+        }
+
+        if (bvhNode.leaf)
+        {
+            const std::vector<OctreeNode*>& leafNodes = bvhNode.leaf->nodes;
+            if (leafNodes.size())
+                (object->*callback)(leafNodes.begin(), leafNodes.end(), inside);
+        }
+        else
+        {
+            CollectBVHMemberCallback(index + 1, volume, object, callback, inside);
+            CollectBVHMemberCallback(bvhNode.secondChild, volume, object, callback, inside);
         }
     }
 
-    /// Queue of nodes to be reinserted.
+    /// Collect nodes from the static geometry BVH along a ray.
+    template <class T> void CollectBVHRaycast(std::vector<T>& result, unsigned index, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const
+    {
+        const BVHNode& bvhNode = bvhNodes[index];
+        if (ray.HitDistance(bvhNode.box) >= maxDistance)
+            return;
+
+        if (bvhNode.leaf)
+            CollectNodes(result, bvhNode.leaf, ray, nodeFlags, maxDistance, layerMask);
+        else
+        {
+            CollectBVHRaycast(result, index + 1, ray, nodeFlags, maxDistance, layerMask);
+            CollectBVHRaycast(result, bvhNode.secondChild, ray, nodeFlags, maxDistance, layerMask);
+        }
+    }
+
+    /// Collect nodes from the static geometry BVH using a frustum and masked testing.
+    void CollectBVHNodesMasked(std::vector<OctreeNode*>& result, unsigned index, const Frustum& frustum, unsigned short nodeFlags, unsigned layerMask, unsigned char planeMask) const
+    {
+        const BVHNode& bvhNode = bvhNodes[index];
+
+        if (planeMask != 0x3f)
+        {
+            planeMask = frustum.IsInsideMasked(bvhNode.box, planeMask);
+            if (planeMask == 0xff)
+                return;
+        }
+
+        if (bvhNode.leaf)
+            CollectNodesMasked(result, bvhNode.leaf, frustum, nodeFlags, layerMask, planeMask);
+        else
+        {
+            CollectBVHNodesMasked(result, index + 1, frustum, nodeFlags, layerMask, planeMask);
+            CollectBVHNodesMasked(result, bvhNode.secondChild, frustum, nodeFlags, layerMask, planeMask);
+        }
+    }
+
+    /// Collect nodes from the static geometry BVH using a frustum and masked testing, and optionally occlusion testing. Invoke a member function for each leaf.
+    template <class T> void CollectBVHMaskedMemberCallback(unsigned index, const Frustum& frustum, T* object, void (T::*callback)(const Octant*, unsigned char),
+        unsigned char planeMask, const OcclusionBuffer* occlusion) const
+    {
+        const BVHNode& bvhNode = bvhNodes[index];
+
+        if (planeMask != 0x3f)
+        {
+            planeMask = frustum.IsInsideMasked(bvhNode.box, planeMask);
+            if (planeMask == 0xff)
+                return;
+        }
+
+        if (occlusion && !occlusion->IsVisible(bvhNode.box))
+            return;
+
+        if (bvhNode.leaf)
+        {
+            if (bvhNode.leaf->nodes.size())
+                (object->*callback)(bvhNode.leaf, planeMask);
+        }
+        else
+        {
+            CollectBVHMaskedMemberCallback(index + 1, frustum, object, callback, planeMask, occlusion);
+            CollectBVHMaskedMemberCallback(bvhNode.secondChild, frustum, object, callback, planeMask, occlusion);
+        }
+    }
+
+    /// Chunks of the concurrent queue of nodes to be reinserted. Chunk i holds UPDATE_QUEUE_CHUNK_SIZE << i nodes. Chunks are kept allocated for reuse.
+    std::atomic<std::atomic<OctreeNode*>*> updateQueueChunks[MAX_UPDATE_QUEUE_CHUNKS];
+    /// Number of nodes appended to the concurrent queue.
+    std::atomic<size_t> numQueuedUpdates;
+    /// Nodes to be reinserted, copied from the concurrent queue for processing.
     std::vector<OctreeNode*> updateQueue;
+    /// Destination world bounding boxes of the batched bounding box update.
+    std::vector<BoundingBox*> boxBatchDest;
+    /// Source local bounding boxes of the batched bounding box update.
+    std::vector<const BoundingBox*> boxBatchSource;
+    /// World transforms of the batched bounding box update.
+    std::vector<const Matrix3x4*> boxBatchTransforms;
+    /// New octants of the nodes being reinserted. These may be ancestors of the final octants if child octants need to be created.
+    std::vector<Octant*> reinsertTargets;
+    /// Flags for reinsertions that need child octants to be created before the final octant is known.
+    std::vector<unsigned char> reinsertIncomplete;
+    /// Nodes moved to other octants, paired with the new octant.
+    std::vector<std::pair<Octant*, OctreeNode*> > movedNodes;
+    /// Octants that nodes were moved out of.
+    std::vector<Octant*> vacatedOctants;
+    /// Octants queued for a sparseness check.
+    std::vector<Octant*> mergeOctants;
+    /// Bounding box of nodes that did not fit in the root in adaptive mode.
+    BoundingBox growBox;
+    /// Adaptive mode flag.
+    bool adaptive;
+    /// Node count threshold for splitting octants in adaptive mode.
+    unsigned splitThreshold;
+    /// Static geometry BVH nodes.
+    std::vector<BVHNode> bvhNodes;
+    /// Static geometry waiting for the BVH to be rebuilt.
+    std::vector<OctreeNode*> bvhPendingNodes;
+    /// Static geometry BVH flag.
+    bool staticBVH;
+    /// Octree generation of the last static geometry BVH rebuild.
+    unsigned bvhRebuildGeneration;
+    /// Bounds of the static geometry BVH before and after the last rebuild.
+    BoundingBox bvhRebuildBox;
+    /// Batched world transform update.
+    TransformUpdater transformUpdater;
+    /// Batched world transform update flag.
+    bool batchTransforms;
+    /// Number of active read phases.
+    mutable std::atomic<int> numReaders;
+    /// Structural change in progress flag.
+    std::atomic<bool> writing;
+    /// Structural change nesting depth.
+    int writeDepth;
+    /// Tasks for finding the new octants.
+    std::vector<AutoPtr<RangeTask<Octree> > > reinsertTasks;
+    /// Tasks for transforming the batched bounding boxes.
+    std::vector<AutoPtr<RangeTask<Octree> > > boxTasks;
+    /// Tasks for sorting the changed octants.
+    std::vector<AutoPtr<RangeTask<Octree> > > sortTasks;
     /// Octants which need to have sort order updated.
     std::vector<Octant*> sortDirtyOctants;
-    /// RaycastSingle initial coarse result.
-    std::vector<std::pair<OctreeNode*, float> > initialRes;
-    /// RaycastSingle final result.
-    std::vector<RaycastResult> finalRes;
     /// Allocator for child octants.
     Allocator<Octant> allocator;
     /// Root octant.
     Octant root;
+    /// Counter of reinsertions and removals.
+    unsigned generation;
+    /// Counter of static geometry changes.
+    unsigned staticGeneration;
+};
+
+/// Scoped read phase of an octree.
+class OctreeReadLock
+{
+public:
+    /// Construct and begin the read phase.
+    OctreeReadLock(const Octree* octree_) :
+        octree(octree_)
+    {
+        octree->BeginRead();
+    }
+
+    /// Destruct and end the read phase.
+    ~OctreeReadLock()
+    {
+        octree->EndRead();
+    }
+
+private:
+    /// Prevent copy construction.
+    OctreeReadLock(const OctreeReadLock& rhs);
+    /// Prevent assignment.
+    OctreeReadLock& operator = (const OctreeReadLock& rhs);
+
+    /// Octree being read.
+    const Octree* octree;
 };
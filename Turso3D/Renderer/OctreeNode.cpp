@@ -3,6 +3,8 @@
 #include "../Math/Ray.h"
 #include "../Scene/Scene.h"
 #include "Camera.h"
+#include "GeometryNode.h"
+#include "Material.h"
 #include "Octree.h"
 #include "OctreeNode.h"
 
@@ -44,6 +46,8 @@ void OctreeNode::SetCastShadows(bool enable)
 void OctreeNode::SetMaxDistance(float distance_)
 {
     maxDistance = Max(distance_, 0.0f);
+    // Cached batches of static geometry depend on whether the draw distance is in use
+    SourceBatches::MarkChanged();
 }
 
 bool OctreeNode::OnPrepareRender(unsigned short frameNumber, Camera* camera)
@@ -96,6 +100,14 @@ void OctreeNode::OnTransformChanged()
         impl->octree->QueueUpdate(this);
 }
 
+void OctreeNode::OnStaticChanged()
+{
+    if (impl->octree)
+        impl->octree->OnStaticChanged(this);
+
+    SpatialNode::OnStaticChanged();
+}
+
 void OctreeNode::OnWorldBoundingBoxUpdate() const
 {
     // The OctreeNode base class does not have a defined size, so represent as a point
@@ -103,6 +115,11 @@ void OctreeNode::OnWorldBoundingBoxUpdate() const
     SetFlag(NF_BOUNDING_BOX_DIRTY, false);
 }
 
+const BoundingBox* OctreeNode::LocalBoundingBox() const
+{
+    return nullptr;
+}
+
 void OctreeNode::RemoveFromOctree()
 {
     if (impl->octree)
@@ -121,4 +138,11 @@ void OctreeNode::OnEnabledChanged(bool newEnabled)
         else
             impl->octree->RemoveNode(this);
     }
+}
+
+void OctreeNode::OnLayerChanged()
+{
+    // Reinsert so that the octant's copy of the layer mask is updated
+    if (!TestFlag(NF_OCTREE_UPDATE_QUEUED) && impl->octree && impl->octant)
+        impl->octree->QueueUpdate(this);
 }
\ No newline at end of file
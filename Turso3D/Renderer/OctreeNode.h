@@ -33,7 +33,7 @@ public:
     virtual void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance);
 
     /// Set whether to cast shadows. Default false on both lights and geometries.
-    void SetCastShadows(bool enable);
+    virtual void SetCastShadows(bool enable);
     /// Set max distance for rendering. 0 is unlimited.
     void SetMaxDistance(float distance);
     
@@ -61,8 +61,14 @@ protected:
     void OnTransformChanged() override;
     /// Handle the enabled status changing.
     void OnEnabledChanged(bool newEnabled) override;
+    /// Handle the layer changing.
+    void OnLayerChanged() override;
+    /// Handle the static flag changing.
+    void OnStaticChanged() override;
     /// Recalculate the world space bounding box.
     virtual void OnWorldBoundingBoxUpdate() const;
+    /// Return the local space bounding box that the world space bounding box is transformed from by the world transform, or null if it is calculated otherwise. Used by the octree to update bounding boxes in a batch.
+    virtual const BoundingBox* LocalBoundingBox() const;
 
     /// World space bounding box.
     mutable BoundingBox worldBoundingBox;
@@ -0,0 +1,383 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/Shader.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "Camera.h"
+#include "Material.h"
+#include "Octree.h"
+#include "ParticleEmitter.h"
+#include "Renderer.h"
+
+#include <algorithm>
+#include <glew.h>
+
+static const float DEFAULT_EMISSION_RATE = 32.0f;
+static const float DEFAULT_LIFETIME = 2.0f;
+static const float DEFAULT_SPEED = 1.0f;
+static const float DEFAULT_SPREAD = 15.0f;
+static const float DEFAULT_PARTICLE_SIZE = 0.25f;
+static const float DEFAULT_FADE_START = 0.5f;
+static const Vector3 DEFAULT_DIRECTION(0.0f, 1.0f, 0.0f);
+static const Color DEFAULT_PARTICLE_COLOR(1.0f, 1.0f, 1.0f, 1.0f);
+static const BlendMode DEFAULT_PARTICLE_BLEND_MODE = BLEND_ADDALPHA;
+
+ParticleEmitter::ParticleEmitter() :
+    direction(DEFAULT_DIRECTION),
+    acceleration(Vector3::ZERO),
+    color(DEFAULT_PARTICLE_COLOR),
+    maxParticles(DEFAULT_MAX_PARTICLES),
+    emitIndex(0),
+    simulationSteps(0),
+    emissionRate(DEFAULT_EMISSION_RATE),
+    emissionAccumulator(0.0f),
+    pendingTime(0.0f),
+    minLifetime(DEFAULT_LIFETIME),
+    maxLifetime(DEFAULT_LIFETIME),
+    minSpeed(DEFAULT_SPEED),
+    maxSpeed(DEFAULT_SPEED),
+    spread(DEFAULT_SPREAD),
+    damping(0.0f),
+    startSize(DEFAULT_PARTICLE_SIZE),
+    endSize(DEFAULT_PARTICLE_SIZE),
+    fadeStart(DEFAULT_FADE_START),
+    blendMode(DEFAULT_PARTICLE_BLEND_MODE),
+    reach(0.0f),
+    lastSimulatedFrameNumber(0),
+    emitting(true),
+    buffersDirty(true)
+{
+    material = new Material();
+    material->SetCullMode(CULL_NONE);
+    material->SetUniform(U_MATDIFFCOLOR, color.Data());
+    geometry = new Geometry();
+
+    SetNumGeometries(1);
+    GeometryNode::SetMaterial(0, material);
+    UpdateMaterial();
+    UpdateBoundingBox();
+}
+
+ParticleEmitter::~ParticleEmitter()
+{
+}
+
+void ParticleEmitter::RegisterObject()
+{
+    RegisterFactory<ParticleEmitter>();
+    // The material is owned by the emitter, so do not copy the materials attribute
+    CopyBaseAttributes<ParticleEmitter, OctreeNode>();
+    RegisterDerivedType<ParticleEmitter, GeometryNode>();
+    RegisterAttribute("maxParticles", &ParticleEmitter::MaxParticles, &ParticleEmitter::SetMaxParticles, DEFAULT_MAX_PARTICLES);
+    RegisterAttribute("emissionRate", &ParticleEmitter::EmissionRate, &ParticleEmitter::SetEmissionRate, DEFAULT_EMISSION_RATE);
+    RegisterAttribute("emitting", &ParticleEmitter::IsEmitting, &ParticleEmitter::SetEmitting, true);
+    RegisterAttribute("minLifetime", &ParticleEmitter::MinLifetime, &ParticleEmitter::SetMinLifetimeAttr, DEFAULT_LIFETIME);
+    RegisterAttribute("maxLifetime", &ParticleEmitter::MaxLifetime, &ParticleEmitter::SetMaxLifetimeAttr, DEFAULT_LIFETIME);
+    RegisterAttribute("minSpeed", &ParticleEmitter::MinSpeed, &ParticleEmitter::SetMinSpeedAttr, DEFAULT_SPEED);
+    RegisterAttribute("maxSpeed", &ParticleEmitter::MaxSpeed, &ParticleEmitter::SetMaxSpeedAttr, DEFAULT_SPEED);
+    RegisterRefAttribute("direction", &ParticleEmitter::Direction, &ParticleEmitter::SetDirection, DEFAULT_DIRECTION);
+    RegisterAttribute("spread", &ParticleEmitter::Spread, &ParticleEmitter::SetSpread, DEFAULT_SPREAD);
+    RegisterRefAttribute("acceleration", &ParticleEmitter::Acceleration, &ParticleEmitter::SetAcceleration, Vector3::ZERO);
+    RegisterAttribute("damping", &ParticleEmitter::Damping, &ParticleEmitter::SetDamping, 0.0f);
+    RegisterAttribute("startSize", &ParticleEmitter::StartSize, &ParticleEmitter::SetStartSizeAttr, DEFAULT_PARTICLE_SIZE);
+    RegisterAttribute("endSize", &ParticleEmitter::EndSize, &ParticleEmitter::SetEndSizeAttr, DEFAULT_PARTICLE_SIZE);
+    RegisterRefAttribute("color", &ParticleEmitter::GetColor, &ParticleEmitter::SetColor, DEFAULT_PARTICLE_COLOR);
+    RegisterAttribute("fadeStart", &ParticleEmitter::FadeStart, &ParticleEmitter::SetFadeStart, DEFAULT_FADE_START);
+    RegisterAttribute("blendMode", &ParticleEmitter::BlendModeAttr, &ParticleEmitter::SetBlendModeAttr, (int)DEFAULT_PARTICLE_BLEND_MODE, blendModeNames);
+    RegisterMixedRefAttribute("texture", &ParticleEmitter::TextureAttr, &ParticleEmitter::SetTextureAttr, ResourceRef(Texture::TypeStatic()));
+}
+
+bool ParticleEmitter::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    // The particles have not been simulated yet, or the buffers are being redefined
+    if (buffersDirty)
+        return false;
+
+    return GeometryNode::OnPrepareRender(frameNumber, camera);
+}
+
+void ParticleEmitter::Update(float timeStep)
+{
+    if (buffersDirty)
+        CreateBuffers();
+    if (!stateTexture)
+        return;
+
+    if (emitting)
+        emissionAccumulator += emissionRate * timeStep;
+    else
+        emissionAccumulator = 0.0f;
+
+    // Particles older than the maximum lifetime are gone in any case, so the skipped time does not need to exceed it
+    pendingTime = Min(pendingTime + timeStep, maxLifetime);
+    if (lastFrameNumber == lastSimulatedFrameNumber && simulationSteps)
+        return;
+
+    unsigned emitCount = emissionAccumulator >= 1.0f ? (unsigned)emissionAccumulator : 0;
+    emissionAccumulator -= (float)emitCount;
+    emitCount = std::min(emitCount, maxParticles);
+
+    Renderer* renderer = Subsystem<Renderer>();
+    ShaderProgram* program = renderer ? renderer->SetProgram("Shaders/ParticleSimulate.glsl") : nullptr;
+    if (program)
+    {
+        PROFILE(SimulateParticles);
+
+        Vector3 localDirection = direction.Normalized();
+        const Matrix3x4& worldTransform = WorldTransform();
+
+        glUniformMatrix3x4fv(program->Uniform("emitterMatrix"), 1, GL_FALSE, worldTransform.Data());
+        renderer->SetUniform(program, "emitParams", Vector4((float)emitIndex, (float)emitCount, (float)maxParticles, pendingTime));
+        renderer->SetUniform(program, "lifeParams", Vector4(minLifetime, maxLifetime, minSpeed, maxSpeed));
+        renderer->SetUniform(program, "directionParams", Vector4(localDirection, Cos(spread)));
+        renderer->SetUniform(program, "accelerationParams", Vector4(acceleration, damping));
+        renderer->SetUniform(program, "randomSeed", (float)(simulationSteps & 0xffff));
+
+        stateTexture->BindImage(0, 0, IMAGE_READ_WRITE);
+        renderer->DispatchCompute((maxParticles + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE, 1);
+        Texture::UnbindImage(0);
+        // The vertex shader fetches the results as a texture
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    emitIndex = (emitIndex + emitCount) % maxParticles;
+    pendingTime = 0.0f;
+    lastSimulatedFrameNumber = lastFrameNumber;
+    ++simulationSteps;
+}
+
+void ParticleEmitter::SetMaxParticles(unsigned num)
+{
+    num = std::max(num, 1u);
+    if (num != maxParticles)
+    {
+        maxParticles = num;
+        buffersDirty = true;
+    }
+}
+
+void ParticleEmitter::SetEmissionRate(float rate)
+{
+    emissionRate = Max(rate, 0.0f);
+}
+
+void ParticleEmitter::SetEmitting(bool enable)
+{
+    emitting = enable;
+}
+
+void ParticleEmitter::SetLifetime(float minLifetime_, float maxLifetime_)
+{
+    minLifetime = Max(minLifetime_, M_EPSILON);
+    maxLifetime = Max(maxLifetime_, minLifetime);
+    UpdateBoundingBox();
+}
+
+void ParticleEmitter::SetSpeed(float minSpeed_, float maxSpeed_)
+{
+    minSpeed = minSpeed_;
+    maxSpeed = Max(maxSpeed_, minSpeed);
+    UpdateBoundingBox();
+}
+
+void ParticleEmitter::SetDirection(const Vector3& direction_)
+{
+    direction = direction_.LengthSquared() > M_EPSILON ? direction_ : DEFAULT_DIRECTION;
+}
+
+void ParticleEmitter::SetSpread(float angle)
+{
+    spread = Clamp(angle, 0.0f, 180.0f);
+}
+
+void ParticleEmitter::SetAcceleration(const Vector3& acceleration_)
+{
+    acceleration = acceleration_;
+    UpdateBoundingBox();
+}
+
+void ParticleEmitter::SetDamping(float damping_)
+{
+    damping = Max(damping_, 0.0f);
+}
+
+void ParticleEmitter::SetSize(float startSize_, float endSize_)
+{
+    startSize = Max(startSize_, 0.0f);
+    endSize = Max(endSize_, 0.0f);
+    UpdateBoundingBox();
+}
+
+void ParticleEmitter::SetColor(const Color& color_)
+{
+    color = color_;
+    material->SetUniform(U_MATDIFFCOLOR, color.Data());
+}
+
+void ParticleEmitter::SetFadeStart(float fadeStart_)
+{
+    fadeStart = Clamp(fadeStart_, 0.0f, 1.0f);
+}
+
+void ParticleEmitter::SetTexture(Texture* texture)
+{
+    material->SetTexture(0, texture);
+    UpdateMaterial();
+}
+
+void ParticleEmitter::SetBlendMode(BlendMode mode)
+{
+    blendMode = mode;
+    UpdateMaterial();
+}
+
+Texture* ParticleEmitter::GetTexture() const
+{
+    return material->GetTexture(0);
+}
+
+void ParticleEmitter::OnWorldBoundingBoxUpdate() const
+{
+    Vector3 center = WorldPosition();
+    Vector3 halfSize(reach, reach, reach);
+    worldBoundingBox.Define(center - halfSize, center + halfSize);
+    SetFlag(NF_BOUNDING_BOX_DIRTY, false);
+}
+
+void ParticleEmitter::SetMinLifetimeAttr(float value)
+{
+    SetLifetime(value, Max(maxLifetime, value));
+}
+
+void ParticleEmitter::SetMaxLifetimeAttr(float value)
+{
+    SetLifetime(Min(minLifetime, value), value);
+}
+
+void ParticleEmitter::SetMinSpeedAttr(float value)
+{
+    SetSpeed(value, Max(maxSpeed, value));
+}
+
+void ParticleEmitter::SetMaxSpeedAttr(float value)
+{
+    SetSpeed(Min(minSpeed, value), value);
+}
+
+void ParticleEmitter::SetStartSizeAttr(float value)
+{
+    SetSize(value, endSize);
+}
+
+void ParticleEmitter::SetEndSizeAttr(float value)
+{
+    SetSize(startSize, value);
+}
+
+void ParticleEmitter::SetBlendModeAttr(int mode)
+{
+    if (mode >= 0 && mode < MAX_BLEND_MODES)
+        SetBlendMode((BlendMode)mode);
+}
+
+int ParticleEmitter::BlendModeAttr() const
+{
+    return (int)blendMode;
+}
+
+void ParticleEmitter::SetTextureAttr(const ResourceRef& texture)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetTexture(texture.name.length() ? cache->LoadResource<Texture>(texture.name) : nullptr);
+}
+
+ResourceRef ParticleEmitter::TextureAttr() const
+{
+    return ResourceRef(Texture::TypeStatic(), ResourceName(GetTexture()));
+}
+
+void ParticleEmitter::UpdateBoundingBox()
+{
+    // The particles may trail behind a moving emitter, so the box only covers their reach from the current position, including the acceleration in any direction
+    reach = Max(Abs(minSpeed), Abs(maxSpeed)) * maxLifetime + 0.5f * acceleration.Length() * maxLifetime * maxLifetime + Max(startSize, endSize) * 0.5f;
+
+    SetFlag(NF_BOUNDING_BOX_DIRTY, true);
+    Octree* octree = GetOctree();
+    if (!TestFlag(NF_OCTREE_UPDATE_QUEUED) && Parent() && octree)
+        octree->QueueUpdate(this);
+}
+
+void ParticleEmitter::UpdateMaterial()
+{
+    Pass* pass = material->CreatePass(PASS_ALPHA);
+    pass->SetShader(Subsystem<ResourceCache>()->LoadResource<Shader>("Shaders/Particle.glsl"), GetTexture() ? "DIFFUSEMAP" : "",
+        GetTexture() ? "DIFFUSEMAP" : "");
+    pass->SetRenderState(blendMode, CMP_LESS, true, false);
+    SourceBatches::MarkChanged();
+}
+
+void ParticleEmitter::CreateBuffers()
+{
+    buffersDirty = false;
+    emitIndex = 0;
+    emissionAccumulator = 0.0f;
+    simulationSteps = 0;
+
+    if (!ShaderProgram::IsComputeSupported())
+    {
+        LOGERROR("Compute shaders not supported, can not simulate particles");
+        stateTexture.Reset();
+        geometry->vertexBuffer.Reset();
+        geometry->indexBuffer.Reset();
+        SetGeometry(0, nullptr);
+        return;
+    }
+
+    // Each particle uses two texels in consecutive rows: position and remaining life, velocity and inverse lifetime. Zero life marks unused particles
+    int rows = (int)((maxParticles + PARTICLE_TEXTURE_WIDTH - 1) / PARTICLE_TEXTURE_WIDTH) * 2;
+    std::vector<Vector4> stateData(PARTICLE_TEXTURE_WIDTH * rows, Vector4::ZERO);
+    ImageLevel stateLevel(IntVector2(PARTICLE_TEXTURE_WIDTH, rows), FMT_RGBA32F, &stateData[0]);
+
+    if (!stateTexture)
+        stateTexture = new Texture();
+    stateTexture->Define(TEX_2D, IntVector2(PARTICLE_TEXTURE_WIDTH, rows), FMT_RGBA32F, 1, 1, &stateLevel);
+    stateTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    material->SetTexture(1, stateTexture);
+
+    // The vertex shader reads no attributes but expands the quads from the vertex index, so a single vertex is enough for the vertex declaration
+    if (!geometry->vertexBuffer)
+    {
+        float vertexData[] = { 0.0f, 0.0f, 0.0f };
+        std::vector<VertexElement> vertexElements;
+        vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+        geometry->vertexBuffer = new VertexBuffer();
+        geometry->vertexBuffer->Define(USAGE_DEFAULT, 1, vertexElements, vertexData);
+    }
+
+    size_t numIndices = maxParticles * 6;
+    size_t indexSize = maxParticles * 4 > 0xffff ? sizeof(unsigned) : sizeof(unsigned short);
+    std::vector<unsigned char> indexData(numIndices * indexSize);
+    for (unsigned i = 0; i < maxParticles; ++i)
+    {
+        unsigned quad[] = { i * 4, i * 4 + 1, i * 4 + 2, i * 4 + 2, i * 4 + 3, i * 4 };
+        for (size_t j = 0; j < 6; ++j)
+        {
+            if (indexSize == sizeof(unsigned short))
+                reinterpret_cast<unsigned short*>(&indexData[0])[i * 6 + j] = (unsigned short)quad[j];
+            else
+                reinterpret_cast<unsigned*>(&indexData[0])[i * 6 + j] = quad[j];
+        }
+    }
+
+    if (!geometry->indexBuffer)
+        geometry->indexBuffer = new IndexBuffer();
+    geometry->indexBuffer->Define(USAGE_DEFAULT, numIndices, indexSize, &indexData[0]);
+    geometry->drawStart = 0;
+    geometry->drawCount = numIndices;
+    SetGeometry(0, geometry);
+}
@@ -0,0 +1,189 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Color.h"
+#include "GeometryNode.h"
+
+class Texture;
+
+/// Particle state texture width. Each row pair holds the state of this many particles. Must match TEXTURE_WIDTH in ParticleSimulate.glsl and Particle.glsl.
+static const int PARTICLE_TEXTURE_WIDTH = 256;
+/// Thread group size of the particle simulation. Must match GROUP_SIZE in ParticleSimulate.glsl.
+static const unsigned PARTICLE_GROUP_SIZE = 64;
+/// Default maximum number of particles.
+static const unsigned DEFAULT_MAX_PARTICLES = 256;
+
+/// %Scene node that emits camera-facing particles. The particles are simulated in world space by a compute shader and stay on the GPU in a state texture, from which the vertex shader expands them into quads. Renders with one draw call in the alpha pass using its own material.
+class ParticleEmitter : public GeometryNode
+{
+    OBJECT(ParticleEmitter);
+
+public:
+    /// Construct.
+    ParticleEmitter();
+    /// Destruct.
+    ~ParticleEmitter();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Prepare object for rendering. Calculate distance from camera and mark as rendered for the next simulation step. Called by Renderer. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+
+    /// Advance the simulation by the time step. Emitters not rendered since the previous update only accumulate the time, which is simulated in one step once they are rendered again. Must be called from the main thread, as it dispatches the simulation shader.
+    void Update(float timeStep);
+
+    /// Set maximum number of live particles. Existing particles are cleared.
+    void SetMaxParticles(unsigned num);
+    /// Set particles emitted per second.
+    void SetEmissionRate(float rate);
+    /// Set whether is emitting new particles. Existing particles live out their lifetime.
+    void SetEmitting(bool enable);
+    /// Set particle lifetime range in seconds.
+    void SetLifetime(float minLifetime, float maxLifetime);
+    /// Set initial particle speed range.
+    void SetSpeed(float minSpeed, float maxSpeed);
+    /// Set emission direction in local space.
+    void SetDirection(const Vector3& direction);
+    /// Set emission cone half-angle in degrees around the direction.
+    void SetSpread(float angle);
+    /// Set world space acceleration, such as gravity.
+    void SetAcceleration(const Vector3& acceleration);
+    /// Set velocity damping per second.
+    void SetDamping(float damping);
+    /// Set particle size at the start and end of its life.
+    void SetSize(float startSize, float endSize);
+    /// Set particle color. The alpha fades out toward the end of life.
+    void SetColor(const Color& color);
+    /// Set the fraction of the lifetime after which the particles start fading out.
+    void SetFadeStart(float fadeStart);
+    /// Set particle texture. Null renders soft round particles.
+    void SetTexture(Texture* texture);
+    /// Set blend mode. Default is additive with alpha.
+    void SetBlendMode(BlendMode mode);
+
+    /// Return geometry type.
+    GeometryType GetGeometryType() const override { return GEOM_CUSTOM; }
+    /// Return per-object shader data, which holds the start and end sizes and the fade start.
+    Vector4 InstanceData() const override { return Vector4(startSize, endSize, fadeStart, 0.0f); }
+    /// Return maximum number of live particles.
+    unsigned MaxParticles() const { return maxParticles; }
+    /// Return particles emitted per second.
+    float EmissionRate() const { return emissionRate; }
+    /// Return whether is emitting.
+    bool IsEmitting() const { return emitting; }
+    /// Return minimum lifetime.
+    float MinLifetime() const { return minLifetime; }
+    /// Return maximum lifetime.
+    float MaxLifetime() const { return maxLifetime; }
+    /// Return minimum initial speed.
+    float MinSpeed() const { return minSpeed; }
+    /// Return maximum initial speed.
+    float MaxSpeed() const { return maxSpeed; }
+    /// Return emission direction in local space.
+    const Vector3& Direction() const { return direction; }
+    /// Return emission cone half-angle.
+    float Spread() const { return spread; }
+    /// Return world space acceleration.
+    const Vector3& Acceleration() const { return acceleration; }
+    /// Return velocity damping.
+    float Damping() const { return damping; }
+    /// Return start size.
+    float StartSize() const { return startSize; }
+    /// Return end size.
+    float EndSize() const { return endSize; }
+    /// Return particle color.
+    const Color& GetColor() const { return color; }
+    /// Return fade start fraction.
+    float FadeStart() const { return fadeStart; }
+    /// Return particle texture.
+    Texture* GetTexture() const;
+    /// Return blend mode.
+    BlendMode GetBlendMode() const { return blendMode; }
+
+protected:
+    /// Recalculate the world space bounding box from the reach of the particles. The particles are in world space, so the box is not transformed by the node's rotation and scale.
+    void OnWorldBoundingBoxUpdate() const override;
+
+private:
+    /// Set lifetime minimum. Used in serialization.
+    void SetMinLifetimeAttr(float value);
+    /// Set lifetime maximum. Used in serialization.
+    void SetMaxLifetimeAttr(float value);
+    /// Set speed minimum. Used in serialization.
+    void SetMinSpeedAttr(float value);
+    /// Set speed maximum. Used in serialization.
+    void SetMaxSpeedAttr(float value);
+    /// Set start size. Used in serialization.
+    void SetStartSizeAttr(float value);
+    /// Set end size. Used in serialization.
+    void SetEndSizeAttr(float value);
+    /// Set blend mode. Used in serialization.
+    void SetBlendModeAttr(int mode);
+    /// Return blend mode. Used in serialization.
+    int BlendModeAttr() const;
+    /// Set texture. Used in serialization.
+    void SetTextureAttr(const ResourceRef& texture);
+    /// Return texture. Used in serialization.
+    ResourceRef TextureAttr() const;
+    /// Recalculate the particle reach from the emission parameters and queue an octree update.
+    void UpdateBoundingBox();
+    /// Update the shader and render state of the material.
+    void UpdateMaterial();
+    /// Create the state texture and geometry for the maximum particle count.
+    void CreateBuffers();
+
+    /// Particle material, holding the particle texture and the state texture.
+    SharedPtr<Material> material;
+    /// Particle geometry.
+    SharedPtr<Geometry> geometry;
+    /// Particle state texture.
+    SharedPtr<Texture> stateTexture;
+    /// Emission direction.
+    Vector3 direction;
+    /// World space acceleration.
+    Vector3 acceleration;
+    /// Particle color.
+    Color color;
+    /// Maximum number of live particles.
+    unsigned maxParticles;
+    /// Next particle slot to emit into.
+    unsigned emitIndex;
+    /// Simulation step counter for random seeds.
+    unsigned simulationSteps;
+    /// Particles emitted per second.
+    float emissionRate;
+    /// Fractional particles carried over to the next update.
+    float emissionAccumulator;
+    /// Time accumulated while not rendered.
+    float pendingTime;
+    /// Minimum lifetime.
+    float minLifetime;
+    /// Maximum lifetime.
+    float maxLifetime;
+    /// Minimum initial speed.
+    float minSpeed;
+    /// Maximum initial speed.
+    float maxSpeed;
+    /// Emission cone half-angle.
+    float spread;
+    /// Velocity damping.
+    float damping;
+    /// Start size.
+    float startSize;
+    /// End size.
+    float endSize;
+    /// Fade start fraction.
+    float fadeStart;
+    /// Blend mode.
+    BlendMode blendMode;
+    /// Maximum distance of the particles from the emitter.
+    float reach;
+    /// Last frame number seen in the previous simulation step.
+    unsigned short lastSimulatedFrameNumber;
+    /// Emitting flag.
+    bool emitting;
+    /// Buffers need recreating flag.
+    bool buffersDirty;
+};
@@ -0,0 +1,245 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Log.h"
+#include "Camera.h"
+#include "Octree.h"
+#include "ReflectionProbe.h"
+
+static const int DEFAULT_PROBE_SIZE = 128;
+static const Vector3 DEFAULT_INFLUENCE_SIZE(10.0f, 10.0f, 10.0f);
+static const float DEFAULT_PROBE_NEARCLIP = 0.1f;
+static const float DEFAULT_PROBE_FARCLIP = 100.0f;
+static const float DEFAULT_PROBE_LODBIAS = 0.25f;
+static const ReflectionProbeUpdateMode DEFAULT_UPDATE_MODE = PROBE_UPDATE_ON_CHANGE;
+/// Size of the least detailed, most rough cubemap mip level.
+static const int MIN_PROBE_LEVEL_SIZE = 4;
+
+static const char* updateModeNames[] =
+{
+    "once",
+    "onChange",
+    "always",
+    nullptr
+};
+
+// Face camera directions and up vectors. The cameras flip vertically, which together with these matches the OpenGL cubemap face orientation
+static const Vector3 faceDirections[] =
+{
+    Vector3(1.0f, 0.0f, 0.0f),
+    Vector3(-1.0f, 0.0f, 0.0f),
+    Vector3(0.0f, 1.0f, 0.0f),
+    Vector3(0.0f, -1.0f, 0.0f),
+    Vector3(0.0f, 0.0f, 1.0f),
+    Vector3(0.0f, 0.0f, -1.0f)
+};
+
+static const Vector3 faceUpDirections[] =
+{
+    Vector3(0.0f, 1.0f, 0.0f),
+    Vector3(0.0f, 1.0f, 0.0f),
+    Vector3(0.0f, 0.0f, -1.0f),
+    Vector3(0.0f, 0.0f, 1.0f),
+    Vector3(0.0f, 1.0f, 0.0f),
+    Vector3(0.0f, 1.0f, 0.0f)
+};
+
+ReflectionProbe::ReflectionProbe() :
+    size(DEFAULT_PROBE_SIZE),
+    influenceSize(DEFAULT_INFLUENCE_SIZE),
+    nearClip(DEFAULT_PROBE_NEARCLIP),
+    farClip(DEFAULT_PROBE_FARCLIP),
+    lodBias(DEFAULT_PROBE_LODBIAS),
+    viewMask(M_MAX_UNSIGNED),
+    backgroundColor(Color::BLACK),
+    updateMode(DEFAULT_UPDATE_MODE),
+    nextFace(0),
+    captureGeneration(0),
+    lastGeneration(0),
+    complete(false),
+    dirty(true)
+{
+}
+
+ReflectionProbe::~ReflectionProbe()
+{
+}
+
+void ReflectionProbe::RegisterObject()
+{
+    RegisterFactory<ReflectionProbe>();
+    RegisterDerivedType<ReflectionProbe, SpatialNode>();
+    CopyBaseAttributes<ReflectionProbe, SpatialNode>();
+
+    RegisterAttribute("size", &ReflectionProbe::Size, &ReflectionProbe::SetSize, DEFAULT_PROBE_SIZE);
+    RegisterRefAttribute("influenceSize", &ReflectionProbe::InfluenceSize, &ReflectionProbe::SetInfluenceSize, DEFAULT_INFLUENCE_SIZE);
+    RegisterAttribute("nearClip", &ReflectionProbe::NearClip, &ReflectionProbe::SetNearClip, DEFAULT_PROBE_NEARCLIP);
+    RegisterAttribute("farClip", &ReflectionProbe::FarClip, &ReflectionProbe::SetFarClip, DEFAULT_PROBE_FARCLIP);
+    RegisterAttribute("lodBias", &ReflectionProbe::LodBias, &ReflectionProbe::SetLodBias, DEFAULT_PROBE_LODBIAS);
+    RegisterAttribute("viewMask", &ReflectionProbe::ViewMask, &ReflectionProbe::SetViewMask, M_MAX_UNSIGNED);
+    RegisterRefAttribute("backgroundColor", &ReflectionProbe::BackgroundColor, &ReflectionProbe::SetBackgroundColor, Color::BLACK);
+    RegisterAttribute("updateMode", &ReflectionProbe::UpdateModeAttr, &ReflectionProbe::SetUpdateModeAttr, (int)DEFAULT_UPDATE_MODE, updateModeNames);
+}
+
+void ReflectionProbe::SetSize(int size_)
+{
+    size_ = (int)NextPowerOfTwo((unsigned)Max(size_, MIN_PROBE_LEVEL_SIZE));
+    if (size_ != size)
+    {
+        size = size_;
+        nextFace = 0;
+        Invalidate();
+    }
+}
+
+void ReflectionProbe::SetInfluenceSize(const Vector3& halfSize)
+{
+    influenceSize = Vector3(Max(halfSize.x, 0.0f), Max(halfSize.y, 0.0f), Max(halfSize.z, 0.0f));
+}
+
+void ReflectionProbe::SetNearClip(float nearClip_)
+{
+    nearClip = Max(nearClip_, M_EPSILON);
+    Invalidate();
+}
+
+void ReflectionProbe::SetFarClip(float farClip_)
+{
+    farClip = Max(farClip_, M_EPSILON);
+    Invalidate();
+}
+
+void ReflectionProbe::SetLodBias(float bias)
+{
+    lodBias = Max(bias, M_EPSILON);
+    Invalidate();
+}
+
+void ReflectionProbe::SetViewMask(unsigned mask)
+{
+    viewMask = mask;
+    Invalidate();
+}
+
+void ReflectionProbe::SetBackgroundColor(const Color& color)
+{
+    backgroundColor = color;
+    Invalidate();
+}
+
+void ReflectionProbe::SetUpdateMode(ReflectionProbeUpdateMode mode)
+{
+    updateMode = mode;
+}
+
+void ReflectionProbe::Invalidate()
+{
+    dirty = true;
+}
+
+BoundingBox ReflectionProbe::WorldInfluenceBox() const
+{
+    Vector3 center = WorldPosition();
+    return BoundingBox(center - influenceSize, center + influenceSize);
+}
+
+bool ReflectionProbe::NeedsUpdate(Octree* octree) const
+{
+    if (dirty || !complete)
+        return true;
+
+    switch (updateMode)
+    {
+    case PROBE_UPDATE_ALWAYS:
+        return true;
+
+    case PROBE_UPDATE_ON_CHANGE:
+        return octree && octree->ChangedSince(WorldInfluenceBox(), lastGeneration);
+
+    default:
+        return false;
+    }
+}
+
+Texture* ReflectionProbe::PrepareCubeTexture()
+{
+    if (!cubeTexture || cubeTexture->Width() != size)
+    {
+        size_t numLevels = 1;
+        while ((size >> numLevels) >= MIN_PROBE_LEVEL_SIZE)
+            ++numLevels;
+
+        if (!cubeTexture)
+            cubeTexture = new Texture();
+        complete = false;
+        if (!cubeTexture->Define(TEX_CUBE, IntVector2(size, size), FMT_RGBA16F, 1, numLevels))
+        {
+            LOGERROR("Failed to create reflection probe cubemap");
+            cubeTexture.Reset();
+            return nullptr;
+        }
+        cubeTexture->DefineSampler(FILTER_TRILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+
+    return cubeTexture;
+}
+
+Camera* ReflectionProbe::FaceCamera(size_t face)
+{
+    if (face >= MAX_CUBE_FACES)
+        return nullptr;
+
+    if (!faceCameras[face])
+    {
+        faceCameras[face] = new Camera();
+        faceCameras[face]->SetFov(90.0f);
+        faceCameras[face]->SetAspectRatio(1.0f);
+        faceCameras[face]->SetFlipVertical(true);
+    }
+
+    Camera* camera = faceCameras[face];
+    Quaternion rotation;
+    rotation.FromLookRotation(faceDirections[face], faceUpDirections[face]);
+    camera->SetTransform(WorldPosition(), rotation);
+    camera->SetNearClip(nearClip);
+    camera->SetFarClip(farClip);
+    camera->SetLodBias(lodBias);
+    camera->SetViewMask(viewMask);
+    return camera;
+}
+
+bool ReflectionProbe::FaceRendered(Octree* octree)
+{
+    // Changes during the capture leave some faces older than the generation, so take it at the start to detect them on the next check
+    if (nextFace == 0)
+    {
+        captureGeneration = octree ? octree->Generation() : 0;
+        dirty = false;
+    }
+
+    nextFace = (nextFace + 1) % MAX_CUBE_FACES;
+    return nextFace == 0;
+}
+
+void ReflectionProbe::CaptureFinished()
+{
+    lastGeneration = captureGeneration;
+    complete = true;
+}
+
+void ReflectionProbe::OnTransformChanged()
+{
+    SpatialNode::OnTransformChanged();
+
+    Invalidate();
+}
+
+void ReflectionProbe::SetUpdateModeAttr(int mode)
+{
+    SetUpdateMode((ReflectionProbeUpdateMode)Clamp(mode, (int)PROBE_UPDATE_ONCE, (int)PROBE_UPDATE_ALWAYS));
+}
+
+int ReflectionProbe::UpdateModeAttr() const
+{
+    return (int)updateMode;
+}
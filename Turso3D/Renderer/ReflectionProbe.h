@@ -0,0 +1,132 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Graphics/GraphicsDefs.h"
+#include "../Math/BoundingBox.h"
+#include "../Math/Color.h"
+#include "../Object/AutoPtr.h"
+#include "../Scene/SpatialNode.h"
+
+class Camera;
+class Octree;
+class Texture;
+
+/// Reflection probe update modes.
+enum ReflectionProbeUpdateMode
+{
+    PROBE_UPDATE_ONCE = 0,
+    PROBE_UPDATE_ON_CHANGE,
+    PROBE_UPDATE_ALWAYS
+};
+
+/// %Reflection probe scene node. Captures the surrounding scene into an environment cubemap, whose mip levels are prefiltered for increasing roughness. Rendered one face at a time by ReflectionProbeUpdater, which must have the probe added.
+class ReflectionProbe : public SpatialNode
+{
+    OBJECT(ReflectionProbe);
+
+public:
+    /// Construct.
+    ReflectionProbe();
+    /// Destruct.
+    ~ReflectionProbe();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Set cubemap face resolution in pixels. Rounded up to a power of two.
+    void SetSize(int size);
+    /// Set half size of the axis-aligned influence box around the probe. Octree changes inside it invalidate the probe in on change mode.
+    void SetInfluenceSize(const Vector3& halfSize);
+    /// Set near clip distance of the face cameras.
+    void SetNearClip(float nearClip);
+    /// Set far clip distance of the face cameras.
+    void SetFarClip(float farClip);
+    /// Set LOD bias of the face cameras. Values lower than 1 use lower quality LODs.
+    void SetLodBias(float bias);
+    /// Set view layer mask of the face cameras.
+    void SetViewMask(unsigned mask);
+    /// Set background color for the parts of the faces not covered by geometry.
+    void SetBackgroundColor(const Color& color);
+    /// Set update mode.
+    void SetUpdateMode(ReflectionProbeUpdateMode mode);
+    /// Mark the whole cubemap to be rerendered.
+    void Invalidate();
+
+    /// Return cubemap face resolution.
+    int Size() const { return size; }
+    /// Return influence box half size.
+    const Vector3& InfluenceSize() const { return influenceSize; }
+    /// Return near clip distance.
+    float NearClip() const { return nearClip; }
+    /// Return far clip distance.
+    float FarClip() const { return farClip; }
+    /// Return LOD bias.
+    float LodBias() const { return lodBias; }
+    /// Return view layer mask.
+    unsigned ViewMask() const { return viewMask; }
+    /// Return background color.
+    const Color& BackgroundColor() const { return backgroundColor; }
+    /// Return update mode.
+    ReflectionProbeUpdateMode UpdateMode() const { return updateMode; }
+    /// Return the prefiltered environment cubemap, or null if not rendered yet.
+    Texture* CubeTexture() const { return cubeTexture; }
+    /// Return world space influence box.
+    BoundingBox WorldInfluenceBox() const;
+    /// Return whether all faces have been rendered and prefiltered at least once.
+    bool IsComplete() const { return complete; }
+    /// Return whether the cubemap should be rerendered in the current update mode. Checks the octree for changes inside the influence box since the last capture in on change mode.
+    bool NeedsUpdate(Octree* octree) const;
+    /// Return the next face to render.
+    size_t NextFace() const { return nextFace; }
+
+    /// Create the cubemap if its size has changed and return it. Called by ReflectionProbeUpdater.
+    Texture* PrepareCubeTexture();
+    /// Position and return the camera of a face. Called by ReflectionProbeUpdater.
+    Camera* FaceCamera(size_t face);
+    /// Advance to the next face after rendering one. Return true when all faces of the capture have been rendered. Called by ReflectionProbeUpdater.
+    bool FaceRendered(Octree* octree);
+    /// Mark the capture prefiltered. Called by ReflectionProbeUpdater.
+    void CaptureFinished();
+
+protected:
+    /// Handle the transform matrix changing.
+    void OnTransformChanged() override;
+
+private:
+    /// Set update mode as int. Used in serialization.
+    void SetUpdateModeAttr(int mode);
+    /// Return update mode as int. Used in serialization.
+    int UpdateModeAttr() const;
+
+    /// Cubemap face resolution.
+    int size;
+    /// Influence box half size.
+    Vector3 influenceSize;
+    /// Near clip distance.
+    float nearClip;
+    /// Far clip distance.
+    float farClip;
+    /// LOD bias.
+    float lodBias;
+    /// View layer mask.
+    unsigned viewMask;
+    /// Background color.
+    Color backgroundColor;
+    /// Update mode.
+    ReflectionProbeUpdateMode updateMode;
+    /// Environment cubemap.
+    SharedPtr<Texture> cubeTexture;
+    /// Face cameras.
+    AutoPtr<Camera> faceCameras[MAX_CUBE_FACES];
+    /// Next face to render.
+    size_t nextFace;
+    /// Octree generation at the start of the capture in progress.
+    unsigned captureGeneration;
+    /// Octree generation at the start of the last finished capture.
+    unsigned lastGeneration;
+    /// Whether has been captured once.
+    bool complete;
+    /// Whether must be rerendered regardless of the update mode.
+    bool dirty;
+};
@@ -0,0 +1,220 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/FrameBuffer.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Scene/Scene.h"
+#include "../Time/Profiler.h"
+#include "Octree.h"
+#include "ReflectionProbe.h"
+#include "ReflectionProbeUpdater.h"
+#include "Renderer.h"
+
+#include <cassert>
+#include <glew.h>
+
+ReflectionProbeUpdater::ReflectionProbeUpdater() :
+    nextProbeIndex(0),
+    facesPerFrame(1),
+    numFacesRendered(0)
+{
+    assert(Object::Subsystem<Renderer>());
+}
+
+ReflectionProbeUpdater::~ReflectionProbeUpdater()
+{
+}
+
+void ReflectionProbeUpdater::AddProbe(ReflectionProbe* probe)
+{
+    if (!probe)
+        return;
+
+    for (auto it = probes.begin(); it != probes.end(); ++it)
+    {
+        if (*it == probe)
+            return;
+    }
+
+    probes.push_back(WeakPtr<ReflectionProbe>(probe));
+}
+
+void ReflectionProbeUpdater::RemoveProbe(ReflectionProbe* probe)
+{
+    for (auto it = probes.begin(); it != probes.end(); ++it)
+    {
+        if (*it == probe)
+        {
+            probes.erase(it);
+            break;
+        }
+    }
+
+    if (currentProbe == probe)
+        currentProbe.Reset();
+}
+
+void ReflectionProbeUpdater::SetFacesPerFrame(unsigned num)
+{
+    facesPerFrame = num;
+}
+
+void ReflectionProbeUpdater::Update(Scene* scene)
+{
+    PROFILE(UpdateReflectionProbes);
+
+    numFacesRendered = 0;
+    if (!scene)
+        return;
+
+    // Drop destroyed probes
+    for (auto it = probes.begin(); it != probes.end();)
+    {
+        if (it->IsExpired())
+            it = probes.erase(it);
+        else
+            ++it;
+    }
+
+    Renderer* renderer = Object::Subsystem<Renderer>();
+    LightingMode lightingMode = renderer->GetLightingMode();
+    bool motionVectors = renderer->MotionVectors();
+    renderer->SetLightingMode(LIGHTING_FORWARD);
+    renderer->SetMotionVectors(false);
+    renderer->SetLightCullingDepth(nullptr);
+
+    while (numFacesRendered < facesPerFrame)
+    {
+        ReflectionProbe* probe = currentProbe;
+        if (!probe)
+        {
+            probe = NextProbe(scene);
+            if (!probe)
+                break;
+            currentProbe = probe;
+        }
+
+        if (!RenderFace(scene, probe))
+        {
+            currentProbe.Reset();
+            break;
+        }
+        ++numFacesRendered;
+
+        if (probe->FaceRendered(scene->FindChild<Octree>()))
+        {
+            Prefilter(probe);
+            probe->CaptureFinished();
+            currentProbe.Reset();
+        }
+    }
+
+    renderer->SetLightingMode(lightingMode);
+    renderer->SetMotionVectors(motionVectors);
+}
+
+ReflectionProbe* ReflectionProbeUpdater::NextProbe(Scene* scene)
+{
+    if (probes.empty())
+        return nullptr;
+
+    for (auto it = probes.begin(); it != probes.end(); ++it)
+    {
+        ReflectionProbe* probe = *it;
+        if (probe->IsEnabled() && !probe->IsComplete())
+            return probe;
+    }
+
+    // Take the probes in turn so that probes updated every frame do not starve the others
+    Octree* octree = scene->FindChild<Octree>();
+    for (size_t i = 0; i < probes.size(); ++i)
+    {
+        size_t index = (nextProbeIndex + i) % probes.size();
+        ReflectionProbe* probe = probes[index];
+        if (probe->IsEnabled() && probe->NeedsUpdate(octree))
+        {
+            nextProbeIndex = index + 1;
+            return probe;
+        }
+    }
+
+    return nullptr;
+}
+
+bool ReflectionProbeUpdater::RenderFace(Scene* scene, ReflectionProbe* probe)
+{
+    PROFILE(RenderReflectionFace);
+
+    Renderer* renderer = Object::Subsystem<Renderer>();
+    Texture* cubeTexture = probe->PrepareCubeTexture();
+    if (!cubeTexture)
+        return false;
+
+    int size = probe->Size();
+    if (!depthTexture || depthTexture->Width() != size)
+    {
+        if (!depthTexture)
+            depthTexture = new Texture();
+        if (!depthTexture->Define(TEX_2D, IntVector2(size, size), FMT_D32F))
+            return false;
+        depthTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+    if (!faceBuffer)
+        faceBuffer = new FrameBuffer();
+
+    // Cull all faces together at the start of the capture. The later faces use the result while no node has moved
+    size_t face = probe->NextFace();
+    if (face == 0)
+    {
+        groupCameras.clear();
+        for (size_t i = 0; i < MAX_CUBE_FACES; ++i)
+            groupCameras.push_back(probe->FaceCamera(i));
+        renderer->PrepareViewGroup(scene, groupCameras);
+    }
+
+    renderer->PrepareView(scene, probe->FaceCamera(face), false);
+
+    faceBuffer->Define(cubeTexture, face, depthTexture);
+    faceBuffer->Bind();
+    renderer->SetViewport(IntRect(0, 0, size, size));
+    renderer->Clear(true, true, IntRect::ZERO, probe->BackgroundColor());
+    renderer->RenderOpaque();
+    return true;
+}
+
+void ReflectionProbeUpdater::Prefilter(ReflectionProbe* probe)
+{
+    PROFILE(PrefilterReflectionProbe);
+
+    Renderer* renderer = Object::Subsystem<Renderer>();
+    Texture* cubeTexture = probe->CubeTexture();
+    size_t numLevels = cubeTexture->NumLevels();
+    if (numLevels < 2)
+        return;
+
+    ShaderProgram* program = ShaderProgram::IsComputeSupported() ? renderer->SetProgram("Shaders/ReflectionFilter.glsl") : nullptr;
+    if (!program)
+    {
+        // Without compute shaders fall back to box filtered mips
+        cubeTexture->Bind(0);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        return;
+    }
+
+    // Each level is filtered from the previous one with the roughness increment, so that the sample count stays low. The lobe widths (squared roughness) add up approximately in quadrature
+    cubeTexture->Bind(0);
+    for (size_t i = 1; i < numLevels; ++i)
+    {
+        int levelSize = Max(probe->Size() >> i, 1);
+        unsigned numGroups = (levelSize + PROBE_FILTER_GROUP_SIZE - 1) / PROBE_FILTER_GROUP_SIZE;
+        float alpha = (float)(i * i) / (float)((numLevels - 1) * (numLevels - 1));
+        float prevAlpha = (float)((i - 1) * (i - 1)) / (float)((numLevels - 1) * (numLevels - 1));
+        float roughness = sqrtf(sqrtf(alpha * alpha - prevAlpha * prevAlpha));
+
+        renderer->SetUniform(program, "filterParams", Vector2((float)(i - 1), roughness));
+        cubeTexture->BindImage(0, i, IMAGE_WRITE);
+        renderer->DispatchCompute(numGroups, numGroups, MAX_CUBE_FACES);
+    }
+
+    Texture::UnbindImage(0);
+}
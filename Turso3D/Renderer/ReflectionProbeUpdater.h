@@ -0,0 +1,69 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Ptr.h"
+
+#include <vector>
+
+class Camera;
+class FrameBuffer;
+class ReflectionProbe;
+class Scene;
+class Texture;
+
+/// Thread group size of the reflection cubemap prefiltering. Must match GROUP_SIZE in ReflectionFilter.glsl.
+static const int PROBE_FILTER_GROUP_SIZE = 8;
+
+/// Amortized reflection probe updates. Renders a fixed number of cubemap faces per frame, by default one, continuing the probe in progress until all its faces are done and then prefiltering its mip levels in a compute shader. Probes that have not been captured yet go first, after which the probes needing an update are taken in turn. The faces are culled together through the Renderer's view group and rendered with forward lighting, without shadows or transparent geometry.
+class ReflectionProbeUpdater
+{
+public:
+    /// Construct. %Renderer subsystem must exist.
+    ReflectionProbeUpdater();
+    /// Destruct.
+    ~ReflectionProbeUpdater();
+
+    /// Add a probe to be updated. Removed automatically when destroyed.
+    void AddProbe(ReflectionProbe* probe);
+    /// Remove a probe.
+    void RemoveProbe(ReflectionProbe* probe);
+    /// Set number of cubemap faces to render per frame.
+    void SetFacesPerFrame(unsigned num);
+    /// Render the faces of the frame. Call before preparing the frame's own views, as this prepares and renders views of its own and replaces the Renderer's view group. Leaves the face framebuffer bound.
+    void Update(Scene* scene);
+
+    /// Return number of probes.
+    size_t NumProbes() const { return probes.size(); }
+    /// Return number of cubemap faces to render per frame.
+    unsigned FacesPerFrame() const { return facesPerFrame; }
+    /// Return number of faces rendered on the last update.
+    unsigned NumFacesRendered() const { return numFacesRendered; }
+    /// Return the probe whose capture is in progress, or null if none.
+    ReflectionProbe* CurrentProbe() const { return currentProbe; }
+
+private:
+    /// Choose the next probe to capture, or null if none needs an update.
+    ReflectionProbe* NextProbe(Scene* scene);
+    /// Render the next face of a probe. Return false on failure.
+    bool RenderFace(Scene* scene, ReflectionProbe* probe);
+    /// Prefilter the mip levels of a captured probe for increasing roughness.
+    void Prefilter(ReflectionProbe* probe);
+
+    /// Probes.
+    std::vector<WeakPtr<ReflectionProbe> > probes;
+    /// Probe whose capture is in progress.
+    WeakPtr<ReflectionProbe> currentProbe;
+    /// Index of the probe to check first on the next capture.
+    size_t nextProbeIndex;
+    /// Framebuffer for rendering the faces.
+    SharedPtr<FrameBuffer> faceBuffer;
+    /// Depth texture for rendering the faces.
+    SharedPtr<Texture> depthTexture;
+    /// Face cameras of the probe being captured for the view group.
+    std::vector<Camera*> groupCameras;
+    /// Number of cubemap faces to render per frame.
+    unsigned facesPerFrame;
+    /// Number of faces rendered on the last update.
+    unsigned numFacesRendered;
+};
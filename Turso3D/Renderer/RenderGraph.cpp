@@ -0,0 +1,459 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/FrameBuffer.h"
+#include "../Graphics/Texture.h"
+#include "../Time/Profiler.h"
+#include "RenderGraph.h"
+#include "Renderer.h"
+
+RenderGraph::RenderGraph() :
+    currentPass(M_MAX_UNSIGNED),
+    frameNumber(0)
+{
+    RegisterSubsystem(this);
+}
+
+RenderGraph::~RenderGraph()
+{
+    RemoveSubsystem(this);
+}
+
+void RenderGraph::Reset()
+{
+    resources.clear();
+    passes.clear();
+    currentPass = M_MAX_UNSIGNED;
+    ++frameNumber;
+}
+
+unsigned RenderGraph::CreateTexture(const char* name, const IntVector2& size, ImageFormat format, TextureFilterMode filter, size_t numLevels, int multisample)
+{
+    RenderGraphResource resource;
+    resource.name = name;
+    resource.size = IntVector2(Max(size.x, 1), Max(size.y, 1));
+    resource.format = format;
+    resource.filter = filter;
+    resource.numLevels = Max((int)numLevels, 1);
+    resource.multisample = Max(multisample, 1);
+    resource.texture = nullptr;
+    resource.imported = false;
+    resource.history = nullptr;
+    resource.firstUse = M_MAX_UNSIGNED;
+    resource.lastUse = 0;
+
+    resources.push_back(resource);
+    return (unsigned)resources.size() - 1;
+}
+
+unsigned RenderGraph::ImportTexture(const char* name, Texture* texture)
+{
+    unsigned index = CreateTexture(name, texture ? IntVector2(texture->Width(), texture->Height()) : IntVector2(1, 1), texture ? texture->Format() : FMT_NONE);
+    resources[index].texture = texture;
+    resources[index].numLevels = texture ? texture->NumLevels() : 1;
+    resources[index].multisample = texture ? texture->Multisample() : 1;
+    resources[index].imported = true;
+    return index;
+}
+
+unsigned RenderGraph::CreateHistoryTexture(const char* name, const IntVector2& size, ImageFormat format, TextureFilterMode filter)
+{
+    IntVector2 clampedSize(Max(size.x, 1), Max(size.y, 1));
+    HistoryTarget& history = historyTargets[name];
+
+    if (!history.textures[0] || history.size != clampedSize || history.format != format || history.filter != filter)
+    {
+        for (size_t i = 0; i < 2; ++i)
+        {
+            history.textures[i] = new Texture();
+            history.textures[i]->Define(TEX_2D, clampedSize, format);
+            history.textures[i]->DefineSampler(filter, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        }
+        history.size = clampedSize;
+        history.format = format;
+        history.filter = filter;
+        history.current = 0;
+        history.valid = false;
+        history.invalidated = false;
+    }
+    else if (history.lastUseFrame != frameNumber)
+    {
+        // The texture written on the previous frame becomes the one to read
+        history.valid = history.lastUseFrame == frameNumber - 1 && !history.invalidated;
+        history.invalidated = false;
+        history.current = 1 - history.current;
+    }
+
+    history.lastUseFrame = frameNumber;
+
+    unsigned index = ImportTexture(name, history.textures[history.current]);
+    resources[index].history = &history;
+    return index;
+}
+
+unsigned RenderGraph::PreviousHistory(unsigned resource)
+{
+    HistoryTarget* history = resource < resources.size() ? resources[resource].history : nullptr;
+    if (!history)
+        return M_MAX_UNSIGNED;
+
+    unsigned index = ImportTexture(resources[resource].name, history->textures[1 - history->current]);
+    resources[index].history = history;
+    return index;
+}
+
+void RenderGraph::InvalidateHistory()
+{
+    for (auto it = historyTargets.begin(); it != historyTargets.end(); ++it)
+    {
+        // If not declared yet on this frame, the content written on the previous frame is discarded when it is
+        it->second.valid = false;
+        it->second.invalidated = it->second.lastUseFrame != frameNumber;
+    }
+}
+
+unsigned RenderGraph::ImportBackbuffer(const IntVector2& size)
+{
+    unsigned index = CreateTexture("Backbuffer", size, FMT_NONE);
+    resources[index].imported = true;
+    return index;
+}
+
+unsigned RenderGraph::AddPass(const char* name, bool sideEffects)
+{
+    RenderGraphPass pass;
+    pass.name = name;
+    pass.depthOutput = M_MAX_UNSIGNED;
+    pass.clearColorValue = Color::BLACK;
+    pass.clearColor = false;
+    pass.clearDepth = false;
+    pass.sideEffects = sideEffects;
+    pass.culled = false;
+    pass.frameBuffer = nullptr;
+    pass.size = IntVector2::ZERO;
+
+    passes.push_back(pass);
+    return (unsigned)passes.size() - 1;
+}
+
+void RenderGraph::Read(unsigned pass, unsigned resource, size_t textureUnit)
+{
+    if (pass >= passes.size() || resource >= resources.size())
+        return;
+
+    RenderGraphRead read;
+    read.resource = resource;
+    read.unit = textureUnit;
+    passes[pass].reads.push_back(read);
+}
+
+void RenderGraph::WriteColor(unsigned pass, unsigned resource)
+{
+    if (pass < passes.size() && resource < resources.size())
+        passes[pass].colorOutputs.push_back(resource);
+}
+
+void RenderGraph::WriteDepth(unsigned pass, unsigned resource)
+{
+    if (pass < passes.size() && resource < resources.size())
+        passes[pass].depthOutput = resource;
+}
+
+void RenderGraph::WriteStorage(unsigned pass, unsigned resource)
+{
+    if (pass < passes.size() && resource < resources.size())
+        passes[pass].storageOutputs.push_back(resource);
+}
+
+void RenderGraph::SetClear(unsigned pass, bool clearColor, bool clearDepth, const Color& clearColorValue)
+{
+    if (pass < passes.size())
+    {
+        passes[pass].clearColor = clearColor;
+        passes[pass].clearDepth = clearDepth;
+        passes[pass].clearColorValue = clearColorValue;
+    }
+}
+
+void RenderGraph::Compile()
+{
+    PROFILE(CompileRenderGraph);
+
+    // Walk the passes backward from the imported outputs. A pass is needed if it writes a needed resource; its inputs become needed, while outputs it clears no longer depend on earlier passes
+    neededResources.resize(resources.size());
+    for (size_t i = 0; i < resources.size(); ++i)
+        neededResources[i] = resources[i].imported;
+
+    for (size_t i = passes.size() - 1; i < passes.size(); --i)
+    {
+        RenderGraphPass& pass = passes[i];
+        bool needed = pass.sideEffects;
+        for (auto it = pass.colorOutputs.begin(); it != pass.colorOutputs.end() && !needed; ++it)
+            needed = neededResources[*it];
+        for (auto it = pass.storageOutputs.begin(); it != pass.storageOutputs.end() && !needed; ++it)
+            needed = neededResources[*it];
+        if (!needed && pass.depthOutput < resources.size())
+            needed = neededResources[pass.depthOutput];
+
+        pass.culled = !needed;
+        if (pass.culled)
+            continue;
+
+        if (pass.clearColor)
+        {
+            for (auto it = pass.colorOutputs.begin(); it != pass.colorOutputs.end(); ++it)
+                neededResources[*it] = false;
+        }
+        if (pass.clearDepth && pass.depthOutput < resources.size())
+            neededResources[pass.depthOutput] = false;
+        for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+            neededResources[it->resource] = true;
+    }
+
+    // Find the lifetimes of the resources in the passes that remain
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        RenderGraphPass& pass = passes[i];
+        if (pass.culled)
+            continue;
+
+        for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+        {
+            resources[it->resource].firstUse = std::min(resources[it->resource].firstUse, i);
+            resources[it->resource].lastUse = std::max(resources[it->resource].lastUse, i);
+        }
+        for (auto it = pass.colorOutputs.begin(); it != pass.colorOutputs.end(); ++it)
+        {
+            resources[*it].firstUse = std::min(resources[*it].firstUse, i);
+            resources[*it].lastUse = std::max(resources[*it].lastUse, i);
+        }
+        for (auto it = pass.storageOutputs.begin(); it != pass.storageOutputs.end(); ++it)
+        {
+            resources[*it].firstUse = std::min(resources[*it].firstUse, i);
+            resources[*it].lastUse = std::max(resources[*it].lastUse, i);
+        }
+        if (pass.depthOutput < resources.size())
+        {
+            resources[pass.depthOutput].firstUse = std::min(resources[pass.depthOutput].firstUse, i);
+            resources[pass.depthOutput].lastUse = std::max(resources[pass.depthOutput].lastUse, i);
+        }
+    }
+
+    // Allocate the transient textures in the order of first use, so that a texture freed by an earlier resource can be aliased by a later one
+    for (auto it = pool.begin(); it != pool.end(); ++it)
+        it->availableFrom = 0;
+
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        if (passes[i].culled)
+            continue;
+
+        for (auto it = resources.begin(); it != resources.end(); ++it)
+        {
+            if (!it->imported && it->firstUse == i)
+                AllocateTexture(*it);
+        }
+    }
+
+    for (auto it = passes.begin(); it != passes.end(); ++it)
+    {
+        if (it->culled)
+            continue;
+
+        unsigned firstOutput = it->colorOutputs.size() ? it->colorOutputs[0] : it->depthOutput;
+        if (firstOutput >= resources.size() && it->storageOutputs.size())
+            firstOutput = it->storageOutputs[0];
+        it->size = firstOutput < resources.size() ? resources[firstOutput].size : IntVector2::ZERO;
+        it->frameBuffer = (it->colorOutputs.size() || it->depthOutput < resources.size()) ? FindFrameBuffer(*it) : nullptr;
+    }
+
+    ReleaseExpired();
+}
+
+bool RenderGraph::BeginPass(unsigned passIndex)
+{
+    if (passIndex >= passes.size() || passes[passIndex].culled)
+        return false;
+
+    if (currentPass != M_MAX_UNSIGNED)
+        EndPass();
+
+    RenderGraphPass& pass = passes[passIndex];
+    Renderer* renderer = Subsystem<Renderer>();
+
+    // The framebuffer binds are skipped when consecutive passes share the same outputs. Compute passes do not render to a framebuffer
+    if (pass.frameBuffer)
+        pass.frameBuffer->Bind();
+    else if (pass.colorOutputs.size())
+        FrameBuffer::Unbind();
+
+    if (renderer && (pass.colorOutputs.size() || pass.depthOutput < resources.size()))
+    {
+        renderer->SetViewport(IntRect(0, 0, pass.size.x, pass.size.y));
+        if (pass.clearColor || pass.clearDepth)
+            renderer->Clear(pass.clearColor, pass.clearDepth, IntRect::ZERO, pass.clearColorValue);
+    }
+
+    for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+    {
+        Texture* texture = resources[it->resource].texture;
+        if (it->unit != RENDERGRAPH_NO_UNIT && texture)
+            texture->Bind(it->unit);
+    }
+
+    currentPass = passIndex;
+    return true;
+}
+
+void RenderGraph::EndPass()
+{
+    if (currentPass >= passes.size())
+        return;
+
+    // Unbind the inputs so that they can be rendered to by later passes without a feedback loop
+    const RenderGraphPass& pass = passes[currentPass];
+    for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+    {
+        if (it->unit != RENDERGRAPH_NO_UNIT)
+            Texture::Unbind(it->unit);
+    }
+
+    // Discard the transient textures used for the last time, so that their content need not be written back to memory
+    unsigned colorMask = 0;
+    for (size_t i = 0; i < pass.colorOutputs.size(); ++i)
+    {
+        if (IsLastUse(pass.colorOutputs[i]))
+            colorMask |= 1 << i;
+    }
+    bool invalidateDepth = pass.depthOutput < resources.size() && IsLastUse(pass.depthOutput);
+    if (pass.frameBuffer && (colorMask || invalidateDepth))
+        pass.frameBuffer->Invalidate(colorMask, invalidateDepth);
+
+    for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+    {
+        if (IsLastUse(it->resource) && resources[it->resource].texture)
+            resources[it->resource].texture->Invalidate();
+    }
+
+    currentPass = M_MAX_UNSIGNED;
+}
+
+size_t RenderGraph::NumCulledPasses() const
+{
+    size_t numCulled = 0;
+    for (auto it = passes.begin(); it != passes.end(); ++it)
+    {
+        if (it->culled)
+            ++numCulled;
+    }
+
+    return numCulled;
+}
+
+size_t RenderGraph::PooledTargetMemory() const
+{
+    size_t memory = 0;
+    for (auto it = pool.begin(); it != pool.end(); ++it)
+    {
+        for (size_t i = 0; i < it->numLevels; ++i)
+            memory += (size_t)Max(it->size.x >> i, 1) * Max(it->size.y >> i, 1) * it->multisample * Image::pixelByteSizes[it->format];
+    }
+
+    return memory;
+}
+
+void RenderGraph::AllocateTexture(RenderGraphResource& resource)
+{
+    for (auto it = pool.begin(); it != pool.end(); ++it)
+    {
+        if (it->availableFrom <= resource.firstUse && it->size == resource.size && it->format == resource.format && it->filter == resource.filter &&
+            it->numLevels == resource.numLevels && it->multisample == resource.multisample)
+        {
+            resource.texture = it->texture;
+            it->availableFrom = resource.lastUse + 1;
+            it->lastUseFrame = frameNumber;
+            return;
+        }
+    }
+
+    PooledRenderTarget target;
+    target.texture = new Texture();
+    target.texture->Define(TEX_2D, resource.size, resource.format, resource.multisample, resource.numLevels);
+    target.texture->DefineSampler(resource.filter, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    target.size = resource.size;
+    target.format = resource.format;
+    target.filter = resource.filter;
+    target.numLevels = resource.numLevels;
+    target.multisample = resource.multisample;
+    target.lastUseFrame = frameNumber;
+    target.availableFrom = resource.lastUse + 1;
+
+    resource.texture = target.texture;
+    pool.push_back(target);
+}
+
+FrameBuffer* RenderGraph::FindFrameBuffer(const RenderGraphPass& pass)
+{
+    attachmentKey.clear();
+    for (auto it = pass.colorOutputs.begin(); it != pass.colorOutputs.end(); ++it)
+    {
+        // Rendering to the backbuffer
+        if (!resources[*it].texture)
+            return nullptr;
+        attachmentKey.push_back(resources[*it].texture);
+    }
+    attachmentKey.push_back(pass.depthOutput < resources.size() ? resources[pass.depthOutput].texture : nullptr);
+
+    CachedFrameBuffer& cached = frameBuffers[attachmentKey];
+    cached.lastUseFrame = frameNumber;
+
+    // Redefine if new, or if a texture at the same address has replaced a destroyed one
+    bool valid = cached.frameBuffer && cached.attachments.size() == attachmentKey.size();
+    for (size_t i = 0; i < attachmentKey.size() && valid; ++i)
+        valid = cached.attachments[i].Get() == attachmentKey[i];
+
+    if (!valid)
+    {
+        cached.frameBuffer = new FrameBuffer();
+        cached.attachments.clear();
+        for (auto it = attachmentKey.begin(); it != attachmentKey.end(); ++it)
+            cached.attachments.push_back(WeakPtr<Texture>(*it));
+
+        Texture* depthTexture = attachmentKey.back();
+        if (pass.colorOutputs.size() > 1)
+        {
+            std::vector<Texture*> colorTextures(attachmentKey.begin(), attachmentKey.end() - 1);
+            cached.frameBuffer->Define(colorTextures, depthTexture);
+        }
+        else
+            cached.frameBuffer->Define(pass.colorOutputs.size() ? attachmentKey[0] : (Texture*)nullptr, depthTexture);
+    }
+
+    return cached.frameBuffer;
+}
+
+void RenderGraph::ReleaseExpired()
+{
+    for (auto it = pool.begin(); it != pool.end();)
+    {
+        if (frameNumber - it->lastUseFrame > RENDER_TARGET_EXPIRE_FRAMES)
+            it = pool.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto it = historyTargets.begin(); it != historyTargets.end();)
+    {
+        if (frameNumber - it->second.lastUseFrame > RENDER_TARGET_EXPIRE_FRAMES)
+            it = historyTargets.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto it = frameBuffers.begin(); it != frameBuffers.end();)
+    {
+        if (frameNumber - it->second.lastUseFrame > RENDER_TARGET_EXPIRE_FRAMES)
+            it = frameBuffers.erase(it);
+        else
+            ++it;
+    }
+}
@@ -0,0 +1,236 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Graphics/GraphicsDefs.h"
+#include "../Math/Color.h"
+#include "../Math/IntVector2.h"
+#include "../Object/Object.h"
+#include "../Object/Ptr.h"
+#include "../Resource/Image.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class FrameBuffer;
+class Texture;
+struct HistoryTarget;
+
+/// Frames after which an unused pooled render target or framebuffer is released.
+static const unsigned RENDER_TARGET_EXPIRE_FRAMES = 60;
+/// Texture unit value for a read that is a dependency only, and is not bound.
+static const size_t RENDERGRAPH_NO_UNIT = 0xffffffff;
+
+/// %Render graph resource: a transient texture allocated from the pool, an imported texture, or the backbuffer.
+struct RenderGraphResource
+{
+    /// Name for debugging.
+    const char* name;
+    /// Size in pixels.
+    IntVector2 size;
+    /// Texture format of a transient texture.
+    ImageFormat format;
+    /// Filtering of a transient texture.
+    TextureFilterMode filter;
+    /// Number of mip levels of a transient texture.
+    size_t numLevels;
+    /// Multisampling level of a transient texture, 1 if not multisampled.
+    int multisample;
+    /// Imported texture or the pooled texture assigned in Compile(). Null for the backbuffer.
+    Texture* texture;
+    /// Whether is imported. Imported resources are the outputs of the graph.
+    bool imported;
+    /// History texture pair of a history resource, or null if not one.
+    HistoryTarget* history;
+    /// First pass using the resource after culling.
+    size_t firstUse;
+    /// Last pass using the resource after culling.
+    size_t lastUse;
+};
+
+/// Texture read of a render graph pass.
+struct RenderGraphRead
+{
+    /// Resource index.
+    unsigned resource;
+    /// Texture unit to bind to, or RENDERGRAPH_NO_UNIT if not bound.
+    size_t unit;
+};
+
+/// %Render graph pass, which renders into its outputs and samples its inputs.
+struct RenderGraphPass
+{
+    /// Name for debugging.
+    const char* name;
+    /// Texture reads.
+    std::vector<RenderGraphRead> reads;
+    /// Color outputs in render target order.
+    std::vector<unsigned> colorOutputs;
+    /// Outputs written through image stores, which are not attached to the framebuffer.
+    std::vector<unsigned> storageOutputs;
+    /// Depth output resource index, or M_MAX_UNSIGNED if none.
+    unsigned depthOutput;
+    /// Clear color value.
+    Color clearColorValue;
+    /// Clear the color outputs when beginning flag.
+    bool clearColor;
+    /// Clear the depth output when beginning flag.
+    bool clearDepth;
+    /// Never culled flag.
+    bool sideEffects;
+    /// Culled flag, set in Compile().
+    bool culled;
+    /// Framebuffer to render to, set in Compile(). Null for the backbuffer or a compute pass.
+    FrameBuffer* frameBuffer;
+    /// Viewport size, set in Compile().
+    IntVector2 size;
+};
+
+/// Pooled transient render target texture.
+struct PooledRenderTarget
+{
+    /// %Texture.
+    SharedPtr<Texture> texture;
+    /// Size in pixels.
+    IntVector2 size;
+    /// Texture format.
+    ImageFormat format;
+    /// Filtering.
+    TextureFilterMode filter;
+    /// Number of mip levels.
+    size_t numLevels;
+    /// Multisampling level.
+    int multisample;
+    /// Frame number when last used.
+    unsigned lastUseFrame;
+    /// First pass of the frame being compiled from which the texture is free to alias.
+    size_t availableFrom;
+};
+
+/// Pair of persistent textures for data kept from the previous frame, for example temporal anti-aliasing color. One is written on the current frame while the other holds the previous frame's content, and they swap each frame.
+struct HistoryTarget
+{
+    /// Textures.
+    SharedPtr<Texture> textures[2];
+    /// Size in pixels.
+    IntVector2 size;
+    /// Texture format.
+    ImageFormat format;
+    /// Filtering.
+    TextureFilterMode filter;
+    /// Index of the texture written on the current frame.
+    size_t current;
+    /// Frame number when last declared.
+    unsigned lastUseFrame;
+    /// Whether the texture of the previous frame holds valid content.
+    bool valid;
+    /// Whether to discard the content written on the previous frame when next declared.
+    bool invalidated;
+};
+
+/// Cached framebuffer for a combination of attachments.
+struct CachedFrameBuffer
+{
+    /// Framebuffer.
+    SharedPtr<FrameBuffer> frameBuffer;
+    /// Attachments, to detect textures that have been destroyed.
+    std::vector<WeakPtr<Texture> > attachments;
+    /// Frame number when last used.
+    unsigned lastUseFrame;
+};
+
+/// %Render graph subsystem for view rendering and post-processing. Passes are declared each frame with their texture inputs and outputs, after which Compile() culls the passes that do not contribute to the imported outputs, allocates the transient textures from a pool, aliasing those whose pass lifetimes do not overlap, and sets up a framebuffer per distinct output combination. Transient textures have undefined content before their first write unless cleared, and their content is invalidated after their last use so that the GPU can skip writing it back to memory.
+class RenderGraph : public Object
+{
+    OBJECT(RenderGraph);
+
+public:
+    /// Construct and register subsystem. %Graphics subsystem must have been initialized.
+    RenderGraph();
+    /// Destruct.
+    ~RenderGraph();
+
+    /// Begin declaring the passes of a new frame. The passes and resources of the previous frame are forgotten, while the pooled textures and framebuffers are kept.
+    void Reset();
+    /// Declare a transient texture and return its index. The name must be persistent; string literals are recommended. A multisampled texture can only be rendered to, resolved with FrameBuffer::Resolve() or read with texelFetch().
+    unsigned CreateTexture(const char* name, const IntVector2& size, ImageFormat format, TextureFilterMode filter = FILTER_BILINEAR, size_t numLevels = 1, int multisample = 1);
+    /// Import an external texture and return its index. Imported textures are outputs of the graph, and must stay alive until the pass rendering to them has executed.
+    unsigned ImportTexture(const char* name, Texture* texture);
+    /// Declare a history texture that persists across frames and return the index of the texture to write on the current frame. The previous frame's content is read through PreviousHistory(). The history is invalid on the first frame, when the size or format changes, after a frame it was not declared on, or after InvalidateHistory(). The texture is an output of the graph like an imported texture. The name must be persistent and unique among the history textures.
+    unsigned CreateHistoryTexture(const char* name, const IntVector2& size, ImageFormat format, TextureFilterMode filter = FILTER_BILINEAR);
+    /// Declare the previous frame's texture of a history resource for reading and return its index.
+    unsigned PreviousHistory(unsigned resource);
+    /// Mark the previous frame's content of all history textures invalid, for example after a camera cut.
+    void InvalidateHistory();
+    /// Import the backbuffer of the given size and return its index. The backbuffer can not be combined with other outputs in the same pass.
+    unsigned ImportBackbuffer(const IntVector2& size);
+    /// Add a pass and return its index. A pass with side effects is never culled.
+    unsigned AddPass(const char* name, bool sideEffects = false);
+    /// Declare a texture read of a pass, bound to the given texture unit for the duration of the pass, or a dependency only if RENDERGRAPH_NO_UNIT.
+    void Read(unsigned pass, unsigned resource, size_t textureUnit = RENDERGRAPH_NO_UNIT);
+    /// Declare a color output of a pass. Multiple color outputs are rendered in the order declared.
+    void WriteColor(unsigned pass, unsigned resource);
+    /// Declare the depth output of a pass.
+    void WriteDepth(unsigned pass, unsigned resource);
+    /// Declare an output of a pass written by compute shader image stores. A pass with only storage outputs leaves the framebuffer and viewport unchanged.
+    void WriteStorage(unsigned pass, unsigned resource);
+    /// Set the outputs to clear when a pass begins. A clear ends the dependency on earlier passes writing the outputs.
+    void SetClear(unsigned pass, bool clearColor, bool clearDepth, const Color& clearColorValue = Color::BLACK);
+    /// Cull unused passes, allocate the transient textures and set up the framebuffers.
+    void Compile();
+    /// Begin a pass: bind its framebuffer, set the viewport, clear and bind the input textures. The storage outputs are bound by the caller. Return false if the pass was culled, in which case it should be skipped.
+    bool BeginPass(unsigned pass);
+    /// End the current pass, unbind its input textures and invalidate the transient textures it used last.
+    void EndPass();
+
+    /// Return the texture of a resource. Valid after Compile() for the passes that were not culled. Null for the backbuffer.
+    Texture* GetTexture(unsigned resource) const { return resource < resources.size() ? resources[resource].texture : nullptr; }
+    /// Return the framebuffer of a pass, for example for blitting. Valid after Compile(). Null for the backbuffer or a culled pass.
+    FrameBuffer* GetFrameBuffer(unsigned pass) const { return pass < passes.size() ? passes[pass].frameBuffer : nullptr; }
+    /// Return whether the previous frame's content of a history resource is valid.
+    bool IsHistoryValid(unsigned resource) const { return resource < resources.size() && resources[resource].history && resources[resource].history->valid; }
+    /// Return whether a pass was culled in Compile().
+    bool IsCulled(unsigned pass) const { return pass < passes.size() && passes[pass].culled; }
+    /// Return number of passes declared this frame.
+    size_t NumPasses() const { return passes.size(); }
+    /// Return number of passes culled this frame.
+    size_t NumCulledPasses() const;
+    /// Return number of pooled render target textures.
+    size_t NumPooledTargets() const { return pool.size(); }
+    /// Return GPU memory used by the pooled render target textures in bytes.
+    size_t PooledTargetMemory() const;
+    /// Return number of cached framebuffers.
+    size_t NumFrameBuffers() const { return frameBuffers.size(); }
+    /// Return number of history textures, each a pair of textures.
+    size_t NumHistoryTextures() const { return historyTargets.size(); }
+
+private:
+    /// Assign a pooled texture to a transient resource, creating a new one if none is free.
+    void AllocateTexture(RenderGraphResource& resource);
+    /// Return whether a resource is a transient texture used for the last time by the current pass.
+    bool IsLastUse(unsigned resource) const { return resource < resources.size() && !resources[resource].imported && resources[resource].lastUse == currentPass; }
+    /// Return a framebuffer for a pass's outputs, creating if necessary.
+    FrameBuffer* FindFrameBuffer(const RenderGraphPass& pass);
+    /// Release the pooled textures, history textures and framebuffers unused for RENDER_TARGET_EXPIRE_FRAMES.
+    void ReleaseExpired();
+
+    /// Resources of the frame.
+    std::vector<RenderGraphResource> resources;
+    /// Passes of the frame in execution order.
+    std::vector<RenderGraphPass> passes;
+    /// Pooled render target textures.
+    std::vector<PooledRenderTarget> pool;
+    /// History textures by name.
+    std::map<std::string, HistoryTarget> historyTargets;
+    /// Cached framebuffers by color attachments followed by the depth attachment.
+    std::map<std::vector<Texture*>, CachedFrameBuffer> frameBuffers;
+    /// Per-resource needed flags for culling.
+    std::vector<bool> neededResources;
+    /// Framebuffer attachment key for lookup.
+    std::vector<Texture*> attachmentKey;
+    /// Current pass, or M_MAX_UNSIGNED if none.
+    unsigned currentPass;
+    /// Frame number for expiring unused textures and framebuffers.
+    unsigned frameNumber;
+};
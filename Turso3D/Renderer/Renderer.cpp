@@ -1,166 +1,579 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../Graphics/FrameBuffer.h"
+#include "../Graphics/GPUProfiler.h"
 #include "../Graphics/Graphics.h"
 #include "../Graphics/IndexBuffer.h"
 #include "../Graphics/RenderBuffer.h"
 #include "../Graphics/Shader.h"
 #include "../Graphics/ShaderProgram.h"
+#include "../Graphics/ShadingRateImage.h"
+#include "../Graphics/StorageBuffer.h"
 #include "../Graphics/Texture.h"
 #include "../Graphics/UniformBuffer.h"
+#include "../Graphics/VertexArrayCache.h"
 #include "../Graphics/VertexBuffer.h"
+#include "../IO/Compression.h"
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
 #include "../Math/Random.h"
+#include "../Object/MemoryTracker.h"
 #include "../Resource/ResourceCache.h"
 #include "../Scene/Scene.h"
 #include "../Time/Profiler.h"
+#include "AnimatedModel.h"
+#include "Animation.h"
 #include "Batch.h"
 #include "Camera.h"
+#include "DecalSet.h"
+#include "IrradianceVolume.h"
 #include "Light.h"
 #include "Material.h"
 #include "Model.h"
 #include "Octree.h"
+#include "ParticleEmitter.h"
+#include "ReflectionProbe.h"
 #include "Renderer.h"
+#include "StaticBatch.h"
 #include "StaticModel.h"
+#include "Terrain.h"
+#include "TextureStreamer.h"
 
 #include <glew.h>
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
-static const GLenum glCompareFuncs[] =
-{
-    GL_NEVER,
-    GL_LESS,
-    GL_EQUAL,
-    GL_LEQUAL,
-    GL_GREATER,
-    GL_NOTEQUAL,
-    GL_GEQUAL,
-    GL_ALWAYS,
-};
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TURSO3D_SSE
+#include <emmintrin.h>
+#endif
 
-static const GLenum glSrcBlend[] =
-{
-    GL_ONE,
-    GL_ONE,
-    GL_DST_COLOR,
-    GL_SRC_ALPHA,
-    GL_SRC_ALPHA,
-    GL_ONE,
-    GL_ONE_MINUS_DST_ALPHA,
-    GL_ONE,
-    GL_SRC_ALPHA
-};
+/// Store an unsigned integer into a float without conversion, to be read back in a shader with floatBitsToUint().
+inline float UintBitsToFloat(unsigned value)
+{
+    float ret;
+    memcpy(&ret, &value, sizeof ret);
+    return ret;
+}
 
-static const unsigned glDestBlend[] =
-{
-    GL_ZERO,
-    GL_ONE,
-    GL_ZERO,
-    GL_ONE_MINUS_SRC_ALPHA,
-    GL_ONE,
-    GL_ONE_MINUS_SRC_ALPHA,
-    GL_DST_ALPHA,
-    GL_ONE,
-    GL_ONE
-};
+/// Sort GPU-driven static geometry by pass, buffers and geometry to form multi-draw runs.
+inline bool CompareGPUDrivenBatches(const Batch& lhs, const Batch& rhs)
+{
+    if (lhs.pass != rhs.pass)
+        return lhs.pass < rhs.pass;
+    if (lhs.geometry->vertexBuffer != rhs.geometry->vertexBuffer)
+        return lhs.geometry->vertexBuffer < rhs.geometry->vertexBuffer;
+    if (lhs.geometry->indexBuffer != rhs.geometry->indexBuffer)
+        return lhs.geometry->indexBuffer < rhs.geometry->indexBuffer;
+    return lhs.geometry < rhs.geometry;
+}
 
-static const unsigned glBlendOp[] =
-{
-    GL_FUNC_ADD,
-    GL_FUNC_ADD,
-    GL_FUNC_ADD,
-    GL_FUNC_ADD,
-    GL_FUNC_ADD,
-    GL_FUNC_ADD,
-    GL_FUNC_ADD,
-    GL_FUNC_REVERSE_SUBTRACT,
-    GL_FUNC_REVERSE_SUBTRACT
+static const CompareMode reversedCompareModes[] =
+{
+    CMP_NEVER,
+    CMP_GREATER,
+    CMP_EQUAL,
+    CMP_GREATER_EQUAL,
+    CMP_LESS,
+    CMP_NOT_EQUAL,
+    CMP_LESS_EQUAL,
+    CMP_ALWAYS,
 };
 
 inline bool CompareLights(Light* lhs, Light* rhs)
 {
-    return lhs->Distance() < rhs->Distance();
+    return lhs->Importance() != rhs->Importance() ? lhs->Importance() > rhs->Importance() : lhs->Distance() < rhs->Distance();
+}
+
+/// Return the mip level of a texture whose size best matches a screen space size in pixels.
+static unsigned short TextureLevelForSize(Texture* texture, float pixels)
+{
+    int levelSize = Max(texture->Width(), texture->Height());
+    unsigned short level = 0;
+    while ((size_t)level + 1 < texture->NumLevels() && (float)(levelSize >> (level + 1)) >= pixels)
+        ++level;
+    return level;
+}
+
+/// Return the shadow map area covered by a world bounding box, including one texel margin. Return the whole viewport if the box extends behind a perspective shadow camera.
+static IntRect ShadowCasterRect(const IntRect& viewport, const Matrix4& viewProj, const BoundingBox& box)
+{
+    Vector2 minNdc(M_MAX_FLOAT, M_MAX_FLOAT);
+    Vector2 maxNdc(-M_MAX_FLOAT, -M_MAX_FLOAT);
+
+    for (int i = 0; i < 8; ++i)
+    {
+        Vector3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+        Vector4 projected = viewProj * Vector4(corner, 1.0f);
+        if (projected.w <= M_EPSILON)
+            return viewport;
+
+        Vector2 ndc(projected.x / projected.w, projected.y / projected.w);
+        minNdc = Vector2(Min(minNdc.x, ndc.x), Min(minNdc.y, ndc.y));
+        maxNdc = Vector2(Max(maxNdc.x, ndc.x), Max(maxNdc.y, ndc.y));
+    }
+
+    float width = (float)viewport.Width();
+    float height = (float)viewport.Height();
+    IntRect rect(
+        viewport.left + (int)floorf((Clamp(minNdc.x, -1.0f, 1.0f) + 1.0f) * 0.5f * width) - 1,
+        viewport.top + (int)floorf((Clamp(minNdc.y, -1.0f, 1.0f) + 1.0f) * 0.5f * height) - 1,
+        viewport.left + (int)ceilf((Clamp(maxNdc.x, -1.0f, 1.0f) + 1.0f) * 0.5f * width) + 1,
+        viewport.top + (int)ceilf((Clamp(maxNdc.y, -1.0f, 1.0f) + 1.0f) * 0.5f * height) + 1);
+
+    return IntRect(Max(rect.left, viewport.left), Max(rect.top, viewport.top), Min(rect.right, viewport.right), Min(rect.bottom, viewport.bottom));
+}
+
+/// Return the union of two rectangles, where a zero rectangle is empty.
+static IntRect MergeRects(const IntRect& lhs, const IntRect& rhs)
+{
+    if (lhs == IntRect::ZERO)
+        return rhs;
+    if (rhs == IntRect::ZERO)
+        return lhs;
+    return IntRect(Min(lhs.left, rhs.left), Min(lhs.top, rhs.top), Max(lhs.right, rhs.right), Max(lhs.bottom, rhs.bottom));
+}
+
+/// Add bytes to a 64-bit FNV-1a hash.
+static void HashBytes(unsigned long long& hash, const void* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+}
+
+/// Return the object space direction of an impostor atlas frame, decoded from the octahedral frame center with Y as the pole. Must match OctahedronToDirection() in Impostor.glsl.
+static Vector3 ImpostorFrameDirection(int x, int y, int framesPerSide)
+{
+    float octX = ((float)x + 0.5f) / framesPerSide * 2.0f - 1.0f;
+    float octY = ((float)y + 0.5f) / framesPerSide * 2.0f - 1.0f;
+    Vector3 direction(octX, 1.0f - fabsf(octX) - fabsf(octY), octY);
+    if (direction.y < 0.0f)
+    {
+        float foldedX = (1.0f - fabsf(direction.z)) * (direction.x >= 0.0f ? 1.0f : -1.0f);
+        float foldedZ = (1.0f - fabsf(direction.x)) * (direction.z >= 0.0f ? 1.0f : -1.0f);
+        direction.x = foldedX;
+        direction.z = foldedZ;
+    }
+    return direction.Normalized();
+}
+
+static bool IsLightVisible(Light* light, const OcclusionBuffer* occlusion)
+{
+    // A light whose whole volume is occluded can not reach a visible surface, so it is skipped along with its shadow views
+    return !occlusion || light->GetLightType() == LIGHT_DIRECTIONAL || occlusion->IsVisible(light->WorldBoundingBox());
+}
+
+static void SetBatchGeometry(Batch& batch, GeometryNode* node, const SourceBatches& batches, size_t index)
+{
+    // Skinned models that were pre-skinned for the view are drawn as static geometry
+    if (node->GetGeometryType() == GEOM_SKINNED)
+    {
+        Geometry* skinnedGeometry = static_cast<AnimatedModel*>(node)->SkinnedGeometry(index);
+        if (skinnedGeometry)
+        {
+            batch.programBits = GEOM_STATIC;
+            batch.geometry = skinnedGeometry;
+            return;
+        }
+    }
+
+    batch.programBits = (unsigned char)node->GetGeometryType();
+    batch.geometry = batches.GetGeometry(index);
 }
 
 Renderer::Renderer() :
-    frameNumber(0),
-    sortViewNumber(0),
-    clusterFrustumsDirty(true),
-    lastPerViewUniforms(0),
-    lastPerMaterialUniforms(0),
-    lastBlendMode(MAX_BLEND_MODES),
-    lastCullMode(MAX_CULL_MODES),
-    lastDepthTest(MAX_COMPARE_MODES),
-    lastColorWrite(true),
-    lastDepthWrite(true),
-    lastDepthBias(false),
+    clusterSize(IntVector3::ZERO),
+    numClusters(0),
+    maxLightsPerCluster(0),
+    maxLights(0),
+    numLightIndices(0),
+    lightIndexRows(0),
+    maxDecals(0),
+    numVisibleDecals(0),
+    numDecalTexels(0),
+    gpuDrivenOctree(nullptr),
+    gpuDrivenGeneration(0),
+    numMultiDrawCommands(0),
+    occlusionPixelBuffer(0),
+    occlusionFence(nullptr),
+    occlusionPendingCamera(nullptr),
+    occlusionBufferCamera(nullptr),
+    activeOcclusionBuffer(nullptr),
+    instanceCapacity(DEFAULT_INSTANCE_CAPACITY),
+    instanceFrameIndex(0),
     hasInstancing(false),
     instancingEnabled(false),
+    instanceDataEnabled(false),
+    useVertexArrays(false),
+    useMultiDraw(false),
+    persistentInstances(false),
+    instanceTransformsDirty(false),
+    clusterFrustumsDirty(true),
+    gpuDrivenStatic(false),
+    gpuDrivenDirty(false),
+    occlusionCulling(false),
+    softwareOcclusion(false),
+    bindlessTextures(false),
+    singlePassPointShadows(false),
+    reverseDepth(false),
+    depthReversed(false),
+    numViewAllocations(0),
+    allocationCheck(false),
+    frameNumber(0),
+    sortViewNumber(0),
+    graphics(Subsystem<Graphics>()),
     depthBiasMul(1.0f),
-    slopeScaleBiasMul(1.0f)
+    slopeScaleBiasMul(1.0f),
+    shadowLodScale(0.0f),
+    shadowThrottleDistance(0.0f),
+    shadowMaxUpdateInterval(1),
+    shadowTexelBudget(0),
+    shadedLightBudget(0),
+    shadowedLightBudget(0),
+    shadowAreaBudget(0),
+    minLightImportance(0.0f),
+    minShadowImportance(0.0f),
+    shadowRepackFrame(0),
+    shadowAtlasFragmented(false),
+    shadowCascadeInterleave(false),
+    statsHistoryIndex(0),
+    numStatsHistory(0),
+    frameBeginQuery(0),
+    dynamicTargetTime(DEFAULT_DYNAMIC_RESOLUTION_TARGET),
+    minResolutionScale(0.5f),
+    maxResolutionScale(1.0f),
+    resolutionScale(1.0f),
+    gpuFrameTime(0.0f),
+    upscaleSharpness(0.5f),
+    upscaleMode(UPSCALE_BILINEAR),
+    framesSinceScaleChange(0),
+    dynamicResolution(false),
+    depthPrePassMode(PREPASS_OFF),
+    prePassOverdrawThreshold(DEFAULT_PREPASS_OVERDRAW),
+    estimatedOverdraw(0.0f),
+    coverageScale(0.0f),
+    depthPrePassActive(false),
+    renderingDepthPrePass(false),
+    renderingAfterPrePass(false),
+    lastPrePassed(false),
+    lightingMode(LIGHTING_FORWARD),
+    renderingDeferred(false),
+    motionVectors(false),
+    renderingMotion(false),
+    historyFrameNumber(0),
+    viewHistoryFrame(0),
+    historyCamera(nullptr),
+    lightCullingDepth(nullptr),
+    gpuLightCulling(false),
+    clusterBoundsDirty(true),
+    coherentCamera(nullptr),
+    coherentOctree(nullptr),
+    coherentViewMask(0),
+    coherentOctreeGeneration(0),
+    coherentBatchGeneration(0),
+    frameCoherence(true),
+    coherentBatchesValid(false),
+    visibilityReused(false),
+    batchesReused(false),
+    coherentAssignmentGeneration(0),
+    staticBatchCaching(false),
+    viewGroupOctree(nullptr),
+    viewGroupGeneration(0),
+    lodTriangleBudget(0),
+    lodBudgetScale(1.0f),
+    coherentLodBudgetScale(1.0f),
+    bonePaletteCapacity(DEFAULT_BONE_PALETTE_CAPACITY),
+    bonePaletteGeneration(0),
+    hasSkinning(StorageBuffer::IsSupported()),
+    bonePaletteDirty(false),
+    computeSkinning(false),
+    alphaMode(ALPHA_SORTED),
+    renderingOIT(false),
+    alphaResolutionDivisor(1),
+    shadingRateSize(IntVector2::ZERO),
+    shadingRateThreshold(DEFAULT_SHADING_RATE_THRESHOLD),
+    variableRateShading(false),
+    fogGridSize(DEFAULT_FOG_GRID_SIZE),
+    fogDensity(DEFAULT_FOG_DENSITY),
+    fogAnisotropy(DEFAULT_FOG_ANISOTROPY),
+    volumetricFog(false),
+    prefilteredShadows(false)
 {
-    assert(Object::Subsystem<Graphics>()->IsInitialized());
+    assert(graphics && graphics->IsInitialized());
 
     RegisterSubsystem(this);
     RegisterRendererLibrary();
 
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-    glDepthMask(GL_TRUE);
+    for (size_t i = 0; i < INSTANCE_BUFFER_FRAMES; ++i)
+        instanceFences[i] = nullptr;
 
-    // Use texcoords 3-5 for instancing if supported
+    graphics->ResetState();
+
+    // Use texcoords 3-5 for instancing if supported, and attribute 12 for per-instance data of skinned and custom geometry
     if (glVertexAttribDivisorARB)
     {
         hasInstancing = true;
+        persistentInstances = VertexBuffer::IsPersistentSupported();
+        useVertexArrays = VertexArrayCache::IsInstancingSupported();
+        useMultiDraw = useVertexArrays && StorageBuffer::IsSupported() && glMultiDrawElementsIndirect;
 
         glVertexAttribDivisorARB(7, 1);
         glVertexAttribDivisorARB(8, 1);
         glVertexAttribDivisorARB(9, 1);
+        glVertexAttribDivisorARB(12, 1);
 
         instanceVertexBuffer = new VertexBuffer();
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+        instanceDataElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
     }
 
     DefineQuadVertexBuffer();
 
     clusterTexture = new Texture();
-    clusterTexture->Define(TEX_3D, IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RGBA32U, 1);
-    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-
+    lightIndexTexture = new Texture();
     lightDataBuffer = new UniformBuffer();
-    lightDataBuffer->Define(USAGE_DYNAMIC, MAX_LIGHTS * sizeof(LightData));
+    perViewDataBuffer = new UniformBuffer();
+    perViewDataBuffer->Define(USAGE_DYNAMIC, sizeof(PerViewData));
+    cubeShadowDataBuffer = new UniformBuffer();
+    cubeShadowDataBuffer->Define(USAGE_DYNAMIC, sizeof(CubeShadowData));
+
+    // The decal buffer size is limited by the maximum uniform block size like the light buffer. It is always bound, as the lit shaders declare it
+    int maxUniformBlockSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUniformBlockSize);
+    maxDecals = Clamp(maxUniformBlockSize / (int)sizeof(DecalData), 1, MAX_VIEW_DECALS);
+    decalData.resize(maxDecals);
+    decalDataBuffer = new UniformBuffer();
+    decalDataBuffer->Define(USAGE_DYNAMIC, maxDecals * sizeof(DecalData));
+
+    SetupLightClusters(IntVector3(DEFAULT_NUM_CLUSTER_X, DEFAULT_NUM_CLUSTER_Y, DEFAULT_NUM_CLUSTER_Z), DEFAULT_MAX_LIGHTS_CLUSTER, DEFAULT_MAX_LIGHTS);
 }
 
 Renderer::~Renderer()
 {
+    if (occlusionFence)
+        glDeleteSync((GLsync)occlusionFence);
+    for (size_t i = 0; i < INSTANCE_BUFFER_FRAMES; ++i)
+    {
+        if (instanceFences[i])
+            glDeleteSync((GLsync)instanceFences[i]);
+    }
+    if (occlusionPixelBuffer)
+        glDeleteBuffers(1, &occlusionPixelBuffer);
+    if (frameBeginQuery)
+        glDeleteQueries(1, &frameBeginQuery);
+    if (pendingFrameQueries.size())
+        glDeleteQueries((GLsizei)pendingFrameQueries.size(), &pendingFrameQueries[0]);
+    if (freeFrameQueries.size())
+        glDeleteQueries((GLsizei)freeFrameQueries.size(), &freeFrameQueries[0]);
+
     RemoveSubsystem(this);
 }
 
-void Renderer::SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format)
+void Renderer::SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format, int numDirCascades)
 {
+    numDirCascades = Clamp(numDirCascades, 1, MAX_SHADOW_CASCADES);
+    IntVector2 dirLightMapSize(dirLightSize * Min(numDirCascades, 2), dirLightSize * (numDirCascades > 2 ? 2 : 1));
+
     shadowMaps.resize(2);
 
     for (size_t i = 0; i < shadowMaps.size(); ++i)
     {
         ShadowMap& shadowMap = shadowMaps[i];
 
-        shadowMap.texture->Define(TEX_2D, i == 0 ? IntVector2(dirLightSize * 2, dirLightSize) : IntVector2(lightAtlasSize, lightAtlasSize), format, 1);
+        shadowMap.texture->Define(TEX_2D, i == 0 ? dirLightMapSize : IntVector2(lightAtlasSize, lightAtlasSize), format, 1);
         shadowMap.texture->DefineSampler(COMPARE_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
         shadowMap.fbo->Define(nullptr, shadowMap.texture);
-    }
 
-    staticObjectShadowBuffer = new RenderBuffer();
-    staticObjectShadowBuffer->Define(IntVector2(lightAtlasSize, lightAtlasSize), format, 1);
-    staticObjectShadowFbo = new FrameBuffer();
-    staticObjectShadowFbo->Define(nullptr, staticObjectShadowBuffer);
+        // Static shadowcasters of static lights are cached in a renderbuffer of the same size
+        if (!shadowMap.staticFbo)
+        {
+            shadowMap.staticBuffer = new RenderBuffer();
+            shadowMap.staticFbo = new FrameBuffer();
+        }
+        shadowMap.staticBuffer->Define(IntVector2(shadowMap.texture->Width(), shadowMap.texture->Height()), format, 1);
+        shadowMap.staticFbo->Define(nullptr, shadowMap.staticBuffer);
+    }
 
     DefineFaceSelectionTextures();
+    DefineShadowMomentTextures();
 
     shadowMapsDirty = true;
 }
 
+bool Renderer::SetShadowBakeDir(const std::string& dir)
+{
+    shadowBakeDir.clear();
+    bakedShadowTiles.clear();
+
+    if (dir.empty())
+        return true;
+
+    std::string bakeDir = AddTrailingSlash(dir);
+    if (!DirExists(bakeDir) && !CreateDir(bakeDir))
+    {
+        LOGERROR("Could not create shadow bake directory " + bakeDir);
+        return false;
+    }
+
+    shadowBakeDir = bakeDir;
+
+    std::vector<std::string> fileNames;
+    ScanDir(fileNames, shadowBakeDir, "*.bin", SCAN_FILES);
+    for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
+        bakedShadowTiles.insert(strtoull(FileName(*it).c_str(), nullptr, 16));
+
+    LOGDEBUGF("Found %u baked shadow tiles", (unsigned)bakedShadowTiles.size());
+    return true;
+}
+
+void Renderer::SetupLightClusters(const IntVector3& clusterSize_, int maxLightsPerCluster_, int maxLights_)
+{
+    // The light buffer size is limited by the maximum uniform block size
+    int maxUniformBlockSize = 0;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUniformBlockSize);
+    int newMaxLights = Clamp(maxLights_, 1, Min(MAX_LIGHTS_LIMIT, maxUniformBlockSize / (int)sizeof(LightData)));
+    if (newMaxLights < maxLights_)
+        LOGWARNINGF("Clamping maximum lights to %d due to uniform block size", newMaxLights);
+
+    clusterSize = IntVector3(Max(clusterSize_.x, 1), Max(clusterSize_.y, 1), Max(clusterSize_.z, 1));
+    numClusters = clusterSize.x * clusterSize.y * clusterSize.z;
+
+    // The light list offset is stored in 24 bits
+    maxLightsPerCluster = Clamp(maxLightsPerCluster_, 1, MAX_LIGHTS_CLUSTER_LIMIT);
+    maxLightsPerCluster = Min(maxLightsPerCluster, (int)(MAX_CLUSTER_LIGHT_INDICES / numClusters));
+
+    clusterFrustums.resize(numClusters);
+    clusterBoundingBoxes.resize(numClusters);
+    clusterMinX.resize(numClusters);
+    clusterMinY.resize(numClusters);
+    clusterMinZ.resize(numClusters);
+    clusterMaxX.resize(numClusters);
+    clusterMaxY.resize(numClusters);
+    clusterMaxZ.resize(numClusters);
+    numClusterLights.resize(numClusters);
+    clusterLightSlots.resize(numClusters * maxLightsPerCluster);
+    clusterData.resize(numClusters);
+
+    // Two 16-bit indices per texel, rounded up to full texture rows
+    size_t indexTextureHeight = (numClusters * maxLightsPerCluster + LIGHT_INDEX_TEXTURE_WIDTH * 2 - 1) / (LIGHT_INDEX_TEXTURE_WIDTH * 2);
+    lightIndices.resize(indexTextureHeight * LIGHT_INDEX_TEXTURE_WIDTH * 2);
+    lightIndexRows = (int)indexTextureHeight;
+    numLightIndices = 0;
+
+    // The cluster decal lists follow in their own rows: an offset and count per cluster, then two 16-bit indices per texel
+    size_t decalTexels = numClusters + (numClusters * MAX_DECALS_CLUSTER + 1) / 2;
+    size_t decalTextureHeight = (decalTexels + LIGHT_INDEX_TEXTURE_WIDTH - 1) / LIGHT_INDEX_TEXTURE_WIDTH;
+    numClusterDecals.resize(numClusters);
+    clusterDecalSlots.resize(numClusters * MAX_DECALS_CLUSTER);
+    decalIndexData.resize(decalTextureHeight * LIGHT_INDEX_TEXTURE_WIDTH);
+    numVisibleDecals = 0;
+    numDecalTexels = 0;
+
+    clusterTexture->Define(TEX_3D, clusterSize, FMT_R32U, 1);
+    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    lightIndexTexture->Define(TEX_2D, IntVector2(LIGHT_INDEX_TEXTURE_WIDTH, (int)(indexTextureHeight + decalTextureHeight)), FMT_R32U, 1);
+    lightIndexTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    if (newMaxLights != maxLights)
+    {
+        maxLights = newMaxLights;
+        lightData.resize(maxLights + 1);
+        lightDataBuffer->Define(USAGE_DYNAMIC, maxLights * sizeof(LightData));
+
+        SetRendererShaderDefines();
+    }
+
+    clusterFrustumsDirty = true;
+}
+
+void Renderer::SetGPUDrivenStatic(bool enable)
+{
+    if (enable && !HasGPUDrivenSupport())
+    {
+        LOGERROR("GPU-driven static geometry requires compute shaders and indirect draws");
+        enable = false;
+    }
+
+    gpuDrivenStatic = enable;
+    gpuDrivenDirty = enable;
+    gpuDrivenOctree = nullptr;
+}
+
+bool Renderer::HasGPUDrivenSupport() const
+{
+    return hasInstancing && ShaderProgram::IsComputeSupported() && StorageBuffer::IsSupported() && glMultiDrawElementsIndirect &&
+        (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+}
+
+void Renderer::SetOcclusionCulling(bool enable)
+{
+    occlusionCulling = enable;
+    if (!enable)
+        occlusionBuffer.Reset();
+}
+
+void Renderer::SetSoftwareOcclusion(bool enable)
+{
+    softwareOcclusion = enable;
+    if (!enable)
+        softwareOcclusionBuffer.Reset();
+}
+
+void Renderer::SetBindlessTextures(bool enable)
+{
+    if (enable && !Texture::IsBindlessSupported())
+    {
+        LOGERROR("Bindless textures are not supported");
+        enable = false;
+    }
+
+    if (enable == bindlessTextures)
+        return;
+
+    bindlessTextures = enable;
+    Material::SetBindlessTextures(enable);
+    SetRendererShaderDefines();
+}
+
+void Renderer::SetReverseDepth(bool enable)
+{
+    if (enable && !HasReverseDepthSupport())
+    {
+        LOGERROR("Reversed depth requires clip control");
+        enable = false;
+    }
+
+    reverseDepth = enable;
+    SetDepthConvention(enable);
+}
+
+bool Renderer::HasReverseDepthSupport() const
+{
+    return GLEW_VERSION_4_5 || GLEW_ARB_clip_control;
+}
+
+void Renderer::SetSinglePassPointShadows(bool enable)
+{
+    if (enable && !HasSinglePassPointShadowSupport())
+    {
+        LOGERROR("Single-pass point light shadows require instancing, viewport arrays and viewport index output from the vertex shader");
+        enable = false;
+    }
+
+    singlePassPointShadows = enable;
+}
+
+bool Renderer::HasSinglePassPointShadowSupport() const
+{
+    return hasInstancing && (GLEW_VERSION_4_1 || GLEW_ARB_viewport_array) && (GLEW_ARB_shader_viewport_layer_array || GLEW_AMD_vertex_shader_viewport_index);
+}
+
 void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMul_)
 {
     depthBiasMul = depthBiasMul_;
@@ -170,13 +583,270 @@ void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMu
     shadowMapsDirty = true;
 }
 
+void Renderer::SetShadowLodScale(float scale)
+{
+    shadowLodScale = Max(scale, 0.0f);
+}
+
+void Renderer::SetShadowUpdateThrottle(float distance, unsigned maxInterval)
+{
+    shadowThrottleDistance = Max(distance, 0.0f);
+    shadowMaxUpdateInterval = maxInterval ? maxInterval : 1;
+}
+
+void Renderer::SetShadowTexelBudget(unsigned texels)
+{
+    shadowTexelBudget = texels;
+}
+
+void Renderer::SetLightBudget(int shadedLights, int shadowedLights, unsigned shadowTexels)
+{
+    shadedLightBudget = Max(shadedLights, 0);
+    shadowedLightBudget = Max(shadowedLights, 0);
+    shadowAreaBudget = shadowTexels;
+}
+
+void Renderer::SetLightImportanceThresholds(float minImportance, float minShadowImportance_)
+{
+    minLightImportance = Max(minImportance, 0.0f);
+    minShadowImportance = Max(minShadowImportance_, 0.0f);
+}
+
+void Renderer::SetShadowCascadeInterleave(bool enable)
+{
+    shadowCascadeInterleave = enable;
+}
+
+void Renderer::SetDynamicResolution(bool enable, float targetFrameMs, float minScale, float maxScale)
+{
+    dynamicResolution = enable;
+    dynamicTargetTime = Max(targetFrameMs, 1.0f);
+    minResolutionScale = Clamp(minScale, 0.1f, 1.0f);
+    maxResolutionScale = Clamp(maxScale, minResolutionScale, 1.0f);
+    resolutionScale = enable ? Clamp(resolutionScale, minResolutionScale, maxResolutionScale) : maxResolutionScale;
+    framesSinceScaleChange = 0;
+}
+
+void Renderer::SetUpscaleMode(UpscaleMode mode, float sharpness)
+{
+    upscaleMode = mode;
+    upscaleSharpness = Clamp(sharpness, 0.0f, 1.0f);
+}
+
+void Renderer::SetDepthPrePass(DepthPrePassMode mode, float overdrawThreshold)
+{
+    depthPrePassMode = mode;
+    prePassOverdrawThreshold = Max(overdrawThreshold, 0.0f);
+    // The overdraw is estimated while collecting the batches
+    coherentBatchesValid = false;
+}
+
+void Renderer::SetLightingMode(LightingMode mode)
+{
+    lightingMode = mode;
+}
+
+void Renderer::SetMotionVectors(bool enable)
+{
+    motionVectors = enable;
+}
+
+void Renderer::SetAlphaMode(AlphaMode mode)
+{
+    if (mode == ALPHA_WEIGHTED_OIT && !(GLEW_VERSION_4_0 || GLEW_ARB_draw_buffers_blend))
+    {
+        LOGERROR("Weighted OIT requires per-target blend functions");
+        mode = ALPHA_SORTED;
+    }
+
+    alphaMode = mode;
+}
+
+void Renderer::SetAlphaResolutionDivisor(int divisor)
+{
+    alphaResolutionDivisor = divisor >= 4 ? 4 : divisor >= 2 ? 2 : 1;
+}
+
+void Renderer::SetVariableRateShading(bool enable, float contrastThreshold)
+{
+    if (enable && !(ShadingRateImage::IsSupported() && ShaderProgram::IsComputeSupported()))
+    {
+        LOGERROR("Variable-rate shading requires shading rate images and compute shaders");
+        enable = false;
+    }
+
+    variableRateShading = enable;
+    shadingRateThreshold = Max(contrastThreshold, 0.0f);
+    if (!enable)
+    {
+        shadingRateImage.Reset();
+        shadingRateSize = IntVector2::ZERO;
+    }
+}
+
+void Renderer::SetVolumetricFog(bool enable, float density, float anisotropy, const IntVector3& gridSize)
+{
+    if (enable && !ShaderProgram::IsComputeSupported())
+    {
+        LOGERROR("Volumetric fog requires compute shaders");
+        enable = false;
+    }
+
+    volumetricFog = enable;
+    fogDensity = Max(density, 0.0f);
+    fogAnisotropy = Clamp(anisotropy, -0.99f, 0.99f);
+    fogGridSize = IntVector3(Max(gridSize.x, 1), Max(gridSize.y, 1), Max(gridSize.z, 1));
+    if (!enable)
+    {
+        fogScatterTexture.Reset();
+        fogIntegratedTexture.Reset();
+    }
+}
+
+void Renderer::SetPrefilteredShadows(bool enable)
+{
+    if (enable && !ShaderProgram::IsComputeSupported())
+    {
+        LOGERROR("Prefiltered shadows require compute shaders");
+        enable = false;
+    }
+
+    if (enable == prefilteredShadows)
+        return;
+
+    prefilteredShadows = enable;
+    DefineShadowMomentTextures();
+    SetRendererShaderDefines();
+
+    // The cached shadow views have no moments yet
+    shadowMapsDirty = true;
+}
+
+void Renderer::SetGPULightCulling(bool enable)
+{
+    if (enable && (!ShaderProgram::IsComputeSupported() || !StorageBuffer::IsSupported()))
+    {
+        LOGERROR("GPU light culling requires compute shaders and shader storage buffers");
+        enable = false;
+    }
+
+    gpuLightCulling = enable;
+}
+
+void Renderer::SetComputeSkinning(bool enable)
+{
+    if (enable && !HasComputeSkinningSupport())
+    {
+        LOGERROR("Compute skinning requires compute shaders and shader storage buffers");
+        enable = false;
+    }
+
+    computeSkinning = enable;
+    skinningJobs.clear();
+    if (!enable)
+        skinnedVertexPools.clear();
+}
+
+bool Renderer::HasComputeSkinningSupport() const
+{
+    return hasSkinning && ShaderProgram::IsComputeSupported();
+}
+
+void Renderer::SetLightCullingDepth(Texture* depthTexture)
+{
+    lightCullingDepth = depthTexture;
+}
+
+void Renderer::SetIrradianceVolume(IrradianceVolume* volume)
+{
+    irradianceVolume = volume;
+}
+
+void Renderer::SetDecalSet(DecalSet* decals)
+{
+    decalSet = decals;
+}
+
+void Renderer::SetAllocationCheck(bool enable)
+{
+    allocationCheck = enable;
+}
+
+void Renderer::SetFrameCoherence(bool enable)
+{
+    frameCoherence = enable;
+    coherentBatchesValid = false;
+    coherentCamera = nullptr;
+}
+
+void Renderer::SetStaticBatchCaching(bool enable)
+{
+    staticBatchCaching = enable;
+    coherentBatchesValid = false;
+    coherentCamera = nullptr;
+}
+
+void Renderer::SetLodTriangleBudget(unsigned triangles)
+{
+    lodTriangleBudget = triangles;
+    lodBudgetScale = 1.0f;
+}
+
+bool Renderer::SetSortKeyLayout(const BatchSortKeyLayout& layout)
+{
+    if (layout.TotalBits() > 64 || layout.depthBits > 32 || layout.programBits > 32 || layout.renderStateBits > 32 || layout.textureBits > 32 ||
+        layout.passBits > 32 || layout.vertexBufferBits > 32 || layout.geometryBits > 32)
+    {
+        LOGERROR("Sort key fields must be at most 32 bits and fit in 64 bits");
+        return false;
+    }
+
+    sortKeyLayout = layout;
+    return true;
+}
+
+void Renderer::PrepareViewGroup(Scene* scene_, const std::vector<Camera*>& cameras)
+{
+    PROFILE(PrepareViewGroup);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    viewGroupCameras.clear();
+    viewGroupViewProjs.clear();
+    viewGroupVolume.frustums.clear();
+    viewGroupNodes.clear();
+    viewGroupOctree = scene_ ? scene_->FindChild<Octree>() : nullptr;
+    if (!viewGroupOctree || cameras.empty())
+    {
+        viewGroupOctree = nullptr;
+        return;
+    }
+
+    unsigned groupViewMask = 0;
+    for (auto it = cameras.begin(); it != cameras.end(); ++it)
+    {
+        Camera* groupCamera = *it;
+        viewGroupCameras.push_back(groupCamera);
+        viewGroupViewProjs.push_back(groupCamera->ViewProjMatrix(false));
+        viewGroupVolume.frustums.push_back(groupCamera->WorldFrustum());
+        groupViewMask |= groupCamera->ViewMask();
+    }
+
+    // Update the octree now, so that the views' own updates have nothing to do and keep the generation unchanged
+    viewGroupOctree->Update(frameNumber);
+    viewGroupOctree->FindNodes(viewGroupNodes, viewGroupVolume, 0, groupViewMask);
+    viewGroupGeneration = viewGroupOctree->Generation();
+}
+
 void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows)
 {
     PROFILE(PrepareView);
+    MEMORY_SCOPE(MEMORY_RENDERER);
 
     if (!scene_ || !camera_)
         return;
 
+    size_t startAllocations = HeapAllocationCount();
+
     scene = scene_;
     camera = camera_;
     octree = scene->FindChild<Octree>();
@@ -186,11 +856,51 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows)
     if (!shadowMaps.size())
         drawShadows = false;
 
+    // Statistics of the previous view are complete now
+    if (frameNumber)
+    {
+        statsSum -= statsHistory[statsHistoryIndex];
+        statsHistory[statsHistoryIndex] = stats;
+        statsSum += stats;
+        statsHistoryIndex = (statsHistoryIndex + 1) % RENDER_STATS_HISTORY;
+        if (numStatsHistory < RENDER_STATS_HISTORY)
+            ++numStatsHistory;
+
+        // Move the LOD distances a step toward the triangle budget. Relax only when clearly under the budget, so that the scale does not oscillate
+        if (lodTriangleBudget && stats.triangles)
+        {
+            float ratio = (float)stats.triangles / (float)lodTriangleBudget;
+            if (ratio > 1.0f)
+                lodBudgetScale *= Min(ratio, 1.0f + LOD_BUDGET_STEP);
+            else if (ratio < LOD_BUDGET_RELAX_RATIO)
+                lodBudgetScale *= Max(ratio / LOD_BUDGET_RELAX_RATIO, 1.0f - LOD_BUDGET_STEP);
+            lodBudgetScale = Clamp(lodBudgetScale, 1.0f, MAX_LOD_BUDGET_SCALE);
+        }
+    }
+    stats.Reset();
+    camera->SetLodBudgetScale(lodTriangleBudget ? lodBudgetScale : 1.0f);
+    camera->SetReverseDepth(reverseDepth);
+
     // Framenumber is never 0
     ++frameNumber;
     if (!frameNumber)
         ++frameNumber;
 
+    // The history frame is never 0, as that marks a view without motion vectors
+    viewHistoryFrame = 0;
+    if (motionVectors)
+    {
+        ++historyFrameNumber;
+        if (!historyFrameNumber)
+            ++historyFrameNumber;
+        viewHistoryFrame = historyFrameNumber;
+    }
+
+    // Scratch data of the previous view is no longer in use
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    frameAllocator.SetNumThreads(workQueue ? workQueue->NumThreads() : 1);
+    frameAllocator.Reset();
+
     frustum = camera->WorldFrustum();
     viewMask = camera->ViewMask();
     geometries.clear();
@@ -200,21 +910,36 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows)
 
     opaqueBatches.Clear();
     alphaBatches.Clear();
-    instanceTransforms.clear();
-    instanceTransformsDirty = true;
+    BeginInstanceTransforms();
+    BeginBonePalette();
 
     for (auto it = shadowMaps.begin(); it != shadowMaps.end(); ++it)
         it->Clear();
 
+    if (gpuDrivenStatic && (gpuDrivenDirty || octree != gpuDrivenOctree || gpuDrivenGeneration != CombinedBuffer::Generation()))
+        DefineGPUDrivenStatic();
+    if (occlusionCulling)
+        ReadOcclusionBuffer();
+
     CollectVisibleNodes();
     CollectLightInteractions(drawShadows);
     CollectNodeBatches();
     SortNodeBatches();
+    RecordRenderCommands();
+    DefinePerViewData();
+
+    numViewAllocations = HeapAllocationCount() - startAllocations;
+    assert(!allocationCheck || !numViewAllocations);
 }
 
 void Renderer::RenderShadowMaps()
 {
     PROFILE(RenderShadowMaps);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+    PROFILE_GPU(RenderShadowMaps);
+
+    BeginFrameTiming();
+    SetDepthConvention(false);
 
     Texture::Unbind(8);
     Texture::Unbind(9);
@@ -242,18 +967,26 @@ void Renderer::RenderShadowMaps()
                 {
                     SetViewport(view->viewport);
                     SetDepthBias(view->light->DepthBias() * depthBiasMul, view->light->SlopeScaleBias() * slopeScaleBiasMul);
-                    RenderBatches(view->shadowCamera, batchQueue.batches);
+                    RenderBatches(view->shadowCamera, batchQueue);
                 }
             }
+            else if (view->renderMode == RENDER_STATIC_LIGHT_LOAD_BAKED && !LoadBakedShadow(shadowMap, *view))
+            {
+                // The static shadowcasters were not collected, so leave them out this frame and render them on the next
+                Clear(false, true, view->viewport);
+                view->lastViewport = IntRect::ZERO;
+            }
         }
 
-        // Now do the shadowmap -> static shadowmap storage blits as necessary
+        // Now do the shadowmap -> static shadowmap storage blits as necessary, and save the newly rendered baked tiles
         for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
         {
             ShadowView* view = shadowMap.shadowViews[j];
 
-            if (view->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
-                FrameBuffer::Blit(staticObjectShadowFbo, view->viewport, shadowMap.fbo, view->viewport, false, true, FILTER_POINT);
+            if (view->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC && view->bakeKey)
+                SaveBakedShadow(shadowMap, *view);
+            if (view->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC || view->renderMode == RENDER_STATIC_LIGHT_LOAD_BAKED)
+                FrameBuffer::Blit(shadowMap.staticFbo, view->viewport, shadowMap.fbo, view->viewport, false, true, FILTER_POINT);
         }
 
         // Rebind shadowmap
@@ -271,7 +1004,12 @@ void Renderer::RenderShadowMaps()
                 break;
 
             case RENDER_STATIC_LIGHT_RESTORE_STATIC:
-                FrameBuffer::Blit(shadowMap.fbo, view->viewport, staticObjectShadowFbo, view->viewport, false, true, FILTER_POINT);
+                // Outside the dirty area the shadow map holds only static shadowcasters already
+                FrameBuffer::Blit(shadowMap.fbo, view->dirtyRect, shadowMap.staticFbo, view->dirtyRect, false, true, FILTER_POINT);
+                break;
+
+            default:
+                // Cached views need no clear, and a loaded baked tile already covers the whole viewport
                 break;
             }
         }
@@ -281,135 +1019,845 @@ void Renderer::RenderShadowMaps()
         {
             ShadowView* view = shadowMap.shadowViews[j];
 
-            if (view->renderMode != RENDER_STATIC_LIGHT_CACHED)
+            if (view->renderMode == RENDER_STATIC_LIGHT_CACHED)
+                ++stats.shadowViewsCached;
+            else
             {
+                ++stats.shadowViewsRendered;
                 BatchQueue& batchQueue = shadowMap.shadowBatches[view->dynamicQueueIdx];
 
                 if (batchQueue.HasBatches())
                 {
                     SetViewport(view->viewport);
                     SetDepthBias(view->light->DepthBias() * depthBiasMul, view->light->SlopeScaleBias() * slopeScaleBiasMul);
-                    RenderBatches(view->shadowCamera, batchQueue.batches);
+                    RenderBatches(view->shadowCamera, batchQueue);
                 }
             }
         }
+
+        if (&shadowMap == &shadowMaps[1])
+            RenderCubeShadows(shadowMap);
     }
 
     SetDepthBias(0.0f, 0.0f);
+    SetDepthConvention(reverseDepth);
+
+    FilterShadowMaps();
+}
+
+void Renderer::RenderCubeShadows(ShadowMap& shadowMap)
+{
+    for (auto it = cubeShadowJobs.begin(); it != cubeShadowJobs.end(); ++it)
+    {
+        BatchQueue& batchQueue = shadowMap.shadowBatches[it->queueIdx];
+        if (!batchQueue.HasBatches())
+            continue;
+
+        Light* light = it->light;
+        std::vector<ShadowView>& shadowViews = light->ShadowViews();
+        size_t numFaces = std::min(shadowViews.size(), (size_t)6);
+
+        CubeShadowData data;
+        for (size_t i = 0; i < numFaces; ++i)
+        {
+            Camera* shadowCamera = shadowViews[i].shadowCamera;
+            shadowCamera->SetReverseDepth(depthReversed);
+            data.faceMatrices[i] = shadowCamera->ViewProjMatrix();
+        }
+
+        cubeShadowDataBuffer->SetData(0, sizeof data, &data);
+        cubeShadowDataBuffer->Bind(UB_CUBESHADOWDATA);
+
+        // Set the first face's viewport through the graphics state so that its cached viewport stays valid. The other viewports are reset by the next viewport change
+        SetViewport(shadowViews[0].viewport);
+        stats.stateChanges += graphics->FlushState();
+        for (size_t i = 1; i < numFaces; ++i)
+        {
+            const IntRect& rect = shadowViews[i].viewport;
+            glViewportIndexedf((GLuint)i, (float)rect.left, (float)rect.top, (float)rect.Width(), (float)rect.Height());
+        }
+
+        SetDepthBias(light->DepthBias() * depthBiasMul, light->SlopeScaleBias() * slopeScaleBiasMul);
+        RenderBatches(shadowViews[0].shadowCamera, batchQueue);
+    }
+}
+
+unsigned long long Renderer::BakedShadowKey(const ShadowView& view, const ShadowMap& shadowMap, const Matrix4& shadowViewProj, GeometryNode* const* shadowCasters, size_t numShadowCasters) const
+{
+    if (shadowBakeDir.empty() || view.singlePass)
+        return 0;
+
+    // The static shadowcasters are hashed separately and summed, so that their order does not matter
+    unsigned long long castersHash = 0;
+    unsigned numStatic = 0;
+    for (size_t i = 0; i < numShadowCasters; ++i)
+    {
+        GeometryNode* node = shadowCasters[i];
+        if (!node->Static())
+            continue;
+
+        unsigned long long nodeHash = 14695981039346656037ULL;
+        HashBytes(nodeHash, &node->WorldBoundingBox(), sizeof(BoundingBox));
+        castersHash += nodeHash;
+        ++numStatic;
+    }
+
+    int tileSize[2] = { view.viewport.Width(), view.viewport.Height() };
+    float bias[2] = { view.light->DepthBias() * depthBiasMul, view.light->SlopeScaleBias() * slopeScaleBiasMul };
+    ImageFormat format = shadowMap.texture->Format();
+
+    unsigned long long hash = 14695981039346656037ULL;
+    HashBytes(hash, shadowViewProj.Data(), sizeof(Matrix4));
+    HashBytes(hash, tileSize, sizeof tileSize);
+    HashBytes(hash, bias, sizeof bias);
+    HashBytes(hash, &format, sizeof format);
+    HashBytes(hash, &numStatic, sizeof numStatic);
+    HashBytes(hash, &castersHash, sizeof castersHash);
+
+    // Zero means no key
+    return hash ? hash : 1;
+}
+
+bool Renderer::LoadBakedShadow(ShadowMap& shadowMap, const ShadowView& view)
+{
+    PROFILE(LoadBakedShadow);
+
+    const IntRect& rect = view.viewport;
+    ImageFormat format = shadowMap.texture->Format();
+    size_t dataSize = (size_t)rect.Width() * rect.Height() * Image::pixelByteSizes[format];
+
+    std::vector<unsigned char> depthData;
+    File file(BakedShadowFileName(view.bakeKey));
+    if (!file.IsOpen() || file.ReadFileID() != "TSSB" || file.Read<unsigned long long>() != view.bakeKey || !ReadCompressed(file, depthData) ||
+        depthData.size() != dataSize)
+    {
+        LOGERRORF("Could not load baked shadow tile %016llx", view.bakeKey);
+        bakedShadowTiles.erase(view.bakeKey);
+        return false;
+    }
+
+    return shadowMap.texture->SetData(0, rect, ImageLevel(IntVector2(rect.Width(), rect.Height()), format, &depthData[0]));
+}
+
+void Renderer::SaveBakedShadow(ShadowMap& shadowMap, const ShadowView& view)
+{
+    PROFILE(SaveBakedShadow);
+
+    const IntRect& rect = view.viewport;
+    ImageFormat format = shadowMap.texture->Format();
+    GLenum glFormat = format == FMT_D24S8 ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT;
+    GLenum glType = format == FMT_D16 ? GL_UNSIGNED_SHORT : format == FMT_D32 ? GL_UNSIGNED_INT : format == FMT_D24S8 ? GL_UNSIGNED_INT_24_8 : GL_FLOAT;
+
+    // Reading back stalls until the static shadowcasters have rendered, which is paid once per tile
+    std::vector<unsigned char> depthData((size_t)rect.Width() * rect.Height() * Image::pixelByteSizes[format]);
+    shadowMap.fbo->BindRead();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(rect.left, rect.top, rect.Width(), rect.Height(), glFormat, glType, &depthData[0]);
+
+    File file(BakedShadowFileName(view.bakeKey), FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        LOGERRORF("Could not write baked shadow tile %016llx", view.bakeKey);
+        return;
+    }
+
+    file.WriteFileID("TSSB");
+    file.Write(view.bakeKey);
+    WriteCompressed(file, &depthData[0], depthData.size());
+    bakedShadowTiles.insert(view.bakeKey);
+}
+
+std::string Renderer::BakedShadowFileName(unsigned long long key) const
+{
+    return shadowBakeDir + FormatString("%016llx", key) + ".bin";
+}
+
+void Renderer::FilterShadowMaps()
+{
+    if (!prefilteredShadows || !shadowFilterTexture)
+        return;
+
+    PROFILE(FilterShadowMaps);
+    PROFILE_GPU(FilterShadowMaps);
+
+    // Filter horizontally from depth to the intermediate moments for all views first, then vertically to the moment textures, so that only two barriers are needed
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        ShaderProgram* program = SetProgram("Shaders/ShadowFilter.glsl", pass == 0 ? "DEPTH" : "");
+        if (!program)
+            break;
+
+        bool dispatched = false;
+
+        for (size_t i = 0; i < shadowMaps.size(); ++i)
+        {
+            ShadowMap& shadowMap = shadowMaps[i];
+            if (shadowMap.shadowViews.empty() || !shadowMap.momentTexture)
+                continue;
+
+            if (pass == 0)
+            {
+                shadowMap.texture->Bind(0);
+                shadowFilterTexture->BindImage(0, 0, IMAGE_WRITE);
+            }
+            else
+            {
+                shadowFilterTexture->Bind(0);
+                shadowMap.momentTexture->BindImage(0, 0, IMAGE_WRITE);
+            }
+
+            for (auto it = shadowMap.shadowViews.begin(); it != shadowMap.shadowViews.end(); ++it)
+            {
+                ShadowView* view = *it;
+                if (view->renderMode == RENDER_STATIC_LIGHT_CACHED)
+                    continue;
+
+                const IntRect& rect = view->viewport;
+                SetUniform(program, "filterRect", Vector4((float)rect.left, (float)rect.top, (float)rect.right, (float)rect.bottom));
+                glDispatchCompute((rect.Width() + SHADOW_FILTER_GROUP_SIZE - 1) / SHADOW_FILTER_GROUP_SIZE, (rect.Height() + SHADOW_FILTER_GROUP_SIZE - 1) /
+                    SHADOW_FILTER_GROUP_SIZE, 1);
+                dispatched = true;
+            }
+        }
+
+        if (!dispatched)
+            break;
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    Texture::Unbind(0);
+    Texture::UnbindImage(0);
 }
 
 void Renderer::RenderOpaque()
 {
     PROFILE(RenderOpaque);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+    PROFILE_GPU(RenderOpaque);
+
+    BeginFrameTiming();
 
     // Update light data now
-    ImageLevel clusterLevel(IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RG32U, clusterData);
-    clusterTexture->SetData(0, IntBox(0, 0, 0, NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), clusterLevel);
-    lightDataBuffer->SetData(0, lights.size() * sizeof(LightData), lightData);
+    if (!gpuLightCulling)
+    {
+        ImageLevel clusterLevel(clusterSize, FMT_R32U, &clusterData[0]);
+        clusterTexture->SetData(0, IntBox(0, 0, 0, clusterSize.x, clusterSize.y, clusterSize.z), clusterLevel);
+        if (numLightIndices)
+        {
+            // Upload only the used rows of the light index list
+            int indexRows = (int)((numLightIndices + LIGHT_INDEX_TEXTURE_WIDTH * 2 - 1) / (LIGHT_INDEX_TEXTURE_WIDTH * 2));
+            ImageLevel indexLevel(IntVector2(LIGHT_INDEX_TEXTURE_WIDTH, indexRows), FMT_R32U, &lightIndices[0]);
+            lightIndexTexture->SetData(0, IntRect(0, 0, LIGHT_INDEX_TEXTURE_WIDTH, indexRows), indexLevel);
+        }
+    }
+    if (lights.size())
+        lightDataBuffer->SetData(0, lights.size() * sizeof(LightData), &lightData[0]);
+    if (numVisibleDecals)
+    {
+        decalDataBuffer->SetData(0, numVisibleDecals * sizeof(DecalData), &decalData[0]);
+        int decalRows = (int)((numDecalTexels + LIGHT_INDEX_TEXTURE_WIDTH - 1) / LIGHT_INDEX_TEXTURE_WIDTH);
+        ImageLevel decalLevel(IntVector2(LIGHT_INDEX_TEXTURE_WIDTH, decalRows), FMT_R32U, &decalIndexData[0]);
+        lightIndexTexture->SetData(0, IntRect(0, lightIndexRows, LIGHT_INDEX_TEXTURE_WIDTH, lightIndexRows + decalRows), decalLevel);
+    }
 
-    if (shadowMaps.size())
+    BindLighting();
+    renderingDeferred = lightingMode == LIGHTING_DEFERRED;
+    renderingMotion = viewHistoryFrame != 0;
+
+    // Without depth bounds the lights can be culled before any geometry is rendered
+    bool cullDepthBounded = lightCullingDepth && depthPrePassActive;
+    if (gpuLightCulling && !cullDepthBounded)
+        CullClusterLightsGPU();
+
+    if (depthPrePassActive)
     {
-        shadowMaps[0].texture->Bind(8);
-        shadowMaps[1].texture->Bind(9);
-        faceSelectionTexture1->Bind(10);
-        faceSelectionTexture2->Bind(11);
+        PROFILE_GPU(DepthPrePass);
+
+        renderingDepthPrePass = true;
+        RenderBatches(camera, opaqueBatches);
+        renderingDepthPrePass = false;
+        renderingAfterPrePass = true;
     }
 
-    clusterTexture->Bind(12);
-    lightDataBuffer->Bind(0);
+    if (gpuLightCulling && cullDepthBounded)
+        CullClusterLightsGPU();
 
-    RenderBatches(camera, opaqueBatches.batches);
+    // In deferred mode the coarse rate applies to the lighting pass instead
+    bool coarseShading = !renderingDeferred && EnableShadingRate();
+
+    RenderBatches(camera, opaqueBatches);
+    renderingAfterPrePass = false;
+
+    if (gpuDrivenStatic && gpuDrivenOctree == octree)
+        RenderGPUDrivenStatic();
+
+    if (coarseShading)
+        ShadingRateImage::Disable();
+
+    renderingDeferred = false;
+    renderingMotion = false;
 }
 
 void Renderer::RenderAlpha()
 {
     PROFILE(RenderAlpha);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+    PROFILE_GPU(RenderAlpha);
 
-    if (shadowMaps.size())
+    BindLighting();
+
+    if (alphaMode != ALPHA_WEIGHTED_OIT)
     {
-        shadowMaps[0].texture->Bind(8);
-        shadowMaps[1].texture->Bind(9);
-        faceSelectionTexture1->Bind(10);
-        faceSelectionTexture2->Bind(11);
+        RenderBatches(camera, alphaBatches);
+        return;
     }
 
-    clusterTexture->Bind(12);
-    lightDataBuffer->Bind(0);
+    // Accumulation starts from zero and revealage from full, ie. nothing covering the background
+    const float zero[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const float one[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    SetRenderState(BLEND_ADD, CULL_NONE, CMP_LESS, true, false);
+    stats.stateChanges += graphics->FlushState();
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, one);
+
+    // The passes' blend modes are replaced by additive accumulation, and the revealage target multiplies by one minus coverage
+    glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+
+    renderingOIT = true;
+    RenderBatches(camera, alphaBatches);
+    renderingOIT = false;
 
-    RenderBatches(camera, alphaBatches.batches);
+    // Restore the blend function of all targets, which the state tracking does not see
+    glBlendFunc(GL_ONE, GL_ONE);
+    graphics->ResetState();
+    lastPass = nullptr;
 }
 
-void Renderer::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite)
+void Renderer::CullClusterLightsGPU()
 {
-    if (blendMode != lastBlendMode)
+    PROFILE(CullClusterLightsGPU);
+    PROFILE_GPU(CullClusterLightsGPU);
+
+    size_t boundsSize = numClusters * 2 * sizeof(Vector4);
+    size_t tileDepthSize = clusterSize.x * clusterSize.y * sizeof(Vector2);
+    size_t clusterDataSize = (numClusters + 1) * sizeof(unsigned);
+    size_t indexSize = lightIndices.size() * sizeof(unsigned short);
+
+    if (!clusterBoundsBuffer)
     {
-        if (blendMode == BLEND_REPLACE)
-            glDisable(GL_BLEND);
-        else
+        clusterBoundsBuffer = new StorageBuffer();
+        tileDepthBuffer = new StorageBuffer();
+        clusterDataBuffer = new StorageBuffer();
+        lightIndexBuffer = new StorageBuffer();
+    }
+
+    if (clusterBoundsBuffer->Size() != boundsSize)
+    {
+        clusterBoundsBuffer->Define(USAGE_DEFAULT, boundsSize);
+        clusterBoundsDirty = true;
+    }
+    if (tileDepthBuffer->Size() != tileDepthSize)
+        tileDepthBuffer->Define(USAGE_DEFAULT, tileDepthSize);
+    if (clusterDataBuffer->Size() != clusterDataSize)
+        clusterDataBuffer->Define(USAGE_DYNAMIC, clusterDataSize);
+    if (lightIndexBuffer->Size() != indexSize)
+        lightIndexBuffer->Define(USAGE_DEFAULT, indexSize);
+
+    if (clusterBoundsDirty)
+    {
+        std::vector<Vector4> boundsData(numClusters * 2);
+        for (size_t i = 0; i < numClusters; ++i)
         {
-            glEnable(GL_BLEND);
-            glBlendFunc(glSrcBlend[blendMode], glDestBlend[blendMode]);
-            glBlendEquation(glBlendOp[blendMode]);
+            boundsData[i * 2] = Vector4(clusterBoundingBoxes[i].min, 0.0f);
+            boundsData[i * 2 + 1] = Vector4(clusterBoundingBoxes[i].max, 0.0f);
         }
 
-        lastBlendMode = blendMode;
+        clusterBoundsBuffer->SetData(0, boundsSize, &boundsData[0]);
+        clusterBoundsDirty = false;
+    }
+
+    // Reset the allocated light index count
+    unsigned numIndices = 0;
+    clusterDataBuffer->SetData(numClusters * sizeof(unsigned), sizeof numIndices, &numIndices);
+
+    UpdatePerViewData(camera);
+
+    bool depthBounds = false;
+    if (lightCullingDepth && depthPrePassActive)
+    {
+        ShaderProgram* depthProgram = SetProgram("Shaders/ClusterDepth.glsl");
+        if (depthProgram)
+        {
+            glUniform2i(depthProgram->Uniform("clusterTiles"), clusterSize.x, clusterSize.y);
+            SetUniform(depthProgram, "depthConversion", depthConversion);
+            lightCullingDepth->Bind(0);
+            tileDepthBuffer->Bind(1);
+
+            glDispatchCompute(clusterSize.x, clusterSize.y, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            Texture::Unbind(0);
+            depthBounds = true;
+        }
     }
 
-    if (cullMode != lastCullMode)
+    ShaderProgram* program = SetProgram("Shaders/ClusterLights.glsl", Material::RendererVSDefines() + (depthBounds ? "DEPTHBOUNDS" : ""));
+    if (program)
     {
-        if (cullMode == CULL_NONE)
-            glDisable(GL_CULL_FACE);
-        else
+        glUniform1ui(program->Uniform("numLights"), (unsigned)lights.size());
+        glUniform1ui(program->Uniform("numClusters"), (unsigned)numClusters);
+        glUniform1ui(program->Uniform("maxLightsPerCluster"), (unsigned)maxLightsPerCluster);
+        glUniform1ui(program->Uniform("maxLightIndices"), (unsigned)lightIndices.size());
+        if (depthBounds)
         {
-            // Use Direct3D convention, ie. clockwise vertices define a front face
-            glEnable(GL_CULL_FACE);
-            glCullFace(cullMode == CULL_BACK ? GL_FRONT : GL_BACK);
+            glUniform1ui(program->Uniform("tilesPerSlice"), (unsigned)(clusterSize.x * clusterSize.y));
+            glUniform1i(program->Uniform("maxDepthOnly"), alphaBatches.HasBatches() ? 1 : 0);
         }
 
-        lastCullMode = cullMode;
-    }
+        clusterBoundsBuffer->Bind(0);
+        clusterDataBuffer->Bind(2);
+        lightIndexBuffer->Bind(3);
 
-    if (depthTest != lastDepthTest)
+        glDispatchCompute(clusterSize.x * clusterSize.y, clusterSize.z, 1);
+        glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+    }
+    else
     {
-        glDepthFunc(glCompareFuncs[depthTest]);
-        lastDepthTest = depthTest;
+        // Leave the clusters without lights
+        std::fill(clusterData.begin(), clusterData.end(), 0);
+        clusterDataBuffer->SetData(0, numClusters * sizeof(unsigned), &clusterData[0]);
     }
 
-    if (colorWrite != lastColorWrite)
+    // Copy the light lists to the textures read by the lit shaders
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, clusterDataBuffer->GLBuffer());
+    clusterTexture->SetData(0, IntBox(0, 0, 0, clusterSize.x, clusterSize.y, clusterSize.z), ImageLevel(clusterSize, FMT_R32U, nullptr));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, lightIndexBuffer->GLBuffer());
+    lightIndexTexture->SetData(0, IntRect(0, 0, LIGHT_INDEX_TEXTURE_WIDTH, lightIndexRows), ImageLevel(IntVector2(LIGHT_INDEX_TEXTURE_WIDTH, lightIndexRows), FMT_R32U, nullptr));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    BindLighting();
+    lastMaterial = nullptr;
+    lastPass = nullptr;
+}
+
+void Renderer::RenderDeferredLighting(Texture* albedoTexture, Texture* normalTexture, Texture* depthTexture)
+{
+    if (!albedoTexture || !normalTexture || !depthTexture || !camera)
+        return;
+
+    PROFILE(RenderDeferredLighting);
+    PROFILE_GPU(RenderDeferredLighting);
+
+    ShaderProgram* program = SetProgram("Shaders/DeferredLighting.glsl", Material::RendererVSDefines() + Material::GlobalVSDefines(),
+        Material::RendererFSDefines() + Material::GlobalFSDefines());
+    if (!program)
+        return;
+
+    // The world position is reconstructed from the hardware depth converted to the API-independent convention. The shader maps it to -1..1, so map back
+    static const Matrix4 depthRangeMatrix(
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.5f, 0.5f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    );
+    Matrix4 invViewProjMatrix = viewProjMatrix.Inverse() * depthRangeMatrix;
+    glUniformMatrix4fv(program->Uniform("invViewProjMatrix"), 1, GL_FALSE, invViewProjMatrix.Data());
+    SetUniform(program, "depthConversion", depthConversion);
+
+    BindLighting();
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+    albedoTexture->Bind(0);
+    normalTexture->Bind(1);
+    depthTexture->Bind(2);
+
+    SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+    bool coarseShading = EnableShadingRate();
+    DrawQuad();
+    if (coarseShading)
+        ShadingRateImage::Disable();
+
+    Texture::Unbind(0);
+    Texture::Unbind(1);
+    Texture::Unbind(2);
+    lastMaterial = nullptr;
+    lastPass = nullptr;
+}
+
+void Renderer::CompositeAlpha(Texture* accumTexture, Texture* revealageTexture, Texture* depthTexture, Texture* lowResDepthTexture)
+{
+    if (!accumTexture || !revealageTexture)
+        return;
+
+    PROFILE(CompositeAlpha);
+    PROFILE_GPU(CompositeAlpha);
+
+    bool bilateral = depthTexture && lowResDepthTexture;
+    ShaderProgram* program = bilateral ? SetProgram("Shaders/OITComposite.glsl", "BILATERAL", "BILATERAL") : SetProgram("Shaders/OITComposite.glsl");
+    if (!program)
+        return;
+
+    accumTexture->Bind(0);
+    revealageTexture->Bind(1);
+    if (bilateral)
     {
-        GLboolean newColorWrite = colorWrite ? GL_TRUE : GL_FALSE;
-        glColorMask(newColorWrite, newColorWrite, newColorWrite, newColorWrite);
-        lastColorWrite = colorWrite;
+        SetUniform(program, "depthLinearize", depthLinearize);
+        SetUniform(program, "depthSharpness", 8.0f);
+        depthTexture->Bind(2);
+        lowResDepthTexture->Bind(3);
     }
 
-    if (depthWrite != lastDepthWrite)
+    SetRenderState(BLEND_ALPHA, CULL_NONE, CMP_ALWAYS, true, false);
+    DrawQuad();
+
+    Texture::Unbind(0);
+    Texture::Unbind(1);
+    if (bilateral)
     {
-        GLboolean newDepthWrite = depthWrite ? GL_TRUE : GL_FALSE;
-        glDepthMask(newDepthWrite);
-        lastDepthWrite = depthWrite;
+        Texture::Unbind(2);
+        Texture::Unbind(3);
     }
+    lastMaterial = nullptr;
+    lastPass = nullptr;
 }
 
-void Renderer::SetDepthBias(float constantBias, float slopeScaleBias)
+void Renderer::DownsampleDepth(Texture* depthTexture)
+{
+    if (!depthTexture)
+        return;
+
+    PROFILE(DownsampleDepth);
+    PROFILE_GPU(DownsampleDepth);
+
+    ShaderProgram* program = SetProgram("Shaders/DepthDownsample.glsl");
+    if (!program)
+        return;
+
+    const IntRect& viewport = graphics->PendingState().viewport;
+    SetUniform(program, "destSize", Vector2((float)viewport.Width(), (float)viewport.Height()));
+    SetUniform(program, "reverseDepth", depthReversed ? 1.0f : 0.0f);
+    depthTexture->Bind(0);
+
+    SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, false, true);
+    DrawQuad();
+
+    Texture::Unbind(0);
+    lastMaterial = nullptr;
+    lastPass = nullptr;
+}
+
+void Renderer::UpdateShadingRate(Texture* colorTexture)
+{
+    if (!variableRateShading || !colorTexture)
+        return;
+
+    PROFILE(UpdateShadingRate);
+    PROFILE_GPU(UpdateShadingRate);
+
+    if (!shadingRateImage)
+        shadingRateImage = new ShadingRateImage();
+    IntVector2 colorSize = colorTexture->Size2D();
+    if (!shadingRateImage->Define(colorSize))
+        return;
+
+    ShaderProgram* program = SetProgram("Shaders/ShadingRate.glsl");
+    if (!program)
+        return;
+
+    const IntVector2& tileSize = shadingRateImage->TileSize();
+    const IntVector2& numTiles = shadingRateImage->Size();
+    SetUniform(program, "rateParams", Vector3((float)tileSize.x, (float)tileSize.y, shadingRateThreshold));
+    colorTexture->Bind(0);
+    shadingRateImage->BindImage(0);
+    DispatchCompute((numTiles.x + SHADING_RATE_GROUP_SIZE - 1) / SHADING_RATE_GROUP_SIZE, (numTiles.y + SHADING_RATE_GROUP_SIZE - 1) / SHADING_RATE_GROUP_SIZE);
+    Texture::UnbindImage(0);
+    Texture::Unbind(0);
+
+    shadingRateSize = colorSize;
+}
+
+void Renderer::RenderVolumetricFog(Texture* depthTexture)
 {
-    if (constantBias <= 0.0f && slopeScaleBias <= 0.0f)
+    if (!volumetricFog || !depthTexture || !camera || camera->IsOrthographic())
+        return;
+
+    PROFILE(RenderVolumetricFog);
+    PROFILE_GPU(RenderVolumetricFog);
+
+    if (!fogScatterTexture || fogScatterTexture->Size() != fogGridSize)
     {
-        if (lastDepthBias)
+        fogScatterTexture = new Texture();
+        fogIntegratedTexture = new Texture();
+        if (!fogScatterTexture->Define(TEX_3D, fogGridSize, FMT_RGBA16F) || !fogIntegratedTexture->Define(TEX_3D, fogGridSize, FMT_RGBA16F))
         {
-            glDisable(GL_POLYGON_OFFSET_FILL);
-            lastDepthBias = false;
+            LOGERROR("Failed to create volumetric fog textures");
+            fogScatterTexture.Reset();
+            fogIntegratedTexture.Reset();
+            return;
         }
+        fogScatterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        fogIntegratedTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
     }
-    else
+
+    // World space rays through the center and toward the right and top edges of the far plane. A froxel's position is the ray at its screen position scaled by the linear depth fraction
+    Vector3 nearSize, farSize;
+    camera->FrustumSize(nearSize, farSize);
+    Quaternion rotation = camera->WorldRotation();
+    Vector3 rayCenter = rotation * Vector3(0.0f, 0.0f, farSize.z);
+    Vector3 rayRight = rotation * Vector3(farSize.x, 0.0f, 0.0f);
+    Vector3 rayUp = rotation * Vector3(0.0f, camera->FlipVertical() ? -farSize.y : farSize.y, 0.0f);
+
+    ShaderProgram* program = SetProgram("Shaders/VolumetricInject.glsl", Material::RendererVSDefines());
+    if (!program)
+        return;
+
+    SetUniform(program, "cameraPosition", camera->WorldPosition());
+    SetUniform(program, "frustumRayCenter", rayCenter);
+    SetUniform(program, "frustumRayRight", rayRight);
+    SetUniform(program, "frustumRayUp", rayUp);
+    SetUniform(program, "fogParams", Vector2(fogDensity, fogAnisotropy));
+    BindLighting();
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+    fogScatterTexture->BindImage(0, 0, IMAGE_WRITE);
+    DispatchCompute((fogGridSize.x + FOG_INJECT_GROUP_SIZE - 1) / FOG_INJECT_GROUP_SIZE, (fogGridSize.y + FOG_INJECT_GROUP_SIZE - 1) / FOG_INJECT_GROUP_SIZE,
+        (fogGridSize.z + FOG_INJECT_GROUP_SIZE - 1) / FOG_INJECT_GROUP_SIZE);
+
+    program = SetProgram("Shaders/VolumetricIntegrate.glsl");
+    if (!program)
+    {
+        Texture::UnbindImage(0);
+        return;
+    }
+
+    SetUniform(program, "frustumRayCenter", rayCenter);
+    SetUniform(program, "frustumRayRight", rayRight);
+    SetUniform(program, "frustumRayUp", rayUp);
+    fogScatterTexture->BindImage(0, 0, IMAGE_READ);
+    fogIntegratedTexture->BindImage(1, 0, IMAGE_WRITE);
+    DispatchCompute((fogGridSize.x + FOG_INTEGRATE_GROUP_SIZE - 1) / FOG_INTEGRATE_GROUP_SIZE, (fogGridSize.y + FOG_INTEGRATE_GROUP_SIZE - 1) / FOG_INTEGRATE_GROUP_SIZE);
+    Texture::UnbindImage(0);
+    Texture::UnbindImage(1);
+
+    program = SetProgram("Shaders/VolumetricFog.glsl");
+    if (!program)
+        return;
+
+    SetUniform(program, "depthLinearize", depthLinearize);
+    // Each slice holds the integration to its far end, so look up half a slice nearer
+    SetUniform(program, "fogDepthParams", Vector2(1.0f / camera->FarClip(), 0.5f / fogGridSize.z));
+    fogIntegratedTexture->Bind(0);
+    depthTexture->Bind(1);
+
+    // The fog color is premultiplied and the alpha is the opacity, so that the scene is attenuated by the transmittance
+    SetRenderState(BLEND_PREMULALPHA, CULL_NONE, CMP_ALWAYS, true, false);
+    DrawQuad();
+
+    Texture::Unbind(0);
+    Texture::Unbind(1);
+    lastMaterial = nullptr;
+    lastPass = nullptr;
+}
+
+bool Renderer::EnableShadingRate()
+{
+    if (!variableRateShading || !shadingRateImage || shadingRateSize == IntVector2::ZERO)
+        return false;
+
+    // The image is in screen space, so it applies only to views the size of the color texture it was written from
+    const IntRect& viewport = graphics->PendingState().viewport;
+    if (viewport.Width() != shadingRateSize.x || viewport.Height() != shadingRateSize.y)
+        return false;
+
+    shadingRateImage->Enable();
+    return true;
+}
+
+bool Renderer::BakeImpostor(StaticModel* source, float distance, int framesPerSide, int frameSize)
+{
+    Model* model = source ? source->GetModel() : nullptr;
+    if (!model || !model->NumGeometries() || framesPerSide < 1 || frameSize < 1)
+        return false;
+
+    PROFILE(BakeImpostor);
+
+    const BoundingBox& bounds = model->LocalBoundingBox();
+    Vector3 center = bounds.Center();
+    float radius = bounds.HalfSize().Length();
+    if (radius <= 0.0f)
+        return false;
+
+    IntVector2 atlasSize(framesPerSide * frameSize, framesPerSide * frameSize);
+    SharedPtr<Texture> atlasTexture(new Texture());
+    SharedPtr<Texture> depthTexture(new Texture());
+    SharedPtr<FrameBuffer> bakeFbo(new FrameBuffer());
+    if (!atlasTexture->Define(TEX_2D, atlasSize, FMT_RGBA8) || !depthTexture->Define(TEX_2D, atlasSize, FMT_D32))
+        return false;
+    atlasTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    bakeFbo->Define(atlasTexture, depthTexture);
+
+    bakeFbo->Bind();
+    SetViewport(IntRect(0, 0, atlasSize.x, atlasSize.y));
+    Clear(true, true, IntRect::ZERO, Color(0.0f, 0.0f, 0.0f, 0.0f));
+    SetRenderState(BLEND_REPLACE, CULL_BACK, CMP_LESS, true, true);
+
+    AutoPtr<Camera> bakeCamera(new Camera());
+    bakeCamera->SetOrthographic(true);
+    bakeCamera->SetOrthoSize(2.0f * radius);
+    bakeCamera->SetAspectRatio(1.0f);
+    bakeCamera->SetNearClip(radius * 0.01f);
+    bakeCamera->SetFarClip(radius * 4.0f);
+
+    for (int y = 0; y < framesPerSide; ++y)
     {
-        if (!lastDepthBias)
+        for (int x = 0; x < framesPerSide; ++x)
         {
-            glEnable(GL_POLYGON_OFFSET_FILL);
-            lastDepthBias = true;
+            // The camera basis must match the quad orientation in Impostor.glsl
+            Vector3 direction = ImpostorFrameDirection(x, y, framesPerSide);
+            Vector3 up = fabsf(direction.y) > 0.99f ? Vector3::FORWARD : Vector3::UP;
+            bakeCamera->SetPosition(center + direction * 2.0f * radius);
+            bakeCamera->LookAt(center, up);
+
+            UpdatePerViewData(bakeCamera.Get());
+            SetViewport(IntRect(x * frameSize, y * frameSize, (x + 1) * frameSize, (y + 1) * frameSize));
+
+            for (size_t i = 0; i < model->NumGeometries(); ++i)
+            {
+                Geometry* geometry = model->GetGeometry(i, 0);
+                Material* material = source->GetMaterial(i);
+                if (!geometry || !material || !geometry->vertexBuffer)
+                    continue;
+
+                Texture* diffuseTexture = material->GetTexture(0);
+                ShaderProgram* program = SetProgram("Shaders/ImpostorBake.glsl", diffuseTexture ? "DIFFUSEMAP" : JSONValue::emptyString,
+                    diffuseTexture ? "DIFFUSEMAP" : JSONValue::emptyString);
+                if (!program)
+                    continue;
+
+                glUniformMatrix3x4fv(program->Uniform(U_WORLDMATRIX), 1, GL_FALSE, Matrix3x4::IDENTITY.Data());
+                material->GetUniformBuffer()->Bind(UB_MATERIALDATA);
+                if (diffuseTexture)
+                    diffuseTexture->Bind(0);
+
+                VertexBuffer* vb = geometry->vertexBuffer;
+                IndexBuffer* ib = geometry->indexBuffer;
+                if (useVertexArrays)
+                    VertexArrayCache::Bind(vb, ib, program->Attributes());
+                else
+                {
+                    vb->Bind(program->Attributes());
+                    if (ib)
+                        ib->Bind();
+                }
+
+                graphics->FlushState();
+                if (!ib)
+                    glDrawArrays(GL_TRIANGLES, (GLsizei)geometry->drawStart, (GLsizei)geometry->drawCount);
+                else
+                    glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)geometry->drawCount, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                        (const void*)(geometry->drawStart * ib->IndexSize()), geometry->baseVertex);
+            }
         }
+    }
+
+    FrameBuffer::Unbind();
+    Texture::Unbind(0);
+    if (useVertexArrays)
+        VertexArrayCache::BindDefault();
+    lastMaterial = nullptr;
+    lastPass = nullptr;
 
-        glPolygonOffset(slopeScaleBias, constantBias);
+    // The quad corners are expanded toward the camera in the vertex shader. Texture coordinates hold the corner offsets
+    float vertexData[] = {
+        center.x, center.y, center.z, -radius, -radius,
+        center.x, center.y, center.z, radius, -radius,
+        center.x, center.y, center.z, radius, radius,
+        center.x, center.y, center.z, -radius, radius
+    };
+    unsigned short indexData[] = { 0, 2, 1, 0, 3, 2 };
+
+    std::vector<VertexElement> vertexElements;
+    vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+    vertexElements.push_back(VertexElement(ELEM_VECTOR2, SEM_TEXCOORD));
+
+    SharedPtr<Geometry> impostorGeometry(new Geometry());
+    impostorGeometry->vertexBuffer = new VertexBuffer();
+    impostorGeometry->vertexBuffer->Define(USAGE_DEFAULT, 4, vertexElements, vertexData);
+    impostorGeometry->indexBuffer = new IndexBuffer();
+    impostorGeometry->indexBuffer->Define(USAGE_DEFAULT, 6, sizeof(unsigned short), indexData);
+    impostorGeometry->drawStart = 0;
+    impostorGeometry->drawCount = 6;
+
+    SharedPtr<Material> impostorMaterial(new Material());
+    impostorMaterial->SetTexture(0, atlasTexture);
+    impostorMaterial->SetUniform(U_MATDIFFCOLOR, Vector4::ONE);
+    impostorMaterial->SetCullMode(CULL_NONE);
+    Pass* pass = impostorMaterial->CreatePass(PASS_OPAQUE);
+    pass->SetShader(Subsystem<ResourceCache>()->LoadResource<Shader>("Shaders/Impostor.glsl"), FormatString("FRAMES=%d", framesPerSide));
+    // Less-equal depth test keeps the impostors out of the depth pre-pass, as the alpha test decides their coverage
+    pass->SetRenderState(BLEND_REPLACE, CMP_LESS_EQUAL, true, true);
+
+    model->SetImpostor(impostorGeometry, impostorMaterial, distance);
+    return true;
+}
+
+void Renderer::UpdateOcclusionBuffer(Texture* depthTexture)
+{
+    // Keep only one readback in flight
+    if (!occlusionCulling || !depthTexture || !depthTexture->Width() || !camera || occlusionFence)
+        return;
+
+    PROFILE(UpdateOcclusionBuffer);
+    PROFILE_GPU(UpdateOcclusionBuffer);
+
+    IntVector2 size(OCCLUSION_BUFFER_WIDTH, Max((OCCLUSION_BUFFER_WIDTH * depthTexture->Height() + depthTexture->Width() - 1) / depthTexture->Width(), 1));
+
+    if (!occlusionTexture)
+    {
+        occlusionTexture = new Texture();
+        occlusionFbo = new FrameBuffer();
+        glGenBuffers(1, &occlusionPixelBuffer);
+    }
+
+    if (occlusionTexture->Width() != size.x || occlusionTexture->Height() != size.y)
+    {
+        occlusionTexture->Define(TEX_2D, size, FMT_R32F);
+        occlusionTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        occlusionFbo->Define(occlusionTexture, nullptr);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, occlusionPixelBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size.x * size.y * sizeof(float), nullptr, GL_STREAM_READ);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
     }
+
+    occlusionFbo->Bind();
+    SetViewport(IntRect(0, 0, size.x, size.y));
+    ShaderProgram* program = SetProgram("Shaders/OcclusionDepth.glsl");
+    if (!program)
+        return;
+
+    SetUniform(program, "destSize", Vector2((float)size.x, (float)size.y));
+    SetUniform(program, "depthConversion", depthConversion);
+    depthTexture->Bind(0);
+    SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+    DrawQuad();
+    Texture::Unbind(0);
+
+    // Read back into the pixel buffer to not stall, and fetch the data on a later frame once the fence has been passed
+    occlusionFbo->BindRead();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, occlusionPixelBuffer);
+    glReadPixels(0, 0, size.x, size.y, GL_RED, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    occlusionFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    occlusionViewProj = viewProjMatrix;
+    occlusionPendingCamera = camera;
+}
+
+void Renderer::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite)
+{
+    graphics->SetRenderState(blendMode, cullMode, depthReversed ? reversedCompareModes[depthTest] : depthTest, colorWrite, depthWrite);
+}
+void Renderer::SetDepthBias(float constantBias, float slopeScaleBias)
+{
+    graphics->SetDepthBias(constantBias, slopeScaleBias);
 }
 
 void Renderer::SetUniform(ShaderProgram* program, const char* name, float value)
@@ -454,7 +1902,7 @@ void Renderer::SetUniform(ShaderProgram* program, const char* name, const Vector
 
 void Renderer::SetViewport(const IntRect& viewRect)
 {
-    glViewport(viewRect.left, viewRect.top, viewRect.right - viewRect.left, viewRect.bottom - viewRect.top);
+    graphics->SetViewport(viewRect);
 }
 
 ShaderProgram* Renderer::SetProgram(const std::string& shaderName, const std::string& vsDefines, const std::string& fsDefines)
@@ -465,44 +1913,72 @@ ShaderProgram* Renderer::SetProgram(const std::string& shaderName, const std::st
         return nullptr;
 
     ShaderProgram* program = shader->CreateProgram(vsDefines, fsDefines);
+    if (program != ShaderProgram::BoundProgram())
+        ++stats.programBinds;
     return program->Bind() ? program : nullptr;
 }
 
 void Renderer::Clear(bool clearColor, bool clearDepth, const IntRect& clearRect, const Color& backgroundColor)
 {
-    if (clearColor)
-    {
-        glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, backgroundColor.a);
-        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-        lastColorWrite = true;
-    }
-    if (clearDepth)
-    {
-        glDepthMask(GL_TRUE);
-        lastDepthWrite = true;
-    }
-
-    GLenum glClearBits = 0;
-    if (clearColor)
-        glClearBits |= GL_COLOR_BUFFER_BIT;
-    if (clearDepth)
-        glClearBits |= GL_DEPTH_BUFFER_BIT;
-
-    if (clearRect == IntRect::ZERO)
-        glClear(glClearBits);
-    else
-    {
-        glEnable(GL_SCISSOR_TEST);
-        glScissor(clearRect.left, clearRect.top, clearRect.right - clearRect.left, clearRect.bottom - clearRect.top);
-        glClear(glClearBits);
-        glDisable(GL_SCISSOR_TEST);
-    }
+    graphics->Clear(clearColor, clearDepth, clearRect, backgroundColor);
 }
 
 void Renderer::DrawQuad()
 {
     quadVertexBuffer->Bind(0x1);
+    stats.stateChanges += graphics->FlushState();
     glDrawArrays(GL_TRIANGLES, 0, 6);
+    ++stats.drawCalls;
+    stats.triangles += 2;
+}
+
+void Renderer::DispatchCompute(unsigned groupsX, unsigned groupsY, unsigned groupsZ)
+{
+    glDispatchCompute(groupsX, groupsY, groupsZ);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void Renderer::Upscale(Texture* source, FrameBuffer* dest, const IntRect& destRect)
+{
+    PROFILE(Upscale);
+
+    if (source)
+    {
+        PROFILE_GPU(Upscale);
+
+        if (dest)
+            dest->Bind();
+        else
+            FrameBuffer::Unbind();
+        SetViewport(destRect);
+
+        ShaderProgram* program = SetProgram("Shaders/Upscale.glsl", JSONValue::emptyString, upscaleMode == UPSCALE_SHARPEN_BILINEAR ? "SHARPEN" : JSONValue::emptyString);
+        SetUniform(program, "sourceInvSize", Vector2(1.0f / source->Width(), 1.0f / source->Height()));
+        SetUniform(program, "sharpness", upscaleSharpness);
+        source->Bind(0);
+        SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+        DrawQuad();
+        Texture::Unbind(0);
+    }
+
+    if (frameBeginQuery)
+    {
+        unsigned endQuery;
+        if (freeFrameQueries.size())
+        {
+            endQuery = freeFrameQueries.back();
+            freeFrameQueries.pop_back();
+        }
+        else
+            glGenQueries(1, &endQuery);
+
+        glQueryCounter(endQuery, GL_TIMESTAMP);
+        pendingFrameQueries.push_back(frameBeginQuery);
+        pendingFrameQueries.push_back(endQuery);
+        frameBeginQuery = 0;
+    }
+
+    UpdateDynamicResolution();
 }
 
 void Renderer::CollectVisibleNodes()
@@ -510,32 +1986,195 @@ void Renderer::CollectVisibleNodes()
     PROFILE(CollectVisibleNodes);
 
     octree->Update(frameNumber);
-    octree->FindNodesMasked(frustum, this, &Renderer::CollectGeometriesAndLights);
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+
+    // Reuse the per-thread lists of the previous view if nothing that affects visibility has changed. The software occlusion buffer would be rasterized the same
+    visibilityReused = frameCoherence && !occlusionCulling && camera == coherentCamera && octree == coherentOctree && octree->Generation() == coherentOctreeGeneration &&
+        viewMask == coherentViewMask && camera->ViewMatrix() == coherentViewMatrix && camera->ProjectionMatrix(false) == coherentProjection &&
+        camera->LodBudgetScale() == coherentLodBudgetScale && (!staticBatchCaching || SourceBatches::AssignmentGeneration() == coherentAssignmentGeneration);
+
+    if (softwareOcclusion && !visibilityReused)
+        RasterizeOccluders();
+
+    // The occlusion buffer is valid only for the camera it was rendered from
+    if (softwareOcclusion && softwareOcclusionBuffer.IsValid())
+        activeOcclusionBuffer = &softwareOcclusionBuffer;
+    else
+        activeOcclusionBuffer = (occlusionCulling && occlusionBuffer.IsValid() && occlusionBufferCamera == camera) ? &occlusionBuffer : nullptr;
+
+    if (!visibilityReused)
+    {
+        if (threadVisibleNodes.size() < numThreads)
+            threadVisibleNodes.resize(numThreads);
+        for (auto it = threadVisibleNodes.begin(); it != threadVisibleNodes.end(); ++it)
+        {
+            it->geometries.clear();
+            it->lights.clear();
+            it->cachedOctants.clear();
+        }
+
+        if (IsViewGroupValid())
+        {
+            // The octree was already queried for the whole view group, so only test its nodes against this view
+            size_t numTasks = numThreads > 1 ? (viewGroupNodes.size() + GEOMETRIES_PER_TASK - 1) / GEOMETRIES_PER_TASK : 1;
+            while (collectViewGroupTasks.size() < numTasks)
+                collectViewGroupTasks.push_back(new RangeTask<Renderer>(this, &Renderer::CollectViewGroupNodesWork));
+
+            TaskCounter counter(0);
+            for (size_t i = 0; i < numTasks; ++i)
+            {
+                RangeTask<Renderer>* task = collectViewGroupTasks[i];
+                task->start = i * GEOMETRIES_PER_TASK;
+                task->end = numTasks > 1 ? std::min((i + 1) * GEOMETRIES_PER_TASK, viewGroupNodes.size()) : viewGroupNodes.size();
+                if (numThreads > 1)
+                    workQueue->QueueTask(task, &counter);
+                else
+                    CollectViewGroupNodesWork(task, 0);
+            }
+
+            if (numThreads > 1)
+                workQueue->Complete(counter);
+        }
+        else if (numThreads > 1)
+        {
+            // Split the query into the top level subtrees and cull them in parallel, each thread into its own lists
+            octreeSubtrees.clear();
+            octree->SplitQueryMasked(octreeSubtrees, frustum, OCTREE_SPLIT_DEPTH);
+
+            while (collectSubtreesTasks.size() < octreeSubtrees.size())
+                collectSubtreesTasks.push_back(new RangeTask<Renderer>(this, &Renderer::CollectSubtreesWork));
+
+            TaskCounter counter(0);
+            for (size_t i = 0; i < octreeSubtrees.size(); ++i)
+            {
+                RangeTask<Renderer>* task = collectSubtreesTasks[i];
+                task->start = i;
+                task->end = i + 1;
+                workQueue->QueueTask(task, &counter);
+            }
+
+            workQueue->Complete(counter);
+        }
+        else
+            octree->FindNodesMasked(frustum, this, &Renderer::CollectGeometriesAndLights, activeOcclusionBuffer);
+
+        coherentCamera = camera;
+        coherentOctree = octree;
+        coherentViewMatrix = camera->ViewMatrix();
+        coherentProjection = camera->ProjectionMatrix(false);
+        coherentViewMask = viewMask;
+        coherentOctreeGeneration = octree->Generation();
+        coherentAssignmentGeneration = SourceBatches::AssignmentGeneration();
+        coherentLodBudgetScale = camera->LodBudgetScale();
+    }
+
+    // Merge the per-thread lists
+    for (auto tIt = threadVisibleNodes.begin(); tIt != threadVisibleNodes.end(); ++tIt)
+    {
+        geometries.insert(geometries.end(), tIt->geometries.begin(), tIt->geometries.end());
+
+        for (auto it = tIt->lights.begin(); it != tIt->lights.end(); ++it)
+        {
+            Light* light = *it;
+            // The octree tests only the bounding box, so cull spot lights whose cone misses the view
+            if (light->OnPrepareRender(frameNumber, camera) && (light->GetLightType() != LIGHT_SPOT || frustum.Intersects(light->WorldFrustum())))
+            {
+                if (light->GetLightType() != LIGHT_DIRECTIONAL)
+                    lights.push_back(light);
+                else if (!dirLight || light->GetColor().Average() > dirLight->GetColor().Average())
+                    dirLight = light;
+            }
+        }
+    }
+
+    // Let the geometries prepare themselves for rendering, in chunks if there are many. Each chunk writes only to its own slots
+    if (numThreads > 1 && geometries.size() > GEOMETRIES_PER_TASK)
+    {
+        size_t numTasks = (geometries.size() + GEOMETRIES_PER_TASK - 1) / GEOMETRIES_PER_TASK;
+        while (prepareGeometriesTasks.size() < numTasks)
+            prepareGeometriesTasks.push_back(new RangeTask<Renderer>(this, &Renderer::PrepareGeometriesWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<Renderer>* task = prepareGeometriesTasks[i];
+            task->start = i * GEOMETRIES_PER_TASK;
+            task->end = std::min((i + 1) * GEOMETRIES_PER_TASK, geometries.size());
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+        PrepareGeometries(0, geometries.size());
+
+    geometries.erase(std::remove(geometries.begin(), geometries.end(), nullptr), geometries.end());
 }
 
 void Renderer::CollectLightInteractions(bool drawShadows)
 {
     PROFILE(CollectLightInteractions);
 
-    // Sort localized lights by increasing distance
+    // Sort localized lights by decreasing importance, then cull the unimportant and clamp to the budget and the maximum supported
     std::sort(lights.begin(), lights.end(), CompareLights);
 
-    // Clamp to maximum supported
-    if (lights.size() > MAX_LIGHTS)
-        lights.resize(MAX_LIGHTS);
+    while (!lights.empty() && lights.back()->Importance() < minLightImportance)
+        lights.pop_back();
+
+    size_t numShadedLights = shadedLightBudget ? Min(shadedLightBudget, maxLights) : maxLights;
+    if (lights.size() > numShadedLights)
+        lights.resize(numShadedLights);
+
+    // Shadows go to the most important lights within the budget
+    lightShadowed.resize(lights.size());
+    int numShadowedLights = 0;
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        Light* light = lights[i];
+        lightShadowed[i] = drawShadows && light->ShadowStrength() < 1.0f && light->Importance() >= minShadowImportance &&
+            (!shadowedLightBudget || numShadowedLights < shadowedLightBudget);
+        if (lightShadowed[i])
+            ++numShadowedLights;
+    }
 
-    // Pre-step for shadow map caching: reallocate all lights' shadow map rectangles which are non-zero at this point.
-    // If shadow maps were dirtied (size or bias change) reset all allocations instead
-    for (auto it = lights.begin(); it != lights.end(); ++it)
+    // Pre-step for shadow map caching: reserve all lights' shadow map rectangles which are non-zero at this point, before any new allocations, so that cached lights keep their place.
+    // If shadow maps were dirtied (size or bias change), or the atlas fragmented, reset all allocations instead. The lights are then allocated most important first
+    for (size_t i = 0; i < lights.size(); ++i)
     {
-        Light* light = *it;
-        if (shadowMapsDirty)
+        Light* light = lights[i];
+        if (shadowMapsDirty || (shadowAtlasFragmented && light->GetLightType() != LIGHT_DIRECTIONAL))
             light->SetShadowMap(nullptr);
-        else if (drawShadows && light->ShadowStrength() < 1.0f && light->ShadowRect() != IntRect::ZERO)
-            AllocateShadowMap(light);
+        else if (lightShadowed[i] && light->ShadowRect() != IntRect::ZERO)
+            AllocateShadowMap(light, true);
+    }
+    if (shadowAtlasFragmented)
+    {
+        shadowRepackFrame = frameNumber;
+        shadowAtlasFragmented = false;
     }
     shadowMapsDirty = false;
 
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+    bool threaded = numThreads > 1;
+
+    if (threadBatches.size() < numThreads)
+        threadBatches.resize(numThreads);
+
+    if (lightShadowCasters.size() < lights.size())
+    {
+        lightShadowCasters.resize(lights.size());
+        lightShadowCasterVisibility.resize(lights.size());
+    }
+    while (shadowQueryTasks.size() < lights.size())
+        shadowQueryTasks.push_back(new RangeTask<Renderer>(this, &Renderer::QueryShadowCastersWork));
+
+    shadowViewJobs.clear();
+    cubeShadowJobs.clear();
+    TaskCounter counter(0);
+
     for (size_t i = 0; i < lights.size(); ++i)
     {
         Light* light = lights[i];
@@ -547,27 +2186,49 @@ void Renderer::CollectLightInteractions(bool drawShadows)
         lightData[i].color = light->EffectiveColor();
         lightData[i].shadowParameters = Vector4::ONE; // Assume unshadowed
 
-        if (!drawShadows || light->ShadowStrength() >= 1.0f)
+        // Fade out lights approaching the culling threshold
+        if (minLightImportance > 0.0f)
+        {
+            float fade = Clamp(light->Importance() / minLightImportance - 1.0f, 0.0f, 1.0f);
+            Color& color = lightData[i].color;
+            color = Color(color.r * fade, color.g * fade, color.b * fade, color.a);
+        }
+
+        lightShadowCasters[i].clear();
+
+        if (!lightShadowed[i])
         {
             light->SetShadowMap(nullptr);
             continue;
         }
 
         // Query for shadowcasters. Lit geometries (both opaque & alpha) are handled by frustum grid so need no bookkeeping
-        initialShadowCasters.clear();
+        RangeTask<Renderer>* task = shadowQueryTasks[i];
+        task->start = i;
+        task->end = i + 1;
+        if (threaded)
+            workQueue->QueueTask(task, &counter);
+        else
+            QueryShadowCastersWork(task, 0);
+    }
 
-        switch (light->GetLightType())
-        {
-        case LIGHT_POINT:
-            octree->FindNodes(reinterpret_cast<std::vector<OctreeNode*>&>(initialShadowCasters), light->WorldSphere(), NF_GEOMETRY | NF_CASTSHADOWS);
-            break;
+    if (threaded)
+        workQueue->Complete(counter);
 
-        case LIGHT_SPOT:
-            octree->FindNodesMasked(reinterpret_cast<std::vector<OctreeNode*>&>(initialShadowCasters), light->WorldFrustum(), NF_GEOMETRY | NF_CASTSHADOWS);
-            break;
-        }
+    // Allocate shadow maps and setup shadow views serially, as the atlas is shared
+    unsigned usedShadowTexels = 0;
+    unsigned allocatedShadowTexels = 0;
 
-        if (!initialShadowCasters.size())
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        Light* light = lights[i];
+        std::vector<GeometryNode*>& initialShadowCasters = lightShadowCasters[i];
+        const std::vector<GeometryNode*>* staticShadowCasters = light->Static() ? &light->StaticShadowCasters() : nullptr;
+
+        if (!lightShadowed[i])
+            continue;
+
+        if (!initialShadowCasters.size() && (!staticShadowCasters || !staticShadowCasters->size()))
         {
             light->SetShadowMap(nullptr);
             continue;
@@ -580,25 +2241,71 @@ void Renderer::CollectLightInteractions(bool drawShadows)
                 continue;
         }
 
+        // Lights that do not fit the texel budget go unshadowed, while smaller ones after them may still fit
+        if (shadowAreaBudget)
+        {
+            unsigned texels = (unsigned)(light->ShadowRect().Width() * light->ShadowRect().Height());
+            if (allocatedShadowTexels + texels > shadowAreaBudget)
+            {
+                light->SetShadowMap(nullptr);
+                continue;
+            }
+            allocatedShadowTexels += texels;
+        }
+
         // Setup shadow cameras & find shadow casters
         light->SetupShadowViews(camera);
         std::vector<ShadowView>& shadowViews = light->ShadowViews();
 
+        // Far lights update less often, and once the texel budget is used, lights that may need an update wait. Lights are sorted most important first
+        bool deferUpdate = false;
+        if (light->GetLightType() != LIGHT_DIRECTIONAL && (shadowThrottleDistance > 0.0f || shadowTexelBudget))
+        {
+            unsigned short framesSinceRender = (unsigned short)(frameNumber - shadowViews[0].lastRenderFrame);
+            unsigned interval = shadowThrottleDistance > 0.0f ? (unsigned)Min(1 + (int)(light->Distance() / shadowThrottleDistance), (int)shadowMaxUpdateInterval) : 1;
+
+            if (framesSinceRender < interval)
+                deferUpdate = true;
+            else if (shadowTexelBudget && (!light->Static() || shadowViews[0].lastDynamicCasters))
+            {
+                unsigned texels = (unsigned)(light->ShadowRect().Width() * light->ShadowRect().Height());
+                if (usedShadowTexels + texels > shadowTexelBudget && framesSinceRender < shadowMaxUpdateInterval)
+                    deferUpdate = true;
+                else
+                    usedShadowTexels += texels;
+            }
+        }
+
         lightData[i].shadowParameters = light->ShadowParameters();
         lightData[i].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
 
+        // Dynamic point lights combine the static geometry of their faces into one queue, rendered for all faces at once. Static point lights cache each face separately
+        bool singlePass = singlePassPointShadows && light->GetLightType() == LIGHT_POINT && !light->Static();
+        if (singlePass)
+        {
+            ShadowMap& shadowMap = shadowMaps[1];
+            if (shadowMap.shadowBatches.size() < shadowMap.freeQueueIdx + 1)
+                shadowMap.shadowBatches.resize(shadowMap.freeQueueIdx + 1);
+
+            CubeShadowJob job;
+            job.light = light;
+            job.queueIdx = shadowMap.freeQueueIdx++;
+            cubeShadowJobs.push_back(job);
+        }
+
         for (size_t j = 0; j < shadowViews.size(); ++j)
         {
             ShadowView& view = shadowViews[j];
+            view.deferUpdate = deferUpdate;
+            view.singlePass = singlePass;
             shadowMaps[1].shadowViews.push_back(&view);
 
             switch (light->GetLightType())
             {
             case LIGHT_POINT:
                 // Check which lit geometries are shadow casters and inside each shadow frustum. First check whether the shadow frustum is inside the view at all
-                /// \todo Could use a frustum-frustum test for more accuracy
-                if (frustum.IsInsideFast(BoundingBox(view.shadowFrustum)))
-                    CollectShadowBatches(shadowMaps[1], view, initialShadowCasters, true);
+                if (frustum.Intersects(view.shadowFrustum))
+                    AddShadowViewJob(shadowMaps[1], view, &initialShadowCasters, staticShadowCasters, &lightShadowCasterVisibility[i], false, true);
                 else
                 {
                     // If not inside the view (and thus not rendered), cannot consider it cached for next frame. However shadow map render this frame is a no-op
@@ -608,8 +2315,8 @@ void Renderer::CollectLightInteractions(bool drawShadows)
                 break;
 
             case LIGHT_SPOT:
-                // For spot light need no frustum check
-                CollectShadowBatches(shadowMaps[1], view, initialShadowCasters, false);
+                // Spot lights outside the view were already culled when collecting them
+                AddShadowViewJob(shadowMaps[1], view, &initialShadowCasters, staticShadowCasters, &lightShadowCasterVisibility[i], false, false);
                 break;
             }
         }
@@ -625,84 +2332,310 @@ void Renderer::CollectLightInteractions(bool drawShadows)
             dirLight->SetupShadowViews(camera);
 
             std::vector<ShadowView>& shadowViews = dirLight->ShadowViews();
+            if (dirLightShadowCasters.size() < shadowViews.size())
+                dirLightShadowCasters.resize(shadowViews.size());
 
             for (size_t i = 0; i < shadowViews.size(); ++i)
             {
                 ShadowView& view = shadowViews[i];
+                // When interleaving, the cascades beyond the first update on alternate frames, staggered so that the work spreads evenly
+                view.deferUpdate = shadowCascadeInterleave && i > 0 && ((frameNumber + i) & 1);
                 shadowMaps[0].shadowViews.push_back(&view);
 
                 // Directional light needs a new frustum query for each split, as the shadow cameras are typically far outside the main view
-                initialShadowCasters.clear();
-                octree->FindNodesMasked(reinterpret_cast<std::vector<OctreeNode*>&>(initialShadowCasters), view.shadowFrustum, NF_GEOMETRY | NF_CASTSHADOWS);
-
-                CollectShadowBatches(shadowMaps[0], view, initialShadowCasters, false);
+                AddShadowViewJob(shadowMaps[0], view, &dirLightShadowCasters[i], nullptr, nullptr, true, false);
             }
         }
     }
 
+    // Collect shadow batches of each view
+    while (shadowBatchesTasks.size() < shadowViewJobs.size())
+        shadowBatchesTasks.push_back(new RangeTask<Renderer>(this, &Renderer::CollectShadowBatchesWork));
+
+    for (size_t i = 0; i < shadowViewJobs.size(); ++i)
+    {
+        RangeTask<Renderer>* task = shadowBatchesTasks[i];
+        task->start = i;
+        task->end = i + 1;
+        if (threaded)
+            workQueue->QueueTask(task, &counter);
+        else
+            CollectShadowBatchesWork(task, 0);
+    }
+
+    if (threaded)
+        workQueue->Complete(counter);
+
+    // Combine the face batches of single-pass point lights once all faces have been collected
+    while (cubeShadowTasks.size() < cubeShadowJobs.size())
+        cubeShadowTasks.push_back(new RangeTask<Renderer>(this, &Renderer::CombineCubeShadowBatchesWork));
+
+    for (size_t i = 0; i < cubeShadowJobs.size(); ++i)
+    {
+        RangeTask<Renderer>* task = cubeShadowTasks[i];
+        task->start = i;
+        task->end = i + 1;
+        if (threaded)
+            workQueue->QueueTask(task, &counter);
+        else
+            CombineCubeShadowBatchesWork(task, 0);
+    }
+
+    if (threaded)
+        workQueue->Complete(counter);
+
     // Update cluster frustums and bounding boxes if camera changed
     DefineClusterFrustums();
+    // The decals are assigned on the CPU also with GPU light culling
+    CollectDecals();
+
+    stats.lights = lights.size();
+    stats.clusters = numClusters;
+
+    // The lights are assigned to the clusters when rendering
+    if (gpuLightCulling)
+        return;
 
     // Clear per-cluster light data
-    memset(numClusterLights, 0, sizeof numClusterLights);
-    memset(clusterData, 0, sizeof clusterData);
+    std::fill(numClusterLights.begin(), numClusterLights.end(), (unsigned char)0);
 
-    // Cull lights against each cluster frustum.
+    // Calculate view space bounds and the affected cluster XY range of each light
     Matrix3x4 cameraView = camera->ViewMatrix();
+    Matrix4 cameraProj = camera->ProjectionMatrix(false);
+
+    if (lightClusterBounds.size() < lights.size())
+        lightClusterBounds.resize(lights.size());
 
     for (size_t i = 0; i < lights.size(); ++i)
     {
         Light* light = lights[i];
+        LightClusterBounds& bounds = lightClusterBounds[i];
 
-        if (light->GetLightType() == LIGHT_POINT)
+        if (light->GetLightType() == LIGHT_SPOT)
         {
-            Sphere bounds(cameraView * light->WorldPosition(), light->Range());
-            float minViewZ = bounds.center.z - light->Range();
-            float maxViewZ = bounds.center.z + light->Range();
+            bounds.frustum = light->WorldFrustum().Transformed(cameraView);
+            bounds.box.Define(bounds.frustum);
+        }
+        else
+        {
+            bounds.sphere = Sphere(cameraView * light->WorldPosition(), light->Range());
+            bounds.box.Define(bounds.sphere);
+        }
+
+        bounds.clusterRect = ClusterRect(bounds.box, cameraProj);
+    }
+
+    // Cull lights against each cluster frustum, one Z slice per task
+    while (clusterLightsTasks.size() < (size_t)clusterSize.z)
+        clusterLightsTasks.push_back(new RangeTask<Renderer>(this, &Renderer::CullClusterLightsWork));
+
+    for (size_t z = 0; z < (size_t)clusterSize.z; ++z)
+    {
+        RangeTask<Renderer>* task = clusterLightsTasks[z];
+        task->start = z;
+        task->end = z + 1;
+        if (threaded && lights.size())
+            workQueue->QueueTask(task, &counter);
+        else
+            CullClusterLightsWork(task, 0);
+    }
+
+    if (threaded)
+        workQueue->Complete(counter);
+
+    // Pack the per-cluster light slots into a contiguous list
+    numLightIndices = 0;
+    for (size_t i = 0; i < numClusters; ++i)
+    {
+        size_t count = numClusterLights[i];
+        clusterData[i] = (unsigned)(numLightIndices << 8 | count);
+        if (count)
+        {
+            if (count > stats.maxClusterLights)
+                stats.maxClusterLights = count;
+            memcpy(&lightIndices[numLightIndices], &clusterLightSlots[i * maxLightsPerCluster], count * sizeof(unsigned short));
+            numLightIndices += count;
+        }
+    }
+
+    stats.clusterLights = numLightIndices;
+}
+
+IntRect Renderer::ClusterRect(const BoundingBox& viewBox, const Matrix4& cameraProj) const
+{
+    // If the bounds cross the near plane, the projection is not usable, so test the whole slice
+    if (!camera->IsOrthographic() && viewBox.min.z < camera->NearClip())
+        return IntRect(0, 0, clusterSize.x - 1, clusterSize.y - 1);
+
+    Vector3 firstProjected = cameraProj * viewBox.min;
+    Vector2 screenMin(firstProjected.x, firstProjected.y);
+    Vector2 screenMax(screenMin);
+    for (unsigned j = 1; j < 8; ++j)
+    {
+        Vector3 corner((j & 1) ? viewBox.max.x : viewBox.min.x, (j & 2) ? viewBox.max.y : viewBox.min.y, (j & 4) ? viewBox.max.z : viewBox.min.z);
+        Vector3 projected = cameraProj * corner;
+        screenMin.x = Min(screenMin.x, projected.x);
+        screenMin.y = Min(screenMin.y, projected.y);
+        screenMax.x = Max(screenMax.x, projected.x);
+        screenMax.y = Max(screenMax.y, projected.y);
+    }
+
+    // Mark boxes entirely outside the screen with an empty rect
+    if (screenMax.x < -1.0f || screenMin.x > 1.0f || screenMax.y < -1.0f || screenMin.y > 1.0f)
+        return IntRect(0, 0, -1, -1);
+
+    // Cluster Y index increases downward
+    return IntRect(
+        Clamp((int)((screenMin.x + 1.0f) * 0.5f * clusterSize.x), 0, clusterSize.x - 1),
+        Clamp((int)((1.0f - screenMax.y) * 0.5f * clusterSize.y), 0, clusterSize.y - 1),
+        Clamp((int)((screenMax.x + 1.0f) * 0.5f * clusterSize.x), 0, clusterSize.x - 1),
+        Clamp((int)((1.0f - screenMin.y) * 0.5f * clusterSize.y), 0, clusterSize.y - 1)
+    );
+}
+
+void Renderer::CollectDecals()
+{
+    numVisibleDecals = 0;
+    numDecalTexels = 0;
+    if (!decalSet || !decalSet->NumDecals())
+        return;
+
+    PROFILE(CollectDecals);
+
+    // Keep the newest visible decals, then reverse so that the newer blend over the older
+    visibleDecals.clear();
+    for (size_t i = decalSet->NumDecals(); i-- > 0 && visibleDecals.size() < (size_t)maxDecals;)
+    {
+        const Decal& decal = decalSet->GetDecal(i);
+        if (frustum.IsInsideFast(decal.worldBox))
+            visibleDecals.push_back(&decal);
+    }
+    std::reverse(visibleDecals.begin(), visibleDecals.end());
 
-            for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+    numVisibleDecals = visibleDecals.size();
+    if (!numVisibleDecals)
+        return;
+
+    std::fill(numClusterDecals.begin(), numClusterDecals.end(), (unsigned char)0);
+
+    Matrix3x4 cameraView = camera->ViewMatrix();
+    Matrix4 cameraProj = camera->ProjectionMatrix(false);
+    const BoundingBox unitBox(Vector3(-0.5f, -0.5f, -0.5f), Vector3(0.5f, 0.5f, 0.5f));
+
+    // The decals are few compared to the clusters they cover, so assign them serially against the cluster bounding boxes
+    for (size_t i = 0; i < numVisibleDecals; ++i)
+    {
+        const Decal& decal = *visibleDecals[i];
+        DecalData& data = decalData[i];
+        data.inverseTransform = decal.inverseTransform;
+        data.atlasRect = decal.atlasRect;
+        data.parameters = Vector4(decal.opacity, 0.0f, 0.0f, 0.0f);
+
+        BoundingBox viewBox = unitBox.Transformed(cameraView * decal.transform);
+        IntRect rect = ClusterRect(viewBox, cameraProj);
+        unsigned short decalIndex = (unsigned short)i;
+
+        for (int z = 0; z < clusterSize.z; ++z)
+        {
+            size_t sliceStart = z * clusterSize.x * clusterSize.y;
+            if (viewBox.min.z > clusterFrustums[sliceStart].vertices[4].z || viewBox.max.z < clusterFrustums[sliceStart].vertices[0].z)
+                continue;
+
+            size_t xStart = rect.left;
+            size_t xEnd = rect.right + 1;
+
+            for (int y = rect.top; y <= rect.bottom; ++y)
             {
-                size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-                if (minViewZ > clusterFrustums[idx].vertices[4].z || maxViewZ < clusterFrustums[idx].vertices[0].z || numClusterLights[idx] >= MAX_LIGHTS_CLUSTER)
-                    continue;
+                size_t rowStart = sliceStart + y * clusterSize.x;
 
-                for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+                for (size_t x = xStart; x < xEnd; x += 4)
                 {
-                    for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                    size_t idx = rowStart + x;
+                    size_t count = std::min(xEnd - x, (size_t)4);
+                    unsigned mask = BoxIntersectsClusters(viewBox, idx, count);
+
+                    for (size_t j = 0; j < count; ++j, ++idx)
                     {
-                        if (bounds.IsInsideFast(clusterBoundingBoxes[idx]) && clusterFrustums[idx].IsInsideFast(bounds))
+                        if ((mask & (1 << j)) && numClusterDecals[idx] < MAX_DECALS_CLUSTER)
                         {
-                            clusterData[idx * MAX_LIGHTS_CLUSTER + numClusterLights[idx]] = (unsigned char)(i + 1);
-                            ++numClusterLights[idx];
+                            clusterDecalSlots[idx * MAX_DECALS_CLUSTER + numClusterDecals[idx]] = decalIndex;
+                            ++numClusterDecals[idx];
                         }
-                        ++idx;
                     }
                 }
             }
         }
-        else if (light->GetLightType() == LIGHT_SPOT)
+    }
+
+    // Pack the per-cluster decal slots after the cluster offsets and counts
+    size_t numDecalIndices = 0;
+    unsigned short* decalIndices = reinterpret_cast<unsigned short*>(&decalIndexData[numClusters]);
+    for (size_t i = 0; i < numClusters; ++i)
+    {
+        size_t count = numClusterDecals[i];
+        decalIndexData[i] = (unsigned)(numDecalIndices << 8 | count);
+        if (count)
+        {
+            memcpy(decalIndices + numDecalIndices, &clusterDecalSlots[i * MAX_DECALS_CLUSTER], count * sizeof(unsigned short));
+            numDecalIndices += count;
+        }
+    }
+
+    numDecalTexels = numClusters + (numDecalIndices + 1) / 2;
+}
+
+void Renderer::CullClusterLightsWork(Task* task, unsigned)
+{
+    PROFILE(CullClusterLightsWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+
+    for (size_t z = rangeTask->start; z < rangeTask->end; ++z)
+    {
+        size_t sliceStart = z * clusterSize.x * clusterSize.y;
+        float sliceNear = clusterFrustums[sliceStart].vertices[0].z;
+        float sliceFar = clusterFrustums[sliceStart].vertices[4].z;
+
+        for (size_t i = 0; i < lights.size(); ++i)
         {
-            Frustum bounds(light->WorldFrustum().Transformed(cameraView));
-            BoundingBox boundsBox(bounds); 
-            float minViewZ = boundsBox.min.z;
-            float maxViewZ = boundsBox.max.z;
+            const LightClusterBounds& bounds = lightClusterBounds[i];
+            if (bounds.box.min.z > sliceFar || bounds.box.max.z < sliceNear)
+                continue;
+
+            bool isSpot = lights[i]->GetLightType() == LIGHT_SPOT;
+            unsigned short lightIndex = (unsigned short)i;
+            size_t xStart = bounds.clusterRect.left;
+            size_t xEnd = bounds.clusterRect.right + 1;
 
-            for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+            for (int y = bounds.clusterRect.top; y <= bounds.clusterRect.bottom; ++y)
             {
-                size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-                if (minViewZ > clusterFrustums[idx].vertices[4].z || maxViewZ < clusterFrustums[idx].vertices[0].z || numClusterLights[idx] >= MAX_LIGHTS_CLUSTER)
-                    continue;
+                size_t rowStart = sliceStart + y * clusterSize.x;
 
-                for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+                for (size_t x = xStart; x < xEnd; x += 4)
                 {
-                    for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                    // Coarse test of 4 clusters at a time against the light sphere or bounding box
+                    size_t idx = rowStart + x;
+                    size_t count = std::min(xEnd - x, (size_t)4);
+                    unsigned mask = isSpot ? BoxIntersectsClusters(bounds.box, idx, count) : SphereIntersectsClusters(bounds.sphere, idx, count);
+                    if (isSpot && mask)
+                    {
+                        unsigned inside;
+                        bounds.frustum.IsInsideMaskedFast(&clusterMinX[idx], &clusterMinY[idx], &clusterMinZ[idx], &clusterMaxX[idx], &clusterMaxY[idx],
+                            &clusterMaxZ[idx], count, &inside);
+                        mask &= inside;
+                    }
+
+                    for (size_t j = 0; j < count; ++j, ++idx)
                     {
-                        if (bounds.IsInsideFast(clusterBoundingBoxes[idx]) && clusterFrustums[idx].IsInsideFast(boundsBox))
+                        if (!(mask & (1 << j)) || numClusterLights[idx] >= maxLightsPerCluster)
+                            continue;
+
+                        if (isSpot ? clusterFrustums[idx].IsInsideFast(bounds.box) : clusterFrustums[idx].IsInsideFast(bounds.sphere))
                         {
-                            clusterData[idx * MAX_LIGHTS_CLUSTER + numClusterLights[idx]] = (unsigned char)(i + 1);
+                            clusterLightSlots[idx * maxLightsPerCluster + numClusterLights[idx]] = lightIndex;
                             ++numClusterLights[idx];
                         }
-                        ++idx;
                     }
                 }
             }
@@ -710,109 +2643,413 @@ void Renderer::CollectLightInteractions(bool drawShadows)
     }
 }
 
-void Renderer::CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, const std::vector<GeometryNode*>& potentialShadowCasters, bool checkFrustum)
+unsigned Renderer::SphereIntersectsClusters(const Sphere& sphere, size_t idx, size_t count) const
 {
-    Light* light = view.light;
-    const Frustum& shadowFrustum = view.shadowFrustum;
-    BoundingBox lightViewFrustumBox(view.lightViewFrustum);
-    const Matrix3x4& lightView = view.shadowCamera->ViewMatrix();
+#ifdef TURSO3D_SSE
+    if (count == 4)
+    {
+        __m128 centerX = _mm_set1_ps(sphere.center.x);
+        __m128 centerY = _mm_set1_ps(sphere.center.y);
+        __m128 centerZ = _mm_set1_ps(sphere.center.z);
 
-    bool dynamicOrDirLight = light->GetLightType() == LIGHT_DIRECTIONAL || !light->Static();
-    bool hasDynamicCasters = false;
+        // Distance from the sphere center to the closest point of each box
+        __m128 dx = _mm_sub_ps(_mm_max_ps(_mm_min_ps(centerX, _mm_loadu_ps(&clusterMaxX[idx])), _mm_loadu_ps(&clusterMinX[idx])), centerX);
+        __m128 dy = _mm_sub_ps(_mm_max_ps(_mm_min_ps(centerY, _mm_loadu_ps(&clusterMaxY[idx])), _mm_loadu_ps(&clusterMinY[idx])), centerY);
+        __m128 dz = _mm_sub_ps(_mm_max_ps(_mm_min_ps(centerZ, _mm_loadu_ps(&clusterMaxZ[idx])), _mm_loadu_ps(&clusterMinZ[idx])), centerZ);
+        __m128 distSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
 
-    shadowCasters.clear();
+        return (unsigned)_mm_movemask_ps(_mm_cmplt_ps(distSquared, _mm_set1_ps(sphere.radius * sphere.radius)));
+    }
+#endif
+
+    unsigned mask = 0;
+    float radiusSquared = sphere.radius * sphere.radius;
 
-    for (auto it = potentialShadowCasters.begin(); it != potentialShadowCasters.end(); ++it)
+    for (size_t i = 0; i < count; ++i)
     {
-        GeometryNode* node = *it;
+        float dx = Clamp(sphere.center.x, clusterMinX[idx + i], clusterMaxX[idx + i]) - sphere.center.x;
+        float dy = Clamp(sphere.center.y, clusterMinY[idx + i], clusterMaxY[idx + i]) - sphere.center.y;
+        float dz = Clamp(sphere.center.z, clusterMinZ[idx + i], clusterMaxZ[idx + i]) - sphere.center.z;
+        if (dx * dx + dy * dy + dz * dz < radiusSquared)
+            mask |= 1 << i;
+    }
 
-        if (checkFrustum && !shadowFrustum.IsInsideFast(node->WorldBoundingBox()))
-            continue;
+    return mask;
+}
 
-        // If shadowcaster is not visible in the main view frustum, check whether its elongated bounding box is
-        // This is done only for dynamic objects or dynamic lights' shadows; cached static shadowmap needs to render everything
-        bool inView = node->LastFrameNumber() == frameNumber;
-        // If not in view, let the node prepare itself for render now. Note: is called for each light the object casts shadows from
-        if (!inView)
-        {
-            if (!node->OnPrepareRender(0, camera))
-                continue;
-        }
+unsigned Renderer::BoxIntersectsClusters(const BoundingBox& box, size_t idx, size_t count) const
+{
+#ifdef TURSO3D_SSE
+    if (count == 4)
+    {
+        __m128 outside = _mm_or_ps(_mm_cmplt_ps(_mm_set1_ps(box.max.x), _mm_loadu_ps(&clusterMinX[idx])),
+            _mm_cmpgt_ps(_mm_set1_ps(box.min.x), _mm_loadu_ps(&clusterMaxX[idx])));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_set1_ps(box.max.y), _mm_loadu_ps(&clusterMinY[idx])));
+        outside = _mm_or_ps(outside, _mm_cmpgt_ps(_mm_set1_ps(box.min.y), _mm_loadu_ps(&clusterMaxY[idx])));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_set1_ps(box.max.z), _mm_loadu_ps(&clusterMinZ[idx])));
+        outside = _mm_or_ps(outside, _mm_cmpgt_ps(_mm_set1_ps(box.min.z), _mm_loadu_ps(&clusterMaxZ[idx])));
+
+        return (unsigned)_mm_movemask_ps(outside) ^ 0xf;
+    }
+#endif
 
-        bool dynamicNode = !node->Static();
+    unsigned mask = 0;
 
-        if (!inView && (dynamicNode || dynamicOrDirLight))
-        { 
-            BoundingBox lightViewBox = node->WorldBoundingBox().Transformed(lightView);
-            
-            if (view.shadowCamera->IsOrthographic())
-                lightViewBox.max.z = Max(lightViewBox.max.z, lightViewFrustumBox.max.z);
-            else
-            {
-                // For perspective lights, extrusion direction depends on the position of the shadow caster
-                Vector3 center = lightViewBox.Center();
-                Ray extrusionRay(center, center);
-                
-                float extrusionDistance = view.shadowCamera->FarClip();
-                float originalDistance = Clamp(center.Length(), M_EPSILON, extrusionDistance);
-                
-                // Because of the perspective, the bounding box must also grow when it is extruded to the distance
-                float sizeFactor = extrusionDistance / originalDistance;
-                
-                // Calculate the endpoint box and merge it to the original. Because it's axis-aligned, it will be larger
-                // than necessary, so the test will be conservative
-                Vector3 newCenter = extrusionDistance * extrusionRay.direction;
-                Vector3 newHalfSize = lightViewBox.Size() * sizeFactor * 0.5f;
-                BoundingBox extrudedBox(newCenter - newHalfSize, newCenter + newHalfSize);
-                lightViewBox.Merge(extrudedBox);
-            }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (box.max.x >= clusterMinX[idx + i] && box.min.x <= clusterMaxX[idx + i] && box.max.y >= clusterMinY[idx + i] &&
+            box.min.y <= clusterMaxY[idx + i] && box.max.z >= clusterMinZ[idx + i] && box.min.z <= clusterMaxZ[idx + i])
+            mask |= 1 << i;
+    }
 
-            if (!view.lightViewFrustum.IsInsideFast(lightViewBox))
-                continue;
-        }
+    return mask;
+}
+
+void Renderer::QueryShadowCastersWork(Task* task, unsigned)
+{
+    PROFILE(QueryShadowCastersWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
 
-        shadowCasters.push_back(node);
+    size_t index = static_cast<RangeTask<Renderer>*>(task)->start;
+    Light* light = lights[index];
+    std::vector<OctreeNode*>& result = reinterpret_cast<std::vector<OctreeNode*>&>(lightShadowCasters[index]);
 
-        if (dynamicNode)
-            hasDynamicCasters = true;
+    // Static lights requery their static shadowcasters only when the light or the static geometry changes, so only the dynamic shadowcasters are queried each frame
+    unsigned short excludeFlags = 0;
+    if (light->Static())
+    {
+        light->UpdateStaticShadowCasters(octree);
+        excludeFlags = NF_STATIC;
     }
 
-    // Now determine which kind of caching can be used for the shadow map, and if we need to go further
-    // Dynamic or directional lights
-    if (dynamicOrDirLight)
+    switch (light->GetLightType())
     {
-        // If light atlas allocation changed, light moved, or amount of objects in view changed, render an optimized shadow map
-        if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f) || view.lastNumGeometries != shadowCasters.size())
-            view.renderMode = RENDER_DYNAMIC_LIGHT;
-        else
-        {
-            // Assume no rendering
-            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+    case LIGHT_POINT:
+        octree->FindNodes(result, light->WorldSphere(), NF_GEOMETRY | NF_CASTSHADOWS, LAYERMASK_ALL, excludeFlags);
+        break;
 
-            // If any of the objects moved this frame, same as above
-            for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
-            {
-                GeometryNode* node = *it;
-                if (node->LastUpdateFrameNumber() == frameNumber)
-                {
-                    view.renderMode = RENDER_DYNAMIC_LIGHT;
-                    break;
-                }
-            }
-        }
+    case LIGHT_SPOT:
+        octree->FindNodesMasked(result, light->WorldFrustum(), NF_GEOMETRY | NF_CASTSHADOWS, LAYERMASK_ALL, excludeFlags);
+        break;
     }
-    // Static lights
-    else
-    {
-        // If light atlas allocation has changed, or the static light changed, render a full shadow map now that can be cached next frame
-        if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f))
-            view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
-        else
-        {
-            // If has dynamic casters now or last frame, restore static shadow map
-            view.renderMode = (view.lastDynamicCasters || hasDynamicCasters) ? RENDER_STATIC_LIGHT_RESTORE_STATIC : RENDER_STATIC_LIGHT_CACHED;
 
-            // If static shadowcasters updated themselves (e.g. LOD change), render shadow map fully
+    // Prepare the shadowcasters outside the main view once here instead of in each shadow view of the light
+    const std::vector<GeometryNode*>& shadowCasters = lightShadowCasters[index];
+    ShadowCasterVisibility& visibility = lightShadowCasterVisibility[index];
+    size_t numCasters = shadowCasters.size();
+    visibility.renderable.resize((numCasters + 31) / 32);
+    std::fill(visibility.renderable.begin(), visibility.renderable.end(), 0u);
+
+    for (size_t i = 0; i < numCasters; ++i)
+    {
+        GeometryNode* node = shadowCasters[i];
+        if (node->LastFrameNumber() == frameNumber || node->OnPrepareRender(0, camera))
+            visibility.renderable[i >> 5] |= 1u << (i & 31);
+    }
+
+    // Point lights test the shadowcasters against each face frustum, so store the bounding boxes for the batched test
+    if (light->GetLightType() == LIGHT_POINT)
+    {
+        visibility.boxes.resize(numCasters * 6);
+        float* boxes = visibility.boxes.data();
+        for (size_t i = 0; i < numCasters; ++i)
+        {
+            const BoundingBox& box = shadowCasters[i]->WorldBoundingBox();
+            boxes[i] = box.min.x;
+            boxes[numCasters + i] = box.min.y;
+            boxes[numCasters * 2 + i] = box.min.z;
+            boxes[numCasters * 3 + i] = box.max.x;
+            boxes[numCasters * 4 + i] = box.max.y;
+            boxes[numCasters * 5 + i] = box.max.z;
+        }
+    }
+}
+
+void Renderer::CollectShadowBatchesWork(Task* task, unsigned threadIndex)
+{
+    PROFILE(CollectShadowBatchesWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    ShadowViewJob& job = shadowViewJobs[static_cast<RangeTask<Renderer>*>(task)->start];
+    job.threadIndex = threadIndex;
+
+    if (job.queryShadowCasters)
+    {
+        std::vector<OctreeNode*>& result = reinterpret_cast<std::vector<OctreeNode*>&>(*job.shadowCasters);
+        result.clear();
+        // Static directional lights store static shadowcasters outside the current caster volume, as the cascade is reused while the camera turns
+        if (job.view->light->Static())
+            octree->FindNodesMasked(result, job.view->shadowFrustum, NF_GEOMETRY | NF_CASTSHADOWS);
+        else
+            octree->FindNodes(result, job.view->casterVolume, NF_GEOMETRY | NF_CASTSHADOWS);
+    }
+
+    const std::vector<GeometryNode*>* staticShadowCasters = job.staticShadowCasters;
+
+    // Point light faces filter the light's static shadowcasters against their own frustum once, and again only after a requery
+    if (staticShadowCasters && job.checkFrustum)
+    {
+        ShadowView& view = *job.view;
+        unsigned version = view.light->StaticShadowCastersVersion();
+        float zoom = view.shadowCamera->Zoom();
+
+        if (view.staticShadowCastersVersion != version || view.staticShadowCastersZoom != zoom)
+        {
+            view.staticShadowCasters.clear();
+            for (auto it = staticShadowCasters->begin(); it != staticShadowCasters->end(); ++it)
+            {
+                if (view.shadowFrustum.IsInsideFast((*it)->WorldBoundingBox()))
+                    view.staticShadowCasters.push_back(*it);
+            }
+
+            view.staticShadowCastersVersion = version;
+            view.staticShadowCastersZoom = zoom;
+        }
+
+        staticShadowCasters = &view.staticShadowCasters;
+    }
+
+    if (!job.visibility)
+    {
+        CollectShadowBatches(*job.shadowMap, *job.view, *job.shadowCasters, staticShadowCasters, job.checkFrustum, nullptr, threadIndex);
+        return;
+    }
+
+    const std::vector<unsigned>& renderable = job.visibility->renderable;
+    if (!job.checkFrustum)
+    {
+        CollectShadowBatches(*job.shadowMap, *job.view, *job.shadowCasters, staticShadowCasters, false, renderable.data(), threadIndex);
+        return;
+    }
+
+    // Test the point light face frustum in one batched pass into a bitset, then combine with the renderable bits shared by the faces
+    size_t numCasters = job.shadowCasters->size();
+    const float* boxes = job.visibility->boxes.data();
+    std::vector<unsigned, FrameStdAllocator<unsigned> > casterMask(renderable.size(), 0u, FrameStdAllocator<unsigned>(&frameAllocator, threadIndex));
+    if (numCasters)
+    {
+        job.view->shadowFrustum.IsInsideMaskedFast(boxes, boxes + numCasters, boxes + numCasters * 2, boxes + numCasters * 3, boxes + numCasters * 4,
+            boxes + numCasters * 5, numCasters, casterMask.data());
+    }
+    for (size_t i = 0; i < casterMask.size(); ++i)
+        casterMask[i] &= renderable[i];
+
+    CollectShadowBatches(*job.shadowMap, *job.view, *job.shadowCasters, staticShadowCasters, false, casterMask.data(), threadIndex);
+}
+
+void Renderer::CombineCubeShadowBatchesWork(Task* task, unsigned)
+{
+    PROFILE(CombineCubeShadowBatchesWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    const CubeShadowJob& job = cubeShadowJobs[static_cast<RangeTask<Renderer>*>(task)->start];
+    ShadowMap& shadowMap = shadowMaps[1];
+    BatchQueue& destQueue = shadowMap.shadowBatches[job.queueIdx];
+    destQueue.Clear();
+
+    // Faces that are cached or outside the view have no batches collected this frame
+    const std::vector<ShadowView>& shadowViews = job.light->ShadowViews();
+    for (auto it = shadowViews.begin(); it != shadowViews.end(); ++it)
+    {
+        if (it->renderMode == RENDER_DYNAMIC_LIGHT)
+        {
+            const std::vector<Batch>& faceBatches = shadowMap.shadowBatches[it->staticQueueIdx].batches;
+            destQueue.batches.insert(destQueue.batches.end(), faceBatches.begin(), faceBatches.end());
+        }
+    }
+
+    destQueue.SortBatches(SORT_STATE);
+    destQueue.SetupFaceInstancing(instanceTransformBuffer);
+}
+
+void Renderer::AddShadowViewJob(ShadowMap& shadowMap, ShadowView& view, std::vector<GeometryNode*>* shadowCasters, const std::vector<GeometryNode*>* staticShadowCasters, const ShadowCasterVisibility* visibility, bool queryShadowCasters, bool checkFrustum)
+{
+    // Reserve both static and dynamic queues, as the render mode is not known before collection
+    if (shadowMap.shadowBatches.size() < shadowMap.freeQueueIdx + 2)
+        shadowMap.shadowBatches.resize(shadowMap.freeQueueIdx + 2);
+
+    view.staticQueueIdx = shadowMap.freeQueueIdx;
+    view.dynamicQueueIdx = shadowMap.freeQueueIdx + 1;
+    shadowMap.freeQueueIdx += 2;
+
+    ShadowViewJob job;
+    job.shadowMap = &shadowMap;
+    job.view = &view;
+    job.shadowCasters = shadowCasters;
+    job.staticShadowCasters = staticShadowCasters;
+    job.visibility = visibility;
+    job.queryShadowCasters = queryShadowCasters;
+    job.checkFrustum = checkFrustum;
+    job.threadIndex = 0;
+    shadowViewJobs.push_back(job);
+}
+
+void Renderer::CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, const std::vector<GeometryNode*>& potentialShadowCasters, const std::vector<GeometryNode*>* staticShadowCasters, bool checkFrustum, const unsigned* casterMask, unsigned threadIndex)
+{
+    Light* light = view.light;
+    const Frustum& shadowFrustum = view.shadowFrustum;
+    BoundingBox lightViewFrustumBox(view.lightViewFrustum);
+    const Matrix3x4& lightView = view.shadowCamera->ViewMatrix();
+    // Shadowcasters whose whole shadow volume is occluded in the view can be skipped
+    Matrix3x4 lightViewInverse = activeOcclusionBuffer ? lightView.Inverse() : Matrix3x4::IDENTITY;
+
+    bool dynamicOrDirLight = light->GetLightType() == LIGHT_DIRECTIONAL || !light->Static();
+    // Static directional lights cache the static shadowcasters of a cascade while it stays in place
+    bool cacheDirStatic = light->GetLightType() == LIGHT_DIRECTIONAL && light->Static();
+    bool cacheStatic = !dynamicOrDirLight || cacheDirStatic;
+    bool hasDynamicCasters = false;
+    bool dynamicCastersUpdated = false;
+    IntRect dynamicRect(IntRect::ZERO);
+    Matrix4 shadowViewProj = cacheStatic ? view.shadowCamera->ProjectionMatrix(false) * lightView : Matrix4::IDENTITY;
+
+    // The filtered list lives in the thread's frame scratch, reserved for the worst case so that it does not grow
+    std::vector<GeometryNode*, FrameStdAllocator<GeometryNode*> > shadowCasters(FrameStdAllocator<GeometryNode*>(&frameAllocator, threadIndex));
+    shadowCasters.reserve(potentialShadowCasters.size() + (staticShadowCasters ? staticShadowCasters->size() : 0));
+
+    const std::vector<GeometryNode*>* casterLists[] = { &potentialShadowCasters, staticShadowCasters };
+
+    for (size_t j = 0; j < 2 && casterLists[j]; ++j)
+    {
+        const std::vector<GeometryNode*>& casters = *casterLists[j];
+        // The mask applies to the potential shadowcasters only
+        const unsigned* mask = !j ? casterMask : nullptr;
+
+        for (size_t k = 0; k < casters.size(); ++k)
+        {
+            GeometryNode* node = casters[k];
+
+            // If shadowcaster is not visible in the main view frustum, check whether its elongated bounding box is
+            // This is done only for dynamic objects or uncached lights' shadows; cached static shadowmap needs to render everything
+            bool inView = node->LastFrameNumber() == frameNumber;
+
+            if (mask)
+            {
+                if (!(mask[k >> 5] & (1u << (k & 31))))
+                    continue;
+            }
+            else
+            {
+                if (checkFrustum && !j && !shadowFrustum.IsInsideFast(node->WorldBoundingBox()))
+                    continue;
+
+                // If not in view, let the node prepare itself for render now. Note: is called for each light the object casts shadows from
+                if (!inView && !node->OnPrepareRender(0, camera))
+                    continue;
+            }
+
+            bool dynamicNode = !node->Static();
+
+            // Directional light cascades also cull visible shadowcasters to their own split of the view, as their shadow frustums overlap the other splits
+            if ((!inView || light->GetLightType() == LIGHT_DIRECTIONAL) && (dynamicNode || !cacheStatic))
+            { 
+                // Directional lights test against the swept caster volume, which is tighter than the elongated box. The box is then needed only for the occlusion test
+                bool dirLightCaster = light->GetLightType() == LIGHT_DIRECTIONAL;
+                if (dirLightCaster && !view.casterVolume.IsInsideFast(node->WorldBoundingBox()))
+                    continue;
+
+                if (!dirLightCaster || activeOcclusionBuffer)
+                {
+                    BoundingBox lightViewBox = node->WorldBoundingBox().Transformed(lightView);
+            
+                    if (view.shadowCamera->IsOrthographic())
+                        lightViewBox.max.z = Max(lightViewBox.max.z, lightViewFrustumBox.max.z);
+                    else
+                    {
+                        // For perspective lights, extrusion direction depends on the position of the shadow caster
+                        Vector3 center = lightViewBox.Center();
+                        Ray extrusionRay(center, center);
+                
+                        float extrusionDistance = view.shadowCamera->FarClip();
+                        float originalDistance = Clamp(center.Length(), M_EPSILON, extrusionDistance);
+                
+                        // Because of the perspective, the bounding box must also grow when it is extruded to the distance
+                        float sizeFactor = extrusionDistance / originalDistance;
+                
+                        // Calculate the endpoint box and merge it to the original. Because it's axis-aligned, it will be larger
+                        // than necessary, so the test will be conservative
+                        Vector3 newCenter = extrusionDistance * extrusionRay.direction;
+                        Vector3 newHalfSize = lightViewBox.Size() * sizeFactor * 0.5f;
+                        BoundingBox extrudedBox(newCenter - newHalfSize, newCenter + newHalfSize);
+                        lightViewBox.Merge(extrudedBox);
+                    }
+
+                    if (!dirLightCaster && !view.lightViewFrustum.IsInsideFast(lightViewBox))
+                        continue;
+                    if (activeOcclusionBuffer && !activeOcclusionBuffer->IsVisible(lightViewBox.Transformed(lightViewInverse)))
+                        continue;
+                }
+            }
+
+            shadowCasters.push_back(node);
+
+            if (dynamicNode)
+            {
+                hasDynamicCasters = true;
+                if (node->LastUpdateFrameNumber() == frameNumber)
+                    dynamicCastersUpdated = true;
+                if (cacheStatic)
+                    dynamicRect = MergeRects(dynamicRect, ShadowCasterRect(view.viewport, shadowViewProj, node->WorldBoundingBox()));
+            }
+        }
+    }
+
+    bool viewChanged = view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f);
+    view.bakeKey = 0;
+
+    // Now determine which kind of caching can be used for the shadow map, and if we need to go further
+    // Dynamic lights, and directional lights whose cascade moved or has no stored static shadowcasters yet
+    if (dynamicOrDirLight && (!cacheDirStatic || viewChanged || !view.staticStored))
+    {
+        // If light atlas allocation changed, light moved, or amount of objects in view changed, render an optimized shadow map
+        if (viewChanged || view.lastNumGeometries != shadowCasters.size())
+            view.renderMode = RENDER_DYNAMIC_LIGHT;
+        else
+        {
+            // Assume no rendering
+            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+
+            // If any of the objects moved this frame, same as above
+            for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
+            {
+                GeometryNode* node = *it;
+                if (node->LastUpdateFrameNumber() == frameNumber)
+                {
+                    view.renderMode = RENDER_DYNAMIC_LIGHT;
+                    break;
+                }
+            }
+        }
+
+        // A directional cascade that stays in place for a frame stores its static shadowcasters on the next render. While it moves, storing would be wasted
+        if (cacheDirStatic && view.renderMode == RENDER_DYNAMIC_LIGHT && !viewChanged)
+            view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+    }
+    // Static lights, and directional lights with stored static shadowcasters
+    else
+    {
+        // If light atlas allocation has changed, or the static light changed, render a full shadow map now that can be cached next frame. Static spot and point lights load the static shadowcasters from a baked tile instead if one exists, or bake it now
+        if (viewChanged)
+        {
+            view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+            if (!dynamicOrDirLight)
+                view.bakeKey = BakedShadowKey(view, shadowMap, shadowViewProj, shadowCasters.data(), shadowCasters.size());
+            if (view.bakeKey && bakedShadowTiles.find(view.bakeKey) != bakedShadowTiles.end())
+                view.renderMode = RENDER_STATIC_LIGHT_LOAD_BAKED;
+        }
+        else
+        {
+            // If dynamic casters moved, or were added or removed, restore the static shadow map in the area they covered now and last frame
+            if (!view.lastDynamicCasters && !hasDynamicCasters)
+                view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+            else if (!dynamicCastersUpdated && dynamicRect == view.lastDynamicRect && view.lastNumGeometries == shadowCasters.size())
+                view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+            else
+            {
+                view.renderMode = RENDER_STATIC_LIGHT_RESTORE_STATIC;
+                view.dirtyRect = MergeRects(dynamicRect, view.lastDynamicRect);
+            }
+
+            // If static shadowcasters updated themselves (e.g. LOD change), render shadow map fully
             for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
             {
                 GeometryNode* node = *it;
@@ -826,6 +3063,16 @@ void Renderer::CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, cons
         }
     }
 
+    // A throttled shadow map is left stale if it stays in place. The changes during the deferred frames are not tracked, so render fully on the next update
+    if (view.deferUpdate && view.lastViewport == view.viewport)
+    {
+        if (view.renderMode != RENDER_STATIC_LIGHT_CACHED)
+            view.updatePending = true;
+        view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+    }
+    else if (view.updatePending && (view.renderMode == RENDER_STATIC_LIGHT_CACHED || view.renderMode == RENDER_STATIC_LIGHT_RESTORE_STATIC))
+        view.renderMode = dynamicOrDirLight ? RENDER_DYNAMIC_LIGHT : RENDER_STATIC_LIGHT_STORE_STATIC;
+
     // If no rendering to be done, return now without collecting batches
     // Note: use the last rendered shadow projection matrix to avoid artifacts when rotating camera
     if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
@@ -834,45 +3081,28 @@ void Renderer::CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, cons
         return;
     }
 
-    ++sortViewNumber;
-    if (!sortViewNumber)
-        ++sortViewNumber;
-
     view.lastDynamicCasters = hasDynamicCasters;
+    view.lastDynamicRect = dynamicRect;
+    view.lastRenderFrame = frameNumber;
+    view.updatePending = false;
+    view.staticStored = view.renderMode != RENDER_DYNAMIC_LIGHT;
     view.lastViewport = view.viewport;
     view.lastNumGeometries = shadowCasters.size();
     view.lastShadowMatrix = view.shadowMatrix;
 
     // Determine batch queues to use
-    BatchQueue* destStatic = nullptr;
-    BatchQueue* destDynamic = nullptr;
-    if (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
-    {
-        if (shadowMap.shadowBatches.size() < shadowMap.freeQueueIdx + 2)
-            shadowMap.shadowBatches.resize(shadowMap.freeQueueIdx + 2);
-
-        destStatic = &shadowMap.shadowBatches[shadowMap.freeQueueIdx];
-        destDynamic = &shadowMap.shadowBatches[shadowMap.freeQueueIdx + 1];
+    BatchQueue* destStatic = view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
+    BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
+    // Single-pass point light faces stage their static geometry unsorted in the otherwise unused static queue, to be combined with the other faces
+    BatchQueue* destFace = view.singlePass ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
+    if (destStatic)
         destStatic->Clear();
-        destDynamic->Clear();
-
-        view.staticQueueIdx = shadowMap.freeQueueIdx;
-        view.dynamicQueueIdx = shadowMap.freeQueueIdx + 1;
-        shadowMap.freeQueueIdx += 2;
-    }
-    else
-    {
-        if (shadowMap.shadowBatches.size() < shadowMap.freeQueueIdx + 1)
-            shadowMap.shadowBatches.resize(shadowMap.freeQueueIdx + 1);
-
-        destDynamic = &shadowMap.shadowBatches[shadowMap.freeQueueIdx];
-        destDynamic->Clear();
-
-        view.dynamicQueueIdx = shadowMap.freeQueueIdx;
-        ++shadowMap.freeQueueIdx;
-    }
+    if (destFace)
+        destFace->Clear();
+    destDynamic->Clear();
 
     Batch newBatch;
+    newBatch.face = destFace ? (unsigned char)(&view - &light->ShadowViews()[0]) : 0;
 
     for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
     {
@@ -884,7 +3114,8 @@ void Renderer::CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, cons
             continue;
 
         // Avoid unnecessary splitting into dynamic and static objects
-        BatchQueue& dest = destStatic ? (node->Static() ? *destStatic : *destDynamic) : *destDynamic;
+        BatchQueue& destQueue = destFace && node->GetGeometryType() == GEOM_STATIC ? *destFace : destStatic ? (node->Static() ? *destStatic : *destDynamic) :
+            *destDynamic;
         const SourceBatches& batches = node->Batches();
         size_t numGeometries = batches.NumGeometries();
 
@@ -895,22 +3126,18 @@ void Renderer::CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, cons
             if (!newBatch.pass)
                 continue;
 
-            newBatch.geometry = batches.GetGeometry(i);
-            newBatch.programBits = (unsigned char)node->GetGeometryType();
+            SetBatchGeometry(newBatch, node, batches, i);
 
-            if (!newBatch.programBits)
-                newBatch.worldTransform = &node->WorldTransform();
-            else
-                newBatch.node = node;
+            newBatch.node = node;
 
-            dest.batches.push_back(newBatch);
+            destQueue.batches.push_back(newBatch);
         }
     }
 
     if (destStatic)
-        destStatic->Sort(instanceTransforms, SORT_STATE, hasInstancing);
+        destStatic->Sort(instanceTransformBuffer, SORT_STATE, hasInstancing, useMultiDraw);
     
-    destDynamic->Sort(instanceTransforms, SORT_STATE, hasInstancing);
+    destDynamic->Sort(instanceTransformBuffer, SORT_STATE, hasInstancing, useMultiDraw);
 }
 
 void Renderer::CollectNodeBatches()
@@ -921,46 +3148,207 @@ void Renderer::CollectNodeBatches()
     if (!sortViewNumber)
         ++sortViewNumber;
 
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+
+    if (threadBatches.size() < numThreads)
+        threadBatches.resize(numThreads);
+    for (auto it = threadBatches.begin(); it != threadBatches.end(); ++it)
+    {
+        it->opaqueBatches.Clear();
+        it->alphaBatches.Clear();
+        it->passDistances.Clear();
+        it->geometryDistances.Clear();
+        it->textureLevels.Clear();
+        it->coveredArea = 0.0f;
+    }
+
+    // A bounding sphere covers pi * radius^2 of the view, whose area is 4 * tan(fov / 2)^2 * aspect ratio at unit distance for perspective cameras
+    if (depthPrePassMode == PREPASS_AUTO)
+    {
+        float viewArea = camera->IsOrthographic() ? camera->OrthoSize() * camera->OrthoSize() * camera->AspectRatio() : 4.0f * Tan(camera->Fov() * 0.5f) * Tan(camera->Fov() * 0.5f) * camera->AspectRatio();
+        coverageScale = viewArea > 0.0f ? M_PI / viewArea : 0.0f;
+    }
+
+    // Screen size in pixels is world size times the scale, divided by distance for perspective cameras
+    textureStreamer = Subsystem<TextureStreamer>();
+    if (textureStreamer)
+    {
+        float viewHeight = (float)Subsystem<Graphics>()->RenderHeight();
+        textureStreamingScale = camera->IsOrthographic() ? viewHeight / camera->OrthoSize() : viewHeight * 0.5f / Tan(camera->Fov() * 0.5f);
+    }
+
+    // Reuse the sorted batches of the previous view if the visible nodes and their geometries and materials are unchanged
+    unsigned batchGeneration = SourceBatches::Generation();
+    batchesReused = visibilityReused && coherentBatchesValid && batchGeneration == coherentBatchGeneration;
+    if (batchesReused)
+    {
+        opaqueBatches.batches = coherentOpaqueBatches;
+        alphaBatches.batches = coherentAlphaBatches;
+
+        if (textureStreamer)
+        {
+            for (auto it = coherentTextureLevels.begin(); it != coherentTextureLevels.end(); ++it)
+                textureStreamer->RequestLevel(it->first, it->second);
+        }
+
+        depthPrePassActive = depthPrePassMode == PREPASS_ON || (depthPrePassMode == PREPASS_AUTO && estimatedOverdraw >= prePassOverdrawThreshold);
+        return;
+    }
+
+    coherentBatchGeneration = batchGeneration;
+    coherentTextureLevels.clear();
+
+    if (numThreads > 1 && geometries.size() > GEOMETRIES_PER_TASK)
+    {
+        size_t numTasks = (geometries.size() + GEOMETRIES_PER_TASK - 1) / GEOMETRIES_PER_TASK;
+        while (collectBatchesTasks.size() < numTasks)
+            collectBatchesTasks.push_back(new RangeTask<Renderer>(this, &Renderer::CollectNodeBatchesWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<Renderer>* task = collectBatchesTasks[i];
+            task->start = i * GEOMETRIES_PER_TASK;
+            task->end = std::min((i + 1) * GEOMETRIES_PER_TASK, geometries.size());
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+        CollectNodeBatches(0, geometries.size(), threadBatches[0]);
+
+    if (staticBatchCaching)
+        CollectCachedBatches(threadBatches[0]);
+
+    // Merge the per-thread minimum distances into the passes and geometries, then the batches themselves
+    for (auto tIt = threadBatches.begin(); tIt != threadBatches.end(); ++tIt)
+    {
+        const MinDistanceMap& passDistances = tIt->passDistances;
+        for (size_t i = 0; i < passDistances.keys.size(); ++i)
+        {
+            Pass* pass = static_cast<Pass*>(passDistances.keys[i]);
+            if (pass && (pass->lastSortKey.first != sortViewNumber || pass->lastSortKey.second > passDistances.distances[i]))
+            {
+                pass->lastSortKey.first = sortViewNumber;
+                pass->lastSortKey.second = passDistances.distances[i];
+            }
+        }
+
+        const MinDistanceMap& geometryDistances = tIt->geometryDistances;
+        for (size_t i = 0; i < geometryDistances.keys.size(); ++i)
+        {
+            Geometry* geometry = static_cast<Geometry*>(geometryDistances.keys[i]);
+            if (geometry && (geometry->lastSortKey.first != sortViewNumber || geometry->lastSortKey.second > geometryDistances.distances[i]))
+            {
+                geometry->lastSortKey.first = sortViewNumber;
+                geometry->lastSortKey.second = geometryDistances.distances[i];
+
+                // Vertex buffers shared by several geometries sort by their nearest geometry
+                VertexBuffer* vertexBuffer = geometry->vertexBuffer;
+                if (vertexBuffer && (vertexBuffer->lastSortKey.first != sortViewNumber || vertexBuffer->lastSortKey.second > geometry->lastSortKey.second))
+                {
+                    vertexBuffer->lastSortKey.first = sortViewNumber;
+                    vertexBuffer->lastSortKey.second = geometry->lastSortKey.second;
+                }
+            }
+        }
+
+        if (textureStreamer)
+        {
+            const MinDistanceMap& textureLevels = tIt->textureLevels;
+            for (size_t i = 0; i < textureLevels.keys.size(); ++i)
+            {
+                if (textureLevels.keys[i])
+                {
+                    textureStreamer->RequestLevel(static_cast<Texture*>(textureLevels.keys[i]), textureLevels.distances[i]);
+                    if (frameCoherence)
+                        coherentTextureLevels.push_back(std::make_pair(static_cast<Texture*>(textureLevels.keys[i]), textureLevels.distances[i]));
+                }
+            }
+        }
+
+        // If the destination is still empty, swap instead of copying
+        std::vector<Batch>& opaque = tIt->opaqueBatches.batches;
+        if (opaqueBatches.batches.empty())
+            opaqueBatches.batches.swap(opaque);
+        else
+            opaqueBatches.batches.insert(opaqueBatches.batches.end(), opaque.begin(), opaque.end());
+
+        std::vector<Batch>& alpha = tIt->alphaBatches.batches;
+        if (alphaBatches.batches.empty())
+            alphaBatches.batches.swap(alpha);
+        else
+            alphaBatches.batches.insert(alphaBatches.batches.end(), alpha.begin(), alpha.end());
+    }
+
+    estimatedOverdraw = 0.0f;
+    if (depthPrePassMode == PREPASS_AUTO)
+    {
+        for (auto tIt = threadBatches.begin(); tIt != threadBatches.end(); ++tIt)
+            estimatedOverdraw += tIt->coveredArea;
+    }
+    depthPrePassActive = depthPrePassMode == PREPASS_ON || (depthPrePassMode == PREPASS_AUTO && estimatedOverdraw >= prePassOverdrawThreshold);
+}
+
+void Renderer::CollectNodeBatchesWork(Task* task, unsigned threadIndex)
+{
+    PROFILE(CollectNodeBatchesWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+    CollectNodeBatches(rangeTask->start, rangeTask->end, threadBatches[threadIndex]);
+}
+
+void Renderer::CollectNodeBatches(size_t start, size_t end, ThreadBatches& dest)
+{
     float farClipMul = 32767.0f / camera->FarClip();
+    bool orthographic = camera->IsOrthographic();
+    float nearClip = camera->NearClip();
 
     Batch newBatch;
 
-    for (auto it = geometries.begin(); it != geometries.end(); ++it)
+    for (size_t j = start; j < end; ++j)
     {
-        GeometryNode* node = *it;
+        GeometryNode* node = geometries[j];
         unsigned short distance = (unsigned short)(node->Distance() * farClipMul);
-        const SourceBatches& batches = node->Batches();
+        const SourceBatches& batches = node->TestFlag(NF_IMPOSTOR) ? static_cast<StaticModel*>(node)->ImpostorBatches() : node->Batches();
         size_t numGeometries = batches.NumGeometries();
 
+        float screenSize = 0.0f;
+        if (textureStreamer)
+            screenSize = node->WorldBoundingBox().Size().Length() * textureStreamingScale / (orthographic ? 1.0f : Max(node->Distance(), nearClip));
+        bool prePassable = false;
+
         for (size_t i = 0; i < numGeometries; ++i)
         {
             Material* material = batches.GetMaterial(i);
+
+            if (textureStreamer)
+            {
+                for (size_t k = 0; k < MAX_MATERIAL_TEXTURE_UNITS; ++k)
+                {
+                    Texture* texture = material->GetTexture(k);
+                    if (texture && texture->IsStreamable())
+                        dest.textureLevels.Insert(texture, TextureLevelForSize(texture, screenSize));
+                }
+            }
             
             // Assume opaque first
             newBatch.pass = material->GetPass(PASS_OPAQUE);
-            newBatch.programBits = (unsigned char)node->GetGeometryType();
-            newBatch.geometry = batches.GetGeometry(i);
+            SetBatchGeometry(newBatch, node, batches, i);
 
-            if (!newBatch.programBits)
-                newBatch.worldTransform = &node->WorldTransform();
-            else
-                newBatch.node = node;
+            newBatch.node = node;
 
             if (newBatch.pass)
             {
                 // Perform distance sort in addition to state sort
-                if (newBatch.pass->lastSortKey.first != sortViewNumber || newBatch.pass->lastSortKey.second > distance)
-                {
-                    newBatch.pass->lastSortKey.first = sortViewNumber;
-                    newBatch.pass->lastSortKey.second = distance;
-                }
-                if (newBatch.geometry->lastSortKey.first != sortViewNumber || newBatch.geometry->lastSortKey.second > distance)
-                {
-                    newBatch.geometry->lastSortKey.first = sortViewNumber;
-                    newBatch.geometry->lastSortKey.second = distance;
-                }
-
-                opaqueBatches.batches.push_back(newBatch);
+                dest.passDistances.Insert(newBatch.pass, distance);
+                dest.geometryDistances.Insert(newBatch.geometry, distance);
+                dest.opaqueBatches.batches.push_back(newBatch);
+                if (depthPrePassMode == PREPASS_AUTO && CanDepthPrePass(newBatch.pass, newBatch.programBits))
+                    prePassable = true;
             }
             else
             {
@@ -970,297 +3358,1539 @@ void Renderer::CollectNodeBatches()
                     continue;
 
                 newBatch.distance = node->Distance();
-                alphaBatches.batches.push_back(newBatch);
+                dest.alphaBatches.batches.push_back(newBatch);
             }
         }
+
+        // Count each node once, and at most as one screen, as the node's geometries mostly cover different pixels
+        if (prePassable)
+        {
+            float radius = node->WorldBoundingBox().Size().Length() * 0.5f;
+            float nodeDistance = node->Distance();
+            float coverage = orthographic ? radius * radius * coverageScale : (nodeDistance > radius ? radius * radius * coverageScale / (nodeDistance * nodeDistance) : 1.0f);
+            dest.coveredArea += Min(coverage, 1.0f);
+        }
     }
 }
 
-void Renderer::SortNodeBatches()
+void Renderer::CollectCachedBatches(ThreadBatches& dest)
 {
-    PROFILE(SortNodeBatches);
+    float farClipMul = 32767.0f / camera->FarClip();
+    bool orthographic = camera->IsOrthographic();
+    float nearClip = camera->NearClip();
+
+    for (auto tIt = threadVisibleNodes.begin(); tIt != threadVisibleNodes.end(); ++tIt)
+    {
+        for (auto oIt = tIt->cachedOctants.begin(); oIt != tIt->cachedOctants.end(); ++oIt)
+        {
+            const OctantBatchCache& cache = *(*oIt)->batchCache;
+
+            // Use the nearest distance of the cached nodes' bounds for all of them. The sort keys are only for reducing overdraw, and the estimates stay conservative
+            float distance = Max(camera->Distance(cache.boundingBox.Center()) - cache.boundingBox.HalfSize().Length(), 0.0f);
+            unsigned short sortDistance = (unsigned short)(distance * farClipMul);
+
+            for (auto it = cache.passes.begin(); it != cache.passes.end(); ++it)
+                dest.passDistances.Insert(*it, sortDistance);
+            for (auto it = cache.geometries.begin(); it != cache.geometries.end(); ++it)
+                dest.geometryDistances.Insert(*it, sortDistance);
+
+            if (textureStreamer)
+            {
+                float screenSize = cache.maxNodeSize * textureStreamingScale / (orthographic ? 1.0f : Max(distance, nearClip));
+                for (auto it = cache.textures.begin(); it != cache.textures.end(); ++it)
+                    dest.textureLevels.Insert(*it, TextureLevelForSize(*it, screenSize));
+            }
+
+            if (depthPrePassMode == PREPASS_AUTO && cache.numPrePassNodes)
+            {
+                float coverage = orthographic ? cache.prePassRadiusSquared * coverageScale : (distance > 0.0f ? cache.prePassRadiusSquared * coverageScale /
+                    (distance * distance) : (float)cache.numPrePassNodes);
+                dest.coveredArea += Min(coverage, (float)cache.numPrePassNodes);
+            }
 
-    opaqueBatches.Sort(instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing);
-    alphaBatches.Sort(instanceTransforms, SORT_DISTANCE, hasInstancing);
+            dest.opaqueBatches.batches.insert(dest.opaqueBatches.batches.end(), cache.batches.begin(), cache.batches.end());
+        }
+    }
 }
 
-void Renderer::RenderBatches(Camera* camera_, const std::vector<Batch>& batches)
+void Renderer::SortNodeBatches()
 {
-    lastMaterial = nullptr;
-    lastPass = nullptr;
+    PROFILE(SortNodeBatches);
 
-    if (hasInstancing && instanceTransformsDirty && instanceTransforms.size())
+    if (!batchesReused)
     {
-        if (instanceVertexBuffer->NumVertices() < instanceTransforms.size())
-            instanceVertexBuffer->Define(USAGE_DYNAMIC, instanceTransforms.size(), instanceVertexElements, &instanceTransforms[0]);
-        else
-            instanceVertexBuffer->SetData(0, instanceTransforms.size(), &instanceTransforms[0]);
-        instanceTransformsDirty = false;
+        opaqueBatches.SortBatches(SORT_STATE_AND_DISTANCE, sortKeyLayout);
+        // Weighted OIT needs no back-to-front order, so the alpha batches can be sorted by state for instancing
+        alphaBatches.SortBatches(alphaMode == ALPHA_WEIGHTED_OIT ? SORT_STATE : SORT_DISTANCE);
+
+        // Keep the sorted batches before the instancing conversion, which overwrites their per-object fields
+        if (frameCoherence)
+        {
+            coherentOpaqueBatches = opaqueBatches.batches;
+            coherentAlphaBatches = alphaBatches.batches;
+        }
+        coherentBatchesValid = frameCoherence;
     }
 
-    if (camera_ != lastCamera)
+    // Only the opaque geometry writes motion vectors
+    opaqueBatches.SetupInstancing(instanceTransformBuffer, hasInstancing, useMultiDraw, viewHistoryFrame);
+    alphaBatches.SetupInstancing(instanceTransformBuffer, hasInstancing, useMultiDraw);
+}
+
+void Renderer::RecordRenderCommands()
+{
+    PROFILE(RecordRenderCommands);
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+    // Divide the view queues so that each thread gets work, but lists stay long enough to combine draws
+    size_t batchesPerList = std::max((opaqueBatches.batches.size() + numThreads - 1) / numThreads, BATCHES_PER_TASK);
+
+    recordCommandLists.clear();
+    AddCommandLists(opaqueBatches, batchesPerList);
+    AddCommandLists(alphaBatches, batchesPerList);
+
+    // Record the shadow queues that will be rendered, one list per queue
+    for (auto it = shadowMaps.begin(); it != shadowMaps.end(); ++it)
     {
-        lastCamera = camera_;
-        ++lastPerViewUniforms;
-        if (!lastPerViewUniforms)
-            ++lastPerViewUniforms;
+        for (auto vIt = it->shadowViews.begin(); vIt != it->shadowViews.end(); ++vIt)
+        {
+            ShadowView* view = *vIt;
+            if (view->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+                AddCommandLists(it->shadowBatches[view->staticQueueIdx], M_MAX_UNSIGNED);
+            if (view->renderMode != RENDER_STATIC_LIGHT_CACHED)
+                AddCommandLists(it->shadowBatches[view->dynamicQueueIdx], M_MAX_UNSIGNED);
+        }
     }
+    for (auto it = cubeShadowJobs.begin(); it != cubeShadowJobs.end(); ++it)
+        AddCommandLists(shadowMaps[1].shadowBatches[it->queueIdx], M_MAX_UNSIGNED);
 
-    for (auto it = batches.begin(); it != batches.end();)
+    if (numThreads > 1 && recordCommandLists.size() > 1)
     {
-        const Batch& batch = *it;
-        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+        while (recordCommandsTasks.size() < recordCommandLists.size())
+            recordCommandsTasks.push_back(new RangeTask<Renderer>(this, &Renderer::RecordRenderCommandsWork));
 
-        ShaderProgram* program = batch.pass->GetShaderProgram(batch.programBits);
-        if (!program->Bind())
+        TaskCounter counter(0);
+        for (size_t i = 0; i < recordCommandLists.size(); ++i)
         {
-            it += (geometryBits == GEOM_INSTANCED) ? batch.instanceCount : 1;
-            continue;
+            RangeTask<Renderer>* task = recordCommandsTasks[i];
+            task->start = i;
+            task->end = i + 1;
+            workQueue->QueueTask(task, &counter);
         }
 
-        if (program->lastPerViewUniforms != lastPerViewUniforms)
-        {
-            Matrix4 projection = camera_->ProjectionMatrix();
-            const Matrix3x4& view = camera_->ViewMatrix();
+        workQueue->Complete(counter);
+    }
+    else
+    {
+        for (auto it = recordCommandLists.begin(); it != recordCommandLists.end(); ++it)
+            (*it)->Record(useMultiDraw);
+    }
+}
 
-            int location = program->Uniform(U_VIEWMATRIX);
-            if (location >= 0)
-                glUniformMatrix3x4fv(location, 1, GL_FALSE, view.Data());
-            location = program->Uniform(U_PROJECTIONMATRIX);
-            if (location >= 0)
-                glUniformMatrix4fv(location, 1, GL_FALSE, projection.Data());
-            location = program->Uniform(U_VIEWPROJMATRIX);
-            if (location >= 0)
-                glUniformMatrix4fv(location, 1, GL_FALSE, (projection * view).Data());
-            location = program->Uniform(U_DEPTHPARAMETERS);
-            if (location >= 0)
-            {
-                Vector4 depthParameters(camera->NearClip(), camera->FarClip(), 0.0f, 0.0f);
-                if (camera_->IsOrthographic())
-                {
-                    depthParameters.z = 0.5f;
-                    depthParameters.w = 0.5f;
-                }
-                else
-                    depthParameters.w = 1.0f / camera->FarClip();
+void Renderer::RecordRenderCommandsWork(Task* task, unsigned)
+{
+    PROFILE(RecordRenderCommandsWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
 
-                glUniform4fv(location, 1, depthParameters.Data());
-            }
-            location = program->Uniform(U_DIRLIGHTDATA);
-            if (location >= 0)
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+        recordCommandLists[i]->Record(useMultiDraw);
+}
+
+void Renderer::AddCommandLists(BatchQueue& batchQueue, size_t batchesPerList)
+{
+    batchQueue.SetupCommandLists(batchesPerList);
+    for (size_t i = 0; i < batchQueue.numCommandLists; ++i)
+        recordCommandLists.push_back(&batchQueue.commandLists[i]);
+}
+
+void Renderer::BeginInstanceTransforms()
+{
+    if (!hasInstancing)
+        return;
+
+    numMultiDrawCommands = 0;
+
+    // Grow when the previous frame did not fit. The old buffer is released by OpenGL once the GPU is done with it
+    size_t numRequested = instanceTransformBuffer.NumRequested();
+    if (numRequested > instanceCapacity || !instanceVertexBuffer->NumVertices())
+    {
+        instanceCapacity = std::max(instanceCapacity, (size_t)NextPowerOfTwo((unsigned)numRequested));
+        for (size_t i = 0; i < INSTANCE_BUFFER_FRAMES; ++i)
+        {
+            if (instanceFences[i])
             {
-                Vector4 dirLightData[12];
-                bool hasShadow = false;
+                glDeleteSync((GLsync)instanceFences[i]);
+                instanceFences[i] = nullptr;
+            }
+        }
+        instanceFrameIndex = 0;
 
-                if (!dirLight)
-                {
-                    dirLightData[0] = Vector4::ZERO;
-                    dirLightData[1] = Vector4::ZERO;
-                    dirLightData[3] = Vector4::ONE;
-                }
-                else
-                {
-                    dirLightData[0] = Vector4(-dirLight->WorldDirection(), 0.0f);
-                    dirLightData[1] = dirLight->GetColor().Data();
+        if (persistentInstances && !instanceVertexBuffer->Define(USAGE_PERSISTENT, instanceCapacity * INSTANCE_BUFFER_FRAMES, instanceDataElements))
+            persistentInstances = false;
+        if (!persistentInstances)
+        {
+            instanceVertexBuffer->Define(USAGE_DYNAMIC, instanceCapacity, instanceDataElements);
+            instanceTransforms.resize(instanceCapacity);
+        }
+    }
+    else if (persistentInstances)
+    {
+        // Fence the region used by the previous frame, then wait until the GPU has finished reading the next one
+        instanceFences[instanceFrameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        instanceFrameIndex = (instanceFrameIndex + 1) % INSTANCE_BUFFER_FRAMES;
 
-                    if (dirLight->ShadowMap())
-                    {
-                        hasShadow = true;
+        GLsync fence = (GLsync)instanceFences[instanceFrameIndex];
+        if (fence)
+        {
+            PROFILE(WaitInstanceBuffer);
 
-                        float farClip = camera->FarClip();
-                        float firstSplit = dirLight->ShadowSplit(0) / farClip;
-                        float secondSplit = dirLight->ShadowSplit(1) / farClip;
+            const GLuint64 timeout = 1000000000;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout) == GL_TIMEOUT_EXPIRED)
+                ;
+            glDeleteSync(fence);
+            instanceFences[instanceFrameIndex] = nullptr;
+        }
+    }
 
-                        dirLightData[2] = Vector4(firstSplit, secondSplit, dirLight->ShadowFadeStart() * secondSplit, 1.0f / (secondSplit - dirLight->ShadowFadeStart() * secondSplit));
-                        dirLightData[3] = dirLight->ShadowParameters();
-                        if (dirLight->ShadowViews().size() >= 2)
-                        {
-                            *reinterpret_cast<Matrix4*>(&dirLightData[4]) = dirLight->ShadowViews()[0].shadowMatrix;
-                            *reinterpret_cast<Matrix4*>(&dirLightData[8]) = dirLight->ShadowViews()[1].shadowMatrix;
-                        }
-                    }
-                    else
-                        dirLightData[3] = Vector4::ONE;
-                }
+    if (persistentInstances)
+    {
+        size_t firstIndex = instanceFrameIndex * instanceCapacity;
+        instanceTransformBuffer.Reset((Vector4*)instanceVertexBuffer->MappedData() + firstIndex, firstIndex, instanceCapacity);
+    }
+    else
+    {
+        instanceTransformBuffer.Reset(&instanceTransforms[0], 0, instanceCapacity);
+        instanceTransformsDirty = true;
+    }
+}
 
-                glUniform4fv(location, hasShadow ? 12 : 4, dirLightData[0].Data());
-            }
+void Renderer::BeginBonePalette()
+{
+    if (!hasSkinning)
+        return;
+
+    // A separate generation identifies the view, as the framenumber wraps too soon
+    ++bonePaletteGeneration;
+    if (!bonePaletteGeneration)
+        ++bonePaletteGeneration;
+
+    size_t numRequested = bonePaletteBuffer.NumRequested() / 3;
+    if (numRequested > bonePaletteCapacity || !bonePaletteStorage)
+    {
+        bonePaletteCapacity = std::max(bonePaletteCapacity, (size_t)NextPowerOfTwo((unsigned)numRequested));
+        bonePalette.resize(bonePaletteCapacity * 3);
+        if (!bonePaletteStorage)
+            bonePaletteStorage = new StorageBuffer();
+        bonePaletteStorage->Define(USAGE_DYNAMIC, bonePaletteCapacity * sizeof(Matrix3x4));
+    }
 
-            program->lastPerViewUniforms = lastPerViewUniforms;
+    bonePaletteBuffer.Reset(&bonePalette[0], 0, bonePalette.size());
+    bonePaletteDirty = true;
+
+    // Grow the transient skinned vertex buffers that ran out of space, or create those of new vertex layouts
+    skinningJobs.clear();
+    for (auto it = skinnedVertexPools.begin(); it != skinnedVertexPools.end(); ++it)
+    {
+        if (it->requested > it->capacity || !it->buffer)
+        {
+            it->capacity = std::max(std::max(it->capacity, DEFAULT_SKINNED_VERTEX_CAPACITY), (size_t)NextPowerOfTwo((unsigned)it->requested));
+            if (!it->buffer)
+                it->buffer = new VertexBuffer();
+            it->buffer->Define(USAGE_DEFAULT, it->capacity, it->elements);
         }
 
-        Material* material = batch.pass->Parent();
-        if (batch.pass != lastPass)
+        it->used = 0;
+        it->requested = 0;
+    }
+}
+
+Matrix3x4* Renderer::AllocateBonePalette(size_t numBones, unsigned& offset)
+{
+    if (!hasSkinning || !numBones)
+        return nullptr;
+
+    unsigned startIndex = 0;
+    Vector4* dest = bonePaletteBuffer.Allocate(numBones * 3, 3, startIndex);
+    if (dest)
+        offset = startIndex / 3;
+    return reinterpret_cast<Matrix3x4*>(dest);
+}
+
+bool Renderer::AllocateSkinnedGeometries(const SourceBatches& source, std::vector<SharedPtr<Geometry> >& dest, unsigned paletteOffset, const Matrix3x4& worldTransform)
+{
+    if (!computeSkinning)
+        return false;
+
+    size_t numGeometries = source.NumGeometries();
+    size_t numJobs = 0;
+    Matrix3x4 inverseWorldTransform = worldTransform.Inverse();
+
+    MutexLock lock(skinningMutex);
+
+    if (dest.size() != numGeometries)
+        dest.resize(numGeometries);
+
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        Geometry* geometry = source.GetGeometry(i);
+        VertexBuffer* vb = geometry ? geometry->vertexBuffer.Get() : nullptr;
+        if (!vb)
+            return false;
+
+        // Skin each vertex buffer of the model once, even if several geometries draw from it
+        const SkinningJob* job = nullptr;
+        for (size_t j = skinningJobs.size() - numJobs; j < skinningJobs.size(); ++j)
         {
-            if (material != lastMaterial)
+            if (skinningJobs[j].source == vb)
             {
-                for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
-                {
-                    Texture* texture = material->GetTexture(i);
-                    if (texture)
-                        texture->Bind(i);
-                }
+                job = &skinningJobs[j];
+                break;
+            }
+        }
 
-                lastMaterial = material;
-                ++lastPerMaterialUniforms;
-                if (!lastPerMaterialUniforms)
-                    ++lastPerMaterialUniforms;
+        if (!job)
+        {
+            const std::vector<VertexElement>& elements = vb->Elements();
+            bool hasWeights = false;
+            bool hasIndices = false;
+            for (auto it = elements.begin(); it != elements.end(); ++it)
+            {
+                if (it->semantic == SEM_BLENDWEIGHT)
+                    hasWeights = it->type == ELEM_VECTOR4;
+                else if (it->semantic == SEM_BLENDINDICES)
+                    hasIndices = it->type == ELEM_UBYTE4;
             }
+            if (!hasWeights || !hasIndices)
+                return false;
 
-            CullMode cullMode = material->GetCullMode();
-            if (camera_->UseReverseCulling())
+            SkinnedVertexPool* pool = nullptr;
+            for (auto it = skinnedVertexPools.begin(); it != skinnedVertexPools.end(); ++it)
+            {
+                if (it->elements.size() == elements.size() && std::equal(elements.begin(), elements.end(), it->elements.begin(),
+                    [](const VertexElement& lhs, const VertexElement& rhs) { return lhs.type == rhs.type && lhs.semantic == rhs.semantic && lhs.index == rhs.index; }))
+                {
+                    pool = &*it;
+                    break;
+                }
+            }
+            if (!pool)
             {
-                if (cullMode == CULL_BACK)
-                    cullMode = CULL_FRONT;
-                else if (cullMode == CULL_FRONT)
-                    cullMode = CULL_BACK;
+                // The buffer of a new layout is created at the start of the next view
+                skinnedVertexPools.push_back(SkinnedVertexPool());
+                pool = &skinnedVertexPools.back();
+                pool->elements = elements;
+                pool->capacity = 0;
+                pool->used = 0;
+                pool->requested = 0;
             }
 
-            SetRenderState(batch.pass->GetBlendMode(), cullMode, batch.pass->GetDepthTest(), batch.pass->GetColorWrite(), batch.pass->GetDepthWrite());
+            size_t numVertices = vb->NumVertices();
+            pool->requested += numVertices;
+            if (!pool->buffer || pool->used + numVertices > pool->capacity)
+                return false;
+
+            SkinningJob newJob;
+            newJob.source = vb;
+            newJob.pool = pool - &skinnedVertexPools[0];
+            newJob.destStart = (unsigned)pool->used;
+            newJob.paletteOffset = paletteOffset;
+            newJob.inverseWorldTransform = inverseWorldTransform;
+            skinningJobs.push_back(newJob);
+            pool->used += numVertices;
+            ++numJobs;
+            job = &skinningJobs.back();
+        }
+
+        if (!dest[i])
+            dest[i] = new Geometry();
 
-            lastPass = batch.pass;
+        // Multi-draw commands of reused batches hold the base vertex, so they must be recollected when it moves
+        Geometry* skinnedGeometry = dest[i];
+        VertexBuffer* skinnedVb = skinnedVertexPools[job->pool].buffer;
+        unsigned baseVertex = geometry->baseVertex + job->destStart;
+        if (skinnedGeometry->vertexBuffer != skinnedVb || skinnedGeometry->indexBuffer != geometry->indexBuffer ||
+            skinnedGeometry->drawStart != geometry->drawStart || skinnedGeometry->drawCount != geometry->drawCount ||
+            skinnedGeometry->baseVertex != baseVertex)
+        {
+            skinnedGeometry->vertexBuffer = skinnedVb;
+            skinnedGeometry->indexBuffer = geometry->indexBuffer;
+            skinnedGeometry->drawStart = geometry->drawStart;
+            skinnedGeometry->drawCount = geometry->drawCount;
+            skinnedGeometry->baseVertex = baseVertex;
+            SourceBatches::MarkLodChanged();
         }
+        skinnedGeometry->lodDistance = geometry->lodDistance;
+    }
+
+    return true;
+}
+
+void Renderer::DispatchSkinning()
+{
+    PROFILE(DispatchSkinning);
+
+    ShaderProgram* program = SetProgram("Shaders/Skinning.glsl");
+    if (!program)
+    {
+        skinningJobs.clear();
+        return;
+    }
+
+    StorageBuffer::Unbind(0);
+    StorageBuffer::Unbind(1);
 
-        if (program->lastPerMaterialUniforms != lastPerMaterialUniforms)
+    for (auto it = skinningJobs.begin(); it != skinningJobs.end(); ++it)
+    {
+        VertexBuffer* source = it->source;
+        const std::vector<VertexElement>& elements = source->Elements();
+
+        // Offsets are in 32-bit words, with -1 for a missing element. The normal and tangent flags tell if they are packed to 10 bits per component
+        int offsets[SEM_BLENDINDICES + 1];
+        bool packed[SEM_BLENDINDICES + 1];
+        for (size_t i = 0; i <= SEM_BLENDINDICES; ++i)
+        {
+            offsets[i] = -1;
+            packed[i] = false;
+        }
+        for (auto eIt = elements.begin(); eIt != elements.end(); ++eIt)
         {
-            const std::map<PresetUniform, Vector4>& uniformValues = material->UniformValues();
-            for (auto uIt = uniformValues.begin(); uIt != uniformValues.end(); ++uIt)
+            if (eIt->index == 0 && offsets[eIt->semantic] < 0)
             {
-                int location = program->Uniform(uIt->first);
-                if (location >= 0)
-                    glUniform4fv(location, 1, uIt->second.Data());
+                offsets[eIt->semantic] = (int)(eIt->offset / sizeof(unsigned));
+                packed[eIt->semantic] = eIt->type == ELEM_INT2101010N;
             }
+        }
+
+        glUniform1ui(program->Uniform("numVertices"), (unsigned)source->NumVertices());
+        glUniform1ui(program->Uniform("vertexWords"), (unsigned)(source->VertexSize() / sizeof(unsigned)));
+        glUniform1ui(program->Uniform("destStart"), it->destStart);
+        glUniform1ui(program->Uniform("paletteOffset"), it->paletteOffset);
+        glUniform4i(program->Uniform("elementOffsets"), offsets[SEM_POSITION], offsets[SEM_NORMAL], offsets[SEM_TANGENT], offsets[SEM_BLENDWEIGHT]);
+        glUniform3i(program->Uniform("elementFlags"), offsets[SEM_BLENDINDICES], packed[SEM_NORMAL] ? 1 : 0, packed[SEM_TANGENT] ? 1 : 0);
+        glUniformMatrix3x4fv(program->Uniform("inverseWorldMatrix"), 1, GL_FALSE, it->inverseWorldTransform.Data());
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source->GLBuffer());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, skinnedVertexPools[it->pool].buffer->GLBuffer());
+        glDispatchCompute(((unsigned)source->NumVertices() + SKINNING_GROUP_SIZE - 1) / SKINNING_GROUP_SIZE, 1, 1);
+    }
+
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+    skinningJobs.clear();
+}
+
+void Renderer::RenderBatches(Camera* camera_, const BatchQueue& batchQueue)
+{
+    lastMaterial = nullptr;
+    lastPass = nullptr;
+
+    // Without persistent mapping, upload the instancing data of all views once per frame, orphaning the previous contents
+    if (instanceTransformsDirty && instanceTransformBuffer.Size())
+    {
+        instanceVertexBuffer->SetData(0, instanceTransformBuffer.Size(), &instanceTransforms[0], true);
+        instanceTransformsDirty = false;
+    }
+
+    // Upload the skinning matrices written while preparing the view, once for all its batch queues
+    if (bonePaletteDirty)
+    {
+        if (bonePaletteBuffer.Size())
+            bonePaletteStorage->SetData(0, bonePaletteBuffer.Size() * sizeof(Vector4), &bonePalette[0]);
+        bonePaletteDirty = false;
+    }
+    if (bonePaletteStorage)
+        bonePaletteStorage->Bind(SB_BONEPALETTE);
+
+    // Pre-skin once for all the batch queues of the view, which draw the result as static geometry
+    if (skinningJobs.size())
+        DispatchSkinning();
+
+    if (camera_ != lastCamera)
+    {
+        lastCamera = camera_;
+        UpdatePerViewData(camera_);
+    }
+
+    for (size_t i = 0; i < batchQueue.numCommandLists; ++i)
+        ExecuteCommands(camera_, batchQueue.commandLists[i]);
+}
 
-            program->lastPerMaterialUniforms = lastPerMaterialUniforms;
+void Renderer::ExecuteCommands(Camera* camera_, const RenderCommandList& commandList)
+{
+    size_t firstDraw = commandList.drawCommands.size() ? UploadMultiDrawCommands(commandList.drawCommands) : 0;
+    ShaderProgram* program = nullptr;
+
+    for (auto it = commandList.commands.begin(); it != commandList.commands.end(); ++it)
+    {
+        const RenderCommand& command = *it;
+        if (command.type == CMD_SETUP_PASS)
+        {
+            program = SetupPass(camera_, command.pass, command.programBits);
+            continue;
         }
 
-        Geometry* geometry = batch.geometry;
+        // Skip the draws of a pass whose program could not be bound
+        if (!program)
+            continue;
+
+        unsigned char geometryBits = command.programBits & SP_GEOMETRYBITS;
+        Geometry* geometry = command.geometry;
+        VertexBuffer* vb = geometry->vertexBuffer;
+        IndexBuffer* ib = geometry->indexBuffer;
+
+        // Skinned and custom geometry and single-pass point light shadows have the per-object data after the world transform, and the previous world transform follows when rendering motion vectors. The instance range is aligned to the instance size
+        bool hasInstanceData = geometryBits != GEOM_INSTANCED || (command.programBits & SP_CUBESHADOWBIT);
+        bool hasPrevTransform = commandList.historyFrame != 0;
+        const unsigned instanceSize = (hasInstanceData ? 4 : 3) + (hasPrevTransform ? 3 : 0);
+        InstanceLayout instanceLayout = hasPrevTransform ? (hasInstanceData ? INSTANCE_TRANSFORM_DATA_PREV : INSTANCE_TRANSFORM_PREV) :
+            (hasInstanceData ? INSTANCE_TRANSFORM_DATA : INSTANCE_TRANSFORM);
 
-        if (geometryBits == GEOM_INSTANCED)
+        if (command.type == CMD_MULTI_DRAW)
         {
-            if (!instancingEnabled)
+            VertexArrayCache::Bind(vb, ib, program->Attributes(), instanceVertexBuffer, instanceLayout);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                (const void*)((firstDraw + command.firstDraw) * sizeof(DrawElementsIndirectCommand)), (GLsizei)command.count, 0);
+
+            ++stats.drawCalls;
+            ++stats.multiDraws;
+            for (size_t j = command.firstDraw; j < command.firstDraw + command.count; ++j)
             {
-                glEnableVertexAttribArray(7);
-                glEnableVertexAttribArray(8);
-                glEnableVertexAttribArray(9);
-                instancingEnabled = true;
+                const DrawElementsIndirectCommand& drawCommand = commandList.drawCommands[j];
+                stats.instances += drawCommand.instanceCount;
+                stats.triangles += (unsigned long long)(drawCommand.count / 3) * drawCommand.instanceCount;
             }
-
-            const size_t instanceVertexSize = sizeof(Matrix3x4);
-            
-            instanceVertexBuffer->Bind(0);
-            glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(batch.instanceStart * instanceVertexSize));
-            glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(batch.instanceStart * instanceVertexSize + sizeof(Vector4)));
-            glVertexAttribPointer(9, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(batch.instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
-
-            VertexBuffer* vb = geometry->vertexBuffer;
-            IndexBuffer* ib = geometry->indexBuffer;
+        }
+        else if (command.type == CMD_DRAW_INSTANCED && useVertexArrays)
+        {
+            VertexArrayCache::Bind(vb, ib, program->Attributes(), instanceVertexBuffer, instanceLayout);
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, (GLsizei)geometry->drawCount, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                (const void*)(geometry->drawStart * ib->IndexSize()), command.count, geometry->baseVertex, command.instanceStart / instanceSize);
+
+            ++stats.drawCalls;
+            ++stats.instancedDraws;
+            stats.instances += command.count;
+            stats.triangles += (unsigned long long)(geometry->drawCount / 3) * command.count;
+        }
+        else if (command.type == CMD_DRAW_INSTANCED)
+        {
+            SetInstanceAttributes(instanceVertexBuffer, command.instanceStart * sizeof(Vector4), hasInstanceData, hasPrevTransform);
             vb->Bind(program->Attributes());
             if (ib)
                 ib->Bind();
 
-            glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)geometry->drawCount, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, 
-                (const void*)(geometry->drawStart* ib->IndexSize()), batch.instanceCount);
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, (GLsizei)geometry->drawCount, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                (const void*)(geometry->drawStart * ib->IndexSize()), command.count, geometry->baseVertex);
 
-            it += batch.instanceCount;
+            ++stats.drawCalls;
+            ++stats.instancedDraws;
+            stats.instances += command.count;
+            stats.triangles += (unsigned long long)(geometry->drawCount / 3) * command.count;
         }
         else
         {
-            if (instancingEnabled)
+            if (useVertexArrays)
+                VertexArrayCache::Bind(vb, ib, program->Attributes());
+            else
             {
-                glDisableVertexAttribArray(7);
-                glDisableVertexAttribArray(8);
-                glDisableVertexAttribArray(9);
-                instancingEnabled = false;
+                DisableInstanceAttributes();
+                vb->Bind(program->Attributes());
+                if (ib)
+                    ib->Bind();
             }
 
-            VertexBuffer* vb = geometry->vertexBuffer;
-            IndexBuffer* ib = geometry->indexBuffer;
-            vb->Bind(program->Attributes());
-            if (ib)
-                ib->Bind();
-
-            if (!geometryBits)
-                glUniformMatrix3x4fv(program->Uniform(U_WORLDMATRIX), 1, GL_FALSE, batch.worldTransform->Data());
-            // TODO: set per-object uniforms from node for other geometry modes (skinning, billboards...)
+            glUniformMatrix3x4fv(program->Uniform(U_WORLDMATRIX), 1, GL_FALSE, command.worldTransform.Data());
+            if (geometryBits)
+                glUniform4fv(program->Uniform(U_INSTANCEDATA), 1, command.instanceData.Data());
+            if (hasPrevTransform)
+                glUniformMatrix3x4fv(program->Uniform(U_PREVWORLDMATRIX), 1, GL_FALSE, command.prevWorldTransform.Data());
 
             if (!ib)
                 glDrawArrays(GL_TRIANGLES, (GLsizei)geometry->drawStart, (GLsizei)geometry->drawCount);
             else
-                glDrawElements(GL_TRIANGLES, (GLsizei)geometry->drawCount, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, 
-                    (const void*)(geometry->drawStart * ib->IndexSize()));
+                glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)geometry->drawCount, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                    (const void*)(geometry->drawStart * ib->IndexSize()), geometry->baseVertex);
 
-            ++it;
+            ++stats.drawCalls;
+            stats.triangles += geometry->drawCount / 3;
         }
     }
 }
 
-bool Renderer::AllocateShadowMap(Light* light)
+void Renderer::SetInstanceAttributes(VertexBuffer* buffer, size_t offset, bool hasInstanceData, bool hasPrevTransform)
 {
-    size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
-    ShadowMap& shadowMap = shadowMaps[index];
+    if (!instancingEnabled)
+    {
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            glEnableVertexAttribArray(7 + i);
+            glEnableVertexAttribArray(13 + i);
+        }
+        instancingEnabled = true;
+    }
 
-    IntVector2 request = light->TotalShadowMapSize();
+    if (hasInstanceData != instanceDataEnabled)
+    {
+        if (hasInstanceData)
+            glEnableVertexAttribArray(12);
+        else
+            glDisableVertexAttribArray(12);
+        instanceDataEnabled = hasInstanceData;
+    }
 
-    // If light already has its preferred shadow rect from the previous frame, try to reallocate it for shadow map caching
-    IntRect oldRect = light->ShadowRect();
-    if (request.x == oldRect.Width() && request.y == oldRect.Height())
+    const size_t transformSize = hasInstanceData ? sizeof(Matrix3x4) + sizeof(Vector4) : sizeof(Matrix3x4);
+    const GLsizei instanceVertexSize = (GLsizei)(transformSize + (hasPrevTransform ? sizeof(Matrix3x4) : 0));
+    // Without a stored previous transform its attributes alias the current one
+    const size_t prevOffset = hasPrevTransform ? offset + transformSize : offset;
+
+    buffer->Bind(0);
+    for (unsigned i = 0; i < 3; ++i)
     {
-        if (shadowMap.allocator.AllocateSpecific(oldRect))
+        glVertexAttribPointer(7 + i, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(offset + i * sizeof(Vector4)));
+        glVertexAttribPointer(13 + i, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(prevOffset + i * sizeof(Vector4)));
+    }
+    if (hasInstanceData)
+        glVertexAttribPointer(12, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(offset + sizeof(Matrix3x4)));
+}
+
+void Renderer::DisableInstanceAttributes()
+{
+    if (instancingEnabled)
+    {
+        for (unsigned i = 0; i < 3; ++i)
         {
-            light->SetShadowMap(shadowMaps[index].texture, light->ShadowRect());
-            return true;
+            glDisableVertexAttribArray(7 + i);
+            glDisableVertexAttribArray(13 + i);
         }
+        instancingEnabled = false;
     }
 
-    IntRect shadowRect;
-    size_t retries = 3;
-    
-    while (retries--)
+    if (instanceDataEnabled)
     {
-        int x, y;
-        if (shadowMap.allocator.Allocate(request.x, request.y, x, y))
+        glDisableVertexAttribArray(12);
+        instanceDataEnabled = false;
+    }
+}
+
+size_t Renderer::UploadMultiDrawCommands(const std::vector<DrawElementsIndirectCommand>& drawCommands)
+{
+    size_t firstCommand = numMultiDrawCommands;
+    numMultiDrawCommands += drawCommands.size();
+
+    if (!multiDrawCommandBuffer)
+        multiDrawCommandBuffer = new StorageBuffer();
+
+    // Append to the commands of the frame so that earlier draws are not overwritten. When growing, the old buffer is released by OpenGL once the GPU is done with it
+    if (numMultiDrawCommands * sizeof(DrawElementsIndirectCommand) > multiDrawCommandBuffer->Size())
+    {
+        size_t capacity = NextPowerOfTwo((unsigned)numMultiDrawCommands);
+        multiDrawCommandBuffer->Define(USAGE_DYNAMIC, capacity * sizeof(DrawElementsIndirectCommand));
+    }
+
+    multiDrawCommandBuffer->SetData(firstCommand * sizeof(DrawElementsIndirectCommand), drawCommands.size() * sizeof(DrawElementsIndirectCommand), &drawCommands[0]);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, multiDrawCommandBuffer->GLBuffer());
+    return firstCommand;
+}
+
+void Renderer::DefinePerViewData()
+{
+    PerViewData& data = viewData;
+
+    data.viewMatrix = camera->ViewMatrix();
+    data.projectionMatrix = camera->ProjectionMatrix();
+    data.viewProjMatrix = camera->ViewProjMatrix();
+
+    data.depthParameters = Vector4(camera->NearClip(), camera->FarClip(), 0.0f, 0.0f);
+    if (camera->IsOrthographic())
+    {
+        // Linear depth from the clip space depth, which is reversed with the 0..1 range
+        data.depthParameters.z = camera->ReverseDepth() ? -1.0f : 0.5f;
+        data.depthParameters.w = camera->ReverseDepth() ? 1.0f : 0.5f;
+    }
+    else
+        data.depthParameters.w = 1.0f / camera->FarClip();
+
+    Vector4* dirLightData = data.dirLightData;
+    if (!dirLight)
+    {
+        dirLightData[0] = Vector4::ZERO;
+        dirLightData[1] = Vector4::ZERO;
+        dirLightData[3] = Vector4::ONE;
+    }
+    else
+    {
+        dirLightData[0] = Vector4(-dirLight->WorldDirection(), 0.0f);
+        dirLightData[1] = dirLight->GetColor().Data();
+
+        if (dirLight->ShadowMap())
         {
-            light->SetShadowMap(shadowMaps[index].texture, IntRect(x, y, x + request.x, y + request.y));
-            return true;
+            float invFarClip = 1.0f / camera->FarClip();
+            std::vector<ShadowView>& shadowViews = dirLight->ShadowViews();
+            // Unused cascades repeat the last split, so that the shader never selects them
+            Vector4 splits = dirLight->ShadowSplits() * invFarClip;
+            float lastSplit = dirLight->ShadowMaxDistance() * invFarClip;
+            float fadeStart = dirLight->ShadowFadeStart() * lastSplit;
+
+            dirLightData[2] = splits;
+            dirLightData[3] = dirLight->ShadowParameters();
+            dirLightData[4] = Vector4(fadeStart, 1.0f / (lastSplit - fadeStart), lastSplit, (float)shadowViews.size());
+            for (size_t i = 0; i < shadowViews.size() && i < MAX_SHADOW_CASCADES; ++i)
+                *reinterpret_cast<Matrix4*>(&dirLightData[5 + 4 * i]) = shadowViews[i].shadowMatrix;
         }
-    
-        request.x /= 2;
-        request.y /= 2;
+        else
+            dirLightData[3] = Vector4::ONE;
     }
 
-    // No room in atlas
-    light->SetShadowMap(nullptr);
-    return false;
+    // Motion vectors leave out the projection offset, so that a jittered projection shows no motion. Without history the previous view-projection is the current
+    data.motionViewProjMatrix = camera->ProjectionMatrix(true, false) * data.viewMatrix;
+    data.prevViewProjMatrix = (viewHistoryFrame && camera == historyCamera) ? historyViewProj : data.motionViewProjMatrix;
+    if (viewHistoryFrame)
+    {
+        historyCamera = camera;
+        historyViewProj = data.motionViewProjMatrix;
+    }
+
+    data.decalParameters = Vector4((float)(lightIndexRows * LIGHT_INDEX_TEXTURE_WIDTH), (float)numVisibleDecals, 0.0f, 0.0f);
+
+    data.ambientColor = camera->AmbientColor().Data();
+    if (irradianceVolume)
+        irradianceVolume->ShaderParameters(data.irradianceParameters[0], data.irradianceParameters[1]);
+    else
+    {
+        data.irradianceParameters[0] = Vector4::ZERO;
+        data.irradianceParameters[1] = Vector4::ZERO;
+    }
+
+    viewProjMatrix = camera->ViewProjMatrix(false);
+    depthConversion = camera->HardwareDepthConversion();
+    if (camera->IsOrthographic())
+        depthLinearize = Vector4(depthConversion.x, depthConversion.y, 1.0f, 0.0f);
+    else
+    {
+        Vector2 depthReconstruct = camera->DepthReconstruct();
+        depthLinearize = Vector4(depthReconstruct.y, 0.0f, -depthReconstruct.x, 1.0f);
+    }
 }
 
-void Renderer::CollectGeometriesAndLights(std::vector<OctreeNode*>::const_iterator begin, std::vector<OctreeNode*>::const_iterator end, unsigned char planeMask)
+void Renderer::UpdatePerViewData(Camera* camera_)
 {
-    for (auto it = begin; it != end; ++it)
+    // The main camera and the directional light were captured in PrepareView. Shadow cameras are only moved by the renderer
+    PerViewData data = viewData;
+
+    if (camera_ != camera)
     {
-        OctreeNode* node = *it;
-        unsigned short flags = node->Flags();
+        camera_->SetReverseDepth(depthReversed);
+        data.viewMatrix = camera_->ViewMatrix();
+        data.projectionMatrix = camera_->ProjectionMatrix();
+        data.viewProjMatrix = camera_->ViewProjMatrix();
 
-        if ((node->LayerMask() & viewMask) && (planeMask == 0x3f || frustum.IsInsideMaskedFast(node->WorldBoundingBox(), planeMask)))
+        if (camera_->IsOrthographic())
         {
-            if (flags & NF_GEOMETRY)
-            {
-                GeometryNode* geometry = static_cast<GeometryNode*>(node);
-                if (geometry->OnPrepareRender(frameNumber, camera))
-                    geometries.push_back(geometry);
-            }
-            else if (flags & NF_LIGHT)
-            {
-                Light* light = static_cast<Light*>(node);
-                if (light->OnPrepareRender(frameNumber, camera))
-                {
-                    if (light->GetLightType() != LIGHT_DIRECTIONAL)
-                        lights.push_back(light);
-                    else if (!dirLight || light->GetColor().Average() > dirLight->GetColor().Average())
-                        dirLight = light;
-                }
-            }
+            data.depthParameters.z = depthReversed ? -1.0f : 0.5f;
+            data.depthParameters.w = depthReversed ? 1.0f : 0.5f;
+        }
+        else
+        {
+            data.depthParameters.z = 0.0f;
+            data.depthParameters.w = 1.0f / camera->FarClip();
+        }
+    }
+
+    perViewDataBuffer->SetData(0, sizeof data, &data);
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+}
+
+ShaderProgram* Renderer::SetupPass(Camera* camera_, Pass* pass, unsigned char programBits)
+{
+    // The depth pre-pass substitutes the depth-only pass, and skips the passes that do not qualify. After the pre-pass, the passes that were rendered in it test for equal depth.
+    // A depth program still compiling in parallel is found ready only by the pre-pass or shadow rendering, so that the main pass does not test against depth that was not rendered
+    bool prePassed = false;
+    if (renderingDepthPrePass)
+    {
+        if (!CanDepthPrePass(pass, programBits))
+            return nullptr;
+        pass = pass->Parent()->DepthPass();
+        prePassed = true;
+    }
+    else if (renderingAfterPrePass && CanDepthPrePass(pass, programBits))
+    {
+        ShaderProgram* depthProgram = pass->Parent()->DepthPass()->GetShaderProgram(programBits);
+        prePassed = depthProgram && !depthProgram->IsLinkPending() && depthProgram->GLProgram();
+    }
+
+    // Deferred mode renders the opaque main passes' G-buffer variations
+    if (renderingDeferred && !renderingDepthPrePass)
+        programBits |= SP_DEFERREDBIT;
+    else if (renderingOIT)
+        programBits |= SP_OITBIT;
+    if (renderingMotion && !renderingDepthPrePass)
+        programBits |= SP_MOTIONBIT;
+
+    ShaderProgram* program = pass->GetShaderProgram(programBits);
+    // Skip the batch instead of blocking while the program is still compiling in parallel
+    if (!program || !program->IsReady())
+        return nullptr;
+    if (program != ShaderProgram::BoundProgram())
+        ++stats.programBinds;
+    if (!program->Bind())
+        return nullptr;
+
+    Material* material = pass->Parent();
+    if (pass != lastPass || prePassed != lastPrePassed)
+    {
+        if (material != lastMaterial)
+        {
+            // With bindless textures the handles are in the material uniform block
+            if (!bindlessTextures)
+            {
+                for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+                {
+                    Texture* texture = material->GetTexture(i);
+                    if (texture)
+                        texture->Bind(i);
+                }
+            }
+
+            material->GetUniformBuffer()->Bind(UB_MATERIALDATA);
+            lastMaterial = material;
+        }
+
+        CullMode cullMode = material->GetCullMode();
+        if (camera_->UseReverseCulling())
+        {
+            if (cullMode == CULL_BACK)
+                cullMode = CULL_FRONT;
+            else if (cullMode == CULL_FRONT)
+                cullMode = CULL_BACK;
+        }
+
+        if (renderingDepthPrePass)
+            SetRenderState(BLEND_REPLACE, cullMode, CMP_LESS, false, true);
+        else if (renderingOIT)
+            SetRenderState(BLEND_ADD, cullMode, pass->GetDepthTest(), pass->GetColorWrite(), false);
+        else if (prePassed)
+            SetRenderState(pass->GetBlendMode(), cullMode, CMP_EQUAL, pass->GetColorWrite(), false);
+        else
+            SetRenderState(pass->GetBlendMode(), cullMode, pass->GetDepthTest(), pass->GetColorWrite(), pass->GetDepthWrite());
+
+        lastPass = pass;
+        lastPrePassed = prePassed;
+    }
+
+    // Apply the render state before the pass's draws, along with any viewport or depth bias set since the last pass
+    stats.stateChanges += graphics->FlushState();
+    return program;
+}
+
+bool Renderer::CanDepthPrePass(Pass* pass, unsigned char programBits) const
+{
+    // The depth shaders transform only static and instanced geometry
+    return (programBits & SP_GEOMETRYBITS) <= SP_INSTANCED && pass->GetBlendMode() == BLEND_REPLACE && pass->GetDepthTest() == CMP_LESS && pass->GetDepthWrite();
+}
+
+void Renderer::DefineGPUDrivenStatic()
+{
+    PROFILE(DefineGPUDrivenStatic);
+
+    gpuDrivenOctree = octree;
+    gpuDrivenDirty = false;
+    gpuDrivenGeneration = CombinedBuffer::Generation();
+    gpuDrivenInstances.clear();
+    gpuDrivenDraws.clear();
+    gpuDrivenCommands.clear();
+
+    // Reset nodes gathered earlier, as they may no longer qualify
+    BoundingBox allBox(-M_MAX_FLOAT, M_MAX_FLOAT);
+    std::vector<OctreeNode*> nodes;
+    octree->FindNodes(nodes, allBox, NF_GEOMETRY | NF_GPU_DRIVEN);
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+        (*it)->SetFlag(NF_GPU_DRIVEN, false);
+
+    nodes.clear();
+    octree->FindNodes(nodes, allBox, NF_GEOMETRY | NF_STATIC);
+
+    // Accept static models without LODs or draw distance whose all geometries are indexed and opaque, so that they can be skipped entirely on the CPU
+    std::vector<Batch> batches;
+    Batch newBatch;
+    newBatch.programBits = GEOM_INSTANCED;
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        GeometryNode* node = static_cast<GeometryNode*>(*it);
+        if (node->Type() != StaticModel::TypeStatic() || node->GetGeometryType() != GEOM_STATIC || node->TestFlag(NF_HASLODLEVELS) ||
+            node->MaxDistance() > 0.0f || static_cast<StaticModel*>(node)->HasImpostor())
+            continue;
+
+        size_t numGeometries = node->NumGeometries();
+        size_t i;
+        for (i = 0; i < numGeometries; ++i)
+        {
+            Material* material = node->GetMaterial(i);
+            Geometry* geometry = node->GetGeometry(i);
+            if (!material || !material->GetPass(PASS_OPAQUE) || !geometry || !geometry->vertexBuffer || !geometry->indexBuffer)
+                break;
+        }
+        if (!numGeometries || i < numGeometries)
+            continue;
+
+        for (i = 0; i < numGeometries; ++i)
+        {
+            newBatch.pass = node->GetMaterial(i)->GetPass(PASS_OPAQUE);
+            newBatch.geometry = node->GetGeometry(i);
+            newBatch.node = node;
+            batches.push_back(newBatch);
+        }
+
+        node->SetFlag(NF_GPU_DRIVEN, true);
+    }
+
+    std::sort(batches.begin(), batches.end(), CompareGPUDrivenBatches);
+
+    GPUDrivenInstance newInstance;
+    unsigned baseInstance = 0;
+
+    for (auto it = batches.begin(); it != batches.end(); ++it)
+    {
+        if (gpuDrivenDraws.empty() || it->pass != gpuDrivenDraws.back().pass || it->geometry != gpuDrivenDraws.back().geometry)
+        {
+            GPUDrivenDraw newDraw;
+            newDraw.pass = it->pass;
+            newDraw.geometry = it->geometry;
+            gpuDrivenDraws.push_back(newDraw);
+
+            DrawElementsIndirectCommand newCommand;
+            newCommand.count = (unsigned)it->geometry->drawCount;
+            newCommand.instanceCount = 0;
+            newCommand.firstIndex = (unsigned)it->geometry->drawStart;
+            newCommand.baseVertex = it->geometry->baseVertex;
+            newCommand.baseInstance = baseInstance;
+            gpuDrivenCommands.push_back(newCommand);
+        }
+
+        const BoundingBox& box = it->node->WorldBoundingBox();
+        newInstance.boxMin = Vector4(box.min, UintBitsToFloat((unsigned)gpuDrivenCommands.size() - 1));
+        newInstance.boxMax = Vector4(box.max, UintBitsToFloat(it->node->LayerMask()));
+        newInstance.worldTransform = it->node->WorldTransform();
+        gpuDrivenInstances.push_back(newInstance);
+        ++baseInstance;
+    }
+
+    if (gpuDrivenInstances.empty())
+        return;
+
+    if (!gpuDrivenInstanceBuffer)
+    {
+        gpuDrivenInstanceBuffer = new StorageBuffer();
+        gpuDrivenCommandBuffer = new StorageBuffer();
+        gpuDrivenTransformBuffer = new VertexBuffer();
+    }
+
+    gpuDrivenInstanceBuffer->Define(USAGE_DEFAULT, gpuDrivenInstances.size() * sizeof(GPUDrivenInstance), &gpuDrivenInstances[0]);
+    gpuDrivenCommandBuffer->Define(USAGE_DYNAMIC, gpuDrivenCommands.size() * sizeof(DrawElementsIndirectCommand), &gpuDrivenCommands[0]);
+    gpuDrivenTransformBuffer->Define(USAGE_DYNAMIC, gpuDrivenInstances.size(), instanceVertexElements);
+
+    LOGDEBUGF("Gathered %d GPU-driven static instances in %d draws", (int)gpuDrivenInstances.size(), (int)gpuDrivenDraws.size());
+}
+
+void Renderer::RenderGPUDrivenStatic()
+{
+    if (gpuDrivenDraws.empty())
+        return;
+
+    PROFILE(RenderGPUDrivenStatic);
+
+    ShaderProgram* cullProgram = SetProgram("Shaders/StaticCull.glsl");
+    if (!cullProgram)
+        return;
+
+    Vector4 frustumPlanes[NUM_FRUSTUM_PLANES];
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+        frustumPlanes[i] = frustum.planes[i].ToVector4();
+
+    glUniform4fv(cullProgram->Uniform("frustumPlanes"), NUM_FRUSTUM_PLANES, frustumPlanes[0].Data());
+    glUniform1ui(cullProgram->Uniform("numInstances"), (unsigned)gpuDrivenInstances.size());
+    glUniform1ui(cullProgram->Uniform("viewMask"), viewMask);
+
+    // Reset the instance counts, then let the compute shader append the visible instances' transforms to each draw's range
+    gpuDrivenCommandBuffer->SetData(0, gpuDrivenCommands.size() * sizeof(DrawElementsIndirectCommand), &gpuDrivenCommands[0]);
+    gpuDrivenInstanceBuffer->Bind(0);
+    gpuDrivenCommandBuffer->Bind(1);
+    StorageBuffer::Unbind(2);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, gpuDrivenTransformBuffer->GLBuffer());
+
+    glDispatchCompute(((unsigned)gpuDrivenInstances.size() + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0);
+
+    // The culled transforms have no history, so motion vectors of the GPU-driven geometry come from the camera movement only
+    SetInstanceAttributes(gpuDrivenTransformBuffer, 0, false, false);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gpuDrivenCommandBuffer->GLBuffer());
+
+    for (size_t i = 0; i < gpuDrivenDraws.size();)
+    {
+        const GPUDrivenDraw& draw = gpuDrivenDraws[i];
+        VertexBuffer* vb = draw.geometry->vertexBuffer;
+        IndexBuffer* ib = draw.geometry->indexBuffer;
+
+        // Submit consecutive draws that share the pass and buffers with one call
+        size_t j = i + 1;
+        while (j < gpuDrivenDraws.size() && gpuDrivenDraws[j].pass == draw.pass && gpuDrivenDraws[j].geometry->vertexBuffer == vb &&
+            gpuDrivenDraws[j].geometry->indexBuffer == ib)
+            ++j;
+
+        ShaderProgram* program = SetupPass(camera, draw.pass, GEOM_INSTANCED);
+        if (program)
+        {
+            vb->Bind(program->Attributes());
+            ib->Bind();
+
+            glMultiDrawElementsIndirect(GL_TRIANGLES, ib->IndexSize() == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                (const void*)(i * sizeof(DrawElementsIndirectCommand)), (GLsizei)(j - i), 0);
+
+            ++stats.drawCalls;
+            ++stats.multiDraws;
+        }
+
+        i = j;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool Renderer::AllocateShadowMap(Light* light, bool reuseOnly)
+{
+    size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
+    ShadowMap& shadowMap = shadowMaps[index];
+
+    IntVector2 request = light->TotalShadowMapSize();
+    IntRect oldRect = light->ShadowRect();
+
+    // Scale point and spot light shadow maps to the light's screen diameter, in power of two steps
+    if (index && shadowLodScale > 0.0f)
+    {
+        int maxSize = light->ShadowMapSize();
+        int numVerticalSplits = light->GetLightType() == LIGHT_POINT ? 2 : 1;
+        int oldSize = oldRect.Height() / numVerticalSplits;
+
+        float viewHeight = (float)Subsystem<Graphics>()->RenderHeight();
+        float screenScale = camera->IsOrthographic() ? viewHeight / camera->OrthoSize() : viewHeight * 0.5f / Tan(camera->Fov() * 0.5f);
+        float diameter = 2.0f * light->Range() * screenScale / (camera->IsOrthographic() ? 1.0f : Max(light->Distance(), light->Range()));
+        float desiredSize = diameter * shadowLodScale;
+
+        int size = Clamp((int)NextPowerOfTwo((unsigned)Max(desiredSize, 1.0f)), Min(MIN_SHADOW_LOD_SIZE, maxSize), maxSize);
+        // Shrink only well below the current size to not reallocate and rerender back and forth at the threshold
+        if (oldSize > 0 && size < oldSize && desiredSize > oldSize * 0.4f)
+            size = Min(oldSize, maxSize);
+
+        request.x = request.x / maxSize * size;
+        request.y = request.y / maxSize * size;
+    }
+
+    // If light already has its preferred shadow rect from the previous frame, try to reallocate it for shadow map caching
+    if (request.x == oldRect.Width() && request.y == oldRect.Height())
+    {
+        if (shadowMap.allocator.AllocateSpecific(oldRect))
+        {
+            light->SetShadowMap(shadowMaps[index].texture, light->ShadowRect());
+            return true;
+        }
+    }
+
+    // Keep the old rect to compare the size on the next allocation
+    if (reuseOnly)
+    {
+        light->SetShadowMap(nullptr, oldRect);
+        return false;
+    }
+
+    size_t retries = 3;
+    
+    while (retries--)
+    {
+        int x, y;
+        if (shadowMap.allocator.Allocate(request.x, request.y, x, y))
+        {
+            light->SetShadowMap(shadowMaps[index].texture, IntRect(x, y, x + request.x, y + request.y));
+            return true;
+        }
+
+        // If the atlas has enough free area but is fragmented, repack it on the next frame. Repacking rerenders all shadow maps, so not too often
+        if (index && shadowMap.allocator.UsedArea() + request.x * request.y <= shadowMap.allocator.Capacity() &&
+            (unsigned short)(frameNumber - shadowRepackFrame) >= SHADOW_REPACK_INTERVAL)
+            shadowAtlasFragmented = true;
+    
+        request.x /= 2;
+        request.y /= 2;
+    }
+
+    // No room in atlas
+    light->SetShadowMap(nullptr);
+    return false;
+}
+
+void Renderer::CollectSubtreesWork(Task* task, unsigned)
+{
+    PROFILE(CollectSubtreesWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+        octree->FindNodesMasked(octreeSubtrees[i], frustum, this, &Renderer::CollectGeometriesAndLights, activeOcclusionBuffer);
+}
+
+void Renderer::PrepareGeometriesWork(Task* task, unsigned)
+{
+    PROFILE(PrepareGeometriesWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+    PrepareGeometries(rangeTask->start, rangeTask->end);
+}
+
+void Renderer::PrepareGeometries(size_t start, size_t end)
+{
+    for (size_t i = start; i < end; ++i)
+    {
+        if (!geometries[i]->OnPrepareRender(frameNumber, camera))
+            geometries[i] = nullptr;
+        else if (viewHistoryFrame)
+            geometries[i]->UpdateHistory(viewHistoryFrame);
+    }
+}
+
+void Renderer::CollectGeometriesAndLights(const Octant* octant, unsigned char planeMask)
+{
+    ThreadVisibleNodes& result = threadVisibleNodes[WorkQueue::ThreadIndex()];
+    // Static geometry culled on the GPU is not collected for the main view
+    unsigned short skipFlags = (gpuDrivenStatic && gpuDrivenOctree == octree) ? NF_GPU_DRIVEN : 0;
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
+
+    // When the octant is completely inside the frustum, its static geometry comes from the batch cache, and only the other nodes are collected
+    if (staticBatchCaching && planeMask == 0x3f && !activeOcclusionBuffer && !skipFlags)
+    {
+        const OctantBatchCache& cache = UpdateBatchCache(octant);
+        if (cache.batches.size())
+            result.cachedOctants.push_back(octant);
+
+        for (auto it = cache.uncachedNodes.begin(); it != cache.uncachedNodes.end(); ++it)
+        {
+            if (!(octant->nodeLayerMasks[*it] & viewMask))
+                continue;
+
+            OctreeNode* node = octantNodes[*it];
+            unsigned short flags = node->Flags();
+            if (flags & NF_GEOMETRY)
+                result.geometries.push_back(static_cast<GeometryNode*>(node));
+            else if (flags & NF_LIGHT)
+                result.lights.push_back(static_cast<Light*>(node));
+        }
+
+        return;
+    }
+
+    // Cull with the octant's packed culling data first, so that only the visible nodes are accessed
+    for (size_t i = 0; i < octantNodes.size(); i += NODES_PER_TEST)
+    {
+        unsigned visible = octant->TestNodes(i, frustum, planeMask, viewMask);
+
+        for (size_t j = i; visible; ++j, visible >>= 1)
+        {
+            if (!(visible & 1))
+                continue;
+
+            OctreeNode* node = octantNodes[j];
+            unsigned short flags = node->Flags();
+
+            if ((flags & NF_GEOMETRY) && !(flags & skipFlags))
+            {
+                if (!activeOcclusionBuffer || activeOcclusionBuffer->IsVisible(node->WorldBoundingBox()))
+                    result.geometries.push_back(static_cast<GeometryNode*>(node));
+            }
+            else if ((flags & NF_LIGHT) && IsLightVisible(static_cast<Light*>(node), activeOcclusionBuffer))
+                result.lights.push_back(static_cast<Light*>(node));
+        }
+    }
+}
+
+void Renderer::CollectViewGroupNodesWork(Task* task, unsigned threadIndex)
+{
+    PROFILE(CollectViewGroupNodesWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+    ThreadVisibleNodes& result = threadVisibleNodes[threadIndex];
+    unsigned short skipFlags = (gpuDrivenStatic && gpuDrivenOctree == octree) ? NF_GPU_DRIVEN : 0;
+
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+    {
+        OctreeNode* node = viewGroupNodes[i];
+        unsigned short flags = node->Flags();
+        if (!(node->LayerMask() & viewMask) || !(flags & (NF_GEOMETRY | NF_LIGHT)) || !frustum.IsInsideFast(node->WorldBoundingBox()))
+            continue;
+
+        if ((flags & NF_GEOMETRY) && !(flags & skipFlags))
+        {
+            if (!activeOcclusionBuffer || activeOcclusionBuffer->IsVisible(node->WorldBoundingBox()))
+                result.geometries.push_back(static_cast<GeometryNode*>(node));
+        }
+        else if ((flags & NF_LIGHT) && IsLightVisible(static_cast<Light*>(node), activeOcclusionBuffer))
+            result.lights.push_back(static_cast<Light*>(node));
+    }
+}
+
+bool Renderer::IsViewGroupValid() const
+{
+    if (octree != viewGroupOctree || octree->Generation() != viewGroupGeneration)
+        return false;
+
+    for (size_t i = 0; i < viewGroupCameras.size(); ++i)
+    {
+        if (viewGroupCameras[i] == camera)
+            return viewGroupViewProjs[i] == camera->ViewProjMatrix(false);
+    }
+
+    return false;
+}
+
+const OctantBatchCache& Renderer::UpdateBatchCache(const Octant* octant)
+{
+    unsigned batchGeneration = SourceBatches::AssignmentGeneration();
+    OctantBatchCache* cache = octant->batchCache.Get();
+    if (cache && cache->octantVersion == octant->version && cache->batchGeneration == batchGeneration && cache->viewMask == viewMask)
+        return *cache;
+
+    // Each octant is visited by one thread during the query, so the cache can be rebuilt without locking
+    if (!cache)
+    {
+        octant->batchCache = new OctantBatchCache();
+        cache = octant->batchCache.Get();
+    }
+
+    cache->batches.clear();
+    cache->uncachedNodes.clear();
+    cache->passes.clear();
+    cache->geometries.clear();
+    cache->textures.clear();
+    cache->boundingBox.Undefine();
+    cache->maxNodeSize = 0.0f;
+    cache->prePassRadiusSquared = 0.0f;
+    cache->numPrePassNodes = 0;
+    cache->octantVersion = octant->version;
+    cache->batchGeneration = batchGeneration;
+    cache->viewMask = viewMask;
+
+    const std::vector<OctreeNode*>& octantNodes = octant->nodes;
+    Batch newBatch;
+    newBatch.programBits = GEOM_STATIC;
+
+    for (size_t i = 0; i < octantNodes.size(); ++i)
+    {
+        OctreeNode* node = octantNodes[i];
+
+        // Accept visible static models without LODs or draw distance whose all geometries are opaque, so that their batches never change while cached
+        bool cacheable = node->TestFlag(NF_GEOMETRY) && node->TestFlag(NF_STATIC) && (octant->nodeLayerMasks[i] & viewMask) && node->Type() == StaticModel::TypeStatic() &&
+            !node->TestFlag(NF_HASLODLEVELS) && node->MaxDistance() <= 0.0f && !static_cast<StaticModel*>(node)->HasImpostor();
+        GeometryNode* geometryNode = static_cast<GeometryNode*>(node);
+        size_t numGeometries = cacheable ? geometryNode->NumGeometries() : 0;
+        if (cacheable)
+        {
+            cacheable = numGeometries && geometryNode->GetGeometryType() == GEOM_STATIC;
+            for (size_t j = 0; cacheable && j < numGeometries; ++j)
+            {
+                Material* material = geometryNode->GetMaterial(j);
+                cacheable = material && material->GetPass(PASS_OPAQUE) && geometryNode->GetGeometry(j);
+            }
+        }
+
+        if (!cacheable)
+        {
+            cache->uncachedNodes.push_back((unsigned)i);
+            continue;
+        }
+
+        bool prePassable = false;
+
+        for (size_t j = 0; j < numGeometries; ++j)
+        {
+            Material* material = geometryNode->GetMaterial(j);
+            newBatch.pass = material->GetPass(PASS_OPAQUE);
+            newBatch.geometry = geometryNode->GetGeometry(j);
+            newBatch.node = geometryNode;
+            cache->batches.push_back(newBatch);
+
+            if (std::find(cache->passes.begin(), cache->passes.end(), newBatch.pass) == cache->passes.end())
+                cache->passes.push_back(newBatch.pass);
+            if (std::find(cache->geometries.begin(), cache->geometries.end(), newBatch.geometry) == cache->geometries.end())
+                cache->geometries.push_back(newBatch.geometry);
+            if (CanDepthPrePass(newBatch.pass, newBatch.programBits))
+                prePassable = true;
+
+            for (size_t k = 0; k < MAX_MATERIAL_TEXTURE_UNITS; ++k)
+            {
+                Texture* texture = material->GetTexture(k);
+                if (texture && texture->IsStreamable() && std::find(cache->textures.begin(), cache->textures.end(), texture) == cache->textures.end())
+                    cache->textures.push_back(texture);
+            }
+        }
+
+        const BoundingBox& box = node->WorldBoundingBox();
+        float nodeSize = box.Size().Length();
+        cache->boundingBox.Merge(box);
+        cache->maxNodeSize = Max(cache->maxNodeSize, nodeSize);
+        if (prePassable)
+        {
+            cache->prePassRadiusSquared += nodeSize * nodeSize * 0.25f;
+            ++cache->numPrePassNodes;
+        }
+    }
+
+    return *cache;
+}
+
+void Renderer::RasterizeOccluders()
+{
+    PROFILE(RasterizeOccluders);
+
+    softwareOcclusionBuffer.Clear(IntVector2(SOFTWARE_OCCLUSION_WIDTH, SOFTWARE_OCCLUSION_HEIGHT), camera->ViewProjMatrix(false));
+
+    occluders.clear();
+    octree->FindNodesMasked(occluders, frustum, NF_ENABLED | NF_GEOMETRY | NF_OCCLUDER, viewMask);
+
+    std::vector<std::pair<float, GeometryNode*>, FrameStdAllocator<std::pair<float, GeometryNode*> > > sortedOccluders(
+        FrameStdAllocator<std::pair<float, GeometryNode*> >(&frameAllocator, 0));
+    sortedOccluders.reserve(occluders.size());
+    for (auto it = occluders.begin(); it != occluders.end(); ++it)
+    {
+        GeometryNode* node = static_cast<GeometryNode*>(*it);
+        sortedOccluders.push_back(std::make_pair(camera->Distance(node->WorldPosition()), node));
+    }
+    std::sort(sortedOccluders.begin(), sortedOccluders.end());
+
+    // Add the nearest occluders until the triangle budget is used
+    for (auto it = sortedOccluders.begin(); it != sortedOccluders.end() && softwareOcclusionBuffer.NumTriangles() < MAX_SOFTWARE_OCCLUSION_TRIANGLES; ++it)
+    {
+        GeometryNode* node = it->second;
+        const Matrix3x4& worldTransform = node->WorldTransform();
+
+        for (size_t i = 0; i < node->NumGeometries(); ++i)
+        {
+            Geometry* geometry = node->GetGeometry(i);
+            OccluderGeometry* occluder = geometry ? geometry->occluder.Get() : nullptr;
+            if (occluder && occluder->indices.size())
+                softwareOcclusionBuffer.AddTriangles(worldTransform, &occluder->vertices[0], occluder->vertices.size(), &occluder->indices[0], occluder->indices.size());
+        }
+    }
+
+    // Without occluders everything would test visible; leave the buffer invalid to skip the tests
+    if (!softwareOcclusionBuffer.NumTriangles())
+        return;
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+
+    if (numThreads > 1)
+    {
+        // Each task owns a separate band of rows, so no synchronization is needed for the depth writes
+        size_t numTasks = (SOFTWARE_OCCLUSION_HEIGHT + SOFTWARE_OCCLUSION_ROWS_PER_TASK - 1) / SOFTWARE_OCCLUSION_ROWS_PER_TASK;
+        while (rasterizeOccludersTasks.size() < numTasks)
+            rasterizeOccludersTasks.push_back(new RangeTask<Renderer>(this, &Renderer::RasterizeOccludersWork));
+
+        TaskCounter counter(0);
+        for (size_t i = 0; i < numTasks; ++i)
+        {
+            RangeTask<Renderer>* task = rasterizeOccludersTasks[i];
+            task->start = i * SOFTWARE_OCCLUSION_ROWS_PER_TASK;
+            task->end = task->start + SOFTWARE_OCCLUSION_ROWS_PER_TASK;
+            workQueue->QueueTask(task, &counter);
+        }
+
+        workQueue->Complete(counter);
+    }
+    else
+        softwareOcclusionBuffer.RasterizeRows(0, SOFTWARE_OCCLUSION_HEIGHT);
+
+    softwareOcclusionBuffer.BuildPyramid();
+}
+
+void Renderer::RasterizeOccludersWork(Task* task, unsigned)
+{
+    PROFILE(RasterizeOccludersWork);
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    RangeTask<Renderer>* rangeTask = static_cast<RangeTask<Renderer>*>(task);
+    softwareOcclusionBuffer.RasterizeRows((int)rangeTask->start, (int)rangeTask->end);
+}
+
+void Renderer::ReadOcclusionBuffer()
+{
+    if (!occlusionFence)
+        return;
+
+    GLenum result = glClientWaitSync((GLsync)occlusionFence, 0, 0);
+    if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+        return;
+
+    PROFILE(ReadOcclusionBuffer);
+
+    glDeleteSync((GLsync)occlusionFence);
+    occlusionFence = nullptr;
+
+    IntVector2 size(occlusionTexture->Width(), occlusionTexture->Height());
+    occlusionData.resize(size.x * size.y);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, occlusionPixelBuffer);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, occlusionData.size() * sizeof(float), &occlusionData[0]);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    occlusionBuffer.SetData(size, &occlusionData[0], occlusionViewProj);
+    occlusionBufferCamera = occlusionPendingCamera;
+}
+
+void Renderer::BeginFrameTiming()
+{
+    if (!dynamicResolution || frameBeginQuery || !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query))
+        return;
+
+    if (freeFrameQueries.size())
+    {
+        frameBeginQuery = freeFrameQueries.back();
+        freeFrameQueries.pop_back();
+    }
+    else
+        glGenQueries(1, &frameBeginQuery);
+
+    glQueryCounter(frameBeginQuery, GL_TIMESTAMP);
+}
+
+void Renderer::UpdateDynamicResolution()
+{
+    // The queries finish in order, so stop at the first frame that is not available yet
+    while (pendingFrameQueries.size())
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(pendingFrameQueries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 beginTime = 0;
+        GLuint64 endTime = 0;
+        glGetQueryObjectui64v(pendingFrameQueries[0], GL_QUERY_RESULT, &beginTime);
+        glGetQueryObjectui64v(pendingFrameQueries[1], GL_QUERY_RESULT, &endTime);
+        float frameTime = (float)(endTime - beginTime) * 0.000001f;
+        gpuFrameTime = gpuFrameTime > 0.0f ? Lerp(gpuFrameTime, frameTime, GPU_FRAME_TIME_SMOOTHING) : frameTime;
+        ++framesSinceScaleChange;
+
+        freeFrameQueries.push_back(pendingFrameQueries[0]);
+        freeFrameQueries.push_back(pendingFrameQueries[1]);
+        pendingFrameQueries.erase(pendingFrameQueries.begin(), pendingFrameQueries.begin() + 2);
+    }
+
+    if (!dynamicResolution || gpuFrameTime <= 0.0f || framesSinceScaleChange < DYNAMIC_RESOLUTION_INTERVAL)
+        return;
+
+    // The pixel count, and roughly the GPU time, scale with the square of the resolution scale. Change in steps so that the render targets are not redefined every frame
+    float desiredScale = resolutionScale * sqrtf(dynamicTargetTime / gpuFrameTime);
+    desiredScale = Clamp(floorf(desiredScale / DYNAMIC_RESOLUTION_STEP + 0.5f) * DYNAMIC_RESOLUTION_STEP, minResolutionScale, maxResolutionScale);
+    if (Abs(desiredScale - resolutionScale) >= DYNAMIC_RESOLUTION_STEP * 0.5f)
+    {
+        resolutionScale = desiredScale;
+        // Measure the new scale from scratch. Frames still in flight were rendered at the old scale, which the interval covers
+        gpuFrameTime = 0.0f;
+        framesSinceScaleChange = 0;
+    }
+}
+
+void Renderer::BindLighting()
+{
+    if (shadowMaps.size())
+    {
+        // Prefiltered shadows sample the moments instead of comparing depth
+        (shadowMaps[0].momentTexture ? shadowMaps[0].momentTexture : shadowMaps[0].texture)->Bind(8);
+        (shadowMaps[1].momentTexture ? shadowMaps[1].momentTexture : shadowMaps[1].texture)->Bind(9);
+        faceSelectionTexture1->Bind(10);
+        faceSelectionTexture2->Bind(11);
+    }
+
+    clusterTexture->Bind(12);
+    lightIndexTexture->Bind(13);
+    if (irradianceVolume && irradianceVolume->IrradianceTexture())
+        irradianceVolume->IrradianceTexture()->Bind(14);
+    if (numVisibleDecals && decalSet && decalSet->Atlas())
+        decalSet->Atlas()->Bind(15);
+    lightDataBuffer->Bind(UB_LIGHTDATA);
+    decalDataBuffer->Bind(UB_DECALDATA);
+}
+
+void Renderer::SetRendererShaderDefines()
+{
+    std::string defines = "MAX_LIGHTS=" + ToString(maxLights) + " MAX_DECALS=" + ToString(maxDecals);
+    if (bindlessTextures)
+        defines += " BINDLESS";
+    if (prefilteredShadows)
+        defines += " EVSM";
+
+    Material::SetRendererShaderDefines(defines, defines);
+}
+
+void Renderer::SetDepthConvention(bool reversed)
+{
+    if (reversed == depthReversed)
+        return;
+
+    glClipControl(GL_LOWER_LEFT, reversed ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+    glClearDepth(reversed ? 0.0f : 1.0f);
+    depthReversed = reversed;
+}
+
+void Renderer::DefineShadowMomentTextures()
+{
+    IntVector2 maxSize(IntVector2::ZERO);
+
+    for (auto it = shadowMaps.begin(); it != shadowMaps.end(); ++it)
+    {
+        ShadowMap& shadowMap = *it;
+        IntVector2 size(shadowMap.texture->Width(), shadowMap.texture->Height());
+
+        // The depth is read unfiltered for converting to moments
+        if (prefilteredShadows)
+        {
+            if (!shadowMap.momentTexture)
+                shadowMap.momentTexture = new Texture();
+            if (shadowMap.momentTexture->Size2D() != size && !shadowMap.momentTexture->Define(TEX_2D, size, FMT_RG32F, 1))
+            {
+                LOGERROR("Failed to create shadow map moment texture");
+                shadowMap.momentTexture.Reset();
+            }
+        }
+        else
+            shadowMap.momentTexture.Reset();
+
+        if (shadowMap.momentTexture)
+        {
+            shadowMap.momentTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
+            shadowMap.texture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
+            maxSize.x = Max(maxSize.x, size.x);
+            maxSize.y = Max(maxSize.y, size.y);
+        }
+        else
+            shadowMap.texture->DefineSampler(COMPARE_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
+    }
+
+    if (maxSize == IntVector2::ZERO)
+        shadowFilterTexture.Reset();
+    else if (!shadowFilterTexture || shadowFilterTexture->Size2D() != maxSize)
+    {
+        shadowFilterTexture = new Texture();
+        if (!shadowFilterTexture->Define(TEX_2D, maxSize, FMT_RG32F, 1))
+        {
+            LOGERROR("Failed to create shadow filter texture");
+            shadowFilterTexture.Reset();
+            return;
         }
+        shadowFilterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
     }
 }
 
@@ -1342,20 +4972,20 @@ void Renderer::DefineClusterFrustums()
         float cameraFarClip = camera->FarClip();
         size_t idx = 0;
 
-        float xStep = 2.0f / NUM_CLUSTER_X;
-        float yStep = 2.0f / NUM_CLUSTER_Y;
-        float zStep = 1.0f / NUM_CLUSTER_Z;
+        float xStep = 2.0f / clusterSize.x;
+        float yStep = 2.0f / clusterSize.y;
+        float zStep = 1.0f / clusterSize.z;
 
-        for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+        for (int z = 0; z < clusterSize.z; ++z)
         {
             Vector4 nearVec = cameraProj * Vector4(0.0f, 0.0f, z > 0 ? powf(z * zStep, 2.0f) * cameraFarClip : cameraNearClip, 1.0f);
             Vector4 farVec = cameraProj * Vector4(0.0f, 0.0f, powf((z + 1) * zStep, 2.0f) * cameraFarClip, 1.0f);
             float near = nearVec.z / nearVec.w;
             float far = farVec.z / farVec.w;
 
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+            for (int y = 0; y < clusterSize.y; ++y)
             {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                for (int x = 0; x < clusterSize.x; ++x)
                 {
                     clusterFrustums[idx].vertices[0] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, near);
                     clusterFrustums[idx].vertices[1] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), near);
@@ -1367,6 +4997,12 @@ void Renderer::DefineClusterFrustums()
                     clusterFrustums[idx].vertices[7] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, far);
                     clusterFrustums[idx].UpdatePlanes();
                     clusterBoundingBoxes[idx].Define(clusterFrustums[idx]);
+                    clusterMinX[idx] = clusterBoundingBoxes[idx].min.x;
+                    clusterMinY[idx] = clusterBoundingBoxes[idx].min.y;
+                    clusterMinZ[idx] = clusterBoundingBoxes[idx].min.z;
+                    clusterMaxX[idx] = clusterBoundingBoxes[idx].max.x;
+                    clusterMaxY[idx] = clusterBoundingBoxes[idx].max.y;
+                    clusterMaxZ[idx] = clusterBoundingBoxes[idx].max.z;
                     ++idx;
                 }
             }
@@ -1374,6 +5010,7 @@ void Renderer::DefineClusterFrustums()
 
         lastClusterFrustumProj = cameraProj;
         clusterFrustumsDirty = false;
+        clusterBoundsDirty = true;
     }
 }
 
@@ -1391,7 +5028,17 @@ void RegisterRendererLibrary()
     OctreeNode::RegisterObject();
     GeometryNode::RegisterObject();
     StaticModel::RegisterObject();
+    StaticBatch::RegisterObject();
+    BoneNode::RegisterObject();
+    AnimatedModel::RegisterObject();
+    ParticleEmitter::RegisterObject();
+    ReflectionProbe::RegisterObject();
+    IrradianceVolume::RegisterObject();
+    DecalSet::RegisterObject();
+    TerrainPatch::RegisterObject();
+    Terrain::RegisterObject();
     Light::RegisterObject();
     Material::RegisterObject();
     Model::RegisterObject();
+    Animation::RegisterObject();
 }
@@ -3,27 +3,398 @@
 #pragma once
 
 #include "../IO/JSONValue.h"
+#include "../Object/Allocator.h"
 #include "../Object/AutoPtr.h"
 #include "../Math/Color.h"
 #include "../Math/Frustum.h"
 #include "../Resource/Image.h"
+#include "../Thread/Mutex.h"
+#include "../Thread/WorkQueue.h"
 #include "Batch.h"
+#include "Octree.h"
+
+#include <set>
 
 class Camera;
+class DecalSet;
+struct Decal;
 class GeometryNode;
 class Graphics;
+class IrradianceVolume;
 class Material;
-class Octree;
 class RenderBuffer;
 class Scene;
+class ShadingRateImage;
+class SourceBatches;
+class StaticModel;
+class StorageBuffer;
+class TextureStreamer;
 class UniformBuffer;
 class VertexBuffer;
 
-static const size_t NUM_CLUSTER_X = 16;
-static const size_t NUM_CLUSTER_Y = 8;
-static const size_t NUM_CLUSTER_Z = 8;
-static const size_t MAX_LIGHTS = 255;
-static const size_t MAX_LIGHTS_CLUSTER = 16;
+static const int DEFAULT_NUM_CLUSTER_X = 16;
+static const int DEFAULT_NUM_CLUSTER_Y = 8;
+static const int DEFAULT_NUM_CLUSTER_Z = 8;
+static const int DEFAULT_MAX_LIGHTS = 255;
+static const int DEFAULT_MAX_LIGHTS_CLUSTER = 16;
+static const int MAX_LIGHTS_LIMIT = 65535;
+static const int MAX_LIGHTS_CLUSTER_LIMIT = 255;
+static const size_t MAX_CLUSTER_LIGHT_INDICES = 0xffffff;
+static const size_t UB_LIGHTDATA = 0;
+static const size_t UB_PERVIEWDATA = 1;
+static const size_t UB_MATERIALDATA = 2;
+static const size_t UB_DECALDATA = 3;
+static const size_t SB_BONEPALETTE = 4;
+static const size_t UB_CUBESHADOWDATA = 4;
+static const int LIGHT_INDEX_TEXTURE_WIDTH = 1024;
+static const int MAX_VIEW_DECALS = 512;
+static const int MAX_DECALS_CLUSTER = 16;
+static const int OCTREE_SPLIT_DEPTH = 2;
+static const size_t GEOMETRIES_PER_TASK = 1024;
+static const size_t BATCHES_PER_TASK = 256;
+static const unsigned GPU_CULL_GROUP_SIZE = 64;
+static const int MIN_SHADOW_LOD_SIZE = 64;
+static const unsigned short SHADOW_REPACK_INTERVAL = 60;
+static const int OCCLUSION_BUFFER_WIDTH = 256;
+static const int SOFTWARE_OCCLUSION_WIDTH = 256;
+static const int SOFTWARE_OCCLUSION_HEIGHT = 128;
+static const int SOFTWARE_OCCLUSION_ROWS_PER_TASK = 16;
+static const size_t MAX_SOFTWARE_OCCLUSION_TRIANGLES = 16384;
+static const size_t DEFAULT_INSTANCE_CAPACITY = 16384;
+static const size_t INSTANCE_BUFFER_FRAMES = 3;
+static const size_t DEFAULT_BONE_PALETTE_CAPACITY = 16384;
+static const size_t DEFAULT_SKINNED_VERTEX_CAPACITY = 65536;
+static const unsigned SKINNING_GROUP_SIZE = 64;
+static const size_t RENDER_STATS_HISTORY = 60;
+static const float DEFAULT_DYNAMIC_RESOLUTION_TARGET = 14.0f;
+static const float DYNAMIC_RESOLUTION_STEP = 0.05f;
+static const unsigned DYNAMIC_RESOLUTION_INTERVAL = 15;
+static const float GPU_FRAME_TIME_SMOOTHING = 0.2f;
+
+static const float DEFAULT_PREPASS_OVERDRAW = 2.0f;
+static const float DEFAULT_SHADING_RATE_THRESHOLD = 0.1f;
+static const unsigned SHADING_RATE_GROUP_SIZE = 8;
+static const IntVector3 DEFAULT_FOG_GRID_SIZE(160, 90, 64);
+static const float DEFAULT_FOG_DENSITY = 0.01f;
+static const float DEFAULT_FOG_ANISOTROPY = 0.3f;
+static const unsigned FOG_INJECT_GROUP_SIZE = 4;
+static const unsigned FOG_INTEGRATE_GROUP_SIZE = 8;
+static const unsigned SHADOW_FILTER_GROUP_SIZE = 8;
+static const float MAX_LOD_BUDGET_SCALE = 16.0f;
+static const float LOD_BUDGET_STEP = 0.1f;
+static const float LOD_BUDGET_RELAX_RATIO = 0.9f;
+
+/// Depth pre-pass modes for opaque geometry.
+enum DepthPrePassMode
+{
+    PREPASS_OFF = 0,
+    PREPASS_ON,
+    PREPASS_AUTO
+};
+
+/// Lighting modes for opaque geometry.
+enum LightingMode
+{
+    LIGHTING_FORWARD = 0,
+    LIGHTING_DEFERRED
+};
+
+/// Rendering modes for transparent geometry.
+enum AlphaMode
+{
+    ALPHA_SORTED = 0,
+    ALPHA_WEIGHTED_OIT
+};
+
+/// Filtering of the dynamic resolution upscale.
+enum UpscaleMode
+{
+    UPSCALE_BILINEAR = 0,
+    UPSCALE_SHARPEN_BILINEAR
+};
+
+/// Per-thread results of the frustum query for visible nodes.
+struct ThreadVisibleNodes
+{
+    /// Geometries in frustum, not yet prepared for rendering.
+    std::vector<GeometryNode*> geometries;
+    /// Lights in frustum, not yet prepared for rendering.
+    std::vector<Light*> lights;
+    /// Octants completely in frustum whose static geometry batches are cached.
+    std::vector<const Octant*> cachedOctants;
+};
+
+/// Union of the view frustums of a view group, for culling the views at once.
+struct ViewGroupVolume
+{
+    /// Test if a bounding box is inside any of the frustums, outside all of them or intersects.
+    Intersection IsInside(const BoundingBox& box) const
+    {
+        Intersection ret = OUTSIDE;
+        for (auto it = frustums.begin(); it != frustums.end(); ++it)
+        {
+            Intersection res = it->IsInside(box);
+            if (res == INSIDE)
+                return INSIDE;
+            else if (res == INTERSECTS)
+                ret = INTERSECTS;
+        }
+        return ret;
+    }
+
+    /// Test if a bounding box is (partially) inside any of the frustums or outside all of them.
+    Intersection IsInsideFast(const BoundingBox& box) const
+    {
+        for (auto it = frustums.begin(); it != frustums.end(); ++it)
+        {
+            if (it->IsInsideFast(box) != OUTSIDE)
+                return INSIDE;
+        }
+        return OUTSIDE;
+    }
+
+    /// View frustums.
+    std::vector<Frustum> frustums;
+};
+
+/// Per-thread results of batch collection.
+struct ThreadBatches
+{
+    /// Opaque batches.
+    BatchQueue opaqueBatches;
+    /// Transparent batches.
+    BatchQueue alphaBatches;
+    /// Minimum distances of opaque passes.
+    MinDistanceMap passDistances;
+    /// Minimum distances of opaque geometries.
+    MinDistanceMap geometryDistances;
+    /// Most detailed requested mip levels of streamed textures.
+    MinDistanceMap textureLevels;
+    /// Estimated screen coverage of the opaque geometries that can be depth pre-passed, summed in screen areas.
+    float coveredArea;
+};
+
+/// Per-frame visibility of the queried shadowcasters of a point or spot light, computed once and shared by its shadow views.
+struct ShadowCasterVisibility
+{
+    /// Shadowcaster bounding boxes in structure-of-arrays layout: min X, Y, Z and max X, Y, Z arrays of the shadowcaster count each. Point lights only, for the face frustum tests.
+    std::vector<float> boxes;
+    /// Bit per shadowcaster, set if visible in the main view, or outside it but within its max distance.
+    std::vector<unsigned> renderable;
+};
+
+/// Shadow view to collect batches for in a worker thread.
+struct ShadowViewJob
+{
+    /// Shadow map the view renders to.
+    ShadowMap* shadowMap;
+    /// Shadow view.
+    ShadowView* view;
+    /// Potential shadowcasters.
+    std::vector<GeometryNode*>* shadowCasters;
+    /// Static light's cached static shadowcasters, or null if included in the potential shadowcasters.
+    const std::vector<GeometryNode*>* staticShadowCasters;
+    /// Precomputed visibility of the potential shadowcasters, or null if not computed.
+    const ShadowCasterVisibility* visibility;
+    /// Whether to query the potential shadowcasters from the octree using the shadow frustum first.
+    bool queryShadowCasters;
+    /// Whether to check the shadowcasters against the shadow frustum.
+    bool checkFrustum;
+    /// Index of the thread that collected the batches.
+    unsigned threadIndex;
+};
+
+/// Point light whose face batches of static geometry are combined for single-pass shadow rendering.
+struct CubeShadowJob
+{
+    /// Point light.
+    Light* light;
+    /// Combined batch queue index in the shadow map.
+    size_t queueIdx;
+};
+
+/// View space bounds of a light for assigning it to light clusters.
+struct LightClusterBounds
+{
+    /// Bounding sphere for point lights.
+    Sphere sphere;
+    /// Frustum for spot lights.
+    Frustum frustum;
+    /// Bounding box.
+    BoundingBox box;
+    /// Range of cluster X & Y indices the light may affect, inclusive.
+    IntRect clusterRect;
+};
+
+/// Static geometry instance for GPU culling. Matches the layout read by the culling compute shader.
+struct GPUDrivenInstance
+{
+    /// World bounding box minimum. W component stores the draw command index.
+    Vector4 boxMin;
+    /// World bounding box maximum. W component stores the layer mask.
+    Vector4 boxMax;
+    /// World transform.
+    Matrix3x4 worldTransform;
+};
+
+/// Draw of GPU-driven static geometry. Consecutive draws with the same pass and buffers are submitted with one multi-draw call.
+struct GPUDrivenDraw
+{
+    /// %Material pass.
+    SharedPtr<Pass> pass;
+    /// %Geometry.
+    SharedPtr<Geometry> geometry;
+};
+
+/// Transient vertex buffer that the skinned vertex buffers of one vertex layout are pre-skinned into each view.
+struct SkinnedVertexPool
+{
+    /// Vertex elements, the same as in the source vertex buffers.
+    std::vector<VertexElement> elements;
+    /// Destination vertex buffer. Null until created at the start of the next view.
+    SharedPtr<VertexBuffer> buffer;
+    /// Capacity in vertices.
+    size_t capacity;
+    /// Vertices allocated in the current view.
+    size_t used;
+    /// Vertices requested in the current view, including those that did not fit.
+    size_t requested;
+};
+
+/// Compute pre-skinning of one skinned model's vertex buffer.
+struct SkinningJob
+{
+    /// Source vertex buffer.
+    VertexBuffer* source;
+    /// Destination pool index.
+    size_t pool;
+    /// First destination vertex.
+    unsigned destStart;
+    /// Bone palette offset in matrices.
+    unsigned paletteOffset;
+    /// Inverse world transform of the model, as the vertices are skinned into model space.
+    Matrix3x4 inverseWorldTransform;
+};
+
+/// Rendering statistics of a view, counted from PrepareView() until the next view is prepared.
+struct RenderStats
+{
+    /// Construct with zero counts.
+    RenderStats()
+    {
+        Reset();
+    }
+
+    /// Reset all counts to zero.
+    void Reset()
+    {
+        drawCalls = 0;
+        instancedDraws = 0;
+        multiDraws = 0;
+        instances = 0;
+        triangles = 0;
+        stateChanges = 0;
+        programBinds = 0;
+        shadowViewsRendered = 0;
+        shadowViewsCached = 0;
+        lights = 0;
+        clusters = 0;
+        clusterLights = 0;
+        maxClusterLights = 0;
+    }
+
+    /// Add the counts of another frame.
+    RenderStats& operator += (const RenderStats& rhs)
+    {
+        drawCalls += rhs.drawCalls;
+        instancedDraws += rhs.instancedDraws;
+        multiDraws += rhs.multiDraws;
+        instances += rhs.instances;
+        triangles += rhs.triangles;
+        stateChanges += rhs.stateChanges;
+        programBinds += rhs.programBinds;
+        shadowViewsRendered += rhs.shadowViewsRendered;
+        shadowViewsCached += rhs.shadowViewsCached;
+        lights += rhs.lights;
+        clusters += rhs.clusters;
+        clusterLights += rhs.clusterLights;
+        maxClusterLights += rhs.maxClusterLights;
+        return *this;
+    }
+
+    /// Subtract the counts of another frame.
+    RenderStats& operator -= (const RenderStats& rhs)
+    {
+        drawCalls -= rhs.drawCalls;
+        instancedDraws -= rhs.instancedDraws;
+        multiDraws -= rhs.multiDraws;
+        instances -= rhs.instances;
+        triangles -= rhs.triangles;
+        stateChanges -= rhs.stateChanges;
+        programBinds -= rhs.programBinds;
+        shadowViewsRendered -= rhs.shadowViewsRendered;
+        shadowViewsCached -= rhs.shadowViewsCached;
+        lights -= rhs.lights;
+        clusters -= rhs.clusters;
+        clusterLights -= rhs.clusterLights;
+        maxClusterLights -= rhs.maxClusterLights;
+        return *this;
+    }
+
+    /// Return the counts divided by a number of frames, rounded to nearest.
+    RenderStats operator / (unsigned long long numFrames) const
+    {
+        RenderStats ret;
+        if (!numFrames)
+            return ret;
+
+        unsigned long long half = numFrames / 2;
+        ret.drawCalls = (drawCalls + half) / numFrames;
+        ret.instancedDraws = (instancedDraws + half) / numFrames;
+        ret.multiDraws = (multiDraws + half) / numFrames;
+        ret.instances = (instances + half) / numFrames;
+        ret.triangles = (triangles + half) / numFrames;
+        ret.stateChanges = (stateChanges + half) / numFrames;
+        ret.programBinds = (programBinds + half) / numFrames;
+        ret.shadowViewsRendered = (shadowViewsRendered + half) / numFrames;
+        ret.shadowViewsCached = (shadowViewsCached + half) / numFrames;
+        ret.lights = (lights + half) / numFrames;
+        ret.clusters = (clusters + half) / numFrames;
+        ret.clusterLights = (clusterLights + half) / numFrames;
+        ret.maxClusterLights = (maxClusterLights + half) / numFrames;
+        return ret;
+    }
+
+    /// Return average number of lights per light cluster.
+    float AverageClusterLights() const { return clusters ? (float)clusterLights / (float)clusters : 0.0f; }
+
+    /// Draw calls, including postprocess quads. A multi-draw counts as one.
+    unsigned long long drawCalls;
+    /// Instanced draw calls.
+    unsigned long long instancedDraws;
+    /// Multi-draw indirect calls.
+    unsigned long long multiDraws;
+    /// Instances drawn by the instanced and multi-draw calls.
+    unsigned long long instances;
+    /// Triangles drawn. GPU-culled static geometry is not included, as its instance counts are only known to the GPU.
+    unsigned long long triangles;
+    /// Blend, cull, depth test, color write, depth write and depth bias state changes.
+    unsigned long long stateChanges;
+    /// Shader program binds.
+    unsigned long long programBinds;
+    /// Shadow views rendered.
+    unsigned long long shadowViewsRendered;
+    /// Shadow views skipped because their shadow map is cached.
+    unsigned long long shadowViewsCached;
+    /// Lights in view.
+    unsigned long long lights;
+    /// Light clusters.
+    unsigned long long clusters;
+    /// Sum of lights over the light clusters.
+    unsigned long long clusterLights;
+    /// Most lights in one cluster.
+    unsigned long long maxClusterLights;
+};
 
 /// High-level rendering subsystem. Performs rendering of 3D scenes.
 class Renderer : public Object
@@ -36,26 +407,110 @@ public:
     /// Destruct.
     ~Renderer();
 
-    /// Set size and format of shadow maps. First map is used for a directional light, the second as an atlas for others.
-    void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format);
+    /// Set size and format of shadow maps. First map is used for a directional light, with room for the given number of cascades of the directional light size, the second as an atlas for others.
+    void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format, int numDirCascades = 2);
+    /// Set directory of the on-disk cache of baked static shadow tiles, or empty to disable. The static shadowcasters of static spot and point lights are rendered once per tile size and shadow projection and saved, after which a tile is loaded to the atlas instead of rendered whenever the light is allocated a new tile, for example on first becoming visible or after the atlas is reset. The dynamic shadowcasters are rendered on top as usual. A tile is identified by the light's shadow projection, the tile size, the shadow map format, the depth bias and the bounding boxes of the static shadowcasters. Single-pass point light shadows are not baked. Return true on success.
+    bool SetShadowBakeDir(const std::string& dir);
+    /// Set light cluster grid size, maximum lights per cluster and maximum lights per view. Shaders are recompiled if the light count changes.
+    void SetupLightClusters(const IntVector3& clusterSize, int maxLightsPerCluster, int maxLights);
+    /// Set whether to cull and draw opaque static models on the GPU with indirect draws. The static geometry is gathered on the next PrepareView. Call again after adding, removing or modifying static models. Requires OpenGL 4.3.
+    void SetGPUDrivenStatic(bool enable);
+    /// Set whether to cull geometries, and lights whose whole volume is hidden along with their shadow views, occluded in the depth buffer of an earlier frame. Requires calling UpdateOcclusionBuffer() each frame.
+    void SetOcclusionCulling(bool enable);
+    /// Set whether to rasterize occluder geometry on the CPU each view and cull occluded geometries, lights and shadowcasters against it. Takes precedence over the previous frame's depth when both are enabled.
+    void SetSoftwareOcclusion(bool enable);
+    /// Set whether to read material textures through bindless handles in the material uniform blocks instead of binding them on each material change. Requires GL_ARB_bindless_texture. Textures can not change sampling parameters after first being rendered this way.
+    void SetBindlessTextures(bool enable);
+    /// Set whether to render the static geometry of dynamic point light shadows for all six faces in one instanced pass, selecting each instance's face matrix and viewport in the vertex shader, so that a shadowcaster is submitted once instead of once per face. Skinned and custom geometry and static point lights are rendered per face. Requires instancing, viewport arrays and GL_ARB_shader_viewport_layer_array or GL_AMD_vertex_shader_viewport_index.
+    void SetSinglePassPointShadows(bool enable);
+    /// Set whether to render the views with reversed depth: clip control keeps the 0..1 depth range with the near plane at 1, the depth tests are reversed and depth is cleared to 0. With a floating point depth buffer such as FMT_D32F the precision stays nearly uniform over distance, so that far clip distances or an infinite far plane do not cause z-fighting. Shadow maps keep the conventional depth. Requires OpenGL 4.5 or GL_ARB_clip_control.
+    void SetReverseDepth(bool enable);
     /// Set global depth bias multipiers for shadow maps.
     void SetShadowDepthBiasMul(float depthBiasMul, float slopeScaleBiasMul);
-    /// Prepare view for rendering.
+    /// Set point and spot light shadow map face resolution relative to the light's screen diameter in pixels. The lights' own shadow map sizes are the maximum. Zero (default) always uses the lights' own sizes.
+    void SetShadowLodScale(float scale);
+    /// Set point and spot light shadow map update throttling: the update interval grows by one frame per distance from the camera, up to the maximum interval. Zero distance (default) updates every frame.
+    void SetShadowUpdateThrottle(float distance, unsigned maxInterval);
+    /// Set maximum point and spot light shadow map texels to update per frame. Lights are updated most important first, while shadow maps that can stay in place are left stale until budget is available or the maximum update interval is reached. Zero (default) is unlimited.
+    void SetShadowTexelBudget(unsigned texels);
+    /// Set per-frame point and spot light budgets: the number of lights shaded, the number of lights with shadows and the shadow map texels they occupy. Lights are ranked by importance, so that the least important first lose their shadows and are then culled. Zero is unlimited, though the shaded lights are always limited by the maximum number of lights.
+    void SetLightBudget(int shadedLights, int shadowedLights, unsigned shadowTexels);
+    /// Set the importance below which point and spot lights are culled, and below which they are rendered without shadows. Lights fade out as their importance falls from twice the culling threshold to it, so that they do not pop. Zero (default) disables the thresholds.
+    void SetLightImportanceThresholds(float minImportance, float minShadowImportance);
+    /// Set whether to update the directional light shadow cascades beyond the first on alternate frames, so that the far cascades can be stale by a frame.
+    void SetShadowCascadeInterleave(bool enable);
+    /// Set whether to scale the view render size to hold a target GPU frame time, measured from the first RenderShadowMaps() or RenderOpaque() of a frame to Upscale(). Size the view render targets with DynamicRenderSize() each frame. Requires timestamp queries, otherwise the maximum scale is used.
+    void SetDynamicResolution(bool enable, float targetFrameMs = DEFAULT_DYNAMIC_RESOLUTION_TARGET, float minScale = 0.5f, float maxScale = 1.0f);
+    /// Set filtering and sharpening strength of Upscale().
+    void SetUpscaleMode(UpscaleMode mode, float sharpness = 0.5f);
+    /// Set depth pre-pass mode. The pre-pass renders static opaque geometry with depth-only shaders, after which its main pass tests depth for equality without writing, so that the lighting shaders run once per pixel. In auto mode the pre-pass is rendered when the summed screen coverage of the opaque geometries, estimated from their bounding spheres, reaches the overdraw threshold.
+    void SetDepthPrePass(DepthPrePassMode mode, float overdrawThreshold = DEFAULT_PREPASS_OVERDRAW);
+    /// Set lighting mode of opaque geometry. In deferred mode RenderOpaque() writes unlit albedo and view space normals to two color targets, after which RenderDeferredLighting() lights each pixel once with the same cluster light lists. Can be changed between views.
+    void SetLightingMode(LightingMode mode);
+    /// Set whether to render motion vectors for temporal reprojection. RenderOpaque() then writes the screen space motion of the opaque geometry since the previous view in texture coordinate units, without the camera's projection offset, to a third color target after the color and normal targets. The previous world transforms of the visible nodes and the previous view-projection of the camera are kept for one camera, so enable it for one view per frame. Skinned geometry and GPU-driven static geometry get motion from the camera movement only. Can be changed between views.
+    void SetMotionVectors(bool enable);
+    /// Set rendering mode of transparent geometry. In weighted OIT mode RenderAlpha() accumulates depth-weighted premultiplied colors and revealage to two color targets without sorting, after which CompositeAlpha() blends the result over the opaque scene. Requires per-target blend functions, otherwise falls back to sorted.
+    void SetAlphaMode(AlphaMode mode);
+    /// Set resolution divisor of transparent geometry in weighted OIT mode: 1 for full, 2 for half or 4 for quarter resolution. Size the accumulation and revealage targets with AlphaRenderSize() and give them a depth target filled by DownsampleDepth(), then pass the full and reduced resolution depth textures to CompositeAlpha() for depth-aware upsampling.
+    void SetAlphaResolutionDivisor(int divisor);
+    /// Set whether to shade the opaque geometry at a coarser rate in screen tiles of low luminance contrast, through a shading rate image written by UpdateShadingRate() from the previous frame's color. The threshold is the relative contrast below which the rate starts to drop. Requires GL_NV_shading_rate_image and compute shaders.
+    void SetVariableRateShading(bool enable, float contrastThreshold = DEFAULT_SHADING_RATE_THRESHOLD);
+    /// Set whether to prefilter the shadow maps as exponential variance shadow maps. When a shadow view is rendered, its depth is converted to exponentially warped moments and blurred separably in compute shaders, so that cached views are not refiltered, and lighting takes one bilinear fetch per light instead of 4 or 9 depth comparisons. The HQSHADOW define has no effect while enabled. Requires compute shaders.
+    void SetPrefilteredShadows(bool enable);
+    /// Set whether to render volumetric fog with RenderVolumetricFog(). The lights are injected into a 3D grid of froxels that follows the light clusters, reusing their light lists and the shadow maps, and the grid is integrated front to back once per view, so that applying the fog costs one 3D texture fetch per pixel regardless of the light count. Density is the extinction per world unit and anisotropy the Henyey-Greenstein forward scattering factor from -1 to 1. Requires compute shaders and a perspective camera.
+    void SetVolumetricFog(bool enable, float density = DEFAULT_FOG_DENSITY, float anisotropy = DEFAULT_FOG_ANISOTROPY, const IntVector3& gridSize = DEFAULT_FOG_GRID_SIZE);
+    /// Set whether to assign the lights to the clusters in a compute shader when rendering opaque geometry, instead of on the CPU in PrepareView(). Requires compute shaders and shader storage buffers. The cluster light statistics are not available in this mode.
+    void SetGPULightCulling(bool enable);
+    /// Set whether to skin animated models once per view in a compute shader into transient vertex buffers, after which the main view and all shadow views draw them as static geometry in model space, with instancing and multi-draws where they share buffers. The transient buffers grow for the next view when out of space, so that until then the models that do not fit are skinned in the vertex shader. Skinned models must have their own vertex buffers. Requires compute shaders and shader storage buffers.
+    void SetComputeSkinning(bool enable);
+    /// Set the depth texture of the view's framebuffer to bound the GPU light culling with after the depth pre-pass, so that clusters in front of or behind the opaque geometry get no lights. Only the far bound is used when the view has transparent geometry. Null to disable. Set for each view.
+    void SetLightCullingDepth(Texture* depthTexture);
+    /// Set irradiance volume to light the views with, added to the camera's ambient color inside it. Null to use only the ambient color. The volume is updated by its owner.
+    void SetIrradianceVolume(IrradianceVolume* volume);
+    /// Set decals to project onto the opaque geometry of the views. The visible decals, up to MaxDecals() per view with the newest kept, are assigned to the light clusters on the CPU and blended over the albedo by the opaque shaders. Null to disable.
+    void SetDecalSet(DecalSet* decals);
+    /// Set whether to assert in debug builds that PrepareView() makes no heap allocations. Requires compiling with TURSO3D_TRACK_HEAP_ALLOCATIONS, and counts the allocations of all threads. Enable after the first frames, once the reused buffers have grown to their steady state size.
+    void SetAllocationCheck(bool enable);
+    /// Set whether to reuse the visible nodes and sorted batches of the previous view when its camera, viewpoint and view mask are unchanged, no octree node has moved or been removed, and no geometry, material or material pass assignment has changed. The instancing data is still written from the current transforms. Not used with GPU occlusion culling, whose readback can change the visibility on a still camera. Default true.
+    void SetFrameCoherence(bool enable);
+    /// Set whether to cache the opaque batches of static models without LOD levels or draw distance per octant. Octants completely inside the view frustum then skip the per-node preparation and batch collection of their static geometry, and estimate its screen coverage and texture streaming levels per octant. The cache is rebuilt when the octant's nodes change or a geometry, material or material pass assignment changes. Not used with occlusion culling or GPU-driven static geometry. Default false.
+    void SetStaticBatchCaching(bool enable);
+    /// Set target triangle count per view, or 0 to disable. The cameras' LOD distances are scaled from the triangle count of the previous view to stay under the budget, within hysteresis so that the LODs settle.
+    void SetLodTriangleBudget(unsigned triangles);
+    /// Set the bit layout of the 64-bit sort key of opaque batches. Return false if the fields do not fit in 64 bits or one is wider than 32 bits.
+    bool SetSortKeyLayout(const BatchSortKeyLayout& layout);
+    /// Cull the views of several cameras rendered in the same frame at once, for example stereo eyes, split-screen players or cubemap faces. Updates the octree and finds the nodes inside the union of the cameras' frustums, after which PrepareView() with any of the cameras tests only those nodes against its own frustum instead of querying the octree. Valid until a node moves or is removed, a camera's view changes, or the next call. Call with an empty list to release the nodes.
+    void PrepareViewGroup(Scene* scene, const std::vector<Camera*>& cameras);
+    /// Prepare view for rendering. The render data is captured, so the camera and scene nodes may be moved while the view is rendered, for example by logic of the next frame running in parallel. Nodes must not be removed before rendering has finished.
     void PrepareView(Scene* scene, Camera* camera, bool drawShadows);
     /// Render shadowmaps before rendering the view. Last shadow framebuffer will be left bound.
     void RenderShadowMaps();
     /// Render opaque objects into currently set framebuffer and viewport. 
     void RenderOpaque();
-    /// Render transparent objects into currently set framebuffer and viewport.
+    /// Render transparent objects into currently set framebuffer and viewport. In weighted OIT mode the framebuffer must have an accumulation target, such as RGBA16F, as color 0 and a revealage target, such as R16F, as color 1, with the opaque scene's depth; both are cleared here.
     void RenderAlpha();
+    /// Light the opaque geometry of the view from the G-buffer written by RenderOpaque() in deferred mode, into the currently set framebuffer and viewport. The output contains the albedo lit, or unchanged for the background and for surfaces whose shaders lit them already. The textures must not be attached to the framebuffer.
+    void RenderDeferredLighting(Texture* albedoTexture, Texture* normalTexture, Texture* depthTexture);
+    /// Blend the transparent geometry accumulated by RenderAlpha() in weighted OIT mode over the currently set framebuffer and viewport. If the depth textures are given, the accumulation is taken to be at reduced resolution and upsampled with weights from the depth similarity. The textures must not be attached to the framebuffer.
+    void CompositeAlpha(Texture* accumTexture, Texture* revealageTexture, Texture* depthTexture = nullptr, Texture* lowResDepthTexture = nullptr);
+    /// Downsample the view's depth texture into the depth target of the currently set framebuffer and viewport, keeping the nearest depth of the covered texels, for rendering transparent geometry at reduced resolution.
+    void DownsampleDepth(Texture* depthTexture);
+    /// Write the shading rate image for the following frames from the view's color texture. The opaque geometry of views with the same size as the texture is then shaded at the coarser rates. Call at the end of the frame.
+    void UpdateShadingRate(Texture* colorTexture);
+    /// Inject the lights into the volumetric fog grid, integrate it and blend the fog over the currently set framebuffer and viewport using the view's depth texture. Call after RenderOpaque(), which assigns the lights to the clusters; the transparent geometry rendered afterward is not fogged. The depth texture must not be attached to the framebuffer.
+    void RenderVolumetricFog(Texture* depthTexture);
+    /// Bake an octahedral impostor atlas of a static model's LOD 0 geometries and materials from framesPerSide x framesPerSide directions, and assign it to the model to be drawn beyond the LOD distance. Renders into its own framebuffer; call outside the view rendering. Return true on success.
+    bool BakeImpostor(StaticModel* source, float distance, int framesPerSide = 8, int frameSize = 128);
+    /// Downsample the view's depth buffer after rendering opaque objects and read it back for occlusion culling on later frames. Leaves the occlusion framebuffer bound.
+    void UpdateOcclusionBuffer(Texture* depthTexture);
 
     /// Clear the current framebuffer.
     void Clear(bool clearColor = true, bool clearDepth = true, const IntRect& clearRect = IntRect::ZERO, const Color& backgroundColor = Color::BLACK);
-    /// Set the viewport rectangle.
+    /// Set the viewport rectangle. Applied by Graphics before the next draw.
     void SetViewport(const IntRect& viewRect);
-    /// Set basic renderstates.
+    /// Set basic renderstates. The depth test is remapped for reverse depth. Applied by Graphics before the next draw.
     void SetRenderState(BlendMode blendMode, CullMode cullMode = CULL_BACK, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
-    /// Set depth bias.
+    /// Set depth bias. Applied by Graphics before the next draw.
     void SetDepthBias(float constantBias = 0.0f, float slopeScaleBias = 0.0f);
 
     /// Set a shader program and bind. Return pointer on success or null otherwise.
@@ -70,30 +525,283 @@ public:
     void SetUniform(ShaderProgram* program, const char* name, const Vector4& value);
     /// Draw a quad with current renderstate.
     void DrawQuad();
+    /// Dispatch the current compute shader program, then make its image stores visible to later texture fetches and image loads.
+    void DispatchCompute(unsigned groupsX, unsigned groupsY, unsigned groupsZ = 1);
+    /// Upscale a view render target to a rectangle of the destination framebuffer, or the backbuffer if null, at the end of the frame. The source texture should use bilinear filtering. Ends the GPU frame timing and updates the dynamic resolution scale.
+    void Upscale(Texture* source, FrameBuffer* dest, const IntRect& destRect);
+    /// Allocate skinning matrices from the bone palette of the current view and return the destination, or null if out of space, in which case the palette grows for the next view. Return the palette offset in matrices on success. Thread-safe; called by skinned geometry when preparing to render.
+    Matrix3x4* AllocateBonePalette(size_t numBones, unsigned& offset);
+    /// Allocate transient vertices for pre-skinning the vertex buffers of a skinned model's geometries with its bone palette offset in the current view, and point the destination geometries to them, creating them if necessary. Return false if compute skinning is disabled, a vertex layout is unsupported or out of space. Thread-safe; called by skinned geometry when preparing to render.
+    bool AllocateSkinnedGeometries(const SourceBatches& source, std::vector<SharedPtr<Geometry> >& dest, unsigned paletteOffset, const Matrix3x4& worldTransform);
+
+    /// Return light cluster grid size.
+    const IntVector3& ClusterSize() const { return clusterSize; }
+    /// Return maximum lights per cluster.
+    int MaxLightsPerCluster() const { return maxLightsPerCluster; }
+    /// Return maximum lights per view.
+    int MaxLights() const { return maxLights; }
+    /// Return whether GPU-driven static geometry is enabled.
+    bool GPUDrivenStatic() const { return gpuDrivenStatic; }
+    /// Return whether the GPU supports the GPU-driven static geometry path.
+    bool HasGPUDrivenSupport() const;
+    /// Return whether occlusion culling is enabled.
+    bool OcclusionCulling() const { return occlusionCulling; }
+    /// Return whether software occlusion is enabled.
+    bool SoftwareOcclusion() const { return softwareOcclusion; }
+    /// Return whether bindless textures are enabled.
+    bool BindlessTextures() const { return bindlessTextures; }
+    /// Return whether single-pass point light shadows are enabled.
+    bool SinglePassPointShadows() const { return singlePassPointShadows; }
+    /// Return whether the GPU supports single-pass point light shadows.
+    bool HasSinglePassPointShadowSupport() const;
+    /// Return whether reversed depth is enabled.
+    bool ReverseDepth() const { return reverseDepth; }
+    /// Return whether the GPU supports reversed depth.
+    bool HasReverseDepthSupport() const;
+    /// Return shadow map resolution scale relative to the light's screen diameter.
+    float ShadowLodScale() const { return shadowLodScale; }
+    /// Return distance per frame of shadow map update interval.
+    float ShadowThrottleDistance() const { return shadowThrottleDistance; }
+    /// Return maximum shadow map update interval in frames.
+    unsigned ShadowMaxUpdateInterval() const { return shadowMaxUpdateInterval; }
+    /// Return shadow map texel update budget per frame.
+    unsigned ShadowTexelBudget() const { return shadowTexelBudget; }
+    /// Return maximum number of shaded point and spot lights, or zero if only limited by the maximum number of lights.
+    int ShadedLightBudget() const { return shadedLightBudget; }
+    /// Return maximum number of shadowed point and spot lights, or zero if unlimited.
+    int ShadowedLightBudget() const { return shadowedLightBudget; }
+    /// Return maximum point and spot light shadow map texels in use per frame, or zero if unlimited.
+    unsigned ShadowAreaBudget() const { return shadowAreaBudget; }
+    /// Return importance below which point and spot lights are culled.
+    float MinLightImportance() const { return minLightImportance; }
+    /// Return importance below which point and spot lights are rendered without shadows.
+    float MinShadowImportance() const { return minShadowImportance; }
+    /// Return whether directional light shadow cascades beyond the first are updated on alternate frames.
+    bool ShadowCascadeInterleave() const { return shadowCascadeInterleave; }
+    /// Return the reserved fraction of the point and spot light shadow map atlas on the last frame.
+    float ShadowAtlasOccupancy() const { return shadowMaps.size() > 1 ? shadowMaps[1].allocator.Occupancy() : 0.0f; }
+    /// Return number of occluder triangles rasterized for the last view.
+    size_t NumOccluderTriangles() const { return softwareOcclusionBuffer.NumTriangles(); }
+    /// Return whether dynamic resolution is enabled.
+    bool DynamicResolution() const { return dynamicResolution; }
+    /// Return current dynamic resolution scale.
+    float ResolutionScale() const { return resolutionScale; }
+    /// Return view render size for an output size at the current dynamic resolution scale.
+    IntVector2 DynamicRenderSize(const IntVector2& outputSize) const { return IntVector2(Max((int)(outputSize.x * resolutionScale + 0.5f), 1), Max((int)(outputSize.y * resolutionScale + 0.5f), 1)); }
+    /// Return smoothed GPU frame time in milliseconds, or 0 if not measured yet.
+    float GPUFrameTime() const { return gpuFrameTime; }
+    /// Return depth pre-pass mode.
+    DepthPrePassMode GetDepthPrePassMode() const { return depthPrePassMode; }
+    /// Return whether the depth pre-pass is rendered for the current view.
+    bool DepthPrePassActive() const { return depthPrePassActive; }
+    /// Return estimated opaque overdraw of the current view. Estimated only in auto depth pre-pass mode.
+    float EstimatedOverdraw() const { return estimatedOverdraw; }
+    /// Return lighting mode of opaque geometry.
+    LightingMode GetLightingMode() const { return lightingMode; }
+    /// Return whether motion vectors are rendered.
+    bool MotionVectors() const { return motionVectors; }
+    /// Return rendering mode of transparent geometry.
+    AlphaMode GetAlphaMode() const { return alphaMode; }
+    /// Return resolution divisor of transparent geometry.
+    int AlphaResolutionDivisor() const { return alphaResolutionDivisor; }
+    /// Return directory of the baked static shadow tile cache, or empty if disabled.
+    const std::string& ShadowBakeDir() const { return shadowBakeDir; }
+    /// Return render target size for transparent geometry from the view size.
+    IntVector2 AlphaRenderSize(const IntVector2& viewSize) const { return IntVector2(Max(viewSize.x / alphaResolutionDivisor, 1), Max(viewSize.y / alphaResolutionDivisor, 1)); }
+    /// Return whether variable-rate shading is enabled.
+    bool VariableRateShading() const { return variableRateShading; }
+    /// Return the shading rate image, or null if not written yet.
+    ShadingRateImage* GetShadingRateImage() const { return shadingRateImage; }
+    /// Return whether prefiltered shadows are enabled.
+    bool PrefilteredShadows() const { return prefilteredShadows; }
+    /// Return whether volumetric fog is enabled.
+    bool VolumetricFog() const { return volumetricFog; }
+    /// Return volumetric fog extinction per world unit.
+    float FogDensity() const { return fogDensity; }
+    /// Return volumetric fog forward scattering factor.
+    float FogAnisotropy() const { return fogAnisotropy; }
+    /// Return volumetric fog grid size in froxels.
+    const IntVector3& FogGridSize() const { return fogGridSize; }
+    /// Return the integrated volumetric fog texture, or null if not rendered yet. Each texel holds the in-scattered light and the transmittance from the camera to the far end of its slice.
+    Texture* VolumetricFogTexture() const { return fogIntegratedTexture; }
+    /// Return whether lights are assigned to the clusters on the GPU.
+    bool GPULightCulling() const { return gpuLightCulling; }
+    /// Return whether animated models are skinned in a compute shader.
+    bool ComputeSkinning() const { return computeSkinning; }
+    /// Return whether the GPU supports compute skinning.
+    bool HasComputeSkinningSupport() const;
+    /// Return irradiance volume.
+    IrradianceVolume* GetIrradianceVolume() const { return irradianceVolume; }
+    /// Return decal set.
+    DecalSet* GetDecalSet() const { return decalSet; }
+    /// Return maximum decals per view.
+    int MaxDecals() const { return maxDecals; }
+    /// Return number of decals visible in the current view.
+    size_t NumVisibleDecals() const { return numVisibleDecals; }
+    /// Return upscale filtering mode.
+    UpscaleMode GetUpscaleMode() const { return upscaleMode; }
+    /// Return upscale sharpening strength.
+    float UpscaleSharpness() const { return upscaleSharpness; }
+    /// Return whether the heap allocation check is enabled.
+    bool AllocationCheck() const { return allocationCheck; }
+    /// Return whether frame coherence is enabled.
+    bool FrameCoherence() const { return frameCoherence; }
+    /// Return whether static batch caching is enabled.
+    bool StaticBatchCaching() const { return staticBatchCaching; }
+    /// Return target triangle count per view, or 0 if disabled.
+    unsigned LodTriangleBudget() const { return lodTriangleBudget; }
+    /// Return the bit layout of the sort key of opaque batches.
+    const BatchSortKeyLayout& SortKeyLayout() const { return sortKeyLayout; }
+    /// Return the current LOD distance multiplier from the triangle budget.
+    float LodBudgetScale() const { return lodBudgetScale; }
+    /// Return whether GPU skinning is supported. Skinned geometry reads its bone palette from a shader storage buffer.
+    bool HasSkinningSupport() const { return hasSkinning; }
+    /// Return the bone palette generation of the current view. Skinned geometry updates its matrices once per generation.
+    unsigned BonePaletteGeneration() const { return bonePaletteGeneration; }
+    /// Return whether the last prepared view reused the previous view's visible nodes.
+    bool VisibilityReused() const { return visibilityReused; }
+    /// Return whether the last prepared view reused the previous view's sorted batches.
+    bool BatchesReused() const { return batchesReused; }
+    /// Return number of heap allocations made during the last PrepareView(). Always zero unless compiled with TURSO3D_TRACK_HEAP_ALLOCATIONS.
+    size_t NumViewAllocations() const { return numViewAllocations; }
+    /// Return rendering statistics of the current view. Complete once the view has been rendered.
+    const RenderStats& Stats() const { return stats; }
+    /// Return rendering statistics averaged over the last completed views, up to RENDER_STATS_HISTORY.
+    RenderStats AverageStats() const { return statsSum / numStatsHistory; }
+    /// Return the per-frame scratch allocator. Reset at the start of PrepareView().
+    FrameAllocator& GetFrameAllocator() { return frameAllocator; }
+    /// Return the brightest directional light of the current view, or null if none.
+    Light* DirLight() const { return dirLight; }
+    /// Return the point and spot lights of the current view.
+    const std::vector<Light*>& Lights() const { return lights; }
+    /// Return the view space bounding boxes of the light clusters.
+    const std::vector<BoundingBox>& ClusterBoundingBoxes() const { return clusterBoundingBoxes; }
 
 private:
     /// Find visible objects within frustum.
     void CollectVisibleNodes();
     /// Check which lights affect which objects.
     void CollectLightInteractions(bool drawShadows);
-    /// Collect (unlit) shadow batches from geometry nodes and sort them.
-    void CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, const std::vector<GeometryNode*>& potentialShadowCasters, bool checkFrustum);
+    /// Collect (unlit) shadow batches from geometry nodes and sort them. Shadow batch queues for the view must have been reserved. Optional static shadowcasters are already known to be inside the shadow frustum. With an optional visibility bitset the potential shadowcasters are filtered by it instead of the frustum test and render preparation.
+    void CollectShadowBatches(ShadowMap& shadowMap, ShadowView& view, const std::vector<GeometryNode*>& potentialShadowCasters, const std::vector<GeometryNode*>* staticShadowCasters, bool checkFrustum, const unsigned* casterMask, unsigned threadIndex);
+    /// Work function for querying the potential shadowcasters of a light.
+    void QueryShadowCastersWork(Task* task, unsigned threadIndex);
+    /// Work function for collecting the shadow batches of a shadow view.
+    void CollectShadowBatchesWork(Task* task, unsigned threadIndex);
+    /// Work function for combining the face batches of a point light for single-pass shadow rendering.
+    void CombineCubeShadowBatchesWork(Task* task, unsigned threadIndex);
+    /// Render the combined static geometry of single-pass point light shadows.
+    void RenderCubeShadows(ShadowMap& shadowMap);
+    /// Return the baked static shadow tile key of a static light's shadow view, or 0 if baking is disabled or the view can not be baked.
+    unsigned long long BakedShadowKey(const ShadowView& view, const ShadowMap& shadowMap, const Matrix4& shadowViewProj, GeometryNode* const* shadowCasters, size_t numShadowCasters) const;
+    /// Upload a baked static shadow tile to the shadow map. Return true on success.
+    bool LoadBakedShadow(ShadowMap& shadowMap, const ShadowView& view);
+    /// Read back the static shadowcasters just rendered to the shadow map and save them as a baked tile.
+    void SaveBakedShadow(ShadowMap& shadowMap, const ShadowView& view);
+    /// Return the file name of a baked static shadow tile.
+    std::string BakedShadowFileName(unsigned long long key) const;
+    /// Define or release the shadow map moment textures, and switch the depth texture sampling to match.
+    void DefineShadowMomentTextures();
+    /// Convert the shadow views rendered this frame to filtered moments.
+    void FilterShadowMaps();
+    /// Add a shadow view for batch collection and reserve its batch queues.
+    void AddShadowViewJob(ShadowMap& shadowMap, ShadowView& view, std::vector<GeometryNode*>* shadowCasters, const std::vector<GeometryNode*>* staticShadowCasters, const ShadowCasterVisibility* visibility, bool queryShadowCasters, bool checkFrustum);
     /// Collect batches from visible objects.
     void CollectNodeBatches();
+    /// Work function for collecting batches from a range of visible objects.
+    void CollectNodeBatchesWork(Task* task, unsigned threadIndex);
+    /// Collect batches from a range of visible objects into per-thread queues.
+    void CollectNodeBatches(size_t start, size_t end, ThreadBatches& dest);
+    /// Collect batches from the cached static geometry of visible octants.
+    void CollectCachedBatches(ThreadBatches& dest);
     /// Sort batches from visible objects.
     void SortNodeBatches();
-    /// Render a batch queue.
-    void RenderBatches(Camera* camera, const std::vector<Batch>& batches);
-    /// Allocate shadow map for light. Return true on success.
-    bool AllocateShadowMap(Light* light);
-    /// %Octree callback for collecting lights and geometries.
-    void CollectGeometriesAndLights(std::vector<OctreeNode*>::const_iterator begin, std::vector<OctreeNode*>::const_iterator end, unsigned char planeMask);
+    /// Advance the instancing buffer to the next frame region and wait until the GPU has finished reading it. Grow the buffer if the previous frame ran out of space.
+    void BeginInstanceTransforms();
+    /// Begin the bone palette of a new view. Grow it if the previous view ran out of space.
+    void BeginBonePalette();
+    /// Pre-skin the skinned vertex buffers of the current view in a compute shader.
+    void DispatchSkinning();
+    /// Capture the per-view uniform data of the main camera and the directional light, so that the scene can be updated while the view is rendered.
+    void DefinePerViewData();
+    /// Fill and bind the per-view uniform block for the main camera or a shadow camera.
+    void UpdatePerViewData(Camera* camera);
+    /// Record the render commands of the view and shadow batch queues, in parallel if possible.
+    void RecordRenderCommands();
+    /// Record render command lists in a worker thread.
+    void RecordRenderCommandsWork(Task* task, unsigned threadIndex);
+    /// Divide a batch queue into render command lists and add them to be recorded.
+    void AddCommandLists(BatchQueue& batchQueue, size_t batchesPerList);
+    /// Render a batch queue by replaying its recorded commands.
+    void RenderBatches(Camera* camera, const BatchQueue& batchQueue);
+    /// Replay a render command list.
+    void ExecuteCommands(Camera* camera, const RenderCommandList& commandList);
+    /// Append indirect draw commands to the buffer of the frame and bind it. Return the index of the first command in the buffer.
+    size_t UploadMultiDrawCommands(const std::vector<DrawElementsIndirectCommand>& drawCommands);
+    /// Bind the shader program of a pass and set its view & material uniforms and renderstates. Return the program on success or null otherwise, including while the program is still compiling.
+    ShaderProgram* SetupPass(Camera* camera, Pass* pass, unsigned char programBits);
+    /// Gather opaque static models from the octree for GPU culling and define the buffers.
+    void DefineGPUDrivenStatic();
+    /// Cull the GPU-driven static geometry with a compute shader and render it with indirect draws.
+    void RenderGPUDrivenStatic();
+    /// Enable the instancing vertex attributes of the default vertex array and point them to a range of an instance buffer, for drawing without vertex array objects. The previous transform attributes alias the current transform if the range has none.
+    void SetInstanceAttributes(VertexBuffer* buffer, size_t offset, bool hasInstanceData, bool hasPrevTransform);
+    /// Disable the instancing vertex attributes of the default vertex array.
+    void DisableInstanceAttributes();
+    /// Build the occlusion buffer from the depth readback if the GPU has finished it.
+    void ReadOcclusionBuffer();
+    /// Rasterize the occluders in the view frustum into the software occlusion buffer, nearest first.
+    void RasterizeOccluders();
+    /// Work function for rasterizing a range of software occlusion buffer rows.
+    void RasterizeOccludersWork(Task* task, unsigned threadIndex);
+    /// Allocate shadow map for light. If reuse only, allocate only the light's rect from the previous frame, and if it cannot be reused, leave the light without a shadow map to be allocated later. Return true on success.
+    bool AllocateShadowMap(Light* light, bool reuseOnly = false);
+    /// Work function for collecting lights and geometries from a range of octree subtrees.
+    void CollectSubtreesWork(Task* task, unsigned threadIndex);
+    /// Work function for preparing a range of visible geometries for rendering.
+    void PrepareGeometriesWork(Task* task, unsigned threadIndex);
+    /// Prepare a range of visible geometries for rendering. Geometries that should not render are replaced with null.
+    void PrepareGeometries(size_t start, size_t end);
+    /// %Octree callback for collecting lights and geometries into the executing thread's list.
+    void CollectGeometriesAndLights(const Octant* octant, unsigned char planeMask);
+    /// Work function for testing a range of the view group's nodes against the view frustum into the executing thread's list.
+    void CollectViewGroupNodesWork(Task* task, unsigned threadIndex);
+    /// Return whether the current view can use the nodes found by PrepareViewGroup().
+    bool IsViewGroupValid() const;
+    /// Rebuild the static geometry batch cache of an octant if stale, and return it.
+    const OctantBatchCache& UpdateBatchCache(const Octant* octant);
+    /// Return whether an opaque pass and shader variation qualify for the depth pre-pass, not considering the depth shader.
+    bool CanDepthPrePass(Pass* pass, unsigned char programBits) const;
+    /// Begin the GPU frame timing for dynamic resolution if not begun yet.
+    void BeginFrameTiming();
+    /// Read back the finished GPU frame timings and adjust the dynamic resolution scale.
+    void UpdateDynamicResolution();
+    /// Bind the shadow maps, light clusters and light data for the lit passes.
+    void BindLighting();
+    /// Set the shader defines controlled by the renderer according to the light count and bindless texture mode.
+    void SetRendererShaderDefines();
+    /// Switch the clip control, clear depth and depth test mapping between the conventional and reversed depth.
+    void SetDepthConvention(bool reversed);
     /// Define face selection texture for point light shadows.
     void DefineFaceSelectionTextures();
     /// Define vertex data for rendering full-screen quads.
     void DefineQuadVertexBuffer();
     /// Setup light cluster frustums and bounding boxes if necessary.
     void DefineClusterFrustums();
+    /// Assign the lights to the clusters in compute shaders and copy the light lists to the cluster textures.
+    void CullClusterLightsGPU();
+    /// Enable the shading rate image for the following draws if variable-rate shading is in use and the viewport matches its size. Return true if enabled.
+    bool EnableShadingRate();
+    /// Work function for assigning lights to a range of cluster Z slices.
+    void CullClusterLightsWork(Task* task, unsigned threadIndex);
+    /// Return the range of cluster X & Y indices a view space box may affect. The whole slice if the box crosses the near plane, or an empty rect if outside the screen.
+    IntRect ClusterRect(const BoundingBox& viewBox, const Matrix4& cameraProj) const;
+    /// Find the visible decals and assign them to the clusters.
+    void CollectDecals();
+    /// Test a sphere against up to 4 consecutive cluster bounding boxes. Return a bitmask of the intersecting clusters.
+    unsigned SphereIntersectsClusters(const Sphere& sphere, size_t idx, size_t count) const;
+    /// Test a bounding box against up to 4 consecutive cluster bounding boxes. Return a bitmask of the intersecting clusters.
+    unsigned BoxIntersectsClusters(const BoundingBox& box, size_t idx, size_t count) const;
 
     /// Current scene.
     Scene* scene;
@@ -103,18 +811,56 @@ private:
     Camera* camera;
     /// Camera frustum.
     Frustum frustum;
+    /// Camera view-projection matrix without the API adjustment, captured in PrepareView.
+    Matrix4 viewProjMatrix;
+    /// Conversion of the camera's hardware depth to the API-independent depth, captured in PrepareView.
+    Vector2 depthConversion;
+    /// Parameters for converting the camera's hardware depth to linear depth as a ratio of linear functions, captured in PrepareView.
+    Vector4 depthLinearize;
+    /// Per-view uniform data of the main camera, captured in PrepareView.
+    PerViewData viewData;
+    /// %Texture streaming subsystem to request mip levels from during batch collection, or null if not in use.
+    TextureStreamer* textureStreamer;
+    /// Scale from world size divided by distance to screen pixels for texture streaming.
+    float textureStreamingScale;
     /// Geometries in frustum.
     std::vector<GeometryNode*> geometries;
     /// Brightest directional light in frustum.
     Light* dirLight;
     /// Point and spot lights in frustum.
     std::vector<Light*> lights;
-    /// Initial shadowcaster list for processing shadowed lights.
-    std::vector<GeometryNode*> initialShadowCasters;
-    /// Intermediate filtered shadowcaster list for processing.
-    std::vector<GeometryNode*> shadowCasters;
+    /// Per-thread frustum query results.
+    std::vector<ThreadVisibleNodes> threadVisibleNodes;
+    /// Octree subtrees for the parallel frustum query.
+    std::vector<OctreeSubtree> octreeSubtrees;
+    /// Tasks for the parallel frustum query.
+    std::vector<AutoPtr<RangeTask<Renderer> > > collectSubtreesTasks;
+    /// Tasks for preparing visible geometries.
+    std::vector<AutoPtr<RangeTask<Renderer> > > prepareGeometriesTasks;
+    /// Potential shadowcasters for each point and spot light.
+    std::vector<std::vector<GeometryNode*> > lightShadowCasters;
+    /// Visibility of the potential shadowcasters for each point and spot light.
+    std::vector<ShadowCasterVisibility> lightShadowCasterVisibility;
+    /// Whether each point and spot light is within the shadow budgets.
+    std::vector<bool> lightShadowed;
+    /// Potential shadowcasters for each directional light split.
+    std::vector<std::vector<GeometryNode*> > dirLightShadowCasters;
+    /// Shadow views to collect batches for.
+    std::vector<ShadowViewJob> shadowViewJobs;
+    /// Tasks for querying shadowcasters.
+    std::vector<AutoPtr<RangeTask<Renderer> > > shadowQueryTasks;
+    /// Tasks for collecting shadow batches.
+    std::vector<AutoPtr<RangeTask<Renderer> > > shadowBatchesTasks;
+    /// Point lights to render in a single pass.
+    std::vector<CubeShadowJob> cubeShadowJobs;
+    /// Tasks for combining the face batches of single-pass point lights.
+    std::vector<AutoPtr<RangeTask<Renderer> > > cubeShadowTasks;
     /// Shadow maps.
     std::vector<ShadowMap> shadowMaps;
+    /// Directory of the baked static shadow tile cache, or empty if disabled.
+    std::string shadowBakeDir;
+    /// Keys of the baked static shadow tiles in the cache directory.
+    std::set<unsigned long long> bakedShadowTiles;
     /// Face selection UV indirection texture 1.
     AutoPtr<Texture> faceSelectionTexture1;
     /// Face selection UV indirection texture 2.
@@ -123,44 +869,190 @@ private:
     AutoPtr<Texture> clusterTexture;
     /// Light data uniform buffer.
     AutoPtr<UniformBuffer> lightDataBuffer;
+    /// Per-view data uniform buffer.
+    AutoPtr<UniformBuffer> perViewDataBuffer;
+    /// Point light face matrix uniform buffer for single-pass shadows.
+    AutoPtr<UniformBuffer> cubeShadowDataBuffer;
+    /// Light index list texture.
+    AutoPtr<Texture> lightIndexTexture;
     /// Cluster frustums for lights.
-    Frustum clusterFrustums[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
+    std::vector<Frustum> clusterFrustums;
     /// Cluster bounding boxes.
-    BoundingBox clusterBoundingBoxes[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
+    std::vector<BoundingBox> clusterBoundingBoxes;
+    /// Cluster bounding box minimum X coordinates.
+    std::vector<float> clusterMinX;
+    /// Cluster bounding box minimum Y coordinates.
+    std::vector<float> clusterMinY;
+    /// Cluster bounding box minimum Z coordinates.
+    std::vector<float> clusterMinZ;
+    /// Cluster bounding box maximum X coordinates.
+    std::vector<float> clusterMaxX;
+    /// Cluster bounding box maximum Y coordinates.
+    std::vector<float> clusterMaxY;
+    /// Cluster bounding box maximum Z coordinates.
+    std::vector<float> clusterMaxZ;
+    /// Light bounds for cluster assignment.
+    std::vector<LightClusterBounds> lightClusterBounds;
+    /// Tasks for assigning lights to clusters.
+    std::vector<AutoPtr<RangeTask<Renderer> > > clusterLightsTasks;
     /// Amount of lights per cluster.
-    unsigned char numClusterLights[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    /// Cluster data CPU copy.
-    unsigned char clusterData[MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    /// Light constantbuffer data CPU copy
-    LightData lightData[MAX_LIGHTS + 1];
+    std::vector<unsigned char> numClusterLights;
+    /// Fixed size light index slots per cluster, filled during cluster assignment.
+    std::vector<unsigned short> clusterLightSlots;
+    /// Cluster data CPU copy. Each entry contains the light list offset in the upper 24 bits and the light count in the lower 8 bits.
+    std::vector<unsigned> clusterData;
+    /// Packed light index list CPU copy.
+    std::vector<unsigned short> lightIndices;
+    /// Light constantbuffer data CPU copy.
+    std::vector<LightData> lightData;
+    /// Light cluster grid size.
+    IntVector3 clusterSize;
+    /// Total number of clusters.
+    size_t numClusters;
+    /// Maximum lights per cluster.
+    int maxLightsPerCluster;
+    /// Maximum lights per view.
+    int maxLights;
+    /// Number of used entries in the light index list.
+    size_t numLightIndices;
+    /// Rows of the light index texture used by the light lists. The cluster decal lists follow.
+    int lightIndexRows;
+    /// Decal uniform buffer.
+    AutoPtr<UniformBuffer> decalDataBuffer;
+    /// Decal uniform buffer data CPU copy.
+    std::vector<DecalData> decalData;
+    /// Amount of decals per cluster.
+    std::vector<unsigned char> numClusterDecals;
+    /// Fixed size decal index slots per cluster, filled during cluster assignment.
+    std::vector<unsigned short> clusterDecalSlots;
+    /// Cluster decal lists in the light index texture layout: the decal list offset and count of each cluster, followed by the packed decal indices.
+    std::vector<unsigned> decalIndexData;
+    /// Maximum decals per view.
+    int maxDecals;
+    /// Number of decals visible in the current view.
+    size_t numVisibleDecals;
+    /// Number of texels used in the cluster decal lists.
+    size_t numDecalTexels;
+    /// Decals visible in the current view, from the oldest to the newest.
+    std::vector<const Decal*> visibleDecals;
     /// Last projection matrix used to initialize cluster frustums.
     Matrix4 lastClusterFrustumProj;
     /// Opaque batches.
     BatchQueue opaqueBatches;
     /// Transparent batches.
     BatchQueue alphaBatches;
-    /// Instancing world transforms.
-    std::vector<Matrix3x4> instanceTransforms;
-    /// Instancing vertex buffer.
+    /// Per-thread batch collection results.
+    std::vector<ThreadBatches> threadBatches;
+    /// Tasks for collecting batches.
+    std::vector<AutoPtr<RangeTask<Renderer> > > collectBatchesTasks;
+    /// Instancing data CPU copy, used when persistently mapped buffers are not supported.
+    std::vector<Vector4> instanceTransforms;
+    /// Instancing data destination of the current frame, shared by all views.
+    InstanceTransformBuffer instanceTransformBuffer;
+    /// GPU-driven static geometry instances CPU copy.
+    std::vector<GPUDrivenInstance> gpuDrivenInstances;
+    /// GPU-driven static geometry draws.
+    std::vector<GPUDrivenDraw> gpuDrivenDraws;
+    /// GPU-driven indirect draw commands with zero instance counts, uploaded before each culling dispatch.
+    std::vector<DrawElementsIndirectCommand> gpuDrivenCommands;
+    /// GPU-driven static geometry instance buffer.
+    AutoPtr<StorageBuffer> gpuDrivenInstanceBuffer;
+    /// GPU-driven indirect draw command buffer.
+    AutoPtr<StorageBuffer> gpuDrivenCommandBuffer;
+    /// GPU-driven culled world transforms, used as an instancing vertex buffer.
+    AutoPtr<VertexBuffer> gpuDrivenTransformBuffer;
+    /// %Octree the GPU-driven static geometry was gathered from.
+    Octree* gpuDrivenOctree;
+    /// Combined buffer generation the GPU-driven draw commands were recorded with.
+    unsigned gpuDrivenGeneration;
+    /// Render command lists to record for the current view.
+    std::vector<RenderCommandList*> recordCommandLists;
+    /// Tasks for recording render commands.
+    std::vector<AutoPtr<RangeTask<Renderer> > > recordCommandsTasks;
+    /// Multi-draw indirect command buffer.
+    AutoPtr<StorageBuffer> multiDrawCommandBuffer;
+    /// Multi-draw indirect commands uploaded in the current frame.
+    size_t numMultiDrawCommands;
+    /// Downsampled depth texture for occlusion culling.
+    AutoPtr<Texture> occlusionTexture;
+    /// Framebuffer for downsampling the depth.
+    AutoPtr<FrameBuffer> occlusionFbo;
+    /// OpenGL pixel buffer for the asynchronous depth readback.
+    unsigned occlusionPixelBuffer;
+    /// OpenGL fence for the pending depth readback, or null if none pending.
+    void* occlusionFence;
+    /// View-projection matrix of the pending depth readback.
+    Matrix4 occlusionViewProj;
+    /// Camera of the pending depth readback.
+    Camera* occlusionPendingCamera;
+    /// Camera the occlusion buffer was rendered from.
+    Camera* occlusionBufferCamera;
+    /// Depth readback CPU copy.
+    std::vector<float> occlusionData;
+    /// Hierarchical depth buffer for occlusion testing.
+    OcclusionBuffer occlusionBuffer;
+    /// Occlusion buffer used by the current view's octree query, or null if not occlusion culling.
+    const OcclusionBuffer* activeOcclusionBuffer;
+    /// Depth buffer rasterized from occluders on the CPU.
+    OcclusionBuffer softwareOcclusionBuffer;
+    /// Occluders in the view frustum.
+    std::vector<OctreeNode*> occluders;
+    /// Tasks for rasterizing the software occlusion buffer.
+    std::vector<AutoPtr<RangeTask<Renderer> > > rasterizeOccludersTasks;
+    /// Instancing vertex buffer. When persistently mapped, holds a ring of frame regions.
     AutoPtr<VertexBuffer> instanceVertexBuffer;
+    /// OpenGL fences for the instancing buffer frame regions, or null if not pending.
+    void* instanceFences[INSTANCE_BUFFER_FRAMES];
+    /// Instancing data capacity per frame in Vector4 units.
+    size_t instanceCapacity;
+    /// Instancing buffer frame region in use.
+    size_t instanceFrameIndex;
     /// Quad vertex buffer.
     AutoPtr<VertexBuffer> quadVertexBuffer;
-    /// Cached static object shadow buffer.
-    AutoPtr<RenderBuffer> staticObjectShadowBuffer;
-    /// Cached static object shadow framebuffer.
-    AutoPtr<FrameBuffer> staticObjectShadowFbo;
     /// Instancing supported flag.
     bool hasInstancing;
-    /// Instancing vertex arrays enabled flag.
+    /// Instance transform and previous instance transform vertex arrays enabled flag.
     bool instancingEnabled;
-    /// Instancing buffer need update flag.
+    /// Per-instance data vertex array enabled flag.
+    bool instanceDataEnabled;
+    /// Cached vertex array objects and base instance draws in use flag.
+    bool useVertexArrays;
+    /// Multi-draw indirect combining of instance groups in use flag.
+    bool useMultiDraw;
+    /// Instancing vertex buffer persistently mapped flag.
+    bool persistentInstances;
+    /// Instancing buffer need update flag. Only used without persistent mapping.
     bool instanceTransformsDirty;
     /// Shadow maps globally dirty flag. All cached shadow content should be reset.
     bool shadowMapsDirty;
     /// Cluster frustums init flag.
     bool clusterFrustumsDirty;
-    /// Vertex elements for the instancing buffer.
+    /// GPU-driven static geometry enabled flag.
+    bool gpuDrivenStatic;
+    /// GPU-driven static geometry need gather flag.
+    bool gpuDrivenDirty;
+    /// Occlusion culling enabled flag.
+    bool occlusionCulling;
+    /// Software occlusion enabled flag.
+    bool softwareOcclusion;
+    /// Bindless textures enabled flag.
+    bool bindlessTextures;
+    /// Single-pass point light shadows enabled flag.
+    bool singlePassPointShadows;
+    /// Reversed depth enabled flag.
+    bool reverseDepth;
+    /// Whether the current depth convention is reversed. Shadow maps are rendered with the conventional depth.
+    bool depthReversed;
+    /// Vertex elements for instancing world transforms.
     std::vector<VertexElement> instanceVertexElements;
+    /// Vertex elements for the instancing buffer, which is addressed in Vector4 units.
+    std::vector<VertexElement> instanceDataElements;
+    /// Per-frame scratch allocator, with a chunk per worker thread.
+    FrameAllocator frameAllocator;
+    /// Heap allocations during the last PrepareView().
+    size_t numViewAllocations;
+    /// Heap allocation check flag.
+    bool allocationCheck;
     /// Camera view mask.
     unsigned viewMask;
     /// Framenumber.
@@ -169,30 +1061,230 @@ private:
     unsigned short sortViewNumber;
     /// Last camera used for rendering.
     Camera* lastCamera;
-    /// Last camera uniforms assignment number.
-    unsigned lastPerViewUniforms;
     /// Last material pass used for rendering.
     Pass* lastPass;
     /// Last material used for rendering.
     Material* lastMaterial;
-    /// Last material uniforms assignment number.
-    unsigned lastPerMaterialUniforms;
-    /// Last blend mode.
-    BlendMode lastBlendMode;
-    /// Last cull mode.
-    CullMode lastCullMode;
-    /// Last depth test.
-    CompareMode lastDepthTest;
-    /// Last color write.
-    bool lastColorWrite;
-    /// Last depth write.
-    bool lastDepthWrite;
-    /// Last depth bias enabled.
-    bool lastDepthBias;
+    /// %Graphics subsystem, which tracks the render state.
+    Graphics* graphics;
     /// Constant depth bias multiplier.
     float depthBiasMul;
     /// Slope-scaled depth bias multiplier.
     float slopeScaleBiasMul;
+    /// Shadow map resolution scale relative to the light's screen diameter.
+    float shadowLodScale;
+    /// Distance per frame of shadow map update interval.
+    float shadowThrottleDistance;
+    /// Maximum shadow map update interval in frames.
+    unsigned shadowMaxUpdateInterval;
+    /// Shadow map texel update budget per frame.
+    unsigned shadowTexelBudget;
+    /// Shaded point and spot light budget per frame.
+    int shadedLightBudget;
+    /// Shadowed point and spot light budget per frame.
+    int shadowedLightBudget;
+    /// Point and spot light shadow map texel budget per frame.
+    unsigned shadowAreaBudget;
+    /// Importance below which point and spot lights are culled.
+    float minLightImportance;
+    /// Importance below which point and spot lights are unshadowed.
+    float minShadowImportance;
+    /// Frame number of the last shadow atlas repack.
+    unsigned short shadowRepackFrame;
+    /// Shadow atlas fragmented flag. Set when an allocation fails although there is enough free area, to repack the atlas on the next frame.
+    bool shadowAtlasFragmented;
+    /// Directional light shadow cascade interleaving flag.
+    bool shadowCascadeInterleave;
+    /// Rendering statistics of the current view.
+    RenderStats stats;
+    /// Rendering statistics of the last completed views.
+    RenderStats statsHistory[RENDER_STATS_HISTORY];
+    /// Sum of the statistics history.
+    RenderStats statsSum;
+    /// Next index to write in the statistics history.
+    size_t statsHistoryIndex;
+    /// Number of views in the statistics history.
+    size_t numStatsHistory;
+    /// Pooled GPU frame timestamp queries.
+    std::vector<unsigned> freeFrameQueries;
+    /// Begin and end timestamp query pairs of the frames waiting for readback.
+    std::vector<unsigned> pendingFrameQueries;
+    /// Begin timestamp query of the frame being timed.
+    unsigned frameBeginQuery;
+    /// Target GPU frame time in milliseconds.
+    float dynamicTargetTime;
+    /// Minimum dynamic resolution scale.
+    float minResolutionScale;
+    /// Maximum dynamic resolution scale.
+    float maxResolutionScale;
+    /// Current dynamic resolution scale.
+    float resolutionScale;
+    /// Smoothed GPU frame time in milliseconds.
+    float gpuFrameTime;
+    /// Upscale sharpening strength.
+    float upscaleSharpness;
+    /// Upscale filtering mode.
+    UpscaleMode upscaleMode;
+    /// Frames measured since the last resolution scale change.
+    unsigned framesSinceScaleChange;
+    /// Dynamic resolution flag.
+    bool dynamicResolution;
+    /// Depth pre-pass mode.
+    DepthPrePassMode depthPrePassMode;
+    /// Overdraw for enabling the depth pre-pass in auto mode.
+    float prePassOverdrawThreshold;
+    /// Estimated opaque overdraw of the current view.
+    float estimatedOverdraw;
+    /// Screen coverage per squared radius divided by squared distance, or per squared radius for orthographic cameras. Used for overdraw estimation.
+    float coverageScale;
+    /// Depth pre-pass rendered for the current view flag.
+    bool depthPrePassActive;
+    /// Rendering the depth pre-pass flag.
+    bool renderingDepthPrePass;
+    /// Rendering the opaque main pass after the depth pre-pass flag.
+    bool renderingAfterPrePass;
+    /// Whether the last set up pass was pre-passed.
+    bool lastPrePassed;
+    /// Lighting mode of opaque geometry.
+    LightingMode lightingMode;
+    /// Rendering the opaque G-buffer in deferred mode flag.
+    bool renderingDeferred;
+    /// Motion vector rendering flag.
+    bool motionVectors;
+    /// Rendering motion vectors in the opaque main pass flag.
+    bool renderingMotion;
+    /// Motion vector history frame number, advanced for each view with motion vectors. Never 0.
+    unsigned short historyFrameNumber;
+    /// History frame number of the current view, or 0 if it renders no motion vectors.
+    unsigned short viewHistoryFrame;
+    /// Camera of the last view with motion vectors.
+    Camera* historyCamera;
+    /// View-projection matrix without the projection offset of the last view with motion vectors.
+    Matrix4 historyViewProj;
+    /// View space cluster bounding boxes for GPU light culling.
+    AutoPtr<StorageBuffer> clusterBoundsBuffer;
+    /// View space depth range of the opaque geometry per cluster tile for GPU light culling.
+    AutoPtr<StorageBuffer> tileDepthBuffer;
+    /// Cluster light list offsets and counts written by GPU light culling, followed by the allocated index count.
+    AutoPtr<StorageBuffer> clusterDataBuffer;
+    /// Packed light indices written by GPU light culling.
+    AutoPtr<StorageBuffer> lightIndexBuffer;
+    /// Depth texture to bound the GPU light culling with.
+    Texture* lightCullingDepth;
+    /// Irradiance volume.
+    WeakPtr<IrradianceVolume> irradianceVolume;
+    /// Decal set.
+    WeakPtr<DecalSet> decalSet;
+    /// GPU light culling flag.
+    bool gpuLightCulling;
+    /// Cluster bounding boxes changed since last uploaded for GPU light culling flag.
+    bool clusterBoundsDirty;
+    /// Camera of the last full visibility query.
+    Camera* coherentCamera;
+    /// Octree of the last full visibility query.
+    Octree* coherentOctree;
+    /// Camera view matrix of the last full visibility query.
+    Matrix3x4 coherentViewMatrix;
+    /// Camera projection matrix of the last full visibility query.
+    Matrix4 coherentProjection;
+    /// View mask of the last full visibility query.
+    unsigned coherentViewMask;
+    /// Octree generation of the last full visibility query.
+    unsigned coherentOctreeGeneration;
+    /// Source batch generation of the cached batches.
+    unsigned coherentBatchGeneration;
+    /// Sorted opaque batches of the last view before instancing.
+    std::vector<Batch> coherentOpaqueBatches;
+    /// Sorted alpha batches of the last view before instancing.
+    std::vector<Batch> coherentAlphaBatches;
+    /// Texture streaming requests of the last view.
+    std::vector<std::pair<Texture*, unsigned short> > coherentTextureLevels;
+    /// Frame coherence flag.
+    bool frameCoherence;
+    /// Cached batches valid for reuse flag.
+    bool coherentBatchesValid;
+    /// Visible nodes reused for the current view flag.
+    bool visibilityReused;
+    /// Sorted batches reused for the current view flag.
+    bool batchesReused;
+    /// Source batch assignment generation of the last full visibility query, whose cached octants refer to the static batch caches.
+    unsigned coherentAssignmentGeneration;
+    /// Static batch caching flag.
+    bool staticBatchCaching;
+    /// Cameras of the view group.
+    std::vector<Camera*> viewGroupCameras;
+    /// View-projection matrices of the view group cameras when culled.
+    std::vector<Matrix4> viewGroupViewProjs;
+    /// Union of the view group cameras' frustums.
+    ViewGroupVolume viewGroupVolume;
+    /// Nodes inside the view group volume.
+    std::vector<OctreeNode*> viewGroupNodes;
+    /// Tasks for testing the view group's nodes.
+    std::vector<AutoPtr<RangeTask<Renderer> > > collectViewGroupTasks;
+    /// Octree of the view group.
+    Octree* viewGroupOctree;
+    /// Octree generation of the view group query.
+    unsigned viewGroupGeneration;
+    /// Target triangle count per view.
+    unsigned lodTriangleBudget;
+    /// Sort key layout of opaque batches.
+    BatchSortKeyLayout sortKeyLayout;
+    /// LOD distance multiplier from the triangle budget.
+    float lodBudgetScale;
+    /// LOD distance multiplier of the last view whose visible nodes were collected.
+    float coherentLodBudgetScale;
+    /// Bone palette CPU copy, in Vector4 units.
+    std::vector<Vector4> bonePalette;
+    /// Bone palette destination of the current view, allocated in Vector4 units with three per matrix.
+    InstanceTransformBuffer bonePaletteBuffer;
+    /// Bone palette shader storage buffer.
+    AutoPtr<StorageBuffer> bonePaletteStorage;
+    /// Bone palette capacity in matrices.
+    size_t bonePaletteCapacity;
+    /// Bone palette generation, incremented for each view. Never 0.
+    unsigned bonePaletteGeneration;
+    /// GPU skinning supported flag.
+    bool hasSkinning;
+    /// Bone palette need upload flag.
+    bool bonePaletteDirty;
+    /// Compute skinning flag.
+    bool computeSkinning;
+    /// Transient vertex buffers for compute skinning by vertex layout.
+    std::vector<SkinnedVertexPool> skinnedVertexPools;
+    /// Compute skinning dispatches of the current view.
+    std::vector<SkinningJob> skinningJobs;
+    /// Mutex for the compute skinning allocations.
+    Mutex skinningMutex;
+    /// Transparent geometry rendering mode.
+    AlphaMode alphaMode;
+    /// Rendering transparent geometry to the OIT targets flag.
+    bool renderingOIT;
+    /// Resolution divisor of transparent geometry.
+    int alphaResolutionDivisor;
+    /// Shading rate image.
+    AutoPtr<ShadingRateImage> shadingRateImage;
+    /// Color texture size the shading rate image was written from.
+    IntVector2 shadingRateSize;
+    /// Relative luminance contrast below which the shading rate drops.
+    float shadingRateThreshold;
+    /// Variable-rate shading flag.
+    bool variableRateShading;
+    /// Volumetric fog in-scattered light and extinction per froxel.
+    AutoPtr<Texture> fogScatterTexture;
+    /// Volumetric fog integrated front to back.
+    AutoPtr<Texture> fogIntegratedTexture;
+    /// Volumetric fog grid size.
+    IntVector3 fogGridSize;
+    /// Volumetric fog extinction per world unit.
+    float fogDensity;
+    /// Volumetric fog forward scattering factor.
+    float fogAnisotropy;
+    /// Volumetric fog flag.
+    bool volumetricFog;
+    /// Prefiltered shadows flag.
+    bool prefilteredShadows;
+    /// Intermediate moments of the separable shadow filter, sized to hold the largest shadow map.
+    AutoPtr<Texture> shadowFilterTexture;
 };
 
 /// Register Renderer related object factories and attributes.
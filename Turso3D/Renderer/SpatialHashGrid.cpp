@@ -0,0 +1,350 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Sphere.h"
+#include "../Time/Profiler.h"
+#include "Octree.h"
+#include "SpatialHashGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+/// Cell coordinates are clamped to this range to keep them representable.
+static const float MAX_CELL_COORD = 1.0e9f;
+
+/// %Task for running a range of a batched grid query.
+template <class T> class GridQueryTask : public Task
+{
+public:
+    /// Run the queries of the range.
+    void Complete(unsigned) override
+    {
+        nodes.clear();
+        counts.resize(end - start);
+        for (size_t i = start; i < end; ++i)
+            counts[i - start] = grid->CollectNodes(nodes, volumes[i], nodeFlags, layerMask);
+    }
+
+    /// Grid to query.
+    const SpatialHashGrid* grid;
+    /// Query volumes.
+    const T* volumes;
+    /// Range start index.
+    size_t start;
+    /// Range end index (exclusive.)
+    size_t end;
+    /// Node flags to require.
+    unsigned short nodeFlags;
+    /// Layer mask to require.
+    unsigned layerMask;
+    /// Found nodes of the range.
+    std::vector<OctreeNode*> nodes;
+    /// Number of nodes found by each query of the range.
+    std::vector<size_t> counts;
+};
+
+/// Return the bounding box of a query volume.
+static inline BoundingBox VolumeBounds(const BoundingBox& box)
+{
+    return box;
+}
+
+/// Return the bounding box of a query volume.
+static inline BoundingBox VolumeBounds(const Sphere& sphere)
+{
+    Vector3 extent(sphere.radius, sphere.radius, sphere.radius);
+    return BoundingBox(sphere.center - extent, sphere.center + extent);
+}
+
+SpatialHashGrid::SpatialHashGrid() :
+    cellSize(1.0f),
+    maxHalfSize(0.0f),
+    numBuckets(0),
+    buildNodes(nullptr),
+    numBucketCounters(0)
+{
+}
+
+void SpatialHashGrid::SetCellSize(float size)
+{
+    cellSize = std::max(size, M_EPSILON);
+}
+
+void SpatialHashGrid::Build(Octree* octree, unsigned short nodeFlags, unsigned layerMask, unsigned short excludeFlags)
+{
+    std::vector<OctreeNode*> nodes;
+    if (octree)
+        octree->FindAllNodes(nodes, nodeFlags, layerMask, excludeFlags);
+    Build(nodes.data(), nodes.size());
+}
+
+void SpatialHashGrid::Build(OctreeNode** nodes, size_t count)
+{
+    PROFILE(BuildSpatialHashGrid);
+
+    if (!nodes || !count)
+    {
+        Clear();
+        return;
+    }
+
+    // Twice as many buckets as nodes keeps the buckets short
+    numBuckets = NextPowerOfTwo((unsigned)std::max(count * 2, (size_t)64));
+    if (numBucketCounters < numBuckets + 1)
+    {
+        numBucketCounters = numBuckets + 1;
+        bucketCounters = new std::atomic<unsigned>[numBucketCounters];
+    }
+    for (size_t i = 0; i <= numBuckets; ++i)
+        bucketCounters[i].store(0, std::memory_order_relaxed);
+
+    buildNodes = nodes;
+    hashedEntries.resize(count);
+    hashedBuckets.resize(count);
+    taskMaxHalfSizes.assign((count + GRID_NODES_PER_TASK - 1) / GRID_NODES_PER_TASK, 0.0f);
+    RunTasks(count, &SpatialHashGrid::HashNodesWork);
+
+    maxHalfSize = *std::max_element(taskMaxHalfSizes.begin(), taskMaxHalfSizes.end());
+
+    // Turn the bucket sizes into start indices, and the counters into insertion positions
+    bucketStarts.resize(numBuckets + 2);
+    unsigned total = 0;
+    for (size_t i = 0; i <= numBuckets; ++i)
+    {
+        unsigned bucketSize = bucketCounters[i].load(std::memory_order_relaxed);
+        bucketStarts[i] = total;
+        bucketCounters[i].store(total, std::memory_order_relaxed);
+        total += bucketSize;
+    }
+    bucketStarts[numBuckets + 1] = total;
+
+    entries.resize(count);
+    RunTasks(count, &SpatialHashGrid::InsertNodesWork);
+    buildNodes = nullptr;
+}
+
+void SpatialHashGrid::Clear()
+{
+    entries.clear();
+    bucketStarts.clear();
+    numBuckets = 0;
+    maxHalfSize = 0.0f;
+}
+
+void SpatialHashGrid::FindNodes(std::vector<OctreeNode*>& result, const BoundingBox& box, unsigned short nodeFlags, unsigned layerMask) const
+{
+    CollectNodes(result, box, nodeFlags, layerMask);
+}
+
+void SpatialHashGrid::FindNodes(std::vector<OctreeNode*>& result, const Sphere& sphere, unsigned short nodeFlags, unsigned layerMask) const
+{
+    CollectNodes(result, sphere, nodeFlags, layerMask);
+}
+
+void SpatialHashGrid::FindNodesBatch(GridQueryResult& result, const BoundingBox* boxes, size_t count, unsigned short nodeFlags, unsigned layerMask) const
+{
+    CollectNodesBatch(result, boxes, count, nodeFlags, layerMask);
+}
+
+void SpatialHashGrid::FindNodesBatch(GridQueryResult& result, const Sphere* spheres, size_t count, unsigned short nodeFlags, unsigned layerMask) const
+{
+    CollectNodesBatch(result, spheres, count, nodeFlags, layerMask);
+}
+
+void SpatialHashGrid::HashNodesWork(Task* task, unsigned)
+{
+    RangeTask<SpatialHashGrid>* rangeTask = static_cast<RangeTask<SpatialHashGrid>*>(task);
+    float taskMaxHalfSize = 0.0f;
+
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+    {
+        OctreeNode* node = buildNodes[i];
+        GridEntry& entry = hashedEntries[i];
+        entry.box = node->WorldBoundingBox();
+        entry.node = node;
+        entry.flags = node->Flags();
+        entry.layerMask = node->LayerMask();
+
+        Vector3 center = entry.box.Center();
+        Vector3 halfSize = entry.box.HalfSize();
+        float nodeHalfSize = std::max(std::max(halfSize.x, halfSize.y), halfSize.z);
+        entry.cell[0] = CellCoord(center.x);
+        entry.cell[1] = CellCoord(center.y);
+        entry.cell[2] = CellCoord(center.z);
+
+        size_t bucket;
+        if (nodeHalfSize * 2.0f > cellSize)
+            bucket = numBuckets;
+        else
+        {
+            bucket = BucketIndex(entry.cell[0], entry.cell[1], entry.cell[2]);
+            taskMaxHalfSize = std::max(taskMaxHalfSize, nodeHalfSize);
+        }
+
+        hashedBuckets[i] = (unsigned)bucket;
+        bucketCounters[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    taskMaxHalfSizes[rangeTask->start / GRID_NODES_PER_TASK] = taskMaxHalfSize;
+}
+
+void SpatialHashGrid::InsertNodesWork(Task* task, unsigned)
+{
+    RangeTask<SpatialHashGrid>* rangeTask = static_cast<RangeTask<SpatialHashGrid>*>(task);
+
+    // The order within a bucket depends on thread timing, which does not matter for the queries
+    for (size_t i = rangeTask->start; i < rangeTask->end; ++i)
+        entries[bucketCounters[hashedBuckets[i]].fetch_add(1, std::memory_order_relaxed)] = hashedEntries[i];
+}
+
+void SpatialHashGrid::RunTasks(size_t count, void (SpatialHashGrid::*function)(Task*, unsigned))
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+
+    if (!workQueue || workQueue->NumThreads() <= 1 || count <= GRID_NODES_PER_TASK)
+    {
+        RangeTask<SpatialHashGrid> task(this, function);
+        task.start = 0;
+        task.end = count;
+        (this->*function)(&task, 0);
+        return;
+    }
+
+    size_t numTasks = (count + GRID_NODES_PER_TASK - 1) / GRID_NODES_PER_TASK;
+    while (tasks.size() < numTasks)
+        tasks.push_back(new RangeTask<SpatialHashGrid>(this, function));
+
+    TaskCounter counter(0);
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        RangeTask<SpatialHashGrid>* task = tasks[i];
+        task->function = function;
+        task->start = i * GRID_NODES_PER_TASK;
+        task->end = std::min((i + 1) * GRID_NODES_PER_TASK, count);
+        workQueue->QueueTask(task, &counter);
+    }
+
+    workQueue->Complete(counter);
+}
+
+size_t SpatialHashGrid::BucketIndex(int x, int y, int z) const
+{
+    unsigned hash = ((unsigned)x * 73856093U) ^ ((unsigned)y * 19349663U) ^ ((unsigned)z * 83492791U);
+    return hash & (numBuckets - 1);
+}
+
+int SpatialHashGrid::CellCoord(float position) const
+{
+    return (int)Clamp(floorf(position / cellSize), -MAX_CELL_COORD, MAX_CELL_COORD);
+}
+
+template <class T> size_t SpatialHashGrid::CollectNodes(std::vector<OctreeNode*>& result, const T& volume, unsigned short nodeFlags, unsigned layerMask) const
+{
+    if (entries.empty())
+        return 0;
+
+    size_t oldSize = result.size();
+
+    // Nodes are hashed by their center, so expand the query by the largest half size to find the nodes extending into it
+    BoundingBox bounds = VolumeBounds(volume);
+    Vector3 expand(maxHalfSize, maxHalfSize, maxHalfSize);
+    int minCell[3] = { CellCoord(bounds.min.x - expand.x), CellCoord(bounds.min.y - expand.y), CellCoord(bounds.min.z - expand.z) };
+    int maxCell[3] = { CellCoord(bounds.max.x + expand.x), CellCoord(bounds.max.y + expand.y), CellCoord(bounds.max.z + expand.z) };
+    double numCells = ((double)maxCell[0] - minCell[0] + 1.0) * ((double)maxCell[1] - minCell[1] + 1.0) * ((double)maxCell[2] - minCell[2] + 1.0);
+
+    if (numCells > (double)numBuckets)
+    {
+        // Query spans more cells than there are buckets, so test all nodes instead
+        for (size_t i = 0; i < bucketStarts[numBuckets]; ++i)
+        {
+            const GridEntry& entry = entries[i];
+            if ((entry.flags & nodeFlags) == nodeFlags && (entry.layerMask & layerMask) && volume.IsInsideFast(entry.box) != OUTSIDE)
+                result.push_back(entry.node);
+        }
+    }
+    else
+    {
+        for (int z = minCell[2]; z <= maxCell[2]; ++z)
+        {
+            for (int y = minCell[1]; y <= maxCell[1]; ++y)
+            {
+                for (int x = minCell[0]; x <= maxCell[0]; ++x)
+                {
+                    size_t bucket = BucketIndex(x, y, z);
+                    for (size_t i = bucketStarts[bucket]; i < bucketStarts[bucket + 1]; ++i)
+                    {
+                        // Skip nodes of other cells that hash to the same bucket, so that each node is found once
+                        const GridEntry& entry = entries[i];
+                        if (entry.cell[0] != x || entry.cell[1] != y || entry.cell[2] != z)
+                            continue;
+                        if ((entry.flags & nodeFlags) == nodeFlags && (entry.layerMask & layerMask) && volume.IsInsideFast(entry.box) != OUTSIDE)
+                            result.push_back(entry.node);
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t i = bucketStarts[numBuckets]; i < bucketStarts[numBuckets + 1]; ++i)
+    {
+        const GridEntry& entry = entries[i];
+        if ((entry.flags & nodeFlags) == nodeFlags && (entry.layerMask & layerMask) && volume.IsInsideFast(entry.box) != OUTSIDE)
+            result.push_back(entry.node);
+    }
+
+    return result.size() - oldSize;
+}
+
+template <class T> void SpatialHashGrid::CollectNodesBatch(GridQueryResult& result, const T* volumes, size_t count, unsigned short nodeFlags, unsigned layerMask) const
+{
+    PROFILE(SpatialHashGridBatchQuery);
+
+    result.nodes.clear();
+    result.starts.resize(count + 1);
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    if (!workQueue || workQueue->NumThreads() <= 1 || count <= GRID_QUERIES_PER_TASK)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            result.starts[i] = result.nodes.size();
+            CollectNodes(result.nodes, volumes[i], nodeFlags, layerMask);
+        }
+        result.starts[count] = result.nodes.size();
+        return;
+    }
+
+    size_t numTasks = (count + GRID_QUERIES_PER_TASK - 1) / GRID_QUERIES_PER_TASK;
+    std::vector<GridQueryTask<T> > queryTasks(numTasks);
+    TaskCounter counter(0);
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        GridQueryTask<T>& task = queryTasks[i];
+        task.grid = this;
+        task.volumes = volumes;
+        task.start = i * GRID_QUERIES_PER_TASK;
+        task.end = std::min((i + 1) * GRID_QUERIES_PER_TASK, count);
+        task.nodeFlags = nodeFlags;
+        task.layerMask = layerMask;
+        workQueue->QueueTask(&task, &counter);
+    }
+
+    workQueue->Complete(counter);
+
+    // Concatenate the per-task results into contiguous spans in query order
+    size_t totalNodes = 0;
+    for (auto it = queryTasks.begin(); it != queryTasks.end(); ++it)
+        totalNodes += it->nodes.size();
+    result.nodes.reserve(totalNodes);
+
+    for (auto it = queryTasks.begin(); it != queryTasks.end(); ++it)
+    {
+        size_t start = result.nodes.size();
+        for (size_t i = it->start; i < it->end; ++i)
+        {
+            result.starts[i] = start;
+            start += it->counts[i - it->start];
+        }
+        result.nodes.insert(result.nodes.end(), it->nodes.begin(), it->nodes.end());
+    }
+    result.starts[count] = result.nodes.size();
+}
@@ -0,0 +1,128 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Object/AutoPtr.h"
+#include "../Scene/Node.h"
+#include "../Thread/WorkQueue.h"
+
+#include <atomic>
+
+class Octree;
+class OctreeNode;
+class Sphere;
+
+/// Number of nodes per spatial hash grid build task.
+static const size_t GRID_NODES_PER_TASK = 1024;
+/// Number of queries per spatial hash grid batch query task.
+static const size_t GRID_QUERIES_PER_TASK = 64;
+
+/// %Node entry in the spatial hash grid.
+struct GridEntry
+{
+    /// World bounding box.
+    BoundingBox box;
+    /// %Node.
+    OctreeNode* node;
+    /// Cell coordinates of the bounding box center.
+    int cell[3];
+    /// %Node flags.
+    unsigned short flags;
+    /// %Node layer mask.
+    unsigned layerMask;
+};
+
+/// Results of a batched spatial hash grid query. The nodes found by query i are stored contiguously from index starts[i] up to starts[i + 1].
+struct GridQueryResult
+{
+    /// Return number of nodes found by a query.
+    size_t Count(size_t query) const { return starts[query + 1] - starts[query]; }
+    /// Return the first node found by a query.
+    OctreeNode* const* Begin(size_t query) const { return nodes.data() + starts[query]; }
+    /// Return the end of the nodes found by a query.
+    OctreeNode* const* End(size_t query) const { return nodes.data() + starts[query + 1]; }
+
+    /// Found nodes of all queries.
+    std::vector<OctreeNode*> nodes;
+    /// Start index of each query's nodes, followed by the total count.
+    std::vector<size_t> starts;
+};
+
+/// Uniform spatial hash grid for proximity queries among many moving octree nodes, such as neighbour searches of agents. Rebuilt from scratch each frame in parallel instead of updating incrementally: the nodes are hashed by the cell of their bounding box center and sorted into contiguous buckets with atomic counters, so that threads insert without locks. Queries expand by the largest node half size, so they find nodes overlapping neighbouring cells. Nodes larger than a cell are kept in a separate list tested by every query, so the cell size should match the typical node and query size.
+class SpatialHashGrid
+{
+    template <class T> friend class GridQueryTask;
+
+public:
+    /// Construct.
+    SpatialHashGrid();
+
+    /// Set cell size. Takes effect on the next build.
+    void SetCellSize(float size);
+    /// Build from the nodes of an octree with the node flags and layer mask. Static nodes are excluded by default, as the octree handles them without per-frame cost. Call after the octree has been updated for the frame.
+    void Build(Octree* octree, unsigned short nodeFlags = 0, unsigned layerMask = LAYERMASK_ALL, unsigned short excludeFlags = NF_STATIC);
+    /// Build from a list of nodes. Uses the WorkQueue subsystem if available.
+    void Build(OctreeNode** nodes, size_t count);
+    /// Remove all nodes.
+    void Clear();
+
+    /// Query for nodes whose bounding box intersects a box. The results are appended.
+    void FindNodes(std::vector<OctreeNode*>& result, const BoundingBox& box, unsigned short nodeFlags = 0, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for nodes whose bounding box intersects a sphere. The results are appended.
+    void FindNodes(std::vector<OctreeNode*>& result, const Sphere& sphere, unsigned short nodeFlags = 0, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query a batch of boxes in parallel. The result of each query is a contiguous span.
+    void FindNodesBatch(GridQueryResult& result, const BoundingBox* boxes, size_t count, unsigned short nodeFlags = 0, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query a batch of spheres in parallel. The result of each query is a contiguous span.
+    void FindNodesBatch(GridQueryResult& result, const Sphere* spheres, size_t count, unsigned short nodeFlags = 0, unsigned layerMask = LAYERMASK_ALL) const;
+
+    /// Return cell size.
+    float CellSize() const { return cellSize; }
+    /// Return number of nodes.
+    size_t NumNodes() const { return entries.size(); }
+    /// Return number of nodes larger than a cell.
+    size_t NumLargeNodes() const { return bucketStarts.empty() ? 0 : entries.size() - bucketStarts[numBuckets]; }
+    /// Return the node entries sorted by bucket.
+    const std::vector<GridEntry>& Entries() const { return entries; }
+
+private:
+    /// Work function to hash a range of nodes and count the bucket sizes.
+    void HashNodesWork(Task* task, unsigned threadIndex);
+    /// Work function to insert a range of hashed nodes to their buckets.
+    void InsertNodesWork(Task* task, unsigned threadIndex);
+    /// Run a work function over a range of nodes in parallel, or in the calling thread if the range is small.
+    void RunTasks(size_t count, void (SpatialHashGrid::*function)(Task*, unsigned));
+    /// Return the bucket index of cell coordinates.
+    size_t BucketIndex(int x, int y, int z) const;
+    /// Return the cell coordinate of a position along one axis.
+    int CellCoord(float position) const;
+    /// Query for nodes using a volume. Return number of nodes found.
+    template <class T> size_t CollectNodes(std::vector<OctreeNode*>& result, const T& volume, unsigned short nodeFlags, unsigned layerMask) const;
+    /// Query a batch of volumes in parallel.
+    template <class T> void CollectNodesBatch(GridQueryResult& result, const T* volumes, size_t count, unsigned short nodeFlags, unsigned layerMask) const;
+
+    /// Cell size.
+    float cellSize;
+    /// Largest half size of the nodes in the buckets, by which queries are expanded.
+    float maxHalfSize;
+    /// Number of buckets as a power of two.
+    size_t numBuckets;
+    /// Node entries sorted by bucket. The nodes larger than a cell are last.
+    std::vector<GridEntry> entries;
+    /// Start index of each bucket's entries. The extra bucket at numBuckets holds the large nodes, and is followed by the total count.
+    std::vector<unsigned> bucketStarts;
+    /// Nodes being built from.
+    OctreeNode** buildNodes;
+    /// Hashed entries before sorting.
+    std::vector<GridEntry> hashedEntries;
+    /// Bucket indices of the hashed entries.
+    std::vector<unsigned> hashedBuckets;
+    /// Bucket sizes when hashing, then insertion positions.
+    AutoArrayPtr<std::atomic<unsigned> > bucketCounters;
+    /// Allocated bucket counters.
+    size_t numBucketCounters;
+    /// Largest node half size found by each build task.
+    std::vector<float> taskMaxHalfSizes;
+    /// Build tasks.
+    std::vector<AutoPtr<RangeTask<SpatialHashGrid> > > tasks;
+};
@@ -0,0 +1,478 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Math/Frustum.h"
+#include "../Math/Ray.h"
+#include "../Scene/Scene.h"
+#include "../Time/Profiler.h"
+#include "Camera.h"
+#include "Material.h"
+#include "Model.h"
+#include "Octree.h"
+#include "StaticBatch.h"
+#include "StaticModel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <glew.h>
+#include <map>
+#include <tuple>
+
+/// Vertex and index data of a source geometry, read back from the GPU.
+struct StaticBatchSourceMesh
+{
+    /// Vertex declaration.
+    std::vector<VertexElement> elements;
+    /// Vertex data of the range referenced by the indices.
+    std::vector<unsigned char> vertexData;
+    /// Triangle list indices relative to the start of the vertex data.
+    std::vector<unsigned> indices;
+    /// Number of vertices.
+    size_t numVertices;
+};
+
+/// Source model geometry assigned to a static batch group.
+struct StaticBatchEntry
+{
+    /// Source model.
+    StaticModel* model;
+    /// Source geometry.
+    Geometry* geometry;
+};
+
+/// Key of models that can be merged together: octant, material, vertex format, layer and shadow casting.
+typedef std::tuple<Octant*, Material*, std::vector<unsigned>, unsigned char, bool> StaticBatchKey;
+
+/// Return a comparable description of a vertex format, ignoring the offsets.
+static std::vector<unsigned> VertexFormatKey(const std::vector<VertexElement>& elements)
+{
+    std::vector<unsigned> ret;
+    for (auto it = elements.begin(); it != elements.end(); ++it)
+        ret.push_back((unsigned)it->type << 16 | (unsigned)it->semantic << 8 | it->index);
+    return ret;
+}
+
+/// Unpack a signed normalized integer of given bits to a float.
+static float UnpackSnorm(unsigned value, unsigned bits)
+{
+    int maxValue = (1 << (bits - 1)) - 1;
+    int signedValue = (int)(value << (32 - bits)) >> (32 - bits);
+    return Max((float)signedValue / (float)maxValue, -1.0f);
+}
+
+/// Pack a normalized float to a signed normalized integer of given bits.
+static unsigned PackSnorm(float value, unsigned bits)
+{
+    int maxValue = (1 << (bits - 1)) - 1;
+    int packed = (int)floorf(Clamp(value, -1.0f, 1.0f) * maxValue + 0.5f);
+    return (unsigned)packed & ((1u << bits) - 1);
+}
+
+/// Transform a direction packed as 10-bit signed normalized components, keeping the 2-bit fourth component with an optional sign flip.
+static unsigned TransformPacked(unsigned packed, const Matrix3& transform, bool flipW)
+{
+    Vector3 direction(UnpackSnorm(packed & 0x3ff, 10), UnpackSnorm((packed >> 10) & 0x3ff, 10), UnpackSnorm((packed >> 20) & 0x3ff, 10));
+    direction = (transform * direction).Normalized();
+    float w = UnpackSnorm(packed >> 30, 2);
+    return PackSnorm(direction.x, 10) | (PackSnorm(direction.y, 10) << 10) | (PackSnorm(direction.z, 10) << 20) |
+        (PackSnorm(flipW ? -w : w, 2) << 30);
+}
+
+/// Read the indexed vertex range and indices of a geometry from the GPU. Return false if not indexed or the vertex format can not be transformed.
+static bool ReadSourceMesh(Geometry* geometry, StaticBatchSourceMesh& dest)
+{
+    VertexBuffer* vb = geometry->vertexBuffer;
+    IndexBuffer* ib = geometry->indexBuffer;
+    if (!vb || !ib || !geometry->drawCount)
+        return false;
+
+    const std::vector<VertexElement>& elements = vb->Elements();
+    bool hasPosition = false;
+    for (auto it = elements.begin(); it != elements.end(); ++it)
+    {
+        if (it->semantic == SEM_POSITION && it->index == 0)
+        {
+            if (it->type != ELEM_VECTOR3)
+                return false;
+            hasPosition = true;
+        }
+        else if (it->semantic == SEM_NORMAL && it->type != ELEM_VECTOR3 && it->type != ELEM_INT2101010N)
+            return false;
+        else if (it->semantic == SEM_TANGENT && it->type != ELEM_VECTOR4 && it->type != ELEM_INT2101010N)
+            return false;
+        else if (it->semantic == SEM_BLENDWEIGHT || it->semantic == SEM_BLENDINDICES)
+            return false;
+    }
+    if (!hasPosition)
+        return false;
+
+    size_t indexSize = ib->IndexSize();
+    std::vector<unsigned char> indexData(geometry->drawCount * indexSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, ib->GLBuffer());
+    glGetBufferSubData(GL_COPY_READ_BUFFER, geometry->drawStart * indexSize, indexData.size(), &indexData[0]);
+
+    dest.indices.resize(geometry->drawCount);
+    unsigned minIndex = M_MAX_UNSIGNED;
+    unsigned maxIndex = 0;
+    for (size_t i = 0; i < geometry->drawCount; ++i)
+    {
+        unsigned index = indexSize == sizeof(unsigned short) ? reinterpret_cast<unsigned short*>(&indexData[0])[i] : reinterpret_cast<unsigned*>(&indexData[0])[i];
+        dest.indices[i] = index;
+        minIndex = std::min(minIndex, index);
+        maxIndex = std::max(maxIndex, index);
+    }
+    for (auto it = dest.indices.begin(); it != dest.indices.end(); ++it)
+        *it -= minIndex;
+
+    size_t vertexSize = vb->VertexSize();
+    dest.elements = elements;
+    dest.numVertices = maxIndex - minIndex + 1;
+    dest.vertexData.resize(dest.numVertices * vertexSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, vb->GLBuffer());
+    glGetBufferSubData(GL_COPY_READ_BUFFER, (geometry->baseVertex + minIndex) * vertexSize, dest.vertexData.size(), &dest.vertexData[0]);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    return true;
+}
+
+/// Append a source mesh to merged vertex and index data, transformed to world space. Return the world space bounding box of the vertices.
+static BoundingBox AppendTransformed(std::vector<unsigned char>& vertexData, std::vector<unsigned>& indices, const StaticBatchSourceMesh& mesh, const Matrix3x4& transform)
+{
+    Matrix3 rotation = transform.ToMatrix3();
+    Matrix3 normalTransform = rotation.Inverse().Transpose();
+    float determinant = rotation.m00 * (rotation.m11 * rotation.m22 - rotation.m12 * rotation.m21) -
+        rotation.m01 * (rotation.m10 * rotation.m22 - rotation.m12 * rotation.m20) +
+        rotation.m02 * (rotation.m10 * rotation.m21 - rotation.m11 * rotation.m20);
+    // Mirroring transforms reverse the winding order and the bitangent direction
+    bool mirrored = determinant < 0.0f;
+
+    size_t vertexSize = mesh.vertexData.size() / mesh.numVertices;
+    size_t vertexStart = vertexData.size() / vertexSize;
+    vertexData.insert(vertexData.end(), mesh.vertexData.begin(), mesh.vertexData.end());
+    BoundingBox box;
+
+    size_t offset = 0;
+    for (auto it = mesh.elements.begin(); it != mesh.elements.end(); ++it)
+    {
+        unsigned char* data = &vertexData[vertexStart * vertexSize + offset];
+        offset += elementSizes[it->type];
+
+        if (it->semantic != SEM_POSITION && it->semantic != SEM_NORMAL && it->semantic != SEM_TANGENT)
+            continue;
+
+        for (size_t i = 0; i < mesh.numVertices; ++i, data += vertexSize)
+        {
+            if (it->type == ELEM_INT2101010N)
+            {
+                unsigned packed;
+                memcpy(&packed, data, sizeof packed);
+                packed = it->semantic == SEM_NORMAL ? TransformPacked(packed, normalTransform, false) : TransformPacked(packed, rotation, mirrored);
+                memcpy(data, &packed, sizeof packed);
+                continue;
+            }
+
+            float* values = reinterpret_cast<float*>(data);
+            Vector3 value(values[0], values[1], values[2]);
+            if (it->semantic == SEM_POSITION)
+            {
+                value = transform * value;
+                box.Merge(value);
+            }
+            else if (it->semantic == SEM_NORMAL)
+                value = (normalTransform * value).Normalized();
+            else
+            {
+                value = (rotation * value).Normalized();
+                if (mirrored)
+                    values[3] = -values[3];
+            }
+
+            values[0] = value.x;
+            values[1] = value.y;
+            values[2] = value.z;
+        }
+    }
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        indices.push_back(mesh.indices[i] + (unsigned)vertexStart);
+        indices.push_back(mesh.indices[mirrored ? i + 2 : i + 1] + (unsigned)vertexStart);
+        indices.push_back(mesh.indices[mirrored ? i + 1 : i + 2] + (unsigned)vertexStart);
+    }
+
+    return box;
+}
+
+StaticBatch::StaticBatch() :
+    combinedAllocation(0)
+{
+}
+
+StaticBatch::~StaticBatch()
+{
+    if (combinedBuffer)
+        combinedBuffer->FreeRange(combinedAllocation);
+}
+
+void StaticBatch::RegisterObject()
+{
+    RegisterFactory<StaticBatch>();
+    RegisterDerivedType<StaticBatch, GeometryNode>();
+}
+
+bool StaticBatch::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    const BoundingBox& worldBox = WorldBoundingBox();
+    distance = camera->Distance(worldBox.Center());
+
+    if (maxDistance > 0.0f && distance > maxDistance)
+        return false;
+
+    // The octree tested the merged bounding box, so test the source models only when there are gaps between them
+    if (parts.size() > 1)
+    {
+        const Frustum& frustum = camera->WorldFrustum();
+        bool visible = false;
+        for (auto it = parts.begin(); it != parts.end(); ++it)
+        {
+            if (frustum.IsInsideFast(it->worldBoundingBox) != OUTSIDE)
+            {
+                visible = true;
+                break;
+            }
+        }
+        if (!visible)
+            return false;
+    }
+
+    lastFrameNumber = frameNumber;
+    return true;
+}
+
+void StaticBatch::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance_)
+{
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        float hitDistance = ray.HitDistance(parts[i].worldBoundingBox);
+        if (hitDistance < maxDistance_)
+        {
+            StaticModel* source = parts[i].source.Get();
+            RaycastResult res;
+            res.position = ray.origin + hitDistance * ray.direction;
+            res.normal = -ray.direction;
+            res.distance = hitDistance;
+            res.node = source ? static_cast<OctreeNode*>(source) : this;
+            res.subObject = i;
+            dest.push_back(res);
+        }
+    }
+}
+
+size_t StaticBatch::MergeStaticModels(Octree* octree, Node* root, size_t maxInstances, size_t maxVertices)
+{
+    PROFILE(MergeStaticModels);
+
+    Scene* scene = octree ? octree->ParentScene() : nullptr;
+    if (!scene || !root)
+        return 0;
+
+    // Find the octants of newly added or moved models
+    octree->Update(0);
+
+    std::vector<StaticModel*> staticModels;
+    root->FindChildren(staticModels, true);
+
+    std::vector<StaticModel*> candidates;
+    std::map<Geometry*, size_t> geometryUses;
+    for (auto it = staticModels.begin(); it != staticModels.end(); ++it)
+    {
+        StaticModel* model = *it;
+        if (model->Type() != StaticModel::TypeStatic() || !model->IsEnabled() || !model->Static() || !model->GetModel() || !model->GetOctant() ||
+            model->TestFlag(NF_HASLODLEVELS) || model->HasImpostor() || model->MaxDistance() > 0.0f || model->IsOccluder() || !model->NumGeometries())
+            continue;
+
+        candidates.push_back(model);
+        for (size_t i = 0; i < model->NumGeometries(); ++i)
+            ++geometryUses[model->GetGeometry(i)];
+    }
+
+    // Read the geometries that are not better left to instancing
+    std::map<Geometry*, StaticBatchSourceMesh> meshes;
+    std::map<StaticBatchKey, std::vector<StaticBatchEntry> > groups;
+    std::map<StaticModel*, std::vector<StaticBatchKey> > modelKeys;
+    for (auto it = candidates.begin(); it != candidates.end(); ++it)
+    {
+        StaticModel* model = *it;
+        bool eligible = true;
+        for (size_t i = 0; i < model->NumGeometries() && eligible; ++i)
+        {
+            Geometry* geometry = model->GetGeometry(i);
+            if (maxInstances && geometryUses[geometry] > maxInstances)
+                eligible = false;
+            else if (meshes.find(geometry) == meshes.end() && !ReadSourceMesh(geometry, meshes[geometry]))
+                eligible = false;
+            else if (meshes[geometry].numVertices > maxVertices)
+                eligible = false;
+        }
+        if (!eligible)
+            continue;
+
+        for (size_t i = 0; i < model->NumGeometries(); ++i)
+        {
+            Geometry* geometry = model->GetGeometry(i);
+            StaticBatchKey key(model->GetOctant(), model->GetMaterial(i), VertexFormatKey(meshes[geometry].elements), model->Layer(), model->CastShadows());
+            StaticBatchEntry entry;
+            entry.model = model;
+            entry.geometry = geometry;
+            groups[key].push_back(entry);
+            modelKeys[model].push_back(key);
+        }
+    }
+
+    // A model is merged only if all its geometries are, and a group only if it has several models. Drop until stable
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto it = groups.begin(); it != groups.end();)
+        {
+            std::vector<StaticBatchEntry>& entries = it->second;
+            if (entries.empty())
+            {
+                groups.erase(it++);
+                continue;
+            }
+            if (entries.size() > 1)
+            {
+                ++it;
+                continue;
+            }
+
+            std::vector<StaticModel*> droppedModels;
+            for (auto eIt = entries.begin(); eIt != entries.end(); ++eIt)
+                droppedModels.push_back(eIt->model);
+            groups.erase(it++);
+
+            for (auto mIt = droppedModels.begin(); mIt != droppedModels.end(); ++mIt)
+            {
+                std::vector<StaticBatchKey>& keys = modelKeys[*mIt];
+                for (auto kIt = keys.begin(); kIt != keys.end(); ++kIt)
+                {
+                    auto gIt = groups.find(*kIt);
+                    if (gIt == groups.end())
+                        continue;
+                    std::vector<StaticBatchEntry>& otherEntries = gIt->second;
+                    for (size_t i = 0; i < otherEntries.size();)
+                    {
+                        if (otherEntries[i].model == *mIt)
+                            otherEntries.erase(otherEntries.begin() + i);
+                        else
+                            ++i;
+                    }
+                }
+                keys.clear();
+            }
+
+            // The iterator may have been invalidated by erasing the dropped models' entries, so restart
+            changed = true;
+            break;
+        }
+    }
+
+    std::map<StaticModel*, bool> mergedModels;
+    size_t numBatches = 0;
+
+    for (auto it = groups.begin(); it != groups.end(); ++it)
+    {
+        const std::vector<StaticBatchEntry>& entries = it->second;
+        Material* material = std::get<1>(it->first);
+
+        for (size_t start = 0; start < entries.size();)
+        {
+            // Split the group into batches of at most the maximum vertex count
+            std::vector<unsigned char> vertexData;
+            std::vector<unsigned> indices;
+            std::vector<StaticBatchPart> parts;
+            BoundingBox box;
+            size_t numVertices = 0;
+            size_t end = start;
+
+            for (; end < entries.size(); ++end)
+            {
+                const StaticBatchSourceMesh& mesh = meshes[entries[end].geometry];
+                if (end > start && numVertices + mesh.numVertices > maxVertices)
+                    break;
+
+                StaticModel* model = entries[end].model;
+                box.Merge(AppendTransformed(vertexData, indices, mesh, model->WorldTransform()));
+                numVertices += mesh.numVertices;
+
+                StaticBatchPart part;
+                part.worldBoundingBox = model->WorldBoundingBox();
+                part.source = model;
+                parts.push_back(part);
+            }
+
+            const std::vector<VertexElement>& elements = meshes[entries[start].geometry].elements;
+            unsigned allocationId = 0;
+            CombinedBuffer* buffer = CombinedBuffer::Allocate(elements, numVertices, indices.size(), allocationId);
+            if (!allocationId)
+            {
+                LOGERRORF("Could not allocate %d vertices and %d indices for a static batch", (int)numVertices, (int)indices.size());
+                start = end;
+                continue;
+            }
+
+            buffer->SetVertices(allocationId, &vertexData[0]);
+            buffer->SetIndices(allocationId, 0, indices.size(), &indices[0]);
+
+            StaticBatch* batch = scene->CreateChild<StaticBatch>();
+            batch->SetTemporary(true);
+            batch->SetStatic(true);
+            batch->SetLayer(std::get<3>(it->first));
+            batch->SetCastShadows(std::get<4>(it->first));
+            batch->boundingBox = box;
+            batch->Define(buffer, allocationId, material, parts);
+            ++numBatches;
+
+            for (size_t i = start; i < end; ++i)
+                mergedModels[entries[i].model] = true;
+            start = end;
+        }
+    }
+
+    for (auto it = mergedModels.begin(); it != mergedModels.end(); ++it)
+        it->first->SetEnabled(false);
+
+    LOGINFOF("Merged %d static models into %d static batches", (int)mergedModels.size(), (int)numBatches);
+    return mergedModels.size();
+}
+
+void StaticBatch::OnWorldBoundingBoxUpdate() const
+{
+    worldBoundingBox = boundingBox.Transformed(WorldTransform());
+    SetFlag(NF_BOUNDING_BOX_DIRTY, false);
+}
+
+void StaticBatch::Define(CombinedBuffer* buffer, unsigned allocationId, Material* material, const std::vector<StaticBatchPart>& parts_)
+{
+    combinedBuffer = buffer;
+    combinedAllocation = allocationId;
+    parts = parts_;
+
+    const CombinedBufferAllocation* allocation = buffer->Allocation(allocationId);
+    SharedPtr<Geometry> geometry(new Geometry());
+    geometry->vertexBuffer = buffer->GetVertexBuffer();
+    geometry->indexBuffer = buffer->GetIndexBuffer();
+    geometry->drawStart = allocation->indexStart;
+    geometry->drawCount = allocation->numIndices;
+    geometry->baseVertex = (unsigned)allocation->vertexStart;
+    buffer->AddGeometry(allocationId, geometry);
+
+    SetNumGeometries(1);
+    SetGeometry(0, geometry);
+    SetMaterial(0, material);
+    OnTransformChanged();
+}
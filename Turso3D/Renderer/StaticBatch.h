@@ -0,0 +1,69 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "StaticModel.h"
+
+class CombinedBuffer;
+class Octree;
+
+/// Default number of models drawing a geometry above which it is left to instancing instead of merging.
+static const size_t DEFAULT_STATIC_BATCH_MAX_INSTANCES = 8;
+/// Default maximum number of vertices in one static batch.
+static const size_t DEFAULT_STATIC_BATCH_VERTICES = 65536;
+
+/// Source model merged into a static batch.
+struct StaticBatchPart
+{
+    /// World space bounding box of the source model.
+    BoundingBox worldBoundingBox;
+    /// Source model, disabled while merged.
+    WeakPtr<StaticModel> source;
+};
+
+/// %Scene node that renders static models sharing a material and an octree octant, merged into one geometry with the world transforms pre-applied. The merged vertices and indices are sub-allocated from a combined buffer. The source models' bounding boxes are kept for culling and raycasts, so that a batch whose models are all outside the view is not rendered even if the merged bounding box is partially inside.
+class StaticBatch : public GeometryNode
+{
+    OBJECT(StaticBatch);
+
+public:
+    /// Construct.
+    StaticBatch();
+    /// Destruct. Free the combined buffer range.
+    ~StaticBatch();
+
+    /// Register factory.
+    static void RegisterObject();
+
+    /// Prepare object for rendering. Return false if none of the source models' bounding boxes are inside the camera frustum. Called by Renderer.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Perform ray test on the source models' bounding boxes and add possible hits to the result vector, with the source model as the hit node.
+    void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
+
+    /// Return number of merged source models.
+    size_t NumParts() const { return parts.size(); }
+    /// Return merged source models.
+    const std::vector<StaticBatchPart>& Parts() const { return parts; }
+
+    /// Merge the enabled static models under a node that share a material, vertex format, layer and shadow casting mode, and reside in the same octree octant, into static batches created as temporary children of the octree's scene, and disable the merged models. Models with LOD levels, impostors, draw distance or occluder rasterization, and groups of only one model, are left as is. Geometries drawn by more than maxInstances models are also left as is, as instancing draws them with fewer draw calls across the octants than merging, unless maxInstances is 0. Reads the geometry data back from the GPU, so call outside the view rendering, for example after loading a scene. Return the number of models merged.
+    static size_t MergeStaticModels(Octree* octree, Node* root, size_t maxInstances = DEFAULT_STATIC_BATCH_MAX_INSTANCES, size_t maxVertices = DEFAULT_STATIC_BATCH_VERTICES);
+
+protected:
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Return the merged local space bounding box.
+    const BoundingBox* LocalBoundingBox() const override { return &boundingBox; }
+
+private:
+    /// Set the merged geometry from a combined buffer range, and the source models.
+    void Define(CombinedBuffer* buffer, unsigned allocationId, Material* material, const std::vector<StaticBatchPart>& parts);
+
+    /// Merged source models.
+    std::vector<StaticBatchPart> parts;
+    /// Merged bounding box. The vertices are in world space, so it is transformed by the batch's own transform only.
+    BoundingBox boundingBox;
+    /// Combined buffer holding the merged geometry.
+    SharedPtr<CombinedBuffer> combinedBuffer;
+    /// Range allocated from the combined buffer.
+    unsigned combinedAllocation;
+};
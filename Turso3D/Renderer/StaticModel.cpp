@@ -2,13 +2,18 @@
 
 #include "../IO/Log.h"
 #include "../Resource/ResourceCache.h"
+#include "../Thread/Mutex.h"
 #include "Camera.h"
 #include "Material.h"
 #include "Model.h"
+#include "Octree.h"
 #include "StaticModel.h"
 
 static Vector3 DOT_SCALE(1 / 3.0f, 1 / 3.0f, 1 / 3.0f);
 
+/// Guards the LOD and impostor geometry assignments, as the same model can be prepared by several shadow casting lights in worker threads at once. Atomic refcounts alone do not make concurrent assignments to the same pointer safe.
+static Mutex lodChangeMutex;
+
 StaticModel::StaticModel() :
     lodBias(1.0f)
 {
@@ -43,10 +48,37 @@ bool StaticModel::OnPrepareRender(unsigned short frameNumber, Camera* camera)
     if (frameNumber - lastUpdateFrameNumber == 0x8000)
         lastUpdateFrameNumber = 0;
 
+    Geometry* impostorGeometry = model ? model->ImpostorGeometry() : nullptr;
+    if (!(Flags() & (NF_HASLODLEVELS | NF_IMPOSTOR)) && !impostorGeometry)
+        return true;
+
+    float lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
+    // Thresholds toward lower quality are moved further and toward higher quality closer, so that a node at a threshold keeps its LOD
+    float lowerQualityMul = 1.0f + camera->LodHysteresis();
+    float higherQualityMul = 1.0f - camera->LodHysteresis();
+
+    // Switch to the impostor beyond its distance, and back
+    bool useImpostor = impostorGeometry && lodDistance > model->ImpostorDistance() * (TestFlag(NF_IMPOSTOR) ? higherQualityMul : lowerQualityMul);
+    if (useImpostor && (impostorBatches.GetGeometry(0) != impostorGeometry || impostorBatches.GetMaterial(0) != model->ImpostorMaterial()))
+    {
+        MutexLock lock(lodChangeMutex);
+        if (!impostorBatches.NumGeometries())
+            impostorBatches.SetNumGeometries(1);
+        impostorBatches.SetGeometry(0, impostorGeometry);
+        impostorBatches.SetMaterial(0, model->ImpostorMaterial());
+    }
+    if (useImpostor != TestFlag(NF_IMPOSTOR))
+    {
+        SetFlag(NF_IMPOSTOR, useImpostor);
+        SourceBatches::MarkLodChanged();
+        lastUpdateFrameNumber = frameNumber;
+    }
+    if (useImpostor)
+        return true;
+
     // Find out the new LOD level if model has LODs
     if (Flags() & NF_HASLODLEVELS)
     {
-        float lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
         size_t numGeometries = batches.NumGeometries();
 
         for (size_t i = 0; i < numGeometries; ++i)
@@ -54,15 +86,24 @@ bool StaticModel::OnPrepareRender(unsigned short frameNumber, Camera* camera)
             const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(i);
             if (lodGeometries.size() > 1)
             {
+                Geometry* current = batches.GetGeometry(i);
+                size_t currentLevel = 0;
+                for (size_t k = 1; k < lodGeometries.size(); ++k)
+                {
+                    if (lodGeometries[k] == current)
+                        currentLevel = k;
+                }
+
                 size_t j;
                 for (j = 1; j < lodGeometries.size(); ++j)
                 {
-                    if (lodDistance <= lodGeometries[j]->lodDistance)
+                    if (lodDistance <= lodGeometries[j]->lodDistance * (j <= currentLevel ? higherQualityMul : lowerQualityMul))
                         break;
                 }
                 if (batches.GetGeometry(i) != lodGeometries[j - 1])
                 {
-                    batches.SetGeometry(i, lodGeometries[j - 1]);
+                    MutexLock lock(lodChangeMutex);
+                    batches.SetLodGeometry(i, lodGeometries[j - 1]);
                     lastUpdateFrameNumber = frameNumber;
                 }
             }
@@ -72,10 +113,65 @@ bool StaticModel::OnPrepareRender(unsigned short frameNumber, Camera* camera)
     return true;
 }
 
+void StaticModel::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance_)
+{
+    bool hasRaycastData = false;
+    for (size_t i = 0; model && i < model->NumGeometries() && !hasRaycastData; ++i)
+        hasRaycastData = model->GetGeometry(i, 0)->raycastData != nullptr;
+
+    if (!hasRaycastData)
+    {
+        OctreeNode::OnRaycast(dest, ray, maxDistance_);
+        return;
+    }
+
+    if (ray.HitDistance(WorldBoundingBox()) >= maxDistance_)
+        return;
+
+    // Test in model space, then convert the hit back to world space for the distance, as the transform may scale
+    const Matrix3x4& transform = WorldTransform();
+    Ray localRay = ray.Transformed(transform.Inverse());
+    float closest = M_INFINITY;
+    size_t closestGeometry = 0;
+    Vector3 localNormal(Vector3::ZERO);
+
+    for (size_t i = 0; i < model->NumGeometries(); ++i)
+    {
+        const OccluderGeometry* triangles = model->GetGeometry(i, 0)->raycastData.Get();
+        if (!triangles || triangles->indices.empty())
+            continue;
+
+        Vector3 normal(Vector3::ZERO);
+        float distance = triangles->bvh.HitDistance(localRay, triangles->vertices, triangles->indices, &normal);
+        if (distance < closest)
+        {
+            closest = distance;
+            closestGeometry = i;
+            localNormal = normal;
+        }
+    }
+
+    if (closest == M_INFINITY)
+        return;
+
+    Vector3 position = transform * (localRay.origin + closest * localRay.direction);
+    float hitDistance = (position - ray.origin).Length();
+    if (hitDistance < maxDistance_)
+    {
+        RaycastResult res;
+        res.position = position;
+        res.normal = (WorldRotation() * localNormal).Normalized();
+        res.distance = hitDistance;
+        res.node = this;
+        res.subObject = closestGeometry;
+        dest.push_back(res);
+    }
+}
+
 void StaticModel::SetModel(Model* model_)
 {
     model = model_;
-    SetFlag(NF_HASLODLEVELS, false);
+    SetFlag(NF_HASLODLEVELS | NF_IMPOSTOR, false);
 
     if (model)
     {
@@ -93,6 +189,9 @@ void StaticModel::SetModel(Model* model_)
         SetNumGeometries(0);
     }
 
+    if (materialInstance)
+        GeometryNode::SetMaterial(materialInstance->Parent());
+
     OnTransformChanged();
 }
 
@@ -101,11 +200,40 @@ void StaticModel::SetLodBias(float bias)
     lodBias = Max(bias, M_EPSILON);
 }
 
+void StaticModel::SetMaterialInstance(MaterialInstance* instance)
+{
+    if (instance == materialInstance)
+        return;
+
+    // Changing the geometry type changes the shader variations, so invalidate cached batches
+    if (!instance != !materialInstance)
+        SourceBatches::MarkChanged();
+
+    materialInstance = instance;
+    if (materialInstance)
+        GeometryNode::SetMaterial(materialInstance->Parent());
+}
+
 Model* StaticModel::GetModel() const
 {
     return model.Get();
 }
 
+MaterialInstance* StaticModel::GetMaterialInstance() const
+{
+    return materialInstance.Get();
+}
+
+GeometryType StaticModel::GetGeometryType() const
+{
+    return materialInstance ? GEOM_CUSTOM : GEOM_STATIC;
+}
+
+Vector4 StaticModel::InstanceData() const
+{
+    return materialInstance ? materialInstance->Parameters() : Vector4::ZERO;
+}
+
 void StaticModel::OnWorldBoundingBoxUpdate() const
 {
     if (model)
@@ -117,6 +245,16 @@ void StaticModel::OnWorldBoundingBoxUpdate() const
         OctreeNode::OnWorldBoundingBoxUpdate();
 }
 
+bool StaticModel::HasImpostor() const
+{
+    return model && model->ImpostorGeometry();
+}
+
+const BoundingBox* StaticModel::LocalBoundingBox() const
+{
+    return model ? &model->LocalBoundingBox() : nullptr;
+}
+
 void StaticModel::SetModelAttr(const ResourceRef& model_)
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
@@ -4,6 +4,9 @@
 
 #include "GeometryNode.h"
 
+class MaterialInstance;
+class Model;
+
 /// %Scene node that renders an unanimated model.
 class StaticModel : public GeometryNode
 {
@@ -20,20 +23,36 @@ public:
 
     /// Prepare object for rendering. Reset framenumber and calculate distance from camera, and check for LOD level changes. Called by Renderer. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Perform ray test on self and add possible hit to the result vector. Tests the triangles of the model through their bounding volume hierarchy when it has raycast data, otherwise the bounding box.
+    void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
 
     /// Set the model resource.
-    void SetModel(Model* model);
+    virtual void SetModel(Model* model);
     /// Set LOD bias. Values higher than 1 use higher quality LOD (acts if distance is smaller.)
     void SetLodBias(float bias);
+    /// Set a material instance to use for all geometries, or null to stop using it. Assigns the parent material and passes the instance parameters as per-object data, so that the node is rendered with custom geometry shader variations. Not supported by animated models, which use the per-object data for skinning.
+    void SetMaterialInstance(MaterialInstance* instance);
 
     /// Return the model resource.
     Model* GetModel() const;
     /// Return LOD bias.
     float LodBias() const { return lodBias; }
+    /// Return the material instance, or null if not used.
+    MaterialInstance* GetMaterialInstance() const;
+    /// Return geometry type. Custom if a material instance is used.
+    GeometryType GetGeometryType() const override;
+    /// Return the material instance parameters as per-object data.
+    Vector4 InstanceData() const override;
+    /// Return whether the model has an impostor.
+    bool HasImpostor() const;
+    /// Return the draw call source data of the model's impostor. Drawn instead of the geometries while the impostor flag is set.
+    const SourceBatches& ImpostorBatches() const { return impostorBatches; }
 
 protected:
     /// Recalculate the world space bounding box.
     void OnWorldBoundingBoxUpdate() const override;
+    /// Return the model's local space bounding box, or null if no model.
+    const BoundingBox* LocalBoundingBox() const override;
 
 private:
     /// Set model attribute. Used in serialization.
@@ -45,4 +64,8 @@ private:
     float lodBias;
     /// Current model resource.
     SharedPtr<Model> model;
+    /// Material instance.
+    SharedPtr<MaterialInstance> materialInstance;
+    /// Impostor draw call source data.
+    SourceBatches impostorBatches;
 };
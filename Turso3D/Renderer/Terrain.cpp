@@ -0,0 +1,552 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/Shader.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Math/Ray.h"
+#include "../Resource/Image.h"
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "Camera.h"
+#include "Material.h"
+#include "Octree.h"
+#include "Terrain.h"
+#include "VirtualTexture.h"
+
+#include <string>
+
+static const Vector3 DEFAULT_TERRAIN_SPACING(1.0f, 32.0f, 1.0f);
+static const float DEFAULT_TEXTURE_REPEAT = 32.0f;
+
+static float DistanceToBox(const BoundingBox& box, const Vector3& point)
+{
+    Vector3 closest(Clamp(point.x, box.min.x, box.max.x), Clamp(point.y, box.min.y, box.max.y), Clamp(point.z, box.min.z, box.max.z));
+    return (point - closest).Length();
+}
+
+static bool IsPowerOfTwo(int value)
+{
+    return value > 0 && (value & (value - 1)) == 0;
+}
+
+TerrainPatch::TerrainPatch() :
+    parentPatch(nullptr),
+    texelOffset(IntVector2::ZERO),
+    level(0)
+{
+}
+
+TerrainPatch::~TerrainPatch()
+{
+}
+
+void TerrainPatch::RegisterObject()
+{
+    RegisterFactory<TerrainPatch>();
+    RegisterDerivedType<TerrainPatch, GeometryNode>();
+    CopyBaseAttributes<TerrainPatch, OctreeNode>();
+}
+
+bool TerrainPatch::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    if ((parentPatch && !parentPatch->IsSubdivided(camera)) || IsSubdivided(camera))
+        return false;
+
+    return GeometryNode::OnPrepareRender(frameNumber, camera);
+}
+
+void TerrainPatch::OnRaycast(std::vector<RaycastResult>&, const Ray&, float)
+{
+}
+
+void TerrainPatch::Define(Terrain* terrain_, TerrainPatch* parentPatch_, int level_, const IntVector2& texelOffset_, const BoundingBox& terrainBox_)
+{
+    terrain = terrain_;
+    parentPatch = parentPatch_;
+    level = level_;
+    texelOffset = texelOffset_;
+    terrainBox = terrainBox_;
+
+    int patchSize = terrain_ ? terrain_->PatchSize() : 0;
+    boundingBox.Define(Vector3(0.0f, terrainBox.min.y, 0.0f), Vector3((float)patchSize, terrainBox.max.y, (float)patchSize));
+
+    SetFlag(NF_BOUNDING_BOX_DIRTY, true);
+    Octree* octree = GetOctree();
+    if (!TestFlag(NF_OCTREE_UPDATE_QUEUED) && octree)
+        octree->QueueUpdate(this);
+}
+
+Vector4 TerrainPatch::InstanceData() const
+{
+    Terrain* owner = terrain.Get();
+    return Vector4((float)texelOffset.x, (float)texelOffset.y, (float)(1 << level), owner ? owner->LodRange(level) : M_MAX_FLOAT);
+}
+
+bool TerrainPatch::IsSubdivided(Camera* camera) const
+{
+    Terrain* owner = terrain.Get();
+    if (!level || !owner)
+        return false;
+
+    return DistanceToBox(WorldBoundingBox(), camera->WorldPosition()) < owner->LodRange(level - 1);
+}
+
+void TerrainPatch::OnWorldBoundingBoxUpdate() const
+{
+    worldBoundingBox = boundingBox.Transformed(WorldTransform());
+    SetFlag(NF_BOUNDING_BOX_DIRTY, false);
+}
+
+Terrain::Terrain() :
+    spacing(DEFAULT_TERRAIN_SPACING),
+    size(0),
+    patchSize(DEFAULT_TERRAIN_PATCH_SIZE),
+    numLevels(0),
+    lodDistance(0.0f),
+    textureRepeat(DEFAULT_TEXTURE_REPEAT)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    Shader* shader = cache->LoadResource<Shader>("Shaders/Terrain.glsl");
+
+    material = new Material();
+    Pass* shadowPass = material->CreatePass(PASS_SHADOW);
+    shadowPass->SetShader(shader, "SHADOW", "SHADOW");
+    shadowPass->SetRenderState(BLEND_REPLACE, CMP_LESS, false, true);
+    material->SetUniform(U_MATDIFFCOLOR, Vector4::ONE);
+    UpdateMaterial();
+}
+
+Terrain::~Terrain()
+{
+}
+
+void Terrain::RegisterObject()
+{
+    RegisterFactory<Terrain>();
+    // The material is owned by the terrain, so do not copy the materials attribute
+    CopyBaseAttributes<Terrain, OctreeNode>();
+    RegisterDerivedType<Terrain, GeometryNode>();
+    // The heightmap is last, so that the patches are created once with the other attributes already set
+    RegisterRefAttribute("spacing", &Terrain::Spacing, &Terrain::SetSpacing, DEFAULT_TERRAIN_SPACING);
+    RegisterAttribute("patchSize", &Terrain::PatchSize, &Terrain::SetPatchSize, DEFAULT_TERRAIN_PATCH_SIZE);
+    RegisterAttribute("lodDistance", &Terrain::LodDistance, &Terrain::SetLodDistance, 0.0f);
+    RegisterAttribute("textureRepeat", &Terrain::TextureRepeat, &Terrain::SetTextureRepeat, DEFAULT_TEXTURE_REPEAT);
+    RegisterMixedRefAttribute("texture", &Terrain::TextureAttr, &Terrain::SetTextureAttr, ResourceRef(Texture::TypeStatic()));
+    RegisterMixedRefAttribute("heightMap", &Terrain::HeightMapAttr, &Terrain::SetHeightMapAttr, ResourceRef(Image::TypeStatic()));
+}
+
+bool Terrain::OnPrepareRender(unsigned short, Camera*)
+{
+    return false;
+}
+
+void Terrain::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance_)
+{
+    TerrainPatch* root = patches.size() ? patches[0].Get() : nullptr;
+    if (!root || ray.HitDistance(WorldBoundingBox()) >= maxDistance_)
+        return;
+
+    // The local ray direction is not normalized, so convert the hit back to world space for the distance
+    const Matrix3x4& worldTransform = WorldTransform();
+    Ray localRay = ray.Transformed(worldTransform.Inverse());
+    float closest = M_INFINITY;
+    Vector3 localNormal;
+    RaycastPatch(root, localRay, closest, localNormal);
+    if (closest == M_INFINITY)
+        return;
+
+    Vector3 position = worldTransform * (localRay.origin + closest * localRay.direction);
+    float hitDistance = (position - ray.origin).Length();
+    if (hitDistance < maxDistance_)
+    {
+        RaycastResult res;
+        res.position = position;
+        res.normal = (WorldRotation() * localNormal).Normalized();
+        res.distance = hitDistance;
+        res.node = this;
+        res.subObject = 0;
+        dest.push_back(res);
+    }
+}
+
+void Terrain::SetCastShadows(bool enable)
+{
+    GeometryNode::SetCastShadows(enable);
+
+    for (auto it = patches.begin(); it != patches.end(); ++it)
+    {
+        if (*it)
+            (*it)->SetCastShadows(enable);
+    }
+}
+
+bool Terrain::SetHeightMap(Image* image)
+{
+    heightMap = image;
+    return CreateTerrain();
+}
+
+void Terrain::SetSpacing(const Vector3& spacing_)
+{
+    spacing = Vector3(Max(spacing_.x, M_EPSILON), spacing_.y, Max(spacing_.z, M_EPSILON));
+    if (heightMap)
+        CreateTerrain();
+}
+
+void Terrain::SetPatchSize(int size_)
+{
+    if (!IsPowerOfTwo(size_) || size_ < 4 || size_ > 128)
+    {
+        LOGERROR("Terrain patch size must be a power of two from 4 to 128");
+        return;
+    }
+
+    if (size_ != patchSize)
+    {
+        patchSize = size_;
+        // The grid geometry is recreated for the new size
+        geometry.Reset();
+        if (heightMap)
+            CreateTerrain();
+    }
+}
+
+void Terrain::SetLodDistance(float distance)
+{
+    lodDistance = Max(distance, 0.0f);
+}
+
+void Terrain::SetTexture(Texture* texture)
+{
+    diffuseTexture = texture;
+    UpdateMaterial();
+}
+
+void Terrain::SetVirtualTexture(VirtualTexture* texture)
+{
+    virtualTexture = texture;
+    UpdateMaterial();
+}
+
+void Terrain::SetTextureRepeat(float repeat)
+{
+    textureRepeat = repeat;
+    UpdateMaterial();
+}
+
+float Terrain::GetHeight(const Vector3& worldPosition) const
+{
+    const Matrix3x4& worldTransform = WorldTransform();
+    if (!size)
+        return worldTransform.Translation().y;
+
+    // Interpolate on the same triangles as the grid geometry, which are split along the cell diagonal from the lower corner
+    Vector3 position = worldTransform.Inverse() * worldPosition;
+    float x = (position.x - boundingBox.min.x) / spacing.x;
+    float z = (position.z - boundingBox.min.z) / spacing.z;
+    if (x < 0.0f || z < 0.0f || x > (float)(size - 1) || z > (float)(size - 1))
+        return worldTransform.Translation().y;
+
+    int cellX = Min((int)x, size - 2);
+    int cellZ = Min((int)z, size - 2);
+    float u = x - (float)cellX;
+    float v = z - (float)cellZ;
+    float h00 = heights[cellZ * size + cellX];
+    float h10 = heights[cellZ * size + cellX + 1];
+    float h01 = heights[(cellZ + 1) * size + cellX];
+    float h11 = heights[(cellZ + 1) * size + cellX + 1];
+
+    float height;
+    if (v > u)
+        height = h00 + v * (h01 - h00) + u * (h11 - h01);
+    else
+        height = h00 + u * (h10 - h00) + v * (h11 - h10);
+
+    return (worldTransform * Vector3(position.x, height, position.z)).y;
+}
+
+Texture* Terrain::GetTexture() const
+{
+    return diffuseTexture.Get();
+}
+
+VirtualTexture* Terrain::GetVirtualTexture() const
+{
+    return virtualTexture.Get();
+}
+
+float Terrain::LodRange(int level) const
+{
+    Vector3 worldScale = WorldScale();
+    float leafSize = (float)patchSize * Max(spacing.x, spacing.z);
+    return Max(lodDistance, TERRAIN_MIN_LOD_RANGE * leafSize) * (float)(1 << level) * Max(worldScale.x, worldScale.z);
+}
+
+void Terrain::OnWorldBoundingBoxUpdate() const
+{
+    if (boundingBox.IsDefined())
+    {
+        worldBoundingBox = boundingBox.Transformed(WorldTransform());
+        SetFlag(NF_BOUNDING_BOX_DIRTY, false);
+    }
+    else
+        OctreeNode::OnWorldBoundingBoxUpdate();
+}
+
+const BoundingBox* Terrain::LocalBoundingBox() const
+{
+    return boundingBox.IsDefined() ? &boundingBox : nullptr;
+}
+
+void Terrain::SetHeightMapAttr(const ResourceRef& image)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetHeightMap(image.name.length() ? cache->LoadResource<Image>(image.name) : nullptr);
+}
+
+ResourceRef Terrain::HeightMapAttr() const
+{
+    return ResourceRef(Image::TypeStatic(), ResourceName(heightMap.Get()));
+}
+
+void Terrain::SetTextureAttr(const ResourceRef& texture)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetTexture(texture.name.length() ? cache->LoadResource<Texture>(texture.name) : nullptr);
+}
+
+ResourceRef Terrain::TextureAttr() const
+{
+    return ResourceRef(Texture::TypeStatic(), ResourceName(GetTexture()));
+}
+
+bool Terrain::CreateTerrain()
+{
+    PROFILE(CreateTerrain);
+
+    RemovePatches();
+    heights.clear();
+    boundingBox.Undefine();
+    size = 0;
+    numLevels = 0;
+
+    SetFlag(NF_BOUNDING_BOX_DIRTY, true);
+    Octree* octree = GetOctree();
+    if (!TestFlag(NF_OCTREE_UPDATE_QUEUED) && octree)
+        octree->QueueUpdate(this);
+
+    Image* image = heightMap.Get();
+    if (!image)
+        return false;
+
+    int components = image->Components();
+    int imageSize = image->Width();
+    if (!image->Data() || (components != 1 && components < 3) || image->Height() != imageSize || imageSize - 1 < patchSize ||
+        !IsPowerOfTwo(imageSize - 1))
+    {
+        LOGERROR("Terrain heightmap " + image->Name() + " must be square with a power of two plus one size, at least the patch size plus one, and 8 bits per component");
+        return false;
+    }
+
+    size = imageSize;
+    for (int quads = patchSize; quads < size - 1; quads *= 2)
+        ++numLevels;
+    ++numLevels;
+
+    heights.resize(size * size);
+    const unsigned char* src = image->Data();
+    float heightScale = components == 1 ? spacing.y / 255.0f : spacing.y / 65535.0f;
+    for (size_t i = 0; i < heights.size(); ++i)
+    {
+        const unsigned char* pixel = src + i * components;
+        heights[i] = (components == 1 ? (float)pixel[0] : (float)(pixel[0] * 256 + pixel[1])) * heightScale;
+    }
+
+    // The terrain is centered on the node
+    Vector3 halfSize(0.5f * (size - 1) * spacing.x, 0.0f, 0.5f * (size - 1) * spacing.z);
+    boundingBox.Define(-halfSize, halfSize);
+
+    ImageLevel heightLevel(IntVector2(size, size), FMT_R32F, &heights[0]);
+    if (!heightTexture)
+        heightTexture = new Texture();
+    heightTexture->Define(TEX_2D, IntVector2(size, size), FMT_R32F, 1, 1, &heightLevel);
+    heightTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    material->SetTexture(1, heightTexture);
+
+    // The grid vertices are in grid units, from which each patch's transform scales to its size
+    if (!geometry)
+    {
+        int verticesPerEdge = patchSize + 1;
+        std::vector<Vector3> vertexData;
+        vertexData.reserve(verticesPerEdge * verticesPerEdge);
+        for (int z = 0; z < verticesPerEdge; ++z)
+        {
+            for (int x = 0; x < verticesPerEdge; ++x)
+                vertexData.push_back(Vector3((float)x, 0.0f, (float)z));
+        }
+
+        std::vector<unsigned short> indexData;
+        indexData.reserve(patchSize * patchSize * 6);
+        for (int z = 0; z < patchSize; ++z)
+        {
+            for (int x = 0; x < patchSize; ++x)
+            {
+                unsigned short v00 = (unsigned short)(z * verticesPerEdge + x);
+                unsigned short v10 = (unsigned short)(v00 + 1);
+                unsigned short v01 = (unsigned short)(v00 + verticesPerEdge);
+                unsigned short v11 = (unsigned short)(v01 + 1);
+                unsigned short quad[] = { v00, v01, v11, v00, v11, v10 };
+                indexData.insert(indexData.end(), quad, quad + 6);
+            }
+        }
+
+        std::vector<VertexElement> vertexElements;
+        vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+
+        geometry = new Geometry();
+        geometry->vertexBuffer = new VertexBuffer();
+        geometry->vertexBuffer->Define(USAGE_DEFAULT, vertexData.size(), vertexElements, &vertexData[0]);
+        geometry->indexBuffer = new IndexBuffer();
+        geometry->indexBuffer->Define(USAGE_DEFAULT, indexData.size(), sizeof(unsigned short), &indexData[0]);
+        geometry->drawStart = 0;
+        geometry->drawCount = indexData.size();
+    }
+
+    TerrainPatch* root = CreatePatch(this, nullptr, numLevels - 1, IntVector2::ZERO);
+    root->SetPosition(boundingBox.min);
+    root->SetScale(Vector3(spacing.x * (1 << (numLevels - 1)), 1.0f, spacing.z * (1 << (numLevels - 1))));
+    boundingBox = root->TerrainBoundingBox();
+    return true;
+}
+
+TerrainPatch* Terrain::CreatePatch(SpatialNode* parent, TerrainPatch* parentPatch, int level, const IntVector2& texelOffset)
+{
+    TerrainPatch* patch = parent->CreateChild<TerrainPatch>();
+    patch->SetTemporary(true);
+    patch->SetLayer(Layer());
+    patch->SetCastShadows(CastShadows());
+    patch->SetNumGeometries(1);
+    patch->SetGeometry(0, geometry);
+    patch->SetMaterial(0, material);
+    patches.push_back(patch);
+
+    int step = 1 << level;
+    BoundingBox terrainBox;
+    if (level > 0)
+    {
+        // The children cover the quadrants of the parent at half the grid spacing
+        int half = patchSize / 2;
+        for (int z = 0; z < 2; ++z)
+        {
+            for (int x = 0; x < 2; ++x)
+            {
+                TerrainPatch* child = CreatePatch(patch, patch, level - 1, texelOffset + IntVector2(x, z) * (half * step));
+                child->SetPosition(Vector3((float)(x * half), 0.0f, (float)(z * half)));
+                child->SetScale(Vector3(0.5f, 1.0f, 0.5f));
+                terrainBox.Merge(child->TerrainBoundingBox());
+            }
+        }
+    }
+    else
+    {
+        for (int z = texelOffset.y; z <= texelOffset.y + patchSize; ++z)
+        {
+            for (int x = texelOffset.x; x <= texelOffset.x + patchSize; ++x)
+                terrainBox.Merge(TexelPosition(x, z));
+        }
+    }
+
+    patch->Define(this, parentPatch, level, texelOffset, terrainBox);
+    return patch;
+}
+
+void Terrain::RemovePatches()
+{
+    // Removing the root removes the other levels too
+    TerrainPatch* root = patches.size() ? patches[0].Get() : nullptr;
+    if (root)
+        root->RemoveSelf();
+
+    patches.clear();
+}
+
+void Terrain::UpdateMaterial()
+{
+    std::string vsDefines;
+    std::string psDefines;
+    // A defined virtual texture replaces the diffuse texture in the material
+    if (virtualTexture && virtualTexture->CacheTexture())
+    {
+        material->SetTexture(0, virtualTexture->CacheTexture());
+        material->SetTexture(2, virtualTexture->PageTableTexture());
+        vsDefines = "VIRTUALTEXTURE";
+        psDefines = "VIRTUALTEXTURE";
+    }
+    else
+    {
+        material->SetTexture(0, diffuseTexture);
+        material->SetTexture(2, nullptr);
+        vsDefines = "UVREPEAT=" + std::to_string(textureRepeat);
+        if (diffuseTexture)
+        {
+            vsDefines += " DIFFUSEMAP";
+            psDefines = "DIFFUSEMAP";
+        }
+    }
+
+    Pass* pass = material->CreatePass(PASS_OPAQUE);
+    pass->SetShader(Subsystem<ResourceCache>()->LoadResource<Shader>("Shaders/Terrain.glsl"), vsDefines, psDefines);
+    SourceBatches::MarkChanged();
+}
+
+void Terrain::RaycastPatch(TerrainPatch* patch, const Ray& ray, float& closest, Vector3& normal) const
+{
+    if (ray.HitDistance(patch->TerrainBoundingBox()) >= closest)
+        return;
+
+    if (patch->Level() > 0)
+    {
+        const std::vector<SharedPtr<Node> >& children = patch->Children();
+        for (auto it = children.begin(); it != children.end(); ++it)
+        {
+            if ((*it)->Type() == TerrainPatch::TypeStatic())
+                RaycastPatch(static_cast<TerrainPatch*>(it->Get()), ray, closest, normal);
+        }
+        return;
+    }
+
+    const IntVector2& offset = patch->TexelOffset();
+    for (int z = offset.y; z < offset.y + patchSize; ++z)
+    {
+        for (int x = offset.x; x < offset.x + patchSize; ++x)
+        {
+            Vector3 v00 = TexelPosition(x, z);
+            Vector3 v10 = TexelPosition(x + 1, z);
+            Vector3 v01 = TexelPosition(x, z + 1);
+            Vector3 v11 = TexelPosition(x + 1, z + 1);
+            Vector3 hitNormal;
+
+            float distance = ray.HitDistance(v00, v01, v11, &hitNormal);
+            if (distance < closest)
+            {
+                closest = distance;
+                normal = hitNormal;
+            }
+            distance = ray.HitDistance(v00, v11, v10, &hitNormal);
+            if (distance < closest)
+            {
+                closest = distance;
+                normal = hitNormal;
+            }
+        }
+    }
+}
+
+Vector3 Terrain::TexelPosition(int x, int z) const
+{
+    x = Clamp(x, 0, size - 1);
+    z = Clamp(z, 0, size - 1);
+    return Vector3(boundingBox.min.x + x * spacing.x, heights[z * size + x], boundingBox.min.z + z * spacing.z);
+}
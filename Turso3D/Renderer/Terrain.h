@@ -0,0 +1,197 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "GeometryNode.h"
+
+class Image;
+class Terrain;
+class Texture;
+class VirtualTexture;
+
+/// Default number of quads along a terrain patch edge.
+static const int DEFAULT_TERRAIN_PATCH_SIZE = 32;
+/// Fraction of a terrain LOD range after which the vertices start morphing toward the next coarser level. Must match MORPH_START in Terrain.glsl.
+static const float TERRAIN_MORPH_START = 0.75f;
+/// Minimum LOD range of the most detailed level in leaf patch sizes. With the morph start above, this keeps neighbouring patches within one level of each other and their edges fully morphed to the same grid.
+static const float TERRAIN_MIN_LOD_RANGE = 6.0f;
+
+/// Quadtree node of a terrain, which renders a square area of the heightmap with the terrain's shared grid geometry, scaled to its level of detail. Created by Terrain as temporary child nodes, with the patches of each level being children of the coarser level.
+class TerrainPatch : public GeometryNode
+{
+    OBJECT(TerrainPatch);
+
+public:
+    /// Construct.
+    TerrainPatch();
+    /// Destruct.
+    ~TerrainPatch();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Prepare object for rendering. Return true only if the camera is close enough for the parent patch to be subdivided, but not this patch. Called by Renderer, possibly several times per view in different threads.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Perform ray test. Does nothing, as the terrain tests its heightfield instead.
+    void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
+
+    /// Set the owning terrain, the parent patch, the quadtree level where 0 is the most detailed, the heightmap texel offset, and the terrain space bounding box.
+    void Define(Terrain* terrain, TerrainPatch* parentPatch, int level, const IntVector2& texelOffset, const BoundingBox& terrainBox);
+
+    /// Return geometry type.
+    GeometryType GetGeometryType() const override { return GEOM_CUSTOM; }
+    /// Return per-object shader data, which holds the heightmap texel offset, the texel step of the grid and the world space LOD range.
+    Vector4 InstanceData() const override;
+    /// Return whether the camera is close enough to render the child patches instead.
+    bool IsSubdivided(Camera* camera) const;
+    /// Return quadtree level.
+    int Level() const { return level; }
+    /// Return heightmap texel offset.
+    const IntVector2& TexelOffset() const { return texelOffset; }
+    /// Return bounding box in terrain space.
+    const BoundingBox& TerrainBoundingBox() const { return terrainBox; }
+
+protected:
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Return the local space bounding box in grid units.
+    const BoundingBox* LocalBoundingBox() const override { return &boundingBox; }
+
+private:
+    /// Owning terrain.
+    WeakPtr<Terrain> terrain;
+    /// Parent patch, or null for the root.
+    TerrainPatch* parentPatch;
+    /// Local space bounding box in grid units.
+    BoundingBox boundingBox;
+    /// Bounding box in terrain space.
+    BoundingBox terrainBox;
+    /// Heightmap texel offset.
+    IntVector2 texelOffset;
+    /// Quadtree level.
+    int level;
+};
+
+/// %Scene node that renders a heightmap with continuous distance-dependent LOD (CDLOD.) The heightmap is divided into a quadtree of patches, which are culled in the octree and selected per camera, so they also cast shadows from their own LOD for each shadow camera. The vertex shader reads the heights from a texture and morphs the vertices toward the coarser level before each LOD transition. All selected patches share the grid geometry and render with one instanced draw call.
+class Terrain : public GeometryNode
+{
+    OBJECT(Terrain);
+
+public:
+    /// Construct.
+    Terrain();
+    /// Destruct.
+    ~Terrain();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Prepare object for rendering. Return false, as the patches render instead.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Perform ray test on the heightfield and add possible hit to the result vector.
+    void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
+    /// Set whether the patches cast shadows.
+    void SetCastShadows(bool enable) override;
+
+    /// Set heightmap image. Must be square, with a size of a power of two plus one, and at least the patch size plus one. Images with one component use it as the height, and with three or four the red and green channels as its high and low byte. Return true on success.
+    bool SetHeightMap(Image* image);
+    /// Set distance between heightmap texels on the X and Z axes, and the height of the maximum heightmap value on the Y axis.
+    void SetSpacing(const Vector3& spacing);
+    /// Set number of quads along a patch edge. Must be a power of two from 4 to 128.
+    void SetPatchSize(int size);
+    /// Set distance within which the most detailed level is used, in terrain space. Each coarser level doubles it. Raised to at least TERRAIN_MIN_LOD_RANGE leaf patch sizes.
+    void SetLodDistance(float distance);
+    /// Set diffuse texture. Null renders the material color only.
+    void SetTexture(Texture* texture);
+    /// Set how many times the diffuse texture repeats across the terrain.
+    void SetTextureRepeat(float repeat);
+    /// Set virtual texture that covers the terrain once, replacing the diffuse texture. Should be defined before setting. Null restores the diffuse texture. Its feedback and update are the application's responsibility.
+    void SetVirtualTexture(VirtualTexture* texture);
+
+    /// Return the terrain surface height in world space at a world position, or the terrain's world position height outside.
+    float GetHeight(const Vector3& worldPosition) const;
+    /// Return heightmap image.
+    Image* HeightMap() const { return heightMap.Get(); }
+    /// Return spacing.
+    const Vector3& Spacing() const { return spacing; }
+    /// Return number of quads along a patch edge.
+    int PatchSize() const { return patchSize; }
+    /// Return distance of the most detailed level.
+    float LodDistance() const { return lodDistance; }
+    /// Return diffuse texture.
+    Texture* GetTexture() const;
+    /// Return virtual texture.
+    VirtualTexture* GetVirtualTexture() const;
+    /// Return texture repeat.
+    float TextureRepeat() const { return textureRepeat; }
+    /// Return heightmap size in texels along an edge, or 0 if not set.
+    int Size() const { return size; }
+    /// Return number of quadtree levels.
+    int NumLevels() const { return numLevels; }
+    /// Return number of patches in all levels.
+    size_t NumPatches() const { return patches.size(); }
+    /// Return patch by index. The root is first.
+    TerrainPatch* Patch(size_t index) const { return index < patches.size() ? patches[index].Get() : nullptr; }
+    /// Return the world space range of a quadtree level, beyond which its patches have fully morphed to the next coarser level.
+    float LodRange(int level) const;
+
+protected:
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Return the local space bounding box.
+    const BoundingBox* LocalBoundingBox() const override;
+
+private:
+    /// Set heightmap. Used in serialization.
+    void SetHeightMapAttr(const ResourceRef& image);
+    /// Return heightmap. Used in serialization.
+    ResourceRef HeightMapAttr() const;
+    /// Set texture. Used in serialization.
+    void SetTextureAttr(const ResourceRef& texture);
+    /// Return texture. Used in serialization.
+    ResourceRef TextureAttr() const;
+    /// Read the heights from the heightmap image and create the height texture, grid geometry and patches. Return true on success.
+    bool CreateTerrain();
+    /// Create a patch and its children recursively, and return it.
+    TerrainPatch* CreatePatch(SpatialNode* parent, TerrainPatch* parentPatch, int level, const IntVector2& texelOffset);
+    /// Remove the patches.
+    void RemovePatches();
+    /// Update the shader defines of the material.
+    void UpdateMaterial();
+    /// Test a ray in terrain space against a patch and its children, and update the closest hit distance and normal.
+    void RaycastPatch(TerrainPatch* patch, const Ray& ray, float& closest, Vector3& normal) const;
+    /// Return terrain space position of a heightmap texel, clamped to the edges.
+    Vector3 TexelPosition(int x, int z) const;
+
+    /// Heightmap image.
+    SharedPtr<Image> heightMap;
+    /// Terrain material, holding the diffuse or virtual texture and the height texture.
+    SharedPtr<Material> material;
+    /// Diffuse texture.
+    SharedPtr<Texture> diffuseTexture;
+    /// Virtual texture.
+    SharedPtr<VirtualTexture> virtualTexture;
+    /// Grid geometry shared by the patches.
+    SharedPtr<Geometry> geometry;
+    /// Height texture.
+    SharedPtr<Texture> heightTexture;
+    /// Patches of all levels, the root first.
+    std::vector<WeakPtr<TerrainPatch> > patches;
+    /// Heights in terrain space.
+    std::vector<float> heights;
+    /// Local space bounding box.
+    BoundingBox boundingBox;
+    /// Texel spacing and maximum height.
+    Vector3 spacing;
+    /// Heightmap size along an edge.
+    int size;
+    /// Quads along a patch edge.
+    int patchSize;
+    /// Number of quadtree levels.
+    int numLevels;
+    /// Distance of the most detailed level.
+    float lodDistance;
+    /// Diffuse texture repeat.
+    float textureRepeat;
+};
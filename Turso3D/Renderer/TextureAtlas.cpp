@@ -0,0 +1,306 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Log.h"
+#include "../IO/StringUtils.h"
+#include "../Math/AreaAllocator.h"
+#include "../Resource/Image.h"
+#include "../Resource/ResourceCache.h"
+#include "../Scene/Node.h"
+#include "../Time/Profiler.h"
+#include "Material.h"
+#include "StaticModel.h"
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <cstring>
+
+/// Sort atlas entries by height and then width, largest first, for tighter packing.
+static bool CompareEntrySize(const AtlasEntry* lhs, const AtlasEntry* rhs)
+{
+    return lhs->size.y != rhs->size.y ? lhs->size.y > rhs->size.y : lhs->size.x > rhs->size.x;
+}
+
+TextureAtlas::TextureAtlas(int maxTextureSize_, int pageSize_) :
+    maxTextureSize(Max(maxTextureSize_, 1)),
+    pageSize(Max(pageSize_, maxTextureSize_ + 2 * ATLAS_PADDING))
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+}
+
+bool TextureAtlas::AddMaterial(Material* material)
+{
+    Texture* texture = material ? material->GetTexture(0) : nullptr;
+    if (!texture || texture->TexType() != TEX_2D || texture->Width() > maxTextureSize || texture->Height() > maxTextureSize ||
+        texture->Name().empty())
+        return false;
+
+    if (std::find(materials.begin(), materials.end(), material) == materials.end())
+        materials.push_back(SharedPtr<Material>(material));
+    return true;
+}
+
+bool TextureAtlas::Build()
+{
+    PROFILE(BuildTextureAtlas);
+
+    // Load each distinct texture once
+    std::map<Texture*, AtlasEntry> entries;
+    for (auto it = materials.begin(); it != materials.end(); ++it)
+    {
+        Texture* texture = (*it)->GetTexture(0);
+        if (entries.find(texture) == entries.end() && !LoadEntry(texture, entries[texture]))
+            entries.erase(texture);
+    }
+
+    std::vector<AtlasEntry*> sortedEntries;
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+        sortedEntries.push_back(&it->second);
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareEntrySize);
+
+    // Pack into the first page with room, starting a new page when none has
+    std::vector<AreaAllocator> allocators;
+    for (auto it = sortedEntries.begin(); it != sortedEntries.end(); ++it)
+    {
+        AtlasEntry& entry = **it;
+        int width = entry.size.x + 2 * ATLAS_PADDING;
+        int height = entry.size.y + 2 * ATLAS_PADDING;
+        int x, y;
+        size_t i = 0;
+        for (; i < allocators.size(); ++i)
+        {
+            if (allocators[i].Allocate(width, height, x, y))
+                break;
+        }
+        if (i == allocators.size())
+        {
+            allocators.push_back(AreaAllocator(pageSize, pageSize, false));
+            allocators.back().Allocate(width, height, x, y);
+        }
+
+        entry.page = i;
+        entry.position = IntVector2(x + ATLAS_PADDING, y + ATLAS_PADDING);
+    }
+
+    // Copy the textures into the page images with their gutters wrapped, as if the textures repeated
+    std::vector<SharedPtr<Image> > pageImages;
+    for (size_t i = 0; i < allocators.size(); ++i)
+    {
+        SharedPtr<Image> image(new Image());
+        image->SetReserveMipChain(true);
+        image->SetSize(IntVector2(pageSize, pageSize), FMT_RGBA8);
+        memset(image->Data(), 0, (size_t)pageSize * pageSize * 4);
+        pageImages.push_back(image);
+    }
+
+    for (auto it = sortedEntries.begin(); it != sortedEntries.end(); ++it)
+    {
+        const AtlasEntry& entry = **it;
+        unsigned char* pageData = pageImages[entry.page]->Data();
+        const IntVector2& size = entry.size;
+
+        for (int y = -ATLAS_PADDING; y < size.y + ATLAS_PADDING; ++y)
+        {
+            int sy = (y + size.y * ATLAS_PADDING) % size.y;
+            unsigned char* dest = pageData + ((size_t)(entry.position.y + y) * pageSize + entry.position.x - ATLAS_PADDING) * 4;
+            for (int x = -ATLAS_PADDING; x < size.x + ATLAS_PADDING; ++x, dest += 4)
+            {
+                int sx = (x + size.x * ATLAS_PADDING) % size.x;
+                memcpy(dest, &entry.data[((size_t)sy * size.x + sx) * 4], 4);
+            }
+        }
+    }
+
+    pages.clear();
+    for (auto it = pageImages.begin(); it != pageImages.end(); ++it)
+    {
+        Image* image = *it;
+        image->GenerateMipChain();
+
+        std::vector<ImageLevel> levels;
+        for (size_t i = 0; i < ATLAS_NUM_LEVELS && i < image->NumLevels(); ++i)
+            levels.push_back(image->Level(i));
+
+        SharedPtr<Texture> page(new Texture());
+        page->SetName("AtlasPage" + std::to_string(pages.size()));
+        page->Define(TEX_2D, image->Size2D(), FMT_RGBA8, 1, levels.size(), &levels[0]);
+        page->DefineSampler(FILTER_TRILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        pages.push_back(page);
+    }
+
+    // Replace the materials with instances that hold their texture rectangles
+    instances.clear();
+    Vector2 invPageSize(1.0f / (float)pageSize, 1.0f / (float)pageSize);
+    for (auto it = materials.begin(); it != materials.end(); ++it)
+    {
+        Material* material = *it;
+        auto entryIt = entries.find(material->GetTexture(0));
+        if (entryIt == entries.end())
+            continue;
+
+        const AtlasEntry& entry = entryIt->second;
+        Vector4 rect((float)entry.size.x * invPageSize.x, (float)entry.size.y * invPageSize.y, (float)entry.position.x * invPageSize.x,
+            (float)entry.position.y * invPageSize.y);
+        instances[material] = new MaterialInstance(AtlasMaterial(material, entry.page), rect);
+    }
+
+    LOGINFOF("Atlased %d textures of %d materials into %d pages with %d materials", (int)entries.size(), (int)instances.size(),
+        (int)pages.size(), (int)atlasMaterials.size());
+
+    return !instances.empty();
+}
+
+size_t TextureAtlas::Apply(Node* root) const
+{
+    if (!root || instances.empty())
+        return 0;
+
+    std::vector<Node*> models;
+    root->FindChildren(models, StaticModel::TypeStatic(), true);
+    size_t numChanged = 0;
+
+    for (auto it = models.begin(); it != models.end(); ++it)
+    {
+        StaticModel* model = static_cast<StaticModel*>(*it);
+        if (!model->NumGeometries() || model->GetMaterialInstance())
+            continue;
+
+        // An instance applies to all geometries, so they must share the material
+        Material* material = model->GetMaterial(0);
+        bool sameMaterial = true;
+        for (size_t i = 1; i < model->NumGeometries(); ++i)
+        {
+            if (model->GetMaterial(i) != material)
+            {
+                sameMaterial = false;
+                break;
+            }
+        }
+
+        MaterialInstance* instance = sameMaterial ? Instance(material) : nullptr;
+        if (instance)
+        {
+            model->SetMaterialInstance(instance);
+            ++numChanged;
+        }
+    }
+
+    return numChanged;
+}
+
+MaterialInstance* TextureAtlas::Instance(Material* material) const
+{
+    auto it = instances.find(material);
+    return it != instances.end() ? it->second.Get() : nullptr;
+}
+
+bool TextureAtlas::LoadEntry(Texture* texture, AtlasEntry& entry) const
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    AutoPtr<Stream> stream = cache ? cache->OpenResource(texture->Name()) : nullptr;
+    SharedPtr<Image> image(new Image());
+    if (!stream || !image->Load(*stream))
+    {
+        LOGWARNING("Could not read image of " + texture->Name() + " for atlasing");
+        return false;
+    }
+
+    entry.size = image->Size2D();
+    if (entry.size.x > maxTextureSize || entry.size.y > maxTextureSize || image->Depth() > 1)
+        return false;
+    entry.data.resize((size_t)entry.size.x * entry.size.y * 4);
+
+    if (image->IsCompressed())
+        return image->DecompressLevel(&entry.data[0], 0);
+
+    // Expand 8-bit formats with fewer components, replicating luminance and adding opaque alpha
+    int components = image->Components();
+    if (image->PixelByteSize() != (size_t)components)
+    {
+        LOGWARNING("Unsupported image format in " + texture->Name() + " for atlasing");
+        return false;
+    }
+
+    const unsigned char* src = image->Data();
+    unsigned char* dest = &entry.data[0];
+    for (size_t i = 0; i < (size_t)entry.size.x * entry.size.y; ++i, src += components, dest += 4)
+    {
+        switch (components)
+        {
+        case 1:
+            dest[0] = dest[1] = dest[2] = src[0];
+            dest[3] = 255;
+            break;
+
+        case 2:
+            dest[0] = dest[1] = dest[2] = src[0];
+            dest[3] = src[1];
+            break;
+
+        case 3:
+            dest[0] = src[0];
+            dest[1] = src[1];
+            dest[2] = src[2];
+            dest[3] = 255;
+            break;
+
+        default:
+            memcpy(dest, src, 4);
+            break;
+        }
+    }
+
+    return true;
+}
+
+Material* TextureAtlas::AtlasMaterial(Material* material, size_t page)
+{
+    // Materials share an atlas material if everything else than the diffuse texture matches
+    std::string signature = material->VSDefines() + "|" + material->FSDefines() + "|" + std::to_string((int)material->GetCullMode());
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        Pass* pass = material->GetPass((PassType)i);
+        if (pass)
+        {
+            signature += "|" + std::to_string((size_t)pass->GetShader()) + " " + pass->VSDefines() + " " + pass->FSDefines() + " " +
+                std::to_string(pass->RenderStateKey());
+        }
+        else
+            signature += "|";
+    }
+    for (size_t i = 1; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+        signature += "|" + std::to_string((size_t)material->GetTexture(i));
+    const std::map<PresetUniform, Vector4>& uniforms = material->UniformValues();
+    for (auto it = uniforms.begin(); it != uniforms.end(); ++it)
+        signature += "|" + std::to_string((int)it->first) + " " + it->second.ToString();
+
+    SharedPtr<Material>& atlasMaterial = atlasMaterials[std::make_pair(signature, page)];
+    if (!atlasMaterial)
+    {
+        atlasMaterial = new Material();
+        atlasMaterial->SetName(material->Name() + "_Atlas" + std::to_string(page));
+        for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+        {
+            Pass* pass = material->GetPass((PassType)i);
+            if (!pass)
+                continue;
+
+            Pass* newPass = atlasMaterial->CreatePass((PassType)i);
+            newPass->SetShader(pass->GetShader(), Trim(pass->VSDefines()), Trim(pass->FSDefines()));
+            newPass->SetRenderState(pass->GetBlendMode(), pass->GetDepthTest(), pass->GetColorWrite(), pass->GetDepthWrite());
+        }
+
+        atlasMaterial->SetShaderDefines(Trim(material->VSDefines() + " ATLAS"), Trim(material->FSDefines() + " ATLAS"));
+        atlasMaterial->SetCullMode(material->GetCullMode());
+        atlasMaterial->SetTexture(0, pages[page]);
+        for (size_t i = 1; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+            atlasMaterial->SetTexture(i, material->GetTexture(i));
+        for (auto it = uniforms.begin(); it != uniforms.end(); ++it)
+            atlasMaterial->SetUniform(it->first, it->second);
+    }
+
+    return atlasMaterial;
+}
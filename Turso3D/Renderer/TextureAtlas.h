@@ -0,0 +1,90 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Object/Ptr.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+class Material;
+class MaterialInstance;
+class Node;
+class Texture;
+
+/// Default largest texture size along either axis that is atlased.
+static const int DEFAULT_ATLAS_MAX_TEXTURE_SIZE = 256;
+/// Default atlas page size.
+static const int DEFAULT_ATLAS_PAGE_SIZE = 2048;
+/// Texels of wrapped gutter around each atlased texture, so that filtering and the coarser mip levels do not read the neighbours.
+static const int ATLAS_PADDING = 8;
+/// Number of mip levels in an atlas page. The coarsest level still has one texel of gutter.
+static const size_t ATLAS_NUM_LEVELS = 4;
+
+/// Atlased texture and its location.
+struct AtlasEntry
+{
+    /// Construct.
+    AtlasEntry() :
+        page(0)
+    {
+    }
+
+    /// RGBA8 pixel data.
+    std::vector<unsigned char> data;
+    /// Size in texels.
+    IntVector2 size;
+    /// Position in the page, excluding the gutter.
+    IntVector2 position;
+    /// Page index.
+    size_t page;
+};
+
+/// Load-time builder that packs the small diffuse textures of materials into shared atlas pages. Each atlased material is replaced by a material instance of an atlas material, which holds the atlas page and whose shaders read the texture's rectangle in the page from the instance data. Materials that differ only by their diffuse texture then share an atlas material, so the objects using them are sorted together and instanced into the same draw calls without texture rebinds. The pass shaders must support the ATLAS define like Diffuse.glsl, which wraps the texture coordinates inside the rectangle, so repeating textures still work.
+class TextureAtlas : public RefCounted
+{
+public:
+    /// Construct with the largest texture size to atlas and the page size.
+    TextureAtlas(int maxTextureSize = DEFAULT_ATLAS_MAX_TEXTURE_SIZE, int pageSize = DEFAULT_ATLAS_PAGE_SIZE);
+    /// Destruct.
+    ~TextureAtlas();
+
+    /// Add a material whose diffuse texture should be atlased. Return false if it has no small 2D diffuse texture.
+    bool AddMaterial(Material* material);
+    /// Load the images of the added materials' textures, pack them into pages and create the atlas materials and instances. Textures whose image can not be read as RGBA8 are left out. Return true if any material was atlased.
+    bool Build();
+    /// Replace the materials of static models in a node hierarchy with their atlas instances. Models with several different materials or an instance already are left as is. Return number of models changed.
+    size_t Apply(Node* root) const;
+
+    /// Return the atlas instance that replaces a material, or null if not atlased.
+    MaterialInstance* Instance(Material* material) const;
+    /// Return number of atlas pages.
+    size_t NumPages() const { return pages.size(); }
+    /// Return atlas page texture by index.
+    Texture* Page(size_t index) const { return index < pages.size() ? pages[index].Get() : nullptr; }
+    /// Return number of atlas materials.
+    size_t NumAtlasMaterials() const { return atlasMaterials.size(); }
+    /// Return number of atlased materials.
+    size_t NumInstances() const { return instances.size(); }
+
+private:
+    /// Read a texture's image as RGBA8 into an entry. Return true on success.
+    bool LoadEntry(Texture* texture, AtlasEntry& entry) const;
+    /// Return the atlas material for a material's passes and parameters on a page, creating it if necessary.
+    Material* AtlasMaterial(Material* material, size_t page);
+
+    /// Materials to atlas.
+    std::vector<SharedPtr<Material> > materials;
+    /// Atlas page textures.
+    std::vector<SharedPtr<Texture> > pages;
+    /// Atlas materials by the material signature and page index.
+    std::map<std::pair<std::string, size_t>, SharedPtr<Material> > atlasMaterials;
+    /// Atlas instances by the original material.
+    std::map<Material*, SharedPtr<MaterialInstance> > instances;
+    /// Largest texture size to atlas.
+    int maxTextureSize;
+    /// Page size.
+    int pageSize;
+};
@@ -0,0 +1,230 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Log.h"
+#include "../IO/Stream.h"
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "../Time/Timer.h"
+#include "TextureStreamer.h"
+
+#include <algorithm>
+
+/// Sort streamed textures by last use frame, least recently used first.
+static bool CompareLastUse(const StreamedTexture* lhs, const StreamedTexture* rhs)
+{
+    return lhs->lastUseFrame < rhs->lastUseFrame;
+}
+
+TextureStreamTask::TextureStreamTask(Texture* texture_, size_t level_, size_t dataSize_) :
+    texture(texture_),
+    level(level_),
+    dataSize(dataSize_),
+    counter(0),
+    success(false)
+{
+}
+
+void TextureStreamTask::Complete(unsigned)
+{
+    PROFILE(LoadTextureLevels);
+
+    success = texture->BeginLoadLevels(*stream, level);
+}
+
+TextureStreamer::TextureStreamer() :
+    budget(DEFAULT_STREAMING_BUDGET),
+    minResidentSize(DEFAULT_STREAMING_MIN_SIZE),
+    maxLoads(DEFAULT_STREAMING_MAX_LOADS),
+    residentDataSize(0),
+    frameNumber(1)
+{
+    RegisterSubsystem(this);
+    Texture::SetStreamingMinSize(minResidentSize);
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    // Let loads that are running finish before destroying the tasks
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue)
+    {
+        for (auto it = loads.begin(); it != loads.end(); ++it)
+            workQueue->Complete((*it)->counter);
+    }
+    loads.clear();
+
+    Texture::SetStreamingMinSize(0);
+    RemoveSubsystem(this);
+}
+
+void TextureStreamer::SetBudget(size_t bytes)
+{
+    budget = bytes;
+}
+
+void TextureStreamer::SetMinResidentSize(int size)
+{
+    minResidentSize = Max(size, 1);
+    Texture::SetStreamingMinSize(minResidentSize);
+}
+
+void TextureStreamer::SetMaxLoads(size_t num)
+{
+    maxLoads = std::max(num, (size_t)1);
+}
+
+void TextureStreamer::RequestLevel(Texture* texture, size_t level)
+{
+    StreamedTexture& state = textures[texture];
+
+    // The pointer may be reused by a new texture after the old one is destroyed
+    if (state.texture.Get() != texture)
+    {
+        state = StreamedTexture();
+        state.texture = texture;
+    }
+
+    if (state.lastUseFrame != frameNumber || level < state.requestedLevel)
+        state.requestedLevel = level;
+    state.lastUseFrame = frameNumber;
+}
+
+void TextureStreamer::Update(float maxMilliseconds)
+{
+    PROFILE(UpdateTextureStreaming);
+
+    HiresTimer timer;
+    long long maxUSec = (long long)(maxMilliseconds * 1000.0f);
+
+    // Upload the finished loads within the time budget
+    for (auto it = loads.begin(); it != loads.end();)
+    {
+        TextureStreamTask* task = *it;
+        if (task->counter.load() > 0)
+        {
+            ++it;
+            continue;
+        }
+        if (timer.ElapsedUSec() >= maxUSec)
+            break;
+
+        StreamedTexture& state = textures[task->texture.Get()];
+        state.loading = false;
+        if (!task->success || !task->texture->EndLoadLevels())
+            state.failed = true;
+
+        it = loads.erase(it);
+    }
+
+    // Recalculate the resident size, including the loads in progress, and forget destroyed textures
+    residentDataSize = 0;
+    for (auto it = textures.begin(); it != textures.end();)
+    {
+        Texture* texture = it->second.texture.Get();
+        if (!texture)
+        {
+            it = textures.erase(it);
+            continue;
+        }
+
+        residentDataSize += texture->ResidentDataSize();
+        ++it;
+    }
+    for (auto it = loads.begin(); it != loads.end(); ++it)
+        residentDataSize += (*it)->dataSize;
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    ResourceCache* cache = Subsystem<ResourceCache>();
+
+    // Start loads for textures that were requested with more detail than resident
+    for (auto it = textures.begin(); it != textures.end() && loads.size() < maxLoads; ++it)
+    {
+        StreamedTexture& state = it->second;
+        Texture* texture = state.texture.Get();
+        if (state.lastUseFrame != frameNumber || state.loading || state.failed || !texture->IsStreamable())
+            continue;
+
+        size_t residentLevel = texture->ResidentLevel();
+        size_t level = state.requestedLevel;
+        if (level >= residentLevel)
+            continue;
+
+        size_t dataSize = 0;
+        for (size_t i = level; i < residentLevel; ++i)
+            dataSize += texture->LevelDataSize(i);
+
+        // If the budget does not allow, load less detail
+        while (!MakeRoom(dataSize) && level < residentLevel)
+        {
+            dataSize -= texture->LevelDataSize(level);
+            ++level;
+        }
+        if (level >= residentLevel)
+            continue;
+
+        AutoPtr<TextureStreamTask> task = new TextureStreamTask(texture, level, dataSize);
+        task->stream = cache ? cache->OpenResource(texture->Name()) : nullptr;
+        if (!task->stream)
+        {
+            LOGERROR("Could not open " + texture->Name() + " for streaming");
+            state.failed = true;
+            continue;
+        }
+
+        state.loading = true;
+        residentDataSize += dataSize;
+
+        if (workQueue)
+            workQueue->QueueTask(task, &task->counter);
+        else
+            task->Complete(0);
+
+        loads.push_back(task);
+    }
+
+    ++frameNumber;
+}
+
+bool TextureStreamer::MakeRoom(size_t dataSize)
+{
+    if (residentDataSize + dataSize <= budget)
+        return true;
+
+    std::vector<StreamedTexture*> unused;
+    std::vector<StreamedTexture*> used;
+    for (auto it = textures.begin(); it != textures.end(); ++it)
+    {
+        StreamedTexture& state = it->second;
+        Texture* texture = state.texture.Get();
+        if (!texture || state.loading || !texture->IsStreamable())
+            continue;
+
+        if (state.lastUseFrame != frameNumber)
+        {
+            if (texture->ResidentLevel() < texture->StreamLevel())
+                unused.push_back(&state);
+        }
+        else if (texture->ResidentLevel() < state.requestedLevel)
+            used.push_back(&state);
+    }
+
+    std::sort(unused.begin(), unused.end(), CompareLastUse);
+
+    for (auto it = unused.begin(); it != unused.end() && residentDataSize + dataSize > budget; ++it)
+    {
+        Texture* texture = (*it)->texture.Get();
+        ReleaseLevels(texture, texture->StreamLevel());
+    }
+    for (auto it = used.begin(); it != used.end() && residentDataSize + dataSize > budget; ++it)
+        ReleaseLevels((*it)->texture.Get(), (*it)->requestedLevel);
+
+    return residentDataSize + dataSize <= budget;
+}
+
+void TextureStreamer::ReleaseLevels(Texture* texture, size_t level)
+{
+    size_t oldDataSize = texture->ResidentDataSize();
+    texture->ReleaseLevels(level);
+    residentDataSize -= oldDataSize - texture->ResidentDataSize();
+}
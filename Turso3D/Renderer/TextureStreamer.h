@@ -0,0 +1,124 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Object.h"
+#include "../Thread/WorkQueue.h"
+
+#include <map>
+
+class Stream;
+class Texture;
+
+/// Default GPU memory budget for streamed textures in bytes.
+static const size_t DEFAULT_STREAMING_BUDGET = 256 * 1024 * 1024;
+/// Default largest mip level size resident on load for streamed textures.
+static const int DEFAULT_STREAMING_MIN_SIZE = 64;
+/// Default maximum number of mip level loads in progress.
+static const size_t DEFAULT_STREAMING_MAX_LOADS = 4;
+
+/// %Task for loading more detailed mip levels of a streamed texture in the background.
+class TextureStreamTask : public Task
+{
+public:
+    /// Construct.
+    TextureStreamTask(Texture* texture, size_t level, size_t dataSize);
+
+    /// Run BeginLoadLevels() of the texture.
+    void Complete(unsigned threadIndex) override;
+
+    /// %Texture being streamed.
+    SharedPtr<Texture> texture;
+    /// Source stream.
+    AutoPtr<Stream> stream;
+    /// Most detailed level to load.
+    size_t level;
+    /// GPU memory the new levels will take.
+    size_t dataSize;
+    /// Completion counter, nonzero while the load is queued or running.
+    TaskCounter counter;
+    /// BeginLoadLevels() result.
+    bool success;
+};
+
+/// Streaming state of a texture.
+struct StreamedTexture
+{
+    /// Construct.
+    StreamedTexture() :
+        requestedLevel(0),
+        lastUseFrame(0),
+        loading(false),
+        failed(false)
+    {
+    }
+
+    /// %Texture.
+    WeakPtr<Texture> texture;
+    /// Most detailed level requested on the last frame used.
+    size_t requestedLevel;
+    /// Frame number when last used.
+    unsigned lastUseFrame;
+    /// Whether a load is in progress.
+    bool loading;
+    /// Whether loading has failed, in which case it is not retried.
+    bool failed;
+};
+
+/// %Texture streaming subsystem. Loads the mip levels of streamed textures that the renderer requests based on screen size, under a GPU memory budget with least recently used eviction.
+class TextureStreamer : public Object
+{
+    OBJECT(TextureStreamer);
+
+public:
+    /// Construct and register subsystem. Enables streaming for textures loaded afterward.
+    TextureStreamer();
+    /// Destruct. Wait for loads in progress and disable streaming.
+    ~TextureStreamer();
+
+    /// Set GPU memory budget for streamed textures in bytes.
+    void SetBudget(size_t bytes);
+    /// Set the largest mip level size resident on load for textures loaded afterward.
+    void SetMinResidentSize(int size);
+    /// Set maximum number of mip level loads in progress.
+    void SetMaxLoads(size_t num);
+    /// Request a mip level of a streamed texture for the current frame. Called by the renderer from the main thread.
+    void RequestLevel(Texture* texture, size_t level);
+    /// Finish loads within the time budget, start loads for the levels requested on the last frame and release least recently used levels when over the budget. Call once per frame.
+    void Update(float maxMilliseconds);
+
+    /// Return GPU memory budget in bytes.
+    size_t Budget() const { return budget; }
+    /// Return the largest mip level size resident on load.
+    int MinResidentSize() const { return minResidentSize; }
+    /// Return maximum number of mip level loads in progress.
+    size_t MaxLoads() const { return maxLoads; }
+    /// Return GPU memory use of the streamed textures as of the last update in bytes.
+    size_t ResidentDataSize() const { return residentDataSize; }
+    /// Return number of streamed textures that have been requested.
+    size_t NumTextures() const { return textures.size(); }
+    /// Return number of mip level loads in progress.
+    size_t NumLoads() const { return loads.size(); }
+
+private:
+    /// Release levels of textures not used on the last frame in least recently used order, then levels more detailed than requested, until the given amount fits the budget. Return true if it fits.
+    bool MakeRoom(size_t dataSize);
+    /// Release levels of a texture down to a level and update the resident size.
+    void ReleaseLevels(Texture* texture, size_t level);
+
+    /// Streamed textures by pointer.
+    std::map<Texture*, StreamedTexture> textures;
+    /// Loads in progress.
+    std::vector<AutoPtr<TextureStreamTask> > loads;
+    /// GPU memory budget.
+    size_t budget;
+    /// Largest mip level size resident on load.
+    int minResidentSize;
+    /// Maximum number of loads in progress.
+    size_t maxLoads;
+    /// GPU memory use of the streamed textures, including the loads in progress.
+    size_t residentDataSize;
+    /// Frame number for the requests.
+    unsigned frameNumber;
+};
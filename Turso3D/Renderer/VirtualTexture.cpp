@@ -0,0 +1,642 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Compression.h"
+#include "../IO/Log.h"
+#include "../IO/Stream.h"
+#include "../Resource/Image.h"
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "../Time/Timer.h"
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <glew.h>
+
+/// Size of a page's RGBA8 data in bytes.
+static const size_t PAGE_DATA_SIZE = VIRTUAL_PAGE_SLOT_SIZE * VIRTUAL_PAGE_SLOT_SIZE * 4;
+
+/// Return number of levels for a virtual texture size, or 0 if the size is not supported.
+static int CalculateNumLevels(int size)
+{
+    if (size < VIRTUAL_PAGE_SIZE || !IsPowerOfTwo((unsigned)size))
+        return 0;
+
+    int numLevels = 1;
+    for (int pages = size / VIRTUAL_PAGE_SIZE; pages > 1; pages >>= 1)
+        ++numLevels;
+    return numLevels <= MAX_VIRTUAL_LEVELS ? numLevels : 0;
+}
+
+VirtualTextureSource::~VirtualTextureSource()
+{
+}
+
+VirtualTextureFile::VirtualTextureFile() :
+    size(0)
+{
+}
+
+VirtualTextureFile::~VirtualTextureFile()
+{
+}
+
+bool VirtualTextureFile::Open(const std::string& name)
+{
+    PROFILE(OpenVirtualTexture);
+
+    stream.Reset();
+    pageOffsets.clear();
+    levelStarts.clear();
+    size = 0;
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    AutoPtr<Stream> newStream = cache ? cache->OpenResource(name) : nullptr;
+    if (!newStream)
+    {
+        LOGERROR("Could not open virtual texture file " + name);
+        return false;
+    }
+
+    if (newStream->ReadFileID() != "VTEX")
+    {
+        LOGERROR(name + " is not a virtual texture file");
+        return false;
+    }
+
+    int newSize = newStream->Read<int>();
+    int pageSize = newStream->Read<int>();
+    int border = newStream->Read<int>();
+    int numLevels = CalculateNumLevels(newSize);
+    if (pageSize != VIRTUAL_PAGE_SIZE || border != VIRTUAL_PAGE_BORDER || !numLevels)
+    {
+        LOGERROR(name + " has an unsupported size or page size");
+        return false;
+    }
+
+    size_t numPages = 0;
+    for (int i = 0; i < numLevels; ++i)
+    {
+        int levelPages = (newSize / VIRTUAL_PAGE_SIZE) >> i;
+        levelStarts.push_back(numPages);
+        numPages += (size_t)levelPages * levelPages;
+    }
+
+    pageOffsets.resize(numPages + 1);
+    size_t tableSize = pageOffsets.size() * sizeof(unsigned long long);
+    if (newStream->Read(&pageOffsets[0], tableSize) != tableSize)
+    {
+        LOGERROR("Failed to read the page table of " + name);
+        pageOffsets.clear();
+        levelStarts.clear();
+        return false;
+    }
+
+    stream = newStream.Detach();
+    size = newSize;
+    return true;
+}
+
+bool VirtualTextureFile::LoadPage(int level, const IntVector2& page, unsigned char* dest)
+{
+    if (!stream || level < 0 || level >= (int)levelStarts.size())
+        return false;
+
+    int levelPages = (size / VIRTUAL_PAGE_SIZE) >> level;
+    if (page.x < 0 || page.y < 0 || page.x >= levelPages || page.y >= levelPages)
+        return false;
+
+    size_t index = levelStarts[level] + (size_t)page.y * levelPages + page.x;
+    size_t dataSize = (size_t)(pageOffsets[index + 1] - pageOffsets[index]);
+    if (!dataSize)
+        return false;
+
+    std::vector<unsigned char> compressed(dataSize);
+    {
+        MutexLock lock(streamMutex);
+        stream->Seek((size_t)pageOffsets[index]);
+        if (stream->Read(&compressed[0], dataSize) != dataSize)
+            return false;
+    }
+
+    return DecompressData(dest, PAGE_DATA_SIZE, &compressed[0], dataSize) == PAGE_DATA_SIZE;
+}
+
+bool VirtualTextureFile::Save(Stream& dest, const Image& image)
+{
+    PROFILE(SaveVirtualTexture);
+
+    int size = image.Width();
+    int numLevels = CalculateNumLevels(size);
+    if (image.Format() != FMT_RGBA8 || image.Height() != size || image.Depth() > 1 || !numLevels)
+    {
+        LOGERROR("Virtual texture image must be square RGBA8 with a power of two size of at least the page size");
+        return false;
+    }
+
+    size_t numPages = 0;
+    for (int i = 0; i < numLevels; ++i)
+    {
+        int levelPages = (size / VIRTUAL_PAGE_SIZE) >> i;
+        numPages += (size_t)levelPages * levelPages;
+    }
+
+    // Write a placeholder page table, which is rewritten once the page offsets are known
+    std::vector<unsigned long long> pageOffsets(numPages + 1);
+    size_t tableSize = pageOffsets.size() * sizeof(unsigned long long);
+    dest.WriteFileID("VTEX");
+    dest.Write(size);
+    dest.Write(VIRTUAL_PAGE_SIZE);
+    dest.Write(VIRTUAL_PAGE_BORDER);
+    size_t tableStart = dest.Position();
+    dest.Write(&pageOffsets[0], tableSize);
+
+    std::vector<unsigned char> pageData(PAGE_DATA_SIZE);
+    std::vector<unsigned char> compressed(CompressBound(PAGE_DATA_SIZE));
+    SharedPtr<Image> mipImage;
+    const Image* levelImage = &image;
+    size_t index = 0;
+
+    for (int level = 0; level < numLevels; ++level)
+    {
+        if (level)
+        {
+            SharedPtr<Image> nextImage(new Image());
+            if (!levelImage->GenerateMipImage(*nextImage.Get()))
+            {
+                LOGERROR("Failed to generate virtual texture mip level");
+                return false;
+            }
+            mipImage = nextImage;
+            levelImage = mipImage.Get();
+        }
+
+        int levelSize = size >> level;
+        int levelPages = levelSize / VIRTUAL_PAGE_SIZE;
+        const unsigned char* levelData = levelImage->Data();
+
+        for (int py = 0; py < levelPages; ++py)
+        {
+            for (int px = 0; px < levelPages; ++px)
+            {
+                // Copy the page with its borders, clamping at the texture edges
+                for (int y = 0; y < VIRTUAL_PAGE_SLOT_SIZE; ++y)
+                {
+                    int sy = Clamp(py * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER + y, 0, levelSize - 1);
+                    for (int x = 0; x < VIRTUAL_PAGE_SLOT_SIZE; ++x)
+                    {
+                        int sx = Clamp(px * VIRTUAL_PAGE_SIZE - VIRTUAL_PAGE_BORDER + x, 0, levelSize - 1);
+                        memcpy(&pageData[(y * VIRTUAL_PAGE_SLOT_SIZE + x) * 4], levelData + ((size_t)sy * levelSize + sx) * 4, 4);
+                    }
+                }
+
+                size_t compressedSize = CompressData(&compressed[0], &pageData[0], PAGE_DATA_SIZE);
+                pageOffsets[index++] = dest.Position();
+                if (dest.Write(&compressed[0], compressedSize) != compressedSize)
+                {
+                    LOGERROR("Failed to write virtual texture page");
+                    return false;
+                }
+            }
+        }
+    }
+
+    size_t end = dest.Position();
+    pageOffsets[index] = end;
+    dest.Seek(tableStart);
+    bool success = dest.Write(&pageOffsets[0], tableSize) == tableSize;
+    dest.Seek(end);
+    return success;
+}
+
+VirtualPageLoadTask::VirtualPageLoadTask(VirtualTextureSource* source_, unsigned page_) :
+    source(source_),
+    page(page_),
+    counter(0),
+    success(false)
+{
+}
+
+void VirtualPageLoadTask::Complete(unsigned)
+{
+    PROFILE(LoadVirtualPage);
+
+    data.resize(PAGE_DATA_SIZE);
+    success = source->LoadPage(VirtualTexture::PageLevel(page), VirtualTexture::PagePosition(page), &data[0]);
+}
+
+VirtualTexture::VirtualTexture() :
+    numPages(0),
+    numLevels(0),
+    cachePages(0),
+    rootSlot(-1),
+    maxLoads(DEFAULT_VIRTUAL_MAX_LOADS),
+    feedbackNumber(0),
+    newFeedback(false)
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    Release();
+}
+
+bool VirtualTexture::Define(VirtualTextureSource* source_, int cachePages_)
+{
+    PROFILE(DefineVirtualTexture);
+
+    Release();
+
+    if (!source_)
+    {
+        LOGERROR("Null virtual texture source");
+        return false;
+    }
+
+    int size = source_->Size();
+    int newNumLevels = CalculateNumLevels(size);
+    if (!newNumLevels)
+    {
+        LOGERROR("Virtual texture size must be a power of two from the page size up to " + std::to_string(VIRTUAL_PAGE_SIZE << (MAX_VIRTUAL_LEVELS - 1)));
+        return false;
+    }
+
+    source = source_;
+    numPages = size / VIRTUAL_PAGE_SIZE;
+    numLevels = newNumLevels;
+    // The page table stores the slot coordinates in 8 bits
+    cachePages = Clamp(cachePages_, 2, 256);
+
+    cacheTexture = new Texture();
+    cacheTexture->Define(TEX_2D, IntVector2(cachePages * VIRTUAL_PAGE_SLOT_SIZE, cachePages * VIRTUAL_PAGE_SLOT_SIZE), FMT_RGBA8);
+    cacheTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    pageTable.resize(numLevels);
+    pageTableDirty.resize(numLevels);
+    for (int i = 0; i < numLevels; ++i)
+    {
+        int levelPages = numPages >> i;
+        pageTable[i].assign((size_t)levelPages * levelPages, 0);
+    }
+    pageTableTexture = new Texture();
+    pageTableTexture->Define(TEX_2D, IntVector2(numPages, numPages), FMT_RGBA8, 1, numLevels);
+    pageTableTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    slots.resize(cachePages * cachePages);
+    for (int i = (int)slots.size() - 1; i >= 0; --i)
+        freeSlots.push_back(i);
+
+    // Load the coarsest page now and keep it resident, so that sampling always finds data
+    std::vector<unsigned char> data(PAGE_DATA_SIZE);
+    if (!source->LoadPage(numLevels - 1, IntVector2::ZERO, &data[0]))
+    {
+        LOGERROR("Failed to load the coarsest virtual texture page");
+        Release();
+        return false;
+    }
+    rootSlot = AllocateSlot();
+    MapPage(PageKey(numLevels - 1, IntVector2::ZERO), rootSlot, &data[0]);
+    UploadPageTable();
+
+    if (IsFeedbackSupported())
+    {
+        readback = new FrameReadback();
+        readback->SetHandler(this);
+    }
+    else
+        LOGWARNING("Image load/store not supported, virtual texture will use the coarsest page only");
+
+    return true;
+}
+
+void VirtualTexture::SetMaxLoads(size_t num)
+{
+    maxLoads = std::max(num, (size_t)1);
+}
+
+void VirtualTexture::BeginFeedback(const IntVector2& viewSize)
+{
+    if (!readback)
+        return;
+
+    IntVector2 size((viewSize.x + VIRTUAL_FEEDBACK_SCALE - 1) / VIRTUAL_FEEDBACK_SCALE, (viewSize.y + VIRTUAL_FEEDBACK_SCALE - 1) / VIRTUAL_FEEDBACK_SCALE);
+    if (size.x <= 0 || size.y <= 0)
+        return;
+
+    if (!feedbackTexture || feedbackTexture->Size2D() != size)
+    {
+        feedbackTexture = new Texture();
+        feedbackTexture->Define(TEX_2D, size, FMT_RGBA8);
+        feedbackClearData.assign((size_t)size.x * size.y * 4, 0);
+    }
+
+    // Zero means no request
+    feedbackTexture->SetData(0, IntRect(0, 0, size.x, size.y), ImageLevel(size, FMT_RGBA8, &feedbackClearData[0]));
+    feedbackTexture->BindImage(VIRTUAL_FEEDBACK_IMAGE_UNIT, 0, IMAGE_WRITE);
+}
+
+void VirtualTexture::EndFeedback()
+{
+    if (!readback || !feedbackTexture)
+        return;
+
+    Texture::UnbindImage(VIRTUAL_FEEDBACK_IMAGE_UNIT);
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+    readback->Read(feedbackTexture);
+}
+
+void VirtualTexture::Update(float maxMilliseconds)
+{
+    PROFILE(UpdateVirtualTexture);
+
+    if (!source)
+        return;
+
+    HiresTimer timer;
+    long long maxUSec = (long long)(maxMilliseconds * 1000.0f);
+
+    // Upload the finished pages within the time budget
+    for (auto it = loads.begin(); it != loads.end();)
+    {
+        VirtualPageLoadTask* task = *it;
+        if (task->counter.load() > 0)
+        {
+            ++it;
+            continue;
+        }
+        if (timer.ElapsedUSec() >= maxUSec)
+            break;
+
+        if (task->success)
+        {
+            int slot = AllocateSlot();
+            if (slot >= 0)
+                MapPage(task->page, slot, &task->data[0]);
+        }
+        else
+        {
+            LOGERROR("Failed to load virtual texture page");
+            failedPages.insert(task->page);
+        }
+
+        it = loads.erase(it);
+    }
+
+    UploadPageTable();
+
+    if (readback)
+        readback->Update();
+
+    bool hasNewFeedback = false;
+    {
+        MutexLock lock(feedbackMutex);
+        if (newFeedback)
+        {
+            requestedPages.swap(feedbackPages);
+            newFeedback = false;
+            hasNewFeedback = true;
+        }
+    }
+
+    // Mark the requested pages and their ancestors used, and collect the missing ones. The ancestors are needed for the fallback while loading
+    if (hasNewFeedback)
+    {
+        ++feedbackNumber;
+        missingPages.clear();
+
+        for (auto it = requestedPages.begin(); it != requestedPages.end(); ++it)
+        {
+            int level = PageLevel(*it);
+            IntVector2 page = PagePosition(*it);
+            if (level < 0 || level >= numLevels || page.x >= (numPages >> level) || page.y >= (numPages >> level))
+                continue;
+
+            for (; level < numLevels; ++level, page.x >>= 1, page.y >>= 1)
+            {
+                unsigned key = PageKey(level, page);
+                auto slotIt = residentPages.find(key);
+                if (slotIt != residentPages.end())
+                {
+                    VirtualPageSlot& slot = slots[slotIt->second];
+                    // If already marked, so are the ancestors
+                    if (slot.lastUse == feedbackNumber)
+                        break;
+                    slot.lastUse = feedbackNumber;
+                }
+                else
+                    missingPages.push_back(key);
+            }
+        }
+
+        // The level is in the highest bits of the key, so sorting in descending order puts the coarsest pages first
+        std::sort(missingPages.begin(), missingPages.end(), std::greater<unsigned>());
+        missingPages.erase(std::unique(missingPages.begin(), missingPages.end()), missingPages.end());
+    }
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+
+    // Start loads for the missing pages
+    for (auto it = missingPages.begin(); it != missingPages.end() && loads.size() < maxLoads; ++it)
+    {
+        unsigned key = *it;
+        if (residentPages.find(key) != residentPages.end() || failedPages.find(key) != failedPages.end())
+            continue;
+
+        bool loading = false;
+        for (auto loadIt = loads.begin(); loadIt != loads.end(); ++loadIt)
+        {
+            if ((*loadIt)->page == key)
+            {
+                loading = true;
+                break;
+            }
+        }
+        if (loading)
+            continue;
+
+        AutoPtr<VirtualPageLoadTask> task = new VirtualPageLoadTask(source, key);
+        if (workQueue)
+            workQueue->QueueTask(task, &task->counter);
+        else
+            task->Complete(0);
+
+        loads.push_back(task);
+    }
+}
+
+void VirtualTexture::OnReadback(const ReadbackData& data)
+{
+    PROFILE(ProcessVirtualTextureFeedback);
+
+    std::vector<unsigned> pages;
+    unsigned lastKey = 0;
+
+    for (int y = 0; y < data.size.y; ++y)
+    {
+        const unsigned char* texel = data.data + y * data.rowSize;
+        for (int x = 0; x < data.size.x; ++x, texel += 4)
+        {
+            unsigned key = texel[0] | (texel[1] << 8) | (texel[2] << 16) | ((unsigned)texel[3] << 24);
+            // Neighbouring texels often request the same page
+            if (key && key != lastKey)
+            {
+                pages.push_back(key);
+                lastKey = key;
+            }
+        }
+    }
+
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+    MutexLock lock(feedbackMutex);
+    feedbackPages.swap(pages);
+    newFeedback = true;
+}
+
+bool VirtualTexture::IsFeedbackSupported()
+{
+    return (GLEW_VERSION_4_2 || GLEW_ARB_shader_image_load_store) && glBindImageTexture && glMemoryBarrier;
+}
+
+void VirtualTexture::Release()
+{
+    // Destroying the readback waits for the handler calls in progress
+    readback.Reset();
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    if (workQueue)
+    {
+        for (auto it = loads.begin(); it != loads.end(); ++it)
+            workQueue->Complete((*it)->counter);
+    }
+    loads.clear();
+
+    source.Reset();
+    cacheTexture.Reset();
+    pageTableTexture.Reset();
+    feedbackTexture.Reset();
+    pageTable.clear();
+    pageTableDirty.clear();
+    slots.clear();
+    freeSlots.clear();
+    residentPages.clear();
+    requestedPages.clear();
+    missingPages.clear();
+    failedPages.clear();
+    feedbackPages.clear();
+    newFeedback = false;
+    numPages = 0;
+    numLevels = 0;
+    cachePages = 0;
+    rootSlot = -1;
+}
+
+int VirtualTexture::AllocateSlot()
+{
+    if (!freeSlots.empty())
+    {
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    // Evict the least recently used page. Pages requested by the latest feedback are still needed, so do not evict them
+    int oldest = -1;
+    for (int i = 0; i < (int)slots.size(); ++i)
+    {
+        if (i == rootSlot || slots[i].lastUse == feedbackNumber)
+            continue;
+        if (oldest < 0 || slots[i].lastUse < slots[oldest].lastUse)
+            oldest = i;
+    }
+
+    if (oldest >= 0)
+        UnmapPage(oldest);
+    return oldest;
+}
+
+void VirtualTexture::MapPage(unsigned page, int slot, const unsigned char* data)
+{
+    slots[slot].page = page;
+    slots[slot].lastUse = feedbackNumber;
+    residentPages[page] = slot;
+
+    IntVector2 slotPos(slot % cachePages, slot / cachePages);
+    IntRect slotRect(slotPos.x * VIRTUAL_PAGE_SLOT_SIZE, slotPos.y * VIRTUAL_PAGE_SLOT_SIZE, (slotPos.x + 1) * VIRTUAL_PAGE_SLOT_SIZE,
+        (slotPos.y + 1) * VIRTUAL_PAGE_SLOT_SIZE);
+    cacheTexture->SetData(0, slotRect, ImageLevel(IntVector2(VIRTUAL_PAGE_SLOT_SIZE, VIRTUAL_PAGE_SLOT_SIZE), FMT_RGBA8, data));
+
+    // Point the entries of the page's area on its own and the more detailed levels to the slot, unless they already have more detail resident
+    int pageLevel = PageLevel(page);
+    IntVector2 pagePos = PagePosition(page);
+    unsigned entry = (unsigned)slotPos.x | ((unsigned)slotPos.y << 8) | ((unsigned)pageLevel << 16) | 0xff000000;
+
+    for (int level = pageLevel; level >= 0; --level)
+    {
+        int scale = 1 << (pageLevel - level);
+        int levelPages = numPages >> level;
+        std::vector<unsigned>& table = pageTable[level];
+
+        for (int y = pagePos.y * scale; y < (pagePos.y + 1) * scale; ++y)
+        {
+            unsigned* row = &table[(size_t)y * levelPages];
+            for (int x = pagePos.x * scale; x < (pagePos.x + 1) * scale; ++x)
+            {
+                if (!(row[x] >> 24) || (int)((row[x] >> 16) & 0xff) >= pageLevel)
+                    row[x] = entry;
+            }
+        }
+
+        pageTableDirty[level] = true;
+    }
+}
+
+void VirtualTexture::UnmapPage(int slot)
+{
+    unsigned page = slots[slot].page;
+    residentPages.erase(page);
+    slots[slot] = VirtualPageSlot();
+
+    // Point the entries that used the page to the parent level's entry, which holds the most detailed resident ancestor. The coarsest page is never unmapped, so the parent level exists
+    int pageLevel = PageLevel(page);
+    IntVector2 pagePos = PagePosition(page);
+    const std::vector<unsigned>& parentTable = pageTable[pageLevel + 1];
+    int parentPages = numPages >> (pageLevel + 1);
+
+    for (int level = pageLevel; level >= 0; --level)
+    {
+        int scale = 1 << (pageLevel - level);
+        int parentShift = pageLevel + 1 - level;
+        int levelPages = numPages >> level;
+        std::vector<unsigned>& table = pageTable[level];
+
+        for (int y = pagePos.y * scale; y < (pagePos.y + 1) * scale; ++y)
+        {
+            unsigned* row = &table[(size_t)y * levelPages];
+            const unsigned* parentRow = &parentTable[(size_t)(y >> parentShift) * parentPages];
+            for (int x = pagePos.x * scale; x < (pagePos.x + 1) * scale; ++x)
+            {
+                if ((int)((row[x] >> 16) & 0xff) == pageLevel)
+                    row[x] = parentRow[x >> parentShift];
+            }
+        }
+
+        pageTableDirty[level] = true;
+    }
+}
+
+void VirtualTexture::UploadPageTable()
+{
+    for (int i = 0; i < numLevels; ++i)
+    {
+        if (!pageTableDirty[i])
+            continue;
+
+        int levelPages = numPages >> i;
+        pageTableTexture->SetData(i, IntRect(0, 0, levelPages, levelPages), ImageLevel(IntVector2(levelPages, levelPages), FMT_RGBA8,
+            &pageTable[i][0]));
+        pageTableDirty[i] = false;
+    }
+}
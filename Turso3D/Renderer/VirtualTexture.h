@@ -0,0 +1,228 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Graphics/FrameReadback.h"
+#include "../Math/IntVector2.h"
+#include "../Math/Math.h"
+#include "../Object/Ptr.h"
+#include "../Thread/Mutex.h"
+
+#include <map>
+#include <set>
+
+class Image;
+class Stream;
+class Texture;
+
+/// Size of a virtual texture page in texels, excluding the border. Must match VT_PAGE_SIZE in VirtualTexture.glsl.
+static const int VIRTUAL_PAGE_SIZE = 128;
+/// Border texels on each side of a page, so that bilinear filtering does not reach the neighbouring slots. Must match VT_PAGE_BORDER in VirtualTexture.glsl.
+static const int VIRTUAL_PAGE_BORDER = 4;
+/// Size of a page including the borders, as stored in the source and the physical cache.
+static const int VIRTUAL_PAGE_SLOT_SIZE = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+/// Maximum number of virtual texture levels, limited by the 12-bit page coordinates of the feedback.
+static const int MAX_VIRTUAL_LEVELS = 13;
+/// Default number of page slots along an edge of the physical cache texture.
+static const int DEFAULT_VIRTUAL_CACHE_PAGES = 24;
+/// Default maximum number of page loads in progress.
+static const size_t DEFAULT_VIRTUAL_MAX_LOADS = 8;
+/// Downscale factor of the feedback image relative to the view. Must match VT_FEEDBACK_SCALE in VirtualTexture.glsl.
+static const int VIRTUAL_FEEDBACK_SCALE = 8;
+/// Image unit of the feedback image. Must match the postfix of vtFeedbackImage7 in VirtualTexture.glsl.
+static const size_t VIRTUAL_FEEDBACK_IMAGE_UNIT = 7;
+
+/// Source of virtual texture pages. LoadPage() is called from worker threads, possibly several at once.
+class VirtualTextureSource : public RefCounted
+{
+public:
+    /// Destruct.
+    virtual ~VirtualTextureSource();
+
+    /// Return size in texels along an edge. Must be a power of two and at least the page size.
+    virtual int Size() const = 0;
+    /// Load a page with its borders as RGBA8 data of VIRTUAL_PAGE_SLOT_SIZE squared texels. Level 0 is the most detailed. Must be thread-safe. Return true on success.
+    virtual bool LoadPage(int level, const IntVector2& page, unsigned char* dest) = 0;
+};
+
+/// Page source that reads a tiled virtual texture file written by Save(). Each page is stored compressed with its borders, so that loading it is one read and decompression.
+class VirtualTextureFile : public VirtualTextureSource
+{
+public:
+    /// Construct.
+    VirtualTextureFile();
+    /// Destruct.
+    ~VirtualTextureFile();
+
+    /// Open a tiled virtual texture file through the resource cache. Return true on success.
+    bool Open(const std::string& name);
+    /// Return size in texels along an edge.
+    int Size() const override { return size; }
+    /// Read and decompress a page. The file reads are serialized, while the decompression runs in parallel.
+    bool LoadPage(int level, const IntVector2& page, unsigned char* dest) override;
+
+    /// Write an image as a tiled virtual texture file, generating the mip levels and the page borders. The image must be square RGBA8 with a power of two size of at least the page size. The stream must be seekable. Return true on success.
+    static bool Save(Stream& dest, const Image& image);
+
+private:
+    /// File stream.
+    AutoPtr<Stream> stream;
+    /// Mutex for the file reads.
+    Mutex streamMutex;
+    /// Offset of each page's data in the file, in level order and then row-major. The last element is the end of the data.
+    std::vector<unsigned long long> pageOffsets;
+    /// Index of each level's first page.
+    std::vector<size_t> levelStarts;
+    /// Size in texels along an edge.
+    int size;
+};
+
+/// %Task for loading a virtual texture page in the background.
+class VirtualPageLoadTask : public Task
+{
+public:
+    /// Construct.
+    VirtualPageLoadTask(VirtualTextureSource* source, unsigned page);
+
+    /// Load the page from the source.
+    void Complete(unsigned threadIndex) override;
+
+    /// Page source.
+    SharedPtr<VirtualTextureSource> source;
+    /// Page key.
+    unsigned page;
+    /// Loaded page data.
+    std::vector<unsigned char> data;
+    /// Completion counter, nonzero while the load is queued or running.
+    TaskCounter counter;
+    /// Load result.
+    bool success;
+};
+
+/// Slot of the physical page cache.
+struct VirtualPageSlot
+{
+    /// Construct free.
+    VirtualPageSlot() :
+        page(M_MAX_UNSIGNED),
+        lastUse(0)
+    {
+    }
+
+    /// Key of the resident page, or M_MAX_UNSIGNED if free.
+    unsigned page;
+    /// Feedback number when last requested.
+    unsigned lastUse;
+};
+
+/// Sparse virtual texture for texturing huge surfaces such as terrain uniquely at a resolution beyond the texture size limits, with a fixed GPU memory cost. The texture is divided into pages that are loaded on demand into the slots of a physical cache texture, evicting the least recently used. A page table texture with a mip level per virtual texture level maps each page to its slot, or to the most detailed resident ancestor, so sampling always finds data while the coarsest page is kept resident. Shaders sample through VirtualTexture.glsl, which also writes the pages they need into a feedback image during the view rendered between BeginFeedback() and EndFeedback(). The feedback is read back asynchronously and the missing pages are loaded on worker threads, coarsest first.
+class VirtualTexture : public RefCounted, public ReadbackHandler
+{
+public:
+    /// Construct.
+    VirtualTexture();
+    /// Destruct. Wait for the loads and feedback reads in progress.
+    ~VirtualTexture();
+
+    /// Define with a page source and the number of page slots along an edge of the physical cache, at most 256. Load the coarsest page immediately. Return true on success.
+    bool Define(VirtualTextureSource* source, int cachePages = DEFAULT_VIRTUAL_CACHE_PAGES);
+    /// Set maximum number of page loads in progress.
+    void SetMaxLoads(size_t num);
+    /// Clear the feedback image for a view size and bind it for writing. Call before rendering the view that uses the texture.
+    void BeginFeedback(const IntVector2& viewSize);
+    /// Unbind the feedback image and queue its readback. Call after rendering the view.
+    void EndFeedback();
+    /// Upload the finished pages within the time budget, process the latest feedback and start loads for the missing pages. Call once per frame.
+    void Update(float maxMilliseconds);
+    /// Handle the read back feedback. Called from a worker thread.
+    void OnReadback(const ReadbackData& data) override;
+
+    /// Return the page source.
+    VirtualTextureSource* Source() const { return source.Get(); }
+    /// Return the physical cache texture, to be set in a material.
+    Texture* CacheTexture() const { return cacheTexture.Get(); }
+    /// Return the page table texture, to be set in a material.
+    Texture* PageTableTexture() const { return pageTableTexture.Get(); }
+    /// Return number of virtual texture levels.
+    int NumLevels() const { return numLevels; }
+    /// Return number of page slots along an edge of the physical cache.
+    int CachePages() const { return cachePages; }
+    /// Return maximum number of page loads in progress.
+    size_t MaxLoads() const { return maxLoads; }
+    /// Return number of resident pages.
+    size_t NumResidentPages() const { return residentPages.size(); }
+    /// Return number of pages requested by the latest feedback.
+    size_t NumRequestedPages() const { return requestedPages.size(); }
+    /// Return number of page loads in progress.
+    size_t NumLoads() const { return loads.size(); }
+
+    /// Return whether feedback rendering is supported. Requires image load/store.
+    static bool IsFeedbackSupported();
+    /// Return page key from level and page coordinates. The level is stored plus one, so that zero in the feedback means no request.
+    static unsigned PageKey(int level, const IntVector2& page) { return (unsigned)page.x | ((unsigned)page.y << 12) | ((unsigned)(level + 1) << 24); }
+    /// Return level from page key.
+    static int PageLevel(unsigned key) { return (int)(key >> 24) - 1; }
+    /// Return page coordinates from page key.
+    static IntVector2 PagePosition(unsigned key) { return IntVector2((int)(key & 0xfff), (int)((key >> 12) & 0xfff)); }
+
+private:
+    /// Release the textures, loads and resident pages.
+    void Release();
+    /// Return a free slot, evicting the least recently used page not requested by the latest feedback if necessary, or -1 if none.
+    int AllocateSlot();
+    /// Upload page data to a slot and map the page to it in the page table.
+    void MapPage(unsigned page, int slot, const unsigned char* data);
+    /// Remove a page from a slot and map its area to the parent's entries in the page table.
+    void UnmapPage(int slot);
+    /// Upload the changed page table levels.
+    void UploadPageTable();
+
+    /// Page source.
+    SharedPtr<VirtualTextureSource> source;
+    /// Physical cache texture.
+    SharedPtr<Texture> cacheTexture;
+    /// Page table texture.
+    SharedPtr<Texture> pageTableTexture;
+    /// Feedback texture.
+    SharedPtr<Texture> feedbackTexture;
+    /// Feedback readback ring.
+    AutoPtr<FrameReadback> readback;
+    /// Page table entries of each level as RGBA8: the slot coordinates and the resident level.
+    std::vector<std::vector<unsigned> > pageTable;
+    /// Page table levels changed since the last upload.
+    std::vector<bool> pageTableDirty;
+    /// Physical cache slots.
+    std::vector<VirtualPageSlot> slots;
+    /// Indices of free slots.
+    std::vector<int> freeSlots;
+    /// Slot index of each resident page by key.
+    std::map<unsigned, int> residentPages;
+    /// Page keys requested by the latest feedback, sorted.
+    std::vector<unsigned> requestedPages;
+    /// Page keys of the requested pages and their ancestors that are not resident, coarsest first.
+    std::vector<unsigned> missingPages;
+    /// Page keys that have failed to load, which are not retried.
+    std::set<unsigned> failedPages;
+    /// Page keys from the feedback handler, not yet taken by Update().
+    std::vector<unsigned> feedbackPages;
+    /// Mutex for the feedback pages.
+    Mutex feedbackMutex;
+    /// Zero data for clearing the feedback texture.
+    std::vector<unsigned char> feedbackClearData;
+    /// Loads in progress.
+    std::vector<AutoPtr<VirtualPageLoadTask> > loads;
+    /// Number of pages along an edge of the most detailed level.
+    int numPages;
+    /// Number of virtual texture levels.
+    int numLevels;
+    /// Page slots along an edge of the physical cache.
+    int cachePages;
+    /// Slot of the coarsest page, which is never evicted.
+    int rootSlot;
+    /// Maximum number of loads in progress.
+    size_t maxLoads;
+    /// Number of the latest feedback, for the page use.
+    unsigned feedbackNumber;
+    /// Whether new feedback has arrived.
+    bool newFeedback;
+};
@@ -0,0 +1,346 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "../Thread/WorkQueue.h"
+#include "Compress.h"
+
+#include <algorithm>
+#include <cstring>
+
+/// Minimum number of pixel rows per compression task.
+static const int COMPRESS_ROWS_PER_TASK = 64;
+/// Power iterations for finding the principal color axis of a block.
+static const int COMPRESS_POWER_ITERATIONS = 4;
+
+/// %Task for compressing a range of block rows.
+class CompressTask : public Task
+{
+public:
+    /// Compress the rows.
+    void Complete(unsigned) override
+    {
+        CompressImageDXT(blocks, src, width, height, format);
+    }
+
+    /// Destination blocks.
+    void* blocks;
+    /// Source pixels.
+    const unsigned char* src;
+    /// Image width.
+    int width;
+    /// Number of rows to compress.
+    int height;
+    /// Compressed format.
+    ImageFormat format;
+};
+
+/// Quantize a color to 5:6:5 bits.
+static inline unsigned Pack565(const int* color)
+{
+    int red = (Clamp(color[0], 0, 255) * 31 + 127) / 255;
+    int green = (Clamp(color[1], 0, 255) * 63 + 127) / 255;
+    int blue = (Clamp(color[2], 0, 255) * 31 + 127) / 255;
+    return (unsigned)((red << 11) | (green << 5) | blue);
+}
+
+/// Expand a 5:6:5 color the same way as the decompressor.
+static inline void Unpack565(unsigned value, int* dest)
+{
+    int red = (value >> 11) & 0x1f;
+    int green = (value >> 5) & 0x3f;
+    int blue = value & 0x1f;
+    dest[0] = (red << 3) | (red >> 2);
+    dest[1] = (green << 2) | (green >> 4);
+    dest[2] = (blue << 3) | (blue >> 2);
+}
+
+/// Choose the nearest 4-color palette entry for each pixel. Return the indices packed two bits per pixel and the total squared error.
+static unsigned ColorIndices(unsigned color0, unsigned color1, const unsigned char* pixels, int& error)
+{
+    int palette[4][3];
+    Unpack565(color0, palette[0]);
+    Unpack565(color1, palette[1]);
+    for (int i = 0; i < 3; ++i)
+    {
+        palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+        palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+    }
+
+    unsigned indices = 0;
+    error = 0;
+
+    for (int i = 0; i < 16; ++i)
+    {
+        const unsigned char* pixel = pixels + i * 4;
+        int bestIndex = 0;
+        int bestError = M_MAX_INT;
+
+        // With equal endpoints the decompressor would use 3-color mode for DXT1, so only the first entry is safe
+        int numColors = color0 == color1 ? 1 : 4;
+        for (int j = 0; j < numColors; ++j)
+        {
+            int dr = pixel[0] - palette[j][0];
+            int dg = pixel[1] - palette[j][1];
+            int db = pixel[2] - palette[j][2];
+            int pixelError = dr * dr + dg * dg + db * db;
+            if (pixelError < bestError)
+            {
+                bestError = pixelError;
+                bestIndex = j;
+            }
+        }
+
+        indices |= (unsigned)bestIndex << (i * 2);
+        error += bestError;
+    }
+
+    return indices;
+}
+
+/// Order the endpoints for 4-color mode, choose the indices and return the total squared error.
+static int EncodeColorEndpoints(unsigned& color0, unsigned& color1, unsigned& indices, const unsigned char* pixels)
+{
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    int error;
+    indices = ColorIndices(color0, color1, pixels, error);
+    return error;
+}
+
+/// Compress the color of a 4x4 block of RGBA pixels to 8 bytes.
+static void CompressColorBlock(unsigned char* dest, const unsigned char* pixels)
+{
+    int minColor[3] = { 255, 255, 255 };
+    int maxColor[3] = { 0, 0, 0 };
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            int value = pixels[i * 4 + j];
+            minColor[j] = Min(minColor[j], value);
+            maxColor[j] = Max(maxColor[j], value);
+            mean[j] += value;
+        }
+    }
+    for (int j = 0; j < 3; ++j)
+        mean[j] *= (1.0f / 16.0f);
+
+    unsigned color0, color1, indices;
+
+    if (minColor[0] == maxColor[0] && minColor[1] == maxColor[1] && minColor[2] == maxColor[2])
+    {
+        color0 = color1 = Pack565(minColor);
+        indices = 0;
+    }
+    else
+    {
+        // Covariance of the colors, stored as the upper triangle
+        float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+        {
+            float r = pixels[i * 4] - mean[0];
+            float g = pixels[i * 4 + 1] - mean[1];
+            float b = pixels[i * 4 + 2] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+
+        // Find the principal axis by power iteration, starting from the bounding box diagonal
+        float axis[3] = { (float)(maxColor[0] - minColor[0]), (float)(maxColor[1] - minColor[1]), (float)(maxColor[2] - minColor[2]) };
+        for (int i = 0; i < COMPRESS_POWER_ITERATIONS; ++i)
+        {
+            float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            float largest = Max(Max(Abs(x), Abs(y)), Abs(z));
+            if (largest < M_EPSILON)
+                break;
+
+            axis[0] = x / largest;
+            axis[1] = y / largest;
+            axis[2] = z / largest;
+        }
+
+        float minProjection = M_INFINITY;
+        float maxProjection = -M_INFINITY;
+        for (int i = 0; i < 16; ++i)
+        {
+            float projection = (pixels[i * 4] - mean[0]) * axis[0] + (pixels[i * 4 + 1] - mean[1]) * axis[1] + (pixels[i * 4 + 2] - mean[2]) *
+                axis[2];
+            minProjection = Min(minProjection, projection);
+            maxProjection = Max(maxProjection, projection);
+        }
+
+        float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        int end0[3], end1[3];
+        for (int j = 0; j < 3; ++j)
+        {
+            end0[j] = (int)(mean[j] + axis[j] * maxProjection / lengthSquared + 0.5f);
+            end1[j] = (int)(mean[j] + axis[j] * minProjection / lengthSquared + 0.5f);
+        }
+
+        color0 = Pack565(end0);
+        color1 = Pack565(end1);
+        int error = EncodeColorEndpoints(color0, color1, indices, pixels);
+
+        // Refine the endpoints once with a least squares fit to the chosen indices
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f };
+        float bx[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+        {
+            float a = weights[(indices >> (i * 2)) & 3];
+            float b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int j = 0; j < 3; ++j)
+            {
+                ax[j] += a * pixels[i * 4 + j];
+                bx[j] += b * pixels[i * 4 + j];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (error > 0 && Abs(determinant) > M_EPSILON)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                end0[j] = (int)((ax[j] * bb - bx[j] * ab) / determinant + 0.5f);
+                end1[j] = (int)((bx[j] * aa - ax[j] * ab) / determinant + 0.5f);
+            }
+
+            unsigned refined0 = Pack565(end0);
+            unsigned refined1 = Pack565(end1);
+            unsigned refinedIndices;
+            if (EncodeColorEndpoints(refined0, refined1, refinedIndices, pixels) < error)
+            {
+                color0 = refined0;
+                color1 = refined1;
+                indices = refinedIndices;
+            }
+        }
+    }
+
+    dest[0] = (unsigned char)color0;
+    dest[1] = (unsigned char)(color0 >> 8);
+    dest[2] = (unsigned char)color1;
+    dest[3] = (unsigned char)(color1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        dest[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+/// Compress the alpha of a 4x4 block of RGBA pixels to 8 bytes in the 8-value DXT5 mode.
+static void CompressAlphaBlock(unsigned char* dest, const unsigned char* pixels)
+{
+    int alpha0 = 0;
+    int alpha1 = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        alpha0 = Max(alpha0, (int)pixels[i * 4 + 3]);
+        alpha1 = Min(alpha1, (int)pixels[i * 4 + 3]);
+    }
+
+    dest[0] = (unsigned char)alpha0;
+    dest[1] = (unsigned char)alpha1;
+
+    unsigned long long indices = 0;
+    if (alpha0 > alpha1)
+    {
+        int codes[8];
+        codes[0] = alpha0;
+        codes[1] = alpha1;
+        for (int i = 1; i < 7; ++i)
+            codes[1 + i] = ((7 - i) * alpha0 + i * alpha1) / 7;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int alpha = pixels[i * 4 + 3];
+            int bestIndex = 0;
+            int bestError = M_MAX_INT;
+            for (int j = 0; j < 8; ++j)
+            {
+                int error = Abs(alpha - codes[j]);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestIndex = j;
+                }
+            }
+
+            indices |= (unsigned long long)bestIndex << (i * 3);
+        }
+    }
+
+    for (int i = 0; i < 6; ++i)
+        dest[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+void CompressImageDXT(void* blocks, const unsigned char* src, int width, int height, ImageFormat format)
+{
+    unsigned char* dest = reinterpret_cast<unsigned char*>(blocks);
+    unsigned char pixels[16 * 4];
+
+    for (int y = 0; y < height; y += 4)
+    {
+        for (int x = 0; x < width; x += 4)
+        {
+            // Blocks at the image edges repeat the last column and row
+            for (int by = 0; by < 4; ++by)
+            {
+                const unsigned char* row = src + (size_t)Min(y + by, height - 1) * width * 4;
+                for (int bx = 0; bx < 4; ++bx)
+                    memcpy(&pixels[(by * 4 + bx) * 4], row + Min(x + bx, width - 1) * 4, 4);
+            }
+
+            if (format == FMT_DXT5)
+            {
+                CompressAlphaBlock(dest, pixels);
+                dest += 8;
+            }
+
+            CompressColorBlock(dest, pixels);
+            dest += 8;
+        }
+    }
+}
+
+void CompressImageParallel(void* blocks, const unsigned char* src, int width, int height, ImageFormat format)
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    int numThreads = workQueue ? (int)workQueue->NumThreads() : 1;
+    if (numThreads < 2 || height <= COMPRESS_ROWS_PER_TASK)
+    {
+        CompressImageDXT(blocks, src, width, height, format);
+        return;
+    }
+
+    // Split at block row boundaries into about four tasks per thread
+    int rowsPerTask = Max(COMPRESS_ROWS_PER_TASK, (height / (numThreads * 4) + 3) & ~3);
+    size_t numTasks = (height + rowsPerTask - 1) / rowsPerTask;
+    size_t blockRowSize = ((width + 3) / 4) * (format == FMT_DXT1 ? 8 : 16);
+
+    AutoArrayPtr<CompressTask> tasks(new CompressTask[numTasks]);
+    TaskCounter counter(0);
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        CompressTask& task = tasks[i];
+        int startRow = (int)i * rowsPerTask;
+        task.blocks = reinterpret_cast<unsigned char*>(blocks) + (startRow / 4) * blockRowSize;
+        task.src = src + (size_t)startRow * width * 4;
+        task.width = width;
+        task.height = Min(rowsPerTask, height - startRow);
+        task.format = format;
+        workQueue->QueueTask(&task, &counter);
+    }
+
+    workQueue->Complete(counter);
+}
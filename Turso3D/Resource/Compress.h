@@ -0,0 +1,10 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Image.h"
+
+/// Compress 8-bit RGBA pixels to DXT1 or DXT5 blocks. DXT1 blocks are always encoded opaque.
+void CompressImageDXT(void* blocks, const unsigned char* src, int width, int height, ImageFormat format);
+/// Compress 8-bit RGBA pixels to DXT1 or DXT5 blocks, split into block rows for the worker threads if the work queue exists.
+void CompressImageParallel(void* blocks, const unsigned char* src, int width, int height, ImageFormat format);
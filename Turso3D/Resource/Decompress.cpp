@@ -1,9 +1,44 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Math/Math.h"
+#include "../Thread/WorkQueue.h"
 #include "Decompress.h"
 
 #include <cstring>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TURSO3D_SSE
+#include <emmintrin.h>
+#endif
+
+/// Minimum number of pixel rows per task in parallel decompression.
+static const int DECOMPRESS_ROWS_PER_TASK = 64;
+
+/// %Task for decompressing a range of block rows.
+class DecompressTask : public Task
+{
+public:
+    /// Decompress the rows.
+    void Complete(unsigned) override
+    {
+        if (format == FMT_ETC1)
+            DecompressImageETC(dest, blocks, width, height);
+        else
+            DecompressImageDXT(dest, blocks, width, height, format);
+    }
+
+    /// Destination pixels.
+    unsigned char* dest;
+    /// Source blocks.
+    const void* blocks;
+    /// Image width.
+    int width;
+    /// Number of rows to decompress.
+    int height;
+    /// Compressed format.
+    ImageFormat format;
+};
+
 // DXT decompression based on the Squish library
 
 /* -----------------------------------------------------------------------------
@@ -31,214 +66,180 @@
 
    -------------------------------------------------------------------------- */
 
-static int Unpack565( unsigned char const* packed, unsigned char* colour )
+/// Expand a RGB565 color to 8 bits per channel with opaque alpha.
+static inline void Unpack565(unsigned value, unsigned short* dest)
 {
-    // build the packed value
-    int value = ( int )packed[0] | ( ( int )packed[1] << 8 );
-
-    // get the components in the stored range
-    unsigned char red = ( unsigned char )( ( value >> 11 ) & 0x1f );
-    unsigned char green = ( unsigned char )( ( value >> 5 ) & 0x3f );
-    unsigned char blue = ( unsigned char )( value & 0x1f );
-
-    // scale up to 8 bits
-    colour[0] = ( red << 3 ) | ( red >> 2 );
-    colour[1] = ( green << 2 ) | ( green >> 4 );
-    colour[2] = ( blue << 3 ) | ( blue >> 2 );
-    colour[3] = 255;
-
-    // return the value
-    return value;
+    unsigned red = (value >> 11) & 0x1f;
+    unsigned green = (value >> 5) & 0x3f;
+    unsigned blue = value & 0x1f;
+
+    dest[0] = (unsigned short)((red << 3) | (red >> 2));
+    dest[1] = (unsigned short)((green << 2) | (green >> 4));
+    dest[2] = (unsigned short)((blue << 3) | (blue >> 2));
+    dest[3] = 255;
 }
 
-static void DecompressColourDXT( unsigned char* rgba, void const* block, bool isDxt1 )
+/// Build the 4-color palettes of two DXT color blocks as packed RGBA.
+static void DXTColorPalettes(const unsigned char* block0, const unsigned char* block1, bool isDxt1, unsigned* palette0, unsigned* palette1)
 {
-    // get the block bytes
-    unsigned char const* bytes = reinterpret_cast< unsigned char const* >( block );
-
-    // unpack the endpoints
-    unsigned char codes[16];
-    int a = Unpack565( bytes, codes );
-    int b = Unpack565( bytes + 2, codes + 4 );
+    unsigned a0 = block0[0] | (block0[1] << 8);
+    unsigned b0 = block0[2] | (block0[3] << 8);
+    unsigned a1 = block1[0] | (block1[1] << 8);
+    unsigned b1 = block1[2] | (block1[3] << 8);
+    bool punch0 = isDxt1 && a0 <= b0;
+    bool punch1 = isDxt1 && a1 <= b1;
+
+    // Endpoints as 16-bit channels, first block in the lower half
+    unsigned short endpoints[16];
+    Unpack565(a0, &endpoints[0]);
+    Unpack565(a1, &endpoints[4]);
+    Unpack565(b0, &endpoints[8]);
+    Unpack565(b1, &endpoints[12]);
+
+    unsigned colors[8];
+
+#ifdef TURSO3D_SSE
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&endpoints[0]));
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&endpoints[8]));
+
+    // Multiplying by 0xaaab and shifting right by 17 divides values below 65536 by 3 exactly
+    __m128i third = _mm_set1_epi16((short)0xaaab);
+    __m128i p2 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(c, c), d), third), 1);
+    __m128i p3 = _mm_srli_epi16(_mm_mulhi_epu16(_mm_add_epi16(c, _mm_add_epi16(d, d)), third), 1);
+
+    // Punch-through blocks use the midpoint and transparent black instead
+    __m128i punch = _mm_set_epi32(punch1 ? -1 : 0, punch1 ? -1 : 0, punch0 ? -1 : 0, punch0 ? -1 : 0);
+    __m128i half = _mm_srli_epi16(_mm_add_epi16(c, d), 1);
+    p2 = _mm_or_si128(_mm_and_si128(punch, half), _mm_andnot_si128(punch, p2));
+    p3 = _mm_andnot_si128(punch, p3);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&colors[0]), _mm_packus_epi16(c, d));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&colors[4]), _mm_packus_epi16(p2, p3));
+#else
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(colors);
+    for (int i = 0; i < 8; ++i)
+    {
+        int c = endpoints[i];
+        int d = endpoints[8 + i];
+        bool punch = i < 4 ? punch0 : punch1;
+
+        bytes[i] = (unsigned char)c;
+        bytes[8 + i] = (unsigned char)d;
+        bytes[16 + i] = (unsigned char)(punch ? (c + d) / 2 : (2 * c + d) / 3);
+        bytes[24 + i] = (unsigned char)(punch ? 0 : (c + 2 * d) / 3);
+    }
+#endif
+
+    // The colors are ordered first endpoints, second endpoints, third colors and fourth colors, alternating between the blocks
+    palette0[0] = colors[0];
+    palette0[1] = colors[2];
+    palette0[2] = colors[4];
+    palette0[3] = colors[6];
+    palette1[0] = colors[1];
+    palette1[1] = colors[3];
+    palette1[2] = colors[5];
+    palette1[3] = colors[7];
+}
 
-    // generate the midpoints
-    for( int i = 0; i < 3; ++i )
+/// Decode the alpha of a DXT3 or DXT5 block, shifted to the alpha byte of packed RGBA.
+static inline void DecompressAlphaDXT(const unsigned char* block, ImageFormat format, unsigned* alphas)
+{
+    if (format == FMT_DXT3)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            unsigned quant = (block[i >> 1] >> ((i & 1) * 4)) & 0xf;
+            alphas[i] = (quant | (quant << 4)) << 24;
+        }
+    }
+    else
     {
-        int c = codes[i];
-        int d = codes[4 + i];
+        int alpha0 = block[0];
+        int alpha1 = block[1];
 
-        if( isDxt1 && a <= b )
+        unsigned codes[8];
+        codes[0] = (unsigned)alpha0;
+        codes[1] = (unsigned)alpha1;
+        if (alpha0 <= alpha1)
         {
-            codes[8 + i] = ( unsigned char )( ( c + d )/2 );
-            codes[12 + i] = 0;
+            for (int i = 1; i < 5; ++i)
+                codes[1 + i] = (unsigned)(((5 - i) * alpha0 + i * alpha1) / 5);
+            codes[6] = 0;
+            codes[7] = 255;
         }
         else
         {
-            codes[8 + i] = ( unsigned char )( ( 2*c + d )/3 );
-            codes[12 + i] = ( unsigned char )( ( c + 2*d )/3 );
+            for (int i = 1; i < 7; ++i)
+                codes[1 + i] = (unsigned)(((7 - i) * alpha0 + i * alpha1) / 7);
         }
-    }
-
-    // fill in alpha for the intermediate values
-    codes[8 + 3] = 255;
-    codes[12 + 3] = ( isDxt1 && a <= b ) ? 0 : 255;
 
-    // unpack the indices
-    unsigned char indices[16];
-    for( int i = 0; i < 4; ++i )
-    {
-        unsigned char* ind = indices + 4*i;
-        unsigned char packed = bytes[4 + i];
-
-        ind[0] = packed & 0x3;
-        ind[1] = ( packed >> 2 ) & 0x3;
-        ind[2] = ( packed >> 4 ) & 0x3;
-        ind[3] = ( packed >> 6 ) & 0x3;
-    }
+        unsigned long long indices = 0;
+        for (int i = 0; i < 6; ++i)
+            indices |= (unsigned long long)block[2 + i] << (8 * i);
 
-    // store out the colours
-    for( int i = 0; i < 16; ++i )
-    {
-        unsigned char offset = 4*indices[i];
-        for( int j = 0; j < 4; ++j )
-            rgba[4*i + j] = codes[offset + j];
+        for (int i = 0; i < 16; ++i)
+            alphas[i] = codes[(indices >> (3 * i)) & 0x7] << 24;
     }
 }
 
-static void DecompressAlphaDXT3( unsigned char* rgba, void const* block )
+/// Write a decompressed DXT block to pixels with a row pitch. Only the given number of columns and rows are written for blocks at the image edges.
+static inline void WriteBlockDXT(unsigned* dest, int pitch, const unsigned char* block, const unsigned* palette, ImageFormat format, int columns, int rows)
 {
-    unsigned char const* bytes = reinterpret_cast< unsigned char const* >( block );
-
-    // unpack the alpha values pairwise
-    for( int i = 0; i < 8; ++i )
+    if (format == FMT_DXT1)
     {
-        // quantise down to 4 bits
-        unsigned char quant = bytes[i];
-
-        // unpack the values
-        unsigned char lo = quant & 0x0f;
-        unsigned char hi = quant & 0xf0;
-
-        // convert back up to bytes
-        rgba[8*i + 3] = lo | ( lo << 4 );
-        rgba[8*i + 7] = hi | ( hi >> 4 );
-    }
-}
-
-static void DecompressAlphaDXT5( unsigned char* rgba, void const* block )
-{
-    // get the two alpha values
-    unsigned char const* bytes = reinterpret_cast< unsigned char const* >( block );
-    int alpha0 = bytes[0];
-    int alpha1 = bytes[1];
-
-    // compare the values to build the codebook
-    unsigned char codes[8];
-    codes[0] = ( unsigned char )alpha0;
-    codes[1] = ( unsigned char )alpha1;
-    if( alpha0 <= alpha1 )
-    {
-        // use 5-alpha codebook
-        for( int i = 1; i < 5; ++i )
-            codes[1 + i] = ( unsigned char )( ( ( 5 - i )*alpha0 + i*alpha1 )/5 );
-        codes[6] = 0;
-        codes[7] = 255;
+        for (int y = 0; y < rows; ++y)
+        {
+            unsigned indices = block[4 + y];
+            unsigned* row = dest + y * pitch;
+            for (int x = 0; x < columns; ++x)
+                row[x] = palette[(indices >> (2 * x)) & 0x3];
+        }
     }
     else
     {
-        // use 7-alpha codebook
-        for( int i = 1; i < 7; ++i )
-            codes[1 + i] = ( unsigned char )( ( ( 7 - i )*alpha0 + i*alpha1 )/7 );
-    }
-
-    // decode the indices
-    unsigned char indices[16];
-    unsigned char const* src = bytes + 2;
-    unsigned char* dest = indices;
-    for( int i = 0; i < 2; ++i )
-    {
-        // grab 3 bytes
-        int value = 0;
-        for( int j = 0; j < 3; ++j )
-        {
-            int byte = *src++;
-            value |= ( byte << 8*j );
-        }
+        unsigned alphas[16];
+        DecompressAlphaDXT(block, format, alphas);
 
-        // unpack 8 3-bit values from it
-        for( int j = 0; j < 8; ++j )
+        const unsigned char* colorBlock = block + 8;
+        for (int y = 0; y < rows; ++y)
         {
-            int index = ( value >> 3*j ) & 0x7;
-            *dest++ = ( unsigned char )index;
+            unsigned indices = colorBlock[4 + y];
+            unsigned* row = dest + y * pitch;
+            for (int x = 0; x < columns; ++x)
+                row[x] = (palette[(indices >> (2 * x)) & 0x3] & 0xffffff) | alphas[y * 4 + x];
         }
     }
-
-    // write out the indexed codebook values
-    for( int i = 0; i < 16; ++i )
-        rgba[4*i + 3] = codes[indices[i]];
-}
-
-static void DecompressDXT( unsigned char* rgba, const void* block, ImageFormat format)
-{
-    // get the block locations
-    void const* colourBlock = block;
-    void const* alphaBock = block;
-    if( format == FMT_DXT3 || format == FMT_DXT5)
-        colourBlock = reinterpret_cast< unsigned char const* >( block ) + 8;
-
-    // decompress colour
-    DecompressColourDXT( rgba, colourBlock, format == FMT_DXT1 );
-
-    // decompress alpha separately if necessary
-    if( format == FMT_DXT3 )
-        DecompressAlphaDXT3( rgba, alphaBock );
-    else if ( format == FMT_DXT5 )
-        DecompressAlphaDXT5( rgba, alphaBock );
 }
 
-void DecompressImageDXT( unsigned char* rgba, const void* blocks, int width, int height, ImageFormat format )
+void DecompressImageDXT(unsigned char* rgba, const void* blocks, int width, int height, ImageFormat format)
 {
-    // initialise the block input
-    unsigned char const* sourceBlock = reinterpret_cast< unsigned char const* >( blocks );
-    int bytesPerBlock = format == FMT_DXT1 ? 8 : 16;
+    const unsigned char* blockRow = reinterpret_cast<const unsigned char*>(blocks);
+    unsigned* pixels = reinterpret_cast<unsigned*>(rgba);
+    size_t bytesPerBlock = format == FMT_DXT1 ? 8 : 16;
+    size_t colorOffset = format == FMT_DXT1 ? 0 : 8;
+    int blocksX = (width + 3) / 4;
 
-    // loop over blocks
-    for( int y = 0; y < height; y += 4 )
+    // Decode two blocks per iteration
+    for (int y = 0; y < height; y += 4)
     {
-        for( int x = 0; x < width; x += 4 )
-        {
-            // decompress the block
-            unsigned char targetRgba[4*16];
-            DecompressDXT( targetRgba, sourceBlock, format );
-
-            // write the decompressed pixels to the correct image locations
-            unsigned char const* sourcePixel = targetRgba;
-            for( int py = 0; py < 4; ++py )
-            {
-                for( int px = 0; px < 4; ++px )
-                {
-                    // get the target location
-                    int sx = x + px;
-                    int sy = y + py;
-                    if( sx < width && sy < height )
-                    {
-                        unsigned char* targetPixel = rgba + 4*( width*sy + sx );
-
-                        // copy the rgba value
-                        for( int i = 0; i < 4; ++i )
-                            *targetPixel++ = *sourcePixel++;
-                    }
-                    else
-                    {
-                        // skip this pixel as its outside the image
-                        sourcePixel += 4;
-                    }
-                }
-            }
+        int rows = Min(height - y, 4);
 
-            // advance
-            sourceBlock += bytesPerBlock;
+        for (int bx = 0; bx < blocksX; bx += 2)
+        {
+            const unsigned char* block0 = blockRow + bx * bytesPerBlock;
+            const unsigned char* block1 = bx + 1 < blocksX ? block0 + bytesPerBlock : block0;
+            unsigned palette0[4];
+            unsigned palette1[4];
+            DXTColorPalettes(block0 + colorOffset, block1 + colorOffset, format == FMT_DXT1, palette0, palette1);
+
+            int x = bx * 4;
+            unsigned* dest = pixels + (size_t)y * width + x;
+            WriteBlockDXT(dest, width, block0, palette0, format, Min(width - x, 4), rows);
+            if (bx + 1 < blocksX)
+                WriteBlockDXT(dest + 4, width, block1, palette1, format, Min(width - x - 4, 4), rows);
         }
+
+        blockRow += blocksX * bytesPerBlock;
     }
 }
 
@@ -263,163 +264,129 @@ misrepresented as being the original software.
 3. This notice may not be removed or altered from any source distribution.
 */
 
-#define _CLAMP_(X,Xmin,Xmax) ( (X)<(Xmax) ? ( (X)<(Xmin)?(Xmin):(X) ) : (Xmax) )
-
-unsigned int ETC_FLIP =  0x01000000;
-unsigned int ETC_DIFF = 0x02000000;
-const int mod[8][4]={{2, 8,-2,-8},
-                    {5, 17, -5, -17},
-                    {9, 29, -9, -29},
-                    {13, 42, -13, -42},
-                    {18, 60, -18, -60},
-                    {24, 80, -24, -80},
-                    {33, 106, -33, -106},
-                    {47, 183, -47, -183}};
-
-// lsb: hgfedcba ponmlkji msb: hgfedcba ponmlkji due to endianness
-static unsigned long ModifyPixel(int red, int green, int blue, int x, int y, unsigned long modBlock, int modTable)
+static const unsigned ETC_FLIP = 0x01000000;
+static const unsigned ETC_DIFF = 0x02000000;
+
+static const int etcModifiers[8][4] =
 {
-    int index = x*4+y, pixelMod;
-    unsigned long mostSig = modBlock<<1;
-    if (index<8)    //hgfedcba
-        pixelMod = mod[modTable][((modBlock>>(index+24))&0x1)+((mostSig>>(index+8))&0x2)];
-    else    // ponmlkj
-        pixelMod = mod[modTable][((modBlock>>(index+8))&0x1)+((mostSig>>(index-8))&0x2)];
-
-    red = _CLAMP_(red+pixelMod,0,255);
-    green = _CLAMP_(green+pixelMod,0,255);
-    blue = _CLAMP_(blue+pixelMod,0,255);
-
-    return ((blue<<16) + (green<<8) + red)|0xff000000;
+    {2, 8, -2, -8},
+    {5, 17, -5, -17},
+    {9, 29, -9, -29},
+    {13, 42, -13, -42},
+    {18, 60, -18, -60},
+    {24, 80, -24, -80},
+    {33, 106, -33, -106},
+    {47, 183, -47, -183}
+};
+
+/// Build the 4-color palette of an ETC subblock from its base color as packed RGBA.
+static inline void ETCPalette(int red, int green, int blue, int modTable, unsigned* palette)
+{
+    const int* modifiers = etcModifiers[modTable];
+
+#ifdef TURSO3D_SSE
+    __m128i base = _mm_set_epi16(0, (short)blue, (short)green, (short)red, 0, (short)blue, (short)green, (short)red);
+    __m128i mod01 = _mm_set_epi16(0, (short)modifiers[1], (short)modifiers[1], (short)modifiers[1], 0, (short)modifiers[0], (short)modifiers[0], (short)modifiers[0]);
+    __m128i mod23 = _mm_set_epi16(0, (short)modifiers[3], (short)modifiers[3], (short)modifiers[3], 0, (short)modifiers[2], (short)modifiers[2], (short)modifiers[2]);
+
+    // Saturating pack clamps the modified colors to 0-255
+    __m128i colors = _mm_packus_epi16(_mm_add_epi16(base, mod01), _mm_add_epi16(base, mod23));
+    colors = _mm_or_si128(colors, _mm_set1_epi32((int)0xff000000));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(palette), colors);
+#else
+    for (int i = 0; i < 4; ++i)
+    {
+        int r = Clamp(red + modifiers[i], 0, 255);
+        int g = Clamp(green + modifiers[i], 0, 255);
+        int b = Clamp(blue + modifiers[i], 0, 255);
+        palette[i] = (unsigned)((b << 16) | (g << 8) | r) | 0xff000000;
+    }
+#endif
 }
 
-static void DecompressETC(unsigned char* pDestData, const void* pSrcData)
+/// Write a decompressed ETC1 block to pixels with a row pitch. Only the given number of columns and rows are written for blocks at the image edges.
+static void WriteBlockETC(unsigned* dest, int pitch, const unsigned char* block, int columns, int rows)
 {
-    unsigned long blockTop, blockBot, *input = (unsigned long*)pSrcData, *output;
+    // The block is stored big-endian; read it the same way as the original little-endian 32-bit words
+    unsigned blockTop = block[0] | (block[1] << 8) | (block[2] << 16) | ((unsigned)block[3] << 24);
+    unsigned blockBot = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned)block[7] << 24);
     unsigned char red1, green1, blue1, red2, green2, blue2;
-    bool bFlip, bDiff;
-    int modtable1,modtable2;
-
-    blockTop = *(input++);
-    blockBot = *(input++);
-
-    output = (unsigned long*)pDestData;
-    // check flipbit
-    bFlip = (blockTop & ETC_FLIP) != 0;
-    bDiff = (blockTop & ETC_DIFF) != 0;
 
-    if(bDiff)
-    {    // differential mode 5 colour bits + 3 difference bits
-        // get base colour for subblock 1
-        blue1 = (unsigned char)((blockTop&0xf80000)>>16);
-        green1 = (unsigned char)((blockTop&0xf800)>>8);
-        red1 = (unsigned char)(blockTop&0xf8);
+    if (blockTop & ETC_DIFF)
+    {
+        // Differential mode 5 color bits + 3 difference bits
+        blue1 = (unsigned char)((blockTop & 0xf80000) >> 16);
+        green1 = (unsigned char)((blockTop & 0xf800) >> 8);
+        red1 = (unsigned char)(blockTop & 0xf8);
 
-        // get differential colour for subblock 2
-        signed char blues = (signed char)(blue1>>3) + ((signed char) ((blockTop & 0x70000) >> 11)>>5);
-        signed char greens = (signed char)(green1>>3) + ((signed char)((blockTop & 0x700) >>3)>>5);
-        signed char reds = (signed char)(red1>>3) + ((signed char)((blockTop & 0x7)<<5)>>5);
+        signed char blues = (signed char)(blue1 >> 3) + ((signed char)((blockTop & 0x70000) >> 11) >> 5);
+        signed char greens = (signed char)(green1 >> 3) + ((signed char)((blockTop & 0x700) >> 3) >> 5);
+        signed char reds = (signed char)(red1 >> 3) + ((signed char)((blockTop & 0x7) << 5) >> 5);
 
         blue2 = (unsigned char)blues;
         green2 = (unsigned char)greens;
         red2 = (unsigned char)reds;
 
-        red1 = red1 +(red1>>5);    // copy bits to lower sig
-        green1 = green1 + (green1>>5);    // copy bits to lower sig
-        blue1 = blue1 + (blue1>>5);    // copy bits to lower sig
+        red1 = red1 + (red1 >> 5);
+        green1 = green1 + (green1 >> 5);
+        blue1 = blue1 + (blue1 >> 5);
 
-        red2 = (red2<<3) +(red2>>2);    // copy bits to lower sig
-        green2 = (green2<<3) + (green2>>2);    // copy bits to lower sig
-        blue2 = (blue2<<3) + (blue2>>2);    // copy bits to lower sig
+        red2 = (red2 << 3) + (red2 >> 2);
+        green2 = (green2 << 3) + (green2 >> 2);
+        blue2 = (blue2 << 3) + (blue2 >> 2);
     }
     else
-    {    // individual mode 4 + 4 colour bits
-        // get base colour for subblock 1
-        blue1 = (unsigned char)((blockTop&0xf00000)>>16);
-        blue1 = blue1 +(blue1>>4);    // copy bits to lower sig
-        green1 = (unsigned char)((blockTop&0xf000)>>8);
-        green1 = green1 + (green1>>4);    // copy bits to lower sig
-        red1 = (unsigned char)(blockTop&0xf0);
-        red1 = red1 + (red1>>4);    // copy bits to lower sig
-
-        // get base colour for subblock 2
-        blue2 = (unsigned char)((blockTop&0xf0000)>>12);
-        blue2 = blue2 +(blue2>>4);    // copy bits to lower sig
-        green2 = (unsigned char)((blockTop&0xf00)>>4);
-        green2 = green2 + (green2>>4);    // copy bits to lower sig
-        red2 = (unsigned char)((blockTop&0xf)<<4);
-        red2 = red2 + (red2>>4);    // copy bits to lower sig
-    }
-    // get the modtables for each subblock
-    modtable1 = (blockTop>>29)&0x7;
-    modtable2 = (blockTop>>26)&0x7;
-
-    if(!bFlip)
-    {   // 2 2x4 blocks side by side
-        for(int j=0;j<4;j++)    // vertical
-        {
-            for(int k=0;k<2;k++)    // horizontal
-            {
-                *(output+j*4+k) = ModifyPixel(red1,green1,blue1,k,j,blockBot,modtable1);
-                *(output+j*4+k+2) = ModifyPixel(red2,green2,blue2,k+2,j,blockBot,modtable2);
-            }
-        }
+    {
+        // Individual mode 4 + 4 color bits
+        blue1 = (unsigned char)((blockTop & 0xf00000) >> 16);
+        blue1 = blue1 + (blue1 >> 4);
+        green1 = (unsigned char)((blockTop & 0xf000) >> 8);
+        green1 = green1 + (green1 >> 4);
+        red1 = (unsigned char)(blockTop & 0xf0);
+        red1 = red1 + (red1 >> 4);
+
+        blue2 = (unsigned char)((blockTop & 0xf0000) >> 12);
+        blue2 = blue2 + (blue2 >> 4);
+        green2 = (unsigned char)((blockTop & 0xf00) >> 4);
+        green2 = green2 + (green2 >> 4);
+        red2 = (unsigned char)((blockTop & 0xf) << 4);
+        red2 = red2 + (red2 >> 4);
     }
-    else
-    {   // 2 4x2 blocks on top of each other
-        for(int j=0;j<2;j++)
+
+    unsigned palettes[8];
+    ETCPalette(red1, green1, blue1, (blockTop >> 29) & 0x7, &palettes[0]);
+    ETCPalette(red2, green2, blue2, (blockTop >> 26) & 0x7, &palettes[4]);
+
+    // Gather the index bits of pixel x * 4 + y into two 16-bit words
+    unsigned lsbBits = ((blockBot >> 24) & 0xff) | (((blockBot >> 16) & 0xff) << 8);
+    unsigned msbBits = ((blockBot >> 8) & 0xff) | ((blockBot & 0xff) << 8);
+    bool flip = (blockTop & ETC_FLIP) != 0;
+
+    for (int y = 0; y < rows; ++y)
+    {
+        unsigned* row = dest + y * pitch;
+        for (int x = 0; x < columns; ++x)
         {
-            for(int k=0;k<4;k++)
-            {
-                *(output+j*4+k) = ModifyPixel(red1,green1,blue1,k,j,blockBot,modtable1);
-                *(output+(j+2)*4+k) = ModifyPixel(red2,green2,blue2,k,j+2,blockBot,modtable2);
-            }
+            int index = x * 4 + y;
+            unsigned subBlock = flip ? (y >> 1) : (x >> 1);
+            unsigned code = ((lsbBits >> index) & 0x1) | (((msbBits >> index) & 0x1) << 1);
+            row[x] = palettes[subBlock * 4 + code];
         }
     }
 }
 
-void DecompressImageETC( unsigned char* rgba, const void* blocks, int width, int height )
+void DecompressImageETC(unsigned char* rgba, const void* blocks, int width, int height)
 {
-    // initialise the block input
-    unsigned char const* sourceBlock = reinterpret_cast< unsigned char const* >( blocks );
-    int bytesPerBlock = 8;
+    const unsigned char* block = reinterpret_cast<const unsigned char*>(blocks);
+    unsigned* pixels = reinterpret_cast<unsigned*>(rgba);
 
-    // loop over blocks
-    for( int y = 0; y < height; y += 4 )
+    for (int y = 0; y < height; y += 4)
     {
-        for( int x = 0; x < width; x += 4 )
+        int rows = Min(height - y, 4);
+        for (int x = 0; x < width; x += 4)
         {
-            // decompress the block
-            unsigned char targetRgba[4*16];
-            DecompressETC( targetRgba, sourceBlock );
-
-            // write the decompressed pixels to the correct image locations
-            unsigned char const* sourcePixel = targetRgba;
-            for( int py = 0; py < 4; ++py )
-            {
-                for( int px = 0; px < 4; ++px )
-                {
-                    // get the target location
-                    int sx = x + px;
-                    int sy = y + py;
-                    if( sx < width && sy < height )
-                    {
-                        unsigned char* targetPixel = rgba + 4*( width*sy + sx );
-
-                        // copy the rgba value
-                        for( int i = 0; i < 4; ++i )
-                            *targetPixel++ = *sourcePixel++;
-                    }
-                    else
-                    {
-                        // skip this pixel as its outside the image
-                        sourcePixel += 4;
-                    }
-                }
-            }
-
-            // advance
-            sourceBlock += bytesPerBlock;
+            WriteBlockETC(pixels + (size_t)y * width + x, width, block, Min(width - x, 4), rows);
+            block += 8;
         }
     }
 }
@@ -918,3 +885,45 @@ void DecompressImagePVRTC(unsigned char* dest, const void *blocks, int width, in
         }
     }
 }
+
+void DecompressImageParallel(unsigned char* dest, const void* blocks, int width, int height, ImageFormat format)
+{
+    if (format >= FMT_PVRTC_RGB_2BPP)
+    {
+        DecompressImagePVRTC(dest, blocks, width, height, format);
+        return;
+    }
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    int numThreads = workQueue ? (int)workQueue->NumThreads() : 1;
+    if (numThreads < 2 || height <= DECOMPRESS_ROWS_PER_TASK)
+    {
+        if (format == FMT_ETC1)
+            DecompressImageETC(dest, blocks, width, height);
+        else
+            DecompressImageDXT(dest, blocks, width, height, format);
+        return;
+    }
+
+    // Split at block row boundaries into about four tasks per thread
+    int rowsPerTask = Max(DECOMPRESS_ROWS_PER_TASK, (height / (numThreads * 4) + 3) & ~3);
+    size_t numTasks = (height + rowsPerTask - 1) / rowsPerTask;
+    size_t bytesPerBlock = (format == FMT_DXT1 || format == FMT_ETC1) ? 8 : 16;
+    size_t blockRowSize = ((width + 3) / 4) * bytesPerBlock;
+
+    AutoArrayPtr<DecompressTask> tasks(new DecompressTask[numTasks]);
+    TaskCounter counter(0);
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        DecompressTask& task = tasks[i];
+        int startRow = (int)i * rowsPerTask;
+        task.dest = dest + (size_t)startRow * width * 4;
+        task.blocks = reinterpret_cast<const unsigned char*>(blocks) + (startRow / 4) * blockRowSize;
+        task.width = width;
+        task.height = Min(rowsPerTask, height - startRow);
+        task.format = format;
+        workQueue->QueueTask(&task, &counter);
+    }
+
+    workQueue->Complete(counter);
+}
@@ -10,3 +10,5 @@ void DecompressImageDXT(unsigned char* dest, const void* blocks, int width, int
 void DecompressImageETC(unsigned char* dest, const void* blocks, int width, int height);
 /// Decompress PVRTC image data.
 void DecompressImagePVRTC(unsigned char* dest, const void* blocks, int width, int height, ImageFormat format);
+/// Decompress DXT, ETC or PVRTC image data. DXT and ETC images are split into block rows for the worker threads if the work queue exists.
+void DecompressImageParallel(unsigned char* dest, const void* blocks, int width, int height, ImageFormat format);
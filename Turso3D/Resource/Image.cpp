@@ -3,11 +3,31 @@
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
 #include "../Math/Math.h"
+#include "../Object/MemoryTracker.h"
+#include "../Thread/WorkQueue.h"
 #include "../Time/Profiler.h"
+#include "Compress.h"
 #include "Decompress.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
+
+#ifdef TURSO3D_LIBJPEG_TURBO
+#include <csetjmp>
+#include <jpeglib.h>
+#ifndef JCS_EXTENSIONS
+#error TURSO3D_LIBJPEG_TURBO requires libjpeg-turbo, plain libjpeg lacks RGBA output and scanline skipping
+#endif
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TURSO3D_SSE
+#include <emmintrin.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -25,6 +45,554 @@
 #define FOURCC_DXT4 (MAKEFOURCC('D','X','T','4'))
 #define FOURCC_DXT5 (MAKEFOURCC('D','X','T','5'))
 
+// DDS header flags used when saving
+static const unsigned DDSD_CAPS = 0x1;
+static const unsigned DDSD_HEIGHT = 0x2;
+static const unsigned DDSD_WIDTH = 0x4;
+static const unsigned DDSD_PIXELFORMAT = 0x1000;
+static const unsigned DDSD_MIPMAPCOUNT = 0x20000;
+static const unsigned DDSD_LINEARSIZE = 0x80000;
+static const unsigned DDPF_FOURCC = 0x4;
+static const unsigned DDSCAPS_COMPLEX = 0x8;
+static const unsigned DDSCAPS_TEXTURE = 0x1000;
+static const unsigned DDSCAPS_MIPMAP = 0x400000;
+
+// KTX2 supercompression schemes
+static const unsigned KTX2_SUPERCOMPRESSION_NONE = 0;
+static const unsigned KTX2_SUPERCOMPRESSION_BASISLZ = 1;
+static const unsigned KTX2_SUPERCOMPRESSION_ZLIB = 3;
+
+/// Minimum number of destination rows per mip generation task.
+static const int MIP_ROWS_PER_TASK = 32;
+/// Minimum number of pixels for decoding a JPEG image in stripes on the worker threads.
+static const int JPEG_STRIPE_MIN_PIXELS = 1024 * 1024;
+/// JPEG stripe row alignment, which is the largest MCU height.
+static const int JPEG_STRIPE_ALIGNMENT = 16;
+/// Kaiser filter radius in destination pixels.
+static const int KAISER_RADIUS = 2;
+/// Kaiser filter taps in source pixels.
+static const int KAISER_TAPS = KAISER_RADIUS * 4;
+/// Kaiser window shape parameter.
+static const float KAISER_ALPHA = 4.0f;
+/// Size of the linear to sRGB lookup table.
+static const int SRGB_TABLE_SIZE = 65536;
+
+/// Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+static float BesselI0(float x)
+{
+    float sum = 1.0f;
+    float term = 1.0f;
+    float halfX = x * 0.5f;
+
+    for (int k = 1; k < 32; ++k)
+    {
+        term *= (halfX / k) * (halfX / k);
+        sum += term;
+        if (term < sum * 1e-7f)
+            break;
+    }
+
+    return sum;
+}
+
+/// Lookup tables for mip generation, created on first use.
+struct MipTables
+{
+    /// Construct.
+    MipTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            float value = i / 255.0f;
+            toLinear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+        }
+
+        for (int i = 0; i < SRGB_TABLE_SIZE; ++i)
+        {
+            float value = (float)i / (SRGB_TABLE_SIZE - 1);
+            value = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+            fromLinear[i] = (unsigned char)(value * 255.0f + 0.5f);
+        }
+
+        // Windowed sinc taps around the destination pixel center, which is halfway between the middle source pixels
+        float sum = 0.0f;
+        for (int i = 0; i < KAISER_TAPS; ++i)
+        {
+            float t = (i - (KAISER_TAPS - 1) * 0.5f) * 0.5f;
+            float sinc = sinf(M_PI * t) / (M_PI * t);
+            float ratio = t / KAISER_RADIUS;
+            kaiserWeights[i] = sinc * BesselI0(KAISER_ALPHA * sqrtf(1.0f - ratio * ratio)) / BesselI0(KAISER_ALPHA);
+            sum += kaiserWeights[i];
+        }
+        for (int i = 0; i < KAISER_TAPS; ++i)
+            kaiserWeights[i] /= sum;
+    }
+
+    /// Convert a linear value to sRGB.
+    unsigned char FromLinear(float value) const { return fromLinear[(int)(Clamp(value, 0.0f, 1.0f) * (SRGB_TABLE_SIZE - 1) + 0.5f)]; }
+
+    /// sRGB to linear conversion.
+    float toLinear[256];
+    /// Linear to sRGB conversion.
+    unsigned char fromLinear[SRGB_TABLE_SIZE];
+    /// Normalized Kaiser filter weights.
+    float kaiserWeights[KAISER_TAPS];
+};
+
+/// Return the mip generation lookup tables.
+static const MipTables& GetMipTables()
+{
+    static const MipTables tables;
+    return tables;
+}
+
+#ifdef TURSO3D_SSE
+/// Reorder 16-bit component sums of adjacent pixels so that the sums to be averaged horizontally are neighbors.
+static inline __m128i PairComponents(__m128i v, int components)
+{
+    if (components == 2)
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    else if (components == 4)
+        return _mm_unpacklo_epi16(v, _mm_srli_si128(v, 8));
+    else
+        return v;
+}
+#endif
+
+/// Compute destination rows of a mip level with a 2x2 box filter.
+static void BoxFilterRows(unsigned char* dest, const unsigned char* src, const IntVector2& srcSize, const IntVector2& destSize, int components, int startRow, int endRow, bool sRGB)
+{
+    size_t srcRowSize = (size_t)srcSize.x * components;
+    int destRowSize = destSize.x * components;
+
+    for (int y = startRow; y < endRow; ++y)
+    {
+        // With an odd or single pixel source the last row and column are clamped
+        const unsigned char* upper = src + (size_t)(y * 2) * srcRowSize;
+        const unsigned char* lower = src + (size_t)Min(y * 2 + 1, srcSize.y - 1) * srcRowSize;
+        unsigned char* out = dest + (size_t)y * destRowSize;
+
+        if (sRGB && components == 4)
+        {
+            const MipTables& tables = GetMipTables();
+
+            for (int x = 0; x < destSize.x; ++x)
+            {
+                int x0 = x * 8;
+                int x1 = Min(x * 2 + 1, srcSize.x - 1) * 4;
+
+                for (int i = 0; i < 3; ++i)
+                {
+                    out[x * 4 + i] = tables.FromLinear((tables.toLinear[upper[x0 + i]] + tables.toLinear[upper[x1 + i]] +
+                        tables.toLinear[lower[x0 + i]] + tables.toLinear[lower[x1 + i]]) * 0.25f);
+                }
+                out[x * 4 + 3] = (unsigned char)(((unsigned)upper[x0 + 3] + upper[x1 + 3] + lower[x0 + 3] + lower[x1 + 3] + 2) >> 2);
+            }
+            continue;
+        }
+
+        int x = 0;
+
+    #ifdef TURSO3D_SSE
+        // Eight destination bytes from sixteen source bytes of both rows per iteration
+        if (srcSize.x > 1)
+        {
+            __m128i zero = _mm_setzero_si128();
+            __m128i ones = _mm_set1_epi16(1);
+            __m128i round = _mm_set1_epi16(2);
+
+            for (; x + 8 <= destRowSize; x += 8)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(upper + x * 2));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower + x * 2));
+                __m128i lo = PairComponents(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)), components);
+                __m128i hi = PairComponents(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)), components);
+                __m128i sums = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+                sums = _mm_srli_epi16(_mm_add_epi16(sums, round), 2);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sums, zero));
+            }
+        }
+    #endif
+
+        for (; x < destRowSize; ++x)
+        {
+            int pixel = x / components;
+            int component = x - pixel * components;
+            int x0 = pixel * 2 * components + component;
+            int x1 = Min(pixel * 2 + 1, srcSize.x - 1) * components + component;
+            out[x] = (unsigned char)(((unsigned)upper[x0] + upper[x1] + lower[x0] + lower[x1] + 2) >> 2);
+        }
+    }
+}
+
+/// Convert a row of filtered values to 8-bit.
+static void StoreFilteredRow(unsigned char* dest, const float* values, int count, int components, bool sRGB)
+{
+    if (sRGB && components == 4)
+    {
+        const MipTables& tables = GetMipTables();
+
+        for (int x = 0; x < count; x += 4)
+        {
+            dest[x] = tables.FromLinear(values[x]);
+            dest[x + 1] = tables.FromLinear(values[x + 1]);
+            dest[x + 2] = tables.FromLinear(values[x + 2]);
+            dest[x + 3] = (unsigned char)Clamp((int)(values[x + 3] * 255.0f + 0.5f), 0, 255);
+        }
+        return;
+    }
+
+    int x = 0;
+
+#ifdef TURSO3D_SSE
+    __m128 scale = _mm_set1_ps(255.0f);
+    for (; x + 8 <= count; x += 8)
+    {
+        __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(values + x), scale));
+        __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(values + x + 4), scale));
+        __m128i words = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x), _mm_packus_epi16(words, words));
+    }
+#endif
+
+    for (; x < count; ++x)
+        dest[x] = (unsigned char)Clamp((int)(values[x] * 255.0f + 0.5f), 0, 255);
+}
+
+/// Compute destination rows of a mip level with a separable Kaiser-windowed sinc filter. Source pixels outside the image are clamped to the edge.
+static void KaiserFilterRows(unsigned char* dest, const unsigned char* src, const IntVector2& srcSize, const IntVector2& destSize, int components, int startRow, int endRow, bool sRGB)
+{
+    const MipTables& tables = GetMipTables();
+    const float* weights = tables.kaiserWeights;
+    const int padLeft = KAISER_TAPS / 2 - 1;
+
+    size_t srcRowSize = (size_t)srcSize.x * components;
+    int destRowSize = destSize.x * components;
+    int firstSrcRow = startRow * 2 - padLeft;
+    int numSrcRows = (endRow - startRow - 1) * 2 + KAISER_TAPS;
+
+    // Expanded source row with clamped edges, horizontally filtered source rows and one vertically filtered row
+    std::vector<float> line((srcSize.x + KAISER_TAPS) * components);
+    std::vector<float> filtered((size_t)numSrcRows * destRowSize);
+    std::vector<float> out(destRowSize);
+
+    for (int i = 0; i < numSrcRows; ++i)
+    {
+        const unsigned char* in = src + (size_t)Clamp(firstSrcRow + i, 0, srcSize.y - 1) * srcRowSize;
+        size_t lineSize = line.size() / components;
+
+        for (size_t j = 0; j < lineSize; ++j)
+        {
+            const unsigned char* pixel = in + Clamp((int)j - padLeft, 0, srcSize.x - 1) * components;
+            float* linePixel = &line[j * components];
+
+            for (int k = 0; k < components; ++k)
+                linePixel[k] = (sRGB && components == 4 && k < 3) ? tables.toLinear[pixel[k]] : pixel[k] * (1.0f / 255.0f);
+        }
+
+        float* row = &filtered[(size_t)i * destRowSize];
+
+    #ifdef TURSO3D_SSE
+        if (components == 4)
+        {
+            for (int x = 0; x < destSize.x; ++x)
+            {
+                const float* taps = &line[x * 8];
+                __m128 sum = _mm_mul_ps(_mm_loadu_ps(taps), _mm_set1_ps(weights[0]));
+                for (int t = 1; t < KAISER_TAPS; ++t)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(taps + t * 4), _mm_set1_ps(weights[t])));
+                _mm_storeu_ps(row + x * 4, sum);
+            }
+            continue;
+        }
+    #endif
+
+        for (int x = 0; x < destSize.x; ++x)
+        {
+            for (int k = 0; k < components; ++k)
+            {
+                const float* taps = &line[x * 2 * components + k];
+                float sum = 0.0f;
+                for (int t = 0; t < KAISER_TAPS; ++t)
+                    sum += taps[t * components] * weights[t];
+                row[x * components + k] = sum;
+            }
+        }
+    }
+
+    for (int y = startRow; y < endRow; ++y)
+    {
+        const float* rows = &filtered[(size_t)(y - startRow) * 2 * destRowSize];
+        int x = 0;
+
+    #ifdef TURSO3D_SSE
+        for (; x + 4 <= destRowSize; x += 4)
+        {
+            __m128 sum = _mm_mul_ps(_mm_loadu_ps(rows + x), _mm_set1_ps(weights[0]));
+            for (int t = 1; t < KAISER_TAPS; ++t)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows + t * destRowSize + x), _mm_set1_ps(weights[t])));
+            _mm_storeu_ps(&out[x], sum);
+        }
+    #endif
+
+        for (; x < destRowSize; ++x)
+        {
+            float sum = 0.0f;
+            for (int t = 0; t < KAISER_TAPS; ++t)
+                sum += rows[t * destRowSize + x] * weights[t];
+            out[x] = sum;
+        }
+
+        StoreFilteredRow(dest + (size_t)y * destRowSize, &out[0], destRowSize, components, sRGB);
+    }
+}
+
+/// Compute destination rows of a mip level.
+static void FilterMipRows(unsigned char* dest, const unsigned char* src, const IntVector2& srcSize, const IntVector2& destSize, int components, int startRow, int endRow, MipFilter filter, bool sRGB)
+{
+    if (filter == MIP_FILTER_KAISER)
+        KaiserFilterRows(dest, src, srcSize, destSize, components, startRow, endRow, sRGB);
+    else
+        BoxFilterRows(dest, src, srcSize, destSize, components, startRow, endRow, sRGB);
+}
+
+/// %Task for computing a range of rows of a mip level.
+class MipTask : public Task
+{
+public:
+    /// Filter the rows.
+    void Complete(unsigned) override
+    {
+        FilterMipRows(dest, src, srcSize, destSize, components, startRow, endRow, filter, sRGB);
+    }
+
+    /// Destination pixels.
+    unsigned char* dest;
+    /// Source pixels.
+    const unsigned char* src;
+    /// Source level size.
+    IntVector2 srcSize;
+    /// Destination level size.
+    IntVector2 destSize;
+    /// Pixel components.
+    int components;
+    /// First destination row.
+    int startRow;
+    /// Destination row to stop at.
+    int endRow;
+    /// Filter.
+    MipFilter filter;
+    /// Average in linear space.
+    bool sRGB;
+};
+
+/// Compute a mip level, splitting large levels into row ranges for the worker threads.
+static void FilterMipLevel(unsigned char* dest, const unsigned char* src, const IntVector2& srcSize, const IntVector2& destSize, int components, MipFilter filter, bool sRGB)
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    int numThreads = workQueue ? (int)workQueue->NumThreads() : 1;
+    if (numThreads < 2 || destSize.y < MIP_ROWS_PER_TASK * 2)
+    {
+        FilterMipRows(dest, src, srcSize, destSize, components, 0, destSize.y, filter, sRGB);
+        return;
+    }
+
+    int rowsPerTask = Max(MIP_ROWS_PER_TASK, destSize.y / (numThreads * 4));
+    size_t numTasks = (destSize.y + rowsPerTask - 1) / rowsPerTask;
+
+    AutoArrayPtr<MipTask> tasks(new MipTask[numTasks]);
+    TaskCounter counter(0);
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        MipTask& task = tasks[i];
+        task.dest = dest;
+        task.src = src;
+        task.srcSize = srcSize;
+        task.destSize = destSize;
+        task.components = components;
+        task.startRow = (int)i * rowsPerTask;
+        task.endRow = Min(task.startRow + rowsPerTask, destSize.y);
+        task.filter = filter;
+        task.sRGB = sRGB;
+        workQueue->QueueTask(&task, &counter);
+    }
+
+    workQueue->Complete(counter);
+}
+
+/// Return the image format of a KTX2 Vulkan format. sRGB formats return their linear counterpart. Return FMT_NONE if not supported.
+static ImageFormat KTX2Format(unsigned vkFormat)
+{
+    switch (vkFormat)
+    {
+    case 9:
+        return FMT_R8;
+    case 16:
+        return FMT_RG8;
+    case 37:
+    case 43:
+        return FMT_RGBA8;
+    case 70:
+        return FMT_R16;
+    case 76:
+        return FMT_R16F;
+    case 77:
+        return FMT_RG16;
+    case 83:
+        return FMT_RG16F;
+    case 91:
+        return FMT_RGBA16;
+    case 97:
+        return FMT_RGBA16F;
+    case 98:
+        return FMT_R32U;
+    case 100:
+        return FMT_R32F;
+    case 101:
+        return FMT_RG32U;
+    case 103:
+        return FMT_RG32F;
+    case 106:
+        return FMT_RGB32F;
+    case 107:
+        return FMT_RGBA32U;
+    case 109:
+        return FMT_RGBA32F;
+    case 131:
+    case 132:
+    case 133:
+    case 134:
+        return FMT_DXT1;
+    case 135:
+    case 136:
+        return FMT_DXT3;
+    case 137:
+    case 138:
+        return FMT_DXT5;
+    case 1000054000:
+        return FMT_PVRTC_RGBA_2BPP;
+    case 1000054001:
+        return FMT_PVRTC_RGBA_4BPP;
+    default:
+        return FMT_NONE;
+    }
+}
+
+#ifdef TURSO3D_LIBJPEG_TURBO
+/// libjpeg error manager that returns to the decoding function instead of exiting the process.
+struct JpegErrorManager
+{
+    /// Standard error manager.
+    jpeg_error_mgr base;
+    /// Return point.
+    jmp_buf returnPoint;
+};
+
+/// Return from a fatal libjpeg error.
+static void JpegErrorExit(j_common_ptr info)
+{
+    longjmp(((JpegErrorManager*)info->err)->returnPoint, 1);
+}
+
+/// Suppress libjpeg messages. Failed images are decoded again with stb_image, which reports the error.
+static void JpegOutputMessage(j_common_ptr)
+{
+}
+
+/// Read a JPEG header. Return false if not a JPEG image or of a color space that is not decoded directly, such as CMYK.
+static bool ReadJpegHeader(const unsigned char* encoded, size_t encodedSize, int& width, int& height, int& components, bool& progressive)
+{
+    jpeg_decompress_struct info;
+    JpegErrorManager error;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = JpegErrorExit;
+    error.base.output_message = JpegOutputMessage;
+    if (setjmp(error.returnPoint))
+    {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, encoded, (unsigned long)encodedSize);
+    jpeg_read_header(&info, TRUE);
+
+    bool supported = info.jpeg_color_space == JCS_GRAYSCALE || info.jpeg_color_space == JCS_YCbCr || info.jpeg_color_space == JCS_RGB;
+    width = (int)info.image_width;
+    height = (int)info.image_height;
+    // RGB is decoded as RGBA, as there are no 24-bit formats
+    components = info.jpeg_color_space == JCS_GRAYSCALE ? 1 : 4;
+    progressive = jpeg_has_multiple_scans(&info) != 0;
+
+    jpeg_destroy_decompress(&info);
+    return supported;
+}
+
+/// Decode a range of JPEG rows directly into the destination image data. Rows before the range are entropy decoded but not transformed. Return true on success.
+static bool DecodeJpegRows(const unsigned char* encoded, size_t encodedSize, unsigned char* dest, int components, int startRow, int endRow)
+{
+    jpeg_decompress_struct info;
+    JpegErrorManager error;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = JpegErrorExit;
+    error.base.output_message = JpegOutputMessage;
+    if (setjmp(error.returnPoint))
+    {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, encoded, (unsigned long)encodedSize);
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = components == 1 ? JCS_GRAYSCALE : JCS_EXT_RGBA;
+    jpeg_start_decompress(&info);
+
+    size_t rowSize = (size_t)info.output_width * components;
+    if (startRow > 0)
+        jpeg_skip_scanlines(&info, (JDIMENSION)startRow);
+
+    JSAMPROW rows[JPEG_STRIPE_ALIGNMENT];
+    while ((int)info.output_scanline < endRow)
+    {
+        int numRows = Min(endRow - (int)info.output_scanline, JPEG_STRIPE_ALIGNMENT);
+        for (int i = 0; i < numRows; ++i)
+            rows[i] = dest + (info.output_scanline + i) * rowSize;
+        jpeg_read_scanlines(&info, rows, (JDIMENSION)numRows);
+    }
+
+    // Destroying also aborts, so the rest of a stripe's data is not decoded
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+/// %Task for decoding a stripe of JPEG rows.
+class JpegStripeTask : public Task
+{
+public:
+    /// Decode the rows.
+    void Complete(unsigned) override
+    {
+        success = DecodeJpegRows(encoded, encodedSize, dest, components, startRow, endRow);
+    }
+
+    /// Encoded image.
+    const unsigned char* encoded;
+    /// Encoded image size.
+    size_t encodedSize;
+    /// Destination pixels.
+    unsigned char* dest;
+    /// Pixel components.
+    int components;
+    /// First row.
+    int startRow;
+    /// Row to stop at.
+    int endRow;
+    /// Decoding result.
+    bool success;
+};
+#endif
+
 const int Image::components[] =
 {
     0,      // FMT_NONE
@@ -48,6 +616,7 @@ const int Image::components[] =
     0,      // FMT_D16
     0,      // FMT_D32
     0,      // FMT_D24S8
+    0,      // FMT_D32F
     0,      // FMT_DXT1
     0,      // FMT_DXT3
     0,      // FMT_DXT5
@@ -81,6 +650,7 @@ const size_t Image::pixelByteSizes[] =
     2,      // FMT_D16
     4,      // FMT_D32
     4,      // FMT_D24S8
+    4,      // FMT_D32F
     0,      // FMT_DXT1
     0,      // FMT_DXT3
     0,      // FMT_DXT5
@@ -244,7 +814,11 @@ ImageLevel::ImageLevel(const IntVector3& size_, ImageFormat format_, const void*
 Image::Image() :
     size(IntVector3::ZERO),
     format(FMT_NONE),
-    numLevels(1)
+    numLevels(1),
+    dataCapacity(0),
+    sourceData(nullptr),
+    referenceSource(false),
+    reserveMipChain(false)
 {
 }
 
@@ -260,8 +834,12 @@ void Image::RegisterObject()
 bool Image::BeginLoad(Stream& source)
 {
     PROFILE(LoadImage);
+    MEMORY_SCOPE(MEMORY_IMAGE);
 
-    // Check for DDS, KTX or PVR compressed format
+    sourceData = nullptr;
+    levelOffsets.clear();
+
+    // Check for DDS, KTX, KTX2 or PVR compressed format
     std::string fileID = source.ReadFileID();
 
     if (fileID == "DDS ")
@@ -290,13 +868,16 @@ bool Image::BeginLoad(Stream& source)
         }
 
         size_t dataSize = source.Size() - source.Position();
-        data = new unsigned char[dataSize];
         size = IntVector3(ddsd.dwWidth, ddsd.dwHeight, Max(ddsd.dwDepth, 1));
         numLevels = ddsd.dwMipMapCount ? ddsd.dwMipMapCount : 1;
-        source.Read(data.Get(), dataSize);
+        ReadCompressedData(source, dataSize);
     }
     else if (fileID == "\253KTX")
     {
+        // KTX2 shares the start of the identifier
+        if (source.ReadFileID() == " 20\273")
+            return LoadKTX2(source);
+
         source.Seek(12);
 
         unsigned endianness = source.Read<unsigned>();
@@ -383,6 +964,7 @@ bool Image::BeginLoad(Stream& source)
         size_t dataSize = source.Size() - source.Position() - mipmaps * sizeof(unsigned);
 
         data = new unsigned char[dataSize];
+        dataCapacity = dataSize;
         size = IntVector3(imageWidth, imageHeight, 1);
         numLevels = mipmaps;
 
@@ -474,47 +1056,29 @@ bool Image::BeginLoad(Stream& source)
         source.Seek(source.Position() + metaDataSize);
         size_t dataSize = source.Size() - source.Position();
 
-        data = new unsigned char[dataSize];
         size = IntVector3(imageWidth, imageHeight, 1);
         numLevels = mipmapCount;
-
-        source.Read(data.Get(), dataSize);
+        ReadCompressedData(source, dataSize);
     }
     else
     {
-        // Not DDS, KTX or PVR, use STBImage to load other image formats as uncompressed
+        // Not DDS, KTX, KTX2 or PVR, decode other image formats as uncompressed. Read the encoded data in place if the stream allows
         source.Seek(0);
-        int imageWidth, imageHeight, imageDepth;
-        unsigned imageComponents;
-        unsigned char* pixelData = DecodePixelData(source, imageWidth, imageHeight, imageDepth, imageComponents);
-        if (!pixelData)
+        size_t encodedSize = source.Size();
+        AutoArrayPtr<unsigned char> buffer;
+        const unsigned char* encoded = source.ReadInPlace(encodedSize);
+        if (!encoded)
         {
-            LOGERROR("Could not load image " + source.Name() + ": " + std::string(stbi_failure_reason()));
-            return false;
+            buffer = new unsigned char[encodedSize];
+            source.Read(buffer.Get(), encodedSize);
+            encoded = buffer.Get();
         }
-        
-        SetSize(IntVector3(imageWidth, imageHeight, imageDepth), componentsToFormat[imageComponents]);
 
-        if (imageComponents != 3)
-            SetData(pixelData);
-        else
+        if (!DecodePixelData(encoded, encodedSize))
         {
-            // Convert RGB to RGBA as for example Direct3D 11 does not support 24-bit formats
-            AutoArrayPtr<unsigned char> rgbaData(new unsigned char[4 * imageWidth * imageHeight]);
-            unsigned char* src = pixelData;
-            unsigned char* dest = rgbaData.Get();
-            for (int i = 0; i < imageWidth * imageHeight; ++i)
-            {
-                *dest++ = *src++;
-                *dest++ = *src++;
-                *dest++ = *src++;
-                *dest++ = 0xff;
-            }
-
-            SetData(rgbaData.Get());
+            LOGERROR("Could not load image " + source.Name() + ": " + std::string(stbi_failure_reason()));
+            return false;
         }
-
-        FreePixelData(pixelData);
     }
 
     return true;
@@ -526,8 +1090,42 @@ bool Image::Save(Stream& dest)
 
     if (IsCompressed())
     {
-        LOGERROR("Can not save compressed image " + Name());
-        return false;
+        if (format > FMT_DXT5 || size.z != 1)
+        {
+            LOGERROR("Can not save compressed image " + Name());
+            return false;
+        }
+
+        DDSurfaceDesc2 ddsd;
+        memset(&ddsd, 0, sizeof ddsd);
+        ddsd.dwSize = sizeof ddsd;
+        ddsd.dwFlags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
+        ddsd.dwWidth = size.x;
+        ddsd.dwHeight = size.y;
+        ddsd.dwLinearSize = (unsigned)Level(0).dataSize;
+        ddsd.ddpfPixelFormat.dwSize = sizeof ddsd.ddpfPixelFormat;
+        ddsd.ddpfPixelFormat.dwFlags = DDPF_FOURCC;
+        ddsd.ddpfPixelFormat.dwFourCC = format == FMT_DXT1 ? FOURCC_DXT1 : (format == FMT_DXT3 ? FOURCC_DXT3 : FOURCC_DXT5);
+        ddsd.ddsCaps.dwCaps = DDSCAPS_TEXTURE;
+        if (numLevels > 1)
+        {
+            ddsd.dwFlags |= DDSD_MIPMAPCOUNT;
+            ddsd.dwMipMapCount = (unsigned)numLevels;
+            ddsd.ddsCaps.dwCaps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+        }
+
+        dest.WriteFileID("DDS ");
+        dest.Write(&ddsd, sizeof ddsd);
+
+        // Write level by level, as levels referenced in place may not be consecutive
+        for (size_t i = 0; i < numLevels; ++i)
+        {
+            ImageLevel level = Level(i);
+            if (dest.Write(level.data, level.dataSize) != level.dataSize)
+                return false;
+        }
+
+        return true;
     }
 
     if (!data)
@@ -558,7 +1156,10 @@ void Image::SetSize(const IntVector2& newSize, ImageFormat newFormat)
 void Image::SetSize(const IntVector3& newSize, ImageFormat newFormat)
 {
     if (newSize == size && newFormat == format)
+    {
+        numLevels = 1;
         return;
+    }
 
     if (newSize.x <= 0 || newSize.y <= 0 || newSize.z <= 0)
     {
@@ -571,7 +1172,12 @@ void Image::SetSize(const IntVector3& newSize, ImageFormat newFormat)
         return;
     }
 
-    data = new unsigned char[newSize.x * newSize.y * newSize.z * pixelByteSizes[newFormat]];
+    dataCapacity = (size_t)newSize.x * newSize.y * newSize.z * pixelByteSizes[newFormat];
+    if (reserveMipChain)
+        dataCapacity = MipChainDataSize(IntVector3(newSize.x, newSize.y, 1), newFormat) * newSize.z;
+    data = new unsigned char[dataCapacity];
+    sourceData = nullptr;
+    levelOffsets.clear();
     size = newSize;
     format = newFormat;
     numLevels = 1;
@@ -585,23 +1191,75 @@ void Image::SetData(const unsigned char* pixelData)
         LOGERROR("Can not set pixel data of a compressed image");
 }
 
-unsigned char* Image::DecodePixelData(Stream& source, int& width, int& height, int& depth, unsigned& pixelByteSize)
+bool Image::DecodePixelData(const unsigned char* encoded, size_t encodedSize)
 {
-    size_t dataSize = source.Size();
+    #ifdef TURSO3D_LIBJPEG_TURBO
+    if (DecodeJpeg(encoded, encodedSize))
+        return true;
+    #endif
 
-    AutoArrayPtr<unsigned char> buffer(new unsigned char[dataSize]);
-    source.Read(buffer.Get(), dataSize);
-    depth = 1;
-    return stbi_load_from_memory(buffer.Get(), (int)dataSize, &width, &height, (int *)&pixelByteSize, 0);
-}
+    int width, height, fileComponents;
+    if (!stbi_info_from_memory(encoded, (int)encodedSize, &width, &height, &fileComponents))
+        return false;
 
-void Image::FreePixelData(unsigned char* pixelData)
-{
+    // Let the decoder convert RGB to RGBA as there are no 24-bit formats
+    int components = fileComponents == 3 ? 4 : fileComponents;
+    unsigned char* pixelData = stbi_load_from_memory(encoded, (int)encodedSize, &width, &height, &fileComponents, components);
     if (!pixelData)
-        return;
+        return false;
 
+    SetSize(IntVector3(width, height, 1), componentsToFormat[components]);
+    SetData(pixelData);
     stbi_image_free(pixelData);
+    return true;
+}
+
+#ifdef TURSO3D_LIBJPEG_TURBO
+bool Image::DecodeJpeg(const unsigned char* encoded, size_t encodedSize)
+{
+    int width, height, components;
+    bool progressive;
+    if (!ReadJpegHeader(encoded, encodedSize, width, height, components, progressive))
+        return false;
+
+    SetSize(IntVector3(width, height, 1), componentsToFormat[components]);
+
+    // Progressive images must be decoded in full before any rows are output, so they can not be split
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    int numThreads = workQueue ? (int)workQueue->NumThreads() : 1;
+    if (progressive || numThreads < 2 || width * height < JPEG_STRIPE_MIN_PIXELS)
+        return DecodeJpegRows(encoded, encodedSize, data.Get(), components, 0, height);
+
+    // Each stripe entropy decodes the rows above it, but the inverse transform and color conversion, which are most of the work, are split
+    int rowsPerTask = (height / numThreads + JPEG_STRIPE_ALIGNMENT - 1) & ~(JPEG_STRIPE_ALIGNMENT - 1);
+    size_t numTasks = (height + rowsPerTask - 1) / rowsPerTask;
+
+    AutoArrayPtr<JpegStripeTask> tasks(new JpegStripeTask[numTasks]);
+    TaskCounter counter(0);
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        JpegStripeTask& task = tasks[i];
+        task.encoded = encoded;
+        task.encodedSize = encodedSize;
+        task.dest = data.Get();
+        task.components = components;
+        task.startRow = (int)i * rowsPerTask;
+        task.endRow = Min(task.startRow + rowsPerTask, height);
+        task.success = false;
+        workQueue->QueueTask(&task, &counter);
+    }
+
+    workQueue->Complete(counter);
+
+    for (size_t i = 0; i < numTasks; ++i)
+    {
+        if (!tasks[i].success)
+            return false;
+    }
+
+    return true;
 }
+#endif
 
 bool Image::GenerateMipImage(Image& dest) const
 {
@@ -614,58 +1272,102 @@ bool Image::GenerateMipImage(Image& dest) const
         return false;
     }
 
+    // \todo Actually support 3D images
     IntVector3 sizeOut(Max(size.x / 2, 1), Max(size.y / 2, 1), Max(size.z / 2, 1));
     dest.SetSize(sizeOut, format);
 
-    const unsigned char* pixelDataIn = data.Get();
-    unsigned char* pixelDataOut = dest.data.Get();
+    FilterMipLevel(dest.data.Get(), data.Get(), Size2D(), dest.Size2D(), pixelByteSize, MIP_FILTER_BOX, false);
+    return true;
+}
+
+bool Image::GenerateMipChain(MipFilter filter, bool sRGB)
+{
+    PROFILE(GenerateMipChain);
 
-    // \todo Actually support 3D images
-    switch (pixelByteSize)
+    int pixelByteSize = Components();
+    if (pixelByteSize < 1 || pixelByteSize > 4 || size.z != 1)
     {
-    case 1:
-        for (int y = 0; y < sizeOut.y; ++y)
-        {
-            const unsigned char* inUpper = &pixelDataIn[(y * 2) * size.x];
-            const unsigned char* inLower = &pixelDataIn[(y * 2 + 1) * size.x];
-            unsigned char* out = &pixelDataOut[y * sizeOut.x];
+        LOGERROR("Unsupported format for generating a mip chain");
+        return false;
+    }
 
-            for (int x = 0; x < sizeOut.x; ++x)
-                out[x] = ((unsigned)inUpper[x * 2] + inUpper[x * 2 + 1] + inLower[x * 2] + inLower[x * 2 + 1]) >> 2;
-        }
-        break;
+    // Reallocate unless the space was reserved when setting the size
+    size_t totalDataSize = MipChainDataSize(size, format);
+    if (dataCapacity < totalDataSize)
+    {
+        unsigned char* chain = new unsigned char[totalDataSize];
+        memcpy(chain, data.Get(), (size_t)size.x * size.y * pixelByteSize);
+        data = chain;
+        dataCapacity = totalDataSize;
+    }
 
-    case 2:
-        for (int y = 0; y < sizeOut.y; ++y)
-        {
-            const unsigned char* inUpper = &pixelDataIn[(y * 2) * size.x * 2];
-            const unsigned char* inLower = &pixelDataIn[(y * 2 + 1) * size.x * 2];
-            unsigned char* out = &pixelDataOut[y * sizeOut.x * 2];
+    numLevels = 1;
+    while ((size.x >> (numLevels - 1)) > 1 || (size.y >> (numLevels - 1)) > 1)
+        ++numLevels;
 
-            for (int x = 0; x < sizeOut.x * 2; x += 2)
-            {
-                out[x] = ((unsigned)inUpper[x * 2] + inUpper[x * 2 + 2] + inLower[x * 2] + inLower[x * 2 + 2]) >> 2;
-                out[x + 1] = ((unsigned)inUpper[x * 2 + 1] + inUpper[x * 2 + 3] + inLower[x * 2 + 1] + inLower[x * 2 + 3]) >> 2;
-            }
-        }
-        break;
+    unsigned char* src = data.Get();
+    IntVector2 srcSize = Size2D();
+    for (size_t i = 1; i < numLevels; ++i)
+    {
+        unsigned char* dest = src + (size_t)srcSize.x * srcSize.y * pixelByteSize;
+        IntVector2 destSize(Max(srcSize.x / 2, 1), Max(srcSize.y / 2, 1));
+        FilterMipLevel(dest, src, srcSize, destSize, pixelByteSize, filter, sRGB);
+        src = dest;
+        srcSize = destSize;
+    }
 
-    case 4:
-        for (int y = 0; y < sizeOut.y; ++y)
-        {
-            const unsigned char* inUpper = &pixelDataIn[(y * 2) * size.x * 4];
-            const unsigned char* inLower = &pixelDataIn[(y * 2 + 1) * size.x * 4];
-            unsigned char* out = &pixelDataOut[y * sizeOut.x * 4];
+    return true;
+}
 
-            for (int x = 0; x < sizeOut.x * 4; x += 4)
-            {
-                out[x] = ((unsigned)inUpper[x * 2] + inUpper[x * 2 + 4] + inLower[x * 2] + inLower[x * 2 + 4]) >> 2;
-                out[x + 1] = ((unsigned)inUpper[x * 2 + 1] + inUpper[x * 2 + 5] + inLower[x * 2 + 1] + inLower[x * 2 + 5]) >> 2;
-                out[x + 2] = ((unsigned)inUpper[x * 2 + 2] + inUpper[x * 2 + 6] + inLower[x * 2 + 2] + inLower[x * 2 + 6]) >> 2;
-                out[x + 3] = ((unsigned)inUpper[x * 2 + 3] + inUpper[x * 2 + 7] + inLower[x * 2 + 3] + inLower[x * 2 + 7]) >> 2;
-            }
-        }
-        break;
+bool Image::Compress(ImageFormat newFormat)
+{
+    PROFILE(CompressImage);
+
+    if (format != FMT_RGBA8 || size.z != 1 || (newFormat != FMT_DXT1 && newFormat != FMT_DXT5))
+    {
+        LOGERROR("Only compressing RGBA images to DXT1 or DXT5 is supported");
+        return false;
+    }
+
+    std::vector<ImageLevel> srcLevels;
+    size_t totalDataSize = 0;
+    for (size_t i = 0; i < numLevels; ++i)
+    {
+        srcLevels.push_back(Level(i));
+        ImageLevel destLevel;
+        CalculateDataSize(srcLevels.back().size, newFormat, destLevel);
+        totalDataSize += destLevel.dataSize;
+    }
+
+    unsigned char* blocks = new unsigned char[totalDataSize];
+    unsigned char* dest = blocks;
+    for (size_t i = 0; i < srcLevels.size(); ++i)
+    {
+        const ImageLevel& srcLevel = srcLevels[i];
+        ImageLevel destLevel;
+        CalculateDataSize(srcLevel.size, newFormat, destLevel);
+        CompressImageParallel(dest, srcLevel.data, srcLevel.size.x, srcLevel.size.y, newFormat);
+        dest += destLevel.dataSize;
+    }
+
+    data = blocks;
+    dataCapacity = totalDataSize;
+    format = newFormat;
+    return true;
+}
+
+bool Image::IsOpaque() const
+{
+    if (format != FMT_RGBA8 && format != FMT_A8)
+        return true;
+
+    size_t stride = format == FMT_RGBA8 ? 4 : 1;
+    size_t dataSize = (size_t)size.x * size.y * size.z * stride;
+    const unsigned char* pixels = data.Get();
+    for (size_t i = stride - 1; i < dataSize; i += stride)
+    {
+        if (pixels[i] != 255)
+            return false;
     }
 
     return true;
@@ -684,7 +1386,7 @@ ImageLevel Image::Level(size_t index) const
     for (;;)
     {
         level.size = IntVector3(Max(size.x >> i, 1), Max(size.y >> i, 1), Max(size.z >> i, 1));
-        level.data = data.Get() + offset;
+        level.data = (sourceData ? sourceData : data.Get()) + (levelOffsets.size() ? levelOffsets[i] : offset);
 
         CalculateDataSize(level.size, format, level);
         if (i == index)
@@ -695,6 +1397,133 @@ ImageLevel Image::Level(size_t index) const
     }
 }
 
+bool Image::LoadKTX2(Stream& source)
+{
+    source.Seek(12);
+
+    unsigned vkFormat = source.Read<unsigned>();
+    /* unsigned typeSize = */ source.Read<unsigned>();
+    unsigned imageWidth = source.Read<unsigned>();
+    unsigned imageHeight = source.Read<unsigned>();
+    unsigned depth = source.Read<unsigned>();
+    unsigned layers = source.Read<unsigned>();
+    unsigned faces = source.Read<unsigned>();
+    unsigned levels = source.Read<unsigned>();
+    unsigned supercompression = source.Read<unsigned>();
+    // Skip the data format descriptor, key/value data and supercompression global data indices
+    source.Seek(source.Position() + 4 * sizeof(unsigned) + 2 * sizeof(unsigned long long));
+
+    if (depth > 1 || layers > 1 || faces > 1)
+    {
+        LOGERROR("3D, array or cube KTX2 files not supported");
+        return false;
+    }
+
+    // Basis Universal files have an undefined format, which their transcoder resolves
+    if (supercompression == KTX2_SUPERCOMPRESSION_BASISLZ || vkFormat == 0)
+    {
+        LOGERROR("Basis Universal KTX2 files not supported");
+        return false;
+    }
+
+    if (supercompression != KTX2_SUPERCOMPRESSION_NONE && supercompression != KTX2_SUPERCOMPRESSION_ZLIB)
+    {
+        LOGERROR("Unsupported supercompression scheme in KTX2 file");
+        return false;
+    }
+
+    format = KTX2Format(vkFormat);
+    if (format == FMT_NONE)
+    {
+        LOGERROR("Unsupported texture format in KTX2 file");
+        return false;
+    }
+
+    // Zero levels requests generating the mip chain on load
+    size = IntVector3(imageWidth, imageHeight ? imageHeight : 1, 1);
+    numLevels = levels ? levels : 1;
+
+    std::vector<size_t> fileOffsets(numLevels);
+    std::vector<size_t> fileSizes(numLevels);
+    std::vector<size_t> levelSizes(numLevels);
+    size_t totalSize = 0;
+    for (size_t i = 0; i < numLevels; ++i)
+    {
+        fileOffsets[i] = (size_t)source.Read<unsigned long long>();
+        fileSizes[i] = (size_t)source.Read<unsigned long long>();
+        size_t uncompressedSize = (size_t)source.Read<unsigned long long>();
+
+        ImageLevel level;
+        CalculateDataSize(IntVector3(Max(size.x >> i, 1), Max(size.y >> i, 1), 1), format, level);
+        levelSizes[i] = level.dataSize;
+        totalSize += level.dataSize;
+
+        if (fileOffsets[i] + fileSizes[i] > source.Size() || (supercompression == KTX2_SUPERCOMPRESSION_NONE ? fileSizes[i] : uncompressedSize) != level.dataSize)
+        {
+            LOGERROR("KTX2 mipmap level data size does not match the file");
+            return false;
+        }
+    }
+
+    // The level index allows referencing the levels in place even though they are stored smallest first, so that streamed textures read only the levels they upload
+    if (referenceSource && IsCompressed() && supercompression == KTX2_SUPERCOMPRESSION_NONE)
+    {
+        source.Seek(0);
+        sourceData = source.ReadInPlace(source.Size());
+        if (sourceData)
+        {
+            levelOffsets = fileOffsets;
+            data.Reset();
+            dataCapacity = 0;
+            return true;
+        }
+    }
+
+    dataCapacity = reserveMipChain && !IsCompressed() ? std::max(totalSize, MipChainDataSize(size, format)) : totalSize;
+    data = new unsigned char[dataCapacity];
+
+    AutoArrayPtr<unsigned char> compressed;
+    size_t dataOffset = 0;
+    for (size_t i = 0; i < numLevels; ++i)
+    {
+        source.Seek(fileOffsets[i]);
+        if (supercompression == KTX2_SUPERCOMPRESSION_NONE)
+            source.Read(&data[dataOffset], levelSizes[i]);
+        else
+        {
+            compressed = new unsigned char[fileSizes[i]];
+            source.Read(compressed.Get(), fileSizes[i]);
+            if (stbi_zlib_decode_buffer((char*)&data[dataOffset], (int)levelSizes[i], (const char*)compressed.Get(), (int)fileSizes[i]) != (int)levelSizes[i])
+            {
+                LOGERROR("Could not decompress KTX2 mipmap level");
+                return false;
+            }
+        }
+
+        dataOffset += levelSizes[i];
+    }
+
+    return true;
+}
+
+void Image::ReadCompressedData(Stream& source, size_t dataSize)
+{
+    if (referenceSource)
+        sourceData = source.ReadInPlace(dataSize);
+
+    if (sourceData)
+    {
+        data.Reset();
+        dataCapacity = 0;
+    }
+    else
+    {
+        data = new unsigned char[dataSize];
+        dataCapacity = dataSize;
+        source.Read(data.Get(), dataSize);
+    }
+}
+
 bool Image::DecompressLevel(unsigned char* dest, size_t index) const
 {
     PROFILE(DecompressImageLevel);
@@ -718,18 +1547,12 @@ bool Image::DecompressLevel(unsigned char* dest, size_t index) const
     case FMT_DXT1:
     case FMT_DXT3:
     case FMT_DXT5:
-        DecompressImageDXT(dest, level.data, level.size.x, level.size.y, format);
-        break;
-
     case FMT_ETC1:
-        DecompressImageETC(dest, level.data, level.size.x, level.size.y);
-        break;
-
     case FMT_PVRTC_RGB_2BPP:
     case FMT_PVRTC_RGBA_2BPP:
     case FMT_PVRTC_RGB_4BPP:
     case FMT_PVRTC_RGBA_4BPP:
-        DecompressImagePVRTC(dest, level.data, level.size.x, level.size.y, format);
+        DecompressImageParallel(dest, level.data, level.size.x, level.size.y, format);
         break;
 
     default:
@@ -740,6 +1563,21 @@ bool Image::DecompressLevel(unsigned char* dest, size_t index) const
     return true;
 }
 
+size_t Image::MipChainDataSize(const IntVector3& size, ImageFormat format)
+{
+    size_t totalDataSize = 0;
+    IntVector3 levelSize = size;
+
+    for (;;)
+    {
+        totalDataSize += (size_t)levelSize.x * levelSize.y * levelSize.z * pixelByteSizes[format];
+        if (levelSize.x <= 1 && levelSize.y <= 1)
+            return totalDataSize;
+
+        levelSize = IntVector3(Max(levelSize.x / 2, 1), Max(levelSize.y / 2, 1), levelSize.z);
+    }
+}
+
 void Image::CalculateDataSize(const IntVector3& size, ImageFormat format, ImageLevel& dest)
 {
     if (format < FMT_DXT1)
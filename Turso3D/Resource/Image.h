@@ -7,6 +7,8 @@
 #include "../Math/IntVector3.h"
 #include "Resource.h"
 
+#include <vector>
+
 /// Image formats.
 enum ImageFormat
 {
@@ -31,6 +33,7 @@ enum ImageFormat
     FMT_D16,
     FMT_D32,
     FMT_D24S8,
+    FMT_D32F,
     FMT_DXT1,
     FMT_DXT3,
     FMT_DXT5,
@@ -41,6 +44,13 @@ enum ImageFormat
     FMT_PVRTC_RGBA_4BPP
 };
 
+/// Mip level generation filters.
+enum MipFilter
+{
+    MIP_FILTER_BOX = 0,
+    MIP_FILTER_KAISER
+};
+
 /// Description of image mip level data.
 struct ImageLevel
 {
@@ -90,8 +100,10 @@ public:
 
     /// Load image from a stream. Return true on success.
     bool BeginLoad(Stream& source) override;
-    /// Save the image to a stream. Regardless of original format, the image is saved as png. Compressed image data is not supported. Return true on success.
+    /// Save the image to a stream. DXT compressed images are saved as DDS including the mip levels, and uncompressed images as PNG. Return true on success.
     bool Save(Stream& dest) override;
+    /// Return CPU memory used by the owned pixel data in bytes.
+    size_t CpuMemoryUse() const override { return data ? dataCapacity : 0; }
 
     /// Set new image pixel dimensions and format. Setting a compressed format is not supported.
     void SetSize(const IntVector2& newSize, ImageFormat newFormat);
@@ -99,6 +111,10 @@ public:
     void SetSize(const IntVector3& newSize, ImageFormat newFormat);
     /// Set new pixel data.
     void SetData(const unsigned char* pixelData);
+    /// Set whether to reference compressed pixel data in place in the source stream on load, if the stream supports it. The stream must then stay alive while the image data is used.
+    void SetReferenceSource(bool enable) { referenceSource = enable; }
+    /// Set whether to allocate space for a mip chain when setting the size or loading uncompressed data, so that GenerateMipChain() does not need to reallocate and copy the top level.
+    void SetReserveMipChain(bool enable) { reserveMipChain = enable; }
 
     /// Return image dimensions in pixels.
     const IntVector3& Size() const { return size; }
@@ -114,7 +130,7 @@ public:
     int Components() const { return components[format]; }
     /// Return byte size of a pixel. Will return 0 for block compressed formats.
     size_t PixelByteSize() const { return pixelByteSizes[format]; } 
-    /// Return pixel data.
+    /// Return owned pixel data. Null for compressed data referenced in place from the source stream, which is accessed with Level().
     unsigned char* Data() const { return data.Get(); }
     /// Return the image format.
     ImageFormat Format() const { return format; }
@@ -124,11 +140,19 @@ public:
     size_t NumLevels() const { return numLevels; }
     /// Calculate the next mip image with halved width and height. Supports uncompressed 8 bits per pixel images only. Return true on success.
     bool GenerateMipImage(Image& dest) const;
+    /// Generate all mip levels down to 1x1 into the image data after the top level. Supports uncompressed 8 bits per pixel 2D images only. With sRGB the color channels of RGBA images are averaged in linear space. Return true on success.
+    bool GenerateMipChain(MipFilter filter = MIP_FILTER_BOX, bool sRGB = false);
+    /// Compress an RGBA image and its mip levels to DXT1 or DXT5 in place. DXT1 discards alpha. Return true on success.
+    bool Compress(ImageFormat newFormat);
+    /// Return whether an uncompressed image has no translucent pixels. Formats without alpha are always opaque.
+    bool IsOpaque() const;
     /// Return the data for a mip level. Images loaded from eg. PNG or JPG formats will only have one (index 0) level.
     ImageLevel Level(size_t index) const;
     /// Decompress a mip level as 8-bit RGBA. Supports compressed images only. Return true on success.
     bool DecompressLevel(unsigned char* dest, size_t levelIndex) const;
 
+    /// Calculate the data size of an uncompressed image with all mip levels down to 1x1.
+    static size_t MipChainDataSize(const IntVector3& size, ImageFormat format);
     /// Calculate the data size of an image level.
     static void CalculateDataSize(const IntVector3& size, ImageFormat format, ImageLevel& dest);
 
@@ -138,17 +162,33 @@ public:
     static const size_t pixelByteSizes[];
 
 private:
-    /// Decode image pixel data using the stb_image library.
-    static unsigned char* DecodePixelData(Stream& source, int& width, int& height, int& depth, unsigned& components);
-    /// Free the decoded pixel data.
-    static void FreePixelData(unsigned char* pixelData);
+    /// Decode an encoded image such as PNG, JPEG or TGA directly into the pixel data. Return true on success.
+    bool DecodePixelData(const unsigned char* encoded, size_t encodedSize);
+#ifdef TURSO3D_LIBJPEG_TURBO
+    /// Decode a JPEG image using libjpeg-turbo, in stripes on the worker threads if large. Return false if not a JPEG image or failed.
+    bool DecodeJpeg(const unsigned char* encoded, size_t encodedSize);
+#endif
+    /// Load a KTX2 file after the identifier has been read. Return true on success.
+    bool LoadKTX2(Stream& source);
+    /// Reference or read compressed pixel data from the stream.
+    void ReadCompressedData(Stream& source, size_t dataSize);
 
     /// Image dimensions.
     IntVector3 size;
     /// Image format.
     ImageFormat format;
-    /// Number of mip levels. 1 for uncompressed images.
+    /// Number of mip levels. 1 for uncompressed images unless a mip chain has been generated.
     size_t numLevels;
     /// Image pixel data.
     AutoArrayPtr<unsigned char> data;
+    /// Allocated size of the owned pixel data.
+    size_t dataCapacity;
+    /// Compressed pixel data referenced in place from the source stream.
+    const unsigned char* sourceData;
+    /// Offsets of the levels in the referenced source data, when they are not stored consecutively from the largest. Empty otherwise.
+    std::vector<size_t> levelOffsets;
+    /// Reference source data in place -flag.
+    bool referenceSource;
+    /// Reserve space for a mip chain -flag.
+    bool reserveMipChain;
 };
@@ -3,6 +3,12 @@
 #include "../IO/Log.h"
 #include "Resource.h"
 
+Resource::Resource() :
+    lastAccess(0),
+    loadingAsync(false)
+{
+}
+
 bool Resource::BeginLoad(Stream&)
 {
     return false;
@@ -14,12 +20,28 @@ bool Resource::EndLoad()
     return true;
 }
 
+bool Resource::EndLoadStep(bool& success)
+{
+    success = EndLoad();
+    return true;
+}
+
 bool Resource::Save(Stream&)
 {
     LOGERROR("Save not supported for " + TypeName());
     return false;
 }
 
+size_t Resource::CpuMemoryUse() const
+{
+    return 0;
+}
+
+size_t Resource::GpuMemoryUse() const
+{
+    return 0;
+}
+
 bool Resource::Load(Stream& source)
 {
     bool success = BeginLoad(source);
@@ -6,6 +6,8 @@
 #include "../IO/ResourceRef.h"
 #include "../Object/Object.h"
 
+#include <atomic>
+
 class Stream;
 
 /// Base class for resources.
@@ -14,12 +16,21 @@ class Resource : public Object
     OBJECT(Resource);
 
 public:
+    /// Construct.
+    Resource();
+
     /// Load the resource data from a stream. May be executed outside the main thread, should not access GPU resources. Return true on success.
     virtual bool BeginLoad(Stream& source);
     /// Finish resource loading if necessary. Always called from the main thread, so GPU resources can be accessed here. Return true on success.
     virtual bool EndLoad();
+    /// Perform part of EndLoad() to spread the GPU uploads of a background load over several frames. Called from the main thread until returns true, with the result written to success on the last call. Default calls EndLoad() at once.
+    virtual bool EndLoadStep(bool& success);
     /// Save the resource to a stream. Return true on success.
     virtual bool Save(Stream& dest);
+    /// Return CPU memory used by the resource data in bytes, for the resource cache memory budgets. Default returns zero.
+    virtual size_t CpuMemoryUse() const;
+    /// Return GPU memory used by the resource data in bytes, for the resource cache memory budgets. Default returns zero.
+    virtual size_t GpuMemoryUse() const;
 
     /// Load the resource synchronously from a binary stream. Return true on success.
     bool Load(Stream& source);
@@ -30,12 +41,26 @@ public:
     const std::string& Name() const { return name; }
     /// Return name hash of the resource.
     const StringHash& NameHash() const { return nameHash; }
+    /// Return whether is being loaded in the background. Resources can queue their dependencies for background loading in BeginLoad() when set.
+    bool IsLoadingAsync() const { return loadingAsync; }
+
+    /// Return the frame number of the last access through the resource cache.
+    unsigned LastAccess() const { return lastAccess.load(std::memory_order_relaxed); }
+
+    /// Set whether is being loaded in the background. Called by ResourceCache.
+    void SetLoadingAsync(bool enable) { loadingAsync = enable; }
+    /// Set the frame number of the last access. Called by ResourceCache, possibly from several threads.
+    void SetLastAccess(unsigned frameNumber) { lastAccess.store(frameNumber, std::memory_order_relaxed); }
 
 private:
     /// Resource name.
     std::string name;
     /// Resource name hash.
     StringHash nameHash;
+    /// Frame number of the last access through the resource cache.
+    std::atomic<unsigned> lastAccess;
+    /// Background loading flag.
+    bool loadingAsync;
 };
 
 /// Return name from a resource pointer.
@@ -3,13 +3,51 @@
 #include "../IO/File.h"
 #include "../IO/FileSystem.h"
 #include "../IO/Log.h"
+#include "../IO/MappedFile.h"
+#include "../IO/MemoryBuffer.h"
+#include "../IO/PackageFile.h"
 #include "../IO/StringUtils.h"
 #include "../Time/Profiler.h"
+#include "../Time/Timer.h"
 #include "Image.h"
 #include "JSONFile.h"
 #include "ResourceCache.h"
+#include "ResourceManifest.h"
 
-ResourceCache::ResourceCache()
+#include <algorithm>
+
+/// Version of the load order file format.
+static const unsigned LOAD_ORDER_VERSION = 1;
+
+ResourceLoadTask::ResourceLoadTask(StringHash type_, const std::string& name_) :
+    type(type_),
+    name(name_),
+    counter(0),
+    reload(false),
+    success(false)
+{
+}
+
+void ResourceLoadTask::Complete(unsigned)
+{
+    if (reload)
+    {
+        PROFILE(ReadReloadResource);
+
+        reloadData.resize(stream->Size());
+        success = reloadData.empty() || stream->Read(&reloadData[0], reloadData.size()) == reloadData.size();
+        return;
+    }
+
+    PROFILE(BeginLoadResource);
+
+    success = resource->BeginLoad(*stream);
+}
+
+ResourceCache::ResourceCache() :
+    accessFrame(0),
+    autoReloadResources(false),
+    recordLoadOrder(false)
 {
     RegisterSubsystem(this);
     RegisterResourceLibrary();
@@ -17,6 +55,15 @@ ResourceCache::ResourceCache()
 
 ResourceCache::~ResourceCache()
 {
+    // Let background loads that are running finish before destroying the resources
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue)
+    {
+        for (auto it = asyncLoads.begin(); it != asyncLoads.end(); ++it)
+            workQueue->Complete(it->second->counter);
+    }
+    asyncLoads.clear();
+
     UnloadAllResources(true);
     RemoveSubsystem(this);
 }
@@ -45,10 +92,43 @@ bool ResourceCache::AddResourceDir(const std::string& pathName, bool addFirst)
     else
         resourceDirs.push_back(fixedPath);
 
+    if (manifest)
+        manifest->ScanDir(fixedPath);
+    if (autoReloadResources || manifest)
+        AddFileWatcher(fixedPath);
+
     LOGINFO("Added resource path " + fixedPath);
     return true;
 }
 
+bool ResourceCache::AddPackage(const std::string& fileName, bool addFirst)
+{
+    PROFILE(AddPackage);
+
+    std::string fullPath = NormalizePath(fileName);
+    if (!IsAbsolutePath(fullPath))
+        fullPath = CurrentDir() + fullPath;
+
+    // Check that the same package does not already exist
+    for (size_t i = 0; i < packages.size(); ++i)
+    {
+        if (packages[i]->FileName() == fullPath)
+            return true;
+    }
+
+    SharedPtr<PackageFile> package(new PackageFile());
+    if (!package->Open(fullPath))
+        return false;
+
+    if (addFirst)
+        packages.insert(packages.begin(), package);
+    else
+        packages.push_back(package);
+
+    LOGINFO("Added resource package " + fullPath);
+    return true;
+}
+
 bool ResourceCache::AddManualResource(Resource* resource)
 {
     if (!resource)
@@ -63,7 +143,7 @@ bool ResourceCache::AddManualResource(Resource* resource)
         return false;
     }
 
-    resources[std::make_pair(resource->Type(), StringHash(resource->Name()))] = resource;
+    StoreResource(std::make_pair(resource->Type(), StringHash(resource->Name())), resource);
     return true;
 }
 
@@ -76,6 +156,18 @@ void ResourceCache::RemoveResourceDir(const std::string& pathName)
     {
         if (resourceDirs[i] == fixedPath)
         {
+            for (auto it = fileWatchers.begin(); it != fileWatchers.end(); ++it)
+            {
+                if ((*it)->Path() == fixedPath)
+                {
+                    fileWatchers.erase(it);
+                    break;
+                }
+            }
+
+            if (manifest)
+                manifest->RemoveDir(fixedPath);
+
             resourceDirs.erase(resourceDirs.begin() + i);
             LOGINFO("Removed resource path " + fixedPath);
             return;
@@ -83,123 +175,233 @@ void ResourceCache::RemoveResourceDir(const std::string& pathName)
     }
 }
 
+void ResourceCache::RemovePackage(const std::string& fileName)
+{
+    std::string fullPath = NormalizePath(fileName);
+    if (!IsAbsolutePath(fullPath))
+        fullPath = CurrentDir() + fullPath;
+
+    for (size_t i = 0; i < packages.size(); ++i)
+    {
+        if (packages[i]->FileName() == fullPath)
+        {
+            // Open entry streams keep the package alive until they are destroyed
+            packages.erase(packages.begin() + i);
+            LOGINFO("Removed resource package " + fullPath);
+            return;
+        }
+    }
+}
+
 void ResourceCache::UnloadResource(StringHash type, const std::string& name, bool force)
 {
     auto key = std::make_pair(type, StringHash(name));
-    auto it = resources.find(key);
-    if (it == resources.end())
-        return;
+    SharedPtr<Resource> unloaded;
 
-    Resource* resource = it->second;
-    if (resource->Refs() == 1 || force)
-        resources.erase(key);
+    {
+        WriteLock lock(resourceMutex);
+        Resource* resource = resources.Find(key);
+        if (resource && (resource->Refs() == 1 || force))
+            unloaded = resources.Erase(key);
+    }
 }
 
 void ResourceCache::UnloadResources(StringHash type, bool force)
 {
-    // In case resources refer to other resources, repeat until there are no further unloads
-    for (;;)
+    UnloadMatchingResources(type, std::string(), true, false, force);
+}
+
+void ResourceCache::UnloadResources(StringHash type, const std::string& partialName, bool force)
+{
+    UnloadMatchingResources(type, partialName, true, true, force);
+}
+
+void ResourceCache::UnloadResources(const std::string& partialName, bool force)
+{
+    UnloadMatchingResources(StringHash(), partialName, false, true, force);
+}
+
+void ResourceCache::UnloadAllResources(bool force)
+{
+    UnloadMatchingResources(StringHash(), std::string(), false, false, force);
+}
+
+bool ResourceCache::ReloadResource(Resource* resource)
+{
+    if (!resource)
+        return false;
+
+    AutoPtr<Stream> stream = OpenResource(resource->Name());
+    return stream ? resource->Load(*stream) : false;
+}
+
+bool ResourceCache::ReloadResourceAsync(Resource* resource)
+{
+    if (!resource || resource->Name().empty())
+        return false;
+
+    auto key = std::make_pair(resource->Type(), resource->NameHash());
     {
-        size_t unloaded = 0;
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        if (asyncLoads.find(key) != asyncLoads.end())
+            return true;
+    }
 
-        for (auto it = resources.begin(); it != resources.end();)
-        {
-            auto current = it++;
-            if (current->first.first == type)
-            {
-                Resource* resource = current->second;
-                if (resource->Refs() == 1 || force)
-                {
-                    resources.erase(current);
-                    ++unloaded;
-                }
-            }
-        }
+    AutoPtr<ResourceLoadTask> newTask(new ResourceLoadTask(resource->Type(), resource->Name()));
+    newTask->stream = OpenResource(resource->Name());
+    if (!newTask->stream)
+        return false;
 
-        if (!unloaded)
-            break;
+    newTask->stream->Prefetch();
+
+    LOGDEBUG("Reloading resource " + resource->Name() + " in the background");
+    newTask->resource = resource;
+    newTask->reload = true;
+
+    ResourceLoadTask* task = newTask.Get();
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        asyncLoads[key] = newTask.Detach();
     }
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue)
+        workQueue->QueueTask(task, &task->counter);
+    else
+        task->Complete(0);
+
+    return true;
 }
 
-void ResourceCache::UnloadResources(StringHash type, const std::string& partialName, bool force)
+void ResourceCache::SetAutoReloadResources(bool enable)
 {
-    // In case resources refer to other resources, repeat until there are no further unloads
-    for (;;)
+    autoReloadResources = enable;
+    UpdateFileWatchers();
+}
+
+void ResourceCache::SetUseManifest(bool enable)
+{
+    if (enable == (manifest != nullptr))
+        return;
+
+    if (enable)
     {
-        size_t unloaded = 0;
+        manifest = new ResourceManifest();
+        for (size_t i = 0; i < resourceDirs.size(); ++i)
+            manifest->ScanDir(resourceDirs[i]);
+    }
+    else
+        manifest.Reset();
 
-        for (auto it = resources.begin(); it != resources.end();)
-        {
-            auto current = it++;
-            if (current->first.first == type)
-            {
-                Resource* resource = current->second;
-                if (StartsWith(resource->Name(), partialName) && (resource->Refs() == 1 || force))
-                {
-                    resources.erase(current);
-                    ++unloaded;
-                }
-            }
-        }
+    UpdateFileWatchers();
+}
 
-        if (!unloaded)
-            break;
+bool ResourceCache::LoadManifest(const std::string& fileName)
+{
+    if (!manifest)
+        manifest = new ResourceManifest();
+
+    File file(fileName);
+    bool success = file.IsOpen() && manifest->Load(file);
+    if (!success)
+        LOGDEBUG("Could not load resource manifest " + fileName + ", scanning the resource directories");
+
+    for (size_t i = 0; i < resourceDirs.size(); ++i)
+    {
+        if (!manifest->HasDir(resourceDirs[i]))
+            manifest->ScanDir(resourceDirs[i]);
     }
+
+    UpdateFileWatchers();
+    return success;
 }
 
-void ResourceCache::UnloadResources(const std::string& partialName, bool force)
+bool ResourceCache::SaveManifest(const std::string& fileName) const
 {
-    // In case resources refer to other resources, repeat until there are no further unloads
-    for (;;)
+    if (!manifest)
+        return false;
+
+    File file(fileName, FILE_WRITE);
+    if (!file.IsOpen() || !manifest->Save(file))
     {
-        size_t unloaded = 0;
+        LOGERROR("Could not save resource manifest " + fileName);
+        return false;
+    }
 
-        for (auto it = resources.begin(); it != resources.end();)
-        {
-            auto current = it++;
-            Resource* resource = current->second;
-            if (StartsWith(resource->Name(), partialName) && (resource->Refs() == 1 || force))
-            {
-                resources.erase(current);
-                ++unloaded;
-            }
-        }
+    return true;
+}
 
-        if (!unloaded)
-            break;
+void ResourceCache::SetRecordLoadOrder(bool enable)
+{
+    std::lock_guard<std::mutex> lock(loadOrderMutex);
+
+    if (enable)
+    {
+        loadOrder.clear();
+        recordedLoads.clear();
     }
+    recordLoadOrder = enable;
 }
 
-void ResourceCache::UnloadAllResources(bool force)
+bool ResourceCache::SaveLoadOrder(const std::string& fileName) const
 {
-    // In case resources refer to other resources, repeat until there are no further unloads
-    for (;;)
+    std::lock_guard<std::mutex> lock(loadOrderMutex);
+
+    File file(fileName, FILE_WRITE);
+    if (!file.IsOpen())
+    {
+        LOGERROR("Could not save resource load order " + fileName);
+        return false;
+    }
+
+    file.WriteFileID("TLDO");
+    file.Write(LOAD_ORDER_VERSION);
+    file.WriteVLE(loadOrder.size());
+    for (auto it = loadOrder.begin(); it != loadOrder.end(); ++it)
     {
-        size_t unloaded = 0;
+        file.Write(it->first.Value());
+        file.Write(it->second);
+    }
 
-        for (auto it = resources.begin(); it != resources.end();)
-        {
-            auto current = it++;
-            Resource* resource = current->second;
-            if (resource->Refs() == 1 || force)
-            {
-                resources.erase(current);
-                ++unloaded;
-            }
-        }
+    return true;
+}
 
-        if (!unloaded)
-            break;
+size_t ResourceCache::PrefetchLoadOrder(const std::string& fileName)
+{
+    PROFILE(PrefetchLoadOrder);
+
+    File file(fileName);
+    if (!file.IsOpen() || file.ReadFileID() != "TLDO" || file.Read<unsigned>() != LOAD_ORDER_VERSION)
+    {
+        LOGDEBUG("Could not load resource load order " + fileName);
+        return 0;
     }
+
+    size_t numLoads = file.ReadVLE();
+    size_t numQueued = 0;
+    for (size_t i = 0; i < numLoads && !file.IsEof(); ++i)
+    {
+        StringHash type(file.Read<unsigned>());
+        std::string name = file.Read<std::string>();
+        if (resources.Find(std::make_pair(type, StringHash(name))) || !Exists(name))
+            continue;
+
+        if (LoadResourceAsync(type, name))
+            ++numQueued;
+    }
+
+    LOGINFOF("Prefetching %d resources from load order %s", (int)numQueued, fileName.c_str());
+    return numQueued;
 }
 
-bool ResourceCache::ReloadResource(Resource* resource)
+AutoPtr<Stream> ResourceCache::OpenFile(const std::string& fileName)
 {
-    if (!resource)
-        return false;
+    // Map the file to memory so that loaders can reference the data in place. Empty files can not be mapped
+    AutoPtr<MappedFile> mappedFile(new MappedFile(fileName));
+    if (mappedFile->IsOpen())
+        return AutoPtr<Stream>(mappedFile.Detach());
 
-    AutoPtr<Stream> stream = OpenResource(resource->Name());
-    return stream ? resource->Load(*stream) : false;
+    return AutoPtr<Stream>(new File(fileName));
 }
 
 AutoPtr<Stream> ResourceCache::OpenResource(const std::string& nameIn)
@@ -207,20 +409,28 @@ AutoPtr<Stream> ResourceCache::OpenResource(const std::string& nameIn)
     std::string name = SanitateResourceName(nameIn);
     AutoPtr<Stream> ret;
 
+    // Packages are searched by name hash without filesystem access
+    for (size_t i = 0; i < packages.size(); ++i)
+    {
+        ret = packages[i]->OpenEntry(name);
+        if (ret)
+            return ret;
+    }
+
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (FileInResourceDir(resourceDirs[i], name))
         {
             // Construct the file first with full path, then rename it to not contain the resource path,
             // so that the file's name can be used in further OpenResource() calls (for example over the network)
-            ret = new File(resourceDirs[i] + name);
+            ret = OpenFile(resourceDirs[i] + name);
             break;
         }
     }
 
     // Fallback using absolute path
     if (!ret)
-        ret = new File(name);
+        ret = OpenFile(name);
 
     if (!ret->IsReadable())
     {
@@ -233,17 +443,43 @@ AutoPtr<Stream> ResourceCache::OpenResource(const std::string& nameIn)
 
 Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn)
 {
+    // Stored names are already sanitated, so a name that matches exactly does not need sanitating. The map is modified only by the main thread, so no lock is needed for reading here
+    Resource* existing = resources.Find(std::make_pair(type, StringHash(nameIn)));
+    if (existing && existing->Name() == nameIn)
+    {
+        if (recordLoadOrder)
+            RecordLoad(type, nameIn);
+        TouchResource(existing);
+        return existing;
+    }
+
     std::string name = SanitateResourceName(nameIn);
 
     // If empty name, return null pointer immediately without logging an error
     if (name.empty())
         return nullptr;
 
+    // Record also the requests that find the resource loaded, as it may have been prefetched
+    if (recordLoadOrder)
+        RecordLoad(type, name);
+
     // Check for existing resource
     auto key = std::make_pair(type, StringHash(name));
-    auto it = resources.find(key);
-    if (it != resources.end())
-        return it->second;
+    existing = resources.Find(key);
+    if (existing)
+    {
+        TouchResource(existing);
+        return existing;
+    }
+
+    // If being loaded in the background, finish now
+    if (IsLoadingAsync(type, name))
+    {
+        WaitAsyncLoad(key);
+        existing = resources.Find(key);
+        if (existing)
+            return existing;
+    }
 
     SharedPtr<Object> newObject = Create(type);
     if (!newObject)
@@ -267,28 +503,505 @@ Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn
     newResource->SetName(name);
     newResource->Load(*stream);
     // Store to cache
-    resources[key] = newResource;
+    StoreResource(key, newResource);
     return newResource;
 }
 
+Resource* ResourceCache::FindResource(StringHash type, StringHash nameHash) const
+{
+    ReadLock lock(resourceMutex);
+    Resource* resource = resources.Find(std::make_pair(type, nameHash));
+    if (resource)
+        TouchResource(resource);
+    return resource;
+}
+
+bool ResourceCache::LoadResourceAsync(StringHash type, const std::string& nameIn, Resource* caller)
+{
+    std::string name = SanitateResourceName(nameIn);
+    if (name.empty())
+        return false;
+
+    if (recordLoadOrder)
+        RecordLoad(type, name);
+
+    auto key = std::make_pair(type, StringHash(name));
+    ResourceLoadTask* newTask = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+
+        if (caller)
+        {
+            auto callerIt = asyncLoads.find(std::make_pair(caller->Type(), caller->NameHash()));
+            if (callerIt != asyncLoads.end())
+                callerIt->second->dependencies.insert(key);
+        }
+
+        if (asyncLoads.find(key) != asyncLoads.end())
+            return true;
+
+        newTask = new ResourceLoadTask(type, name);
+        asyncLoads[key] = newTask;
+    }
+
+    // Dependencies are queued from BeginLoad(), possibly on a worker thread, so can not access the resource map yet
+    if (!caller)
+        StartAsyncLoad(newTask);
+
+    return true;
+}
+
+void ResourceCache::UpdateAsyncLoads(float maxMilliseconds)
+{
+    PROFILE(UpdateAsyncLoads);
+
+    HiresTimer timer;
+    long long maxUSec = (long long)(maxMilliseconds * 1000.0f);
+
+    if (!fileWatchers.empty())
+        CheckFileChanges();
+
+    // Start dependency loads queued from BeginLoad()
+    std::vector<ResourceLoadTask*> queuedTasks;
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        for (auto it = asyncLoads.begin(); it != asyncLoads.end(); ++it)
+        {
+            if (!it->second->resource)
+                queuedTasks.push_back(it->second);
+        }
+    }
+
+    for (auto it = queuedTasks.begin(); it != queuedTasks.end(); ++it)
+        StartAsyncLoad(*it);
+
+    for (;;)
+    {
+        ResourceLoadTask* readyTask = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(asyncLoadMutex);
+            for (auto it = asyncLoads.begin(); it != asyncLoads.end(); ++it)
+            {
+                if (IsAsyncLoadReady(it->second))
+                {
+                    readyTask = it->second;
+                    break;
+                }
+            }
+        }
+
+        if (!readyTask)
+            break;
+
+        if (!FinishAsyncLoad(readyTask, std::max(maxUSec - timer.ElapsedUSec(), 0LL)))
+            break;
+        if (timer.ElapsedUSec() >= maxUSec)
+            break;
+    }
+
+    accessFrame.fetch_add(1, std::memory_order_relaxed);
+    EnforceMemoryBudgets();
+}
+
+void ResourceCache::SetMemoryBudget(StringHash type, size_t bytes)
+{
+    if (bytes)
+        memoryBudgets[type] = bytes;
+    else
+        memoryBudgets.erase(type);
+}
+
+size_t ResourceCache::EnforceMemoryBudgets()
+{
+    if (memoryBudgets.empty())
+        return 0;
+
+    PROFILE(EnforceMemoryBudgets);
+
+    size_t numUnloaded = 0;
+    unsigned currentFrame = accessFrame.load(std::memory_order_relaxed);
+
+    for (auto it = memoryBudgets.begin(); it != memoryBudgets.end(); ++it)
+    {
+        ResourceMemoryUse use = MemoryUse(it->first);
+        if (use.Total() <= it->second)
+            continue;
+
+        // Destroy the resources only after releasing the lock, in case destruction releases or looks up other resources
+        std::vector<SharedPtr<Resource> > unloaded;
+
+        {
+            WriteLock lock(resourceMutex);
+
+            // Collect the unloadable resources as pairs of last access and slot index, oldest first
+            std::vector<std::pair<unsigned, size_t> > candidates;
+            for (size_t i = 0; i < resources.NumSlots(); ++i)
+            {
+                Resource* resource = resources.At(i);
+                if (resource && resources.KeyAt(i).first == it->first && resource->Refs() == 1 && resource->LastAccess() != currentFrame)
+                    candidates.push_back(std::make_pair(resource->LastAccess(), i));
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            size_t total = use.Total();
+            for (auto cIt = candidates.begin(); cIt != candidates.end() && total > it->second; ++cIt)
+            {
+                Resource* resource = resources.At(cIt->second);
+                total -= std::min(resource->CpuMemoryUse() + resource->GpuMemoryUse(), total);
+                unloaded.push_back(resources.EraseAt(cIt->second));
+            }
+        }
+
+        if (unloaded.size())
+            LOGDEBUGF("Unloaded %d resources of type %s over the memory budget", (int)unloaded.size(), Object::TypeNameFromType(it->first).c_str());
+        numUnloaded += unloaded.size();
+    }
+
+    return numUnloaded;
+}
+
+bool ResourceCache::IsLoadingAsync(StringHash type, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(asyncLoadMutex);
+    return asyncLoads.find(std::make_pair(type, StringHash(SanitateResourceName(name)))) != asyncLoads.end();
+}
+
+size_t ResourceCache::NumAsyncLoads()
+{
+    std::lock_guard<std::mutex> lock(asyncLoadMutex);
+    return asyncLoads.size();
+}
+
+size_t ResourceCache::NumRecordedLoads() const
+{
+    std::lock_guard<std::mutex> lock(loadOrderMutex);
+    return loadOrder.size();
+}
+
+size_t ResourceCache::MemoryBudget(StringHash type) const
+{
+    auto it = memoryBudgets.find(type);
+    return it != memoryBudgets.end() ? it->second : 0;
+}
+
+ResourceMemoryUse ResourceCache::MemoryUse(StringHash type) const
+{
+    return MatchingMemoryUse(type, true);
+}
+
+ResourceMemoryUse ResourceCache::TotalMemoryUse() const
+{
+    return MatchingMemoryUse(StringHash(), false);
+}
+
+void ResourceCache::StartAsyncLoad(ResourceLoadTask* task)
+{
+    auto key = std::make_pair(task->type, StringHash(task->name));
+    SharedPtr<Resource> newResource;
+
+    // If already loaded, or the resource can not be created or opened, there is nothing to wait for
+    if (!resources.Find(key))
+    {
+        SharedPtr<Object> newObject = Create(task->type);
+        newResource = dynamic_cast<Resource*>(newObject.Get());
+        if (!newResource)
+            LOGERROR("Could not load unknown resource type " + ToString(task->type));
+        else
+            task->stream = OpenResource(task->name);
+    }
+
+    if (!task->stream)
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        asyncLoads.erase(key);
+        return;
+    }
+
+    // Start reading the data from storage already, so that the reads of all loads in flight are queued at once instead of the worker blocking on each page in turn
+    task->stream->Prefetch();
+
+    LOGDEBUG("Loading resource " + task->name + " in the background");
+    newResource->SetName(task->name);
+    newResource->SetLoadingAsync(true);
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        task->resource = newResource;
+    }
+
+    if (workQueue)
+        workQueue->QueueTask(task, &task->counter);
+    else
+        task->Complete(0);
+}
+
+void ResourceCache::WaitAsyncLoad(const ResourceKey& key)
+{
+    ResourceLoadTask* task;
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        auto it = asyncLoads.find(key);
+        if (it == asyncLoads.end())
+            return;
+        task = it->second;
+    }
+
+    if (!task->resource)
+    {
+        StartAsyncLoad(task);
+        // Starting may have finished the load immediately
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        if (asyncLoads.find(key) == asyncLoads.end())
+            return;
+    }
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue)
+        workQueue->Complete(task->counter);
+
+    // Dependencies no longer change once BeginLoad() has completed
+    for (auto it = task->dependencies.begin(); it != task->dependencies.end(); ++it)
+        WaitAsyncLoad(*it);
+
+    FinishAsyncLoad(task);
+}
+
+bool ResourceCache::FinishAsyncLoad(ResourceLoadTask* task, long long maxUSec)
+{
+    PROFILE(FinishAsyncLoad);
+
+    SharedPtr<Resource> resource = task->resource;
+    bool success = task->success;
+    auto key = std::make_pair(task->type, StringHash(task->name));
+
+    if (task->reload)
+    {
+        if (success)
+        {
+            MemoryBuffer buffer(task->reloadData);
+            success = resource->Load(buffer);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(asyncLoadMutex);
+            asyncLoads.erase(key);
+        }
+
+        resourceReloadedEvent.resource = resource;
+        resourceReloadedEvent.success = success;
+        resourceReloadedEvent.Send(this);
+        return true;
+    }
+
+    if (success)
+    {
+        // Always make progress, even if the budget is already spent
+        HiresTimer timer;
+        while (!resource->EndLoadStep(success))
+        {
+            if (maxUSec >= 0 && timer.ElapsedUSec() >= maxUSec)
+                return false;
+        }
+    }
+
+    resource->SetLoadingAsync(false);
+    StoreResource(key, resource);
+
+    {
+        std::lock_guard<std::mutex> lock(asyncLoadMutex);
+        asyncLoads.erase(key);
+    }
+
+    resourceLoadedEvent.resource = resource;
+    resourceLoadedEvent.success = success;
+    resourceLoadedEvent.Send(this);
+    return true;
+}
+
+bool ResourceCache::IsAsyncLoadReady(ResourceLoadTask* task) const
+{
+    if (!task->resource || task->counter.load() > 0)
+        return false;
+
+    for (auto it = task->dependencies.begin(); it != task->dependencies.end(); ++it)
+    {
+        if (asyncLoads.find(*it) != asyncLoads.end())
+            return false;
+    }
+
+    return true;
+}
+
+size_t ResourceCache::ReloadGpuResources()
+{
+    std::vector<SharedPtr<Resource> > gpuResources;
+    {
+        ReadLock lock(resourceMutex);
+        for (size_t i = 0; i < resources.NumSlots(); ++i)
+        {
+            Resource* resource = resources.At(i);
+            if (resource && resource->GpuMemoryUse() && !resource->Name().empty())
+                gpuResources.push_back(SharedPtr<Resource>(resource));
+        }
+    }
+
+    size_t numReloaded = 0;
+    for (auto it = gpuResources.begin(); it != gpuResources.end(); ++it)
+    {
+        if (ReloadResource(*it))
+            ++numReloaded;
+        else
+            LOGERROR("Failed to reload GPU resource " + (*it)->Name());
+    }
+
+    return numReloaded;
+}
+
 void ResourceCache::ResourcesByType(std::vector<Resource*>& result, StringHash type) const
 {
     result.clear();
 
-    for (auto it = resources.begin(); it != resources.end(); ++it)
+    ReadLock lock(resourceMutex);
+    for (size_t i = 0; i < resources.NumSlots(); ++i)
+    {
+        Resource* resource = resources.At(i);
+        if (resource && resources.KeyAt(i).first == type)
+            result.push_back(resource);
+    }
+}
+
+void ResourceCache::CheckFileChanges()
+{
+    std::vector<Resource*> changed;
+    std::string fileName;
+
+    for (auto it = fileWatchers.begin(); it != fileWatchers.end(); ++it)
     {
-        if (it->second->Type() == type)
-            result.push_back(it->second);
+        while ((*it)->NextChange(fileName))
+        {
+            if (manifest)
+                manifest->UpdateFile((*it)->Path(), fileName);
+            if (!autoReloadResources)
+                continue;
+
+            // The same file may be loaded as several resource types
+            {
+                ReadLock lock(resourceMutex);
+                StringHash nameHash(fileName);
+                for (size_t i = 0; i < resources.NumSlots(); ++i)
+                {
+                    Resource* resource = resources.At(i);
+                    if (resource && resources.KeyAt(i).second == nameHash && resource->Name() == fileName)
+                        changed.push_back(resource);
+                }
+            }
+
+            for (auto rIt = changed.begin(); rIt != changed.end(); ++rIt)
+                ReloadResourceAsync(*rIt);
+            changed.clear();
+        }
     }
 }
 
+void ResourceCache::UpdateFileWatchers()
+{
+    if (!autoReloadResources && !manifest)
+        fileWatchers.clear();
+    else if (fileWatchers.empty())
+    {
+        for (size_t i = 0; i < resourceDirs.size(); ++i)
+            AddFileWatcher(resourceDirs[i]);
+    }
+}
+
+void ResourceCache::AddFileWatcher(const std::string& pathName)
+{
+    AutoPtr<FileWatcher> watcher(new FileWatcher());
+    if (watcher->StartWatching(pathName, true))
+        fileWatchers.push_back(watcher);
+}
+
+void ResourceCache::StoreResource(const ResourceKey& key, Resource* resource)
+{
+    TouchResource(resource);
+
+    WriteLock lock(resourceMutex);
+    resources.Insert(key, resource);
+}
+
+void ResourceCache::UnloadMatchingResources(StringHash type, const std::string& partialName, bool matchType, bool matchName, bool force)
+{
+    // In case resources refer to other resources, repeat until there are no further unloads
+    for (;;)
+    {
+        // Destroy the resources only after releasing the lock, in case destruction releases or looks up other resources
+        std::vector<SharedPtr<Resource> > unloaded;
+
+        {
+            WriteLock lock(resourceMutex);
+            for (size_t i = 0; i < resources.NumSlots(); ++i)
+            {
+                Resource* resource = resources.At(i);
+                if (!resource || (matchType && resources.KeyAt(i).first != type) || (matchName && !StartsWith(resource->Name(), partialName)))
+                    continue;
+
+                if (resource->Refs() == 1 || force)
+                    unloaded.push_back(resources.EraseAt(i));
+            }
+        }
+
+        if (unloaded.empty())
+            break;
+    }
+}
+
+ResourceMemoryUse ResourceCache::MatchingMemoryUse(StringHash type, bool matchType) const
+{
+    ResourceMemoryUse use;
+
+    ReadLock lock(resourceMutex);
+    for (size_t i = 0; i < resources.NumSlots(); ++i)
+    {
+        Resource* resource = resources.At(i);
+        if (!resource || (matchType && resources.KeyAt(i).first != type))
+            continue;
+
+        use.cpu += resource->CpuMemoryUse();
+        use.gpu += resource->GpuMemoryUse();
+        ++use.count;
+    }
+
+    return use;
+}
+
+void ResourceCache::RecordLoad(StringHash type, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(loadOrderMutex);
+
+    if (recordLoadOrder && recordedLoads.insert(std::make_pair(type, StringHash(name))).second)
+        loadOrder.push_back(std::make_pair(type, name));
+}
+
+void ResourceCache::TouchResource(Resource* resource) const
+{
+    resource->SetLastAccess(accessFrame.load(std::memory_order_relaxed));
+}
+
 bool ResourceCache::Exists(const std::string& nameIn) const
 {
     std::string name = SanitateResourceName(nameIn);
 
+    for (size_t i = 0; i < packages.size(); ++i)
+    {
+        if (packages[i]->Exists(name))
+            return true;
+    }
+
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (FileInResourceDir(resourceDirs[i], name))
             return true;
     }
 
@@ -300,9 +1013,15 @@ unsigned ResourceCache::LastModifiedTime(const std::string& nameIn) const
 {
     std::string name = SanitateResourceName(nameIn);
 
+    for (size_t i = 0; i < packages.size(); ++i)
+    {
+        if (packages[i]->Exists(name))
+            return ::LastModifiedTime(packages[i]->FileName());
+    }
+
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (FileInResourceDir(resourceDirs[i], name))
             return ::LastModifiedTime(resourceDirs[i] + name);
     }
 
@@ -314,13 +1033,18 @@ std::string ResourceCache::ResourceFileName(const std::string& name) const
 {
     for (unsigned i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (FileInResourceDir(resourceDirs[i], name))
             return resourceDirs[i] + name;
     }
 
     return std::string();
 }
 
+bool ResourceCache::FileInResourceDir(const std::string& pathName, const std::string& name) const
+{
+    return manifest ? manifest->Exists(pathName, name) : FileExists(pathName + name);
+}
+
 std::string ResourceCache::SanitateResourceName(const std::string& nameIn) const
 {
     // Sanitate unsupported constructs from the resource name
@@ -2,12 +2,85 @@
 
 #pragma once
 
+#include "../IO/FileWatcher.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/Event.h"
 #include "../Object/Object.h"
+#include "../Thread/Mutex.h"
+#include "../Thread/WorkQueue.h"
+#include "ResourceMap.h"
 
+#include <atomic>
+#include <mutex>
+#include <set>
+
+class PackageFile;
 class Resource;
+class ResourceCache;
+class ResourceManifest;
 class Stream;
 
-typedef std::map<std::pair<StringHash, StringHash>, SharedPtr<Resource> > ResourceMap;
+/// %Task for loading a resource in the background. Runs BeginLoad() on a worker thread, after which the cache finishes the load in the main thread. For a reload, reads the file to memory instead, after which the resource is reloaded in the main thread.
+class ResourceLoadTask : public Task
+{
+public:
+    /// Construct.
+    ResourceLoadTask(StringHash type, const std::string& name);
+
+    /// Run BeginLoad() of the resource, or read the file for a reload.
+    void Complete(unsigned threadIndex) override;
+
+    /// %Resource type.
+    StringHash type;
+    /// %Resource name.
+    std::string name;
+    /// %Resource being loaded. Null until the load is started in the main thread.
+    SharedPtr<Resource> resource;
+    /// Source stream.
+    AutoPtr<Stream> stream;
+    /// Completion counter, nonzero while BeginLoad() is queued or running.
+    TaskCounter counter;
+    /// Loads that must finish before this resource's EndLoad(), for example textures of a material.
+    std::set<ResourceKey> dependencies;
+    /// File data for a reload.
+    std::vector<unsigned char> reloadData;
+    /// Whether reloads an existing resource.
+    bool reload;
+    /// BeginLoad() or file read result.
+    bool success;
+};
+
+/// Memory use of resources.
+struct ResourceMemoryUse
+{
+    /// Construct with zero use.
+    ResourceMemoryUse() :
+        cpu(0),
+        gpu(0),
+        count(0)
+    {
+    }
+
+    /// Return CPU and GPU memory use combined.
+    size_t Total() const { return cpu + gpu; }
+
+    /// CPU memory in bytes.
+    size_t cpu;
+    /// GPU memory in bytes.
+    size_t gpu;
+    /// Number of resources.
+    size_t count;
+};
+
+/// Background resource load finished event.
+class ResourceLoadedEvent : public Event
+{
+public:
+    /// Loaded resource.
+    Resource* resource;
+    /// Whether loading succeeded.
+    bool success;
+};
  
 /// %Resource cache subsystem. Loads resources on demand and stores them for later access.
 class ResourceCache : public Object
@@ -22,14 +95,20 @@ public:
 
     /// Add a resource directory. Return true on success.
     bool AddResourceDir(const std::string& pathName, bool addFirst = false);
+    /// Add a package file. Packages are searched before the resource directories. Return true on success.
+    bool AddPackage(const std::string& fileName, bool addFirst = false);
     /// Add a manually created resource. If returns success, the resource cache takes ownership of it.
     bool AddManualResource(Resource* resource);
     /// Remove a resource directory.
     void RemoveResourceDir(const std::string& pathName);
-    /// Open a resource file stream from the resource directories. Return a pointer to the stream, or null if not found.
+    /// Remove a package file.
+    void RemovePackage(const std::string& fileName);
+    /// Open a resource file stream from the packages or resource directories. Return a pointer to the stream, or null if not found.
     AutoPtr<Stream> OpenResource(const std::string& name);
-    /// Load and return a resource.
+    /// Load and return a resource. A cached resource is found without sanitating the name if the name is already in the sanitated form.
     Resource* LoadResource(StringHash type, const std::string& name);
+    /// Return an already loaded resource by type and the hash of its sanitated name, or null if not loaded. Does not sanitate or hash the name. Safe to call from any thread, but the caller must hold a reference if the resource may be unloaded meanwhile.
+    Resource* FindResource(StringHash type, StringHash nameHash) const;
     /// Unload resource. Optionally force removal even if referenced.
     void UnloadResource(StringHash type, const std::string& name, bool force = false);
     /// Unload all resources of type.
@@ -42,15 +121,69 @@ public:
     void UnloadAllResources(bool force = false);
     /// Reload an existing resource. Return true on success.
     bool ReloadResource(Resource* resource);
+    /// Queue an existing resource for reloading. The file is read in the background and the resource is reloaded in the main thread on UpdateAsyncLoads(), after which the resource reloaded event is sent. Return false if the file can not be opened.
+    bool ReloadResourceAsync(Resource* resource);
+    /// Reload the resources that hold GPU data from their source files, for recreating them after the GPU context has been lost, as the CPU-side data is released after upload. Manual resources without a source file are skipped. Return number of resources reloaded.
+    size_t ReloadGpuResources();
+    /// Set whether to watch the resource directories for changed files and reload the corresponding resources automatically.
+    void SetAutoReloadResources(bool enable);
+    /// Set whether to find the files of the resource directories from a cached manifest instead of checking the filesystem on each lookup. The directories are scanned in parallel on the work queue, and watched for changes to keep the manifest up to date; created files become visible after the file watcher delay.
+    void SetUseManifest(bool enable);
+    /// Load a manifest saved on a previous run and enable its use. Resource directories found in the file are only verified by the modified times of their subdirectories, and the changed subdirectories rescanned. If the file can not be loaded, the directories are scanned fully and false is returned.
+    bool LoadManifest(const std::string& fileName);
+    /// Save the manifest for loading on the next run. Return true on success.
+    bool SaveManifest(const std::string& fileName) const;
+    /// Set whether to record the type and name of each distinct resource requested through LoadResource() or LoadResourceAsync(), in request order, for saving as a load order for prefetching on the next run. Enabling clears the previous recording.
+    void SetRecordLoadOrder(bool enable);
+    /// Save the recorded load order. Return true on success.
+    bool SaveLoadOrder(const std::string& fileName) const;
+    /// Load a load order saved on a previous run and queue its resources for loading in the background in the recorded order, so that their files are read and decoded in parallel on the work queue and later LoadResource() calls find them loaded or wait only for the rest of the load. Resources that are already loaded or no longer exist are skipped. Textures and other GPU resources finish their loads in the main thread, so the rendering context must be initialized. Return number of resources queued.
+    size_t PrefetchLoadOrder(const std::string& fileName);
+    /// Queue a resource for loading in the background. Return false if the name is empty. Called from a resource's BeginLoad() with the resource as the caller, the load becomes its dependency and is started on the next UpdateAsyncLoads(). Completion is signaled with the resource loaded event.
+    bool LoadResourceAsync(StringHash type, const std::string& name, Resource* caller = nullptr);
+    /// Finish background loads and reloads in the main thread until the time budget is spent. Loads that have begun and whose dependencies are finished are completed in steps with EndLoadStep() and stored to the cache. At least one step is performed per call. Afterward advances the access frame number and enforces the memory budgets; call once per frame.
+    void UpdateAsyncLoads(float maxMilliseconds);
+    /// Set the combined CPU and GPU memory budget of a resource type in bytes. Zero is unlimited. Manual resources are unloaded like the others, so hold a reference to keep them.
+    void SetMemoryBudget(StringHash type, size_t bytes);
+    /// Unload least recently used resources of the types that exceed their memory budget. Only resources not referenced outside the cache and not accessed on the current frame are unloaded. Called by UpdateAsyncLoads(). Return number of resources unloaded.
+    size_t EnforceMemoryBudgets();
+    /// Queue a resource for loading in the background, template version.
+    template <class T> bool LoadResourceAsync(const std::string& name, Resource* caller = nullptr) { return LoadResourceAsync(T::TypeStatic(), name, caller); }
     /// Load and return a resource, template version.
     template <class T> T* LoadResource(const std::string& name) { return static_cast<T*>(LoadResource(T::TypeStatic(), name)); }
     /// Load and return a resource, template version.
     template <class T> T* LoadResource(const char* name) { return static_cast<T*>(LoadResource(T::TypeStatic(), name)); }
+    /// Return an already loaded resource by the hash of its sanitated name, template version.
+    template <class T> T* FindResource(StringHash nameHash) const { return static_cast<T*>(FindResource(T::TypeStatic(), nameHash)); }
+    /// Set the memory budget of a resource type in bytes, template version.
+    template <class T> void SetMemoryBudget(size_t bytes) { SetMemoryBudget(T::TypeStatic(), bytes); }
 
     /// Return resources by type.
     void ResourcesByType(std::vector<Resource*>& result, StringHash type) const;
     /// Return resource directories.
     const std::vector<std::string>& ResourceDirs() const { return resourceDirs; }
+    /// Return package files.
+    const std::vector<SharedPtr<PackageFile> >& Packages() const { return packages; }
+    /// Return whether a resource is being loaded in the background.
+    bool IsLoadingAsync(StringHash type, const std::string& name);
+    /// Return number of unfinished background loads.
+    size_t NumAsyncLoads();
+    /// Return whether resources are reloaded automatically when the files change.
+    bool AutoReloadResources() const { return autoReloadResources; }
+    /// Return whether the load order is being recorded.
+    bool RecordLoadOrder() const { return recordLoadOrder; }
+    /// Return number of resources in the recorded load order.
+    size_t NumRecordedLoads() const;
+    /// Return the resource manifest, or null if not in use.
+    const ResourceManifest* Manifest() const { return manifest.Get(); }
+    /// Return the memory budget of a resource type in bytes, or zero if unlimited.
+    size_t MemoryBudget(StringHash type) const;
+    /// Return memory use of the loaded resources of a type.
+    ResourceMemoryUse MemoryUse(StringHash type) const;
+    /// Return memory use of all loaded resources.
+    ResourceMemoryUse TotalMemoryUse() const;
+    /// Return the current access frame number, used to order resources for unloading.
+    unsigned AccessFrame() const { return accessFrame.load(std::memory_order_relaxed); }
     /// Return whether a file exists in the resource directories.
     bool Exists(const std::string& name) const;
     /// Return last modified time of a file from the resource directories, or 0 if doesn't exist.
@@ -78,9 +211,71 @@ public:
     /// Normalize and remove unsupported constructs from a resource directory name.
     std::string SanitateResourceDirName(const std::string& name) const;
 
+    /// Background resource load finished event.
+    ResourceLoadedEvent resourceLoadedEvent;
+    /// Background resource reload finished event.
+    ResourceLoadedEvent resourceReloadedEvent;
+
 private:
+    /// Open a file for reading, memory-mapped if possible.
+    AutoPtr<Stream> OpenFile(const std::string& fileName);
+    /// Create the resource and queue its BeginLoad(), or finish immediately if already loaded.
+    void StartAsyncLoad(ResourceLoadTask* task);
+    /// Wait for a background load and its dependencies to finish, then complete it.
+    void WaitAsyncLoad(const ResourceKey& key);
+    /// Run EndLoadStep() of a background load until finished or the time budget is spent, then store the resource and send the loaded event. Negative budget is unlimited. Return true if finished.
+    bool FinishAsyncLoad(ResourceLoadTask* task, long long maxUSec = -1);
+    /// Return whether a background load has begun and its dependencies are finished. The async load mutex must be held.
+    bool IsAsyncLoadReady(ResourceLoadTask* task) const;
+    /// Update the manifest and queue reloads for the files that have changed in the watched resource directories.
+    void CheckFileChanges();
+    /// Start or stop watching the resource directories for changes, as needed by automatic reloading and the manifest.
+    void UpdateFileWatchers();
+    /// Start watching a resource directory for changes.
+    void AddFileWatcher(const std::string& pathName);
+    /// Return whether a file exists in a resource directory, using the manifest if in use.
+    bool FileInResourceDir(const std::string& pathName, const std::string& name) const;
+    /// Store a resource to the map.
+    void StoreResource(const ResourceKey& key, Resource* resource);
+    /// Unload resources matching optional type and partial name, repeating while resources referred to by the unloaded ones become unreferenced.
+    void UnloadMatchingResources(StringHash type, const std::string& partialName, bool matchType, bool matchName, bool force);
+    /// Return memory use of the loaded resources, optionally matching a type.
+    ResourceMemoryUse MatchingMemoryUse(StringHash type, bool matchType) const;
+    /// Mark a resource accessed on the current frame.
+    void TouchResource(Resource* resource) const;
+    /// Add a resource request to the recorded load order, if not recorded already.
+    void RecordLoad(StringHash type, const std::string& name);
+
+    /// Loaded resources.
     ResourceMap resources;
+    /// Lock for the resource map. It is modified only by the main thread, which takes the write lock; other threads take the read lock for lookups.
+    mutable ReadWriteMutex resourceMutex;
+    /// %Resource directories.
     std::vector<std::string> resourceDirs;
+    /// Package files.
+    std::vector<SharedPtr<PackageFile> > packages;
+    /// Cached listing of the resource directories' files.
+    AutoPtr<ResourceManifest> manifest;
+    /// Watchers for the resource directories when reloading automatically or using the manifest.
+    std::vector<AutoPtr<FileWatcher> > fileWatchers;
+    /// Unfinished background loads.
+    std::map<ResourceKey, AutoPtr<ResourceLoadTask> > asyncLoads;
+    /// Mutex for the background loads, which are queued also from worker threads.
+    std::mutex asyncLoadMutex;
+    /// Recorded load order of resource types and sanitated names.
+    std::vector<std::pair<StringHash, std::string> > loadOrder;
+    /// Keys of the resources in the recorded load order.
+    std::set<ResourceKey> recordedLoads;
+    /// Mutex for the load order recording, as background loads are queued also from worker threads.
+    mutable std::mutex loadOrderMutex;
+    /// Memory budgets by resource type.
+    std::map<StringHash, size_t> memoryBudgets;
+    /// Access frame number, advanced on each UpdateAsyncLoads().
+    std::atomic<unsigned> accessFrame;
+    /// Automatic reload flag.
+    bool autoReloadResources;
+    /// Load order recording flag.
+    std::atomic<bool> recordLoadOrder;
 };
 
 /// Register Resource related object factories and attributes.
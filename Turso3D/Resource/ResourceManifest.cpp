@@ -0,0 +1,386 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/FileSystem.h"
+#include "../IO/Log.h"
+#include "../IO/Stream.h"
+#include "../Thread/WorkQueue.h"
+#include "../Time/Profiler.h"
+#include "ResourceManifest.h"
+
+#include <deque>
+#include <mutex>
+#include <set>
+
+/// Manifest file format version.
+static const unsigned MANIFEST_VERSION = 1;
+
+struct ManifestScan;
+
+/// %Task for scanning one directory of a resource directory, or verifying it against a loaded listing.
+class DirScanTask : public Task
+{
+public:
+    /// Construct.
+    DirScanTask(ManifestScan* scan_, const std::string& subDir_, bool verify_, unsigned knownTime_) :
+        scan(scan_),
+        subDir(subDir_),
+        verify(verify_),
+        modifiedTime(knownTime_),
+        exists(true),
+        changed(true)
+    {
+    }
+
+    /// Scan or verify the directory, and queue scans of its new subdirectories.
+    void Complete(unsigned threadIndex) override;
+
+    /// Scan state.
+    ManifestScan* scan;
+    /// Directory name relative to the resource directory, with trailing slash.
+    std::string subDir;
+    /// Whether to only rescan if the modified time differs from the loaded listing.
+    bool verify;
+    /// Last modified time. When verifying, the time in the loaded listing before completion.
+    unsigned modifiedTime;
+    /// Whether the directory exists.
+    bool exists;
+    /// Whether was scanned. If false, the files of the loaded listing are still valid.
+    bool changed;
+    /// Scanned files and subdirectories.
+    std::vector<DirEntry> entries;
+};
+
+/// State of a parallel scan of one resource directory.
+struct ManifestScan
+{
+    /// Queue a directory to be scanned or verified.
+    void QueueDir(const std::string& subDir, bool verify, unsigned knownTime)
+    {
+        DirScanTask* task;
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.emplace_back(this, subDir, verify, knownTime);
+            task = &tasks.back();
+        }
+
+        if (workQueue)
+            workQueue->QueueTask(task, &counter);
+        else
+            task->Complete(0);
+    }
+
+    /// Resource directory path with trailing slash.
+    std::string path;
+    /// Listing loaded from a manifest file, or null for a full scan.
+    const ManifestDir* loaded;
+    /// Work queue, or null to scan in the calling thread.
+    WorkQueue* workQueue;
+    /// Directory tasks. A deque keeps the tasks in place as more are added.
+    std::deque<DirScanTask> tasks;
+    /// Mutex for adding tasks from the worker threads.
+    std::mutex tasksMutex;
+    /// Counter of unfinished tasks.
+    TaskCounter counter;
+};
+
+void DirScanTask::Complete(unsigned)
+{
+    std::string fullPath = scan->path + subDir;
+
+    if (verify)
+    {
+        unsigned currentTime = LastModifiedTime(fullPath);
+        if (!currentTime)
+        {
+            exists = false;
+            return;
+        }
+        if (currentTime == modifiedTime)
+        {
+            changed = false;
+            return;
+        }
+        modifiedTime = currentTime;
+    }
+    else if (!modifiedTime)
+        modifiedTime = LastModifiedTime(fullPath);
+
+    ScanDirEntries(entries, fullPath);
+
+    // Subdirectories in the loaded listing are verified by their own tasks
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (!it->isDir)
+            continue;
+
+        std::string childDir = subDir + it->name + "/";
+        if (!scan->loaded || scan->loaded->subDirs.find(childDir) == scan->loaded->subDirs.end())
+            scan->QueueDir(childDir, false, it->modifiedTime);
+    }
+}
+
+/// Return the directory part of a resource name with trailing slash, or empty if in the resource directory itself.
+static std::string NameDir(const std::string& name)
+{
+    size_t pos = name.rfind('/');
+    return pos != std::string::npos ? name.substr(0, pos + 1) : std::string();
+}
+
+/// Scan a subdirectory and its subdirectories in the calling thread into a listing.
+static void ScanSubDir(const std::string& path, const std::string& subDir, ManifestDir& dest)
+{
+    dest.subDirs[subDir] = LastModifiedTime(path + subDir);
+
+    std::vector<DirEntry> entries;
+    ScanDirEntries(entries, path + subDir);
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it->isDir)
+            ScanSubDir(path, subDir + it->name + "/", dest);
+        else
+        {
+            ManifestFile& file = dest.files[subDir + it->name];
+            file.size = it->size;
+            file.modifiedTime = it->modifiedTime;
+        }
+    }
+}
+
+ResourceManifest::ResourceManifest()
+{
+}
+
+void ResourceManifest::ScanDir(const std::string& pathName)
+{
+    PROFILE(ScanResourceManifest);
+
+    ManifestScan scan;
+    scan.path = pathName;
+    scan.workQueue = Object::Subsystem<WorkQueue>();
+    scan.counter = 0;
+
+    // A loaded listing always contains at least the resource directory itself, otherwise do a full scan
+    auto loadedIt = loadedDirs.find(pathName);
+    scan.loaded = (loadedIt != loadedDirs.end() && !loadedIt->second.subDirs.empty()) ? &loadedIt->second : nullptr;
+
+    if (scan.loaded)
+    {
+        for (auto it = scan.loaded->subDirs.begin(); it != scan.loaded->subDirs.end(); ++it)
+            scan.QueueDir(it->first, true, it->second);
+    }
+    else
+        scan.QueueDir(std::string(), false, 0);
+
+    if (scan.workQueue)
+        scan.workQueue->Complete(scan.counter);
+
+    // Combine the scanned directories with the unchanged directories of the loaded listing
+    ManifestDir result;
+    std::set<std::string> rescanned;
+    size_t numRescanned = 0;
+
+    for (auto it = scan.tasks.begin(); it != scan.tasks.end(); ++it)
+    {
+        if (!it->exists)
+            continue;
+
+        result.subDirs[it->subDir] = it->modifiedTime;
+        if (!it->changed)
+            continue;
+
+        rescanned.insert(it->subDir);
+        ++numRescanned;
+        for (auto eIt = it->entries.begin(); eIt != it->entries.end(); ++eIt)
+        {
+            if (eIt->isDir)
+                continue;
+
+            ManifestFile& file = result.files[it->subDir + eIt->name];
+            file.size = eIt->size;
+            file.modifiedTime = eIt->modifiedTime;
+        }
+    }
+
+    if (scan.loaded)
+    {
+        for (auto it = scan.loaded->files.begin(); it != scan.loaded->files.end(); ++it)
+        {
+            std::string dirName = NameDir(it->first);
+            if (result.subDirs.find(dirName) != result.subDirs.end() && rescanned.find(dirName) == rescanned.end())
+                result.files.insert(*it);
+        }
+
+        LOGDEBUGF("Verified resource manifest of %s, rescanned %u of %u directories", pathName.c_str(), (unsigned)numRescanned,
+            (unsigned)scan.tasks.size());
+    }
+    else
+        LOGDEBUGF("Scanned %u files in %u directories for the resource manifest of %s", (unsigned)result.files.size(),
+            (unsigned)result.subDirs.size(), pathName.c_str());
+
+    if (loadedIt != loadedDirs.end())
+        loadedDirs.erase(loadedIt);
+
+    ManifestDir& dir = dirs[pathName];
+    dir.subDirs.swap(result.subDirs);
+    dir.files.swap(result.files);
+}
+
+void ResourceManifest::RemoveDir(const std::string& pathName)
+{
+    dirs.erase(pathName);
+}
+
+void ResourceManifest::UpdateFile(const std::string& pathName, const std::string& name)
+{
+    auto it = dirs.find(pathName);
+    if (it == dirs.end())
+        return;
+
+    ManifestDir& dir = it->second;
+    std::string fullName = pathName + name;
+
+    if (DirExists(fullName))
+        ScanSubDir(pathName, AddTrailingSlash(name), dir);
+    else if (FileExists(fullName))
+    {
+        // Rescan the containing directory for the file's size and modified time
+        std::string dirName = NameDir(name);
+        std::vector<DirEntry> entries;
+        ScanDirEntries(entries, pathName + dirName);
+        for (auto eIt = entries.begin(); eIt != entries.end(); ++eIt)
+        {
+            if (!eIt->isDir && dirName + eIt->name == name)
+            {
+                ManifestFile& file = dir.files[name];
+                file.size = eIt->size;
+                file.modifiedTime = eIt->modifiedTime;
+                break;
+            }
+        }
+    }
+    else
+    {
+        // Removed file, or a removed subdirectory and everything below it
+        dir.files.erase(name);
+
+        std::string subDir = AddTrailingSlash(name);
+        if (dir.subDirs.erase(subDir))
+        {
+            for (auto sIt = dir.subDirs.begin(); sIt != dir.subDirs.end();)
+            {
+                if (sIt->first.compare(0, subDir.length(), subDir) == 0)
+                    sIt = dir.subDirs.erase(sIt);
+                else
+                    ++sIt;
+            }
+            for (auto fIt = dir.files.begin(); fIt != dir.files.end();)
+            {
+                if (fIt->first.compare(0, subDir.length(), subDir) == 0)
+                    fIt = dir.files.erase(fIt);
+                else
+                    ++fIt;
+            }
+        }
+    }
+}
+
+bool ResourceManifest::Load(Stream& source)
+{
+    PROFILE(LoadResourceManifest);
+
+    if (source.ReadFileID() != "TMAN" || source.Read<unsigned>() != MANIFEST_VERSION)
+        return false;
+
+    loadedDirs.clear();
+
+    size_t numDirs = source.ReadVLE();
+    for (size_t i = 0; i < numDirs && !source.IsEof(); ++i)
+    {
+        ManifestDir& dir = loadedDirs[source.Read<std::string>()];
+
+        size_t numSubDirs = source.ReadVLE();
+        for (size_t j = 0; j < numSubDirs && !source.IsEof(); ++j)
+        {
+            std::string name = source.Read<std::string>();
+            dir.subDirs[name] = source.Read<unsigned>();
+        }
+
+        size_t numFiles = source.ReadVLE();
+        dir.files.reserve(numFiles);
+        for (size_t j = 0; j < numFiles && !source.IsEof(); ++j)
+        {
+            std::string name = source.Read<std::string>();
+            ManifestFile& file = dir.files[name];
+            file.size = source.Read<unsigned long long>();
+            file.modifiedTime = source.Read<unsigned>();
+        }
+    }
+
+    return true;
+}
+
+bool ResourceManifest::Save(Stream& dest) const
+{
+    PROFILE(SaveResourceManifest);
+
+    // Keep the loaded listings of directories that were not used on this run
+    std::vector<std::pair<const std::string*, const ManifestDir*> > saveDirs;
+    for (auto it = dirs.begin(); it != dirs.end(); ++it)
+        saveDirs.push_back(std::make_pair(&it->first, &it->second));
+    for (auto it = loadedDirs.begin(); it != loadedDirs.end(); ++it)
+    {
+        if (dirs.find(it->first) == dirs.end())
+            saveDirs.push_back(std::make_pair(&it->first, &it->second));
+    }
+
+    dest.WriteFileID("TMAN");
+    dest.Write(MANIFEST_VERSION);
+    dest.WriteVLE(saveDirs.size());
+
+    for (auto it = saveDirs.begin(); it != saveDirs.end(); ++it)
+    {
+        const ManifestDir& dir = *it->second;
+        dest.Write(*it->first);
+
+        dest.WriteVLE(dir.subDirs.size());
+        for (auto sIt = dir.subDirs.begin(); sIt != dir.subDirs.end(); ++sIt)
+        {
+            dest.Write(sIt->first);
+            dest.Write(sIt->second);
+        }
+
+        dest.WriteVLE(dir.files.size());
+        for (auto fIt = dir.files.begin(); fIt != dir.files.end(); ++fIt)
+        {
+            dest.Write(fIt->first);
+            dest.Write(fIt->second.size);
+            dest.Write(fIt->second.modifiedTime);
+        }
+    }
+
+    return true;
+}
+
+const ManifestFile* ResourceManifest::FindFile(const std::string& pathName, const std::string& name) const
+{
+    auto it = dirs.find(pathName);
+    if (it == dirs.end())
+        return nullptr;
+
+    auto fIt = it->second.files.find(name);
+    return fIt != it->second.files.end() ? &fIt->second : nullptr;
+}
+
+const ManifestDir* ResourceManifest::Dir(const std::string& pathName) const
+{
+    auto it = dirs.find(pathName);
+    return it != dirs.end() ? &it->second : nullptr;
+}
+
+size_t ResourceManifest::NumFiles() const
+{
+    size_t ret = 0;
+    for (auto it = dirs.begin(); it != dirs.end(); ++it)
+        ret += it->second.files.size();
+    return ret;
+}
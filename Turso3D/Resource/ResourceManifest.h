@@ -0,0 +1,64 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Stream;
+
+/// File of a resource directory in the manifest.
+struct ManifestFile
+{
+    /// Size in bytes.
+    unsigned long long size;
+    /// Last modified time as seconds since epoch.
+    unsigned modifiedTime;
+};
+
+/// Listing of the files of a resource directory and its subdirectories.
+struct ManifestDir
+{
+    /// Last modified times of the subdirectories by name relative to the resource directory, with trailing slash. The resource directory itself is included as an empty name.
+    std::map<std::string, unsigned> subDirs;
+    /// Files by name relative to the resource directory.
+    std::unordered_map<std::string, ManifestFile> files;
+};
+
+/// Cached listing of the files in the resource directories, so that resources can be found without filesystem calls. The directories are scanned recursively in parallel on the work queue. The manifest can be saved and loaded between runs, after which only directories whose modified time has changed are rescanned. Single files and subdirectories are updated from file change notifications. The manifest is accessed from the main thread only.
+class ResourceManifest
+{
+public:
+    /// Construct.
+    ResourceManifest();
+
+    /// Scan a resource directory and replace its listing. If the directory has a listing loaded from a manifest file, only verify its subdirectories and rescan those that have changed.
+    void ScanDir(const std::string& pathName);
+    /// Remove the listing of a resource directory.
+    void RemoveDir(const std::string& pathName);
+    /// Update a file or subdirectory of a resource directory after a change notification, adding, updating or removing it according to its current state on the filesystem.
+    void UpdateFile(const std::string& pathName, const std::string& name);
+    /// Load directory listings from a saved manifest. They are used after verifying on the next ScanDir(). Return true on success.
+    bool Load(Stream& source);
+    /// Save the directory listings. Return true on success.
+    bool Save(Stream& dest) const;
+
+    /// Return file information from a resource directory, or null if not found.
+    const ManifestFile* FindFile(const std::string& pathName, const std::string& name) const;
+    /// Return whether a file exists in a resource directory.
+    bool Exists(const std::string& pathName, const std::string& name) const { return FindFile(pathName, name) != nullptr; }
+    /// Return whether has a listing of a resource directory, either scanned or loaded.
+    bool HasDir(const std::string& pathName) const { return dirs.find(pathName) != dirs.end(); }
+    /// Return the listing of a resource directory, or null if not found.
+    const ManifestDir* Dir(const std::string& pathName) const;
+    /// Return the total number of files.
+    size_t NumFiles() const;
+
+private:
+    /// Scanned resource directories by absolute path with trailing slash.
+    std::map<std::string, ManifestDir> dirs;
+    /// Resource directories loaded from a manifest file and not yet verified.
+    std::map<std::string, ManifestDir> loadedDirs;
+};
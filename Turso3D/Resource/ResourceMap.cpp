@@ -0,0 +1,130 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Resource.h"
+#include "ResourceMap.h"
+
+static inline size_t HashResourceKey(const ResourceKey& key)
+{
+    // Mix the type and name so that same-named resources of different types spread out, and the low bits are usable
+    unsigned hash = key.first.Value() * 0x9e3779b1 ^ key.second.Value();
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+ResourceMap::ResourceMap() :
+    numUsed(0),
+    numDeleted(0)
+{
+}
+
+ResourceMap::~ResourceMap()
+{
+}
+
+Resource* ResourceMap::Find(const ResourceKey& key) const
+{
+    size_t index = FindSlot(key);
+    return index != NO_RESOURCE_SLOT ? slots[index].resource.Get() : nullptr;
+}
+
+void ResourceMap::Insert(const ResourceKey& key, Resource* resource)
+{
+    size_t index = FindSlot(key);
+    if (index != NO_RESOURCE_SLOT)
+    {
+        slots[index].resource = resource;
+        return;
+    }
+
+    // Keep the load including deleted markers under 3/4, so that probing stays short and always finds an empty slot
+    if ((numUsed + numDeleted + 1) * 4 > slots.size() * 3)
+    {
+        size_t numSlots = MIN_RESOURCE_SLOTS;
+        while ((numUsed + 1) * 2 > numSlots)
+            numSlots <<= 1;
+        Rehash(numSlots);
+    }
+
+    size_t mask = slots.size() - 1;
+    index = HashResourceKey(key) & mask;
+    while (slots[index].state == RESOURCE_SLOT_USED)
+        index = (index + 1) & mask;
+
+    ResourceSlot& slot = slots[index];
+    if (slot.state == RESOURCE_SLOT_DELETED)
+        --numDeleted;
+    slot.key = key;
+    slot.resource = resource;
+    slot.state = RESOURCE_SLOT_USED;
+    ++numUsed;
+}
+
+SharedPtr<Resource> ResourceMap::Erase(const ResourceKey& key)
+{
+    size_t index = FindSlot(key);
+    return index != NO_RESOURCE_SLOT ? EraseAt(index) : SharedPtr<Resource>();
+}
+
+SharedPtr<Resource> ResourceMap::EraseAt(size_t index)
+{
+    ResourceSlot& slot = slots[index];
+    if (slot.state != RESOURCE_SLOT_USED)
+        return SharedPtr<Resource>();
+
+    SharedPtr<Resource> ret = slot.resource;
+    slot.resource.Reset();
+    slot.state = RESOURCE_SLOT_DELETED;
+    --numUsed;
+    ++numDeleted;
+    return ret;
+}
+
+void ResourceMap::Clear()
+{
+    slots.clear();
+    numUsed = 0;
+    numDeleted = 0;
+}
+
+size_t ResourceMap::FindSlot(const ResourceKey& key) const
+{
+    if (slots.empty())
+        return NO_RESOURCE_SLOT;
+
+    size_t mask = slots.size() - 1;
+    for (size_t index = HashResourceKey(key) & mask;; index = (index + 1) & mask)
+    {
+        const ResourceSlot& slot = slots[index];
+        if (slot.state == RESOURCE_SLOT_EMPTY)
+            return NO_RESOURCE_SLOT;
+        if (slot.state == RESOURCE_SLOT_USED && slot.key == key)
+            return index;
+    }
+}
+
+void ResourceMap::Rehash(size_t numSlots)
+{
+    std::vector<ResourceSlot> oldSlots(numSlots);
+    oldSlots.swap(slots);
+    numUsed = 0;
+    numDeleted = 0;
+
+    size_t mask = numSlots - 1;
+    for (auto it = oldSlots.begin(); it != oldSlots.end(); ++it)
+    {
+        if (it->state != RESOURCE_SLOT_USED)
+            continue;
+
+        size_t index = HashResourceKey(it->key) & mask;
+        while (slots[index].state == RESOURCE_SLOT_USED)
+            index = (index + 1) & mask;
+
+        ResourceSlot& slot = slots[index];
+        slot.key = it->key;
+        slot.resource = it->resource;
+        slot.state = RESOURCE_SLOT_USED;
+        ++numUsed;
+    }
+}
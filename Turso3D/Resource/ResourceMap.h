@@ -0,0 +1,90 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/StringHash.h"
+#include "../Object/Ptr.h"
+
+#include <vector>
+
+class Resource;
+
+typedef std::pair<StringHash, StringHash> ResourceKey;
+
+/// Slot index returned when a key is not found.
+static const size_t NO_RESOURCE_SLOT = (size_t)-1;
+/// Minimum number of slots in a resource map.
+static const size_t MIN_RESOURCE_SLOTS = 64;
+
+/// State of a resource map slot.
+enum ResourceSlotState
+{
+    RESOURCE_SLOT_EMPTY = 0,
+    RESOURCE_SLOT_USED,
+    RESOURCE_SLOT_DELETED
+};
+
+/// %Resource map slot.
+struct ResourceSlot
+{
+    /// Construct empty.
+    ResourceSlot() :
+        state(RESOURCE_SLOT_EMPTY)
+    {
+    }
+
+    /// Type and name hash.
+    ResourceKey key;
+    /// %Resource.
+    SharedPtr<Resource> resource;
+    /// Slot state.
+    ResourceSlotState state;
+};
+
+/// Open-addressing hash map of resources by type and name hash, using linear probing. Erasing leaves a deleted marker, so slots can be erased while iterating by index. Not thread-safe by itself.
+class ResourceMap
+{
+public:
+    /// Construct empty.
+    ResourceMap();
+    /// Destruct.
+    ~ResourceMap();
+
+    /// Return a resource by key, or null if not found.
+    Resource* Find(const ResourceKey& key) const;
+    /// Insert a resource, replacing any existing resource with the same key.
+    void Insert(const ResourceKey& key, Resource* resource);
+    /// Erase a resource by key and return it, so that it can be destroyed later. Return null if not found.
+    SharedPtr<Resource> Erase(const ResourceKey& key);
+    /// Erase the resource in a slot and return it, so that it can be destroyed later.
+    SharedPtr<Resource> EraseAt(size_t index);
+    /// Remove all resources.
+    void Clear();
+
+    /// Return number of resources.
+    size_t Size() const { return numUsed; }
+    /// Return number of slots for iteration.
+    size_t NumSlots() const { return slots.size(); }
+    /// Return the resource in a slot, or null if the slot is not used.
+    Resource* At(size_t index) const { return slots[index].state == RESOURCE_SLOT_USED ? slots[index].resource.Get() : nullptr; }
+    /// Return the key of a slot.
+    const ResourceKey& KeyAt(size_t index) const { return slots[index].key; }
+
+private:
+    /// Prevent copy construction.
+    ResourceMap(const ResourceMap& rhs);
+    /// Prevent assignment.
+    ResourceMap& operator = (const ResourceMap& rhs);
+
+    /// Return the slot index of a key, or NO_RESOURCE_SLOT if not found.
+    size_t FindSlot(const ResourceKey& key) const;
+    /// Rebuild with a new power of two number of slots, dropping the deleted markers.
+    void Rehash(size_t numSlots);
+
+    /// Slots.
+    std::vector<ResourceSlot> slots;
+    /// Number of used slots.
+    size_t numUsed;
+    /// Number of deleted slots.
+    size_t numDeleted;
+};
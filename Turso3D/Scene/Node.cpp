@@ -1,14 +1,16 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/JSONReader.h"
+#include "../IO/JSONWriter.h"
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
-#include "../Object/Allocator.h"
+#include "../Object/MemoryTracker.h"
 #include "../Object/ObjectResolver.h"
-#include "../Resource/JSONFile.h"
 #include "Scene.h"
 
 static std::vector<SharedPtr<Node> > noChildren;
 static Allocator<NodeImpl> nodeImplAllocator;
+static PoolAllocator nodePool(64);
 
 Node::Node() :
     impl(nodeImplAllocator.Allocate()),
@@ -18,6 +20,9 @@ Node::Node() :
 {
     impl->scene = nullptr;
     impl->id = 0;
+    impl->typeIndex = 0;
+    impl->dirtyAttributes = 0;
+    impl->replicationFlags = 0;
 }
 
 Node::~Node()
@@ -30,6 +35,25 @@ Node::~Node()
     nodeImplAllocator.Free(impl);
 }
 
+void* Node::operator new(size_t size)
+{
+    MEMORY_SCOPE(MEMORY_SCENE);
+    return nodePool.Allocate(size);
+}
+
+void Node::operator delete(void* ptr, size_t size)
+{
+    nodePool.Free(ptr, size);
+}
+
+void Node::PoolStats(std::vector<AllocatorStats>& dest)
+{
+    nodePool.Stats(dest);
+
+    // The implementation structures have their own allocator
+    dest.push_back(nodeImplAllocator.Stats());
+}
+
 void Node::RegisterObject()
 {
     RegisterFactory<Node>();
@@ -102,6 +126,39 @@ void Node::LoadJSON(const JSONValue& source, ObjectResolver& resolver)
     }
 }
 
+void Node::LoadJSON(JSONReader& source, ObjectResolver& resolver)
+{
+    // Type and id has been read by the parent
+    if (!source.BeginObject())
+        return;
+
+    const AttributeTable* table = ClassAttributeTable();
+    while (source.NextKey())
+    {
+        if (source.Key() == "children")
+        {
+            if (!source.BeginArray())
+                continue;
+
+            while (source.NextElement())
+            {
+                StringHash childType;
+                unsigned childId;
+                Node* child = PeekJSONTypeAndId(source, childType, childId) ? CreateChild(childType) : nullptr;
+                if (child)
+                {
+                    resolver.StoreObject(childId, child);
+                    child->LoadJSON(source, resolver);
+                }
+                else
+                    source.SkipValue();
+            }
+        }
+        else if (!LoadJSONAttribute(source, resolver, table))
+            source.SkipValue();
+    }
+}
+
 void Node::SaveJSON(JSONValue& dest)
 {
     dest["type"] = TypeName();
@@ -124,11 +181,65 @@ void Node::SaveJSON(JSONValue& dest)
     }
 }
 
+void Node::SaveJSON(JSONWriter& dest)
+{
+    dest.Key("type");
+    dest.WriteString(TypeName());
+    dest.Key("id");
+    dest.WriteUInt(Id());
+    Serializable::SaveJSON(dest);
+
+    if (NumPersistentChildren())
+    {
+        dest.Key("children");
+        dest.BeginArray();
+        for (auto it = impl->children.begin(); it != impl->children.end(); ++it)
+        {
+            Node* child = *it;
+            if (!child->IsTemporary())
+            {
+                dest.BeginObject();
+                child->SaveJSON(dest);
+                dest.EndObject();
+            }
+        }
+        dest.EndArray();
+    }
+}
+
 bool Node::SaveJSON(Stream& dest)
 {
-    JSONFile json;
-    SaveJSON(json.Root());
-    return json.Save(dest);
+    JSONWriter writer(dest);
+    writer.BeginObject();
+    SaveJSON(writer);
+    writer.EndObject();
+    return writer.Flush();
+}
+
+bool Node::PeekJSONTypeAndId(JSONReader& source, StringHash& type, unsigned& id)
+{
+    size_t position = source.Position();
+    type = StringHash();
+    id = 0;
+
+    if (!source.BeginObject())
+    {
+        source.SetPosition(position);
+        return false;
+    }
+
+    while (source.NextKey())
+    {
+        if (source.Key() == "type")
+            type = StringHash(source.ReadString());
+        else if (source.Key() == "id")
+            id = (unsigned)source.ReadNumber();
+        else
+            source.SkipValue();
+    }
+
+    source.SetPosition(position);
+    return true;
 }
 
 void Node::SetName(const std::string& newName)
@@ -144,7 +255,10 @@ void Node::SetName(const char* newName)
 void Node::SetLayer(unsigned char newLayer)
 {
     if (layer < 32)
+    {
         layer = newLayer;
+        OnLayerChanged();
+    }
     else
         LOGERROR("Can not set layer 32 or higher");
 }
@@ -213,6 +327,11 @@ Node* Node::CreateChild(StringHash childType, const char* childName)
     return child;
 }
 
+void Node::ReserveChildren(size_t num)
+{
+    impl->children.reserve(num);
+}
+
 void Node::AddChild(Node* child)
 {
     // Check for illegal or redundant parent assignment
@@ -239,7 +358,10 @@ void Node::AddChild(Node* child)
     }
 #endif
 
+    // Hold a reference so that removing from the old parent does not destroy the child
+    SharedPtr<Node> childRef(child);
     Node* oldParent = child->parent;
+    bool sameScene = impl->scene && child->impl->scene == impl->scene;
     if (oldParent)
     {
         for (auto it = oldParent->impl->children.begin(); it != oldParent->impl->children.end(); ++it)
@@ -257,6 +379,9 @@ void Node::AddChild(Node* child)
     child->OnParentSet(this, oldParent);
     if (impl->scene)
         impl->scene->AddNode(child);
+    // A node added to the scene is marked created instead
+    if (sameScene)
+        child->MarkDirty(0, NRF_PARENT_CHANGED);
 }
 
 void Node::RemoveChild(Node* child)
@@ -441,6 +566,34 @@ void Node::FindChildrenByLayer(std::vector<Node*>& result, unsigned layerMask, b
     }
 }
 
+void Node::MarkAttributeDirty(Attribute* attr)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    if (!attr || !attributes)
+        return;
+
+    for (size_t i = 0; i < attributes->size(); ++i)
+    {
+        if (attributes->at(i) == attr)
+        {
+            MarkDirty(1ULL << (i < 63 ? i : 63));
+            break;
+        }
+    }
+}
+
+void Node::MarkDirty(unsigned long long attributeMask, unsigned char flags)
+{
+    Scene* scene = impl->scene;
+    if (!scene || !scene->IsChangeTracking() || (!attributeMask && !flags))
+        return;
+
+    if (!impl->dirtyAttributes && !impl->replicationFlags)
+        scene->AddChangedNode(this);
+    impl->dirtyAttributes |= attributeMask;
+    impl->replicationFlags |= flags;
+}
+
 void Node::SetScene(Scene* newScene)
 {
     Scene* oldScene = impl->scene;
@@ -477,3 +630,13 @@ void Node::OnSceneSet(Scene*, Scene*)
 void Node::OnEnabledChanged(bool)
 {
 }
+
+void Node::OnAttributeSet(Attribute* attr)
+{
+    if (impl->scene && impl->scene->IsChangeTracking())
+        MarkAttributeDirty(attr);
+}
+
+void Node::OnLayerChanged()
+{
+}
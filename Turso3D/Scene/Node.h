@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "../Object/Allocator.h"
 #include "../Object/Serializable.h"
 #include "../Math/Quaternion.h"
 
@@ -23,6 +24,13 @@ static const unsigned short NF_GEOMETRY = 0x100;
 static const unsigned short NF_LIGHT = 0x200;
 static const unsigned short NF_CASTSHADOWS = 0x400;
 static const unsigned short NF_HASLODLEVELS = 0x800;
+static const unsigned short NF_GPU_DRIVEN = 0x1000;
+static const unsigned short NF_OCCLUDER = 0x2000;
+static const unsigned short NF_TRANSFORM_UPDATE_QUEUED = 0x4000;
+static const unsigned short NF_IMPOSTOR = 0x8000;
+static const unsigned char NRF_CREATED = 0x1;
+static const unsigned char NRF_PARENT_CHANGED = 0x2;
+static const unsigned long long DIRTY_ATTRIBUTES_ALL = 0xffffffffffffffffULL;
 static const unsigned char LAYER_DEFAULT = 0x0;
 static const unsigned LAYERMASK_ALL = 0xffffffff;
 
@@ -45,8 +53,14 @@ struct NodeImpl
     Scene* scene;
     /// Id within the scene.
     unsigned id;
+    /// Index in the scene's array of nodes with the same type.
+    unsigned typeIndex;
     /// %Node name.
     std::string name;
+    /// Bitmask of attributes changed since the last replication sync, by attribute index. Attributes from index 63 onward share the last bit.
+    unsigned long long dirtyAttributes;
+    /// Replication flags of structural changes since the last sync.
+    unsigned char replicationFlags;
 };
 
 /// Base class for scene nodes.
@@ -62,6 +76,13 @@ public:
     
     /// Register factory and attributes.
     static void RegisterObject();
+
+    /// Allocate memory for a node from the pool of its size class, so that nodes of the same class are contiguous in memory.
+    static void* operator new(size_t size);
+    /// Free node memory to its pool.
+    static void operator delete(void* ptr, size_t size);
+    /// Return statistics of the node memory pools.
+    static void PoolStats(std::vector<AllocatorStats>& dest);
     
     /// Load from binary stream. Store node references to be resolved later.
     void Load(Stream& source, ObjectResolver& resolver) override;
@@ -69,13 +90,19 @@ public:
     void Save(Stream& dest) override;
     /// Load from JSON data. Store node references to be resolved later.
     void LoadJSON(const JSONValue& source, ObjectResolver& resolver) override;
+    /// Load from a streaming JSON reader. Store node references to be resolved later.
+    void LoadJSON(JSONReader& source, ObjectResolver& resolver) override;
     /// Save as JSON data.
     void SaveJSON(JSONValue& dest) override;
+    /// Save as keys of the object being written by a streaming JSON writer, including the child nodes.
+    void SaveJSON(JSONWriter& dest) override;
     /// Return unique id within the scene, or 0 if not in a scene.
     unsigned Id() const override { return impl->id; }
 
-    /// Save as JSON text data to a binary stream. Return true on success.
+    /// Save as JSON text data to a binary stream, streaming the text without building a JSONValue tree. Return true on success.
     bool SaveJSON(Stream& dest);
+    /// Read the type and id of a node object from a streaming JSON reader without consuming it, as the keys may be in any order. Return false if the value is not an object.
+    static bool PeekJSONTypeAndId(JSONReader& source, StringHash& type, unsigned& id);
     /// Set name. Is not required to be unique within the scene.
     void SetName(const std::string& newName);
     /// Set name.
@@ -98,6 +125,8 @@ public:
     Node* CreateChild(StringHash childType, const char* childName);
     /// Add node as a child. Same as calling SetParent for the child node.
     void AddChild(Node* child);
+    /// Reserve space for child nodes, for example before adding many.
+    void ReserveChildren(size_t num);
     /// Remove child node. Will delete it if there are no other strong references to it.
     void RemoveChild(Node* child);
     /// Remove child node by index.
@@ -106,6 +135,8 @@ public:
     void RemoveAllChildren();
     /// Remove self immediately. As this will delete the node (if no other strong references exist) no operations on the node are permitted after calling this.
     void RemoveSelf();
+    /// Mark an attribute changed for scene replication, when it was changed through a setter that does not track changes. Has no effect unless the scene tracks changes.
+    void MarkAttributeDirty(Attribute* attr);
     /// Create child node of the specified type, template version.
     template <class T> T* CreateChild() { return static_cast<T*>(CreateChild(T::TypeStatic())); }
     /// Create named child node of the specified type, template version.
@@ -168,10 +199,22 @@ public:
     bool TestFlag(unsigned short bit) const { return (flags & bit) != 0; }
     /// Return bit flags. Used internally eg. by octree queries.
     unsigned short Flags() const { return flags; }
+    /// Mark attributes by index bitmask and replication flags changed, if the scene tracks changes. Called internally.
+    void MarkDirty(unsigned long long attributeMask, unsigned char flags = 0);
+    /// Clear the replication changes. Called internally.
+    void ClearDirty() { impl->dirtyAttributes = 0; impl->replicationFlags = 0; }
+    /// Return bitmask of attributes changed since the last replication sync.
+    unsigned long long DirtyAttributes() const { return impl->dirtyAttributes; }
+    /// Return replication flags of structural changes since the last sync.
+    unsigned char ReplicationFlags() const { return impl->replicationFlags; }
     /// Assign node to a new scene. Called internally.
     void SetScene(Scene* newScene);
     /// Assign new id. Called internally.
     void SetId(unsigned newId);
+    /// Assign index in the scene's array of nodes with the same type. Called internally.
+    void SetTypeIndex(unsigned newIndex) { impl->typeIndex = newIndex; }
+    /// Return index in the scene's array of nodes with the same type.
+    unsigned TypeIndex() const { return impl->typeIndex; }
     
     /// Skip the binary data of a node hierarchy, in case the node could not be created.
     static void SkipHierarchy(Stream& source);
@@ -183,6 +226,10 @@ protected:
     virtual void OnSceneSet(Scene* newScene, Scene* oldScene);
     /// Handle the enabled status changing.
     virtual void OnEnabledChanged(bool newEnabled);
+    /// Handle the layer changing.
+    virtual void OnLayerChanged();
+    /// Handle an attribute value being set through SetAttributeValue() by marking it changed for replication.
+    void OnAttributeSet(Attribute* attr) override;
 
     /// Node implementation.
     NodeImpl* impl;
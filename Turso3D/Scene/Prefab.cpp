@@ -0,0 +1,340 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../IO/ObjectRef.h"
+#include "../Math/Matrix3x4.h"
+#include "../Object/Serializable.h"
+#include "../Resource/JSONFile.h"
+#include "../Time/Profiler.h"
+#include "Prefab.h"
+#include "SpatialNode.h"
+
+#include <algorithm>
+
+/// Alignment of fixed-size attribute values in the template data.
+static const size_t PREFAB_VALUE_ALIGNMENT = 8;
+
+Prefab::Prefab() :
+    hasObjectRefs(false)
+{
+}
+
+Prefab::~Prefab()
+{
+}
+
+void Prefab::RegisterObject()
+{
+    RegisterFactory<Prefab>();
+}
+
+bool Prefab::BeginLoad(Stream& source)
+{
+    PROFILE(LoadPrefab);
+
+    JSONFile json;
+    if (!json.Load(source))
+    {
+        LOGERROR("Could not parse prefab " + source.Name());
+        return false;
+    }
+
+    return Define(json.Root());
+}
+
+size_t Prefab::CpuMemoryUse() const
+{
+    size_t ret = nodes.size() * sizeof(PrefabNode) + attributes.size() * sizeof(PrefabAttribute) + fixedData.size();
+    for (auto it = strings.begin(); it != strings.end(); ++it)
+        ret += sizeof(std::string) + it->length();
+    for (auto it = resourceRefs.begin(); it != resourceRefs.end(); ++it)
+        ret += sizeof(ResourceRef) + it->name.length();
+    for (auto it = resourceRefLists.begin(); it != resourceRefLists.end(); ++it)
+    {
+        ret += sizeof(ResourceRefList);
+        for (auto nIt = it->names.begin(); nIt != it->names.end(); ++nIt)
+            ret += sizeof(std::string) + nIt->length();
+    }
+    ret += jsonValues.size() * sizeof(JSONValue);
+    return ret;
+}
+
+bool Prefab::Define(const JSONValue& source)
+{
+    PROFILE(DefinePrefab);
+
+    Clear();
+
+    if (!source.IsObject())
+    {
+        LOGERROR("Prefab data is not a JSON object");
+        return false;
+    }
+
+    // Old node id's paired with the template node indices
+    std::vector<std::pair<unsigned, unsigned> > ids;
+    AddNode(source, 0, ids);
+    if (nodes.empty())
+    {
+        LOGERROR("Prefab root node is of unknown type");
+        return false;
+    }
+
+    // Map object refs to template node indices plus one. Refs to nodes outside the prefab become null
+    std::sort(ids.begin(), ids.end());
+    for (auto it = attributes.begin(); it != attributes.end(); ++it)
+    {
+        if (it->attr->Type() != ATTR_OBJECTREF)
+            continue;
+
+        auto idIt = std::lower_bound(ids.begin(), ids.end(), std::make_pair((unsigned)it->index, 0u));
+        it->index = (it->index && idIt != ids.end() && idIt->first == it->index) ? idIt->second + 1 : 0;
+    }
+
+    // The storage vectors do not grow anymore, so the value pointers can be assigned
+    for (auto it = attributes.begin(); it != attributes.end(); ++it)
+    {
+        switch (it->attr->Type())
+        {
+        case ATTR_OBJECTREF:
+            it->value = nullptr;
+            break;
+
+        case ATTR_STRING:
+            it->value = &strings[it->index];
+            break;
+
+        case ATTR_RESOURCEREF:
+            it->value = &resourceRefs[it->index];
+            break;
+
+        case ATTR_RESOURCEREFLIST:
+            it->value = &resourceRefLists[it->index];
+            break;
+
+        case ATTR_JSONVALUE:
+            it->value = &jsonValues[it->index];
+            break;
+
+        default:
+            it->value = &fixedData[it->index];
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool Prefab::Define(Node* root)
+{
+    if (!root)
+    {
+        Clear();
+        return false;
+    }
+
+    JSONValue json;
+    root->SaveJSON(json);
+    return Define(json);
+}
+
+Node* Prefab::Instantiate(Node* parent) const
+{
+    if (!parent || nodes.empty())
+        return nullptr;
+
+    std::vector<Node*> instanceNodes(nodes.size());
+    return InstantiateOne(parent, instanceNodes);
+}
+
+size_t Prefab::Instantiate(Node* parent, size_t count, const Matrix3x4* transforms, std::vector<Node*>* dest) const
+{
+    PROFILE(InstantiatePrefab);
+
+    if (!parent || nodes.empty())
+        return 0;
+
+    parent->ReserveChildren(parent->NumChildren() + count);
+    if (dest)
+        dest->reserve(dest->size() + count);
+
+    std::vector<Node*> instanceNodes(nodes.size());
+    size_t numInstances = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        Node* root = InstantiateOne(parent, instanceNodes);
+        if (!root)
+            break;
+
+        if (transforms && root->TestFlag(NF_SPATIAL))
+        {
+            Vector3 position;
+            Quaternion rotation;
+            Vector3 scale;
+            transforms[i].Decompose(position, rotation, scale);
+            static_cast<SpatialNode*>(root)->SetTransform(position, rotation, scale);
+        }
+
+        if (dest)
+            dest->push_back(root);
+        ++numInstances;
+    }
+
+    return numInstances;
+}
+
+void Prefab::AddNode(const JSONValue& source, unsigned parentIndex, std::vector<std::pair<unsigned, unsigned> >& ids)
+{
+    // Unknown node types are dropped along with their children, like when loading a scene
+    StringHash type(source["type"].GetString());
+    if (TypeNameFromType(type).empty())
+    {
+        LOGWARNING("Skipping prefab node of unknown type " + source["type"].GetString());
+        return;
+    }
+
+    unsigned index = (unsigned)nodes.size();
+    ids.push_back(std::make_pair((unsigned)source["id"].GetNumber(), index));
+
+    PrefabNode newNode;
+    newNode.type = type;
+    newNode.parentIndex = nodes.empty() ? index : parentIndex;
+    newNode.numChildren = 0;
+    newNode.firstAttribute = (unsigned)attributes.size();
+    newNode.endAttribute = newNode.firstAttribute;
+    nodes.push_back(newNode);
+
+    const AttributeTable* table = Serializable::FindAttributeTable(type);
+    if (table)
+    {
+        const JSONObject& object = source.GetObject();
+
+        for (auto it = table->attributes.begin(); it != table->attributes.end(); ++it)
+        {
+            Attribute* attr = *it;
+            auto jsonIt = object.find(attr->Name());
+            if (jsonIt == object.end())
+                continue;
+
+            PrefabAttribute newAttr;
+            newAttr.attr = attr;
+            newAttr.value = nullptr;
+
+            AttributeType attrType = attr->Type();
+            switch (attrType)
+            {
+            case ATTR_OBJECTREF:
+                // Store the old id until all nodes are known
+                newAttr.index = (size_t)jsonIt->second.GetNumber();
+                hasObjectRefs = true;
+                break;
+
+            case ATTR_STRING:
+                newAttr.index = strings.size();
+                strings.push_back(jsonIt->second.GetString());
+                break;
+
+            case ATTR_RESOURCEREF:
+                newAttr.index = resourceRefs.size();
+                resourceRefs.push_back(ResourceRef());
+                Attribute::FromJSON(attrType, &resourceRefs.back(), jsonIt->second);
+                break;
+
+            case ATTR_RESOURCEREFLIST:
+                newAttr.index = resourceRefLists.size();
+                resourceRefLists.push_back(ResourceRefList());
+                Attribute::FromJSON(attrType, &resourceRefLists.back(), jsonIt->second);
+                break;
+
+            case ATTR_JSONVALUE:
+                newAttr.index = jsonValues.size();
+                jsonValues.push_back(jsonIt->second);
+                break;
+
+            default:
+                newAttr.index = (fixedData.size() + PREFAB_VALUE_ALIGNMENT - 1) & ~(PREFAB_VALUE_ALIGNMENT - 1);
+                fixedData.resize(newAttr.index + attr->ByteSize());
+                Attribute::FromJSON(attrType, &fixedData[newAttr.index], jsonIt->second);
+                break;
+            }
+
+            attributes.push_back(newAttr);
+        }
+    }
+
+    nodes[index].endAttribute = (unsigned)attributes.size();
+
+    const JSONArray& children = source["children"].GetArray();
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        size_t oldNumNodes = nodes.size();
+        AddNode(*it, index, ids);
+        if (nodes.size() > oldNumNodes)
+            ++nodes[index].numChildren;
+    }
+}
+
+Node* Prefab::InstantiateOne(Node* parent, std::vector<Node*>& instanceNodes) const
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const PrefabNode& templateNode = nodes[i];
+        Node* nodeParent = i ? instanceNodes[templateNode.parentIndex] : parent;
+        Node* node = nodeParent ? nodeParent->CreateChild(templateNode.type) : nullptr;
+        instanceNodes[i] = node;
+        if (!node)
+        {
+            if (!i)
+                return nullptr;
+            continue;
+        }
+
+        if (templateNode.numChildren)
+            node->ReserveChildren(templateNode.numChildren);
+
+        for (unsigned j = templateNode.firstAttribute; j < templateNode.endAttribute; ++j)
+        {
+            const PrefabAttribute& attr = attributes[j];
+            if (attr.value)
+                attr.attr->FromValue(node, attr.value);
+        }
+    }
+
+    // Apply object refs once all the nodes of the instance exist
+    if (hasObjectRefs)
+    {
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            const PrefabNode& templateNode = nodes[i];
+            Node* node = instanceNodes[i];
+            if (!node)
+                continue;
+
+            for (unsigned j = templateNode.firstAttribute; j < templateNode.endAttribute; ++j)
+            {
+                const PrefabAttribute& attr = attributes[j];
+                if (attr.value)
+                    continue;
+
+                Node* target = attr.index ? instanceNodes[attr.index - 1] : nullptr;
+                ObjectRef ref(target ? target->Id() : 0);
+                attr.attr->FromValue(node, &ref);
+            }
+        }
+    }
+
+    return instanceNodes[0];
+}
+
+void Prefab::Clear()
+{
+    nodes.clear();
+    attributes.clear();
+    fixedData.clear();
+    strings.clear();
+    resourceRefs.clear();
+    resourceRefLists.clear();
+    jsonValues.clear();
+    hasObjectRefs = false;
+}
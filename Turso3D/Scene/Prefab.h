@@ -0,0 +1,95 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/ResourceRef.h"
+#include "../Resource/Resource.h"
+
+class Attribute;
+class Matrix3x4;
+class Node;
+
+/// Attribute value of a prefab template node.
+struct PrefabAttribute
+{
+    /// Attribute description from the per-class attribute table.
+    Attribute* attr;
+    /// Index of the value in the prefab's storage of the attribute's type. For object refs, the referred template node index plus one, or zero if the ref points outside the prefab.
+    size_t index;
+    /// Value in memory, passed directly to the attribute. Null for object refs.
+    const void* value;
+};
+
+/// Node of a prefab template.
+struct PrefabNode
+{
+    /// Node type.
+    StringHash type;
+    /// Parent node index, or the node's own index for the root.
+    unsigned parentIndex;
+    /// Number of child nodes.
+    unsigned numChildren;
+    /// Index of the first attribute value.
+    unsigned firstAttribute;
+    /// Index past the last attribute value.
+    unsigned endAttribute;
+};
+
+/// Node hierarchy template that is deserialized once from JSON and can then be instantiated many times. Each node's attribute values are stored ready in memory form, so that instantiation only creates the nodes and copies the values, with fixed-size member attributes written directly into the node. Object refs between the template's nodes are remapped to each instance without a resolver pass. Only the per-class registered attributes are stored.
+class Prefab : public Resource
+{
+    OBJECT(Prefab);
+
+public:
+    /// Construct.
+    Prefab();
+    /// Destruct.
+    ~Prefab();
+
+    /// Register object factory.
+    static void RegisterObject();
+
+    /// Load the template from JSON node data in a stream. Return true on success.
+    bool BeginLoad(Stream& source) override;
+    /// Return CPU memory used by the template.
+    size_t CpuMemoryUse() const override;
+
+    /// Define the template from JSON node data, as saved by Node::SaveJSON(). Return true on success.
+    bool Define(const JSONValue& source);
+    /// Define the template from an existing node and its persistent children. Return true on success.
+    bool Define(Node* root);
+    /// Instantiate once as a child of a parent node and return the root node, or null on failure.
+    Node* Instantiate(Node* parent) const;
+    /// Instantiate several times as children of a parent node, optionally setting the root node transforms from an array of count parent space matrices. The instantiated root nodes are appended to the destination vector if given. Return the number of instances created.
+    size_t Instantiate(Node* parent, size_t count, const Matrix3x4* transforms = nullptr, std::vector<Node*>* dest = nullptr) const;
+
+    /// Return number of nodes in the template.
+    size_t NumNodes() const { return nodes.size(); }
+    /// Return the template nodes. The root is first and parents precede their children.
+    const std::vector<PrefabNode>& Nodes() const { return nodes; }
+
+private:
+    /// Add a node and its children from JSON data to the template, and record the id mapping of the nodes.
+    void AddNode(const JSONValue& source, unsigned parentIndex, std::vector<std::pair<unsigned, unsigned> >& ids);
+    /// Instantiate the template once. Return the root node.
+    Node* InstantiateOne(Node* parent, std::vector<Node*>& instanceNodes) const;
+    /// Clear the template.
+    void Clear();
+
+    /// Template nodes in depth-first order.
+    std::vector<PrefabNode> nodes;
+    /// Attribute values of all nodes.
+    std::vector<PrefabAttribute> attributes;
+    /// Fixed-size attribute values.
+    std::vector<unsigned char> fixedData;
+    /// String attribute values.
+    std::vector<std::string> strings;
+    /// Resource ref attribute values.
+    std::vector<ResourceRef> resourceRefs;
+    /// Resource ref list attribute values.
+    std::vector<ResourceRefList> resourceRefLists;
+    /// JSON attribute values.
+    std::vector<JSONValue> jsonValues;
+    /// Whether any attribute is an object ref.
+    bool hasObjectRefs;
+};
@@ -1,16 +1,113 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/JSONReader.h"
 #include "../IO/Log.h"
-#include "../IO/Stream.h"
+#include "../IO/MemoryBuffer.h"
+#include "../IO/ObjectRef.h"
+#include "../IO/VectorBuffer.h"
+#include "../Object/MemoryTracker.h"
 #include "../Object/ObjectResolver.h"
-#include "../Resource/JSONFile.h"
 #include "../Time/Profiler.h"
+#include "Prefab.h"
 #include "Scene.h"
 #include "SpatialNode.h"
 
+#include <algorithm>
+
+/// Columnar binary scene format version.
+static const unsigned SCENE_FILE_VERSION = 1;
+/// Parent index of the scene root in the columnar format.
+static const unsigned NO_PARENT_INDEX = 0xffffffff;
+
+/// Collect the persistent nodes of a hierarchy in depth-first order along with their parent indices.
+static void CollectSaveNodes(Node* node, unsigned parentIndex, std::vector<Node*>& dest, std::vector<unsigned>& parentIndices)
+{
+    unsigned index = (unsigned)dest.size();
+    dest.push_back(node);
+    parentIndices.push_back(parentIndex);
+
+    const std::vector<SharedPtr<Node> >& children = node->Children();
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        Node* child = *it;
+        if (!child->IsTemporary())
+            CollectSaveNodes(child, index, dest, parentIndices);
+    }
+}
+
+/// Pending replication changes of a node.
+struct NodeChanges
+{
+    /// Changed node.
+    Node* node;
+    /// Bitmask of changed attributes.
+    unsigned long long attributes;
+    /// Replication flags.
+    unsigned char flags;
+};
+
+/// Return whether a node or any of its ancestors is temporary, in which case it is not replicated.
+static bool IsInTemporaryTree(Node* node)
+{
+    for (; node; node = node->Parent())
+    {
+        if (node->IsTemporary())
+            return true;
+    }
+    return false;
+}
+
+/// Write the replication record of one node: id, flags, type and parent if needed, and the changed attributes by index.
+static void WriteNodeChanges(Stream& dest, const NodeChanges& changes)
+{
+    Node* node = changes.node;
+    dest.Write(node->Id());
+    dest.Write(changes.flags);
+    if (changes.flags & NRF_CREATED)
+        dest.Write(node->Type());
+    if (changes.flags & (NRF_CREATED | NRF_PARENT_CHANGED))
+        dest.Write(node->Parent() ? node->Parent()->Id() : 0u);
+
+    const std::vector<SharedPtr<Attribute> >* attributes = node->Attributes();
+    size_t numAttributes = attributes ? attributes->size() : 0;
+    size_t numChanged = 0;
+    for (size_t i = 0; i < numAttributes; ++i)
+    {
+        if (changes.attributes & (1ULL << (i < 63 ? i : 63)))
+            ++numChanged;
+    }
+
+    dest.WriteVLE(numChanged);
+    for (size_t i = 0; i < numAttributes; ++i)
+    {
+        if (changes.attributes & (1ULL << (i < 63 ? i : 63)))
+        {
+            Attribute* attr = attributes->at(i);
+            dest.WriteVLE(i);
+            dest.Write((unsigned char)attr->Type());
+            attr->ToBinary(node, dest);
+        }
+    }
+}
+
+/// Write a chunk with its ID and size.
+static void WriteChunk(Stream& dest, const char* id, const VectorBuffer& chunk)
+{
+    dest.WriteFileID(id);
+    dest.Write((unsigned)chunk.Size());
+    dest.Write(chunk.Data(), chunk.Size());
+}
+
 Scene::Scene() :
-    nextNodeId(1)
+    firstFreeSlot(0),
+    lastFreeSlot(0),
+    numFreeSlots(0),
+    numNodes(0),
+    changeTracking(false)
 {
+    // Reserve slot 0 for the null id
+    idSlots.resize(1);
+
     // Register self to allow finding by ID
     AddNode(this);
 }
@@ -19,9 +116,9 @@ Scene::~Scene()
 {
     // Node destructor will also remove children. But at that point the node<>id maps have been destroyed 
     // so must tear down the scene tree already here
-    RemoveAllChildren();
+    Clear();
     RemoveNode(this);
-    assert(nodes.empty());
+    assert(!numNodes);
 }
 
 void Scene::RegisterObject()
@@ -35,19 +132,105 @@ void Scene::Save(Stream& dest)
 {
     PROFILE(SaveScene);
     
-    LOGINFO("Saving scene to " + dest.Name());
+    // Unnamed memory streams, such as snapshots, are not logged
+    if (!dest.Name().empty())
+        LOGINFO("Saving scene to " + dest.Name());
     
-    dest.WriteFileID("SCNE");
-    Node::Save(dest);
+    std::vector<Node*> saveNodes;
+    std::vector<unsigned> parentIndices;
+    CollectSaveNodes(this, NO_PARENT_INDEX, saveNodes, parentIndices);
+
+    // Group the nodes by type. Object refs are stored as node indices plus one, so that loading resolves them with an array lookup
+    std::vector<StringHash> types;
+    std::vector<unsigned> typeIndices;
+    std::vector<std::vector<Node*> > typeNodes;
+    std::map<unsigned, unsigned> refIndices;
+    for (size_t i = 0; i < saveNodes.size(); ++i)
+    {
+        Node* node = saveNodes[i];
+        size_t typeIndex = std::find(types.begin(), types.end(), node->Type()) - types.begin();
+        if (typeIndex == types.size())
+        {
+            types.push_back(node->Type());
+            typeNodes.resize(types.size());
+        }
+
+        typeIndices.push_back((unsigned)typeIndex);
+        typeNodes[typeIndex].push_back(node);
+        refIndices[node->Id()] = (unsigned)i + 1;
+    }
+
+    dest.WriteFileID("TSCN");
+    dest.Write(SCENE_FILE_VERSION);
+
+    VectorBuffer chunk;
+    chunk.Write((unsigned)saveNodes.size());
+    chunk.Write((unsigned)types.size());
+    for (auto it = types.begin(); it != types.end(); ++it)
+        chunk.Write(*it);
+    chunk.Write(&typeIndices[0], typeIndices.size() * sizeof(unsigned));
+    chunk.Write(&parentIndices[0], parentIndices.size() * sizeof(unsigned));
+    WriteChunk(dest, "NODE", chunk);
+
+    VectorBuffer column;
+    for (size_t i = 0; i < types.size(); ++i)
+    {
+        const std::vector<Node*>& columnNodes = typeNodes[i];
+        const std::vector<SharedPtr<Attribute> >* attributes = columnNodes[0]->Attributes();
+        size_t numAttributes = attributes ? attributes->size() : 0;
+
+        chunk.Clear();
+        chunk.Write((unsigned)i);
+        chunk.WriteVLE(numAttributes);
+
+        for (size_t j = 0; j < numAttributes; ++j)
+        {
+            Attribute* attr = attributes->at(j);
+            size_t byteSize = attr->ByteSize();
+
+            // Fixed size values are stored contiguously in memory layout, the rest sequentially in the binary serialization format
+            column.Clear();
+            if (byteSize)
+            {
+                column.Resize(columnNodes.size() * byteSize);
+                for (size_t k = 0; k < columnNodes.size(); ++k)
+                {
+                    unsigned char* value = column.ModifiableData() + k * byteSize;
+                    attr->ToValue(columnNodes[k], value);
+                    if (attr->Type() == ATTR_OBJECTREF)
+                    {
+                        ObjectRef& ref = *reinterpret_cast<ObjectRef*>(value);
+                        auto refIt = refIndices.find(ref.id);
+                        ref.id = refIt != refIndices.end() ? refIt->second : 0;
+                    }
+                }
+            }
+            else
+            {
+                for (size_t k = 0; k < columnNodes.size(); ++k)
+                    attr->ToBinary(columnNodes[k], column);
+            }
+
+            chunk.Write(attr->Name());
+            chunk.Write((unsigned char)attr->Type());
+            chunk.WriteBuffer(column.Buffer());
+        }
+
+        WriteChunk(dest, "ATTR", chunk);
+    }
 }
 
 bool Scene::Load(Stream& source)
 {
     PROFILE(LoadScene);
+    MEMORY_SCOPE(MEMORY_SCENE);
     
-    LOGINFO("Loading scene from " + source.Name());
+    if (!source.Name().empty())
+        LOGINFO("Loading scene from " + source.Name());
     
     std::string fileId = source.ReadFileID();
+    if (fileId == "TSCN")
+        return LoadColumns(source);
     if (fileId != "SCNE")
     {
         LOGERROR("File is not a binary scene file");
@@ -72,9 +255,187 @@ bool Scene::Load(Stream& source)
     return true;
 }
 
+bool Scene::LoadColumns(Stream& source)
+{
+    unsigned version = source.Read<unsigned>();
+    if (version != SCENE_FILE_VERSION)
+    {
+        LOGERRORF("Unsupported binary scene file version %u", version);
+        return false;
+    }
+
+    Clear();
+
+    // Nodes by index in the file, null for unknown types, and the nodes of each type in column order
+    std::vector<Node*> loadNodes;
+    std::vector<std::vector<Node*> > typeNodes;
+
+    // Skip unknown chunks to allow extending the format
+    while (!source.IsEof())
+    {
+        std::string chunkId = source.ReadFileID();
+        size_t chunkSize = source.Read<unsigned>();
+        size_t chunkEnd = source.Position() + chunkSize;
+        if (chunkEnd > source.Size())
+        {
+            LOGERROR("Truncated chunk in binary scene file");
+            return false;
+        }
+
+        if (chunkId == "NODE")
+        {
+            if (!LoadNodeChunk(source, loadNodes, typeNodes))
+                return false;
+        }
+        else if (chunkId == "ATTR")
+            LoadAttributeChunk(source, loadNodes, typeNodes);
+
+        source.Seek(chunkEnd);
+    }
+
+    return true;
+}
+
+bool Scene::LoadNodeChunk(Stream& source, std::vector<Node*>& loadNodes, std::vector<std::vector<Node*> >& typeNodes)
+{
+    PROFILE(CreateSceneNodes);
+
+    size_t numNodes = source.Read<unsigned>();
+    size_t numTypes = source.Read<unsigned>();
+    std::vector<StringHash> types(numTypes);
+    for (size_t i = 0; i < numTypes; ++i)
+        types[i] = source.Read<StringHash>();
+
+    std::vector<unsigned> typeIndices(numNodes);
+    std::vector<unsigned> parentIndices(numNodes);
+    if (!numNodes || source.Read(&typeIndices[0], numNodes * sizeof(unsigned)) != numNodes * sizeof(unsigned) ||
+        source.Read(&parentIndices[0], numNodes * sizeof(unsigned)) != numNodes * sizeof(unsigned))
+    {
+        LOGERROR("Truncated node chunk in binary scene file");
+        return false;
+    }
+
+    if (typeIndices[0] >= numTypes || types[typeIndices[0]] != TypeStatic())
+    {
+        LOGERROR("Mismatching type of scene root node in scene file");
+        return false;
+    }
+
+    // Reserve the child arrays before creating the nodes
+    std::vector<unsigned> numChildren(numNodes, 0);
+    for (size_t i = 1; i < numNodes; ++i)
+    {
+        if (parentIndices[i] < i)
+            ++numChildren[parentIndices[i]];
+    }
+
+    loadNodes.resize(numNodes);
+    typeNodes.resize(numTypes);
+    for (size_t i = 0; i < numNodes; ++i)
+    {
+        // Parents precede their children. Children of unknown node types are dropped
+        Node* node = nullptr;
+        if (i == 0)
+            node = this;
+        else if (parentIndices[i] < i && loadNodes[parentIndices[i]] && typeIndices[i] < numTypes)
+            node = loadNodes[parentIndices[i]]->CreateChild(types[typeIndices[i]]);
+
+        if (node && numChildren[i])
+            node->ReserveChildren(numChildren[i]);
+
+        loadNodes[i] = node;
+        if (typeIndices[i] < numTypes)
+            typeNodes[typeIndices[i]].push_back(node);
+    }
+
+    return true;
+}
+
+void Scene::LoadAttributeChunk(Stream& source, const std::vector<Node*>& loadNodes, const std::vector<std::vector<Node*> >& typeNodes)
+{
+    PROFILE(LoadSceneAttributes);
+
+    size_t typeIndex = source.Read<unsigned>();
+    if (typeIndex >= typeNodes.size())
+        return;
+
+    const std::vector<Node*>& columnNodes = typeNodes[typeIndex];
+    Node* firstNode = nullptr;
+    for (auto it = columnNodes.begin(); it != columnNodes.end() && !firstNode; ++it)
+        firstNode = *it;
+
+    size_t numAttributes = source.ReadVLE();
+    std::vector<unsigned char> column;
+
+    for (size_t i = 0; i < numAttributes && !source.IsEof(); ++i)
+    {
+        std::string name = source.Read<std::string>();
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+        size_t columnSize = source.ReadVLE();
+
+        // Skip attributes that no longer exist or have changed type
+        Attribute* attr = firstNode ? firstNode->FindAttribute(name) : nullptr;
+        if (!attr || attr->Type() != type)
+        {
+            source.Seek(source.Position() + columnSize);
+            continue;
+        }
+
+        // Reference the whole column in place if the stream allows, otherwise read it at once
+        const unsigned char* columnData = columnSize ? source.ReadInPlace(columnSize) : nullptr;
+        if (!columnData && columnSize)
+        {
+            column.resize(columnSize);
+            if (source.Read(&column[0], columnSize) != columnSize)
+                continue;
+            columnData = &column[0];
+        }
+        if (!columnData)
+            continue;
+
+        size_t byteSize = attr->ByteSize();
+        if (byteSize)
+        {
+            if (columnSize < columnNodes.size() * byteSize)
+                continue;
+
+            for (size_t j = 0; j < columnNodes.size(); ++j)
+            {
+                Node* node = columnNodes[j];
+                if (!node)
+                    continue;
+
+                const unsigned char* value = columnData + j * byteSize;
+                if (type == ATTR_OBJECTREF)
+                {
+                    // The column may be read-only mapped data, so remap a copy
+                    ObjectRef ref;
+                    memcpy(static_cast<void*>(&ref), value, sizeof ref);
+                    ref.id = (ref.id && ref.id <= loadNodes.size() && loadNodes[ref.id - 1]) ? loadNodes[ref.id - 1]->Id() : 0;
+                    attr->FromValue(node, &ref);
+                }
+                else
+                    attr->FromValue(node, value);
+            }
+        }
+        else
+        {
+            MemoryBuffer buffer(columnData, columnSize);
+            for (size_t j = 0; j < columnNodes.size() && !buffer.IsEof(); ++j)
+            {
+                if (columnNodes[j])
+                    attr->FromBinary(columnNodes[j], buffer);
+                else
+                    Attribute::Skip(type, buffer);
+            }
+        }
+    }
+}
+
 bool Scene::LoadJSON(const JSONValue& source)
 {
     PROFILE(LoadSceneJSON);
+    MEMORY_SCOPE(MEMORY_SCENE);
     
     StringHash ownType(source["type"].GetString());
     unsigned ownId = (unsigned)source["id"].GetNumber();
@@ -98,29 +459,75 @@ bool Scene::LoadJSON(const JSONValue& source)
 bool Scene::LoadJSON(Stream& source)
 {
     LOGINFO("Loading scene from " + source.Name());
-    
-    JSONFile json;
-    bool success = json.Load(source);
-    LoadJSON(json.Root());
+
+    JSONReader reader(source);
+    bool success = LoadJSON(reader);
+    if (reader.HasError())
+        LOGERRORF("Parsing JSON from %s failed on line %u; data may be partial", source.Name().c_str(), reader.Line());
     return success;
 }
 
+bool Scene::LoadJSON(JSONReader& source)
+{
+    PROFILE(LoadSceneJSON);
+    MEMORY_SCOPE(MEMORY_SCENE);
+
+    StringHash ownType;
+    unsigned ownId;
+    if (!PeekJSONTypeAndId(source, ownType, ownId) || ownType != TypeStatic())
+    {
+        LOGERROR("Mismatching type of scene root node in scene file");
+        return false;
+    }
+
+    Clear();
+
+    ObjectResolver resolver;
+    resolver.StoreObject(ownId, this);
+    Node::LoadJSON(source, resolver);
+    resolver.Resolve();
+
+    return !source.HasError();
+}
+
 bool Scene::SaveJSON(Stream& dest)
 {
     PROFILE(SaveSceneJSON);
     
     LOGINFO("Saving scene to " + dest.Name());
     
-    JSONFile json;
-    Node::SaveJSON(json.Root());
-    return json.Save(dest);
+    return Node::SaveJSON(dest);
 }
 
 Node* Scene::Instantiate(Stream& source)
+{
+    ObjectResolver resolver;
+    Node* child = Instantiate(source, resolver);
+    resolver.Resolve();
+    return child;
+}
+
+Node* Scene::InstantiateJSON(const JSONValue& source)
+{
+    ObjectResolver resolver;
+    Node* child = InstantiateJSON(source, resolver);
+    resolver.Resolve();
+    return child;
+}
+
+Node* Scene::InstantiateJSON(JSONReader& source)
+{
+    ObjectResolver resolver;
+    Node* child = InstantiateJSON(source, resolver);
+    resolver.Resolve();
+    return child;
+}
+
+Node* Scene::Instantiate(Stream& source, ObjectResolver& resolver)
 {
     PROFILE(Instantiate);
     
-    ObjectResolver resolver;
+    resolver.NextBatch();
     StringHash childType(source.Read<StringHash>());
     unsigned childId = source.Read<unsigned>();
 
@@ -129,17 +536,16 @@ Node* Scene::Instantiate(Stream& source)
     {
         resolver.StoreObject(childId, child);
         child->Load(source, resolver);
-        resolver.Resolve();
     }
 
     return child;
 }
 
-Node* Scene::InstantiateJSON(const JSONValue& source)
+Node* Scene::InstantiateJSON(const JSONValue& source, ObjectResolver& resolver)
 {
     PROFILE(InstantiateJSON);
     
-    ObjectResolver resolver;
+    resolver.NextBatch();
     StringHash childType(source["type"].GetString());
     unsigned childId = (unsigned)source["id"].GetNumber();
 
@@ -148,7 +554,23 @@ Node* Scene::InstantiateJSON(const JSONValue& source)
     {
         resolver.StoreObject(childId, child);
         child->LoadJSON(source, resolver);
-        resolver.Resolve();
+    }
+
+    return child;
+}
+
+Node* Scene::InstantiateJSON(JSONReader& source, ObjectResolver& resolver)
+{
+    PROFILE(InstantiateJSON);
+
+    resolver.NextBatch();
+    StringHash childType;
+    unsigned childId;
+    Node* child = PeekJSONTypeAndId(source, childType, childId) ? CreateChild(childType) : nullptr;
+    if (child)
+    {
+        resolver.StoreObject(childId, child);
+        child->LoadJSON(source, resolver);
     }
 
     return child;
@@ -156,47 +578,157 @@ Node* Scene::InstantiateJSON(const JSONValue& source)
 
 Node* Scene::InstantiateJSON(Stream& source)
 {
-    JSONFile json;
-    json.Load(source);
-    return InstantiateJSON(json.Root());
+    JSONReader reader(source);
+    return InstantiateJSON(reader);
 }
 
 void Scene::Clear()
 {
+    PROFILE(ClearScene);
+
+    // The removals of replicated nodes are recorded per node
+    if (changeTracking || !NumChildren())
+    {
+        RemoveAllChildren();
+        return;
+    }
+
+    // Detach the scene-level nodes such as the octree first, so that they drop the other nodes wholesale instead of each node removing itself
+    const std::vector<SharedPtr<Node> >& sceneChildren = Children();
+    for (auto it = sceneChildren.begin(); it != sceneChildren.end(); ++it)
+    {
+        if (!dynamic_cast<SpatialNode*>(it->Get()))
+            (*it)->SetScene(nullptr);
+    }
+
+    std::vector<Node*> stack;
+    for (auto it = sceneChildren.begin(); it != sceneChildren.end(); ++it)
+        stack.push_back(*it);
+    while (!stack.empty())
+    {
+        Node* node = stack.back();
+        stack.pop_back();
+
+        if (node->ParentScene() == this)
+            node->SetScene(nullptr);
+        node->SetId(0);
+        node->ClearDirty();
+
+        const std::vector<SharedPtr<Node> >& nodeChildren = node->Children();
+        for (auto it = nodeChildren.begin(); it != nodeChildren.end(); ++it)
+            stack.push_back(*it);
+    }
+
+    // Free the id slots in one pass, advancing their generations so that the old ids do not find new nodes
+    size_t sceneIndex = Id() & NODE_ID_INDEX_MASK;
+    for (size_t i = 1; i < idSlots.size(); ++i)
+    {
+        if (i != sceneIndex && idSlots[i].node)
+            FreeNodeId(idSlots[i].id);
+    }
+
+    typeNodes.clear();
+    AddTypeNode(this);
+
+    // The children are no longer in the scene, so releasing them only notifies the direct children of losing their parent
     RemoveAllChildren();
-    nextNodeId = 1;
 }
 
-Node* Scene::FindNode(unsigned id_) const
+void Scene::SetChangeTracking(bool enable)
+{
+    if (enable == changeTracking)
+        return;
+
+    changeTracking = enable;
+    if (!enable)
+    {
+        for (auto it = changedNodeIds.begin(); it != changedNodeIds.end(); ++it)
+        {
+            Node* node = FindNode(*it);
+            if (node)
+                node->ClearDirty();
+        }
+        changedNodeIds.clear();
+        removedNodeIds.clear();
+    }
+}
+
+size_t Scene::WriteChanges(Stream& dest)
 {
-    auto it = nodes.find(id_);
-    return it != nodes.end() ? it->second : nullptr;
+    PROFILE(WriteSceneChanges);
+
+    // Clear each node's changes as it is collected, which also skips duplicate ids
+    std::vector<NodeChanges> changes;
+    changes.reserve(changedNodeIds.size());
+    for (auto it = changedNodeIds.begin(); it != changedNodeIds.end(); ++it)
+    {
+        Node* node = FindNode(*it);
+        if (!node || (!node->DirtyAttributes() && !node->ReplicationFlags()))
+            continue;
+
+        NodeChanges nodeChanges;
+        nodeChanges.node = node;
+        nodeChanges.attributes = node->DirtyAttributes();
+        nodeChanges.flags = node->ReplicationFlags();
+        node->ClearDirty();
+        if (!IsInTemporaryTree(node))
+            changes.push_back(nodeChanges);
+    }
+
+    dest.Write(false);
+    dest.Write(Id());
+    dest.WriteVLE(removedNodeIds.size());
+    for (auto it = removedNodeIds.begin(); it != removedNodeIds.end(); ++it)
+        dest.Write(*it);
+    dest.WriteVLE(changes.size());
+    for (auto it = changes.begin(); it != changes.end(); ++it)
+        WriteNodeChanges(dest, *it);
+
+    changedNodeIds.clear();
+    removedNodeIds.clear();
+    return changes.size();
 }
 
-void Scene::AddNode(Node* node)
+void Scene::WriteFullState(Stream& dest)
 {
-    if (!node || node->ParentScene() == this)
-        return;
+    PROFILE(WriteSceneFullState);
 
-    while (nodes.find(nextNodeId) != nodes.end())
+    std::vector<Node*> saveNodes;
+    std::vector<unsigned> parentIndices;
+    CollectSaveNodes(this, NO_PARENT_INDEX, saveNodes, parentIndices);
+
+    dest.Write(true);
+    dest.Write(Id());
+    dest.WriteVLE(0);
+    dest.WriteVLE(saveNodes.size());
+    for (auto it = saveNodes.begin(); it != saveNodes.end(); ++it)
     {
-        ++nextNodeId;
-        if (!nextNodeId)
-            ++nextNodeId;
+        NodeChanges nodeChanges;
+        nodeChanges.node = *it;
+        nodeChanges.attributes = DIRTY_ATTRIBUTES_ALL;
+        nodeChanges.flags = *it != this ? NRF_CREATED : 0;
+        WriteNodeChanges(dest, nodeChanges);
     }
+}
+
+void Scene::AddNode(Node* node)
+{
+    if (!node || node->ParentScene() == this)
+        return;
 
     Scene* oldScene = node->ParentScene();
     if (oldScene)
     {
-        unsigned oldId = node->Id();
-        oldScene->nodes.erase(oldId);
+        oldScene->FreeNodeId(node->Id());
+        oldScene->RemoveTypeNode(node);
     }
 
-    nodes[nextNodeId] = node;
     node->SetScene(this);
-    node->SetId(nextNodeId);
-
-    ++nextNodeId;
+    node->SetId(AllocateNodeId(node));
+    AddTypeNode(node);
+    node->ClearDirty();
+    if (changeTracking)
+        node->MarkDirty(DIRTY_ATTRIBUTES_ALL, NRF_CREATED);
 
     // If node has children, add them to the scene as well
     if (node->NumChildren())
@@ -212,7 +744,13 @@ void Scene::RemoveNode(Node* node)
     if (!node || node->ParentScene() != this)
         return;
 
-    nodes.erase(node->Id());
+    // Nodes created since the last sync were never replicated, so their removal needs not be either
+    if (changeTracking && !node->IsTemporary() && !(node->ReplicationFlags() & NRF_CREATED))
+        removedNodeIds.push_back(node->Id());
+
+    FreeNodeId(node->Id());
+    RemoveTypeNode(node);
+    node->ClearDirty();
     node->SetScene(nullptr);
     node->SetId(0);
     
@@ -225,6 +763,89 @@ void Scene::RemoveNode(Node* node)
     }
 }
 
+const std::vector<Node*>& Scene::NodesOfType(StringHash type) const
+{
+    static const std::vector<Node*> noNodes;
+
+    auto it = typeNodes.find(type);
+    return it != typeNodes.end() ? it->second : noNodes;
+}
+
+void Scene::AddTypeNode(Node* node)
+{
+    std::vector<Node*>& nodes = typeNodes[node->Type()];
+    node->SetTypeIndex((unsigned)nodes.size());
+    nodes.push_back(node);
+}
+
+void Scene::RemoveTypeNode(Node* node)
+{
+    auto it = typeNodes.find(node->Type());
+    if (it == typeNodes.end())
+        return;
+
+    std::vector<Node*>& nodes = it->second;
+    unsigned index = node->TypeIndex();
+    if (index >= nodes.size() || nodes[index] != node)
+        return;
+
+    nodes[index] = nodes.back();
+    nodes[index]->SetTypeIndex(index);
+    nodes.pop_back();
+    node->SetTypeIndex(0);
+}
+
+unsigned Scene::AllocateNodeId(Node* node)
+{
+    ++numNodes;
+
+    // Reuse the oldest freed slot only when enough are free, otherwise grow the table
+    if (numFreeSlots >= MIN_FREE_NODE_ID_SLOTS || (numFreeSlots && idSlots.size() > NODE_ID_INDEX_MASK))
+    {
+        NodeIdSlot& slot = idSlots[firstFreeSlot];
+        firstFreeSlot = slot.nextFree;
+        if (!--numFreeSlots)
+            lastFreeSlot = 0;
+        slot.node = node;
+        return slot.id;
+    }
+
+    if (idSlots.size() > NODE_ID_INDEX_MASK)
+    {
+        LOGERROR("Node id table is full");
+        --numNodes;
+        return 0;
+    }
+
+    NodeIdSlot newSlot;
+    newSlot.node = node;
+    newSlot.id = (unsigned)idSlots.size();
+    newSlot.nextFree = 0;
+    idSlots.push_back(newSlot);
+    return newSlot.id;
+}
+
+void Scene::FreeNodeId(unsigned id_)
+{
+    size_t index = id_ & NODE_ID_INDEX_MASK;
+    if (!index || index >= idSlots.size() || idSlots[index].id != id_)
+        return;
+
+    // Advance the generation so that the old id no longer finds the slot
+    NodeIdSlot& slot = idSlots[index];
+    slot.node = nullptr;
+    slot.id += 1 << NODE_ID_INDEX_BITS;
+    slot.nextFree = 0;
+    --numNodes;
+
+    if (numFreeSlots)
+        idSlots[lastFreeSlot].nextFree = (unsigned)index;
+    else
+        firstFreeSlot = (unsigned)index;
+    lastFreeSlot = (unsigned)index;
+    ++numFreeSlots;
+}
+
 void RegisterSceneLibrary()
 {
     static bool registered = false;
@@ -235,4 +856,5 @@ void RegisterSceneLibrary()
     Node::RegisterObject();
     Scene::RegisterObject();
     SpatialNode::RegisterObject();
+    Prefab::RegisterObject();
 }
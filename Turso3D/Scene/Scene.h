@@ -4,6 +4,24 @@
 
 #include "Node.h"
 
+/// Number of low bits in a node id that index the id table. The remaining high bits are a generation count that detects stale id's.
+static const unsigned NODE_ID_INDEX_BITS = 24;
+/// Mask for the id table index in a node id.
+static const unsigned NODE_ID_INDEX_MASK = (1 << NODE_ID_INDEX_BITS) - 1;
+/// Number of freed id table slots to hold before reusing them, so that the generation of a single slot does not wrap around quickly.
+static const size_t MIN_FREE_NODE_ID_SLOTS = 1024;
+
+/// %Node id table slot.
+struct NodeIdSlot
+{
+    /// Node, or null if free.
+    Node* node;
+    /// Current or next id of the slot, including the generation.
+    unsigned id;
+    /// Next slot in the free list.
+    unsigned nextFree;
+};
+
 /// %Scene root node, which also represents the whole scene.
 class Scene : public Node
 {
@@ -18,43 +36,105 @@ public:
     /// Register factory and attributes.
     static void RegisterObject();
 
-    /// Save scene to binary stream.
+    /// Save scene to a binary stream. Attributes of nodes with the same type are stored together in columns.
     void Save(Stream& dest) override;
     
-    /// Load scene from a binary stream. Existing nodes will be destroyed. Return true on success.
+    /// Load scene from a binary stream, either in the columnar or the older hierarchical format. Existing nodes will be destroyed. Return true on success.
     bool Load(Stream& source);
     /// Load scene from JSON data. Existing nodes will be destroyed. Return true on success.
     bool LoadJSON(const JSONValue& source);
     /// Load scene from JSON text data read from a binary stream. Existing nodes will be destroyed. Return true if the JSON was correctly parsed; otherwise the data may be partial.
     bool LoadJSON(Stream& source);
-    /// Save scene as JSON text data to a binary stream. Return true on success.
+    /// Load scene from a streaming JSON reader without building a JSONValue tree. Existing nodes will be destroyed. Return true if the JSON was correctly parsed; otherwise the data may be partial.
+    bool LoadJSON(JSONReader& source);
+    /// Save scene as JSON text data to a binary stream, streaming the text without building a JSONValue tree. Return true on success.
     bool SaveJSON(Stream& dest);
     /// Instantiate node(s) from binary stream and return the root node.
     Node* Instantiate(Stream& source);
     /// Instantiate node(s) from JSON data and return the root node.
     Node* InstantiateJSON(const JSONValue& source);
+    /// Instantiate node(s) from a streaming JSON reader and return the root node.
+    Node* InstantiateJSON(JSONReader& source);
     /// Load JSON data as text from a binary stream, then instantiate node(s) from it and return the root node.
     Node* InstantiateJSON(Stream& source);
-    /// Destroy child nodes recursively, leaving the scene empty.
+    /// Instantiate node(s) from binary stream and return the root node, storing the object refs to a resolver as a new batch. Call Resolve() on the resolver afterward, so that the refs of many instantiations are resolved in one pass.
+    Node* Instantiate(Stream& source, ObjectResolver& resolver);
+    /// Instantiate node(s) from JSON data and return the root node, storing the object refs to a resolver as a new batch.
+    Node* InstantiateJSON(const JSONValue& source, ObjectResolver& resolver);
+    /// Instantiate node(s) from a streaming JSON reader and return the root node, storing the object refs to a resolver as a new batch.
+    Node* InstantiateJSON(JSONReader& source, ObjectResolver& resolver);
+    /// Destroy child nodes recursively, leaving the scene empty. Unless tracking changes, the nodes are detached from the scene in bulk: the plain child nodes of the root, such as the octree, first release their scene-wide state at once, after which the id table and the arrays of nodes by type are reset in one pass instead of per node.
     void Clear();
+    /// Enable or disable tracking of node changes for replication. Disabling discards the changes collected so far.
+    void SetChangeTracking(bool enable);
+    /// Write the node changes since the last call for a SceneReplica to apply, and clear them. Return number of changed nodes written.
+    size_t WriteChanges(Stream& dest);
+    /// Write all persistent nodes for a SceneReplica to apply, replacing its contents. Used for example when a new replica connects. Does not clear the tracked changes.
+    void WriteFullState(Stream& dest);
 
-    /// Find node by id.
-    Node* FindNode(unsigned id) const;
+    /// Find node by id. Return null if not found or if the id is stale, meaning the node has been removed and the id table slot reused.
+    Node* FindNode(unsigned id) const
+    {
+        size_t index = id & NODE_ID_INDEX_MASK;
+        return (index < idSlots.size() && idSlots[index].id == id) ? idSlots[index].node : nullptr;
+    }
+    /// Return number of nodes in the scene, including the scene itself.
+    size_t NumNodes() const { return numNodes; }
+    /// Return whether tracks node changes for replication.
+    bool IsChangeTracking() const { return changeTracking; }
+    /// Return number of nodes with changes since the last WriteChanges(). May include duplicates and removed nodes.
+    size_t NumChangedNodes() const { return changedNodeIds.size(); }
+    /// Return all nodes of a type in the scene as a contiguous array in no particular order, without walking the node tree. Derived types are not included. The array changes when nodes of the type are added or removed, so it must not be held over scene modifications.
+    const std::vector<Node*>& NodesOfType(StringHash type) const;
+    /// Return all nodes of a type in the scene, template version.
+    template <class T> const std::vector<T*>& NodesOfType() const { return reinterpret_cast<const std::vector<T*>&>(NodesOfType(T::TypeStatic())); }
 
     /// Add node to the scene. This assigns a scene-unique id to it. Called internally.
     void AddNode(Node* node);
     /// Remove node from the scene. This removes the id mapping but does not destroy the node. Called internally.
     void RemoveNode(Node* node);
+    /// Add a node that has new changes since the last WriteChanges(). Called internally.
+    void AddChangedNode(Node* node) { changedNodeIds.push_back(node->Id()); }
     
     using Node::Load;
     using Node::LoadJSON;
     using Node::SaveJSON;
 
 private:
-    /// Map from id's to nodes.
-    std::map<unsigned, Node*> nodes;
-    /// Next free node id.
-    unsigned nextNodeId;
+    /// Load the columnar binary format after the file ID. Return true on success.
+    bool LoadColumns(Stream& source);
+    /// Load the node chunk of the columnar format and create the nodes.
+    bool LoadNodeChunk(Stream& source, std::vector<Node*>& loadNodes, std::vector<std::vector<Node*> >& typeNodes);
+    /// Load a chunk of attribute columns of the columnar format.
+    void LoadAttributeChunk(Stream& source, const std::vector<Node*>& loadNodes, const std::vector<std::vector<Node*> >& typeNodes);
+
+    /// Allocate an id table slot for a node and return the id.
+    unsigned AllocateNodeId(Node* node);
+    /// Free the id table slot of a node id.
+    void FreeNodeId(unsigned id);
+    /// Add a node to the array of its type.
+    void AddTypeNode(Node* node);
+    /// Remove a node from the array of its type by swapping the last node in its place.
+    void RemoveTypeNode(Node* node);
+
+    /// Id table indexed by the low bits of node id's. Slot 0 is not used so that id's are never zero.
+    std::vector<NodeIdSlot> idSlots;
+    /// First slot in the free list.
+    unsigned firstFreeSlot;
+    /// Last slot in the free list.
+    unsigned lastFreeSlot;
+    /// Number of slots in the free list.
+    size_t numFreeSlots;
+    /// Number of nodes in the scene.
+    size_t numNodes;
+    /// Nodes by type.
+    std::map<StringHash, std::vector<Node*> > typeNodes;
+    /// Ids of nodes with changes since the last WriteChanges().
+    std::vector<unsigned> changedNodeIds;
+    /// Ids of replicated nodes removed since the last WriteChanges().
+    std::vector<unsigned> removedNodeIds;
+    /// Whether tracks node changes for replication.
+    bool changeTracking;
 };
 
 /// Register Scene related object factories and attributes.
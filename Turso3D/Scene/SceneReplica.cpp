@@ -0,0 +1,161 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../IO/ObjectRef.h"
+#include "../IO/Stream.h"
+#include "../Object/ObjectResolver.h"
+#include "../Time/Profiler.h"
+#include "Scene.h"
+#include "SceneReplica.h"
+
+SceneReplica::SceneReplica(Scene* scene_)
+{
+    SetScene(scene_);
+}
+
+void SceneReplica::SetScene(Scene* scene_)
+{
+    scene = scene_;
+    nodeIds.clear();
+}
+
+bool SceneReplica::ApplyChanges(Stream& source)
+{
+    PROFILE(ApplySceneChanges);
+
+    if (!scene)
+    {
+        LOGERROR("No scene to apply replicated changes to");
+        return false;
+    }
+
+    bool full = source.Read<bool>();
+    unsigned rootId = source.Read<unsigned>();
+    if (full)
+    {
+        scene->Clear();
+        nodeIds.clear();
+    }
+    nodeIds[rootId] = scene->Id();
+
+    size_t numRemoved = source.ReadVLE();
+    for (size_t i = 0; i < numRemoved && !source.IsEof(); ++i)
+    {
+        unsigned masterId = source.Read<unsigned>();
+        Node* node = FindNode(masterId);
+        if (node && node != scene)
+            node->RemoveSelf();
+        nodeIds.erase(masterId);
+    }
+
+    // New nodes are stored to the resolver so that object refs to them resolve regardless of the record order
+    ObjectResolver resolver;
+    std::vector<std::pair<Node*, unsigned> > pendingParents;
+
+    size_t numNodes = source.ReadVLE();
+    for (size_t i = 0; i < numNodes; ++i)
+    {
+        if (source.IsEof())
+        {
+            LOGERROR("Truncated scene replication data");
+            return false;
+        }
+
+        unsigned masterId = source.Read<unsigned>();
+        unsigned char flags = source.Read<unsigned char>();
+        StringHash type;
+        unsigned parentId = 0;
+        if (flags & NRF_CREATED)
+            type = source.Read<StringHash>();
+        if (flags & (NRF_CREATED | NRF_PARENT_CHANGED))
+            parentId = source.Read<unsigned>();
+
+        Node* node = FindNode(masterId);
+        Node* parent = (flags & (NRF_CREATED | NRF_PARENT_CHANGED)) ? FindNode(parentId) : nullptr;
+
+        if (flags & NRF_CREATED)
+        {
+            if (node && node != scene)
+                node->RemoveSelf();
+
+            // Parents normally precede their children. If not, create under the scene and reparent at the end
+            node = (parent ? parent : scene.Get())->CreateChild(type);
+            if (node)
+            {
+                nodeIds[masterId] = node->Id();
+                resolver.StoreObject(masterId, node);
+                if (!parent)
+                    pendingParents.push_back(std::make_pair(node, parentId));
+            }
+            else
+                nodeIds.erase(masterId);
+        }
+        else if ((flags & NRF_PARENT_CHANGED) && node && node != scene)
+        {
+            if (parent)
+                node->SetParent(parent);
+            else
+                pendingParents.push_back(std::make_pair(node, parentId));
+        }
+
+        ReadAttributes(source, node, resolver);
+    }
+
+    for (auto it = pendingParents.begin(); it != pendingParents.end(); ++it)
+    {
+        Node* parent = FindNode(it->second);
+        if (parent && parent != it->first)
+            it->first->SetParent(parent);
+    }
+
+    resolver.Resolve();
+    return true;
+}
+
+Node* SceneReplica::FindNode(unsigned masterId) const
+{
+    if (!scene)
+        return nullptr;
+
+    auto it = nodeIds.find(masterId);
+    return it != nodeIds.end() ? scene->FindNode(it->second) : nullptr;
+}
+
+void SceneReplica::ReadAttributes(Stream& source, Node* node, ObjectResolver& resolver)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = node ? node->Attributes() : nullptr;
+    size_t numAttributes = attributes ? attributes->size() : 0;
+
+    size_t numChanged = source.ReadVLE();
+    for (size_t i = 0; i < numChanged && !source.IsEof(); ++i)
+    {
+        size_t index = source.ReadVLE();
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+
+        // Skip attributes the node does not have or that have changed type
+        Attribute* attr = index < numAttributes ? attributes->at(index).Get() : nullptr;
+        if (!attr || attr->Type() != type)
+        {
+            Attribute::Skip(type, source);
+            continue;
+        }
+
+        if (type != ATTR_OBJECTREF)
+        {
+            attr->FromBinary(node, source);
+            continue;
+        }
+
+        // Null refs are set directly, refs to already existing nodes via the resolver along with the new nodes
+        ObjectRef ref = source.Read<ObjectRef>();
+        if (!ref.id)
+            attr->FromValue(node, &ref);
+        else
+        {
+            Node* target = FindNode(ref.id);
+            if (target)
+                resolver.StoreObject(ref.id, target);
+            resolver.StoreObjectRef(node, attr, ref);
+        }
+    }
+}
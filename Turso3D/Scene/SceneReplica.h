@@ -0,0 +1,41 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Ptr.h"
+
+#include <unordered_map>
+
+class Node;
+class ObjectResolver;
+class Scene;
+class Stream;
+
+/// Receiving side of scene replication. Applies the node changes written by Scene::WriteChanges() or Scene::WriteFullState() of a master scene to a local scene, creating, reparenting and removing nodes and setting the changed attributes. Master node id's are mapped to the local nodes, and object refs are resolved through the mapping.
+class SceneReplica
+{
+public:
+    /// Construct with the local scene to update.
+    SceneReplica(Scene* scene = nullptr);
+
+    /// Set the local scene. Clears the node id mapping.
+    void SetScene(Scene* scene);
+    /// Apply changes from a stream. Return true on success.
+    bool ApplyChanges(Stream& source);
+
+    /// Return the local scene.
+    Scene* TargetScene() const { return scene; }
+    /// Return the local node that corresponds to a master node id, or null if not found.
+    Node* FindNode(unsigned masterId) const;
+    /// Return number of mapped nodes, including the scene.
+    size_t NumNodes() const { return nodeIds.size(); }
+
+private:
+    /// Read the changed attributes of a node. If the node is null, skip them.
+    void ReadAttributes(Stream& source, Node* node, ObjectResolver& resolver);
+
+    /// Local scene.
+    WeakPtr<Scene> scene;
+    /// Local node id's by master node id.
+    std::unordered_map<unsigned, unsigned> nodeIds;
+};
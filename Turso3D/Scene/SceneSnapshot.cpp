@@ -0,0 +1,61 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Compression.h"
+#include "../IO/MemoryBuffer.h"
+#include "../Time/Profiler.h"
+#include "Scene.h"
+#include "SceneSnapshot.h"
+
+SceneSnapshot::SceneSnapshot()
+{
+}
+
+void SceneSnapshot::Capture(Scene* scene)
+{
+    PROFILE(CaptureSceneSnapshot);
+
+    data.Clear();
+    if (scene)
+        scene->Save(data);
+}
+
+bool SceneSnapshot::Restore(Scene* scene) const
+{
+    PROFILE(RestoreSceneSnapshot);
+
+    if (!scene || IsEmpty())
+        return false;
+
+    MemoryBuffer source(data.Buffer());
+    return scene->Load(source);
+}
+
+bool SceneSnapshot::Write(Stream& dest, const SceneSnapshot* baseline) const
+{
+    PROFILE(WriteSceneSnapshot);
+
+    const unsigned char* baselineData = (baseline && !baseline->IsEmpty()) ? baseline->data.Data() : nullptr;
+    return WriteCompressed(dest, data.Buffer().empty() ? nullptr : data.Data(), data.Size(), baselineData,
+        baselineData ? baseline->Size() : 0);
+}
+
+bool SceneSnapshot::Read(Stream& source, const SceneSnapshot* baseline)
+{
+    PROFILE(ReadSceneSnapshot);
+
+    const unsigned char* baselineData = (baseline && !baseline->IsEmpty()) ? baseline->data.Data() : nullptr;
+    std::vector<unsigned char> buffer;
+    if (!ReadCompressed(source, buffer, baselineData, baselineData ? baseline->Size() : 0))
+    {
+        data.Clear();
+        return false;
+    }
+
+    data.SetData(buffer);
+    return true;
+}
+
+void SceneSnapshot::Clear()
+{
+    data.Clear();
+}
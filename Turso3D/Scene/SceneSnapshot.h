@@ -0,0 +1,37 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/VectorBuffer.h"
+
+class Scene;
+
+/// In-memory binary snapshot of a scene for quick save and restore. Snapshots can be written to a stream compressed, and as a delta against a baseline snapshot that the reader also has, for example to send the scene state to a remote viewer each frame. The columnar scene format keeps attribute values at the same offsets as long as the set of nodes does not change, so a delta against the previous frame is mostly zero bytes and compresses to a small fraction of the full snapshot.
+class SceneSnapshot
+{
+public:
+    /// Construct empty.
+    SceneSnapshot();
+
+    /// Capture the scene's current state.
+    void Capture(Scene* scene);
+    /// Restore the scene to the captured state. Existing nodes will be destroyed. Return true on success.
+    bool Restore(Scene* scene) const;
+    /// Write the snapshot compressed, optionally as a delta against a baseline snapshot. Return true on success.
+    bool Write(Stream& dest, const SceneSnapshot* baseline = nullptr) const;
+    /// Read a snapshot written with Write(), using the same baseline snapshot as when writing. Return true on success.
+    bool Read(Stream& source, const SceneSnapshot* baseline = nullptr);
+    /// Clear the snapshot.
+    void Clear();
+
+    /// Return size of the uncompressed snapshot in bytes.
+    size_t Size() const { return data.Size(); }
+    /// Return whether is empty.
+    bool IsEmpty() const { return data.Size() == 0; }
+    /// Return the uncompressed snapshot data.
+    const std::vector<unsigned char>& Data() const { return data.Buffer(); }
+
+private:
+    /// Snapshot data in the columnar binary scene format.
+    VectorBuffer data;
+};
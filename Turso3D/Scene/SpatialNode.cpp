@@ -1,7 +1,10 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "Scene.h"
 #include "SpatialNode.h"
 
+unsigned long long SpatialNode::transformAttributeMask = 0;
+
 SpatialNode::SpatialNode() :
     worldTransform(Matrix3x4::IDENTITY)
 {
@@ -21,23 +24,36 @@ void SpatialNode::RegisterObject()
     RegisterRefAttribute("rotation", &SpatialNode::Rotation, &SpatialNode::SetRotation, Quaternion::IDENTITY);
     RegisterRefAttribute("scale", &SpatialNode::Scale, &SpatialNode::SetScale, Vector3::ONE);
     RegisterAttribute("static", &SpatialNode::Static, &SpatialNode::SetStatic, false);
+
+    // Subclasses copy the base attributes first, so the transform attributes have the same indices in all of them
+    const AttributeTable* table = FindAttributeTable(TypeStatic());
+    transformAttributeMask = 0;
+    for (size_t i = 0; i < table->attributes.size() && i < 63; ++i)
+    {
+        const std::string& name = table->attributes[i]->Name();
+        if (name == "position" || name == "rotation" || name == "scale")
+            transformAttributeMask |= 1ULL << i;
+    }
 }
 
 void SpatialNode::SetPosition(const Vector3& newPosition)
 {
     impl->position = newPosition;
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
 void SpatialNode::SetRotation(const Quaternion& newRotation)
 {
     impl->rotation = newRotation;
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
 void SpatialNode::SetDirection(const Vector3& newDirection)
 {
     impl->rotation = Quaternion(Vector3::FORWARD, newDirection);
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -52,6 +68,7 @@ void SpatialNode::SetScale(const Vector3& newScale)
     if (impl->scale.z == 0.0f)
         impl->scale.z = M_EPSILON;
 
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -64,6 +81,7 @@ void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& new
 {
     impl->position = newPosition;
     impl->rotation = newRotation;
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -72,6 +90,7 @@ void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& new
     impl->position = newPosition;
     impl->rotation = newRotation;
     impl->scale = newScale;
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -146,8 +165,7 @@ void SpatialNode::SetStatic(bool enable)
     if (enable != Static())
     {
         SetFlag(NF_STATIC, enable);
-        // Handle possible octree reinsertion
-        OnTransformChanged();
+        OnStaticChanged();
     }
 }
 
@@ -172,6 +190,7 @@ void SpatialNode::Translate(const Vector3& delta, TransformSpace space)
         break;
     }
 
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -198,6 +217,7 @@ void SpatialNode::Rotate(const Quaternion& delta, TransformSpace space)
         break;
     }
 
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -237,6 +257,7 @@ void SpatialNode::RotateAround(const Vector3& point, const Quaternion& delta, Tr
     Vector3 oldRelativePos = oldRotation.Inverse() * (impl->position - parentSpacePoint);
     impl->position = impl->rotation * oldRelativePos + parentSpacePoint;
 
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -296,6 +317,7 @@ void SpatialNode::ApplyScale(float delta)
 void SpatialNode::ApplyScale(const Vector3& delta)
 {
     impl->scale *= delta;
+    MarkTransformDirty();
     OnTransformChanged();
 }
 
@@ -309,14 +331,27 @@ void SpatialNode::OnTransformChanged()
 {
     SetFlag(NF_WORLD_TRANSFORM_DIRTY, true);
 
+    // A dirty world transform means the whole subtree below is already dirty, as the world transform can only be updated after the parent's
     for (auto it = impl->children.begin(); it != impl->children.end(); ++it)
     {
         Node* child = *it;
-        if (child->TestFlag(NF_SPATIAL))
+        if (child->TestFlag(NF_SPATIAL) && !child->TestFlag(NF_WORLD_TRANSFORM_DIRTY))
             static_cast<SpatialNode*>(child)->OnTransformChanged();
     }
 }
 
+void SpatialNode::OnStaticChanged()
+{
+    // Handle possible octree reinsertion
+    OnTransformChanged();
+}
+
+void SpatialNode::MarkTransformDirty()
+{
+    if (impl->scene && impl->scene->IsChangeTracking())
+        MarkDirty(transformAttributeMask);
+}
+
 void SpatialNode::UpdateWorldTransform() const
 {
     if (TestFlag(NF_SPATIAL_PARENT))
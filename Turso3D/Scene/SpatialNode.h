@@ -16,6 +16,8 @@ enum TransformSpace
 /// Base class for scene nodes with position in three-dimensional space.
 class SpatialNode : public Node
 {
+    friend class TransformUpdater;
+
     OBJECT(SpatialNode);
 
 public:
@@ -116,11 +118,17 @@ protected:
     void OnParentSet(Node* newParent, Node* oldParent) override;
     /// Handle the transform matrix changing.
     virtual void OnTransformChanged();
+    /// Handle the static flag changing.
+    virtual void OnStaticChanged();
 
 private:
+    /// Mark the parent space transform changed for replication.
+    void MarkTransformDirty();
     /// Update world transform matrix from spatial parent chain.
     void UpdateWorldTransform() const;
 
     /// World transform matrix.
     mutable Matrix3x4 worldTransform;
+    /// Bitmask of the position, rotation and scale attribute indices.
+    static unsigned long long transformAttributeMask;
 };
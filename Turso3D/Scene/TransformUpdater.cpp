@@ -0,0 +1,110 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Time/Profiler.h"
+#include "TransformUpdater.h"
+
+#include <algorithm>
+
+TransformUpdater::TransformUpdater()
+{
+}
+
+void TransformUpdater::AddNode(SpatialNode* node)
+{
+    // A dirty node's ancestors may be dirty as well, then they need to be updated first
+    while (node && node->TestFlag(NF_WORLD_TRANSFORM_DIRTY) && !node->TestFlag(NF_TRANSFORM_UPDATE_QUEUED))
+    {
+        node->SetFlag(NF_TRANSFORM_UPDATE_QUEUED, true);
+        addedNodes.push_back(node);
+        node = node->SpatialParent();
+    }
+}
+
+void TransformUpdater::Update()
+{
+    if (addedNodes.empty())
+        return;
+
+    PROFILE(UpdateTransforms);
+
+    // The depth is the number of dirty ancestors. Clean ancestors do not need updating
+    depths.resize(addedNodes.size());
+    unsigned maxDepth = 0;
+    for (size_t i = 0; i < addedNodes.size(); ++i)
+    {
+        unsigned depth = 0;
+        for (SpatialNode* parentNode = addedNodes[i]->SpatialParent(); parentNode && parentNode->TestFlag(NF_WORLD_TRANSFORM_DIRTY);
+            parentNode = parentNode->SpatialParent())
+            ++depth;
+
+        depths[i] = depth;
+        maxDepth = std::max(maxDepth, depth);
+    }
+
+    // Counting sort by depth
+    levelStarts.clear();
+    levelStarts.resize(maxDepth + 2, 0);
+    for (size_t i = 0; i < depths.size(); ++i)
+        ++levelStarts[depths[i] + 1];
+    for (size_t i = 1; i < levelStarts.size(); ++i)
+        levelStarts[i] += levelStarts[i - 1];
+
+    sortedNodes.resize(addedNodes.size());
+    for (size_t i = 0; i < addedNodes.size(); ++i)
+        sortedNodes[levelStarts[depths[i]]++] = addedNodes[i];
+
+    // The start indices were advanced to the next level's start by the sort, so shift them back
+    for (size_t i = levelStarts.size() - 1; i > 0; --i)
+        levelStarts[i] = levelStarts[i - 1];
+    levelStarts[0] = 0;
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+
+    for (size_t i = 0; i <= maxDepth; ++i)
+    {
+        size_t start = levelStarts[i];
+        size_t end = levelStarts[i + 1];
+
+        if (numThreads > 1 && end - start > TRANSFORMS_PER_TASK)
+        {
+            size_t numTasks = (end - start + TRANSFORMS_PER_TASK - 1) / TRANSFORMS_PER_TASK;
+            while (tasks.size() < numTasks)
+                tasks.push_back(new RangeTask<TransformUpdater>(this, &TransformUpdater::UpdateTransformsWork));
+
+            TaskCounter counter(0);
+            for (size_t j = 0; j < numTasks; ++j)
+            {
+                RangeTask<TransformUpdater>* task = tasks[j];
+                task->start = start + j * TRANSFORMS_PER_TASK;
+                task->end = std::min(start + (j + 1) * TRANSFORMS_PER_TASK, end);
+                workQueue->QueueTask(task, &counter);
+            }
+
+            workQueue->Complete(counter);
+        }
+        else
+            UpdateTransforms(start, end);
+    }
+
+    addedNodes.clear();
+}
+
+void TransformUpdater::UpdateTransformsWork(Task* task, unsigned)
+{
+    PROFILE(UpdateTransformsWork);
+
+    RangeTask<TransformUpdater>* rangeTask = static_cast<RangeTask<TransformUpdater>*>(task);
+    UpdateTransforms(rangeTask->start, rangeTask->end);
+}
+
+void TransformUpdater::UpdateTransforms(size_t start, size_t end)
+{
+    // The parents have been updated on a previous level, so each node only reads its parent's world transform
+    for (size_t i = start; i < end; ++i)
+    {
+        SpatialNode* node = sortedNodes[i];
+        node->UpdateWorldTransform();
+        node->SetFlag(NF_TRANSFORM_UPDATE_QUEUED, false);
+    }
+}
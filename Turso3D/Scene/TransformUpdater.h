@@ -0,0 +1,43 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Thread/WorkQueue.h"
+#include "SpatialNode.h"
+
+/// Number of nodes per world transform update task.
+static const size_t TRANSFORMS_PER_TASK = 256;
+
+/// Batched world transform update. Sorts dirty spatial nodes by their depth in the dirty part of the hierarchy into a contiguous array, then calculates one depth level at a time in parallel, as the nodes of a level only depend on parents of the previous levels.
+class TransformUpdater
+{
+public:
+    /// Construct.
+    TransformUpdater();
+
+    /// Add a node and its dirty spatial ancestors to be updated. Nodes without a dirty world transform or already added are ignored.
+    void AddNode(SpatialNode* node);
+    /// Calculate the world transforms of the added nodes and clear the node list. Uses the WorkQueue subsystem if available. Must not be called while other threads modify the nodes.
+    void Update();
+
+    /// Return number of added nodes.
+    size_t NumNodes() const { return addedNodes.size(); }
+
+private:
+    /// Work function to calculate a range of the sorted nodes.
+    void UpdateTransformsWork(Task* task, unsigned threadIndex);
+    /// Calculate a range of the sorted nodes.
+    void UpdateTransforms(size_t start, size_t end);
+
+    /// Added nodes.
+    std::vector<SpatialNode*> addedNodes;
+    /// Depths of the added nodes.
+    std::vector<unsigned> depths;
+    /// Added nodes sorted by depth.
+    std::vector<SpatialNode*> sortedNodes;
+    /// Start indices of the depth levels in the sorted nodes, followed by the end index.
+    std::vector<size_t> levelStarts;
+    /// Update tasks.
+    std::vector<AutoPtr<RangeTask<TransformUpdater> > > tasks;
+};
@@ -0,0 +1,415 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
+#include "../IO/Log.h"
+#include "../IO/ResourceRef.h"
+#include "../IO/StringUtils.h"
+#include "../Object/Attribute.h"
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "../Time/Timer.h"
+#include "Scene.h"
+#include "SpatialNode.h"
+#include "WorldPartition.h"
+
+#include <algorithm>
+#include <cmath>
+
+CellLoadTask::CellLoadTask() :
+    counter(0),
+    success(false)
+{
+}
+
+void CellLoadTask::Complete(unsigned)
+{
+    PROFILE(ParseWorldCell);
+
+    success = data.BeginLoad(*stream);
+    stream.Reset();
+    if (!success)
+        return;
+
+    // The attribute tables are not modified after registration, so they can be read from a worker thread
+    const JSONArray& children = data.Root()["children"].GetArray();
+    for (auto it = children.begin(); it != children.end(); ++it)
+        CollectResources(*it);
+}
+
+void CellLoadTask::CollectResources(const JSONValue& node)
+{
+    const AttributeTable* table = Serializable::FindAttributeTable(StringHash(node["type"].GetString()));
+    if (table)
+    {
+        for (auto it = table->attributes.begin(); it != table->attributes.end(); ++it)
+        {
+            Attribute* attr = *it;
+            AttributeType type = attr->Type();
+            if ((type != ATTR_RESOURCEREF && type != ATTR_RESOURCEREFLIST) || !node.Contains(attr->Name()))
+                continue;
+
+            const std::string& value = node[attr->Name()].GetString();
+            if (type == ATTR_RESOURCEREF)
+            {
+                ResourceRef ref;
+                if (ref.FromString(value) && !ref.name.empty())
+                    resources.push_back(std::make_pair(ref.type, ref.name));
+            }
+            else
+            {
+                ResourceRefList refs;
+                if (refs.FromString(value))
+                {
+                    for (auto nIt = refs.names.begin(); nIt != refs.names.end(); ++nIt)
+                    {
+                        if (!nIt->empty())
+                            resources.push_back(std::make_pair(refs.type, *nIt));
+                    }
+                }
+            }
+        }
+    }
+
+    const JSONArray& children = node["children"].GetArray();
+    for (auto it = children.begin(); it != children.end(); ++it)
+        CollectResources(*it);
+}
+
+WorldPartition::WorldPartition(Scene* scene_) :
+    scene(scene_),
+    cellSize(DEFAULT_CELL_LOAD_DISTANCE),
+    loadDistance(DEFAULT_CELL_LOAD_DISTANCE),
+    unloadDistance(DEFAULT_CELL_LOAD_DISTANCE * 1.25f),
+    maxLoadingCells(DEFAULT_MAX_LOADING_CELLS)
+{
+}
+
+WorldPartition::~WorldPartition()
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        CellLoadTask* task = it->second.task.Get();
+        if (task && task->counter.load() > 0 && workQueue)
+            workQueue->Complete(task->counter);
+    }
+}
+
+bool WorldPartition::LoadIndex(Stream& source)
+{
+    JSONFile json;
+    if (!json.Load(source))
+        return false;
+
+    const JSONValue& root = json.Root();
+    SetCellSize((float)root["cellSize"].GetNumber());
+
+    const JSONArray& cellsArray = root["cells"].GetArray();
+    for (auto it = cellsArray.begin(); it != cellsArray.end(); ++it)
+    {
+        const JSONValue& cellJSON = *it;
+        AddCell(IntVector2((int)cellJSON["x"].GetNumber(), (int)cellJSON["z"].GetNumber()), cellJSON["file"].GetString());
+    }
+
+    return true;
+}
+
+void WorldPartition::SetCellSize(float size)
+{
+    cellSize = Max(size, M_EPSILON);
+}
+
+void WorldPartition::AddCell(const IntVector2& coords, const std::string& fileName)
+{
+    WorldCell& cell = cells[std::make_pair(coords.x, coords.y)];
+    if (cell.state != CELL_UNLOADED)
+        Unload(cell);
+    cell.fileName = fileName;
+}
+
+void WorldPartition::SetLoadDistance(float loadDistance_, float unloadDistance_)
+{
+    loadDistance = Max(loadDistance_, 0.0f);
+    unloadDistance = Max(unloadDistance_, loadDistance);
+}
+
+void WorldPartition::SetMaxLoadingCells(size_t num)
+{
+    maxLoadingCells = std::max(num, (size_t)1);
+}
+
+void WorldPartition::Update(const Vector3& viewPosition, float maxMilliseconds)
+{
+    PROFILE(UpdateWorldPartition);
+
+    if (!scene)
+        return;
+
+    HiresTimer timer;
+    long long maxUSec = (long long)(maxMilliseconds * 1000.0f);
+
+    // Unload the far cells, and find the unloaded cells within the load distance
+    std::vector<std::pair<float, WorldCell*> > loadCells;
+    size_t numReading = 0;
+
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        WorldCell& cell = it->second;
+        float distance = CellDistance(IntVector2(it->first.first, it->first.second), viewPosition);
+
+        if (cell.state == CELL_UNLOADED)
+        {
+            if (distance <= loadDistance)
+                loadCells.push_back(std::make_pair(distance, &cell));
+        }
+        else if (distance > unloadDistance)
+            Unload(cell);
+
+        if (cell.state == CELL_READING)
+            ++numReading;
+    }
+
+    // Start the closest cells first
+    std::sort(loadCells.begin(), loadCells.end());
+    for (auto it = loadCells.begin(); it != loadCells.end() && numReading < maxLoadingCells; ++it)
+    {
+        if (StartLoad(*it->second))
+            ++numReading;
+    }
+
+    bool attached = false;
+
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        WorldCell& cell = it->second;
+        if (cell.state == CELL_UNLOADED || cell.state == CELL_LOADED)
+            continue;
+
+        UpdateLoad(cell, timer, maxUSec, attached);
+        if (attached && timer.ElapsedUSec() >= maxUSec)
+            break;
+    }
+}
+
+void WorldPartition::UnloadAll()
+{
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+        Unload(it->second);
+}
+
+size_t WorldPartition::NumActiveCells() const
+{
+    size_t ret = 0;
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        if (it->second.state != CELL_UNLOADED)
+            ++ret;
+    }
+    return ret;
+}
+
+CellState WorldPartition::GetCellState(const IntVector2& coords) const
+{
+    auto it = cells.find(std::make_pair(coords.x, coords.y));
+    return it != cells.end() ? it->second.state : CELL_UNLOADED;
+}
+
+IntVector2 WorldPartition::CellCoords(const Vector3& position) const
+{
+    return IntVector2((int)floorf(position.x / cellSize), (int)floorf(position.z / cellSize));
+}
+
+bool WorldPartition::SaveCells(Node* root, float cellSize, const std::string& directory, const std::string& resourcePath)
+{
+    PROFILE(SaveWorldCells);
+
+    if (!root || cellSize <= 0.0f)
+        return false;
+
+    std::string dirName = AddTrailingSlash(directory);
+    std::string resourceDir = resourcePath.empty() ? resourcePath : AddTrailingSlash(resourcePath);
+    if (!DirExists(dirName) && !CreateDir(dirName))
+    {
+        LOGERROR("Could not create world cell directory " + dirName);
+        return false;
+    }
+
+    std::map<std::pair<int, int>, JSONFile> cellFiles;
+    const std::vector<SharedPtr<Node> >& children = root->Children();
+
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        Node* child = *it;
+        if (!child->TestFlag(NF_SPATIAL) || child->IsTemporary())
+            continue;
+
+        Vector3 position = static_cast<SpatialNode*>(child)->WorldPosition();
+        JSONValue& cellRoot = cellFiles[std::make_pair((int)floorf(position.x / cellSize), (int)floorf(position.z / cellSize))].Root();
+        if (cellRoot.IsNull())
+        {
+            cellRoot["type"] = "Node";
+            cellRoot["children"].SetEmptyArray();
+        }
+
+        JSONValue childJSON;
+        child->SaveJSON(childJSON);
+        cellRoot["children"].Push(childJSON);
+    }
+
+    JSONFile index;
+    index.Root()["cellSize"] = cellSize;
+    JSONValue& cellsArray = index.Root()["cells"];
+    cellsArray.SetEmptyArray();
+
+    for (auto it = cellFiles.begin(); it != cellFiles.end(); ++it)
+    {
+        std::string fileName = "Cell_" + ToString(it->first.first) + "_" + ToString(it->first.second) + ".json";
+        File cellFile(dirName + fileName, FILE_WRITE);
+        if (!cellFile.IsOpen() || !it->second.Save(cellFile))
+        {
+            LOGERROR("Could not save world cell " + dirName + fileName);
+            return false;
+        }
+
+        JSONValue cellJSON;
+        cellJSON["x"] = it->first.first;
+        cellJSON["z"] = it->first.second;
+        cellJSON["file"] = resourceDir + fileName;
+        cellsArray.Push(cellJSON);
+    }
+
+    File indexFile(dirName + "Index.json", FILE_WRITE);
+    if (!indexFile.IsOpen() || !index.Save(indexFile))
+    {
+        LOGERROR("Could not save world cell index " + dirName + "Index.json");
+        return false;
+    }
+
+    return true;
+}
+
+bool WorldPartition::StartLoad(WorldCell& cell)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    AutoPtr<Stream> stream = cache ? cache->OpenResource(cell.fileName) : AutoPtr<Stream>();
+
+    // A cell that can not be opened is left empty instead of retrying every frame
+    if (!stream)
+    {
+        LOGERROR("Could not open world cell " + cell.fileName);
+        cell.state = CELL_LOADED;
+        return false;
+    }
+
+    stream->Prefetch();
+    cell.task = new CellLoadTask();
+    cell.task->stream = stream;
+    cell.state = CELL_READING;
+
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    if (workQueue)
+        workQueue->QueueTask(cell.task.Get(), &cell.task->counter);
+    else
+        cell.task->Complete(0);
+
+    return true;
+}
+
+void WorldPartition::UpdateLoad(WorldCell& cell, HiresTimer& timer, long long maxUSec, bool& attached)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    CellLoadTask* task = cell.task.Get();
+
+    if (cell.state == CELL_READING)
+    {
+        if (task->counter.load() > 0)
+            return;
+
+        if (!task->success)
+        {
+            LOGERROR("Could not parse world cell " + cell.fileName);
+            cell.task.Reset();
+            cell.state = CELL_LOADED;
+            return;
+        }
+
+        // The background loads are started in the main thread, as they access the resource map
+        if (cache)
+        {
+            for (auto it = task->resources.begin(); it != task->resources.end(); ++it)
+                cache->LoadResourceAsync(it->first, it->second);
+        }
+
+        cell.state = CELL_WAITING_RESOURCES;
+    }
+
+    if (cell.state == CELL_WAITING_RESOURCES)
+    {
+        // Check the pending resources from the end, dropping those that have finished
+        while (cache && task->resources.size())
+        {
+            const std::pair<StringHash, std::string>& resource = task->resources.back();
+            if (cache->IsLoadingAsync(resource.first, resource.second))
+                return;
+            task->resources.pop_back();
+        }
+
+        cell.resolver = new ObjectResolver();
+        cell.attachIndex = 0;
+        cell.state = CELL_ATTACHING;
+    }
+
+    const JSONArray& children = task->data.Root()["children"].GetArray();
+
+    while (cell.attachIndex < children.size())
+    {
+        if (attached && timer.ElapsedUSec() >= maxUSec)
+            return;
+
+        const JSONValue& childJSON = children[cell.attachIndex++];
+        Node* child = scene->CreateChild(StringHash(childJSON["type"].GetString()));
+        if (child)
+        {
+            cell.resolver->StoreObject((unsigned)childJSON["id"].GetNumber(), child);
+            child->LoadJSON(childJSON, *cell.resolver);
+            cell.nodes.push_back(WeakPtr<Node>(child));
+            attached = true;
+        }
+    }
+
+    cell.resolver->Resolve();
+    cell.resolver.Reset();
+    cell.task.Reset();
+    cell.state = CELL_LOADED;
+}
+
+void WorldPartition::Unload(WorldCell& cell)
+{
+    // A cell being parsed can not be interrupted. It is unloaded on a later update
+    if (cell.state == CELL_READING && cell.task->counter.load() > 0)
+        return;
+
+    for (auto it = cell.nodes.begin(); it != cell.nodes.end(); ++it)
+    {
+        Node* node = *it;
+        if (node && node->Parent())
+            node->Parent()->RemoveChild(node);
+    }
+
+    cell.nodes.clear();
+    cell.resolver.Reset();
+    cell.task.Reset();
+    cell.attachIndex = 0;
+    cell.state = CELL_UNLOADED;
+}
+
+float WorldPartition::CellDistance(const IntVector2& coords, const Vector3& position) const
+{
+    float minX = coords.x * cellSize;
+    float minZ = coords.y * cellSize;
+    float dx = Max(Max(minX - position.x, position.x - (minX + cellSize)), 0.0f);
+    float dz = Max(Max(minZ - position.z, position.z - (minZ + cellSize)), 0.0f);
+    return sqrtf(dx * dx + dz * dz);
+}
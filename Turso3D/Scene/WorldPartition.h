@@ -0,0 +1,149 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/StringHash.h"
+#include "../Math/IntVector2.h"
+#include "../Math/Vector3.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/ObjectResolver.h"
+#include "../Resource/JSONFile.h"
+#include "../Thread/WorkQueue.h"
+#include "Node.h"
+
+#include <map>
+
+class HiresTimer;
+class Scene;
+class Stream;
+
+/// Default distance from the view within which cells are loaded.
+static const float DEFAULT_CELL_LOAD_DISTANCE = 100.0f;
+/// Default number of cells read and parsed in the background at the same time.
+static const size_t DEFAULT_MAX_LOADING_CELLS = 4;
+
+/// Load state of a world partition cell.
+enum CellState
+{
+    CELL_UNLOADED = 0,
+    CELL_READING,
+    CELL_WAITING_RESOURCES,
+    CELL_ATTACHING,
+    CELL_LOADED
+};
+
+/// %Task for reading and parsing a cell's scene data in the background, and collecting the resources referenced by its nodes.
+class CellLoadTask : public Task
+{
+public:
+    /// Construct.
+    CellLoadTask();
+
+    /// Parse the JSON data and find the referenced resources.
+    void Complete(unsigned threadIndex) override;
+
+    /// Source stream, opened in the main thread.
+    AutoPtr<Stream> stream;
+    /// Parsed cell data. The children of the root are the nodes to attach to the scene.
+    JSONFile data;
+    /// Resources referenced by the nodes' attributes, to be loaded before attaching.
+    std::vector<std::pair<StringHash, std::string> > resources;
+    /// Completion counter, nonzero while queued or running.
+    TaskCounter counter;
+    /// Parse result.
+    bool success;
+
+private:
+    /// Collect the resource references of a node and its children.
+    void CollectResources(const JSONValue& node);
+};
+
+/// Spatial cell of a world partition.
+struct WorldCell
+{
+    /// Construct.
+    WorldCell() :
+        state(CELL_UNLOADED),
+        attachIndex(0)
+    {
+    }
+
+    /// Resource name of the cell's scene data.
+    std::string fileName;
+    /// Current load state.
+    CellState state;
+    /// Background read and parse task while loading.
+    AutoPtr<CellLoadTask> task;
+    /// Resolver for object references between the cell's nodes while attaching.
+    AutoPtr<ObjectResolver> resolver;
+    /// Index of the next child of the parsed data to attach.
+    size_t attachIndex;
+    /// Attached root nodes of the cell.
+    std::vector<WeakPtr<Node> > nodes;
+};
+
+/// Streams a large scene in square cells on the XZ plane around the view. Each cell is a JSON scene data file whose top-level children are attached to the scene. The cells are read and parsed on worker threads, their resources are loaded in the background, and the nodes are attached to the scene in a time-budgeted step in the main thread, so that only the cells within the load distance are in memory.
+class WorldPartition : public RefCounted
+{
+public:
+    /// Construct for a scene.
+    WorldPartition(Scene* scene);
+    /// Destruct. Wait for background parsing to finish. Attached nodes are left in the scene.
+    ~WorldPartition();
+
+    /// Load the cell index from JSON text data. The index contains the cell size and an array of cells with their XZ coordinates and data file names. Return true on success.
+    bool LoadIndex(Stream& source);
+    /// Set cell size. Should be set before adding cells.
+    void SetCellSize(float size);
+    /// Add a cell with a scene data resource name.
+    void AddCell(const IntVector2& coords, const std::string& fileName);
+    /// Set distance from the view within which cells are loaded, and the distance beyond which loaded cells are unloaded. The unload distance is clamped to at least the load distance; use a larger value to avoid reloading cells at the boundary.
+    void SetLoadDistance(float loadDistance, float unloadDistance);
+    /// Set number of cells read and parsed in the background at the same time.
+    void SetMaxLoadingCells(size_t num);
+    /// Start loading cells near the view and unloading far cells, and attach loaded nodes to the scene until the time budget is spent. At least one node is attached per call if any are ready. Call once per frame after ResourceCache::UpdateAsyncLoads().
+    void Update(const Vector3& viewPosition, float maxMilliseconds);
+    /// Unload all cells.
+    void UnloadAll();
+
+    /// Return cell size.
+    float CellSize() const { return cellSize; }
+    /// Return load distance.
+    float LoadDistance() const { return loadDistance; }
+    /// Return unload distance.
+    float UnloadDistance() const { return unloadDistance; }
+    /// Return number of cells.
+    size_t NumCells() const { return cells.size(); }
+    /// Return number of cells that are loaded or loading.
+    size_t NumActiveCells() const;
+    /// Return the state of a cell, or unloaded if it does not exist.
+    CellState GetCellState(const IntVector2& coords) const;
+    /// Return the cell coordinates of a world position.
+    IntVector2 CellCoords(const Vector3& position) const;
+
+    /// Save the spatial children of a node into cell data files by their world position, and write a cell index. The files are written to a directory and named in the index with a resource path prefix. The saved nodes are not removed. Return true on success.
+    static bool SaveCells(Node* root, float cellSize, const std::string& directory, const std::string& resourcePath);
+
+private:
+    /// Start the background read of a cell.
+    bool StartLoad(WorldCell& cell);
+    /// Advance a cell that is loading, attaching nodes until the time budget is spent. The attached flag tells whether any node has been attached during this update, and is set when one is.
+    void UpdateLoad(WorldCell& cell, HiresTimer& timer, long long maxUSec, bool& attached);
+    /// Remove a cell's nodes from the scene and free its data.
+    void Unload(WorldCell& cell);
+    /// Return the distance from a position to a cell on the XZ plane.
+    float CellDistance(const IntVector2& coords, const Vector3& position) const;
+
+    /// %Scene to attach the nodes to.
+    WeakPtr<Scene> scene;
+    /// Cells by coordinates.
+    std::map<std::pair<int, int>, WorldCell> cells;
+    /// Cell size.
+    float cellSize;
+    /// Load distance.
+    float loadDistance;
+    /// Unload distance.
+    float unloadDistance;
+    /// Maximum number of cells parsed at the same time.
+    size_t maxLoadingCells;
+};
@@ -0,0 +1,321 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "CPUTopology.h"
+
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#endif
+
+/// Number of logical processors an affinity mask can address.
+static const unsigned MAX_MASK_PROCESSORS = 64;
+
+#ifdef __linux__
+/// Read an unsigned value from a sysfs file. Return false if the file does not exist.
+static bool ReadSysValue(const std::string& fileName, unsigned& value)
+{
+    FILE* file = fopen(fileName.c_str(), "r");
+    if (!file)
+        return false;
+
+    bool success = fscanf(file, "%u", &value) == 1;
+    fclose(file);
+    return success;
+}
+
+/// Read a sysfs processor list such as "0-3,8-11" as an affinity mask. Return false if the file does not exist.
+static bool ReadSysProcessorList(const std::string& fileName, AffinityMask& mask)
+{
+    FILE* file = fopen(fileName.c_str(), "r");
+    if (!file)
+        return false;
+
+    char buffer[1024];
+    size_t length = fread(buffer, 1, sizeof buffer - 1, file);
+    buffer[length] = 0;
+    fclose(file);
+
+    mask = 0;
+    const char* ptr = buffer;
+    while (*ptr >= '0' && *ptr <= '9')
+    {
+        char* end;
+        unsigned long first = strtoul(ptr, &end, 10);
+        unsigned long last = first;
+        if (*end == '-')
+            last = strtoul(end + 1, &end, 10);
+        for (unsigned long i = first; i <= last && i < MAX_MASK_PROCESSORS; ++i)
+            mask |= 1ULL << i;
+        ptr = *end == ',' ? end + 1 : end;
+    }
+
+    return true;
+}
+#endif
+
+CPUTopology::CPUTopology() :
+    numCores(0),
+    numPackages(0),
+    numNumaNodes(0),
+    numEfficiencyClasses(0)
+{
+    if (!Query() || processors.empty())
+    {
+        processors.clear();
+        unsigned numProcessors = std::max(std::min(std::thread::hardware_concurrency(), MAX_MASK_PROCESSORS), 1u);
+        for (unsigned i = 0; i < numProcessors; ++i)
+        {
+            LogicalProcessor processor;
+            processor.index = i;
+            processor.core = i;
+            processors.push_back(processor);
+        }
+    }
+
+    CountUnits();
+}
+
+AffinityMask CPUTopology::AllMask() const
+{
+    AffinityMask mask = 0;
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+        mask |= 1ULL << it->index;
+    return mask;
+}
+
+AffinityMask CPUTopology::PerformanceMask() const
+{
+    AffinityMask mask = 0;
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+    {
+        if (it->efficiencyClass == numEfficiencyClasses - 1)
+            mask |= 1ULL << it->index;
+    }
+    return mask;
+}
+
+AffinityMask CPUTopology::EfficiencyMask() const
+{
+    AffinityMask mask = 0;
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+    {
+        if (it->efficiencyClass == 0)
+            mask |= 1ULL << it->index;
+    }
+    return mask;
+}
+
+AffinityMask CPUTopology::NumaNodeMask(unsigned node) const
+{
+    AffinityMask mask = 0;
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+    {
+        if (it->numaNode == node)
+            mask |= 1ULL << it->index;
+    }
+    return mask;
+}
+
+AffinityMask CPUTopology::PrimaryThreadMask() const
+{
+    AffinityMask mask = 0;
+    std::vector<bool> coreFound(numCores);
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+    {
+        if (!coreFound[it->core])
+        {
+            coreFound[it->core] = true;
+            mask |= 1ULL << it->index;
+        }
+    }
+    return mask;
+}
+
+const CPUTopology& CPUTopology::System()
+{
+    static const CPUTopology topology;
+    return topology;
+}
+
+bool CPUTopology::Query()
+{
+    #ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+        return false;
+
+    std::vector<unsigned char> buffer(length);
+    if (!GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&buffer[0], &length))
+        return false;
+
+    // Affinity masks address the first processor group only
+    LogicalProcessor groupProcessors[MAX_MASK_PROCESSORS];
+    AffinityMask presentMask = 0;
+    unsigned coreIndex = 0;
+    unsigned packageIndex = 0;
+
+    for (DWORD offset = 0; offset < length;)
+    {
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)&buffer[offset];
+        switch (info->Relationship)
+        {
+        case RelationProcessorCore:
+            if (info->Processor.GroupMask[0].Group == 0)
+            {
+                AffinityMask mask = info->Processor.GroupMask[0].Mask;
+                for (unsigned i = 0; i < MAX_MASK_PROCESSORS; ++i)
+                {
+                    if (mask & (1ULL << i))
+                    {
+                        groupProcessors[i].index = i;
+                        groupProcessors[i].core = coreIndex;
+                        groupProcessors[i].efficiencyClass = info->Processor.EfficiencyClass;
+                    }
+                }
+                presentMask |= mask;
+                ++coreIndex;
+            }
+            break;
+
+        case RelationProcessorPackage:
+            for (WORD i = 0; i < info->Processor.GroupCount; ++i)
+            {
+                if (info->Processor.GroupMask[i].Group != 0)
+                    continue;
+                AffinityMask mask = info->Processor.GroupMask[i].Mask;
+                for (unsigned j = 0; j < MAX_MASK_PROCESSORS; ++j)
+                {
+                    if (mask & (1ULL << j))
+                        groupProcessors[j].package = packageIndex;
+                }
+            }
+            ++packageIndex;
+            break;
+
+        case RelationNumaNode:
+            if (info->NumaNode.GroupMask.Group == 0)
+            {
+                AffinityMask mask = info->NumaNode.GroupMask.Mask;
+                for (unsigned i = 0; i < MAX_MASK_PROCESSORS; ++i)
+                {
+                    if (mask & (1ULL << i))
+                        groupProcessors[i].numaNode = info->NumaNode.NodeNumber;
+                }
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        offset += info->Size;
+    }
+
+    for (unsigned i = 0; i < MAX_MASK_PROCESSORS; ++i)
+    {
+        if (presentMask & (1ULL << i))
+            processors.push_back(groupProcessors[i]);
+    }
+
+    return true;
+
+    #elif defined(__linux__)
+    long numConfigured = sysconf(_SC_NPROCESSORS_CONF);
+    if (numConfigured <= 0)
+        return false;
+
+    // Hybrid Intel CPUs list their performance and efficiency cores as separate PMUs. Otherwise use the relative capacity, which hybrid ARM CPUs report
+    AffinityMask atomMask = 0;
+    AffinityMask performanceMask = 0;
+    bool intelHybrid = ReadSysProcessorList("/sys/devices/cpu_atom/cpus", atomMask) && ReadSysProcessorList("/sys/devices/cpu_core/cpus", performanceMask);
+
+    std::vector<std::pair<unsigned, unsigned> > coreIds;
+    for (unsigned i = 0; i < (unsigned)numConfigured && i < MAX_MASK_PROCESSORS; ++i)
+    {
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(i) + "/";
+
+        // Offline processors have no topology
+        unsigned coreId, packageId;
+        if (!ReadSysValue(dir + "topology/core_id", coreId) || !ReadSysValue(dir + "topology/physical_package_id", packageId))
+            continue;
+
+        LogicalProcessor processor;
+        processor.index = i;
+        processor.package = packageId;
+
+        // Core IDs are unique only within a package
+        std::pair<unsigned, unsigned> coreKey(packageId, coreId);
+        auto coreIt = std::find(coreIds.begin(), coreIds.end(), coreKey);
+        processor.core = (unsigned)(coreIt - coreIds.begin());
+        if (coreIt == coreIds.end())
+            coreIds.push_back(coreKey);
+
+        unsigned capacity;
+        if (intelHybrid)
+            processor.efficiencyClass = (performanceMask & (1ULL << i)) ? 1 : 0;
+        else if (ReadSysValue(dir + "cpu_capacity", capacity))
+            processor.efficiencyClass = capacity;
+
+        processors.push_back(processor);
+    }
+
+    // Node numbers may have gaps, so check each possible node
+    for (unsigned i = 0; i < MAX_MASK_PROCESSORS; ++i)
+    {
+        AffinityMask nodeMask;
+        if (!ReadSysProcessorList("/sys/devices/system/node/node" + std::to_string(i) + "/cpulist", nodeMask))
+            continue;
+
+        for (auto it = processors.begin(); it != processors.end(); ++it)
+        {
+            if (nodeMask & (1ULL << it->index))
+                it->numaNode = i;
+        }
+    }
+
+    return true;
+
+    #else
+    return false;
+    #endif
+}
+
+void CPUTopology::CountUnits()
+{
+    std::vector<unsigned> cores;
+    std::vector<unsigned> packages;
+    std::vector<unsigned> numaNodes;
+    std::vector<unsigned> efficiencyClasses;
+
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+    {
+        cores.push_back(it->core);
+        packages.push_back(it->package);
+        numaNodes.push_back(it->numaNode);
+        efficiencyClasses.push_back(it->efficiencyClass);
+    }
+
+    std::vector<unsigned>* units[] = { &cores, &packages, &numaNodes, &efficiencyClasses };
+    for (size_t i = 0; i < 4; ++i)
+    {
+        std::sort(units[i]->begin(), units[i]->end());
+        units[i]->erase(std::unique(units[i]->begin(), units[i]->end()), units[i]->end());
+    }
+
+    numCores = (unsigned)cores.size();
+    numPackages = (unsigned)packages.size();
+    numNumaNodes = (unsigned)numaNodes.size();
+    numEfficiencyClasses = (unsigned)efficiencyClasses.size();
+
+    // Efficiency classes are reported as arbitrary values such as relative capacities, so rank them
+    for (auto it = processors.begin(); it != processors.end(); ++it)
+        it->efficiencyClass = (unsigned)(std::lower_bound(efficiencyClasses.begin(), efficiencyClasses.end(), it->efficiencyClass) - efficiencyClasses.begin());
+}
@@ -0,0 +1,86 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Thread.h"
+
+#include <vector>
+
+/// Logical processor in the CPU topology.
+struct LogicalProcessor
+{
+    /// Construct.
+    LogicalProcessor() :
+        index(0),
+        core(0),
+        package(0),
+        numaNode(0),
+        efficiencyClass(0)
+    {
+    }
+
+    /// Operating system index, which is the processor's bit in affinity masks.
+    unsigned index;
+    /// Physical core index. SMT siblings share the core.
+    unsigned core;
+    /// Physical package (socket) index.
+    unsigned package;
+    /// NUMA node index.
+    unsigned numaNode;
+    /// Efficiency class. 0 is the most power-efficient and higher classes are faster. All processors are class 0 on CPUs that are not hybrid.
+    unsigned efficiencyClass;
+};
+
+/// CPU topology of the system: physical cores and their SMT siblings, packages, NUMA nodes and the efficiency classes of hybrid CPUs. Only the first 64 logical processors are described, as that is what an affinity mask can address.
+class CPUTopology
+{
+public:
+    /// Construct by querying the operating system. If the query is not supported, each logical processor reported by the standard library is described as its own core.
+    CPUTopology();
+
+    /// Return the logical processors.
+    const std::vector<LogicalProcessor>& Processors() const { return processors; }
+    /// Return number of logical processors.
+    unsigned NumLogicalProcessors() const { return (unsigned)processors.size(); }
+    /// Return number of physical cores.
+    unsigned NumCores() const { return numCores; }
+    /// Return number of physical packages.
+    unsigned NumPackages() const { return numPackages; }
+    /// Return number of NUMA nodes.
+    unsigned NumNumaNodes() const { return numNumaNodes; }
+    /// Return number of efficiency classes.
+    unsigned NumEfficiencyClasses() const { return numEfficiencyClasses; }
+    /// Return whether the CPU has cores of different efficiency classes.
+    bool IsHybrid() const { return numEfficiencyClasses > 1; }
+
+    /// Return mask of all logical processors.
+    AffinityMask AllMask() const;
+    /// Return mask of the logical processors in the fastest efficiency class.
+    AffinityMask PerformanceMask() const;
+    /// Return mask of the logical processors in the most power-efficient class.
+    AffinityMask EfficiencyMask() const;
+    /// Return mask of the logical processors in a NUMA node.
+    AffinityMask NumaNodeMask(unsigned node) const;
+    /// Return mask with the first logical processor of each physical core, leaving out the SMT siblings.
+    AffinityMask PrimaryThreadMask() const;
+
+    /// Return the system's topology, which is queried on first use. Thread-safe.
+    static const CPUTopology& System();
+
+private:
+    /// Query from the operating system. Return true on success.
+    bool Query();
+    /// Count the cores, packages, NUMA nodes and efficiency classes, and renumber the efficiency classes to be consecutive.
+    void CountUnits();
+
+    /// Logical processors.
+    std::vector<LogicalProcessor> processors;
+    /// Number of physical cores.
+    unsigned numCores;
+    /// Number of physical packages.
+    unsigned numPackages;
+    /// Number of NUMA nodes.
+    unsigned numNumaNodes;
+    /// Number of efficiency classes.
+    unsigned numEfficiencyClasses;
+};
@@ -0,0 +1,231 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#ifdef TURSO3D_COROUTINES
+
+#include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "Coroutine.h"
+#include "Thread.h"
+
+#include <cassert>
+#include <glew.h>
+
+/// Work queue task that resumes a coroutine on a worker thread.
+struct ResumeTask : public Task
+{
+    /// Construct.
+    ResumeTask() :
+        counter(0)
+    {
+    }
+
+    /// Resume the coroutine.
+    void Complete(unsigned) override
+    {
+        handle.resume();
+    }
+
+    /// Coroutine to resume.
+    std::coroutine_handle<> handle;
+    /// Completion counter. The work queue decrements it as the last access to the task, so the task can be reused once it is zero.
+    TaskCounter counter;
+};
+
+CoroutineScheduler::CoroutineScheduler()
+{
+    RegisterSubsystem(this);
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    if (cache)
+        SubscribeToEvent(cache->resourceLoadedEvent, &CoroutineScheduler::HandleResourceLoaded);
+}
+
+CoroutineScheduler::~CoroutineScheduler()
+{
+    // Wait for the coroutines resumed on the workers, as their tasks are destroyed
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    for (auto it = resumeTasks.begin(); it != resumeTasks.end(); ++it)
+    {
+        if (workQueue)
+            workQueue->Complete((*it)->counter);
+    }
+
+    for (auto it = fenceWaiters.begin(); it != fenceWaiters.end(); ++it)
+        glDeleteSync((GLsync)it->first);
+
+    RemoveSubsystem(this);
+}
+
+void CoroutineScheduler::Update()
+{
+    PROFILE(UpdateCoroutines);
+
+    assert(Thread::IsMainThread());
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        resumeHandles.swap(readyQueue);
+    }
+    for (auto it = resumeHandles.begin(); it != resumeHandles.end(); ++it)
+        it->resume();
+    resumeHandles.clear();
+
+    // Resuming may add new fence waits, so take the signaled ones out first
+    for (size_t i = 0; i < fenceWaiters.size();)
+    {
+        GLenum result = glClientWaitSync((GLsync)fenceWaiters[i].first, 0, 0);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+        {
+            glDeleteSync((GLsync)fenceWaiters[i].first);
+            resumeHandles.push_back(fenceWaiters[i].second);
+            fenceWaiters.erase(fenceWaiters.begin() + i);
+        }
+        else
+            ++i;
+    }
+    for (auto it = resumeHandles.begin(); it != resumeHandles.end(); ++it)
+        it->resume();
+    resumeHandles.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        resumeHandles.swap(mainThreadQueue);
+    }
+    for (auto it = resumeHandles.begin(); it != resumeHandles.end(); ++it)
+        it->resume();
+    resumeHandles.clear();
+}
+
+void CoroutineScheduler::ResumeOnMainThread(std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+    mainThreadQueue.push_back(handle);
+}
+
+void CoroutineScheduler::ResumeOnWorker(std::coroutine_handle<> handle)
+{
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    ResumeTask* task = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        for (auto it = resumeTasks.begin(); it != resumeTasks.end(); ++it)
+        {
+            if (!(*it)->counter.load())
+            {
+                task = *it;
+                break;
+            }
+        }
+        if (!task)
+        {
+            task = new ResumeTask();
+            resumeTasks.push_back(task);
+        }
+
+        // Queue while holding the lock, so that the task is not taken again before its counter is raised
+        task->handle = handle;
+        workQueue->QueueTask(task, &task->counter);
+    }
+}
+
+void CoroutineScheduler::ResumeOnFence(void* fence, std::coroutine_handle<> handle)
+{
+    fenceWaiters.push_back(std::make_pair(fence, handle));
+}
+
+bool CoroutineScheduler::ResumeOnResourceLoad(StringHash type, const std::string& name, SharedPtr<Resource>* result, std::coroutine_handle<> handle)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+
+    std::string sanitatedName = cache->SanitateResourceName(name);
+
+    // If the load finished or failed immediately, as the resource was already loaded or its file could not be opened, there is no completion event to wait for
+    if (!cache->LoadResourceAsync(type, sanitatedName) || !cache->IsLoadingAsync(type, sanitatedName))
+    {
+        *result = cache->FindResource(type, StringHash(sanitatedName));
+        return false;
+    }
+
+    // Loads complete in UpdateAsyncLoads() on the main thread, so the waiter is registered in time
+    ResourceWaiter waiter;
+    waiter.type = type;
+    waiter.nameHash = StringHash(sanitatedName);
+    waiter.result = result;
+    waiter.handle = handle;
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    resourceWaiters.push_back(waiter);
+    return true;
+}
+
+size_t CoroutineScheduler::NumSuspended()
+{
+    std::lock_guard<std::mutex> lock(queueMutex);
+
+    size_t numSuspended = mainThreadQueue.size() + readyQueue.size() + resourceWaiters.size() + fenceWaiters.size();
+    for (auto it = resumeTasks.begin(); it != resumeTasks.end(); ++it)
+    {
+        if ((*it)->counter.load())
+            ++numSuspended;
+    }
+
+    return numSuspended;
+}
+
+void CoroutineScheduler::HandleResourceLoaded(ResourceLoadedEvent& event)
+{
+    Resource* resource = event.resource;
+    if (!resource)
+        return;
+
+    // Resume from Update(), so that the coroutines do not run in the middle of the resource cache's update
+    std::lock_guard<std::mutex> lock(queueMutex);
+    for (size_t i = 0; i < resourceWaiters.size();)
+    {
+        ResourceWaiter& waiter = resourceWaiters[i];
+        if (waiter.type == resource->Type() && waiter.nameHash == resource->NameHash())
+        {
+            *waiter.result = event.success ? resource : nullptr;
+            readyQueue.push_back(waiter.handle);
+            resourceWaiters.erase(resourceWaiters.begin() + i);
+        }
+        else
+            ++i;
+    }
+}
+
+void NextFrame::await_suspend(std::coroutine_handle<> handle) const
+{
+    Object::Subsystem<CoroutineScheduler>()->ResumeOnMainThread(handle);
+}
+
+void SwitchToWorker::await_suspend(std::coroutine_handle<> handle) const
+{
+    Object::Subsystem<CoroutineScheduler>()->ResumeOnWorker(handle);
+}
+
+void GpuFence::await_suspend(std::coroutine_handle<> handle) const
+{
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    Object::Subsystem<CoroutineScheduler>()->ResumeOnFence(fence, handle);
+}
+
+bool ResourceLoadAwaiter::await_ready()
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    std::string sanitatedName = cache->SanitateResourceName(name);
+    if (cache->IsLoadingAsync(type, sanitatedName))
+        return false;
+
+    result = cache->FindResource(type, StringHash(sanitatedName));
+    return result.Get() != nullptr;
+}
+
+bool ResourceLoadAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+    return Object::Subsystem<CoroutineScheduler>()->ResumeOnResourceLoad(type, name, &result, handle);
+}
+
+#endif
@@ -0,0 +1,309 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+// Coroutine tasks require C++20. Configure with TURSO3D_COROUTINES to compile them
+#ifdef TURSO3D_COROUTINES
+
+#include "../Resource/Resource.h"
+#include "WorkQueue.h"
+
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class ResourceLoadedEvent;
+struct ResumeTask;
+template <class T> class CoTask;
+
+/// Promise data common to all coroutine tasks.
+struct CoPromiseBase
+{
+    /// Awaiter of the final suspend point. Transfers to the awaiting coroutine, or destroys the coroutine if it was detached.
+    struct FinalAwaiter
+    {
+        /// Return whether the coroutine can continue without suspending.
+        bool await_ready() const noexcept { return false; }
+        /// Transfer to the awaiting coroutine.
+        template <class P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            CoPromiseBase& promise = handle.promise();
+            std::coroutine_handle<> next = promise.continuation ? promise.continuation : std::noop_coroutine();
+            if (promise.detached)
+                handle.destroy();
+            return next;
+        }
+        /// Never resumed.
+        void await_resume() const noexcept {}
+    };
+
+    /// Start suspended, so that the task runs when awaited or detached.
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    /// Suspend at the end to resume the awaiting coroutine.
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    /// Terminate on an exception, as the engine does not use them.
+    void unhandled_exception() { std::terminate(); }
+
+    /// Coroutine awaiting the task, or null.
+    std::coroutine_handle<> continuation;
+    /// Whether the coroutine destroys itself on completion.
+    bool detached = false;
+};
+
+/// Promise of a coroutine task with a result.
+template <class T> struct CoPromise : public CoPromiseBase
+{
+    /// Return the task object.
+    CoTask<T> get_return_object();
+    /// Store the result.
+    template <class U> void return_value(U&& value) { result = std::forward<U>(value); }
+
+    /// Result value.
+    T result;
+};
+
+/// Promise of a coroutine task without a result.
+template <> struct CoPromise<void> : public CoPromiseBase
+{
+    /// Return the task object.
+    CoTask<void> get_return_object();
+    /// Finish without a result.
+    void return_void() {}
+};
+
+/// Coroutine task that can be awaited by another coroutine, or detached to run on its own. Named so to not clash with the work queue's tasks. The task starts when awaited or detached, and continues on whichever thread resumes it after each suspension: see NextFrame, SwitchToWorker, GpuFence and LoadAsync.
+template <class T = void> class CoTask
+{
+public:
+    typedef CoPromise<T> promise_type;
+
+    /// Construct empty.
+    CoTask() :
+        handle(nullptr)
+    {
+    }
+
+    /// Construct from the coroutine handle.
+    explicit CoTask(std::coroutine_handle<promise_type> handle_) :
+        handle(handle_)
+    {
+    }
+
+    /// Move-construct.
+    CoTask(CoTask&& task) noexcept :
+        handle(task.handle)
+    {
+        task.handle = nullptr;
+    }
+
+    /// Destruct. Destroys the coroutine if not detached, which must not be running then.
+    ~CoTask()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    /// Move-assign.
+    CoTask& operator = (CoTask&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            if (handle)
+                handle.destroy();
+            handle = rhs.handle;
+            rhs.handle = nullptr;
+        }
+        return *this;
+    }
+
+    /// Start running without awaiting. The coroutine destroys itself on completion and this task becomes empty.
+    void Detach()
+    {
+        if (handle)
+        {
+            std::coroutine_handle<promise_type> detached = handle;
+            handle = nullptr;
+            detached.promise().detached = true;
+            detached.resume();
+        }
+    }
+
+    /// Return whether holds a coroutine.
+    bool IsValid() const { return handle != nullptr; }
+    /// Return whether the coroutine has run to completion.
+    bool IsDone() const { return !handle || handle.done(); }
+
+    /// Return whether can continue without suspending, as the task has already completed.
+    bool await_ready() const noexcept { return handle.done(); }
+    /// Start the task, which resumes the awaiting coroutine on completion.
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    /// Return the result.
+    T await_resume()
+    {
+        if constexpr (!std::is_void<T>::value)
+            return std::move(handle.promise().result);
+    }
+
+private:
+    /// Prevent copy construction.
+    CoTask(const CoTask& task) = delete;
+    /// Prevent copy assignment.
+    CoTask& operator = (const CoTask& rhs) = delete;
+
+    /// Coroutine handle.
+    std::coroutine_handle<promise_type> handle;
+};
+
+template <class T> CoTask<T> CoPromise<T>::get_return_object()
+{
+    return CoTask<T>(std::coroutine_handle<CoPromise<T> >::from_promise(*this));
+}
+
+inline CoTask<void> CoPromise<void>::get_return_object()
+{
+    return CoTask<void>(std::coroutine_handle<CoPromise<void> >::from_promise(*this));
+}
+
+/// Coroutine scheduler subsystem. Resumes suspended coroutines on the main thread from Update(), which the application calls once per frame after ResourceCache::UpdateAsyncLoads(), and on the worker threads through the work queue. Coroutines still suspended when the scheduler is destroyed are not resumed.
+class CoroutineScheduler : public Object
+{
+    OBJECT(CoroutineScheduler);
+
+public:
+    /// Construct and register subsystem. The work queue and resource cache subsystems must exist.
+    CoroutineScheduler();
+    /// Destruct.
+    ~CoroutineScheduler();
+
+    /// Resume the coroutines whose resource loads and GPU fences have completed, then those that waited for the next frame. Coroutines suspending for the next frame meanwhile are resumed on the next call. Call on the main thread.
+    void Update();
+
+    /// Resume a coroutine on the main thread on the next Update(). Thread-safe.
+    void ResumeOnMainThread(std::coroutine_handle<> handle);
+    /// Resume a coroutine on a worker thread. Thread-safe.
+    void ResumeOnWorker(std::coroutine_handle<> handle);
+    /// Resume a coroutine once a fence has been signaled. Takes ownership of the fence. Call on the main thread.
+    void ResumeOnFence(void* fence, std::coroutine_handle<> handle);
+    /// Start a background resource load and resume a coroutine with the resource, or null if failed, once it has completed. If the load finishes or fails immediately, store the result and return false to continue without suspending. Call on the main thread.
+    bool ResumeOnResourceLoad(StringHash type, const std::string& name, SharedPtr<Resource>* result, std::coroutine_handle<> handle);
+
+    /// Return number of suspended coroutines the scheduler knows of.
+    size_t NumSuspended();
+
+private:
+    /// Handle a background resource load finishing.
+    void HandleResourceLoaded(ResourceLoadedEvent& event);
+
+    /// Coroutine waiting for a resource load.
+    struct ResourceWaiter
+    {
+        /// Resource type.
+        StringHash type;
+        /// Sanitated resource name hash.
+        StringHash nameHash;
+        /// Result destination.
+        SharedPtr<Resource>* result;
+        /// Coroutine to resume.
+        std::coroutine_handle<> handle;
+    };
+
+    /// Coroutines to resume on the next Update().
+    std::vector<std::coroutine_handle<> > mainThreadQueue;
+    /// Coroutines whose resource loads have completed.
+    std::vector<std::coroutine_handle<> > readyQueue;
+    /// Coroutines waiting for resource loads.
+    std::vector<ResourceWaiter> resourceWaiters;
+    /// Coroutines waiting for fences.
+    std::vector<std::pair<void*, std::coroutine_handle<> > > fenceWaiters;
+    /// Work queue tasks for resuming coroutines on the worker threads. Reused once their counter reaches zero.
+    std::vector<AutoPtr<ResumeTask> > resumeTasks;
+    /// Swap buffer for resuming.
+    std::vector<std::coroutine_handle<> > resumeHandles;
+    /// Mutex for the queues.
+    std::mutex queueMutex;
+};
+
+/// Awaiter that continues on the main thread on the next frame.
+class NextFrame
+{
+public:
+    /// Return whether can continue without suspending.
+    bool await_ready() const noexcept { return false; }
+    /// Queue the coroutine to the scheduler.
+    void await_suspend(std::coroutine_handle<> handle) const;
+    /// Continue.
+    void await_resume() const noexcept {}
+};
+
+/// Awaiter that continues on a worker thread, for work that should not block the frame.
+class SwitchToWorker
+{
+public:
+    /// Return whether can continue without suspending.
+    bool await_ready() const noexcept { return false; }
+    /// Queue the coroutine to the work queue.
+    void await_suspend(std::coroutine_handle<> handle) const;
+    /// Continue.
+    void await_resume() const noexcept {}
+};
+
+/// Awaiter that continues on the main thread once the GPU has completed the commands issued so far, for example before reading back or reusing a buffer. Await on the main thread.
+class GpuFence
+{
+public:
+    /// Return whether can continue without suspending.
+    bool await_ready() const noexcept { return false; }
+    /// Insert the fence and queue the coroutine to the scheduler.
+    void await_suspend(std::coroutine_handle<> handle) const;
+    /// Continue.
+    void await_resume() const noexcept {}
+};
+
+/// Awaiter of a background resource load, which continues on the main thread with the resource or null if loading failed. An already loaded resource is returned without suspending. Await on the main thread.
+class ResourceLoadAwaiter
+{
+public:
+    /// Construct with resource type and name.
+    ResourceLoadAwaiter(StringHash type_, const std::string& name_) :
+        type(type_),
+        name(name_)
+    {
+    }
+
+    /// Return the resource without suspending if already loaded.
+    bool await_ready();
+    /// Start the load and queue the coroutine to the scheduler. Return false to continue immediately if the load finished or failed right away.
+    bool await_suspend(std::coroutine_handle<> handle);
+
+protected:
+    /// Resource type.
+    StringHash type;
+    /// Resource name.
+    std::string name;
+    /// Loaded resource.
+    SharedPtr<Resource> result;
+};
+
+/// Awaiter of a background resource load, template version.
+template <class T> class LoadAsync : public ResourceLoadAwaiter
+{
+public:
+    /// Construct with resource name.
+    LoadAsync(const std::string& name_) :
+        ResourceLoadAwaiter(T::TypeStatic(), name_)
+    {
+    }
+
+    /// Return the loaded resource, or null if failed.
+    T* await_resume() const noexcept { return static_cast<T*>(result.Get()); }
+};
+
+#endif
@@ -1,5 +1,6 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Math/SIMD.h"
 #include "Mutex.h"
 
 #ifdef _WIN32
@@ -8,11 +9,30 @@
 #include <pthread.h>
 #endif
 
+#include <thread>
+
+/// Hint the CPU that the thread is polling a lock, which saves power and frees execution resources for a hyperthreaded sibling.
+static inline void SpinPause()
+{
+#ifdef TURSO3D_SSE
+    _mm_pause();
+#endif
+}
+
+/// Return the number of polls to use. On a single CPU the lock holder can not run while another thread polls, so polling only wastes the timeslice.
+static unsigned EffectiveSpinCount(unsigned spinCount)
+{
+    static const bool multipleCpus = std::thread::hardware_concurrency() > 1;
+    return multipleCpus ? spinCount : 0;
+}
+
 #ifdef _WIN32
-Mutex::Mutex() :
-    handle(new CRITICAL_SECTION)
+Mutex::Mutex(unsigned spinCount_) :
+    handle(new CRITICAL_SECTION),
+    spinCount(EffectiveSpinCount(spinCount_))
 {
-    InitializeCriticalSection((CRITICAL_SECTION*)handle);
+    // The critical section has a spin phase built in
+    InitializeCriticalSectionAndSpinCount((CRITICAL_SECTION*)handle, spinCount);
 }
 
 Mutex::~Mutex()
@@ -28,19 +48,86 @@ void Mutex::Acquire()
     EnterCriticalSection((CRITICAL_SECTION*)handle);
 }
 
+bool Mutex::TryAcquire()
+{
+    return TryEnterCriticalSection((CRITICAL_SECTION*)handle) != FALSE;
+}
+
 void Mutex::Release()
 {
     LeaveCriticalSection((CRITICAL_SECTION*)handle);
 }
+
+ReadWriteMutex::ReadWriteMutex(unsigned spinCount_) :
+    handle(new SRWLOCK),
+    spinCount(EffectiveSpinCount(spinCount_))
+{
+    // SRW locks queue readers behind a waiting writer, so writers are preferred without further setup
+    InitializeSRWLock((SRWLOCK*)handle);
+}
+
+ReadWriteMutex::~ReadWriteMutex()
+{
+    delete (SRWLOCK*)handle;
+    handle = nullptr;
+}
+
+void ReadWriteMutex::AcquireRead()
+{
+    SRWLOCK* l = (SRWLOCK*)handle;
+    for (unsigned i = 0; i < spinCount; ++i)
+    {
+        if (TryAcquireSRWLockShared(l))
+            return;
+        SpinPause();
+    }
+
+    AcquireSRWLockShared(l);
+}
+
+bool ReadWriteMutex::TryAcquireRead()
+{
+    return TryAcquireSRWLockShared((SRWLOCK*)handle) != FALSE;
+}
+
+void ReadWriteMutex::ReleaseRead()
+{
+    ReleaseSRWLockShared((SRWLOCK*)handle);
+}
+
+void ReadWriteMutex::AcquireWrite()
+{
+    SRWLOCK* l = (SRWLOCK*)handle;
+    for (unsigned i = 0; i < spinCount; ++i)
+    {
+        if (TryAcquireSRWLockExclusive(l))
+            return;
+        SpinPause();
+    }
+
+    AcquireSRWLockExclusive(l);
+}
+
+bool ReadWriteMutex::TryAcquireWrite()
+{
+    return TryAcquireSRWLockExclusive((SRWLOCK*)handle) != FALSE;
+}
+
+void ReadWriteMutex::ReleaseWrite()
+{
+    ReleaseSRWLockExclusive((SRWLOCK*)handle);
+}
 #else
-Mutex::Mutex() :
-    handle(new pthread_mutex_t)
+Mutex::Mutex(unsigned spinCount_) :
+    handle(new pthread_mutex_t),
+    spinCount(EffectiveSpinCount(spinCount_))
 {
     pthread_mutex_t* m = (pthread_mutex_t*)handle;
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
     pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
 }
 
 Mutex::~Mutex()
@@ -53,13 +140,95 @@ Mutex::~Mutex()
 
 void Mutex::Acquire()
 {
-    pthread_mutex_lock((pthread_mutex_t*)handle);
+    // Poll before blocking. The blocking lock sleeps on a futex where available, which costs a system call both to sleep and to wake up
+    pthread_mutex_t* m = (pthread_mutex_t*)handle;
+    for (unsigned i = 0; i < spinCount; ++i)
+    {
+        if (!pthread_mutex_trylock(m))
+            return;
+        SpinPause();
+    }
+
+    pthread_mutex_lock(m);
+}
+
+bool Mutex::TryAcquire()
+{
+    return pthread_mutex_trylock((pthread_mutex_t*)handle) == 0;
 }
 
 void Mutex::Release()
 {
     pthread_mutex_unlock((pthread_mutex_t*)handle);
 }
+
+ReadWriteMutex::ReadWriteMutex(unsigned spinCount_) :
+    handle(new pthread_rwlock_t),
+    spinCount(EffectiveSpinCount(spinCount_))
+{
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    // Glibc prefers readers by default, which lets continuous lookups starve a writer
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init((pthread_rwlock_t*)handle, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+ReadWriteMutex::~ReadWriteMutex()
+{
+    pthread_rwlock_t* l = (pthread_rwlock_t*)handle;
+    pthread_rwlock_destroy(l);
+    delete l;
+    handle = nullptr;
+}
+
+void ReadWriteMutex::AcquireRead()
+{
+    pthread_rwlock_t* l = (pthread_rwlock_t*)handle;
+    for (unsigned i = 0; i < spinCount; ++i)
+    {
+        if (!pthread_rwlock_tryrdlock(l))
+            return;
+        SpinPause();
+    }
+
+    pthread_rwlock_rdlock(l);
+}
+
+bool ReadWriteMutex::TryAcquireRead()
+{
+    return pthread_rwlock_tryrdlock((pthread_rwlock_t*)handle) == 0;
+}
+
+void ReadWriteMutex::ReleaseRead()
+{
+    pthread_rwlock_unlock((pthread_rwlock_t*)handle);
+}
+
+void ReadWriteMutex::AcquireWrite()
+{
+    pthread_rwlock_t* l = (pthread_rwlock_t*)handle;
+    for (unsigned i = 0; i < spinCount; ++i)
+    {
+        if (!pthread_rwlock_trywrlock(l))
+            return;
+        SpinPause();
+    }
+
+    pthread_rwlock_wrlock(l);
+}
+
+bool ReadWriteMutex::TryAcquireWrite()
+{
+    return pthread_rwlock_trywrlock((pthread_rwlock_t*)handle) == 0;
+}
+
+void ReadWriteMutex::ReleaseWrite()
+{
+    pthread_rwlock_unlock((pthread_rwlock_t*)handle);
+}
 #endif
 
 MutexLock::MutexLock(Mutex& mutex_) :
@@ -72,3 +241,25 @@ MutexLock::~MutexLock()
 {
     mutex.Release();
 }
+
+ReadLock::ReadLock(ReadWriteMutex& mutex_) :
+    mutex(mutex_)
+{
+    mutex.AcquireRead();
+}
+
+ReadLock::~ReadLock()
+{
+    mutex.ReleaseRead();
+}
+
+WriteLock::WriteLock(ReadWriteMutex& mutex_) :
+    mutex(mutex_)
+{
+    mutex.AcquireWrite();
+}
+
+WriteLock::~WriteLock()
+{
+    mutex.ReleaseWrite();
+}
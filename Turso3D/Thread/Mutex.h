@@ -2,23 +2,38 @@
 
 #pragma once
 
-/// Operating system mutual exclusion primitive.
+/// Default number of times a mutex is polled before the thread is put to sleep. Locks in the engine are held for short times, so a contended lock is usually released before a sleep and wakeup would complete.
+static const unsigned DEFAULT_MUTEX_SPIN_COUNT = 1000;
+
+/// Operating system mutual exclusion primitive. Recursive. Spins for a short while before blocking in the operating system.
 class Mutex
 {
 public:
-    /// Construct.
-    Mutex();
+    /// Construct with the number of polls before blocking. 0 blocks immediately. Polling is disabled on a single CPU.
+    Mutex(unsigned spinCount = DEFAULT_MUTEX_SPIN_COUNT);
     /// Destruct.
     ~Mutex();
     
     /// Acquire the mutex. Block if already acquired.
     void Acquire();
+    /// Try to acquire the mutex without blocking. Return true on success.
+    bool TryAcquire();
     /// Release the mutex.
     void Release();
+
+    /// Return the number of polls before blocking.
+    unsigned SpinCount() const { return spinCount; }
     
 private:
+    /// Prevent copy construction.
+    Mutex(const Mutex& rhs);
+    /// Prevent assignment.
+    Mutex& operator = (const Mutex& rhs);
+
     /// Mutex handle.
     void* handle;
+    /// Number of polls before blocking.
+    unsigned spinCount;
 };
 
 /// Lock that automatically acquires and releases a mutex.
@@ -39,3 +54,78 @@ private:
     /// Mutex reference.
     Mutex& mutex;
 };
+
+/// Operating system reader-writer lock primitive. Any number of readers may hold it at the same time, while a writer holds it exclusively. Waiting writers are preferred over new readers, so that a steady stream of readers can not starve them. Not recursive: a thread must not acquire it for reading again while holding it, as a waiting writer would deadlock both. Spins for a short while before blocking in the operating system.
+class ReadWriteMutex
+{
+public:
+    /// Construct with the number of polls before blocking. 0 blocks immediately. Polling is disabled on a single CPU.
+    ReadWriteMutex(unsigned spinCount = DEFAULT_MUTEX_SPIN_COUNT);
+    /// Destruct.
+    ~ReadWriteMutex();
+
+    /// Acquire for reading. Block if a writer holds it or is waiting for it.
+    void AcquireRead();
+    /// Try to acquire for reading without blocking. Return true on success.
+    bool TryAcquireRead();
+    /// Release after reading.
+    void ReleaseRead();
+    /// Acquire for writing. Block if readers or a writer hold it.
+    void AcquireWrite();
+    /// Try to acquire for writing without blocking. Return true on success.
+    bool TryAcquireWrite();
+    /// Release after writing.
+    void ReleaseWrite();
+
+    /// Return the number of polls before blocking.
+    unsigned SpinCount() const { return spinCount; }
+
+private:
+    /// Prevent copy construction.
+    ReadWriteMutex(const ReadWriteMutex& rhs);
+    /// Prevent assignment.
+    ReadWriteMutex& operator = (const ReadWriteMutex& rhs);
+
+    /// Lock handle.
+    void* handle;
+    /// Number of polls before blocking.
+    unsigned spinCount;
+};
+
+/// Lock that automatically acquires and releases a reader-writer mutex for reading.
+class ReadLock
+{
+public:
+    /// Construct and acquire the mutex for reading.
+    ReadLock(ReadWriteMutex& mutex);
+    /// Destruct. Release the mutex.
+    ~ReadLock();
+
+private:
+    /// Prevent copy construction.
+    ReadLock(const ReadLock& rhs);
+    /// Prevent assignment.
+    ReadLock& operator = (const ReadLock& rhs);
+
+    /// Mutex reference.
+    ReadWriteMutex& mutex;
+};
+
+/// Lock that automatically acquires and releases a reader-writer mutex for writing.
+class WriteLock
+{
+public:
+    /// Construct and acquire the mutex for writing.
+    WriteLock(ReadWriteMutex& mutex);
+    /// Destruct. Release the mutex.
+    ~WriteLock();
+
+private:
+    /// Prevent copy construction.
+    WriteLock(const WriteLock& rhs);
+    /// Prevent assignment.
+    WriteLock& operator = (const WriteLock& rhs);
+
+    /// Mutex reference.
+    ReadWriteMutex& mutex;
+};
@@ -1,5 +1,6 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "CPUTopology.h"
 #include "Thread.h"
 
 #ifdef _WIN32
@@ -8,18 +9,107 @@
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef _WIN32
+typedef HANDLE NativeThread;
+#else
+typedef pthread_t NativeThread;
+#endif
+
+/// Return the logical processors of a scheduling class, or the explicit mask if nonzero.
+static AffinityMask EffectiveAffinity(SchedulingClass cls, AffinityMask mask)
+{
+    const CPUTopology& topology = CPUTopology::System();
+    if (!mask && topology.IsHybrid())
+    {
+        if (cls == SCHEDULE_CRITICAL)
+            mask = topology.PerformanceMask();
+        else if (cls == SCHEDULE_BACKGROUND)
+            mask = topology.EfficiencyMask();
+    }
+
+    return mask ? mask : topology.AllMask();
+}
+
+/// Apply a scheduling class and affinity mask to a thread. Return true if fully applied.
+static bool ApplyScheduling(NativeThread thread, long nativeID, SchedulingClass cls, AffinityMask mask)
+{
+    AffinityMask cores = EffectiveAffinity(cls, mask);
+
+    #ifdef _WIN32
+    static const int priorities[] = { THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_ABOVE_NORMAL, THREAD_PRIORITY_BELOW_NORMAL };
+    bool success = SetThreadAffinityMask(thread, (DWORD_PTR)cores) != 0;
+    return SetThreadPriority(thread, priorities[cls]) && success;
+    #elif defined(__linux__)
+    static const int niceValues[] = { 0, -5, 10 };
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned i = 0; i < 64; ++i)
+    {
+        if (cores & (1ULL << i))
+            CPU_SET(i, &set);
+    }
+    bool success = pthread_setaffinity_np(thread, sizeof set, &set) == 0;
+    // Each Linux thread has its own nice value, addressed by the kernel thread ID
+    return setpriority(PRIO_PROCESS, (id_t)nativeID, niceValues[cls]) == 0 && success;
+    #else
+    return false;
+    #endif
+}
+
+/// Return the current thread's operating system ID.
+static long CurrentNativeID()
+{
+    #ifdef _WIN32
+    return (long)GetCurrentThreadId();
+    #elif defined(__linux__)
+    return (long)syscall(SYS_gettid);
+    #else
+    return 1;
+    #endif
+}
+
+/// Startup of a thread before its thread function.
+struct ThreadStartup
+{
+    /// Publish the thread's operating system ID and apply its scheduling. Setting the scheduling from another thread applies it directly once the ID is published, so either that or this sees the latest values.
+    static void Begin(Thread* thread)
+    {
+        thread->nativeID.store(CurrentNativeID());
+        SchedulingClass cls = thread->GetSchedulingClass();
+        AffinityMask mask = thread->Affinity();
+        if (cls != SCHEDULE_NORMAL || mask)
+            Thread::SetCurrentThreadScheduling(cls, mask);
+    }
+
+    /// Clear the operating system ID after the thread function.
+    static void End(Thread* thread)
+    {
+        thread->nativeID.store(0);
+    }
+};
+
 #ifdef _WIN32
 DWORD WINAPI ThreadFunctionStatic(void* data)
 {
     Thread* thread = static_cast<Thread*>(data);
+    ThreadStartup::Begin(thread);
     thread->ThreadFunction();
+    ThreadStartup::End(thread);
     return 0;
 }
 #else
 void* ThreadFunctionStatic(void* data)
 {
     Thread* thread = static_cast<Thread*>(data);
+    ThreadStartup::Begin(thread);
     thread->ThreadFunction();
+    ThreadStartup::End(thread);
     pthread_exit(nullptr);
     return nullptr;
 }
@@ -29,7 +119,10 @@ ThreadID Thread::mainThreadID = Thread::CurrentThreadID();
 
 Thread::Thread() :
     handle(nullptr),
-    shouldRun(false)
+    shouldRun(false),
+    schedulingClass(SCHEDULE_NORMAL),
+    affinity(0),
+    nativeID(0)
 {
 }
 
@@ -89,6 +182,34 @@ void Thread::SetPriority(int priority)
     #endif
 }
 
+void Thread::SetSchedulingClass(SchedulingClass cls)
+{
+    schedulingClass.store(cls);
+    long id = nativeID.load();
+    if (handle && id)
+    {
+        #ifdef _WIN32
+        ApplyScheduling((HANDLE)handle, id, cls, affinity.load());
+        #else
+        ApplyScheduling(*(pthread_t*)handle, id, cls, affinity.load());
+        #endif
+    }
+}
+
+void Thread::SetAffinity(AffinityMask mask)
+{
+    affinity.store(mask);
+    long id = nativeID.load();
+    if (handle && id)
+    {
+        #ifdef _WIN32
+        ApplyScheduling((HANDLE)handle, id, GetSchedulingClass(), mask);
+        #else
+        ApplyScheduling(*(pthread_t*)handle, id, GetSchedulingClass(), mask);
+        #endif
+    }
+}
+
 void Thread::Sleep(unsigned mSec)
 {
     #ifdef _WIN32
@@ -116,3 +237,12 @@ bool Thread::IsMainThread()
 {
     return CurrentThreadID() == mainThreadID;
 }
+
+bool Thread::SetCurrentThreadScheduling(SchedulingClass cls, AffinityMask mask)
+{
+    #ifdef _WIN32
+    return ApplyScheduling(GetCurrentThread(), CurrentNativeID(), cls, mask);
+    #else
+    return ApplyScheduling(pthread_self(), CurrentNativeID(), cls, mask);
+    #endif
+}
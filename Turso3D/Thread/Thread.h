@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #ifndef WIN32
 #include <pthread.h>
 #endif
@@ -12,9 +14,25 @@ typedef pthread_t ThreadID;
 typedef unsigned ThreadID;
 #endif
 
+/// Mask of logical processors by their operating system index. Zero means no restriction.
+typedef unsigned long long AffinityMask;
+
+/// %Thread scheduling class, which selects the priority and the preferred cores.
+enum SchedulingClass
+{
+    /// Default priority on any core.
+    SCHEDULE_NORMAL = 0,
+    /// Raised priority on the performance cores of a hybrid CPU, for work that the frame waits on. Raising the priority may require privileges and is skipped without them.
+    SCHEDULE_CRITICAL,
+    /// Lowered priority on the efficiency cores of a hybrid CPU, for work such as background loading and logging.
+    SCHEDULE_BACKGROUND
+};
+
 /// Operating system thread.
 class Thread
 {
+    friend struct ThreadStartup;
+
 public:
     /// Construct. Does not start the thread yet.
     Thread();
@@ -30,9 +48,17 @@ public:
     void Stop();
     /// Set thread priority. The thread must have been started first.
     void SetPriority(int priority);
+    /// Set scheduling class. Can be called before or after starting the thread.
+    void SetSchedulingClass(SchedulingClass cls);
+    /// Set the logical processors the thread may run on, overriding the scheduling class's cores. Zero to use the scheduling class's cores. Can be called before or after starting the thread.
+    void SetAffinity(AffinityMask mask);
     
     /// Return whether thread exists.
     bool IsStarted() const { return handle != nullptr; }
+    /// Return scheduling class.
+    SchedulingClass GetSchedulingClass() const { return (SchedulingClass)schedulingClass.load(); }
+    /// Return the affinity mask set explicitly, or zero if the scheduling class's cores are used.
+    AffinityMask Affinity() const { return affinity.load(); }
 
     /// Sleep the current thread for the specified amount of milliseconds. 0 to just yield the timeslice.
     static void Sleep(unsigned mSec);
@@ -42,12 +68,20 @@ public:
     static ThreadID CurrentThreadID();
     /// Return whether is executing in the main thread.
     static bool IsMainThread();
+    /// Apply a scheduling class and affinity mask to the current thread, for threads not created through this class such as the main thread. Zero mask uses the scheduling class's cores. Return true if fully applied.
+    static bool SetCurrentThreadScheduling(SchedulingClass cls, AffinityMask mask = 0);
     
 protected:
     /// Thread handle.
     void* handle;
     /// Running flag.
     volatile bool shouldRun;
+    /// Scheduling class.
+    std::atomic<int> schedulingClass;
+    /// Explicit affinity mask.
+    std::atomic<AffinityMask> affinity;
+    /// Operating system thread ID once the thread function has started, or zero.
+    std::atomic<long> nativeID;
     
     /// Main thread's thread ID.
     static ThreadID mainThreadID;
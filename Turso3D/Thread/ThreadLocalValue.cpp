@@ -2,12 +2,66 @@
 
 #include "ThreadLocalValue.h"
 
+#include <mutex>
+#include <vector>
+
 #ifdef _WIN32
 #include <Windows.h>
 #endif
 
-ThreadLocalValue::ThreadLocalValue()
+/// Allocator of the native slots.
+struct ThreadLocalSlotAllocator
+{
+    /// Construct.
+    ThreadLocalSlotAllocator() :
+        numSlots(0),
+        lastGeneration(0)
+    {
+    }
+
+    /// Mutex for allocating.
+    std::mutex mutex;
+    /// Slots released by destroyed thread local values.
+    std::vector<unsigned> freeSlots;
+    /// Number of slots allocated so far.
+    unsigned numSlots;
+    /// Last allocated generation. Zero is never allocated, as it matches the zero-initialized slots of a new thread.
+    unsigned lastGeneration;
+};
+
+/// Return the slot allocator. Constructed on first use so that static thread local values are destroyed before it.
+static ThreadLocalSlotAllocator& SlotAllocator()
+{
+    static ThreadLocalSlotAllocator allocator;
+    return allocator;
+}
+
+ThreadLocalValue::ThreadLocalValue() :
+    slot(MAX_THREAD_LOCAL_SLOTS),
+    generation(0),
+    valid(false)
 {
+    {
+        ThreadLocalSlotAllocator& allocator = SlotAllocator();
+        std::lock_guard<std::mutex> lock(allocator.mutex);
+        if (!allocator.freeSlots.empty())
+        {
+            slot = allocator.freeSlots.back();
+            allocator.freeSlots.pop_back();
+        }
+        else if (allocator.numSlots < MAX_THREAD_LOCAL_SLOTS)
+            slot = allocator.numSlots++;
+
+        if (slot < MAX_THREAD_LOCAL_SLOTS)
+        {
+            if (!++allocator.lastGeneration)
+                ++allocator.lastGeneration;
+            generation = allocator.lastGeneration;
+            valid = true;
+            return;
+        }
+    }
+
     #ifdef _WIN32
     key = TlsAlloc();
     valid = key != TLS_OUT_OF_INDEXES;
@@ -18,7 +72,14 @@ ThreadLocalValue::ThreadLocalValue()
 
 ThreadLocalValue::~ThreadLocalValue()
 {
-    if (valid)
+    if (slot < MAX_THREAD_LOCAL_SLOTS)
+    {
+        // Values left in the slot by other threads are ignored by the next user due to the generation mismatch
+        ThreadLocalSlotAllocator& allocator = SlotAllocator();
+        std::lock_guard<std::mutex> lock(allocator.mutex);
+        allocator.freeSlots.push_back(slot);
+    }
+    else if (valid)
     {
         #ifdef _WIN32
         TlsFree(key);
@@ -28,7 +89,7 @@ ThreadLocalValue::~ThreadLocalValue()
     }
 }
 
-void ThreadLocalValue::SetValue(void* value)
+void ThreadLocalValue::SetKeyValue(void* value)
 {
     if (valid)
     {
@@ -40,7 +101,7 @@ void ThreadLocalValue::SetValue(void* value)
     }
 }
 
-void* ThreadLocalValue::Value() const
+void* ThreadLocalValue::KeyValue() const
 {
     if (valid)
     {
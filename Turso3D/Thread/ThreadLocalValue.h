@@ -12,7 +12,26 @@ typedef unsigned TLSKeyID;
 typedef pthread_key_t TLSKeyID;
 #endif
 
-/// %Thread local storage value.
+/// Number of thread local values that are stored in native thread local storage. Further values fall back to the operating system's keys.
+static const unsigned MAX_THREAD_LOCAL_SLOTS = 64;
+
+/// Native thread local storage slot of a thread local value. Plain data so that the slot array needs no initialization on thread start.
+struct ThreadLocalSlot
+{
+    /// Value set by the thread.
+    void* value;
+    /// Generation of the thread local value that set it. Values of destroyed thread local values are ignored by a mismatch.
+    unsigned generation;
+};
+
+/// Return the current thread's native thread local storage slots.
+inline ThreadLocalSlot* ThreadLocalSlots()
+{
+    static thread_local ThreadLocalSlot slots[MAX_THREAD_LOCAL_SLOTS];
+    return slots;
+}
+
+/// %Thread local storage value. The first values are stored in a native thread local array, which makes access a single thread local memory read, and the rest in operating system keys.
 class ThreadLocalValue
 {
 public:
@@ -23,16 +42,49 @@ public:
     ~ThreadLocalValue();
 
     /// Set the value.
-    void SetValue(void* value);
+    void SetValue(void* value)
+    {
+        if (slot < MAX_THREAD_LOCAL_SLOTS)
+        {
+            ThreadLocalSlot& entry = ThreadLocalSlots()[slot];
+            entry.value = value;
+            entry.generation = generation;
+        }
+        else
+            SetKeyValue(value);
+    }
 
     /// Return the value.
-    void* Value() const;
+    void* Value() const
+    {
+        if (slot < MAX_THREAD_LOCAL_SLOTS)
+        {
+            const ThreadLocalSlot& entry = ThreadLocalSlots()[slot];
+            return entry.generation == generation ? entry.value : nullptr;
+        }
+        else
+            return KeyValue();
+    }
     
     /// Return whether was successfully allocated. Returns false when the OS resources for thread local values have been exhausted.
     bool Valid() const { return valid; }
 
 private:
-    /// Key used by the OS to identify the value.
+    /// Prevent copy construction.
+    ThreadLocalValue(const ThreadLocalValue& rhs);
+    /// Prevent assignment.
+    ThreadLocalValue& operator = (const ThreadLocalValue& rhs);
+
+    /// Set the value through the operating system key.
+    void SetKeyValue(void* value);
+    /// Return the value through the operating system key.
+    void* KeyValue() const;
+
+    /// Native slot index, or MAX_THREAD_LOCAL_SLOTS if all were in use.
+    unsigned slot;
+    /// Generation stored with the value in the native slot. Unique for each thread local value that has used the slot.
+    unsigned generation;
+    /// Key used by the OS to identify the value, when not using a native slot.
     TLSKeyID key;
     /// Valid flag.
     bool valid;
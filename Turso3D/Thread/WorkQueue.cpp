@@ -0,0 +1,306 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "CPUTopology.h"
+#include "WorkQueue.h"
+
+#include <cassert>
+#include <thread>
+
+/// Number of empty polls before a worker thread goes to sleep.
+static const unsigned WORKER_SPIN_COUNT = 256;
+
+static thread_local unsigned threadIndex = 0;
+
+/// %Thread that executes tasks from a work queue.
+class WorkerThread : public Thread
+{
+public:
+    /// Construct.
+    WorkerThread(WorkQueue* owner_, unsigned index_) :
+        owner(owner_),
+        index(index_)
+    {
+    }
+
+    /// Execute tasks until the work queue shuts down.
+    void ThreadFunction() override
+    {
+        threadIndex = index;
+        owner->WorkerLoop(index);
+    }
+
+private:
+    /// Owning work queue.
+    WorkQueue* owner;
+    /// %Thread index.
+    unsigned index;
+};
+
+/// Acquire the spin lock of a task deque.
+inline void LockDeque(TaskDeque& deque)
+{
+    while (deque.lock.test_and_set(std::memory_order_acquire))
+        ;
+}
+
+/// Release the spin lock of a task deque.
+inline void UnlockDeque(TaskDeque& deque)
+{
+    deque.lock.clear(std::memory_order_release);
+}
+
+Task::Task() :
+    numDependencies(1),
+    counter(nullptr)
+{
+}
+
+Task::~Task()
+{
+}
+
+void Task::AddDependency(Task* dependency)
+{
+    assert(dependency && dependency != this);
+
+    dependency->dependentTasks.push_back(this);
+    numDependencies.fetch_add(1);
+}
+
+WorkQueue::WorkQueue(unsigned numThreads) :
+    numReadyTasks(0),
+    numPendingTasks(0),
+    numSleepingThreads(0),
+    shouldExit(false)
+{
+    RegisterSubsystem(this);
+
+    if (!numThreads)
+    {
+        numThreads = std::thread::hardware_concurrency();
+        if (numThreads)
+            --numThreads;
+    }
+
+    for (unsigned i = 0; i <= numThreads; ++i)
+        queues.push_back(new TaskDeque());
+
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        WorkerThread* thread = new WorkerThread(this, i + 1);
+        threads.push_back(thread);
+        thread->Run();
+    }
+
+    const CPUTopology& topology = CPUTopology::System();
+    LOGINFOF("Created %d worker threads on %d logical processors, %d cores, %d packages, %d NUMA nodes, %d efficiency classes", numThreads,
+        topology.NumLogicalProcessors(), topology.NumCores(), topology.NumPackages(), topology.NumNumaNodes(), topology.NumEfficiencyClasses());
+}
+
+WorkQueue::~WorkQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        shouldExit = true;
+    }
+    wakeCondition.notify_all();
+
+    // Destroying the thread objects waits for them to finish
+    threads.clear();
+    queues.clear();
+
+    RemoveSubsystem(this);
+}
+
+void WorkQueue::SetSchedulingClass(SchedulingClass cls)
+{
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        (*it)->SetSchedulingClass(cls);
+}
+
+void WorkQueue::SetWorkerSchedulingClass(unsigned threadIndex, SchedulingClass cls)
+{
+    if (threadIndex >= 1 && threadIndex <= threads.size())
+        threads[threadIndex - 1]->SetSchedulingClass(cls);
+}
+
+void WorkQueue::SetWorkerAffinity(unsigned threadIndex, AffinityMask mask)
+{
+    if (threadIndex >= 1 && threadIndex <= threads.size())
+        threads[threadIndex - 1]->SetAffinity(mask);
+}
+
+void WorkQueue::QueueTask(Task* task, TaskCounter* counter)
+{
+    assert(task);
+
+    task->counter = counter;
+    if (counter)
+        counter->fetch_add(1);
+    numPendingTasks.fetch_add(1);
+
+    // Release the reference held until queued. Tasks with dependencies are pushed when the last dependency completes instead
+    if (task->numDependencies.fetch_sub(1) == 1)
+        PushTask(task);
+}
+
+void WorkQueue::QueueTasks(size_t count, Task** tasks, TaskCounter* counter)
+{
+    for (size_t i = 0; i < count; ++i)
+        QueueTask(tasks[i], counter);
+}
+
+void WorkQueue::Complete()
+{
+    unsigned index = ThreadIndex();
+
+    while (numPendingTasks.load() > 0)
+    {
+        Task* task = PopTask(index);
+        if (task)
+            ExecuteTask(task, index);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void WorkQueue::Complete(TaskCounter& counter)
+{
+    unsigned index = ThreadIndex();
+
+    while (counter.load() > 0)
+    {
+        Task* task = PopTask(index);
+        if (task)
+            ExecuteTask(task, index);
+        else
+            std::this_thread::yield();
+    }
+}
+
+bool WorkQueue::TryComplete()
+{
+    unsigned index = ThreadIndex();
+
+    Task* task = PopTask(index);
+    if (task)
+        ExecuteTask(task, index);
+
+    return numPendingTasks.load() == 0;
+}
+
+unsigned WorkQueue::ThreadIndex()
+{
+    return threadIndex;
+}
+
+void WorkQueue::PushTask(Task* task)
+{
+    TaskDeque& deque = *queues[ThreadIndex()];
+
+    LockDeque(deque);
+    deque.tasks.push_back(task);
+    UnlockDeque(deque);
+
+    numReadyTasks.fetch_add(1);
+
+    // Locking the mutex before notifying ensures a worker that just decided to sleep will not miss the wakeup
+    if (numSleepingThreads.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeCondition.notify_one();
+    }
+}
+
+Task* WorkQueue::PopTask(unsigned index)
+{
+    if (numReadyTasks.load(std::memory_order_relaxed) <= 0)
+        return nullptr;
+
+    // Own queue first, newest task for cache locality
+    {
+        TaskDeque& deque = *queues[index];
+        LockDeque(deque);
+        if (!deque.tasks.empty())
+        {
+            Task* task = deque.tasks.back();
+            deque.tasks.pop_back();
+            UnlockDeque(deque);
+            numReadyTasks.fetch_sub(1);
+            return task;
+        }
+        UnlockDeque(deque);
+    }
+
+    // Then steal the oldest task from other threads
+    size_t numQueues = queues.size();
+    for (size_t i = 1; i < numQueues; ++i)
+    {
+        TaskDeque& deque = *queues[(index + i) % numQueues];
+        LockDeque(deque);
+        if (!deque.tasks.empty())
+        {
+            Task* task = deque.tasks.front();
+            deque.tasks.pop_front();
+            UnlockDeque(deque);
+            numReadyTasks.fetch_sub(1);
+            return task;
+        }
+        UnlockDeque(deque);
+    }
+
+    return nullptr;
+}
+
+void WorkQueue::ExecuteTask(Task* task, unsigned index)
+{
+    // Hold the task again until it is requeued
+    task->numDependencies.store(1, std::memory_order_relaxed);
+    task->Complete(index);
+
+    // Take the dependent list before signaling completion, as the task may be requeued or destroyed after that
+    TaskCounter* counter = task->counter;
+    std::vector<Task*> dependents;
+    dependents.swap(task->dependentTasks);
+
+    for (auto it = dependents.begin(); it != dependents.end(); ++it)
+    {
+        Task* dependent = *it;
+        if (dependent->numDependencies.fetch_sub(1) == 1)
+            PushTask(dependent);
+    }
+
+    if (counter)
+        counter->fetch_sub(1);
+    numPendingTasks.fetch_sub(1);
+}
+
+void WorkQueue::WorkerLoop(unsigned index)
+{
+    unsigned spinCount = 0;
+
+    while (!shouldExit.load())
+    {
+        Task* task = PopTask(index);
+        if (task)
+        {
+            ExecuteTask(task, index);
+            spinCount = 0;
+            continue;
+        }
+
+        if (++spinCount < WORKER_SPIN_COUNT)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        numSleepingThreads.fetch_add(1);
+        while (!shouldExit.load() && numReadyTasks.load() <= 0)
+            wakeCondition.wait(lock);
+        numSleepingThreads.fetch_sub(1);
+        spinCount = 0;
+    }
+}
@@ -0,0 +1,167 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Object.h"
+#include "Thread.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+class WorkerThread;
+
+/// Counter of unfinished tasks that can be waited on.
+typedef std::atomic<int> TaskCounter;
+
+/// Unit of work for execution by the worker threads. The task is not owned by the work queue and must stay alive until completed.
+class Task
+{
+    friend class WorkQueue;
+
+public:
+    /// Construct.
+    Task();
+    /// Destruct.
+    virtual ~Task();
+
+    /// Perform the work. Thread index is 0 for the main thread and 1 upward for the worker threads.
+    virtual void Complete(unsigned threadIndex) = 0;
+
+    /// Make this task execute only after another task has been completed. Set up the dependency before queuing either task; they may then be queued in any order. The dependency is forgotten once fulfilled.
+    void AddDependency(Task* dependency);
+
+    /// Return number of unfulfilled dependencies, plus one while the task has not been queued.
+    int NumDependencies() const { return numDependencies.load(std::memory_order_relaxed); }
+
+private:
+    /// Unfulfilled dependency count, plus one while not queued, so that a dependency completing before this task is queued does not push it.
+    std::atomic<int> numDependencies;
+    /// Tasks waiting for this task to complete.
+    std::vector<Task*> dependentTasks;
+    /// Completion counter to decrement, if any.
+    TaskCounter* counter;
+};
+
+/// %Task that calls a member function of an object.
+template <class T> class MemberFunctionTask : public Task
+{
+public:
+    typedef void (T::*WorkFunctionPtr)(Task*, unsigned);
+
+    /// Construct.
+    MemberFunctionTask(T* object_, WorkFunctionPtr function_) :
+        object(object_),
+        function(function_)
+    {
+    }
+
+    /// Call the member function.
+    void Complete(unsigned threadIndex) override
+    {
+        (object->*function)(this, threadIndex);
+    }
+
+    /// Object instance.
+    T* object;
+    /// Member function.
+    WorkFunctionPtr function;
+};
+
+/// %Task that calls a member function of an object to process a range of items.
+template <class T> class RangeTask : public MemberFunctionTask<T>
+{
+public:
+    /// Construct.
+    RangeTask(T* object_, typename MemberFunctionTask<T>::WorkFunctionPtr function_) :
+        MemberFunctionTask<T>(object_, function_),
+        start(0),
+        end(0)
+    {
+    }
+
+    /// Range start index.
+    size_t start;
+    /// Range end index (exclusive.)
+    size_t end;
+};
+
+/// %Task queue of one thread. The owning thread pushes and pops at the back, while other threads steal from the front.
+struct TaskDeque
+{
+    /// Spin lock flag.
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    /// Queued tasks.
+    std::deque<Task*> tasks;
+};
+
+/// Worker thread subsystem with work-stealing task queues. The main thread participates in task execution while it waits for completion.
+class WorkQueue : public Object
+{
+    OBJECT(WorkQueue);
+
+    friend class WorkerThread;
+
+public:
+    /// Construct and start the worker threads. Register subsystem. Zero thread count uses one thread per CPU core minus the main thread.
+    WorkQueue(unsigned numThreads = 0);
+    /// Destruct. Stop the worker threads. Any queued tasks are discarded.
+    ~WorkQueue();
+
+    /// Queue a task for execution. If the task has unfulfilled dependencies, it is held back until they complete. If a counter is given, it is incremented now and decremented once the task completes.
+    void QueueTask(Task* task, TaskCounter* counter = nullptr);
+    /// Queue several tasks for execution.
+    void QueueTasks(size_t count, Task** tasks, TaskCounter* counter = nullptr);
+    /// Execute tasks on the calling thread until all queued tasks have completed.
+    void Complete();
+    /// Execute tasks on the calling thread until the counter reaches zero.
+    void Complete(TaskCounter& counter);
+    /// Execute one task on the calling thread if available. Return true if all queued tasks have completed.
+    bool TryComplete();
+    /// Set the scheduling class of all worker threads.
+    void SetSchedulingClass(SchedulingClass cls);
+    /// Set the scheduling class of a worker thread by its thread index, 1 upward. For example a worker can be left for background loading on the efficiency cores while the rest are critical.
+    void SetWorkerSchedulingClass(unsigned threadIndex, SchedulingClass cls);
+    /// Set the logical processors a worker thread may run on by its thread index, 1 upward. Zero to use the scheduling class's cores.
+    void SetWorkerAffinity(unsigned threadIndex, AffinityMask mask);
+
+    /// Return number of worker threads, not counting the main thread.
+    unsigned NumWorkerThreads() const { return (unsigned)threads.size(); }
+    /// Return number of threads that execute tasks, including the main thread.
+    unsigned NumThreads() const { return (unsigned)threads.size() + 1; }
+    /// Return number of queued tasks that have not completed yet.
+    int NumPendingTasks() const { return numPendingTasks.load(); }
+
+    /// Return the executing thread's index: 0 for the main thread or any thread outside the work queue, 1 upward for worker threads.
+    static unsigned ThreadIndex();
+
+private:
+    /// Push a task that is ready to execute into the calling thread's queue and wake up a worker if necessary.
+    void PushTask(Task* task);
+    /// Pop a task from own queue, or steal from other threads. Return null if no tasks.
+    Task* PopTask(unsigned threadIndex);
+    /// Execute a task and release its dependent tasks.
+    void ExecuteTask(Task* task, unsigned threadIndex);
+    /// Worker thread loop.
+    void WorkerLoop(unsigned threadIndex);
+
+    /// Worker threads.
+    std::vector<AutoPtr<WorkerThread> > threads;
+    /// Per-thread task queues. Index 0 is the main thread.
+    std::vector<AutoPtr<TaskDeque> > queues;
+    /// Mutex for sleeping worker threads.
+    std::mutex sleepMutex;
+    /// Condition for waking up sleeping worker threads.
+    std::condition_variable wakeCondition;
+    /// Number of tasks that are ready to execute in the queues.
+    std::atomic<int> numReadyTasks;
+    /// Number of tasks queued and not yet completed, including held-back tasks.
+    std::atomic<int> numPendingTasks;
+    /// Number of sleeping worker threads.
+    std::atomic<int> numSleepingThreads;
+    /// Shutdown flag.
+    std::atomic<bool> shouldExit;
+};
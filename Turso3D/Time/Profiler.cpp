@@ -1,14 +1,24 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/Stream.h"
+#include "../Object/MemoryTracker.h"
 #include "../Thread/Thread.h"
+#include "../Thread/WorkQueue.h"
 #include "Profiler.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
 static const int LINE_MAX_LENGTH = 256;
 static const int NAME_MAX_LENGTH = 30;
 
+/// Compare thread contexts for output in work queue thread order.
+static bool CompareThreads(const ProfilerThread* lhs, const ProfilerThread* rhs)
+{
+    return lhs->workerIndex < rhs->workerIndex;
+}
+
 ProfilerBlock::ProfilerBlock(ProfilerBlock* parent_, const char* name_) :
     name(name_),
     parent(parent_),
@@ -39,10 +49,14 @@ void ProfilerBlock::Begin()
 
 void ProfilerBlock::End()
 {
-    long long currentTime = timer.ElapsedUSec();
-    if (currentTime > maxTime)
-        maxTime = currentTime;
-    time += currentTime;
+    AddTime(timer.ElapsedTicks());
+}
+
+void ProfilerBlock::AddTime(long long ticks)
+{
+    if (ticks > maxTime)
+        maxTime = ticks;
+    time += ticks;
 }
 
 void ProfilerBlock::EndFrame()
@@ -97,11 +111,97 @@ ProfilerBlock* ProfilerBlock::FindOrCreateChild(const char* name_)
     return newBlock;
 }
 
+ProfilerThread::ProfilerThread(unsigned workerIndex_) :
+    workerIndex(workerIndex_),
+    events(PROFILER_EVENT_BUFFER_SIZE),
+    writeIndex(0),
+    readIndex(0),
+    openBlocks(0),
+    droppedDepth(0),
+    droppedBlocks(0)
+{
+    root = new ProfilerBlock(nullptr, "Root");
+    current = root;
+}
+
+void ProfilerThread::RecordEvent(const char* name, long long time)
+{
+    size_t write = writeIndex.load(std::memory_order_relaxed);
+
+    if (name)
+    {
+        // Begin only if there is room for the end events of this and the open blocks
+        size_t used = write - readIndex.load(std::memory_order_acquire);
+        if (droppedDepth || used + openBlocks + 2 > PROFILER_EVENT_BUFFER_SIZE)
+        {
+            ++droppedDepth;
+            droppedBlocks.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ++openBlocks;
+    }
+    else
+    {
+        if (droppedDepth)
+        {
+            --droppedDepth;
+            return;
+        }
+        if (!openBlocks)
+            return;
+        --openBlocks;
+    }
+
+    ProfilerEvent& event = events[write & (PROFILER_EVENT_BUFFER_SIZE - 1)];
+    event.name = name;
+    event.time = time;
+    writeIndex.store(write + 1, std::memory_order_release);
+}
+
+void ProfilerThread::ProcessEvents(std::vector<TraceEvent>* trace)
+{
+    size_t read = readIndex.load(std::memory_order_relaxed);
+    size_t write = writeIndex.load(std::memory_order_acquire);
+
+    for (; read != write; ++read)
+    {
+        const ProfilerEvent& event = events[read & (PROFILER_EVENT_BUFFER_SIZE - 1)];
+        if (trace)
+        {
+            TraceEvent traceEvent;
+            traceEvent.name = event.name;
+            traceEvent.time = event.time;
+            traceEvent.duration = 0;
+            traceEvent.thread = workerIndex;
+            traceEvent.type = event.name ? TRACE_BEGIN : TRACE_END;
+            trace->push_back(traceEvent);
+        }
+
+        if (event.name)
+        {
+            current = current->FindOrCreateChild(event.name);
+            ++current->count;
+            beginTimes.push_back(event.time);
+        }
+        else if (current != root)
+        {
+            current->AddTime(event.time - beginTimes.back());
+            beginTimes.pop_back();
+            current = current->parent;
+        }
+    }
+
+    readIndex.store(read, std::memory_order_release);
+}
+
 Profiler::Profiler() :
     intervalFrames(0),
-    totalFrames(0)
+    totalFrames(0),
+    maxTraceEvents(0),
+    capturing(false)
 {
     root = new ProfilerBlock(nullptr, "Root");
+    gpuRoot = new ProfilerBlock(nullptr, "Root");
     current = root;
     RegisterSubsystem(this);
 }
@@ -113,23 +213,34 @@ Profiler::~Profiler()
 
 void Profiler::BeginBlock(const char* name)
 {
-    // Currently profiling is a no-op if attempted from outside main thread
     if (!Thread::IsMainThread())
+    {
+        ThreadContext()->RecordEvent(name, eventTimer.ElapsedTicks());
         return;
+    }
     
     current = current->FindOrCreateChild(name);
     current->Begin();
+
+    if (capturing)
+        AddTraceEvent(name, TRACE_BEGIN);
 }
 
 void Profiler::EndBlock()
 {
     if (!Thread::IsMainThread())
+    {
+        ThreadContext()->RecordEvent(nullptr, eventTimer.ElapsedTicks());
         return;
+    }
     
     if (current != root)
     {
         current->End();
         current = current->parent;
+
+        if (capturing)
+            AddTraceEvent(nullptr, TRACE_END);
     }
 }
 
@@ -138,6 +249,9 @@ void Profiler::BeginFrame()
     // End the previous frame if any
     EndFrame();
 
+    if (capturing)
+        AddTraceEvent("Frame", TRACE_FRAME);
+
     BeginBlock("RunFrame");
 }
 
@@ -149,14 +263,137 @@ void Profiler::EndFrame()
         ++intervalFrames;
         ++totalFrames;
         root->EndFrame();
+        gpuRoot->EndFrame();
         current = root;
+
+        // Blocks still open in the other threads are accounted to the frame they end in
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (auto it = threads.begin(); it != threads.end(); ++it)
+        {
+            (*it)->ProcessEvents(capturing ? &trace : nullptr);
+            (*it)->root->EndFrame();
+        }
+
+        // The memory allocation counts are per frame as well
+        MemoryEndFrame();
+        if (capturing)
+            AddMemoryCounters();
+
+        if (capturing && trace.size() >= maxTraceEvents)
+            EndCapture();
     }
 }
 
 void Profiler::BeginInterval()
 {
     root->BeginInterval();
+    gpuRoot->BeginInterval();
     intervalFrames = 0;
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        (*it)->root->BeginInterval();
+}
+
+void Profiler::BeginCapture(size_t maxEvents)
+{
+    trace.clear();
+    maxTraceEvents = maxEvents;
+    capturing = true;
+}
+
+void Profiler::EndCapture()
+{
+    capturing = false;
+}
+
+void Profiler::AddGPUBlock(const char* name, long long beginTime, long long endTime)
+{
+    // The blocks that ended before this began are not its parents
+    while (gpuOpenBlocks.size() && gpuOpenEndTimes.back() <= beginTime)
+    {
+        gpuOpenBlocks.pop_back();
+        gpuOpenEndTimes.pop_back();
+    }
+
+    ProfilerBlock* parent = gpuOpenBlocks.size() ? gpuOpenBlocks.back() : gpuRoot.Get();
+    ProfilerBlock* block = parent->FindOrCreateChild(name);
+    ++block->count;
+    block->AddTime(endTime > beginTime ? endTime - beginTime : 0);
+    gpuOpenBlocks.push_back(block);
+    gpuOpenEndTimes.push_back(endTime);
+
+    if (!capturing)
+        return;
+
+    // The GPU blocks are collected in the order they began, not ended, so record them whole
+    TraceEvent traceEvent;
+    traceEvent.name = name;
+    traceEvent.time = beginTime;
+    traceEvent.duration = endTime > beginTime ? endTime - beginTime : 0;
+    traceEvent.thread = TRACE_GPU_THREAD;
+    traceEvent.type = TRACE_COMPLETE;
+    trace.push_back(traceEvent);
+}
+
+bool Profiler::SaveTrace(Stream& dest) const
+{
+    std::string output("{\"traceEvents\":[\n");
+    char line[LINE_MAX_LENGTH];
+
+    // Name the threads first
+    sprintf(line, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"Main thread\"}},\n");
+    output += line;
+    sprintf(line, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", TRACE_GPU_THREAD);
+    output += line;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (auto it = threads.begin(); it != threads.end(); ++it)
+        {
+            if ((*it)->workerIndex)
+            {
+                sprintf(line, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"Worker thread %u\"}}", (*it)->workerIndex,
+                    (*it)->workerIndex);
+                output += line;
+            }
+        }
+    }
+
+    // The trace format's timestamps are in microseconds. Write them with nanosecond decimals to keep short blocks apart
+    for (auto it = trace.begin(); it != trace.end(); ++it)
+    {
+        double time = HiresTimer::TicksToNSec(it->time) * 0.001;
+
+        switch (it->type)
+        {
+        case TRACE_BEGIN:
+            sprintf(line, ",\n{\"name\":\"%s\",\"ph\":\"B\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}", it->name, it->thread, time);
+            break;
+
+        case TRACE_END:
+            sprintf(line, ",\n{\"ph\":\"E\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}", it->thread, time);
+            break;
+
+        case TRACE_COMPLETE:
+            sprintf(line, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", it->name, it->thread, time,
+                HiresTimer::TicksToNSec(it->duration) * 0.001);
+            break;
+
+        case TRACE_FRAME:
+            sprintf(line, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":%u,\"ts\":%.3f}", it->name, it->thread, time);
+            break;
+
+        case TRACE_COUNTER:
+            sprintf(line, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"args\":{\"MB\":%.3f}}", it->name, it->thread, time,
+                it->duration / (1024.0 * 1024.0));
+            break;
+        }
+
+        output += line;
+    }
+
+    output += "\n]}\n";
+    return dest.Write(output.data(), output.length()) == output.length();
 }
 
 std::string Profiler::OutputResults(bool showUnused, bool showTotal, size_t maxDepth) const
@@ -176,9 +413,114 @@ std::string Profiler::OutputResults(bool showUnused, bool showTotal, size_t maxD
 
     OutputResults(root, output, 0, maxDepth, showUnused, showTotal);
 
+    // The GPU blocks are reported a few frames late, so their last frame values lag behind
+    if (gpuRoot->children.size())
+    {
+        output += "\nGPU\n\n";
+        OutputResults(gpuRoot, output, 0, maxDepth, showUnused, showTotal);
+    }
+
+    // The other threads' busy time is the time in their top level blocks. The rest of the main thread's frame time they were idle
+    long long mainTime = 0;
+    for (auto it = root->children.begin(); it != root->children.end(); ++it)
+        mainTime += showTotal ? (*it)->frameTime : (*it)->intervalTime;
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    std::vector<ProfilerThread*> sortedThreads;
+    for (auto it = threads.begin(); it != threads.end(); ++it)
+        sortedThreads.push_back(*it);
+    std::sort(sortedThreads.begin(), sortedThreads.end(), CompareThreads);
+
+    for (auto it = sortedThreads.begin(); it != sortedThreads.end(); ++it)
+    {
+        const ProfilerThread* thread = *it;
+        long long busyTime = 0;
+        for (auto childIt = thread->root->children.begin(); childIt != thread->root->children.end(); ++childIt)
+            busyTime += showTotal ? (*childIt)->frameTime : (*childIt)->intervalTime;
+
+        char line[LINE_MAX_LENGTH];
+        float frames = showTotal ? 1.0f : (float)Max((int)intervalFrames, 1);
+        float busy = (float)HiresTimer::TicksToMSec(busyTime) / frames;
+        float idle = mainTime ? 100.0f * Max(1.0f - (float)busyTime / (float)mainTime, 0.0f) : 0.0f;
+        if (thread->workerIndex)
+            sprintf(line, "\nWorker thread %u: busy %.3f ms per frame, idle %.1f%%", thread->workerIndex, busy, idle);
+        else
+            sprintf(line, "\nOther thread: busy %.3f ms per frame", busy);
+        output += std::string(line);
+
+        unsigned dropped = thread->droppedBlocks.load(std::memory_order_relaxed);
+        if (dropped)
+        {
+            sprintf(line, ", %u blocks dropped", dropped);
+            output += std::string(line);
+        }
+        output += "\n\n";
+
+        OutputResults(thread->root, output, 0, maxDepth, showUnused, showTotal);
+    }
+
+    // Heap categories stay at zero unless the heap allocations are tracked
+    output += "\nMemory                         Current MB   Peak MB    Allocs   Frame allocs  Frame KB\n\n";
+    for (size_t i = 0; i < MAX_MEMORY_CATEGORIES; ++i)
+    {
+        MemoryCategoryStats stats = MemoryGetStats((MemoryCategory)i);
+        if (!stats.peak && !showUnused)
+            continue;
+
+        char line[LINE_MAX_LENGTH];
+        sprintf(line, "%-30s %10.2f %9.2f %9u %14u %9.1f\n", MemoryCategoryName((MemoryCategory)i), stats.current / (1024.0f * 1024.0f),
+            stats.peak / (1024.0f * 1024.0f), (unsigned)stats.allocations, (unsigned)stats.frameAllocations, stats.frameBytes / 1024.0f);
+        output += std::string(line);
+    }
+
     return output;
 }
 
+void Profiler::AddTraceEvent(const char* name, TraceEventType type)
+{
+    TraceEvent traceEvent;
+    traceEvent.name = name;
+    traceEvent.time = eventTimer.ElapsedTicks();
+    traceEvent.duration = 0;
+    traceEvent.thread = 0;
+    traceEvent.type = type;
+    trace.push_back(traceEvent);
+}
+
+void Profiler::AddMemoryCounters()
+{
+    long long time = eventTimer.ElapsedTicks();
+    for (size_t i = 0; i < MAX_MEMORY_CATEGORIES; ++i)
+    {
+        MemoryCategoryStats stats = MemoryGetStats((MemoryCategory)i);
+        if (!stats.peak)
+            continue;
+
+        TraceEvent traceEvent;
+        traceEvent.name = MemoryCategoryName((MemoryCategory)i);
+        traceEvent.time = time;
+        traceEvent.duration = (long long)stats.current;
+        traceEvent.thread = 0;
+        traceEvent.type = TRACE_COUNTER;
+        trace.push_back(traceEvent);
+    }
+}
+
+ProfilerThread* Profiler::ThreadContext()
+{
+    ProfilerThread* context = static_cast<ProfilerThread*>(threadContext.Value());
+    if (!context)
+    {
+        context = new ProfilerThread(WorkQueue::ThreadIndex());
+        threadContext.SetValue(context);
+
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threads.push_back(context);
+    }
+
+    return context;
+}
+
 void Profiler::OutputResults(ProfilerBlock* block, std::string& output, size_t depth, size_t maxDepth, bool showUnused, bool showTotal) const
 {
     char line[LINE_MAX_LENGTH];
@@ -191,8 +533,8 @@ void Profiler::OutputResults(ProfilerBlock* block, std::string& output, size_t d
     if (depth >= maxDepth)
         return;
 
-    // Do not print the root block as it does not collect any actual data
-    if (block != root)
+    // Do not print the root blocks as they do not collect any actual data
+    if (block->parent)
     {
         if (showUnused || block->intervalCount || (showTotal && block->totalCount))
         {
@@ -204,23 +546,23 @@ void Profiler::OutputResults(ProfilerBlock* block, std::string& output, size_t d
 
             if (!showTotal)
             {
-                float avg = (block->intervalCount ? block->intervalTime / block->intervalCount : 0.0f) / 1000.0f;
-                float max = block->intervalMaxTime / 1000.0f;
-                float frame = block->intervalTime / currentInterval / 1000.0f;
-                float all = block->intervalTime / 1000.0f;
+                float avg = block->intervalCount ? (float)HiresTimer::TicksToMSec(block->intervalTime / block->intervalCount) : 0.0f;
+                float max = (float)HiresTimer::TicksToMSec(block->intervalMaxTime);
+                float frame = (float)HiresTimer::TicksToMSec(block->intervalTime / currentInterval);
+                float all = (float)HiresTimer::TicksToMSec(block->intervalTime);
 
                 sprintf(line, "%s %5u %8.3f %8.3f %8.3f %9.3f\n", indentedName, Min(block->intervalCount, 99999),
                     avg, max, frame, all);
             }
             else
             {
-                float avg = (block->frameCount ? block->frameTime / block->frameCount : 0.0f) / 1000.0f;
-                float max = block->frameMaxTime / 1000.0f;
-                float all = block->frameTime / 1000.0f;
+                float avg = block->frameCount ? (float)HiresTimer::TicksToMSec(block->frameTime / block->frameCount) : 0.0f;
+                float max = (float)HiresTimer::TicksToMSec(block->frameMaxTime);
+                float all = (float)HiresTimer::TicksToMSec(block->frameTime);
 
-                float totalAvg = (block->totalCount ? block->totalTime / block->totalCount : 0.0f) / 1000.0f;
-                float totalMax = block->totalMaxTime / 1000.0f;
-                float totalAll = block->totalTime / 1000.0f;
+                float totalAvg = block->totalCount ? (float)HiresTimer::TicksToMSec(block->totalTime / block->totalCount) : 0.0f;
+                float totalMax = (float)HiresTimer::TicksToMSec(block->totalMaxTime);
+                float totalAll = (float)HiresTimer::TicksToMSec(block->totalTime);
 
                 sprintf(line, "%s %5u %8.3f %8.3f %9.3f  %7u %9.3f %9.3f %11.3f\n", indentedName, Min(block->frameCount, 99999),
                     avg, max, all, Min(block->totalCount, 99999), totalAvg, totalMax, totalAll);
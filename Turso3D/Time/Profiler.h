@@ -4,13 +4,50 @@
 
 #include "../Math/Math.h"
 #include "../Object/Object.h"
+#include "../Thread/ThreadLocalValue.h"
 #include "Timer.h"
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 
 #define USE_PROFILER
 
-/// Profiling data for one block in the profiling tree.
+/// Number of events in a profiled thread's ring buffer. Must be a power of two.
+static const size_t PROFILER_EVENT_BUFFER_SIZE = 16384;
+/// Default maximum number of events in a trace capture.
+static const size_t DEFAULT_MAX_TRACE_EVENTS = 1000000;
+/// Trace thread index for the GPU timestamps.
+static const unsigned TRACE_GPU_THREAD = 0xffff;
+
+class Stream;
+
+/// Trace event types.
+enum TraceEventType
+{
+    TRACE_BEGIN = 0,
+    TRACE_END,
+    TRACE_FRAME,
+    TRACE_COMPLETE,
+    TRACE_COUNTER
+};
+
+/// Timestamped event of a trace capture.
+struct TraceEvent
+{
+    /// Block name. Null for block ends.
+    const char* name;
+    /// Time in timer ticks since profiler creation.
+    long long time;
+    /// Duration in timer ticks for a complete block, which is recorded as one event. Value for a counter.
+    long long duration;
+    /// Thread index: 0 for the main thread, work queue thread index, or TRACE_GPU_THREAD.
+    unsigned thread;
+    /// Event type.
+    TraceEventType type;
+};
+
+/// Profiling data for one block in the profiling tree. Times are in raw timer ticks, which are converted with HiresTimer::TicksToMSec() and the like only on output.
 class ProfilerBlock
 {
 public:
@@ -23,6 +60,8 @@ public:
     void Begin();
     /// End time measurement.
     void End();
+    /// Add the time of a call in timer ticks, when measured elsewhere.
+    void AddTime(long long ticks);
     /// Process stats at the end of frame.
     void EndFrame();
     /// Begin an interval lasting several frames.
@@ -64,7 +103,50 @@ public:
     unsigned totalCount;
 };
 
-/// Hierarchical performance profiler subsystem.
+/// Profiling block begin or end recorded by a thread other than the main thread.
+struct ProfilerEvent
+{
+    /// Block name, or null for a block end.
+    const char* name;
+    /// Time in timer ticks since profiler creation.
+    long long time;
+};
+
+/// Profiling context of a thread other than the main thread. The thread records events into a ring buffer without locking, and the main thread builds the block tree from them at the end of each frame.
+class ProfilerThread
+{
+public:
+    /// Construct.
+    ProfilerThread(unsigned workerIndex);
+
+    /// Record a block begin (name non-null) or end. Called only from the owning thread. When the buffer is full, blocks are dropped whole so that the tree stays balanced.
+    void RecordEvent(const char* name, long long time);
+    /// Build the block tree from the events recorded so far, and append them to a trace capture if non-null. Called from the main thread.
+    void ProcessEvents(std::vector<TraceEvent>* trace);
+
+    /// Work queue thread index, or 0 if not a work queue thread.
+    unsigned workerIndex;
+    /// Root block.
+    AutoPtr<ProfilerBlock> root;
+    /// Current block when processing events.
+    ProfilerBlock* current;
+    /// Begin times of the open blocks when processing events.
+    std::vector<long long> beginTimes;
+    /// Event ring buffer.
+    std::vector<ProfilerEvent> events;
+    /// Number of events written. Only the owning thread writes.
+    std::atomic<size_t> writeIndex;
+    /// Number of events processed. Only the main thread writes.
+    std::atomic<size_t> readIndex;
+    /// Blocks recorded and not yet ended. Only the owning thread uses.
+    size_t openBlocks;
+    /// Nesting depth of the blocks dropped due to a full buffer. Only the owning thread uses.
+    size_t droppedDepth;
+    /// Number of blocks dropped since start.
+    std::atomic<unsigned> droppedBlocks;
+};
+
+/// Hierarchical performance profiler subsystem. The main thread's blocks are measured directly, and each other thread gets its own block tree.
 class Profiler : public Object
 {
     OBJECT(Profiler);
@@ -85,6 +167,14 @@ public:
     void EndFrame();
     /// Begin a profiler interval.
     void BeginInterval();
+    /// Begin capturing timestamped events of all threads for a trace, discarding the previous capture. The capture stops by itself when full.
+    void BeginCapture(size_t maxEvents = DEFAULT_MAX_TRACE_EVENTS);
+    /// Stop capturing events. The captured events are kept for saving.
+    void EndCapture();
+    /// Add a block measured on the GPU, with the begin and end converted to the profiler's event time in ticks. The blocks must be added in the order they began. Nesting is determined from the times.
+    void AddGPUBlock(const char* name, long long beginTime, long long endTime);
+    /// Save the captured events as Chrome trace event JSON, which can be viewed in chrome://tracing or Perfetto. Return true on success.
+    bool SaveTrace(Stream& dest) const;
 
     /// Output results into a string.
     std::string OutputResults(bool showUnused = false, bool showTotal = false, size_t maxDepth = M_MAX_UNSIGNED) const;
@@ -92,8 +182,22 @@ public:
     const ProfilerBlock* CurrentBlock() const { return current; }
     /// Return the root profiling block.
     const ProfilerBlock* RootBlock() const { return root; }
+    /// Return the root GPU profiling block.
+    const ProfilerBlock* GPURootBlock() const { return gpuRoot; }
+    /// Return whether is capturing events.
+    bool IsCapturing() const { return capturing; }
+    /// Return the captured events.
+    const std::vector<TraceEvent>& TraceEvents() const { return trace; }
+    /// Return current time in timer ticks since profiler creation, used for the event times.
+    long long EventTime() const { return eventTimer.ElapsedTicks(); }
 
 private:
+    /// Return the calling thread's context, creating it on first use. Not used for the main thread.
+    ProfilerThread* ThreadContext();
+    /// Add a main thread event to the trace capture.
+    void AddTraceEvent(const char* name, TraceEventType type);
+    /// Add the memory category counters to the trace capture.
+    void AddMemoryCounters();
     /// Output results recursively.
     void OutputResults(ProfilerBlock* block, std::string& output, size_t depth, size_t maxDepth, bool showUnused, bool showTotal) const;
 
@@ -101,10 +205,30 @@ private:
     ProfilerBlock* current;
     /// Root profiling block.
     AutoPtr<ProfilerBlock> root;
+    /// Root GPU profiling block.
+    AutoPtr<ProfilerBlock> gpuRoot;
+    /// Open GPU blocks when adding.
+    std::vector<ProfilerBlock*> gpuOpenBlocks;
+    /// End times of the open GPU blocks.
+    std::vector<long long> gpuOpenEndTimes;
     /// Frames in the current interval.
     size_t intervalFrames;
     /// Total frames since start.
     size_t totalFrames;
+    /// Timer for the event times.
+    mutable HiresTimer eventTimer;
+    /// The calling thread's context.
+    ThreadLocalValue threadContext;
+    /// Contexts of the threads other than the main thread.
+    std::vector<AutoPtr<ProfilerThread> > threads;
+    /// Mutex for the thread contexts.
+    mutable std::mutex threadsMutex;
+    /// Captured trace events.
+    std::vector<TraceEvent> trace;
+    /// Maximum number of events in the trace capture.
+    size_t maxTraceEvents;
+    /// Capturing flag.
+    bool capturing;
 };
 
 /// Helper class for automatically beginning and ending a profiling block
@@ -15,9 +15,12 @@
 
 std::string TimeStamp()
 {
-    time_t sysTime;
-    time(&sysTime);
+    return TimeStamp(CurrentTime());
+}
 
+std::string TimeStamp(unsigned time)
+{
+    time_t sysTime = (time_t)time;
     std::string ret(ctime(&sysTime));
     return Replace(ret, "\n", "");
 }
@@ -6,5 +6,7 @@
 
 /// Return a date/time stamp as a string.
 std::string TimeStamp();
+/// Return a date/time stamp of a time in seconds since epoch as a string.
+std::string TimeStamp(unsigned time);
 /// Return current time as seconds since epoch.
 unsigned CurrentTime();
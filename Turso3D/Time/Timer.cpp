@@ -10,6 +10,18 @@
 #else
 #include <sys/time.h>
 #include <unistd.h>
+#if defined(__i386__) || defined(__x86_64__)
+#define TURSO3D_TSC
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#endif
+
+#ifdef TURSO3D_TSC
+/// CPUID 0x80000007 EDX bit of the invariant timestamp counter.
+static const unsigned INVARIANT_TSC_BIT = 1 << 8;
+/// Time in nanoseconds to measure the timestamp counter frequency at startup.
+static const long long TSC_CALIBRATION_NSEC = 2000000;
 #endif
 
 /// \cond PRIVATE
@@ -36,7 +48,10 @@ public:
 static TimerInitializer initializer;
 
 bool HiresTimer::supported = false;
+bool HiresTimer::timestampCounter = false;
 long long HiresTimer::frequency = 1000;
+double HiresTimer::usecPerTick = 1000.0;
+double HiresTimer::nsecPerTick = 1000000.0;
 
 Timer::Timer()
 {
@@ -74,47 +89,48 @@ HiresTimer::HiresTimer()
 
 long long HiresTimer::ElapsedUSec()
 {
-    long long currentTime;
-    
-    #ifdef _WIN32
-    if (supported)
-    {
-        LARGE_INTEGER counter;
-        QueryPerformanceCounter(&counter);
-        currentTime = counter.QuadPart;
-    }
-    else
-        currentTime = timeGetTime();
-    #else
-    struct timeval time;
-    gettimeofday(&time, 0);
-    currentTime = time.tv_sec * 1000000LL + time.tv_usec;
-    #endif
-    
-    long long elapsedTime = currentTime - startTime;
+    long long elapsedTime = Ticks() - startTime;
     
     // Correct for possible weirdness with changing internal frequency
     if (elapsedTime < 0)
         elapsedTime = 0;
     
-    return (elapsedTime * 1000000LL) / frequency;
+    return TicksToUSec(elapsedTime);
+}
+
+long long HiresTimer::ElapsedNSec()
+{
+    long long elapsedTime = Ticks() - startTime;
+    if (elapsedTime < 0)
+        elapsedTime = 0;
+
+    return TicksToNSec(elapsedTime);
 }
 
 void HiresTimer::Reset()
+{
+    startTime = Ticks();
+}
+
+long long HiresTimer::Ticks()
 {
     #ifdef _WIN32
     if (supported)
     {
         LARGE_INTEGER counter;
         QueryPerformanceCounter(&counter);
-        startTime = counter.QuadPart;
+        return counter.QuadPart;
     }
     else
-        startTime = timeGetTime();
+        return timeGetTime();
     #else
-    struct timeval time;
-    gettimeofday(&time, 0);
-    startTime = time.tv_sec * 1000000LL + time.tv_usec;
+    #ifdef TURSO3D_TSC
+    if (timestampCounter)
+        return (long long)__rdtsc();
+    #endif
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
     #endif
 }
 
@@ -128,7 +144,33 @@ void HiresTimer::Initialize()
         supported = true;
     }
     #else
-    frequency = 1000000;
+    frequency = 1000000000LL;
     supported = true;
+
+    #ifdef TURSO3D_TSC
+    // Use the timestamp counter only if it runs at a constant rate regardless of power states
+    unsigned eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) && eax >= 0x80000007 && __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) &&
+        (edx & INVARIANT_TSC_BIT))
+    {
+        // Calibrate against the monotonic clock by busy-waiting a short while
+        long long clockStart = Ticks();
+        long long counterStart = (long long)__rdtsc();
+        long long clockEnd;
+        do
+            clockEnd = Ticks();
+        while (clockEnd - clockStart < TSC_CALIBRATION_NSEC);
+        long long counterEnd = (long long)__rdtsc();
+
+        if (counterEnd > counterStart)
+        {
+            frequency = (long long)((double)(counterEnd - counterStart) * 1000000000.0 / (double)(clockEnd - clockStart));
+            timestampCounter = true;
+        }
+    }
     #endif
+    #endif
+
+    usecPerTick = 1000000.0 / (double)frequency;
+    nsecPerTick = 1000000000.0 / (double)frequency;
 }
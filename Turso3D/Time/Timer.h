@@ -19,7 +19,7 @@ private:
     unsigned startTime;
 };
 
-/// High-resolution operating system timer used in profiling.
+/// High-resolution timer used in profiling. Reads raw ticks from the invariant CPU timestamp counter when available, otherwise from the operating system's performance counter or monotonic clock. The tick frequency is calibrated once at program start.
 class HiresTimer
 {
 public:
@@ -28,22 +28,44 @@ public:
 
     /// Return elapsed microseconds.
     long long ElapsedUSec();
+    /// Return elapsed nanoseconds.
+    long long ElapsedNSec();
+    /// Return elapsed ticks.
+    long long ElapsedTicks() { return Ticks() - startTime; }
     /// Reset the timer.
     void Reset();
 
-    /// Perform one-time initialization to check support and frequency. Is called automatically at program start.
+    /// Perform one-time initialization to check support and calibrate the frequency. Is called automatically at program start.
     static void Initialize();
+    /// Return the current raw tick value. Only differences of tick values are meaningful.
+    static long long Ticks();
+    /// Convert ticks to microseconds.
+    static long long TicksToUSec(long long ticks) { return (long long)(ticks * usecPerTick); }
+    /// Convert ticks to nanoseconds.
+    static long long TicksToNSec(long long ticks) { return (long long)(ticks * nsecPerTick); }
+    /// Convert ticks to fractional milliseconds.
+    static double TicksToMSec(long long ticks) { return ticks * usecPerTick * 0.001; }
+    /// Convert nanoseconds to ticks.
+    static long long NSecToTicks(long long nsec) { return (long long)(nsec / nsecPerTick); }
     /// Return if high-resolution timer is supported.
     static bool IsSupported() { return supported; }
-    /// Return high-resolution timer frequency if supported.
+    /// Return whether the ticks are read from the CPU timestamp counter.
+    static bool IsTimestampCounter() { return timestampCounter; }
+    /// Return tick frequency per second.
     static long long Frequency() { return frequency; }
 
 private:
-    /// Starting clock value in CPU ticks.
+    /// Starting clock value in ticks.
     long long startTime;
 
     /// High-resolution timer support flag.
     static bool supported;
-    /// High-resolution timer frequency.
+    /// CPU timestamp counter flag.
+    static bool timestampCounter;
+    /// Tick frequency per second.
     static long long frequency;
+    /// Microseconds per tick.
+    static double usecPerTick;
+    /// Nanoseconds per tick.
+    static double nsecPerTick;
 };
@@ -1,57 +1,290 @@
 #include "Graphics/FrameBuffer.h"
+#include "Graphics/GPUProfiler.h"
 #include "Graphics/Graphics.h"
+#include "Graphics/ShaderProgram.h"
 #include "Graphics/Texture.h"
 #include "Input/Input.h"
 #include "IO/Arguments.h"
+#include "IO/File.h"
 #include "IO/FileSystem.h"
 #include "IO/Log.h"
 #include "IO/StringUtils.h"
 #include "Math/Math.h"
 #include "Math/Random.h"
+#include "Object/EventQueue.h"
+#include "Object/MemoryTracker.h"
 #include "Renderer/Camera.h"
+#include "Renderer/DebugRenderer.h"
 #include "Renderer/Light.h"
 #include "Renderer/Material.h"
 #include "Renderer/Model.h"
 #include "Renderer/Octree.h"
+#include "Renderer/DecalSet.h"
+#include "Renderer/IrradianceVolume.h"
+#include "Renderer/ReflectionProbe.h"
+#include "Renderer/ReflectionProbeUpdater.h"
+#include "Renderer/RenderGraph.h"
 #include "Renderer/Renderer.h"
+#include "Resource/Image.h"
+#include "Resource/JSONFile.h"
 #include "Resource/ResourceCache.h"
+#include "Renderer/StaticBatch.h"
 #include "Renderer/StaticModel.h"
+#include "Renderer/Terrain.h"
+#include "Renderer/TextureStreamer.h"
 #include "Scene/Scene.h"
+#include "Thread/Coroutine.h"
+#include "Thread/WorkQueue.h"
 #include "Time/Timer.h"
 #include "Time/Profiler.h"
 
 #include <SDL.h>
+#include <algorithm>
+#include <cstring>
 #include <glew.h>
 
-void CreateScene(Scene* scene, int preset)
+/// Default number of measured frames in benchmark mode.
+static const unsigned DEFAULT_BENCHMARK_FRAMES = 1000;
+/// Frames rendered before measuring in benchmark mode, so that resources are loaded and the reused buffers have grown.
+static const unsigned BENCHMARK_WARMUP_FRAMES = 60;
+/// Mip levels of the half-resolution linear depth pyramid for compute SSAO.
+static const size_t SSAO_DEPTH_LEVELS = 4;
+/// Thread group size of the compute SSAO depth and occlusion passes.
+static const int SSAO_GROUP_SIZE = 8;
+/// Thread group length of the compute SSAO bilateral blur passes.
+static const int SSAO_BLUR_GROUP_SIZE = 64;
+
+/// Camera position and rotation on a recorded camera path.
+struct CameraKey
+{
+    /// Position.
+    Vector3 position;
+    /// Rotation.
+    Quaternion rotation;
+};
+
+/// Key state change during a captured frame.
+struct CaptureKey
+{
+    /// Key code.
+    unsigned keyCode;
+    /// New state, pressed or released.
+    ButtonState state;
+};
+
+/// Frame of a captured session, replayed with -replay.
+struct CaptureFrame
+{
+    /// Camera position.
+    Vector3 position;
+    /// Camera rotation.
+    Quaternion rotation;
+    /// Animation time of the dynamic objects.
+    float animationTime;
+    /// Frame time in microseconds when captured.
+    unsigned frameTime;
+    /// Key presses and releases of the frame, for the scene and rendering option changes.
+    std::vector<CaptureKey> keys;
+};
+
+/// Parameters of the generated stress scene, scene preset 2.
+struct StressSceneParams
+{
+    /// Construct with defaults.
+    StressSceneParams() :
+        numObjects(10000),
+        dynamicRatio(0.0f),
+        numLights(100),
+        shadowRatio(0.25f),
+        numMaterials(1),
+        useLods(true)
+    {
+    }
+
+    /// Number of objects.
+    unsigned numObjects;
+    /// Fraction of the objects that move each frame.
+    float dynamicRatio;
+    /// Number of point lights.
+    unsigned numLights;
+    /// Fraction of the lights that cast shadows.
+    float shadowRatio;
+    /// Number of distinct materials per model.
+    unsigned numMaterials;
+    /// Whether to switch the mushroom LOD levels by distance. When false, the most detailed level is always drawn.
+    bool useLods;
+};
+
+/// Moving object of the stress scene.
+struct DynamicObject
+{
+    /// Object.
+    StaticModel* object;
+    /// Rest position.
+    Vector3 position;
+    /// Phase of the movement.
+    float phase;
+};
+
+/// Create material variants with different diffuse colors, so that the objects using them can not be batched together. The first is the base material itself.
+static void CreateMaterialVariants(const std::string& baseName, unsigned numMaterials, RandomGenerator& random, std::vector<SharedPtr<Material> >& dest)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    dest.clear();
+    dest.push_back(SharedPtr<Material>(cache->LoadResource<Material>(baseName)));
+
+    for (unsigned i = 1; i < numMaterials; ++i)
+    {
+        AutoPtr<Stream> source = cache->OpenResource(baseName);
+        SharedPtr<Material> material(new Material());
+        if (!source || !material->Load(*source))
+            break;
+
+        material->SetUniform(U_MATDIFFCOLOR, Vector4(0.5f + random.NextFloat() * 0.5f, 0.5f + random.NextFloat() * 0.5f, 0.5f + random.NextFloat() * 0.5f, 1.0f));
+        dest.push_back(material);
+    }
+}
+
+/// Create the stress scene objects and lights, spread at constant density so that the view contents stay comparable as the object count grows.
+static void CreateStressScene(Scene* scene, const StressSceneParams& params, std::vector<DynamicObject>& dynamicObjects)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    RandomGenerator random(1);
+
+    float areaSize = sqrtf((float)params.numObjects) * 5.0f;
+    // A dynamic object every 1 / ratio objects, spread evenly
+    unsigned dynamicInterval = params.dynamicRatio > 0.0f ? (unsigned)(1.0f / Min(params.dynamicRatio, 1.0f) + 0.5f) : 0;
+
+    std::vector<SharedPtr<Material> > boxMaterials;
+    std::vector<SharedPtr<Material> > mushroomMaterials;
+    CreateMaterialVariants("Stone.json", params.numMaterials, random, boxMaterials);
+    CreateMaterialVariants("Mushroom.json", params.numMaterials, random, mushroomMaterials);
+
+    Model* boxModel = cache->LoadResource<Model>("Box.mdl");
+    Model* mushroomModel = cache->LoadResource<Model>("Mushroom.mdl");
+
+    StaticModel* ground = scene->CreateChild<StaticModel>();
+    ground->SetStatic(true);
+    ground->SetPosition(Vector3(0.0f, -0.05f, 0.0f));
+    ground->SetScale(Vector3(areaSize, 0.1f, areaSize));
+    ground->SetModel(boxModel);
+    ground->SetMaterial(boxMaterials[0]);
+    ground->SetOccluder(true);
+
+    dynamicObjects.clear();
+
+    for (unsigned i = 0; i < params.numObjects; ++i)
+    {
+        bool isDynamic = dynamicInterval && i % dynamicInterval == 0;
+        bool isMushroom = (i & 1) != 0;
+
+        StaticModel* object = scene->CreateChild<StaticModel>();
+        object->SetStatic(!isDynamic);
+        Vector3 position(random.NextFloat() * areaSize - 0.5f * areaSize, isMushroom ? 0.0f : 0.5f, random.NextFloat() * areaSize - 0.5f * areaSize);
+        object->SetPosition(position);
+        object->SetRotation(Quaternion(0.0f, random.NextFloat() * 360.0f, 0.0f));
+        object->SetCastShadows(true);
+        object->SetMaxDistance(600.0f);
+
+        if (isMushroom)
+        {
+            object->SetScale(1.5f);
+            object->SetModel(mushroomModel);
+            object->SetMaterial(mushroomMaterials[(i >> 1) % mushroomMaterials.size()]);
+            object->SetLodBias(params.useLods ? 2.0f : M_INFINITY);
+        }
+        else
+        {
+            object->SetModel(boxModel);
+            object->SetMaterial(boxMaterials[(i >> 1) % boxMaterials.size()]);
+        }
+
+        if (isDynamic)
+        {
+            DynamicObject dynamicObject;
+            dynamicObject.object = object;
+            dynamicObject.position = position;
+            dynamicObject.phase = random.NextFloat() * M_PI * 2.0f;
+            dynamicObjects.push_back(dynamicObject);
+        }
+    }
+
+    unsigned numShadowedLights = (unsigned)(params.numLights * Clamp(params.shadowRatio, 0.0f, 1.0f) + 0.5f);
+
+    for (unsigned i = 0; i < params.numLights; ++i)
+    {
+        Light* light = scene->CreateChild<Light>();
+        light->SetStatic(true);
+        light->SetLightType(LIGHT_POINT);
+        light->SetCastShadows(i < numShadowedLights);
+        Vector3 colorVec = 2.0f * Vector3(random.NextFloat(), random.NextFloat(), random.NextFloat()).Normalized();
+        light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z));
+        light->SetRange(40.0f);
+        light->SetPosition(Vector3(random.NextFloat() * areaSize - 0.5f * areaSize, 7.0f, random.NextFloat() * areaSize - 0.5f * areaSize));
+        light->SetShadowMapSize(256);
+        light->SetShadowMaxDistance(200.0f);
+        light->SetMaxDistance(900.0f);
+    }
+}
+
+/// Move the dynamic objects of the stress scene up and down.
+static void AnimateDynamicObjects(std::vector<DynamicObject>& dynamicObjects, float time)
+{
+    PROFILE(AnimateDynamicObjects);
+
+    for (auto it = dynamicObjects.begin(); it != dynamicObjects.end(); ++it)
+        it->object->SetPosition(it->position + Vector3(0.0f, 1.0f + sinf(time + it->phase), 0.0f));
+}
+
+void CreateScene(Scene* scene, int preset, const StressSceneParams& stressParams, std::vector<DynamicObject>& dynamicObjects)
 {
     ResourceCache* cache = Object::Subsystem<ResourceCache>();
 
     scene->Clear();
     scene->CreateChild<Octree>();
+    dynamicObjects.clear();
+
+    if (preset == 2)
+        CreateStressScene(scene, stressParams, dynamicObjects);
 
     if (preset == 0)
     {
-        SetRandomSeed(1);
+        RandomGenerator random(1);
 
-        for (int y = -55; y <= 55; ++y)
+        // Gently rolling ground from a generated heightmap
+        const int heightMapSize = 1025;
+        std::vector<unsigned char> heightData(heightMapSize * heightMapSize);
+        for (int y = 0; y < heightMapSize; ++y)
         {
-            for (int x = -55; x <= 55; ++x)
+            for (int x = 0; x < heightMapSize; ++x)
             {
-                StaticModel* object = scene->CreateChild<StaticModel>();
-                object->SetStatic(true);
-                object->SetPosition(Vector3(10.5f * x, -0.05f, 10.5f * y));
-                object->SetScale(Vector3(10.0f, 0.1f, 10.0f));
-                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-                object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+                float height = 0.5f + 0.25f * sinf(x * 0.02f) * cosf(y * 0.015f) + 0.25f * sinf((x + y) * 0.005f);
+                heightData[y * heightMapSize + x] = (unsigned char)Clamp((int)(height * 255.0f), 0, 255);
             }
         }
 
+        SharedPtr<Image> heightMap(new Image());
+        heightMap->SetSize(IntVector2(heightMapSize, heightMapSize), FMT_R8);
+        heightMap->SetData(&heightData[0]);
+
+        Terrain* terrain = scene->CreateChild<Terrain>();
+        terrain->SetStatic(true);
+        terrain->SetPosition(Vector3(0.0f, -4.0f, 0.0f));
+        terrain->SetSpacing(Vector3(1.125f, 8.0f, 1.125f));
+        terrain->SetTexture(cache->LoadResource<Texture>("StoneDiffuse.dds"));
+        terrain->SetTextureRepeat(100.0f);
+        terrain->SetCastShadows(true);
+        terrain->SetHeightMap(heightMap);
+
         for (unsigned i = 0; i < 10000; ++i)
         {
             StaticModel* object = scene->CreateChild<StaticModel>();
             object->SetStatic(true);
-            object->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 0.0f, Random() * 1000.0f - 500.0f));
+            Vector3 position(random.NextFloat() * 1000.0f - 500.0f, 0.0f, random.NextFloat() * 1000.0f - 500.0f);
+            position.y = terrain->GetHeight(position);
+            object->SetPosition(position);
             object->SetScale(1.5f);
             object->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
             object->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
@@ -66,10 +299,12 @@ void CreateScene(Scene* scene, int preset)
             light->SetStatic(true);
             light->SetLightType(LIGHT_POINT);
             light->SetCastShadows(true);
-            Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
+            Vector3 colorVec = 2.0f * Vector3(random.NextFloat(), random.NextFloat(), random.NextFloat()).Normalized();
             light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z));
             light->SetRange(40.0f);
-            light->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 7.0f, Random() * 1000.0f - 500.0f));
+            Vector3 position(random.NextFloat() * 1000.0f - 500.0f, 0.0f, random.NextFloat() * 1000.0f - 500.0f);
+            position.y = terrain->GetHeight(position) + 7.0f;
+            light->SetPosition(position);
             light->SetDirection(Vector3(0.0f, -1.0f, 0.0f));
             light->SetShadowMapSize(256);
             light->SetShadowMaxDistance(200.0f);
@@ -101,29 +336,767 @@ void CreateScene(Scene* scene, int preset)
     }
 }
 
+/// Camera movement logic. In pipelined mode runs in a worker thread while the previous frame is rendered.
+class CameraLogic
+{
+public:
+    /// Construct.
+    CameraLogic(Camera* camera_, Input* input_) :
+        camera(camera_),
+        input(input_),
+        yaw(0.0f),
+        pitch(20.0f),
+        dt(0.0f)
+    {
+    }
+
+    /// Move the camera according to the input state of the frame.
+    void Update(Task*, unsigned)
+    {
+        Rotate(input->MouseMove());
+
+        float moveSpeed = (input->KeyDown(SDLK_LSHIFT) || input->KeyDown(SDLK_RSHIFT)) ? 50.0f : 5.0f;
+
+        if (input->KeyDown(SDLK_w))
+            camera->Translate(Vector3::FORWARD * dt * moveSpeed);
+        if (input->KeyDown(SDLK_s))
+            camera->Translate(Vector3::BACK * dt * moveSpeed);
+        if (input->KeyDown(SDLK_a))
+            camera->Translate(Vector3::LEFT * dt * moveSpeed);
+        if (input->KeyDown(SDLK_d))
+            camera->Translate(Vector3::RIGHT * dt * moveSpeed);
+    }
+
+    /// Rotate the camera by a mouse movement.
+    void Rotate(const IntVector2& mouseMove)
+    {
+        yaw += mouseMove.x * 0.1f;
+        pitch += mouseMove.y * 0.1f;
+        pitch = Clamp(pitch, -90.0f, 90.0f);
+        camera->SetRotation(Quaternion(pitch, yaw, 0.0f));
+    }
+
+    /// Camera to move.
+    Camera* camera;
+    /// Input subsystem.
+    Input* input;
+    /// Yaw angle.
+    float yaw;
+    /// Pitch angle.
+    float pitch;
+    /// Frame time step.
+    float dt;
+};
+
+/// Load a camera path recorded with -recordpath. Return true on success.
+static bool LoadCameraPath(const std::string& fileName, std::vector<CameraKey>& dest)
+{
+    File file(fileName);
+    JSONFile json;
+    if (!file.IsOpen() || !json.Load(file))
+        return false;
+
+    const JSONArray& keys = json.Root().GetArray();
+    dest.clear();
+    for (auto it = keys.begin(); it != keys.end(); ++it)
+    {
+        const JSONValue& position = (*it)["position"];
+        const JSONValue& rotation = (*it)["rotation"];
+        CameraKey key;
+        key.position = Vector3((float)position[0].GetNumber(), (float)position[1].GetNumber(), (float)position[2].GetNumber());
+        key.rotation = Quaternion((float)rotation[0].GetNumber(), (float)rotation[1].GetNumber(), (float)rotation[2].GetNumber(), (float)rotation[3].GetNumber());
+        dest.push_back(key);
+    }
+
+    return !dest.empty();
+}
+
+/// Save a recorded camera path. Return true on success.
+static bool SaveCameraPath(const std::string& fileName, const std::vector<CameraKey>& keys)
+{
+    JSONFile json;
+    JSONValue& root = json.Root();
+    for (auto it = keys.begin(); it != keys.end(); ++it)
+    {
+        JSONValue key;
+        key["position"].Push(it->position.x);
+        key["position"].Push(it->position.y);
+        key["position"].Push(it->position.z);
+        key["rotation"].Push(it->rotation.w);
+        key["rotation"].Push(it->rotation.x);
+        key["rotation"].Push(it->rotation.y);
+        key["rotation"].Push(it->rotation.z);
+        root.Push(key);
+    }
+
+    File file(fileName, FILE_WRITE);
+    return file.IsOpen() && json.Save(file);
+}
+
+/// Save a captured session with the scene it started from. Return true on success.
+static bool SaveCapture(const std::string& fileName, int preset, const StressSceneParams& stressParams, const std::vector<CaptureFrame>& frames)
+{
+    File file(fileName, FILE_WRITE);
+    if (!file.IsOpen())
+        return false;
+
+    file.WriteFileID("TCAP");
+    file.Write(preset);
+    file.Write(stressParams.numObjects);
+    file.Write(stressParams.dynamicRatio);
+    file.Write(stressParams.numLights);
+    file.Write(stressParams.shadowRatio);
+    file.Write(stressParams.numMaterials);
+    file.Write(stressParams.useLods);
+
+    file.WriteVLE(frames.size());
+    for (auto it = frames.begin(); it != frames.end(); ++it)
+    {
+        file.Write(it->position);
+        file.Write(it->rotation);
+        file.Write(it->animationTime);
+        file.Write(it->frameTime);
+        file.WriteVLE(it->keys.size());
+        for (auto keyIt = it->keys.begin(); keyIt != it->keys.end(); ++keyIt)
+        {
+            file.Write(keyIt->keyCode);
+            file.Write((unsigned char)keyIt->state);
+        }
+    }
+
+    return true;
+}
+
+/// Load a session captured with -capture. Return true on success.
+static bool LoadCapture(const std::string& fileName, int& preset, StressSceneParams& stressParams, std::vector<CaptureFrame>& frames)
+{
+    File file(fileName);
+    if (!file.IsOpen() || file.ReadFileID() != "TCAP")
+        return false;
+
+    preset = file.Read<int>();
+    stressParams.numObjects = file.Read<unsigned>();
+    stressParams.dynamicRatio = file.Read<float>();
+    stressParams.numLights = file.Read<unsigned>();
+    stressParams.shadowRatio = file.Read<float>();
+    stressParams.numMaterials = file.Read<unsigned>();
+    stressParams.useLods = file.Read<bool>();
+
+    frames.resize(file.ReadVLE());
+    for (auto it = frames.begin(); it != frames.end(); ++it)
+    {
+        // A truncated capture is not replayable
+        if (file.IsEof())
+            return false;
+
+        it->position = file.Read<Vector3>();
+        it->rotation = file.Read<Quaternion>();
+        it->animationTime = file.Read<float>();
+        it->frameTime = file.Read<unsigned>();
+        it->keys.resize(file.ReadVLE());
+        for (auto keyIt = it->keys.begin(); keyIt != it->keys.end(); ++keyIt)
+        {
+            keyIt->keyCode = file.Read<unsigned>();
+            keyIt->state = (ButtonState)file.Read<unsigned char>();
+        }
+    }
+
+    return !frames.empty();
+}
+
+/// Return whether a captured key is applied on replay. Keys that change the window, presentation or tracing are left out.
+static bool IsReplayedKey(unsigned keyCode)
+{
+    return keyCode != 27 && keyCode != SDLK_f && keyCode != SDLK_v && keyCode != SDLK_t;
+}
+
+/// Create the default benchmark camera path, a circle around the scene center.
+static void DefaultCameraPath(std::vector<CameraKey>& dest)
+{
+    dest.clear();
+    for (int angle = 0; angle <= 360; angle += 30)
+    {
+        CameraKey key;
+        key.position = Vector3(75.0f * sinf(angle * M_DEGTORAD), 20.0f, -75.0f * cosf(angle * M_DEGTORAD));
+        key.rotation = Quaternion(15.0f, (float)-angle, 0.0f);
+        dest.push_back(key);
+    }
+}
+
+/// Sample a camera path at a position from 0 (start) to 1 (end).
+static CameraKey SampleCameraPath(const std::vector<CameraKey>& keys, float t)
+{
+    float keyPos = Clamp(t, 0.0f, 1.0f) * (keys.size() - 1);
+    size_t lastIndex = keys.size() - 1;
+    size_t index = (size_t)keyPos < lastIndex ? (size_t)keyPos : lastIndex;
+    size_t nextIndex = index < lastIndex ? index + 1 : lastIndex;
+    float lerp = keyPos - index;
+
+    CameraKey ret;
+    ret.position = keys[index].position.Lerp(keys[nextIndex].position, lerp);
+    ret.rotation = keys[index].rotation.Slerp(keys[nextIndex].rotation, lerp);
+    return ret;
+}
+
+/// Return number of compute thread groups to cover a size.
+static unsigned NumGroups(int size, int groupSize)
+{
+    return (unsigned)((size + groupSize - 1) / groupSize);
+}
+
+/// Return an element of the Halton low-discrepancy sequence in a prime base, for temporal jitter offsets.
+static float Halton(unsigned index, unsigned base)
+{
+    float result = 0.0f;
+    float fraction = 1.0f / base;
+    while (index)
+    {
+        result += (index % base) * fraction;
+        index /= base;
+        fraction /= base;
+    }
+    return result;
+}
+
+/// Return a profiler block's interval totals and its children as JSON.
+static JSONValue ProfilerBlockJSON(const ProfilerBlock* block, size_t numFrames)
+{
+    JSONValue ret;
+    ret["name"] = block->name;
+    ret["count"] = block->intervalCount;
+    ret["totalMs"] = HiresTimer::TicksToMSec(block->intervalTime);
+    ret["frameMs"] = numFrames ? HiresTimer::TicksToMSec(block->intervalTime) / numFrames : 0.0;
+    ret["maxMs"] = HiresTimer::TicksToMSec(block->intervalMaxTime);
+
+    for (auto it = block->children.begin(); it != block->children.end(); ++it)
+    {
+        if ((*it)->intervalCount)
+            ret["children"].Push(ProfilerBlockJSON(*it, numFrames));
+    }
+
+    return ret;
+}
+
+/// Find a profiler block by name from a block tree. Return null if not found.
+static const ProfilerBlock* FindProfilerBlock(const ProfilerBlock* block, const char* name)
+{
+    if (block->name && !strcmp(block->name, name))
+        return block;
+
+    for (auto it = block->children.begin(); it != block->children.end(); ++it)
+    {
+        const ProfilerBlock* found = FindProfilerBlock(*it, name);
+        if (found)
+            return found;
+    }
+
+    return nullptr;
+}
+
+/// Return the per-frame interval time in milliseconds of a profiler block by name, or zero if not found.
+static double ProfilerBlockFrameMs(const ProfilerBlock* root, const char* name, size_t numFrames)
+{
+    const ProfilerBlock* block = FindProfilerBlock(root, name);
+    return block && numFrames ? HiresTimer::TicksToMSec(block->intervalTime) / numFrames : 0.0;
+}
+
+/// Return render statistics as JSON.
+static JSONValue RenderStatsJSON(const RenderStats& stats)
+{
+    JSONValue ret;
+    ret["drawCalls"] = (double)stats.drawCalls;
+    ret["instancedDraws"] = (double)stats.instancedDraws;
+    ret["multiDraws"] = (double)stats.multiDraws;
+    ret["triangles"] = (double)stats.triangles;
+    ret["stateChanges"] = (double)stats.stateChanges;
+    ret["programBinds"] = (double)stats.programBinds;
+    ret["shadowViewsRendered"] = (double)stats.shadowViewsRendered;
+    ret["shadowViewsCached"] = (double)stats.shadowViewsCached;
+    ret["lights"] = (double)stats.lights;
+    return ret;
+}
+
+/// Return the time in milliseconds of a profiler block by name on the last ended frame, or zero if not found.
+static double ProfilerBlockLastFrameMs(const ProfilerBlock* root, const char* name)
+{
+    const ProfilerBlock* block = FindProfilerBlock(root, name);
+    return block ? HiresTimer::TicksToMSec(block->frameTime) : 0.0;
+}
+
+/// Return the time, view preparation stages and render statistics of a replayed frame as JSON, along with the frame time when captured.
+static JSONValue ReplayFrameJSON(long long frameTime, const CaptureFrame& captured, Profiler* profiler, const RenderStats& stats)
+{
+    JSONValue ret;
+    ret["ms"] = frameTime * 0.001;
+    ret["capturedMs"] = captured.frameTime * 0.001;
+
+    const ProfilerBlock* profilerRoot = profiler->RootBlock();
+    JSONValue& stages = ret["stagesMs"];
+    stages["CollectVisibleNodes"] = ProfilerBlockLastFrameMs(profilerRoot, "CollectVisibleNodes");
+    stages["CollectLightInteractions"] = ProfilerBlockLastFrameMs(profilerRoot, "CollectLightInteractions");
+    stages["CollectNodeBatches"] = ProfilerBlockLastFrameMs(profilerRoot, "CollectNodeBatches");
+    stages["SortNodeBatches"] = ProfilerBlockLastFrameMs(profilerRoot, "SortNodeBatches");
+    stages["Render"] = ProfilerBlockLastFrameMs(profilerRoot, "RenderShadowMaps") + ProfilerBlockLastFrameMs(profilerRoot, "RenderOpaque") +
+        ProfilerBlockLastFrameMs(profilerRoot, "RenderAlpha");
+
+    ret["renderStats"] = RenderStatsJSON(stats);
+    return ret;
+}
+
+/// Return benchmark frame time percentiles, view preparation stage and profiler block totals, and render statistics as JSON.
+static JSONValue BenchmarkResultsJSON(int preset, const StressSceneParams& stressParams, std::vector<long long> frameTimes, Profiler* profiler, const RenderStats& stats)
+{
+    JSONValue root;
+    if (frameTimes.empty())
+        return root;
+
+    std::sort(frameTimes.begin(), frameTimes.end());
+    long long totalTime = 0;
+    for (auto it = frameTimes.begin(); it != frameTimes.end(); ++it)
+        totalTime += *it;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+
+    root["preset"] = preset;
+    if (preset == 2)
+    {
+        JSONValue& scene = root["scene"];
+        scene["objects"] = stressParams.numObjects;
+        scene["dynamicRatio"] = stressParams.dynamicRatio;
+        scene["lights"] = stressParams.numLights;
+        scene["shadowRatio"] = stressParams.shadowRatio;
+        scene["materials"] = stressParams.numMaterials;
+        scene["lods"] = stressParams.useLods;
+    }
+    root["frames"] = (unsigned)frameTimes.size();
+    root["width"] = graphics->RenderWidth();
+    root["height"] = graphics->RenderHeight();
+    root["fps"] = totalTime ? 1000000.0 * frameTimes.size() / totalTime : 0.0;
+
+    JSONValue& frameTime = root["frameTimeMs"];
+    frameTime["mean"] = totalTime * 0.001 / frameTimes.size();
+    frameTime["min"] = frameTimes.front() * 0.001;
+    frameTime["p50"] = frameTimes[frameTimes.size() * 50 / 100] * 0.001;
+    frameTime["p90"] = frameTimes[frameTimes.size() * 90 / 100] * 0.001;
+    frameTime["p95"] = frameTimes[frameTimes.size() * 95 / 100] * 0.001;
+    frameTime["p99"] = frameTimes[frameTimes.size() * 99 / 100] * 0.001;
+    frameTime["max"] = frameTimes.back() * 0.001;
+
+    // The view preparation stages and the rendering, for seeing how each scales with the scene
+    const ProfilerBlock* profilerRoot = profiler->RootBlock();
+    JSONValue& stages = root["stagesMs"];
+    stages["CollectVisibleNodes"] = ProfilerBlockFrameMs(profilerRoot, "CollectVisibleNodes", frameTimes.size());
+    stages["CollectLightInteractions"] = ProfilerBlockFrameMs(profilerRoot, "CollectLightInteractions", frameTimes.size());
+    stages["CollectNodeBatches"] = ProfilerBlockFrameMs(profilerRoot, "CollectNodeBatches", frameTimes.size());
+    stages["SortNodeBatches"] = ProfilerBlockFrameMs(profilerRoot, "SortNodeBatches", frameTimes.size());
+    stages["Render"] = ProfilerBlockFrameMs(profilerRoot, "RenderShadowMaps", frameTimes.size()) + ProfilerBlockFrameMs(profilerRoot, "RenderOpaque",
+        frameTimes.size()) + ProfilerBlockFrameMs(profilerRoot, "RenderAlpha", frameTimes.size());
+
+    root["blocks"] = ProfilerBlockJSON(profilerRoot, frameTimes.size())["children"];
+    root["gpuBlocks"] = ProfilerBlockJSON(profiler->GPURootBlock(), frameTimes.size())["children"];
+
+    root["renderStats"] = RenderStatsJSON(stats);
+
+    // Counted by Graphics from the end of the warmup
+    const GraphicsStateStats& stateStats = Graphics::StateStats();
+    JSONValue& glStats = root["glStateStats"];
+    glStats["stateChanges"] = (double)stateStats.stateChanges / frameTimes.size();
+    glStats["filteredStateChanges"] = (double)stateStats.filteredStateChanges / frameTimes.size();
+    glStats["bindings"] = (double)stateStats.bindings / frameTimes.size();
+    glStats["filteredBindings"] = (double)stateStats.filteredBindings / frameTimes.size();
+
+    return root;
+}
+
+/// Scene of a benchmark run.
+struct BenchmarkConfig
+{
+    /// Scene preset.
+    int preset;
+    /// Stress scene parameters for preset 2.
+    StressSceneParams stressParams;
+};
+
+/// Create the benchmark suite, which varies one stress scene parameter at a time from a 100k object baseline, and the object count from 10k to 1M.
+static void CreateBenchmarkSuite(std::vector<BenchmarkConfig>& dest)
+{
+    BenchmarkConfig baseline;
+    baseline.preset = 2;
+    baseline.stressParams.numObjects = 100000;
+
+    dest.clear();
+
+    static const unsigned objectCounts[] = { 10000, 100000, 1000000 };
+    for (size_t i = 0; i < sizeof objectCounts / sizeof objectCounts[0]; ++i)
+    {
+        BenchmarkConfig config = baseline;
+        config.stressParams.numObjects = objectCounts[i];
+        dest.push_back(config);
+    }
+
+    static const float dynamicRatios[] = { 0.1f, 0.5f };
+    for (size_t i = 0; i < sizeof dynamicRatios / sizeof dynamicRatios[0]; ++i)
+    {
+        BenchmarkConfig config = baseline;
+        config.stressParams.dynamicRatio = dynamicRatios[i];
+        dest.push_back(config);
+    }
+
+    static const unsigned lightCounts[] = { 10, 250 };
+    for (size_t i = 0; i < sizeof lightCounts / sizeof lightCounts[0]; ++i)
+    {
+        BenchmarkConfig config = baseline;
+        config.stressParams.numLights = lightCounts[i];
+        dest.push_back(config);
+    }
+
+    static const float shadowRatios[] = { 0.0f, 1.0f };
+    for (size_t i = 0; i < sizeof shadowRatios / sizeof shadowRatios[0]; ++i)
+    {
+        BenchmarkConfig config = baseline;
+        config.stressParams.shadowRatio = shadowRatios[i];
+        dest.push_back(config);
+    }
+
+    static const unsigned materialCounts[] = { 16, 256 };
+    for (size_t i = 0; i < sizeof materialCounts / sizeof materialCounts[0]; ++i)
+    {
+        BenchmarkConfig config = baseline;
+        config.stressParams.numMaterials = materialCounts[i];
+        dest.push_back(config);
+    }
+
+    BenchmarkConfig noLods = baseline;
+    noLods.stressParams.useLods = false;
+    dest.push_back(noLods);
+}
+
+/// Stop the profiler trace capture and save it next to the executable.
+static void SaveProfilerTrace(Profiler* profiler)
+{
+    profiler->EndCapture();
+
+    File traceFile(ExecutableDir() + "Trace.json", FILE_WRITE);
+    if (traceFile.IsOpen() && profiler->SaveTrace(traceFile))
+        LOGINFO("Saved profiler trace to " + traceFile.Name());
+}
+
+/// Format rendering statistics on one line.
+static std::string RenderStatsText(const RenderStats& stats)
+{
+    return FormatString("Draws %llu (instanced %llu, multi %llu) Tris %llu States %llu Programs %llu Shadow views %llu (cached %llu) Lights %llu (cluster avg %.2f max %llu)",
+        stats.drawCalls, stats.instancedDraws, stats.multiDraws, stats.triangles, stats.stateChanges, stats.programBinds,
+        stats.shadowViewsRendered, stats.shadowViewsCached, stats.lights, stats.AverageClusterLights(), stats.maxClusterLights);
+}
+
 int ApplicationMain(std::vector<std::string> arguments)
 {
     AutoPtr<Profiler> profiler = new Profiler();
     AutoPtr<Log> log = new Log();
+    AutoPtr<EventQueue> eventQueue = new EventQueue();
+    AutoPtr<WorkQueue> workQueue = new WorkQueue();
     AutoPtr<ResourceCache> cache = new ResourceCache();
+    // Find the resource files from a manifest kept between runs, instead of checking the filesystem on each load
+    std::string manifestFile = ExecutableDir() + "ResourceManifest.bin";
+    cache->LoadManifest(manifestFile);
+    #ifdef TURSO3D_COROUTINES
+    AutoPtr<CoroutineScheduler> coroutineScheduler = new CoroutineScheduler();
+    #endif
     cache->AddResourceDir(ExecutableDir() + "Data");
+    cache->SaveManifest(manifestFile);
+
+    // In pipelined mode the logic of the next frame runs in parallel with the rendering of the prepared frame
+    bool pipelined = false;
+    // In benchmark mode a scene preset is rendered along a camera path for a fixed number of frames, and the results are saved as JSON
+    bool benchmark = false;
+    bool benchmarkSuite = false;
+    int preset = 0;
+    StressSceneParams stressParams;
+    unsigned benchmarkFrames = DEFAULT_BENCHMARK_FRAMES;
+    std::string cameraPathFile;
+    std::string recordPathFile;
+    // A captured session is replayed frame by frame in benchmark mode, with the per-frame results added to the output
+    std::string captureFile;
+    std::string replayFile;
+    std::string benchmarkOutputFile = ExecutableDir() + "Benchmark.json";
+    PresentMode presentMode = PRESENT_IMMEDIATE;
+    int maxFrameRate = 0;
+    int maxFramesInFlight = 0;
+    // Sample the call stacks of every Nth heap allocation and print the most frequent at exit. Requires TURSO3D_TRACK_HEAP_ALLOCATIONS
+    unsigned memorySampleInterval = 0;
+    // Dynamic resolution scales the view render size to hold the target GPU frame time
+    bool dynamicResolution = false;
+    float dynamicTargetTime = DEFAULT_DYNAMIC_RESOLUTION_TARGET;
+    bool sharpenUpscale = false;
+    DepthPrePassMode prePassMode = PREPASS_OFF;
+    LightingMode lightingMode = LIGHTING_FORWARD;
+    bool gpuLightCulling = false;
+    bool computeSkinning = false;
+    // Headless runs render to an offscreen EGL surface, for benchmarking on servers without a display
+    bool headless = false;
+    bool frameCoherence = true;
+    bool staticBatchCaching = false;
+    bool reverseDepth = false;
+    bool precompileShaders = false;
+    // Distant static models are replaced with baked impostors beyond this LOD distance, or never if zero
+    float impostorDistance = 0.0f;
+    // Static models sharing a material in the same octant are merged into static batches. Geometries drawn by more models than the instance limit are left to instancing, unless it is zero
+    bool mergeStaticModels = false;
+    size_t staticBatchInstances = DEFAULT_STATIC_BATCH_MAX_INSTANCES;
+    unsigned lodTriangleBudget = 0;
+    int shadedLightBudget = 0;
+    int shadowedLightBudget = 0;
+    // A reflection probe above the scene origin is captured one cubemap face per frame
+    bool reflectionProbes = false;
+    // Every other light is baked into an irradiance volume covering the scene instead of being rendered
+    bool irradianceVolume = false;
+    // Weighted OIT transparency renders at the render size divided by this and is upsampled with a depth-aware filter
+    int alphaResolutionDivisor = 1;
+    // Coarse shading rate for low contrast screen tiles of the previous frame, where supported
+    bool variableRateShading = false;
+    // Jittered projection resolved against the reprojected previous frames with motion vectors
+    bool temporalAA = false;
+    // Froxel fog lit by the cluster lights and shadow maps
+    bool volumetricFog = false;
+    // Decals scattered over the ground, applied by the opaque shaders through the light clusters
+    bool decals = false;
+    // The static shadowcasters of static lights are baked to a cache on disk, and loaded instead of rendered on later runs
+    bool bakeShadows = false;
+    // Opaque geometry renders to multisampled targets that are resolved before post-processing. Forward lighting only
+    int multisample = 1;
+    // Debug geometry drawn over the view: 1 for the octants, 2 for the light clusters, 3 for the shadow frustums
+    int debugDraw = 0;
+    // Mouse movement that arrives during the frame rotates the camera just before the view is prepared
+    bool lateLatch = false;
+    bool pinCores = false;
+
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        bool hasValue = i + 1 < arguments.size();
+
+        if (arguments[i] == "-pipelined")
+            pipelined = true;
+        else if (arguments[i] == "-benchmark")
+        {
+            benchmark = true;
+            if (hasValue && arguments[i + 1][0] != '-')
+                preset = ParseInt(arguments[++i]);
+        }
+        else if (arguments[i] == "-benchmarksuite")
+            benchmark = benchmarkSuite = true;
+        else if (arguments[i] == "-scene" && hasValue)
+            preset = ParseInt(arguments[++i]);
+        else if (arguments[i] == "-objects" && hasValue)
+            stressParams.numObjects = (unsigned)Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-dynamic" && hasValue)
+            stressParams.dynamicRatio = ParseFloat(arguments[++i]);
+        else if (arguments[i] == "-lights" && hasValue)
+            stressParams.numLights = (unsigned)Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-shadowratio" && hasValue)
+            stressParams.shadowRatio = ParseFloat(arguments[++i]);
+        else if (arguments[i] == "-materials" && hasValue)
+            stressParams.numMaterials = (unsigned)Max(ParseInt(arguments[++i]), 1);
+        else if (arguments[i] == "-nolods")
+            stressParams.useLods = false;
+        else if (arguments[i] == "-frames" && hasValue)
+            benchmarkFrames = (unsigned)Max(ParseInt(arguments[++i]), 1);
+        else if (arguments[i] == "-camerapath" && hasValue)
+            cameraPathFile = arguments[++i];
+        else if (arguments[i] == "-recordpath" && hasValue)
+            recordPathFile = arguments[++i];
+        else if (arguments[i] == "-capture" && hasValue)
+            captureFile = arguments[++i];
+        else if (arguments[i] == "-replay" && hasValue)
+        {
+            replayFile = arguments[++i];
+            benchmark = true;
+        }
+        else if (arguments[i] == "-output" && hasValue)
+            benchmarkOutputFile = arguments[++i];
+        else if (arguments[i] == "-vsync")
+            presentMode = PRESENT_VSYNC;
+        else if (arguments[i] == "-adaptivevsync")
+            presentMode = PRESENT_ADAPTIVE_VSYNC;
+        else if (arguments[i] == "-maxfps" && hasValue)
+            maxFrameRate = ParseInt(arguments[++i]);
+        else if (arguments[i] == "-framesinflight" && hasValue)
+            maxFramesInFlight = ParseInt(arguments[++i]);
+        else if (arguments[i] == "-memorysample" && hasValue)
+            memorySampleInterval = (unsigned)Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-dynamicres")
+        {
+            dynamicResolution = true;
+            if (hasValue && arguments[i + 1][0] != '-')
+                dynamicTargetTime = ParseFloat(arguments[++i]);
+        }
+        else if (arguments[i] == "-sharpen")
+            sharpenUpscale = true;
+        else if (arguments[i] == "-prepass")
+            prePassMode = PREPASS_ON;
+        else if (arguments[i] == "-autoprepass")
+            prePassMode = PREPASS_AUTO;
+        else if (arguments[i] == "-deferred")
+            lightingMode = LIGHTING_DEFERRED;
+        else if (arguments[i] == "-gpulights")
+            gpuLightCulling = true;
+        else if (arguments[i] == "-computeskinning")
+            computeSkinning = true;
+        else if (arguments[i] == "-headless")
+            headless = true;
+        else if (arguments[i] == "-debugdraw" && hasValue)
+            debugDraw = Clamp(ParseInt(arguments[++i]), 0, 3);
+        else if (arguments[i] == "-nocoherence")
+            frameCoherence = false;
+        else if (arguments[i] == "-staticcache")
+            staticBatchCaching = true;
+        else if (arguments[i] == "-reversez")
+            reverseDepth = true;
+        else if (arguments[i] == "-precompileshaders")
+            precompileShaders = true;
+        else if (arguments[i] == "-impostors" && hasValue)
+            impostorDistance = ParseFloat(arguments[++i]);
+        else if (arguments[i] == "-staticbatch")
+        {
+            mergeStaticModels = true;
+            if (hasValue && arguments[i + 1][0] != '-')
+                staticBatchInstances = (size_t)Max(ParseInt(arguments[++i]), 0);
+        }
+        else if (arguments[i] == "-tribudget" && hasValue)
+            lodTriangleBudget = (unsigned)Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-lightbudget" && hasValue)
+            shadedLightBudget = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-shadowbudget" && hasValue)
+            shadowedLightBudget = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-probes")
+            reflectionProbes = true;
+        else if (arguments[i] == "-irradiance")
+            irradianceVolume = true;
+        else if (arguments[i] == "-alphares" && hasValue)
+            alphaResolutionDivisor = ParseInt(arguments[++i]);
+        else if (arguments[i] == "-vrs")
+            variableRateShading = true;
+        else if (arguments[i] == "-temporal")
+            temporalAA = true;
+        else if (arguments[i] == "-fog")
+            volumetricFog = true;
+        else if (arguments[i] == "-decals")
+            decals = true;
+        else if (arguments[i] == "-bakeshadows")
+            bakeShadows = true;
+        else if (arguments[i] == "-msaa" && hasValue)
+            multisample = Clamp(ParseInt(arguments[++i]), 1, 16);
+        else if (arguments[i] == "-latelatch")
+            lateLatch = true;
+        else if (arguments[i] == "-pincores")
+            pinCores = true;
+    }
 
-    AutoPtr<Graphics> graphics = new Graphics("Turso3D renderer test", IntVector2(1920, 1080));
+    std::vector<CameraKey> cameraPath;
+    std::vector<BenchmarkConfig> benchmarkConfigs;
+    std::vector<CaptureFrame> replayFrames;
+    if (!replayFile.empty())
+    {
+        if (!LoadCapture(replayFile, preset, stressParams, replayFrames))
+        {
+            LOGERROR("Could not load capture " + replayFile);
+            return 1;
+        }
+
+        // The capture defines the scene and the frames
+        benchmarkSuite = false;
+        benchmarkFrames = (unsigned)replayFrames.size();
+    }
+
+    if (benchmark)
+    {
+        if (benchmarkSuite)
+            CreateBenchmarkSuite(benchmarkConfigs);
+        else
+        {
+            BenchmarkConfig config;
+            config.preset = preset;
+            config.stressParams = stressParams;
+            benchmarkConfigs.push_back(config);
+        }
+        preset = benchmarkConfigs[0].preset;
+        stressParams = benchmarkConfigs[0].stressParams;
+
+        if (cameraPathFile.empty() || !LoadCameraPath(cameraPathFile, cameraPath))
+        {
+            if (!cameraPathFile.empty())
+                LOGERROR("Could not load camera path " + cameraPathFile + ", using the default path");
+            DefaultCameraPath(cameraPath);
+        }
+
+        // The camera path replaces the interactive logic
+        pipelined = false;
+        recordPathFile.clear();
+        captureFile.clear();
+    }
+
+    // Keep the main thread and the frame's workers on the performance cores of a hybrid CPU
+    if (pinCores)
+    {
+        Thread::SetCurrentThreadScheduling(SCHEDULE_CRITICAL);
+        workQueue->SetSchedulingClass(SCHEDULE_CRITICAL);
+    }
+
+    AutoPtr<Graphics> graphics = new Graphics("Turso3D renderer test", IntVector2(1920, 1080), headless);
     if (!graphics->Initialize())
         return 1;
+    // Measure the frame rate unlimited by the display
+    if (!benchmark)
+    {
+        graphics->SetPresentMode(presentMode);
+        graphics->SetMaxFrameRate(maxFrameRate);
+    }
+    graphics->SetMaxFramesInFlight(maxFramesInFlight);
+
+    if (ShaderProgram::IsBinarySupported())
+        ShaderProgram::SetBinaryCacheDir(ExecutableDir() + "ShaderCache");
+    if (ShaderProgram::IsParallelCompileSupported())
+        ShaderProgram::SetParallelCompile(true);
+
+    // Compress PNG and JPG textures on load, caching the result
+    Texture::SetLoadCompression(true);
+    Texture::SetCompressionCacheDir(ExecutableDir() + "TextureCache");
+    Material::SetBinaryCacheDir(ExecutableDir() + "MaterialCache");
 
     AutoPtr<Input> input = new Input(graphics->Window());
 
     AutoPtr<Renderer> renderer = new Renderer();
+    GPUProfiler::SetEnabled(true);
     renderer->SetupShadowMaps(1024, 2048, FMT_D16);
+    if (bakeShadows)
+        renderer->SetShadowBakeDir(ExecutableDir() + "ShadowCache");
+    renderer->SetDynamicResolution(dynamicResolution, dynamicTargetTime);
+    renderer->SetUpscaleMode(sharpenUpscale ? UPSCALE_SHARPEN_BILINEAR : UPSCALE_BILINEAR);
+    renderer->SetDepthPrePass(prePassMode);
+    renderer->SetLightingMode(lightingMode);
+    renderer->SetGPULightCulling(gpuLightCulling);
+    renderer->SetComputeSkinning(computeSkinning);
+    renderer->SetFrameCoherence(frameCoherence);
+    renderer->SetStaticBatchCaching(staticBatchCaching);
+    renderer->SetReverseDepth(reverseDepth);
+    renderer->SetLodTriangleBudget(lodTriangleBudget);
+    renderer->SetLightBudget(shadedLightBudget, shadowedLightBudget, 0);
+    renderer->SetAlphaResolutionDivisor(alphaResolutionDivisor);
+    renderer->SetVariableRateShading(variableRateShading);
+    renderer->SetMotionVectors(temporalAA);
+    renderer->SetVolumetricFog(volumetricFog);
+    AutoPtr<DebugRenderer> debugRenderer = new DebugRenderer();
+
+    // Enable texture streaming before loading the scene
+    AutoPtr<TextureStreamer> textureStreamer = new TextureStreamer();
 
-    AutoPtr<FrameBuffer> viewFbo = new FrameBuffer();
-    AutoPtr<FrameBuffer> viewMRTFbo = new FrameBuffer();
-    AutoPtr<FrameBuffer> ssaoFbo = new FrameBuffer();
-    AutoPtr<Texture> colorBuffer = new Texture();
-    AutoPtr<Texture> normalBuffer = new Texture();
-    AutoPtr<Texture> depthStencilBuffer = new Texture();
-    AutoPtr<Texture> ssaoTexture = new Texture();
+    // Load the resources the previous run of the scene preset requested in the background, and record this run's for the next
+    std::string loadOrderFile = ExecutableDir() + "LoadOrder" + std::to_string(preset) + ".bin";
+    cache->PrefetchLoadOrder(loadOrderFile);
+    cache->SetRecordLoadOrder(true);
+
+    // The view and postprocessing targets are allocated by the render graph each frame
+    AutoPtr<RenderGraph> renderGraph = new RenderGraph();
+    bool computeSSAO = ShaderProgram::IsComputeSupported();
 
     unsigned char noiseData[4 * 4 * 4];
     for (int i = 0; i < 4 * 4; ++i)
@@ -143,29 +1116,100 @@ int ApplicationMain(std::vector<std::string> arguments)
     noiseTexture->DefineSampler(FILTER_POINT);
 
     AutoPtr<Scene> scene = new Scene();
-    CreateScene(scene, 0);
+    std::vector<DynamicObject> dynamicObjects;
+    CreateScene(scene, preset, stressParams, dynamicObjects);
+
+    AutoPtr<ReflectionProbeUpdater> probeUpdater = reflectionProbes ? new ReflectionProbeUpdater() : nullptr;
+
+    if (impostorDistance > 0.0f)
+    {
+        // Bake each model once, from the materials of the first non-occluder node using it
+        const std::vector<StaticModel*>& staticModels = scene->NodesOfType<StaticModel>();
+        for (auto it = staticModels.begin(); it != staticModels.end(); ++it)
+        {
+            StaticModel* staticModel = *it;
+            if (staticModel->GetModel() && !staticModel->HasImpostor() && !staticModel->IsOccluder())
+                renderer->BakeImpostor(staticModel, impostorDistance);
+        }
+    }
+
+    if (mergeStaticModels)
+        StaticBatch::MergeStaticModels(scene->FindChild<Octree>(), scene, staticBatchInstances);
+
+    if (precompileShaders)
+    {
+        // Link the programs the scene's materials can use in any lighting and alpha mode, filling the program binary cache
+        std::vector<Material*> materials;
+        std::vector<ShaderVariation> variations;
+        cache->ResourcesByType(materials);
+        materials.push_back(Material::DefaultMaterial());
+        Material::CollectShaderVariations(variations, materials, 0xf, SP_INSTANCEDBIT | SP_DEFERREDBIT | SP_OITBIT | (temporalAA ? SP_MOTIONBIT : 0));
+        size_t numLinked = Shader::PrecompilePrograms(variations);
+        LOGINFOF("Precompiled %u/%u shader programs", (unsigned)numLinked, (unsigned)variations.size());
+    }
 
     AutoPtr<Camera> camera = new Camera();
     camera->SetPosition(Vector3(0.0f, 20.0f, -75.0f));
+    // Reversed float depth keeps its precision with an infinite far plane
+    camera->SetInfiniteFarClip(renderer->ReverseDepth());
 
-    float yaw = 0.0f, pitch = 20.0f;
+    unsigned temporalFrame = 0;
     HiresTimer frameTimer;
     Timer profilerTimer;
-    float dt = 0.0f;
     int shadowMode = 1;
     bool drawSSAO = false;
+    bool useOcclusion = true;
+    bool useSoftwareOcclusion = false;
+    bool useStaticBVH = false;
+    bool useBindless = false;
+    bool tracing = false;
+    bool showStats = false;
+
+    CameraLogic logic(camera, input);
+    MemberFunctionTask<CameraLogic> logicTask(&logic, &CameraLogic::Update);
+    TaskCounter logicCounter(0);
+
+    renderer->SetOcclusionCulling(useOcclusion);
+    renderer->SetSoftwareOcclusion(useSoftwareOcclusion);
 
     std::string profilerOutput;
+    size_t benchmarkIndex = 0;
+    unsigned benchmarkFrame = 0;
+    std::vector<long long> benchmarkFrameTimes;
+    RenderStats benchmarkStats;
+    JSONValue benchmarkResults;
+    Timer animationTimer;
+    std::vector<CameraKey> recordedPath;
+    std::vector<CaptureFrame> capturedFrames;
+    JSONValue replayResults;
+
+    // Sample only the frames, not the loading
+    MemorySetSampleInterval(memorySampleInterval);
 
     while (!input->ShouldExit() && !input->KeyPressed(27))
     {
         frameTimer.Reset();
 
-        if (profilerTimer.ElapsedMSec() >= 1000)
+        if (benchmark)
         {
-            profilerOutput = profiler->OutputResults();
+            // The profiler interval covers the measured frames
+            if (benchmarkFrame == BENCHMARK_WARMUP_FRAMES)
+                profiler->BeginInterval();
+        }
+        else if (profilerTimer.ElapsedMSec() >= 1000)
+        {
+            RenderStats averageStats = renderer->AverageStats();
+            profilerOutput = profiler->OutputResults() + "\n" + RenderStatsText(averageStats) + "\n" + FormatString("Input latency %.2f ms\n", graphics->InputLatency());
+            if (renderer->GetDepthPrePassMode() == PREPASS_AUTO)
+                profilerOutput += FormatString("Estimated overdraw %.2f depth pre-pass %s\n", renderer->EstimatedOverdraw(), renderer->DepthPrePassActive() ? "on" : "off");
+            if (renderer->DynamicResolution())
+                profilerOutput += FormatString("Resolution scale %.2f GPU frame %.2f ms\n", renderer->ResolutionScale(), renderer->GPUFrameTime());
+            profilerOutput += FormatString("Render targets %d (%.2f MB) framebuffers %d passes culled %d\n", (int)renderGraph->NumPooledTargets(), renderGraph->PooledTargetMemory() / (1024.0f * 1024.0f), (int)renderGraph->NumFrameBuffers(), (int)renderGraph->NumCulledPasses());
             profiler->BeginInterval();
             profilerTimer.Reset();
+
+            if (showStats)
+                SDL_SetWindowTitle(graphics->Window(), RenderStatsText(averageStats).c_str());
         }
 
         profiler->BeginFrame();
@@ -174,129 +1218,709 @@ int ApplicationMain(std::vector<std::string> arguments)
 
         input->Update();
 
+        // In replay the captured frame drives the camera, the animation and the key presses, one captured frame per rendered frame regardless of the time taken. The warmup stays on the first frame
+        const CaptureFrame* replayFrame = nullptr;
+        if (!replayFrames.empty())
+        {
+            replayFrame = &replayFrames[benchmarkFrame > BENCHMARK_WARMUP_FRAMES ? benchmarkFrame - BENCHMARK_WARMUP_FRAMES : 0];
+            if (benchmarkFrame >= BENCHMARK_WARMUP_FRAMES)
+            {
+                for (auto it = replayFrame->keys.begin(); it != replayFrame->keys.end(); ++it)
+                {
+                    if (IsReplayedKey(it->keyCode))
+                        input->SetKeyState(it->keyCode, it->state);
+                }
+            }
+        }
+
+        if (input->MouseMove() != IntVector2::ZERO)
+            graphics->MarkInput();
+        eventQueue->DispatchEvents();
+        cache->UpdateAsyncLoads(2.0f);
+        #ifdef TURSO3D_COROUTINES
+        coroutineScheduler->Update();
+        #endif
+        textureStreamer->Update(2.0f);
+
         if (input->KeyPressed(SDLK_1))
         {
+            // The last mode prefilters the shadow maps, when compute shaders are supported
             ++shadowMode;
-            if (shadowMode > 2)
+            if (shadowMode > (ShaderProgram::IsComputeSupported() ? 3 : 2))
                 shadowMode = 0;
             
-            float biasMul = shadowMode > 1 ? 1.25f : 1.0f;
-            Material::SetGlobalShaderDefines("", shadowMode > 1 ? "HQSHADOW" : "");
+            float biasMul = shadowMode == 2 ? 1.25f : 1.0f;
+            Material::SetGlobalShaderDefines("", shadowMode == 2 ? "HQSHADOW" : "");
             renderer->SetShadowDepthBiasMul(biasMul, biasMul);
+            renderer->SetPrefilteredShadows(shadowMode == 3);
         }
         
         if (input->KeyPressed(SDLK_2))
             drawSSAO = !drawSSAO;
         if (input->KeyPressed(SDLK_3))
-            CreateScene(scene, 0);
+        {
+            CreateScene(scene, 0, stressParams, dynamicObjects);
+            scene->FindChild<Octree>()->SetStaticBVH(useStaticBVH);
+        }
         if (input->KeyPressed(SDLK_4))
-            CreateScene(scene, 1);
+        {
+            CreateScene(scene, 1, stressParams, dynamicObjects);
+            scene->FindChild<Octree>()->SetStaticBVH(useStaticBVH);
+        }
+        if (input->KeyPressed(SDLK_9))
+        {
+            CreateScene(scene, 2, stressParams, dynamicObjects);
+            scene->FindChild<Octree>()->SetStaticBVH(useStaticBVH);
+        }
+        if (input->KeyPressed(SDLK_5))
+        {
+            useOcclusion = !useOcclusion;
+            renderer->SetOcclusionCulling(useOcclusion);
+        }
+        if (input->KeyPressed(SDLK_6))
+        {
+            useSoftwareOcclusion = !useSoftwareOcclusion;
+            renderer->SetSoftwareOcclusion(useSoftwareOcclusion);
+        }
+        if (input->KeyPressed(SDLK_7))
+        {
+            useStaticBVH = !useStaticBVH;
+            scene->FindChild<Octree>()->SetStaticBVH(useStaticBVH);
+        }
+        if (input->KeyPressed(SDLK_8))
+        {
+            useBindless = !useBindless;
+            renderer->SetBindlessTextures(useBindless);
+            useBindless = renderer->BindlessTextures();
+        }
         if (input->KeyPressed(SDLK_f))
             graphics->SetFullscreen(!graphics->IsFullscreen());
+        if (input->KeyPressed(SDLK_p))
+            renderer->SetDepthPrePass((DepthPrePassMode)((renderer->GetDepthPrePassMode() + 1) % (PREPASS_AUTO + 1)));
+        if (input->KeyPressed(SDLK_l))
+            renderer->SetLightingMode(renderer->GetLightingMode() == LIGHTING_FORWARD ? LIGHTING_DEFERRED : LIGHTING_FORWARD);
+        if (input->KeyPressed(SDLK_g))
+            renderer->SetGPULightCulling(!renderer->GPULightCulling());
+        if (input->KeyPressed(SDLK_c) && renderer->HasSinglePassPointShadowSupport())
+            renderer->SetSinglePassPointShadows(!renderer->SinglePassPointShadows());
+        if (input->KeyPressed(SDLK_b))
+            debugDraw = (debugDraw + 1) % 4;
+        if (input->KeyPressed(SDLK_o))
+            renderer->SetAlphaMode(renderer->GetAlphaMode() == ALPHA_SORTED ? ALPHA_WEIGHTED_OIT : ALPHA_SORTED);
+        if (input->KeyPressed(SDLK_v))
+        {
+            // Cycle immediate, vertical sync and adaptive vertical sync. Skip adaptive if it falls back to vertical sync
+            PresentMode oldMode = graphics->CurrentPresentMode();
+            graphics->SetPresentMode((PresentMode)((oldMode + 1) % (PRESENT_ADAPTIVE_VSYNC + 1)));
+            if (graphics->CurrentPresentMode() == oldMode)
+                graphics->SetPresentMode(PRESENT_IMMEDIATE);
+        }
+        if (input->KeyPressed(SDLK_r))
+        {
+            // Show the average rendering statistics in the window title, updated with the profiler output
+            showStats = !showStats;
+            SDL_SetWindowTitle(graphics->Window(), showStats ? RenderStatsText(renderer->AverageStats()).c_str() : "Turso3D renderer test");
+        }
+        if (input->KeyPressed(SDLK_t))
+        {
+            // Capture a trace between the presses, or until the capture is full
+            if (!tracing)
+                profiler->BeginCapture();
+            else
+                SaveProfilerTrace(profiler);
+            tracing = !tracing;
+        }
         
-        IntVector2 mouseMove = input->MouseMove();
-        yaw += mouseMove.x * 0.1f;
-        pitch += mouseMove.y * 0.1f;
-        pitch = Clamp(pitch, -90.0f, 90.0f);
-        camera->SetRotation(Quaternion(pitch, yaw, 0.0f));
+        if (replayFrame)
+        {
+            camera->SetPosition(replayFrame->position);
+            camera->SetRotation(replayFrame->rotation);
+        }
+        else if (benchmark)
+        {
+            unsigned measuredFrame = benchmarkFrame > BENCHMARK_WARMUP_FRAMES ? benchmarkFrame - BENCHMARK_WARMUP_FRAMES : 0;
+            CameraKey key = SampleCameraPath(cameraPath, benchmarkFrames > 1 ? (float)measuredFrame / (float)(benchmarkFrames - 1) : 0.0f);
+            camera->SetPosition(key.position);
+            camera->SetRotation(key.rotation);
+        }
+        else if (!pipelined)
+            logic.Update(nullptr, 0);
 
-        float moveSpeed = (input->KeyDown(SDLK_LSHIFT) || input->KeyDown(SDLK_RSHIFT)) ? 50.0f : 5.0f;
+        // Animate with a fixed time step in benchmark mode for repeatable results
+        float animationTime = replayFrame ? replayFrame->animationTime : benchmark ? benchmarkFrame / 60.0f : animationTimer.ElapsedMSec() * 0.001f;
+        AnimateDynamicObjects(dynamicObjects, animationTime);
 
-        if (input->KeyDown(SDLK_w))
-            camera->Translate(Vector3::FORWARD * dt * moveSpeed);
-        if (input->KeyDown(SDLK_s))
-            camera->Translate(Vector3::BACK * dt * moveSpeed);
-        if (input->KeyDown(SDLK_a))
-            camera->Translate(Vector3::LEFT * dt * moveSpeed);
-        if (input->KeyDown(SDLK_d))
-            camera->Translate(Vector3::RIGHT * dt * moveSpeed);
+        if (!recordPathFile.empty())
+        {
+            CameraKey key;
+            key.position = camera->Position();
+            key.rotation = camera->Rotation();
+            recordedPath.push_back(key);
+        }
+
+        if (!captureFile.empty())
+        {
+            CaptureFrame frame;
+            frame.position = camera->Position();
+            frame.rotation = camera->Rotation();
+            frame.animationTime = animationTime;
+            frame.frameTime = 0;
+            const std::map<unsigned, ButtonState>& keyStates = input->KeyStates();
+            for (auto it = keyStates.begin(); it != keyStates.end(); ++it)
+            {
+                if (it->second == STATE_PRESSED || it->second == STATE_RELEASED)
+                {
+                    CaptureKey key;
+                    key.keyCode = it->first;
+                    key.state = it->second;
+                    frame.keys.push_back(key);
+                }
+            }
+            capturedFrames.push_back(frame);
+        }
+
+        int outputWidth = graphics->RenderWidth();
+        int outputHeight = graphics->RenderHeight();
+        IntVector2 renderSize = renderer->DynamicRenderSize(IntVector2(outputWidth, outputHeight));
+        int width = renderSize.x;
+        int height = renderSize.y;
+
+        IntVector2 halfSize(Max(width / 2, 1), Max(height / 2, 1));
+
+        renderGraph->Reset();
+        bool deferred = renderer->GetLightingMode() == LIGHTING_DEFERRED;
+        bool weightedOIT = renderer->GetAlphaMode() == ALPHA_WEIGHTED_OIT;
+        bool lowResAlpha = weightedOIT && renderer->AlphaResolutionDivisor() > 1;
+        IntVector2 alphaSize = renderer->AlphaRenderSize(renderSize);
+        unsigned colorRes = renderGraph->CreateTexture("Color", renderSize, FMT_RGBA8);
+        unsigned albedoRes = renderGraph->CreateTexture("Albedo", renderSize, FMT_RGBA8);
+        unsigned depthRes = renderGraph->CreateTexture("Depth", renderSize, FMT_D32F);
+        unsigned normalRes = renderGraph->CreateTexture("Normal", renderSize, FMT_RGBA8);
+        unsigned ssaoDepthRes = renderGraph->CreateTexture("SSAODepth", halfSize, FMT_R16F, FILTER_BILINEAR, SSAO_DEPTH_LEVELS);
+        unsigned ssaoRes = renderGraph->CreateTexture("SSAO", halfSize, FMT_R8);
+        unsigned ssaoBlurRes = renderGraph->CreateTexture("SSAOBlur", halfSize, FMT_R8);
+        unsigned ssaoBlurredRes = renderGraph->CreateTexture("SSAOBlurred", halfSize, FMT_R8);
+        unsigned alphaAccumRes = renderGraph->CreateTexture("AlphaAccum", alphaSize, FMT_RGBA16F);
+        unsigned alphaRevealageRes = renderGraph->CreateTexture("AlphaRevealage", alphaSize, FMT_R16F);
+        unsigned alphaDepthRes = renderGraph->CreateTexture("AlphaDepth", alphaSize, FMT_D32F);
+        unsigned motionRes = renderGraph->CreateTexture("Motion", renderSize, FMT_RG16F, FILTER_POINT);
+        unsigned noiseRes = renderGraph->ImportTexture("Noise", noiseTexture);
+        // The G-buffer is not multisampled, so deferred lighting renders without MSAA
+        bool msaa = multisample > 1 && !deferred;
+        unsigned colorMSAARes = renderGraph->CreateTexture("ColorMSAA", renderSize, FMT_RGBA8, FILTER_POINT, 1, multisample);
+        unsigned normalMSAARes = renderGraph->CreateTexture("NormalMSAA", renderSize, FMT_RGBA8, FILTER_POINT, 1, multisample);
+        unsigned motionMSAARes = renderGraph->CreateTexture("MotionMSAA", renderSize, FMT_RG16F, FILTER_POINT, 1, multisample);
+        unsigned depthMSAARes = renderGraph->CreateTexture("DepthMSAA", renderSize, FMT_D32F, FILTER_POINT, 1, multisample);
+        unsigned backbufferRes = renderGraph->ImportBackbuffer(IntVector2(outputWidth, outputHeight));
+
+        // In deferred mode the opaque pass writes the G-buffer, which the lighting pass shades into the color target
+        unsigned opaquePass = renderGraph->AddPass("Opaque");
+        renderGraph->WriteColor(opaquePass, deferred ? albedoRes : (msaa ? colorMSAARes : colorRes));
+        // Motion vectors are the third color output, after the normals
+        size_t numOpaqueOutputs = 1;
+        if (drawSSAO || deferred || temporalAA)
+        {
+            renderGraph->WriteColor(opaquePass, msaa ? normalMSAARes : normalRes);
+            ++numOpaqueOutputs;
+        }
+        if (temporalAA)
+        {
+            renderGraph->WriteColor(opaquePass, msaa ? motionMSAARes : motionRes);
+            ++numOpaqueOutputs;
+        }
+        renderGraph->WriteDepth(opaquePass, msaa ? depthMSAARes : depthRes);
+        renderGraph->SetClear(opaquePass, true, true, Color::BLACK);
+
+        // With MSAA the opaque outputs are resolved to the single-sampled targets. The pass has no outputs and is culled otherwise
+        unsigned resolvePass = renderGraph->AddPass("Resolve");
+        if (msaa)
+        {
+            unsigned msaaOutputs[] = { colorMSAARes, normalMSAARes, motionMSAARes };
+            unsigned outputs[] = { colorRes, normalRes, motionRes };
+            for (size_t i = 0; i < numOpaqueOutputs; ++i)
+            {
+                renderGraph->Read(resolvePass, msaaOutputs[i]);
+                renderGraph->WriteColor(resolvePass, outputs[i]);
+            }
+            renderGraph->Read(resolvePass, depthMSAARes);
+            renderGraph->WriteDepth(resolvePass, depthRes);
+        }
+
+        unsigned lightingPass = renderGraph->AddPass("DeferredLighting");
+        if (deferred)
+        {
+            renderGraph->Read(lightingPass, albedoRes);
+            renderGraph->Read(lightingPass, normalRes);
+            renderGraph->Read(lightingPass, depthRes);
+            renderGraph->WriteColor(lightingPass, colorRes);
+        }
+
+        // Compute SSAO builds a linear depth pyramid, then blurs the occlusion in separable passes before compositing. The raw and final occlusion textures alias
+        unsigned ssaoDepthPass = renderGraph->AddPass("SSAODepth");
+        unsigned ssaoPass = renderGraph->AddPass("SSAO");
+        unsigned ssaoBlurHPass = renderGraph->AddPass("SSAOBlurH");
+        unsigned ssaoBlurVPass = renderGraph->AddPass("SSAOBlurV");
+        unsigned ssaoCompositePass = renderGraph->AddPass("SSAOComposite");
+        if (drawSSAO && computeSSAO)
+        {
+            renderGraph->Read(ssaoDepthPass, depthRes, 0);
+            renderGraph->WriteStorage(ssaoDepthPass, ssaoDepthRes);
+            renderGraph->Read(ssaoPass, ssaoDepthRes, 0);
+            renderGraph->Read(ssaoPass, normalRes, 1);
+            renderGraph->Read(ssaoPass, noiseRes, 2);
+            renderGraph->WriteStorage(ssaoPass, ssaoRes);
+            renderGraph->Read(ssaoBlurHPass, ssaoRes, 0);
+            renderGraph->Read(ssaoBlurHPass, ssaoDepthRes, 1);
+            renderGraph->WriteStorage(ssaoBlurHPass, ssaoBlurRes);
+            renderGraph->Read(ssaoBlurVPass, ssaoBlurRes, 0);
+            renderGraph->Read(ssaoBlurVPass, ssaoDepthRes, 1);
+            renderGraph->WriteStorage(ssaoBlurVPass, ssaoBlurredRes);
+            renderGraph->Read(ssaoCompositePass, ssaoBlurredRes, 0);
+            renderGraph->WriteColor(ssaoCompositePass, colorRes);
+        }
+        else if (drawSSAO)
+        {
+            renderGraph->Read(ssaoPass, depthRes, 0);
+            renderGraph->Read(ssaoPass, normalRes, 1);
+            renderGraph->Read(ssaoPass, noiseRes, 2);
+            renderGraph->WriteColor(ssaoPass, ssaoRes);
+            renderGraph->Read(ssaoCompositePass, ssaoRes, 0);
+            renderGraph->WriteColor(ssaoCompositePass, colorRes);
+        }
+
+        // The fog is blended over the opaque scene only
+        unsigned fogPass = renderGraph->AddPass("VolumetricFog");
+        if (renderer->VolumetricFog())
+        {
+            renderGraph->Read(fogPass, depthRes);
+            renderGraph->WriteColor(fogPass, colorRes);
+        }
+
+        // Weighted OIT accumulates the transparent geometry to its own targets against the scene depth, then composites them over the color target. At low resolution the depth is downsampled first and the composite upsamples guided by both depths
+        unsigned alphaDepthPass = renderGraph->AddPass("AlphaDepth");
+        unsigned alphaPass = renderGraph->AddPass("Alpha");
+        unsigned alphaCompositePass = renderGraph->AddPass("AlphaComposite");
+        if (weightedOIT)
+        {
+            if (lowResAlpha)
+            {
+                renderGraph->Read(alphaDepthPass, depthRes);
+                renderGraph->WriteDepth(alphaDepthPass, alphaDepthRes);
+            }
+            renderGraph->WriteColor(alphaPass, alphaAccumRes);
+            renderGraph->WriteColor(alphaPass, alphaRevealageRes);
+            renderGraph->WriteDepth(alphaPass, lowResAlpha ? alphaDepthRes : depthRes);
+            renderGraph->Read(alphaCompositePass, alphaAccumRes);
+            renderGraph->Read(alphaCompositePass, alphaRevealageRes);
+            if (lowResAlpha)
+            {
+                renderGraph->Read(alphaCompositePass, depthRes);
+                renderGraph->Read(alphaCompositePass, alphaDepthRes);
+            }
+            renderGraph->WriteColor(alphaCompositePass, colorRes);
+        }
+        else
+        {
+            renderGraph->WriteColor(alphaPass, colorRes);
+            renderGraph->WriteDepth(alphaPass, depthRes);
+        }
 
-        int width = graphics->RenderWidth();
-        int height = graphics->RenderHeight();
+        // Debug geometry is drawn over the finished scene, before the temporal resolve so that it is antialiased too
+        unsigned debugPass = renderGraph->AddPass("Debug");
+        if (debugDraw)
+        {
+            renderGraph->WriteColor(debugPass, colorRes);
+            renderGraph->WriteDepth(debugPass, depthRes);
+        }
 
-        if (colorBuffer->Width() != width || colorBuffer->Height() != height)
+        // The temporal resolve blends the frame into the history reprojected from the previous frames, and the result is both the output and the next frame's history
+        unsigned temporalPass = renderGraph->AddPass("TemporalResolve");
+        unsigned historyRes = M_MAX_UNSIGNED;
+        if (temporalAA)
         {
-            colorBuffer->Define(TEX_2D, IntVector2(width, height), FMT_RGBA8);
-            colorBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-            depthStencilBuffer->Define(TEX_2D, IntVector2(width, height), FMT_D32);
-            depthStencilBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-            normalBuffer->Define(TEX_2D, IntVector2(width, height), FMT_RGBA8);
-            normalBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-            viewFbo->Define(colorBuffer, depthStencilBuffer);
+            historyRes = renderGraph->CreateHistoryTexture("TemporalHistory", renderSize, FMT_RGBA8);
+            renderGraph->Read(temporalPass, colorRes, 0);
+            renderGraph->Read(temporalPass, renderGraph->PreviousHistory(historyRes), 1);
+            renderGraph->Read(temporalPass, motionRes, 2);
+            renderGraph->WriteColor(temporalPass, historyRes);
+        }
+        unsigned finalRes = temporalAA ? historyRes : colorRes;
 
-            std::vector<Texture*> mrt;
-            mrt.push_back(colorBuffer.Get());
-            mrt.push_back(normalBuffer.Get());
-            viewMRTFbo->Define(mrt, depthStencilBuffer);
+        unsigned outputPass = renderGraph->AddPass("Output");
+        renderGraph->Read(outputPass, finalRes);
+        renderGraph->WriteColor(outputPass, backbufferRes);
+
+        renderGraph->Compile();
+
+        if (probeUpdater)
+        {
+            // The probe is lost when the scene is recreated
+            if (!scene->FindChild<ReflectionProbe>())
+            {
+                ReflectionProbe* probe = scene->CreateChild<ReflectionProbe>();
+                probe->SetPosition(Vector3(0.0f, 5.0f, 0.0f));
+                probeUpdater->AddProbe(probe);
+            }
+            probeUpdater->Update(scene);
         }
 
-        if (drawSSAO && (ssaoTexture->Width() != colorBuffer->Width() / 2 || ssaoTexture->Height() != colorBuffer->Height() / 2))
+        if (irradianceVolume)
         {
-            ssaoTexture->Define(TEX_2D, IntVector2(colorBuffer->Width() / 2, colorBuffer->Height() / 2), FMT_R32F, 1, 1);
-            ssaoTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-            ssaoFbo->Define(ssaoTexture, nullptr);
+            // The volume is lost when the scene is recreated
+            IrradianceVolume* volume = scene->FindChild<IrradianceVolume>();
+            if (!volume)
+            {
+                std::vector<Light*> sceneLights;
+                scene->FindChildren(sceneLights);
+                for (size_t i = 1; i < sceneLights.size(); i += 2)
+                    sceneLights[i]->SetBaked(true);
+
+                volume = scene->CreateChild<IrradianceVolume>();
+                volume->SetPosition(Vector3(0.0f, 10.0f, 0.0f));
+                volume->SetSize(Vector3(1000.0f, 40.0f, 1000.0f));
+                volume->SetResolution(IntVector3(64, 4, 64));
+                renderer->SetIrradianceVolume(volume);
+            }
+            volume->Update();
+        }
+
+        // The decal set is lost when the scene is recreated
+        if (decals && !scene->FindChild<DecalSet>())
+        {
+            DecalSet* decalSet = scene->CreateChild<DecalSet>();
+            decalSet->SetAtlas(cache->LoadResource<Texture>("StoneDiffuse.dds"));
+            for (int i = 0; i < DEFAULT_MAX_DECALS; ++i)
+            {
+                Vector3 position(Random() * 200.0f - 100.0f, 0.0f, Random() * 200.0f - 100.0f);
+                Quaternion rotation(90.0f, 0.0f, Random() * 360.0f);
+                Vector4 atlasRect(floorf(Random() * 4.0f) * 0.25f, floorf(Random() * 4.0f) * 0.25f, 0.25f, 0.25f);
+                decalSet->AddDecal(position, rotation, Vector3(3.0f, 3.0f, 2.0f), atlasRect, 0.75f);
+            }
+            renderer->SetDecalSet(decalSet);
+        }
+
+        camera->SetAspectRatio((float)outputWidth / (float)outputHeight);
+
+        // In pipelined mode the logic task may be moving the camera, so latch only when it runs on the main thread
+        if (lateLatch && !pipelined && !benchmark)
+        {
+            input->LatchMouse();
+            if (input->LateMouseMove() != IntVector2::ZERO)
+            {
+                graphics->MarkInput();
+                logic.Rotate(input->LateMouseMove());
+            }
         }
 
-        camera->SetAspectRatio((float)width / (float)height);
+        // Jitter the projection by a subpixel offset that cycles through 8 positions
+        if (temporalAA)
+        {
+            unsigned jitterIndex = (temporalFrame++ % 8) + 1;
+            camera->SetProjectionOffset(Vector2((Halton(jitterIndex, 2) - 0.5f) / width, (Halton(jitterIndex, 3) - 0.5f) / height));
+        }
 
         renderer->PrepareView(scene, camera, shadowMode > 0);
-        
+
+        // The camera values used by the postprocessing must also be read before the logic moves it
+        Vector2 depthReconstruct = camera->DepthReconstruct();
+        Vector3 nearVec, farVec;
+        camera->FrustumSize(nearVec, farVec);
+        Matrix4 viewProjMatrix = camera->ViewProjMatrix();
+
+        if (debugDraw == 1)
+            debugRenderer->AddOctree(scene->FindChild<Octree>(), Color(0.0f, 1.0f, 0.0f, 0.5f));
+        else if (debugDraw == 2)
+            debugRenderer->AddLightClusters(renderer, camera, Color(0.0f, 0.5f, 1.0f, 0.25f));
+        else if (debugDraw == 3)
+            debugRenderer->AddShadowFrustums(renderer, Color(1.0f, 1.0f, 0.0f));
+
+        if (pipelined)
+            workQueue->QueueTask(&logicTask, &logicCounter);
+
         renderer->RenderShadowMaps();
 
-        if (drawSSAO)
-            viewMRTFbo->Bind();
-        else
-            viewFbo->Bind();
+        if (renderGraph->BeginPass(opaquePass))
+        {
+            // A multisampled depth texture can not be sampled for light culling or the occlusion buffer
+            renderer->SetLightCullingDepth(msaa ? nullptr : renderGraph->GetTexture(depthRes));
+            renderer->RenderOpaque();
+            if (!msaa)
+                renderer->UpdateOcclusionBuffer(renderGraph->GetTexture(depthRes));
+            renderGraph->EndPass();
+        }
 
-        renderer->SetViewport(IntRect(0, 0, width, height));
-        renderer->Clear(true, true, IntRect::ZERO, Color::BLACK);
-        renderer->RenderOpaque();
+        if (renderGraph->BeginPass(resolvePass))
+        {
+            FrameBuffer::Resolve(renderGraph->GetFrameBuffer(resolvePass), renderGraph->GetFrameBuffer(opaquePass), IntRect(0, 0, width, height), numOpaqueOutputs, true);
+            renderer->UpdateOcclusionBuffer(renderGraph->GetTexture(depthRes));
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(lightingPass))
+        {
+            renderer->RenderDeferredLighting(renderGraph->GetTexture(albedoRes), renderGraph->GetTexture(normalRes), renderGraph->GetTexture(depthRes));
+            renderGraph->EndPass();
+        }
 
         if (drawSSAO)
         {
-            float farClip = camera->FarClip();
-            float nearClip = camera->NearClip();
-            Vector3 nearVec, farVec;
-            camera->FrustumSize(nearVec, farVec);
-
-            ssaoFbo->Bind();
-            renderer->SetViewport(IntRect(0, 0, ssaoTexture->Width(), ssaoTexture->Height()));
-            ShaderProgram* program = renderer->SetProgram("Shaders/SSAO.glsl");
-            renderer->SetUniform(program, "noiseInvSize", Vector2(ssaoTexture->Width() / 4.0f, ssaoTexture->Height() / 4.0f));
-            renderer->SetUniform(program, "screenInvSize", Vector2(1.0f / colorBuffer->Width(), 1.0f / colorBuffer->Height()));
-            renderer->SetUniform(program, "frustumSize", Vector4(farVec, (float)height / (float)width));
-            renderer->SetUniform(program, "aoParameters", Vector4(0.15f, 1.0f, 0.015f, 0.15f));
-            renderer->SetUniform(program, "depthReconstruct", Vector2(farClip / (farClip - nearClip), -nearClip / (farClip - nearClip)));
-            depthStencilBuffer->Bind(0);
-            normalBuffer->Bind(1);
-            noiseTexture->Bind(2);
-            renderer->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
-            renderer->DrawQuad();
-            Texture::Unbind(1);
-            Texture::Unbind(2);
-
-            viewFbo->Bind();
-            renderer->SetViewport(IntRect(0, 0, width, height));
-            program = renderer->SetProgram("Shaders/SSAOBlur.glsl");
-            renderer->SetUniform(program, "blurInvSize", Vector2(1.0f / ssaoTexture->Width(), 1.0f / ssaoTexture->Height()));
-            ssaoTexture->Bind(0);
-            renderer->SetRenderState(BLEND_SUBTRACT, CULL_NONE, CMP_ALWAYS, true, false);
-            renderer->DrawQuad();
-            Texture::Unbind(0);
-        }
-
-        viewFbo->Bind();
-        renderer->SetViewport(IntRect(0, 0, width, height));
-        renderer->RenderAlpha();
-
-        FrameBuffer::Blit(nullptr, IntRect(0, 0, width, height), viewFbo, IntRect(0, 0, width, height), true, false, FILTER_POINT);
+            PROFILE(RenderSSAO);
+            PROFILE_GPU(RenderSSAO);
+
+            Texture* ssaoTexture = renderGraph->GetTexture(ssaoRes);
+            ShaderProgram* program;
+
+            if (renderGraph->BeginPass(ssaoDepthPass))
+            {
+                // Linearize and downsample the depth buffer, then reduce each pyramid level from the previous
+                Texture* ssaoDepth = renderGraph->GetTexture(ssaoDepthRes);
+                program = renderer->SetProgram("Shaders/SSAODepth.glsl");
+                if (program)
+                {
+                    renderer->SetUniform(program, "depthReconstruct", depthReconstruct);
+                    renderer->SetUniform(program, "sourceLevel", 0.0f);
+                    ssaoDepth->BindImage(0, 0);
+                    renderer->DispatchCompute(NumGroups(halfSize.x, SSAO_GROUP_SIZE), NumGroups(halfSize.y, SSAO_GROUP_SIZE));
+                }
+
+                program = renderer->SetProgram("Shaders/SSAODepth.glsl", "DOWNSAMPLE");
+                if (program)
+                {
+                    ssaoDepth->Bind(0);
+                    for (size_t i = 1; i < ssaoDepth->NumLevels(); ++i)
+                    {
+                        renderer->SetUniform(program, "sourceLevel", (float)(i - 1));
+                        ssaoDepth->BindImage(0, i);
+                        renderer->DispatchCompute(NumGroups(Max(halfSize.x >> i, 1), SSAO_GROUP_SIZE), NumGroups(Max(halfSize.y >> i, 1), SSAO_GROUP_SIZE));
+                    }
+                }
+
+                Texture::UnbindImage(0);
+                renderGraph->EndPass();
+            }
+
+            if (renderGraph->BeginPass(ssaoPass))
+            {
+                if (computeSSAO)
+                {
+                    program = renderer->SetProgram("Shaders/SSAOCompute.glsl");
+                    if (program)
+                    {
+                        renderer->SetUniform(program, "screenInvSize", Vector2(1.0f / width, 1.0f / height));
+                        renderer->SetUniform(program, "frustumSize", Vector4(farVec, (float)height / (float)width));
+                        renderer->SetUniform(program, "aoParameters", Vector4(0.15f, 1.0f, 0.015f, 0.15f));
+                        ssaoTexture->BindImage(0);
+                        renderer->DispatchCompute(NumGroups(halfSize.x, SSAO_GROUP_SIZE), NumGroups(halfSize.y, SSAO_GROUP_SIZE));
+                        Texture::UnbindImage(0);
+                    }
+                }
+                else
+                {
+                    program = renderer->SetProgram("Shaders/SSAO.glsl");
+                    renderer->SetUniform(program, "noiseInvSize", Vector2(ssaoTexture->Width() / 4.0f, ssaoTexture->Height() / 4.0f));
+                    renderer->SetUniform(program, "screenInvSize", Vector2(1.0f / width, 1.0f / height));
+                    renderer->SetUniform(program, "frustumSize", Vector4(farVec, (float)height / (float)width));
+                    renderer->SetUniform(program, "aoParameters", Vector4(0.15f, 1.0f, 0.015f, 0.15f));
+                    renderer->SetUniform(program, "depthReconstruct", depthReconstruct);
+                    renderer->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+                    renderer->DrawQuad();
+                }
+                renderGraph->EndPass();
+            }
+
+            if (renderGraph->BeginPass(ssaoBlurHPass))
+            {
+                program = renderer->SetProgram("Shaders/SSAOBilateral.glsl", "HORIZONTAL");
+                if (program)
+                {
+                    renderer->SetUniform(program, "depthSharpness", 8.0f);
+                    renderGraph->GetTexture(ssaoBlurRes)->BindImage(0);
+                    renderer->DispatchCompute(NumGroups(halfSize.x, SSAO_BLUR_GROUP_SIZE), halfSize.y);
+                    Texture::UnbindImage(0);
+                }
+                renderGraph->EndPass();
+            }
+
+            if (renderGraph->BeginPass(ssaoBlurVPass))
+            {
+                program = renderer->SetProgram("Shaders/SSAOBilateral.glsl");
+                if (program)
+                {
+                    renderer->SetUniform(program, "depthSharpness", 8.0f);
+                    renderGraph->GetTexture(ssaoBlurredRes)->BindImage(0);
+                    renderer->DispatchCompute(halfSize.x, NumGroups(halfSize.y, SSAO_BLUR_GROUP_SIZE));
+                    Texture::UnbindImage(0);
+                }
+                renderGraph->EndPass();
+            }
+
+            if (renderGraph->BeginPass(ssaoCompositePass))
+            {
+                if (computeSSAO)
+                    program = renderer->SetProgram("Shaders/SSAOComposite.glsl");
+                else
+                {
+                    program = renderer->SetProgram("Shaders/SSAOBlur.glsl");
+                    renderer->SetUniform(program, "blurInvSize", Vector2(1.0f / ssaoTexture->Width(), 1.0f / ssaoTexture->Height()));
+                }
+                renderer->SetRenderState(BLEND_SUBTRACT, CULL_NONE, CMP_ALWAYS, true, false);
+                renderer->DrawQuad();
+                renderGraph->EndPass();
+            }
+        }
+
+        if (renderGraph->BeginPass(fogPass))
+        {
+            renderer->RenderVolumetricFog(renderGraph->GetTexture(depthRes));
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(alphaDepthPass))
+        {
+            renderer->DownsampleDepth(renderGraph->GetTexture(depthRes));
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(alphaPass))
+        {
+            renderer->RenderAlpha();
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(alphaCompositePass))
+        {
+            if (lowResAlpha)
+                renderer->CompositeAlpha(renderGraph->GetTexture(alphaAccumRes), renderGraph->GetTexture(alphaRevealageRes), renderGraph->GetTexture(depthRes), renderGraph->GetTexture(alphaDepthRes));
+            else
+                renderer->CompositeAlpha(renderGraph->GetTexture(alphaAccumRes), renderGraph->GetTexture(alphaRevealageRes));
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(debugPass))
+        {
+            debugRenderer->Render(viewProjMatrix);
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(temporalPass))
+        {
+            PROFILE(TemporalResolve);
+            PROFILE_GPU(TemporalResolve);
+
+            ShaderProgram* program = renderer->SetProgram("Shaders/TemporalResolve.glsl");
+            if (program)
+            {
+                renderer->SetUniform(program, "screenInvSize", Vector2(1.0f / width, 1.0f / height));
+                renderer->SetUniform(program, "historyWeight", renderGraph->IsHistoryValid(historyRes) ? 0.9f : 0.0f);
+                renderer->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+                renderer->DrawQuad();
+            }
+            renderGraph->EndPass();
+        }
+
+        if (renderGraph->BeginPass(outputPass))
+        {
+            // Measure the contrast of the finished frame to choose the shading rates of the next
+            renderer->UpdateShadingRate(renderGraph->GetTexture(finalRes));
+            if (renderer->DynamicResolution())
+                renderer->Upscale(renderGraph->GetTexture(finalRes), nullptr, IntRect(0, 0, outputWidth, outputHeight));
+            else
+            {
+                FrameBuffer* finalFrameBuffer = renderGraph->GetFrameBuffer(temporalAA ? temporalPass : (weightedOIT ? alphaCompositePass : alphaPass));
+                FrameBuffer::Blit(nullptr, IntRect(0, 0, width, height), finalFrameBuffer, IntRect(0, 0, width, height), true, false, FILTER_POINT);
+            }
+            renderGraph->EndPass();
+        }
         graphics->Present();
 
+        if (pipelined)
+            workQueue->Complete(logicCounter);
+
         profiler->EndFrame();
-        dt = frameTimer.ElapsedUSec() * 0.000001f;
+        logic.dt = frameTimer.ElapsedUSec() * 0.000001f;
+        if (!capturedFrames.empty())
+            capturedFrames.back().frameTime = (unsigned)frameTimer.ElapsedUSec();
+
+        if (benchmark)
+        {
+            if (benchmarkFrame >= BENCHMARK_WARMUP_FRAMES)
+            {
+                benchmarkFrameTimes.push_back(frameTimer.ElapsedUSec());
+                benchmarkStats += renderer->Stats();
+                if (replayFrame)
+                    replayResults.Push(ReplayFrameJSON(benchmarkFrameTimes.back(), *replayFrame, profiler, renderer->Stats()));
+            }
+            else
+                Graphics::ResetStateStats();
+            if (++benchmarkFrame >= BENCHMARK_WARMUP_FRAMES + benchmarkFrames)
+            {
+                const BenchmarkConfig& config = benchmarkConfigs[benchmarkIndex];
+                JSONValue result = BenchmarkResultsJSON(config.preset, config.stressParams, benchmarkFrameTimes, profiler, benchmarkStats / benchmarkFrames);
+                if (!replayFrames.empty())
+                    result["replayFrames"] = replayResults;
+                LOGINFOF("Benchmark %u/%u: %.2f ms per frame", (unsigned)benchmarkIndex + 1, (unsigned)benchmarkConfigs.size(),
+                    result["frameTimeMs"]["mean"].GetNumber());
+                if (benchmarkSuite)
+                    benchmarkResults.Push(result);
+                else
+                    benchmarkResults = result;
+
+                if (++benchmarkIndex >= benchmarkConfigs.size())
+                    break;
+
+                const BenchmarkConfig& nextConfig = benchmarkConfigs[benchmarkIndex];
+                CreateScene(scene, nextConfig.preset, nextConfig.stressParams, dynamicObjects);
+                scene->FindChild<Octree>()->SetStaticBVH(useStaticBVH);
+                benchmarkFrame = 0;
+                benchmarkFrameTimes.clear();
+                benchmarkStats.Reset();
+            }
+        }
+    }
+
+    if (tracing)
+        SaveProfilerTrace(profiler);
+
+    if (benchmark)
+    {
+        // An interrupted benchmark is not comparable
+        if (benchmarkIndex < benchmarkConfigs.size())
+            return 1;
+
+        JSONFile json;
+        json.Root() = benchmarkResults;
+        File resultFile(benchmarkOutputFile, FILE_WRITE);
+        if (!resultFile.IsOpen() || !json.Save(resultFile))
+        {
+            LOGERROR("Could not save benchmark results to " + benchmarkOutputFile);
+            return 1;
+        }
+
+        LOGINFO("Saved benchmark results to " + benchmarkOutputFile);
+        return 0;
+    }
+
+    cache->SaveLoadOrder(loadOrderFile);
+
+    if (!recordPathFile.empty())
+    {
+        if (SaveCameraPath(recordPathFile, recordedPath))
+            LOGINFO("Saved camera path to " + recordPathFile);
+        else
+            LOGERROR("Could not save camera path " + recordPathFile);
+    }
+
+    if (!captureFile.empty())
+    {
+        if (SaveCapture(captureFile, preset, stressParams, capturedFrames))
+            LOGINFO("Saved capture to " + captureFile);
+        else
+            LOGERROR("Could not save capture " + captureFile);
     }
 
     printf("%s", profilerOutput.c_str());
+    if (memorySampleInterval)
+        printf("\n%s", MemorySampleReport().c_str());
 
     return 0;
 }